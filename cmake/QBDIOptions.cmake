@@ -23,6 +23,9 @@ option(QBDI_ASAN
 # Enable the logging level debug
 option(QBDI_LOG_DEBUG "Enable Debug log level" OFF)
 
+# Enable the profiler of the translation
+option(QBDI_PROFILE_TRANSLATION "Enable the profiler of the translation" OFF)
+
 # Compile static Library
 option(QBDI_STATIC_LIBRARY "Build the static library" ON)
 
@@ -56,9 +59,14 @@ if(NOT
   # Validator (compare execution between QBDIPreload and ptrace)
   option(QBDI_TOOLS_VALIDATOR
          "Compile the validator (need QBDI_TOOLS_QBDIPRELOAD)" OFF)
+
+  # Coverage (write the coverage of a process in the drcov format)
+  option(QBDI_TOOLS_COVERAGE
+         "Compile the coverage tool (need QBDI_TOOLS_QBDIPRELOAD)" ON)
 else()
   set(QBDI_TOOLS_QBDIPRELOAD OFF)
   set(QBDI_TOOLS_VALIDATOR OFF)
+  set(QBDI_TOOLS_COVERAGE OFF)
 endif()
 
 # PYQBDI (need a python 32bit for 32bit architecture)
@@ -106,6 +114,11 @@ if(QBDI_TOOLS_VALIDATOR AND NOT QBDI_TOOLS_QBDIPRELOAD)
     FATAL_ERROR "Need QBDI_TOOLS_QBDIPRELOAD to compile QBDI_TOOLS_VALIDATOR")
 endif()
 
+if(QBDI_TOOLS_COVERAGE AND NOT QBDI_TOOLS_QBDIPRELOAD)
+  # the coverage tool is only a convenience, disable it with QBDIPreload
+  set(QBDI_TOOLS_COVERAGE OFF)
+endif()
+
 # display resulted options
 message(STATUS "== QBDI Options ==")
 message(STATUS "QBDI_CCACHE:           ${QBDI_CCACHE}")
@@ -123,6 +136,7 @@ if(CMAKE_BUILD_TYPE STREQUAL "Debug")
 else()
   message(STATUS "QBDI_LOG_DEBUG:        ${QBDI_LOG_DEBUG}")
 endif()
+message(STATUS "QBDI_PROFILE_TRANSLATION: ${QBDI_PROFILE_TRANSLATION}")
 message(STATUS "QBDI_STATIC_LIBRARY:   ${QBDI_STATIC_LIBRARY}")
 message(STATUS "QBDI_SHARED_LIBRARY:   ${QBDI_SHARED_LIBRARY}")
 message(STATUS "QBDI_TEST:             ${QBDI_TEST}")
@@ -134,6 +148,7 @@ if(NOT
     OR QBDI_PLATFORM_ANDROID))
   message(STATUS "QBDI_TOOLS_QBDIPRELOAD: ${QBDI_TOOLS_QBDIPRELOAD}")
   message(STATUS "QBDI_TOOLS_VALIDATOR:  ${QBDI_TOOLS_VALIDATOR}")
+  message(STATUS "QBDI_TOOLS_COVERAGE:   ${QBDI_TOOLS_COVERAGE}")
 endif()
 message(STATUS "QBDI_TOOLS_PYQBDI:     ${QBDI_TOOLS_PYQBDI}")
 message(STATUS "QBDI_TOOLS_FRIDAQBDI:  ${QBDI_TOOLS_FRIDAQBDI}")
@@ -143,3 +158,7 @@ message(STATUS "")
 if(QBDI_LOG_DEBUG)
   set(QBDI_ENABLE_LOG_DEBUG 1)
 endif()
+
+if(QBDI_PROFILE_TRANSLATION)
+  set(QBDI_ENABLE_PROFILE_TRANSLATION 1)
+endif()
@@ -12,3 +12,8 @@ for i in dist/*; do
     auditwheel repair $i -w outwheel;
 done
 
+for v in cp38-cp38 cp39-cp39 cp310-cp310; do
+    /opt/python/$v/bin/python -m pip install outwheel/*-$v-*.whl
+    /opt/python/$v/bin/python -m unittest discover -v -s tools/pyqbdi/tests
+done
+
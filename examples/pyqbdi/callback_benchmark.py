@@ -0,0 +1,113 @@
+#!/usr/bin/env python3
+
+# Cost of the Python callbacks, with the JSON format of the callback benchmark
+# of QBDIBenchmark (written in the file of QBDI_BENCHMARK_JSON if defined)
+
+import os
+import sys
+import time
+import ctypes
+import json
+import struct
+import pyqbdi
+
+ROUNDS = 100
+
+def countCB(vm, gpr, fpr, data):
+    data[0] += 1
+    return pyqbdi.CONTINUE
+
+def countEventCB(vm, evt, gpr, fpr, data):
+    data[0] += 1
+    return pyqbdi.CONTINUE
+
+def analysisCB(vm, gpr, fpr, data):
+    vm.getInstAnalysis(data[1])
+    data[0] += 1
+    return pyqbdi.CONTINUE
+
+def getTarget():
+    if sys.platform == 'darwin':
+        libmname = 'libSystem.dylib'
+    elif sys.platform == 'win32':
+        libmname = 'api-ms-win-crt-math-l1-1-0.dll'
+    else:
+        libmname = 'libm.so.6'
+    libm = ctypes.cdll.LoadLibrary(libmname)
+    return ctypes.cast(libm.sin, ctypes.c_void_p).value
+
+def measure(funcPtr, setup):
+    vm = pyqbdi.VM()
+    state = vm.getGPRState()
+    stack = pyqbdi.allocateVirtualStack(state, 0x100000)
+    assert stack is not None
+    vm.addInstrumentedModuleFromAddr(funcPtr)
+    counter = setup(vm)
+
+    def run():
+        fpr = vm.getFPRState()
+        fpr.xmm0 = struct.pack('<d', 1.0)
+        vm.setFPRState(fpr)
+        pyqbdi.simulateCall(vm.getGPRState(), 0x42424242)
+        vm.run(funcPtr, 0x42424242)
+
+    # fill the cache, the measure only includes the execution
+    run()
+    before = counter[0] if counter is not None else 0
+    start = time.perf_counter_ns()
+    for _ in range(ROUNDS):
+        run()
+    elapsed = (time.perf_counter_ns() - start) / ROUNDS
+    callbacks = (counter[0] - before) // ROUNDS if counter is not None else 0
+    pyqbdi.alignedFree(stack)
+    return elapsed, callbacks
+
+def run():
+    funcPtr = getTarget()
+    baseline, _ = measure(funcPtr, lambda vm: None)
+    results = [{"name": "none", "kind": "baseline", "ns_per_run": baseline,
+                "ns_per_callback": 0, "callbacks": 0}]
+
+    def add(name, setup):
+        ns, callbacks = measure(funcPtr, setup)
+        perCallback = (ns - baseline) / callbacks if callbacks else 0
+        results.append({"name": name, "kind": "Python", "ns_per_run": ns,
+                        "ns_per_callback": perCallback, "callbacks": callbacks})
+        print("{} (Python): {:.0f} ns per run, {:.2f} ns per callback ({} callbacks)".format(
+            name, ns, perCallback, callbacks))
+
+    def codeCB(pos):
+        def setup(vm):
+            counter = [0]
+            vm.addCodeCB(pos, countCB, counter)
+            return counter
+        return setup
+
+    def analysisSetup(vm):
+        data = [0, pyqbdi.ANALYSIS_INSTRUCTION | pyqbdi.ANALYSIS_DISASSEMBLY]
+        vm.addCodeCB(pyqbdi.PREINST, analysisCB, data)
+        return data
+
+    def memoryCB(vm):
+        counter = [0]
+        vm.addMemAccessCB(pyqbdi.MEMORY_READ_WRITE, countCB, counter)
+        return counter
+
+    def eventCB(vm):
+        counter = [0]
+        vm.addVMEventCB(pyqbdi.SEQUENCE_ENTRY, countEventCB, counter)
+        return counter
+
+    add("PREINST", codeCB(pyqbdi.PREINST))
+    add("POSTINST", codeCB(pyqbdi.POSTINST))
+    add("INSTRUCTION|DISASSEMBLY", analysisSetup)
+    add("MEMORY_READ_WRITE", memoryCB)
+    add("SEQUENCE_ENTRY", eventCB)
+
+    path = os.environ.get("QBDI_BENCHMARK_JSON")
+    if path is not None:
+        with open(path, 'w') as f:
+            json.dump({"benchmark": "callbacks", "results": results}, f, indent=2)
+
+if __name__ == "__main__":
+    run()
@@ -26,7 +26,10 @@
 #include "QBDI/VM_C.h"
 #endif
 
+#include "QBDI/AnalysisExport.h"
 #include "QBDI/Logs.h"
+#include "QBDI/Observer.h"
+#include "QBDI/Trace.h"
 #include "QBDI/Version.h"
 
 #endif // QBDI_H_
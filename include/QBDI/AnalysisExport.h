@@ -0,0 +1,264 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef QBDI_ANALYSISEXPORT_H_
+#define QBDI_ANALYSISEXPORT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "QBDI/InstAnalysis.h"
+#include "QBDI/Platform.h"
+#include "QBDI/State.h"
+
+#ifdef __cplusplus
+#include <memory>
+#include <string>
+#endif
+
+/*
+ * The export is a header followed by three arrays at the offsets of the
+ * header: the records sorted by address, the operands and the string pool.
+ * The arrays are aligned on 8 bytes and use the byte order of the exporting
+ * host, the file can be mapped and used without decoding.
+ */
+
+#ifdef __cplusplus
+namespace QBDI {
+
+class AnalysisExporter;
+using AnalysisExporterRef = AnalysisExporter *;
+
+extern "C" {
+#else
+typedef void *AnalysisExporterRef;
+#endif
+
+#define QBDI_ANALYSIS_EXPORT_VERSION 1
+/*! Offset of an absent string */
+#define QBDI_ANALYSIS_EXPORT_NO_STRING 0xffffffffu
+
+/*! Boolean properties of an InstAnalysisRecord
+ */
+typedef enum {
+  _QBDI_EI(RECORD_AFFECT_CONTROL_FLOW) = 1 << 0, /*!< affectControlFlow */
+  _QBDI_EI(RECORD_IS_BRANCH) = 1 << 1,           /*!< isBranch */
+  _QBDI_EI(RECORD_IS_CALL) = 1 << 2,             /*!< isCall */
+  _QBDI_EI(RECORD_IS_RETURN) = 1 << 3,           /*!< isReturn */
+  _QBDI_EI(RECORD_IS_COMPARE) = 1 << 4,          /*!< isCompare */
+  _QBDI_EI(RECORD_IS_PREDICABLE) = 1 << 5,       /*!< isPredicable */
+  _QBDI_EI(RECORD_IS_MOVE_IMM) = 1 << 6,         /*!< isMoveImm */
+  _QBDI_EI(RECORD_MAY_LOAD) = 1 << 7,            /*!< mayLoad */
+  _QBDI_EI(RECORD_MAY_STORE) = 1 << 8,           /*!< mayStore */
+  _QBDI_EI(RECORD_MAY_LOAD_LLVM) = 1 << 9,       /*!< mayLoad_LLVM */
+  _QBDI_EI(RECORD_MAY_STORE_LLVM) = 1 << 10,     /*!< mayStore_LLVM */
+} InstAnalysisRecordFlag;
+
+/*! Header of an analysis export
+ */
+typedef struct {
+  char magic[8];             /*!< "QBDIANA" */
+  uint32_t version;          /*!< QBDI_ANALYSIS_EXPORT_VERSION */
+  uint32_t headerSize;       /*!< sizeof(AnalysisExportHeader) */
+  uint32_t recordSize;       /*!< sizeof(InstAnalysisRecord) */
+  uint32_t operandSize;      /*!< sizeof(OperandRecord) */
+  uint64_t nbRecords;        /*!< Number of InstAnalysisRecord */
+  uint64_t nbOperands;       /*!< Number of OperandRecord */
+  uint64_t stringPoolSize;   /*!< Size of the string pool (in bytes) */
+  uint64_t recordsOffset;    /*!< Offset of the records in the file */
+  uint64_t operandsOffset;   /*!< Offset of the operands in the file */
+  uint64_t stringPoolOffset; /*!< Offset of the string pool in the file */
+} AnalysisExportHeader;
+
+/*! Exported InstAnalysis. The strings are offsets in the string pool (or
+ * QBDI_ANALYSIS_EXPORT_NO_STRING).
+ */
+typedef struct {
+  uint64_t address;      /*!< Instruction address */
+  uint64_t gprRead;      /*!< Bitmask of the GPR read */
+  uint64_t gprWrite;     /*!< Bitmask of the GPR written */
+  uint64_t fprRead;      /*!< Bitmask of the FPR read */
+  uint64_t fprWrite;     /*!< Bitmask of the FPR written */
+  uint32_t instSize;     /*!< Instruction size (in bytes) */
+  uint32_t mnemonic;     /*!< LLVM mnemonic */
+  uint32_t disassembly;  /*!< Instruction disassembly */
+  uint32_t symbol;       /*!< Instruction symbol */
+  uint32_t symbolOffset; /*!< Instruction symbol offset */
+  uint32_t module;       /*!< Instruction module name */
+  uint32_t loadSize;     /*!< Size of the expected read access */
+  uint32_t storeSize;    /*!< Size of the expected write access */
+  uint32_t firstOperand; /*!< Index of the first operand in the operands */
+  uint32_t flags;        /*!< InstAnalysisRecordFlag bits */
+  uint32_t analysisType; /*!< AnalysisType of the exported analysis */
+  uint8_t numOperands;   /*!< Number of operands */
+  uint8_t condition;     /*!< ConditionType */
+  uint8_t flagsAccess;   /*!< RegisterAccessType of the flags */
+  uint8_t cpuMode;       /*!< CPUMode */
+} InstAnalysisRecord;
+
+/*! Exported OperandAnalysis
+ */
+typedef struct {
+  uint64_t value;      /*!< Operand value (if immediate), or register Id */
+  uint32_t regName;    /*!< Register name (offset in the string pool) */
+  int16_t regCtxIdx;   /*!< Register index in VM state (< 0 if not know) */
+  uint8_t type;        /*!< OperandType */
+  uint8_t flag;        /*!< OperandFlag */
+  uint8_t size;        /*!< Operand size (in bytes) */
+  uint8_t regOff;      /*!< Sub-register offset in register (in bits) */
+  uint8_t regAccess;   /*!< RegisterAccessType */
+  uint8_t reserved[5]; /*!< Zero */
+} OperandRecord;
+
+/*! Create an empty analysis exporter.
+ *
+ * @return The exporter.
+ */
+QBDI_EXPORT AnalysisExporterRef qbdi_newAnalysisExporter();
+
+/*! Destroy an analysis exporter.
+ *
+ * @param[in] exporter  The exporter to destroy.
+ */
+QBDI_EXPORT void qbdi_deleteAnalysisExporter(AnalysisExporterRef exporter);
+
+/*! Add an analysis to an export. An address already exported is ignored.
+ *
+ * @param[in] exporter  The exporter.
+ * @param[in] analysis  The analysis to add.
+ *
+ * @return False if the analysis wasn't added.
+ */
+QBDI_EXPORT bool qbdi_analysisExporterAdd(AnalysisExporterRef exporter,
+                                          const InstAnalysis *analysis);
+
+/*! Write the export to a file. The file is truncated.
+ *
+ * @param[in] exporter  The exporter.
+ * @param[in] path      The path of the export.
+ *
+ * @return False if the file cannot be written.
+ */
+QBDI_EXPORT bool qbdi_analysisExporterWrite(AnalysisExporterRef exporter,
+                                            const char *path);
+
+#ifdef __cplusplus
+} // extern "C"
+
+// Forward declaration of private AnalysisExportData
+class AnalysisExportData;
+
+/*! Builder of an analysis export. The strings are deduplicated in the string
+ * pool.
+ */
+class QBDI_EXPORT AnalysisExporter {
+private:
+  std::unique_ptr<AnalysisExportData> data;
+
+public:
+  AnalysisExporter();
+
+  ~AnalysisExporter();
+
+  AnalysisExporter(const AnalysisExporter &) = delete;
+  AnalysisExporter &operator=(const AnalysisExporter &) = delete;
+
+  /*! Add an analysis to the export. An address already exported is ignored.
+   *
+   * @param[in] analysis  The analysis to add.
+   *
+   * @return False if the analysis wasn't added.
+   */
+  bool add(const InstAnalysis &analysis);
+
+  /*! Return the number of exported analyses.
+   */
+  size_t size() const;
+
+  /*! Write the export to a file. The file is truncated.
+   *
+   * @param[in] path  The path of the export.
+   *
+   * @return False if the file cannot be written.
+   */
+  bool write(const std::string &path) const;
+};
+
+// Forward declaration of private AnalysisExportFile
+class AnalysisExportFile;
+
+/*! Reader of an analysis export written by an AnalysisExporter.
+ */
+class QBDI_EXPORT AnalysisExportReader {
+private:
+  std::unique_ptr<AnalysisExportFile> file;
+
+public:
+  /*! Load an analysis export.
+   *
+   * @param[in] path  The path of the export.
+   */
+  AnalysisExportReader(const std::string &path);
+
+  ~AnalysisExportReader();
+
+  AnalysisExportReader(const AnalysisExportReader &) = delete;
+  AnalysisExportReader &operator=(const AnalysisExportReader &) = delete;
+
+  /*! Return true if the export is loaded.
+   */
+  bool isOpen() const;
+
+  /*! Return the number of records.
+   */
+  size_t size() const;
+
+  /*! Return the record of an index, sorted by address.
+   *
+   * @param[in] index  The index of the record (< size()).
+   */
+  const InstAnalysisRecord &getRecord(size_t index) const;
+
+  /*! Search the record of an address.
+   *
+   * @param[in] address  The address of the instruction.
+   *
+   * @return The record, nullptr if the address isn't exported.
+   */
+  const InstAnalysisRecord *find(rword address) const;
+
+  /*! Return an operand of a record.
+   *
+   * @param[in] record  The record.
+   * @param[in] index   The index of the operand (< record.numOperands).
+   */
+  const OperandRecord &getOperand(const InstAnalysisRecord &record,
+                                  size_t index) const;
+
+  /*! Return a string of the string pool.
+   *
+   * @param[in] offset  The offset of the string.
+   *
+   * @return The string, nullptr if offset is QBDI_ANALYSIS_EXPORT_NO_STRING.
+   */
+  const char *getString(uint32_t offset) const;
+};
+
+} // namespace QBDI
+#endif
+
+#endif // QBDI_ANALYSISEXPORT_H_
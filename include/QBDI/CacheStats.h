@@ -0,0 +1,332 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef QBDI_CACHESTATS_H_
+#define QBDI_CACHESTATS_H_
+
+#include <stdint.h>
+
+#include "QBDI/Platform.h"
+#include "QBDI/State.h"
+
+#ifdef __cplusplus
+namespace QBDI {
+#endif
+
+/*! Statistics of the translation cache of a VM
+ */
+typedef struct {
+  rword regionCount;        /*!< Number of regions of the cache */
+  rword execBlockCount;     /*!< Number of ExecBlocks of the regions */
+  rword sequenceCount;      /*!< Number of sequences of the ExecBlocks */
+  rword codeSize;           /*!< Bytes of code blocks mapped */
+  rword dataSize;           /*!< Bytes of data blocks mapped */
+  rword usedCodeSize;       /*!< Bytes of code written in the code blocks */
+  rword shadowSize;         /*!< Bytes of the data blocks available for the
+                             * shadows
+                             */
+  rword usedShadowSize;     /*!< Bytes of shadows allocated in the data
+                             * blocks
+                             */
+  rword shadowFullCount;    /*!< Number of ExecBlocks filled by their shadows
+                             * since the creation of the VM
+                             */
+  rword translatedSize;     /*!< Bytes of original code translated since the
+                             * creation of the VM
+                             */
+  rword translationSize;    /*!< Bytes of code generated since the creation of
+                             * the VM
+                             */
+  rword optimizedSize;      /*!< Bytes of code removed by the optimization of
+                             * the patches since the creation of the VM
+                             */
+  rword cacheHits;          /*!< Number of sequences found in the cache */
+  rword cacheMisses;        /*!< Number of addresses not found in the cache */
+  rword splitCount;         /*!< Number of lookups which entered an existing
+                             * sequence in its middle
+                             */
+  rword flushCount;         /*!< Number of flushes of the cache */
+  rword evictionCount;      /*!< Number of regions evicted by the cache
+                             * limit
+                             */
+  rword retranslationCount; /*!< Number of basic blocks translated again
+                             * after an eviction
+                             */
+  rword ibtcHits;           /*!< Hits of the indirect branch cache of the
+                             * current ExecBlocks
+                             */
+  rword ibtcMisses;         /*!< Misses of the indirect branch cache of the
+                             * current ExecBlocks
+                             */
+  float occupationRatio;    /*!< Ratio of the code blocks written */
+  float shadowRatio;        /*!< Ratio of the shadows of the data blocks
+                             * allocated
+                             */
+  float expansionRatio;     /*!< Ratio between the generated code size and the
+                             * translated code size
+                             */
+} CacheStats;
+
+/*! Memory used by the translation cache of a VM, by component
+ */
+typedef struct {
+  rword codeSize;      /*!< Bytes of code blocks mapped */
+  rword dataSize;      /*!< Bytes of data blocks mapped */
+  rword metadataSize;  /*!< Bytes of the metadata of the instructions and the
+                        * sequences of the ExecBlocks
+                        */
+  rword analysisSize;  /*!< Bytes of the InstAnalysis cached by the
+                        * ExecBlocks
+                        */
+  rword regionMapSize; /*!< Bytes of the regions and their address maps */
+  rword callbackSize;  /*!< Bytes of the callbacks of the InstrRules kept by
+                        * the regions
+                        */
+  rword totalSize;     /*!< Sum of the previous sizes */
+  rword instCount;     /*!< Number of instructions in the cache */
+} MemoryStats;
+
+/*! Statistics of the transfers of the ExecBroker to a native address
+ */
+typedef struct {
+  rword target;    /*!< Address of the native code called by the transfers */
+  rword count;     /*!< Number of transfers to the target */
+  uint64_t cycles; /*!< Cycles spent in the native code of the transfers. The
+                    * instrumented code called back with OPT_ENABLE_REENTRY
+                    * isn't included.
+                    */
+} TransferStats;
+
+/*! Counters of the execution of a VM: the dispatches of the sequences and
+ *  the reasons of the returns of the generated code to the VM
+ */
+typedef struct {
+  uint64_t dispatchCount;     /*!< Number of sequences dispatched by the VM */
+  uint64_t hostExitCount;     /*!< Number of returns of the generated code to
+                               * the VM
+                               */
+  uint64_t sequenceExitCount; /*!< Returns at the end of a sequence */
+  uint64_t callbackContinue;  /*!< Returns for a callback which returned
+                               * CONTINUE
+                               */
+  uint64_t callbackSkipInst;  /*!< Returns for a callback which returned
+                               * SKIP_INST
+                               */
+  uint64_t callbackSkipPatch; /*!< Returns for a callback which returned
+                               * SKIP_PATCH
+                               */
+  uint64_t callbackBreakToVM; /*!< Returns for a callback which returned
+                               * BREAK_TO_VM
+                               */
+  uint64_t callbackStop;      /*!< Returns for a callback which returned STOP */
+  uint64_t breakToVMCount;    /*!< Dispatches done again after a BREAK_TO_VM of
+                               * a callback or an event
+                               */
+  uint64_t transferCount;     /*!< Transfers of the ExecBroker to the native
+                               * code
+                               */
+  uint64_t cacheMisses;       /*!< Addresses not found in the cache */
+  uint64_t splitCount;        /*!< Lookups which entered an existing sequence in
+                               * its middle
+                               */
+} ExecStats;
+
+/*! Costs of an InstrRule, attributed to the rule when the statistics of the
+ *  rules are enabled
+ */
+typedef struct {
+  uint32_t id;             /*!< Id of the InstrRule */
+  rword instrumentCount;   /*!< Number of instructions instrumented by the
+                            * rule
+                            */
+  rword instCount;         /*!< Number of instructions generated by the rule,
+                            * the merged callbacks are shared by their rules
+                            */
+  rword codeSize;          /*!< Bytes of code written for the rule, estimated
+                            * from its share of the instructions of each
+                            * sequence
+                            */
+  rword shadowCount;       /*!< Number of shadows allocated by the generated
+                            * instructions
+                            */
+  uint64_t callbackCount;  /*!< Number of calls of the callbacks of the rule,
+                            * from the returns of the generated code to the
+                            * VM
+                            */
+  uint64_t callbackCycles; /*!< Cycles spent in the callbacks of the rule */
+} InstrRuleStats;
+
+/*! Execution counter of a sequence of the sequence profile
+ */
+typedef struct {
+  rword address;         /*!< Address of the first instruction of the
+                          * sequence
+                          */
+  rword instCount;       /*!< Number of instructions of the sequence */
+  uint64_t executions;   /*!< Number of executions of the sequence */
+  const char *symbol;    /*!< Nearest symbol before the address (may be
+                          * NULL)
+                          */
+  uint32_t symbolOffset; /*!< Offset of the address in the symbol */
+  const char *module;    /*!< Module of the address (may be NULL) */
+} SequenceStats;
+
+/*! Outcome counters of a conditional branch of the branch profile
+ */
+typedef struct {
+  rword address;         /*!< Address of the conditional branch */
+  rword target;          /*!< Address of the branch target */
+  uint64_t taken;        /*!< Number of executions which jumped to the
+                          * target
+                          */
+  uint64_t notTaken;     /*!< Number of executions which fell through */
+  const char *symbol;    /*!< Nearest symbol before the address (may be
+                          * NULL)
+                          */
+  uint32_t symbolOffset; /*!< Offset of the address in the symbol */
+  const char *module;    /*!< Module of the address (may be NULL) */
+} BranchStats;
+
+/*! Execution counter of a target of an indirect call or jump of the indirect
+ *  profile
+ */
+typedef struct {
+  rword address;               /*!< Address of the indirect call or jump */
+  rword target;                /*!< Address of the target, 0 for the targets
+                                * beyond the table of the site
+                                */
+  uint64_t count;              /*!< Number of executions to the target */
+  const char *symbol;          /*!< Nearest symbol before the address (may
+                                * be NULL)
+                                */
+  uint32_t symbolOffset;       /*!< Offset of the address in the symbol */
+  const char *module;          /*!< Module of the address (may be NULL) */
+  const char *targetSymbol;    /*!< Nearest symbol before the target (may be
+                                * NULL)
+                                */
+  uint32_t targetSymbolOffset; /*!< Offset of the target in its symbol */
+} IndirectTargetStats;
+
+/*! Execution counter of a value of a register of a value profile
+ */
+typedef struct {
+  rword address;  /*!< Address of the instruction */
+  uint32_t reg;   /*!< Index of the register in the GPRState */
+  uint8_t others; /*!< 1 if the counter is shared by the values beyond the
+                   * table of the site, value is then the last of them
+                   */
+  rword value;    /*!< Value of the register before the instruction */
+  uint64_t count; /*!< Number of executions with the value */
+} ValueStats;
+
+/*! Edge of the call graph profile, from a call site to a callee
+ */
+typedef struct {
+  rword address;               /*!< Address of the call instruction */
+  rword target;                /*!< Address of the callee, 0 for the callees
+                                * beyond the table of an indirect call
+                                */
+  uint64_t count;              /*!< Number of calls */
+  rword inclusive;             /*!< Number of instrumented instructions
+                                * executed between the calls and their
+                                * returns
+                                */
+  const char *symbol;          /*!< Nearest symbol before the call (may be
+                                * NULL)
+                                */
+  uint32_t symbolOffset;       /*!< Offset of the call in the symbol */
+  const char *module;          /*!< Module of the call (may be NULL) */
+  const char *targetSymbol;    /*!< Nearest symbol before the callee (may be
+                                * NULL)
+                                */
+  uint32_t targetSymbolOffset; /*!< Offset of the callee in its symbol */
+} CallGraphEdgeStats;
+
+/*! Counter of the memory accesses of a page of the page histogram
+ */
+typedef struct {
+  rword page;     /*!< Address of the page (aligned on 4KiB) */
+  uint64_t count; /*!< Number of memory accesses which start in the page */
+} PageAccessStats;
+
+/*! Hardware event sampled by the hardware sampling of a VM
+ */
+typedef enum {
+  _QBDI_EI(SAMPLE_CYCLES) = 0,       /*!< CPU cycles */
+  _QBDI_EI(SAMPLE_INSTRUCTIONS) = 1, /*!< Retired instructions */
+  _QBDI_EI(SAMPLE_CACHE_MISSES) = 2, /*!< Last level cache misses */
+  _QBDI_EI(SAMPLE_BRANCH_MISSES) = 3 /*!< Mispredicted branches */
+} HardwareEvent;
+
+/*! Samples of a hardware event attributed to an original instruction
+ */
+typedef struct {
+  rword address;         /*!< Address of the original instruction, 0 for the
+                          * samples outside of the ExecBlocks (QBDI and the
+                          * native code called by the ExecBroker)
+                          */
+  uint64_t samples;      /*!< Number of samples of the instruction */
+  const char *symbol;    /*!< Nearest symbol before the address (may be
+                          * NULL)
+                          */
+  uint32_t symbolOffset; /*!< Offset of the address in the symbol */
+  const char *module;    /*!< Module of the address (may be NULL) */
+} HardwareSample;
+
+/*! Number of size classes of the allocation profile. The class 0 counts the
+ *  allocations of 0 byte, the class i the sizes in [2^(i-1), 2^i).
+ */
+#define QBDI_ALLOCATION_SIZE_CLASSES 64
+
+/*! Maximal number of frames of a stack sampled by the allocation profile
+ */
+#define QBDI_ALLOCATION_STACK_DEPTH 8
+
+/*! Counters of the calls to the allocators of the allocation profile
+ */
+typedef struct {
+  uint64_t mallocCount;    /*!< Number of calls to malloc */
+  uint64_t callocCount;    /*!< Number of calls to calloc */
+  uint64_t reallocCount;   /*!< Number of calls to realloc */
+  uint64_t freeCount;      /*!< Number of calls to free */
+  uint64_t newCount;       /*!< Number of calls to operator new and new[] */
+  uint64_t deleteCount;    /*!< Number of calls to operator delete and
+                            * delete[]
+                            */
+  uint64_t allocatedBytes; /*!< Bytes requested by the allocations */
+  uint64_t sizeClasses[QBDI_ALLOCATION_SIZE_CLASSES]; /*!< Number of
+                                                       * allocations by size
+                                                       * class
+                                                       */
+} AllocationStats;
+
+/*! Stack of the allocations sampled by the allocation profile
+ */
+typedef struct {
+  rword frames[QBDI_ALLOCATION_STACK_DEPTH]; /*!< Return addresses, from the
+                                              * allocator to its callers,
+                                              * followed by 0
+                                              */
+  uint64_t samples;      /*!< Number of allocations sampled with the stack */
+  uint64_t sampledBytes; /*!< Bytes requested by the sampled allocations */
+} AllocationSite;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // QBDI_CACHESTATS_H_
@@ -93,6 +93,28 @@ typedef VMInstance *VMInstanceRef;
  */
 typedef VMAction (*InstCallback)(VMInstanceRef vm, GPRState *gprState,
                                  FPRState *fprState, void *data);
+
+/*! Instruction callback function type with the analysis of the instruction.
+ *
+ * @param[in] vm            VM instance of the callback.
+ * @param[in] gprState      A structure containing the state of the
+ *                          General Purpose Registers. Modifying
+ *                          it affects the VM execution accordingly.
+ * @param[in] fprState      A structure containing the state of the
+ *                          Floating Point Registers. Modifying
+ *                          it affects the VM execution accordingly.
+ * @param[in] analysis      The analysis of the instruction, made when the
+ *                          instruction was instrumented.
+ * @param[in] data          User defined data which can be defined when
+ *                          registering the callback.
+ *
+ * @return                  The callback result used to signal subsequent
+ *                          actions the VM needs to take.
+ */
+typedef VMAction (*InstAnalysisCallback)(VMInstanceRef vm, GPRState *gprState,
+                                         FPRState *fprState,
+                                         const InstAnalysis *analysis,
+                                         void *data);
 #ifdef __cplusplus
 /*! Instruction callback lambda type.
  *
@@ -119,6 +141,30 @@ typedef enum {
   _QBDI_EI(POSTINST)     /*!< Positioned after the instruction.*/
 } InstPosition;
 
+/*! Kind of coverage recorded in a coverage bitmap.
+ */
+typedef enum {
+  _QBDI_EI(COVERAGE_EDGE) = 0, /*!< Count the edges between the basic blocks
+                                * (AFL style) */
+  _QBDI_EI(COVERAGE_BLOCK) = 1 /*!< Count the basic blocks */
+} CoverageMode;
+
+/*! Registers of the guest used by a lightweight callback. The bit i of
+ * FOOTPRINT_ALL_GPR is the register i of GPRState (see QBDI_GPR_GET).
+ */
+typedef enum {
+  _QBDI_EI(FOOTPRINT_NONE) = 0,                /*!< Only SP, PC, the flags
+                                                * and the registers
+                                                * clobbered by a call */
+  _QBDI_EI(FOOTPRINT_ALL_GPR) = (1 << 16) - 1, /*!< All the general purpose
+                                                * registers */
+  _QBDI_EI(FOOTPRINT_FPR) = 1 << 16,           /*!< The FPRState or the
+                                                * floating point and vector
+                                                * registers */
+} CallbackFootprint;
+
+_QBDI_ENABLE_BITMASK_OPERATORS(CallbackFootprint)
+
 /*! Priority of callback
  *
  * A callback with an higher priority will be call before a callback with a
@@ -170,8 +216,12 @@ typedef enum {
                                             * returns from an execution
                                             * transfer.
                                             */
-  _QBDI_EI(SYSCALL_ENTRY) = 1 << 7,        /*!< Not implemented.*/
-  _QBDI_EI(SYSCALL_EXIT) = 1 << 8,         /*!< Not implemented.*/
+  _QBDI_EI(SYSCALL_ENTRY) = 1 << 7,        /*!< Triggered before the
+                                            * execution of a system call.
+                                            */
+  _QBDI_EI(SYSCALL_EXIT) = 1 << 8,         /*!< Triggered after the execution
+                                            * of a system call.
+                                            */
   _QBDI_EI(SIGNAL) = 1 << 9,               /*!< Not implemented.*/
 } VMEvent;
 
@@ -198,6 +248,10 @@ typedef struct {
                           * be the execution transfer destination.
                           */
   rword lastSignal;      /*!< Not implemented.*/
+  rword syscallNumber;   /*!< The number of the system call (SYSCALL_ENTRY
+                          * and SYSCALL_EXIT). The arguments are in the
+                          * GPRState at SYSCALL_ENTRY.
+                          */
 } VMState;
 
 /*! VM callback function type.
@@ -243,12 +297,54 @@ static const uint16_t NO_REGISTRATION = 0xFFFF;
 static const uint16_t NOT_FOUND = 0xFFFF;
 static const uint16_t ANY = 0xFFFF;
 
+/*! Policy of the tracking of the modules loaded and unloaded by the process
+ */
+typedef enum {
+  _QBDI_EI(NO_MODULE_TRACKING) = 0,
+  _QBDI_EI(MODULE_TRACK_LOAD) = 1,       /*!< Add the executable ranges of the
+                                          * loaded modules to the instrumented
+                                          * ranges */
+  _QBDI_EI(MODULE_TRACK_UNLOAD) = 1 << 1, /*!< Remove the executable ranges of
+                                           * the unloaded modules from the
+                                           * instrumented ranges and from the
+                                           * cache */
+  _QBDI_EI(MODULE_TRACK_ALL) = 3,         /*!< MODULE_TRACK_LOAD and
+                                           * MODULE_TRACK_UNLOAD */
+} ModuleTracking;
+
+_QBDI_ENABLE_BITMASK_OPERATORS(ModuleTracking);
+
+/*! Status of a slice of execution run by runFor
+ */
+typedef enum {
+  _QBDI_EI(SLICE_NOT_RUN) = 0,  /*!< The PC isn't instrumented, nothing has
+                                 * been executed */
+  _QBDI_EI(SLICE_FINISHED) = 1, /*!< The stop address has been reached */
+  _QBDI_EI(SLICE_EXPIRED) = 2,  /*!< The budget of the slice is exhausted, the
+                                 * PC is the entry of the next sequence */
+  _QBDI_EI(SLICE_STOPPED) = 3,  /*!< A callback or a stop request stopped the
+                                 * execution */
+} SliceStatus;
+
 /*! Memory access type (read / write / ...)
  */
 typedef enum {
   _QBDI_EI(MEMORY_READ) = 1,       /*!< Memory read access */
   _QBDI_EI(MEMORY_WRITE) = 1 << 1, /*!< Memory write access */
-  _QBDI_EI(MEMORY_READ_WRITE) = 3  /*!< Memory read/write access */
+  _QBDI_EI(MEMORY_READ_WRITE) = 3, /*!< Memory read/write access */
+  _QBDI_EI(MEMORY_ADDRESS_ONLY) = 1 << 2, /*!< Modifier of the recording
+                                           * (recordMemoryAccess and the
+                                           * memory access callbacks): the
+                                           * value isn't captured */
+  _QBDI_EI(MEMORY_NO_STACK) = 1 << 3,     /*!< Modifier of the recording:
+                                           * the accesses relative to the
+                                           * stack pointer (push, pop, call,
+                                           * ret and the operands based on
+                                           * it) aren't recorded */
+  _QBDI_EI(MEMORY_NO_FRAME) = 1 << 4,     /*!< Modifier of the recording:
+                                           * as MEMORY_NO_STACK, and the
+                                           * operands based on the frame
+                                           * pointer aren't recorded */
 } MemoryAccessType;
 
 _QBDI_ENABLE_BITMASK_OPERATORS(MemoryAccessType);
@@ -265,6 +361,22 @@ typedef enum {
                                             */
   _QBDI_EI(MEMORY_UNKNOWN_VALUE) = 1 << 2, /*!< The value of the access is
                                             * unknown or hasn't been retrived.
+                                            * Never set with MEMORY_BULK.
+                                            */
+  _QBDI_EI(MEMORY_BULK) = 1 << 3,          /*!< The access summarizes all the
+                                            * iterations of an instruction with
+                                            * a REP prefix. The value holds the
+                                            * length of the range in bytes.
+                                            */
+  _QBDI_EI(MEMORY_BULK_BACKWARD) = 1 << 4, /*!< The bulk access has been done
+                                            * from the high addresses to the
+                                            * low addresses (DF=1).
+                                            */
+  _QBDI_EI(MEMORY_WIDE_VALUE) = 1 << 5,    /*!< The value of the access is
+                                            * larger than a rword: the value
+                                            * holds its first bytes and the
+                                            * whole value is given by
+                                            * getMemoryAccessValue.
                                             */
 } MemoryAccessFlags;
 
@@ -281,6 +393,181 @@ typedef struct {
   MemoryAccessFlags flags; /*!< Memory access flags */
 } MemoryAccess;
 
+/*! Compact record of a memory access in the memory trace buffer
+ */
+typedef struct {
+  rword instAddress;   /*!< Address of instruction making the access */
+  rword accessAddress; /*!< Address of accessed memory */
+  rword value;         /*!< Value read from / written to memory */
+  uint16_t size;       /*!< Size of memory access (in bytes) */
+  uint16_t type;       /*!< Memory access type (MemoryAccessType) */
+  uint16_t flags;      /*!< Memory access flags (MemoryAccessFlags) */
+  uint16_t reserved;   /*!< Unused */
+} MemoryTraceEntry;
+
+/*! Memory trace callback function type.
+ *
+ * @param[in] vm            VM instance of the callback.
+ * @param[in] entries       The memory accesses recorded since the previous
+ *                          call, in the order of the execution.
+ * @param[in] count         The number of entries.
+ * @param[in] data          User defined data which can be defined when
+ *                          registering the callback.
+ *
+ * @return                  The callback result used to signal the VM to
+ *                          continue (CONTINUE) or to stop (STOP).
+ */
+typedef VMAction (*MemoryTraceCallback)(VMInstanceRef vm,
+                                        const MemoryTraceEntry *entries,
+                                        size_t count, void *data);
+
+/*! Maximum number of arguments of a CallTraceEntry
+ */
+#define QBDI_CALL_TRACE_MAX_ARGS 6
+
+/*! Record of a call in the call trace buffer
+ */
+typedef struct {
+  rword callAddress; /*!< Address of the call instruction */
+  rword target;      /*!< Address of the callee */
+  rword nbArgs;      /*!< Number of captured arguments */
+  rword args[QBDI_CALL_TRACE_MAX_ARGS]; /*!< The first arguments of the call,
+                                         * from the registers of the ABI of
+                                         * the platform (or the stack on X86)
+                                         */
+} CallTraceEntry;
+
+/*! Call trace callback function type.
+ *
+ * @param[in] vm            VM instance of the callback.
+ * @param[in] entries       The calls recorded since the previous call, in the
+ *                          order of the execution.
+ * @param[in] count         The number of entries.
+ * @param[in] data          User defined data which can be defined when
+ *                          registering the callback.
+ *
+ * @return                  The callback result used to signal the VM to
+ *                          continue (CONTINUE) or to stop (STOP).
+ */
+typedef VMAction (*CallTraceCallback)(VMInstanceRef vm,
+                                      const CallTraceEntry *entries,
+                                      size_t count, void *data);
+
+/*! Basic block translated by the VM, given in batches to a
+ * NewBasicBlockCallback.
+ */
+typedef struct {
+  rword start;       /*!< Start of the basic block */
+  rword end;         /*!< End of the basic block (excluded) */
+  rword moduleStart; /*!< Start of the instrumented range of the basic block,
+                      * it identifies its module */
+} NewBasicBlockEntry;
+
+/*! Callback of the basic blocks translated by the VM.
+ *
+ * @param[in] vm            VM instance of the callback.
+ * @param[in] entries       The basic blocks translated since the previous
+ *                          call, in the order of the translation.
+ * @param[in] count         The number of entries.
+ * @param[in] data          User defined data which can be defined when
+ *                          registering the callback.
+ *
+ * @return                  The callback result used to signal the VM to
+ *                          continue (CONTINUE) or to stop (STOP).
+ */
+typedef VMAction (*NewBasicBlockCallback)(VMInstanceRef vm,
+                                          const NewBasicBlockEntry *entries,
+                                          size_t count, void *data);
+
+/*! Basic block memory access callback function type.
+ *
+ * @param[in] vm            VM instance of the callback.
+ * @param[in] vmState       A structure containing the current state of the VM.
+ * @param[in] gprState      A structure containing the state of the
+ *                          General Purpose Registers. Modifying
+ *                          it affects the VM execution accordingly.
+ * @param[in] fprState      A structure containing the state of the
+ *                          Floating Point Registers. Modifying
+ *                          it affects the VM execution accordingly.
+ * @param[in] accesses      The memory accesses of the sequence, in the order
+ *                          of the instructions. The array is only valid
+ *                          during the callback.
+ * @param[in] count         The number of memory accesses.
+ * @param[in] data          User defined data which can be defined when
+ *                          registering the callback.
+ *
+ * @return                  The callback result used to signal subsequent
+ *                          actions the VM needs to take.
+ */
+typedef VMAction (*BBMemAccessCallback)(VMInstanceRef vm,
+                                        const VMState *vmState,
+                                        GPRState *gprState,
+                                        FPRState *fprState,
+                                        const MemoryAccess *accesses,
+                                        size_t count, void *data);
+
+/*! Location of an instruction of the cache given to a CachedInstCallback
+ */
+typedef struct {
+  rword seqStart;     /*!< Address of the first instruction of the
+                       * sequence */
+  rword seqEnd;       /*!< Address after the last instruction of the
+                       * sequence */
+  rword bbEnd;        /*!< Address after the basic block of the sequence */
+  uint16_t instIndex; /*!< Index of the instruction in the sequence */
+  uint16_t nbInst;    /*!< Number of instructions of the sequence */
+} CachedInstLocation;
+
+/*! Cache iteration callback function type.
+ *
+ * @param[in] vm            VM instance of the callback.
+ * @param[in] location      The sequence of the instruction and its index.
+ * @param[in] analysis      The analysis of the instruction, valid until the
+ *                          cache is cleared.
+ * @param[in] data          User defined data given to the iteration.
+ *
+ * @return                  CONTINUE to continue the iteration, STOP to end
+ *                          it.
+ */
+typedef VMAction (*CachedInstCallback)(VMInstanceRef vm,
+                                       const CachedInstLocation *location,
+                                       const InstAnalysis *analysis,
+                                       void *data);
+
+/*! Kind of predicate evaluated by the generated code before a callback.
+ */
+typedef enum {
+  _QBDI_EI(PREDICATE_REG_EQUAL) = 0,       /*!< The register is equal to value
+                                            */
+  _QBDI_EI(PREDICATE_REG_NOT_EQUAL) = 1,   /*!< The register isn't equal to
+                                            * value */
+  _QBDI_EI(PREDICATE_REG_BELOW) = 2,       /*!< The register is below value
+                                            * (unsigned) */
+  _QBDI_EI(PREDICATE_REG_ABOVE_EQUAL) = 3, /*!< The register is above or equal
+                                            * to value (unsigned) */
+  _QBDI_EI(PREDICATE_MEM_IN_RANGE) = 4,    /*!< The address of the access is
+                                            * in [value, end) (PREINST only) */
+  _QBDI_EI(PREDICATE_COUNTER) = 5,         /*!< Once every value executions */
+  _QBDI_EI(PREDICATE_SAMPLE) = 6,          /*!< After a pseudo-random number
+                                            * of executions, value on
+                                            * average */
+} PredicateType;
+
+/*! Predicate of a callback. The predicate is evaluated by the instrumented
+ * code and the callback is called only if it holds, without breaking to the
+ * host otherwise.
+ */
+typedef struct {
+  PredicateType type;      /*!< Kind of predicate */
+  uint32_t reg;            /*!< Index of the register in GPRState
+                            * (PREDICATE_REG_*) */
+  MemoryAccessType access; /*!< MEMORY_READ or MEMORY_WRITE
+                            * (PREDICATE_MEM_IN_RANGE) */
+  rword value;             /*!< Compared value, start of the range or period of
+                            * the counter or of the sampling */
+  rword end;               /*!< End of the range (PREDICATE_MEM_IN_RANGE) */
+} CallbackPredicate;
+
 #ifdef __cplusplus
 struct InstrRuleDataCBK {
   InstPosition position; /*!< Relative position of the event callback (PREINST /
@@ -353,6 +640,45 @@ typedef std::function<std::vector<InstrRuleDataCBK>(VMInstanceRef vm,
                                                     const InstAnalysis *inst)>
     InstrRuleCbLambda;
 
+/*! Instrumentation rule callback lambda type which adds the callbacks to an
+ * output vector. The vector is reused between the instructions and isn't
+ * allocated when no callback is added.
+ *
+ * @param[in] vm     VM instance of the callback.
+ * @param[in] inst   AnalysisType of the current instrumented Instruction.
+ * @param[out] cbks  The cbk to call when this instruction is run.
+ */
+typedef std::function<void(VMInstanceRef vm, const InstAnalysis *inst,
+                           std::vector<InstrRuleDataCBK> &cbks)>
+    InstrRuleFillCbLambda;
+
+/*! Basic block instrumentation rule callback function type.
+ *
+ * @param[in] vm     VM instance of the callback.
+ * @param[in] block  Analyses of the instructions of the basic block in the
+ *                   range of the rule, in the order of their addresses.
+ * @param[out] cbks  The cbk to call when the instructions are run. cbks[i]
+ *                   is an empty vector for the instruction block[i].
+ * @param[in] data   User defined data which can be defined when registering
+ *                   the callback.
+ */
+typedef void (*InstrRuleBBCallback)(
+    VMInstanceRef vm, const std::vector<const InstAnalysis *> &block,
+    std::vector<std::vector<InstrRuleDataCBK>> &cbks, void *data);
+
+/*! Basic block instrumentation rule callback lambda type.
+ *
+ * @param[in] vm     VM instance of the callback.
+ * @param[in] block  Analyses of the instructions of the basic block in the
+ *                   range of the rule, in the order of their addresses.
+ * @param[out] cbks  The cbk to call when the instructions are run. cbks[i]
+ *                   is an empty vector for the instruction block[i].
+ */
+typedef std::function<void(VMInstanceRef vm,
+                           const std::vector<const InstAnalysis *> &block,
+                           std::vector<std::vector<InstrRuleDataCBK>> &cbks)>
+    InstrRuleBBCbLambda;
+
 } // QBDI::
 #endif
 
@@ -171,6 +171,18 @@ typedef struct {
   OperandAnalysis *operands;      /*!< Structure containing analysis results
                                    * of an operand provided by the VM.
                                    * (warning: NULL if !ANALYSIS_OPERANDS) */
+  uint64_t gprRead;  /*!< Bitmask of the GPRState registers read by the
+                      * instruction, the bit i is the register of index i
+                      * (REG_FLAG if flagsAccess is a read)
+                      * (warning: 0 if !ANALYSIS_OPERANDS) */
+  uint64_t gprWrite; /*!< Bitmask of the GPRState registers written by the
+                      * instruction (warning: 0 if !ANALYSIS_OPERANDS) */
+  uint64_t fprRead;  /*!< Bitmask of the FPRState registers read by the
+                      * instruction, the bit i is the 16 bytes at the offset
+                      * 16 * i (the regCtxIdx of the operand)
+                      * (warning: 0 if !ANALYSIS_OPERANDS) */
+  uint64_t fprWrite; /*!< Bitmask of the FPRState registers written by the
+                      * instruction (warning: 0 if !ANALYSIS_OPERANDS) */
   // ANALYSIS_SYMBOL
   const char *symbol;    /*!< Instruction symbol
                           * (warning: NULL if !ANALYSIS_SYMBOL or not found)
@@ -185,6 +197,11 @@ typedef struct {
                           */
 } InstAnalysis;
 
+/*! Handle of an instruction of the cache of a VM (see VM::getInstHandle).
+ * 0 is never a valid handle.
+ */
+typedef uint64_t InstHandle;
+
 #ifdef __cplusplus
 }
 #endif
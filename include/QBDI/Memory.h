@@ -52,6 +52,24 @@ typedef struct {
                                */
 } qbdi_MemoryMap;
 
+/*! Offset of an absent name in a string pool */
+#define QBDI_MEMORYMAP_NO_NAME 0xffffffffu
+
+/*! Map of a memory area (region) written in a buffer of the caller. The name
+ * is an offset in a string pool of the caller.
+ */
+typedef struct {
+  rword start;                /*!< Range start value. */
+  rword end;                  /*!< Range end value (always excluded). */
+  qbdi_Permission permission; /*!< Region access rights
+                               * (PF_READ, PF_WRITE, PF_EXEC).
+                               */
+  uint32_t name;              /*!< Offset of the null terminated name in the
+                               * string pool (or QBDI_MEMORYMAP_NO_NAME if the
+                               * pool is too small).
+                               */
+} qbdi_MemoryMapEntry;
+
 /*! Get a list of all the memory maps (regions) of a process.
  *
  * @param[in]  pid  The identifier of the process.
@@ -73,6 +91,44 @@ QBDI_EXPORT qbdi_MemoryMap *qbdi_getRemoteProcessMaps(rword pid, bool full_path,
 QBDI_EXPORT qbdi_MemoryMap *qbdi_getCurrentProcessMaps(bool full_path,
                                                        size_t *size);
 
+/*! Get a list of all the memory maps (regions) of the current process from
+ *  a snapshot. The snapshot is taken at the first call and reused until
+ *  qbdi_invalidateProcessMapsCache is called. On Linux, the snapshot is also
+ *  taken again when a module has been loaded or unloaded since the last call.
+ *
+ * @param[in]  full_path  Return the full path of the module in name field
+ * @param[out] size Will be set to the number of strings in the returned array.
+ *
+ * @return  An array of MemoryMap object.
+ */
+QBDI_EXPORT qbdi_MemoryMap *qbdi_getCachedProcessMaps(bool full_path,
+                                                      size_t *size);
+
+/*! Write the memory maps of the snapshot of qbdi_getCachedProcessMaps in
+ *  buffers of the caller, without allocation.
+ *
+ * @param[in]  full_path  Return the full path of the module in name field
+ * @param[out] maps       Array where the memory maps are written.
+ * @param[in]  capacity   Number of elements of maps.
+ * @param[out] pool       String pool where the names are written.
+ * @param[in]  poolSize   Size of the string pool (in bytes).
+ * @param[out] poolNeeded If not NULL, set to the size of the string pool
+ *                        needed by all the names.
+ *
+ * @return The number of memory maps. Only the first capacity maps are written
+ *         if the number is greater.
+ */
+QBDI_EXPORT size_t qbdi_getCachedProcessMapsBuffer(bool full_path,
+                                                   qbdi_MemoryMapEntry *maps,
+                                                   size_t capacity, char *pool,
+                                                   size_t poolSize,
+                                                   size_t *poolNeeded);
+
+/*! Invalidate the snapshot of the memory maps of the current process. The
+ *  next call to qbdi_getCachedProcessMaps reads the memory maps again.
+ */
+QBDI_EXPORT void qbdi_invalidateProcessMapsCache();
+
 /*! Free an array of memory maps objects.
  *
  * @param[in] arr  An array of MemoryMap object.
@@ -93,6 +149,26 @@ QBDI_EXPORT void qbdi_freeMemoryMapArray(qbdi_MemoryMap *arr, size_t size);
  */
 QBDI_EXPORT char **qbdi_getModuleNames(size_t *size);
 
+/*! Write the names of the modules of the snapshot of
+ *  qbdi_getCachedProcessMaps in buffers of the caller, without allocation.
+ *
+ * @param[out] names      Array where the offsets of the names in the string
+ *                        pool are written (QBDI_MEMORYMAP_NO_NAME if the pool
+ *                        is too small).
+ * @param[in]  capacity   Number of elements of names.
+ * @param[out] pool       String pool where the names are written.
+ * @param[in]  poolSize   Size of the string pool (in bytes).
+ * @param[out] poolNeeded If not NULL, set to the size of the string pool
+ *                        needed by all the names.
+ *
+ * @return The number of modules. Only the first capacity names are written
+ *         if the number is greater.
+ */
+QBDI_EXPORT size_t qbdi_getCachedModuleNamesBuffer(uint32_t *names,
+                                                   size_t capacity, char *pool,
+                                                   size_t poolSize,
+                                                   size_t *poolNeeded);
+
 /*! Allocate a block of memory of a specified sized with an aligned base
  * address.
  *
@@ -101,6 +101,22 @@ QBDI_EXPORT std::vector<MemoryMap> getRemoteProcessMaps(QBDI::rword pid,
 QBDI_EXPORT std::vector<MemoryMap>
 getCurrentProcessMaps(bool full_path = false);
 
+/*! Get a list of all the memory maps (regions) of the current process from
+ *  a snapshot. The snapshot is taken at the first call and reused until
+ *  invalidateProcessMapsCache is called. On Linux, the snapshot is also taken
+ *  again when a module has been loaded or unloaded since the last call.
+ *
+ * @param[in] full_path  Return the full path of the module in name field
+ * @return  A vector of MemoryMap object.
+ */
+QBDI_EXPORT std::vector<MemoryMap>
+getCachedProcessMaps(bool full_path = false);
+
+/*! Invalidate the snapshot of the memory maps of the current process. The
+ *  next call to getCachedProcessMaps reads the memory maps again.
+ */
+QBDI_EXPORT void invalidateProcessMapsCache();
+
 /*! Get a list of all the module names loaded in the process memory.
  *
  * @return  A vector of string of module names.
@@ -0,0 +1,227 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef QBDI_OBSERVER_H_
+#define QBDI_OBSERVER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "QBDI/Callback.h"
+#include "QBDI/Platform.h"
+#include "QBDI/State.h"
+
+#ifdef __cplusplus
+#include <functional>
+#include <memory>
+#endif
+
+/*! Maximum number of memory accesses of an ObservedState
+ */
+#define QBDI_OBSERVER_MAX_ACCESS 4
+
+#ifdef __cplusplus
+namespace QBDI {
+
+class Observer;
+using ObserverRef = Observer *;
+
+extern "C" {
+#else
+typedef void *ObserverRef;
+#endif
+
+/*! State of an instruction captured for an Observer
+ */
+typedef struct {
+  rword address;     /*!< Value of PC: the address of the instruction at
+                      * PREINST, the next address at POSTINST */
+  GPRState gprState; /*!< The observed registers, the other ones are 0 */
+  uint32_t nbAccess; /*!< Number of memory accesses of the instruction */
+  MemoryAccess access[QBDI_OBSERVER_MAX_ACCESS]; /*!< The first memory
+                                                  * accesses of the
+                                                  * instruction */
+} ObservedState;
+
+/*! Observe-only callback, called by a worker thread of an Observer.
+ *
+ * @param[in] state  The captured state of the instruction.
+ * @param[in] data   User defined data which can be defined when creating the
+ *                   Observer.
+ */
+typedef void (*ObserverCallback)(const ObservedState *state, void *data);
+
+/*! Create an observer.
+ *
+ * @param[in] cbk        The callback called by the worker threads.
+ * @param[in] data       User defined data passed to the callback.
+ * @param[in] registers  The registers to capture, the bit i is the register
+ *                       i of GPRState (see QBDI_GPR_GET).
+ * @param[in] memory     Capture the memory accesses of the instructions.
+ * @param[in] workers    The number of worker threads.
+ * @param[in] capacity   The number of states of the queue of each worker.
+ *
+ * @return The observer, NULL if cbk is NULL.
+ */
+QBDI_EXPORT ObserverRef qbdi_newObserver(ObserverCallback cbk, void *data,
+                                         uint32_t registers, bool memory,
+                                         size_t workers, size_t capacity);
+
+/*! Wait for the pending states and delete an observer. The observer must not
+ * be attached to a VM anymore.
+ *
+ * @param[in] observer  The observer.
+ */
+QBDI_EXPORT void qbdi_deleteObserver(ObserverRef observer);
+
+/*! Wait until the callback is called for all the captured states.
+ *
+ * @param[in] observer  The observer.
+ */
+QBDI_EXPORT void qbdi_flushObserver(ObserverRef observer);
+
+/*! Register the callback of an observer on every instruction of a VM.
+ *
+ * @param[in] observer  The observer.
+ * @param[in] instance  The VM to observe.
+ * @param[in] pos       The position of the capture (PREINST / POSTINST).
+ *
+ * @return The id of the registered instrumentation (or
+ *         VMError::INVALID_EVENTID).
+ */
+QBDI_EXPORT uint32_t qbdi_attachObserver(ObserverRef observer,
+                                         VMInstanceRef instance,
+                                         InstPosition pos);
+
+/*! Register the callback of an observer on an address range of a VM.
+ *
+ * @param[in] observer  The observer.
+ * @param[in] instance  The VM to observe.
+ * @param[in] start     Start of the address range.
+ * @param[in] end       End of the address range.
+ * @param[in] pos       The position of the capture (PREINST / POSTINST).
+ *
+ * @return The id of the registered instrumentation (or
+ *         VMError::INVALID_EVENTID).
+ */
+QBDI_EXPORT uint32_t qbdi_attachObserverRange(ObserverRef observer,
+                                              VMInstanceRef instance,
+                                              rword start, rword end,
+                                              InstPosition pos);
+
+#ifdef __cplusplus
+} // extern "C"
+
+// Forward declaration of private ObserverQueue
+class ObserverQueue;
+
+/*! Observe-only callback of an Observer
+ */
+using ObserverCbLambda = std::function<void(const ObservedState &)>;
+
+/*! Observe-only instrumentation. The instrumented thread captures the
+ * declared registers and memory accesses of each instruction in a single
+ * producer single consumer queue without lock and returns to the instrumented
+ * code, the callback is called later by a worker thread. The callback cannot
+ * change the state of the guest nor stop the execution.
+ *
+ * Without memory accesses, the capture is a lightweight callback (see
+ * VM::addCodeCBLight) which only saves the declared registers. The memory
+ * accesses need a complete context switch and the memory recording of the VM.
+ *
+ * With several workers, the states are distributed in turn to the workers:
+ * the callback must be thread safe and the states of consecutive
+ * instructions are handled in any order. The states must be produced by a
+ * single thread, a VM per thread needs an observer per thread.
+ */
+class QBDI_EXPORT Observer {
+private:
+  std::unique_ptr<ObserverQueue> queue;
+
+public:
+  /*! Create an observer.
+   *
+   * @param[in] cbk        The callback called by the worker threads.
+   * @param[in] registers  The registers to capture, the bit i is the
+   *                       register i of GPRState (see QBDI_GPR_GET).
+   * @param[in] memory     Capture the memory accesses of the instructions.
+   * @param[in] workers    The number of worker threads.
+   * @param[in] capacity   The number of states of the queue of each worker.
+   */
+  Observer(const ObserverCbLambda &cbk, uint32_t registers = 0,
+           bool memory = false, size_t workers = 1, size_t capacity = 4096);
+
+  /*! Create an observer with a function pointer.
+   *
+   * @param[in] cbk        The callback called by the worker threads.
+   * @param[in] data       User defined data passed to the callback.
+   * @param[in] registers  The registers to capture.
+   * @param[in] memory     Capture the memory accesses of the instructions.
+   * @param[in] workers    The number of worker threads.
+   * @param[in] capacity   The number of states of the queue of each worker.
+   */
+  Observer(ObserverCallback cbk, void *data, uint32_t registers = 0,
+           bool memory = false, size_t workers = 1, size_t capacity = 4096);
+
+  /*! Wait for the pending states and stop the worker threads. The observer
+   * must not be attached to a VM anymore.
+   */
+  ~Observer();
+
+  Observer(const Observer &) = delete;
+  Observer &operator=(const Observer &) = delete;
+
+  /*! Wait until the callback is called for all the captured states.
+   */
+  void flush();
+
+  /*! Register the capture on every instruction of a VM. The observer must
+   * outlive the instrumentation.
+   *
+   * @param[in] vm   The VM to observe.
+   * @param[in] pos  The position of the capture (PREINST / POSTINST). The
+   *                 memory writes are only known at POSTINST.
+   *
+   * @return The id of the registered instrumentation (or
+   *         VMError::INVALID_EVENTID).
+   */
+  uint32_t attach(VM &vm, InstPosition pos = PREINST);
+
+  /*! Register the capture on an address range of a VM. The observer must
+   * outlive the instrumentation.
+   *
+   * @param[in] vm     The VM to observe.
+   * @param[in] start  Start of the address range.
+   * @param[in] end    End of the address range.
+   * @param[in] pos    The position of the capture (PREINST / POSTINST).
+   *
+   * @return The id of the registered instrumentation (or
+   *         VMError::INVALID_EVENTID).
+   */
+  uint32_t attachRange(VM &vm, rword start, rword end,
+                       InstPosition pos = PREINST);
+
+  /*! InstCallback of the capture, data must be an Observer.
+   */
+  static VMAction observeCB(VMInstanceRef vm, GPRState *gprState,
+                            FPRState *fprState, void *data);
+};
+
+} // namespace QBDI
+#endif
+
+#endif // QBDI_OBSERVER_H_
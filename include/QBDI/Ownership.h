@@ -0,0 +1,173 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef QBDI_OWNERSHIP_H_
+#define QBDI_OWNERSHIP_H_
+
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "QBDI/Callback.h"
+#include "QBDI/Platform.h"
+#include "QBDI/State.h"
+
+namespace QBDI {
+
+// Forward declaration of private OwnershipTable
+struct OwnershipTable;
+
+/*! Memory access which breaks the ownership of a granule
+ */
+typedef struct {
+  rword address;         /*!< Address of the access */
+  uint32_t owner;        /*!< Owner of the granule before the access, 0 for
+                          * the first access of the granule */
+  uint32_t thread;       /*!< Thread of the OwnershipFilter */
+  MemoryAccessType type; /*!< MEMORY_READ or MEMORY_WRITE */
+} OwnershipAccess;
+
+/*! Callback of an access to a granule which isn't owned by the thread of the
+ * filter, called before the instruction.
+ *
+ * @param[in] vm        VM instance of the callback.
+ * @param[in] gprState  A structure containing the state of the General
+ *                      Purpose Registers. Modifying it affects the VM
+ *                      execution accordingly.
+ * @param[in] fprState  A structure containing the state of the Floating Point
+ *                      Registers. Modifying it affects the VM execution
+ *                      accordingly.
+ * @param[in] access    The access and the owner of its granule.
+ * @param[in] data      User defined data which can be defined when creating
+ *                      the filter.
+ *
+ * @return              The callback result used to signal subsequent
+ *                      actions the VM needs to take.
+ */
+typedef VMAction (*OwnershipCallback)(VMInstanceRef vm, GPRState *gprState,
+                                      FPRState *fprState,
+                                      const OwnershipAccess *access,
+                                      void *data);
+
+/*! Owners of the memory shared by the threads of a process. The memory is
+ * shadowed by granules of OwnershipShadow::GRANULE bytes, each granule holds
+ * the identifier of the thread which owns it (0 if it has no owner).
+ *
+ * The shadow is read without lock by the generated code of the filters and
+ * must outlive them.
+ */
+class QBDI_EXPORT OwnershipShadow {
+private:
+  std::unique_ptr<OwnershipTable> table;
+
+  friend class OwnershipFilter;
+  friend class VM;
+
+public:
+  /*! Size in bytes of a granule
+   */
+  static constexpr rword GRANULE = 8;
+
+  OwnershipShadow();
+  ~OwnershipShadow();
+
+  OwnershipShadow(const OwnershipShadow &) = delete;
+  OwnershipShadow &operator=(const OwnershipShadow &) = delete;
+
+  /*! Get the owner of the granule of an address
+   *
+   * @param[in] address  The address
+   *
+   * @return The identifier of the owner, 0 if the granule has no owner
+   */
+  uint32_t getOwner(rword address) const;
+
+  /*! Set the owner of the granules of a memory range. A thread can take a
+   * shared granule from the filter callback to stop its next breaks.
+   *
+   * @param[in] address  Start of the range
+   * @param[in] size     Size of the range in bytes
+   * @param[in] owner    The identifier of the owner, 0 to release the
+   *                     granules
+   */
+  void setOwner(rword address, rword size, uint32_t owner);
+
+  /*! Get the size in bytes of the allocated shadow
+   */
+  size_t getShadowSize() const;
+
+  /*! Release all the granules, the shadow stays allocated
+   */
+  void clear();
+};
+
+/*! Ownership filter of the memory accesses of a thread. The generated code
+ * compares the owner of the granule of each access with the thread of the
+ * filter and only breaks to the host when they differ. At the first access
+ * of a granule, the granule is given to the thread before the callback.
+ *
+ * A filter is used by the VM of a single thread. The VM of each thread needs
+ * its own filter, with the same OwnershipShadow.
+ */
+class QBDI_EXPORT OwnershipFilter {
+private:
+  OwnershipShadow &shadow;
+  uint32_t thread;
+  OwnershipCallback cbk;
+  void *data;
+  // address of the last access of another owner, written by the generated
+  // code before the break to the host
+  rword missAddress;
+
+  friend class VM;
+
+public:
+  /*! Create a filter.
+   *
+   * @param[in] shadow  The shared shadow of the owners.
+   * @param[in] thread  The identifier of the thread, different from 0.
+   * @param[in] cbk     The callback of the accesses of the other owners, or
+   *                    nullptr.
+   * @param[in] data    User defined data passed to the callback.
+   */
+  OwnershipFilter(OwnershipShadow &shadow, uint32_t thread,
+                  OwnershipCallback cbk, void *data);
+
+  OwnershipFilter(const OwnershipFilter &) = delete;
+  OwnershipFilter &operator=(const OwnershipFilter &) = delete;
+
+  /*! Get the identifier of the thread of the filter
+   */
+  inline uint32_t getThread() const { return thread; }
+
+  /*! Handle an access which broke the filter. Used by the generated code of
+   * VM::addOwnershipFilter.
+   *
+   * @param[in] vm        VM instance of the callback.
+   * @param[in] gprState  The GPRState of the callback.
+   * @param[in] fprState  The FPRState of the callback.
+   * @param[in] type      MEMORY_READ or MEMORY_WRITE.
+   *
+   * @return The action returned by the callback.
+   */
+  VMAction handleMiss(VMInstanceRef vm, GPRState *gprState,
+                      FPRState *fprState, MemoryAccessType type);
+};
+
+} // namespace QBDI
+
+#endif // QBDI_OWNERSHIP_H_
@@ -0,0 +1,76 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef QBDI_PLAN_H_
+#define QBDI_PLAN_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "QBDI/Callback.h"
+#include "QBDI/Platform.h"
+#include "QBDI/State.h"
+
+#ifdef __cplusplus
+namespace QBDI {
+#endif
+
+/*! Action of a step of an instrumentation plan
+ */
+typedef enum {
+  _QBDI_EI(PLAN_COUNT_INSTRUCTIONS) = 0, /*!< Count the instructions executed
+                                          * in the functions or the range */
+  _QBDI_EI(PLAN_COUNT_CALLS) = 1,        /*!< Count the executions of the
+                                          * first instruction of the
+                                          * functions or the range */
+  _QBDI_EI(PLAN_COVERAGE) = 2,           /*!< Update a coverage bitmap (see
+                                          * VM::setCoverageBitmap) */
+  _QBDI_EI(PLAN_MEMORY_TRACE) = 3,       /*!< Trace the memory accesses in a
+                                          * buffer (see VM::setMemoryTrace)
+                                          */
+  _QBDI_EI(PLAN_STOP) = 4,               /*!< Stop the runs after a number of
+                                          * instructions (see
+                                          * VM::setInstructionBudget) */
+} PlanAction;
+
+/*! Step of an instrumentation plan. Each action only reads its own fields,
+ * the other ones can be left to 0.
+ */
+typedef struct {
+  PlanAction action;       /*!< The action of the step */
+  const char *function;    /*!< PLAN_COUNT_*: the name of the functions of the
+                            * step, or NULL to use the range */
+  rword start;             /*!< PLAN_COUNT_*: start of the range */
+  rword end;               /*!< PLAN_COUNT_*: end of the range */
+  uint64_t *counter;       /*!< PLAN_COUNT_*: the counter incremented by the
+                            * generated code */
+  uint8_t *bitmap;         /*!< PLAN_COVERAGE: the coverage bitmap */
+  CoverageMode coverage;   /*!< PLAN_COVERAGE: the kind of coverage */
+  MemoryAccessType memory; /*!< PLAN_MEMORY_TRACE: the accesses to trace */
+  MemoryTraceCallback cbk; /*!< PLAN_MEMORY_TRACE: the callback of a full
+                            * buffer */
+  void *data;              /*!< PLAN_MEMORY_TRACE: the data of the callback */
+  size_t size;             /*!< PLAN_COVERAGE: the size of the bitmap,
+                            * PLAN_MEMORY_TRACE: the number of entries of the
+                            * buffer, PLAN_STOP: the number of instructions */
+} PlanStep;
+
+#ifdef __cplusplus
+} // namespace QBDI
+#endif
+
+#endif // QBDI_PLAN_H_
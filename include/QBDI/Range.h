@@ -18,6 +18,7 @@
 #ifndef QBDI_RANGE_H_
 #define QBDI_RANGE_H_
 
+#include <algorithm>
 #include <ostream>
 #include <vector>
 
@@ -128,6 +129,54 @@ class RangeSet {
 private:
   std::vector<Range<T>> ranges;
 
+  // The ranges are sorted, disjoint and not adjacent: their ends are sorted
+  // too and the lookups are binary searches.
+
+  // index of the first range with an end greater than t
+  size_t firstEndAbove(const T t) const {
+    return std::upper_bound(
+               ranges.begin(), ranges.end(), t,
+               [](const T v, const Range<T> &r) { return v < r.end(); }) -
+           ranges.begin();
+  }
+
+  // index of the first range with an end greater or equal to t
+  size_t firstEndFrom(const T t) const {
+    return std::lower_bound(
+               ranges.begin(), ranges.end(), t,
+               [](const Range<T> &r, const T v) { return r.end() < v; }) -
+           ranges.begin();
+  }
+
+  // merge ranges sorted by their start in one pass
+  template <typename It>
+  void mergeSorted(It first, It last) {
+    std::vector<Range<T>> merged;
+    merged.reserve(ranges.size() + (last - first));
+    auto append = [&merged](const Range<T> &r) {
+      if (r.end() <= r.start()) {
+        return;
+      }
+      if (not merged.empty() and r.start() <= merged.back().end()) {
+        if (merged.back().end() < r.end()) {
+          merged.back().setEnd(r.end());
+        }
+      } else {
+        merged.push_back(r);
+      }
+    };
+    auto cur = ranges.cbegin();
+    while (cur != ranges.cend() or first != last) {
+      if (first == last or
+          (cur != ranges.cend() and cur->start() <= first->start())) {
+        append(*cur++);
+      } else {
+        append(*first++);
+      }
+    }
+    ranges.swap(merged);
+  }
+
 public:
   RangeSet() {}
 
@@ -142,39 +191,18 @@ public:
   }
 
   bool contains(const T t) const {
-    for (const Range<T> &r : ranges) {
-      if (r.contains(t)) {
-        return true;
-      }
-      if (r.start() > t) {
-        return false;
-      }
-    }
-    return false;
+    size_t i = firstEndAbove(t);
+    return i < ranges.size() && ranges[i].contains(t);
   }
 
   bool contains(const Range<T> &t) const {
-    for (const Range<T> &r : ranges) {
-      if (r.contains(t)) {
-        return true;
-      }
-      if (r.start() > t.end()) {
-        return false;
-      }
-    }
-    return false;
+    size_t i = firstEndFrom(t.end());
+    return i < ranges.size() && ranges[i].contains(t);
   }
 
   bool overlaps(const Range<T> &t) const {
-    for (const Range<T> &r : ranges) {
-      if (r.overlaps(t)) {
-        return true;
-      }
-      if (r.end() < t.start()) {
-        return false;
-      }
-    }
-    return false;
+    size_t i = firstEndAbove(t.start());
+    return i < ranges.size() && ranges[i].overlaps(t);
   }
 
   void add(const Range<T> &t) {
@@ -187,16 +215,14 @@ public:
     }
 
     // Find start in sorted range list
-    for (i = 0; i < ranges.size(); i++) {
-      if (ranges[i].end() >= t.start()) {
-        // Add a new range before ranges[i]
-        if (ranges[i].start() > t.start()) {
-          ranges.insert(ranges.begin() + i, t);
-        }
-        // else extend ranges[i]
-        r = i;
-        break;
+    i = firstEndFrom(t.start());
+    if (i < ranges.size()) {
+      // Add a new range before ranges[i]
+      if (ranges[i].start() > t.start()) {
+        ranges.insert(ranges.begin() + i, t);
       }
+      // else extend ranges[i]
+      r = i;
     }
     // If no range to extend or insert before was found
     if (i == ranges.size()) {
@@ -224,8 +250,28 @@ public:
   }
 
   void add(const RangeSet<T> &t) {
-    for (const Range<T> &r : t.getRanges()) {
-      add(r);
+    if (t.ranges.size() == 1) {
+      add(t.ranges[0]);
+    } else if (not t.ranges.empty()) {
+      mergeSorted(t.ranges.cbegin(), t.ranges.cend());
+    }
+  }
+
+  /*! Add a list of ranges in a single merge, faster than adding them one by
+   * one when the list is sorted by the start of the ranges.
+   *
+   * @param[in] t  The ranges to add, which may overlap.
+   */
+  void addAll(const std::vector<Range<T>> &t) {
+    auto byStart = [](const Range<T> &a, const Range<T> &b) {
+      return a.start() < b.start();
+    };
+    if (std::is_sorted(t.begin(), t.end(), byStart)) {
+      mergeSorted(t.cbegin(), t.cend());
+    } else {
+      std::vector<Range<T>> sorted = t;
+      std::sort(sorted.begin(), sorted.end(), byStart);
+      mergeSorted(sorted.cbegin(), sorted.cend());
     }
   }
 
@@ -239,27 +285,23 @@ public:
     }
 
     // Find deletion start
-    for (i = 0; i < ranges.size(); i++) {
-      if (ranges[i].end() >= t.start()) {
-        // start inside a range
-        if (ranges[i].start() < t.start()) {
-          // Split a range
-          if (t.end() < ranges[i].end()) {
-            ranges.insert(ranges.begin() + i,
-                          Range<T>(ranges[i].start(), t.start()));
-            ranges[i + 1].setStart(t.end());
-            return;
-          }
-          // Truncate a range
-          else {
-            ranges[i].setEnd(t.start());
-            r = i + 1;
-            break;
-          }
+    i = firstEndFrom(t.start());
+    if (i < ranges.size()) {
+      // start inside a range
+      if (ranges[i].start() < t.start()) {
+        // Split a range
+        if (t.end() < ranges[i].end()) {
+          ranges.insert(ranges.begin() + i,
+                        Range<T>(ranges[i].start(), t.start()));
+          ranges[i + 1].setStart(t.end());
+          return;
         }
+        // Truncate a range
+        ranges[i].setEnd(t.start());
+        r = i + 1;
+      } else {
         // start before a range
         r = i;
-        break;
       }
     }
     // If no range to delete was found
@@ -280,25 +322,50 @@ public:
   }
 
   void remove(const RangeSet<T> &t) {
-    for (const Range<T> &r : t.getRanges()) {
-      remove(r);
+    if (t.ranges.size() == 1) {
+      remove(t.ranges[0]);
+      return;
     }
+    // subtract the two sorted lists in one pass
+    std::vector<Range<T>> kept;
+    size_t j = 0;
+    for (const Range<T> &r : ranges) {
+      T start = r.start();
+      while (j < t.ranges.size() and t.ranges[j].end() <= start) {
+        j++;
+      }
+      // a removed range which ends after r may also cut the next range
+      for (; j < t.ranges.size() and t.ranges[j].start() < r.end(); j++) {
+        if (start < t.ranges[j].start()) {
+          kept.emplace_back(start, t.ranges[j].start());
+        }
+        start = t.ranges[j].end();
+        if (r.end() <= start) {
+          break;
+        }
+      }
+      if (start < r.end()) {
+        kept.emplace_back(start, r.end());
+      }
+    }
+    ranges.swap(kept);
   }
 
   void intersect(const RangeSet<T> &t) {
-    RangeSet<T> intersected;
-    for (size_t i = 0; i < ranges.size(); i++) {
-      if (t.contains(ranges[i])) {
-        intersected.add(ranges[i]);
+    std::vector<Range<T>> intersected;
+    size_t i = 0;
+    size_t j = 0;
+    while (i < ranges.size() and j < t.ranges.size()) {
+      if (ranges[i].overlaps(t.ranges[j])) {
+        intersected.push_back(ranges[i].intersect(t.ranges[j]));
+      }
+      if (ranges[i].end() < t.ranges[j].end()) {
+        i++;
       } else {
-        for (const Range<T> &r : t.getRanges()) {
-          if (r.overlaps(ranges[i])) {
-            intersected.add(r.intersect(ranges[i]));
-          }
-        }
+        j++;
       }
     }
-    ranges = intersected.getRanges();
+    ranges.swap(intersected);
   }
 
   void intersect(const Range<T> &t) {
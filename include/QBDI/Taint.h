@@ -0,0 +1,150 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef QBDI_TAINT_H_
+#define QBDI_TAINT_H_
+
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "QBDI/Callback.h"
+#include "QBDI/Platform.h"
+#include "QBDI/State.h"
+
+namespace QBDI {
+
+// Forward declaration of private ShadowMemory
+class ShadowMemory;
+
+/*! Taint label of a byte. Each bit is a source of taint, the label of a
+ * result is the union of the labels of its operands. 0 is untainted.
+ */
+typedef uint8_t TaintLabel;
+
+/*! Policy event of the taint tracking
+ */
+typedef enum {
+  _QBDI_EI(TAINT_BRANCH) = 1,  /*!< The condition or the target of a branch is
+                                * tainted */
+  _QBDI_EI(TAINT_POINTER) = 2, /*!< A register used to compute the address of
+                                * a memory access is tainted */
+} TaintEvent;
+
+/*! Callback of a policy event of the taint tracking, called after the
+ * instruction.
+ *
+ * @param[in] vm        VM instance of the callback.
+ * @param[in] gprState  A structure containing the state of the General
+ *                      Purpose Registers. Modifying it affects the VM
+ *                      execution accordingly.
+ * @param[in] fprState  A structure containing the state of the Floating Point
+ *                      Registers. Modifying it affects the VM execution
+ *                      accordingly.
+ * @param[in] event     The policy event.
+ * @param[in] label     The label of the tainted condition, target or address.
+ * @param[in] data      User defined data which can be defined when
+ *                      registering the callback.
+ *
+ * @return              The callback result used to signal subsequent
+ *                      actions the VM needs to take.
+ */
+typedef VMAction (*TaintCallback)(VMInstanceRef vm, GPRState *gprState,
+                                  FPRState *fprState, TaintEvent event,
+                                  TaintLabel label, void *data);
+
+/*! Shadow state of a taint tracking. The memory is shadowed byte per byte,
+ * the general purpose registers have one label each and the floating point
+ * registers one label per byte of the FPRState. The stack pointer and the
+ * program counter are never tainted.
+ *
+ * The state is given to VM::addTaintTracking and must outlive the
+ * instrumentation.
+ */
+class QBDI_EXPORT TaintState {
+private:
+  std::unique_ptr<ShadowMemory> memory;
+  TaintLabel gprLabels[NUM_GPR];
+  TaintLabel fprLabels[sizeof(FPRState)];
+  TaintLabel flagsLabel;
+  TaintCallback cbk;
+  void *data;
+
+  friend class VM;
+
+public:
+  TaintState();
+  ~TaintState();
+
+  TaintState(const TaintState &) = delete;
+  TaintState &operator=(const TaintState &) = delete;
+
+  /*! Set the label of a memory range
+   *
+   * @param[in] address  Start of the range
+   * @param[in] size     Size of the range in bytes
+   * @param[in] label    The label of the bytes, 0 to untaint them
+   */
+  void setMemoryLabel(rword address, rword size, TaintLabel label);
+
+  /*! Get the union of the labels of a memory range
+   *
+   * @param[in] address  Start of the range
+   * @param[in] size     Size of the range in bytes
+   */
+  TaintLabel getMemoryLabel(rword address, rword size = 1) const;
+
+  /*! Set the label of a general purpose register
+   *
+   * @param[in] reg    Index of the register in the GPRState
+   * @param[in] label  The label of the register
+   */
+  void setRegisterLabel(unsigned reg, TaintLabel label);
+
+  /*! Get the label of a general purpose register
+   *
+   * @param[in] reg    Index of the register in the GPRState
+   */
+  TaintLabel getRegisterLabel(unsigned reg) const;
+
+  /*! Get the label of the flags
+   */
+  inline TaintLabel getFlagsLabel() const { return flagsLabel; }
+
+  /*! Get the size in bytes of the allocated memory shadow
+   */
+  size_t getShadowSize() const;
+
+  /*! Untaint the memory and the registers
+   */
+  void clear();
+
+  /*! Propagate the labels of the current instruction. Used by the
+   * instrumentation of VM::addTaintTracking.
+   *
+   * @param[in] vm        VM instance of the callback.
+   * @param[in] gprState  The GPRState of the callback.
+   * @param[in] fprState  The FPRState of the callback.
+   *
+   * @return The action returned by the policy callbacks.
+   */
+  VMAction propagate(VMInstanceRef vm, GPRState *gprState, FPRState *fprState);
+};
+
+} // namespace QBDI
+
+#endif // QBDI_TAINT_H_
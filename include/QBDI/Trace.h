@@ -0,0 +1,303 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef QBDI_TRACE_H_
+#define QBDI_TRACE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "QBDI/Callback.h"
+#include "QBDI/Platform.h"
+#include "QBDI/State.h"
+
+#ifdef __cplusplus
+#include <memory>
+#include <string>
+#endif
+
+#ifdef __cplusplus
+namespace QBDI {
+
+class TraceWriter;
+class TraceReader;
+using TraceWriterRef = TraceWriter *;
+using TraceReaderRef = TraceReader *;
+
+extern "C" {
+#else
+typedef void *TraceWriterRef;
+typedef void *TraceReaderRef;
+#endif
+
+/*! Type of a record of a binary trace
+ */
+typedef enum {
+  _QBDI_EI(TRACE_SEQUENCE) = 1, /*!< A sequence of instructions is executed */
+  _QBDI_EI(TRACE_MEMORY) = 2,   /*!< A memory access */
+  _QBDI_EI(TRACE_COVERAGE) = 3, /*!< A non zero entry of a coverage bitmap */
+} TraceRecordType;
+
+/*! Record of a binary trace decoded by a TraceReader
+ */
+typedef struct {
+  TraceRecordType type;    /*!< Type of the record */
+  uint32_t blockID;        /*!< TRACE_SEQUENCE: identifier of the sequence in
+                            * the trace, starting at 1 */
+  rword start;             /*!< TRACE_SEQUENCE: start of the sequence.
+                            * TRACE_COVERAGE: index in the bitmap */
+  rword end;               /*!< TRACE_SEQUENCE: end of the sequence
+                            * (excluded). TRACE_COVERAGE: value of the
+                            * entry */
+  MemoryTraceEntry access; /*!< TRACE_MEMORY: the memory access */
+} TraceRecord;
+
+/*! Create a trace writer to a file. The file is truncated.
+ *
+ * @param[in] path      The path of the trace file.
+ * @param[in] capacity  The number of events of the queue to the writer
+ *                      thread.
+ *
+ * @return The writer, NULL if the file cannot be opened.
+ */
+QBDI_EXPORT TraceWriterRef qbdi_newTraceWriter(const char *path,
+                                               size_t capacity);
+
+/*! Create a trace writer to a file descriptor (a pipe or a socket). The
+ * descriptor is duplicated and can be closed by the caller.
+ *
+ * @param[in] fd        The file descriptor of the output.
+ * @param[in] capacity  The number of events of the queue to the writer
+ *                      thread.
+ *
+ * @return The writer, NULL if the descriptor cannot be used.
+ */
+QBDI_EXPORT TraceWriterRef qbdi_newTraceWriterFd(int fd, size_t capacity);
+
+/*! Write the pending events and destroy a trace writer.
+ *
+ * @param[in] writer  The writer to destroy.
+ */
+QBDI_EXPORT void qbdi_deleteTraceWriter(TraceWriterRef writer);
+
+/*! Wait until all the events given to a trace writer are written.
+ *
+ * @param[in] writer  The trace writer.
+ */
+QBDI_EXPORT void qbdi_flushTraceWriter(TraceWriterRef writer);
+
+/*! Add the non zero entries of a coverage bitmap to a trace.
+ *
+ * @param[in] writer  The trace writer.
+ * @param[in] bitmap  The coverage bitmap (see qbdi_setCoverageBitmap).
+ * @param[in] size    The size of the bitmap.
+ */
+QBDI_EXPORT void qbdi_traceWriterAddCoverage(TraceWriterRef writer,
+                                             const uint8_t *bitmap,
+                                             size_t size);
+
+/*! Encode the following sequences of a trace as taken / not taken bits when
+ * they are one of the two last successors of the previous sequence.
+ *
+ * @param[in] writer  The trace writer.
+ * @param[in] enable  Enable or disable the compression.
+ */
+QBDI_EXPORT void qbdi_traceWriterSetCompressedControlFlow(TraceWriterRef writer,
+                                                          bool enable);
+
+/*! Register the callbacks of a trace writer: a SEQUENCE_ENTRY callback and,
+ * if type isn't 0, the memory trace of the VM. The writer must outlive the
+ * instrumentation and the events must be given by a single thread.
+ *
+ * @param[in] writer    The trace writer.
+ * @param[in] instance  The VM to trace.
+ * @param[in] type      The memory accesses to trace, 0 to trace only the
+ *                      sequences.
+ *
+ * @return The id of the SEQUENCE_ENTRY callback (or INVALID_EVENTID).
+ */
+QBDI_EXPORT uint32_t qbdi_attachTraceWriter(TraceWriterRef writer,
+                                            VMInstanceRef instance,
+                                            MemoryAccessType type);
+
+/*! Open a trace for the decoding.
+ *
+ * @param[in] path  The path of the trace file.
+ *
+ * @return The reader, NULL if the file isn't a valid trace.
+ */
+QBDI_EXPORT TraceReaderRef qbdi_newTraceReader(const char *path);
+
+/*! Decode the next record of a trace.
+ *
+ * @param[in]  reader  The trace reader.
+ * @param[out] record  The decoded record.
+ *
+ * @return False at the end of the trace or on a malformed record.
+ */
+QBDI_EXPORT bool qbdi_traceReaderNext(TraceReaderRef reader,
+                                      TraceRecord *record);
+
+/*! Close and destroy a trace reader.
+ *
+ * @param[in] reader  The reader to destroy.
+ */
+QBDI_EXPORT void qbdi_deleteTraceReader(TraceReaderRef reader);
+
+#ifdef __cplusplus
+} // extern "C"
+
+// Forward declaration of private TraceQueue
+class TraceQueue;
+// Forward declaration of private TraceDecoder
+class TraceDecoder;
+
+/*! Binary trace sink. The events are pushed in a single producer single
+ * consumer queue without lock and encoded in a compact format by a writer
+ * thread, the instrumented thread never waits for the output unless the queue
+ * is full.
+ *
+ * The events must be given by a single thread, a VM per thread needs a writer
+ * per thread.
+ */
+class QBDI_EXPORT TraceWriter {
+private:
+  std::unique_ptr<TraceQueue> queue;
+
+public:
+  /*! Create a trace writer to a file. The file is truncated.
+   *
+   * @param[in] path      The path of the trace file.
+   * @param[in] capacity  The number of events of the queue.
+   */
+  TraceWriter(const std::string &path, size_t capacity = 65536);
+
+  /*! Create a trace writer to a file descriptor (a pipe or a socket). The
+   * descriptor is duplicated and can be closed by the caller.
+   *
+   * @param[in] fd        The file descriptor of the output.
+   * @param[in] capacity  The number of events of the queue.
+   */
+  TraceWriter(int fd, size_t capacity = 65536);
+
+  /*! Write the pending events and close the output.
+   */
+  ~TraceWriter();
+
+  TraceWriter(const TraceWriter &) = delete;
+  TraceWriter &operator=(const TraceWriter &) = delete;
+
+  /*! Return true if the output is open. The events of a writer without output
+   * are ignored.
+   */
+  bool isOpen() const;
+
+  /*! Add an executed sequence to the trace.
+   *
+   * @param[in] start  Start of the sequence.
+   * @param[in] end    End of the sequence (excluded).
+   */
+  void addSequence(rword start, rword end);
+
+  /*! Add a memory access to the trace.
+   *
+   * @param[in] access  The memory access.
+   */
+  void addMemoryAccess(const MemoryTraceEntry &access);
+
+  /*! Encode the following sequences as taken / not taken bits, in the style
+   * of the TNT packets of Intel PT. The two last successors of each sequence
+   * are learned in the same order by the writer and the reader: a sequence
+   * which is one of them is written as a bit, the other ones (the first
+   * executions and the indirect targets) are written with their identifier or
+   * their address. The reader doesn't need the code of the modules.
+   *
+   * @param[in] enable  Enable or disable the compression.
+   */
+  void setCompressedControlFlow(bool enable);
+
+  /*! Add the non zero entries of a coverage bitmap to the trace.
+   *
+   * @param[in] bitmap  The coverage bitmap (see VM::setCoverageBitmap).
+   * @param[in] size    The size of the bitmap.
+   */
+  void addCoverage(const uint8_t *bitmap, size_t size);
+
+  /*! Wait until all the events given to the writer are written.
+   */
+  void flush();
+
+  /*! Register the callbacks of the writer: a SEQUENCE_ENTRY callback and, if
+   * type isn't 0, the memory trace of the VM (see VM::setMemoryTrace). The
+   * writer must outlive the instrumentation.
+   *
+   * @param[in] vm    The VM to trace.
+   * @param[in] type  The memory accesses to trace, 0 to trace only the
+   *                  sequences.
+   *
+   * @return The id of the SEQUENCE_ENTRY callback (or
+   *         VMError::INVALID_EVENTID).
+   */
+  uint32_t attach(VM &vm, MemoryAccessType type = MEMORY_READ_WRITE);
+
+  /*! VMCallback of a SEQUENCE_ENTRY event, data must be a TraceWriter.
+   */
+  static VMAction sequenceCB(VMInstanceRef vm, const VMState *vmState,
+                             GPRState *gprState, FPRState *fprState,
+                             void *data);
+
+  /*! MemoryTraceCallback of VM::setMemoryTrace, data must be a TraceWriter.
+   */
+  static VMAction memoryCB(VMInstanceRef vm, const MemoryTraceEntry *entries,
+                           size_t count, void *data);
+};
+
+/*! Decoder of a binary trace written by a TraceWriter.
+ */
+class QBDI_EXPORT TraceReader {
+private:
+  std::unique_ptr<TraceDecoder> decoder;
+
+public:
+  /*! Open a trace file.
+   *
+   * @param[in] path  The path of the trace file.
+   */
+  TraceReader(const std::string &path);
+
+  ~TraceReader();
+
+  TraceReader(const TraceReader &) = delete;
+  TraceReader &operator=(const TraceReader &) = delete;
+
+  /*! Return true if the file is open and has a valid header.
+   */
+  bool isOpen() const;
+
+  /*! Decode the next record of the trace.
+   *
+   * @param[out] record  The decoded record.
+   *
+   * @return False at the end of the trace or on a malformed record.
+   */
+  bool next(TraceRecord &record);
+};
+
+} // namespace QBDI
+#endif
+
+#endif // QBDI_TRACE_H_
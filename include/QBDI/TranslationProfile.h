@@ -0,0 +1,63 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef QBDI_TRANSLATIONPROFILE_H_
+#define QBDI_TRANSLATIONPROFILE_H_
+
+#include <stdint.h>
+
+#include "QBDI/Platform.h"
+
+#ifdef __cplusplus
+namespace QBDI {
+#endif
+
+/*! Cumulative measure of a translation phase
+ */
+typedef struct {
+  uint64_t cycles; /*!< Cycles spent in the phase, including the nested phases
+                    */
+  uint64_t count;  /*!< Number of times the phase was entered */
+  uint64_t bytes;  /*!< Bytes read or written by the phase, if any */
+} ProfilePhase;
+
+/*! Profile of the translation of a VM. The counters are only updated when
+ * QBDI is compiled with QBDI_PROFILE_TRANSLATION, they stay at zero otherwise.
+ */
+typedef struct {
+  ProfilePhase disassembly;   /*!< Disassembly of the original instructions,
+                               * the bytes are the size of the instructions
+                               */
+  ProfilePhase patchRules;    /*!< Generation of the patches by the PatchRules
+                               */
+  ProfilePhase instrRules;    /*!< Application of the InstrRules */
+  ProfilePhase tempManager;   /*!< Allocation of the temporary registers, nested
+                               * in the PatchRules and the InstrRules
+                               */
+  ProfilePhase encoding;      /*!< Encoding of the generated instructions, the
+                               * bytes are the size of the encoded code
+                               */
+  ProfilePhase writeSequence; /*!< Writing of the sequences in the ExecBlocks,
+                               * the bytes are the size of the written code
+                               */
+} TranslationProfile;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // QBDI_TRANSLATIONPROFILE_H_
@@ -23,42 +23,202 @@
 #include <memory>
 #include <stdint.h>
 #include <string>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
 #include "QBDI/Bitmask.h"
+#include "QBDI/CacheStats.h"
 #include "QBDI/Callback.h"
 #include "QBDI/Errors.h"
 #include "QBDI/InstAnalysis.h"
 #include "QBDI/Options.h"
+#include "QBDI/Ownership.h"
+#include "QBDI/Plan.h"
 #include "QBDI/Platform.h"
 #include "QBDI/Range.h"
 #include "QBDI/State.h"
+#include "QBDI/Taint.h"
+#include "QBDI/TranslationProfile.h"
 
 namespace QBDI {
 
 // Forward declaration of engine class
 class Engine;
-// Forward declaration of private memCBInfo
-struct MemCBInfo;
-// Forward declaration of private InstrCBInfo
-struct InstrCBInfo;
+// Forward declaration of private MemCBIndex
+struct MemCBIndex;
+// Forward declaration of private BBMemAccessCBInfo
+struct BBMemAccessCBInfo;
+// Forward declaration of private VMSnapshot
+struct VMSnapshot;
+// Forward declaration of private FunctionHookInfo
+struct FunctionHookInfo;
+
+/*! Owned copy of a callable of a templated instruction callback. The
+ * callable is called by a trampoline instantiated for its type, without
+ * std::function.
+ */
+class InstCbFunctor {
+  void *object;
+  void *(*cloneObject)(const void *);
+  void (*deleteObject)(void *);
+
+public:
+  template <typename F, typename T = typename std::decay<F>::type,
+            typename std::enable_if<not std::is_same<T, InstCbFunctor>::value,
+                                    int>::type = 0>
+  explicit InstCbFunctor(F &&f)
+      : object(new T(std::forward<F>(f))),
+        cloneObject([](const void *o) -> void * {
+          return new T(*static_cast<const T *>(o));
+        }),
+        deleteObject([](void *o) { delete static_cast<T *>(o); }) {}
+
+  InstCbFunctor(const InstCbFunctor &other)
+      : object(other.cloneObject(other.object)),
+        cloneObject(other.cloneObject), deleteObject(other.deleteObject) {}
+
+  InstCbFunctor &operator=(const InstCbFunctor &other) {
+    if (this != &other) {
+      void *copy = other.cloneObject(other.object);
+      deleteObject(object);
+      object = copy;
+      cloneObject = other.cloneObject;
+      deleteObject = other.deleteObject;
+    }
+    return *this;
+  }
+
+  ~InstCbFunctor() { deleteObject(object); }
+
+  void *get() const { return object; }
+
+  template <typename T>
+  static VMAction trampoline(VMInstanceRef vm, GPRState *gprState,
+                             FPRState *fprState, void *data) {
+    return (*static_cast<T *>(data))(vm, gprState, fprState);
+  }
+};
+
+// Result of a call of F as an instruction callback
+template <typename F>
+using InstFunctorResult = decltype(std::declval<F &>()(
+    std::declval<VMInstanceRef>(), std::declval<GPRState *>(),
+    std::declval<FPRState *>()));
+
+template <typename F, typename = void>
+struct IsInstFunctor : std::false_type {};
+
+template <typename F>
+struct IsInstFunctor<F, decltype(void(std::declval<InstFunctorResult<F>>()))>
+    : std::is_convertible<InstFunctorResult<F>, VMAction> {};
+
+// A callable of an instruction callback, but not an InstCbLambda which has
+// its own overloads. The public headers stay usable in C++11.
+template <typename F>
+using EnableIfInstFunctor = typename std::enable_if<
+    IsInstFunctor<typename std::decay<F>::type>::value and
+        not std::is_same<typename std::decay<F>::type, InstCbLambda>::value,
+    int>::type;
+
+class VM;
+
+/*! A call of a function prepared by VM::prepareCall. The stack pointer of the
+ *  GPRState is captured by prepareCall and restored by each invoke: the
+ *  frames of the calls don't drift down the stack. The fake return address
+ *  is never translated, the run stops when it is reached without any stop
+ *  callback, and the cache of the function stays warm between the calls.
+ *  The PreparedCall mustn't outlive (or be used after a move of) its VM.
+ */
+class QBDI_EXPORT PreparedCall {
+private:
+  VM *vm;
+  rword function;
+  uint32_t argNum;
+  rword stackPointer;
+
+  friend class VM;
+
+  PreparedCall(VM *vm, rword function, uint32_t argNum, rword stackPointer)
+      : vm(vm), function(function), argNum(argNum),
+        stackPointer(stackPointer) {}
+
+public:
+  /*! Call the function using the DBI (and the current state of the VM).
+   *  This method mustn't be called if the VM already runs.
+   *
+   * @param[in] [retval]  Pointer to the returned value (optional).
+   * @param[in] args      An array of the arguments of the prepared call.
+   *
+   * @return  True if at least one block has been executed, false if no stack
+   *          pointer was set when the call was prepared.
+   */
+  bool invoke(rword *retval, const rword *args);
+
+  /*! Call the function using the DBI (and the current state of the VM).
+   *  This method mustn't be called if the VM already runs.
+   *
+   * @param[in] [retval]  Pointer to the returned value (optional).
+   * @param[in] args      The arguments, the list must have the number of
+   *                      arguments of the prepared call.
+   *
+   * @return  True if at least one block has been executed, false if no stack
+   *          pointer was set when the call was prepared.
+   */
+  bool invoke(rword *retval, const std::vector<rword> &args = {});
+
+  /*! Get the number of arguments of the prepared call.
+   */
+  uint32_t getArgNum() const { return argNum; }
+};
 
 class QBDI_EXPORT VM {
 private:
   // Private internal engine
   std::unique_ptr<Engine> engine;
   uint8_t memoryLoggingLevel;
-  std::unique_ptr<std::vector<std::pair<uint32_t, MemCBInfo>>> memCBInfos;
+  // the modifiers of the recording of the reads and of the writes
+  // (MEMORY_ADDRESS_ONLY, MEMORY_NO_STACK, MEMORY_NO_FRAME) and the ids of the
+  // rules recorded with modifiers
+  uint8_t readRecordModifiers;
+  uint8_t writeRecordModifiers;
+  std::vector<std::pair<uint32_t, MemoryAccessType>> restrictedRecordIDs;
+  // the ranges of recordMemoryAccessRange, for the types which aren't
+  // recorded on all the instructions
+  RangeSet<rword> recordedReadRanges;
+  RangeSet<rword> recordedWriteRanges;
+  std::vector<std::pair<uint32_t, MemoryAccessType>> rangeRecordIDs;
+  std::unique_ptr<MemCBIndex> memCBInfos;
   uint32_t memCBID;
   uint32_t memReadGateCBID;
   uint32_t memWriteGateCBID;
+  // stop callback of runFor, disabled between the slices
+  uint32_t sliceStopCBID = VMError::INVALID_EVENTID;
+  rword sliceStop = 0;
+  std::unique_ptr<
+      std::vector<std::pair<uint32_t, std::unique_ptr<BBMemAccessCBInfo>>>>
+      bbMemAccessCBInfos;
+  // hooks of addFunctionHook, by the id of their entry gate
   std::unique_ptr<
-      std::vector<std::pair<uint32_t, std::unique_ptr<InstrCBInfo>>>>
-      instrCBInfos;
+      std::vector<std::pair<uint32_t, std::unique_ptr<FunctionHookInfo>>>>
+      functionHooks;
   std::forward_list<std::pair<uint32_t, VMCbLambda>> vmCBData;
   std::forward_list<std::pair<uint32_t, InstCbLambda>> instCBData;
   std::forward_list<std::pair<uint32_t, InstrRuleCbLambda>> instrRuleCBData;
+  std::forward_list<std::pair<uint32_t, InstrRuleFillCbLambda>>
+      instrRuleFillCBData;
+  std::forward_list<std::pair<uint32_t, InstrRuleBBCbLambda>> instrRuleBBCBData;
+  std::forward_list<std::pair<uint32_t, uint64_t>> counterData;
+  std::forward_list<std::pair<uint32_t, InstCbFunctor>> functorCBData;
+  // reused by the getInstMemoryAccess and getBBMemoryAccess with a buffer
+  mutable std::vector<MemoryAccess> memAccessScratch;
+  // state restored by restoreSnapshot
+  std::unique_ptr<VMSnapshot> snapshot;
+
+  void analyseInstMemoryAccess(std::vector<MemoryAccess> &dest) const;
+  void analyseBBMemoryAccess(std::vector<MemoryAccess> &dest) const;
+
+  friend class PreparedCall;
 
 public:
   /*! Construct a new VM for a given CPU with specific attributes
@@ -144,10 +304,40 @@ public:
    * @param[in] options  the new options of the VM
    *
    * If the new options is different that the current ones, the cache will be
-   * clear.
+   * clear. The options which only change the analysis of the instructions
+   * (OPT_ATT_SYNTAX, OPT_ENABLE_SHARED_ANALYSIS) only drop the cached
+   * InstAnalysis, and the options only read when the VM runs or patches a new
+   * basic block (OPT_ENABLE_ASYNC_PATCH, OPT_ENABLE_SHARED_PATCHES,
+   * OPT_ENABLE_SUPERBLOCK, OPT_BYPASS_PLT, OPT_ENABLE_REENTRY,
+   * OPT_ENABLE_MEMCB_PAGE_WATCH) keep the cache.
    */
   void setOptions(Options options);
 
+  /*! Get the size of the code and data blocks used to store the instrumented
+   * code.
+   *
+   * @param[out] codeSize  Size in bytes of the code blocks (0 for one page)
+   * @param[out] dataSize  Size in bytes of the data blocks (0 for one page)
+   */
+  void getExecBlockSize(uint32_t *codeSize, uint32_t *dataSize) const;
+
+  /*! Set the size of the code and data blocks used to store the instrumented
+   * code. The sizes are rounded up to the page size. Larger blocks reduce the
+   * fragmentation of the cache for large or heavily instrumented basic blocks.
+   * This method mustn't be called when the VM runs.
+   *
+   * @param[in] codeSize  Size in bytes of the code blocks, up to 64KiB
+   *                      (0 for one page)
+   * @param[in] dataSize  Size in bytes of the data blocks, up to 512KiB
+   *                      (0 for one page)
+   *
+   * @return True if the sizes are valid and have been applied.
+   *
+   * If the new sizes are different that the current ones, the cache will be
+   * clear.
+   */
+  bool setExecBlockSize(uint32_t codeSize, uint32_t dataSize);
+
   /*! Add an address range to the set of instrumented address ranges.
    *
    * @param[in] start  Start address of the range (included).
@@ -173,6 +363,38 @@ public:
    */
   bool addInstrumentedModuleFromAddr(rword addr);
 
+  /*! Add the address ranges of the functions with a name to the set of
+   * instrumented address ranges. The calls from the functions to the
+   * uninstrumented code are executed natively and the execution comes back
+   * to the VM when they return. Only the symbol tables of the modules on
+   * Linux and Android are used.
+   *
+   * @param[in] name  The name of the function symbols.
+   *
+   * @return  True if at least one range was added to the instrumented ranges.
+   */
+  bool addInstrumentedFunction(const std::string &name);
+
+  /*! Add the address range of the function which contains an address to the
+   * set of instrumented address ranges (see addInstrumentedFunction).
+   *
+   * @param[in] addr  An address of the function.
+   *
+   * @return  True if a range was added to the instrumented ranges.
+   */
+  bool addInstrumentedFunctionFromAddr(rword addr);
+
+  /*! Add the address ranges of the functions whose name matches a POSIX
+   * extended regular expression to the set of instrumented address ranges
+   * (see addInstrumentedFunction). A part of the name matches, unless the
+   * expression is anchored with ^ and $.
+   *
+   * @param[in] pattern  The regular expression.
+   *
+   * @return  True if at least one range was added to the instrumented ranges.
+   */
+  bool addInstrumentedFunctionRegex(const std::string &pattern);
+
   /*! Adds all the executable memory maps to the instrumented range set.
    * @return  True if at least one range was added to the instrumented ranges.
    */
@@ -209,6 +431,27 @@ public:
    */
   void removeAllInstrumentedRanges();
 
+  /*! Track the modules loaded and unloaded by the process during the
+   * execution, without polling the memory maps. The loader is checked when
+   * the execution reaches an address that isn't instrumented and when the
+   * ExecBroker returns from the native code. The new modules are added to the
+   * instrumented ranges before their first instruction with
+   * MODULE_TRACK_LOAD. The unloaded modules are removed from the instrumented
+   * ranges and from the cache with MODULE_TRACK_UNLOAD.
+   *
+   * The modules are tracked on Linux and macOS only.
+   *
+   * @param[in] tracking  The policy, NO_MODULE_TRACKING to disable the
+   *                      tracking.
+   */
+  void setModuleTracking(ModuleTracking tracking);
+
+  /*! Get the policy of the tracking of the modules.
+   *
+   * @return  The policy set with setModuleTracking.
+   */
+  ModuleTracking getModuleTracking() const;
+
   /*! Start the execution by the DBI.
    *  This method mustn't be called if the VM already runs.
    *
@@ -219,6 +462,52 @@ public:
    */
   bool run(rword start, rword stop);
 
+  /*! Start the execution by the DBI, until one of the stop addresses is
+   *  reached. The sequences of the stops are translated with a break to the
+   *  host before the stop instruction, the linked sequences and the
+   *  superblocks don't go through them. This method mustn't be called if the
+   *  VM already runs.
+   *
+   * @param[in] start  Address of the first instruction to execute.
+   * @param[in] stops  Stop the execution when one of these instructions is
+   *                   reached. The set is expected to be small (the return
+   *                   sites of a harness, the exit stubs, ...).
+   *
+   * @return  True if at least one block has been executed.
+   */
+  bool runUntil(rword start, const std::vector<rword> &stops);
+
+  /*! Run a slice of the execution by the DBI, from the PC of the current
+   *  GPRState. The slice stops at the entry of the first sequence which
+   *  doesn't fit in the budget: the next slice resumes from a cached
+   *  sequence. A first sequence larger than the budget is executed entirely.
+   *  The contexts of several tasks can be switched with setGPRState and
+   *  setFPRState between the slices, they share the translation cache.
+   *  The first slice flushes the cache, the budget given to
+   *  setInstructionBudget isn't consumed by the slices. This method mustn't
+   *  be called if the VM already runs.
+   *
+   * @param[in] stop    Stop the execution when this instruction is reached.
+   * @param[in] budget  The number of instructions of the slice.
+   *
+   * @return  SLICE_EXPIRED or SLICE_STOPPED if the execution can be resumed
+   *          with another slice, SLICE_FINISHED if the stop is reached,
+   *          SLICE_NOT_RUN if the PC isn't instrumented.
+   */
+  SliceStatus runFor(rword stop, rword budget);
+
+  /*! Execute the instruction at the PC of the current GPRState and return,
+   *  the GPRState and the FPRState are updated. The VM must have the option
+   *  OPT_SINGLE_STEP. The InstCallbacks of the instruction are called, the
+   *  VMEvent callbacks aren't. A call to a non-instrumented function is
+   *  executed until its return. This method mustn't be called if the VM
+   *  already runs.
+   *
+   * @return  True if the instruction has been executed, false if the VM
+   *          doesn't have OPT_SINGLE_STEP or the PC can't be executed.
+   */
+  bool step();
+
   /*! Call a function using the DBI (and its current state).
    *  This method mustn't be called if the VM already runs.
    *
@@ -266,6 +555,74 @@ public:
    */
   bool callV(rword *retval, rword function, uint32_t argNum, va_list ap);
 
+  /*! Prepare the repeated calls of a function using the DBI. The stack
+   *  pointer of the current GPRState is the stack of each call, a virtual
+   *  stack must be set before the call is prepared.
+   *
+   * @param[in] function   Address of the function start instruction.
+   * @param[in] argNum     The number of arguments of each call.
+   *
+   * @return  The prepared call.
+   *
+   * @details Example:
+   *
+   *     QBDI::PreparedCall target = vm->prepareCall(funcPtr, 2);
+   *     for (QBDI::rword i = 0; i < 1000; i++) {
+   *       rword retVal;
+   *       target.invoke(&retVal, {i, 42});
+   *     }
+   *
+   */
+  PreparedCall prepareCall(rword function, uint32_t argNum);
+
+  /*! Limit the number of instructions executed by the next runs. The
+   *  generated code subtracts the number of instructions of each sequence
+   *  from the budget at its entry, without any callback. When the budget
+   *  ends in a sequence, the sequence is instrumented again to stop the run
+   *  before the first instruction over the budget, with PC set to this
+   *  instruction. The translation cache is flushed when the budget is enabled
+   *  or disabled. This method mustn't be called if the VM already runs.
+   *
+   *  The instructions are counted when their sequence is entered: an
+   *  instruction skipped by a callback which changes the PC is still counted.
+   *  The instructions executed natively through the ExecBroker aren't counted.
+   *
+   * @param[in] budget  The number of instructions, 0 to disable the budget.
+   *
+   * @return True if the budget has been configured.
+   */
+  bool setInstructionBudget(rword budget);
+
+  /*! Get the number of instructions left in the budget. The difference with
+   *  the budget given to setInstructionBudget is the number of instructions
+   *  executed since.
+   *
+   * @return The number of instructions left, 0 if the budget is exhausted or
+   *         disabled.
+   */
+  rword getInstructionBudget() const;
+
+  /*! Enable or disable the test of the stop requests by the generated code.
+   *  The test is a load and a branch at the entry of each sequence, without
+   *  any callback if no stop is requested. Without the polling, a stop
+   *  request is only seen when the execution returns to the VM between two
+   *  sequences. The translation cache is flushed. This method mustn't be
+   *  called if the VM already runs.
+   *
+   * @param[in] enable  Enable or disable the polling.
+   *
+   * @return True if the polling has been configured.
+   */
+  bool setStopPolling(bool enable);
+
+  /*! Request the run of the VM to stop at the entry of the next sequence,
+   *  with PC set to the first instruction of the sequence. This method may
+   *  be called from any thread. The request is cleared when a run stops
+   *  because of it: a request made when the VM doesn't run stops the next
+   *  run before its first instruction.
+   */
+  void requestStop();
+
   /*! Add a custom instrumentation rule to the VM.
    *
    * @param[in] cbk       A function pointer to the callback
@@ -278,7 +635,17 @@ public:
    */
   uint32_t addInstrRule(InstrRuleCallback cbk, AnalysisType type, void *data);
 
-  // register C like InstrRuleCallback
+  /*! Add a custom instrumentation rule to the VM. The callback adds the
+   * callbacks to apply in an output vector, reused between the instructions.
+   *
+   * @param[in] cbk       A function pointer to the callback
+   * @param[in] type      Analyse type needed for this instruction function
+   *                      pointer to the callback
+   * @param[in] data      User defined data passed to the callback.
+   *
+   * @return The id of the registered instrumentation
+   * (or VMError::INVALID_EVENTID in case of failure).
+   */
   uint32_t addInstrRule(InstrRuleCallbackC cbk, AnalysisType type, void *data);
 
   /*! Add a custom instrumentation rule to the VM.
@@ -293,6 +660,19 @@ public:
   uint32_t addInstrRule(const InstrRuleCbLambda &cbk, AnalysisType type);
   uint32_t addInstrRule(InstrRuleCbLambda &&cbk, AnalysisType type);
 
+  /*! Add a custom instrumentation rule to the VM. The lambda adds the
+   * callbacks to apply in an output vector, reused between the instructions.
+   *
+   * @param[in] cbk       A lambda function to the callback
+   * @param[in] type      Analyse type needed for this instruction function
+   *                      pointer to the callback
+   *
+   * @return The id of the registered instrumentation
+   * (or VMError::INVALID_EVENTID in case of failure).
+   */
+  uint32_t addInstrRule(const InstrRuleFillCbLambda &cbk, AnalysisType type);
+  uint32_t addInstrRule(InstrRuleFillCbLambda &&cbk, AnalysisType type);
+
   /*! Add a custom instrumentation rule to the VM on a specify range
    *
    * @param[in] start     Begin of the range of address where apply the rule
@@ -328,6 +708,13 @@ public:
   uint32_t addInstrRuleRange(rword start, rword end, InstrRuleCbLambda &&cbk,
                              AnalysisType type);
 
+  // register InstrRuleFillCbLambda
+  uint32_t addInstrRuleRange(rword start, rword end,
+                             const InstrRuleFillCbLambda &cbk,
+                             AnalysisType type);
+  uint32_t addInstrRuleRange(rword start, rword end,
+                             InstrRuleFillCbLambda &&cbk, AnalysisType type);
+
   /*! Add a custom instrumentation rule to the VM on a specify set of range
    *
    * @param[in] range     Range of address where apply the rule
@@ -342,6 +729,10 @@ public:
   uint32_t addInstrRuleRangeSet(RangeSet<rword> range, InstrRuleCallback cbk,
                                 AnalysisType type, void *data);
 
+  // register C like InstrRuleCallback
+  uint32_t addInstrRuleRangeSet(RangeSet<rword> range, InstrRuleCallbackC cbk,
+                                AnalysisType type, void *data);
+
   /*! Add a custom instrumentation rule to the VM on a specify set of range
    *
    * @param[in] range     Range of address where apply the rule
@@ -358,6 +749,66 @@ public:
   uint32_t addInstrRuleRangeSet(RangeSet<rword> range, InstrRuleCbLambda &&cbk,
                                 AnalysisType type);
 
+  // register InstrRuleFillCbLambda
+  uint32_t addInstrRuleRangeSet(RangeSet<rword> range,
+                                const InstrRuleFillCbLambda &cbk,
+                                AnalysisType type);
+  uint32_t addInstrRuleRangeSet(RangeSet<rword> range,
+                                InstrRuleFillCbLambda &&cbk, AnalysisType type);
+
+  /*! Add a custom instrumentation rule to the VM, called once for each basic
+   * block with the analyses of all its instructions. A basic block which is
+   * partially in the cache or which doesn't fit in an ExecBlock is given in
+   * several parts.
+   *
+   * @param[in] cbk       A function pointer to the callback
+   * @param[in] type      Analyse type needed for the instructions of the
+   *                      basic block
+   * @param[in] data      User defined data passed to the callback.
+   *
+   * @return The id of the registered instrumentation
+   * (or VMError::INVALID_EVENTID in case of failure).
+   */
+  uint32_t addBBInstrRule(InstrRuleBBCallback cbk, AnalysisType type,
+                          void *data);
+
+  /*! Add a custom instrumentation rule to the VM, called once for each basic
+   * block with the analyses of all its instructions.
+   *
+   * @param[in] cbk       A lambda function to the callback
+   * @param[in] type      Analyse type needed for the instructions of the
+   *                      basic block
+   *
+   * @return The id of the registered instrumentation
+   * (or VMError::INVALID_EVENTID in case of failure).
+   */
+  uint32_t addBBInstrRule(const InstrRuleBBCbLambda &cbk, AnalysisType type);
+  uint32_t addBBInstrRule(InstrRuleBBCbLambda &&cbk, AnalysisType type);
+
+  /*! Add a custom instrumentation rule to the VM on a specify range, called
+   * once for each basic block with the analyses of its instructions in the
+   * range.
+   *
+   * @param[in] start     Begin of the range of address where apply the rule
+   * @param[in] end       End of the range of address where apply the rule
+   * @param[in] cbk       A function pointer to the callback
+   * @param[in] type      Analyse type needed for the instructions of the
+   *                      basic block
+   * @param[in] data      User defined data passed to the callback.
+   *
+   * @return The id of the registered instrumentation (or
+   * VMError::INVALID_EVENTID in case of failure).
+   */
+  uint32_t addBBInstrRuleRange(rword start, rword end, InstrRuleBBCallback cbk,
+                               AnalysisType type, void *data);
+
+  // register InstrRuleBBCbLambda
+  uint32_t addBBInstrRuleRange(rword start, rword end,
+                               const InstrRuleBBCbLambda &cbk,
+                               AnalysisType type);
+  uint32_t addBBInstrRuleRange(rword start, rword end,
+                               InstrRuleBBCbLambda &&cbk, AnalysisType type);
+
   /*! Register a callback event if the instruction matches the mnemonic.
    *
    * @param[in] mnemonic   Mnemonic to match.
@@ -420,6 +871,31 @@ public:
   uint32_t addCodeCB(InstPosition pos, InstCbLambda &&cbk,
                      int priority = PRIORITY_DEFAULT);
 
+  /*! Register a callable for every instruction executed. The callable is
+   * called directly by a trampoline instantiated for its type, without the
+   * indirection of std::function. It must be copyable, the copies of the VM
+   * have their own copy.
+   *
+   * @param[in] pos      Relative position of the callback (PREINST / POSTINST).
+   * @param[in] cbk      A callable with the signature of InstCbLambda
+   * @param[in] priority The priority of the callback.
+   *
+   * @return The id of the registered instrumentation (or
+   * VMError::INVALID_EVENTID in case of failure).
+   */
+  template <typename F, EnableIfInstFunctor<F> = 0>
+  uint32_t addCodeCB(InstPosition pos, F &&cbk,
+                     int priority = PRIORITY_DEFAULT) {
+    using T = typename std::decay<F>::type;
+    functorCBData.emplace_front(0xffffffff,
+                                InstCbFunctor(std::forward<F>(cbk)));
+    auto &el = functorCBData.front();
+    uint32_t id = addCodeCB(pos, InstCbFunctor::trampoline<T>,
+                            el.second.get(), priority);
+    el.first = id;
+    return id;
+  }
+
   /*! Register a callback for when a specific address is executed.
    *
    * @param[in] address  Code address which will trigger the callback.
@@ -450,6 +926,67 @@ public:
   uint32_t addCodeAddrCB(rword address, InstPosition pos, InstCbLambda &&cbk,
                          int priority = PRIORITY_DEFAULT);
 
+  /*! Register a callable for when a specific address is executed, called
+   * without std::function (see addCodeCB).
+   *
+   * @param[in] address  Code address which will trigger the callback.
+   * @param[in] pos      Relative position of the callback (PREINST / POSTINST).
+   * @param[in] cbk      A callable with the signature of InstCbLambda
+   * @param[in] priority The priority of the callback.
+   *
+   * @return The id of the registered instrumentation (or
+   * VMError::INVALID_EVENTID in case of failure).
+   */
+  template <typename F, EnableIfInstFunctor<F> = 0>
+  uint32_t addCodeAddrCB(rword address, InstPosition pos, F &&cbk,
+                         int priority = PRIORITY_DEFAULT) {
+    using T = typename std::decay<F>::type;
+    functorCBData.emplace_front(0xffffffff,
+                                InstCbFunctor(std::forward<F>(cbk)));
+    auto &el = functorCBData.front();
+    uint32_t id = addCodeAddrCB(address, pos, InstCbFunctor::trampoline<T>,
+                                el.second.get(), priority);
+    el.first = id;
+    return id;
+  }
+
+  /*! Register a callback for when one of the addresses is executed. A single
+   * instrumentation is registered for all the addresses, which is a lot
+   * cheaper to translate than an addCodeAddrCB per address. The matched
+   * address is given by getInstAnalysis().
+   *
+   * @param[in] addresses Code addresses which will trigger the callback.
+   * @param[in] pos       Relative position of the callback
+   *                      (PREINST / POSTINST).
+   * @param[in] cbk       A function pointer to the callback.
+   * @param[in] data      User defined data passed to the callback.
+   * @param[in] priority  The priority of the callback.
+   *
+   * @return The id of the registered instrumentation (or
+   * VMError::INVALID_EVENTID in case of failure).
+   */
+  uint32_t addCodeAddrSetCB(const std::vector<rword> &addresses,
+                            InstPosition pos, InstCallback cbk, void *data,
+                            int priority = PRIORITY_DEFAULT);
+
+  /*! Register a callback for when one of the addresses is executed.
+   *
+   * @param[in] addresses Code addresses which will trigger the callback.
+   * @param[in] pos       Relative position of the callback
+   *                      (PREINST / POSTINST).
+   * @param[in] cbk       A lambda function to the callback
+   * @param[in] priority  The priority of the callback.
+   *
+   * @return The id of the registered instrumentation (or
+   * VMError::INVALID_EVENTID in case of failure).
+   */
+  uint32_t addCodeAddrSetCB(const std::vector<rword> &addresses,
+                            InstPosition pos, const InstCbLambda &cbk,
+                            int priority = PRIORITY_DEFAULT);
+  uint32_t addCodeAddrSetCB(const std::vector<rword> &addresses,
+                            InstPosition pos, InstCbLambda &&cbk,
+                            int priority = PRIORITY_DEFAULT);
+
   /*! Register a callback for when a specific address range is executed.
    *
    * @param[in] start    Start of the address range which will trigger
@@ -487,11 +1024,41 @@ public:
   uint32_t addCodeRangeCB(rword start, rword end, InstPosition pos,
                           InstCbLambda &&cbk, int priority = PRIORITY_DEFAULT);
 
-  /*! Register a callback event for every memory access matching the type
-   * bitfield made by the instructions.
+  /*! Register a callable for when a specific address range is executed,
+   * called without std::function (see addCodeCB).
    *
-   * @param[in] type       A mode bitfield: either QBDI::MEMORY_READ,
-   *                       QBDI::MEMORY_WRITE or both (QBDI::MEMORY_READ_WRITE).
+   * @param[in] start    Start of the address range which will trigger
+   *                     the callback.
+   * @param[in] end      End of the address range which will trigger
+   *                     the callback.
+   * @param[in] pos      Relative position of the callback (PREINST / POSTINST).
+   * @param[in] cbk      A callable with the signature of InstCbLambda
+   * @param[in] priority The priority of the callback.
+   *
+   * @return The id of the registered instrumentation (or
+   * VMError::INVALID_EVENTID in case of failure).
+   */
+  template <typename F, EnableIfInstFunctor<F> = 0>
+  uint32_t addCodeRangeCB(rword start, rword end, InstPosition pos, F &&cbk,
+                          int priority = PRIORITY_DEFAULT) {
+    using T = typename std::decay<F>::type;
+    functorCBData.emplace_front(0xffffffff,
+                                InstCbFunctor(std::forward<F>(cbk)));
+    auto &el = functorCBData.front();
+    uint32_t id = addCodeRangeCB(start, end, pos, InstCbFunctor::trampoline<T>,
+                                 el.second.get(), priority);
+    el.first = id;
+    return id;
+  }
+
+  /*! Register a callback event for every instruction executed, called only if
+   * a predicate holds. The predicate is evaluated by the instrumented code,
+   * without returning to the VM when it doesn't hold.
+   *
+   * @param[in] pos        Relative position of the event callback
+   *                       (PREINST / POSTINST). PREDICATE_MEM_IN_RANGE is
+   *                       only available with PREINST.
+   * @param[in] predicate  The predicate of the callback.
    * @param[in] cbk        A function pointer to the callback.
    * @param[in] data       User defined data passed to the callback.
    * @param[in] priority   The priority of the callback.
@@ -499,66 +1066,366 @@ public:
    * @return The id of the registered instrumentation
    * (or VMError::INVALID_EVENTID in case of failure).
    */
-  uint32_t addMemAccessCB(MemoryAccessType type, InstCallback cbk, void *data,
-                          int priority = PRIORITY_DEFAULT);
-
-  /*! Register a callback event for every memory access matching the type
-   * bitfield made by the instructions.
+  uint32_t addCodeCBIf(InstPosition pos, const CallbackPredicate &predicate,
+                       InstCallback cbk, void *data,
+                       int priority = PRIORITY_DEFAULT);
+
+  /*! Register a callback for when a specific address range is executed,
+   * called only if a predicate holds. The predicate is evaluated by the
+   * instrumented code, without returning to the VM when it doesn't hold.
+   *
+   * @param[in] start      Start of the address range which will trigger
+   *                       the callback.
+   * @param[in] end        End of the address range which will trigger
+   *                       the callback.
+   * @param[in] pos        Relative position of the callback
+   *                       (PREINST / POSTINST). PREDICATE_MEM_IN_RANGE is
+   *                       only available with PREINST.
+   * @param[in] predicate  The predicate of the callback.
+   * @param[in] cbk        A function pointer to the callback.
+   * @param[in] data       User defined data passed to the callback.
+   * @param[in] priority   The priority of the callback.
    *
-   * @param[in] type       A mode bitfield: either QBDI::MEMORY_READ,
-   *                       QBDI::MEMORY_WRITE or both (QBDI::MEMORY_READ_WRITE).
-   * @param[in] cbk        A lambda function to the callback
+   * @return The id of the registered instrumentation (or
+   * VMError::INVALID_EVENTID in case of failure).
+   */
+  uint32_t addCodeRangeCBIf(rword start, rword end, InstPosition pos,
+                            const CallbackPredicate &predicate,
+                            InstCallback cbk, void *data,
+                            int priority = PRIORITY_DEFAULT);
+
+  /*! Register a lightweight callback event for every instruction executed.
+   * The callback is called by the instrumented code on the host stack,
+   * without returning to the VM. Only SP, PC, the flags, the registers
+   * clobbered by a call and the registers of the footprint are valid in the
+   * GPRState, and only the changes of these registers are applied.
+   *
+   * Without FOOTPRINT_FPR, the FPRState isn't up to date and the callback
+   * must not use the floating point and vector registers. With FOOTPRINT_FPR,
+   * the callback is called with a complete context switch, like addCodeCB.
+   * The callback must not get the analysis or the memory accesses of the
+   * current instruction from the VM.
+   *
+   * @param[in] pos        Relative position of the event callback
+   *                       (PREINST / POSTINST).
+   * @param[in] cbk        A function pointer to the callback.
+   * @param[in] data       User defined data passed to the callback.
+   * @param[in] footprint  The registers used by the callback.
    * @param[in] priority   The priority of the callback.
    *
    * @return The id of the registered instrumentation
    * (or VMError::INVALID_EVENTID in case of failure).
    */
-  uint32_t addMemAccessCB(MemoryAccessType type, const InstCbLambda &cbk,
-                          int priority = PRIORITY_DEFAULT);
-  uint32_t addMemAccessCB(MemoryAccessType type, InstCbLambda &&cbk,
+  uint32_t addCodeCBLight(InstPosition pos, InstCallback cbk, void *data,
+                          CallbackFootprint footprint,
                           int priority = PRIORITY_DEFAULT);
 
-  /*! Add a virtual callback which is triggered for any memory access at a
-   * specific address matching the access type. Virtual callbacks are called via
-   * callback forwarding by a gate callback triggered on every memory access.
-   * This incurs a high performance cost. The callback has the default priority.
+  /*! Register a lightweight callback for when a specific address range is
+   * executed. See addCodeCBLight for the restrictions of the callback.
    *
-   * @param[in] address  Code address which will trigger the callback.
-   * @param[in] type     A mode bitfield: either QBDI::MEMORY_READ,
-   *                     QBDI::MEMORY_WRITE or both (QBDI::MEMORY_READ_WRITE).
-   * @param[in] cbk      A function pointer to the callback.
-   * @param[in] data     User defined data passed to the callback.
+   * @param[in] start      Start of the address range which will trigger
+   *                       the callback.
+   * @param[in] end        End of the address range which will trigger
+   *                       the callback.
+   * @param[in] pos        Relative position of the callback
+   *                       (PREINST / POSTINST).
+   * @param[in] cbk        A function pointer to the callback.
+   * @param[in] data       User defined data passed to the callback.
+   * @param[in] footprint  The registers used by the callback.
+   * @param[in] priority   The priority of the callback.
    *
-   * @return The id of the registered instrumentation
-   * (or VMError::INVALID_EVENTID in case of failure).
+   * @return The id of the registered instrumentation (or
+   * VMError::INVALID_EVENTID in case of failure).
    */
-  uint32_t addMemAddrCB(rword address, MemoryAccessType type, InstCallback cbk,
-                        void *data);
+  uint32_t addCodeRangeCBLight(rword start, rword end, InstPosition pos,
+                               InstCallback cbk, void *data,
+                               CallbackFootprint footprint,
+                               int priority = PRIORITY_DEFAULT);
 
-  /*! Add a virtual callback which is triggered for any memory access at a
-   * specific address matching the access type. Virtual callbacks are called via
-   * callback forwarding by a gate callback triggered on every memory access.
-   * This incurs a high performance cost. The callback has the default priority.
+  /*! Register a callback event for every instruction executed, with the
+   * analysis of the instruction. The analysis is made once, when the
+   * instruction is instrumented, instead of a call to getInstAnalysis at each
+   * execution.
    *
-   * @param[in] address  Code address which will trigger the callback.
-   * @param[in] type     A mode bitfield: either QBDI::MEMORY_READ,
-   *                     QBDI::MEMORY_WRITE or both (QBDI::MEMORY_READ_WRITE).
-   * @param[in] cbk      A lambda function to the callback
+   * @param[in] pos        Relative position of the event callback
+   *                       (PREINST / POSTINST).
+   * @param[in] cbk        A function pointer to the callback.
+   * @param[in] data       User defined data passed to the callback.
+   * @param[in] type       Properties to retrieve in the analysis.
+   * @param[in] priority   The priority of the callback.
    *
    * @return The id of the registered instrumentation
    * (or VMError::INVALID_EVENTID in case of failure).
    */
-  uint32_t addMemAddrCB(rword address, MemoryAccessType type,
-                        const InstCbLambda &cbk);
-  uint32_t addMemAddrCB(rword address, MemoryAccessType type,
-                        InstCbLambda &&cbk);
-
-  /*! Add a virtual callback which is triggered for any memory access in a
-   * specific address range matching the access type. Virtual callbacks are
-   * called via callback forwarding by a gate callback triggered on every memory
-   * access. This incurs a high performance cost. The callback has the default
-   * priority.
-   *
+  uint32_t addCodeAnalysisCB(InstPosition pos, InstAnalysisCallback cbk,
+                             void *data,
+                             AnalysisType type = ANALYSIS_INSTRUCTION,
+                             int priority = PRIORITY_DEFAULT);
+
+  /*! Register a callback event for an address range, with the analysis of
+   * the instruction (see addCodeAnalysisCB).
+   *
+   * @param[in] start      Start of the address range which will trigger the
+   *                       callback.
+   * @param[in] end        End of the address range which will trigger the
+   *                       callback.
+   * @param[in] pos        Relative position of the event callback
+   *                       (PREINST / POSTINST).
+   * @param[in] cbk        A function pointer to the callback.
+   * @param[in] data       User defined data passed to the callback.
+   * @param[in] type       Properties to retrieve in the analysis.
+   * @param[in] priority   The priority of the callback.
+   *
+   * @return The id of the registered instrumentation
+   * (or VMError::INVALID_EVENTID in case of failure).
+   */
+  uint32_t addCodeRangeAnalysisCB(rword start, rword end, InstPosition pos,
+                                  InstAnalysisCallback cbk, void *data,
+                                  AnalysisType type = ANALYSIS_INSTRUCTION,
+                                  int priority = PRIORITY_DEFAULT);
+
+  /*! Register an inline counter of the executions of an address range. The
+   * counter is incremented by the generated code, without returning to the
+   * VM. The increment isn't atomic.
+   *
+   * @param[in]  start    Start of the address range which will increment
+   *                      the counter.
+   * @param[in]  end      End of the address range which will increment
+   *                      the counter.
+   * @param[in]  pos      Relative position of the increment (PREINST /
+   *                      POSTINST).
+   * @param[out] counter  The address of the counter, valid until the
+   *                      instrumentation is removed. The counter starts at
+   *                      zero and can be reset by the user.
+   * @param[in]  priority The priority of the increment.
+   *
+   * @return The id of the registered instrumentation (or
+   * VMError::INVALID_EVENTID in case of failure).
+   */
+  uint32_t addCodeCounter(rword start, rword end, InstPosition pos,
+                          uint64_t **counter, int priority = PRIORITY_DEFAULT);
+
+  /*! Update a coverage bitmap from the generated code, without returning to
+   * the VM. At the entry of each sequence, the entry of the edge (AFL style)
+   * or of the basic block is incremented. The 8 bits entries wrap around.
+   * The coverage isn't removed by deleteAllInstrumentations.
+   *
+   * @param[in] bitmap  The bitmap to update, nullptr to disable the coverage.
+   *                    The bitmap must stay valid while it is used by the VM.
+   * @param[in] size    The size of the bitmap, a power of two up to 2**31.
+   * @param[in] mode    The kind of coverage (COVERAGE_EDGE / COVERAGE_BLOCK).
+   *
+   * @return True if the coverage has been configured.
+   */
+  bool setCoverageBitmap(uint8_t *bitmap, size_t size,
+                         CoverageMode mode = COVERAGE_EDGE);
+
+  /*! Clear the coverage bitmap and the previous location of the edge
+   * coverage, without flushing the translation cache. This method can be used
+   * between two runs of a fuzzer.
+   */
+  void resetCoverage();
+
+  /*! Compile an instrumentation plan into the inline instrumentations of the
+   * VM, without any user callback but the one of the memory trace. The
+   * counters are inline counters of the instructions of their step. The
+   * coverage, the memory trace and the stop apply to the whole VM and replace
+   * the ones configured with their own methods. If a step can't be applied,
+   * the instrumentation added by the previous steps is removed.
+   *
+   * @param[in]  steps    The steps of the plan.
+   * @param[in]  nbSteps  The number of steps.
+   * @param[out] ids      If not nullptr, an array of nbSteps ids receiving the
+   *                      id of the instrumentation of each counter, or
+   *                      VMError::INVALID_EVENTID for the other steps.
+   *
+   * @return True if all the steps have been applied.
+   */
+  bool addPlan(const PlanStep *steps, size_t nbSteps, uint32_t *ids = nullptr);
+
+  /*! Take a snapshot of the GPR and FPR states of the VM and of the content of
+   * some ranges of memory, replacing the previous snapshot. The snapshot can
+   * be restored between the iterations of a persistent loop.
+   *
+   * @param[in] ranges  The ranges of memory to save. They must be readable
+   *                    and writable, and must not contain instrumented code.
+   */
+  void takeSnapshot(const RangeSet<rword> &ranges = {});
+
+  /*! Restore the states and the memory saved by VM::takeSnapshot. The
+   * translation cache isn't flushed. On Linux, when the kernel supports the
+   * soft dirty bits, only the pages written since the snapshot or the last
+   * restore are copied back, by the instrumented code or not.
+   *
+   * @return False if no snapshot has been taken.
+   */
+  bool restoreSnapshot();
+
+  /*! Register a callback event for every memory access matching the type
+   * bitfield made by the instructions.
+   *
+   * @param[in] type       A mode bitfield: either QBDI::MEMORY_READ,
+   *                       QBDI::MEMORY_WRITE or both (QBDI::MEMORY_READ_WRITE),
+   *                       with QBDI::MEMORY_ADDRESS_ONLY if the callback
+   *                       doesn't need the value of the accesses, and
+   *                       QBDI::MEMORY_NO_STACK or QBDI::MEMORY_NO_FRAME
+   *                       if it ignores the accesses to the stack.
+   * @param[in] cbk        A function pointer to the callback.
+   * @param[in] data       User defined data passed to the callback.
+   * @param[in] priority   The priority of the callback.
+   *
+   * @return The id of the registered instrumentation
+   * (or VMError::INVALID_EVENTID in case of failure).
+   */
+  uint32_t addMemAccessCB(MemoryAccessType type, InstCallback cbk, void *data,
+                          int priority = PRIORITY_DEFAULT);
+
+  /*! Register a callback event for every memory access matching the type
+   * bitfield made by the instructions.
+   *
+   * @param[in] type       A mode bitfield: either QBDI::MEMORY_READ,
+   *                       QBDI::MEMORY_WRITE or both (QBDI::MEMORY_READ_WRITE).
+   * @param[in] cbk        A lambda function to the callback
+   * @param[in] priority   The priority of the callback.
+   *
+   * @return The id of the registered instrumentation
+   * (or VMError::INVALID_EVENTID in case of failure).
+   */
+  uint32_t addMemAccessCB(MemoryAccessType type, const InstCbLambda &cbk,
+                          int priority = PRIORITY_DEFAULT);
+  uint32_t addMemAccessCB(MemoryAccessType type, InstCbLambda &&cbk,
+                          int priority = PRIORITY_DEFAULT);
+
+  /*! Register a callable for every memory access matching the type bitfield,
+   * called without std::function (see addCodeCB).
+   *
+   * @param[in] type       A mode bitfield: either QBDI::MEMORY_READ,
+   *                       QBDI::MEMORY_WRITE or both (QBDI::MEMORY_READ_WRITE).
+   * @param[in] cbk        A callable with the signature of InstCbLambda
+   * @param[in] priority   The priority of the callback.
+   *
+   * @return The id of the registered instrumentation
+   * (or VMError::INVALID_EVENTID in case of failure).
+   */
+  template <typename F, EnableIfInstFunctor<F> = 0>
+  uint32_t addMemAccessCB(MemoryAccessType type, F &&cbk,
+                          int priority = PRIORITY_DEFAULT) {
+    using T = typename std::decay<F>::type;
+    functorCBData.emplace_front(0xffffffff,
+                                InstCbFunctor(std::forward<F>(cbk)));
+    auto &el = functorCBData.front();
+    uint32_t id = addMemAccessCB(type, InstCbFunctor::trampoline<T>,
+                                 el.second.get(), priority);
+    el.first = id;
+    return id;
+  }
+
+  /*! Register a callback event for the memory accesses matching the type
+   * bitfield, called only if a predicate holds. The accesses are recorded on
+   * every execution, but the instrumented code only returns to the VM when the
+   * predicate holds. PREDICATE_COUNTER and PREDICATE_SAMPLE allow to sample
+   * the accesses.
+   *
+   * @param[in] type       A mode bitfield: either QBDI::MEMORY_READ,
+   *                       QBDI::MEMORY_WRITE or both (QBDI::MEMORY_READ_WRITE).
+   *                       PREDICATE_MEM_IN_RANGE is only available with
+   *                       QBDI::MEMORY_READ.
+   * @param[in] predicate  The predicate of the callback.
+   * @param[in] cbk        A function pointer to the callback.
+   * @param[in] data       User defined data passed to the callback.
+   * @param[in] priority   The priority of the callback.
+   *
+   * @return The id of the registered instrumentation
+   * (or VMError::INVALID_EVENTID in case of failure).
+   */
+  uint32_t addMemAccessCBIf(MemoryAccessType type,
+                            const CallbackPredicate &predicate,
+                            InstCallback cbk, void *data,
+                            int priority = PRIORITY_DEFAULT);
+
+  /*! Propagate the taint labels of a TaintState after every instruction.
+   * The labels of the registers and of the memory accesses read by an
+   * instruction are propagated to the registers and the memory it writes. The
+   * callback is only called on the policy events.
+   *
+   * The memory accesses are recorded (see recordMemoryAccess). Copies of the
+   * VM share the TaintState.
+   *
+   * @param[in] state      The shadow state, must outlive the instrumentation.
+   * @param[in] cbk        The callback of the policy events, or nullptr.
+   * @param[in] data       User defined data passed to the callback.
+   * @param[in] priority   The priority of the propagation.
+   *
+   * @return The id of the registered instrumentation
+   * (or VMError::INVALID_EVENTID in case of failure).
+   */
+  uint32_t addTaintTracking(TaintState *state, TaintCallback cbk, void *data,
+                            int priority = PRIORITY_DEFAULT);
+
+  /*! Check the ownership of the memory accessed by every instruction with an
+   * OwnershipFilter. The generated code compares the owner of the granule of
+   * the first byte of each access with the thread of the filter and only
+   * breaks to the host when they differ, before the instruction. The writes
+   * on the stack are not checked and a REP access is checked on its first
+   * address.
+   *
+   * Copies of the VM share the filter.
+   *
+   * @param[in] filter     The filter of the thread of the VM, must outlive
+   *                       the instrumentation.
+   * @param[in] type       The accesses to check: QBDI::MEMORY_READ,
+   *                       QBDI::MEMORY_WRITE or both
+   *                       (QBDI::MEMORY_READ_WRITE).
+   * @param[in] priority   The priority of the check.
+   *
+   * @return The id of the registered instrumentation
+   * (or VMError::INVALID_EVENTID in case of failure).
+   */
+  uint32_t addOwnershipFilter(OwnershipFilter *filter,
+                              MemoryAccessType type = MEMORY_READ_WRITE,
+                              int priority = PRIORITY_DEFAULT);
+
+  /*! Add a virtual callback which is triggered for any memory access at a
+   * specific address matching the access type. Virtual callbacks are called via
+   * callback forwarding by a gate callback triggered on every memory access.
+   * This incurs a high performance cost. The callback has the default priority.
+   *
+   * @param[in] address  Code address which will trigger the callback.
+   * @param[in] type     A mode bitfield: either QBDI::MEMORY_READ,
+   *                     QBDI::MEMORY_WRITE or both (QBDI::MEMORY_READ_WRITE).
+   * @param[in] cbk      A function pointer to the callback.
+   * @param[in] data     User defined data passed to the callback.
+   *
+   * @return The id of the registered instrumentation
+   * (or VMError::INVALID_EVENTID in case of failure).
+   */
+  uint32_t addMemAddrCB(rword address, MemoryAccessType type, InstCallback cbk,
+                        void *data);
+
+  /*! Add a virtual callback which is triggered for any memory access at a
+   * specific address matching the access type. Virtual callbacks are called via
+   * callback forwarding by a gate callback triggered on every memory access.
+   * This incurs a high performance cost. The callback has the default priority.
+   *
+   * @param[in] address  Code address which will trigger the callback.
+   * @param[in] type     A mode bitfield: either QBDI::MEMORY_READ,
+   *                     QBDI::MEMORY_WRITE or both (QBDI::MEMORY_READ_WRITE).
+   * @param[in] cbk      A lambda function to the callback
+   *
+   * @return The id of the registered instrumentation
+   * (or VMError::INVALID_EVENTID in case of failure).
+   */
+  uint32_t addMemAddrCB(rword address, MemoryAccessType type,
+                        const InstCbLambda &cbk);
+  uint32_t addMemAddrCB(rword address, MemoryAccessType type,
+                        InstCbLambda &&cbk);
+
+  /*! Add a virtual callback which is triggered for any memory access in a
+   * specific address range matching the access type. Virtual callbacks are
+   * called via callback forwarding by a gate callback triggered on every memory
+   * access. This incurs a high performance cost. The callback has the default
+   * priority.
+   *
    * @param[in] start    Start of the address range which will trigger the
    *                     callback.
    * @param[in] end      End of the address range which will trigger the
@@ -596,6 +1463,23 @@ public:
   uint32_t addMemRangeCB(rword start, rword end, MemoryAccessType type,
                          InstCbLambda &&cbk);
 
+  /*! Register a callback which receives the memory accesses of each sequence
+   * at its end (QBDI::SEQUENCE_EXIT). The accesses are decoded with a table
+   * precomputed when the sequence is translated. The basic block ends when
+   * vmState->event contains QBDI::BASIC_BLOCK_EXIT. This enables the record
+   * of the memory accesses of the given type.
+   *
+   * @param[in] type     A mode bitfield: either QBDI::MEMORY_READ,
+   *                     QBDI::MEMORY_WRITE or both (QBDI::MEMORY_READ_WRITE).
+   * @param[in] cbk      A function pointer to the callback.
+   * @param[in] data     User defined data passed to the callback.
+   *
+   * @return The id of the registered instrumentation (or
+   * VMError::INVALID_EVENTID in case of failure).
+   */
+  uint32_t addBBMemAccessCB(MemoryAccessType type, BBMemAccessCallback cbk,
+                            void *data);
+
   /*! Register a callback event for a specific VM event.
    *
    * @param[in] mask  A mask of VM event type which will trigger the callback.
@@ -618,6 +1502,82 @@ public:
   uint32_t addVMEventCB(VMEvent mask, const VMCbLambda &cbk);
   uint32_t addVMEventCB(VMEvent mask, VMCbLambda &&cbk);
 
+  /*! Give the basic blocks translated by the runs to a callback in batches,
+   * instead of a BASIC_BLOCK_NEW event for each basic block. The callback is
+   * called before the execution of the basic block which fills the batch,
+   * and with the pending entries at the end of each run. The basic blocks
+   * translated outside of a run (precacheBasicBlock, step) aren't given.
+   *
+   * @param[in] cbk        The callback of the entries, nullptr to disable
+   *                       the batches.
+   * @param[in] data       User defined data passed to the callback.
+   * @param[in] threshold  The number of entries of a batch.
+   *
+   * @return True if the batches have been configured.
+   */
+  bool setNewBasicBlockBatch(NewBasicBlockCallback cbk, void *data,
+                             size_t threshold = 1024);
+
+  /*! Register the callbacks of the transfers of the execution to a native
+   * function, which isn't instrumented. Unlike a callback of
+   * QBDI::EXEC_TRANSFER_CALL, the callbacks are only called for this target,
+   * after the callbacks of the events. The post callback receives the state
+   * returned by the function. If a callback doesn't return
+   * QBDI::VMAction::CONTINUE, the state is the state of the event.
+   *
+   * @param[in] target   The address of the native function.
+   * @param[in] preCbk   The callback before the transfer, or nullptr.
+   * @param[in] postCbk  The callback after the return of the function, or
+   *                     nullptr.
+   * @param[in] data     User defined data passed to the callbacks.
+   *
+   * @return The id of the registered instrumentation (or
+   * VMError::INVALID_EVENTID in case of failure).
+   */
+  uint32_t addTransferHook(rword target, VMCallback preCbk, VMCallback postCbk,
+                           void *data);
+
+  /*! Register the callbacks of the entry and the exit of an instrumented
+   * function. The entry callback is called before the first instruction of
+   * the function. The exit is detected with a shadow call stack: the return
+   * address of each call is recorded at the entry, and the exit callback is
+   * called before the instruction at the return address, with the stack
+   * pointer above the frame of the call. Only the return addresses of the
+   * callers are instrumented, not the returns of the process.
+   *
+   * A call left without its return (longjmp, exception) is dropped without
+   * exit callback once the stack pointer is above its frame. A function that
+   * the hooked function tail calls returns at the same address, the exit
+   * callbacks of both functions are called. The entry mustn't be the target
+   * of a branch of the function.
+   *
+   * @param[in] address  The address of the entry of the function.
+   * @param[in] onEntry  The callback of the entry, or nullptr.
+   * @param[in] onExit   The callback of the exit, or nullptr.
+   * @param[in] data     User defined data passed to the callbacks.
+   *
+   * @return The id of the registered instrumentation (or
+   * VMError::INVALID_EVENTID in case of failure).
+   */
+  uint32_t addFunctionHook(rword address, InstCallback onEntry,
+                           InstCallback onExit, void *data);
+
+  /*! Replace a function by another one. The calls and the jumps to the
+   * original function continue at the replacement without any callback, the
+   * original function is never translated. A replacement outside of the
+   * instrumented ranges is executed natively with the ExecBroker, a
+   * replacement inside them is instrumented. The replacement receives the
+   * arguments and the return address of the original function, and may call
+   * the original function natively.
+   *
+   * @param[in] orig         The address of the original function.
+   * @param[in] replacement  The address of the replacement.
+   *
+   * @return The id of the registered instrumentation (or
+   * VMError::INVALID_EVENTID in case of failure).
+   */
+  uint32_t replaceFunction(rword orig, rword replacement);
+
   /*! Remove an instrumentation.
    *
    * @param[in] id The id of the instrumentation to remove.
@@ -626,6 +1586,20 @@ public:
    */
   bool deleteInstrumentation(uint32_t id);
 
+  /*! Enable or disable an instrumentation without removing it. The callbacks
+   * of the instruction and memory access instrumentations test a flag in the
+   * generated code and don't need any flush of the cache. The other
+   * instrumentations (InstrRule callbacks, inline counters) are flushed.
+   *
+   * @param[in] id      The id of the instrumentation.
+   * @param[in] enable  Enable or disable the instrumentation.
+   *
+   * @return  True if the instrumentation exists. The VM events and the
+   *          memory callbacks of a range (addMemAddrCB, addMemRangeCB) cannot
+   *          be disabled.
+   */
+  bool setInstrumentationEnabled(uint32_t id, bool enable);
+
   /*! Remove all the registered instrumentations.
    *
    */
@@ -661,18 +1635,142 @@ public:
       rword address,
       AnalysisType type = ANALYSIS_INSTRUCTION | ANALYSIS_DISASSEMBLY) const;
 
+  /*! Obtain the handle of the current instruction. The handle resolves the
+   * analysis of the instruction without searching the cache and can be kept
+   * by a tool instead of the address. This method must only be used in an
+   * InstCallback.
+   *
+   * @return The handle of the current instruction, 0 on failure.
+   */
+  InstHandle getInstHandle() const;
+
+  /*! Obtain the handle of a cached instruction.
+   *
+   * @param[in] address The address of the instruction.
+   *
+   * @return The handle of the instruction, 0 if the instruction isn't in the
+   *    cache.
+   */
+  InstHandle getCachedInstHandle(rword address) const;
+
+  /*! Obtain the analysis of an instruction from its handle. A handle is
+   * invalidated when the ExecBlock of its instruction is freed, for instance
+   * after a clearCache. The validity of the returned pointer is the same as
+   * VM::getCachedInstAnalysis.
+   *
+   * @param[in] handle  The handle of the instruction.
+   * @param[in] [type]  Properties to retrieve during analysis.
+   *                    This argument is optional, defaulting to
+   *                    QBDI::ANALYSIS_INSTRUCTION | QBDI::ANALYSIS_DISASSEMBLY
+   *
+   * @return A InstAnalysis structure containing the analysis result.
+   *    null if the handle is no longer valid.
+   */
+  const InstAnalysis *getInstAnalysisByHandle(
+      InstHandle handle,
+      AnalysisType type = ANALYSIS_INSTRUCTION | ANALYSIS_DISASSEMBLY) const;
+
+  /*! Call a callback on each instruction of the translation cache with its
+   * analysis, without a lookup per instruction. The analyses are computed
+   * lazily, only for the requested type.
+   *
+   * The instructions of a sequence are given in order, but the order of the
+   * sequences is unspecified. A sequence starting in the middle of a basic
+   * block shares its instructions with the sequence of the basic block, these
+   * instructions are given once for each sequence. The callback must not
+   * modify the cache of the VM nor run the VM.
+   *
+   * @param[in] cbk     The callback, returning STOP to end the iteration.
+   * @param[in] data    User defined data given to the callback.
+   * @param[in] [type]  Properties to retrieve during analysis.
+   *                    This argument is optional, defaulting to
+   *                    QBDI::ANALYSIS_INSTRUCTION
+   *
+   * @return The number of instructions given to the callback.
+   */
+  size_t iterateCache(CachedInstCallback cbk, void *data,
+                      AnalysisType type = ANALYSIS_INSTRUCTION) const;
+
+  /*! Disassemble and analyse the instructions of a range without
+   * translating them. The analyses are written in an array of the caller and
+   * are independent of the cache of the VM. The operands and the disassembly
+   * of the analyses must be released with VM::releaseAnalyses.
+   *
+   * The analysis stops at the end of the range, at the first invalid
+   * instruction, when the array is full or, if basicBlock is true, after the
+   * first instruction that may change the control flow.
+   *
+   * @param[in]  start       Start of the range, the memory of the range must
+   *                         be readable.
+   * @param[in]  end         End of the range (excluded).
+   * @param[out] analyses    The array of the analyses.
+   * @param[in]  count       The number of InstAnalysis of the array.
+   * @param[in]  [type]      Properties to retrieve during analysis.
+   * @param[in]  [basicBlock]  Stop at the end of the first basic block.
+   * @param[in]  [nbThreads] The number of threads of the analysis. The
+   *                         disassembly of the range is always sequential.
+   *
+   * @return The number of analysed instructions.
+   */
+  size_t analyzeRange(
+      rword start, rword end, InstAnalysis *analyses, size_t count,
+      AnalysisType type = ANALYSIS_INSTRUCTION | ANALYSIS_DISASSEMBLY,
+      bool basicBlock = false, unsigned nbThreads = 1) const;
+
+  /*! Release the operands and the disassembly of analyses written by
+   * VM::analyzeRange.
+   *
+   * @param[in] analyses  The array of the analyses.
+   * @param[in] count     The number of analyses returned by analyzeRange.
+   */
+  static void releaseAnalyses(InstAnalysis *analyses, size_t count);
+
   /*! Add instrumentation rules to log memory access using inline
    * instrumentation and instruction shadows.
    *
    * @param[in] type Memory mode bitfield to activate the logging for:
    *            either QBDI::MEMORY_READ, QBDI::MEMORY_WRITE or both
-   *            (QBDI::MEMORY_READ_WRITE).
+   *            (QBDI::MEMORY_READ_WRITE). With QBDI::MEMORY_ADDRESS_ONLY,
+   *            the value of the accesses isn't captured unless another
+   *            recording of the same type needs it. With
+   *            QBDI::MEMORY_NO_STACK (or QBDI::MEMORY_NO_FRAME), the
+   *            accesses relative to the stack pointer (and the frame
+   *            pointer) aren't recorded, under the same condition.
    *
    * @return True if inline memory logging is supported, False if not or in case
    *         of error.
    */
   bool recordMemoryAccess(MemoryAccessType type);
 
+  /*! Add instrumentation rules to log the memory accesses of the instructions
+   * of a range only. The other instructions don't pay for the recording,
+   * unless recordMemoryAccess is called for the same type.
+   *
+   * @param[in] start Start of the range of instructions.
+   * @param[in] end   End of the range of instructions (not included).
+   * @param[in] type  Memory mode bitfield to activate the logging for:
+   *            either QBDI::MEMORY_READ, QBDI::MEMORY_WRITE or both
+   *            (QBDI::MEMORY_READ_WRITE).
+   *
+   * @return True if inline memory logging is supported, False if not or in case
+   *         of error.
+   */
+  bool recordMemoryAccessRange(rword start, rword end, MemoryAccessType type);
+
+  /*! Add instrumentation rules to log the memory accesses of the instructions
+   * of a set of ranges only.
+   *
+   * @param[in] range Set of ranges of instructions.
+   * @param[in] type  Memory mode bitfield to activate the logging for:
+   *            either QBDI::MEMORY_READ, QBDI::MEMORY_WRITE or both
+   *            (QBDI::MEMORY_READ_WRITE).
+   *
+   * @return True if inline memory logging is supported, False if not or in case
+   *         of error.
+   */
+  bool recordMemoryAccessRangeSet(const RangeSet<rword> &range,
+                                  MemoryAccessType type);
+
   /*! Obtain the memory accesses made by the last executed instruction.
    *  The method should be called in an InstCallback.
    *
@@ -680,6 +1778,17 @@ public:
    */
   std::vector<MemoryAccess> getInstMemoryAccess() const;
 
+  /*! Obtain the memory accesses made by the last executed instruction without
+   *  allocating. The method should be called in an InstCallback.
+   *
+   * @param[out] buffer    Array where the memory accesses are written.
+   * @param[in]  capacity  Number of elements of the buffer.
+   *
+   * @return The number of memory accesses made by the instruction. Only the
+   *         first capacity accesses are written if the number is greater.
+   */
+  size_t getInstMemoryAccess(MemoryAccess *buffer, size_t capacity) const;
+
   /*! Obtain the memory accesses made by the last executed basic block.
    *  The method should be called in a VMCallback with VMEvent::SEQUENCE_EXIT.
    *
@@ -687,6 +1796,114 @@ public:
    */
   std::vector<MemoryAccess> getBBMemoryAccess() const;
 
+  /*! Obtain the memory accesses made by the last executed basic block without
+   *  allocating. The method should be called in a VMCallback with
+   *  VMEvent::SEQUENCE_EXIT.
+   *
+   * @param[out] buffer    Array where the memory accesses are written.
+   * @param[in]  capacity  Number of elements of the buffer.
+   *
+   * @return The number of memory accesses made by the basic block. Only the
+   *         first capacity accesses are written if the number is greater.
+   */
+  size_t getBBMemoryAccess(MemoryAccess *buffer, size_t capacity) const;
+
+  /*! Obtain the whole value of a memory access larger than a rword, captured
+   *  with the option OPT_ENABLE_WIDE_MEMACCESS_VALUE (MEMORY_WIDE_VALUE). The
+   *  method should be called in the callback which obtained the access.
+   *
+   * @param[in]  access  An access of getInstMemoryAccess or getBBMemoryAccess.
+   * @param[out] buffer  Buffer where the value is written.
+   * @param[in]  size    Size of the buffer, at least access.size bytes.
+   *
+   * @return True if the value has been written in the buffer.
+   */
+  bool getMemoryAccessValue(const MemoryAccess &access, void *buffer,
+                            size_t size) const;
+
+  /*! Trace the memory accesses in a buffer written by the generated code. The
+   *  VM only returns to the host when the buffer is full: the callback then
+   *  receives all the entries of the buffer. The pending entries are also
+   *  given at the end of each run. The size of the REP accesses isn't
+   *  computed (MEMORY_UNKNOWN_SIZE).
+   *
+   * @param[in] type      Memory mode bitfield of the accesses to trace:
+   *                      either QBDI::MEMORY_READ, QBDI::MEMORY_WRITE or both
+   *                      (QBDI::MEMORY_READ_WRITE).
+   * @param[in] cbk       The callback of the entries, nullptr to disable the
+   *                      trace.
+   * @param[in] data      User defined data passed to the callback.
+   * @param[in] capacity  The number of entries of the buffer.
+   *
+   * @return True if the trace has been configured.
+   */
+  bool setMemoryTrace(MemoryAccessType type, MemoryTraceCallback cbk,
+                      void *data, size_t capacity = 4096);
+
+  /*! Trace the calls in a buffer written by the generated code. After each
+   *  call, the generated code appends the address of the call, its target
+   *  and its first arguments, read in the argument registers of the ABI of
+   *  the platform (on the stack on X86). The VM only returns to the host when
+   *  the buffer is full: the callback then receives all the entries of the
+   *  buffer. The pending entries are also given at the end of each run. The
+   *  translation cache is flushed.
+   *
+   * @param[in] cbk       The callback of the entries, nullptr to disable the
+   *                      trace.
+   * @param[in] data      User defined data passed to the callback.
+   * @param[in] nbArgs    The number of arguments of the calls, at most
+   *                      QBDI_CALL_TRACE_MAX_ARGS (4 on Windows X86_64). The
+   *                      arity of a callee can be set with setCallTraceArity.
+   * @param[in] capacity  The number of entries of the buffer.
+   *
+   * @return True if the trace has been configured.
+   */
+  bool setCallTrace(CallTraceCallback cbk, void *data, uint32_t nbArgs = 4,
+                    size_t capacity = 1024);
+
+  /*! Set the number of arguments captured for the direct calls of a callee
+   *  in the call trace. The indirect calls use the number of arguments of
+   *  setCallTrace. The translation cache is flushed.
+   *
+   * @param[in] target  The address of the callee.
+   * @param[in] nbArgs  The number of arguments, at most
+   *                    QBDI_CALL_TRACE_MAX_ARGS.
+   *
+   * @return False if the call trace isn't enabled.
+   */
+  bool setCallTraceArity(rword target, uint32_t nbArgs);
+
+  /*! Count the memory accesses by page of 4KiB from the generated code,
+   *  without any callback. The counters are kept in a sparse two-level
+   *  histogram: the VM only returns to the host on the first access to each
+   *  1GiB of memory, to allocate its counters. The translation cache is
+   *  flushed. The counters are kept when the histogram is disabled. A REP
+   *  access is counted once, on the page of its first address.
+   *
+   * @param[in] enable  Enable or disable the histogram.
+   * @param[in] type    Memory mode bitfield of the accesses to count: either
+   *                    QBDI::MEMORY_READ, QBDI::MEMORY_WRITE or both
+   *                    (QBDI::MEMORY_READ_WRITE).
+   *
+   * @return True if the histogram has been configured.
+   */
+  bool setPageHistogram(bool enable,
+                        MemoryAccessType type = MEMORY_READ_WRITE);
+
+  /*! Get a snapshot of the counters of the accessed pages, sorted by
+   *  decreasing number of accesses.
+   *
+   * @param[in] topN  The maximal number of pages returned (0 for all).
+   *
+   * @return The counters of the accessed pages.
+   */
+  std::vector<PageAccessStats> getPageHistogram(size_t topN = 0) const;
+
+  /*! Clear the counters of the page histogram, without flushing the
+   *  translation cache.
+   */
+  void resetPageHistogram();
+
   /*! Pre-cache a known basic block
    *  This method mustn't be called if the VM already runs.
    *
@@ -696,7 +1913,90 @@ public:
    */
   bool precacheBasicBlock(rword pc);
 
-  /*! Clear a specific address range from the translation cache.
+  /*! Pre-cache a list of known basic blocks in one go, before the first
+   *  run. With OPT_ENABLE_ASYNC_PATCH, the worker thread disassembles and
+   *  patches the next basic blocks of the list while the VM instruments and
+   *  writes the current one. This method mustn't be called if the VM already
+   *  runs.
+   *
+   * @param[in] addresses  Start addresses of the basic blocks. The addresses
+   *                       which aren't instrumented or are already cached
+   *                       are skipped.
+   *
+   * @return The number of basic blocks inserted in the cache.
+   */
+  size_t precacheBasicBlocks(const std::vector<rword> &addresses);
+
+  /*! Pre-cache the code of a range reachable from entry points, by
+   *  following the targets of the direct branches and calls and the return
+   *  addresses of the calls. The indirect branches aren't followed. This
+   *  method mustn't be called if the VM already runs.
+   *
+   * @param[in] start       The start of the range.
+   * @param[in] end         The end of the range (excluded).
+   * @param[in] entries     The entry points of the code, start by default.
+   * @param[in] useSymbols  Also use the function symbols of the range as
+   *                        entry points (Linux and Android only).
+   *
+   * @return The number of basic blocks inserted in the cache.
+   */
+  size_t precacheRange(rword start, rword end,
+                       const std::vector<rword> &entries = {},
+                       bool useSymbols = false);
+
+  /*! Pre-cache the code of the executable maps of a module, reachable from
+   *  entry points and from the function symbols of the module, like
+   *  VM::precacheRange. This method mustn't be called if the VM already
+   *  runs.
+   *
+   * @param[in] name        The name of the module.
+   * @param[in] entries     The entry points of the code.
+   * @param[in] useSymbols  Use the function symbols of the module as entry
+   *                        points (Linux and Android only).
+   *
+   * @return The number of basic blocks inserted in the cache.
+   */
+  size_t precacheModule(const std::string &name,
+                        const std::vector<rword> &entries = {},
+                        bool useSymbols = true);
+
+  /*! Pre-cache the sequences cached by another VM, for example a configured
+   *  VM copied for each worker thread. A copy of a VM reuses the patches of
+   *  its source, the sequences are only instrumented and written again. The
+   *  two VMs mustn't run.
+   *
+   * @param[in] vm  The VM whose cache is reproduced.
+   *
+   * @return The number of basic blocks inserted in the cache.
+   */
+  size_t precacheFrom(const VM &vm);
+
+  /*! Write the start addresses of the sequences of the translation cache in
+   *  a file, relative to the base address of their module, for example
+   *  before the VM is destroyed. The sequences which aren't in a module are
+   *  ignored.
+   *
+   * @param[in] path  The path of the file.
+   *
+   * @return False if the file cannot be written.
+   */
+  bool saveCacheProfile(const char *path) const;
+
+  /*! Pre-cache the sequences recorded by VM::saveCacheProfile, possibly by
+   *  another process, with VM::precacheBasicBlocks. The addresses are
+   *  relocated to the modules loaded in the process, the modules which
+   *  aren't loaded are ignored. This method mustn't be called if the VM
+   *  already runs.
+   *
+   * @param[in] path  The path of the file.
+   *
+   * @return The number of basic blocks inserted in the cache.
+   */
+  size_t prewarmCache(const char *path);
+
+  /*! Clear a specific address range from the translation cache. The code of
+   * the range is disassembled again at its next execution: this method must
+   * be called when the code is modified.
    *
    * @param[in] start Start of the address range to clear from the cache.
    * @param[in] end   End of the address range to clear from the cache.
@@ -707,6 +2007,362 @@ public:
   /*! Clear the entire translation cache.
    */
   void clearAllCache();
+
+  /*! Seal the translation cache before the process forks its workers. The
+   *  code blocks of the cached sequences aren't written anymore: the forked
+   *  processes share their pages copy-on-write with the parent, and only get
+   *  a private copy of their data. The sequences translated after the seal
+   *  are written in new code blocks. The exits of the sealed sequences are
+   *  no longer linked, VM::precacheBasicBlocks should be used before the
+   *  seal to link them. This method mustn't be called when the VM runs.
+   *
+   * @return False if OPT_ENABLE_DUAL_MAPPING or OPT_ENABLE_SHARED_CONTEXT is
+   *         enabled: their shared memory would be written by the parent and
+   *         the children.
+   */
+  bool sealCache();
+
+  /*! Get the memory budget of the translation cache.
+   *
+   * @return The budget in bytes (0 for no limit).
+   */
+  size_t getCacheLimit() const;
+
+  /*! Set the memory budget of the translation cache. When a new ExecBlock
+   *  exceeds the budget, the least recently used regions of the cache are
+   *  evicted. The evicted code is translated again on its next execution.
+   *
+   * @param[in] limit  The budget in bytes (0 for no limit).
+   */
+  void setCacheLimit(size_t limit);
+
+  /*! Get the statistics of the translation cache. The counters are kept up to
+   *  date by the VM, this method can be called periodically.
+   *
+   * @return The statistics of the cache.
+   */
+  CacheStats getCacheStats() const;
+
+  /*! Get the memory used by the translation cache, by component. The sizes
+   *  divided by the number of instructions of the cache give the cost of an
+   *  instrumented instruction.
+   *
+   * @return The memory used by the cache.
+   */
+  MemoryStats getMemoryStats() const;
+
+  /*! Get the statistics of the transfers of the ExecBroker to the native
+   *  code, sorted by decreasing number of cycles. The hottest targets are the
+   *  code worth instrumenting or the transfers worth avoiding.
+   *
+   * @param[in] topN  The maximal number of targets returned (0 for all).
+   *
+   * @return The statistics of the targets of the transfers.
+   */
+  std::vector<TransferStats> getTransferStats(size_t topN = 0) const;
+
+  /*! Count the dispatches of the sequences and the reasons of the returns of
+   *  the generated code to the VM: the ends of the sequences, the callbacks
+   *  by their results, the transfers of the ExecBroker, the cache misses and
+   *  the splits of the sequences. The counters are updated by the VM at each
+   *  return, the generated code isn't changed. The counters are reset when
+   *  they are enabled.
+   *
+   * @param[in] enable  True to count the executions, false to disable and
+   *                    discard the counters.
+   */
+  void setExecStats(bool enable);
+
+  /*! Get the execution counters since their last reset.
+   *
+   * @return The counters (all 0 if they are disabled).
+   */
+  ExecStats getExecStats() const;
+
+  /*! Reset the execution counters, before a run to get the counters of this
+   *  run.
+   */
+  void resetExecStats();
+
+  /*! Demote automatically the functions to the native execution. A function
+   *  called threshold times without executing a sequence with an
+   *  instrumentation, in the function or in its callees, is then executed
+   *  natively as the code which isn't instrumented. The functions are only
+   *  demoted in the runs without VMEvent and without the instrumentations of
+   *  the VM (coverage, profiles, memory or call trace, budget, ...), their
+   *  entries are called directly by an instrumented call. The calls through
+   *  the linked exits of OPT_ENABLE_BLOCK_CHAINING aren't counted. The
+   *  demotions are reset when an instrumentation is added. A function which
+   *  calls an instrumented code once in threshold calls may be demoted.
+   *
+   * @param[in] threshold  The number of calls before the demotion, 0 to
+   *                       disable the demotion and reset its state.
+   */
+  void setAutoDemotion(uint32_t threshold);
+
+  /*! Get the entries of the functions demoted by the automatic demotion.
+   *
+   * @return The sorted entries of the demoted functions.
+   */
+  std::vector<rword> getDemotedFunctions() const;
+
+  /*! Attribute the costs of the instrumentation to the InstrRules: the
+   *  instructions generated by each rule and their estimated bytes, the
+   *  shadows allocated, the calls of the callbacks and their cycles. The
+   *  callbacks are called through a timing lambda while the statistics are
+   *  enabled. The translation cache is flushed when the state changes. The
+   *  statistics are kept when they are disabled and when the rules are
+   *  deleted.
+   *
+   * @param[in] enable      Enable or disable the statistics.
+   * @param[in] reportPath  File where the statistics sorted by cost are
+   *                        written as text when the VM is destroyed, nullptr
+   *                        for no report.
+   *
+   * @return True if the statistics have been configured.
+   */
+  bool setInstrRuleStats(bool enable, const char *reportPath = nullptr);
+
+  /*! Get the statistics of the InstrRules, sorted by decreasing cycles of
+   *  their callbacks, then by decreasing code size.
+   *
+   * @param[in] topN  The maximal number of rules returned (0 for all).
+   *
+   * @return The statistics of the InstrRules applied since the enable.
+   */
+  std::vector<InstrRuleStats> getInstrRuleStats(size_t topN = 0) const;
+
+  /*! Reset the statistics of the InstrRules, without flushing the
+   *  translation cache.
+   */
+  void resetInstrRuleStats();
+
+  /*! Count the executions of each sequence from the generated code, without
+   *  returning to the VM. The profile gives the hot spots of the guest as the
+   *  number of instructions executed by each sequence. The translation cache
+   *  is flushed. The counters are kept when the profile is disabled.
+   *
+   *  The executions of a sequence entered in its middle aren't counted until
+   *  the cache is flushed.
+   *
+   * @param[in] enable      Enable or disable the profile.
+   * @param[in] reportPath  File where the sorted profile is written as text
+   *                        when the VM is destroyed, nullptr for no report.
+   *
+   * @return True if the profile has been configured.
+   */
+  bool setSequenceProfile(bool enable, const char *reportPath = nullptr);
+
+  /*! Get the execution counters of the sequences, sorted by decreasing
+   *  number of instructions executed (executions * instCount). The addresses
+   *  are symbolized with the symbol index of the modules.
+   *
+   * @param[in] topN  The maximal number of sequences returned (0 for all).
+   *
+   * @return The counters of the executed sequences.
+   */
+  std::vector<SequenceStats> getSequenceProfile(size_t topN = 0) const;
+
+  /*! Clear the execution counters of the sequences, without flushing the
+   *  translation cache.
+   */
+  void resetSequenceProfile();
+
+  /*! Count the outcomes of the conditional branches (Jcc) from the generated
+   *  code, without returning to the VM. The translation cache is flushed.
+   *  The counters are kept when the profile is disabled.
+   *
+   * @param[in] enable  Enable or disable the profile.
+   *
+   * @return True if the profile has been configured.
+   */
+  bool setBranchProfile(bool enable);
+
+  /*! Get the outcome counters of the executed conditional branches, sorted
+   *  by decreasing number of executions. The addresses are symbolized with
+   *  the symbol index of the modules.
+   *
+   * @param[in] topN  The maximal number of branches returned (0 for all).
+   *
+   * @return The counters of the executed branches.
+   */
+  std::vector<BranchStats> getBranchProfile(size_t topN = 0) const;
+
+  /*! Clear the outcome counters of the conditional branches, without
+   *  flushing the translation cache.
+   */
+  void resetBranchProfile();
+
+  /*! Count the targets of the indirect calls and jumps from the generated
+   *  code, without returning to the VM. Each site records its first targets
+   *  in a small table, the other targets are counted together. The
+   *  translation cache is flushed. The tables are kept when the profile is
+   *  disabled.
+   *
+   * @param[in] enable  Enable or disable the profile.
+   *
+   * @return True if the profile has been configured.
+   */
+  bool setIndirectProfile(bool enable);
+
+  /*! Get the executed targets of the indirect calls and jumps, sorted by
+   *  decreasing number of executions. The sites and the targets are
+   *  symbolized with the symbol index of the modules.
+   *
+   * @param[in] topN  The maximal number of targets returned (0 for all).
+   *
+   * @return The counters of the executed targets.
+   */
+  std::vector<IndirectTargetStats> getIndirectProfile(size_t topN = 0) const;
+
+  /*! Clear the counters of the targets of the indirect calls and jumps,
+   *  without flushing the translation cache.
+   */
+  void resetIndirectProfile();
+
+  /*! Count the values of a register before an instruction from the
+   *  generated code, without returning to the VM. The site records its first
+   *  values in a small table, the other values are counted together. Only
+   *  the translations of the instruction are flushed. The profile is an
+   *  instrumentation, removed with deleteInstrumentation.
+   *
+   * @param[in] address  The address of the instruction.
+   * @param[in] reg      The index of the register in the GPRState (up to
+   *                     REG_SP).
+   * @param[in] buckets  The number of values recorded in the table (1 to
+   *                     16).
+   *
+   * @return The id of the registered instrumentation (or
+   * VMError::INVALID_EVENTID in case of failure).
+   */
+  uint32_t addValueProfile(rword address, uint32_t reg, size_t buckets = 4);
+
+  /*! Get the values counted by a value profile, sorted by decreasing number
+   *  of executions.
+   *
+   * @param[in] id    The id of the value profile.
+   * @param[in] topN  The maximal number of values returned (0 for all).
+   *
+   * @return The counters of the values.
+   */
+  std::vector<ValueStats> getValueProfile(uint32_t id, size_t topN = 0) const;
+
+  /*! Clear the counters of a value profile, without flushing the translation
+   *  cache.
+   *
+   * @param[in] id  The id of the value profile.
+   *
+   * @return True if the id is a value profile.
+   */
+  bool resetValueProfile(uint32_t id);
+
+  /*! Record the call graph from the generated code, without returning to the
+   *  VM. Each call counts its edge from the call site to the callee and
+   *  pushes a frame on a shadow stack, popped by the matching return. The
+   *  instrumented instructions executed between a call and its return are
+   *  accumulated on its edge. The translation cache is flushed. The edges
+   *  are kept when the profile is disabled.
+   *
+   * @param[in] enable  Enable or disable the profile.
+   *
+   * @return True if the profile has been configured.
+   */
+  bool setCallGraphProfile(bool enable);
+
+  /*! Get the executed edges of the call graph, sorted by decreasing number
+   *  of calls. The call sites and the callees are symbolized with the symbol
+   *  index of the modules.
+   *
+   * @param[in] topN  The maximal number of edges returned (0 for all).
+   *
+   * @return The counters of the executed edges.
+   */
+  std::vector<CallGraphEdgeStats> getCallGraphProfile(size_t topN = 0) const;
+
+  /*! Clear the counters of the edges of the call graph, without flushing the
+   *  translation cache.
+   */
+  void resetCallGraphProfile();
+
+  /*! Count the calls to the allocators (malloc, calloc, realloc, free and
+   *  the operators new and delete) with transfer hooks on their entries,
+   *  resolved by the symbol index of the modules (Linux and Android only).
+   *  The requested sizes are counted in size classes by relaxed atomic
+   *  counters, and the stack of one allocation in samplePeriod is recorded:
+   *  the return address of the allocator, then the frames of the shadow
+   *  stack if the call graph profile is enabled. The hooks are only called
+   *  for the calls of instrumented code to the allocators which aren't
+   *  instrumented. The counters are kept when the profile is disabled.
+   *
+   * @param[in] enable        Enable or disable the profile.
+   * @param[in] samplePeriod  The number of allocations between two sampled
+   *                          stacks, 0 to not sample the stacks.
+   * @param[in] reportPath    File where the counters and the symbolized
+   *                          stacks are written as text when the VM is
+   *                          destroyed, nullptr for no report.
+   *
+   * @return False if no allocator is found in the loaded modules.
+   */
+  bool setAllocationProfile(bool enable, uint32_t samplePeriod = 64,
+                            const char *reportPath = nullptr);
+
+  /*! Get the counters of the allocation profile. The counters can be read by
+   *  another thread during a run.
+   *
+   * @return The number of calls to each allocator and the size classes.
+   */
+  AllocationStats getAllocationProfile() const;
+
+  /*! Get the stacks sampled by the allocation profile, sorted by decreasing
+   *  sampled bytes. The stacks must be read when the VM isn't running.
+   *
+   * @param[in] topN  The maximal number of stacks returned (0 for all).
+   *
+   * @return The sampled stacks.
+   */
+  std::vector<AllocationSite> getAllocationSites(size_t topN = 0) const;
+
+  /*! Clear the counters and the stacks of the allocation profile.
+   */
+  void resetAllocationProfile();
+
+  /*! Sample a hardware event of the thread of the VM during the runs, with
+   *  perf_event_open (Linux and Android only). The PCs of the samples taken
+   *  in the ExecBlocks are attributed to the original instructions. The
+   *  counter is opened again when the VM runs in another thread. A copy of
+   *  the VM doesn't sample the event.
+   *
+   * @param[in] event   The hardware event (SAMPLE_CYCLES, ...).
+   * @param[in] period  The number of events between two samples, 0 to
+   *                    disable the sampling.
+   *
+   * @return True if the sampling has been configured, false if the counter
+   *         cannot be opened.
+   */
+  bool setHardwareSampling(HardwareEvent event, uint64_t period);
+
+  /*! Get the samples of the hardware event by original instruction, sorted
+   *  by decreasing number of samples. The samples outside of the ExecBlocks
+   *  are counted with the address 0.
+   *
+   * @param[in] topN  The maximal number of instructions returned (0 for
+   *                  all).
+   *
+   * @return The samples of the instructions.
+   */
+  std::vector<HardwareSample> getHardwareSamples(size_t topN = 0) const;
+
+  /*! Clear the samples of the hardware sampling.
+   */
+  void resetHardwareSamples();
+
+  /*! Get the cumulative profile of the translation phases. The profile is
+   *  only updated when QBDI is compiled with QBDI_PROFILE_TRANSLATION, and it
+   *  is also logged when the VM is destroyed.
+   *
+   * @return The profile of the translation.
+   */
+  TranslationProfile getTranslationProfile() const;
 };
 
 } // namespace QBDI
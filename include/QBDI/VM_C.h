@@ -22,12 +22,15 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+#include "QBDI/CacheStats.h"
 #include "QBDI/Callback.h"
 #include "QBDI/Errors.h"
 #include "QBDI/InstAnalysis.h"
 #include "QBDI/Options.h"
+#include "QBDI/Plan.h"
 #include "QBDI/Platform.h"
 #include "QBDI/State.h"
+#include "QBDI/TranslationProfile.h"
 
 #ifdef __cplusplus
 namespace QBDI {
@@ -86,6 +89,41 @@ QBDI_EXPORT bool qbdi_addInstrumentedModule(VMInstanceRef instance,
 QBDI_EXPORT bool qbdi_addInstrumentedModuleFromAddr(VMInstanceRef instance,
                                                     rword addr);
 
+/*! Add the address ranges of the functions with a name to the set of
+ * instrumented address ranges. The calls from the functions to the
+ * uninstrumented code are executed natively. Only the symbol tables of the
+ * modules on Linux and Android are used.
+ *
+ * @param[in] instance  VM instance.
+ * @param[in] name      The name of the function symbols.
+ *
+ * @return  True if at least one range was added to the instrumented ranges.
+ */
+QBDI_EXPORT bool qbdi_addInstrumentedFunction(VMInstanceRef instance,
+                                              const char *name);
+
+/*! Add the address range of the function which contains an address to the
+ * set of instrumented address ranges.
+ *
+ * @param[in] instance  VM instance.
+ * @param[in] addr      An address of the function.
+ *
+ * @return  True if a range was added to the instrumented ranges.
+ */
+QBDI_EXPORT bool qbdi_addInstrumentedFunctionFromAddr(VMInstanceRef instance,
+                                                      rword addr);
+
+/*! Add the address ranges of the functions whose name matches a POSIX
+ * extended regular expression to the set of instrumented address ranges.
+ *
+ * @param[in] instance  VM instance.
+ * @param[in] pattern   The regular expression.
+ *
+ * @return  True if at least one range was added to the instrumented ranges.
+ */
+QBDI_EXPORT bool qbdi_addInstrumentedFunctionRegex(VMInstanceRef instance,
+                                                   const char *pattern);
+
 /*! Adds all the executable memory maps to the instrumented range set.
  *
  * @param[in] instance VM instance.
@@ -131,6 +169,26 @@ QBDI_EXPORT bool qbdi_removeInstrumentedModuleFromAddr(VMInstanceRef instance,
  */
 QBDI_EXPORT void qbdi_removeAllInstrumentedRanges(VMInstanceRef instance);
 
+/*! Track the modules loaded and unloaded by the process during the
+ * execution, without polling the memory maps. The new modules are added to
+ * the instrumented ranges with MODULE_TRACK_LOAD, the unloaded modules are
+ * removed from the instrumented ranges and from the cache with
+ * MODULE_TRACK_UNLOAD. The modules are tracked on Linux and macOS only.
+ *
+ * @param[in] instance  VM instance.
+ * @param[in] tracking  The policy, NO_MODULE_TRACKING to disable the tracking.
+ */
+QBDI_EXPORT void qbdi_setModuleTracking(VMInstanceRef instance,
+                                        ModuleTracking tracking);
+
+/*! Get the policy of the tracking of the modules.
+ *
+ * @param[in] instance  VM instance.
+ *
+ * @return  The policy set with qbdi_setModuleTracking.
+ */
+QBDI_EXPORT ModuleTracking qbdi_getModuleTracking(VMInstanceRef instance);
+
 /*! Start the execution by the DBI from a given address (and stop when another
  * is reached). This method mustn't be called when the VM already runs.
  *
@@ -142,6 +200,44 @@ QBDI_EXPORT void qbdi_removeAllInstrumentedRanges(VMInstanceRef instance);
  */
 QBDI_EXPORT bool qbdi_run(VMInstanceRef instance, rword start, rword stop);
 
+/*! Start the execution by the DBI from a given address, until one of the stop
+ *  addresses is reached. This method mustn't be called when the VM already
+ *  runs.
+ *
+ * @param[in] instance  VM instance.
+ * @param[in] start     Address of the first instruction to execute.
+ * @param[in] stops     Array of the stop addresses.
+ * @param[in] nbStops   Number of elements of the array.
+ *
+ * @return  True if at least one block has been executed.
+ */
+QBDI_EXPORT bool qbdi_runUntil(VMInstanceRef instance, rword start,
+                               const rword *stops, size_t nbStops);
+
+/*! Run a slice of the execution by the DBI, from the PC of the current
+ *  GPRState. The slice stops at the entry of the first sequence which doesn't
+ *  fit in the budget, the next slice resumes from a cached sequence. This
+ *  method mustn't be called when the VM already runs.
+ *
+ * @param[in] instance  VM instance.
+ * @param[in] stop      Stop the execution when this instruction is reached.
+ * @param[in] budget    The number of instructions of the slice.
+ *
+ * @return  The status of the slice.
+ */
+QBDI_EXPORT SliceStatus qbdi_runFor(VMInstanceRef instance, rword stop,
+                                    rword budget);
+
+/*! Execute the instruction at the PC of the current GPRState and return. The
+ *  VM must have the option QBDI_OPT_SINGLE_STEP, the VMEvent callbacks aren't
+ *  called. This method mustn't be called when the VM already runs.
+ *
+ * @param[in] instance  VM instance.
+ *
+ * @return  True if the instruction has been executed.
+ */
+QBDI_EXPORT bool qbdi_step(VMInstanceRef instance);
+
 /*! Call a function using the DBI (and its current state).
  *  This method mustn't be called when the VM already runs.
  *
@@ -197,6 +293,46 @@ QBDI_EXPORT bool qbdi_callV(VMInstanceRef instance, rword *retval,
 QBDI_EXPORT bool qbdi_callA(VMInstanceRef instance, rword *retval,
                             rword function, uint32_t argNum, const rword *args);
 
+/*! Limit the number of instructions executed by the next runs. The generated
+ *  code subtracts the number of instructions of each sequence from the budget
+ *  and the run stops before the first instruction over the budget. This
+ *  function mustn't be called when the VM runs.
+ *
+ * @param[in] instance  VM instance.
+ * @param[in] budget    The number of instructions, 0 to disable the budget.
+ *
+ * @return True if the budget has been configured.
+ */
+QBDI_EXPORT bool qbdi_setInstructionBudget(VMInstanceRef instance,
+                                           rword budget);
+
+/*! Get the number of instructions left in the budget.
+ *
+ * @param[in] instance  VM instance.
+ *
+ * @return The number of instructions left, 0 if the budget is exhausted or
+ *         disabled.
+ */
+QBDI_EXPORT rword qbdi_getInstructionBudget(VMInstanceRef instance);
+
+/*! Enable or disable the test of the stop requests by the generated code at
+ *  the entry of each sequence. This function mustn't be called when the VM
+ *  runs.
+ *
+ * @param[in] instance  VM instance.
+ * @param[in] enable    Enable or disable the polling.
+ *
+ * @return True if the polling has been configured.
+ */
+QBDI_EXPORT bool qbdi_setStopPolling(VMInstanceRef instance, bool enable);
+
+/*! Request the run of the VM to stop at the entry of the next sequence. This
+ *  function may be called from any thread.
+ *
+ * @param[in] instance  VM instance.
+ */
+QBDI_EXPORT void qbdi_requestStop(VMInstanceRef instance);
+
 /*! Obtain the current general purpose register state.
  *
  * @param[in] instance  VM instance.
@@ -245,6 +381,31 @@ QBDI_EXPORT Options qbdi_getOptions(VMInstanceRef instance);
  */
 QBDI_EXPORT void qbdi_setOptions(VMInstanceRef instance, Options options);
 
+/*! Get the size of the code and data blocks used to store the instrumented
+ *  code.
+ *
+ * @param[in]  instance  VM instance.
+ * @param[out] codeSize  Size in bytes of the code blocks (0 for one page)
+ * @param[out] dataSize  Size in bytes of the data blocks (0 for one page)
+ */
+QBDI_EXPORT void qbdi_getExecBlockSize(VMInstanceRef instance,
+                                       uint32_t *codeSize, uint32_t *dataSize);
+
+/*! Set the size of the code and data blocks used to store the instrumented
+ *  code. The sizes are rounded up to the page size.
+ *  This method mustn't be called when the VM runs.
+ *
+ * @param[in] instance  VM instance.
+ * @param[in] codeSize  Size in bytes of the code blocks, up to 64KiB
+ *                      (0 for one page)
+ * @param[in] dataSize  Size in bytes of the data blocks, up to 512KiB
+ *                      (0 for one page)
+ *
+ * @return True if the sizes are valid and have been applied.
+ */
+QBDI_EXPORT bool qbdi_setExecBlockSize(VMInstanceRef instance,
+                                       uint32_t codeSize, uint32_t dataSize);
+
 /*! Add a custom instrumentation rule to the VM.
  *
  * @param[in] instance   VM instance.
@@ -308,6 +469,113 @@ QBDI_EXPORT uint32_t qbdi_addMemAccessCB(VMInstanceRef instance,
                                          InstCallback cbk, void *data,
                                          int priority);
 
+/*! Register a callback event for the memory accesses matching the type
+ * bitfield, called only if a predicate holds. The accesses are recorded on
+ * every execution but the instrumented code only returns to the VM when the
+ * predicate holds, QBDI_PREDICATE_COUNTER and QBDI_PREDICATE_SAMPLE allow to
+ * sample the accesses.
+ *
+ * @param[in] instance   VM instance.
+ * @param[in] type       A mode bitfield: either QBDI_MEMORY_READ,
+ *                       QBDI_MEMORY_WRITE or both (QBDI_MEMORY_READ_WRITE).
+ *                       QBDI_PREDICATE_MEM_IN_RANGE is only available with
+ *                       QBDI_MEMORY_READ.
+ * @param[in] predicate  The predicate of the callback.
+ * @param[in] cbk        A function pointer to the callback.
+ * @param[in] data       User defined data passed to the callback.
+ * @param[in] priority   The priority of the callback.
+ *
+ * @return The id of the registered instrumentation (or QBDI_INVALID_EVENTID
+ * in case of failure).
+ */
+QBDI_EXPORT uint32_t qbdi_addMemAccessCBIf(VMInstanceRef instance,
+                                           MemoryAccessType type,
+                                           const CallbackPredicate *predicate,
+                                           InstCallback cbk, void *data,
+                                           int priority);
+
+/*! Register an inline counter of the executions of an address range. The
+ * counter is incremented by the generated code, without returning to the VM.
+ *
+ * @param[in]  instance  VM instance.
+ * @param[in]  start     Start of the address range which will increment the
+ *                       counter.
+ * @param[in]  end       End of the address range which will increment the
+ *                       counter.
+ * @param[in]  pos       Relative position of the increment
+ *                       (QBDI_PREINST / QBDI_POSTINST).
+ * @param[out] counter   The address of the counter, valid until the
+ *                       instrumentation is removed.
+ * @param[in]  priority  The priority of the increment.
+ *
+ * @return The id of the registered instrumentation (or QBDI_INVALID_EVENTID
+ * in case of failure).
+ */
+QBDI_EXPORT uint32_t qbdi_addCodeCounter(VMInstanceRef instance, rword start,
+                                         rword end, InstPosition pos,
+                                         uint64_t **counter, int priority);
+
+/*! Update a coverage bitmap from the generated code, without returning to the
+ * VM. At the entry of each sequence, the entry of the edge (AFL style) or of
+ * the basic block is incremented.
+ *
+ * @param[in] instance  VM instance.
+ * @param[in] bitmap    The bitmap to update, NULL to disable the coverage.
+ * @param[in] size      The size of the bitmap, a power of two up to 2**31.
+ * @param[in] mode      The kind of coverage
+ *                      (QBDI_COVERAGE_EDGE / QBDI_COVERAGE_BLOCK).
+ *
+ * @return True if the coverage has been configured.
+ */
+QBDI_EXPORT bool qbdi_setCoverageBitmap(VMInstanceRef instance,
+                                        uint8_t *bitmap, size_t size,
+                                        CoverageMode mode);
+
+/*! Clear the coverage bitmap and the previous location of the edge coverage,
+ * without flushing the translation cache.
+ *
+ * @param[in] instance  VM instance.
+ */
+QBDI_EXPORT void qbdi_resetCoverage(VMInstanceRef instance);
+
+/*! Compile an instrumentation plan into the inline instrumentations of the
+ * VM. If a step can't be applied, the instrumentation added by the previous
+ * steps is removed.
+ *
+ * @param[in]  instance  VM instance.
+ * @param[in]  steps     The steps of the plan.
+ * @param[in]  nbSteps   The number of steps.
+ * @param[out] ids       If not NULL, an array of nbSteps ids receiving the id
+ *                       of the instrumentation of each counter, or
+ *                       QBDI_INVALID_EVENTID for the other steps.
+ *
+ * @return True if all the steps have been applied.
+ */
+QBDI_EXPORT bool qbdi_addPlan(VMInstanceRef instance, const PlanStep *steps,
+                              size_t nbSteps, uint32_t *ids);
+
+/*! Take a snapshot of the GPR and FPR states of the VM and of the content of
+ * some ranges of memory, replacing the previous snapshot. The snapshot can be
+ * restored between the iterations of a persistent loop.
+ *
+ * @param[in] instance  VM instance.
+ * @param[in] ranges    Array of nbRanges pairs of start (included) and end
+ *                      (excluded) addresses. The ranges must be readable and
+ *                      writable, and must not contain instrumented code.
+ * @param[in] nbRanges  The number of ranges.
+ */
+QBDI_EXPORT void qbdi_takeSnapshot(VMInstanceRef instance, const rword *ranges,
+                                   size_t nbRanges);
+
+/*! Restore the states and the memory saved by qbdi_takeSnapshot. The
+ * translation cache isn't flushed.
+ *
+ * @param[in] instance  VM instance.
+ *
+ * @return False if no snapshot has been taken.
+ */
+QBDI_EXPORT bool qbdi_restoreSnapshot(VMInstanceRef instance);
+
 /*! Add a virtual callback which is triggered for any memory access at a
  * specific address matching the access type. Virtual callbacks are called via
  * callback forwarding by a gate callback triggered on every memory access. This
@@ -348,6 +616,25 @@ QBDI_EXPORT uint32_t qbdi_addMemRangeCB(VMInstanceRef instance, rword start,
                                         rword end, MemoryAccessType type,
                                         InstCallback cbk, void *data);
 
+/*! Register a callback which receives the memory accesses of each sequence at
+ * its end (QBDI_SEQUENCE_EXIT). The accesses are decoded with a table
+ * precomputed when the sequence is translated. The basic block ends when
+ * vmState->event contains QBDI_BASIC_BLOCK_EXIT.
+ *
+ * @param[in] instance  VM instance.
+ * @param[in] type      A mode bitfield: either QBDI_MEMORY_READ,
+ *                      QBDI_MEMORY_WRITE or both (QBDI_MEMORY_READ_WRITE).
+ * @param[in] cbk       A function pointer to the callback.
+ * @param[in] data      User defined data passed to the callback.
+ *
+ * @return The id of the registered instrumentation (or QBDI_INVALID_EVENTID
+ * in case of failure).
+ */
+QBDI_EXPORT uint32_t qbdi_addBBMemAccessCB(VMInstanceRef instance,
+                                           MemoryAccessType type,
+                                           BBMemAccessCallback cbk,
+                                           void *data);
+
 /*! Register a callback event if the instruction matches the mnemonic.
  *
  * @param[in] instance   VM instance.
@@ -398,6 +685,27 @@ QBDI_EXPORT uint32_t qbdi_addCodeAddrCB(VMInstanceRef instance, rword address,
                                         InstPosition pos, InstCallback cbk,
                                         void *data, int priority);
 
+/*! Register a callback for when one of the addresses is executed. A single
+ * instrumentation is registered for all the addresses.
+ *
+ * @param[in] instance     VM instance.
+ * @param[in] addresses    Code addresses which will trigger the callback.
+ * @param[in] nbAddresses  Number of addresses.
+ * @param[in] pos          Relative position of the callback
+ *                         (QBDI_PREINST / QBDI_POSTINST).
+ * @param[in] cbk          A function pointer to the callback.
+ * @param[in] data         User defined data passed to the callback.
+ * @param[in] priority     The priority of the callback.
+ *
+ * @return The id of the registered instrumentation (or QBDI_INVALID_EVENTID
+ * in case of failure).
+ */
+QBDI_EXPORT uint32_t qbdi_addCodeAddrSetCB(VMInstanceRef instance,
+                                           const rword *addresses,
+                                           size_t nbAddresses,
+                                           InstPosition pos, InstCallback cbk,
+                                           void *data, int priority);
+
 /*! Register a callback for when a specific address range is executed.
  *
  * @param[in] instance  VM instance.
@@ -417,6 +725,147 @@ QBDI_EXPORT uint32_t qbdi_addCodeRangeCB(VMInstanceRef instance, rword start,
                                          InstCallback cbk, void *data,
                                          int priority);
 
+/*! Register a callback event for every instruction executed, called only if
+ * a predicate holds. The predicate is evaluated by the instrumented code,
+ * without returning to the VM when it doesn't hold.
+ *
+ * @param[in] instance   VM instance.
+ * @param[in] pos        Relative position of the event callback
+ *                       (QBDI_PREINST / QBDI_POSTINST).
+ *                       QBDI_PREDICATE_MEM_IN_RANGE is only available with
+ *                       QBDI_PREINST.
+ * @param[in] predicate  The predicate of the callback.
+ * @param[in] cbk        A function pointer to the callback.
+ * @param[in] data       User defined data passed to the callback.
+ * @param[in] priority   The priority of the callback.
+ *
+ * @return The id of the registered instrumentation (or QBDI_INVALID_EVENTID
+ * in case of failure).
+ */
+QBDI_EXPORT uint32_t qbdi_addCodeCBIf(VMInstanceRef instance, InstPosition pos,
+                                      const CallbackPredicate *predicate,
+                                      InstCallback cbk, void *data,
+                                      int priority);
+
+/*! Register a callback for when a specific address range is executed, called
+ * only if a predicate holds. The predicate is evaluated by the instrumented
+ * code, without returning to the VM when it doesn't hold.
+ *
+ * @param[in] instance   VM instance.
+ * @param[in] start      Start of the address range which will trigger the
+ *                       callback.
+ * @param[in] end        End of the address range which will trigger the
+ *                       callback.
+ * @param[in] pos        Relative position of the callback
+ *                       (QBDI_PREINST / QBDI_POSTINST).
+ *                       QBDI_PREDICATE_MEM_IN_RANGE is only available with
+ *                       QBDI_PREINST.
+ * @param[in] predicate  The predicate of the callback.
+ * @param[in] cbk        A function pointer to the callback.
+ * @param[in] data       User defined data passed to the callback.
+ * @param[in] priority   The priority of the callback.
+ *
+ * @return The id of the registered instrumentation (or QBDI_INVALID_EVENTID
+ * in case of failure).
+ */
+QBDI_EXPORT uint32_t qbdi_addCodeRangeCBIf(VMInstanceRef instance, rword start,
+                                           rword end, InstPosition pos,
+                                           const CallbackPredicate *predicate,
+                                           InstCallback cbk, void *data,
+                                           int priority);
+
+/*! Register a lightweight callback event for every instruction executed. The
+ * callback is called by the instrumented code on the host stack, without
+ * returning to the VM. Only SP, PC, the flags, the registers clobbered by a
+ * call and the registers of the footprint are valid in the GPRState.
+ *
+ * Without QBDI_FOOTPRINT_FPR, the FPRState isn't up to date and the callback
+ * must not use the floating point and vector registers.
+ *
+ * @param[in] instance   VM instance.
+ * @param[in] pos        Relative position of the event callback
+ *                       (QBDI_PREINST / QBDI_POSTINST).
+ * @param[in] cbk        A function pointer to the callback.
+ * @param[in] data       User defined data passed to the callback.
+ * @param[in] footprint  The registers used by the callback.
+ * @param[in] priority   The priority of the callback.
+ *
+ * @return The id of the registered instrumentation (or QBDI_INVALID_EVENTID
+ * in case of failure).
+ */
+QBDI_EXPORT uint32_t qbdi_addCodeCBLight(VMInstanceRef instance,
+                                         InstPosition pos, InstCallback cbk,
+                                         void *data,
+                                         CallbackFootprint footprint,
+                                         int priority);
+
+/*! Register a lightweight callback for when a specific address range is
+ * executed. See qbdi_addCodeCBLight for the restrictions of the callback.
+ *
+ * @param[in] instance   VM instance.
+ * @param[in] start      Start of the address range which will trigger the
+ *                       callback.
+ * @param[in] end        End of the address range which will trigger the
+ *                       callback.
+ * @param[in] pos        Relative position of the callback
+ *                       (QBDI_PREINST / QBDI_POSTINST).
+ * @param[in] cbk        A function pointer to the callback.
+ * @param[in] data       User defined data passed to the callback.
+ * @param[in] footprint  The registers used by the callback.
+ * @param[in] priority   The priority of the callback.
+ *
+ * @return The id of the registered instrumentation (or QBDI_INVALID_EVENTID
+ * in case of failure).
+ */
+QBDI_EXPORT uint32_t qbdi_addCodeRangeCBLight(VMInstanceRef instance,
+                                              rword start, rword end,
+                                              InstPosition pos,
+                                              InstCallback cbk, void *data,
+                                              CallbackFootprint footprint,
+                                              int priority);
+
+/*! Register a callback event for every instruction executed, with the
+ * analysis of the instruction made when the instruction is instrumented.
+ *
+ * @param[in] instance  VM instance.
+ * @param[in] pos       Relative position of the event callback
+ *                      (QBDI_PREINST / QBDI_POSTINST).
+ * @param[in] cbk       A function pointer to the callback.
+ * @param[in] data      User defined data passed to the callback.
+ * @param[in] type      Properties to retrieve in the analysis.
+ * @param[in] priority  The priority of the callback.
+ *
+ * @return The id of the registered instrumentation (or QBDI_INVALID_EVENTID
+ * in case of failure).
+ */
+QBDI_EXPORT uint32_t qbdi_addCodeAnalysisCB(VMInstanceRef instance,
+                                            InstPosition pos,
+                                            InstAnalysisCallback cbk,
+                                            void *data, AnalysisType type,
+                                            int priority);
+
+/*! Register a callback event for an address range, with the analysis of the
+ * instruction made when the instruction is instrumented.
+ *
+ * @param[in] instance  VM instance.
+ * @param[in] start     Start of the address range which will trigger the
+ *                      callback.
+ * @param[in] end       End of the address range which will trigger the
+ *                      callback.
+ * @param[in] pos       Relative position of the event callback
+ *                      (QBDI_PREINST / QBDI_POSTINST).
+ * @param[in] cbk       A function pointer to the callback.
+ * @param[in] data      User defined data passed to the callback.
+ * @param[in] type      Properties to retrieve in the analysis.
+ * @param[in] priority  The priority of the callback.
+ *
+ * @return The id of the registered instrumentation (or QBDI_INVALID_EVENTID
+ * in case of failure).
+ */
+QBDI_EXPORT uint32_t qbdi_addCodeRangeAnalysisCB(
+    VMInstanceRef instance, rword start, rword end, InstPosition pos,
+    InstAnalysisCallback cbk, void *data, AnalysisType type, int priority);
+
 /*! Register a callback event for a specific VM event.
  *
  * @param[in] instance  VM instance.
@@ -430,6 +879,67 @@ QBDI_EXPORT uint32_t qbdi_addCodeRangeCB(VMInstanceRef instance, rword start,
 QBDI_EXPORT uint32_t qbdi_addVMEventCB(VMInstanceRef instance, VMEvent mask,
                                        VMCallback cbk, void *data);
 
+/*! Give the basic blocks translated by the runs to a callback in batches.
+ * The callback is called when the batch is full and at the end of each run.
+ *
+ * @param[in] instance   VM instance.
+ * @param[in] cbk        The callback of the entries, NULL to disable the
+ *                       batches.
+ * @param[in] data       User defined data passed to the callback.
+ * @param[in] threshold  The number of entries of a batch.
+ *
+ * @return True if the batches have been configured.
+ */
+QBDI_EXPORT bool qbdi_setNewBasicBlockBatch(VMInstanceRef instance,
+                                            NewBasicBlockCallback cbk,
+                                            void *data, size_t threshold);
+
+/*! Register the callbacks of the transfers of the execution to a native
+ * function. The callbacks are only called for this target.
+ *
+ * @param[in] instance  VM instance.
+ * @param[in] target    The address of the native function.
+ * @param[in] preCbk    The callback before the transfer, or NULL.
+ * @param[in] postCbk   The callback after the return of the function, or NULL.
+ * @param[in] data      User defined data passed to the callbacks.
+ *
+ * @return The id of the registered instrumentation (or QBDI_INVALID_EVENTID
+ * in case of failure).
+ */
+QBDI_EXPORT uint32_t qbdi_addTransferHook(VMInstanceRef instance, rword target,
+                                          VMCallback preCbk, VMCallback postCbk,
+                                          void *data);
+
+/*! Register the callbacks of the entry and the exit of an instrumented
+ * function. The exit is detected at the return address recorded at the
+ * entry, the returns of the process aren't instrumented.
+ *
+ * @param[in] instance  VM instance.
+ * @param[in] address   The address of the entry of the function.
+ * @param[in] onEntry   The callback of the entry, or NULL.
+ * @param[in] onExit    The callback of the exit, or NULL.
+ * @param[in] data      User defined data passed to the callbacks.
+ *
+ * @return The id of the registered instrumentation (or QBDI_INVALID_EVENTID
+ * in case of failure).
+ */
+QBDI_EXPORT uint32_t qbdi_addFunctionHook(VMInstanceRef instance,
+                                          rword address, InstCallback onEntry,
+                                          InstCallback onExit, void *data);
+
+/*! Replace a function by another one. The calls and the jumps to the original
+ * function continue at the replacement without any callback.
+ *
+ * @param[in] instance     VM instance.
+ * @param[in] orig         The address of the original function.
+ * @param[in] replacement  The address of the replacement.
+ *
+ * @return The id of the registered instrumentation (or QBDI_INVALID_EVENTID
+ * in case of failure).
+ */
+QBDI_EXPORT uint32_t qbdi_replaceFunction(VMInstanceRef instance, rword orig,
+                                          rword replacement);
+
 /*! Remove an instrumentation.
  *
  * @param[in] instance  VM instance.
@@ -440,6 +950,20 @@ QBDI_EXPORT uint32_t qbdi_addVMEventCB(VMInstanceRef instance, VMEvent mask,
 QBDI_EXPORT bool qbdi_deleteInstrumentation(VMInstanceRef instance,
                                             uint32_t id);
 
+/*! Enable or disable an instrumentation without removing it. The callbacks of
+ * the instruction and memory access instrumentations don't need any flush of
+ * the cache.
+ *
+ * @param[in] instance  VM instance.
+ * @param[in] id        The id of the instrumentation.
+ * @param[in] enable    Enable or disable the instrumentation.
+ *
+ * @return  True if the instrumentation exists. The VM events and the memory
+ *          callbacks of a range cannot be disabled.
+ */
+QBDI_EXPORT bool qbdi_setInstrumentationEnabled(VMInstanceRef instance,
+                                                uint32_t id, bool enable);
+
 /*! Remove all the registered instrumentations.
  *
  * @param[in] instance  VM instance.
@@ -474,6 +998,94 @@ QBDI_EXPORT const InstAnalysis *
 qbdi_getCachedInstAnalysis(const VMInstanceRef instance, rword address,
                            AnalysisType type);
 
+/*! Obtain the handle of the current instruction. The handle resolves the
+ * analysis of the instruction without searching the cache and can be kept by a
+ * tool instead of the address. This method must only be used in an
+ * InstCallback.
+ *
+ * @param[in] instance     VM instance.
+ *
+ * @return The handle of the current instruction, 0 on failure.
+ */
+QBDI_EXPORT InstHandle qbdi_getInstHandle(const VMInstanceRef instance);
+
+/*! Obtain the handle of a cached instruction.
+ *
+ * @param[in] instance     VM instance.
+ * @param[in] address      The address of the instruction.
+ *
+ * @return The handle of the instruction, 0 if the instruction isn't in the
+ *    cache.
+ */
+QBDI_EXPORT InstHandle qbdi_getCachedInstHandle(const VMInstanceRef instance,
+                                                rword address);
+
+/*! Obtain the analysis of an instruction from its handle. A handle is
+ * invalidated when the ExecBlock of its instruction is freed, for instance
+ * after a clearCache.
+ *
+ * @param[in] instance     VM instance.
+ * @param[in] handle       The handle of the instruction.
+ * @param[in] type         Properties to retrieve during analysis.
+ *
+ * @return A InstAnalysis structure containing the analysis result.
+ *    null if the handle is no longer valid.
+ */
+QBDI_EXPORT const InstAnalysis *
+qbdi_getInstAnalysisByHandle(const VMInstanceRef instance, InstHandle handle,
+                             AnalysisType type);
+
+/*! Call a callback on each instruction of the translation cache with its
+ * analysis, without a lookup per instruction. The order of the sequences is
+ * unspecified and the instructions shared by several sequences are given once
+ * for each of them. The callback must not modify the cache of the VM.
+ *
+ * @param[in] instance     VM instance.
+ * @param[in] cbk          The callback, returning QBDI_STOP to end the
+ *                         iteration.
+ * @param[in] data         User defined data given to the callback.
+ * @param[in] type         Properties to retrieve during analysis.
+ *
+ * @return The number of instructions given to the callback.
+ */
+QBDI_EXPORT size_t qbdi_iterateCache(const VMInstanceRef instance,
+                                     CachedInstCallback cbk, void *data,
+                                     AnalysisType type);
+
+/*! Disassemble and analyse the instructions of a range without translating
+ * them. The analyses are written in an array of the caller and are
+ * independent of the cache of the VM. The operands and the disassembly of the
+ * analyses must be released with qbdi_releaseAnalyses.
+ *
+ * The analysis stops at the end of the range, at the first invalid
+ * instruction, when the array is full or, if basicBlock is true, after the
+ * first instruction that may change the control flow.
+ *
+ * @param[in]  instance    VM instance.
+ * @param[in]  start       Start of the range, the memory of the range must be
+ *                         readable.
+ * @param[in]  end         End of the range (excluded).
+ * @param[out] analyses    The array of the analyses.
+ * @param[in]  count       The number of InstAnalysis of the array.
+ * @param[in]  type        Properties to retrieve during analysis.
+ * @param[in]  basicBlock  Stop at the end of the first basic block.
+ * @param[in]  nbThreads   The number of threads of the analysis.
+ *
+ * @return The number of analysed instructions.
+ */
+QBDI_EXPORT size_t qbdi_analyzeRange(const VMInstanceRef instance, rword start,
+                                     rword end, InstAnalysis *analyses,
+                                     size_t count, AnalysisType type,
+                                     bool basicBlock, unsigned nbThreads);
+
+/*! Release the operands and the disassembly of analyses written by
+ * qbdi_analyzeRange.
+ *
+ * @param[in] analyses  The array of the analyses.
+ * @param[in] count     The number of analyses returned by qbdi_analyzeRange.
+ */
+QBDI_EXPORT void qbdi_releaseAnalyses(InstAnalysis *analyses, size_t count);
+
 /*! Add instrumentation rules to log memory access using inline instrumentation
  and
  *  instruction shadows.
@@ -481,7 +1093,11 @@ qbdi_getCachedInstAnalysis(const VMInstanceRef instance, rword address,
  * @param[in] instance  VM instance.
  * @param[in] type      Memory mode bitfield to activate the logging for:
  *                      either QBDI_MEMORY_READ, QBDI_MEMORY_WRITE
- *                      or both (QBDI_MEMORY_READ_WRITE).
+ *                      or both (QBDI_MEMORY_READ_WRITE). With
+ *                      QBDI_MEMORY_ADDRESS_ONLY, the value of the accesses
+ *                      isn't captured. With QBDI_MEMORY_NO_STACK or
+ *                      QBDI_MEMORY_NO_FRAME, the accesses relative to the
+ *                      stack aren't recorded.
  *
  * @return True if inline memory logging is supported, False if not or in case
  of error.
@@ -489,6 +1105,23 @@ qbdi_getCachedInstAnalysis(const VMInstanceRef instance, rword address,
 QBDI_EXPORT bool qbdi_recordMemoryAccess(VMInstanceRef instance,
                                          MemoryAccessType type);
 
+/*! Add instrumentation rules to log the memory accesses of the instructions
+ *  of a range only.
+ *
+ * @param[in] instance  VM instance.
+ * @param[in] start     Start of the range of instructions.
+ * @param[in] end       End of the range of instructions (not included).
+ * @param[in] type      Memory mode bitfield to activate the logging for:
+ *                      either QBDI_MEMORY_READ, QBDI_MEMORY_WRITE
+ *                      or both (QBDI_MEMORY_READ_WRITE).
+ *
+ * @return True if inline memory logging is supported, False if not or in case
+ of error.
+ */
+QBDI_EXPORT bool qbdi_recordMemoryAccessRange(VMInstanceRef instance,
+                                              rword start, rword end,
+                                              MemoryAccessType type);
+
 /*! Obtain the memory accesses made by the last executed instruction.
  *  The method should be called in an InstCallback.
  *  Return NULL and a size of 0 if the instruction made no memory access.
@@ -515,6 +1148,139 @@ QBDI_EXPORT MemoryAccess *qbdi_getInstMemoryAccess(VMInstanceRef instance,
 QBDI_EXPORT MemoryAccess *qbdi_getBBMemoryAccess(VMInstanceRef instance,
                                                  size_t *size);
 
+/*! Obtain the memory accesses made by the last executed instruction without
+ *  allocating. The method should be called in an InstCallback.
+ *
+ *  @param[in]  instance     VM instance.
+ *  @param[out] buffer       Array where the memory accesses are written.
+ *  @param[in]  capacity     Number of elements of the buffer.
+ *
+ * @return The number of memory accesses made by the instruction. Only the
+ *         first capacity accesses are written if the number is greater.
+ */
+QBDI_EXPORT size_t qbdi_getInstMemoryAccessBuffer(VMInstanceRef instance,
+                                                  MemoryAccess *buffer,
+                                                  size_t capacity);
+
+/*! Obtain the memory accesses made by the last executed basic block without
+ *  allocating. The method should be called in a VMCallback with
+ *  QBDI_SEQUENCE_EXIT.
+ *
+ *  @param[in]  instance     VM instance.
+ *  @param[out] buffer       Array where the memory accesses are written.
+ *  @param[in]  capacity     Number of elements of the buffer.
+ *
+ * @return The number of memory accesses made by the basic block. Only the
+ *         first capacity accesses are written if the number is greater.
+ */
+QBDI_EXPORT size_t qbdi_getBBMemoryAccessBuffer(VMInstanceRef instance,
+                                                MemoryAccess *buffer,
+                                                size_t capacity);
+
+/*! Obtain the whole value of a memory access larger than a rword, captured
+ *  with the option QBDI_OPT_ENABLE_WIDE_MEMACCESS_VALUE
+ *  (QBDI_MEMORY_WIDE_VALUE). The method should be called in the callback
+ *  which obtained the access.
+ *
+ *  @param[in]  instance     VM instance.
+ *  @param[in]  access       An access of qbdi_getInstMemoryAccess or
+ *                           qbdi_getBBMemoryAccess.
+ *  @param[out] buffer       Buffer where the value is written.
+ *  @param[in]  size         Size of the buffer, at least access->size bytes.
+ *
+ * @return True if the value has been written in the buffer.
+ */
+QBDI_EXPORT bool qbdi_getMemoryAccessValue(VMInstanceRef instance,
+                                           const MemoryAccess *access,
+                                           void *buffer, size_t size);
+
+/*! Trace the memory accesses in a buffer written by the generated code. The
+ *  VM only returns to the host when the buffer is full: the callback then
+ *  receives all the entries of the buffer. The pending entries are also given
+ *  at the end of each run.
+ *
+ * @param[in] instance     VM instance.
+ * @param[in] type         Memory mode bitfield of the accesses to trace:
+ *                         either QBDI_MEMORY_READ, QBDI_MEMORY_WRITE or both
+ *                         (QBDI_MEMORY_READ_WRITE).
+ * @param[in] cbk          The callback of the entries, NULL to disable the
+ *                         trace.
+ * @param[in] data         User defined data passed to the callback.
+ * @param[in] capacity     The number of entries of the buffer.
+ *
+ * @return True if the trace has been configured.
+ */
+QBDI_EXPORT bool qbdi_setMemoryTrace(VMInstanceRef instance,
+                                     MemoryAccessType type,
+                                     MemoryTraceCallback cbk, void *data,
+                                     size_t capacity);
+
+/*! Trace the calls in a buffer written by the generated code. After each
+ *  call, the address of the call, its target and its first arguments are
+ *  appended to the buffer. The VM only returns to the host when the buffer is
+ *  full. The pending entries are also given at the end of each run.
+ *
+ * @param[in] instance     VM instance.
+ * @param[in] cbk          The callback of the entries, NULL to disable the
+ *                         trace.
+ * @param[in] data         User defined data passed to the callback.
+ * @param[in] nbArgs       The number of arguments of the calls, at most
+ *                         QBDI_CALL_TRACE_MAX_ARGS.
+ * @param[in] capacity     The number of entries of the buffer.
+ *
+ * @return True if the trace has been configured.
+ */
+QBDI_EXPORT bool qbdi_setCallTrace(VMInstanceRef instance,
+                                   CallTraceCallback cbk, void *data,
+                                   uint32_t nbArgs, size_t capacity);
+
+/*! Set the number of arguments captured for the direct calls of a callee in
+ *  the call trace.
+ *
+ * @param[in] instance     VM instance.
+ * @param[in] target       The address of the callee.
+ * @param[in] nbArgs       The number of arguments, at most
+ *                         QBDI_CALL_TRACE_MAX_ARGS.
+ *
+ * @return False if the call trace isn't enabled.
+ */
+QBDI_EXPORT bool qbdi_setCallTraceArity(VMInstanceRef instance, rword target,
+                                        uint32_t nbArgs);
+
+/*! Count the memory accesses by page of 4KiB from the generated code. The
+ *  translation cache is flushed.
+ *
+ * @param[in] instance     VM instance.
+ * @param[in] enable       Enable or disable the histogram.
+ * @param[in] type         Memory mode bitfield of the accesses to count:
+ *                         either QBDI_MEMORY_READ, QBDI_MEMORY_WRITE or both
+ *                         (QBDI_MEMORY_READ_WRITE).
+ *
+ * @return True if the histogram has been configured.
+ */
+QBDI_EXPORT bool qbdi_setPageHistogram(VMInstanceRef instance, bool enable,
+                                       MemoryAccessType type);
+
+/*! Get a snapshot of the counters of the accessed pages, sorted by
+ *  decreasing number of accesses.
+ *
+ * @param[in]  instance     VM instance.
+ * @param[out] buffer       Array where the counters are written.
+ * @param[in]  capacity     Number of elements of the buffer.
+ *
+ * @return The number of accessed pages. Only the first capacity pages are
+ *         written if the number is greater.
+ */
+QBDI_EXPORT size_t qbdi_getPageHistogram(VMInstanceRef instance,
+                                         PageAccessStats *buffer,
+                                         size_t capacity);
+
+/*! Clear the counters of the page histogram.
+ *
+ * @param[in] instance     VM instance.
+ */
+QBDI_EXPORT void qbdi_resetPageHistogram(VMInstanceRef instance);
+
 /*! Pre-cache a known basic block
  *  This method mustn't be called when the VM runs.
  *
@@ -525,6 +1291,84 @@ QBDI_EXPORT MemoryAccess *qbdi_getBBMemoryAccess(VMInstanceRef instance,
  */
 QBDI_EXPORT bool qbdi_precacheBasicBlock(VMInstanceRef instance, rword pc);
 
+/*! Pre-cache a list of known basic blocks in one go.
+ *  This method mustn't be called when the VM runs.
+ *
+ *  @param[in]  instance     VM instance.
+ *  @param[in]  addresses    Start addresses of the basic blocks.
+ *  @param[in]  count        The number of addresses.
+ *
+ * @return The number of basic blocks inserted in the cache.
+ */
+QBDI_EXPORT size_t qbdi_precacheBasicBlocks(VMInstanceRef instance,
+                                            const rword *addresses,
+                                            size_t count);
+
+/*! Pre-cache the code of a range reachable from entry points through the
+ *  direct branches and calls.
+ *  This method mustn't be called when the VM runs.
+ *
+ *  @param[in]  instance     VM instance.
+ *  @param[in]  start        The start of the range.
+ *  @param[in]  end          The end of the range (excluded).
+ *  @param[in]  entries      The entry points, or NULL to start at start.
+ *  @param[in]  count        The number of entry points.
+ *  @param[in]  useSymbols   Also use the function symbols of the range.
+ *
+ * @return The number of basic blocks inserted in the cache.
+ */
+QBDI_EXPORT size_t qbdi_precacheRange(VMInstanceRef instance, rword start,
+                                      rword end, const rword *entries,
+                                      size_t count, bool useSymbols);
+
+/*! Pre-cache the code of the executable maps of a module reachable from
+ *  entry points and its function symbols.
+ *  This method mustn't be called when the VM runs.
+ *
+ *  @param[in]  instance     VM instance.
+ *  @param[in]  name         The name of the module.
+ *  @param[in]  entries      The entry points, or NULL.
+ *  @param[in]  count        The number of entry points.
+ *  @param[in]  useSymbols   Use the function symbols of the module.
+ *
+ * @return The number of basic blocks inserted in the cache.
+ */
+QBDI_EXPORT size_t qbdi_precacheModule(VMInstanceRef instance,
+                                       const char *name, const rword *entries,
+                                       size_t count, bool useSymbols);
+
+/*! Pre-cache the sequences cached by another VM. The two VMs mustn't run.
+ *
+ *  @param[in]  instance     VM instance.
+ *  @param[in]  other        The VM whose cache is reproduced.
+ *
+ * @return The number of basic blocks inserted in the cache.
+ */
+QBDI_EXPORT size_t qbdi_precacheFrom(VMInstanceRef instance,
+                                     VMInstanceRef other);
+
+/*! Write the start addresses of the cached sequences in a file, relative to
+ *  the base address of their module.
+ *
+ *  @param[in]  instance     VM instance.
+ *  @param[in]  path         The path of the file.
+ *
+ * @return False if the file cannot be written.
+ */
+QBDI_EXPORT bool qbdi_saveCacheProfile(VMInstanceRef instance,
+                                       const char *path);
+
+/*! Pre-cache the sequences recorded by qbdi_saveCacheProfile in the modules
+ *  loaded in the process.
+ *  This method mustn't be called when the VM runs.
+ *
+ *  @param[in]  instance     VM instance.
+ *  @param[in]  path         The path of the file.
+ *
+ * @return The number of basic blocks inserted in the cache.
+ */
+QBDI_EXPORT size_t qbdi_prewarmCache(VMInstanceRef instance, const char *path);
+
 /*! Clear a specific address range from the translation cache.
  *
  * @param[in] instance     VM instance.
@@ -541,6 +1385,389 @@ QBDI_EXPORT void qbdi_clearCache(VMInstanceRef instance, rword start,
  */
 QBDI_EXPORT void qbdi_clearAllCache(VMInstanceRef instance);
 
+/*! Seal the translation cache before the process forks its workers. The
+ *  forked processes share the code of the cached sequences with the parent.
+ *  This method mustn't be called when the VM runs.
+ *
+ * @param[in] instance     VM instance.
+ *
+ * @return False if OPT_ENABLE_DUAL_MAPPING or OPT_ENABLE_SHARED_CONTEXT is
+ *         enabled.
+ */
+QBDI_EXPORT bool qbdi_sealCache(VMInstanceRef instance);
+
+/*! Get the memory budget of the translation cache.
+ *
+ * @param[in] instance     VM instance.
+ *
+ * @return The budget in bytes (0 for no limit).
+ */
+QBDI_EXPORT size_t qbdi_getCacheLimit(VMInstanceRef instance);
+
+/*! Set the memory budget of the translation cache. When a new ExecBlock
+ *  exceeds the budget, the least recently used regions of the cache are
+ *  evicted.
+ *
+ * @param[in] instance     VM instance.
+ * @param[in] limit        The budget in bytes (0 for no limit).
+ */
+QBDI_EXPORT void qbdi_setCacheLimit(VMInstanceRef instance, size_t limit);
+
+/*! Get the statistics of the translation cache.
+ *
+ * @param[in]  instance     VM instance.
+ * @param[out] stats        The statistics of the cache.
+ */
+QBDI_EXPORT void qbdi_getCacheStats(VMInstanceRef instance, CacheStats *stats);
+
+/*! Get the memory used by the translation cache, by component.
+ *
+ * @param[in]  instance     VM instance.
+ * @param[out] stats        The memory used by the cache.
+ */
+QBDI_EXPORT void qbdi_getMemoryStats(VMInstanceRef instance,
+                                     MemoryStats *stats);
+
+/*! Get the statistics of the transfers of the ExecBroker to the native code,
+ *  sorted by decreasing number of cycles.
+ *
+ * @param[in]  instance     VM instance.
+ * @param[out] buffer       Array where the statistics are written.
+ * @param[in]  capacity     Number of elements of the buffer.
+ *
+ * @return The number of targets of the transfers. Only the first capacity
+ *         targets are written if the number is greater.
+ */
+QBDI_EXPORT size_t qbdi_getTransferStats(VMInstanceRef instance,
+                                         TransferStats *buffer,
+                                         size_t capacity);
+
+/*! Count the dispatches of the sequences and the reasons of the returns of
+ *  the generated code to the VM. The counters are reset when they are
+ *  enabled.
+ *
+ * @param[in] instance     VM instance.
+ * @param[in] enable       True to count the executions, false to disable and
+ *                         discard the counters.
+ */
+QBDI_EXPORT void qbdi_setExecStats(VMInstanceRef instance, bool enable);
+
+/*! Get the execution counters since their last reset.
+ *
+ * @param[in]  instance     VM instance.
+ * @param[out] stats        The counters (all 0 if they are disabled).
+ */
+QBDI_EXPORT void qbdi_getExecStats(VMInstanceRef instance, ExecStats *stats);
+
+/*! Reset the execution counters.
+ *
+ * @param[in] instance     VM instance.
+ */
+QBDI_EXPORT void qbdi_resetExecStats(VMInstanceRef instance);
+
+/*! Demote automatically the functions called threshold times without
+ *  executing an instrumented sequence to the native execution.
+ *
+ * @param[in] instance     VM instance.
+ * @param[in] threshold    The number of calls before the demotion, 0 to
+ *                         disable the demotion.
+ */
+QBDI_EXPORT void qbdi_setAutoDemotion(VMInstanceRef instance,
+                                      uint32_t threshold);
+
+/*! Get the entries of the functions demoted by the automatic demotion.
+ *
+ * @param[in]  instance     VM instance.
+ * @param[out] buffer       Array where the sorted entries are written.
+ * @param[in]  capacity     Number of elements of the buffer.
+ *
+ * @return The number of demoted functions. Only the first capacity entries
+ *         are written if the number is greater.
+ */
+QBDI_EXPORT size_t qbdi_getDemotedFunctions(VMInstanceRef instance,
+                                            rword *buffer, size_t capacity);
+
+/*! Attribute the costs of the instrumentation to the InstrRules. The
+ *  translation cache is flushed when the state changes.
+ *
+ * @param[in] instance     VM instance.
+ * @param[in] enable       Enable or disable the statistics.
+ * @param[in] reportPath   File where the statistics sorted by cost are
+ *                         written when the VM is destroyed, NULL for no
+ *                         report.
+ *
+ * @return True if the statistics have been configured.
+ */
+QBDI_EXPORT bool qbdi_setInstrRuleStats(VMInstanceRef instance, bool enable,
+                                        const char *reportPath);
+
+/*! Get the statistics of the InstrRules, sorted by decreasing cost.
+ *
+ * @param[in]  instance     VM instance.
+ * @param[out] buffer       Array where the statistics are written.
+ * @param[in]  capacity     Number of elements of the buffer.
+ *
+ * @return The number of InstrRules. Only the first capacity statistics are
+ *         written if the number is greater.
+ */
+QBDI_EXPORT size_t qbdi_getInstrRuleStats(VMInstanceRef instance,
+                                          InstrRuleStats *buffer,
+                                          size_t capacity);
+
+/*! Reset the statistics of the InstrRules.
+ *
+ * @param[in] instance     VM instance.
+ */
+QBDI_EXPORT void qbdi_resetInstrRuleStats(VMInstanceRef instance);
+
+/*! Count the executions of each sequence from the generated code. The
+ *  translation cache is flushed.
+ *
+ * @param[in] instance     VM instance.
+ * @param[in] enable       Enable or disable the profile.
+ * @param[in] reportPath   File where the sorted profile is written when the
+ *                         VM is destroyed, NULL for no report.
+ *
+ * @return True if the profile has been configured.
+ */
+QBDI_EXPORT bool qbdi_setSequenceProfile(VMInstanceRef instance, bool enable,
+                                         const char *reportPath);
+
+/*! Get the execution counters of the sequences, sorted by decreasing number
+ *  of instructions executed.
+ *
+ * @param[in]  instance     VM instance.
+ * @param[out] buffer       Array where the counters are written.
+ * @param[in]  capacity     Number of elements of the buffer.
+ *
+ * @return The number of executed sequences. Only the first capacity
+ *         sequences are written if the number is greater.
+ */
+QBDI_EXPORT size_t qbdi_getSequenceProfile(VMInstanceRef instance,
+                                           SequenceStats *buffer,
+                                           size_t capacity);
+
+/*! Clear the execution counters of the sequences.
+ *
+ * @param[in] instance     VM instance.
+ */
+QBDI_EXPORT void qbdi_resetSequenceProfile(VMInstanceRef instance);
+
+/*! Count the outcomes of the conditional branches from the generated code.
+ *  The translation cache is flushed.
+ *
+ * @param[in] instance     VM instance.
+ * @param[in] enable       Enable or disable the profile.
+ *
+ * @return True if the profile has been configured.
+ */
+QBDI_EXPORT bool qbdi_setBranchProfile(VMInstanceRef instance, bool enable);
+
+/*! Get the outcome counters of the executed conditional branches, sorted by
+ *  decreasing number of executions.
+ *
+ * @param[in]  instance     VM instance.
+ * @param[out] buffer       Array where the counters are written.
+ * @param[in]  capacity     Number of elements of the buffer.
+ *
+ * @return The number of executed branches. Only the first capacity branches
+ *         are written if the number is greater.
+ */
+QBDI_EXPORT size_t qbdi_getBranchProfile(VMInstanceRef instance,
+                                         BranchStats *buffer, size_t capacity);
+
+/*! Clear the outcome counters of the conditional branches.
+ *
+ * @param[in] instance     VM instance.
+ */
+QBDI_EXPORT void qbdi_resetBranchProfile(VMInstanceRef instance);
+
+/*! Count the targets of the indirect calls and jumps from the generated
+ *  code. The translation cache is flushed.
+ *
+ * @param[in] instance     VM instance.
+ * @param[in] enable       Enable or disable the profile.
+ *
+ * @return True if the profile has been configured.
+ */
+QBDI_EXPORT bool qbdi_setIndirectProfile(VMInstanceRef instance, bool enable);
+
+/*! Get the executed targets of the indirect calls and jumps, sorted by
+ *  decreasing number of executions.
+ *
+ * @param[in]  instance     VM instance.
+ * @param[out] buffer       Array where the counters are written.
+ * @param[in]  capacity     Number of elements of the buffer.
+ *
+ * @return The number of executed targets. Only the first capacity targets
+ *         are written if the number is greater.
+ */
+QBDI_EXPORT size_t qbdi_getIndirectProfile(VMInstanceRef instance,
+                                           IndirectTargetStats *buffer,
+                                           size_t capacity);
+
+/*! Clear the counters of the targets of the indirect calls and jumps.
+ *
+ * @param[in] instance     VM instance.
+ */
+QBDI_EXPORT void qbdi_resetIndirectProfile(VMInstanceRef instance);
+
+/*! Count the values of a register before an instruction from the generated
+ *  code. The profile is removed with qbdi_deleteInstrumentation.
+ *
+ * @param[in] instance     VM instance.
+ * @param[in] address      The address of the instruction.
+ * @param[in] reg          The index of the register in the GPRState.
+ * @param[in] buckets      The number of values recorded in the table (1 to
+ *                         16).
+ *
+ * @return The id of the registered instrumentation (or QBDI_INVALID_EVENTID
+ * in case of failure).
+ */
+QBDI_EXPORT uint32_t qbdi_addValueProfile(VMInstanceRef instance,
+                                          rword address, uint32_t reg,
+                                          size_t buckets);
+
+/*! Get the values counted by a value profile, sorted by decreasing number of
+ *  executions.
+ *
+ * @param[in]  instance     VM instance.
+ * @param[in]  id           The id of the value profile.
+ * @param[out] buffer       Array where the counters are written.
+ * @param[in]  capacity     Number of elements of the buffer.
+ *
+ * @return The number of counted values. Only the first capacity values are
+ *         written if the number is greater.
+ */
+QBDI_EXPORT size_t qbdi_getValueProfile(VMInstanceRef instance, uint32_t id,
+                                        ValueStats *buffer, size_t capacity);
+
+/*! Clear the counters of a value profile.
+ *
+ * @param[in] instance     VM instance.
+ * @param[in] id           The id of the value profile.
+ *
+ * @return True if the id is a value profile.
+ */
+QBDI_EXPORT bool qbdi_resetValueProfile(VMInstanceRef instance, uint32_t id);
+
+/*! Record the call graph from the generated code. The translation cache is
+ *  flushed.
+ *
+ * @param[in] instance     VM instance.
+ * @param[in] enable       Enable or disable the profile.
+ *
+ * @return True if the profile has been configured.
+ */
+QBDI_EXPORT bool qbdi_setCallGraphProfile(VMInstanceRef instance, bool enable);
+
+/*! Get the executed edges of the call graph, sorted by decreasing number of
+ *  calls.
+ *
+ * @param[in]  instance     VM instance.
+ * @param[out] buffer       Array where the edges are written.
+ * @param[in]  capacity     Number of elements of the buffer.
+ *
+ * @return The number of executed edges. Only the first capacity edges are
+ *         written if the number is greater.
+ */
+QBDI_EXPORT size_t qbdi_getCallGraphProfile(VMInstanceRef instance,
+                                            CallGraphEdgeStats *buffer,
+                                            size_t capacity);
+
+/*! Clear the counters of the edges of the call graph.
+ *
+ * @param[in] instance     VM instance.
+ */
+QBDI_EXPORT void qbdi_resetCallGraphProfile(VMInstanceRef instance);
+
+/*! Count the calls to the allocators with transfer hooks on their entries
+ *  and sample the stacks of the allocations (Linux and Android only).
+ *
+ * @param[in] instance     VM instance.
+ * @param[in] enable       Enable or disable the profile.
+ * @param[in] samplePeriod The number of allocations between two sampled
+ *                         stacks, 0 to not sample the stacks.
+ * @param[in] reportPath   File where the profile is written when the VM is
+ *                         destroyed, NULL for no report.
+ *
+ * @return False if no allocator is found in the loaded modules.
+ */
+QBDI_EXPORT bool qbdi_setAllocationProfile(VMInstanceRef instance, bool enable,
+                                           uint32_t samplePeriod,
+                                           const char *reportPath);
+
+/*! Get the counters of the allocation profile.
+ *
+ * @param[in]  instance     VM instance.
+ * @param[out] stats        The counters of the allocators.
+ */
+QBDI_EXPORT void qbdi_getAllocationProfile(VMInstanceRef instance,
+                                           AllocationStats *stats);
+
+/*! Get the stacks sampled by the allocation profile, sorted by decreasing
+ *  sampled bytes.
+ *
+ * @param[in]  instance     VM instance.
+ * @param[out] buffer       Array where the stacks are written.
+ * @param[in]  capacity     Number of elements of the buffer.
+ *
+ * @return The number of sampled stacks. Only the first capacity stacks are
+ *         written if the number is greater.
+ */
+QBDI_EXPORT size_t qbdi_getAllocationSites(VMInstanceRef instance,
+                                           AllocationSite *buffer,
+                                           size_t capacity);
+
+/*! Clear the counters and the stacks of the allocation profile.
+ *
+ * @param[in] instance     VM instance.
+ */
+QBDI_EXPORT void qbdi_resetAllocationProfile(VMInstanceRef instance);
+
+/*! Sample a hardware event of the thread of the VM during the runs (Linux
+ *  and Android only).
+ *
+ * @param[in] instance     VM instance.
+ * @param[in] event        The hardware event.
+ * @param[in] period       The number of events between two samples, 0 to
+ *                         disable the sampling.
+ *
+ * @return True if the sampling has been configured.
+ */
+QBDI_EXPORT bool qbdi_setHardwareSampling(VMInstanceRef instance,
+                                          HardwareEvent event,
+                                          uint64_t period);
+
+/*! Get the samples of the hardware event by original instruction, sorted by
+ *  decreasing number of samples.
+ *
+ * @param[in]  instance     VM instance.
+ * @param[out] buffer       Array where the samples are written.
+ * @param[in]  capacity     Number of elements of the buffer.
+ *
+ * @return The number of sampled instructions. Only the first capacity
+ *         instructions are written if the number is greater.
+ */
+QBDI_EXPORT size_t qbdi_getHardwareSamples(VMInstanceRef instance,
+                                           HardwareSample *buffer,
+                                           size_t capacity);
+
+/*! Clear the samples of the hardware sampling.
+ *
+ * @param[in] instance     VM instance.
+ */
+QBDI_EXPORT void qbdi_resetHardwareSamples(VMInstanceRef instance);
+
+/*! Get the cumulative profile of the translation phases. The profile is only
+ * updated when QBDI is compiled with QBDI_PROFILE_TRANSLATION.
+ *
+ * @param[in]  instance     VM instance.
+ * @param[out] profile      The profile of the translation.
+ */
+QBDI_EXPORT void qbdi_getTranslationProfile(VMInstanceRef instance,
+                                            TranslationProfile *profile);
+
 #ifdef __cplusplus
 } // "C"
 } // QBDI::
@@ -30,14 +30,141 @@ namespace QBDI {
 typedef enum {
   _QBDI_EI(NO_OPT) = 0, /*!< Default value */
   // general options between 0 and 23
-  _QBDI_EI(OPT_DISABLE_FPR) = 1 << 0,          /*!< Disable all operation on FPU
-                                                * (SSE, AVX, SIMD). May break
-                                                * the execution if the target
-                                                * use the FPU
+  _QBDI_EI(OPT_DISABLE_FPR) = 1 << 0,           /*!< Disable all operation on
+                                                 * FPU (SSE, AVX, SIMD). May
+                                                 * break the execution if the
+                                                 * target use the FPU
+                                                 */
+  _QBDI_EI(OPT_DISABLE_OPTIONAL_FPR) = 1 << 1,  /*!< Disable context switch
+                                                 * optimisation when the target
+                                                 * execblock doesn't used FPR
+                                                 */
+  _QBDI_EI(OPT_ENABLE_BLOCK_CHAINING) = 1 << 2, /*!< Link the translated
+                                                 * sequences together when the
+                                                 * successor is already in the
+                                                 * cache, without returning to
+                                                 * the VM between them
+                                                 */
+  _QBDI_EI(OPT_ENABLE_INDIRECT_CACHE) = 1 << 3, /*!< Look up the targets of
+                                                 * the indirect branches in a
+                                                 * cache of the ExecBlock and
+                                                 * jump to the translated
+                                                 * sequence on a hit
+                                                 */
+  _QBDI_EI(OPT_ENABLE_SHARED_CONTEXT) = 1 << 4, /*!< Share the context page
+                                                 * between all the ExecBlocks
+                                                 * to avoid copying the state
+                                                 * when the execution moves
+                                                 * to another ExecBlock (Linux
+                                                 * and Android only)
+                                                 */
+  _QBDI_EI(OPT_ENABLE_DUAL_MAPPING) = 1 << 5,   /*!< Map the code of the
+                                                 * ExecBlocks twice, a writable
+                                                 * and an executable alias, to
+                                                 * write the code without
+                                                 * changing the permissions of
+                                                 * the pages (Linux and Android
+                                                 * only)
+                                                 */
+  _QBDI_EI(OPT_ENABLE_ASYNC_PATCH) = 1 << 6,    /*!< Disassemble and patch
+                                                 * the likely successors of
+                                                 * the translated basic blocks
+                                                 * in a worker thread
+                                                 */
+  _QBDI_EI(OPT_ENABLE_SUPERBLOCK) = 1 << 7,     /*!< Retranslate the hot
+                                                 * sequences as superblocks
+                                                 * that follow the direct
+                                                 * jumps and calls
+                                                 */
+  _QBDI_EI(OPT_ENABLE_MEMACCESS_COALESCING) = 1 << 8, /*!< Record only the
+                                                       * address of the memory
+                                                       * accesses and merge
+                                                       * the adjacent accesses
+                                                       * of a sequence
+                                                       * relative to the same
+                                                       * registers
+                                                       */
+  _QBDI_EI(OPT_ENABLE_MEMCB_PAGE_WATCH) = 1 << 9, /*!< Protect the pages
+                                                    * of the ranges of
+                                                    * addMemRangeCB and only
+                                                    * instrument the
+                                                    * sequences which access
+                                                    * them
+                                                    */
+  _QBDI_EI(OPT_ENABLE_SHARED_ANALYSIS) = 1 << 10, /*!< Share the analyses
+                                                    * of the instructions
+                                                    * with the other VMs
+                                                    * of the process which
+                                                    * use this option
+                                                    */
+  _QBDI_EI(OPT_BYPASS_PLT) = 1 << 11, /*!< Execute the targets of the PLT
+                                     * stubs without instrumenting the
+                                     * stubs
+                                     */
+  _QBDI_EI(OPT_ENABLE_REENTRY) = 1 << 12, /*!< Execute through the VM the
+                                         * instrumented functions called
+                                         * back by the non-instrumented
+                                         * functions
+                                         */
+  _QBDI_EI(OPT_ENABLE_SHARED_PATCHES) = 1 << 13, /*!< Share the translated
+                                                  * basic blocks with the
+                                                  * other VMs of the process
+                                                  * which use the same CPU
+                                                  * and options
+                                                  */
+  _QBDI_EI(OPT_ENABLE_LIVENESS) = 1 << 14, /*!< Use the registers and the
+                                            * flags dead in the basic
+                                            * block as scratch of the
+                                            * instrumentation. Their
+                                            * value may be wrong in the
+                                            * callbacks
+                                            */
+  _QBDI_EI(OPT_ENABLE_HUGE_PAGES) = 1 << 15, /*!< Put the code and the data
+                                              * of the ExecBlocks in
+                                              * separate areas backed by
+                                              * transparent huge pages
+                                              * (Linux and Android only)
+                                              */
+  _QBDI_EI(OPT_ENABLE_RETURN_STACK) = 1 << 16, /*!< Predict the targets of
+                                                * the returns with a shadow
+                                                * stack of the calls of the
+                                                * ExecBlock. Used with
+                                                * OPT_ENABLE_INDIRECT_CACHE
                                                 */
-  _QBDI_EI(OPT_DISABLE_OPTIONAL_FPR) = 1 << 1, /*!< Disable context switch
-                                                * optimisation when the target
-                                                * execblock doesn't used FPR
+  _QBDI_EI(OPT_ENABLE_PERF_MAP) = 1 << 17, /*!< Name the translated code
+                                            * in the perf map of the
+                                            * process
+                                            * (/tmp/perf-<pid>.map, Linux
+                                            * and Android only)
+                                            */
+  _QBDI_EI(OPT_ENABLE_SMC_DETECTION) = 1 << 18, /*!< Protect the writable
+                                                 * pages of the translated
+                                                 * code against the writes
+                                                 * and translate again the
+                                                 * code of the written
+                                                 * pages (Linux, Android
+                                                 * and macOS only)
+                                                 */
+  _QBDI_EI(OPT_ENABLE_WIDE_MEMACCESS_VALUE) = 1 << 19, /*!< Capture the
+                                                        * value of the
+                                                        * recorded accesses
+                                                        * of 16, 32 and 64
+                                                        * bytes
+                                                        */
+  _QBDI_EI(OPT_SINGLE_STEP) = 1 << 20, /*!< Translate the instructions in
+                                        * sequences of one instruction,
+                                        * executed one at a time by
+                                        * VM::step. The chaining, the
+                                        * superblocks and the asynchronous
+                                        * patch are disabled
+                                        */
+  _QBDI_EI(OPT_ENABLE_NUMA_BINDING) = 1 << 21, /*!< Bind the ExecBlocks and
+                                                * their contexts to the
+                                                * NUMA node of the thread
+                                                * which runs the VM, and
+                                                * move them when the VM
+                                                * runs on another node
+                                                * (Linux and Android only)
                                                 */
   // architecture specific option between 24 and 31
   _QBDI_EI(OPT_ATT_SYNTAX) = 1 << 24,   /*!< Used the AT&T syntax for
@@ -48,6 +175,14 @@ typedef enum {
                                          * instructions (RD|WR)(FS|GS)BASE that
                                          * must be supported by the operating
                                          * system */
+  _QBDI_EI(OPT_ENABLE_NEAR_EXECBLOCK) = 1 << 26, /*!< Allocate the ExecBlocks
+                                                  * near the instrumented
+                                                  * code and access the
+                                                  * memory relative to RIP
+                                                  * without a temporary
+                                                  * register when it is
+                                                  * reachable
+                                                  */
 } Options;
 
 _QBDI_ENABLE_BITMASK_OPERATORS(Options)
@@ -0,0 +1,258 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "QBDI/Range.h"
+
+#include "Engine/AllocationProfile.h"
+#include "Patch/InstrRules.h"
+#include "Utility/LogSys.h"
+#include "Utility/Symbol.h"
+
+namespace QBDI {
+
+// The symbols of the allocators, the mangled operators for a 64 and a 32 bits
+// size_t. The arrays share the operators of the objects.
+static const std::pair<const char *, AllocatorFunction> allocatorSymbols[] = {
+    {"malloc", ALLOCATOR_MALLOC},
+    {"calloc", ALLOCATOR_CALLOC},
+    {"realloc", ALLOCATOR_REALLOC},
+    {"free", ALLOCATOR_FREE},
+    {"_Znwm", ALLOCATOR_NEW},
+    {"_Znwj", ALLOCATOR_NEW},
+    {"_Znam", ALLOCATOR_NEW},
+    {"_Znaj", ALLOCATOR_NEW},
+    {"_ZnwmRKSt9nothrow_t", ALLOCATOR_NEW},
+    {"_ZnwjRKSt9nothrow_t", ALLOCATOR_NEW},
+    {"_ZnamRKSt9nothrow_t", ALLOCATOR_NEW},
+    {"_ZnajRKSt9nothrow_t", ALLOCATOR_NEW},
+    {"_ZdlPv", ALLOCATOR_DELETE},
+    {"_ZdlPvm", ALLOCATOR_DELETE},
+    {"_ZdlPvj", ALLOCATOR_DELETE},
+    {"_ZdaPv", ALLOCATOR_DELETE},
+    {"_ZdaPvm", ALLOCATOR_DELETE},
+    {"_ZdaPvj", ALLOCATOR_DELETE},
+};
+
+// Get an integer argument of a call, at the entry of the callee
+static rword getArgument(const GPRState *gprState, unsigned index) {
+#if defined(QBDI_ARCH_X86_64)
+#if defined(QBDI_PLATFORM_WINDOWS)
+  return index == 0 ? gprState->rcx : gprState->rdx;
+#else
+  return index == 0 ? gprState->rdi : gprState->rsi;
+#endif
+#else
+  // the arguments follow the return address on the stack
+  const rword *stack =
+      reinterpret_cast<const rword *>(QBDI_GPR_GET(gprState, REG_SP));
+  return stack[index + 1];
+#endif
+}
+
+// The class 0 counts the empty allocations, the class i the sizes in
+// [2^(i-1), 2^i), the last class also counts the larger sizes
+static size_t getSizeClass(rword size) {
+  size_t sizeClass = 0;
+  while (size != 0 and sizeClass < QBDI_ALLOCATION_SIZE_CLASSES - 1) {
+    size >>= 1;
+    sizeClass++;
+  }
+  return sizeClass;
+}
+
+AllocationProfile::AllocationProfile() {
+  for (size_t i = 0; i < ALLOCATOR_FUNCTIONS; i++) {
+    hooks[i] = Hook{this, static_cast<AllocatorFunction>(i)};
+  }
+  reset();
+}
+
+std::vector<std::pair<rword, AllocatorFunction>>
+AllocationProfile::findAllocators() {
+  std::vector<std::pair<rword, AllocatorFunction>> res;
+  for (const auto &symbol : allocatorSymbols) {
+    std::vector<Range<rword>> extents;
+    getFunctionExtents(symbol.first, extents);
+    for (const Range<rword> &extent : extents) {
+      // the aliases of a function are only hooked once
+      if (std::none_of(res.begin(), res.end(),
+                       [&extent](const std::pair<rword, AllocatorFunction> &p) {
+                         return p.first == extent.start();
+                       })) {
+        res.emplace_back(extent.start(), symbol.second);
+      }
+    }
+  }
+  return res;
+}
+
+VMAction AllocationProfile::hookCB(VMInstanceRef vm, const VMState *vmState,
+                                   GPRState *gprState, FPRState *fprState,
+                                   void *data) {
+  const Hook *hook = static_cast<const Hook *>(data);
+  hook->profile->record(hook->function, gprState);
+  return CONTINUE;
+}
+
+void AllocationProfile::record(AllocatorFunction function,
+                               const GPRState *gprState) {
+  counts[function].fetch_add(1, std::memory_order_relaxed);
+  rword size;
+  switch (function) {
+    case ALLOCATOR_MALLOC:
+    case ALLOCATOR_NEW:
+      size = getArgument(gprState, 0);
+      break;
+    case ALLOCATOR_CALLOC:
+      size = getArgument(gprState, 0) * getArgument(gprState, 1);
+      break;
+    case ALLOCATOR_REALLOC:
+      size = getArgument(gprState, 1);
+      break;
+    default:
+      // the releases are only counted
+      return;
+  }
+  allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+  sizeClasses[getSizeClass(size)].fetch_add(1, std::memory_order_relaxed);
+
+  if (samplePeriod == 0 or --sampleCountdown != 0) {
+    return;
+  }
+  sampleCountdown = samplePeriod;
+  // the return address of the allocator, then the ones of the shadow stack.
+  // The top frame is the call of the allocator when it is instrumented.
+  std::array<rword, QBDI_ALLOCATION_STACK_DEPTH> stack{};
+  size_t depth = 0;
+  stack[depth++] =
+      *reinterpret_cast<const rword *>(QBDI_GPR_GET(gprState, REG_SP));
+  if (callStack != nullptr) {
+    // the frame 0 is the entry point, a deeper stack lost its oldest frames
+    for (rword i = 0; i < callStack->top and i < CALL_GRAPH_DEPTH and
+                      depth < QBDI_ALLOCATION_STACK_DEPTH;
+         i++) {
+      rword returnAddress =
+          callStack->frames[(callStack->top - i) % CALL_GRAPH_DEPTH]
+              .returnAddress;
+      if (returnAddress != stack[depth - 1]) {
+        stack[depth++] = returnAddress;
+      }
+    }
+  }
+  std::pair<uint64_t, uint64_t> &site = sites[stack];
+  site.first++;
+  site.second += size;
+}
+
+AllocationStats AllocationProfile::getStats() const {
+  AllocationStats stats;
+  stats.mallocCount = counts[ALLOCATOR_MALLOC].load(std::memory_order_relaxed);
+  stats.callocCount = counts[ALLOCATOR_CALLOC].load(std::memory_order_relaxed);
+  stats.reallocCount =
+      counts[ALLOCATOR_REALLOC].load(std::memory_order_relaxed);
+  stats.freeCount = counts[ALLOCATOR_FREE].load(std::memory_order_relaxed);
+  stats.newCount = counts[ALLOCATOR_NEW].load(std::memory_order_relaxed);
+  stats.deleteCount = counts[ALLOCATOR_DELETE].load(std::memory_order_relaxed);
+  stats.allocatedBytes = allocatedBytes.load(std::memory_order_relaxed);
+  for (size_t i = 0; i < QBDI_ALLOCATION_SIZE_CLASSES; i++) {
+    stats.sizeClasses[i] = sizeClasses[i].load(std::memory_order_relaxed);
+  }
+  return stats;
+}
+
+std::vector<AllocationSite> AllocationProfile::getSites(size_t topN) const {
+  std::vector<AllocationSite> res;
+  res.reserve(sites.size());
+  for (const auto &it : sites) {
+    AllocationSite site;
+    std::copy(it.first.begin(), it.first.end(), site.frames);
+    site.samples = it.second.first;
+    site.sampledBytes = it.second.second;
+    res.push_back(site);
+  }
+  // the map is sorted by stack, the sort is stable for the equal sites
+  std::stable_sort(res.begin(), res.end(),
+                   [](const AllocationSite &a, const AllocationSite &b) {
+                     if (a.sampledBytes != b.sampledBytes) {
+                       return a.sampledBytes > b.sampledBytes;
+                     }
+                     return a.samples > b.samples;
+                   });
+  if (topN != 0 and res.size() > topN) {
+    res.resize(topN);
+  }
+  return res;
+}
+
+void AllocationProfile::reset() {
+  for (std::atomic<uint64_t> &count : counts) {
+    count.store(0, std::memory_order_relaxed);
+  }
+  allocatedBytes.store(0, std::memory_order_relaxed);
+  for (std::atomic<uint64_t> &count : sizeClasses) {
+    count.store(0, std::memory_order_relaxed);
+  }
+  sites.clear();
+  sampleCountdown = samplePeriod;
+}
+
+bool AllocationProfile::writeReport(const char *path) const {
+  FILE *file = fopen(path, "w");
+  if (file == nullptr) {
+    QBDI_ERROR("Cannot open the allocation profile {}", path);
+    return false;
+  }
+  AllocationStats stats = getStats();
+  fprintf(file, "# malloc calloc realloc free new delete allocatedBytes\n");
+  fprintf(file,
+          "%" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64
+          " %" PRIu64 " %" PRIu64 "\n",
+          stats.mallocCount, stats.callocCount, stats.reallocCount,
+          stats.freeCount, stats.newCount, stats.deleteCount,
+          stats.allocatedBytes);
+  fprintf(file, "# sizeClass allocations\n");
+  for (size_t i = 0; i < QBDI_ALLOCATION_SIZE_CLASSES; i++) {
+    if (stats.sizeClasses[i] != 0) {
+      fprintf(file, "%zu %" PRIu64 "\n", i, stats.sizeClasses[i]);
+    }
+  }
+  fprintf(file, "# sampledBytes samples frames\n");
+  for (const AllocationSite &site : getSites()) {
+    fprintf(file, "%" PRIu64 " %" PRIu64, site.sampledBytes, site.samples);
+    for (rword frame : site.frames) {
+      if (frame == 0) {
+        break;
+      }
+      const char *symbol = nullptr;
+      uint32_t symbolOffset = 0;
+      const char *module = nullptr;
+      findSymbol(frame, symbol, symbolOffset, module);
+      fprintf(file, " 0x%" PRIx64 ":%s+0x%x:%s", static_cast<uint64_t>(frame),
+              symbol != nullptr ? symbol : "?", symbolOffset,
+              module != nullptr ? module : "?");
+    }
+    fprintf(file, "\n");
+  }
+  return fclose(file) == 0;
+}
+
+} // namespace QBDI
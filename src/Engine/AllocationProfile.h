@@ -0,0 +1,108 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef ALLOCATIONPROFILE_H
+#define ALLOCATIONPROFILE_H
+
+#include <array>
+#include <atomic>
+#include <map>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "QBDI/CacheStats.h"
+#include "QBDI/Callback.h"
+#include "QBDI/State.h"
+
+namespace QBDI {
+
+struct CallGraphState;
+
+enum AllocatorFunction {
+  ALLOCATOR_MALLOC = 0,
+  ALLOCATOR_CALLOC,
+  ALLOCATOR_REALLOC,
+  ALLOCATOR_FREE,
+  ALLOCATOR_NEW,
+  ALLOCATOR_DELETE,
+  ALLOCATOR_FUNCTIONS
+};
+
+/*! Counters of the calls to the allocators, updated by the transfer hooks of
+ * their entries. The counters and the size classes are relaxed atomics, they
+ * can be read by another thread during a run. The call sites are only
+ * updated by the thread of the run.
+ */
+struct AllocationProfile {
+  // data of the transfer hooks, one per function to keep its address stable
+  struct Hook {
+    AllocationProfile *profile;
+    AllocatorFunction function;
+  };
+  Hook hooks[ALLOCATOR_FUNCTIONS];
+  // ids of the transfer hooks registered in the Engine
+  std::vector<uint32_t> hookIds;
+  std::string reportPath;
+  // an allocation in samplePeriod records the stack of its call
+  uint32_t samplePeriod = 1;
+  uint32_t sampleCountdown = 1;
+  // shadow stack of the call graph, null if the call graph is disabled
+  const CallGraphState *callStack = nullptr;
+
+  std::atomic<uint64_t> counts[ALLOCATOR_FUNCTIONS];
+  std::atomic<uint64_t> allocatedBytes;
+  std::atomic<uint64_t> sizeClasses[QBDI_ALLOCATION_SIZE_CLASSES];
+  // samples and bytes of the sampled stacks
+  std::map<std::array<rword, QBDI_ALLOCATION_STACK_DEPTH>,
+           std::pair<uint64_t, uint64_t>>
+      sites;
+
+  AllocationProfile();
+
+  /*! Get the entries of the allocators of the loaded modules, from the
+   * symbol index
+   */
+  static std::vector<std::pair<rword, AllocatorFunction>> findAllocators();
+
+  /*! Transfer hook of the entry of an allocator, data is the Hook of the
+   * function
+   */
+  static VMAction hookCB(VMInstanceRef vm, const VMState *vmState,
+                         GPRState *gprState, FPRState *fprState, void *data);
+
+  /*! Count a call to an allocator, with the arguments of the state at its
+   * entry
+   */
+  void record(AllocatorFunction function, const GPRState *gprState);
+
+  AllocationStats getStats() const;
+
+  /*! Get the sampled stacks, sorted by decreasing sampled bytes
+   */
+  std::vector<AllocationSite> getSites(size_t topN = 0) const;
+
+  void reset();
+
+  bool writeReport(const char *path) const;
+};
+
+} // namespace QBDI
+
+#endif // ALLOCATIONPROFILE_H
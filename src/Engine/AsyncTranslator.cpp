@@ -0,0 +1,122 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+#include <utility>
+
+#include "llvm/MC/MCInstrInfo.h"
+
+#include "Engine/AsyncTranslator.h"
+#include "Engine/LLVMCPU.h"
+#include "Patch/Patch.h"
+#include "Patch/PatchRule.h"
+#include "Patch/PatchRules.h"
+#include "Utility/LogSys.h"
+
+namespace QBDI {
+
+AsyncTranslator::AsyncTranslator(const std::string &cpu,
+                                 const std::vector<std::string> &mattrs,
+                                 Options opts)
+    : epoch(0), stop(false) {
+  llvmCPUs = std::make_unique<LLVMCPUs>(cpu, mattrs, opts);
+  patchRules = std::make_unique<PatchRuleTable>(
+      getDefaultPatchRules(opts),
+      llvmCPUs->getCPU(CPUMode::DEFAULT).getMCII().getNumOpcodes());
+  worker = std::thread(&AsyncTranslator::workerLoop, this);
+}
+
+AsyncTranslator::~AsyncTranslator() {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    stop = true;
+  }
+  cond.notify_all();
+  worker.join();
+}
+
+void AsyncTranslator::request(rword address, const Range<rword> &range,
+                              CPUMode cpuMode) {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    if (pending.size() >= MAX_PENDING or staged.size() >= MAX_STAGED or
+        staged.count(address) != 0 or
+        std::any_of(pending.begin(), pending.end(),
+                    [address](const Request &r) {
+                      return r.address == address;
+                    })) {
+      return;
+    }
+    pending.push_back(Request{address, range.end(), cpuMode});
+  }
+  cond.notify_one();
+}
+
+bool AsyncTranslator::take(rword address, const LLVMCPU &llvmcpu,
+                           std::vector<Patch> &basicBlock) {
+  std::lock_guard<std::mutex> guard(lock);
+  auto it = staged.find(address);
+  if (it == staged.end()) {
+    return false;
+  }
+  StagedBlock block = std::move(it->second);
+  staged.erase(it);
+  if (block.cpuMode != llvmcpu.getCPUMode()) {
+    return false;
+  }
+  // the patches must use the LLVMCPU of the VM from now on
+  for (Patch &p : block.basicBlock) {
+    p.llvmcpu = &llvmcpu;
+  }
+  basicBlock = std::move(block.basicBlock);
+  QBDI_DEBUG("Take the basic block 0x{:x} translated by the worker", address);
+  return true;
+}
+
+void AsyncTranslator::discard() {
+  std::lock_guard<std::mutex> guard(lock);
+  epoch++;
+  pending.clear();
+  staged.clear();
+}
+
+void AsyncTranslator::workerLoop() {
+  std::unique_lock<std::mutex> guard(lock);
+  while (true) {
+    cond.wait(guard, [this] { return stop or not pending.empty(); });
+    if (stop) {
+      return;
+    }
+    Request req = pending.front();
+    pending.pop_front();
+    uint64_t reqEpoch = epoch;
+
+    guard.unlock();
+    std::vector<Patch> basicBlock = patchRules->patchBasicBlock(
+        req.address, req.end, llvmCPUs->getCPU(req.cpuMode));
+    guard.lock();
+
+    // the code may have changed during the translation
+    if (reqEpoch == epoch and not basicBlock.empty() and
+        staged.size() < MAX_STAGED) {
+      staged.emplace(req.address,
+                     StagedBlock{req.cpuMode, std::move(basicBlock)});
+    }
+  }
+}
+
+} // namespace QBDI
@@ -0,0 +1,123 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef ASYNCTRANSLATOR_H
+#define ASYNCTRANSLATOR_H
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "QBDI/Options.h"
+#include "QBDI/Range.h"
+#include "QBDI/State.h"
+
+namespace QBDI {
+
+class LLVMCPU;
+class LLVMCPUs;
+class Patch;
+class PatchRuleTable;
+
+/*! Disassemble and patch the likely successors of the translated basic
+ * blocks in a worker thread. The worker only applies the PatchRules with its
+ * own LLVMCPUs: the instrumentation, which may call the user callbacks, and
+ * the write in the cache stay in the thread of the VM.
+ */
+class AsyncTranslator {
+  // maximum number of pending requests and of staged basic blocks
+  static constexpr size_t MAX_PENDING = 64;
+  static constexpr size_t MAX_STAGED = 256;
+
+  struct Request {
+    rword address;
+    rword end; // end of the readable code
+    CPUMode cpuMode;
+  };
+
+  struct StagedBlock {
+    CPUMode cpuMode;
+    std::vector<Patch> basicBlock;
+  };
+
+  // only used by the worker after the construction
+  std::unique_ptr<LLVMCPUs> llvmCPUs;
+  std::unique_ptr<PatchRuleTable> patchRules;
+
+  std::mutex lock;
+  std::condition_variable cond;
+  std::deque<Request> pending;
+  std::unordered_map<rword, StagedBlock> staged;
+  // incremented when the staged basic blocks are discarded
+  uint64_t epoch;
+  bool stop;
+  std::thread worker;
+
+  void workerLoop();
+
+public:
+  /*! Start a translation worker.
+   *
+   * @param[in] cpu      The name of the CPU
+   * @param[in] mattrs   A list of additional attributes
+   * @param[in] opts     The options of the Engine
+   */
+  AsyncTranslator(const std::string &cpu,
+                  const std::vector<std::string> &mattrs, Options opts);
+
+  /*! Stop and join the worker.
+   */
+  ~AsyncTranslator();
+
+  AsyncTranslator(const AsyncTranslator &) = delete;
+  AsyncTranslator &operator=(const AsyncTranslator &) = delete;
+
+  /*! Request the translation of a basic block. The request is dropped if the
+   * queue is full or if the address is already pending or staged.
+   *
+   * @param[in] address   The address of the basic block.
+   * @param[in] range     The instrumented range that contains the address.
+   *                      The basic block is cut at its end.
+   * @param[in] cpuMode   The CPUMode of the basic block.
+   */
+  void request(rword address, const Range<rword> &range, CPUMode cpuMode);
+
+  /*! Take a staged basic block.
+   *
+   * @param[in]  address     The address of the basic block.
+   * @param[in]  llvmcpu     The LLVMCPU of the VM, used by the taken patches.
+   * @param[out] basicBlock  The patches of the basic block.
+   *
+   * @return True if the basic block was staged for the mode of llvmcpu.
+   */
+  bool take(rword address, const LLVMCPU &llvmcpu,
+            std::vector<Patch> &basicBlock);
+
+  /*! Discard the pending requests and the staged basic blocks, including the
+   * one being translated. Must be called when the code may have changed.
+   */
+  void discard();
+};
+
+} // namespace QBDI
+
+#endif // ASYNCTRANSLATOR_H
@@ -17,12 +17,24 @@
  */
 #include <algorithm>
 #include <cstdint>
+#include <inttypes.h>
+#include <iterator>
+#include <stdio.h>
 #include <string.h>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
-#include "llvm/ADT/ArrayRef.h"
-#include "llvm/MC/MCDisassembler/MCDisassembler.h"
 #include "llvm/MC/MCInst.h"
+#include "llvm/MC/MCInstrDesc.h"
+#include "llvm/MC/MCInstrInfo.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/Process.h"
 
+#include "Engine/AllocationProfile.h"
+#include "Engine/AsyncTranslator.h"
 #include "Engine/Engine.h"
 #include "Engine/LLVMCPU.h"
 
@@ -30,16 +42,26 @@
 #include "ExecBlock/ExecBlock.h"
 #include "ExecBlock/ExecBlockManager.h"
 #include "ExecBroker/ExecBroker.h"
+#include "Patch/InstInfo.h"
 #include "Patch/InstMetadata.h"
 #include "Patch/InstrRule.h"
+#include "Patch/MemoryAccess.h"
 #include "Patch/Patch.h"
+#include "Patch/PatchCondition.h"
 #include "Patch/PatchRule.h"
 #include "Patch/PatchRules.h"
+#include "Patch/Register.h"
 #include "Utility/LogSys.h"
+#include "Utility/PageWatch.h"
+#include "Utility/PerfMap.h"
+#include "Utility/PerfSampler.h"
+#include "Utility/Profiler.h"
+#include "Utility/Symbol.h"
 
 #include "QBDI/Bitmask.h"
 #include "QBDI/Config.h"
 #include "QBDI/Errors.h"
+#include "QBDI/Memory.hpp"
 #include "QBDI/Range.h"
 #include "QBDI/State.h"
 
@@ -50,18 +72,64 @@
 
 namespace QBDI {
 
+// VMEvent signaled when the code is translated. The translation is done on a
+// cache miss, where the generated code always returns to the VM, they don't
+// prevent the execution to stay in the generated code between the sequences.
+static const VMEvent translationEvent = VMEvent::BASIC_BLOCK_NEW;
+
+// VMEvent signaled when the code is executed, that needs to return to the VM
+// between each sequence. The links, the indirect branch cache and the
+// superblocks are only used without them. The EXEC_TRANSFER events are
+// signaled when the execution leaves the instrumented range, that always
+// returns to the VM.
+static const VMEvent sequenceEvent =
+    VMEvent::SEQUENCE_ENTRY | VMEvent::SEQUENCE_EXIT |
+    VMEvent::BASIC_BLOCK_ENTRY | VMEvent::BASIC_BLOCK_EXIT;
+
+// VMEvent signaled by the callbacks of the system calls
+static const VMEvent syscallEvent =
+    VMEvent::SYSCALL_ENTRY | VMEvent::SYSCALL_EXIT;
+
+// Options that allow to execute several sequences without returning to the VM
+static const Options chainingOptions =
+    Options::OPT_ENABLE_BLOCK_CHAINING | Options::OPT_ENABLE_INDIRECT_CACHE;
+
+// Options that execute several instructions without returning to the VM,
+// cleared by OPT_SINGLE_STEP
+static const Options multiStepOptions =
+    chainingOptions | Options::OPT_ENABLE_RETURN_STACK |
+    Options::OPT_ENABLE_SUPERBLOCK | Options::OPT_ENABLE_ASYNC_PATCH;
+
+static Options filterOptions(Options options) {
+  if (options & Options::OPT_SINGLE_STEP) {
+    return static_cast<Options>(options & ~multiStepOptions);
+  }
+  return options;
+}
+
+// Number of executions of a sequence before building a superblock from it
+static const uint32_t superBlockThreshold = 64;
+
+// Maximal number of basic blocks of a superblock
+static const size_t superBlockMaxBasicBlocks = 8;
+
 Engine::Engine(const std::string &_cpu, const std::vector<std::string> &_mattrs,
                Options opts, VMInstanceRef vminstance)
-    : vminstance(vminstance), instrRulesCounter(0), vmCallbacksCounter(0),
-      curCPUMode(CPUMode::DEFAULT), options(opts), eventMask(VMEvent::NO_EVENT),
+    : vminstance(vminstance), instrRulesCounter(0),
+      instrRulesFilterDirty(true), vmCallbacksCounter(0),
+      curCPUMode(CPUMode::DEFAULT), options(filterOptions(opts)),
+      execBlockCodeSize(0),
+      execBlockDataSize(0), cacheLimit(0), eventMask(VMEvent::NO_EVENT),
       running(false) {
 
-  llvmCPUs = std::make_unique<LLVMCPUs>(_cpu, _mattrs, opts);
+  llvmCPUs = std::make_unique<LLVMCPUs>(_cpu, _mattrs, options);
   blockManager = std::make_unique<ExecBlockManager>(*llvmCPUs, vminstance);
   execBroker = blockManager->getExecBroker();
 
   // Get default Patch rules for this architecture
-  patchRules = getDefaultPatchRules(options);
+  initPatchRules();
+  initTranslator();
+  initPatchCache();
 
   gprState = std::make_unique<GPRState>();
   fprState = std::make_unique<FPRState>();
@@ -74,30 +142,151 @@ Engine::Engine(const std::string &_cpu, const std::vector<std::string> &_mattrs,
   curExecBlock = nullptr;
 }
 
-Engine::~Engine() = default;
+Engine::~Engine() {
+  if (sequenceProfile and not sequenceProfile->reportPath.empty()) {
+    sequenceProfile->writeReport(sequenceProfile->reportPath.c_str());
+  }
+  if (not ruleStatsReport.empty()) {
+    writeInstrRuleStatsReport(ruleStatsReport.c_str());
+  }
+  if (allocationProfile and not allocationProfile->reportPath.empty()) {
+    allocationProfile->writeReport(allocationProfile->reportPath.c_str());
+  }
+  if (options & Options::OPT_ENABLE_PERF_MAP) {
+    flushPerfMap();
+  }
+  if (options & Options::OPT_ENABLE_SMC_DETECTION) {
+    unwatchPages(this);
+  }
+#if defined(QBDI_PROFILE_TRANSLATION)
+  if (profile.disassembly.count != 0 or profile.writeSequence.count != 0) {
+    dumpTranslationProfile(profile);
+  }
+#endif
+}
 
 Engine::Engine(const Engine &other)
     : vminstance(nullptr), instrRules(),
       instrRulesCounter(other.instrRulesCounter),
-      vmCallbacks(other.vmCallbacks),
+      instrRulesFilterDirty(true), vmCallbacks(other.vmCallbacks),
       vmCallbacksCounter(other.vmCallbacksCounter),
-      curCPUMode(CPUMode::DEFAULT), options(other.options),
-      eventMask(other.eventMask), running(false) {
+      vmCallbacksByEvent(other.vmCallbacksByEvent),
+      transferHooks(other.transferHooks), replacements(other.replacements),
+      curCPUMode(CPUMode::DEFAULT),
+      options(other.options),
+      execBlockCodeSize(other.execBlockCodeSize),
+      execBlockDataSize(other.execBlockDataSize),
+      cacheLimit(other.cacheLimit), eventMask(other.eventMask),
+      running(false), coverageBitmap(other.coverageBitmap),
+      coverageSize(other.coverageSize) {
 
   llvmCPUs = std::make_unique<LLVMCPUs>(
       other.llvmCPUs->getCPU(), other.llvmCPUs->getMattrs(), other.options);
-  blockManager = std::make_unique<ExecBlockManager>(*llvmCPUs, nullptr);
+  blockManager = std::make_unique<ExecBlockManager>(
+      *llvmCPUs, nullptr, execBlockCodeSize, execBlockDataSize);
+  blockManager->setCacheLimit(cacheLimit);
   execBroker = blockManager->getExecBroker();
   // copy instrumentation range
   execBroker->setInstrumentedRange(other.execBroker->getInstrumentedRange());
+  execBroker->setModuleTracking(other.execBroker->getModuleTracking());
 
   // Get default Patch rules for this architecture
-  patchRules = getDefaultPatchRules(options);
+  initPatchRules();
+  initTranslator();
+  // The patches only depend on the CPU and the options, the copy reuses the
+  // patches of the source
+  patchCache = other.patchCache;
 
   // Copy unique_ptr of instrRules
   for (const auto &r : other.instrRules) {
     instrRules.emplace_back(r.first, r.second->clone());
+    instrRules.back().second->setGuard(allocGuard(r.second->isEnabled()));
+  }
+  // the value profiles of the copy have their own counters
+  for (const auto &p : other.valueProfiles) {
+    auto profile = std::make_unique<ValueProfile>(
+        p.second->address, p.second->reg, p.second->entries.size() - 1);
+    getInstrRule(p.first)->changeDataPtr(profile.get());
+    valueProfiles.emplace(p.first, std::move(profile));
+  }
+  if (other.coverageRule) {
+    coverageRule = other.coverageRule->clone();
+    coverageRule->changeDataPtr(&coveragePrevLoc);
+  }
+  // The copy has its own counters and no report
+  if (other.sequenceProfileRule) {
+    sequenceProfile = std::make_unique<SequenceProfile>();
+    sequenceProfileRule = std::make_unique<InstrRuleSequenceProfile>(
+        sequenceProfile.get(), PRIORITY_MEMACCESS_LIMIT + 2);
   }
+  if (other.branchProfileRule) {
+    branchProfile = std::make_unique<BranchProfile>();
+    branchProfileRule = InstrRuleBranchProfile::unique(
+        branchProfile.get(), PRIORITY_MEMACCESS_LIMIT + 2);
+  }
+  if (other.indirectProfileRule) {
+    indirectProfile = std::make_unique<IndirectProfile>();
+    indirectProfileRule = InstrRuleIndirectProfile::unique(
+        indirectProfile.get(), PRIORITY_MEMACCESS_LIMIT + 2);
+  }
+  if (other.callGraphRule) {
+    callGraphProfile = std::make_unique<CallGraphProfile>();
+    callGraphRule = std::make_unique<InstrRuleCallGraph>(
+        callGraphProfile.get(), PRIORITY_MEMACCESS_LIMIT + 2);
+  }
+  copyAllocationProfile(other);
+  // The copy starts with the budget left in the original
+  if (other.instructionBudgetRule) {
+    instructionBudget = other.instructionBudget;
+    budgetEnabled = other.budgetEnabled;
+    sliceRule = other.sliceRule;
+    instructionBudgetRule = std::make_unique<InstrRuleInstructionBudget>(
+        &instructionBudget, budgetExhaustedCB, this,
+        PRIORITY_MEMACCESS_LIMIT + 3);
+  }
+  if (other.stopPollingRule) {
+    stopPollingRule = InstrRuleStopRequest::unique(
+        reinterpret_cast<const rword *>(&stopRequest), stopRequestCB, this,
+        PRIORITY_MEMACCESS_LIMIT + 4);
+  }
+  // The copy has its own trace buffer
+  if (other.memoryTrace) {
+    const MemoryTraceBuffer &trace = *other.memoryTrace;
+    memoryTrace = std::make_unique<MemoryTraceBuffer>(
+        trace.type, trace.capacity, trace.cbk, trace.data);
+    memoryTraceRule = other.memoryTraceRule->clone();
+    memoryTraceRule->changeDataPtr(memoryTrace.get());
+  }
+  if (other.callTrace) {
+    const CallTraceBuffer &trace = *other.callTrace;
+    callTrace = std::make_unique<CallTraceBuffer>(
+        trace.nbArgs, trace.capacity, trace.cbk, trace.data);
+    callTrace->arity = trace.arity;
+    callTraceRule = other.callTraceRule->clone();
+    callTraceRule->changeDataPtr(callTrace.get());
+  }
+  // the counters of the copy start at 0
+  execStats.reset();
+  if (other.execStats) {
+    execStats = std::make_unique<ExecStats>();
+  }
+  // the copy learns its own demotions
+  demotionThreshold = other.demotionThreshold;
+  resetDemotion();
+  // the statistics of the rules of the copy start at 0, without report
+  ruleStatsEnabled = other.ruleStatsEnabled;
+  resetInstrRuleStats();
+  // the pending batch stays in the original engine
+  newBlockBatchCbk = other.newBlockBatchCbk;
+  newBlockBatchData = other.newBlockBatchData;
+  newBlockBatchThreshold = other.newBlockBatchThreshold;
+  if (other.pageHistogramRule) {
+    pageHistogram = std::make_unique<PageHistogram>(other.pageHistogram->type);
+    pageHistogramRule = InstrRulePageHistogram::unique(
+        pageHistogram.get(), PRIORITY_MEMACCESS_LIMIT + 2);
+  }
+  // the callbacks of the system calls signal the events of this Engine
+  updateSyscallRules();
 
   gprState = std::make_unique<GPRState>();
   fprState = std::make_unique<FPRState>();
@@ -119,24 +308,151 @@ Engine &Engine::operator=(const Engine &other) {
     llvmCPUs = std::make_unique<LLVMCPUs>(
         other.llvmCPUs->getCPU(), other.llvmCPUs->getMattrs(), other.options);
 
-    blockManager = std::make_unique<ExecBlockManager>(*llvmCPUs, nullptr);
+    blockManager = std::make_unique<ExecBlockManager>(
+        *llvmCPUs, nullptr, execBlockCodeSize, execBlockDataSize);
+    blockManager->setCacheLimit(cacheLimit);
     execBroker = blockManager->getExecBroker();
   }
 
   this->setOptions(other.options);
+  // the CPU may have changed without the options, the patches of the other
+  // Engine have the same CPU and options
+  patchCache = other.patchCache;
+  this->setExecBlockSize(other.execBlockCodeSize, other.execBlockDataSize);
+  this->setCacheLimit(other.cacheLimit);
 
   // copy the configuration
+  releaseAllGuards();
   instrRules.clear();
+  valueProfiles.clear();
   for (const auto &r : other.instrRules) {
     instrRules.emplace_back(r.first, r.second->clone());
+    instrRules.back().second->setGuard(allocGuard(r.second->isEnabled()));
+  }
+  // the value profiles of the copy have their own counters
+  for (const auto &p : other.valueProfiles) {
+    auto profile = std::make_unique<ValueProfile>(
+        p.second->address, p.second->reg, p.second->entries.size() - 1);
+    getInstrRule(p.first)->changeDataPtr(profile.get());
+    valueProfiles.emplace(p.first, std::move(profile));
   }
+  instrRulesFilterDirty = true;
   vmCallbacks = other.vmCallbacks;
   instrRulesCounter = other.instrRulesCounter;
   vmCallbacksCounter = other.vmCallbacksCounter;
+  vmCallbacksByEvent = other.vmCallbacksByEvent;
+  transferHooks = other.transferHooks;
+  replacements = other.replacements;
   eventMask = other.eventMask;
+  coverageRule.reset();
+  if (other.coverageRule) {
+    coverageRule = other.coverageRule->clone();
+    coverageRule->changeDataPtr(&coveragePrevLoc);
+  }
+  coverageBitmap = other.coverageBitmap;
+  coverageSize = other.coverageSize;
+  coveragePrevLoc = 0;
+  sequenceProfileRule.reset();
+  if (other.sequenceProfileRule) {
+    if (not sequenceProfile) {
+      sequenceProfile = std::make_unique<SequenceProfile>();
+    }
+    sequenceProfileRule = std::make_unique<InstrRuleSequenceProfile>(
+        sequenceProfile.get(), PRIORITY_MEMACCESS_LIMIT + 2);
+  }
+  branchProfileRule.reset();
+  if (other.branchProfileRule) {
+    if (not branchProfile) {
+      branchProfile = std::make_unique<BranchProfile>();
+    }
+    branchProfileRule = InstrRuleBranchProfile::unique(
+        branchProfile.get(), PRIORITY_MEMACCESS_LIMIT + 2);
+  }
+  indirectProfileRule.reset();
+  if (other.indirectProfileRule) {
+    if (not indirectProfile) {
+      indirectProfile = std::make_unique<IndirectProfile>();
+    }
+    indirectProfileRule = InstrRuleIndirectProfile::unique(
+        indirectProfile.get(), PRIORITY_MEMACCESS_LIMIT + 2);
+  }
+  callGraphRule.reset();
+  if (other.callGraphRule) {
+    if (not callGraphProfile) {
+      callGraphProfile = std::make_unique<CallGraphProfile>();
+    }
+    callGraphRule = std::make_unique<InstrRuleCallGraph>(
+        callGraphProfile.get(), PRIORITY_MEMACCESS_LIMIT + 2);
+  }
+  copyAllocationProfile(other);
+  instructionBudgetRule.reset();
+  instructionBudget = other.instructionBudget;
+  budgetEnabled = other.budgetEnabled;
+  sliceRule = other.sliceRule;
+  if (other.instructionBudgetRule) {
+    instructionBudgetRule = std::make_unique<InstrRuleInstructionBudget>(
+        &instructionBudget, budgetExhaustedCB, this,
+        PRIORITY_MEMACCESS_LIMIT + 3);
+  }
+  stopPollingRule.reset();
+  if (other.stopPollingRule) {
+    stopPollingRule = InstrRuleStopRequest::unique(
+        reinterpret_cast<const rword *>(&stopRequest), stopRequestCB, this,
+        PRIORITY_MEMACCESS_LIMIT + 4);
+  }
+  flushMemoryTrace();
+  memoryTraceRule.reset();
+  memoryTrace.reset();
+  flushCallTrace();
+  callTraceRule.reset();
+  callTrace.reset();
+  if (other.memoryTrace) {
+    const MemoryTraceBuffer &trace = *other.memoryTrace;
+    memoryTrace = std::make_unique<MemoryTraceBuffer>(
+        trace.type, trace.capacity, trace.cbk, trace.data);
+    memoryTraceRule = other.memoryTraceRule->clone();
+    memoryTraceRule->changeDataPtr(memoryTrace.get());
+  }
+  if (other.callTrace) {
+    const CallTraceBuffer &trace = *other.callTrace;
+    callTrace = std::make_unique<CallTraceBuffer>(
+        trace.nbArgs, trace.capacity, trace.cbk, trace.data);
+    callTrace->arity = trace.arity;
+    callTraceRule = other.callTraceRule->clone();
+    callTraceRule->changeDataPtr(callTrace.get());
+  }
+  // the counters of the copy start at 0
+  execStats.reset();
+  if (other.execStats) {
+    execStats = std::make_unique<ExecStats>();
+  }
+  // the copy learns its own demotions
+  demotionThreshold = other.demotionThreshold;
+  resetDemotion();
+  // the statistics of the rules of the copy start at 0, without report
+  ruleStatsEnabled = other.ruleStatsEnabled;
+  resetInstrRuleStats();
+  // the pending batch stays in the original engine
+  newBlockBatchCbk = other.newBlockBatchCbk;
+  newBlockBatchData = other.newBlockBatchData;
+  newBlockBatchThreshold = other.newBlockBatchThreshold;
+  pageHistogramRule.reset();
+  if (other.pageHistogramRule) {
+    if (not pageHistogram) {
+      pageHistogram =
+          std::make_unique<PageHistogram>(other.pageHistogram->type);
+    }
+    pageHistogram->type = other.pageHistogram->type;
+    pageHistogramRule = InstrRulePageHistogram::unique(
+        pageHistogram.get(), PRIORITY_MEMACCESS_LIMIT + 2);
+  }
+  syscallEntryRule.reset();
+  syscallExitRule.reset();
+  updateSyscallRules();
 
   // copy instrumentation range
   execBroker->setInstrumentedRange(other.execBroker->getInstrumentedRange());
+  execBroker->setModuleTracking(other.execBroker->getModuleTracking());
 
   // copy state
   setGPRState(other.getGPRState());
@@ -148,30 +464,100 @@ Engine &Engine::operator=(const Engine &other) {
 void Engine::setOptions(Options options) {
   QBDI_REQUIRE_ACTION(not running && "Cannot setOptions on a running Engine",
                       abort());
+  options = filterOptions(options);
   if (options != this->options) {
     QBDI_DEBUG("Change Options from {:x} to {:x}", this->options, options);
-    clearAllCache();
+    // The options which only change the analysis of the instructions
+    Options analysisOptions = Options::OPT_ENABLE_SHARED_ANALYSIS;
+#if defined(QBDI_ARCH_X86_64) || defined(QBDI_ARCH_X86)
+    analysisOptions |= Options::OPT_ATT_SYNTAX;
+#endif
+    // The options only read when the VM runs or patches a new basic block,
+    // the code in the cache stays valid
+    Options runtimeOptions =
+        Options::OPT_ENABLE_ASYNC_PATCH | Options::OPT_ENABLE_SHARED_PATCHES |
+        Options::OPT_ENABLE_SUPERBLOCK | Options::OPT_BYPASS_PLT |
+        Options::OPT_ENABLE_REENTRY | Options::OPT_ENABLE_MEMCB_PAGE_WATCH;
+
+    if (((this->options ^ options) & ~(analysisOptions | runtimeOptions)) !=
+        0) {
+      // the patches are kept in the cache of the previous options, which may
+      // be shared with other VMs
+      if (translator) {
+        translator->discard();
+      }
+      blockManager->clearCache(true);
+    } else if (((this->options ^ options) & analysisOptions) != 0) {
+      blockManager->clearInstAnalyses();
+    }
     llvmCPUs->setOptions(options);
+    if ((this->options & ~options) & Options::OPT_ENABLE_SMC_DETECTION) {
+      unwatchPages(this);
+      smcWatchedPages.clear();
+      smcCheckedPages.clear();
+    }
 
-    Options needRecreate =
-        Options::OPT_DISABLE_FPR | Options::OPT_DISABLE_OPTIONAL_FPR;
+    Options needRecreate = Options::OPT_DISABLE_FPR |
+                           Options::OPT_DISABLE_OPTIONAL_FPR |
+                           Options::OPT_ENABLE_SHARED_CONTEXT |
+                           Options::OPT_ENABLE_DUAL_MAPPING |
+                           Options::OPT_ENABLE_HUGE_PAGES |
+                           Options::OPT_ENABLE_NUMA_BINDING;
 #if defined(QBDI_ARCH_X86_64)
-    needRecreate |= Options::OPT_ENABLE_FS_GS;
+    needRecreate |= Options::OPT_ENABLE_FS_GS |
+                    Options::OPT_ENABLE_NEAR_EXECBLOCK;
 #endif // QBDI_ARCH_X86_64
 
+    // The PatchRules are created with the new options
+    Options previousOptions = this->options;
+    this->options = options;
+
     // need to recreate all ExecBlock
-    if (((this->options ^ options) & needRecreate) != 0) {
+    if (((previousOptions ^ options) & needRecreate) != 0) {
       const RangeSet<rword> instrumentationRange =
           execBroker->getInstrumentedRange();
 
-      patchRules = getDefaultPatchRules(options);
-      blockManager = std::make_unique<ExecBlockManager>(*llvmCPUs, vminstance);
+      initPatchRules();
+      blockManager = std::make_unique<ExecBlockManager>(
+          *llvmCPUs, vminstance, execBlockCodeSize, execBlockDataSize);
+      blockManager->setCacheLimit(cacheLimit);
       execBroker = blockManager->getExecBroker();
 
       execBroker->setInstrumentedRange(instrumentationRange);
     }
-    this->options = options;
+    initTranslator();
+    initPatchCache();
+  }
+}
+
+bool Engine::setExecBlockSize(uint32_t codeSize, uint32_t dataSize) {
+  QBDI_REQUIRE_ACTION(
+      not running && "Cannot setExecBlockSize on a running Engine", abort());
+  if (codeSize > MAX_CODE_BLOCK_SIZE or dataSize > MAX_DATA_BLOCK_SIZE) {
+    QBDI_ERROR("Invalid ExecBlock size: code 0x{:x} (max 0x{:x}), data 0x{:x} "
+               "(max 0x{:x})",
+               codeSize, MAX_CODE_BLOCK_SIZE, dataSize, MAX_DATA_BLOCK_SIZE);
+    return false;
   }
+  if (codeSize != execBlockCodeSize or dataSize != execBlockDataSize) {
+    QBDI_DEBUG("Change ExecBlock size to code 0x{:x} data 0x{:x}", codeSize,
+               dataSize);
+    clearAllCache();
+    execBlockCodeSize = codeSize;
+    execBlockDataSize = dataSize;
+
+    // need to recreate all ExecBlock
+    const RangeSet<rword> instrumentationRange =
+        execBroker->getInstrumentedRange();
+
+    blockManager = std::make_unique<ExecBlockManager>(
+        *llvmCPUs, vminstance, execBlockCodeSize, execBlockDataSize);
+    blockManager->setCacheLimit(cacheLimit);
+    execBroker = blockManager->getExecBroker();
+
+    execBroker->setInstrumentedRange(instrumentationRange);
+  }
+  return true;
 }
 
 void Engine::changeVMInstanceRef(VMInstanceRef vminstance) {
@@ -225,6 +611,27 @@ bool Engine::isPreInst() const {
          QBDI_GPR_GET(getGPRState(), REG_PC);
 }
 
+const std::vector<MemoryAccess> &Engine::getInstMemoryAccess() const {
+  if (curExecBlock == nullptr) {
+    instMemAccess.clear();
+    instMemAccessBlock = nullptr;
+    return instMemAccess;
+  }
+  uint16_t instID = curExecBlock->getCurrentInstID();
+  bool afterInst = not isPreInst();
+  if (instMemAccessBlock != curExecBlock or
+      instMemAccessVisit != curExecBlock->getHostVisit() or
+      instMemAccessID != instID or instMemAccessPost != afterInst) {
+    instMemAccess.clear();
+    analyseMemoryAccess(*curExecBlock, instID, afterInst, instMemAccess);
+    instMemAccessBlock = curExecBlock;
+    instMemAccessVisit = curExecBlock->getHostVisit();
+    instMemAccessID = instID;
+    instMemAccessPost = afterInst;
+  }
+  return instMemAccess;
+}
+
 void Engine::addInstrumentedRange(rword start, rword end) {
   execBroker->addInstrumentedRange(Range<rword>(start, end));
 }
@@ -242,100 +649,118 @@ bool Engine::instrumentAllExecutableMaps() {
 }
 
 void Engine::removeInstrumentedRange(rword start, rword end) {
+  // A linked sequence doesn't check if its successor is still instrumented
+  blockManager->unlinkExits();
   execBroker->removeInstrumentedRange(Range<rword>(start, end));
 }
 
 bool Engine::removeInstrumentedModule(const std::string &name) {
+  blockManager->unlinkExits();
   return execBroker->removeInstrumentedModule(name);
 }
 
 bool Engine::removeInstrumentedModuleFromAddr(rword addr) {
+  blockManager->unlinkExits();
   return execBroker->removeInstrumentedModuleFromAddr(addr);
 }
 
 void Engine::removeAllInstrumentedRanges() {
+  blockManager->unlinkExits();
   execBroker->removeAllInstrumentedRanges();
 }
 
-std::vector<Patch> Engine::patch(rword start) {
-  std::vector<Patch> basicBlock;
-  const LLVMCPU &llvmcpu = llvmCPUs->getCPU(curCPUMode);
-  const llvm::ArrayRef<uint8_t> code((uint8_t *)start, (size_t)-1);
-  bool basicBlockEnd = false;
-  rword i = 0;
-  QBDI_DEBUG("Patching basic block at address 0x{:x}", start);
+void Engine::setModuleTracking(ModuleTracking tracking) {
+  execBroker->setModuleTracking(tracking);
+}
 
-  // Get Basic block
-  while (not basicBlockEnd) {
-    llvm::MCInst inst;
-    llvm::MCDisassembler::DecodeStatus dstatus;
-    rword address = start;
-    Patch *patch = nullptr;
-    uint64_t instSize = 0;
+ModuleTracking Engine::getModuleTracking() const {
+  return execBroker->getModuleTracking();
+}
 
-    // Aggregate a complete patch
-    do {
-      // Disassemble
-      rword prev_address = address;
-      address = start + i;
-      dstatus = llvmcpu.getInstruction(inst, instSize, code.slice(i), address);
-      if (llvm::MCDisassembler::Success != dstatus) {
-        QBDI_DEBUG("Bump into invalid instruction at address {:x}", address);
-        // Current instruction is invalid, stop the basic block right here
-        if (prev_address == address) {
-          QBDI_CRITICAL(
-              "Disassembly error : fail to parse address 0x{:x} ({:n})",
-              address,
-              spdlog::to_hex(reinterpret_cast<uint8_t *>(address),
-                             reinterpret_cast<uint8_t *>(address + 16)));
-          abort();
-        } else {
-          address = prev_address;
-          basicBlockEnd = true;
-          break;
-        }
-      }
-      QBDI_REQUIRE_ACTION(llvm::MCDisassembler::Success == dstatus, abort());
-      QBDI_DEBUG_BLOCK({
-        std::string disass = llvmcpu.showInst(inst, address);
-        QBDI_DEBUG("Patching 0x{:x} {}", address, disass.c_str());
-      });
-      // Patch & merge
-      for (uint32_t j = 0; j < patchRules.size(); j++) {
-        if (patchRules[j].canBeApplied(inst, address, instSize, llvmcpu)) {
-          QBDI_DEBUG("Patch rule {} applied", j);
-          if (patch == nullptr) {
-            basicBlock.push_back(
-                patchRules[j].generate(inst, address, instSize, llvmcpu));
-            patch = &basicBlock.back();
-          } else {
-            QBDI_DEBUG("Previous instruction merged");
-            *patch =
-                patchRules[j].generate(inst, address, instSize, llvmcpu, patch);
-          }
-          break;
-        }
-      }
-      QBDI_REQUIRE_ACTION(patch != nullptr, abort());
-      i += instSize;
-    } while (patch->metadata.merge);
+void Engine::updateModules() {
+  RangeSet<rword> unloaded;
+  if (execBroker->updateModules(unloaded)) {
+    // A linked sequence doesn't check if its successor is still instrumented
+    blockManager->unlinkExits();
+  }
+  if (not unloaded.getRanges().empty()) {
+    clearCache(unloaded);
+  }
+}
 
-    if (patch) {
-      QBDI_DEBUG("Patch of size {:x} generated", patch->metadata.patchSize);
-    }
+void Engine::initPatchRules() {
+  patchRules = std::make_unique<PatchRuleTable>(
+      getDefaultPatchRules(options),
+      llvmCPUs->getCPU(CPUMode::DEFAULT).getMCII().getNumOpcodes());
+}
 
-    if (basicBlockEnd || patch->metadata.modifyPC) {
-      QBDI_DEBUG(
-          "Basic block starting at address 0x{:x} ended at address 0x{:x}",
-          start, address);
-      basicBlockEnd = true;
-    }
+void Engine::initTranslator() {
+  translator.reset();
+  if (options & Options::OPT_ENABLE_ASYNC_PATCH) {
+    translator = std::make_unique<AsyncTranslator>(
+        llvmCPUs->getCPU(), llvmCPUs->getMattrs(), options);
+  }
+}
+
+void Engine::initPatchCache() {
+  if ((options & Options::OPT_ENABLE_SHARED_PATCHES) == 0) {
+    patchCache = std::make_shared<PatchCache>();
+    return;
   }
+  // the output of the PatchRules depends on the CPU and the options
+  std::string key = llvmCPUs->getCPU();
+  for (const std::string &mattr : llvmCPUs->getMattrs()) {
+    key += "," + mattr;
+  }
+  key += ":" + std::to_string(static_cast<uint64_t>(options));
+  patchCache = PatchCache::getShared(key);
+}
 
+std::vector<Patch> Engine::patch(rword start) {
+  const LLVMCPU &llvmcpu = llvmCPUs->getCPU(curCPUMode);
+  std::vector<Patch> basicBlock;
+  if (patchCache->get(start, llvmcpu, basicBlock)) {
+    QBDI_DEBUG("Reuse the patches of the basic block 0x{:x}", start);
+    return basicBlock;
+  }
+  // disassemble and patch new basic block, or take it from the worker
+  if (not translator or not translator->take(start, llvmcpu, basicBlock)) {
+    basicBlock = patchRules->patchBasicBlock(
+        start, ~static_cast<rword>(0), llvmcpu,
+        (options & Options::OPT_SINGLE_STEP) != 0);
+  }
+  if (basicBlock.empty()) {
+    QBDI_CRITICAL("Disassembly error : fail to parse address 0x{:x} ({:n})",
+                  start,
+                  spdlog::to_hex(reinterpret_cast<uint8_t *>(start),
+                                 reinterpret_cast<uint8_t *>(start + 16)));
+    abort();
+  }
+  patchCache->add(basicBlock);
   return basicBlock;
 }
 
-void Engine::instrument(std::vector<Patch> &basicBlock, size_t patchEnd) {
+void Engine::initInstrRulesFilter() {
+  instrRulesFilter.clear();
+  instrRulesFilter.reserve(instrRules.size());
+  for (const auto &item : instrRules) {
+    InstrRuleFilter filter;
+    filter.range = item.second->affectedRange();
+    filter.anyOpcode = not item.second->getOpcodes(filter.opcodes);
+    if (filter.anyOpcode) {
+      filter.opcodes.clear();
+    } else {
+      std::sort(filter.opcodes.begin(), filter.opcodes.end());
+    }
+    filter.basicBlock = item.second->isBasicBlockRule();
+    instrRulesFilter.push_back(std::move(filter));
+  }
+  instrRulesFilterDirty = false;
+}
+
+void Engine::instrument(std::vector<Patch> &basicBlock, size_t patchEnd,
+                        std::vector<uint32_t> &instrRuleIDs) {
+  QBDI_PROFILE_SCOPE(instrRules);
   const LLVMCPU &llvmcpu = llvmCPUs->getCPU(curCPUMode);
   QBDI_DEBUG(
       "Instrumenting sequence [0x{:x}, 0x{:x}] in basic block [0x{:x}, 0x{:x}]",
@@ -343,6 +768,79 @@ void Engine::instrument(std::vector<Patch> &basicBlock, size_t patchEnd) {
       basicBlock[patchEnd - 1].metadata.address,
       basicBlock.front().metadata.address, basicBlock.back().metadata.address);
 
+  if (instrRulesFilterDirty) {
+    initInstrRulesFilter();
+  }
+
+  // Only keep the rules that can instrument this sequence, in priority order
+  Range<rword> seqRange(basicBlock.front().metadata.address,
+                        basicBlock[patchEnd - 1].metadata.endAddress());
+  std::vector<size_t> candidates;
+  std::vector<size_t> bbCandidates;
+  for (size_t j = 0; j < instrRulesFilter.size(); j++) {
+    if (instrRulesFilter[j].range.overlaps(seqRange)) {
+      if (instrRulesFilter[j].basicBlock) {
+        bbCandidates.push_back(j);
+      } else {
+        candidates.push_back(j);
+      }
+    }
+  }
+
+  // The instrumentation may use the registers and the flags that are dead
+  if ((options & Options::OPT_ENABLE_LIVENESS) != 0) {
+    computeLiveness(basicBlock);
+  }
+
+  // The coverage is updated at the entry of the sequence
+  if (coverageRule) {
+    coverageRule->tryInstrument(basicBlock.front(), llvmcpu);
+  }
+  if (sequenceProfileRule) {
+    sequenceProfileRule->instrumentSequence(basicBlock.front(), patchEnd,
+                                            llvmcpu);
+  }
+  if (callGraphRule) {
+    callGraphRule->instrumentSequence(basicBlock.front(), patchEnd, llvmcpu);
+  }
+  // The budget is checked before the other instrumentations of the sequence
+  if (instructionBudgetRule) {
+    instructionBudgetRule->instrumentSequence(basicBlock.front(), patchEnd,
+                                              llvmcpu);
+  }
+  // and the stop request before the budget
+  if (stopPollingRule) {
+    stopPollingRule->tryInstrument(basicBlock.front(), llvmcpu);
+  }
+  // The basic block rules see the whole sequence, before the patches are
+  // finalized
+  for (size_t j : bbCandidates) {
+    const InstrRule *rule = instrRules[j].second.get();
+    if (not rule->isEnabled() and not rule->hasInlineGuard()) {
+      continue;
+    }
+    InstrRuleStats *stats = nullptr;
+    if (ruleStatsEnabled) {
+      stats = applyRuleStats(instrRules[j].first);
+      for (size_t i = 0; i < patchEnd; i++) {
+        basicBlock[i].ruleStats = stats;
+      }
+    }
+    if (rule->tryInstrumentBasicBlock(basicBlock, patchEnd, llvmcpu)) {
+      QBDI_DEBUG("Basic block instrumentation rule {:x} applied",
+                 instrRules[j].first);
+      instrRuleIDs.push_back(instrRules[j].first);
+      if (stats != nullptr) {
+        stats->instrumentCount++;
+      }
+    }
+    if (stats != nullptr) {
+      for (size_t i = 0; i < patchEnd; i++) {
+        basicBlock[i].ruleStats = nullptr;
+      }
+    }
+  }
+
   for (size_t i = 0; i < patchEnd; i++) {
     Patch &patch = basicBlock[i];
     QBDI_DEBUG_BLOCK({
@@ -352,25 +850,205 @@ void Engine::instrument(std::vector<Patch> &basicBlock, size_t patchEnd) {
                  disass.c_str());
     });
     // Instrument
-    for (const auto &item : instrRules) {
-      const InstrRule *rule = item.second.get();
+    if (memoryTraceRule) {
+      memoryTraceRule->tryInstrument(patch, llvmcpu);
+    }
+    if (callTraceRule) {
+      callTraceRule->tryInstrument(patch, llvmcpu);
+    }
+    if (pageHistogramRule) {
+      pageHistogramRule->tryInstrument(patch, llvmcpu);
+    }
+    if (branchProfileRule) {
+      branchProfileRule->tryInstrument(patch, llvmcpu);
+    }
+    if (indirectProfileRule) {
+      indirectProfileRule->tryInstrument(patch, llvmcpu);
+    }
+    if (callGraphRule) {
+      callGraphRule->tryInstrument(patch, llvmcpu);
+    }
+    if (syscallEntryRule) {
+      syscallEntryRule->tryInstrument(patch, llvmcpu);
+      syscallExitRule->tryInstrument(patch, llvmcpu);
+    }
+    if (budgetStopRule) {
+      budgetStopRule->tryInstrument(patch, llvmcpu);
+    }
+    unsigned opcode = patch.metadata.inst.getOpcode();
+    Range<rword> instRange(patch.metadata.address,
+                           patch.metadata.endAddress());
+    for (size_t j : candidates) {
+      const InstrRuleFilter &filter = instrRulesFilter[j];
+      if (not filter.anyOpcode and
+          not std::binary_search(filter.opcodes.begin(), filter.opcodes.end(),
+                                 opcode)) {
+        continue;
+      }
+      if (not filter.range.overlaps(instRange)) {
+        continue;
+      }
+      const InstrRule *rule = instrRules[j].second.get();
+      if (not rule->isEnabled() and not rule->hasInlineGuard()) {
+        continue;
+      }
+      if (ruleStatsEnabled) {
+        patch.ruleStats = applyRuleStats(instrRules[j].first);
+      }
       if (rule->tryInstrument(patch, llvmcpu)) {
-        QBDI_DEBUG("Instrumentation rule {:x} applied", item.first);
+        QBDI_DEBUG("Instrumentation rule {:x} applied", instrRules[j].first);
+        instrRuleIDs.push_back(instrRules[j].first);
+        if (patch.ruleStats != nullptr) {
+          patch.ruleStats->instrumentCount++;
+        }
       }
+      patch.ruleStats = nullptr;
     }
     patch.finalizeInstsPatch();
+    if (ruleStatsEnabled) {
+      pendingRuleInsts += patch.insts.size();
+    }
+  }
+  std::sort(instrRuleIDs.begin(), instrRuleIDs.end());
+  instrRuleIDs.erase(std::unique(instrRuleIDs.begin(), instrRuleIDs.end()),
+                     instrRuleIDs.end());
+}
+
+void Engine::requestSuccessors(const std::vector<Patch> &basicBlock) {
+  const InstMetadata &last = basicBlock.back().metadata;
+  rword successors[2];
+  unsigned nbSuccessors = 0;
+  if (last.modifyPC) {
+    nbSuccessors = getStaticSuccessors(last.inst, last.address, last.instSize,
+                                       successors);
+  } else {
+    successors[nbSuccessors++] = last.endAddress();
+  }
+  for (unsigned i = 0; i < nbSuccessors; i++) {
+    if (blockManager->getExecBlock(successors[i]) != nullptr) {
+      continue;
+    }
+    requestTranslation(successors[i]);
+  }
+}
+
+void Engine::requestTranslation(rword address) {
+  // The worker doesn't read beyond the instrumented range of the address
+  for (const Range<rword> &r : execBroker->getInstrumentedRange().getRanges()) {
+    if (r.contains(address)) {
+      translator->request(address, r, curCPUMode);
+      return;
+    }
   }
 }
 
 void Engine::handleNewBasicBlock(rword pc) {
+  QBDI_PROFILE_TARGET(profile);
   // disassemble and patch new basic block
   Patch::Vec basicBlock = patch(pc);
-  // Reserve cache and get uncached instruction
-  size_t patchEnd = blockManager->preWriteBasicBlock(basicBlock);
-  // instrument uncached instruction
-  instrument(basicBlock, patchEnd);
-  // Write in the cache
-  blockManager->writeBasicBlock(std::move(basicBlock), patchEnd);
+  if (translator) {
+    requestSuccessors(basicBlock);
+  }
+  writeNewBasicBlock(std::move(basicBlock));
+}
+
+void Engine::writeNewBasicBlock(std::vector<Patch> basicBlock) {
+  while (true) {
+    if (options & Options::OPT_ENABLE_SMC_DETECTION) {
+      watchTranslatedCode(basicBlock.front().metadata.address,
+                          basicBlock.back().metadata.endAddress());
+    }
+    // Reserve cache and get uncached instruction
+    size_t patchEnd = blockManager->preWriteBasicBlock(basicBlock);
+    // instrument uncached instruction
+    std::vector<uint32_t> instrRuleIDs;
+    instrument(basicBlock, patchEnd, instrRuleIDs);
+    // Write in the cache. The end of the basic block is patched again if no
+    // ExecBlock can reach the memory of its near patches.
+    rword written = blockManager->getWrittenCodeSize();
+    rword unwritten = blockManager->writeBasicBlock(std::move(basicBlock),
+                                                    patchEnd, instrRuleIDs);
+    if (ruleStatsEnabled) {
+      attributeCodeSize(blockManager->getWrittenCodeSize() - written);
+    }
+    if (unwritten == 0) {
+      return;
+    }
+    basicBlock = patch(unwritten);
+  }
+}
+
+void Engine::watchTranslatedCode(rword start, rword end) {
+  static const rword pageSize =
+      llvm::expectedToOptional(llvm::sys::Process::getPageSize())
+          .getValueOr(4096);
+  // the maps of the process are read once for each new page
+  RangeSet<rword> pages;
+  pages.add({start & ~(pageSize - 1), (end + pageSize - 1) & ~(pageSize - 1)});
+  pages.remove(smcCheckedPages);
+  for (const Range<rword> &r : pages.getRanges()) {
+    if (not watchPagesOnce(this, r, smcWatchedPages)) {
+      QBDI_WARN("The writes of the code at 0x{:x} may not be detected",
+                r.start());
+    }
+  }
+  smcCheckedPages.add(pages);
+}
+
+bool Engine::invalidateWrittenCode() {
+  RangeSet<rword> written;
+  if (not takeWrittenPages(this, written)) {
+    return false;
+  }
+  QBDI_DEBUG("Translated code written in {} pages", written.getRanges().size());
+  // the pages are watched again when their code is translated again
+  smcWatchedPages.remove(written);
+  smcCheckedPages.remove(written);
+  clearCache(written);
+  return true;
+}
+
+bool Engine::handleNewSuperBlock(rword pc, const std::vector<rword> &stops) {
+  // Follow the direct jumps and calls to the basic blocks in the cache. The
+  // superblock ends with the first other branch, which is its side exit.
+  QBDI_PROFILE_TARGET(profile);
+  std::vector<Patch> superBlock;
+  std::vector<rword> heads;
+  std::vector<uint32_t> instrRuleIDs;
+  rword address = pc;
+  while (true) {
+    Patch::Vec basicBlock = patch(address);
+    heads.push_back(address);
+    const InstMetadata &last = basicBlock.back().metadata;
+    rword target = 0;
+    bool follow =
+        heads.size() < superBlockMaxBasicBlocks and
+        getUnconditionalTarget(last.inst, last.address, last.instSize,
+                               target) and
+        std::find(stops.begin(), stops.end(), target) == stops.end() and
+        std::find(heads.begin(), heads.end(), target) == heads.end() and
+        replacements.count(target) == 0 and
+        not smcWatchedPages.contains(target) and
+        execBroker->isInstrumented(target) and
+        blockManager->getExecBlock(target) != nullptr;
+    if (heads.size() == 1 and not follow) {
+      return false;
+    }
+    instrument(basicBlock, basicBlock.size(), instrRuleIDs);
+    std::move(basicBlock.begin(), basicBlock.end(),
+              std::back_inserter(superBlock));
+    if (not follow) {
+      break;
+    }
+    address = target;
+  }
+  QBDI_DEBUG("Build superblock 0x{:x} with {} basic blocks", pc, heads.size());
+  rword written = blockManager->getWrittenCodeSize();
+  bool res = blockManager->writeSuperBlock(std::move(superBlock), instrRuleIDs);
+  if (ruleStatsEnabled) {
+    attributeCodeSize(blockManager->getWrittenCodeSize() - written);
+  }
+  return res;
 }
 
 bool Engine::precacheBasicBlock(rword pc) {
@@ -390,46 +1068,334 @@ bool Engine::precacheBasicBlock(rword pc) {
   return true;
 }
 
-bool Engine::run(rword start, rword stop) {
-  QBDI_REQUIRE_ACTION(not running && "Cannot run an already running Engine",
-                      abort());
+size_t Engine::precacheBasicBlocks(const std::vector<rword> &addresses) {
+  QBDI_REQUIRE_ACTION(
+      not running && "Cannot precacheBasicBlocks on a running Engine",
+      abort());
+  // number of basic blocks requested to the worker ahead of the writes
+  static const size_t requestWindow = 32;
 
-  rword currentPC = start;
-  bool hasRan = false;
-  curGPRState = gprState.get();
-  curFPRState = fprState.get();
+  if (blockManager->isFlushPending()) {
+    blockManager->flushCommit();
+  }
+  running = true;
+  size_t count = 0;
+  size_t requested = 0;
+  for (size_t i = 0; i < addresses.size(); i++) {
+    for (; translator and requested < addresses.size() and
+           requested < i + requestWindow;
+         requested++) {
+      if (execBroker->isInstrumented(addresses[requested]) and
+          blockManager->getExecBlock(addresses[requested]) == nullptr) {
+        requestTranslation(addresses[requested]);
+      }
+    }
+    // The ExecBlocks stay writable until their next execution
+    if (execBroker->isInstrumented(addresses[i]) and
+        blockManager->getExecBlock(addresses[i]) == nullptr) {
+      handleNewBasicBlock(addresses[i]);
+      count++;
+    }
+  }
+  running = false;
+  return count;
+}
+
+bool Engine::isDecodable(rword address, const RangeSet<rword> &bounds) const {
+  for (const Range<rword> &r : bounds.getRanges()) {
+    if (r.contains(address)) {
+      // the disassembler doesn't read beyond the bounds
+      llvm::MCInst inst;
+      uint64_t instSize = 0;
+      llvm::ArrayRef<uint8_t> code(reinterpret_cast<const uint8_t *>(address),
+                                   std::min<rword>(r.end() - address, 16));
+      return llvmCPUs->getCPU(curCPUMode).getInstruction(
+                 inst, instSize, code, address) ==
+             llvm::MCDisassembler::Success;
+    }
+  }
+  return false;
+}
 
-  rword basicBlockBeginAddr = 0;
-  rword basicBlockEndAddr = 0;
+size_t Engine::precacheReachable(const RangeSet<rword> &bounds,
+                                 const std::vector<rword> &entries,
+                                 bool useSymbols) {
+  QBDI_REQUIRE_ACTION(
+      not running && "Cannot precacheReachable on a running Engine", abort());
 
-  // Start address is out of range
-  if (!execBroker->isInstrumented(start)) {
+  if (blockManager->isFlushPending()) {
+    blockManager->flushCommit();
+  }
+  std::vector<rword> pending = entries;
+  if (useSymbols) {
+    for (const Range<rword> &r : bounds.getRanges()) {
+      getFunctionSymbols(r.start(), r.end(), pending);
+    }
+  }
+  const llvm::MCInstrInfo &MCII = llvmCPUs->getCPU(curCPUMode).getMCII();
+  std::unordered_set<rword> visited;
+  running = true;
+  size_t count = 0;
+  while (not pending.empty()) {
+    rword address = pending.back();
+    pending.pop_back();
+    // The static successors may be data or the padding after a call that
+    // doesn't return, patch() aborts on an invalid first instruction.
+    if (not visited.insert(address).second or
+        not execBroker->isInstrumented(address) or
+        not isDecodable(address, bounds)) {
+      continue;
+    }
+    Patch::Vec basicBlock = patch(address);
+    const InstMetadata &last = basicBlock.back().metadata;
+    rword successors[2];
+    unsigned nbSuccessors = 0;
+    if (not last.modifyPC) {
+      successors[nbSuccessors++] = last.endAddress();
+    } else if (isIndirectCallOrJump(last.inst) and
+               MCII.get(last.inst.getOpcode()).isCall()) {
+      successors[nbSuccessors++] = last.endAddress();
+    } else {
+      nbSuccessors = getStaticSuccessors(last.inst, last.address,
+                                         last.instSize, successors);
+    }
+    for (unsigned i = 0; i < nbSuccessors; i++) {
+      if (visited.count(successors[i]) == 0) {
+        pending.push_back(successors[i]);
+        // the worker patches the successors during the writes
+        if (translator and bounds.contains(successors[i]) and
+            blockManager->getExecBlock(successors[i]) == nullptr) {
+          requestTranslation(successors[i]);
+        }
+      }
+    }
+    // The ExecBlocks stay writable until their next execution
+    if (blockManager->getExecBlock(address) == nullptr) {
+      writeNewBasicBlock(std::move(basicBlock));
+      count++;
+    }
+  }
+  running = false;
+  return count;
+}
+
+// The maps of the modules, sorted by address, and the base of each module
+static std::vector<MemoryMap>
+getModuleMaps(std::unordered_map<std::string, rword> &bases) {
+  std::vector<MemoryMap> maps = getCurrentProcessMaps(true);
+  // the anonymous maps and the special maps ([stack], ...) aren't modules
+  maps.erase(std::remove_if(maps.begin(), maps.end(),
+                            [](const MemoryMap &m) {
+                              return m.name.empty() or m.name[0] == '[';
+                            }),
+             maps.end());
+  std::sort(maps.begin(), maps.end(),
+            [](const MemoryMap &a, const MemoryMap &b) {
+              return a.range.start() < b.range.start();
+            });
+  for (const MemoryMap &m : maps) {
+    bases.emplace(m.name, m.range.start());
+  }
+  return maps;
+}
+
+std::vector<rword> Engine::getCachedSequences() const {
+  std::vector<rword> starts;
+  blockManager->forEachSequence(
+      [&starts](const ExecBlock &block, const SeqLoc &seqLoc) {
+        starts.push_back(seqLoc.seqStart);
+        return true;
+      });
+  std::sort(starts.begin(), starts.end());
+  starts.erase(std::unique(starts.begin(), starts.end()), starts.end());
+  return starts;
+}
+
+bool Engine::saveCacheProfile(const char *path) const {
+  std::vector<rword> starts = getCachedSequences();
+
+  std::unordered_map<std::string, rword> bases;
+  std::vector<MemoryMap> maps = getModuleMaps(bases);
+
+  std::vector<std::pair<const std::string *, rword>> entries;
+  auto map = maps.begin();
+  for (rword start : starts) {
+    while (map != maps.end() and map->range.end() <= start) {
+      ++map;
+    }
+    if (map == maps.end()) {
+      break;
+    }
+    // the code outside of the modules cannot be found again
+    if (map->range.contains(start)) {
+      entries.emplace_back(&map->name, start - bases[map->name]);
+    }
+  }
+  // grouped by module
+  std::stable_sort(entries.begin(), entries.end(),
+                   [](const std::pair<const std::string *, rword> &a,
+                      const std::pair<const std::string *, rword> &b) {
+                     return *a.first < *b.first;
+                   });
+
+  FILE *file = fopen(path, "w");
+  if (file == nullptr) {
+    QBDI_ERROR("Cannot open the cache profile {}", path);
     return false;
   }
+  fprintf(file, "# offset module\n");
+  for (const auto &entry : entries) {
+    fprintf(file, "0x%" PRIx64 " %s\n", static_cast<uint64_t>(entry.second),
+            entry.first->c_str());
+  }
+  return fclose(file) == 0;
+}
 
-  running = true;
+size_t Engine::prewarmCache(const char *path) {
+  FILE *file = fopen(path, "r");
+  if (file == nullptr) {
+    QBDI_ERROR("Cannot open the cache profile {}", path);
+    return 0;
+  }
+  std::unordered_map<std::string, rword> bases;
+  getModuleMaps(bases);
+
+  std::vector<rword> addresses;
+  char line[4096];
+  char module[4096];
+  while (fgets(line, sizeof(line), file) != nullptr) {
+    uint64_t offset = 0;
+    if (line[0] == '#' or
+        sscanf(line, "0x%" SCNx64 " %4095[^\n]", &offset, module) != 2) {
+      continue;
+    }
+    // the module may not be loaded in this process
+    auto base = bases.find(module);
+    if (base != bases.end()) {
+      addresses.push_back(base->second + static_cast<rword>(offset));
+    }
+  }
+  fclose(file);
+  return precacheBasicBlocks(addresses);
+}
+
+// The loop is instantiated with and without the events: the loop of the
+// runs without VMEvent has no event to signal and no basic block to track
+template <bool withEvents>
+bool Engine::dispatchLoop(RunState &state, const std::vector<rword> &stops) {
+  rword &currentPC = state.currentPC;
+  ExecBlock *&lastExecBlock = state.lastExecBlock;
+  uint16_t &lastExitID = state.lastExitID;
+  rword &basicBlockBeginAddr = state.basicBlockBeginAddr;
+  rword &basicBlockEndAddr = state.basicBlockEndAddr;
+  bool &batchFull = state.batchFull;
+
+  // The options and the sampler cannot change during a run
+  const bool smcDetection = options & Options::OPT_ENABLE_SMC_DETECTION;
+  const bool superBlocks = options & Options::OPT_ENABLE_SUPERBLOCK;
+  const bool bypassPLT = options & Options::OPT_BYPASS_PLT;
+  const bool chaining = options & chainingOptions;
+  const bool sampled = sampler != nullptr;
 
   // Execute basic block per basic block
   do {
     VMAction action = CONTINUE;
 
+    // A callback may register or remove the VMEvents during the run
+    if ((eventMask != VMEvent::NO_EVENT) != withEvents) {
+      return false;
+    }
+
+    // A stop may be requested by another thread
+    if (stopRequest.load(std::memory_order_relaxed) != 0) {
+      QBDI_DEBUG("Receive a stop request");
+      stopRequest.store(0);
+      QBDI_GPR_SET(curGPRState, REG_PC, currentPC);
+      break;
+    }
+
+    // The sequences of the written code are translated again, the flush is
+    // committed before the next sequence
+    if (smcDetection) {
+      invalidateWrittenCode();
+    }
+
+    // The samples are attributed before the ExecBlocks change
+    if (sampled) {
+      drainHardwareSamples();
+    }
+
+    // The original function of a replacement is never translated, the
+    // replacement is executed as any other target
+    if (not replacements.empty()) {
+      auto it = replacements.find(currentPC);
+      if (it != replacements.end()) {
+        QBDI_DEBUG("Replace 0x{:x} by 0x{:x}", currentPC,
+                   it->second.replacement);
+        currentPC = it->second.replacement;
+        QBDI_GPR_SET(curGPRState, REG_PC, currentPC);
+        lastExecBlock = nullptr;
+      }
+    }
+
+    // The target may be in a module loaded since the last check
+    bool instrumented = execBroker->isInstrumented(currentPC);
+    if (not instrumented) {
+      updateModules();
+      instrumented = execBroker->isInstrumented(currentPC);
+    }
+
+    // The functions demoted by the automatic demotion are executed natively
+    // as the code which isn't instrumented
+    bool demoted = false;
+    if constexpr (not withEvents) {
+      demoted = not demotedFunctions.empty() and
+                demotedFunctions.count(currentPC) != 0 and canDemote() and
+                transferHooks.count(currentPC) == 0;
+    }
+
     // If this PC is not instrumented try to transfer execution
-    if (execBroker->isInstrumented(currentPC) == false &&
+    if ((demoted or not instrumented) &&
         execBroker->canTransferExecution(curGPRState)) {
 
       curExecBlock = nullptr;
+      lastExecBlock = nullptr;
       basicBlockBeginAddr = 0;
       basicBlockEndAddr = 0;
 
       QBDI_DEBUG("Executing 0x{:x} through execBroker", currentPC);
-      action = signalEvent(EXEC_TRANSFER_CALL, currentPC, nullptr, 0,
-                           curGPRState, curFPRState);
-      // transfer execution
-      if (action == CONTINUE) {
-        execBroker->transferExecution(currentPC, curGPRState, curFPRState);
-        action = signalEvent(EXEC_TRANSFER_RETURN, currentPC, nullptr, 0,
+      if constexpr (withEvents) {
+        action = signalEvent(EXEC_TRANSFER_CALL, currentPC, nullptr, 0,
                              curGPRState, curFPRState);
       }
+      // the hooks of the target are called after the callbacks of the events
+      if (not transferHooks.empty()) {
+        action = std::max(action,
+                          signalTransferHooks(EXEC_TRANSFER_CALL, currentPC,
+                                              curGPRState, curFPRState));
+      }
+      // transfer execution
+      if (action == CONTINUE) {
+        if (execStats) {
+          execStats->transferCount++;
+        }
+        execBroker->transferExecution(currentPC, curGPRState, curFPRState);
+        // the call to the native code returns without the generated code
+        if (callGraphRule) {
+          callGraphProfile->popFrame(QBDI_GPR_GET(curGPRState, REG_PC));
+        }
+        // the native code may have loaded or unloaded a module
+        updateModules();
+        if (not transferHooks.empty()) {
+          action = signalTransferHooks(EXEC_TRANSFER_RETURN, currentPC,
+                                       curGPRState, curFPRState);
+        }
+        if constexpr (withEvents) {
+          action = std::max(action, signalEvent(EXEC_TRANSFER_RETURN,
+                                                currentPC, nullptr, 0,
+                                                curGPRState, curFPRState));
+        }
+      }
     }
     // Else execute through DBI
     else {
@@ -445,29 +1411,94 @@ bool Engine::run(rword start, rword stop) {
         curFPRState = fprState.get();
         // Commit the flush
         blockManager->flushCommit();
+        lastExecBlock = nullptr;
       }
 
-      // Test if we have it in cache
+      // Test if we have it in cache, as a superblock if a hot sequence starts
+      // at this address
       SeqLoc currentSequence;
-      curExecBlock =
-          blockManager->getProgrammedExecBlock(currentPC, &currentSequence);
+      curExecBlock = nullptr;
+      bool useSuperBlock =
+          superBlocks and
+          (not withEvents or (eventMask & sequenceEvent) == 0) and
+          not smcWatchedPages.contains(currentPC);
+      if (useSuperBlock) {
+        curExecBlock =
+            blockManager->getProgrammedSuperBlock(currentPC, &currentSequence);
+        if (curExecBlock == nullptr and
+            blockManager->countExecution(currentPC) == superBlockThreshold and
+            handleNewSuperBlock(currentPC, stops)) {
+          curExecBlock = blockManager->getProgrammedSuperBlock(
+              currentPC, &currentSequence);
+        }
+        if (curExecBlock != nullptr) {
+          // a superblock may contain several basic blocks
+          basicBlockBeginAddr = 0;
+          basicBlockEndAddr = 0;
+        }
+      }
+      if (curExecBlock == nullptr) {
+        curExecBlock =
+            blockManager->getProgrammedExecBlock(currentPC, &currentSequence);
+        // the lookup entered an existing sequence in its middle
+        if (execStats and curExecBlock != nullptr and
+            curExecBlock->getCurrentEntryID() !=
+                curExecBlock->getSeqStart(curExecBlock->getCurrentSeqID())) {
+          execStats->splitCount++;
+        }
+      }
+      rword stubTarget;
+      if (curExecBlock == nullptr and bypassPLT and
+          execBroker->resolveStub(currentPC, curGPRState, stubTarget)) {
+        // The stub isn't translated and the previous exit isn't linked, the
+        // slot is read again at the next call
+        QBDI_DEBUG("Bypass the stub at 0x{:x}", currentPC);
+        QBDI_GPR_SET(curGPRState, REG_PC, stubTarget);
+        currentPC = stubTarget;
+        lastExecBlock = nullptr;
+        continue;
+      }
       if (curExecBlock == nullptr) {
         QBDI_DEBUG(
             "Cache miss for 0x{:x}, patching & instrumenting new basic block",
             currentPC);
+        if (execStats) {
+          execStats->cacheMisses++;
+        }
         handleNewBasicBlock(currentPC);
         // Signal a new basic block
-        event |= BASIC_BLOCK_NEW;
+        event |= translationEvent;
         // Set new basic block as current
         curExecBlock =
             blockManager->getProgrammedExecBlock(currentPC, &currentSequence);
         QBDI_REQUIRE_ACTION(curExecBlock != nullptr, abort());
+        if (newBlockBatchCbk != nullptr) {
+          const RangeSet<rword> &ranges = execBroker->getInstrumentedRange();
+          auto it = std::upper_bound(
+              ranges.getRanges().begin(), ranges.getRanges().end(), currentPC,
+              [](rword pc, const Range<rword> &r) { return pc < r.end(); });
+          newBlockBatch.push_back(
+              {currentPC, currentSequence.bbEnd,
+               (it != ranges.getRanges().end()) ? it->start() : 0});
+          batchFull = newBlockBatch.size() >= newBlockBatchThreshold;
+        }
+      }
+
+      // Link the exit of the previous sequence to this one. The code which
+      // can be written returns to the VM to check the writes.
+      if (lastExecBlock == curExecBlock && lastExitID != NO_EXIT &&
+          (not withEvents || (eventMask & sequenceEvent) == 0) &&
+          not smcWatchedPages.contains(currentPC)) {
+        curExecBlock->linkExit(lastExitID, curExecBlock->getCurrentEntryID());
       }
+      lastExecBlock = nullptr;
 
-      if (basicBlockEndAddr == 0) {
-        event |= BASIC_BLOCK_ENTRY;
-        basicBlockEndAddr = currentSequence.bbEnd;
-        basicBlockBeginAddr = currentPC;
+      if constexpr (withEvents) {
+        if (basicBlockEndAddr == 0) {
+          event |= BASIC_BLOCK_ENTRY;
+          basicBlockEndAddr = currentSequence.bbEnd;
+          basicBlockBeginAddr = currentPC;
+        }
       }
 
       // Set context if necessary
@@ -479,23 +1510,65 @@ bool Engine::run(rword start, rword stop) {
       curGPRState = &(curExecBlock->getContext()->gprState);
       curFPRState = &(curExecBlock->getContext()->fprState);
 
-      action = signalEvent(event, currentPC, &currentSequence,
-                           basicBlockBeginAddr, curGPRState, curFPRState);
+      if constexpr (withEvents) {
+        action = signalEvent(event, currentPC, &currentSequence,
+                             basicBlockBeginAddr, curGPRState, curFPRState);
+      }
+      if (batchFull) {
+        batchFull = false;
+        if (flushNewBasicBlockBatch() == STOP) {
+          action = STOP;
+        }
+      }
 
       if (action == CONTINUE) {
-        hasRan = true;
-        action = curExecBlock->execute();
+        state.hasRan = true;
+        uint16_t entryID = curExecBlock->getCurrentEntryID();
+        if (execStats) {
+          execStats->dispatchCount++;
+        }
+        action = curExecBlock->execute(execStats.get());
         // Signal events if normal exit
         if (action == CONTINUE) {
-          if (basicBlockEndAddr == currentSequence.seqEnd) {
-            action = signalEvent(SEQUENCE_EXIT | BASIC_BLOCK_EXIT, currentPC,
-                                 &currentSequence, basicBlockBeginAddr,
-                                 curGPRState, curFPRState);
-            basicBlockBeginAddr = 0;
-            basicBlockEndAddr = 0;
-          } else {
-            action = signalEvent(SEQUENCE_EXIT, currentPC, &currentSequence,
-                                 basicBlockBeginAddr, curGPRState, curFPRState);
+          // the return address of a call is hooked by the ExecBroker if the
+          // target isn't instrumented
+          rword callReturn =
+              curExecBlock->getSeqCallReturn(curExecBlock->getCurrentSeqID());
+          if (callReturn != 0) {
+            execBroker->addReturnPoint(curGPRState, callReturn);
+          }
+          if (demotionThreshold != 0) {
+            trackDemotion(curExecBlock->isInstrumented());
+            // the next address is the entry of the called function
+            if (callReturn != 0) {
+              demotionFrames.push_back({QBDI_GPR_GET(curGPRState, REG_PC),
+                                        QBDI_GPR_GET(curGPRState, REG_SP),
+                                        true});
+            }
+          }
+          if (chaining) {
+            lastExecBlock = curExecBlock;
+            lastExitID = curExecBlock->getLastExitID();
+            if (curExecBlock->getCurrentEntryID() != entryID) {
+              // others sequences has been executed through linked exits or the
+              // indirect branch cache
+              basicBlockBeginAddr = 0;
+              basicBlockEndAddr = 0;
+            }
+          }
+          if constexpr (withEvents) {
+            if (basicBlockEndAddr == currentSequence.seqEnd) {
+              action = signalEvent(SEQUENCE_EXIT | BASIC_BLOCK_EXIT,
+                                   currentPC, &currentSequence,
+                                   basicBlockBeginAddr, curGPRState,
+                                   curFPRState);
+              basicBlockBeginAddr = 0;
+              basicBlockEndAddr = 0;
+            } else {
+              action = signalEvent(SEQUENCE_EXIT, currentPC, &currentSequence,
+                                   basicBlockBeginAddr, curGPRState,
+                                   curFPRState);
+            }
           }
         }
       }
@@ -507,11 +1580,66 @@ bool Engine::run(rword start, rword stop) {
     if (action != CONTINUE) {
       basicBlockBeginAddr = 0;
       basicBlockEndAddr = 0;
+      if (execStats and action == BREAK_TO_VM) {
+        execStats->breakToVMCount++;
+      }
     }
     // Get next block PC
     currentPC = QBDI_GPR_GET(curGPRState, REG_PC);
     QBDI_DEBUG("Next address to execute is 0x{:x}", currentPC);
-  } while (currentPC != stop);
+    // The stops are few, the native code may return to any of them
+  } while (std::find(stops.begin(), stops.end(), currentPC) == stops.end());
+  return true;
+}
+
+bool Engine::run(rword start, const std::vector<rword> &stops) {
+  QBDI_REQUIRE_ACTION(not running && "Cannot run an already running Engine",
+                      abort());
+
+  RunState state;
+  state.currentPC = start;
+  state.lastExitID = NO_EXIT;
+  curGPRState = gprState.get();
+  curFPRState = fprState.get();
+
+  // Start address is out of range
+  if (!execBroker->isInstrumented(start)) {
+    return false;
+  }
+
+  // The execution must return to the VM when a stop address is reached
+  for (rword stop : stops) {
+    if (options & chainingOptions) {
+      blockManager->unlinkExits(stop);
+    }
+    // and a superblock mustn't go through it
+    if (options & Options::OPT_ENABLE_SUPERBLOCK) {
+      blockManager->clearSuperBlocks(Range<rword>(stop, stop + 1));
+    }
+  }
+
+  running = true;
+  execBroker->clearReturnPoints();
+  // the calls of the previous runs are never returned in this run
+  demotionFrames.clear();
+  // the run may be on another NUMA node than the cache
+  if (options & Options::OPT_ENABLE_NUMA_BINDING) {
+    blockManager->bindToCurrentNumaNode();
+  }
+  if (sampler) {
+    sampler->start();
+  }
+
+  // The loop is selected by the registered events, and selected again when a
+  // callback changes them
+  bool finished = false;
+  while (not finished) {
+    if (eventMask == VMEvent::NO_EVENT) {
+      finished = dispatchLoop<false>(state, stops);
+    } else {
+      finished = dispatchLoop<true>(state, stops);
+    }
+  }
 
   // Copy final context
   *gprState = *curGPRState;
@@ -521,15 +1649,148 @@ bool Engine::run(rword start, rword stop) {
   curExecBlock = nullptr;
   running = false;
 
-  return hasRan;
+  // The stop of the budget only applies to this run
+  disarmBudgetStop();
+  // no sequence counts in the removed value tables anymore
+  retiredValueProfiles.clear();
+  freeGuards.insert(freeGuards.end(), retiredGuards.begin(),
+                    retiredGuards.end());
+  retiredGuards.clear();
+
+  // Give the last entries of the traces
+  flushMemoryTrace();
+  flushCallTrace();
+  flushNewBasicBlockBatch();
+  if (sampler) {
+    sampler->stop();
+    drainHardwareSamples();
+  }
+  if (options & Options::OPT_ENABLE_PERF_MAP) {
+    flushPerfMap();
+  }
+
+  return state.hasRan;
+}
+
+SliceStatus Engine::runFor(rword stop, rword budget) {
+  QBDI_REQUIRE_ACTION(not running && "Cannot runFor on a running Engine",
+                      abort());
+  QBDI_REQUIRE_ACTION(budget != 0, return SliceStatus::SLICE_NOT_RUN);
+
+  // The rule is kept after the slice, only the first slice flushes the cache
+  if (not instructionBudgetRule) {
+    if (translator) {
+      translator->discard();
+    }
+    blockManager->clearCache(true);
+    instructionBudgetRule = std::make_unique<InstrRuleInstructionBudget>(
+        &instructionBudget, budgetExhaustedCB, this,
+        PRIORITY_MEMACCESS_LIMIT + 3);
+  }
+  sliceRule = true;
+  // The budget of setInstructionBudget isn't consumed by the slice
+  rword savedBudget =
+      budgetEnabled ? instructionBudget : ~static_cast<rword>(0);
+  instructionBudget = budget;
+  sliceBudget = budget;
+  sliceExpired = false;
+  inSlice = true;
+
+  bool hasRan = run(QBDI_GPR_GET(gprState.get(), REG_PC), {stop});
+
+  inSlice = false;
+  instructionBudget = savedBudget;
+  if (QBDI_GPR_GET(gprState.get(), REG_PC) == stop) {
+    return SliceStatus::SLICE_FINISHED;
+  }
+  if (sliceExpired) {
+    return SliceStatus::SLICE_EXPIRED;
+  }
+  if (not hasRan) {
+    return SliceStatus::SLICE_NOT_RUN;
+  }
+  return SliceStatus::SLICE_STOPPED;
+}
+
+bool Engine::step() {
+  QBDI_REQUIRE_ACTION(not running && "Cannot step a running Engine", abort());
+  QBDI_REQUIRE_ACTION(options & Options::OPT_SINGLE_STEP, return false);
+
+  rword currentPC = QBDI_GPR_GET(gprState.get(), REG_PC);
+  if (execBroker->isInstrumented(currentPC) == false) {
+    updateModules();
+  }
+
+  running = true;
+  if (execBroker->isInstrumented(currentPC) == false) {
+    if (not execBroker->canTransferExecution(gprState.get())) {
+      running = false;
+      return false;
+    }
+    if (execStats) {
+      execStats->transferCount++;
+    }
+    execBroker->transferExecution(currentPC, gprState.get(), fprState.get());
+    updateModules();
+    running = false;
+    return true;
+  }
+
+  if (blockManager->isFlushPending()) {
+    blockManager->flushCommit();
+  }
+  // Each sequence is a single instruction which returns to the VM, the
+  // events and the links of the exits are skipped
+  SeqLoc currentSequence;
+  curExecBlock =
+      blockManager->getProgrammedExecBlock(currentPC, &currentSequence);
+  if (curExecBlock == nullptr) {
+    if (execStats) {
+      execStats->cacheMisses++;
+    }
+    handleNewBasicBlock(currentPC);
+    curExecBlock =
+        blockManager->getProgrammedExecBlock(currentPC, &currentSequence);
+    QBDI_REQUIRE_ACTION(curExecBlock != nullptr, abort());
+  }
+  Context *context = curExecBlock->getContext();
+  context->gprState = *gprState;
+  context->fprState = *fprState;
+  curGPRState = &context->gprState;
+  curFPRState = &context->fprState;
+
+  if (execStats) {
+    execStats->dispatchCount++;
+  }
+  curExecBlock->execute(execStats.get());
+  rword callReturn =
+      curExecBlock->getSeqCallReturn(curExecBlock->getCurrentSeqID());
+
+  *gprState = *curGPRState;
+  *fprState = *curFPRState;
+  curGPRState = gprState.get();
+  curFPRState = fprState.get();
+  curExecBlock = nullptr;
+  if (callReturn != 0) {
+    execBroker->addReturnPoint(gprState.get(), callReturn);
+  }
+  running = false;
+  retiredValueProfiles.clear();
+  freeGuards.insert(freeGuards.end(), retiredGuards.begin(),
+                    retiredGuards.end());
+  retiredGuards.clear();
+  return true;
 }
 
 uint32_t Engine::addInstrRule(std::unique_ptr<InstrRule> &&rule) {
   uint32_t id = instrRulesCounter++;
   QBDI_REQUIRE_ACTION(id < EVENTID_VM_MASK, return VMError::INVALID_EVENTID);
 
-  this->clearCache(rule->affectedRange());
+  // Only flush the regions with an instruction that the rule may instrument
+  blockManager->clearCache(*rule);
+  commitFlush();
 
+  rule->setGuard(allocGuard(true));
   auto v = std::make_pair(id, std::move(rule));
 
   // insert rule in instrRules and keep the priority order
@@ -540,6 +1801,9 @@ uint32_t Engine::addInstrRule(std::unique_ptr<InstrRule> &&rule) {
                                       b.second->getPriority();
                              });
   instrRules.insert(it, std::move(v));
+  instrRulesFilterDirty = true;
+  // the demoted functions may be instrumented by the new rule
+  resetDemotion();
 
   return id;
 }
@@ -561,7 +1825,10 @@ uint32_t Engine::addVMEventCB(VMEvent mask, VMCallback cbk, void *data) {
   uint32_t id = vmCallbacksCounter++;
   QBDI_REQUIRE_ACTION(id < EVENTID_VM_MASK, return VMError::INVALID_EVENTID);
   vmCallbacks.emplace_back(id, CallbackRegistration{mask, cbk, data});
-  eventMask |= mask;
+  rebuildVMCallbacks();
+  if (mask & sequenceEvent) {
+    blockManager->unlinkExits();
+  }
   return id | EVENTID_VM_MASK;
 }
 
@@ -580,14 +1847,214 @@ bool Engine::setVMEventCB(uint32_t id, VMCallback cbk, void *data) {
   }
 }
 
+uint32_t Engine::addTransferHook(rword target, VMCallback preCbk,
+                                 VMCallback postCbk, void *data) {
+  uint32_t id = vmCallbacksCounter++;
+  QBDI_REQUIRE_ACTION(id < EVENTID_VM_MASK, return VMError::INVALID_EVENTID);
+  transferHooks[target].push_back(TransferHook{id, preCbk, postCbk, data});
+  return id | EVENTID_VM_MASK;
+}
+
+uint32_t Engine::replaceFunction(rword orig, rword replacement) {
+  QBDI_REQUIRE_ACTION(orig != replacement, return VMError::INVALID_EVENTID);
+  uint32_t id = vmCallbacksCounter++;
+  QBDI_REQUIRE_ACTION(id < EVENTID_VM_MASK, return VMError::INVALID_EVENTID);
+  // The exits linked to the original function must return to the VM
+  blockManager->unlinkExits(orig);
+  blockManager->clearSuperBlocks(Range<rword>(orig, orig + 1));
+  replacements[orig] = FunctionReplacement{id, replacement};
+  return id | EVENTID_VM_MASK;
+}
+
+VMAction Engine::signalTransferHooks(VMEvent event, rword target,
+                                     GPRState *gprState, FPRState *fprState) {
+  auto it = transferHooks.find(target);
+  if (it == transferHooks.end()) {
+    return CONTINUE;
+  }
+  // a callback may remove the hooks of the target
+  std::vector<TransferHook> hooks = it->second;
+  VMState vmState{event, target, target, target, target, 0, 0};
+  VMAction action = CONTINUE;
+  for (const TransferHook &hook : hooks) {
+    VMCallback cbk =
+        (event == EXEC_TRANSFER_CALL) ? hook.preCbk : hook.postCbk;
+    if (cbk == nullptr) {
+      continue;
+    }
+    vmState.event = event;
+    VMAction res = cbk(vminstance, &vmState, gprState, fprState, hook.data);
+    if (res > action) {
+      action = res;
+    }
+  }
+  return action;
+}
+
+void Engine::rebuildVMCallbacks() {
+  eventMask = VMEvent::NO_EVENT;
+  // clear the lists without releasing them, the lists of a running
+  // signalEvent must stay valid
+  for (std::vector<uint32_t> &l : vmCallbacksByEvent) {
+    l.clear();
+  }
+  for (uint32_t i = 0; i < vmCallbacks.size(); i++) {
+    VMEvent mask = vmCallbacks[i].second.mask;
+    eventMask |= mask;
+    for (size_t bit = 0; bit < VM_EVENT_BITS; bit++) {
+      if (static_cast<uint32_t>(mask) & (1u << bit)) {
+        vmCallbacksByEvent[bit].push_back(i);
+      }
+    }
+  }
+  updateSyscallRules();
+}
+
+void Engine::updateSyscallRules() {
+  bool enabled = (eventMask & syscallEvent) != 0;
+  if (enabled == (syscallEntryRule != nullptr)) {
+    return;
+  }
+  // Only the regions with a system call are flushed. The entry callback is
+  // also needed by SYSCALL_EXIT, to keep the number of the system call.
+  if (enabled) {
+    syscallEntryRule = InstrRuleBasicCBK::unique(
+        IsSyscall::unique(), syscallEntryCB, this, PREINST, true,
+        PRIORITY_DEFAULT, RelocTagPreInstStdCBK);
+    syscallExitRule = InstrRuleBasicCBK::unique(
+        IsSyscall::unique(), syscallExitCB, this, POSTINST, true,
+        PRIORITY_DEFAULT, RelocTagPostInstStdCBK);
+    blockManager->clearCache(*syscallEntryRule);
+  } else {
+    blockManager->clearCache(*syscallEntryRule);
+    syscallEntryRule.reset();
+    syscallExitRule.reset();
+  }
+  if (translator) {
+    translator->discard();
+  }
+  commitFlush();
+}
+
+VMAction Engine::syscallEntryCB(VMInstanceRef vm, GPRState *gprState,
+                                FPRState *fprState, void *data) {
+  Engine *engine = static_cast<Engine *>(data);
+  engine->syscallAddress = QBDI_GPR_GET(gprState, REG_PC);
+  engine->syscallNumber = getSyscallNumber(gprState);
+  return engine->signalEvent(SYSCALL_ENTRY, engine->syscallAddress, nullptr,
+                             0, gprState, fprState);
+}
+
+VMAction Engine::syscallExitCB(VMInstanceRef vm, GPRState *gprState,
+                               FPRState *fprState, void *data) {
+  Engine *engine = static_cast<Engine *>(data);
+  return engine->signalEvent(SYSCALL_EXIT, engine->syscallAddress, nullptr, 0,
+                             gprState, fprState);
+}
+
+void Engine::armBudgetStop(rword sequence, rword stop) {
+  disarmBudgetStop();
+  budgetSequence = sequence;
+  budgetStopAddress = stop;
+  budgetStopRule = InstrRuleBasicCBK::unique(
+      AddressIs::unique(stop), budgetStopCB, this, PREINST, true,
+      PRIORITY_MEMACCESS_LIMIT + 3, RelocTagPreInstStdCBK);
+  // Only the generated code of the sequences with the stop changes
+  if (translator) {
+    translator->discard();
+  }
+  blockManager->clearCache(Range<rword>(stop, stop + 1));
+  commitFlush();
+}
+
+void Engine::disarmBudgetStop() {
+  if (not budgetStopRule) {
+    return;
+  }
+  budgetStopRule.reset();
+  if (translator) {
+    translator->discard();
+  }
+  blockManager->clearCache(
+      Range<rword>(budgetStopAddress, budgetStopAddress + 1));
+  commitFlush();
+  budgetSequence = 0;
+  budgetStopAddress = 0;
+}
+
+VMAction Engine::budgetExhaustedCB(VMInstanceRef vm, GPRState *gprState,
+                                   FPRState *fprState, void *data) {
+  Engine *engine = static_cast<Engine *>(data);
+  if (engine->inSlice) {
+    // A sequence larger than the whole slice is executed, the next one stops
+    if (engine->instructionBudget == engine->sliceBudget) {
+      engine->instructionBudget = 0;
+      return CONTINUE;
+    }
+    // The slice stops at the entry of the sequence, which is kept in the
+    // cache for the next slice
+    engine->sliceExpired = true;
+    return STOP;
+  }
+  if (engine->instructionBudget == 0) {
+    return STOP;
+  }
+  // The budget ends in this sequence, the sequence is translated again with a
+  // stop on the last instruction of the budget
+  rword sequence = QBDI_GPR_GET(gprState, REG_PC);
+  if (sequence == engine->budgetSequence) {
+    return CONTINUE;
+  }
+  const ExecBlock *execBlock = engine->curExecBlock;
+  uint16_t stopID = execBlock->getCurrentInstID() + engine->instructionBudget;
+  engine->armBudgetStop(sequence, execBlock->getInstMetadata(stopID).address);
+  return BREAK_TO_VM;
+}
+
+VMAction Engine::budgetStopCB(VMInstanceRef vm, GPRState *gprState,
+                              FPRState *fprState, void *data) {
+  Engine *engine = static_cast<Engine *>(data);
+  engine->instructionBudget = 0;
+  return STOP;
+}
+
+VMAction Engine::stopRequestCB(VMInstanceRef vm, GPRState *gprState,
+                               FPRState *fprState, void *data) {
+  Engine *engine = static_cast<Engine *>(data);
+  QBDI_DEBUG("Receive a stop request");
+  engine->stopRequest.store(0);
+  return STOP;
+}
+
 VMAction Engine::signalEvent(VMEvent event, rword currentPC,
                              const SeqLoc *seqLoc, rword basicBlockBegin,
                              GPRState *gprState, FPRState *fprState) {
-  if ((event & eventMask) == 0) {
+  uint32_t active = static_cast<uint32_t>(event & eventMask);
+  if (active == 0) {
+    return CONTINUE;
+  }
+
+  // an event may have several bits (SEQUENCE_EXIT | BASIC_BLOCK_EXIT). Keep a
+  // cursor in the list of each bit and merge them, to call each callback once
+  // in the order of registration.
+  const std::vector<uint32_t> *lists[VM_EVENT_BITS];
+  size_t cursors[VM_EVENT_BITS];
+  size_t nbLists = 0;
+  for (size_t bit = 0; bit < VM_EVENT_BITS; bit++) {
+    if ((active & (1u << bit)) != 0 && !vmCallbacksByEvent[bit].empty()) {
+      lists[nbLists] = &vmCallbacksByEvent[bit];
+      cursors[nbLists] = 0;
+      nbLists++;
+    }
+  }
+  if (nbLists == 0) {
     return CONTINUE;
   }
 
-  VMState vmState{event, currentPC, currentPC, currentPC, currentPC, 0};
+  VMState vmState{event, currentPC, currentPC, currentPC, currentPC, 0, 0};
+  if (event & syscallEvent) {
+    vmState.syscallNumber = syscallNumber;
+  }
   if (seqLoc != nullptr) {
     vmState.basicBlockStart = basicBlockBegin;
     vmState.basicBlockEnd = seqLoc->bbEnd;
@@ -596,19 +2063,100 @@ VMAction Engine::signalEvent(VMEvent event, rword currentPC,
   }
 
   VMAction action = CONTINUE;
-  for (const auto &item : vmCallbacks) {
-    const QBDI::CallbackRegistration &r = item.second;
-    if (event & r.mask) {
-      vmState.event = event;
-      VMAction res = r.cbk(vminstance, &vmState, gprState, fprState, r.data);
-      if (res > action) {
-        action = res;
+  while (true) {
+    uint32_t next = UINT32_MAX;
+    for (size_t i = 0; i < nbLists; i++) {
+      if (cursors[i] < lists[i]->size() && (*lists[i])[cursors[i]] < next) {
+        next = (*lists[i])[cursors[i]];
+      }
+    }
+    if (next >= vmCallbacks.size()) {
+      break;
+    }
+    for (size_t i = 0; i < nbLists; i++) {
+      if (cursors[i] < lists[i]->size() && (*lists[i])[cursors[i]] == next) {
+        cursors[i]++;
       }
     }
+    const QBDI::CallbackRegistration &r = vmCallbacks[next].second;
+    vmState.event = event;
+    VMAction res = r.cbk(vminstance, &vmState, gprState, fprState, r.data);
+    if (res > action) {
+      action = res;
+    }
   }
   return action;
 }
 
+size_t Engine::analyzeRange(rword start, rword end, InstAnalysis *analyses,
+                            size_t count, AnalysisType type, bool basicBlock,
+                            unsigned nbThreads) const {
+  // below this number of instructions, a thread isn't worth its LLVMCPU
+  static constexpr size_t MIN_INST_PER_THREAD = 1024;
+
+  const LLVMCPU &llvmcpu = llvmCPUs->getCPU(curCPUMode);
+  const llvm::ArrayRef<uint8_t> code(reinterpret_cast<const uint8_t *>(start),
+                                     static_cast<size_t>(end - start));
+  std::vector<InstMetadata> metadata;
+  rword offset = 0;
+
+  // the boundaries of the instructions are only known sequentially
+  while (start + offset < end and metadata.size() < count) {
+    llvm::MCInst inst;
+    uint64_t instSize = 0;
+    rword address = start + offset;
+    if (llvmcpu.getInstruction(inst, instSize, code.slice(offset), address) !=
+        llvm::MCDisassembler::Success) {
+      QBDI_DEBUG("Bump into invalid instruction at address {:x}", address);
+      break;
+    }
+    const llvm::MCInstrDesc &desc = llvmcpu.getMCII().get(inst.getOpcode());
+    bool modifyPC = desc.mayAffectControlFlow(inst, llvmcpu.getMRI());
+    metadata.emplace_back(inst, address, instSize, 0, curCPUMode, modifyPC);
+    offset += instSize;
+    if (basicBlock and modifyPC) {
+      break;
+    }
+  }
+
+  auto analyse = [&metadata, analyses, type](const LLVMCPU &cpu, size_t first,
+                                             size_t last) {
+    for (size_t i = first; i < last; i++) {
+      analyzeInstMetadata(metadata[i], type, cpu);
+      InstAnalysis *ana = metadata[i].analysis.get();
+      analyses[i] = *ana;
+      // the operands and the disassembly are owned by the caller
+      if (metadata[i].analysis.get_deleter().shared != nullptr) {
+        copyInstAnalysisContent(analyses[i]);
+      } else {
+        ana->operands = nullptr;
+        ana->disassembly = nullptr;
+      }
+      metadata[i].analysis.reset();
+    }
+  };
+
+  size_t nbInst = metadata.size();
+  size_t maxThreads = std::max<size_t>(1, nbInst / MIN_INST_PER_THREAD);
+  size_t nbWorkers = std::min<size_t>(std::max(nbThreads, 1u), maxThreads);
+  size_t chunk = (nbInst + nbWorkers - 1) / nbWorkers;
+
+  // the LLVM printer isn't shared between the threads
+  std::vector<std::thread> workers;
+  for (size_t t = 1; t < nbWorkers; t++) {
+    workers.emplace_back([this, &analyse, t, chunk, nbInst]() {
+      LLVMCPUs cpus(llvmCPUs->getCPU(), llvmCPUs->getMattrs(), options);
+      analyse(cpus.getCPU(curCPUMode), std::min(nbInst, t * chunk),
+              std::min(nbInst, (t + 1) * chunk));
+    });
+  }
+  analyse(llvmcpu, 0, std::min(nbInst, chunk));
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+  return nbInst;
+}
+
 const InstAnalysis *Engine::getInstAnalysis(rword address,
                                             AnalysisType type) const {
   const ExecBlock *block = blockManager->getExecBlock(address);
@@ -621,20 +2169,94 @@ const InstAnalysis *Engine::getInstAnalysis(rword address,
   return block->getInstAnalysis(instID, type);
 }
 
+InstHandle Engine::getInstHandle(rword address) const {
+  const ExecBlock *block = blockManager->getExecBlock(address);
+  if (block == nullptr) {
+    // not in cache
+    return 0;
+  }
+  uint16_t instID = block->getInstID(address);
+  QBDI_REQUIRE_ACTION(instID != NOT_FOUND, return 0);
+  return block->getInstHandle(instID);
+}
+
+const InstAnalysis *Engine::getInstAnalysisByHandle(InstHandle handle,
+                                                    AnalysisType type) const {
+  const ExecBlock *block = blockManager->getExecBlockOfHandle(handle);
+  if (block == nullptr) {
+    return nullptr;
+  }
+  return block->getInstAnalysis(static_cast<uint16_t>(handle & 0xffff), type);
+}
+
+size_t Engine::iterateCache(CachedInstCallback cbk, void *data,
+                            AnalysisType type) const {
+  size_t count = 0;
+  blockManager->forEachSequence([&](const ExecBlock &block,
+                                    const SeqLoc &seqLoc) {
+    uint16_t start = block.getSeqStart(seqLoc.seqID);
+    uint16_t end = block.getSeqEnd(seqLoc.seqID);
+    CachedInstLocation location = {seqLoc.seqStart, seqLoc.seqEnd,
+                                   seqLoc.bbEnd, 0,
+                                   static_cast<uint16_t>(end - start + 1)};
+    for (uint16_t instID = start; instID <= end; instID++) {
+      location.instIndex = instID - start;
+      count++;
+      if (cbk(vminstance, &location, block.getInstAnalysis(instID, type),
+              data) == STOP) {
+        return false;
+      }
+    }
+    return true;
+  });
+  return count;
+}
+
 bool Engine::deleteInstrumentation(uint32_t id) {
   if (id & EVENTID_VM_MASK) {
     id &= ~EVENTID_VM_MASK;
     for (size_t i = 0; i < vmCallbacks.size(); i++) {
       if (vmCallbacks[i].first == id) {
         vmCallbacks.erase(vmCallbacks.begin() + i);
+        rebuildVMCallbacks();
+        return true;
+      }
+    }
+    for (auto it = transferHooks.begin(); it != transferHooks.end(); ++it) {
+      std::vector<TransferHook> &hooks = it->second;
+      auto hook = std::find_if(
+          hooks.begin(), hooks.end(),
+          [id](const TransferHook &h) { return h.id == id; });
+      if (hook != hooks.end()) {
+        hooks.erase(hook);
+        if (hooks.empty()) {
+          transferHooks.erase(it);
+        }
+        return true;
+      }
+    }
+    for (auto it = replacements.begin(); it != replacements.end(); ++it) {
+      if (it->second.id == id) {
+        replacements.erase(it);
         return true;
       }
     }
   } else {
     for (size_t i = 0; i < instrRules.size(); i++) {
       if (instrRules[i].first == id) {
-        this->clearCache(instrRules[i].second->affectedRange());
+        blockManager->clearInstrRule(id);
+        commitFlush();
+        releaseGuard(instrRules[i].second->getGuard());
         instrRules.erase(instrRules.begin() + i);
+        instrRulesFilterDirty = true;
+        auto it = valueProfiles.find(id);
+        if (it != valueProfiles.end()) {
+          // the current sequence may still count in the table
+          if (running) {
+            retiredValueProfiles.push_back(std::move(it->second));
+          }
+          valueProfiles.erase(it);
+        }
         return true;
       }
     }
@@ -642,31 +2264,927 @@ bool Engine::deleteInstrumentation(uint32_t id) {
   return false;
 }
 
+bool Engine::setInstrumentationEnabled(uint32_t id, bool enable) {
+  InstrRule *rule = getInstrRule(id);
+  if (rule == nullptr) {
+    return false;
+  }
+  if (rule->isEnabled() == enable) {
+    return true;
+  }
+  rule->setEnabled(enable);
+  if (rule->hasInlineGuard()) {
+    return true;
+  }
+  if (enable) {
+    blockManager->clearCache(*rule);
+  } else {
+    blockManager->clearInstrRule(id);
+  }
+  commitFlush();
+  return true;
+}
+
 void Engine::deleteAllInstrumentations() {
   // clear cache
   for (const auto &r : instrRules) {
-    this->clearCache(r.second->affectedRange());
+    blockManager->clearInstrRule(r.first);
   }
+  commitFlush();
+  releaseAllGuards();
   instrRules.clear();
+  instrRulesFilterDirty = true;
+  for (auto &p : valueProfiles) {
+    if (running) {
+      retiredValueProfiles.push_back(std::move(p.second));
+    }
+  }
+  valueProfiles.clear();
   vmCallbacks.clear();
+  transferHooks.clear();
+  replacements.clear();
+  // the ids of the hooks of the allocators are given again from 0
+  if (allocationProfile) {
+    allocationProfile->hookIds.clear();
+  }
   instrRulesCounter = 0;
   vmCallbacksCounter = 0;
-  eventMask = VMEvent::NO_EVENT;
+  rebuildVMCallbacks();
 }
 
-void Engine::clearAllCache() { blockManager->clearCache(not running); }
+void Engine::setCacheLimit(size_t limit) {
+  cacheLimit = limit;
+  blockManager->setCacheLimit(limit);
+}
 
-void Engine::clearCache(rword start, rword end) {
-  blockManager->clearCache(Range<rword>(start, end));
-  if (not running && blockManager->isFlushPending()) {
-    blockManager->flushCommit();
+CacheStats Engine::getCacheStats() const {
+  return blockManager->getCacheStats();
+}
+
+MemoryStats Engine::getMemoryStats() const {
+  return blockManager->getMemoryStats();
+}
+
+std::vector<TransferStats> Engine::getTransferStats(size_t topN) const {
+  return execBroker->getTransferStats(topN);
+}
+
+void Engine::setExecStats(bool enable) {
+  if (not enable) {
+    execStats.reset();
+  } else if (not execStats) {
+    execStats = std::make_unique<ExecStats>();
+    resetExecStats();
   }
 }
 
-void Engine::clearCache(RangeSet<rword> rangeSet) {
-  blockManager->clearCache(rangeSet);
-  if (not running && blockManager->isFlushPending()) {
-    blockManager->flushCommit();
+ExecStats Engine::getExecStats() const {
+  if (not execStats) {
+    return ExecStats{};
+  }
+  return *execStats;
+}
+
+void Engine::resetExecStats() {
+  if (execStats) {
+    *execStats = {};
+  }
+}
+
+void Engine::setAutoDemotion(uint32_t threshold) {
+  demotionThreshold = threshold;
+  resetDemotion();
+}
+
+std::vector<rword> Engine::getDemotedFunctions() const {
+  std::vector<rword> functions(demotedFunctions.begin(),
+                               demotedFunctions.end());
+  std::sort(functions.begin(), functions.end());
+  return functions;
+}
+
+bool Engine::canDemote() const {
+  // the instrumentations of the engine apply on every instruction
+  return demotionThreshold != 0 and not coverageRule and
+         not sequenceProfileRule and not branchProfileRule and
+         not indirectProfileRule and not callGraphRule and
+         not instructionBudgetRule and not budgetStopRule and
+         not stopPollingRule and not memoryTraceRule and not callTraceRule and
+         not pageHistogramRule;
+}
+
+void Engine::trackDemotion(bool instrumented) {
+  // the sequence executed is in the called functions, the ones which have
+  // just returned included. The frames above a dirty frame are pushed after
+  // it, the loop stops at the first dirty frame.
+  if (instrumented) {
+    for (auto it = demotionFrames.rbegin();
+         it != demotionFrames.rend() and it->clean; ++it) {
+      it->clean = false;
+    }
+  }
+  // the calls returned or unwound
+  rword sp = QBDI_GPR_GET(curGPRState, REG_SP);
+  while (not demotionFrames.empty() and sp > demotionFrames.back().sp) {
+    const DemotionFrame &frame = demotionFrames.back();
+    if (not frame.clean) {
+      // a function which reached an instrumented ExecBlock is never demoted
+      keptFunctions.insert(frame.target);
+      demotionCounts.erase(frame.target);
+    } else if (keptFunctions.count(frame.target) == 0 and
+               demotedFunctions.count(frame.target) == 0) {
+      uint32_t &count = demotionCounts[frame.target];
+      if (++count >= demotionThreshold) {
+        QBDI_DEBUG("Demote 0x{:x} to the native execution", frame.target);
+        demotedFunctions.insert(frame.target);
+        demotionCounts.erase(frame.target);
+        // the linked calls must return to the VM to transfer the function
+        if (options & chainingOptions) {
+          blockManager->unlinkExits(frame.target);
+        }
+      }
+    }
+    demotionFrames.pop_back();
+  }
+}
+
+bool Engine::setInstrRuleStats(bool enable, const char *reportPath) {
+  QBDI_REQUIRE_ACTION(not running &&
+                          "Cannot setInstrRuleStats on a running Engine",
+                      abort());
+  ruleStatsReport = (enable and reportPath != nullptr) ? reportPath : "";
+  if (enable == ruleStatsEnabled) {
+    return true;
+  }
+  // The generated code is attributed again, the output of the PatchRules is
+  // kept
+  if (translator) {
+    translator->discard();
+  }
+  blockManager->clearCache(true);
+  ruleStatsEnabled = enable;
+  return true;
+}
+
+std::vector<InstrRuleStats> Engine::getInstrRuleStats(size_t topN) const {
+  std::vector<InstrRuleStats> res;
+  res.reserve(ruleStats.size());
+  for (const auto &it : ruleStats) {
+    res.push_back(*it.second);
+  }
+  // the time of the callbacks, then the generated code
+  std::sort(res.begin(), res.end(),
+            [](const InstrRuleStats &a, const InstrRuleStats &b) {
+              if (a.callbackCycles != b.callbackCycles) {
+                return a.callbackCycles > b.callbackCycles;
+              }
+              if (a.codeSize != b.codeSize) {
+                return a.codeSize > b.codeSize;
+              }
+              return a.id < b.id;
+            });
+  if (topN != 0 and res.size() > topN) {
+    res.resize(topN);
+  }
+  return res;
+}
+
+void Engine::resetInstrRuleStats() {
+  // the generated code keeps the addresses of the statistics
+  for (auto &it : ruleStats) {
+    *it.second = {};
+    it.second->id = it.first;
+  }
+}
+
+InstrRuleStats *Engine::applyRuleStats(uint32_t id) {
+  std::unique_ptr<InstrRuleStats> &stats = ruleStats[id];
+  if (not stats) {
+    stats = std::make_unique<InstrRuleStats>();
+    stats->id = id;
+  }
+  // the instructions of the rule in the sequence are counted from here
+  if (std::none_of(pendingRuleStats.begin(), pendingRuleStats.end(),
+                   [&stats](const std::pair<InstrRuleStats *, rword> &p) {
+                     return p.first == stats.get();
+                   })) {
+    pendingRuleStats.emplace_back(stats.get(), stats->instCount);
+  }
+  return stats.get();
+}
+
+void Engine::attributeCodeSize(rword written) {
+  if (pendingRuleInsts != 0) {
+    for (const auto &p : pendingRuleStats) {
+      rword insts = p.first->instCount - p.second;
+      p.first->codeSize += written * insts / pendingRuleInsts;
+    }
+  }
+  pendingRuleStats.clear();
+  pendingRuleInsts = 0;
+}
+
+bool Engine::writeInstrRuleStatsReport(const char *path) const {
+  FILE *file = fopen(path, "w");
+  if (file == nullptr) {
+    QBDI_ERROR("Cannot open the report of the InstrRules {}", path);
+    return false;
+  }
+  fprintf(file, "# callbackCycles callbackCount codeSize instCount "
+                "shadowCount instrumentCount id\n");
+  for (const InstrRuleStats &stats : getInstrRuleStats(0)) {
+    fprintf(file,
+            "%" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64
+            " %" PRIu64 " 0x%x\n",
+            stats.callbackCycles, stats.callbackCount,
+            static_cast<uint64_t>(stats.codeSize),
+            static_cast<uint64_t>(stats.instCount),
+            static_cast<uint64_t>(stats.shadowCount),
+            static_cast<uint64_t>(stats.instrumentCount), stats.id);
+  }
+  return fclose(file) == 0;
+}
+
+void Engine::resetDemotion() {
+  demotionFrames.clear();
+  demotionCounts.clear();
+  demotedFunctions.clear();
+  keptFunctions.clear();
+}
+
+TranslationProfile Engine::getTranslationProfile() const { return profile; }
+
+void Engine::clearAllCache() {
+  if (translator) {
+    translator->discard();
+  }
+  if (options & Options::OPT_ENABLE_SMC_DETECTION) {
+    unwatchPages(this);
+    smcWatchedPages.clear();
+    smcCheckedPages.clear();
+  }
+  patchCache->clear();
+  blockManager->clearCache(not running);
+}
+
+bool Engine::sealCache() {
+  QBDI_REQUIRE_ACTION(not running && "Cannot sealCache on a running Engine",
+                      abort());
+  // The shared memory objects stay writable by the parent and the children
+  if (options &
+      (Options::OPT_ENABLE_DUAL_MAPPING | Options::OPT_ENABLE_SHARED_CONTEXT)) {
+    QBDI_WARN("Cannot seal the cache with OPT_ENABLE_DUAL_MAPPING or "
+              "OPT_ENABLE_SHARED_CONTEXT");
+    return false;
+  }
+  blockManager->sealCache();
+  return true;
+}
+
+bool Engine::setCoverage(uint8_t *bitmap, size_t size, CoverageMode mode) {
+  QBDI_REQUIRE_ACTION(not running && "Cannot setCoverage on a running Engine",
+                      abort());
+  if (bitmap != nullptr) {
+    // The index of an edge is an immediate of the generated code
+    QBDI_REQUIRE_ACTION(size >= 2 and (size & (size - 1)) == 0 and
+                            static_cast<uint64_t>(size) <= (UINT64_C(1) << 31),
+                        return false);
+    QBDI_REQUIRE_ACTION(mode == COVERAGE_EDGE or mode == COVERAGE_BLOCK,
+                        return false);
+  }
+  if (bitmap == nullptr and not coverageRule) {
+    return true;
+  }
+  // Only the generated code changes, the output of the PatchRules is kept
+  if (translator) {
+    translator->discard();
+  }
+  blockManager->clearCache(true);
+
+  coverageRule.reset();
+  coverageBitmap = bitmap;
+  coverageSize = (bitmap != nullptr) ? size : 0;
+  coveragePrevLoc = 0;
+  if (bitmap != nullptr) {
+    coverageRule = InstrRuleCoverage::unique(bitmap, size, mode,
+                                             &coveragePrevLoc,
+                                             PRIORITY_MEMACCESS_LIMIT + 2);
+  }
+  return true;
+}
+
+void Engine::resetCoverage() {
+  if (coverageBitmap != nullptr) {
+    memset(coverageBitmap, 0, coverageSize);
+  }
+  coveragePrevLoc = 0;
+}
+
+bool Engine::setSequenceProfile(bool enable, const char *reportPath) {
+  QBDI_REQUIRE_ACTION(not running &&
+                          "Cannot setSequenceProfile on a running Engine",
+                      abort());
+  if (not enable and not sequenceProfileRule) {
+    return true;
+  }
+  // Only the generated code changes, the output of the PatchRules is kept
+  if (translator) {
+    translator->discard();
+  }
+  blockManager->clearCache(true);
+
+  sequenceProfileRule.reset();
+  if (enable) {
+    if (not sequenceProfile) {
+      sequenceProfile = std::make_unique<SequenceProfile>();
+    }
+    sequenceProfile->reportPath = (reportPath != nullptr) ? reportPath : "";
+    sequenceProfileRule = std::make_unique<InstrRuleSequenceProfile>(
+        sequenceProfile.get(), PRIORITY_MEMACCESS_LIMIT + 2);
+  }
+  return true;
+}
+
+std::vector<SequenceStats> Engine::getSequenceProfile(size_t topN) const {
+  if (not sequenceProfile) {
+    return {};
+  }
+  return sequenceProfile->getStats(topN);
+}
+
+void Engine::resetSequenceProfile() {
+  if (sequenceProfile) {
+    sequenceProfile->reset();
+  }
+}
+
+bool Engine::setBranchProfile(bool enable) {
+  QBDI_REQUIRE_ACTION(not running &&
+                          "Cannot setBranchProfile on a running Engine",
+                      abort());
+  if (not enable and not branchProfileRule) {
+    return true;
+  }
+  // Only the generated code changes, the output of the PatchRules is kept
+  if (translator) {
+    translator->discard();
+  }
+  blockManager->clearCache(true);
+
+  branchProfileRule.reset();
+  if (enable) {
+    if (not branchProfile) {
+      branchProfile = std::make_unique<BranchProfile>();
+    }
+    branchProfileRule = InstrRuleBranchProfile::unique(
+        branchProfile.get(), PRIORITY_MEMACCESS_LIMIT + 2);
+  }
+  return true;
+}
+
+std::vector<BranchStats> Engine::getBranchProfile(size_t topN) const {
+  if (not branchProfile) {
+    return {};
+  }
+  return branchProfile->getStats(topN);
+}
+
+void Engine::resetBranchProfile() {
+  if (branchProfile) {
+    branchProfile->reset();
+  }
+}
+
+bool Engine::setIndirectProfile(bool enable) {
+  QBDI_REQUIRE_ACTION(not running &&
+                          "Cannot setIndirectProfile on a running Engine",
+                      abort());
+  if (not enable and not indirectProfileRule) {
+    return true;
+  }
+  // Only the generated code changes, the output of the PatchRules is kept
+  if (translator) {
+    translator->discard();
+  }
+  blockManager->clearCache(true);
+
+  indirectProfileRule.reset();
+  if (enable) {
+    if (not indirectProfile) {
+      indirectProfile = std::make_unique<IndirectProfile>();
+    }
+    indirectProfileRule = InstrRuleIndirectProfile::unique(
+        indirectProfile.get(), PRIORITY_MEMACCESS_LIMIT + 2);
+  }
+  return true;
+}
+
+std::vector<IndirectTargetStats>
+Engine::getIndirectProfile(size_t topN) const {
+  if (not indirectProfile) {
+    return {};
+  }
+  return indirectProfile->getStats(topN);
+}
+
+void Engine::resetIndirectProfile() {
+  if (indirectProfile) {
+    indirectProfile->reset();
+  }
+}
+
+uint32_t Engine::addValueProfile(rword address, uint32_t reg,
+                                 size_t buckets) {
+  QBDI_REQUIRE_ACTION(reg <= REG_SP, return VMError::INVALID_EVENTID);
+  QBDI_REQUIRE_ACTION(buckets > 0 && buckets <= VALUE_TABLE_MAX_SIZE,
+                      return VMError::INVALID_EVENTID);
+  auto profile = std::make_unique<ValueProfile>(address, reg, buckets);
+  uint32_t id = addInstrRule(
+      InstrRuleValueProfile::unique(profile.get(), PRIORITY_DEFAULT));
+  if (id != VMError::INVALID_EVENTID) {
+    valueProfiles.emplace(id, std::move(profile));
+  }
+  return id;
+}
+
+std::vector<ValueStats> Engine::getValueProfile(uint32_t id,
+                                                size_t topN) const {
+  auto it = valueProfiles.find(id);
+  if (it == valueProfiles.end()) {
+    return {};
+  }
+  return it->second->getStats(topN);
+}
+
+bool Engine::resetValueProfile(uint32_t id) {
+  auto it = valueProfiles.find(id);
+  if (it == valueProfiles.end()) {
+    return false;
+  }
+  it->second->reset();
+  return true;
+}
+
+bool Engine::setCallGraphProfile(bool enable) {
+  QBDI_REQUIRE_ACTION(not running &&
+                          "Cannot setCallGraphProfile on a running Engine",
+                      abort());
+  if (not enable and not callGraphRule) {
+    return true;
+  }
+  // Only the generated code changes, the output of the PatchRules is kept
+  if (translator) {
+    translator->discard();
+  }
+  blockManager->clearCache(true);
+
+  callGraphRule.reset();
+  if (enable) {
+    if (not callGraphProfile) {
+      callGraphProfile = std::make_unique<CallGraphProfile>();
+    }
+    callGraphRule = std::make_unique<InstrRuleCallGraph>(
+        callGraphProfile.get(), PRIORITY_MEMACCESS_LIMIT + 2);
+  }
+  // the allocation profile samples the stacks from the shadow stack
+  if (allocationProfile) {
+    allocationProfile->callStack =
+        callGraphRule ? &callGraphProfile->state : nullptr;
+  }
+  return true;
+}
+
+std::vector<CallGraphEdgeStats>
+Engine::getCallGraphProfile(size_t topN) const {
+  if (not callGraphProfile) {
+    return {};
+  }
+  return callGraphProfile->getStats(topN);
+}
+
+void Engine::resetCallGraphProfile() {
+  if (callGraphProfile) {
+    callGraphProfile->reset();
+  }
+}
+
+bool Engine::setAllocationProfile(bool enable, uint32_t samplePeriod,
+                                  const char *reportPath) {
+  QBDI_REQUIRE_ACTION(not running &&
+                          "Cannot setAllocationProfile on a running Engine",
+                      abort());
+  if (allocationProfile) {
+    for (uint32_t id : allocationProfile->hookIds) {
+      deleteInstrumentation(id);
+    }
+    allocationProfile->hookIds.clear();
+  }
+  if (not enable) {
+    return true;
+  }
+  std::vector<std::pair<rword, AllocatorFunction>> allocators =
+      AllocationProfile::findAllocators();
+  if (allocators.empty()) {
+    QBDI_WARN("No allocator found for the allocation profile");
+    return false;
+  }
+  if (not allocationProfile) {
+    allocationProfile = std::make_unique<AllocationProfile>();
+  }
+  allocationProfile->reportPath = (reportPath != nullptr) ? reportPath : "";
+  allocationProfile->samplePeriod = samplePeriod;
+  allocationProfile->sampleCountdown = samplePeriod;
+  allocationProfile->callStack =
+      callGraphRule ? &callGraphProfile->state : nullptr;
+  for (const auto &allocator : allocators) {
+    uint32_t id = addTransferHook(
+        allocator.first, AllocationProfile::hookCB, nullptr,
+        &allocationProfile->hooks[allocator.second]);
+    if (id != VMError::INVALID_EVENTID) {
+      allocationProfile->hookIds.push_back(id);
+    }
+  }
+  return true;
+}
+
+AllocationStats Engine::getAllocationProfile() const {
+  if (not allocationProfile) {
+    return AllocationStats{};
+  }
+  return allocationProfile->getStats();
+}
+
+std::vector<AllocationSite> Engine::getAllocationSites(size_t topN) const {
+  if (not allocationProfile) {
+    return {};
+  }
+  return allocationProfile->getSites(topN);
+}
+
+void Engine::resetAllocationProfile() {
+  if (allocationProfile) {
+    allocationProfile->reset();
+  }
+}
+
+void Engine::copyAllocationProfile(const Engine &other) {
+  // the hooks copied from the other engine count in the profile of this
+  // engine, the report stays in the original
+  if (allocationProfile) {
+    allocationProfile->hookIds.clear();
+  }
+  if (not other.allocationProfile) {
+    return;
+  }
+  if (not allocationProfile) {
+    allocationProfile = std::make_unique<AllocationProfile>();
+  }
+  allocationProfile->samplePeriod = other.allocationProfile->samplePeriod;
+  allocationProfile->sampleCountdown = allocationProfile->samplePeriod;
+  allocationProfile->hookIds = other.allocationProfile->hookIds;
+  allocationProfile->callStack =
+      callGraphRule ? &callGraphProfile->state : nullptr;
+  for (auto &it : transferHooks) {
+    for (TransferHook &hook : it.second) {
+      if (hook.preCbk == AllocationProfile::hookCB) {
+        const AllocationProfile::Hook *data =
+            static_cast<const AllocationProfile::Hook *>(hook.data);
+        hook.data = &allocationProfile->hooks[data->function];
+      }
+    }
+  }
+}
+
+bool Engine::setHardwareSampling(HardwareEvent event, uint64_t period) {
+  QBDI_REQUIRE_ACTION(not running &&
+                          "Cannot setHardwareSampling on a running Engine",
+                      abort());
+  sampler.reset();
+  if (period == 0) {
+    return true;
+  }
+  QBDI_REQUIRE_ACTION(event == SAMPLE_CYCLES or event == SAMPLE_INSTRUCTIONS or
+                          event == SAMPLE_CACHE_MISSES or
+                          event == SAMPLE_BRANCH_MISSES,
+                      return false);
+  sampler = std::make_unique<PerfSampler>(event, period);
+  if (not sampler->isValid()) {
+    sampler.reset();
+    return false;
+  }
+  return true;
+}
+
+std::vector<HardwareSample> Engine::getHardwareSamples(size_t topN) const {
+  std::vector<HardwareSample> res;
+  res.reserve(hardwareSamples.size());
+  for (const auto &it : hardwareSamples) {
+    res.push_back(HardwareSample{it.first, it.second, nullptr, 0, nullptr});
+  }
+  std::sort(res.begin(), res.end(),
+            [](const HardwareSample &a, const HardwareSample &b) {
+              if (a.samples != b.samples) {
+                return a.samples > b.samples;
+              }
+              return a.address < b.address;
+            });
+  if (topN != 0 and res.size() > topN) {
+    res.resize(topN);
+  }
+  for (HardwareSample &sample : res) {
+    if (sample.address != 0) {
+      findSymbol(sample.address, sample.symbol, sample.symbolOffset,
+                 sample.module);
+    }
+  }
+  return res;
+}
+
+void Engine::resetHardwareSamples() { hardwareSamples.clear(); }
+
+void Engine::drainHardwareSamples() {
+  std::vector<rword> pcs;
+  sampler->drain(pcs);
+  for (rword pc : pcs) {
+    hardwareSamples[blockManager->getOriginalAddress(pc)]++;
+  }
+}
+
+bool Engine::setMemoryTrace(MemoryAccessType type, MemoryTraceCallback cbk,
+                            void *data, size_t capacity) {
+  QBDI_REQUIRE_ACTION(not running &&
+                          "Cannot setMemoryTrace on a running Engine",
+                      abort());
+  if (cbk != nullptr) {
+    QBDI_REQUIRE_ACTION(type == MEMORY_READ or type == MEMORY_WRITE or
+                            type == MEMORY_READ_WRITE,
+                        return false);
+    QBDI_REQUIRE_ACTION(capacity > MEMORY_TRACE_MAX_ENTRIES, return false);
+  }
+  if (cbk == nullptr and not memoryTrace) {
+    return true;
+  }
+  // Only the generated code changes, the output of the PatchRules is kept
+  if (translator) {
+    translator->discard();
+  }
+  blockManager->clearCache(true);
+
+  flushMemoryTrace();
+  memoryTraceRule.reset();
+  memoryTrace.reset();
+  if (cbk != nullptr) {
+    memoryTrace =
+        std::make_unique<MemoryTraceBuffer>(type, capacity, cbk, data);
+    memoryTraceRule = InstrRuleMemoryTrace::unique(
+        memoryTrace.get(), PRIORITY_MEMACCESS_LIMIT + 2);
+  }
+  return true;
+}
+
+void Engine::flushMemoryTrace() {
+  if (memoryTrace) {
+    memoryTrace->flush(vminstance);
+  }
+}
+
+bool Engine::setCallTrace(CallTraceCallback cbk, void *data, uint32_t nbArgs,
+                          size_t capacity) {
+  QBDI_REQUIRE_ACTION(not running && "Cannot setCallTrace on a running Engine",
+                      abort());
+  if (cbk != nullptr) {
+    QBDI_REQUIRE_ACTION(nbArgs <= QBDI_CALL_TRACE_MAX_ARGS, return false);
+    QBDI_REQUIRE_ACTION(capacity > 0, return false);
+  }
+  if (cbk == nullptr and not callTrace) {
+    return true;
+  }
+  // Only the generated code changes, the output of the PatchRules is kept
+  if (translator) {
+    translator->discard();
+  }
+  blockManager->clearCache(true);
+
+  flushCallTrace();
+  callTraceRule.reset();
+  callTrace.reset();
+  if (cbk != nullptr) {
+    callTrace = std::make_unique<CallTraceBuffer>(nbArgs, capacity, cbk, data);
+    callTraceRule = InstrRuleCallTrace::unique(callTrace.get(),
+                                               PRIORITY_MEMACCESS_LIMIT + 2);
+  }
+  return true;
+}
+
+bool Engine::setCallTraceArity(rword target, uint32_t nbArgs) {
+  QBDI_REQUIRE_ACTION(not running &&
+                          "Cannot setCallTraceArity on a running Engine",
+                      abort());
+  QBDI_REQUIRE_ACTION(nbArgs <= QBDI_CALL_TRACE_MAX_ARGS, return false);
+  if (not callTrace) {
+    return false;
+  }
+  if (translator) {
+    translator->discard();
+  }
+  blockManager->clearCache(true);
+  callTrace->arity[target] = nbArgs;
+  return true;
+}
+
+void Engine::flushCallTrace() {
+  if (callTrace) {
+    callTrace->flush(vminstance);
+  }
+}
+
+bool Engine::setNewBasicBlockBatch(NewBasicBlockCallback cbk, void *data,
+                                   size_t threshold) {
+  QBDI_REQUIRE_ACTION(not running &&
+                          "Cannot setNewBasicBlockBatch on a running Engine",
+                      abort());
+  QBDI_REQUIRE_ACTION(cbk == nullptr or threshold > 0, return false);
+  // the batch is always empty between two runs
+  newBlockBatchCbk = cbk;
+  newBlockBatchData = data;
+  newBlockBatchThreshold = threshold;
+  newBlockBatch.clear();
+  newBlockBatch.reserve((cbk != nullptr) ? threshold : 0);
+  return true;
+}
+
+VMAction Engine::flushNewBasicBlockBatch() {
+  if (newBlockBatch.empty()) {
+    return CONTINUE;
+  }
+  VMAction action = newBlockBatchCbk(vminstance, newBlockBatch.data(),
+                                     newBlockBatch.size(), newBlockBatchData);
+  newBlockBatch.clear();
+  return action;
+}
+
+bool Engine::setPageHistogram(bool enable, MemoryAccessType type) {
+  QBDI_REQUIRE_ACTION(not running &&
+                          "Cannot setPageHistogram on a running Engine",
+                      abort());
+  if (enable) {
+    QBDI_REQUIRE_ACTION(type == MEMORY_READ or type == MEMORY_WRITE or
+                            type == MEMORY_READ_WRITE,
+                        return false);
+  }
+  if (not enable and not pageHistogramRule) {
+    return true;
+  }
+  // Only the generated code changes, the output of the PatchRules is kept
+  if (translator) {
+    translator->discard();
+  }
+  blockManager->clearCache(true);
+
+  pageHistogramRule.reset();
+  if (enable) {
+    if (not pageHistogram) {
+      pageHistogram = std::make_unique<PageHistogram>(type);
+    }
+    pageHistogram->type = type;
+    pageHistogramRule = InstrRulePageHistogram::unique(
+        pageHistogram.get(), PRIORITY_MEMACCESS_LIMIT + 2);
+  }
+  return true;
+}
+
+std::vector<PageAccessStats> Engine::getPageHistogram(size_t topN) const {
+  if (not pageHistogram) {
+    return {};
+  }
+  return pageHistogram->getStats(topN);
+}
+
+void Engine::resetPageHistogram() {
+  if (pageHistogram) {
+    pageHistogram->reset();
+  }
+}
+
+bool Engine::setStopPolling(bool enable) {
+  QBDI_REQUIRE_ACTION(not running &&
+                          "Cannot setStopPolling on a running Engine",
+                      abort());
+  if (enable == (stopPollingRule != nullptr)) {
+    return true;
+  }
+  if (translator) {
+    translator->discard();
+  }
+  blockManager->clearCache(true);
+
+  stopPollingRule.reset();
+  if (enable) {
+    // the generated code reads the value of the atomic
+    static_assert(sizeof(std::atomic<rword>) == sizeof(rword) and
+                  std::atomic<rword>::is_always_lock_free);
+    stopPollingRule = InstrRuleStopRequest::unique(
+        reinterpret_cast<const rword *>(&stopRequest), stopRequestCB, this,
+        PRIORITY_MEMACCESS_LIMIT + 4);
+  }
+  return true;
+}
+
+bool Engine::setInstructionBudget(rword budget) {
+  QBDI_REQUIRE_ACTION(not running &&
+                          "Cannot setInstructionBudget on a running Engine",
+                      abort());
+  budgetEnabled = (budget != 0);
+  // The rule of the slices is kept, without budget it is never exhausted
+  if (budget == 0 and sliceRule) {
+    instructionBudget = ~static_cast<rword>(0);
+    return true;
+  }
+  instructionBudget = budget;
+  // The generated code reads the budget, a new budget doesn't need a flush
+  if ((budget != 0) == (instructionBudgetRule != nullptr)) {
+    return true;
+  }
+  if (translator) {
+    translator->discard();
+  }
+  blockManager->clearCache(true);
+
+  instructionBudgetRule.reset();
+  if (budget != 0) {
+    instructionBudgetRule = std::make_unique<InstrRuleInstructionBudget>(
+        &instructionBudget, budgetExhaustedCB, this,
+        PRIORITY_MEMACCESS_LIMIT + 3);
+  }
+  return true;
+}
+
+void Engine::clearCache(rword start, rword end) {
+  // The code of the staged and cached basic blocks may have changed
+  if (translator) {
+    translator->discard();
+  }
+  patchCache->clear(Range<rword>(start, end));
+  blockManager->clearCache(Range<rword>(start, end));
+  if (not running && blockManager->isFlushPending()) {
+    blockManager->flushCommit();
+  }
+}
+
+void Engine::clearCache(RangeSet<rword> rangeSet) {
+  if (translator) {
+    translator->discard();
+  }
+  for (const Range<rword> &r : rangeSet.getRanges()) {
+    patchCache->clear(r);
+  }
+  blockManager->clearCache(rangeSet);
+  commitFlush();
+}
+
+void Engine::commitFlush() {
+  // When the Engine runs, the flush is committed before the next sequence
+  if (not running && blockManager->isFlushPending()) {
+    blockManager->flushCommit();
+  }
+}
+
+rword *Engine::allocGuard(bool enabled) {
+  rword *guard;
+  if (freeGuards.empty()) {
+    instrRulesGuards.push_back(0);
+    guard = &instrRulesGuards.back();
+  } else {
+    guard = freeGuards.back();
+    freeGuards.pop_back();
+  }
+  *guard = enabled ? 1 : 0;
+  return guard;
+}
+
+// The code of the rule must have been flushed. The current sequence of a run
+// may still read the flag until the end of the run.
+void Engine::releaseGuard(rword *guard) {
+  if (guard == nullptr) {
+    return;
+  }
+  if (running) {
+    retiredGuards.push_back(guard);
+  } else {
+    freeGuards.push_back(guard);
+  }
+}
+
+// Release the flags of all the rules, before instrRules is cleared
+void Engine::releaseAllGuards() {
+  if (running) {
+    for (const auto &r : instrRules) {
+      releaseGuard(r.second->getGuard());
+    }
+  } else {
+    instrRulesGuards.clear();
+    freeGuards.clear();
+    retiredGuards.clear();
   }
 }
 
@@ -18,36 +18,83 @@
 #ifndef ENGINE_H
 #define ENGINE_H
 
+#include <array>
+#include <atomic>
 #include <cstdlib>
+#include <deque>
 #include <memory>
 #include <stdint.h>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
+#include "QBDI/CacheStats.h"
 #include "QBDI/Callback.h"
 #include "QBDI/InstAnalysis.h"
 #include "QBDI/Options.h"
 #include "QBDI/Range.h"
 #include "QBDI/State.h"
+#include "QBDI/TranslationProfile.h"
 
 namespace QBDI {
 
 class LLVMCPUs;
 class ExecBlock;
 class ExecBlockManager;
+class AsyncTranslator;
 class ExecBroker;
-class PatchRule;
+class PerfSampler;
+class PatchCache;
+class PatchRuleTable;
 class InstrRule;
+class InstrRuleCallGraph;
+class InstrRuleInstructionBudget;
+class InstrRuleSequenceProfile;
+struct AllocationProfile;
+struct BranchProfile;
+struct CallGraphProfile;
+struct CallTraceBuffer;
+struct IndirectProfile;
+struct MemoryTraceBuffer;
+struct PageHistogram;
+struct SequenceProfile;
+struct ValueProfile;
 class Patch;
 struct SeqLoc;
 
+// number of bits used by VMEvent
+static constexpr size_t VM_EVENT_BITS = 10;
+
 struct CallbackRegistration {
   VMEvent mask;
   VMCallback cbk;
   void *data;
 };
 
+// Callbacks of the transfers to a native function
+struct TransferHook {
+  uint32_t id;
+  VMCallback preCbk;
+  VMCallback postCbk;
+  void *data;
+};
+
+// Native function called instead of an original function
+struct FunctionReplacement {
+  uint32_t id;
+  rword replacement;
+};
+
+// Prefilter of an InstrRule, computed when the rules change
+struct InstrRuleFilter {
+  RangeSet<rword> range;
+  bool anyOpcode;
+  std::vector<unsigned> opcodes; // sorted, used if anyOpcode is false
+  bool basicBlock;               // applied by tryInstrumentBasicBlock
+};
+
 class Engine {
 private:
   VMInstanceRef vminstance;
@@ -55,33 +102,235 @@ private:
   std::unique_ptr<LLVMCPUs> llvmCPUs;
   std::unique_ptr<ExecBlockManager> blockManager;
   ExecBroker *execBroker;
-  std::vector<PatchRule> patchRules;
+  std::unique_ptr<PatchRuleTable> patchRules;
+  // output of the PatchRules, kept when the instrumentation changes. Shared
+  // by the Engines of the process with OPT_ENABLE_SHARED_PATCHES.
+  std::shared_ptr<PatchCache> patchCache;
+  std::unique_ptr<AsyncTranslator> translator;
   std::vector<std::pair<uint32_t, std::unique_ptr<InstrRule>>> instrRules;
   uint32_t instrRulesCounter;
+  // enable flag of each instrRules, read by the generated code. The flags of
+  // the deleted rules are reused by the next rules, the ones deleted during a
+  // run are only reused after the end of the run.
+  std::deque<rword> instrRulesGuards;
+  std::vector<rword *> freeGuards;
+  std::vector<rword *> retiredGuards;
+  // prefilter of each instrRules, rebuild before the instrumentation if dirty
+  std::vector<InstrRuleFilter> instrRulesFilter;
+  bool instrRulesFilterDirty;
   std::vector<std::pair<uint32_t, CallbackRegistration>> vmCallbacks;
   uint32_t vmCallbacksCounter;
+  // index in vmCallbacks of the callbacks of each VMEvent bit, in the order of
+  // registration. Rebuild with eventMask when vmCallbacks changes.
+  std::array<std::vector<uint32_t>, VM_EVENT_BITS> vmCallbacksByEvent;
+  // hooks of the transfers to the native code, by target. The ids are taken
+  // from vmCallbacksCounter.
+  std::unordered_map<rword, std::vector<TransferHook>> transferHooks;
+  // replacements of the functions, by original address. The ids are taken
+  // from vmCallbacksCounter.
+  std::unordered_map<rword, FunctionReplacement> replacements;
   std::unique_ptr<GPRState> gprState;
   std::unique_ptr<FPRState> fprState;
   GPRState *curGPRState;
   FPRState *curFPRState;
   ExecBlock *curExecBlock;
+  // memory accesses decoded by getInstMemoryAccess and their instruction
+  mutable std::vector<MemoryAccess> instMemAccess;
+  mutable const ExecBlock *instMemAccessBlock = nullptr;
+  mutable uint64_t instMemAccessVisit = 0;
+  mutable uint16_t instMemAccessID = 0;
+  mutable bool instMemAccessPost = false;
   CPUMode curCPUMode;
   Options options;
+  uint32_t execBlockCodeSize;
+  uint32_t execBlockDataSize;
+  size_t cacheLimit;
   VMEvent eventMask;
   bool running;
+  // updated by the translation if QBDI_PROFILE_TRANSLATION is enabled
+  TranslationProfile profile = {};
+  // coverage bitmap updated by the generated code, null if disabled
+  std::unique_ptr<InstrRule> coverageRule;
+  uint8_t *coverageBitmap = nullptr;
+  size_t coverageSize = 0;
+  rword coveragePrevLoc = 0;
+  // execution counters of the sequences, kept when the profile is disabled
+  std::unique_ptr<SequenceProfile> sequenceProfile;
+  std::unique_ptr<InstrRuleSequenceProfile> sequenceProfileRule;
+  // outcome counters of the conditional branches, kept when the profile is
+  // disabled
+  std::unique_ptr<BranchProfile> branchProfile;
+  std::unique_ptr<InstrRule> branchProfileRule;
+  // target tables of the indirect calls and jumps, kept when the profile is
+  // disabled
+  std::unique_ptr<IndirectProfile> indirectProfile;
+  std::unique_ptr<InstrRule> indirectProfileRule;
+  // edges and shadow stack of the call graph, kept when the profile is
+  // disabled
+  std::unique_ptr<CallGraphProfile> callGraphProfile;
+  std::unique_ptr<InstrRuleCallGraph> callGraphRule;
+  // counters of the allocators updated by their transfer hooks, kept when the
+  // profile is disabled
+  std::unique_ptr<AllocationProfile> allocationProfile;
+  // value tables of the value profiles, by id of their InstrRule. The tables
+  // removed during a run are freed at the end of the run.
+  std::unordered_map<uint32_t, std::unique_ptr<ValueProfile>> valueProfiles;
+  std::vector<std::unique_ptr<ValueProfile>> retiredValueProfiles;
+  // instructions left to execute, decremented by the generated code at the
+  // entry of each sequence. The stop rule breaks on the last instruction of
+  // the budget, in the sequence at budgetSequence.
+  rword instructionBudget = 0;
+  std::unique_ptr<InstrRuleInstructionBudget> instructionBudgetRule;
+  std::unique_ptr<InstrRule> budgetStopRule;
+  rword budgetSequence = 0;
+  rword budgetStopAddress = 0;
+  // the budget has been set with setInstructionBudget. Once a slice of
+  // runFor has installed the rule, it is kept and instructionBudget is
+  // unlimited when no budget is set.
+  bool budgetEnabled = false;
+  bool sliceRule = false;
+  // state of the slice run by runFor
+  bool inSlice = false;
+  bool sliceExpired = false;
+  rword sliceBudget = 0;
+  // stop request written by any thread, tested by the run loop and by the
+  // generated code at the entry of each sequence if the polling is enabled
+  std::atomic<rword> stopRequest{0};
+  std::unique_ptr<InstrRule> stopPollingRule;
+  // hardware sampling of the thread of the run, null if disabled
+  std::unique_ptr<PerfSampler> sampler;
+  std::unordered_map<rword, uint64_t> hardwareSamples;
+  // memory trace written by the generated code, null if disabled
+  std::unique_ptr<MemoryTraceBuffer> memoryTrace;
+  std::unique_ptr<InstrRule> memoryTraceRule;
+  // call trace written by the generated code, null if disabled
+  std::unique_ptr<CallTraceBuffer> callTrace;
+  std::unique_ptr<InstrRule> callTraceRule;
+  // execution counters of the runs, null if disabled
+  std::unique_ptr<ExecStats> execStats;
+  // automatic demotion: the functions called demotionThreshold times without
+  // executing an instrumented ExecBlock are then executed natively. The
+  // frames are the calls in progress, closed when the stack pointer is above
+  // the one of the entry. The functions which reached an instrumented
+  // ExecBlock are kept in the DBI.
+  struct DemotionFrame {
+    rword target;
+    rword sp;
+    bool clean;
+  };
+  uint32_t demotionThreshold = 0;
+  std::vector<DemotionFrame> demotionFrames;
+  std::unordered_map<rword, uint32_t> demotionCounts;
+  std::unordered_set<rword> demotedFunctions;
+  std::unordered_set<rword> keptFunctions;
+  // costs of the InstrRules by id, kept when the statistics are disabled and
+  // when the rules are deleted. The code size of a written sequence is
+  // shared by its rules in proportion of their instructions, counted from
+  // pendingRuleStats, which holds the instCount of each rule before the
+  // sequence.
+  bool ruleStatsEnabled = false;
+  std::string ruleStatsReport;
+  std::unordered_map<uint32_t, std::unique_ptr<InstrRuleStats>> ruleStats;
+  std::vector<std::pair<InstrRuleStats *, rword>> pendingRuleStats;
+  rword pendingRuleInsts = 0;
+  // basic blocks translated by the run, given in batches to the callback
+  NewBasicBlockCallback newBlockBatchCbk = nullptr;
+  void *newBlockBatchData = nullptr;
+  size_t newBlockBatchThreshold = 0;
+  std::vector<NewBasicBlockEntry> newBlockBatch;
+  // counters of the memory accesses by page, kept when the histogram is
+  // disabled
+  std::unique_ptr<PageHistogram> pageHistogram;
+  std::unique_ptr<InstrRule> pageHistogramRule;
+  // callbacks of the system calls that signal the SYSCALL events, null if no
+  // VMCallback listens to them
+  std::unique_ptr<InstrRule> syscallEntryRule;
+  std::unique_ptr<InstrRule> syscallExitRule;
+  // address and number of the last system call, kept for SYSCALL_EXIT
+  rword syscallAddress = 0;
+  rword syscallNumber = 0;
+  // OPT_ENABLE_SMC_DETECTION: the pages of the translated code protected
+  // against the writes, and the pages already given to the page watch
+  RangeSet<rword> smcWatchedPages;
+  RangeSet<rword> smcCheckedPages;
+
+  void initPatchRules();
+  void initTranslator();
+  void initPatchCache();
+  void initInstrRulesFilter();
 
   std::vector<Patch> patch(rword start);
 
   void initGPRState();
   void initFPRState();
 
-  void instrument(std::vector<Patch> &basicBlock, size_t patchEnd);
+  void instrument(std::vector<Patch> &basicBlock, size_t patchEnd,
+                  std::vector<uint32_t> &instrRuleIDs);
+  void requestSuccessors(const std::vector<Patch> &basicBlock);
+  void requestTranslation(rword address);
   void handleNewBasicBlock(rword pc);
+  void writeNewBasicBlock(std::vector<Patch> basicBlock);
+  bool isDecodable(rword address, const RangeSet<rword> &bounds) const;
+  void watchTranslatedCode(rword start, rword end);
+  bool invalidateWrittenCode();
+  void updateModules();
+  void commitFlush();
+  rword *allocGuard(bool enabled);
+  void releaseGuard(rword *guard);
+  void releaseAllGuards();
+  bool handleNewSuperBlock(rword pc, const std::vector<rword> &stops);
+  void rebuildVMCallbacks();
+  void updateSyscallRules();
+  void copyAllocationProfile(const Engine &other);
+
+  static VMAction syscallEntryCB(VMInstanceRef vm, GPRState *gprState,
+                                 FPRState *fprState, void *data);
+  static VMAction syscallExitCB(VMInstanceRef vm, GPRState *gprState,
+                                FPRState *fprState, void *data);
+
+  void armBudgetStop(rword sequence, rword stop);
+  void disarmBudgetStop();
+
+  bool canDemote() const;
+  void trackDemotion(bool instrumented);
+  void resetDemotion();
+
+  InstrRuleStats *applyRuleStats(uint32_t id);
+  void attributeCodeSize(rword written);
+  bool writeInstrRuleStatsReport(const char *path) const;
+
+  static VMAction budgetExhaustedCB(VMInstanceRef vm, GPRState *gprState,
+                                    FPRState *fprState, void *data);
+  static VMAction budgetStopCB(VMInstanceRef vm, GPRState *gprState,
+                               FPRState *fprState, void *data);
+  static VMAction stopRequestCB(VMInstanceRef vm, GPRState *gprState,
+                                FPRState *fprState, void *data);
 
   VMAction signalEvent(VMEvent kind, rword currentPC, const SeqLoc *seqLoc,
                        rword basicBlockBegin, GPRState *gprState,
                        FPRState *fprState);
 
+  // State of the dispatch loop of a run, kept when the loop is selected again
+  struct RunState {
+    rword currentPC;
+    bool hasRan = false;
+    bool batchFull = false;
+    rword basicBlockBeginAddr = 0;
+    rword basicBlockEndAddr = 0;
+    // Last exit taken, used to link the sequences together
+    ExecBlock *lastExecBlock = nullptr;
+    uint16_t lastExitID;
+  };
+
+  /*! Dispatch loop of run. The loop without events doesn't signal the
+   * VMEvents nor track the basic blocks.
+   *
+   * @return True if the run is finished, false if the events changed and the
+   *         loop must be selected again
+   */
+  template <bool withEvents>
+  bool dispatchLoop(RunState &state, const std::vector<rword> &stops);
+
 public:
   /*! Construct a new Engine for a given CPU with specific attributes
    *
@@ -145,6 +394,27 @@ public:
    */
   void setOptions(Options options);
 
+  /*! Get the size of the code and data blocks of the ExecBlocks
+   *
+   * @param[out] codeSize  Size in bytes of the code blocks (0 for one page)
+   * @param[out] dataSize  Size in bytes of the data blocks (0 for one page)
+   */
+  void getExecBlockSize(uint32_t &codeSize, uint32_t &dataSize) const {
+    codeSize = execBlockCodeSize;
+    dataSize = execBlockDataSize;
+  }
+
+  /*! Set the size of the code and data blocks of the ExecBlocks
+   *
+   * If the new sizes mismatch the current one, clearAllCache will be called.
+   *
+   * @param[in] codeSize  Size in bytes of the code blocks (0 for one page)
+   * @param[in] dataSize  Size in bytes of the data blocks (0 for one page)
+   *
+   * @return True if the sizes are valid and have been applied
+   */
+  bool setExecBlockSize(uint32_t codeSize, uint32_t dataSize);
+
   /*! Add an address range to the set of instrumented address ranges.
    *
    * @param[in] start  Start address of the range (included).
@@ -200,13 +470,45 @@ public:
    */
   void removeAllInstrumentedRanges();
 
+  /*! Set the policy of the tracking of the modules loaded and unloaded
+   * during the execution.
+   *
+   * @param[in] tracking  The policy
+   */
+  void setModuleTracking(ModuleTracking tracking);
+
+  /*! Get the policy of the tracking of the modules.
+   */
+  ModuleTracking getModuleTracking() const;
+
   /*! Start the execution by the DBI.
    *
    * @param[in] start  Pointer to the first instruction to execute.
-   * @param[in] stop   Stop the execution when this instruction is reached.
+   * @param[in] stops  Stop the execution when one of these instructions is
+   *                   reached.
    * @return  True if at least one block has been executed.
    */
-  bool run(rword start, rword stop);
+  bool run(rword start, const std::vector<rword> &stops);
+
+  /*! Run a slice of the execution from the PC of the current GPRState. The
+   * slice stops at the entry of the first sequence which doesn't fit in the
+   * budget, or after the first sequence if it is larger than the budget.
+   * The translation cache is flushed by the first slice only.
+   *
+   * @param[in] stop    Stop the execution when this instruction is reached.
+   * @param[in] budget  The number of instructions of the slice.
+   *
+   * @return  The status of the slice.
+   */
+  SliceStatus runFor(rword stop, rword budget);
+
+  /*! Execute the instruction at the PC of the current GPRState, without the
+   * VMEvent callbacks. Need OPT_SINGLE_STEP. A call to a non-instrumented
+   * function is executed until its return.
+   *
+   * @return  True if the instruction has been executed.
+   */
+  bool step();
 
   /*! Add a custom instrumentation rule to the engine. Requires internal headers
    *
@@ -246,6 +548,44 @@ public:
    */
   bool setVMEventCB(uint32_t id, VMCallback cbk, void *data);
 
+  /*! Register the callbacks of the transfers to a native function.
+   *
+   * @param[in] target   The address of the function.
+   * @param[in] preCbk   The callback before the transfer, or nullptr.
+   * @param[in] postCbk  The callback after the return, or nullptr.
+   * @param[in] data     User defined data passed to the callbacks.
+   *
+   * @return The id of the registered instrumentation (or
+   * VMError::INVALID_EVENTID in case of failure).
+   */
+  uint32_t addTransferHook(rword target, VMCallback preCbk, VMCallback postCbk,
+                           void *data);
+
+  /*! Replace a function by another one. The execution reaching the original
+   * address continues at the replacement, without translating the original
+   * function.
+   *
+   * @param[in] orig         The address of the original function.
+   * @param[in] replacement  The address of the replacement.
+   *
+   * @return The id of the registered instrumentation (or
+   * VMError::INVALID_EVENTID in case of failure).
+   */
+  uint32_t replaceFunction(rword orig, rword replacement);
+
+  /*! Call the transfer hooks of a target.
+   *
+   * @param[in] event     EXEC_TRANSFER_CALL for the callbacks before the
+   *                      transfer, EXEC_TRANSFER_RETURN after it.
+   * @param[in] target    The target of the transfer.
+   * @param[in] gprState  The GPRState given to the callbacks.
+   * @param[in] fprState  The FPRState given to the callbacks.
+   *
+   * @return The action of the callbacks.
+   */
+  VMAction signalTransferHooks(VMEvent event, rword target,
+                               GPRState *gprState, FPRState *fprState);
+
   /*! Remove an instrumentation.
    *
    * @param[in] id The id of the instrumentation to remove.
@@ -253,6 +593,17 @@ public:
    */
   bool deleteInstrumentation(uint32_t id);
 
+  /*! Enable or disable an instrumentation rule. The rules with a callback that
+   * breaks to the host test their flag in the generated code and don't need
+   * any flush of the cache, the other rules are flushed.
+   *
+   * @param[in] id      The id of the rule
+   * @param[in] enable  Enable or disable the rule
+   *
+   * @return True if the rule exists
+   */
+  bool setInstrumentationEnabled(uint32_t id, bool enable);
+
   /*! Remove all the registered instrumentations.
    *
    */
@@ -264,12 +615,26 @@ public:
    */
   const ExecBlock *getCurExecBlock() const { return curExecBlock; }
 
+  /*! Expose the LLVMCPU of each CPUMode
+   *
+   * @return A reference to the LLVMCPUs of the Engine
+   */
+  const LLVMCPUs &getLLVMCPUs() const { return *llvmCPUs; }
+
   /*! Check if current ExecBlock is PREINST in current state
    *
    * @return true if engine state is Pre-inst
    */
   bool isPreInst() const;
 
+  /*! Get the memory accesses of the current instruction. They are decoded
+   * once per return of the generated code to the host, the callbacks of the
+   * same instruction share them.
+   *
+   * @return The memory accesses, valid until the next call
+   */
+  const std::vector<MemoryAccess> &getInstMemoryAccess() const;
+
   /*! Pre-cache a known basic block
    *
    * @param[in] pc Start address of a basic block
@@ -278,6 +643,54 @@ public:
    */
   bool precacheBasicBlock(rword pc);
 
+  /*! Pre-cache a list of basic blocks in one go. With
+   * OPT_ENABLE_ASYNC_PATCH, the worker patches the next basic blocks of the
+   * list while the current one is instrumented and written.
+   *
+   * @param[in] addresses  The start addresses of the basic blocks. The
+   *                       addresses which aren't instrumented or are already
+   *                       cached are skipped.
+   *
+   * @return The number of basic blocks inserted in the cache.
+   */
+  size_t precacheBasicBlocks(const std::vector<rword> &addresses);
+
+  /*! Pre-cache the basic blocks reachable from entry points through the
+   * direct branches and calls, without leaving some bounds. The indirect
+   * branches and the returns aren't followed.
+   *
+   * @param[in] bounds      The ranges of the code to translate.
+   * @param[in] entries     The entry points of the code.
+   * @param[in] useSymbols  Also use the function symbols in the bounds as
+   *                        entry points.
+   *
+   * @return The number of basic blocks inserted in the cache.
+   */
+  size_t precacheReachable(const RangeSet<rword> &bounds,
+                           const std::vector<rword> &entries, bool useSymbols);
+
+  /*! Write the start address of the cached sequences relative to their
+   * module in a file.
+   *
+   * @param[in] path  The path of the file.
+   *
+   * @return False if the file cannot be written.
+   */
+  bool saveCacheProfile(const char *path) const;
+
+  /*! Get the sorted start addresses of the cached sequences.
+   */
+  std::vector<rword> getCachedSequences() const;
+
+  /*! Pre-cache the sequences of a file written by saveCacheProfile, in the
+   * modules loaded in the process.
+   *
+   * @param[in] path  The path of the file.
+   *
+   * @return The number of basic blocks inserted in the cache.
+   */
+  size_t prewarmCache(const char *path);
+
   /*! Return an InstAnalysis for a cached instruction.
    * The pointer may be invalid by any noconst method call.
    *
@@ -289,7 +702,57 @@ public:
    */
   const InstAnalysis *getInstAnalysis(rword address, AnalysisType type) const;
 
-  /*! Clear a specific address range from the translation cache.
+  /*! Return the handle of a cached instruction.
+   *
+   * @param[in] address Start address of the instruction
+   *
+   * @return The handle or 0 if the instruction isn't in the cache.
+   */
+  InstHandle getInstHandle(rword address) const;
+
+  /*! Return an InstAnalysis from the handle of an instruction.
+   *
+   * @param[in] handle  The handle of the instruction
+   * @param[in] type    type of the Analysis
+   *
+   * @return A pointer to the Analysis or a null pointer if the ExecBlock of
+   * the instruction has been freed.
+   */
+  const InstAnalysis *getInstAnalysisByHandle(InstHandle handle,
+                                              AnalysisType type) const;
+
+  /*! Call a callback on each instruction of the cache.
+   *
+   * @param[in] cbk   The callback
+   * @param[in] data  User defined data given to the callback
+   * @param[in] type  type of the Analysis
+   *
+   * @return The number of instructions given to the callback
+   */
+  size_t iterateCache(CachedInstCallback cbk, void *data,
+                      AnalysisType type) const;
+
+  /*! Disassemble and analyse a range without translating it. The analyses
+   * are copied in an array of the caller which owns their operands and their
+   * disassembly.
+   *
+   * @param[in]  start       Start of the range
+   * @param[in]  end         End of the range (excluded)
+   * @param[out] analyses    The array of the analyses
+   * @param[in]  count       The size of the array
+   * @param[in]  type        type of the Analysis
+   * @param[in]  basicBlock  Stop after the first instruction which may change
+   *                         the control flow
+   * @param[in]  nbThreads   The number of threads of the analysis
+   *
+   * @return The number of analysed instructions
+   */
+  size_t analyzeRange(rword start, rword end, InstAnalysis *analyses,
+                      size_t count, AnalysisType type, bool basicBlock,
+                      unsigned nbThreads) const;
+
+  /*! Clear a specific address range from the translation cache. The code of
+   * the range is disassembled again at its next execution.
    *
    * @param[in] start Start of the address range to clear from the cache.
    * @param[in] end   End of the address range to clear from the cache.
@@ -297,15 +760,399 @@ public:
    */
   void clearCache(rword start, rword end);
 
-  /*! Clear a specific address rangeSet from the translation cache.
+  /*! Clear a specific address rangeSet from the translation cache. The code
+   * of the rangeSet is disassembled again at its next execution.
    *
    * @param[in] rangeSet    The range set to clear from the cache.
    */
   void clearCache(RangeSet<rword> rangeSet);
 
+  /*! Get the memory budget of the translation cache
+   */
+  size_t getCacheLimit() const { return cacheLimit; }
+
+  /*! Set the memory budget of the translation cache. When the cache exceeds
+   * it, the least recently used regions are evicted.
+   *
+   * @param[in] limit  Budget in bytes (0 for no limit)
+   */
+  void setCacheLimit(size_t limit);
+
+  /*! Get the statistics of the translation cache
+   */
+  CacheStats getCacheStats() const;
+
+  /*! Get the memory used by the translation cache
+   */
+  MemoryStats getMemoryStats() const;
+
+  /*! Get the statistics of the transfers to the native code
+   *
+   * @param[in] topN  Maximal number of targets returned (0 for all)
+   */
+  std::vector<TransferStats> getTransferStats(size_t topN) const;
+
+  /*! Enable or disable the execution counters. The counters are reset when
+   * they are enabled.
+   *
+   * @param[in] enable  True to count the executions
+   */
+  void setExecStats(bool enable);
+
+  /*! Get the execution counters since their last reset
+   */
+  ExecStats getExecStats() const;
+
+  /*! Reset the execution counters
+   */
+  void resetExecStats();
+
+  /*! Enable or disable the automatic demotion of the functions to the native
+   * execution. The state of the demotion is reset.
+   *
+   * @param[in] threshold  Number of calls without instrumentation before a
+   *                       function is demoted (0 to disable)
+   */
+  void setAutoDemotion(uint32_t threshold);
+
+  /*! Get the entries of the functions demoted to the native execution
+   */
+  std::vector<rword> getDemotedFunctions() const;
+
+  /*! Attribute the generated code, the shadows and the time of the
+   * callbacks to the InstrRules. The translation cache is flushed.
+   *
+   * @param[in] enable      Enable or disable the statistics
+   * @param[in] reportPath  File where the statistics are written when the
+   *                        Engine is destroyed, nullptr for no report
+   *
+   * @return True if the statistics have been configured
+   */
+  bool setInstrRuleStats(bool enable, const char *reportPath);
+
+  /*! Get the statistics of the InstrRules, sorted by decreasing cost
+   *
+   * @param[in] topN  Maximal number of rules returned (0 for all)
+   */
+  std::vector<InstrRuleStats> getInstrRuleStats(size_t topN) const;
+
+  /*! Reset the statistics of the InstrRules, without flushing the
+   * translation cache.
+   */
+  void resetInstrRuleStats();
+
+  /*! Get the profile of the translation
+   */
+  TranslationProfile getTranslationProfile() const;
+
   /*! Clear the entire translation cache.
    */
   void clearAllCache();
+
+  /*! Seal the ExecBlocks of the translation cache before the process forks.
+   *
+   * @return False if an option maps the ExecBlocks with a shared memory
+   *         object.
+   */
+  bool sealCache();
+
+  /*! Update a coverage bitmap from the generated code at the entry of each
+   * sequence. The translation cache is flushed.
+   *
+   * @param[in] bitmap  The bitmap to update, nullptr to disable the coverage
+   * @param[in] size    The size of the bitmap, a power of two
+   * @param[in] mode    The kind of coverage
+   *
+   * @return True if the coverage has been configured
+   */
+  bool setCoverage(uint8_t *bitmap, size_t size, CoverageMode mode);
+
+  /*! Clear the coverage bitmap and the previous location, without flushing
+   * the translation cache.
+   */
+  void resetCoverage();
+
+  /*! Count the executions of each sequence from the generated code. The
+   * translation cache is flushed.
+   *
+   * @param[in] enable      Enable or disable the counters
+   * @param[in] reportPath  File where the profile is written when the Engine
+   *                        is destroyed, nullptr for no report
+   *
+   * @return True if the profile has been configured
+   */
+  bool setSequenceProfile(bool enable, const char *reportPath);
+
+  /*! Get the counters of the executed sequences
+   *
+   * @param[in] topN  Maximal number of sequences returned (0 for all)
+   */
+  std::vector<SequenceStats> getSequenceProfile(size_t topN) const;
+
+  /*! Clear the counters of the sequences, without flushing the translation
+   * cache.
+   */
+  void resetSequenceProfile();
+
+  /*! Enable or disable the outcome counters of the conditional branches,
+   * incremented by the generated code. The translation cache is flushed.
+   *
+   * @param[in] enable  Enable or disable the counters
+   *
+   * @return True if the profile has been configured
+   */
+  bool setBranchProfile(bool enable);
+
+  /*! Get the counters of the executed conditional branches
+   *
+   * @param[in] topN  Maximal number of branches returned (0 for all)
+   */
+  std::vector<BranchStats> getBranchProfile(size_t topN) const;
+
+  /*! Clear the counters of the branches, without flushing the translation
+   * cache.
+   */
+  void resetBranchProfile();
+
+  /*! Enable or disable the target tables of the indirect calls and jumps,
+   * filled by the generated code. The translation cache is flushed.
+   *
+   * @param[in] enable  Enable or disable the tables
+   *
+   * @return True if the profile has been configured
+   */
+  bool setIndirectProfile(bool enable);
+
+  /*! Get the executed targets of the indirect calls and jumps
+   *
+   * @param[in] topN  Maximal number of targets returned (0 for all)
+   */
+  std::vector<IndirectTargetStats> getIndirectProfile(size_t topN) const;
+
+  /*! Clear the counters of the targets, without flushing the translation
+   * cache.
+   */
+  void resetIndirectProfile();
+
+  /*! Count the values of a register before an instruction from the generated
+   * code.
+   *
+   * @param[in] address  The address of the instruction
+   * @param[in] reg      The index of the register in the GPRState
+   * @param[in] buckets  The number of values recorded in the table
+   *
+   * @return The id of the InstrRule (or VMError::INVALID_EVENTID)
+   */
+  uint32_t addValueProfile(rword address, uint32_t reg, size_t buckets);
+
+  /*! Get the counters of the values of a value profile
+   *
+   * @param[in] id    The id of the value profile
+   * @param[in] topN  Maximal number of values returned (0 for all)
+   */
+  std::vector<ValueStats> getValueProfile(uint32_t id, size_t topN) const;
+
+  /*! Clear the counters of a value profile, without flushing the translation
+   * cache.
+   *
+   * @param[in] id  The id of the value profile
+   *
+   * @return False if the id isn't a value profile
+   */
+  bool resetValueProfile(uint32_t id);
+
+  /*! Enable or disable the call graph recorded by the generated code. The
+   * translation cache is flushed.
+   *
+   * @param[in] enable  Enable or disable the call graph
+   *
+   * @return True if the profile has been configured
+   */
+  bool setCallGraphProfile(bool enable);
+
+  /*! Get the executed edges of the call graph
+   *
+   * @param[in] topN  Maximal number of edges returned (0 for all)
+   */
+  std::vector<CallGraphEdgeStats> getCallGraphProfile(size_t topN) const;
+
+  /*! Clear the counters of the edges, without flushing the translation
+   * cache.
+   */
+  void resetCallGraphProfile();
+
+  /*! Count the calls to the allocators from their transfer hooks and sample
+   * the stacks of the allocations.
+   *
+   * @param[in] enable        Enable or disable the profile
+   * @param[in] samplePeriod  Number of allocations between two sampled
+   *                          stacks, 0 to not sample the stacks
+   * @param[in] reportPath    File where the profile is written when the
+   *                          Engine is destroyed, nullptr for no report
+   *
+   * @return False if no allocator is found
+   */
+  bool setAllocationProfile(bool enable, uint32_t samplePeriod,
+                            const char *reportPath);
+
+  /*! Get the counters of the allocators
+   */
+  AllocationStats getAllocationProfile() const;
+
+  /*! Get the sampled stacks of the allocations
+   *
+   * @param[in] topN  Maximal number of stacks returned (0 for all)
+   */
+  std::vector<AllocationSite> getAllocationSites(size_t topN) const;
+
+  /*! Clear the counters and the stacks of the allocation profile
+   */
+  void resetAllocationProfile();
+
+  /*! Sample a hardware event during the runs and attribute the samples to
+   * the original instructions.
+   *
+   * @param[in] event   The hardware event
+   * @param[in] period  The number of events between two samples, 0 to
+   *                    disable the sampling
+   *
+   * @return True if the sampling has been configured
+   */
+  bool setHardwareSampling(HardwareEvent event, uint64_t period);
+
+  /*! Get the samples of the original instructions
+   *
+   * @param[in] topN  Maximal number of instructions returned (0 for all)
+   */
+  std::vector<HardwareSample> getHardwareSamples(size_t topN) const;
+
+  /*! Clear the samples of the hardware sampling
+   */
+  void resetHardwareSamples();
+
+  /*! Attribute the samples of the ring buffer of the sampler to the original
+   * instructions. The ExecBlocks of the samples must still be in the cache.
+   */
+  void drainHardwareSamples();
+
+  /*! Append the memory accesses to a trace buffer from the generated code.
+   * The entries are given to the callback when the buffer is full and at
+   * the end of the execution. The translation cache is flushed.
+   *
+   * @param[in] type      The type of the memory accesses to trace
+   * @param[in] cbk       The callback of the entries, nullptr to disable the
+   *                      trace
+   * @param[in] data      User defined data passed to the callback
+   * @param[in] capacity  The number of entries of the buffer
+   *
+   * @return True if the trace has been configured
+   */
+  bool setMemoryTrace(MemoryAccessType type, MemoryTraceCallback cbk,
+                      void *data, size_t capacity);
+
+  /*! Give the pending entries of the memory trace to its callback
+   */
+  void flushMemoryTrace();
+
+  /*! Append the target and the first arguments of the calls to a trace
+   * buffer from the generated code. The entries are given to the callback
+   * when the buffer is full and at the end of the execution. The translation
+   * cache is flushed.
+   *
+   * @param[in] cbk       The callback of the entries, nullptr to disable the
+   *                      trace
+   * @param[in] data      User defined data passed to the callback
+   * @param[in] nbArgs    The number of arguments of the calls without arity
+   * @param[in] capacity  The number of entries of the buffer
+   *
+   * @return True if the trace has been configured
+   */
+  bool setCallTrace(CallTraceCallback cbk, void *data, uint32_t nbArgs,
+                    size_t capacity);
+
+  /*! Set the number of arguments captured for the direct calls of a callee.
+   * The translation cache is flushed.
+   *
+   * @param[in] target  The address of the callee
+   * @param[in] nbArgs  The number of arguments
+   *
+   * @return False if the call trace isn't enabled
+   */
+  bool setCallTraceArity(rword target, uint32_t nbArgs);
+
+  /*! Give the pending entries of the call trace to its callback
+   */
+  void flushCallTrace();
+
+  /*! Give the basic blocks translated by the runs to a callback in batches.
+   *
+   * @param[in] cbk        The callback of the entries, nullptr to disable
+   *                       the batches
+   * @param[in] data       User defined data passed to the callback
+   * @param[in] threshold  The number of entries of a batch
+   *
+   * @return True if the batches have been configured
+   */
+  bool setNewBasicBlockBatch(NewBasicBlockCallback cbk, void *data,
+                             size_t threshold);
+
+  /*! Give the pending basic blocks of the batch to its callback
+   *
+   * @return The action of the callback
+   */
+  VMAction flushNewBasicBlockBatch();
+
+  /*! Enable or disable the page histogram counted by the generated code. The
+   * translation cache is flushed.
+   *
+   * @param[in] enable  Enable or disable the histogram
+   * @param[in] type    The type of the memory accesses to count
+   *
+   * @return True if the histogram has been configured
+   */
+  bool setPageHistogram(bool enable, MemoryAccessType type);
+
+  /*! Get the counters of the accessed pages
+   *
+   * @param[in] topN  Maximal number of pages returned (0 for all)
+   */
+  std::vector<PageAccessStats> getPageHistogram(size_t topN) const;
+
+  /*! Clear the counters of the pages, without flushing the translation
+   * cache.
+   */
+  void resetPageHistogram();
+
+  /*! Set the number of instructions that the next runs may execute. The
+   * generated code subtracts the instructions of each sequence from the budget
+   * and the run stops before the first instruction over the budget. The
+   * translation cache is flushed when the budget is enabled or disabled.
+   *
+   * @param[in] budget  The number of instructions, 0 to disable the budget
+   *
+   * @return True if the budget has been configured
+   */
+  bool setInstructionBudget(rword budget);
+
+  /*! Get the number of instructions left in the budget
+   */
+  rword getInstructionBudget() const {
+    return budgetEnabled ? instructionBudget : 0;
+  }
+
+  /*! Enable or disable the test of the stop request by the generated code at
+   * the entry of each sequence. The translation cache is flushed.
+   *
+   * @param[in] enable  Enable or disable the polling
+   *
+   * @return True if the polling has been configured
+   */
+  bool setStopPolling(bool enable);
+
+  /*! Request the current or the next run to stop at the entry of a sequence.
+   * This method can be called from any thread.
+   */
+  void requestStop() { stopRequest.store(1); }
 };
 
 } // namespace QBDI
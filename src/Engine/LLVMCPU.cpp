@@ -15,6 +15,8 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <mutex>
+#include <unordered_map>
 #include <utility>
 
 #include "llvm/ADT/SmallVector.h"
@@ -46,7 +48,9 @@
 
 #include "QBDI/Config.h"
 #include "Engine/LLVMCPU.h"
+#include "Utility/InstAnalysis_prive.h"
 #include "Utility/LogSys.h"
+#include "Utility/Profiler.h"
 #include "Utility/System.h"
 #include "Utility/memory_ostream.h"
 
@@ -54,6 +58,21 @@
 
 namespace QBDI {
 
+namespace {
+
+// The targets are registered once for all the VMs
+void initializeLLVMTargets() {
+  static std::once_flag initialized;
+  std::call_once(initialized, []() {
+    llvm::InitializeAllTargetInfos();
+    llvm::InitializeAllTargetMCs();
+    llvm::InitializeAllAsmParsers();
+    llvm::InitializeAllDisassemblers();
+  });
+}
+
+} // anonymous namespace
+
 LLVMCPUs::LLVMCPUs(const std::string &_cpu,
                    const std::vector<std::string> &_mattrs, Options opts) {
 #if defined(QBDI_ARCH_ARM)
@@ -78,18 +97,13 @@ void LLVMCPUs::setOptions(Options opts) {
   }
 }
 
-LLVMCPU::LLVMCPU(const std::string &_cpu, const std::string &_arch,
-                 const std::vector<std::string> &_mattrs, Options opts,
-                 CPUMode cpumode)
-    : cpu(_cpu), arch(_arch), mattrs(_mattrs), options(opts), cpumode(cpumode) {
+LLVMCPUTarget::LLVMCPUTarget(const std::string &_cpu, const std::string &arch,
+                             const std::vector<std::string> &_mattrs)
+    : cpu(_cpu), mattrs(_mattrs) {
 
   std::string error;
-  std::string featuresStr;
 
-  llvm::InitializeAllTargetInfos();
-  llvm::InitializeAllTargetMCs();
-  llvm::InitializeAllAsmParsers();
-  llvm::InitializeAllDisassemblers();
+  initializeLLVMTargets();
 
   // Build features string
   if (cpu.empty()) {
@@ -116,69 +130,126 @@ LLVMCPU::LLVMCPU(const std::string &_cpu, const std::string &_arch,
   target = llvm::TargetRegistry::lookupTarget(arch, processTriple, error);
   QBDI_DEBUG("Initialized LLVM for target {}", tripleName.c_str());
 
-  // Allocate all LLVM classes
+  // Allocate the LLVM classes which don't depend on a MCContext
   llvm::MCTargetOptions MCOptions;
   MRI = std::unique_ptr<llvm::MCRegisterInfo>(
       target->createMCRegInfo(tripleName));
   MAI = std::unique_ptr<llvm::MCAsmInfo>(
       target->createMCAsmInfo(*MRI, tripleName, MCOptions));
   MCII = std::unique_ptr<llvm::MCInstrInfo>(target->createMCInstrInfo());
+  opcodeAnalysis = std::make_unique<OpcodeAnalysisCache>(*MCII, *MRI);
   MSTI = std::unique_ptr<llvm::MCSubtargetInfo>(
       target->createMCSubtargetInfo(tripleName, cpu, featuresStr));
-  MCTX = std::make_unique<llvm::MCContext>(processTriple, MAI.get(), MRI.get(),
-                                           MSTI.get());
+  QBDI_DEBUG("Initialized LLVM subtarget with cpu {} and features {}",
+             cpu.c_str(), featuresStr.c_str());
+}
+
+LLVMCPUTarget::~LLVMCPUTarget() = default;
+
+std::shared_ptr<const LLVMCPUTarget>
+LLVMCPUTarget::getShared(const std::string &cpu, const std::string &arch,
+                         const std::vector<std::string> &mattrs) {
+  // Never destroyed: a static VM may release its LLVMCPU after the end of main
+  static std::mutex *sharedLock = new std::mutex;
+  static auto *shared =
+      new std::unordered_map<std::string, std::weak_ptr<const LLVMCPUTarget>>;
+
+  // the empty cpu and mattrs select the host ones
+  std::string key = arch + ":" + cpu;
+  for (const std::string &mattr : mattrs) {
+    key += "," + mattr;
+  }
+
+  std::lock_guard<std::mutex> guard(*sharedLock);
+  for (auto it = shared->begin(); it != shared->end();) {
+    if (it->second.expired()) {
+      it = shared->erase(it);
+    } else {
+      ++it;
+    }
+  }
+  std::shared_ptr<const LLVMCPUTarget> target = (*shared)[key].lock();
+  if (not target) {
+    target = std::make_shared<const LLVMCPUTarget>(cpu, arch, mattrs);
+    (*shared)[key] = target;
+  }
+  return target;
+}
+
+LLVMCPU::LLVMCPU(const std::string &_cpu, const std::string &_arch,
+                 const std::vector<std::string> &_mattrs, Options opts,
+                 CPUMode cpumode)
+    : shared(LLVMCPUTarget::getShared(_cpu, _arch, _mattrs)), arch(_arch),
+      options(opts), cpumode(cpumode) {
+
+  const llvm::Target *target = shared->target;
+  const llvm::MCRegisterInfo &MRI = *shared->MRI;
+  const llvm::MCInstrInfo &MCII = *shared->MCII;
+  const llvm::MCSubtargetInfo &MSTI = *shared->MSTI;
+
+  // The MCContext and its users are mutable, each LLVMCPU has its own
+  llvm::MCTargetOptions MCOptions;
+  MCTX = std::make_unique<llvm::MCContext>(
+      llvm::Triple(shared->tripleName), shared->MAI.get(), &MRI, &MSTI);
   MOFI = std::unique_ptr<llvm::MCObjectFileInfo>(
       target->createMCObjectFileInfo(*MCTX, false));
   MCTX->setObjectFileInfo(MOFI.get());
-  QBDI_DEBUG("Initialized LLVM subtarget with cpu {} and features {}",
-             cpu.c_str(), featuresStr.c_str());
 
   auto MAB = std::unique_ptr<llvm::MCAsmBackend>(
-      target->createMCAsmBackend(*MSTI, *MRI, MCOptions));
+      target->createMCAsmBackend(MSTI, MRI, MCOptions));
   MCE = std::unique_ptr<llvm::MCCodeEmitter>(
-      target->createMCCodeEmitter(*MCII, *MRI, *MCTX));
+      target->createMCCodeEmitter(MCII, MRI, *MCTX));
 
   // assembler, disassembler and printer
   null_ostream = std::make_unique<llvm::raw_null_ostream>();
 
   disassembler = std::unique_ptr<llvm::MCDisassembler>(
-      target->createMCDisassembler(*MSTI, *MCTX));
+      target->createMCDisassembler(MSTI, *MCTX));
 
   auto codeEmitter = std::unique_ptr<llvm::MCCodeEmitter>(
-      target->createMCCodeEmitter(*MCII, *MRI, *MCTX));
+      target->createMCCodeEmitter(MCII, MRI, *MCTX));
 
   auto objectWriter = std::unique_ptr<llvm::MCObjectWriter>(
       MAB->createObjectWriter(*null_ostream));
 
   assembler = std::make_unique<llvm::MCAssembler>(
       *MCTX, std::move(MAB), std::move(codeEmitter), std::move(objectWriter));
+}
+
+LLVMCPU::~LLVMCPU() = default;
 
+std::unique_ptr<llvm::MCInstPrinter> LLVMCPU::createAsmPrinter() const {
   unsigned int variant = 0;
 #if defined(QBDI_ARCH_X86_64) || defined(QBDI_ARCH_X86)
   variant = ((options & Options::OPT_ATT_SYNTAX) == 0) ? 1 : 0;
 #else
-  variant = MAI->getAssemblerDialect();
+  variant = shared->MAI->getAssemblerDialect();
 #endif
 
-  asmPrinter = std::unique_ptr<llvm::MCInstPrinter>(target->createMCInstPrinter(
-      MSTI->getTargetTriple(), variant, *MAI, *MCII, *MRI));
-  asmPrinter->setPrintImmHex(true);
-  asmPrinter->setPrintImmHex(llvm::HexStyle::C);
+  auto printer = std::unique_ptr<llvm::MCInstPrinter>(
+      shared->target->createMCInstPrinter(shared->MSTI->getTargetTriple(),
+                                          variant, *shared->MAI,
+                                          *shared->MCII, *shared->MRI));
+  printer->setPrintImmHex(true);
+  printer->setPrintImmHex(llvm::HexStyle::C);
+  return printer;
 }
 
-LLVMCPU::~LLVMCPU() = default;
-
 llvm::MCDisassembler::DecodeStatus
 LLVMCPU::getInstruction(llvm::MCInst &instr, uint64_t &size,
                         llvm::ArrayRef<uint8_t> bytes, uint64_t address) const {
-  return disassembler->getInstruction(instr, size, bytes, address,
-                                      llvm::nulls());
+  QBDI_PROFILE_SCOPE(disassembly);
+  llvm::MCDisassembler::DecodeStatus status =
+      disassembler->getInstruction(instr, size, bytes, address, llvm::nulls());
+  QBDI_PROFILE_BYTES(disassembly, size);
+  return status;
 }
 
-void LLVMCPU::writeInstruction(const llvm::MCInst inst,
+void LLVMCPU::writeInstruction(const llvm::MCInst &inst,
                                memory_ostream *stream) const {
   // MCCodeEmitter needs a fixups array
   llvm::SmallVector<llvm::MCFixup, 4> fixups;
+  QBDI_PROFILE_SCOPE(encoding);
 
   uint64_t pos = stream->current_pos();
   QBDI_DEBUG_BLOCK({
@@ -186,8 +257,10 @@ void LLVMCPU::writeInstruction(const llvm::MCInst inst,
     std::string disass = showInst(inst, address);
     QBDI_DEBUG("Assembling {} at 0x{:x}", disass.c_str(), address);
   });
-  assembler->getEmitter().encodeInstruction(inst, *stream, fixups, *MSTI);
+  assembler->getEmitter().encodeInstruction(inst, *stream, fixups,
+                                            *shared->MSTI);
   uint64_t size = stream->current_pos() - pos;
+  QBDI_PROFILE_BYTES(encoding, size);
 
   if (fixups.size() > 0) {
     llvm::MCValue target = llvm::MCValue();
@@ -197,7 +270,7 @@ void LLVMCPU::writeInstruction(const llvm::MCInst inst,
       assembler->getBackend().applyFixup(
           *assembler, fixup, target,
           llvm::MutableArrayRef<char>((char *)stream->get_ptr() + pos, size),
-          (uint64_t)value, true, MSTI.get());
+          (uint64_t)value, true, shared->MSTI.get());
     } else {
       QBDI_WARN("Could not evalutate fixup, might crash!");
     }
@@ -211,35 +284,43 @@ void LLVMCPU::writeInstruction(const llvm::MCInst inst,
                          stream->current_pos()));
 }
 
+unsigned LLVMCPU::getInstSize(const llvm::MCInst &inst) const {
+  llvm::SmallVector<llvm::MCFixup, 4> fixups;
+  llvm::SmallVector<char, 16> buffer;
+  llvm::raw_svector_ostream stream(buffer);
+  assembler->getEmitter().encodeInstruction(inst, stream, fixups,
+                                            *shared->MSTI);
+  return static_cast<unsigned>(buffer.size());
+}
+
 std::string LLVMCPU::showInst(const llvm::MCInst &inst,
                               uint64_t address) const {
   std::string out;
   llvm::raw_string_ostream rso(out);
 
+  std::call_once(asmPrinterFlag,
+                 [this]() { asmPrinter = createAsmPrinter(); });
   llvm::StringRef unusedAnnotations;
-  asmPrinter->printInst(&inst, address, unusedAnnotations, *MSTI, rso);
+  asmPrinter->printInst(&inst, address, unusedAnnotations, *shared->MSTI,
+                        rso);
 
   rso.flush();
   return out;
 }
 
 const char *LLVMCPU::getRegisterName(unsigned int id) const {
-  return MRI->getName(id);
+  return shared->MRI->getName(id);
 }
 
 void LLVMCPU::setOptions(Options opts) {
+  Options previous = options;
+  options = opts;
 #if defined(QBDI_ARCH_X86_64) || defined(QBDI_ARCH_X86)
-  if (((opts ^ options) & Options::OPT_ATT_SYNTAX) != 0) {
-    asmPrinter =
-        std::unique_ptr<llvm::MCInstPrinter>(target->createMCInstPrinter(
-            MSTI->getTargetTriple(),
-            ((opts & Options::OPT_ATT_SYNTAX) == 0) ? 1 : 0, *MAI, *MCII,
-            *MRI));
-    asmPrinter->setPrintImmHex(true);
-    asmPrinter->setPrintImmHex(llvm::HexStyle::C);
+  // a printer not yet created will use the new syntax
+  if (((opts ^ previous) & Options::OPT_ATT_SYNTAX) != 0 and asmPrinter) {
+    asmPrinter = createAsmPrinter();
   }
 #endif
-  options = opts;
 }
 
 } // namespace QBDI
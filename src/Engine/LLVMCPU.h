@@ -20,6 +20,7 @@
 
 #include <algorithm>
 #include <memory>
+#include <mutex>
 #include <stdint.h>
 #include <string>
 #include <vector>
@@ -47,31 +48,63 @@ class raw_pwrite_stream;
 
 namespace QBDI {
 class memory_ostream;
+class OpcodeAnalysisCache;
 
-class LLVMCPU {
-
-private:
+// The MC components of a target, a CPU and its features which are only read
+// after their creation. They are shared by all the LLVMCPU of the process
+// with the same configuration, while the LLVMCPU keeps the components which
+// depend on a MCContext.
+class LLVMCPUTarget {
+public:
   std::string tripleName;
   std::string cpu;
-  std::string arch;
   std::vector<std::string> mattrs;
+  std::string featuresStr;
   const llvm::Target *target;
+
+  std::unique_ptr<llvm::MCAsmInfo> MAI;
+  std::unique_ptr<llvm::MCInstrInfo> MCII;
+  std::unique_ptr<llvm::MCRegisterInfo> MRI;
+  std::unique_ptr<llvm::MCSubtargetInfo> MSTI;
+  // thread safe, the opcodes are analysed once for the process
+  std::unique_ptr<OpcodeAnalysisCache> opcodeAnalysis;
+
+  LLVMCPUTarget(const std::string &cpu, const std::string &arch,
+                const std::vector<std::string> &mattrs);
+
+  ~LLVMCPUTarget();
+
+  LLVMCPUTarget(const LLVMCPUTarget &) = delete;
+  LLVMCPUTarget &operator=(const LLVMCPUTarget &) = delete;
+
+  // Get the shared components of a configuration, created if no LLVMCPU
+  // uses them
+  static std::shared_ptr<const LLVMCPUTarget>
+  getShared(const std::string &cpu, const std::string &arch,
+            const std::vector<std::string> &mattrs);
+};
+
+class LLVMCPU {
+
+private:
+  std::shared_ptr<const LLVMCPUTarget> shared;
+  std::string arch;
   Options options;
   CPUMode cpumode;
 
-  std::unique_ptr<llvm::MCAsmInfo> MAI;
   std::unique_ptr<llvm::MCCodeEmitter> MCE;
   std::unique_ptr<llvm::MCContext> MCTX;
-  std::unique_ptr<llvm::MCInstrInfo> MCII;
   std::unique_ptr<llvm::MCObjectFileInfo> MOFI;
-  std::unique_ptr<llvm::MCRegisterInfo> MRI;
-  std::unique_ptr<llvm::MCSubtargetInfo> MSTI;
 
   std::unique_ptr<llvm::MCAssembler> assembler;
   std::unique_ptr<llvm::MCDisassembler> disassembler;
-  std::unique_ptr<llvm::MCInstPrinter> asmPrinter;
+  // created by the first showInst, most of the VMs never print an instruction
+  mutable std::unique_ptr<llvm::MCInstPrinter> asmPrinter;
+  mutable std::once_flag asmPrinterFlag;
   std::unique_ptr<llvm::raw_pwrite_stream> null_ostream;
 
+  std::unique_ptr<llvm::MCInstPrinter> createAsmPrinter() const;
+
 public:
   LLVMCPU(const std::string &cpu = "", const std::string &arch = "",
           const std::vector<std::string> &mattrs = {},
@@ -85,7 +118,11 @@ public:
   LLVMCPU(const LLVMCPU &) = delete;
   LLVMCPU &operator=(const LLVMCPU &) = delete;
 
-  void writeInstruction(llvm::MCInst inst, memory_ostream *stream) const;
+  void writeInstruction(const llvm::MCInst &inst,
+                        memory_ostream *stream) const;
+
+  // Size of the encoding of an instruction, without fixups
+  unsigned getInstSize(const llvm::MCInst &inst) const;
 
   llvm::MCDisassembler::DecodeStatus
   getInstruction(llvm::MCInst &inst, uint64_t &size,
@@ -95,15 +132,22 @@ public:
 
   const char *getRegisterName(unsigned int id) const;
 
-  inline const std::string &getCPU() const { return cpu; }
+  inline const std::string &getCPU() const { return shared->cpu; }
 
-  inline const std::vector<std::string> &getMattrs() const { return mattrs; }
+  inline const std::vector<std::string> &getMattrs() const {
+    return shared->mattrs;
+  }
 
   inline const CPUMode getCPUMode() const { return cpumode; }
 
-  inline const llvm::MCInstrInfo &getMCII() const { return *MCII; }
+  inline const llvm::MCInstrInfo &getMCII() const { return *shared->MCII; }
+
+  inline const llvm::MCRegisterInfo &getMRI() const { return *shared->MRI; }
 
-  inline const llvm::MCRegisterInfo &getMRI() const { return *MRI; }
+  // the table is populated by the analysis of the instructions
+  inline OpcodeAnalysisCache &getOpcodeAnalysis() const {
+    return *shared->opcodeAnalysis;
+  }
 
   Options getOptions() const { return options; }
   void setOptions(Options opts);
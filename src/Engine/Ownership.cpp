@@ -0,0 +1,84 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <atomic>
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "QBDI/Callback.h"
+#include "QBDI/Ownership.h"
+#include "QBDI/State.h"
+
+#include "Patch/MemoryAccess.h"
+#include "Utility/LogSys.h"
+
+namespace QBDI {
+
+OwnershipShadow::OwnershipShadow()
+    : table(std::make_unique<OwnershipTable>()) {}
+
+OwnershipShadow::~OwnershipShadow() = default;
+
+uint32_t OwnershipShadow::getOwner(rword address) const {
+  return table->load(address);
+}
+
+void OwnershipShadow::setOwner(rword address, rword size, uint32_t owner) {
+  if (size == 0) {
+    return;
+  }
+  rword first = address >> OWNERSHIP_GRANULE_SHIFT;
+  rword last = (address + size - 1) >> OWNERSHIP_GRANULE_SHIFT;
+  for (rword granule = first; granule <= last; granule++) {
+    table->get(granule << OWNERSHIP_GRANULE_SHIFT)
+        .store(owner, std::memory_order_relaxed);
+  }
+}
+
+size_t OwnershipShadow::getShadowSize() const {
+  return OWNERSHIP_DIRECTORY_SIZE * sizeof(rword) +
+         table->nbLeaves.load() * OWNERSHIP_LEAF_SIZE * sizeof(uint32_t);
+}
+
+void OwnershipShadow::clear() { table->clear(); }
+
+OwnershipFilter::OwnershipFilter(OwnershipShadow &shadow, uint32_t thread,
+                                 OwnershipCallback cbk, void *data)
+    : shadow(shadow), thread(thread), cbk(cbk), data(data), missAddress(0) {
+  QBDI_REQUIRE_ACTION(thread != 0, abort());
+}
+
+VMAction OwnershipFilter::handleMiss(VMInstanceRef vm, GPRState *gprState,
+                                     FPRState *fprState,
+                                     MemoryAccessType type) {
+  OwnershipTable::Owner &slot = shadow.table->get(missAddress);
+  // the first access of a granule gives it to the thread
+  uint32_t owner = 0;
+  if (not slot.compare_exchange_strong(owner, thread) and owner == thread) {
+    // the granule was given to this thread since the check
+    return CONTINUE;
+  }
+  if (cbk == nullptr) {
+    return CONTINUE;
+  }
+  OwnershipAccess access = {missAddress, owner, thread, type};
+  return cbk(vm, gprState, fprState, &access, data);
+}
+
+} // namespace QBDI
@@ -0,0 +1,216 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "QBDI/Callback.h"
+#include "QBDI/InstAnalysis.h"
+#include "QBDI/State.h"
+#include "QBDI/Taint.h"
+#include "QBDI/VM.h"
+
+#include "Utility/LogSys.h"
+#include "Utility/ShadowMemory.h"
+
+namespace QBDI {
+
+// The number of accesses kept for an instruction
+static const size_t maxInstAccess = 8;
+
+TaintState::TaintState()
+    : memory(std::make_unique<ShadowMemory>()), cbk(nullptr), data(nullptr) {
+  clear();
+}
+
+TaintState::~TaintState() = default;
+
+void TaintState::setMemoryLabel(rword address, rword size, TaintLabel label) {
+  memory->set(address, size, label);
+}
+
+TaintLabel TaintState::getMemoryLabel(rword address, rword size) const {
+  return memory->get(address, size);
+}
+
+void TaintState::setRegisterLabel(unsigned reg, TaintLabel label) {
+  QBDI_REQUIRE_ACTION(reg < NUM_GPR, return );
+  if (reg != REG_SP and reg != REG_PC) {
+    gprLabels[reg] = label;
+  }
+}
+
+TaintLabel TaintState::getRegisterLabel(unsigned reg) const {
+  QBDI_REQUIRE_ACTION(reg < NUM_GPR, return 0);
+  return gprLabels[reg];
+}
+
+size_t TaintState::getShadowSize() const { return memory->getAllocatedSize(); }
+
+void TaintState::clear() {
+  memory->clear();
+  memset(gprLabels, 0, sizeof(gprLabels));
+  memset(fprLabels, 0, sizeof(fprLabels));
+  flagsLabel = 0;
+}
+
+// The length of an access, the bulk accesses keep it in the value
+static inline rword accessLength(const MemoryAccess &access) {
+  if (access.flags & MEMORY_BULK) {
+    return access.value;
+  }
+  return access.size;
+}
+
+// XOR or SUB of a register with itself, the result doesn't depend on the
+// register. InstAnalysis merges the operands of the same register.
+static bool isZeroIdiom(const InstAnalysis &analysis) {
+  static const char *const mnemonics[] = {"XOR", "SUB", "PXOR", "VPXOR",
+                                          "VXOR"};
+  if (analysis.mayLoad) {
+    return false;
+  }
+  bool match = false;
+  for (const char *m : mnemonics) {
+    if (strncmp(analysis.mnemonic, m, strlen(m)) == 0) {
+      match = true;
+      break;
+    }
+  }
+  if (not match) {
+    return false;
+  }
+  int16_t reg = -1;
+  for (uint8_t i = 0; i < analysis.numOperands; i++) {
+    const OperandAnalysis &op = analysis.operands[i];
+    if (op.flag & OPERANDFLAG_IMPLICIT) {
+      continue;
+    }
+    if (op.type != OPERAND_GPR and op.type != OPERAND_FPR) {
+      return false;
+    }
+    if (reg != -1 and reg != op.regCtxIdx) {
+      return false;
+    }
+    reg = op.regCtxIdx;
+  }
+  return reg != -1;
+}
+
+VMAction TaintState::propagate(VMInstanceRef vm, GPRState *gprState,
+                               FPRState *fprState) {
+  VM *qbdivm = static_cast<VM *>(vm);
+  const InstAnalysis *analysis =
+      qbdivm->getInstAnalysis(ANALYSIS_INSTRUCTION | ANALYSIS_OPERANDS);
+  QBDI_REQUIRE_ACTION(analysis != nullptr, return CONTINUE);
+
+  bool isLea = strncmp(analysis->mnemonic, "LEA", 3) == 0;
+
+  // the labels of the registers read by the instruction, the address
+  // operands are kept apart except for LEA
+  TaintLabel source = 0;
+  TaintLabel address = 0;
+  for (uint8_t i = 0; i < analysis->numOperands; i++) {
+    const OperandAnalysis &op = analysis->operands[i];
+    if ((op.regAccess & REGISTER_READ) == 0 or op.regCtxIdx < 0) {
+      continue;
+    }
+    TaintLabel label = 0;
+    if (op.type == OPERAND_GPR) {
+      label = gprLabels[op.regCtxIdx];
+    } else if (op.type == OPERAND_FPR) {
+      size_t end = std::min<size_t>(op.regCtxIdx + op.size, sizeof(FPRState));
+      for (size_t j = op.regCtxIdx; j < end; j++) {
+        label |= fprLabels[j];
+      }
+    }
+    if ((op.flag & OPERANDFLAG_ADDR) and not isLea) {
+      address |= label;
+    } else {
+      source |= label;
+    }
+  }
+  TaintLabel condition =
+      (analysis->flagsAccess & REGISTER_READ) ? flagsLabel : 0;
+
+  MemoryAccess accesses[maxInstAccess];
+  size_t nbAccess = std::min(
+      qbdivm->getInstMemoryAccess(accesses, maxInstAccess), maxInstAccess);
+  for (size_t i = 0; i < nbAccess; i++) {
+    if (accesses[i].type & MEMORY_READ) {
+      source |= memory->get(accesses[i].accessAddress,
+                            accessLength(accesses[i]));
+    }
+  }
+
+  // policy events, with the labels before the instruction
+  VMAction action = CONTINUE;
+  if (cbk != nullptr) {
+    if (address != 0 and not isLea and nbAccess > 0) {
+      action = std::max(
+          action, cbk(vm, gprState, fprState, TAINT_POINTER, address, data));
+    }
+    if (analysis->affectControlFlow and (source | condition) != 0) {
+      action = std::max(action, cbk(vm, gprState, fprState, TAINT_BRANCH,
+                                    source | condition, data));
+    }
+  }
+
+  // the return address pushed by a call doesn't depend on its target
+  TaintLabel result = 0;
+  if (not analysis->affectControlFlow and not isZeroIdiom(*analysis)) {
+    result = source | condition;
+  }
+
+  for (uint8_t i = 0; i < analysis->numOperands; i++) {
+    const OperandAnalysis &op = analysis->operands[i];
+    if ((op.regAccess & REGISTER_WRITE) == 0 or op.regCtxIdx < 0) {
+      continue;
+    }
+    if (op.type == OPERAND_GPR) {
+      if (op.regCtxIdx == REG_SP or op.regCtxIdx == REG_PC) {
+        continue;
+      }
+      // the writes of 8 and 16 bits keep the other bytes of the register
+      if (op.size < sizeof(uint32_t)) {
+        gprLabels[op.regCtxIdx] |= result;
+      } else {
+        gprLabels[op.regCtxIdx] = result;
+      }
+    } else if (op.type == OPERAND_FPR) {
+      size_t end = std::min<size_t>(op.regCtxIdx + op.size, sizeof(FPRState));
+      for (size_t j = op.regCtxIdx; j < end; j++) {
+        fprLabels[j] = result;
+      }
+    }
+  }
+  if (analysis->flagsAccess & REGISTER_WRITE) {
+    flagsLabel = result;
+  }
+  for (size_t i = 0; i < nbAccess; i++) {
+    if (accesses[i].type & MEMORY_WRITE) {
+      memory->set(accesses[i].accessAddress, accessLength(accesses[i]),
+                  result);
+    }
+  }
+  return action;
+}
+
+} // namespace QBDI
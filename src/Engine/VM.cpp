@@ -20,6 +20,7 @@
 #include <memory>
 #include <stdarg.h>
 #include <stdlib.h>
+#include <string.h>
 #include <string>
 #include <utility>
 #include <vector>
@@ -30,8 +31,10 @@
 #include "QBDI/InstAnalysis.h"
 #include "QBDI/Memory.hpp"
 #include "QBDI/Options.h"
+#include "QBDI/Ownership.h"
 #include "QBDI/Range.h"
 #include "QBDI/State.h"
+#include "QBDI/Taint.h"
 #include "QBDI/VM.h"
 
 #include "Engine/Engine.h"
@@ -43,33 +46,185 @@
 #include "Patch/PatchCondition.h"
 #include "Patch/PatchGenerator.h"
 #include "Patch/PatchUtils.h"
+#include "Utility/DirtyPages.h"
+#include "Utility/InstAnalysis_prive.h"
 #include "Utility/LogSys.h"
+#include "Utility/PageWatch.h"
+#include "Utility/Symbol.h"
 
 // Mask to identify Virtual Callback events
 #define EVENTID_VIRTCB_MASK (1UL << 31)
 
 namespace QBDI {
 
-VMAction memReadGate(VMInstanceRef vm, GPRState *gprState, FPRState *fprState,
-                     void *data) {
-  std::vector<std::pair<uint32_t, MemCBInfo>> &memCBInfos =
-      *static_cast<std::vector<std::pair<uint32_t, MemCBInfo>> *>(data);
-  std::vector<MemoryAccess> memAccesses = vm->getInstMemoryAccess();
-  RangeSet<rword> readRange;
-  for (const MemoryAccess &memAccess : memAccesses) {
-    if (memAccess.type & MEMORY_READ) {
-      Range<rword> accessRange(memAccess.accessAddress,
-                               memAccess.accessAddress + memAccess.size);
-      readRange.add(accessRange);
+void MemCBIndex::add(uint32_t id, const MemCBInfo &info) {
+  // the callbacks with the same start stay in the order of registration
+  auto it = std::upper_bound(
+      infos.begin(), infos.end(), info.range.start(),
+      [](rword start, const std::pair<uint32_t, MemCBInfo> &el) {
+        return start < el.second.range.start();
+      });
+  infos.emplace(it, id, info);
+  updateMaxEnd();
+}
+
+bool MemCBIndex::remove(uint32_t id) {
+  auto found = std::remove_if(infos.begin(), infos.end(),
+                              [id](const std::pair<uint32_t, MemCBInfo> &el) {
+                                return id == el.first;
+                              });
+  if (found == infos.end()) {
+    return false;
+  }
+  infos.erase(found, infos.end());
+  updateMaxEnd();
+  if (pageWatchCBID != VMError::INVALID_EVENTID) {
+    watch();
+  }
+  return true;
+}
+
+MemCBInfo *MemCBIndex::find(uint32_t id) {
+  auto it = std::find_if(infos.begin(), infos.end(),
+                         [id](const std::pair<uint32_t, MemCBInfo> &el) {
+                           return id == el.first;
+                         });
+  if (it == infos.end()) {
+    return nullptr;
+  }
+  return &it->second;
+}
+
+void MemCBIndex::clear() {
+  if (pageWatchCBID != VMError::INVALID_EVENTID) {
+    unwatchPages(this);
+  }
+  infos.clear();
+  maxEnd.clear();
+  // the rules and the callbacks are already removed from the engine
+  pageWatchCBID = VMError::INVALID_EVENTID;
+  promoted.clear();
+  promotedIDs.clear();
+  promotedType = 0;
+}
+
+MemCBIndex::~MemCBIndex() {
+  if (pageWatchCBID != VMError::INVALID_EVENTID) {
+    unwatchPages(this);
+  }
+}
+
+bool MemCBIndex::watch() {
+  unwatchPages(this);
+  for (const auto &p : infos) {
+    if (not watchPages(this, p.second.range, p.second.type)) {
+      return false;
     }
   }
+  return true;
+}
+
+uint8_t MemCBIndex::neededGates() const {
+  uint8_t gates = 0;
+  for (const auto &p : infos) {
+    gates |= (p.second.type == MEMORY_READ) ? MEMORY_READ : MEMORY_WRITE;
+  }
+  return gates;
+}
+
+void MemCBIndex::promote(VM *vm, Range<rword> range) {
+  QBDI_DEBUG("Promote the range [0x{:x}, 0x{:x}] of addMemRangeCB",
+             range.start(), range.end());
+  promoted.add(range);
+  if (promotedType == 0) {
+    promotedType = neededGates();
+  }
+  // memWriteGate reports the reads of the MEMORY_READ_WRITE callbacks
+  vm->recordMemoryAccessRange(
+      range.start(), range.end(),
+      (promotedType & MEMORY_WRITE) ? MEMORY_READ_WRITE : MEMORY_READ);
+  if (promotedType & MEMORY_READ) {
+    promotedIDs.push_back(engine->addInstrRule(InstrRuleBasicCBK::unique(
+        And::unique(conv_unique<PatchCondition>(
+            InstructionInRange::unique(range.start(), range.end()),
+            DoesReadAccess::unique())),
+        memReadGate, this, InstPosition::PREINST, true, PRIORITY_DEFAULT,
+        RelocTagPreInstStdCBK)));
+  }
+  if (promotedType & MEMORY_WRITE) {
+    promotedIDs.push_back(engine->addInstrRule(InstrRuleBasicCBK::unique(
+        And::unique(conv_unique<PatchCondition>(
+            InstructionInRange::unique(range.start(), range.end()),
+            Or::unique(conv_unique<PatchCondition>(
+                DoesReadAccess::unique(), DoesWriteAccess::unique())))),
+        memWriteGate, this, InstPosition::POSTINST, true, PRIORITY_DEFAULT,
+        RelocTagPostInstStdCBK)));
+  }
+}
+
+void MemCBIndex::resetPromotion() {
+  for (uint32_t id : promotedIDs) {
+    engine->deleteInstrumentation(id);
+  }
+  promoted.clear();
+  promotedIDs.clear();
+  promotedType = 0;
+}
+
+void MemCBIndex::updateMaxEnd() {
+  maxEnd.resize(infos.size());
+  rword end = 0;
+  for (size_t i = 0; i < infos.size(); i++) {
+    end = std::max(end, infos[i].second.range.end());
+    maxEnd[i] = end;
+  }
+}
+
+// Forward the accesses of the current instruction to the callbacks of the
+// gate. The read gate handles the MEMORY_READ callbacks, the write gate the
+// others.
+static VMAction memGate(VMInstanceRef vm, GPRState *gprState,
+                        FPRState *fprState, MemCBIndex &index, bool readGate) {
+  const ExecBlock *curExecBlock = index.engine->getCurExecBlock();
+  QBDI_REQUIRE_ACTION(curExecBlock != nullptr, return VMAction::CONTINUE);
+
+  // shared with the other callbacks of the instruction
+  const std::vector<MemoryAccess> &accesses =
+      index.engine->getInstMemoryAccess();
+
+  // bounds of the accesses, to only look at the ranges that may overlap them
+  rword low = ~static_cast<rword>(0);
+  rword high = 0;
+  for (const MemoryAccess &memAccess : accesses) {
+    low = std::min(low, memAccess.accessAddress);
+    high = std::max(high, memAccess.accessAddress + memAccess.size);
+  }
+  if (low >= high) {
+    return VMAction::CONTINUE;
+  }
 
   VMAction action = VMAction::CONTINUE;
-  for (const auto &p : memCBInfos) {
-    // Check access type and range
-    if (p.second.type == MEMORY_READ and readRange.overlaps(p.second.range)) {
+  size_t i = std::upper_bound(index.maxEnd.begin(), index.maxEnd.end(), low) -
+             index.maxEnd.begin();
+  for (; i < index.infos.size() and index.infos[i].second.range.start() < high;
+       i++) {
+    const MemCBInfo &info = index.infos[i].second;
+    if ((info.type == MEMORY_READ) != readGate) {
+      continue;
+    }
+    // a MEMORY_READ_WRITE callback matches both the reads and the writes
+    bool match = false;
+    for (const MemoryAccess &memAccess : accesses) {
+      Range<rword> accessRange(memAccess.accessAddress,
+                               memAccess.accessAddress + memAccess.size);
+      if ((memAccess.type & info.type) and accessRange.overlaps(info.range)) {
+        match = true;
+        break;
+      }
+    }
+    if (match) {
       // Forward to virtual callback
-      VMAction ret = p.second.cbk(vm, gprState, fprState, p.second.data);
+      VMAction ret = info.cbk(vm, gprState, fprState, info.data);
       // Always keep the most extreme action as the return
       if (ret > action) {
         action = ret;
@@ -79,51 +234,124 @@ VMAction memReadGate(VMInstanceRef vm, GPRState *gprState, FPRState *fprState,
   return action;
 }
 
+VMAction memReadGate(VMInstanceRef vm, GPRState *gprState, FPRState *fprState,
+                     void *data) {
+  return memGate(vm, gprState, fprState, *static_cast<MemCBIndex *>(data),
+                 true);
+}
+
 VMAction memWriteGate(VMInstanceRef vm, GPRState *gprState, FPRState *fprState,
                       void *data) {
-  std::vector<std::pair<uint32_t, MemCBInfo>> &memCBInfos =
-      *static_cast<std::vector<std::pair<uint32_t, MemCBInfo>> *>(data);
-  std::vector<MemoryAccess> memAccesses = vm->getInstMemoryAccess();
-  RangeSet<rword> readRange;
-  RangeSet<rword> writeRange;
-  for (const MemoryAccess &memAccess : memAccesses) {
-    Range<rword> accessRange(memAccess.accessAddress,
-                             memAccess.accessAddress + memAccess.size);
-    if (memAccess.type & MEMORY_READ) {
-      readRange.add(accessRange);
+  return memGate(vm, gprState, fprState, *static_cast<MemCBIndex *>(data),
+                 false);
+}
+
+VMAction BBMemAccessGate(VMInstanceRef vm, const VMState *vmState,
+                         GPRState *gprState, FPRState *fprState, void *data) {
+  BBMemAccessCBInfo &info = *static_cast<BBMemAccessCBInfo *>(data);
+  const ExecBlock *curExecBlock = info.engine->getCurExecBlock();
+  QBDI_REQUIRE_ACTION(curExecBlock != nullptr, return VMAction::CONTINUE);
+
+  info.accesses.clear();
+  analyseSeqMemoryAccess(*curExecBlock, curExecBlock->getCurrentEntryID(),
+                         curExecBlock->getCurrentInstID() + 1, info.type,
+                         info.accesses);
+  return info.cbk(vm, vmState, gprState, fprState, info.accesses.data(),
+                  info.accesses.size(), info.data);
+}
+
+VMAction functionEntryGate(VMInstanceRef vm, GPRState *gprState,
+                           FPRState *fprState, void *data) {
+  FunctionHookInfo &info = *static_cast<FunctionHookInfo *>(data);
+  if (info.onExit == nullptr) {
+    return info.onEntry(vm, gprState, fprState, info.data);
+  }
+  rword sp = QBDI_GPR_GET(gprState, REG_SP);
+  rword returnAddress = *reinterpret_cast<const rword *>(sp);
+  if (info.pendingEntry) {
+    info.pendingEntry = false;
+    if (not info.frames.empty() and info.frames.back().sp == sp and
+        info.frames.back().returnAddress == returnAddress) {
+      return VMAction::CONTINUE;
     }
-    if (memAccess.type & MEMORY_WRITE) {
-      writeRange.add(accessRange);
+  }
+  // the frames below the stack pointer have been left without their return.
+  // A frame at the same address is kept for a tail call.
+  while (not info.frames.empty() and info.frames.back().sp < sp) {
+    info.frames.pop_back();
+  }
+  info.frames.push_back(FunctionHookFrame{returnAddress, sp});
+
+  VMAction action = VMAction::CONTINUE;
+  if (info.onEntry != nullptr) {
+    action = info.onEntry(vm, gprState, fprState, info.data);
+  }
+  // The first call from a caller adds a gate on its return address. The
+  // translation of the return address must be flushed before the return.
+  if (info.exitIDs.count(returnAddress) == 0) {
+    uint32_t id =
+        vm->addCodeAddrCB(returnAddress, PREINST, functionExitGate, &info);
+    info.exitIDs[returnAddress] = id;
+    if (id != VMError::INVALID_EVENTID and action == VMAction::CONTINUE) {
+      info.pendingEntry = true;
+      action = VMAction::BREAK_TO_VM;
     }
   }
+  return action;
+}
 
+VMAction functionExitGate(VMInstanceRef vm, GPRState *gprState,
+                          FPRState *fprState, void *data) {
+  FunctionHookInfo &info = *static_cast<FunctionHookInfo *>(data);
+  rword sp = QBDI_GPR_GET(gprState, REG_SP);
+  rword pc = QBDI_GPR_GET(gprState, REG_PC);
   VMAction action = VMAction::CONTINUE;
-  for (const auto &p : memCBInfos) {
-    // Check accessCB
-    // 1. has MEMORY_WRITE and write range overlaps
-    // 2. is MEMORY_READ_WRITE and read range overlaps
-    // note: the case with MEMORY_READ only is managed by memReadGate
-    if (((p.second.type & MEMORY_WRITE) and
-         writeRange.overlaps(p.second.range)) or
-        (p.second.type == MEMORY_READ_WRITE and
-         readRange.overlaps(p.second.range))) {
-      // Forward to virtual callback
-      VMAction ret = p.second.cbk(vm, gprState, fprState, p.second.data);
-      // Always keep the most extreme action as the return
-      if (ret > action) {
-        action = ret;
+  // the frames below the stack pointer have returned. The frames of another
+  // return address have been left by a longjmp.
+  while (not info.frames.empty() and info.frames.back().sp < sp) {
+    FunctionHookFrame frame = info.frames.back();
+    info.frames.pop_back();
+    if (frame.returnAddress == pc) {
+      VMAction res = info.onExit(vm, gprState, fprState, info.data);
+      if (res > action) {
+        action = res;
       }
     }
   }
   return action;
 }
 
-std::vector<InstrRuleDataCBK>
-InstrCBGateC(VMInstanceRef vm, const InstAnalysis *inst, void *_data) {
-  InstrCBInfo *data = static_cast<InstrCBInfo *>(_data);
-  std::vector<InstrRuleDataCBK> vec{};
-  data->cbk(vm, inst, &vec, data->data);
-  return vec;
+// Promote the sequences whose instructions have faulted on a page watched for
+// addMemRangeCB. The faulting access isn't reported, the gates are only
+// called from the next execution of the sequence.
+VMAction pageWatchGate(VMInstanceRef vm, const VMState *vmState,
+                       GPRState *gprState, FPRState *fprState, void *data) {
+  MemCBIndex &index = *static_cast<MemCBIndex *>(data);
+  if (not takePageFaults(&index, index.faults)) {
+    return VMAction::CONTINUE;
+  }
+  const ExecBlock *curExecBlock = index.engine->getCurExecBlock();
+  QBDI_REQUIRE_ACTION(curExecBlock != nullptr, return VMAction::CONTINUE);
+
+  RangeSet<rword> ranges;
+  for (rword pc : index.faults) {
+    // the faults of the callbacks and of the VM aren't in the ExecBlock
+    uint16_t instID = curExecBlock->getInstIDOfCode(pc);
+    if (instID == NOT_FOUND) {
+      continue;
+    }
+    uint16_t seqID = curExecBlock->getSeqID(instID);
+    for (uint16_t i = curExecBlock->getSeqStart(seqID);
+         i <= curExecBlock->getSeqEnd(seqID); i++) {
+      const CachedInstMetadata &metadata = curExecBlock->getInstMetadata(i);
+      ranges.add({metadata.address, metadata.endAddress()});
+    }
+  }
+  ranges.remove(index.promoted);
+  for (const Range<rword> &r : ranges.getRanges()) {
+    index.promote(static_cast<VM *>(vm), r);
+  }
+  return VMAction::CONTINUE;
 }
 
 VMAction VMCBLambdaProxy(VMInstanceRef vm, const VMState *vmState,
@@ -144,6 +372,20 @@ InstrRuleCBLambdaProxy(VMInstanceRef vm, const InstAnalysis *ana, void *_data) {
   return data(vm, ana);
 }
 
+void InstrRuleFillCBLambdaProxy(VMInstanceRef vm, const InstAnalysis *ana,
+                                InstrRuleDataVec cbks, void *_data) {
+  InstrRuleFillCbLambda &data = *static_cast<InstrRuleFillCbLambda *>(_data);
+  data(vm, ana, *cbks);
+}
+
+void InstrRuleBBCBLambdaProxy(VMInstanceRef vm,
+                              const std::vector<const InstAnalysis *> &block,
+                              std::vector<std::vector<InstrRuleDataCBK>> &cbks,
+                              void *_data) {
+  InstrRuleBBCbLambda &data = *static_cast<InstrRuleBBCbLambda *>(_data);
+  data(vm, block, cbks);
+}
+
 VMAction stopCallback(VMInstanceRef vm, GPRState *gprState, FPRState *fprState,
                       void *data) {
   return VMAction::STOP;
@@ -153,16 +395,20 @@ VMAction stopCallback(VMInstanceRef vm, GPRState *gprState, FPRState *fprState,
 
 VM::VM(const std::string &cpu, const std::vector<std::string> &mattrs,
        Options opts)
-    : memoryLoggingLevel(0), memCBID(0),
+    : memoryLoggingLevel(0), readRecordModifiers(0), writeRecordModifiers(0),
+      memCBID(0),
       memReadGateCBID(VMError::INVALID_EVENTID),
       memWriteGateCBID(VMError::INVALID_EVENTID) {
 #if defined(_QBDI_ASAN_ENABLED_)
   opts |= Options::OPT_DISABLE_FPR;
 #endif
   engine = std::make_unique<Engine>(cpu, mattrs, opts, this);
-  memCBInfos = std::make_unique<std::vector<std::pair<uint32_t, MemCBInfo>>>();
-  instrCBInfos = std::make_unique<
-      std::vector<std::pair<uint32_t, std::unique_ptr<InstrCBInfo>>>>();
+  memCBInfos = std::make_unique<MemCBIndex>();
+  memCBInfos->engine = engine.get();
+  bbMemAccessCBInfos = std::make_unique<
+      std::vector<std::pair<uint32_t, std::unique_ptr<BBMemAccessCBInfo>>>>();
+  functionHooks = std::make_unique<
+      std::vector<std::pair<uint32_t, std::unique_ptr<FunctionHookInfo>>>>();
 }
 
 // destructor
@@ -173,12 +419,25 @@ VM::~VM() = default;
 
 VM::VM(VM &&vm)
     : engine(std::move(vm.engine)), memoryLoggingLevel(vm.memoryLoggingLevel),
+      readRecordModifiers(vm.readRecordModifiers),
+      writeRecordModifiers(vm.writeRecordModifiers),
+      restrictedRecordIDs(std::move(vm.restrictedRecordIDs)),
+      recordedReadRanges(std::move(vm.recordedReadRanges)),
+      recordedWriteRanges(std::move(vm.recordedWriteRanges)),
+      rangeRecordIDs(std::move(vm.rangeRecordIDs)),
       memCBInfos(std::move(vm.memCBInfos)), memCBID(vm.memCBID),
       memReadGateCBID(vm.memReadGateCBID),
-      memWriteGateCBID(vm.memWriteGateCBID),
-      instrCBInfos(std::move(vm.instrCBInfos)),
+      memWriteGateCBID(vm.memWriteGateCBID), sliceStopCBID(vm.sliceStopCBID),
+      sliceStop(vm.sliceStop),
+      bbMemAccessCBInfos(std::move(vm.bbMemAccessCBInfos)),
+      functionHooks(std::move(vm.functionHooks)),
       vmCBData(std::move(vm.vmCBData)), instCBData(std::move(vm.instCBData)),
-      instrRuleCBData(std::move(vm.instrRuleCBData)) {
+      instrRuleCBData(std::move(vm.instrRuleCBData)),
+      instrRuleFillCBData(std::move(vm.instrRuleFillCBData)),
+      instrRuleBBCBData(std::move(vm.instrRuleBBCBData)),
+      counterData(std::move(vm.counterData)),
+      functorCBData(std::move(vm.functorCBData)),
+      snapshot(std::move(vm.snapshot)) {
 
   engine->changeVMInstanceRef(this);
 }
@@ -188,14 +447,28 @@ VM::VM(VM &&vm)
 VM &VM::operator=(VM &&vm) {
   engine = std::move(vm.engine);
   memoryLoggingLevel = vm.memoryLoggingLevel;
+  readRecordModifiers = vm.readRecordModifiers;
+  writeRecordModifiers = vm.writeRecordModifiers;
+  restrictedRecordIDs = std::move(vm.restrictedRecordIDs);
+  recordedReadRanges = std::move(vm.recordedReadRanges);
+  recordedWriteRanges = std::move(vm.recordedWriteRanges);
+  rangeRecordIDs = std::move(vm.rangeRecordIDs);
   memCBInfos = std::move(vm.memCBInfos);
   memCBID = vm.memCBID;
   memReadGateCBID = vm.memReadGateCBID;
   memWriteGateCBID = vm.memWriteGateCBID;
-  instrCBInfos = std::move(vm.instrCBInfos);
+  sliceStopCBID = vm.sliceStopCBID;
+  sliceStop = vm.sliceStop;
+  bbMemAccessCBInfos = std::move(vm.bbMemAccessCBInfos);
+  functionHooks = std::move(vm.functionHooks);
   vmCBData = std::move(vm.vmCBData);
   instCBData = std::move(vm.instCBData);
   instrRuleCBData = std::move(vm.instrRuleCBData);
+  instrRuleFillCBData = std::move(vm.instrRuleFillCBData);
+  instrRuleBBCBData = std::move(vm.instrRuleBBCBData);
+  counterData = std::move(vm.counterData);
+  functorCBData = std::move(vm.functorCBData);
+  snapshot = std::move(vm.snapshot);
 
   engine->changeVMInstanceRef(this);
 
@@ -207,19 +480,51 @@ VM &VM::operator=(VM &&vm) {
 VM::VM(const VM &vm)
     : engine(std::make_unique<Engine>(*vm.engine)),
       memoryLoggingLevel(vm.memoryLoggingLevel),
-      memCBInfos(std::make_unique<std::vector<std::pair<uint32_t, MemCBInfo>>>(
-          *vm.memCBInfos)),
+      readRecordModifiers(vm.readRecordModifiers),
+      writeRecordModifiers(vm.writeRecordModifiers),
+      restrictedRecordIDs(vm.restrictedRecordIDs),
+      recordedReadRanges(vm.recordedReadRanges),
+      recordedWriteRanges(vm.recordedWriteRanges),
+      rangeRecordIDs(vm.rangeRecordIDs),
+      memCBInfos(std::make_unique<MemCBIndex>(*vm.memCBInfos)),
       memCBID(vm.memCBID), memReadGateCBID(vm.memReadGateCBID),
-      memWriteGateCBID(vm.memWriteGateCBID), vmCBData(vm.vmCBData),
-      instCBData(vm.instCBData), instrRuleCBData(vm.instrRuleCBData) {
+      memWriteGateCBID(vm.memWriteGateCBID), sliceStopCBID(vm.sliceStopCBID),
+      sliceStop(vm.sliceStop), vmCBData(vm.vmCBData),
+      instCBData(vm.instCBData), instrRuleCBData(vm.instrRuleCBData),
+      instrRuleFillCBData(vm.instrRuleFillCBData),
+      instrRuleBBCBData(vm.instrRuleBBCBData), counterData(vm.counterData),
+      functorCBData(vm.functorCBData),
+      snapshot(vm.snapshot ? std::make_unique<VMSnapshot>(*vm.snapshot)
+                           : nullptr) {
 
   engine->changeVMInstanceRef(this);
-  instrCBInfos = std::make_unique<
-      std::vector<std::pair<uint32_t, std::unique_ptr<InstrCBInfo>>>>();
-  for (const auto &p : *vm.instrCBInfos) {
-    engine->deleteInstrumentation(p.first);
-    addInstrRuleRange(p.second->range.start(), p.second->range.end(),
-                      p.second->cbk, p.second->type, p.second->data);
+  memCBInfos->engine = engine.get();
+  bbMemAccessCBInfos = std::make_unique<
+      std::vector<std::pair<uint32_t, std::unique_ptr<BBMemAccessCBInfo>>>>();
+  for (const auto &p : *vm.bbMemAccessCBInfos) {
+    auto info = std::make_unique<BBMemAccessCBInfo>(BBMemAccessCBInfo{
+        p.second->type, p.second->cbk, p.second->data, engine.get(), {}});
+    engine->setVMEventCB(p.first, BBMemAccessGate, info.get());
+    bbMemAccessCBInfos->emplace_back(p.first, std::move(info));
+  }
+
+  functionHooks = std::make_unique<
+      std::vector<std::pair<uint32_t, std::unique_ptr<FunctionHookInfo>>>>();
+  for (const auto &p : *vm.functionHooks) {
+    // the calls of the source VM aren't returned in the copy
+    auto info = std::make_unique<FunctionHookInfo>(FunctionHookInfo{
+        p.second->onEntry, p.second->onExit, p.second->data,
+        p.second->exitIDs, {}});
+    InstrRule *rule = engine->getInstrRule(p.first);
+    QBDI_REQUIRE_ACTION(rule != nullptr, abort());
+    QBDI_REQUIRE_ACTION(rule->changeDataPtr(info.get()), abort());
+    for (const auto &exit : info->exitIDs) {
+      rule = engine->getInstrRule(exit.second);
+      if (rule != nullptr) {
+        QBDI_REQUIRE_ACTION(rule->changeDataPtr(info.get()), abort());
+      }
+    }
+    functionHooks->emplace_back(p.first, std::move(info));
   }
 
   if (memReadGateCBID != VMError::INVALID_EVENTID) {
@@ -234,19 +539,28 @@ VM::VM(const VM &vm)
     QBDI_REQUIRE_ACTION(rule->changeDataPtr(memCBInfos.get()), abort());
   }
 
+  if (memCBInfos->pageWatchCBID != VMError::INVALID_EVENTID) {
+    engine->setVMEventCB(memCBInfos->pageWatchCBID, pageWatchGate,
+                         memCBInfos.get());
+    for (uint32_t id : memCBInfos->promotedIDs) {
+      InstrRule *rule = engine->getInstrRule(id);
+      QBDI_REQUIRE_ACTION(rule != nullptr, abort());
+      QBDI_REQUIRE_ACTION(rule->changeDataPtr(memCBInfos.get()), abort());
+    }
+    memCBInfos->watch();
+  } else {
+    unwatchPages(memCBInfos.get());
+  }
+
   for (auto &p : vmCBData) {
     engine->setVMEventCB(p.first, VMCBLambdaProxy, &p.second);
   }
 
   for (std::pair<uint32_t, InstCbLambda> &p : instCBData) {
     if (p.first & EVENTID_VIRTCB_MASK) {
-      uint32_t id = p.first;
-      auto it = std::find_if(memCBInfos->begin(), memCBInfos->end(),
-                             [id](const std::pair<uint32_t, MemCBInfo> &el) {
-                               return id == el.first;
-                             });
-      QBDI_REQUIRE_ACTION(it != memCBInfos->end(), abort());
-      it->second.data = &p.second;
+      MemCBInfo *info = memCBInfos->find(p.first);
+      QBDI_REQUIRE_ACTION(info != nullptr, abort());
+      info->data = &p.second;
     } else {
       InstrRule *rule = engine->getInstrRule(p.first);
       QBDI_REQUIRE_ACTION(rule != nullptr, abort());
@@ -259,6 +573,30 @@ VM::VM(const VM &vm)
     QBDI_REQUIRE_ACTION(rule != nullptr, abort());
     QBDI_REQUIRE_ACTION(rule->changeDataPtr(&p.second), abort());
   }
+
+  for (std::pair<uint32_t, InstrRuleFillCbLambda> &p : instrRuleFillCBData) {
+    InstrRule *rule = engine->getInstrRule(p.first);
+    QBDI_REQUIRE_ACTION(rule != nullptr, abort());
+    QBDI_REQUIRE_ACTION(rule->changeDataPtr(&p.second), abort());
+  }
+
+  for (std::pair<uint32_t, InstrRuleBBCbLambda> &p : instrRuleBBCBData) {
+    InstrRule *rule = engine->getInstrRule(p.first);
+    QBDI_REQUIRE_ACTION(rule != nullptr, abort());
+    QBDI_REQUIRE_ACTION(rule->changeDataPtr(&p.second), abort());
+  }
+
+  for (std::pair<uint32_t, InstCbFunctor> &p : functorCBData) {
+    InstrRule *rule = engine->getInstrRule(p.first);
+    QBDI_REQUIRE_ACTION(rule != nullptr, abort());
+    QBDI_REQUIRE_ACTION(rule->changeDataPtr(p.second.get()), abort());
+  }
+
+  for (std::pair<uint32_t, uint64_t> &p : counterData) {
+    InstrRule *rule = engine->getInstrRule(p.first);
+    QBDI_REQUIRE_ACTION(rule != nullptr, abort());
+    QBDI_REQUIRE_ACTION(rule->changeDataPtr(&p.second), abort());
+  }
 }
 
 // Copy operator
@@ -266,18 +604,49 @@ VM::VM(const VM &vm)
 VM &VM::operator=(const VM &vm) {
   *engine = *vm.engine;
   *memCBInfos = *vm.memCBInfos;
+  memCBInfos->engine = engine.get();
 
   memoryLoggingLevel = vm.memoryLoggingLevel;
+  readRecordModifiers = vm.readRecordModifiers;
+  writeRecordModifiers = vm.writeRecordModifiers;
+  restrictedRecordIDs = vm.restrictedRecordIDs;
+  recordedReadRanges = vm.recordedReadRanges;
+  recordedWriteRanges = vm.recordedWriteRanges;
+  rangeRecordIDs = vm.rangeRecordIDs;
   memCBID = vm.memCBID;
   memReadGateCBID = vm.memReadGateCBID;
   memWriteGateCBID = vm.memWriteGateCBID;
+  sliceStopCBID = vm.sliceStopCBID;
+  sliceStop = vm.sliceStop;
+  snapshot =
+      vm.snapshot ? std::make_unique<VMSnapshot>(*vm.snapshot) : nullptr;
+
+  bbMemAccessCBInfos = std::make_unique<
+      std::vector<std::pair<uint32_t, std::unique_ptr<BBMemAccessCBInfo>>>>();
+  for (const auto &p : *vm.bbMemAccessCBInfos) {
+    auto info = std::make_unique<BBMemAccessCBInfo>(BBMemAccessCBInfo{
+        p.second->type, p.second->cbk, p.second->data, engine.get(), {}});
+    engine->setVMEventCB(p.first, BBMemAccessGate, info.get());
+    bbMemAccessCBInfos->emplace_back(p.first, std::move(info));
+  }
 
-  instrCBInfos = std::make_unique<
-      std::vector<std::pair<uint32_t, std::unique_ptr<InstrCBInfo>>>>();
-  for (const auto &p : *vm.instrCBInfos) {
-    engine->deleteInstrumentation(p.first);
-    addInstrRuleRange(p.second->range.start(), p.second->range.end(),
-                      p.second->cbk, p.second->type, p.second->data);
+  functionHooks = std::make_unique<
+      std::vector<std::pair<uint32_t, std::unique_ptr<FunctionHookInfo>>>>();
+  for (const auto &p : *vm.functionHooks) {
+    // the calls of the source VM aren't returned in the copy
+    auto info = std::make_unique<FunctionHookInfo>(FunctionHookInfo{
+        p.second->onEntry, p.second->onExit, p.second->data,
+        p.second->exitIDs, {}});
+    InstrRule *rule = engine->getInstrRule(p.first);
+    QBDI_REQUIRE_ACTION(rule != nullptr, abort());
+    QBDI_REQUIRE_ACTION(rule->changeDataPtr(info.get()), abort());
+    for (const auto &exit : info->exitIDs) {
+      rule = engine->getInstrRule(exit.second);
+      if (rule != nullptr) {
+        QBDI_REQUIRE_ACTION(rule->changeDataPtr(info.get()), abort());
+      }
+    }
+    functionHooks->emplace_back(p.first, std::move(info));
   }
 
   if (memReadGateCBID != VMError::INVALID_EVENTID) {
@@ -292,6 +661,19 @@ VM &VM::operator=(const VM &vm) {
     QBDI_REQUIRE_ACTION(rule->changeDataPtr(memCBInfos.get()), abort());
   }
 
+  if (memCBInfos->pageWatchCBID != VMError::INVALID_EVENTID) {
+    engine->setVMEventCB(memCBInfos->pageWatchCBID, pageWatchGate,
+                         memCBInfos.get());
+    for (uint32_t id : memCBInfos->promotedIDs) {
+      InstrRule *rule = engine->getInstrRule(id);
+      QBDI_REQUIRE_ACTION(rule != nullptr, abort());
+      QBDI_REQUIRE_ACTION(rule->changeDataPtr(memCBInfos.get()), abort());
+    }
+    memCBInfos->watch();
+  } else {
+    unwatchPages(memCBInfos.get());
+  }
+
   vmCBData = vm.vmCBData;
   for (auto &p : vmCBData) {
     engine->setVMEventCB(p.first, VMCBLambdaProxy, &p.second);
@@ -300,13 +682,9 @@ VM &VM::operator=(const VM &vm) {
   instCBData = vm.instCBData;
   for (std::pair<uint32_t, InstCbLambda> &p : instCBData) {
     if (p.first & EVENTID_VIRTCB_MASK) {
-      uint32_t id = p.first;
-      auto it = std::find_if(memCBInfos->begin(), memCBInfos->end(),
-                             [id](const std::pair<uint32_t, MemCBInfo> &el) {
-                               return id == el.first;
-                             });
-      QBDI_REQUIRE_ACTION(it != memCBInfos->end(), abort());
-      it->second.data = &p.second;
+      MemCBInfo *info = memCBInfos->find(p.first);
+      QBDI_REQUIRE_ACTION(info != nullptr, abort());
+      info->data = &p.second;
     } else {
       InstrRule *rule = engine->getInstrRule(p.first);
       QBDI_REQUIRE_ACTION(rule != nullptr, abort());
@@ -321,6 +699,34 @@ VM &VM::operator=(const VM &vm) {
     QBDI_REQUIRE_ACTION(rule->changeDataPtr(&p.second), abort());
   }
 
+  instrRuleFillCBData = vm.instrRuleFillCBData;
+  for (std::pair<uint32_t, InstrRuleFillCbLambda> &p : instrRuleFillCBData) {
+    InstrRule *rule = engine->getInstrRule(p.first);
+    QBDI_REQUIRE_ACTION(rule != nullptr, abort());
+    QBDI_REQUIRE_ACTION(rule->changeDataPtr(&p.second), abort());
+  }
+
+  instrRuleBBCBData = vm.instrRuleBBCBData;
+  for (std::pair<uint32_t, InstrRuleBBCbLambda> &p : instrRuleBBCBData) {
+    InstrRule *rule = engine->getInstrRule(p.first);
+    QBDI_REQUIRE_ACTION(rule != nullptr, abort());
+    QBDI_REQUIRE_ACTION(rule->changeDataPtr(&p.second), abort());
+  }
+
+  functorCBData = vm.functorCBData;
+  for (std::pair<uint32_t, InstCbFunctor> &p : functorCBData) {
+    InstrRule *rule = engine->getInstrRule(p.first);
+    QBDI_REQUIRE_ACTION(rule != nullptr, abort());
+    QBDI_REQUIRE_ACTION(rule->changeDataPtr(p.second.get()), abort());
+  }
+
+  counterData = vm.counterData;
+  for (std::pair<uint32_t, uint64_t> &p : counterData) {
+    InstrRule *rule = engine->getInstrRule(p.first);
+    QBDI_REQUIRE_ACTION(rule != nullptr, abort());
+    QBDI_REQUIRE_ACTION(rule->changeDataPtr(&p.second), abort());
+  }
+
   engine->changeVMInstanceRef(this);
 
   return *this;
@@ -361,6 +767,25 @@ void VM::setOptions(Options options) {
   engine->setOptions(options);
 }
 
+// getExecBlockSize
+
+void VM::getExecBlockSize(uint32_t *codeSize, uint32_t *dataSize) const {
+  uint32_t code, data;
+  engine->getExecBlockSize(code, data);
+  if (codeSize != nullptr) {
+    *codeSize = code;
+  }
+  if (dataSize != nullptr) {
+    *dataSize = data;
+  }
+}
+
+// setExecBlockSize
+
+bool VM::setExecBlockSize(uint32_t codeSize, uint32_t dataSize) {
+  return engine->setExecBlockSize(codeSize, dataSize);
+}
+
 // addInstrumentedRange
 
 void VM::addInstrumentedRange(rword start, rword end) {
@@ -380,6 +805,41 @@ bool VM::addInstrumentedModuleFromAddr(rword addr) {
   return engine->addInstrumentedModuleFromAddr(addr);
 }
 
+// addInstrumentedFunction
+
+bool VM::addInstrumentedFunction(const std::string &name) {
+  std::vector<Range<rword>> extents;
+  getFunctionExtents(name, extents);
+  for (const Range<rword> &extent : extents) {
+    engine->addInstrumentedRange(extent.start(), extent.end());
+  }
+  return not extents.empty();
+}
+
+// addInstrumentedFunctionFromAddr
+
+bool VM::addInstrumentedFunctionFromAddr(rword addr) {
+  Range<rword> extent(0, 0);
+  if (not getFunctionExtent(addr, extent)) {
+    return false;
+  }
+  engine->addInstrumentedRange(extent.start(), extent.end());
+  return true;
+}
+
+// addInstrumentedFunctionRegex
+
+bool VM::addInstrumentedFunctionRegex(const std::string &pattern) {
+  std::vector<Range<rword>> extents;
+  if (not getFunctionExtentsRegex(pattern, extents)) {
+    return false;
+  }
+  for (const Range<rword> &extent : extents) {
+    engine->addInstrumentedRange(extent.start(), extent.end());
+  }
+  return not extents.empty();
+}
+
 // instrumentAllExecutableMaps
 
 bool VM::instrumentAllExecutableMaps() {
@@ -399,6 +859,16 @@ void VM::removeAllInstrumentedRanges() {
   engine->removeAllInstrumentedRanges();
 }
 
+// setModuleTracking
+
+void VM::setModuleTracking(ModuleTracking tracking) {
+  engine->setModuleTracking(tracking);
+}
+
+ModuleTracking VM::getModuleTracking() const {
+  return engine->getModuleTracking();
+}
+
 // removeInstrumentedModule
 
 bool VM::removeInstrumentedModule(const std::string &name) {
@@ -413,14 +883,47 @@ bool VM::removeInstrumentedModuleFromAddr(rword addr) {
 
 // run
 
-bool VM::run(rword start, rword stop) {
-  uint32_t stopCB =
-      addCodeAddrCB(stop, InstPosition::PREINST, stopCallback, nullptr);
-  bool ret = engine->run(start, stop);
-  deleteInstrumentation(stopCB);
+bool VM::run(rword start, rword stop) { return runUntil(start, {stop}); }
+
+// runUntil
+
+bool VM::runUntil(rword start, const std::vector<rword> &stops) {
+  std::vector<uint32_t> stopCBs;
+  stopCBs.reserve(stops.size());
+  for (rword stop : stops) {
+    stopCBs.push_back(
+        addCodeAddrCB(stop, InstPosition::PREINST, stopCallback, nullptr));
+  }
+  bool ret = engine->run(start, stops);
+  for (uint32_t stopCB : stopCBs) {
+    deleteInstrumentation(stopCB);
+  }
   return ret;
 }
 
+// runFor
+
+SliceStatus VM::runFor(rword stop, rword budget) {
+  // The stop callback is kept between the slices, its inline guard disables
+  // it without flushing the cache
+  if (sliceStopCBID == VMError::INVALID_EVENTID or sliceStop != stop or
+      not setInstrumentationEnabled(sliceStopCBID, true)) {
+    if (sliceStopCBID != VMError::INVALID_EVENTID) {
+      deleteInstrumentation(sliceStopCBID);
+    }
+    sliceStopCBID =
+        addCodeAddrCB(stop, InstPosition::PREINST, stopCallback, nullptr);
+    sliceStop = stop;
+  }
+  SliceStatus status = engine->runFor(stop, budget);
+  setInstrumentationEnabled(sliceStopCBID, false);
+  return status;
+}
+
+// step
+
+bool VM::step() { return engine->step(); }
+
 // callA
 
 #define FAKE_RET_ADDR 42
@@ -466,6 +969,64 @@ bool VM::callV(rword *retval, rword function, uint32_t argNum, va_list ap) {
   return res;
 }
 
+// prepareCall
+
+PreparedCall VM::prepareCall(rword function, uint32_t argNum) {
+  GPRState *state = getGPRState();
+  QBDI_REQUIRE_ACTION(state != nullptr, abort());
+
+  return PreparedCall(this, function, argNum, QBDI_GPR_GET(state, REG_SP));
+}
+
+// invoke
+
+bool PreparedCall::invoke(rword *retval, const rword *args) {
+  static const std::vector<rword> stops = {FAKE_RET_ADDR};
+
+  // a stack pointer must be set in state when the call is prepared
+  if (stackPointer == 0) {
+    return false;
+  }
+  GPRState *state = vm->getGPRState();
+  QBDI_REQUIRE_ACTION(state != nullptr, abort());
+
+  // each call starts with the same stack
+  QBDI_GPR_SET(state, REG_SP, stackPointer);
+  simulateCallA(state, FAKE_RET_ADDR, argNum, args);
+  // The fake return address is never instrumented: unlike VM::run, no stop
+  // callback is added and removed for each call
+  bool res = vm->engine->run(function, stops);
+  if (retval != nullptr) {
+    *retval = QBDI_GPR_GET(state, REG_RETURN);
+  }
+  return res;
+}
+
+bool PreparedCall::invoke(rword *retval, const std::vector<rword> &args) {
+  QBDI_REQUIRE_ACTION(args.size() == argNum, abort());
+  return invoke(retval, args.data());
+}
+
+// setInstructionBudget
+
+bool VM::setInstructionBudget(rword budget) {
+  return engine->setInstructionBudget(budget);
+}
+
+// getInstructionBudget
+
+rword VM::getInstructionBudget() const {
+  return engine->getInstructionBudget();
+}
+
+// setStopPolling
+
+bool VM::setStopPolling(bool enable) { return engine->setStopPolling(enable); }
+
+// requestStop
+
+void VM::requestStop() { engine->requestStop(); }
+
 // addInstrRule
 
 uint32_t VM::addInstrRule(InstrRuleCallback cbk, AnalysisType type,
@@ -478,11 +1039,10 @@ uint32_t VM::addInstrRule(InstrRuleCallback cbk, AnalysisType type,
 
 uint32_t VM::addInstrRule(InstrRuleCallbackC cbk, AnalysisType type,
                           void *data) {
-  InstrCBInfo *_data =
-      new InstrCBInfo{Range<rword>(0, (rword)-1), cbk, type, data};
-  uint32_t id = addInstrRule(InstrCBGateC, type, _data);
-  instrCBInfos->emplace_back(id, _data);
-  return id;
+  RangeSet<rword> r;
+  r.add(Range<rword>(0, (rword)-1));
+  return engine->addInstrRule(
+      InstrRuleUser::unique(cbk, type, data, this, std::move(r)));
 }
 
 uint32_t VM::addInstrRule(const InstrRuleCbLambda &cbk, AnalysisType type) {
@@ -499,6 +1059,20 @@ uint32_t VM::addInstrRule(InstrRuleCbLambda &&cbk, AnalysisType type) {
   return id;
 }
 
+uint32_t VM::addInstrRule(const InstrRuleFillCbLambda &cbk, AnalysisType type) {
+  auto &el = instrRuleFillCBData.emplace_front(0xffffffff, cbk);
+  uint32_t id = addInstrRule(InstrRuleFillCBLambdaProxy, type, &el.second);
+  el.first = id;
+  return id;
+}
+
+uint32_t VM::addInstrRule(InstrRuleFillCbLambda &&cbk, AnalysisType type) {
+  auto &el = instrRuleFillCBData.emplace_front(0xffffffff, std::move(cbk));
+  uint32_t id = addInstrRule(InstrRuleFillCBLambdaProxy, type, &el.second);
+  el.first = id;
+  return id;
+}
+
 // addInstrRuleRange
 
 uint32_t VM::addInstrRuleRange(rword start, rword end, InstrRuleCallback cbk,
@@ -510,11 +1084,9 @@ uint32_t VM::addInstrRuleRange(rword start, rword end, InstrRuleCallback cbk,
 
 uint32_t VM::addInstrRuleRange(rword start, rword end, InstrRuleCallbackC cbk,
                                AnalysisType type, void *data) {
-  InstrCBInfo *_data =
-      new InstrCBInfo{Range<rword>(start, end), cbk, type, data};
-  uint32_t id = addInstrRuleRange(start, end, InstrCBGateC, type, _data);
-  instrCBInfos->emplace_back(id, _data);
-  return id;
+  RangeSet<rword> r;
+  r.add(Range<rword>(start, end));
+  return engine->addInstrRule(InstrRuleUser::unique(cbk, type, data, this, r));
 }
 
 uint32_t VM::addInstrRuleRange(rword start, rword end,
@@ -536,6 +1108,25 @@ uint32_t VM::addInstrRuleRange(rword start, rword end, InstrRuleCbLambda &&cbk,
   return id;
 }
 
+uint32_t VM::addInstrRuleRange(rword start, rword end,
+                               const InstrRuleFillCbLambda &cbk,
+                               AnalysisType type) {
+  auto &el = instrRuleFillCBData.emplace_front(0xffffffff, cbk);
+  uint32_t id = addInstrRuleRange(start, end, InstrRuleFillCBLambdaProxy, type,
+                                  &el.second);
+  el.first = id;
+  return id;
+}
+
+uint32_t VM::addInstrRuleRange(rword start, rword end,
+                               InstrRuleFillCbLambda &&cbk, AnalysisType type) {
+  auto &el = instrRuleFillCBData.emplace_front(0xffffffff, std::move(cbk));
+  uint32_t id = addInstrRuleRange(start, end, InstrRuleFillCBLambdaProxy, type,
+                                  &el.second);
+  el.first = id;
+  return id;
+}
+
 // addInstrRuleRangeSet
 
 uint32_t VM::addInstrRuleRangeSet(RangeSet<rword> range, InstrRuleCallback cbk,
@@ -544,6 +1135,13 @@ uint32_t VM::addInstrRuleRangeSet(RangeSet<rword> range, InstrRuleCallback cbk,
       InstrRuleUser::unique(cbk, type, data, this, std::move(range)));
 }
 
+uint32_t VM::addInstrRuleRangeSet(RangeSet<rword> range,
+                                  InstrRuleCallbackC cbk, AnalysisType type,
+                                  void *data) {
+  return engine->addInstrRule(
+      InstrRuleUser::unique(cbk, type, data, this, std::move(range)));
+}
+
 uint32_t VM::addInstrRuleRangeSet(RangeSet<rword> range,
                                   const InstrRuleCbLambda &cbk,
                                   AnalysisType type) {
@@ -563,28 +1161,104 @@ uint32_t VM::addInstrRuleRangeSet(RangeSet<rword> range,
   return id;
 }
 
-// addMnemonicCB
-
-uint32_t VM::addMnemonicCB(const char *mnemonic, InstPosition pos,
-                           InstCallback cbk, void *data, int priority) {
-  QBDI_REQUIRE_ACTION(mnemonic != nullptr, return VMError::INVALID_EVENTID);
-  QBDI_REQUIRE_ACTION(cbk != nullptr, return VMError::INVALID_EVENTID);
-  return engine->addInstrRule(InstrRuleBasicCBK::unique(
-      MnemonicIs::unique(mnemonic), cbk, data, pos, true, priority,
-      (pos == PREINST) ? RelocTagPreInstStdCBK : RelocTagPostInstStdCBK));
+uint32_t VM::addInstrRuleRangeSet(RangeSet<rword> range,
+                                  const InstrRuleFillCbLambda &cbk,
+                                  AnalysisType type) {
+  auto &el = instrRuleFillCBData.emplace_front(0xffffffff, cbk);
+  uint32_t id = addInstrRuleRangeSet(
+      std::move(range), InstrRuleFillCBLambdaProxy, type, &el.second);
+  el.first = id;
+  return id;
 }
 
-uint32_t VM::addMnemonicCB(const char *mnemonic, InstPosition pos,
-                           const InstCbLambda &cbk, int priority) {
-  auto &el = instCBData.emplace_front(0xffffffff, cbk);
-  uint32_t id =
-      addMnemonicCB(mnemonic, pos, InstCBLambdaProxy, &el.second, priority);
+uint32_t VM::addInstrRuleRangeSet(RangeSet<rword> range,
+                                  InstrRuleFillCbLambda &&cbk,
+                                  AnalysisType type) {
+  auto &el = instrRuleFillCBData.emplace_front(0xffffffff, std::move(cbk));
+  uint32_t id = addInstrRuleRangeSet(
+      std::move(range), InstrRuleFillCBLambdaProxy, type, &el.second);
   el.first = id;
   return id;
 }
 
-uint32_t VM::addMnemonicCB(const char *mnemonic, InstPosition pos,
-                           InstCbLambda &&cbk, int priority) {
+// addBBInstrRule
+
+uint32_t VM::addBBInstrRule(InstrRuleBBCallback cbk, AnalysisType type,
+                            void *data) {
+  RangeSet<rword> r;
+  r.add(Range<rword>(0, (rword)-1));
+  return engine->addInstrRule(
+      InstrRuleBBUser::unique(cbk, type, data, this, std::move(r)));
+}
+
+uint32_t VM::addBBInstrRule(const InstrRuleBBCbLambda &cbk,
+                            AnalysisType type) {
+  auto &el = instrRuleBBCBData.emplace_front(0xffffffff, cbk);
+  uint32_t id = addBBInstrRule(InstrRuleBBCBLambdaProxy, type, &el.second);
+  el.first = id;
+  return id;
+}
+
+uint32_t VM::addBBInstrRule(InstrRuleBBCbLambda &&cbk, AnalysisType type) {
+  auto &el = instrRuleBBCBData.emplace_front(0xffffffff, std::move(cbk));
+  uint32_t id = addBBInstrRule(InstrRuleBBCBLambdaProxy, type, &el.second);
+  el.first = id;
+  return id;
+}
+
+// addBBInstrRuleRange
+
+uint32_t VM::addBBInstrRuleRange(rword start, rword end,
+                                 InstrRuleBBCallback cbk, AnalysisType type,
+                                 void *data) {
+  RangeSet<rword> r;
+  r.add(Range<rword>(start, end));
+  return engine->addInstrRule(
+      InstrRuleBBUser::unique(cbk, type, data, this, std::move(r)));
+}
+
+uint32_t VM::addBBInstrRuleRange(rword start, rword end,
+                                 const InstrRuleBBCbLambda &cbk,
+                                 AnalysisType type) {
+  auto &el = instrRuleBBCBData.emplace_front(0xffffffff, cbk);
+  uint32_t id = addBBInstrRuleRange(start, end, InstrRuleBBCBLambdaProxy,
+                                    type, &el.second);
+  el.first = id;
+  return id;
+}
+
+uint32_t VM::addBBInstrRuleRange(rword start, rword end,
+                                 InstrRuleBBCbLambda &&cbk, AnalysisType type) {
+  auto &el = instrRuleBBCBData.emplace_front(0xffffffff, std::move(cbk));
+  uint32_t id = addBBInstrRuleRange(start, end, InstrRuleBBCBLambdaProxy,
+                                    type, &el.second);
+  el.first = id;
+  return id;
+}
+
+// addMnemonicCB
+
+uint32_t VM::addMnemonicCB(const char *mnemonic, InstPosition pos,
+                           InstCallback cbk, void *data, int priority) {
+  QBDI_REQUIRE_ACTION(mnemonic != nullptr, return VMError::INVALID_EVENTID);
+  QBDI_REQUIRE_ACTION(cbk != nullptr, return VMError::INVALID_EVENTID);
+  return engine->addInstrRule(InstrRuleBasicCBK::unique(
+      MnemonicIs::unique(mnemonic, engine->getLLVMCPUs()), cbk, data, pos,
+      true, priority,
+      (pos == PREINST) ? RelocTagPreInstStdCBK : RelocTagPostInstStdCBK));
+}
+
+uint32_t VM::addMnemonicCB(const char *mnemonic, InstPosition pos,
+                           const InstCbLambda &cbk, int priority) {
+  auto &el = instCBData.emplace_front(0xffffffff, cbk);
+  uint32_t id =
+      addMnemonicCB(mnemonic, pos, InstCBLambdaProxy, &el.second, priority);
+  el.first = id;
+  return id;
+}
+
+uint32_t VM::addMnemonicCB(const char *mnemonic, InstPosition pos,
+                           InstCbLambda &&cbk, int priority) {
   auto &el = instCBData.emplace_front(0xffffffff, std::move(cbk));
   uint32_t id =
       addMnemonicCB(mnemonic, pos, InstCBLambdaProxy, &el.second, priority);
@@ -645,6 +1319,38 @@ uint32_t VM::addCodeAddrCB(rword address, InstPosition pos, InstCbLambda &&cbk,
   return id;
 }
 
+// addCodeAddrSetCB
+
+uint32_t VM::addCodeAddrSetCB(const std::vector<rword> &addresses,
+                              InstPosition pos, InstCallback cbk, void *data,
+                              int priority) {
+  QBDI_REQUIRE_ACTION(not addresses.empty(), return VMError::INVALID_EVENTID);
+  QBDI_REQUIRE_ACTION(cbk != nullptr, return VMError::INVALID_EVENTID);
+  return engine->addInstrRule(InstrRuleBasicCBK::unique(
+      AddressIn::unique(addresses), cbk, data, pos, true, priority,
+      (pos == PREINST) ? RelocTagPreInstStdCBK : RelocTagPostInstStdCBK));
+}
+
+uint32_t VM::addCodeAddrSetCB(const std::vector<rword> &addresses,
+                              InstPosition pos, const InstCbLambda &cbk,
+                              int priority) {
+  auto &el = instCBData.emplace_front(0xffffffff, cbk);
+  uint32_t id =
+      addCodeAddrSetCB(addresses, pos, InstCBLambdaProxy, &el.second, priority);
+  el.first = id;
+  return id;
+}
+
+uint32_t VM::addCodeAddrSetCB(const std::vector<rword> &addresses,
+                              InstPosition pos, InstCbLambda &&cbk,
+                              int priority) {
+  auto &el = instCBData.emplace_front(0xffffffff, std::move(cbk));
+  uint32_t id =
+      addCodeAddrSetCB(addresses, pos, InstCBLambdaProxy, &el.second, priority);
+  el.first = id;
+  return id;
+}
+
 // addCodeRangeCB
 
 uint32_t VM::addCodeRangeCB(rword start, rword end, InstPosition pos,
@@ -674,25 +1380,359 @@ uint32_t VM::addCodeRangeCB(rword start, rword end, InstPosition pos,
   return id;
 }
 
+// addCodeCBIf
+
+static bool isValidPredicate(InstPosition pos,
+                             const CallbackPredicate &predicate) {
+  switch (predicate.type) {
+    case PREDICATE_REG_EQUAL:
+    case PREDICATE_REG_NOT_EQUAL:
+    case PREDICATE_REG_BELOW:
+    case PREDICATE_REG_ABOVE_EQUAL:
+      return predicate.reg < REG_PC;
+    case PREDICATE_MEM_IN_RANGE:
+      // the address of the access is computed before the instruction
+      return pos == PREINST and predicate.value < predicate.end and
+             (predicate.access == MEMORY_READ or
+              predicate.access == MEMORY_WRITE);
+    case PREDICATE_COUNTER:
+      return predicate.value > 0;
+    case PREDICATE_SAMPLE:
+      // the countdowns are drawn in [1, 2 * value - 1]
+      return predicate.value > 0 and predicate.value <= (~rword(0) >> 1);
+    default:
+      return false;
+  }
+}
+
+static PatchConditionUniquePtr
+predicateCondition(PatchConditionUniquePtr &&condition,
+                   const CallbackPredicate &predicate) {
+  if (predicate.type != PREDICATE_MEM_IN_RANGE) {
+    return std::move(condition);
+  }
+  PatchConditionUniquePtr access;
+  if (predicate.access == MEMORY_READ) {
+    access = DoesReadAccess::unique();
+  } else {
+    access = DoesWriteAccess::unique();
+  }
+  return And::unique(
+      conv_unique<PatchCondition>(std::move(condition), std::move(access)));
+}
+
+uint32_t VM::addCodeCBIf(InstPosition pos, const CallbackPredicate &predicate,
+                         InstCallback cbk, void *data, int priority) {
+  QBDI_REQUIRE_ACTION(cbk != nullptr, return VMError::INVALID_EVENTID);
+  QBDI_REQUIRE_ACTION(isValidPredicate(pos, predicate),
+                      return VMError::INVALID_EVENTID);
+  return engine->addInstrRule(InstrRulePredicateCBK::unique(
+      predicateCondition(True::unique(), predicate), predicate, cbk, data, pos,
+      priority,
+      (pos == PREINST) ? RelocTagPreInstStdCBK : RelocTagPostInstStdCBK));
+}
+
+uint32_t VM::addCodeRangeCBIf(rword start, rword end, InstPosition pos,
+                              const CallbackPredicate &predicate,
+                              InstCallback cbk, void *data, int priority) {
+  QBDI_REQUIRE_ACTION(start < end, return VMError::INVALID_EVENTID);
+  QBDI_REQUIRE_ACTION(cbk != nullptr, return VMError::INVALID_EVENTID);
+  QBDI_REQUIRE_ACTION(isValidPredicate(pos, predicate),
+                      return VMError::INVALID_EVENTID);
+  return engine->addInstrRule(InstrRulePredicateCBK::unique(
+      predicateCondition(InstructionInRange::unique(start, end), predicate),
+      predicate, cbk, data, pos, priority,
+      (pos == PREINST) ? RelocTagPreInstStdCBK : RelocTagPostInstStdCBK));
+}
+
+// addCodeCBLight
+
+uint32_t VM::addCodeCBLight(InstPosition pos, InstCallback cbk, void *data,
+                            CallbackFootprint footprint, int priority) {
+  QBDI_REQUIRE_ACTION(cbk != nullptr, return VMError::INVALID_EVENTID);
+  return engine->addInstrRule(InstrRuleDirectCBK::unique(
+      True::unique(), cbk, data, footprint, this, pos, priority,
+      (pos == PREINST) ? RelocTagPreInstStdCBK : RelocTagPostInstStdCBK));
+}
+
+uint32_t VM::addCodeRangeCBLight(rword start, rword end, InstPosition pos,
+                                 InstCallback cbk, void *data,
+                                 CallbackFootprint footprint, int priority) {
+  QBDI_REQUIRE_ACTION(start < end, return VMError::INVALID_EVENTID);
+  QBDI_REQUIRE_ACTION(cbk != nullptr, return VMError::INVALID_EVENTID);
+  return engine->addInstrRule(InstrRuleDirectCBK::unique(
+      InstructionInRange::unique(start, end), cbk, data, footprint, this, pos,
+      priority,
+      (pos == PREINST) ? RelocTagPreInstStdCBK : RelocTagPostInstStdCBK));
+}
+
+// addCodeAnalysisCB
+
+// The analysis is resolved by the rule when the instruction is instrumented
+// and kept in the callback of the instruction
+static InstrRuleFillCbLambda analysisRule(InstPosition pos,
+                                          InstAnalysisCallback cbk,
+                                          void *data, int priority) {
+  return [pos, cbk, data, priority](VMInstanceRef, const InstAnalysis *analysis,
+                                    std::vector<InstrRuleDataCBK> &cbks) {
+    cbks.emplace_back(pos,
+                      InstCbLambda([cbk, data, analysis](VMInstanceRef vm,
+                                                         GPRState *gprState,
+                                                         FPRState *fprState) {
+                        return cbk(vm, gprState, fprState, analysis, data);
+                      }),
+                      priority);
+  };
+}
+
+uint32_t VM::addCodeAnalysisCB(InstPosition pos, InstAnalysisCallback cbk,
+                               void *data, AnalysisType type, int priority) {
+  QBDI_REQUIRE_ACTION(cbk != nullptr, return VMError::INVALID_EVENTID);
+  return addInstrRule(analysisRule(pos, cbk, data, priority), type);
+}
+
+uint32_t VM::addCodeRangeAnalysisCB(rword start, rword end, InstPosition pos,
+                                    InstAnalysisCallback cbk, void *data,
+                                    AnalysisType type, int priority) {
+  QBDI_REQUIRE_ACTION(start < end, return VMError::INVALID_EVENTID);
+  QBDI_REQUIRE_ACTION(cbk != nullptr, return VMError::INVALID_EVENTID);
+  return addInstrRuleRange(start, end, analysisRule(pos, cbk, data, priority),
+                           type);
+}
+
+// addCodeCounter
+
+uint32_t VM::addCodeCounter(rword start, rword end, InstPosition pos,
+                            uint64_t **counter, int priority) {
+  QBDI_REQUIRE_ACTION(start < end, return VMError::INVALID_EVENTID);
+  QBDI_REQUIRE_ACTION(counter != nullptr, return VMError::INVALID_EVENTID);
+  auto &el = counterData.emplace_front(0xffffffff, 0);
+  uint32_t id = engine->addInstrRule(InstrRuleCounter::unique(
+      InstructionInRange::unique(start, end), &el.second, pos, priority));
+  el.first = id;
+  *counter = &el.second;
+  return id;
+}
+
+// setMemoryTrace
+
+bool VM::setMemoryTrace(MemoryAccessType type, MemoryTraceCallback cbk,
+                        void *data, size_t capacity) {
+  return engine->setMemoryTrace(type, cbk, data, capacity);
+}
+
+// setCallTrace
+
+bool VM::setCallTrace(CallTraceCallback cbk, void *data, uint32_t nbArgs,
+                      size_t capacity) {
+  return engine->setCallTrace(cbk, data, nbArgs, capacity);
+}
+
+// setCallTraceArity
+
+bool VM::setCallTraceArity(rword target, uint32_t nbArgs) {
+  return engine->setCallTraceArity(target, nbArgs);
+}
+
+// setPageHistogram
+
+bool VM::setPageHistogram(bool enable, MemoryAccessType type) {
+  return engine->setPageHistogram(enable, type);
+}
+
+// getPageHistogram
+
+std::vector<PageAccessStats> VM::getPageHistogram(size_t topN) const {
+  return engine->getPageHistogram(topN);
+}
+
+// resetPageHistogram
+
+void VM::resetPageHistogram() { engine->resetPageHistogram(); }
+
+// setCoverageBitmap
+
+bool VM::setCoverageBitmap(uint8_t *bitmap, size_t size, CoverageMode mode) {
+  return engine->setCoverage(bitmap, size, mode);
+}
+
+// resetCoverage
+
+void VM::resetCoverage() { engine->resetCoverage(); }
+
+// addPlan
+
+// The instructions of a counter of a plan: the whole functions or the range
+// for PLAN_COUNT_INSTRUCTIONS, their first instruction for PLAN_COUNT_CALLS
+static PatchConditionUniquePtr planCounterCondition(const PlanStep &step) {
+  std::vector<Range<rword>> extents;
+  if (step.function != nullptr) {
+    getFunctionExtents(step.function, extents);
+  } else if (step.start < step.end) {
+    extents.emplace_back(step.start, step.end);
+  }
+  PatchCondition::UniquePtrVec conditions;
+  for (const Range<rword> &extent : extents) {
+    if (step.action == PLAN_COUNT_CALLS) {
+      conditions.push_back(AddressIs::unique(extent.start()));
+    } else {
+      conditions.push_back(
+          InstructionInRange::unique(extent.start(), extent.end()));
+    }
+  }
+  if (conditions.size() == 1) {
+    return std::move(conditions[0]);
+  } else if (not conditions.empty()) {
+    return Or::unique(std::move(conditions));
+  }
+  return nullptr;
+}
+
+bool VM::addPlan(const PlanStep *steps, size_t nbSteps, uint32_t *ids) {
+  QBDI_REQUIRE_ACTION(steps != nullptr or nbSteps == 0, return false);
+  std::vector<uint32_t> added(nbSteps, VMError::INVALID_EVENTID);
+  bool coverage = false;
+  bool memoryTrace = false;
+  bool budget = false;
+  bool applied = true;
+
+  for (size_t i = 0; applied and i < nbSteps; i++) {
+    const PlanStep &step = steps[i];
+    switch (step.action) {
+      case PLAN_COUNT_INSTRUCTIONS:
+      case PLAN_COUNT_CALLS: {
+        PatchConditionUniquePtr condition = planCounterCondition(step);
+        if (step.counter == nullptr or not condition) {
+          QBDI_ERROR("Invalid counter in the step {} of the plan", i);
+          applied = false;
+          break;
+        }
+        added[i] = engine->addInstrRule(InstrRuleCounter::unique(
+            std::move(condition), step.counter, PREINST));
+        applied = (added[i] != VMError::INVALID_EVENTID);
+        break;
+      }
+      case PLAN_COVERAGE:
+        // a null bitmap would disable the coverage
+        applied = coverage =
+            (step.bitmap != nullptr and
+             setCoverageBitmap(step.bitmap, step.size, step.coverage));
+        break;
+      case PLAN_MEMORY_TRACE:
+        applied = memoryTrace =
+            (step.cbk != nullptr and setMemoryTrace(step.memory, step.cbk,
+                                                    step.data, step.size));
+        break;
+      case PLAN_STOP:
+        applied = budget = (step.size != 0 and setInstructionBudget(step.size));
+        break;
+      default:
+        QBDI_ERROR("Unknown action {} in the step {} of the plan",
+                   static_cast<unsigned>(step.action), i);
+        applied = false;
+        break;
+    }
+  }
+
+  if (not applied) {
+    for (uint32_t id : added) {
+      if (id != VMError::INVALID_EVENTID) {
+        engine->deleteInstrumentation(id);
+      }
+    }
+    std::fill(added.begin(), added.end(), VMError::INVALID_EVENTID);
+    if (coverage) {
+      setCoverageBitmap(nullptr, 0);
+    }
+    if (memoryTrace) {
+      setMemoryTrace(MEMORY_READ_WRITE, nullptr, nullptr);
+    }
+    if (budget) {
+      setInstructionBudget(0);
+    }
+  }
+  if (ids != nullptr) {
+    std::copy(added.begin(), added.end(), ids);
+  }
+  return applied;
+}
+
+// takeSnapshot
+
+VMSnapshot::~VMSnapshot() { untrackDirtyPages(this); }
+
+void VM::takeSnapshot(const RangeSet<rword> &ranges) {
+  snapshot = std::make_unique<VMSnapshot>();
+  snapshot->gprState = *engine->getGPRState();
+  snapshot->fprState = *engine->getFPRState();
+  snapshot->ranges = ranges;
+  for (const Range<rword> &r : ranges.getRanges()) {
+    const uint8_t *content = reinterpret_cast<const uint8_t *>(r.start());
+    snapshot->memory.emplace_back(
+        r, std::vector<uint8_t>(content, content + r.size()));
+  }
+  if (not snapshot->memory.empty()) {
+    snapshot->dirtyTracking = trackDirtyPages(snapshot.get(), ranges);
+  }
+}
+
+// restoreSnapshot
+
+bool VM::restoreSnapshot() {
+  if (not snapshot) {
+    return false;
+  }
+  engine->setGPRState(&snapshot->gprState);
+  engine->setFPRState(&snapshot->fprState);
+  if (snapshot->memory.empty()) {
+    return true;
+  }
+  // without the written pages, all the ranges are restored
+  RangeSet<rword> dirtyPages;
+  bool dirtyOnly = snapshot->dirtyTracking and
+                   takeDirtyPages(snapshot.get(), dirtyPages);
+  for (const auto &p : snapshot->memory) {
+    if (not dirtyOnly) {
+      memcpy(reinterpret_cast<void *>(p.first.start()), p.second.data(),
+             p.second.size());
+      continue;
+    }
+    RangeSet<rword> written = dirtyPages;
+    written.intersect(p.first);
+    for (const Range<rword> &r : written.getRanges()) {
+      memcpy(reinterpret_cast<void *>(r.start()),
+             p.second.data() + (r.start() - p.first.start()), r.size());
+    }
+  }
+  // the pages written by the restore aren't dirty
+  if (snapshot->dirtyTracking) {
+    snapshot->dirtyTracking = resetDirtyPages(snapshot.get());
+  } else {
+    snapshot->dirtyTracking =
+        trackDirtyPages(snapshot.get(), snapshot->ranges);
+  }
+  return true;
+}
+
 // addMemAccessCB
 
 uint32_t VM::addMemAccessCB(MemoryAccessType type, InstCallback cbk, void *data,
                             int priority) {
   QBDI_REQUIRE_ACTION(cbk != nullptr, return VMError::INVALID_EVENTID);
   recordMemoryAccess(type);
-  switch (type) {
+  switch (type & MEMORY_READ_WRITE) {
     case MEMORY_READ:
       return engine->addInstrRule(InstrRuleBasicCBK::unique(
-          DoesReadAccess::unique(), cbk, data, InstPosition::PREINST, true,
-          priority, RelocTagPreInstStdCBK));
+          DoesReadAccess::unique(type), cbk, data, InstPosition::PREINST,
+          true, priority, RelocTagPreInstStdCBK));
     case MEMORY_WRITE:
       return engine->addInstrRule(InstrRuleBasicCBK::unique(
-          DoesWriteAccess::unique(), cbk, data, InstPosition::POSTINST, true,
-          priority, RelocTagPostInstStdCBK));
+          DoesWriteAccess::unique(type), cbk, data, InstPosition::POSTINST,
+          true, priority, RelocTagPostInstStdCBK));
     case MEMORY_READ_WRITE:
       return engine->addInstrRule(InstrRuleBasicCBK::unique(
-          Or::unique(conv_unique<PatchCondition>(DoesReadAccess::unique(),
-                                                 DoesWriteAccess::unique())),
+          Or::unique(conv_unique<PatchCondition>(
+              DoesReadAccess::unique(type), DoesWriteAccess::unique(type))),
           cbk, data, InstPosition::POSTINST, true, priority,
           RelocTagPostInstStdCBK));
     default:
@@ -716,6 +1756,69 @@ uint32_t VM::addMemAccessCB(MemoryAccessType type, InstCbLambda &&cbk,
   return id;
 }
 
+uint32_t VM::addMemAccessCBIf(MemoryAccessType type,
+                              const CallbackPredicate &predicate,
+                              InstCallback cbk, void *data, int priority) {
+  QBDI_REQUIRE_ACTION(cbk != nullptr, return VMError::INVALID_EVENTID);
+  // the positions of the callbacks of addMemAccessCB
+  InstPosition pos =
+      ((type & MEMORY_READ_WRITE) == MEMORY_READ) ? PREINST : POSTINST;
+  QBDI_REQUIRE_ACTION(isValidPredicate(pos, predicate),
+                      return VMError::INVALID_EVENTID);
+  PatchConditionUniquePtr condition;
+  switch (type & MEMORY_READ_WRITE) {
+    case MEMORY_READ:
+      condition = DoesReadAccess::unique(type);
+      break;
+    case MEMORY_WRITE:
+      condition = DoesWriteAccess::unique(type);
+      break;
+    case MEMORY_READ_WRITE:
+      condition = Or::unique(conv_unique<PatchCondition>(
+          DoesReadAccess::unique(type), DoesWriteAccess::unique(type)));
+      break;
+    default:
+      return VMError::INVALID_EVENTID;
+  }
+  recordMemoryAccess(type);
+  return engine->addInstrRule(InstrRulePredicateCBK::unique(
+      predicateCondition(std::move(condition), predicate), predicate, cbk,
+      data, pos, priority,
+      (pos == PREINST) ? RelocTagPreInstStdCBK : RelocTagPostInstStdCBK));
+}
+
+// addTaintTracking
+
+static VMAction taintPropagation(VMInstanceRef vm, GPRState *gprState,
+                                 FPRState *fprState, void *data) {
+  return static_cast<TaintState *>(data)->propagate(vm, gprState, fprState);
+}
+
+uint32_t VM::addTaintTracking(TaintState *state, TaintCallback cbk,
+                              void *data, int priority) {
+  QBDI_REQUIRE_ACTION(state != nullptr, return VMError::INVALID_EVENTID);
+  if (not recordMemoryAccess(MEMORY_READ_WRITE)) {
+    return VMError::INVALID_EVENTID;
+  }
+  state->cbk = cbk;
+  state->data = data;
+  return engine->addInstrRule(InstrRuleBasicCBK::unique(
+      True::unique(), taintPropagation, state, InstPosition::POSTINST, true,
+      priority, RelocTagPostInstStdCBK));
+}
+
+// addOwnershipFilter
+
+uint32_t VM::addOwnershipFilter(OwnershipFilter *filter, MemoryAccessType type,
+                                int priority) {
+  QBDI_REQUIRE_ACTION(filter != nullptr, return VMError::INVALID_EVENTID);
+  QBDI_REQUIRE_ACTION(type & MEMORY_READ_WRITE,
+                      return VMError::INVALID_EVENTID);
+  OwnershipCheck check = {filter->shadow.table.get(), filter->thread,
+                          &filter->missAddress, filter, type};
+  return engine->addInstrRule(InstrRuleOwnership::unique(check, priority));
+}
+
 // addMemAddrCB
 
 uint32_t VM::addMemAddrCB(rword address, MemoryAccessType type,
@@ -742,25 +1845,64 @@ uint32_t VM::addMemAddrCB(rword address, MemoryAccessType type,
 
 // addMemRangeCB
 
+// OPT_ENABLE_MEMCB_PAGE_WATCH: protect the pages of a new range instead of
+// adding the gates on all the instructions
+static bool watchMemRange(Engine &engine, MemCBIndex &index,
+                          const MemCBInfo &info) {
+  if (not isPageWatchSupported() ||
+      not watchPages(&index, info.range, info.type)) {
+    return false;
+  }
+  if (index.pageWatchCBID == VMError::INVALID_EVENTID) {
+    index.pageWatchCBID =
+        engine.addVMEventCB(SEQUENCE_EXIT, pageWatchGate, &index);
+  }
+  return index.pageWatchCBID != VMError::INVALID_EVENTID;
+}
+
 uint32_t VM::addMemRangeCB(rword start, rword end, MemoryAccessType type,
                            InstCallback cbk, void *data) {
   QBDI_REQUIRE_ACTION(start < end, return VMError::INVALID_EVENTID);
   QBDI_REQUIRE_ACTION(type & MEMORY_READ_WRITE,
                       return VMError::INVALID_EVENTID);
   QBDI_REQUIRE_ACTION(cbk != nullptr, return VMError::INVALID_EVENTID);
-  if ((type == MEMORY_READ) && memReadGateCBID == VMError::INVALID_EVENTID) {
+  MemCBInfo info{type, {start, end}, cbk, data};
+  // the page watch is only used while no gate is on all the instructions
+  if ((engine->getOptions() & Options::OPT_ENABLE_MEMCB_PAGE_WATCH) &&
+      memReadGateCBID == VMError::INVALID_EVENTID &&
+      memWriteGateCBID == VMError::INVALID_EVENTID &&
+      watchMemRange(*engine, *memCBInfos, info)) {
+    uint32_t id = memCBID++;
+    QBDI_REQUIRE_ACTION(id < EVENTID_VIRTCB_MASK,
+                        return VMError::INVALID_EVENTID);
+    memCBInfos->add(id | EVENTID_VIRTCB_MASK, info);
+    // the promoted ranges don't have the gate of a new type
+    if (memCBInfos->neededGates() & ~memCBInfos->promotedType) {
+      memCBInfos->resetPromotion();
+    }
+    return id | EVENTID_VIRTCB_MASK;
+  }
+  if (memCBInfos->pageWatchCBID != VMError::INVALID_EVENTID) {
+    // the gates on all the instructions replace the page watch
+    engine->deleteInstrumentation(memCBInfos->pageWatchCBID);
+    memCBInfos->pageWatchCBID = VMError::INVALID_EVENTID;
+    memCBInfos->resetPromotion();
+    unwatchPages(memCBInfos.get());
+  }
+  uint8_t gates = memCBInfos->neededGates() |
+                  ((type == MEMORY_READ) ? MEMORY_READ : MEMORY_WRITE);
+  if ((gates & MEMORY_READ) && memReadGateCBID == VMError::INVALID_EVENTID) {
     memReadGateCBID =
         addMemAccessCB(MEMORY_READ, memReadGate, memCBInfos.get());
   }
-  if ((type & MEMORY_WRITE) && memWriteGateCBID == VMError::INVALID_EVENTID) {
+  if ((gates & MEMORY_WRITE) && memWriteGateCBID == VMError::INVALID_EVENTID) {
     memWriteGateCBID =
         addMemAccessCB(MEMORY_READ_WRITE, memWriteGate, memCBInfos.get());
   }
   uint32_t id = memCBID++;
   QBDI_REQUIRE_ACTION(id < EVENTID_VIRTCB_MASK,
                       return VMError::INVALID_EVENTID);
-  memCBInfos->emplace_back(id | EVENTID_VIRTCB_MASK,
-                           MemCBInfo{type, {start, end}, cbk, data});
+  memCBInfos->add(id | EVENTID_VIRTCB_MASK, info);
   return id | EVENTID_VIRTCB_MASK;
 }
 
@@ -780,6 +1922,26 @@ uint32_t VM::addMemRangeCB(rword start, rword end, MemoryAccessType type,
   return id;
 }
 
+// addBBMemAccessCB
+
+uint32_t VM::addBBMemAccessCB(MemoryAccessType type, BBMemAccessCallback cbk,
+                              void *data) {
+  QBDI_REQUIRE_ACTION(type & MEMORY_READ_WRITE,
+                      return VMError::INVALID_EVENTID);
+  QBDI_REQUIRE_ACTION(cbk != nullptr, return VMError::INVALID_EVENTID);
+  if (not recordMemoryAccess(type)) {
+    return VMError::INVALID_EVENTID;
+  }
+  auto info = std::make_unique<BBMemAccessCBInfo>(
+      BBMemAccessCBInfo{type, cbk, data, engine.get(), {}});
+  uint32_t id =
+      engine->addVMEventCB(SEQUENCE_EXIT, BBMemAccessGate, info.get());
+  if (id != VMError::INVALID_EVENTID) {
+    bbMemAccessCBInfos->emplace_back(id, std::move(info));
+  }
+  return id;
+}
+
 // addVMEventCB
 
 uint32_t VM::addVMEventCB(VMEvent mask, VMCallback cbk, void *data) {
@@ -802,57 +1964,133 @@ uint32_t VM::addVMEventCB(VMEvent mask, VMCbLambda &&cbk) {
   return id;
 }
 
+// setNewBasicBlockBatch
+
+bool VM::setNewBasicBlockBatch(NewBasicBlockCallback cbk, void *data,
+                               size_t threshold) {
+  return engine->setNewBasicBlockBatch(cbk, data, threshold);
+}
+
+// addTransferHook
+
+uint32_t VM::addTransferHook(rword target, VMCallback preCbk,
+                             VMCallback postCbk, void *data) {
+  QBDI_REQUIRE_ACTION(preCbk != nullptr or postCbk != nullptr,
+                      return VMError::INVALID_EVENTID);
+  return engine->addTransferHook(target, preCbk, postCbk, data);
+}
+
+// addFunctionHook
+
+uint32_t VM::addFunctionHook(rword address, InstCallback onEntry,
+                             InstCallback onExit, void *data) {
+  QBDI_REQUIRE_ACTION(onEntry != nullptr or onExit != nullptr,
+                      return VMError::INVALID_EVENTID);
+  auto info = std::make_unique<FunctionHookInfo>(
+      FunctionHookInfo{onEntry, onExit, data, {}, {}});
+  uint32_t id =
+      addCodeAddrCB(address, PREINST, functionEntryGate, info.get());
+  if (id != VMError::INVALID_EVENTID) {
+    functionHooks->emplace_back(id, std::move(info));
+  }
+  return id;
+}
+
+// replaceFunction
+
+uint32_t VM::replaceFunction(rword orig, rword replacement) {
+  return engine->replaceFunction(orig, replacement);
+}
+
 // deleteInstrumentation
 
 bool VM::deleteInstrumentation(uint32_t id) {
   if (id & EVENTID_VIRTCB_MASK) {
-    auto found = std::remove_if(memCBInfos->begin(), memCBInfos->end(),
-                                [id](const std::pair<uint32_t, MemCBInfo> &el) {
-                                  return id == el.first;
-                                });
-    if (found == memCBInfos->end()) {
+    if (not memCBInfos->remove(id)) {
       return false;
     }
 
-    memCBInfos->erase(found, memCBInfos->end());
     instCBData.remove_if([id](const std::pair<uint32_t, InstCbLambda> &x) {
       return x.first == id;
     });
     return true;
   } else {
-    instrCBInfos->erase(
+    bbMemAccessCBInfos->erase(
         std::remove_if(
-            instrCBInfos->begin(), instrCBInfos->end(),
-            [id](const std::pair<uint32_t, std::unique_ptr<InstrCBInfo>> &x) {
-              return x.first == id;
-            }),
-        instrCBInfos->end());
+            bbMemAccessCBInfos->begin(), bbMemAccessCBInfos->end(),
+            [id](const std::pair<uint32_t, std::unique_ptr<BBMemAccessCBInfo>>
+                     &x) { return x.first == id; }),
+        bbMemAccessCBInfos->end());
+    auto hook = std::find_if(
+        functionHooks->begin(), functionHooks->end(),
+        [id](const std::pair<uint32_t, std::unique_ptr<FunctionHookInfo>> &x) {
+          return x.first == id;
+        });
+    if (hook != functionHooks->end()) {
+      for (const auto &exit : hook->second->exitIDs) {
+        engine->deleteInstrumentation(exit.second);
+      }
+      functionHooks->erase(hook);
+    }
     vmCBData.remove_if([id](const std::pair<uint32_t, VMCbLambda> &x) {
       return x.first == id;
     });
     instCBData.remove_if([id](const std::pair<uint32_t, InstCbLambda> &x) {
       return x.first == id;
     });
+    counterData.remove_if([id](const std::pair<uint32_t, uint64_t> &x) {
+      return x.first == id;
+    });
     instrRuleCBData.remove_if(
         [id](const std::pair<uint32_t, InstrRuleCbLambda> &x) {
           return x.first == id;
         });
+    instrRuleFillCBData.remove_if(
+        [id](const std::pair<uint32_t, InstrRuleFillCbLambda> &x) {
+          return x.first == id;
+        });
+    instrRuleBBCBData.remove_if(
+        [id](const std::pair<uint32_t, InstrRuleBBCbLambda> &x) {
+          return x.first == id;
+        });
+    functorCBData.remove_if([id](const std::pair<uint32_t, InstCbFunctor> &x) {
+      return x.first == id;
+    });
     return engine->deleteInstrumentation(id);
   }
 }
 
+bool VM::setInstrumentationEnabled(uint32_t id, bool enable) {
+  if (id & EVENTID_VIRTCB_MASK) {
+    return false;
+  }
+  return engine->setInstrumentationEnabled(id, enable);
+}
+
 // deleteAllInstrumentations
 
 void VM::deleteAllInstrumentations() {
   engine->deleteAllInstrumentations();
   memReadGateCBID = VMError::INVALID_EVENTID;
   memWriteGateCBID = VMError::INVALID_EVENTID;
+  sliceStopCBID = VMError::INVALID_EVENTID;
   memCBInfos->clear();
-  instrCBInfos->clear();
+  bbMemAccessCBInfos->clear();
+  functionHooks->clear();
   vmCBData.clear();
   instCBData.clear();
   instrRuleCBData.clear();
+  instrRuleFillCBData.clear();
+  instrRuleBBCBData.clear();
+  counterData.clear();
+  functorCBData.clear();
   memoryLoggingLevel = 0;
+  readRecordModifiers = 0;
+  writeRecordModifiers = 0;
+  restrictedRecordIDs.clear();
+  recordedReadRanges.clear();
+  recordedWriteRanges.clear();
+  rangeRecordIDs.clear();
 }
 
 // getInstAnalysis
@@ -871,22 +2109,160 @@ const InstAnalysis *VM::getCachedInstAnalysis(rword address,
   return engine->getInstAnalysis(address, type);
 }
 
+// getInstHandle
+
+InstHandle VM::getInstHandle() const {
+  const ExecBlock *curExecBlock = engine->getCurExecBlock();
+  QBDI_REQUIRE_ACTION(curExecBlock != nullptr, return 0);
+  return curExecBlock->getInstHandle(curExecBlock->getCurrentInstID());
+}
+
+// getCachedInstHandle
+
+InstHandle VM::getCachedInstHandle(rword address) const {
+  return engine->getInstHandle(address);
+}
+
+// getInstAnalysisByHandle
+
+const InstAnalysis *VM::getInstAnalysisByHandle(InstHandle handle,
+                                                AnalysisType type) const {
+  return engine->getInstAnalysisByHandle(handle, type);
+}
+
+// iterateCache
+
+size_t VM::iterateCache(CachedInstCallback cbk, void *data,
+                        AnalysisType type) const {
+  QBDI_REQUIRE_ACTION(cbk != nullptr, return 0);
+  return engine->iterateCache(cbk, data, type);
+}
+
+// analyzeRange
+
+size_t VM::analyzeRange(rword start, rword end, InstAnalysis *analyses,
+                        size_t count, AnalysisType type, bool basicBlock,
+                        unsigned nbThreads) const {
+  QBDI_REQUIRE_ACTION(start <= end, return 0);
+  return engine->analyzeRange(start, end, analyses, count, type, basicBlock,
+                              nbThreads);
+}
+
+void VM::releaseAnalyses(InstAnalysis *analyses, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    releaseInstAnalysisContent(analyses[i]);
+  }
+}
+
 // recordMemoryAccess
 
 bool VM::recordMemoryAccess(MemoryAccessType type) {
   if constexpr (is_arm)
     return false;
 
+  // MEMORY_NO_FRAME also skips the accesses of MEMORY_NO_STACK
+  uint8_t modifiers =
+      type & (MEMORY_ADDRESS_ONLY | MEMORY_NO_STACK | MEMORY_NO_FRAME);
+  if (modifiers & MEMORY_NO_FRAME) {
+    modifiers |= MEMORY_NO_STACK;
+  }
+  for (MemoryAccessType access : {MEMORY_READ, MEMORY_WRITE}) {
+    if ((type & access) == 0) {
+      continue;
+    }
+    uint8_t &current = (access == MEMORY_READ) ? readRecordModifiers
+                                               : writeRecordModifiers;
+    uint8_t recorded = modifiers;
+    if (memoryLoggingLevel & access) {
+      // the value and the stack accesses are recorded as soon as a recording
+      // needs them
+      recorded = current & modifiers;
+      if (recorded == current) {
+        continue;
+      }
+      std::vector<std::pair<uint32_t, MemoryAccessType>> records;
+      for (const auto &p : restrictedRecordIDs) {
+        if (p.second & access) {
+          engine->deleteInstrumentation(p.first);
+        } else {
+          records.push_back(p);
+        }
+      }
+      restrictedRecordIDs.swap(records);
+    }
+    memoryLoggingLevel |= access;
+    current = recorded;
+    MemoryAccessType ruleType =
+        static_cast<MemoryAccessType>(access | recorded);
+    for (auto &r : (access == MEMORY_READ)
+                       ? getInstrRuleMemAccessRead(ruleType)
+                       : getInstrRuleMemAccessWrite(ruleType)) {
+      uint32_t id = engine->addInstrRule(std::move(r));
+      if (recorded != 0) {
+        restrictedRecordIDs.emplace_back(id, access);
+      }
+    }
+  }
+  // the rules of recordMemoryAccessRange are now redundant
+  if (not rangeRecordIDs.empty()) {
+    std::vector<std::pair<uint32_t, MemoryAccessType>> records;
+    for (const auto &p : rangeRecordIDs) {
+      if (p.second & memoryLoggingLevel) {
+        engine->deleteInstrumentation(p.first);
+      } else {
+        records.push_back(p);
+      }
+    }
+    rangeRecordIDs.swap(records);
+  }
+  if (memoryLoggingLevel & MEMORY_READ) {
+    recordedReadRanges.clear();
+  }
+  if (memoryLoggingLevel & MEMORY_WRITE) {
+    recordedWriteRanges.clear();
+  }
+  return true;
+}
+
+bool VM::recordMemoryAccessRange(rword start, rword end,
+                                 MemoryAccessType type) {
+  if constexpr (is_arm)
+    return false;
+
+  QBDI_REQUIRE_ACTION(start < end, return false);
+  Range<rword> range{start, end};
   if (type & MEMORY_READ && !(memoryLoggingLevel & MEMORY_READ)) {
-    memoryLoggingLevel |= MEMORY_READ;
-    for (auto &r : getInstrRuleMemAccessRead()) {
-      engine->addInstrRule(std::move(r));
+    RangeSet<rword> added;
+    added.add(range);
+    added.remove(recordedReadRanges);
+    for (const Range<rword> &r : added.getRanges()) {
+      for (auto &rule : getInstrRuleMemAccessRead(r)) {
+        rangeRecordIDs.emplace_back(engine->addInstrRule(std::move(rule)),
+                                    MEMORY_READ);
+      }
     }
+    recordedReadRanges.add(range);
   }
   if (type & MEMORY_WRITE && !(memoryLoggingLevel & MEMORY_WRITE)) {
-    memoryLoggingLevel |= MEMORY_WRITE;
-    for (auto &r : getInstrRuleMemAccessWrite()) {
-      engine->addInstrRule(std::move(r));
+    RangeSet<rword> added;
+    added.add(range);
+    added.remove(recordedWriteRanges);
+    for (const Range<rword> &r : added.getRanges()) {
+      for (auto &rule : getInstrRuleMemAccessWrite(r)) {
+        rangeRecordIDs.emplace_back(engine->addInstrRule(std::move(rule)),
+                                    MEMORY_WRITE);
+      }
+    }
+    recordedWriteRanges.add(range);
+  }
+  return true;
+}
+
+bool VM::recordMemoryAccessRangeSet(const RangeSet<rword> &range,
+                                    MemoryAccessType type) {
+  for (const Range<rword> &r : range.getRanges()) {
+    if (not recordMemoryAccessRange(r.start(), r.end(), type)) {
+      return false;
     }
   }
   return true;
@@ -894,57 +2270,356 @@ bool VM::recordMemoryAccess(MemoryAccessType type) {
 
 // getInstMemoryAccess
 
-std::vector<MemoryAccess> VM::getInstMemoryAccess() const {
+void VM::analyseInstMemoryAccess(std::vector<MemoryAccess> &dest) const {
   if constexpr (is_arm)
-    return {};
+    return;
 
-  const ExecBlock *curExecBlock = engine->getCurExecBlock();
-  if (curExecBlock == nullptr) {
-    return {};
-  }
-  uint16_t instID = curExecBlock->getCurrentInstID();
+  const std::vector<MemoryAccess> &accesses = engine->getInstMemoryAccess();
+  dest.insert(dest.end(), accesses.begin(), accesses.end());
+}
+
+std::vector<MemoryAccess> VM::getInstMemoryAccess() const {
   std::vector<MemoryAccess> memAccess;
-  analyseMemoryAccess(*curExecBlock, instID, !engine->isPreInst(), memAccess);
+  analyseInstMemoryAccess(memAccess);
   return memAccess;
 }
 
+size_t VM::getInstMemoryAccess(MemoryAccess *buffer, size_t capacity) const {
+  QBDI_REQUIRE_ACTION(buffer != nullptr or capacity == 0, return 0);
+  if constexpr (is_arm)
+    return 0;
+
+  // copied from the accesses decoded for the instruction
+  const std::vector<MemoryAccess> &accesses = engine->getInstMemoryAccess();
+  std::copy_n(accesses.begin(), std::min(capacity, accesses.size()), buffer);
+  return accesses.size();
+}
+
 // getBBMemoryAccess
 
-std::vector<MemoryAccess> VM::getBBMemoryAccess() const {
+void VM::analyseBBMemoryAccess(std::vector<MemoryAccess> &dest) const {
   if constexpr (is_arm)
-    return {};
+    return;
 
   const ExecBlock *curExecBlock = engine->getCurExecBlock();
   if (curExecBlock == nullptr) {
-    return {};
+    return;
   }
   uint16_t bbID = curExecBlock->getCurrentSeqID();
   uint16_t instID = curExecBlock->getCurrentInstID();
-  std::vector<MemoryAccess> memAccess;
   QBDI_DEBUG(
       "Search MemoryAccess for Basic Block {:x} stopping at Instruction {:x}",
       bbID, instID);
 
+  // the accesses of the executed instructions are decoded with the table of
+  // the sequence, only the current one depends on the position
+  uint16_t entryID = curExecBlock->getCurrentEntryID();
   uint16_t endInstID = curExecBlock->getSeqEnd(bbID);
-  for (uint16_t itInstID = curExecBlock->getSeqStart(bbID);
-       itInstID <= std::min(endInstID, instID); itInstID++) {
-
-    analyseMemoryAccess(*curExecBlock, itInstID,
-                        itInstID != instID || !engine->isPreInst(), memAccess);
+  if (instID > endInstID) {
+    analyseSeqMemoryAccess(*curExecBlock, entryID, endInstID + 1,
+                           MEMORY_READ_WRITE, dest);
+  } else if (instID >= entryID) {
+    analyseSeqMemoryAccess(*curExecBlock, entryID, instID, MEMORY_READ_WRITE,
+                           dest);
+    const std::vector<MemoryAccess> &accesses = engine->getInstMemoryAccess();
+    dest.insert(dest.end(), accesses.begin(), accesses.end());
   }
+}
+
+std::vector<MemoryAccess> VM::getBBMemoryAccess() const {
+  std::vector<MemoryAccess> memAccess;
+  analyseBBMemoryAccess(memAccess);
   return memAccess;
 }
 
+size_t VM::getBBMemoryAccess(MemoryAccess *buffer, size_t capacity) const {
+  QBDI_REQUIRE_ACTION(buffer != nullptr or capacity == 0, return 0);
+  memAccessScratch.clear();
+  analyseBBMemoryAccess(memAccessScratch);
+  std::copy_n(memAccessScratch.begin(),
+              std::min(capacity, memAccessScratch.size()), buffer);
+  return memAccessScratch.size();
+}
+
+// getMemoryAccessValue
+
+bool VM::getMemoryAccessValue(const MemoryAccess &access, void *buffer,
+                              size_t size) const {
+  QBDI_REQUIRE_ACTION(buffer != nullptr, return false);
+  if constexpr (is_arm)
+    return false;
+
+  const ExecBlock *curExecBlock = engine->getCurExecBlock();
+  if (curExecBlock == nullptr or (access.flags & MEMORY_WIDE_VALUE) == 0 or
+      size < access.size) {
+    return false;
+  }
+  return QBDI::getMemoryAccessValue(*curExecBlock, access,
+                                    static_cast<uint8_t *>(buffer));
+}
+
 // precacheBasicBlock
 
 bool VM::precacheBasicBlock(rword pc) { return engine->precacheBasicBlock(pc); }
 
+// precacheBasicBlocks
+
+size_t VM::precacheBasicBlocks(const std::vector<rword> &addresses) {
+  return engine->precacheBasicBlocks(addresses);
+}
+
+// precacheRange
+
+size_t VM::precacheRange(rword start, rword end,
+                         const std::vector<rword> &entries, bool useSymbols) {
+  QBDI_REQUIRE_ACTION(start < end, return 0);
+  RangeSet<rword> bounds;
+  bounds.add(Range<rword>(start, end));
+  if (entries.empty()) {
+    return engine->precacheReachable(bounds, {start}, useSymbols);
+  }
+  return engine->precacheReachable(bounds, entries, useSymbols);
+}
+
+// precacheModule
+
+size_t VM::precacheModule(const std::string &name,
+                          const std::vector<rword> &entries, bool useSymbols) {
+  RangeSet<rword> bounds;
+  for (const MemoryMap &m : getCurrentProcessMaps()) {
+    if ((m.name == name) && (m.permission & QBDI::PF_EXEC)) {
+      bounds.add(m.range);
+    }
+  }
+  if (bounds.getRanges().empty()) {
+    QBDI_WARN("No executable map for the module {}", name);
+    return 0;
+  }
+  return engine->precacheReachable(bounds, entries, useSymbols);
+}
+
+// precacheFrom
+
+size_t VM::precacheFrom(const VM &vm) {
+  if (&vm == this) {
+    return 0;
+  }
+  return engine->precacheBasicBlocks(vm.engine->getCachedSequences());
+}
+
+// saveCacheProfile
+
+bool VM::saveCacheProfile(const char *path) const {
+  QBDI_REQUIRE_ACTION(path != nullptr, return false);
+  return engine->saveCacheProfile(path);
+}
+
+// prewarmCache
+
+size_t VM::prewarmCache(const char *path) {
+  QBDI_REQUIRE_ACTION(path != nullptr, return 0);
+  return engine->prewarmCache(path);
+}
+
 // clearAllCache
 
 void VM::clearAllCache() { engine->clearAllCache(); }
 
+// sealCache
+
+bool VM::sealCache() { return engine->sealCache(); }
+
 // clearCache
 
 void VM::clearCache(rword start, rword end) { engine->clearCache(start, end); }
 
+// getCacheLimit
+
+size_t VM::getCacheLimit() const { return engine->getCacheLimit(); }
+
+// setCacheLimit
+
+void VM::setCacheLimit(size_t limit) { engine->setCacheLimit(limit); }
+
+// getCacheStats
+
+CacheStats VM::getCacheStats() const { return engine->getCacheStats(); }
+
+// getMemoryStats
+
+MemoryStats VM::getMemoryStats() const { return engine->getMemoryStats(); }
+
+// getTransferStats
+
+std::vector<TransferStats> VM::getTransferStats(size_t topN) const {
+  return engine->getTransferStats(topN);
+}
+
+// setExecStats
+
+void VM::setExecStats(bool enable) { engine->setExecStats(enable); }
+
+// getExecStats
+
+ExecStats VM::getExecStats() const { return engine->getExecStats(); }
+
+// resetExecStats
+
+void VM::resetExecStats() { engine->resetExecStats(); }
+
+// setAutoDemotion
+
+void VM::setAutoDemotion(uint32_t threshold) {
+  engine->setAutoDemotion(threshold);
+}
+
+// getDemotedFunctions
+
+std::vector<rword> VM::getDemotedFunctions() const {
+  return engine->getDemotedFunctions();
+}
+
+// setInstrRuleStats
+
+bool VM::setInstrRuleStats(bool enable, const char *reportPath) {
+  return engine->setInstrRuleStats(enable, reportPath);
+}
+
+// getInstrRuleStats
+
+std::vector<InstrRuleStats> VM::getInstrRuleStats(size_t topN) const {
+  return engine->getInstrRuleStats(topN);
+}
+
+// resetInstrRuleStats
+
+void VM::resetInstrRuleStats() { engine->resetInstrRuleStats(); }
+
+// setSequenceProfile
+
+bool VM::setSequenceProfile(bool enable, const char *reportPath) {
+  return engine->setSequenceProfile(enable, reportPath);
+}
+
+// getSequenceProfile
+
+std::vector<SequenceStats> VM::getSequenceProfile(size_t topN) const {
+  return engine->getSequenceProfile(topN);
+}
+
+// resetSequenceProfile
+
+void VM::resetSequenceProfile() { engine->resetSequenceProfile(); }
+
+// setBranchProfile
+
+bool VM::setBranchProfile(bool enable) {
+  return engine->setBranchProfile(enable);
+}
+
+// getBranchProfile
+
+std::vector<BranchStats> VM::getBranchProfile(size_t topN) const {
+  return engine->getBranchProfile(topN);
+}
+
+// resetBranchProfile
+
+void VM::resetBranchProfile() { engine->resetBranchProfile(); }
+
+// setIndirectProfile
+
+bool VM::setIndirectProfile(bool enable) {
+  return engine->setIndirectProfile(enable);
+}
+
+// getIndirectProfile
+
+std::vector<IndirectTargetStats> VM::getIndirectProfile(size_t topN) const {
+  return engine->getIndirectProfile(topN);
+}
+
+// resetIndirectProfile
+
+void VM::resetIndirectProfile() { engine->resetIndirectProfile(); }
+
+// addValueProfile
+
+uint32_t VM::addValueProfile(rword address, uint32_t reg, size_t buckets) {
+  return engine->addValueProfile(address, reg, buckets);
+}
+
+// getValueProfile
+
+std::vector<ValueStats> VM::getValueProfile(uint32_t id, size_t topN) const {
+  return engine->getValueProfile(id, topN);
+}
+
+// resetValueProfile
+
+bool VM::resetValueProfile(uint32_t id) {
+  return engine->resetValueProfile(id);
+}
+
+// setCallGraphProfile
+
+bool VM::setCallGraphProfile(bool enable) {
+  return engine->setCallGraphProfile(enable);
+}
+
+// getCallGraphProfile
+
+std::vector<CallGraphEdgeStats> VM::getCallGraphProfile(size_t topN) const {
+  return engine->getCallGraphProfile(topN);
+}
+
+// resetCallGraphProfile
+
+void VM::resetCallGraphProfile() { engine->resetCallGraphProfile(); }
+
+// setAllocationProfile
+
+bool VM::setAllocationProfile(bool enable, uint32_t samplePeriod,
+                              const char *reportPath) {
+  return engine->setAllocationProfile(enable, samplePeriod, reportPath);
+}
+
+// getAllocationProfile
+
+AllocationStats VM::getAllocationProfile() const {
+  return engine->getAllocationProfile();
+}
+
+// getAllocationSites
+
+std::vector<AllocationSite> VM::getAllocationSites(size_t topN) const {
+  return engine->getAllocationSites(topN);
+}
+
+// resetAllocationProfile
+
+void VM::resetAllocationProfile() { engine->resetAllocationProfile(); }
+
+// setHardwareSampling
+
+bool VM::setHardwareSampling(HardwareEvent event, uint64_t period) {
+  return engine->setHardwareSampling(event, period);
+}
+
+// getHardwareSamples
+
+std::vector<HardwareSample> VM::getHardwareSamples(size_t topN) const {
+  return engine->getHardwareSamples(topN);
+}
+
+// resetHardwareSamples
+
+void VM::resetHardwareSamples() { engine->resetHardwareSamples(); }
+
+// getTranslationProfile
+
+TranslationProfile VM::getTranslationProfile() const {
+  return engine->getTranslationProfile();
+}
+
 } // namespace QBDI
@@ -15,6 +15,7 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <algorithm>
 #include <stdarg.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -25,6 +26,7 @@
 #include "QBDI/Errors.h"
 #include "QBDI/InstAnalysis.h"
 #include "QBDI/Options.h"
+#include "QBDI/Range.h"
 #include "QBDI/State.h"
 #include "QBDI/VM.h"
 #include "QBDI/VM_C.h"
@@ -73,6 +75,26 @@ bool qbdi_addInstrumentedModuleFromAddr(VMInstanceRef instance, rword addr) {
   return static_cast<VM *>(instance)->addInstrumentedModuleFromAddr(addr);
 }
 
+bool qbdi_addInstrumentedFunction(VMInstanceRef instance, const char *name) {
+  QBDI_REQUIRE_ACTION(instance, return false);
+  QBDI_REQUIRE_ACTION(name, return false);
+  return static_cast<VM *>(instance)->addInstrumentedFunction(
+      std::string(name));
+}
+
+bool qbdi_addInstrumentedFunctionFromAddr(VMInstanceRef instance, rword addr) {
+  QBDI_REQUIRE_ACTION(instance, return false);
+  return static_cast<VM *>(instance)->addInstrumentedFunctionFromAddr(addr);
+}
+
+bool qbdi_addInstrumentedFunctionRegex(VMInstanceRef instance,
+                                       const char *pattern) {
+  QBDI_REQUIRE_ACTION(instance, return false);
+  QBDI_REQUIRE_ACTION(pattern, return false);
+  return static_cast<VM *>(instance)->addInstrumentedFunctionRegex(
+      std::string(pattern));
+}
+
 bool qbdi_instrumentAllExecutableMaps(VMInstanceRef instance) {
   QBDI_REQUIRE_ACTION(instance, return false);
   return static_cast<VM *>(instance)->instrumentAllExecutableMaps();
@@ -89,6 +111,16 @@ void qbdi_removeAllInstrumentedRanges(VMInstanceRef instance) {
   static_cast<VM *>(instance)->removeAllInstrumentedRanges();
 }
 
+void qbdi_setModuleTracking(VMInstanceRef instance, ModuleTracking tracking) {
+  QBDI_REQUIRE_ACTION(instance, return );
+  static_cast<VM *>(instance)->setModuleTracking(tracking);
+}
+
+ModuleTracking qbdi_getModuleTracking(VMInstanceRef instance) {
+  QBDI_REQUIRE_ACTION(instance, return NO_MODULE_TRACKING);
+  return static_cast<VM *>(instance)->getModuleTracking();
+}
+
 bool qbdi_removeInstrumentedModule(VMInstanceRef instance, const char *name) {
   QBDI_REQUIRE_ACTION(instance, return false);
   return static_cast<VM *>(instance)->removeInstrumentedModule(
@@ -105,6 +137,24 @@ bool qbdi_run(VMInstanceRef instance, rword start, rword stop) {
   return static_cast<VM *>(instance)->run(start, stop);
 }
 
+bool qbdi_runUntil(VMInstanceRef instance, rword start, const rword *stops,
+                   size_t nbStops) {
+  QBDI_REQUIRE_ACTION(instance, return false);
+  QBDI_REQUIRE_ACTION(stops != nullptr or nbStops == 0, return false);
+  return static_cast<VM *>(instance)->runUntil(
+      start, std::vector<rword>(stops, stops + nbStops));
+}
+
+SliceStatus qbdi_runFor(VMInstanceRef instance, rword stop, rword budget) {
+  QBDI_REQUIRE_ACTION(instance, return SliceStatus::SLICE_NOT_RUN);
+  return static_cast<VM *>(instance)->runFor(stop, budget);
+}
+
+bool qbdi_step(VMInstanceRef instance) {
+  QBDI_REQUIRE_ACTION(instance, return false);
+  return static_cast<VM *>(instance)->step();
+}
+
 bool qbdi_call(VMInstanceRef instance, rword *retval, rword function,
                uint32_t argNum, ...) {
   QBDI_REQUIRE_ACTION(instance, return false);
@@ -127,6 +177,26 @@ bool qbdi_callA(VMInstanceRef instance, rword *retval, rword function,
   return static_cast<VM *>(instance)->callA(retval, function, argNum, args);
 }
 
+bool qbdi_setInstructionBudget(VMInstanceRef instance, rword budget) {
+  QBDI_REQUIRE_ACTION(instance, return false);
+  return static_cast<VM *>(instance)->setInstructionBudget(budget);
+}
+
+rword qbdi_getInstructionBudget(VMInstanceRef instance) {
+  QBDI_REQUIRE_ACTION(instance, return 0);
+  return static_cast<VM *>(instance)->getInstructionBudget();
+}
+
+bool qbdi_setStopPolling(VMInstanceRef instance, bool enable) {
+  QBDI_REQUIRE_ACTION(instance, return false);
+  return static_cast<VM *>(instance)->setStopPolling(enable);
+}
+
+void qbdi_requestStop(VMInstanceRef instance) {
+  QBDI_REQUIRE_ACTION(instance, return );
+  static_cast<VM *>(instance)->requestStop();
+}
+
 GPRState *qbdi_getGPRState(VMInstanceRef instance) {
   QBDI_REQUIRE_ACTION(instance, return nullptr);
   return static_cast<VM *>(instance)->getGPRState();
@@ -157,6 +227,18 @@ void qbdi_setOptions(VMInstanceRef instance, Options options) {
   static_cast<VM *>(instance)->setOptions(options);
 }
 
+void qbdi_getExecBlockSize(VMInstanceRef instance, uint32_t *codeSize,
+                           uint32_t *dataSize) {
+  QBDI_REQUIRE_ACTION(instance, return );
+  static_cast<VM *>(instance)->getExecBlockSize(codeSize, dataSize);
+}
+
+bool qbdi_setExecBlockSize(VMInstanceRef instance, uint32_t codeSize,
+                           uint32_t dataSize) {
+  QBDI_REQUIRE_ACTION(instance, return false);
+  return static_cast<VM *>(instance)->setExecBlockSize(codeSize, dataSize);
+}
+
 uint32_t qbdi_addMnemonicCB(VMInstanceRef instance, const char *mnemonic,
                             InstPosition pos, InstCallback cbk, void *data,
                             int priority) {
@@ -179,6 +261,17 @@ uint32_t qbdi_addCodeAddrCB(VMInstanceRef instance, rword address,
                                                     priority);
 }
 
+uint32_t qbdi_addCodeAddrSetCB(VMInstanceRef instance, const rword *addresses,
+                               size_t nbAddresses, InstPosition pos,
+                               InstCallback cbk, void *data, int priority) {
+  QBDI_REQUIRE_ACTION(instance, return VMError::INVALID_EVENTID);
+  QBDI_REQUIRE_ACTION(addresses != nullptr or nbAddresses == 0,
+                      return VMError::INVALID_EVENTID);
+  return static_cast<VM *>(instance)->addCodeAddrSetCB(
+      std::vector<rword>(addresses, addresses + nbAddresses), pos, cbk, data,
+      priority);
+}
+
 uint32_t qbdi_addCodeRangeCB(VMInstanceRef instance, rword start, rword end,
                              InstPosition pos, InstCallback cbk, void *data,
                              int priority) {
@@ -187,12 +280,158 @@ uint32_t qbdi_addCodeRangeCB(VMInstanceRef instance, rword start, rword end,
                                                      priority);
 }
 
+uint32_t qbdi_addCodeCBIf(VMInstanceRef instance, InstPosition pos,
+                          const CallbackPredicate *predicate, InstCallback cbk,
+                          void *data, int priority) {
+  QBDI_REQUIRE_ACTION(instance, return VMError::INVALID_EVENTID);
+  QBDI_REQUIRE_ACTION(predicate, return VMError::INVALID_EVENTID);
+  return static_cast<VM *>(instance)->addCodeCBIf(pos, *predicate, cbk, data,
+                                                  priority);
+}
+
+uint32_t qbdi_addCodeRangeCBIf(VMInstanceRef instance, rword start, rword end,
+                               InstPosition pos,
+                               const CallbackPredicate *predicate,
+                               InstCallback cbk, void *data, int priority) {
+  QBDI_REQUIRE_ACTION(instance, return VMError::INVALID_EVENTID);
+  QBDI_REQUIRE_ACTION(predicate, return VMError::INVALID_EVENTID);
+  return static_cast<VM *>(instance)->addCodeRangeCBIf(
+      start, end, pos, *predicate, cbk, data, priority);
+}
+
+uint32_t qbdi_addCodeCBLight(VMInstanceRef instance, InstPosition pos,
+                             InstCallback cbk, void *data,
+                             CallbackFootprint footprint, int priority) {
+  QBDI_REQUIRE_ACTION(instance, return VMError::INVALID_EVENTID);
+  return static_cast<VM *>(instance)->addCodeCBLight(pos, cbk, data,
+                                                     footprint, priority);
+}
+
+uint32_t qbdi_addCodeRangeCBLight(VMInstanceRef instance, rword start,
+                                  rword end, InstPosition pos,
+                                  InstCallback cbk, void *data,
+                                  CallbackFootprint footprint, int priority) {
+  QBDI_REQUIRE_ACTION(instance, return VMError::INVALID_EVENTID);
+  return static_cast<VM *>(instance)->addCodeRangeCBLight(
+      start, end, pos, cbk, data, footprint, priority);
+}
+
+uint32_t qbdi_addCodeAnalysisCB(VMInstanceRef instance, InstPosition pos,
+                                InstAnalysisCallback cbk, void *data,
+                                AnalysisType type, int priority) {
+  QBDI_REQUIRE_ACTION(instance, return VMError::INVALID_EVENTID);
+  return static_cast<VM *>(instance)->addCodeAnalysisCB(pos, cbk, data, type,
+                                                        priority);
+}
+
+uint32_t qbdi_addCodeRangeAnalysisCB(VMInstanceRef instance, rword start,
+                                     rword end, InstPosition pos,
+                                     InstAnalysisCallback cbk, void *data,
+                                     AnalysisType type, int priority) {
+  QBDI_REQUIRE_ACTION(instance, return VMError::INVALID_EVENTID);
+  return static_cast<VM *>(instance)->addCodeRangeAnalysisCB(
+      start, end, pos, cbk, data, type, priority);
+}
+
+uint32_t qbdi_addCodeCounter(VMInstanceRef instance, rword start, rword end,
+                             InstPosition pos, uint64_t **counter,
+                             int priority) {
+  QBDI_REQUIRE_ACTION(instance, return VMError::INVALID_EVENTID);
+  return static_cast<VM *>(instance)->addCodeCounter(start, end, pos, counter,
+                                                     priority);
+}
+
+bool qbdi_setMemoryTrace(VMInstanceRef instance, MemoryAccessType type,
+                         MemoryTraceCallback cbk, void *data,
+                         size_t capacity) {
+  QBDI_REQUIRE_ACTION(instance, return false);
+  return static_cast<VM *>(instance)->setMemoryTrace(type, cbk, data,
+                                                     capacity);
+}
+
+bool qbdi_setCallTrace(VMInstanceRef instance, CallTraceCallback cbk,
+                       void *data, uint32_t nbArgs, size_t capacity) {
+  QBDI_REQUIRE_ACTION(instance, return false);
+  return static_cast<VM *>(instance)->setCallTrace(cbk, data, nbArgs,
+                                                   capacity);
+}
+
+bool qbdi_setCallTraceArity(VMInstanceRef instance, rword target,
+                            uint32_t nbArgs) {
+  QBDI_REQUIRE_ACTION(instance, return false);
+  return static_cast<VM *>(instance)->setCallTraceArity(target, nbArgs);
+}
+
+bool qbdi_setPageHistogram(VMInstanceRef instance, bool enable,
+                           MemoryAccessType type) {
+  QBDI_REQUIRE_ACTION(instance, return false);
+  return static_cast<VM *>(instance)->setPageHistogram(enable, type);
+}
+
+size_t qbdi_getPageHistogram(VMInstanceRef instance, PageAccessStats *buffer,
+                             size_t capacity) {
+  QBDI_REQUIRE_ACTION(instance, return 0);
+  std::vector<PageAccessStats> stats =
+      static_cast<VM *>(instance)->getPageHistogram();
+  if (buffer != nullptr) {
+    std::copy_n(stats.begin(), std::min(capacity, stats.size()), buffer);
+  }
+  return stats.size();
+}
+
+void qbdi_resetPageHistogram(VMInstanceRef instance) {
+  QBDI_REQUIRE_ACTION(instance, return );
+  static_cast<VM *>(instance)->resetPageHistogram();
+}
+
+bool qbdi_setCoverageBitmap(VMInstanceRef instance, uint8_t *bitmap,
+                            size_t size, CoverageMode mode) {
+  QBDI_REQUIRE_ACTION(instance, return false);
+  return static_cast<VM *>(instance)->setCoverageBitmap(bitmap, size, mode);
+}
+
+void qbdi_resetCoverage(VMInstanceRef instance) {
+  QBDI_REQUIRE_ACTION(instance, return );
+  static_cast<VM *>(instance)->resetCoverage();
+}
+
+bool qbdi_addPlan(VMInstanceRef instance, const PlanStep *steps,
+                  size_t nbSteps, uint32_t *ids) {
+  QBDI_REQUIRE_ACTION(instance, return false);
+  return static_cast<VM *>(instance)->addPlan(steps, nbSteps, ids);
+}
+
+void qbdi_takeSnapshot(VMInstanceRef instance, const rword *ranges,
+                       size_t nbRanges) {
+  QBDI_REQUIRE_ACTION(instance, return );
+  QBDI_REQUIRE_ACTION(ranges != nullptr or nbRanges == 0, return );
+  RangeSet<rword> rangeSet;
+  for (size_t i = 0; i < nbRanges; i++) {
+    rangeSet.add(Range<rword>(ranges[2 * i], ranges[2 * i + 1]));
+  }
+  static_cast<VM *>(instance)->takeSnapshot(rangeSet);
+}
+
+bool qbdi_restoreSnapshot(VMInstanceRef instance) {
+  QBDI_REQUIRE_ACTION(instance, return false);
+  return static_cast<VM *>(instance)->restoreSnapshot();
+}
+
 uint32_t qbdi_addMemAccessCB(VMInstanceRef instance, MemoryAccessType type,
                              InstCallback cbk, void *data, int priority) {
   QBDI_REQUIRE_ACTION(instance, return VMError::INVALID_EVENTID);
   return static_cast<VM *>(instance)->addMemAccessCB(type, cbk, data, priority);
 }
 
+uint32_t qbdi_addMemAccessCBIf(VMInstanceRef instance, MemoryAccessType type,
+                               const CallbackPredicate *predicate,
+                               InstCallback cbk, void *data, int priority) {
+  QBDI_REQUIRE_ACTION(instance, return VMError::INVALID_EVENTID);
+  QBDI_REQUIRE_ACTION(predicate, return VMError::INVALID_EVENTID);
+  return static_cast<VM *>(instance)->addMemAccessCBIf(type, *predicate, cbk,
+                                                       data, priority);
+}
+
 uint32_t qbdi_addMemAddrCB(VMInstanceRef instance, rword address,
                            MemoryAccessType type, InstCallback cbk,
                            void *data) {
@@ -208,17 +447,59 @@ uint32_t qbdi_addMemRangeCB(VMInstanceRef instance, rword start, rword end,
                                                     data);
 }
 
+uint32_t qbdi_addBBMemAccessCB(VMInstanceRef instance, MemoryAccessType type,
+                               BBMemAccessCallback cbk, void *data) {
+  QBDI_REQUIRE_ACTION(instance, return VMError::INVALID_EVENTID);
+  return static_cast<VM *>(instance)->addBBMemAccessCB(type, cbk, data);
+}
+
 uint32_t qbdi_addVMEventCB(VMInstanceRef instance, VMEvent mask, VMCallback cbk,
                            void *data) {
   QBDI_REQUIRE_ACTION(instance, return VMError::INVALID_EVENTID);
   return static_cast<VM *>(instance)->addVMEventCB(mask, cbk, data);
 }
 
+bool qbdi_setNewBasicBlockBatch(VMInstanceRef instance,
+                                NewBasicBlockCallback cbk, void *data,
+                                size_t threshold) {
+  QBDI_REQUIRE_ACTION(instance, return false);
+  return static_cast<VM *>(instance)->setNewBasicBlockBatch(cbk, data,
+                                                            threshold);
+}
+
+uint32_t qbdi_addTransferHook(VMInstanceRef instance, rword target,
+                              VMCallback preCbk, VMCallback postCbk,
+                              void *data) {
+  QBDI_REQUIRE_ACTION(instance, return VMError::INVALID_EVENTID);
+  return static_cast<VM *>(instance)->addTransferHook(target, preCbk, postCbk,
+                                                      data);
+}
+
+uint32_t qbdi_addFunctionHook(VMInstanceRef instance, rword address,
+                              InstCallback onEntry, InstCallback onExit,
+                              void *data) {
+  QBDI_REQUIRE_ACTION(instance, return VMError::INVALID_EVENTID);
+  return static_cast<VM *>(instance)->addFunctionHook(address, onEntry, onExit,
+                                                      data);
+}
+
+uint32_t qbdi_replaceFunction(VMInstanceRef instance, rword orig,
+                              rword replacement) {
+  QBDI_REQUIRE_ACTION(instance, return VMError::INVALID_EVENTID);
+  return static_cast<VM *>(instance)->replaceFunction(orig, replacement);
+}
+
 bool qbdi_deleteInstrumentation(VMInstanceRef instance, uint32_t id) {
   QBDI_REQUIRE_ACTION(instance, return false);
   return static_cast<VM *>(instance)->deleteInstrumentation(id);
 }
 
+bool qbdi_setInstrumentationEnabled(VMInstanceRef instance, uint32_t id,
+                                    bool enable) {
+  QBDI_REQUIRE_ACTION(instance, return false);
+  return static_cast<VM *>(instance)->setInstrumentationEnabled(id, enable);
+}
+
 void qbdi_deleteAllInstrumentations(VMInstanceRef instance) {
   QBDI_REQUIRE_ACTION(instance, return );
   static_cast<VM *>(instance)->deleteAllInstrumentations();
@@ -238,11 +519,58 @@ const InstAnalysis *qbdi_getCachedInstAnalysis(const VMInstanceRef instance,
                                                                   type);
 }
 
+InstHandle qbdi_getInstHandle(const VMInstanceRef instance) {
+  QBDI_REQUIRE_ACTION(instance, return 0);
+  return static_cast<const VM *>(instance)->getInstHandle();
+}
+
+InstHandle qbdi_getCachedInstHandle(const VMInstanceRef instance,
+                                    rword address) {
+  QBDI_REQUIRE_ACTION(instance, return 0);
+  return static_cast<const VM *>(instance)->getCachedInstHandle(address);
+}
+
+const InstAnalysis *qbdi_getInstAnalysisByHandle(const VMInstanceRef instance,
+                                                 InstHandle handle,
+                                                 AnalysisType type) {
+  QBDI_REQUIRE_ACTION(instance, return nullptr);
+  return static_cast<const VM *>(instance)->getInstAnalysisByHandle(handle,
+                                                                    type);
+}
+
+size_t qbdi_iterateCache(const VMInstanceRef instance, CachedInstCallback cbk,
+                         void *data, AnalysisType type) {
+  QBDI_REQUIRE_ACTION(instance, return 0);
+  return static_cast<const VM *>(instance)->iterateCache(cbk, data, type);
+}
+
+size_t qbdi_analyzeRange(const VMInstanceRef instance, rword start, rword end,
+                         InstAnalysis *analyses, size_t count,
+                         AnalysisType type, bool basicBlock,
+                         unsigned nbThreads) {
+  QBDI_REQUIRE_ACTION(instance, return 0);
+  QBDI_REQUIRE_ACTION(analyses, return 0);
+  return static_cast<const VM *>(instance)->analyzeRange(
+      start, end, analyses, count, type, basicBlock, nbThreads);
+}
+
+void qbdi_releaseAnalyses(InstAnalysis *analyses, size_t count) {
+  QBDI_REQUIRE_ACTION(analyses, return);
+  VM::releaseAnalyses(analyses, count);
+}
+
 bool qbdi_recordMemoryAccess(VMInstanceRef instance, MemoryAccessType type) {
   QBDI_REQUIRE_ACTION(instance, return false);
   return static_cast<VM *>(instance)->recordMemoryAccess(type);
 }
 
+bool qbdi_recordMemoryAccessRange(VMInstanceRef instance, rword start,
+                                  rword end, MemoryAccessType type) {
+  QBDI_REQUIRE_ACTION(instance, return false);
+  return static_cast<VM *>(instance)->recordMemoryAccessRange(start, end,
+                                                              type);
+}
+
 MemoryAccess *qbdi_getInstMemoryAccess(VMInstanceRef instance, size_t *size) {
   QBDI_REQUIRE_ACTION(instance, return nullptr);
   QBDI_REQUIRE_ACTION(size, return nullptr);
@@ -283,19 +611,343 @@ MemoryAccess *qbdi_getBBMemoryAccess(VMInstanceRef instance, size_t *size) {
   return ma_arr;
 }
 
+size_t qbdi_getInstMemoryAccessBuffer(VMInstanceRef instance,
+                                      MemoryAccess *buffer, size_t capacity) {
+  QBDI_REQUIRE_ACTION(instance, return 0);
+  return static_cast<VM *>(instance)->getInstMemoryAccess(buffer, capacity);
+}
+
+size_t qbdi_getBBMemoryAccessBuffer(VMInstanceRef instance,
+                                    MemoryAccess *buffer, size_t capacity) {
+  QBDI_REQUIRE_ACTION(instance, return 0);
+  return static_cast<VM *>(instance)->getBBMemoryAccess(buffer, capacity);
+}
+
+bool qbdi_getMemoryAccessValue(VMInstanceRef instance,
+                               const MemoryAccess *access, void *buffer,
+                               size_t size) {
+  QBDI_REQUIRE_ACTION(instance, return false);
+  QBDI_REQUIRE_ACTION(access, return false);
+  return static_cast<VM *>(instance)->getMemoryAccessValue(*access, buffer,
+                                                           size);
+}
+
 bool qbdi_precacheBasicBlock(VMInstanceRef instance, rword pc) {
   QBDI_REQUIRE_ACTION(instance, return false);
   return static_cast<VM *>(instance)->precacheBasicBlock(pc);
 }
 
+size_t qbdi_precacheBasicBlocks(VMInstanceRef instance, const rword *addresses,
+                                size_t count) {
+  QBDI_REQUIRE_ACTION(instance, return 0);
+  QBDI_REQUIRE_ACTION(addresses != nullptr or count == 0, return 0);
+  return static_cast<VM *>(instance)->precacheBasicBlocks(
+      std::vector<rword>(addresses, addresses + count));
+}
+
+size_t qbdi_precacheRange(VMInstanceRef instance, rword start, rword end,
+                          const rword *entries, size_t count,
+                          bool useSymbols) {
+  QBDI_REQUIRE_ACTION(instance, return 0);
+  QBDI_REQUIRE_ACTION(entries != nullptr or count == 0, return 0);
+  return static_cast<VM *>(instance)->precacheRange(
+      start, end, std::vector<rword>(entries, entries + count), useSymbols);
+}
+
+size_t qbdi_precacheModule(VMInstanceRef instance, const char *name,
+                           const rword *entries, size_t count,
+                           bool useSymbols) {
+  QBDI_REQUIRE_ACTION(instance, return 0);
+  QBDI_REQUIRE_ACTION(name != nullptr, return 0);
+  QBDI_REQUIRE_ACTION(entries != nullptr or count == 0, return 0);
+  return static_cast<VM *>(instance)->precacheModule(
+      std::string(name), std::vector<rword>(entries, entries + count),
+      useSymbols);
+}
+
+size_t qbdi_precacheFrom(VMInstanceRef instance, VMInstanceRef other) {
+  QBDI_REQUIRE_ACTION(instance, return 0);
+  QBDI_REQUIRE_ACTION(other, return 0);
+  return static_cast<VM *>(instance)->precacheFrom(
+      *static_cast<VM *>(other));
+}
+
+bool qbdi_saveCacheProfile(VMInstanceRef instance, const char *path) {
+  QBDI_REQUIRE_ACTION(instance, return false);
+  return static_cast<VM *>(instance)->saveCacheProfile(path);
+}
+
+size_t qbdi_prewarmCache(VMInstanceRef instance, const char *path) {
+  QBDI_REQUIRE_ACTION(instance, return 0);
+  return static_cast<VM *>(instance)->prewarmCache(path);
+}
+
 void qbdi_clearAllCache(VMInstanceRef instance) {
   static_cast<VM *>(instance)->clearAllCache();
 }
 
+bool qbdi_sealCache(VMInstanceRef instance) {
+  QBDI_REQUIRE_ACTION(instance, return false);
+  return static_cast<VM *>(instance)->sealCache();
+}
+
 void qbdi_clearCache(VMInstanceRef instance, rword start, rword end) {
   static_cast<VM *>(instance)->clearCache(start, end);
 }
 
+size_t qbdi_getCacheLimit(VMInstanceRef instance) {
+  QBDI_REQUIRE_ACTION(instance, return 0);
+  return static_cast<VM *>(instance)->getCacheLimit();
+}
+
+void qbdi_setCacheLimit(VMInstanceRef instance, size_t limit) {
+  QBDI_REQUIRE_ACTION(instance, return );
+  static_cast<VM *>(instance)->setCacheLimit(limit);
+}
+
+void qbdi_getCacheStats(VMInstanceRef instance, CacheStats *stats) {
+  QBDI_REQUIRE_ACTION(instance, return );
+  QBDI_REQUIRE_ACTION(stats, return );
+  *stats = static_cast<VM *>(instance)->getCacheStats();
+}
+
+void qbdi_getMemoryStats(VMInstanceRef instance, MemoryStats *stats) {
+  QBDI_REQUIRE_ACTION(instance, return );
+  QBDI_REQUIRE_ACTION(stats, return );
+  *stats = static_cast<VM *>(instance)->getMemoryStats();
+}
+
+size_t qbdi_getTransferStats(VMInstanceRef instance, TransferStats *buffer,
+                             size_t capacity) {
+  QBDI_REQUIRE_ACTION(instance, return 0);
+  std::vector<TransferStats> stats =
+      static_cast<VM *>(instance)->getTransferStats();
+  if (buffer != nullptr) {
+    std::copy_n(stats.begin(), std::min(capacity, stats.size()), buffer);
+  }
+  return stats.size();
+}
+
+void qbdi_setExecStats(VMInstanceRef instance, bool enable) {
+  QBDI_REQUIRE_ACTION(instance, return );
+  static_cast<VM *>(instance)->setExecStats(enable);
+}
+
+void qbdi_getExecStats(VMInstanceRef instance, ExecStats *stats) {
+  QBDI_REQUIRE_ACTION(instance, return );
+  QBDI_REQUIRE_ACTION(stats, return );
+  *stats = static_cast<VM *>(instance)->getExecStats();
+}
+
+void qbdi_resetExecStats(VMInstanceRef instance) {
+  QBDI_REQUIRE_ACTION(instance, return );
+  static_cast<VM *>(instance)->resetExecStats();
+}
+
+void qbdi_setAutoDemotion(VMInstanceRef instance, uint32_t threshold) {
+  QBDI_REQUIRE_ACTION(instance, return );
+  static_cast<VM *>(instance)->setAutoDemotion(threshold);
+}
+
+size_t qbdi_getDemotedFunctions(VMInstanceRef instance, rword *buffer,
+                                size_t capacity) {
+  QBDI_REQUIRE_ACTION(instance, return 0);
+  std::vector<rword> functions =
+      static_cast<VM *>(instance)->getDemotedFunctions();
+  if (buffer != nullptr) {
+    std::copy_n(functions.begin(), std::min(capacity, functions.size()),
+                buffer);
+  }
+  return functions.size();
+}
+
+bool qbdi_setInstrRuleStats(VMInstanceRef instance, bool enable,
+                            const char *reportPath) {
+  QBDI_REQUIRE_ACTION(instance, return false);
+  return static_cast<VM *>(instance)->setInstrRuleStats(enable, reportPath);
+}
+
+size_t qbdi_getInstrRuleStats(VMInstanceRef instance, InstrRuleStats *buffer,
+                              size_t capacity) {
+  QBDI_REQUIRE_ACTION(instance, return 0);
+  std::vector<InstrRuleStats> stats =
+      static_cast<VM *>(instance)->getInstrRuleStats();
+  if (buffer != nullptr) {
+    std::copy_n(stats.begin(), std::min(capacity, stats.size()), buffer);
+  }
+  return stats.size();
+}
+
+void qbdi_resetInstrRuleStats(VMInstanceRef instance) {
+  QBDI_REQUIRE_ACTION(instance, return );
+  static_cast<VM *>(instance)->resetInstrRuleStats();
+}
+
+bool qbdi_setSequenceProfile(VMInstanceRef instance, bool enable,
+                             const char *reportPath) {
+  QBDI_REQUIRE_ACTION(instance, return false);
+  return static_cast<VM *>(instance)->setSequenceProfile(enable, reportPath);
+}
+
+size_t qbdi_getSequenceProfile(VMInstanceRef instance, SequenceStats *buffer,
+                               size_t capacity) {
+  QBDI_REQUIRE_ACTION(instance, return 0);
+  std::vector<SequenceStats> stats =
+      static_cast<VM *>(instance)->getSequenceProfile();
+  if (buffer != nullptr) {
+    std::copy_n(stats.begin(), std::min(capacity, stats.size()), buffer);
+  }
+  return stats.size();
+}
+
+void qbdi_resetSequenceProfile(VMInstanceRef instance) {
+  QBDI_REQUIRE_ACTION(instance, return );
+  static_cast<VM *>(instance)->resetSequenceProfile();
+}
+
+bool qbdi_setBranchProfile(VMInstanceRef instance, bool enable) {
+  QBDI_REQUIRE_ACTION(instance, return false);
+  return static_cast<VM *>(instance)->setBranchProfile(enable);
+}
+
+size_t qbdi_getBranchProfile(VMInstanceRef instance, BranchStats *buffer,
+                             size_t capacity) {
+  QBDI_REQUIRE_ACTION(instance, return 0);
+  std::vector<BranchStats> stats =
+      static_cast<VM *>(instance)->getBranchProfile();
+  if (buffer != nullptr) {
+    std::copy_n(stats.begin(), std::min(capacity, stats.size()), buffer);
+  }
+  return stats.size();
+}
+
+void qbdi_resetBranchProfile(VMInstanceRef instance) {
+  QBDI_REQUIRE_ACTION(instance, return );
+  static_cast<VM *>(instance)->resetBranchProfile();
+}
+
+bool qbdi_setIndirectProfile(VMInstanceRef instance, bool enable) {
+  QBDI_REQUIRE_ACTION(instance, return false);
+  return static_cast<VM *>(instance)->setIndirectProfile(enable);
+}
+
+size_t qbdi_getIndirectProfile(VMInstanceRef instance,
+                               IndirectTargetStats *buffer, size_t capacity) {
+  QBDI_REQUIRE_ACTION(instance, return 0);
+  std::vector<IndirectTargetStats> stats =
+      static_cast<VM *>(instance)->getIndirectProfile();
+  if (buffer != nullptr) {
+    std::copy_n(stats.begin(), std::min(capacity, stats.size()), buffer);
+  }
+  return stats.size();
+}
+
+void qbdi_resetIndirectProfile(VMInstanceRef instance) {
+  QBDI_REQUIRE_ACTION(instance, return );
+  static_cast<VM *>(instance)->resetIndirectProfile();
+}
+
+uint32_t qbdi_addValueProfile(VMInstanceRef instance, rword address,
+                              uint32_t reg, size_t buckets) {
+  QBDI_REQUIRE_ACTION(instance, return VMError::INVALID_EVENTID);
+  return static_cast<VM *>(instance)->addValueProfile(address, reg, buckets);
+}
+
+size_t qbdi_getValueProfile(VMInstanceRef instance, uint32_t id,
+                            ValueStats *buffer, size_t capacity) {
+  QBDI_REQUIRE_ACTION(instance, return 0);
+  std::vector<ValueStats> stats =
+      static_cast<VM *>(instance)->getValueProfile(id);
+  if (buffer != nullptr) {
+    std::copy_n(stats.begin(), std::min(capacity, stats.size()), buffer);
+  }
+  return stats.size();
+}
+
+bool qbdi_resetValueProfile(VMInstanceRef instance, uint32_t id) {
+  QBDI_REQUIRE_ACTION(instance, return false);
+  return static_cast<VM *>(instance)->resetValueProfile(id);
+}
+
+bool qbdi_setCallGraphProfile(VMInstanceRef instance, bool enable) {
+  QBDI_REQUIRE_ACTION(instance, return false);
+  return static_cast<VM *>(instance)->setCallGraphProfile(enable);
+}
+
+size_t qbdi_getCallGraphProfile(VMInstanceRef instance,
+                                CallGraphEdgeStats *buffer, size_t capacity) {
+  QBDI_REQUIRE_ACTION(instance, return 0);
+  std::vector<CallGraphEdgeStats> stats =
+      static_cast<VM *>(instance)->getCallGraphProfile();
+  if (buffer != nullptr) {
+    std::copy_n(stats.begin(), std::min(capacity, stats.size()), buffer);
+  }
+  return stats.size();
+}
+
+void qbdi_resetCallGraphProfile(VMInstanceRef instance) {
+  QBDI_REQUIRE_ACTION(instance, return );
+  static_cast<VM *>(instance)->resetCallGraphProfile();
+}
+
+bool qbdi_setAllocationProfile(VMInstanceRef instance, bool enable,
+                               uint32_t samplePeriod, const char *reportPath) {
+  QBDI_REQUIRE_ACTION(instance, return false);
+  return static_cast<VM *>(instance)->setAllocationProfile(enable, samplePeriod,
+                                                           reportPath);
+}
+
+void qbdi_getAllocationProfile(VMInstanceRef instance, AllocationStats *stats) {
+  QBDI_REQUIRE_ACTION(instance, return );
+  QBDI_REQUIRE_ACTION(stats, return );
+  *stats = static_cast<VM *>(instance)->getAllocationProfile();
+}
+
+size_t qbdi_getAllocationSites(VMInstanceRef instance, AllocationSite *buffer,
+                               size_t capacity) {
+  QBDI_REQUIRE_ACTION(instance, return 0);
+  std::vector<AllocationSite> sites =
+      static_cast<VM *>(instance)->getAllocationSites();
+  if (buffer != nullptr) {
+    std::copy_n(sites.begin(), std::min(capacity, sites.size()), buffer);
+  }
+  return sites.size();
+}
+
+void qbdi_resetAllocationProfile(VMInstanceRef instance) {
+  QBDI_REQUIRE_ACTION(instance, return );
+  static_cast<VM *>(instance)->resetAllocationProfile();
+}
+
+bool qbdi_setHardwareSampling(VMInstanceRef instance, HardwareEvent event,
+                              uint64_t period) {
+  QBDI_REQUIRE_ACTION(instance, return false);
+  return static_cast<VM *>(instance)->setHardwareSampling(event, period);
+}
+
+size_t qbdi_getHardwareSamples(VMInstanceRef instance, HardwareSample *buffer,
+                               size_t capacity) {
+  QBDI_REQUIRE_ACTION(instance, return 0);
+  std::vector<HardwareSample> samples =
+      static_cast<VM *>(instance)->getHardwareSamples();
+  if (buffer != nullptr) {
+    std::copy_n(samples.begin(), std::min(capacity, samples.size()), buffer);
+  }
+  return samples.size();
+}
+
+void qbdi_resetHardwareSamples(VMInstanceRef instance) {
+  QBDI_REQUIRE_ACTION(instance, return );
+  static_cast<VM *>(instance)->resetHardwareSamples();
+}
+
+void qbdi_getTranslationProfile(VMInstanceRef instance,
+                                TranslationProfile *profile) {
+  QBDI_REQUIRE_ACTION(instance, return );
+  QBDI_REQUIRE_ACTION(profile, return );
+  *profile = static_cast<VM *>(instance)->getTranslationProfile();
+}
+
 uint32_t qbdi_addInstrRule(VMInstanceRef instance, InstrRuleCallbackC cbk,
                            AnalysisType type, void *data) {
   QBDI_REQUIRE_ACTION(instance, return VMError::INVALID_EVENTID);
@@ -18,6 +18,9 @@
 #ifndef QBDI_VM_INTERNAL_H_
 #define QBDI_VM_INTERNAL_H_
 
+#include <unordered_map>
+#include <vector>
+
 #include "QBDI/VM.h"
 
 namespace QBDI {
@@ -29,11 +32,95 @@ struct MemCBInfo {
   void *data;
 };
 
-struct InstrCBInfo {
-  Range<rword> range;
-  InstrRuleCallbackC cbk;
-  AnalysisType type;
+/*! The callbacks of addMemRangeCB, sorted by the start of their range. Shared
+ * by memReadGate and memWriteGate.
+ */
+struct MemCBIndex {
+  Engine *engine;
+  std::vector<std::pair<uint32_t, MemCBInfo>> infos;
+  // maximal end of the ranges of infos[0..i], to skip the ranges that end
+  // before an access
+  std::vector<rword> maxEnd;
+
+  // OPT_ENABLE_MEMCB_PAGE_WATCH: the pages of the ranges are protected and the
+  // gates are only added on the sequences which have faulted on them.
+  uint32_t pageWatchCBID = VMError::INVALID_EVENTID;
+  RangeSet<rword> promoted;
+  // the gates of the promoted ranges
+  std::vector<uint32_t> promotedIDs;
+  // the gates of the promoted ranges: MEMORY_READ for memReadGate,
+  // MEMORY_WRITE for memWriteGate
+  uint8_t promotedType = 0;
+  // reused for each sequence
+  std::vector<rword> faults;
+
+  MemCBIndex() = default;
+  MemCBIndex(const MemCBIndex &) = default;
+  MemCBIndex &operator=(const MemCBIndex &) = default;
+  ~MemCBIndex();
+
+  void add(uint32_t id, const MemCBInfo &info);
+  bool remove(uint32_t id);
+  MemCBInfo *find(uint32_t id);
+  void clear();
+  // protect again the pages of the ranges for this index
+  bool watch();
+  // the gates needed by the ranges, as promotedType
+  uint8_t neededGates() const;
+  // record the accesses and add the gates on a range of instructions
+  void promote(VM *vm, Range<rword> range);
+  // remove the gates of all the promoted ranges, the accesses stay recorded
+  void resetPromotion();
+
+private:
+  void updateMaxEnd();
+};
+
+struct BBMemAccessCBInfo {
+  MemoryAccessType type;
+  BBMemAccessCallback cbk;
+  void *data;
+  const Engine *engine;
+  // reused for each sequence
+  std::vector<MemoryAccess> accesses;
+};
+
+// A call of a function hooked by addFunctionHook, not returned yet
+struct FunctionHookFrame {
+  rword returnAddress;
+  // stack pointer at the entry of the function
+  rword sp;
+};
+
+struct FunctionHookInfo {
+  InstCallback onEntry;
+  InstCallback onExit;
   void *data;
+  // gate on the return address of each caller, added at its first call
+  std::unordered_map<rword, uint32_t> exitIDs;
+  // shadow call stack of the hooked function
+  std::vector<FunctionHookFrame> frames;
+  // the entry is executed again after the BREAK_TO_VM of a new exit gate
+  bool pendingEntry = false;
+};
+
+struct VMSnapshot {
+  GPRState gprState;
+  FPRState fprState;
+  RangeSet<rword> ranges;
+  std::vector<std::pair<Range<rword>, std::vector<uint8_t>>> memory;
+  // the pages written in the ranges are tracked with this snapshot as owner,
+  // only the written pages are restored
+  bool dirtyTracking = false;
+
+  VMSnapshot() = default;
+  // the pages written before the copy are unknown, the first restore of the
+  // copy restores all the ranges
+  VMSnapshot(const VMSnapshot &other)
+      : gprState(other.gprState), fprState(other.fprState),
+        ranges(other.ranges), memory(other.memory) {}
+  VMSnapshot &operator=(const VMSnapshot &) = delete;
+  ~VMSnapshot();
 };
 
 VMAction memReadGate(VMInstanceRef vm, GPRState *gprState, FPRState *fprState,
@@ -42,8 +129,17 @@ VMAction memReadGate(VMInstanceRef vm, GPRState *gprState, FPRState *fprState,
 VMAction memWriteGate(VMInstanceRef vm, GPRState *gprState, FPRState *fprState,
                       void *data);
 
-std::vector<InstrRuleDataCBK>
-InstrCBGateC(VMInstanceRef vm, const InstAnalysis *inst, void *_data);
+VMAction pageWatchGate(VMInstanceRef vm, const VMState *vmState,
+                       GPRState *gprState, FPRState *fprState, void *data);
+
+VMAction BBMemAccessGate(VMInstanceRef vm, const VMState *vmState,
+                         GPRState *gprState, FPRState *fprState, void *data);
+
+VMAction functionEntryGate(VMInstanceRef vm, GPRState *gprState,
+                           FPRState *fprState, void *data);
+
+VMAction functionExitGate(VMInstanceRef vm, GPRState *gprState,
+                          FPRState *fprState, void *data);
 
 VMAction VMCBLambdaProxy(VMInstanceRef vm, const VMState *vmState,
                          GPRState *gprState, FPRState *fprState, void *_data);
@@ -52,6 +148,12 @@ VMAction InstCBLambdaProxy(VMInstanceRef vm, GPRState *gprState,
 
 std::vector<InstrRuleDataCBK>
 InstrRuleCBLambdaProxy(VMInstanceRef vm, const InstAnalysis *ana, void *_data);
+void InstrRuleFillCBLambdaProxy(VMInstanceRef vm, const InstAnalysis *ana,
+                                InstrRuleDataVec cbks, void *_data);
+void InstrRuleBBCBLambdaProxy(VMInstanceRef vm,
+                              const std::vector<const InstAnalysis *> &block,
+                              std::vector<std::vector<InstrRuleDataCBK>> &cbks,
+                              void *_data);
 
 VMAction stopCallback(VMInstanceRef vm, GPRState *gprState, FPRState *fprState,
                       void *data);
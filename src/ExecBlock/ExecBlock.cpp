@@ -17,21 +17,26 @@
  */
 #include <algorithm>
 #include <iterator>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <string>
 #include <system_error>
 
 #include "llvm/ADT/Optional.h"
 #include "llvm/MC/MCDisassembler/MCDisassembler.h"
 #include "llvm/MC/MCInst.h"
+#include "llvm/MC/MCInstrInfo.h"
 #include "llvm/Support/Error.h"
+#include "llvm/Support/MathExtras.h"
 #include "llvm/Support/Process.h"
 
 #include "Engine/LLVMCPU.h"
 #include "ExecBlock/Context.h"
 #include "ExecBlock/ExecBlock.h"
 #include "Patch/ExecBlockFlags.h"
+#include "Patch/MemoryAccess.h"
 #include "Patch/Patch.h"
 #include "Patch/PatchGenerator.h"
 #include "Patch/PatchRules.h"
@@ -40,6 +45,9 @@
 #include "Patch/Types.h"
 #include "Utility/InstAnalysis_prive.h"
 #include "Utility/LogSys.h"
+#include "Utility/PerfMap.h"
+#include "Utility/Profiler.h"
+#include "Utility/Symbol.h"
 #include "Utility/System.h"
 #include "Utility/memory_ostream.h"
 
@@ -48,13 +56,54 @@
 
 namespace QBDI {
 
+namespace {
+
+// last id of getHostVisit() given in the thread
+thread_local uint64_t lastHostVisit = 0;
+
+// Permissions of the memory of a new ExecBlock
+unsigned getBlockMemoryFlags() {
+  unsigned mflags = llvm::sys::Memory::MF_READ | llvm::sys::Memory::MF_WRITE;
+  if constexpr (is_ios)
+    mflags |= llvm::sys::Memory::MF_EXEC;
+  return mflags;
+}
+
+void countCallbackResult(ExecStats &stats, VMAction action) {
+  switch (action) {
+    case CONTINUE:
+      stats.callbackContinue++;
+      break;
+    case SKIP_INST:
+      stats.callbackSkipInst++;
+      break;
+    case SKIP_PATCH:
+      stats.callbackSkipPatch++;
+      break;
+    case BREAK_TO_VM:
+      stats.callbackBreakToVM++;
+      break;
+    case STOP:
+      stats.callbackStop++;
+      break;
+  }
+}
+
+} // anonymous namespace
+
 ExecBlock::ExecBlock(
     const LLVMCPUs &llvmCPUs, VMInstanceRef vminstance,
     const std::vector<std::unique_ptr<RelocatableInst>> *execBlockPrologue,
     const std::vector<std::unique_ptr<RelocatableInst>> *execBlockEpilogue,
-    uint32_t epilogueSize_)
-    : vminstance(vminstance), llvmCPUs(llvmCPUs), epilogueSize(epilogueSize_),
-      isFull(false) {
+    uint32_t epilogueSize_, const SharedContext *sharedContext,
+    uint32_t codeSize, uint32_t dataSize, ExecBlockTemplate *blockTemplate,
+    rword nearAddress, ExecBlockAllocator *blockAllocator,
+    const ExecBlockTrampoline *trampoline)
+    : vminstance(vminstance), llvmCPUs(llvmCPUs), ibtcExecuteFlags(0xff),
+      ibtcHits(0), ibtcMisses(0), epilogueSize(epilogueSize_), isFull(false),
+      shadowsFull(false), hot(false), instrumented(false), sealed(false),
+      allocator(nullptr), registry(nullptr), registrySlot(0),
+      registryGeneration(0) {
 
   // Allocate memory blocks
   std::error_code ec;
@@ -64,37 +113,134 @@ ExecBlock::ExecBlock(
       is_ios ? 4096
              : llvm::expectedToOptional(llvm::sys::Process::getPageSize())
                    .getValueOr(4096);
-  unsigned mflags = PF::MF_READ | PF::MF_WRITE;
-
-  if constexpr (is_ios)
-    mflags |= PF::MF_EXEC;
-
-  // Allocate 2 pages block
-  codeBlock = QBDI::allocateMappedMemory(2 * pageSize, nullptr, mflags, ec);
-  QBDI_REQUIRE_ACTION(codeBlock.base() != nullptr, abort());
-  // Split it in two blocks
-  dataBlock = llvm::sys::MemoryBlock(
-      reinterpret_cast<void *>(reinterpret_cast<uint64_t>(codeBlock.base()) +
-                               pageSize),
-      pageSize);
-  codeBlock = llvm::sys::MemoryBlock(codeBlock.base(), pageSize);
+  unsigned mflags = getBlockMemoryFlags();
+
+  // Round the sizes to the page size, one page by default
+  QBDI_REQUIRE_ACTION(codeSize <= MAX_CODE_BLOCK_SIZE, abort());
+  QBDI_REQUIRE_ACTION(dataSize <= MAX_DATA_BLOCK_SIZE, abort());
+  size_t codeBlockSize =
+      codeSize == 0 ? pageSize : llvm::alignTo(codeSize, pageSize);
+  size_t dataBlockSize =
+      dataSize == 0 ? pageSize : llvm::alignTo(dataSize, pageSize);
+  QBDI_REQUIRE_ACTION(codeBlockSize <= MAX_CODE_BLOCK_SIZE, abort());
+  // The shared context needs one more page in front of the data block
+  if (sharedContext != nullptr) {
+    dataBlockSize += pageSize;
+  }
+  // The memory operands of the code are accessed with a rel32 displacement
+  // when the block is near enough
+  if (nearAddress != 0) {
+    codeBlock = QBDI::allocateNearMappedMemory(codeBlockSize + dataBlockSize,
+                                               nearAddress,
+                                               NEAR_EXEC_BLOCK_DISTANCE, mflags,
+                                               ec);
+  } else if (blockAllocator != nullptr and
+             (llvmCPUs.getOptions() & Options::OPT_ENABLE_DUAL_MAPPING) == 0) {
+    if (blockAllocator->allocate(codeBlockSize, dataBlockSize, codeBlock,
+                                 dataBlock)) {
+      allocator = blockAllocator;
+    }
+  }
+  if (allocator == nullptr) {
+    if (codeBlock.base() == nullptr) {
+      codeBlock = QBDI::allocateMappedMemory(codeBlockSize + dataBlockSize,
+                                             nullptr, mflags, ec);
+    }
+    QBDI_REQUIRE_ACTION(codeBlock.base() != nullptr, abort());
+    // Split it in two blocks
+    dataBlock = llvm::sys::MemoryBlock(
+        reinterpret_cast<void *>(reinterpret_cast<uint64_t>(codeBlock.base()) +
+                                 codeBlockSize),
+        dataBlockSize);
+    codeBlock = llvm::sys::MemoryBlock(codeBlock.base(), codeBlockSize);
+  }
+  codeWriteBlock = codeBlock;
+  dualMapped = false;
+  // Pages are RWX on iOS
+  if constexpr (not is_ios) {
+    if (llvmCPUs.getOptions() & Options::OPT_ENABLE_DUAL_MAPPING) {
+      // Replace the code block by an executable alias of a shared memory
+      // object. The code is written through a second writable alias and the
+      // permissions never change. The handle isn't needed once mapped.
+      int handle = QBDI::createSharedMemory(codeBlockSize);
+      if (handle >= 0) {
+        llvm::sys::MemoryBlock writeBlock =
+            QBDI::mapSharedMemory(handle, codeBlockSize, nullptr);
+        if (writeBlock.base() != nullptr) {
+          QBDI_REQUIRE_ACTION(
+              QBDI::mapSharedMemory(handle, codeBlockSize, codeBlock.base(),
+                                    PF::MF_READ | PF::MF_EXEC)
+                      .base() != nullptr,
+              abort());
+          codeWriteBlock = writeBlock;
+          dualMapped = true;
+        }
+        QBDI::releaseSharedMemory(handle);
+      }
+      if (not dualMapped) {
+        QBDI_WARN("Dual mapping not available, change the permissions of the "
+                  "code block");
+      }
+    }
+  }
   QBDI_DEBUG("codeBlock @ 0x{:x} | dataBlock @ 0x{:x} | pageSize {} bytes",
              reinterpret_cast<rword>(codeBlock.base()),
              reinterpret_cast<rword>(dataBlock.base()), pageSize);
 
   // Other initializations
-  context = static_cast<Context *>(dataBlock.base());
+  if (sharedContext != nullptr) {
+    // Replace the first page of the data block by the shared context page.
+    // The host uses the canonical mapping of the context.
+    QBDI_REQUIRE_ACTION(QBDI::mapSharedMemory(sharedContext->handle, pageSize,
+                                              dataBlock.base())
+                                .base() != nullptr,
+                        abort());
+    context = sharedContext->context;
+    shadowsOffset = pageSize;
+  } else {
+    context = static_cast<Context *>(dataBlock.base());
+    shadowsOffset = sizeof(Context);
+    // the memory of a recycled block isn't zeroed
+    if (allocator != nullptr) {
+      memset(context, 0, sizeof(Context));
+    }
+  }
+  if (trampoline == nullptr) {
+    ownTrampoline = std::make_unique<ExecBlockTrampoline>(
+        llvmCPUs.getCPU(CPUMode::DEFAULT));
+    trampoline = ownTrampoline.get();
+  }
+  context->hostState.prologue = trampoline->getPrologue();
+  context->hostState.epilogue = trampoline->getEpilogue();
   shadows = reinterpret_cast<rword *>(
-      reinterpret_cast<rword>(dataBlock.base()) + sizeof(Context));
+      reinterpret_cast<rword>(dataBlock.base()) + shadowsOffset);
   shadowIdx = 0;
   currentSeq = 0;
+  currentEntry = 0;
   currentInst = 0;
-  codeStream = std::make_unique<memory_ostream>(codeBlock);
-  pageState = RW;
+  hostVisit = ++lastHostVisit;
+  codeStream = std::make_unique<memory_ostream>(codeWriteBlock);
+  pageState = dualMapped ? RX : RW;
 
   std::vector<std::unique_ptr<RelocatableInst>> execBlockPrologue_;
   std::vector<std::unique_ptr<RelocatableInst>> execBlockEpilogue_;
 
+  rword dataOffset =
+      getDataBlockBase() - reinterpret_cast<rword>(codeBlock.base());
+  if (blockTemplate != nullptr and not blockTemplate->epilogue.empty() and
+      blockTemplate->dataOffset == dataOffset) {
+    // Copy the prologue and the epilogue of the previous ExecBlocks
+    QBDI_REQUIRE_ACTION(blockTemplate->epilogue.size() == epilogueSize,
+                        abort());
+    uint8_t *code = static_cast<uint8_t *>(codeWriteBlock.base());
+    memcpy(code + codeBlock.allocatedSize() - epilogueSize,
+           blockTemplate->epilogue.data(), epilogueSize);
+    memcpy(code, blockTemplate->prologue.data(),
+           blockTemplate->prologue.size());
+    codeStream->seek(blockTemplate->prologue.size());
+    return;
+  }
+
   const LLVMCPU &llvmcpu = llvmCPUs.getCPU(CPUMode::DEFAULT);
 
   if (execBlockPrologue == nullptr) {
@@ -112,7 +258,7 @@ ExecBlock::ExecBlock(
       if (inst->getTag() != RelocatableInstTag::RelocInst) {
         continue;
       }
-      llvmcpu.writeInstruction(inst->reloc(this), codeStream.get());
+      writeRelocatableInst(*inst, llvmcpu);
     }
     epilogueSize = codeStream->current_pos();
     codeStream->seek(0);
@@ -124,7 +270,7 @@ ExecBlock::ExecBlock(
     if (inst->getTag() != RelocatableInstTag::RelocInst) {
       continue;
     }
-    llvmcpu.writeInstruction(inst->reloc(this), codeStream.get());
+    writeRelocatableInst(*inst, llvmcpu);
   }
   QBDI_REQUIRE_ACTION(codeStream->current_pos() == codeBlock.allocatedSize() &&
                           "Wrong Epilogue Size",
@@ -135,11 +281,232 @@ ExecBlock::ExecBlock(
     if (inst->getTag() != RelocatableInstTag::RelocInst) {
       continue;
     }
-    llvmcpu.writeInstruction(inst->reloc(this), codeStream.get());
+    writeRelocatableInst(*inst, llvmcpu);
+  }
+
+  if (blockTemplate != nullptr) {
+    const uint8_t *code = static_cast<const uint8_t *>(codeWriteBlock.base());
+    blockTemplate->prologue.assign(code, code + codeStream->current_pos());
+    blockTemplate->epilogue.assign(
+        code + codeBlock.allocatedSize() - epilogueSize,
+        code + codeBlock.allocatedSize());
+    blockTemplate->dataOffset = dataOffset;
   }
 }
 
+ExecBlockTrampoline::ExecBlockTrampoline(const LLVMCPU &llvmcpu) {
+  std::error_code ec;
+  uint64_t pageSize =
+      is_ios ? 4096
+             : llvm::expectedToOptional(llvm::sys::Process::getPageSize())
+                   .getValueOr(4096);
+  block = QBDI::allocateMappedMemory(pageSize, nullptr, getBlockMemoryFlags(),
+                                     ec);
+  QBDI_REQUIRE_ACTION(block.base() != nullptr, abort());
+
+  rword base = reinterpret_cast<rword>(block.base());
+  memory_ostream stream(block);
+  prologue = base;
+  for (const auto &inst :
+       getTrampolinePrologue(llvmcpu.getOptions(), llvmcpu)) {
+    llvmcpu.writeInstruction(inst->reloc(nullptr), &stream);
+  }
+  epilogue = base + stream.current_pos();
+  for (const auto &inst :
+       getTrampolineEpilogue(llvmcpu.getOptions(), llvmcpu)) {
+    llvmcpu.writeInstruction(inst->reloc(nullptr), &stream);
+  }
+  QBDI_REQUIRE_ACTION(stream.current_pos() <= pageSize, abort());
+  QBDI_DEBUG("Trampolines @ 0x{:x} | {} bytes", base, stream.current_pos());
+
+  if constexpr (not is_ios) {
+    QBDI_REQUIRE_ACTION(!llvm::sys::Memory::protectMappedMemory(
+                            block, llvm::sys::Memory::MF_READ |
+                                       llvm::sys::Memory::MF_EXEC),
+                        abort());
+  }
+  llvm::sys::Memory::InvalidateInstructionCache(block.base(),
+                                                block.allocatedSize());
+}
+
+ExecBlockTrampoline::~ExecBlockTrampoline() {
+  QBDI::releaseMappedMemory(block);
+}
+
+ExecBlockAllocator::~ExecBlockAllocator() {
+  for (llvm::sys::MemoryBlock &chunk : chunks) {
+    QBDI::releaseMappedMemory(chunk);
+  }
+}
+
+bool ExecBlockAllocator::allocate(size_t codeSize, size_t dataSize,
+                                  llvm::sys::MemoryBlock &codeBlock,
+                                  llvm::sys::MemoryBlock &dataBlock) {
+  for (FreeList &freeList : freeLists) {
+    if (freeList.codeSize == codeSize and freeList.dataSize == dataSize and
+        not freeList.blocks.empty()) {
+      const std::pair<void *, void *> &block = freeList.blocks.back();
+      codeBlock = llvm::sys::MemoryBlock(block.first, codeSize);
+      dataBlock = llvm::sys::MemoryBlock(block.second, dataSize);
+      freeList.blocks.pop_back();
+      return true;
+    }
+  }
+  bool fit;
+  if (chunks.empty()) {
+    fit = false;
+  } else if (hugePages) {
+    fit = codeUsed + codeSize <= CHUNK_SIZE and
+          dataUsed + dataSize <= CHUNK_SIZE;
+  } else {
+    fit = codeUsed + codeSize + dataSize <= chunks.back().allocatedSize();
+  }
+  if (not fit) {
+    std::error_code ec;
+    llvm::sys::MemoryBlock chunk;
+    if (hugePages) {
+      // the blocks are smaller than an area
+      chunk = QBDI::allocateHugeMappedMemory(2 * CHUNK_SIZE,
+                                             getBlockMemoryFlags(), ec);
+    } else {
+      chunk = QBDI::allocateMappedMemory(
+          std::max(codeSize + dataSize, static_cast<size_t>(CHUNK_SIZE)),
+          nullptr, getBlockMemoryFlags(), ec);
+    }
+    if (chunk.base() == nullptr) {
+      return false;
+    }
+    // the first chunk is bound to the thread which translates
+    if (numaBinding) {
+      if (numaNode < 0) {
+        numaNode = getCurrentNumaNode();
+      }
+      bindMemoryToNumaNode(chunk, numaNode);
+    }
+    chunks.push_back(chunk);
+    codeUsed = 0;
+    dataUsed = 0;
+  }
+  uint8_t *base = static_cast<uint8_t *>(chunks.back().base());
+  codeBlock = llvm::sys::MemoryBlock(base + codeUsed, codeSize);
+  if (hugePages) {
+    dataBlock = llvm::sys::MemoryBlock(base + CHUNK_SIZE + dataUsed, dataSize);
+    dataUsed += dataSize;
+  } else {
+    dataBlock = llvm::sys::MemoryBlock(base + codeUsed + codeSize, dataSize);
+    codeUsed += dataSize;
+  }
+  codeUsed += codeSize;
+  return true;
+}
+
+void ExecBlockAllocator::release(const llvm::sys::MemoryBlock &codeBlock,
+                                 const llvm::sys::MemoryBlock &dataBlock) {
+  // The code block may be executable
+  llvm::sys::MemoryBlock code = codeBlock;
+  QBDI_REQUIRE_ACTION(
+      !llvm::sys::Memory::protectMappedMemory(code, getBlockMemoryFlags()),
+      abort());
+  size_t codeSize = codeBlock.allocatedSize();
+  size_t dataSize = dataBlock.allocatedSize();
+  for (FreeList &freeList : freeLists) {
+    if (freeList.codeSize == codeSize and freeList.dataSize == dataSize) {
+      freeList.blocks.emplace_back(codeBlock.base(), dataBlock.base());
+      return;
+    }
+  }
+  freeLists.push_back(
+      {codeSize, dataSize, {{codeBlock.base(), dataBlock.base()}}});
+}
+
+size_t ExecBlockAllocator::getMappedSize() const {
+  size_t size = 0;
+  for (const llvm::sys::MemoryBlock &chunk : chunks) {
+    size += chunk.allocatedSize();
+  }
+  return size;
+}
+
+bool ExecBlockAllocator::bindToCurrentNumaNode() {
+  if (not numaBinding) {
+    return false;
+  }
+  int node = getCurrentNumaNode();
+  if (node < 0) {
+    return false;
+  }
+  if (node == numaNode) {
+    return true;
+  }
+  QBDI_DEBUG("Move {} chunks of ExecBlocks to the NUMA node {}", chunks.size(),
+             node);
+  numaNode = node;
+  bool res = true;
+  for (const llvm::sys::MemoryBlock &chunk : chunks) {
+    res = bindMemoryToNumaNode(chunk, node) and res;
+  }
+  return res;
+}
+
+void ExecBlockRegistry::add(ExecBlock &block) {
+  uint32_t slot;
+  if (freeSlots.empty()) {
+    QBDI_REQUIRE_ACTION(slots.size() < (1u << SLOT_BITS), return);
+    slot = slots.size();
+    slots.push_back({nullptr, 1});
+  } else {
+    slot = freeSlots.back();
+    freeSlots.pop_back();
+  }
+  slots[slot].block = &block;
+  block.registry = this;
+  block.registrySlot = slot;
+  block.registryGeneration = slots[slot].generation;
+}
+
+void ExecBlockRegistry::remove(uint32_t slot) {
+  QBDI_REQUIRE_ACTION(slot < slots.size(), return);
+  slots[slot].block = nullptr;
+  // 0 is never a valid generation
+  slots[slot].generation =
+      (slots[slot].generation % ((1u << GENERATION_BITS) - 1)) + 1;
+  freeSlots.push_back(slot);
+}
+
+const ExecBlock *ExecBlockRegistry::get(InstHandle handle) const {
+  uint32_t slot = static_cast<uint32_t>(handle >> (16 + GENERATION_BITS));
+  uint32_t generation =
+      static_cast<uint32_t>(handle >> 16) & ((1u << GENERATION_BITS) - 1);
+  if (slot >= slots.size() or slots[slot].generation != generation) {
+    return nullptr;
+  }
+  const ExecBlock *block = slots[slot].block;
+  if (block == nullptr or (handle & 0xffff) >= block->getNextInstID()) {
+    return nullptr;
+  }
+  return block;
+}
+
+InstHandle ExecBlock::getInstHandle(uint16_t instID) const {
+  if (registry == nullptr or instID >= instMetadata.size()) {
+    return 0;
+  }
+  return (static_cast<InstHandle>(registrySlot)
+          << (16 + ExecBlockRegistry::GENERATION_BITS)) |
+         (static_cast<InstHandle>(registryGeneration) << 16) | instID;
+}
+
 ExecBlock::~ExecBlock() {
+  if (registry != nullptr) {
+    registry->remove(registrySlot);
+  }
+  if (allocator != nullptr) {
+    allocator->release(codeBlock, dataBlock);
+    return;
+  }
+  if (dualMapped) {
+    QBDI::releaseMappedMemory(codeWriteBlock);
+  }
   // Reunite the 2 blocks before freeing them
   codeBlock = llvm::sys::MemoryBlock(
       codeBlock.base(), codeBlock.allocatedSize() + dataBlock.allocatedSize());
@@ -191,17 +558,56 @@ void ExecBlock::show() const {
   fprintf(stderr, "]\n");
 }
 
-VMAction ExecBlock::execute() {
+VMAction ExecBlock::execute(ExecStats *stats) {
   QBDI_DEBUG("Executing ExecBlock 0x{:x} programmed with selector at 0x{:x}",
              reinterpret_cast<uintptr_t>(this), context->hostState.selector);
 
   do {
     context->hostState.callback = static_cast<rword>(0);
     context->hostState.data = static_cast<rword>(0);
+    context->hostState.callbackSite = static_cast<rword>(0);
+    context->hostState.exitID = static_cast<rword>(NO_EXIT);
 
     QBDI_DEBUG("Execution of ExecBlock 0x{:x} resumed at 0x{:x}",
                reinterpret_cast<uintptr_t>(this), context->hostState.selector);
     run();
+    hostVisit = ++lastHostVisit;
+    if (stats != nullptr) {
+      stats->hostExitCount++;
+    }
+
+    // A linked exit or the indirect branch cache may have moved the
+    // execution to another sequence
+    uint16_t exitID = getLastExitID();
+    if (context->hostState.exitID == IBTC_HIT) {
+      const IBTCEntry *entry =
+          reinterpret_cast<const IBTCEntry *>(context->hostState.ibtcEntry);
+      currentEntry = static_cast<uint16_t>(entry->instID);
+      currentSeq = instRegistry[currentEntry].seqID;
+    } else if (exitID != NO_EXIT) {
+      const ExitInfo &exit = exitRegistry[exitID];
+      if (exit.indirect) {
+        // the indirect exits only return to the VM on a miss
+        ibtcMisses++;
+      }
+      if (exit.linkedInstID != NOT_FOUND) {
+        currentEntry = exit.linkedInstID;
+        currentSeq = instRegistry[currentEntry].seqID;
+      } else if (exit.seqID != currentSeq) {
+        currentSeq = exit.seqID;
+        currentEntry = seqRegistry[currentSeq].startInstID;
+      }
+    }
+
+    // The common callbacks only write the index of their record
+    if (context->hostState.callbackSite != 0) {
+      QBDI_REQUIRE(context->hostState.callbackSite <= callbackRegistry.size());
+      const CallbackInfo &site =
+          callbackRegistry[context->hostState.callbackSite - 1];
+      context->hostState.callback = site.callback;
+      context->hostState.data = site.data;
+      context->hostState.origin = site.instID;
+    }
 
     if (context->hostState.callback != 0) {
       currentInst = context->hostState.origin;
@@ -216,6 +622,9 @@ VMAction ExecBlock::execute() {
           (reinterpret_cast<InstCallback>(context->hostState.callback))(
               vminstance, &context->gprState, &context->fprState,
               (void *)context->hostState.data);
+      if (stats != nullptr) {
+        countCallbackResult(*stats, r);
+      }
 
       switch (r) {
         case CONTINUE:
@@ -281,6 +690,9 @@ VMAction ExecBlock::execute() {
     }
   } while (context->hostState.callback != 0);
   currentInst = seqRegistry[currentSeq].endInstID;
+  if (stats != nullptr) {
+    stats->sequenceExitCount++;
+  }
 
   return CONTINUE;
 }
@@ -288,6 +700,7 @@ VMAction ExecBlock::execute() {
 SeqWriteResult
 ExecBlock::writeSequence(std::vector<Patch>::const_iterator seqIt,
                          std::vector<Patch>::const_iterator seqEnd) {
+  QBDI_PROFILE_SCOPE(writeSequence);
   rword startOffset = (rword)codeStream->current_pos();
   uint16_t startInstID = getNextInstID();
   uint16_t seqID = getNextSeqID();
@@ -325,6 +738,7 @@ ExecBlock::writeSequence(std::vector<Patch>::const_iterator seqIt,
     uint32_t rollbackShadowIdx = shadowIdx;
     size_t rollbackShadowRegistry = shadowRegistry.size();
     size_t rollbackTagRegistry = tagRegistry.size();
+    size_t rollbackCallbackRegistry = callbackRegistry.size();
 
     QBDI_DEBUG_BLOCK({
       std::string disass =
@@ -336,6 +750,18 @@ ExecBlock::writeSequence(std::vector<Patch>::const_iterator seqIt,
           seqIt->metadata.address, disass.c_str());
     });
 
+    // The patch cannot be written if this ExecBlock is too far from the
+    // memory it accesses with a rel32 displacement
+    if (not canReach(*seqIt)) {
+      QBDI_DEBUG("ExecBlock 0x{:x} cannot reach the memory of the patch",
+                 reinterpret_cast<uintptr_t>(this));
+      if (codeStream->current_pos() == startOffset) {
+        return {EXEC_BLOCK_FULL, 0, 0};
+      }
+      needTerminator = true;
+      break;
+    }
+
     // Attempt to write a complete patch. If not, rollback to the last complete
     // patch written
     if (not writePatch(*seqIt, llvmcpu)) {
@@ -349,10 +775,14 @@ ExecBlock::writeSequence(std::vector<Patch>::const_iterator seqIt,
       shadowIdx = rollbackShadowIdx;
       shadowRegistry.resize(rollbackShadowRegistry);
       tagRegistry.resize(rollbackTagRegistry);
+      callbackRegistry.resize(rollbackCallbackRegistry);
       // It's a NULL rollback, don't terminate it
       if (rollbackOffset == startOffset) {
         QBDI_DEBUG("NULL rollback, nothing written to ExecBlock 0x{:x}",
                    reinterpret_cast<uintptr_t>(this));
+        if (isFull) {
+          shrinkMetadata();
+        }
         return {EXEC_BLOCK_FULL, 0, 0};
       }
       needTerminator = true;
@@ -360,8 +790,16 @@ ExecBlock::writeSequence(std::vector<Patch>::const_iterator seqIt,
     } else {
       // Complete instruction was written, we add the metadata
       // Move the analysis of the instruction in the cached metadata
-      instMetadata.push_back(seqIt->metadata.lightCopy());
-      instMetadata.back().analysis.reset(seqIt->metadata.analysis.release());
+      const InstMetadata &metadata = seqIt->metadata;
+      instMetadata.push_back(CachedInstMetadata{
+          metadata.address, metadata.instSize, metadata.patchSize,
+          metadata.inst.getOpcode(), metadata.inst.getFlags(),
+          static_cast<uint32_t>(instOperands.size()),
+          static_cast<uint16_t>(metadata.inst.getNumOperands()),
+          metadata.modifyPC, metadata.merge, metadata.cpuMode,
+          metadata.execblockFlags, std::move(metadata.analysis)});
+      instOperands.insert(instOperands.end(), metadata.inst.begin(),
+                          metadata.inst.end());
       // Register instruction
       instRegistry.push_back(InstInfo{
           seqID, static_cast<uint16_t>(rollbackOffset), 0,
@@ -381,6 +819,7 @@ ExecBlock::writeSequence(std::vector<Patch>::const_iterator seqIt,
       patchWritten += 1;
     }
   }
+  rword patchesEnd = codeStream->current_pos();
   // The last instruction of the sequence doesn't end with a change of RIP/PC,
   // add a Terminator
   if (needTerminator) {
@@ -393,16 +832,8 @@ ExecBlock::writeSequence(std::vector<Patch>::const_iterator seqIt,
       if (inst->getTag() != RelocatableInstTag::RelocInst) {
         continue;
       }
-      llvmcpu.writeInstruction(inst->reloc(this), codeStream.get());
-    }
-  }
-  // JIT the jump to epilogue
-  RelocatableInst::UniquePtrVec jmpEpilogue = JmpEpilogue();
-  for (const RelocatableInst::UniquePtr &inst : jmpEpilogue) {
-    if (inst->getTag() != RelocatableInstTag::RelocInst) {
-      continue;
+      writeRelocatableInst(*inst, llvmcpu);
     }
-    llvmcpu.writeInstruction(inst->reloc(this), codeStream.get());
   }
   // change the flag of the basicblock
   if (llvmcpu.getOptions() & Options::OPT_DISABLE_FPR) {
@@ -410,29 +841,309 @@ ExecBlock::writeSequence(std::vector<Patch>::const_iterator seqIt,
   } else if (llvmcpu.getOptions() & Options::OPT_DISABLE_OPTIONAL_FPR) {
     executeFlags = defaultExecuteFlags;
   }
+  // JIT the jump to epilogue
+  if (llvmcpu.getOptions() & (Options::OPT_ENABLE_BLOCK_CHAINING |
+                              Options::OPT_ENABLE_INDIRECT_CACHE)) {
+    writeSequenceExits(seqID, needTerminator, executeFlags, llvmcpu);
+  } else {
+    RelocatableInst::UniquePtrVec jmpEpilogue = JmpEpilogue();
+    for (const RelocatableInst::UniquePtr &inst : jmpEpilogue) {
+      if (inst->getTag() != RelocatableInstTag::RelocInst) {
+        continue;
+      }
+      writeRelocatableInst(*inst, llvmcpu);
+    }
+  }
   // Register sequence
   uint16_t endInstID = getNextInstID() - 1;
   seqRegistry.push_back(SeqInfo{startInstID, endInstID, executeFlags, cpuMode});
+  // Decode the memory accesses once for all the executions of the sequence
+  size_t memAccessOffset = memAccessRegistry.size();
+  compileMemoryAccess(*this, llvmcpu, startInstID, endInstID,
+                      memAccessRegistry);
+  seqRegistry.back().memAccessOffset = static_cast<uint32_t>(memAccessOffset);
+  seqRegistry.back().memAccessSize =
+      static_cast<uint32_t>(memAccessRegistry.size() - memAccessOffset);
+  const CachedInstMetadata &endInst = instMetadata[endInstID];
+  if (llvmcpu.getMCII().get(endInst.opcode).isCall()) {
+    seqRegistry.back().callReturn = endInst.endAddress();
+  }
   finalizeScratchRegisterForPatch();
   // Return write results
   unsigned bytesWritten =
       static_cast<unsigned>(codeStream->current_pos() - startOffset);
+  if (llvmcpu.getOptions() & Options::OPT_ENABLE_PERF_MAP) {
+    writePerfMap(startInstID, endInstID, patchesEnd,
+                 startOffset + bytesWritten);
+  }
   QBDI_DEBUG("End write sequence in basicblock 0x{:x} with execFlags : {:x}",
              reinterpret_cast<uintptr_t>(this), executeFlags);
+  QBDI_PROFILE_BYTES(writeSequence, bytesWritten);
+  if (isFull) {
+    shrinkMetadata();
+  }
   return SeqWriteResult{seqID, bytesWritten, patchWritten};
 }
 
-uint16_t ExecBlock::splitSequence(uint16_t instID) {
-  QBDI_REQUIRE(instID < instRegistry.size());
+void ExecBlock::writeRelocatableInst(const RelocatableInst &inst,
+                                     const LLVMCPU &llvmcpu) {
+  if (inst.isNoReloc()) {
+    // most of the instructions of the patches don't need a relocation
+    llvmcpu.writeInstruction(static_cast<const NoReloc &>(inst).getInst(),
+                             codeStream.get());
+  } else {
+    llvmcpu.writeInstruction(inst.reloc(this), codeStream.get());
+  }
+}
+
+void ExecBlock::seal() {
+  if (not isFull) {
+    isFull = true;
+    shrinkMetadata();
+  }
+  sealed = true;
+  // Pages are RWX on iOS
+  if constexpr (not is_ios) {
+    makeRX();
+  }
+}
+
+void ExecBlock::shrinkMetadata() {
+  instMetadata.shrink_to_fit();
+  instOperands.shrink_to_fit();
+  instRegistry.shrink_to_fit();
+  seqRegistry.shrink_to_fit();
+  shadowRegistry.shrink_to_fit();
+  memAccessRegistry.shrink_to_fit();
+  tagRegistry.shrink_to_fit();
+  callbackRegistry.shrink_to_fit();
+  exitRegistry.shrink_to_fit();
+}
+
+void ExecBlock::writePerfMap(uint16_t startInstID, uint16_t endInstID,
+                             rword patchesEnd, rword sequenceEnd) const {
+  if (not isPerfMapSupported()) {
+    return;
+  }
+  rword address = instMetadata[startInstID].address;
+  const char *symbol = nullptr;
+  const char *module = nullptr;
+  uint32_t symbolOffset = 0;
+  findSymbol(address, symbol, symbolOffset, module);
+
+  char location[256];
+  if (symbol != nullptr) {
+    snprintf(location, sizeof(location), "%s+0x%x", symbol, symbolOffset);
+  } else if (module != nullptr) {
+    snprintf(location, sizeof(location), "%s!0x%llx", module,
+             static_cast<unsigned long long>(address));
+  } else {
+    snprintf(location, sizeof(location), "0x%llx",
+             static_cast<unsigned long long>(address));
+  }
+  std::string code = std::string("[QBDI] ") + location;
+  std::string instrumentation =
+      std::string("[QBDI instrumentation] ") + location;
+  std::string exits = std::string("[QBDI exit] ") + location;
+
+  // Adjacent ranges with the same name are merged in a single entry
+  rword base = reinterpret_cast<rword>(codeBlock.base());
+  rword rangeStart = instRegistry[startInstID].offset;
+  const std::string *rangeName = &instrumentation;
+  auto addRange = [&](rword end, const std::string &name) {
+    if (&name != rangeName) {
+      addPerfMapEntry(base + rangeStart, end - rangeStart, rangeName->c_str());
+      rangeStart = end;
+      rangeName = &name;
+    }
+  };
+
+  for (uint16_t instID = startInstID; instID <= endInstID; instID++) {
+    const InstInfo &info = instRegistry[instID];
+    rword patchBegin = info.offset;
+    for (const TagInfo &tag : getTagByInst(instID)) {
+      if (tag.tag == RelocTagPatchBegin) {
+        patchBegin = tag.offset;
+        break;
+      }
+    }
+    // [offset, patchBegin) is the PREINST instrumentation,
+    // [patchBegin, offsetSkip) the instruction and the rest of the patch the
+    // POSTINST instrumentation
+    addRange(patchBegin, code);
+    addRange(info.offsetSkip, instrumentation);
+  }
+  addRange(patchesEnd, exits);
+  addPerfMapEntry(base + rangeStart, sequenceEnd - rangeStart,
+                  rangeName->c_str());
+}
+
+bool ExecBlock::canReach(const Patch &patch) const {
+  rword start = reinterpret_cast<rword>(codeBlock.base());
+  rword end = start + codeBlock.allocatedSize();
+  for (const RelocatableInst::UniquePtr &inst : patch.insts) {
+    rword target;
+    if (inst->getRel32Target(target) and
+        std::max(end, target) - std::min(start, target) > INT32_MAX) {
+      return false;
+    }
+  }
+  return true;
+}
+
+uint16_t ExecBlock::getLastExitID() const {
+  rword exitID = context->hostState.exitID;
+  if (exitID >= exitRegistry.size()) {
+    return NO_EXIT;
+  }
+  return static_cast<uint16_t>(exitID);
+}
+
+bool ExecBlock::linkExit(uint16_t exitID, uint16_t instID) {
+  QBDI_REQUIRE_ACTION(exitID < exitRegistry.size(), return false);
+  QBDI_REQUIRE_ACTION(instID < instRegistry.size(), return false);
+  ExitInfo &exit = exitRegistry[exitID];
   uint16_t seqID = instRegistry[instID].seqID;
-  seqRegistry.push_back(SeqInfo{
-      instID, seqRegistry[seqID].endInstID, seqRegistry[seqID].executeFlags,
-      seqRegistry[seqID].cpuMode, seqRegistry[seqID].sr});
-  return getNextSeqID() - 1;
+  const SeqInfo &source = seqRegistry[exit.seqID];
+  const SeqInfo &target = seqRegistry[seqID];
+  rword address = instMetadata[instID].address;
+
+  if (exit.indirect) {
+    // The cache is shared by every indirect exits of the ExecBlock. The target
+    // mustn't need more context than any sequence that can look it up.
+    if (source.cpuMode != target.cpuMode or
+        (target.executeFlags & ~ibtcExecuteFlags) != 0) {
+      QBDI_DEBUG("Cannot cache seqID {:x}: incompatible context", seqID);
+      return false;
+    }
+    QBDI_DEBUG("Cache indirect target 0x{:x} of ExecBlock 0x{:x} (seqID {:x})",
+               address, reinterpret_cast<uintptr_t>(this), seqID);
+    setIBTCEntry(ibtc[address % IBTC_SIZE], address, instID);
+    // the returns to the target from the calls of the ExecBlock are predicted
+    for (ReturnLink &link : returnLinks) {
+      if (link.returnAddress == address) {
+        setIBTCEntry(link.entry, address, instID);
+      }
+    }
+    return true;
+  }
+  if (exit.linkedInstID != NOT_FOUND) {
+    return exit.linkedInstID == instID;
+  }
+  if (address != exit.target) {
+    return false;
+  }
+  // The link would write a private copy of the page of the exit
+  if (sealed) {
+    return false;
+  }
+  // The prologue only restores the context needed by the first sequence, the
+  // linked sequence mustn't need more.
+  if (source.cpuMode != target.cpuMode or
+      (target.executeFlags & ~source.executeFlags) != 0) {
+    QBDI_DEBUG("Cannot link exit {} to seqID {:x}: incompatible context",
+               exitID, seqID);
+    return false;
+  }
+  QBDI_DEBUG("Link exit {} of ExecBlock 0x{:x} to seqID {:x} (0x{:x})", exitID,
+             reinterpret_cast<uintptr_t>(this), seqID, exit.target);
+  if constexpr (not is_ios) {
+    makeRW();
+  }
+  writeExitJump(exit, instRegistry[instID].offset);
+  exit.linkedInstID = instID;
+  return true;
+}
+
+void ExecBlock::unlinkExits() {
+  for (ExitInfo &exit : exitRegistry) {
+    if (exit.linkedInstID != NOT_FOUND) {
+      if constexpr (not is_ios) {
+        makeRW();
+      }
+      writeExitJump(exit, codeBlock.allocatedSize() - epilogueSize);
+      exit.linkedInstID = NOT_FOUND;
+    }
+  }
+  if (ibtc) {
+    for (size_t i = 0; i < IBTC_SIZE; i++) {
+      resetIBTCEntry(ibtc[i]);
+    }
+  }
+  for (ReturnLink &link : returnLinks) {
+    resetIBTCEntry(link.entry);
+  }
+}
+
+void ExecBlock::unlinkExits(rword target) {
+  for (ExitInfo &exit : exitRegistry) {
+    if (exit.linkedInstID != NOT_FOUND and exit.target == target) {
+      if constexpr (not is_ios) {
+        makeRW();
+      }
+      writeExitJump(exit, codeBlock.allocatedSize() - epilogueSize);
+      exit.linkedInstID = NOT_FOUND;
+    }
+  }
+  if (ibtc) {
+    IBTCEntry &entry = ibtc[target % IBTC_SIZE];
+    if (entry.negTarget == static_cast<rword>(0) - target) {
+      resetIBTCEntry(entry);
+    }
+  }
+  for (ReturnLink &link : returnLinks) {
+    if (link.returnAddress == target) {
+      resetIBTCEntry(link.entry);
+    }
+  }
+}
+
+void ExecBlock::resetIBTCEntry(IBTCEntry &entry) {
+  // An empty entry matches the address 0 and jumps to the epilogue, which is
+  // handled as a miss.
+  ibtcHits += entry.hits;
+  entry.negTarget = 0;
+  entry.hostAddr = reinterpret_cast<rword>(codeBlock.base()) +
+                   codeBlock.allocatedSize() - epilogueSize;
+  entry.hits = 0;
+  entry.instID = NOT_FOUND;
+}
+
+void ExecBlock::setIBTCEntry(IBTCEntry &entry, rword address, uint16_t instID) {
+  resetIBTCEntry(entry);
+  entry.negTarget = static_cast<rword>(0) - address;
+  entry.hostAddr =
+      reinterpret_cast<rword>(codeBlock.base()) + instRegistry[instID].offset;
+  entry.instID = instID;
+}
+
+size_t ExecBlock::getMetadataMemory() const {
+  return instMetadata.capacity() * sizeof(CachedInstMetadata) +
+         instOperands.capacity() * sizeof(llvm::MCOperand) +
+         instRegistry.capacity() * sizeof(InstInfo) +
+         seqRegistry.capacity() * sizeof(SeqInfo) +
+         shadowRegistry.capacity() * sizeof(ShadowInfo) +
+         memAccessRegistry.capacity() * sizeof(MemAccessInfo) +
+         tagRegistry.capacity() * sizeof(TagInfo) +
+         callbackRegistry.capacity() * sizeof(CallbackInfo) +
+         exitRegistry.capacity() * sizeof(ExitInfo);
+}
+
+rword ExecBlock::getIBTCHits() const {
+  rword hits = ibtcHits;
+  if (ibtc) {
+    for (size_t i = 0; i < IBTC_SIZE; i++) {
+      hits += ibtc[i].hits;
+    }
+  }
+  for (const ReturnLink &link : returnLinks) {
+    hits += link.entry.hits;
+  }
+  return hits;
 }
 
 void ExecBlock::makeRX() {
-  if (not isRX()) {
+  if (not isRX() and not dualMapped) {
     QBDI_DEBUG("Making ExecBlock 0x{:x} RX", reinterpret_cast<uintptr_t>(this));
     QBDI_REQUIRE_ACTION(!llvm::sys::Memory::protectMappedMemory(
                             codeBlock, PF::MF_READ | PF::MF_EXEC),
@@ -442,7 +1153,7 @@ void ExecBlock::makeRX() {
 }
 
 void ExecBlock::makeRW() {
-  if (not isRW()) {
+  if (not isRW() and not dualMapped) {
     QBDI_DEBUG("Making ExecBlock 0x{:x} RW", reinterpret_cast<uintptr_t>(this));
     QBDI_REQUIRE_ACTION(!llvm::sys::Memory::protectMappedMemory(
                             codeBlock, PF::MF_READ | PF::MF_WRITE),
@@ -452,10 +1163,16 @@ void ExecBlock::makeRW() {
 }
 
 uint16_t ExecBlock::newShadow(uint16_t tag) {
-  uint16_t id = shadowIdx++;
-  QBDI_REQUIRE_ACTION(id * sizeof(rword) <
-                          dataBlock.allocatedSize() - sizeof(Context),
-                      abort());
+  uint16_t id = 0;
+  if (shadowIdx < getShadowCapacity()) {
+    id = shadowIdx++;
+  } else {
+    // writePatch rolls back the current patch, the shadow 0 stands in for the
+    // missing one until then
+    QBDI_DEBUG("No shadow left in ExecBlock 0x{:x}",
+               reinterpret_cast<uintptr_t>(this));
+    shadowsFull = true;
+  }
   if (tag != ShadowReservedTag::Untagged) {
     QBDI_DEBUG("Registering new tagged shadow {} for instID {} wih tag {:x}",
                id, getNextInstID(), tag);
@@ -464,11 +1181,36 @@ uint16_t ExecBlock::newShadow(uint16_t tag) {
   return id;
 }
 
+uint32_t ExecBlock::newCallbackSite(rword callback, rword data) {
+  uint32_t site = getCallbackSite(callback, data);
+  if (site == 0) {
+    callbackRegistry.push_back({callback, data, getNextInstID()});
+    site = static_cast<uint32_t>(callbackRegistry.size());
+  }
+  return site;
+}
+
+uint32_t ExecBlock::getCallbackSite(rword callback, rword data) const {
+  uint16_t nextInstID = getNextInstID();
+
+  // the records of the instruction being written are the last ones
+  for (size_t i = callbackRegistry.size();
+       i > 0 and callbackRegistry[i - 1].instID == nextInstID; i--) {
+    const CallbackInfo &site = callbackRegistry[i - 1];
+    if (site.callback == callback and site.data == data) {
+      return static_cast<uint32_t>(i);
+    }
+  }
+  return 0;
+}
+
 uint16_t ExecBlock::getLastShadow(uint16_t tag) {
   uint16_t nextInstID = getNextInstID();
 
-  for (auto it = shadowRegistry.crbegin(); it != shadowRegistry.crend(); ++it) {
-    if (it->instID == nextInstID && it->tag == tag) {
+  // the shadows of the instruction being written are the last ones
+  for (auto it = shadowRegistry.crbegin();
+       it != shadowRegistry.crend() and it->instID == nextInstID; ++it) {
+    if (it->tag == tag) {
       return it->shadowID;
     }
   }
@@ -478,7 +1220,7 @@ uint16_t ExecBlock::getLastShadow(uint16_t tag) {
 
 void ExecBlock::setShadow(uint16_t id, rword v) {
   QBDI_REQUIRE_ACTION(id * sizeof(rword) <
-                          dataBlock.allocatedSize() - sizeof(Context),
+                          dataBlock.allocatedSize() - shadowsOffset,
                       abort());
   QBDI_DEBUG("Set shadow {} to 0x{:x}", id, v);
   shadows[id] = v;
@@ -486,13 +1228,13 @@ void ExecBlock::setShadow(uint16_t id, rword v) {
 
 rword ExecBlock::getShadow(uint16_t id) const {
   QBDI_REQUIRE_ACTION(id * sizeof(rword) <
-                          dataBlock.allocatedSize() - sizeof(Context),
+                          dataBlock.allocatedSize() - shadowsOffset,
                       abort());
   return shadows[id];
 }
 
 rword ExecBlock::getShadowOffset(uint16_t id) const {
-  rword offset = sizeof(Context) + id * sizeof(rword);
+  rword offset = shadowsOffset + id * sizeof(rword);
   QBDI_REQUIRE_ACTION(offset < dataBlock.allocatedSize(), abort());
   return offset;
 }
@@ -506,11 +1248,36 @@ uint16_t ExecBlock::getInstID(rword address) const {
   return NOT_FOUND;
 }
 
-const InstMetadata &ExecBlock::getInstMetadata(uint16_t instID) const {
+uint16_t ExecBlock::getInstIDOfCode(rword address) const {
+  rword base = reinterpret_cast<rword>(codeBlock.base());
+  if (address < base || address >= getCurrentPC() || instRegistry.empty()) {
+    return NOT_FOUND;
+  }
+  // the instructions are written in the order of their ID
+  rword offset = address - base;
+  auto it = std::upper_bound(
+      instRegistry.begin(), instRegistry.end(), offset,
+      [](rword offset, const InstInfo &info) { return offset < info.offset; });
+  if (it == instRegistry.begin()) {
+    return NOT_FOUND;
+  }
+  return static_cast<uint16_t>(std::distance(instRegistry.begin(), it) - 1);
+}
+
+const CachedInstMetadata &ExecBlock::getInstMetadata(uint16_t instID) const {
   QBDI_REQUIRE(instID < instMetadata.size());
   return instMetadata[instID];
 }
 
+InstMetadata ExecBlock::getOriginalInstMetadata(uint16_t instID) const {
+  QBDI_REQUIRE(instID < instMetadata.size());
+  const CachedInstMetadata &metadata = instMetadata[instID];
+  return InstMetadata(getOriginalMCInst(instID), metadata.address,
+                      metadata.instSize, metadata.patchSize, metadata.cpuMode,
+                      metadata.modifyPC, metadata.merge,
+                      metadata.execblockFlags);
+}
+
 rword ExecBlock::getInstAddress(uint16_t instID) const {
   QBDI_REQUIRE(instID < instMetadata.size());
   return instMetadata[instID].address;
@@ -522,16 +1289,41 @@ rword ExecBlock::getInstInstrumentedAddress(uint16_t instID) const {
          static_cast<rword>(instRegistry[instID].offset);
 }
 
-const llvm::MCInst &ExecBlock::getOriginalMCInst(uint16_t instID) const {
+llvm::MCInst ExecBlock::getOriginalMCInst(uint16_t instID) const {
   QBDI_REQUIRE(instID < instMetadata.size());
-  return instMetadata[instID].inst;
+  const CachedInstMetadata &metadata = instMetadata[instID];
+  llvm::MCInst inst;
+  inst.setOpcode(metadata.opcode);
+  inst.setFlags(metadata.flags);
+  for (uint32_t i = 0; i < metadata.operandCount; i++) {
+    inst.addOperand(instOperands[metadata.operandOffset + i]);
+  }
+  return inst;
 }
 
 const InstAnalysis *ExecBlock::getInstAnalysis(uint16_t instID,
                                                AnalysisType type) const {
   QBDI_REQUIRE(instID < instMetadata.size());
-  return analyzeInstMetadata(instMetadata[instID], type,
-                             llvmCPUs.getCPU(instMetadata[instID].cpuMode));
+  const CachedInstMetadata &cached = instMetadata[instID];
+  // the MCInst is only rebuilt when the analysis must be completed
+  if (cached.analysis != nullptr and
+      (cached.analysis->analysisType & type) == type) {
+    return cached.analysis.get();
+  }
+  InstMetadata metadata = getOriginalInstMetadata(instID);
+  metadata.analysis = std::move(cached.analysis);
+  const InstAnalysis *analysis =
+      analyzeInstMetadata(metadata, type, llvmCPUs.getCPU(metadata.cpuMode),
+                          &analysisArena);
+  cached.analysis = std::move(metadata.analysis);
+  return analysis;
+}
+
+void ExecBlock::clearInstAnalyses() {
+  for (CachedInstMetadata &metadata : instMetadata) {
+    metadata.analysis.reset();
+  }
+  analysisArena.clear();
 }
 
 uint16_t ExecBlock::getSeqID(rword address) const {
@@ -575,13 +1367,32 @@ ExecBlock::getShadowByInst(uint16_t instID) const {
   }
 }
 
+llvm::ArrayRef<MemAccessInfo>
+ExecBlock::getMemAccessBySeq(uint16_t seqID) const {
+  QBDI_REQUIRE(seqID < seqRegistry.size());
+  const SeqInfo &seq = seqRegistry[seqID];
+  return llvm::ArrayRef<MemAccessInfo>(
+      memAccessRegistry.data() + seq.memAccessOffset, seq.memAccessSize);
+}
+
 std::vector<ShadowInfo> ExecBlock::queryShadowByInst(uint16_t instID,
                                                      uint16_t tag) const {
   std::vector<ShadowInfo> result;
 
-  for (const auto &reg : shadowRegistry) {
-    if ((instID == ANY || reg.instID == instID) &&
-        (tag == ANY || reg.tag == tag)) {
+  // the shadows of a written instruction are indexed by its InstInfo, the
+  // ones of the instruction being written are the last ones
+  llvm::ArrayRef<ShadowInfo> shadows = shadowRegistry;
+  if (instID != ANY and instID < instRegistry.size()) {
+    shadows = getShadowByInst(instID);
+  } else if (instID != ANY) {
+    size_t first = shadowRegistry.size();
+    while (first > 0 and shadowRegistry[first - 1].instID == instID) {
+      first--;
+    }
+    shadows = shadows.drop_front(first);
+  }
+  for (const auto &reg : shadows) {
+    if (tag == ANY || reg.tag == tag) {
       result.push_back(reg);
     }
   }
@@ -593,20 +1404,18 @@ std::vector<ShadowInfo> ExecBlock::queryShadowBySeq(uint16_t seqID,
                                                     uint16_t tag) const {
   std::vector<ShadowInfo> result;
 
-  if (seqID == ANY) {
-    for (const auto &reg : shadowRegistry) {
-      if (tag == ANY || reg.tag == tag) {
-        result.push_back(reg);
-      }
-    }
-  } else {
-    uint16_t firstInstID = getSeqStart(seqID);
-    uint16_t lastInstID = getSeqEnd(seqID);
-    for (const auto &reg : shadowRegistry) {
-      if (firstInstID <= reg.instID && reg.instID <= lastInstID &&
-          (tag == ANY || reg.tag == tag)) {
-        result.push_back(reg);
-      }
+  // the shadows of the instructions of a sequence are contiguous
+  llvm::ArrayRef<ShadowInfo> shadows = shadowRegistry;
+  if (seqID != ANY) {
+    const InstInfo &first = instRegistry[getSeqStart(seqID)];
+    const InstInfo &last = instRegistry[getSeqEnd(seqID)];
+    shadows = shadows.slice(first.shadowOffset, last.shadowOffset +
+                                                    last.shadowSize -
+                                                    first.shadowOffset);
+  }
+  for (const auto &reg : shadows) {
+    if (tag == ANY || reg.tag == tag) {
+      result.push_back(reg);
     }
   }
 
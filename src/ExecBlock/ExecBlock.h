@@ -18,8 +18,12 @@
 #ifndef EXECBLOCK_H
 #define EXECBLOCK_H
 
+#include <algorithm>
+#include <deque>
+#include <limits>
 #include <memory>
 #include <stdint.h>
+#include <utility>
 #include <vector>
 
 #include "llvm/ADT/ArrayRef.h"
@@ -29,6 +33,7 @@
 #include "Patch/Types.h"
 #include "Utility/memory_ostream.h"
 
+#include "QBDI/CacheStats.h"
 #include "QBDI/Callback.h"
 #include "QBDI/Config.h"
 #include "QBDI/InstAnalysis.h"
@@ -73,6 +78,11 @@ struct SeqInfo {
   uint8_t executeFlags;
   CPUMode cpuMode;
   ScratchRegisterSeqInfo sr;
+  // memory accesses of the sequence in memAccessRegistry
+  uint32_t memAccessOffset = 0;
+  uint32_t memAccessSize = 0;
+  // return address of the call ending the sequence, 0 if it isn't a call
+  rword callReturn = 0;
 };
 
 struct SeqWriteResult {
@@ -87,16 +97,258 @@ struct ShadowInfo {
   uint16_t shadowID;
 };
 
+/*! Memory access of an instruction, decoded from its shadows when the sequence
+ * is written.
+ */
+struct MemAccessInfo {
+  uint16_t instID;
+  uint16_t shadowID;      // address, or begin address of a range
+  uint16_t valueShadowID; // value, or end address of a range
+  uint16_t size;          // size of the access, or atomic size of a range
+  int32_t offset;         // added to the address of the coalesced accesses
+  MemoryAccessType type;
+  MemoryAccessFlags flags;
+  bool range;
+};
+
 struct TagInfo {
   uint16_t tag;
   uint16_t offset;
 };
 
+/*! Callback of a break to the host. The generated code only writes the index
+ * of the record (plus one) in hostState.callbackSite.
+ */
+struct CallbackInfo {
+  rword callback;
+  rword data;
+  uint16_t instID;
+};
+
+struct ExitInfo {
+  uint16_t seqID;
+  uint16_t offset;
+  // first instruction executed by the linked jump, NOT_FOUND if unlinked
+  uint16_t linkedInstID;
+  bool indirect;
+  rword target;
+};
+
+/*! Entry of the indirect branch target cache. The first three fields are read
+ * and written by the generated code.
+ */
+struct IBTCEntry {
+  rword negTarget; /*!< Two's complement of the cached target address */
+  rword hostAddr;  /*!< Address of the translated sequence */
+  rword hits;      /*!< Number of hits of this entry */
+  rword instID;    /*!< ID of the first instruction of the translated entry */
+};
+
+// The return stack is indexed by the low byte of its top
+static const size_t RETURN_STACK_SIZE = 256;
+
+/*! IBTCEntry of the return address of a call, filled when the sequence of the
+ * return address is linked in the ExecBlock of the call.
+ */
+struct ReturnLink {
+  IBTCEntry entry;     /*!< Entry looked up by the returns */
+  rword returnAddress; /*!< Return address of the call */
+};
+
+/*! Shadow stack of the calls of an ExecBlock. The calls push their
+ * ReturnLink and the returns pop the top link and compare it with their
+ * target before looking up the indirect branch target cache. The stack wraps
+ * around when it overflows, a wrong link is only a miss.
+ */
+struct ReturnStack {
+  rword top;                           /*!< Index of the top link */
+  IBTCEntry *links[RETURN_STACK_SIZE]; /*!< Pushed links */
+  IBTCEntry empty;                     /*!< Link of the unused slots */
+};
+
+/*! Context page shared by all the ExecBlocks of a VM.
+ */
+struct SharedContext {
+  int handle;       /*!< Handle of the shared memory of the context */
+  Context *context; /*!< Canonical mapping of the context */
+};
+
+/*! Encoded prologue and epilogue shared by ExecBlocks with the same layout.
+ * They only address the data block relatively to the PC, so their bytes can
+ * be copied in a new ExecBlock instead of being assembled again.
+ */
+struct ExecBlockTemplate {
+  std::vector<uint8_t> prologue; /*!< Bytes at the start of the code block */
+  std::vector<uint8_t> epilogue; /*!< Bytes at the end of the code block */
+  rword dataOffset = 0;          /*!< Offset of the data block */
+};
+
 static const uint16_t EXEC_BLOCK_FULL = 0xFFFF;
+static const uint16_t NO_EXIT = 0xFFFF;
+// exitID set by the generated code when the indirect branch cache is hit
+static const uint16_t IBTC_HIT = 0xFFFE;
+// The cache is indexed by the low byte of the target address
+static const size_t IBTC_SIZE = 256;
+// The offsets in the code block are stored on 16 bits
+static const uint32_t MAX_CODE_BLOCK_SIZE = 0x10000;
+// The shadows are indexed on 16 bits
+static const uint32_t MAX_DATA_BLOCK_SIZE = 0x80000;
+// Distance to the code of the ExecBlocks allocated near it
+static const uint64_t NEAR_EXEC_BLOCK_DISTANCE = 0x40000000;
+
+class ExecBlock;
+
+/*! Slots of the ExecBlocks of an ExecBlockManager, used to resolve an
+ * InstHandle without searching the regions. A slot is released by the
+ * destructor of its ExecBlock and its generation changes, so the handles of a
+ * freed ExecBlock are never resolved.
+ */
+class ExecBlockRegistry {
+private:
+  struct Slot {
+    ExecBlock *block;
+    uint32_t generation;
+  };
+
+  std::vector<Slot> slots;
+  std::vector<uint32_t> freeSlots;
+
+public:
+  static const unsigned SLOT_BITS = 24;
+  static const unsigned GENERATION_BITS = 24;
+
+  ExecBlockRegistry() = default;
+
+  ExecBlockRegistry(const ExecBlockRegistry &) = delete;
+  ExecBlockRegistry &operator=(const ExecBlockRegistry &) = delete;
+
+  void add(ExecBlock &block);
+
+  void remove(uint32_t slot);
+
+  const ExecBlock *get(InstHandle handle) const;
+};
 
-/*! Manages the concept of an exec block made of two contiguous memory blocks
- * (one for the code, the other for the data) used to store and execute
- * instrumented basic blocks.
+/*! Memory of the ExecBlocks of an ExecBlockManager. The blocks are carved out
+ * of large chunks, and the memory of a freed block is kept for the next block
+ * with the same layout instead of being unmapped. The chunks are unmapped
+ * with the allocator.
+ *
+ * With the huge pages, a chunk is made of a code area and a data area aligned
+ * on the huge pages. The code of the ExecBlocks is packed in the code area
+ * and the data blocks are put in the data area.
+ */
+class ExecBlockAllocator {
+private:
+  struct FreeList {
+    size_t codeSize;
+    size_t dataSize;
+    // code and data blocks of the freed ExecBlocks
+    std::vector<std::pair<void *, void *>> blocks;
+  };
+
+  bool hugePages;
+  // NUMA node of the chunks, -1 if they aren't bound
+  bool numaBinding;
+  int numaNode;
+  std::vector<llvm::sys::MemoryBlock> chunks;
+  // bytes already carved out of the code and the data areas of the last chunk
+  size_t codeUsed;
+  size_t dataUsed;
+  std::vector<FreeList> freeLists;
+
+public:
+  // Size of the chunks (of each area with the huge pages), a larger block gets
+  // a chunk of its own
+  static const size_t CHUNK_SIZE = 0x200000;
+
+  ExecBlockAllocator(bool hugePages = false, bool numaBinding = false)
+      : hugePages(hugePages), numaBinding(numaBinding), numaNode(-1),
+        codeUsed(0), dataUsed(0) {}
+
+  ~ExecBlockAllocator();
+
+  ExecBlockAllocator(const ExecBlockAllocator &) = delete;
+  ExecBlockAllocator &operator=(const ExecBlockAllocator &) = delete;
+
+  /*! Allocate the memory of an ExecBlock, readable and writable. The data
+   * block follows the code block unless the huge pages are used.
+   *
+   * @param[in]  codeSize   Size of the code block, aligned on the page size
+   * @param[in]  dataSize   Size of the data block, aligned on the page size
+   * @param[out] codeBlock  The code block
+   * @param[out] dataBlock  The data block
+   *
+   * @return False if the memory cannot be mapped
+   */
+  bool allocate(size_t codeSize, size_t dataSize,
+                llvm::sys::MemoryBlock &codeBlock,
+                llvm::sys::MemoryBlock &dataBlock);
+
+  /*! Give back the memory of an ExecBlock. The code block is made writable
+   * again and the memory is reused by the next block with the same sizes.
+   *
+   * @param[in] codeBlock  The code block returned by allocate
+   * @param[in] dataBlock  The data block returned by allocate
+   */
+  void release(const llvm::sys::MemoryBlock &codeBlock,
+               const llvm::sys::MemoryBlock &dataBlock);
+
+  /*! Return the size of the mapped chunks.
+   */
+  size_t getMappedSize() const;
+
+  /*! Return the NUMA node of the chunks, -1 if they aren't bound.
+   */
+  int getNumaNode() const { return numaNode; }
+
+  /*! Bind the chunks to the NUMA node of the current thread, the pages of
+   * the chunks already touched are moved to the node. The next chunks are
+   * bound to the same node. Only used with the NUMA binding.
+   *
+   * @return False if the node of the thread is unknown or if the chunks
+   *         cannot be bound
+   */
+  bool bindToCurrentNumaNode();
+};
+
+/*! Shared context switches of the ExecBlocks of a VM. The prologue and the
+ * epilogue of an ExecBlock are small stubs which load the address of their
+ * context and jump to the trampolines through the hostState of the context.
+ */
+class ExecBlockTrampoline {
+private:
+  llvm::sys::MemoryBlock block;
+  rword prologue;
+  rword epilogue;
+
+public:
+  /*! Assemble the trampolines in a page of their own.
+   *
+   * @param[in] llvmcpu  LLVMCPU used to assemble the trampolines
+   */
+  ExecBlockTrampoline(const LLVMCPU &llvmcpu);
+
+  ~ExecBlockTrampoline();
+
+  ExecBlockTrampoline(const ExecBlockTrampoline &) = delete;
+  ExecBlockTrampoline &operator=(const ExecBlockTrampoline &) = delete;
+
+  /*! Address of the trampoline called by the ExecBlock prologue. It saves
+   * the host stack pointer and restores the guest state but the first GPR and
+   * the stack pointer.
+   */
+  inline rword getPrologue() const { return prologue; }
+
+  /*! Address of the trampoline jumped to by the ExecBlock epilogue. It saves
+   * the guest state and returns to the host.
+   */
+  inline rword getEpilogue() const { return epilogue; }
+};
+
+/*! Manages the concept of an exec block made of two memory blocks (one for
+ * the code, the other for the data) used to store and execute instrumented
+ * basic blocks.
  */
 class ExecBlock {
 private:
@@ -106,23 +358,67 @@ private:
 
   VMInstanceRef vminstance;
   llvm::sys::MemoryBlock codeBlock;
+  // writable alias of the code block with OPT_ENABLE_DUAL_MAPPING, or the
+  // code block itself
+  llvm::sys::MemoryBlock codeWriteBlock;
   llvm::sys::MemoryBlock dataBlock;
   std::unique_ptr<memory_ostream> codeStream;
   const LLVMCPUs &llvmCPUs;
   Context *context;
   rword *shadows;
+  rword shadowsOffset;
   std::vector<ShadowInfo> shadowRegistry;
+  std::vector<MemAccessInfo> memAccessRegistry;
   std::vector<TagInfo> tagRegistry;
+  std::vector<CallbackInfo> callbackRegistry;
+  std::vector<ExitInfo> exitRegistry;
+  std::unique_ptr<IBTCEntry[]> ibtc;
+  // links of the calls with OPT_ENABLE_RETURN_STACK, never moved once pushed
+  std::unique_ptr<ReturnStack> returnStack;
+  std::deque<ReturnLink> returnLinks;
+  uint8_t ibtcExecuteFlags;
+  rword ibtcHits;
+  rword ibtcMisses;
   uint16_t shadowIdx;
-  std::vector<InstMetadata> instMetadata;
+  // storage of the analyses of the cached instructions, released with the
+  // ExecBlock
+  mutable InstAnalysisArena analysisArena;
+  std::vector<CachedInstMetadata> instMetadata;
+  // operands of the MCInst of the instructions
+  std::vector<llvm::MCOperand> instOperands;
   std::vector<InstInfo> instRegistry;
   std::vector<SeqInfo> seqRegistry;
   PageState pageState;
+  bool dualMapped;
   uint16_t currentSeq;
+  // instruction where the current sequence has been entered
+  uint16_t currentEntry;
   uint16_t currentInst;
+  // id of the last return of the generated code to the host, unique in the
+  // thread
+  uint64_t hostVisit;
   uint32_t epilogueSize;
   bool isFull;
+  // set when a shadow was requested while the data block had none left
+  bool shadowsFull;
+  // the ExecBlock only holds superblocks
+  bool hot;
+  // an InstrRule was applied on a sequence of the ExecBlock
+  bool instrumented;
+  // the code block isn't written anymore, its pages stay shared with the
+  // processes forked after the seal
+  bool sealed;
   ScratchRegisterInfo srInfo;
+  // allocator of the memory of the blocks, nullptr if they are mapped
+  ExecBlockAllocator *allocator;
+  // slot of the ExecBlock in the registry of its ExecBlockManager
+  ExecBlockRegistry *registry;
+  uint32_t registrySlot;
+  uint32_t registryGeneration;
+  // trampolines of a block created without the ones of its ExecBlockManager
+  std::unique_ptr<ExecBlockTrampoline> ownTrampoline;
+
+  friend class ExecBlockRegistry;
 
   /*! Verify if the code block is in read execute mode.
    *
@@ -136,11 +432,13 @@ private:
    */
   inline bool isRW() const { return pageState == RW; }
 
-  /*! Changes the code block permissions to RX.
+  /*! Changes the code block permissions to RX. Does nothing if the code
+   * block is dual mapped.
    */
   void makeRX();
 
-  /*! Changes the code block permissions to RW.
+  /*! Changes the code block permissions to RW. Does nothing if the code
+   * block is dual mapped.
    */
   void makeRW();
 
@@ -151,6 +449,87 @@ private:
 
   void finalizeScratchRegisterForPatch();
 
+  /*! Release the unused capacity of the metadata once the ExecBlock is full,
+   * no instruction or sequence is added to it anymore.
+   */
+  void shrinkMetadata();
+
+  /*! Write the end of a sequence. When the block chaining is enabled, each
+   * static successor of the sequence gets its own exit that can later be
+   * linked with linkExit. When the indirect branch cache is enabled, the
+   * indirect branches look up their target in the cache of the ExecBlock.
+   *
+   * @param[in] seqID           ID of the sequence being written.
+   * @param[in] terminated      True if a terminator ends the sequence.
+   * @param[in] executeFlags    The executeFlags of the sequence.
+   * @param[in] llvmcpu         LLVMCPU used to assemble the instructions.
+   */
+  void writeSequenceExits(uint16_t seqID, bool terminated, uint8_t executeFlags,
+                          const LLVMCPU &llvmcpu);
+
+  /*! Write a RelocatableInst at the current position of the code stream. The
+   * instruction of a NoReloc is written without a copy nor a virtual call.
+   *
+   * @param[in] inst            The RelocatableInst to write.
+   * @param[in] llvmcpu         LLVMCPU used to assemble the instruction.
+   */
+  void writeRelocatableInst(const RelocatableInst &inst,
+                            const LLVMCPU &llvmcpu);
+
+  /*! Name the code of a sequence in the perf map of the process. The
+   * original instructions, the instrumentation and the exits of the sequence
+   * get distinct entries.
+   *
+   * @param[in] startInstID     ID of the first instruction of the sequence.
+   * @param[in] endInstID       ID of the last instruction of the sequence.
+   * @param[in] patchesEnd      Offset of the end of the last patch.
+   * @param[in] sequenceEnd     Offset of the end of the sequence.
+   */
+  void writePerfMap(uint16_t startInstID, uint16_t endInstID, rword patchesEnd,
+                    rword sequenceEnd) const;
+
+  /*! Write an exit that looks up the target of an indirect branch in the
+   * indirect branch target cache. A miss jumps to the epilogue.
+   *
+   * @param[in] seqID           ID of the sequence being written.
+   * @param[in] executeFlags    The executeFlags of the sequence.
+   * @param[in] llvmcpu         LLVMCPU used to assemble the instructions.
+   */
+  void writeIndirectExit(uint16_t seqID, uint8_t executeFlags,
+                         const LLVMCPU &llvmcpu);
+
+  /*! Allocate the return stack if it doesn't exist yet.
+   */
+  void initReturnStack();
+
+  /*! Write the push of the ReturnLink of the call ending the sequence on
+   * the return stack.
+   *
+   * @param[in] llvmcpu         LLVMCPU used to assemble the instructions.
+   */
+  void writeReturnPush(const LLVMCPU &llvmcpu);
+
+  /*! Reset an entry of the indirect branch target cache.
+   *
+   * @param[in] entry   The entry to reset.
+   */
+  void resetIBTCEntry(IBTCEntry &entry);
+
+  /*! Set the target of an entry of the indirect branch target cache.
+   *
+   * @param[in] entry    The entry to set.
+   * @param[in] address  The address of the target.
+   * @param[in] instID   The instruction of the target.
+   */
+  void setIBTCEntry(IBTCEntry &entry, rword address, uint16_t instID);
+
+  /*! Patch the jump of an exit to a new offset of the code block.
+   *
+   * @param[in] exit    The exit to patch.
+   * @param[in] target  Offset of the new target in the code block.
+   */
+  void writeExitJump(const ExitInfo &exit, rword target);
+
 public:
   /*! Construct a new ExecBlock
    *
@@ -160,6 +539,23 @@ public:
    * @param[in] execBlockPrologue  cached prologue of ExecManager
    * @param[in] execBlockEpilogue  cached epilogue of ExecManager
    * @param[in] epilogueSize       size in bytes of the epilogue (0 is not know)
+   * @param[in] sharedContext      context page shared with the other
+   *                               ExecBlocks (nullptr to use a private one)
+   * @param[in] codeSize           size in bytes of the code block, rounded up
+   *                               to the page size (0 for one page)
+   * @param[in] dataSize           size in bytes of the data block, rounded up
+   *                               to the page size (0 for one page)
+   * @param[in] blockTemplate      encoded prologue and epilogue of the
+   *                               ExecBlocks with the same layout. Filled by
+   *                               the first ExecBlock if empty (nullptr to
+   *                               always assemble them)
+   * @param[in] nearAddress        address of the code near which the block is
+   *                               allocated if possible (0 for anywhere)
+   * @param[in] blockAllocator     allocator of the memory of the blocks
+   *                               (nullptr to map them). Not used for the near
+   *                               and the dual mapped blocks.
+   * @param[in] trampoline         shared context switches of the blocks
+   *                               (nullptr to assemble a private one)
    */
   ExecBlock(
       const LLVMCPUs &llvmCPUs, VMInstanceRef vminstance = nullptr,
@@ -167,7 +563,11 @@ public:
           nullptr,
       const std::vector<std::unique_ptr<RelocatableInst>> *execBlockEpilogue =
           nullptr,
-      uint32_t epilogueSize = 0);
+      uint32_t epilogueSize = 0, const SharedContext *sharedContext = nullptr,
+      uint32_t codeSize = 0, uint32_t dataSize = 0,
+      ExecBlockTemplate *blockTemplate = nullptr, rword nearAddress = 0,
+      ExecBlockAllocator *blockAllocator = nullptr,
+      const ExecBlockTrampoline *trampoline = nullptr);
 
   ~ExecBlock();
 
@@ -188,8 +588,11 @@ public:
 
   /*! Execute the sequence currently programmed in the selector of the exec
    * block. Take care of the callbacks handling.
+   *
+   * @param[in] stats    If not null, the returns to the host are counted in
+   *                     it.
    */
-  VMAction execute();
+  VMAction execute(ExecStats *stats = nullptr);
 
   /*! Write a new sequence in the exec block. This function does not guarantee
    * that the sequence will be written in its entierty and might stop before the
@@ -204,13 +607,14 @@ public:
   SeqWriteResult writeSequence(std::vector<Patch>::const_iterator seqStart,
                                std::vector<Patch>::const_iterator seqEnd);
 
-  /*! Split an existing sequence at instruction instID to create a new sequence.
+  /*! Check if the rel32 displacements of a patch can reach their target from
+   * the code block.
    *
-   * @param instID  [in] ID of the instruction where to split the sequence at.
+   * @param patch [in] The patch.
    *
-   * @return The new sequence ID.
+   * @return True if the patch can be written in this exec block.
    */
-  uint16_t splitSequence(uint16_t instID);
+  bool canReach(const Patch &patch) const;
 
   /*! Get the address of the DataBlock
    *
@@ -226,7 +630,8 @@ public:
    * @return The computed offset.
    */
   rword getDataBlockOffset() const {
-    return codeBlock.allocatedSize() - codeStream->current_pos();
+    return getDataBlockBase() - reinterpret_cast<rword>(codeBlock.base()) -
+           codeStream->current_pos();
   }
 
   /*! Compute the offset between the current code stream position and the start
@@ -272,19 +677,43 @@ public:
    */
   uint16_t getInstID(rword address) const;
 
+  /*! Obtain the ID of the instruction whose instrumented code contains an
+   * address.
+   *
+   * @param address An address in the code block of this ExecBlock.
+   *
+   * @return The instruction ID or NOT_FOUND.
+   */
+  uint16_t getInstIDOfCode(rword address) const;
+
   /*! Obtain the current instruction ID.
    *
    * @return The ID of the current instruction.
    */
   uint16_t getCurrentInstID() const { return currentInst; }
 
+  /*! Obtain the id of the last return of the generated code to the host. The
+   * state of the shadows doesn't change until the next one.
+   *
+   * @return An id unique among the ExecBlocks of the thread.
+   */
+  uint64_t getHostVisit() const { return hostVisit; }
+
   /*! Obtain the instruction metadata for a specific instruction ID.
    *
    * @param instID The instruction ID.
    *
    * @return The metadata of the instruction.
    */
-  const InstMetadata &getInstMetadata(uint16_t instID) const;
+  const CachedInstMetadata &getInstMetadata(uint16_t instID) const;
+
+  /*! Rebuild the complete metadata of an instruction, without its analysis.
+   *
+   * @param instID The instruction ID.
+   *
+   * @return The metadata of the instruction with its MCInst.
+   */
+  InstMetadata getOriginalInstMetadata(uint16_t instID) const;
 
   /*! Obtain the instruction address for a specific instruction ID.
    *
@@ -302,13 +731,14 @@ public:
    */
   rword getInstInstrumentedAddress(uint16_t instID) const;
 
-  /*! Obtain the original MCInst for a specific instruction ID.
+  /*! Obtain the original MCInst for a specific instruction ID. The MCInst is
+   * rebuilt from the operands stored by the ExecBlock.
    *
    * @param instID The instruction ID.
    *
    * @return The original MCInst of the instruction.
    */
-  const llvm::MCInst &getOriginalMCInst(uint16_t instID) const;
+  llvm::MCInst getOriginalMCInst(uint16_t instID) const;
 
   /*! Obtain the analysis of an instruction. Analysis results are
    * cached in the InstAnalysis. The validity of the returned pointer is only
@@ -322,6 +752,14 @@ public:
    */
   const InstAnalysis *getInstAnalysis(uint16_t instID, AnalysisType type) const;
 
+  /*! Obtain the handle of an instruction.
+   *
+   * @param[in] instID  The ID of the instruction.
+   *
+   * @return The handle, or 0 if the ExecBlock isn't in a registry.
+   */
+  InstHandle getInstHandle(uint16_t instID) const;
+
   /*! Obtain the next sequence ID.
    *
    * @return The next sequence ID.
@@ -353,6 +791,13 @@ public:
    */
   uint16_t getCurrentSeqID() const { return currentSeq; }
 
+  /*! Obtain the instruction where the current sequence has been entered. It
+   * is the start of the sequence unless it has been entered in the middle.
+   *
+   * @return The ID of the first executed instruction of the current sequence.
+   */
+  uint16_t getCurrentEntryID() const { return currentEntry; }
+
   /*! Obtain the sequence start address for a specific sequence ID.
    *
    * @param seqID The sequence ID.
@@ -370,6 +815,17 @@ public:
    */
   uint16_t getSeqEnd(uint16_t seqID) const;
 
+  /*! Obtain the return address of the call ending a sequence.
+   *
+   * @param seqID The sequence ID.
+   *
+   * @return The address after the call, 0 if the sequence doesn't end with a
+   *         call.
+   */
+  rword getSeqCallReturn(uint16_t seqID) const {
+    return seqRegistry[seqID].callReturn;
+  }
+
   /*! Set the selector of the exec block to a specific sequence offset. Used to
    * program the execution of a specific sequence within the exec block.
    *
@@ -377,6 +833,56 @@ public:
    */
   void selectSeq(uint16_t seqID);
 
+  /*! Set the selector of the exec block to an instruction in the middle of a
+   * sequence. The entry shares the metadata of its sequence, the prologue
+   * restores the context needed by the whole sequence.
+   *
+   *  @param instID [in] The instruction where the sequence is entered.
+   */
+  void selectEntry(uint16_t instID);
+
+  /*! Obtain the last exit taken by the previous execution of the ExecBlock.
+   *
+   * @return The ID of the exit or NO_EXIT.
+   */
+  uint16_t getLastExitID() const;
+
+  /*! Link an exit to an instruction of this ExecBlock, the start of a
+   * sequence or an entry in its middle. The exit must target the address of
+   * the instruction and its sequence must not need a context that the
+   * sequence of the exit doesn't restore.
+   *
+   * @param[in] exitID  The ID of the exit to link.
+   * @param[in] instID  The ID of the instruction to jump to.
+   *
+   * @return True if the exit has been linked.
+   */
+  bool linkExit(uint16_t exitID, uint16_t instID);
+
+  /*! Restore every linked exit of the ExecBlock to the epilogue and empty
+   * the indirect branch target cache.
+   */
+  void unlinkExits();
+
+  /*! Restore the linked exits of the ExecBlock that target an address to the
+   * epilogue and remove the address from the indirect branch target cache.
+   *
+   * @param[in] target  The target address of the exits.
+   */
+  void unlinkExits(rword target);
+
+  /*! Get the number of hits of the indirect branch target cache.
+   *
+   * @return The number of hits.
+   */
+  rword getIBTCHits() const;
+
+  /*! Get the number of misses of the indirect branch target cache.
+   *
+   * @return The number of misses.
+   */
+  rword getIBTCMisses() const { return ibtcMisses; }
+
   /*! Get a pointer to the context structure stored in the data block.
    *
    * @return The context pointer.
@@ -384,7 +890,9 @@ public:
   Context *getContext() const { return context; }
 
   /*! Allocate a new shadow within the data block. Used by relocation to load or
-   * store data from the instrumented code.
+   * store data from the instrumented code. If the data block has no shadow
+   * left, the ExecBlock is marked as full and the patch being written is
+   * rolled back.
    *
    * @param tag The tag associated with the registration, 0xFFFF is reserved for
    * unregistered shadows.
@@ -393,6 +901,100 @@ public:
    */
   uint16_t newShadow(uint16_t tag = ShadowReservedTag::Untagged);
 
+  /*! Register the callback of a break to the host of the instruction being
+   * written, once for the sites with the same callback and data. The record
+   * is rolled back with the patch.
+   *
+   * @param callback The callback function.
+   * @param data     The data of the callback.
+   *
+   * @return The value written by the generated code in
+   * hostState.callbackSite, never 0.
+   */
+  uint32_t newCallbackSite(rword callback, rword data);
+
+  /*! Get the callback site registered for the instruction being written.
+   *
+   * @param callback The callback function.
+   * @param data     The data of the callback.
+   *
+   * @return The value written by the generated code in
+   * hostState.callbackSite, or 0 if the callback isn't registered.
+   */
+  uint32_t getCallbackSite(rword callback, rword data) const;
+
+  /*! Get the number of callback records of the ExecBlock
+   */
+  inline size_t getCallbackSiteCount() const {
+    return callbackRegistry.size();
+  }
+
+  /*! Get the number of shadows the data block can hold
+   */
+  inline size_t getShadowCapacity() const {
+    return std::min<size_t>(
+        (dataBlock.allocatedSize() - shadowsOffset) / sizeof(rword),
+        std::numeric_limits<uint16_t>::max());
+  }
+
+  /*! Get the number of shadows allocated in the data block
+   */
+  inline size_t getShadowCount() const { return shadowIdx; }
+
+  /*! Return true if the ExecBlock became full because its data block had no
+   * shadow left
+   */
+  inline bool isShadowFull() const { return shadowsFull; }
+
+  /*! Reserve the ExecBlock to the superblocks. The hot code is kept
+   * contiguous, apart from the sequences executed once.
+   */
+  inline void setHot() { hot = true; }
+
+  /*! Return true if the ExecBlock only holds superblocks
+   */
+  inline bool isHot() const { return hot; }
+
+  /*! Mark that an InstrRule was applied on a sequence of the ExecBlock
+   */
+  inline void setInstrumented() { instrumented = true; }
+
+  /*! Return true if an InstrRule was applied on a sequence of the ExecBlock.
+   * The linked exits and the indirect branch cache only go to the sequences
+   * of the same ExecBlock.
+   */
+  inline bool isInstrumented() const { return instrumented; }
+
+  /*! Seal the ExecBlock before the process forks. No sequence is added to
+   * the ExecBlock and its exits aren't linked anymore: the code block is only
+   * written again to unlink an exit or when the ExecBlock is reclaimed.
+   */
+  void seal();
+
+  /*! Return true if the ExecBlock has been sealed
+   */
+  inline bool isSealed() const { return sealed; }
+
+  /*! Get the number of instructions written in the ExecBlock
+   */
+  inline size_t getInstCount() const { return instMetadata.size(); }
+
+  /*! Get the bytes of the heap used by the metadata of the instructions and
+   * the sequences (the InstMetadata and the registries)
+   */
+  size_t getMetadataMemory() const;
+
+  /*! Get the bytes of the heap used by the analyses cached in the ExecBlock
+   */
+  inline size_t getAnalysisMemory() const {
+    return analysisArena.getAllocatedSize();
+  }
+
+  /*! Drop the analyses cached in the ExecBlock, they are computed again by
+   * the next getInstAnalysis.
+   */
+  void clearInstAnalyses();
+
   /*! Search the last Shadow with the tag for the current instruction.
    *  Used by relocation to load or store data from the instrumented code.
    *
@@ -433,6 +1035,15 @@ public:
    */
   const llvm::ArrayRef<ShadowInfo> getShadowByInst(uint16_t instID) const;
 
+  /* Get the memory accesses of a sequence decoded when it was written. They
+   * are sorted by instruction.
+   *
+   * @param seqID  The id of the sequence in the ExecBlock
+   *
+   * @return the memory accesses of the sequence
+   */
+  llvm::ArrayRef<MemAccessInfo> getMemAccessBySeq(uint16_t seqID) const;
+
   /* Query registered shadows and returns a vector of matching shadowID
    *
    * @param
@@ -477,6 +1088,22 @@ public:
     return reinterpret_cast<rword>(codeBlock.base()) + tinfo.offset;
   }
 
+  /*! Get the size of the memory allocated for the ExecBlock
+   *
+   * @return The size in bytes of the code and data blocks.
+   */
+  inline size_t getAllocatedSize() const {
+    return codeBlock.allocatedSize() + dataBlock.allocatedSize();
+  }
+
+  /*! Get the size of the code block
+   */
+  inline size_t getCodeSize() const { return codeBlock.allocatedSize(); }
+
+  /*! Get the size of the data block
+   */
+  inline size_t getDataSize() const { return dataBlock.allocatedSize(); }
+
   /* Compute the occupation ratio of the ExecBlock.
    *
    * @return the occupation ratio.
@@ -20,27 +20,74 @@
 #include <stdlib.h>
 #include <utility>
 
+#include "llvm/MC/MCInst.h"
+#include "llvm/Support/Memory.h"
+#include "llvm/Support/Process.h"
+
 #include "Engine/LLVMCPU.h"
 #include "ExecBlock/ExecBlock.h"
 #include "ExecBlock/ExecBlockManager.h"
 #include "ExecBroker/ExecBroker.h"
 #include "Patch/InstMetadata.h"
+#include "Patch/InstrRule.h"
 #include "Patch/Patch.h"
 #include "Patch/PatchRules.h"
 #include "Patch/RelocatableInst.h"
 #include "Utility/LogSys.h"
+#include "Utility/System.h"
+
+#include "QBDI/Config.h"
 
 namespace QBDI {
 
 ExecBlockManager::ExecBlockManager(const LLVMCPUs &llvmCPUs,
-                                   VMInstanceRef vminstance)
-    : total_translated_size(1), total_translation_size(1),
-      vminstance(vminstance), llvmCPUs(llvmCPUs),
+                                   VMInstanceRef vminstance,
+                                   uint32_t codeBlockSize,
+                                   uint32_t dataBlockSize)
+    : blockAllocator(
+          (llvmCPUs.getOptions() & Options::OPT_ENABLE_HUGE_PAGES) != 0,
+          (llvmCPUs.getOptions() & Options::OPT_ENABLE_NUMA_BINDING) != 0),
+      regionCache(REGION_CACHE_SIZE, RegionCacheEntry{0, 0}),
+      total_translated_size(1), total_translation_size(1), needFlush(false),
+      cacheLimit(0), useClock(0), evictionCount(0), retranslationCount(0),
+      writtenCodeSize(0), stats(), vminstance(vminstance), llvmCPUs(llvmCPUs),
+      codeBlockSize(codeBlockSize), dataBlockSize(dataBlockSize),
       execBlockPrologue(getExecBlockPrologue(llvmCPUs.getOptions())),
       execBlockEpilogue(getExecBlockEpilogue(llvmCPUs.getOptions())) {
 
+  if (llvmCPUs.getOptions() & Options::OPT_ENABLE_SHARED_CONTEXT) {
+    uint64_t pageSize =
+        llvm::expectedToOptional(llvm::sys::Process::getPageSize())
+            .getValueOr(4096);
+    int handle = createSharedMemory(pageSize);
+    if (handle >= 0) {
+      llvm::sys::MemoryBlock block =
+          mapSharedMemory(handle, pageSize, nullptr);
+      if (block.base() != nullptr) {
+        sharedContext = std::make_unique<SharedContext>(
+            SharedContext{handle, static_cast<Context *>(block.base())});
+      } else {
+        releaseSharedMemory(handle);
+      }
+    }
+    if (not sharedContext) {
+      QBDI_WARN("Shared context not available, use a context per ExecBlock");
+    }
+  }
+
+  // The prologue and the epilogue only address the data block relatively to
+  // the PC on X86_64. The ExecBlocks of the regions have the same layout and
+  // can share their encoding.
+  if constexpr (is_x86_64) {
+    execBlockTemplate = std::make_unique<ExecBlockTemplate>();
+  }
+
+  trampoline = std::make_unique<ExecBlockTrampoline>(
+      llvmCPUs.getCPU(CPUMode::DEFAULT));
+
   auto execBrokerBlock = std::make_unique<ExecBlock>(
-      llvmCPUs, vminstance, &execBlockPrologue, &execBlockEpilogue, 0);
+      llvmCPUs, vminstance, &execBlockPrologue, &execBlockEpilogue, 0,
+      sharedContext.get(), 0, 0, nullptr, 0, nullptr, trampoline.get());
   epilogueSize = execBrokerBlock->getEpilogueSize();
   execBroker = std::make_unique<ExecBroker>(std::move(execBrokerBlock),
                                             llvmCPUs, vminstance);
@@ -49,6 +96,14 @@ ExecBlockManager::ExecBlockManager(const LLVMCPUs &llvmCPUs,
 ExecBlockManager::~ExecBlockManager() {
   QBDI_DEBUG_BLOCK({ this->printCacheStatistics(); });
   clearCache();
+  if (sharedContext) {
+    llvm::sys::MemoryBlock block(
+        sharedContext->context,
+        llvm::expectedToOptional(llvm::sys::Process::getPageSize())
+            .getValueOr(4096));
+    releaseMappedMemory(block);
+    releaseSharedMemory(sharedContext->handle);
+  }
 }
 
 void ExecBlockManager::changeVMInstanceRef(VMInstanceRef vminstance) {
@@ -92,6 +147,133 @@ void ExecBlockManager::printCacheStatistics() const {
   }
   QBDI_DEBUG("\tMean occupation ratio: {}", mean_occupation);
   QBDI_DEBUG("\tRegion overflow count: {}", region_overflow);
+  rword ibtcHits = 0;
+  rword ibtcMisses = 0;
+  getIBTCStats(ibtcHits, ibtcMisses);
+  QBDI_DEBUG("\tIndirect branch cache: {} hits, {} misses", ibtcHits,
+             ibtcMisses);
+  QBDI_DEBUG("\tCache size: 0x{:x} bytes, {} evictions, {} retranslations",
+             getCacheSize(), evictionCount, retranslationCount);
+  QBDI_DEBUG("\tExecBlock memory: 0x{:x} bytes mapped",
+             blockAllocator.getMappedSize());
+}
+
+void ExecBlockManager::bindToCurrentNumaNode() {
+  int previousNode = blockAllocator.getNumaNode();
+  if (blockAllocator.bindToCurrentNumaNode() and sharedContext and
+      blockAllocator.getNumaNode() != previousNode) {
+    uint64_t pageSize =
+        llvm::expectedToOptional(llvm::sys::Process::getPageSize())
+            .getValueOr(4096);
+    bindMemoryToNumaNode(
+        llvm::sys::MemoryBlock(sharedContext->context, pageSize),
+        blockAllocator.getNumaNode());
+  }
+}
+
+CacheStats ExecBlockManager::getCacheStats() const {
+  CacheStats res = stats;
+  res.regionCount = regions.size();
+  res.evictionCount = evictionCount;
+  res.retranslationCount = retranslationCount;
+  // the hits of the indirect branch cache are counted by the generated code
+  if (llvmCPUs.getOptions() & Options::OPT_ENABLE_INDIRECT_CACHE) {
+    getIBTCStats(res.ibtcHits, res.ibtcMisses);
+  }
+  if (res.codeSize != 0) {
+    res.occupationRatio = static_cast<float>(res.usedCodeSize) /
+                          static_cast<float>(res.codeSize);
+  }
+  if (res.shadowSize != 0) {
+    res.shadowRatio = static_cast<float>(res.usedShadowSize) /
+                      static_cast<float>(res.shadowSize);
+  }
+  res.expansionRatio = getExpansionRatio();
+  return res;
+}
+
+MemoryStats ExecBlockManager::getMemoryStats() const {
+  MemoryStats res = {};
+  res.codeSize = stats.codeSize;
+  res.dataSize = stats.dataSize;
+  res.regionMapSize = regions.capacity() * sizeof(ExecRegion) +
+                      regionCache.capacity() * sizeof(RegionCacheEntry);
+  for (const ExecRegion &region : regions) {
+    for (const auto &block : region.blocks) {
+      res.metadataSize += sizeof(ExecBlock) + block->getMetadataMemory();
+      res.analysisSize += block->getAnalysisMemory();
+      res.instCount += block->getInstCount();
+    }
+    res.regionMapSize +=
+        region.blocks.capacity() * sizeof(std::unique_ptr<ExecBlock>) +
+        region.sequenceCache.memorySize() + region.instCache.memorySize() +
+        region.superBlockCache.memorySize() +
+        region.superBlockRanges.getRanges().capacity() * sizeof(Range<rword>) +
+        region.executionCount.memorySize() +
+        region.instrRuleIDs.capacity() * sizeof(uint32_t);
+    // the captures of the lambdas allocated on the heap aren't counted
+    res.callbackSize +=
+        region.userInstCB.capacity() * sizeof(std::unique_ptr<InstCbLambda>) +
+        region.userInstCB.size() * sizeof(InstCbLambda);
+  }
+  res.totalSize = res.codeSize + res.dataSize + res.metadataSize +
+                  res.analysisSize + res.regionMapSize + res.callbackSize;
+  return res;
+}
+
+void ExecBlockManager::addBlockStats(const ExecBlock &block) {
+  stats.execBlockCount++;
+  stats.codeSize += block.getCodeSize();
+  stats.dataSize += block.getDataSize();
+  stats.usedCodeSize += block.getCodeSize() - block.getEpilogueOffset();
+  stats.shadowSize += block.getShadowCapacity() * sizeof(rword);
+  stats.usedShadowSize += block.getShadowCount() * sizeof(rword);
+}
+
+void ExecBlockManager::removeBlockStats(const ExecBlock &block) {
+  stats.execBlockCount--;
+  stats.codeSize -= block.getCodeSize();
+  stats.dataSize -= block.getDataSize();
+  stats.usedCodeSize -= block.getCodeSize() - block.getEpilogueOffset();
+  stats.shadowSize -= block.getShadowCapacity() * sizeof(rword);
+  stats.usedShadowSize -= block.getShadowCount() * sizeof(rword);
+}
+
+void ExecBlockManager::updateShadowStats(const ExecBlock &block,
+                                         size_t shadowCount, bool shadowFull) {
+  stats.usedShadowSize +=
+      (block.getShadowCount() - shadowCount) * sizeof(rword);
+  if (shadowFull or not block.isShadowFull()) {
+    return;
+  }
+  stats.shadowFullCount++;
+  // The shadows filled the ExecBlock before half of its code block, the next
+  // ExecBlocks get a larger data block
+  if (block.getEpilogueOffset() * 2 > block.getCodeSize() and
+      dataBlockSize < MAX_DATA_BLOCK_SIZE) {
+    size_t current = std::max<size_t>(dataBlockSize, block.getDataSize());
+    dataBlockSize = std::min<size_t>(MAX_DATA_BLOCK_SIZE, current * 2);
+    QBDI_DEBUG("Shadow pressure: data block size increased to 0x{:x}",
+               dataBlockSize);
+  }
+}
+
+void ExecBlockManager::removeRegionStats(const ExecRegion &region) {
+  for (const auto &block : region.blocks) {
+    removeBlockStats(*block);
+  }
+  stats.sequenceCount -= region.sequenceCache.size();
+}
+
+void ExecBlockManager::getIBTCStats(rword &hits, rword &misses) const {
+  hits = 0;
+  misses = 0;
+  for (const auto &r : regions) {
+    for (const auto &block : r.blocks) {
+      hits += block->getIBTCHits();
+      misses += block->getIBTCMisses();
+    }
+  }
 }
 
 ExecBlock *ExecBlockManager::getProgrammedExecBlock(rword address,
@@ -102,9 +284,10 @@ ExecBlock *ExecBlockManager::getProgrammedExecBlock(rword address,
 
   if (r < regions.size() && regions[r].covered.contains(address)) {
     ExecRegion &region = regions[r];
+    region.lastUse = ++useClock;
 
     // Attempting sequenceCache resolution
-    const std::map<rword, SeqLoc>::const_iterator seqLoc =
+    const AddressMap<SeqLoc>::const_iterator seqLoc =
         region.sequenceCache.find(address);
     if (seqLoc != region.sequenceCache.end()) {
       QBDI_DEBUG("Found sequence 0x{:x} in ExecBlock 0x{:x} as seqID {:x}",
@@ -116,44 +299,40 @@ ExecBlock *ExecBlockManager::getProgrammedExecBlock(rword address,
       if (programmedSeqLock != nullptr) {
         *programmedSeqLock = seqLoc->second;
       }
+      stats.cacheHits++;
       // Select sequence and return execBlock
       region.blocks[seqLoc->second.blockIdx]->selectSeq(seqLoc->second.seqID);
       return region.blocks[seqLoc->second.blockIdx].get();
     }
 
-    // Attempting instCache resolution
-    const std::map<rword, InstLoc>::const_iterator instLoc =
+    // Attempting instCache resolution, the sequence is entered in the middle
+    // without creating a new one
+    const AddressMap<InstLoc>::const_iterator instLoc =
         region.instCache.find(address);
     if (instLoc != region.instCache.end()) {
-      // Retrieving corresponding block and seqLoc
       ExecBlock *block = region.blocks[instLoc->second.blockIdx].get();
-      uint16_t existingSeqId = block->getSeqID(instLoc->second.instID);
-      const SeqLoc &existingSeqLoc =
-          region.sequenceCache[block
-                                   ->getInstMetadata(
-                                       block->getSeqStart(existingSeqId))
-                                   .address];
-      // Creating a new sequence at that instruction and
-      // saving it in the sequenceCache
-      uint16_t newSeqID = block->splitSequence(instLoc->second.instID);
-      regions[r].sequenceCache[address] = SeqLoc{
-          instLoc->second.blockIdx, newSeqID, existingSeqLoc.bbEnd, address,
-          existingSeqLoc.seqEnd,
-      };
-      QBDI_DEBUG(
-          "Splitted seqID {:x} at instID {:x} in ExecBlock 0x{:x} as new "
-          "sequence with seqID {:x}",
-          existingSeqId, instLoc->second.instID,
-          reinterpret_cast<uintptr_t>(block), newSeqID);
-      // copy current sequence info
+      uint16_t seqID = block->getSeqID(instLoc->second.instID);
+      const AddressMap<SeqLoc>::const_iterator existingSeqLoc =
+          region.sequenceCache.find(
+              block->getInstMetadata(block->getSeqStart(seqID)).address);
+      QBDI_REQUIRE_ACTION(existingSeqLoc != region.sequenceCache.end(),
+                          abort());
+      QBDI_DEBUG("Found instruction 0x{:x} in seqID {:x} of ExecBlock 0x{:x}",
+                 address, seqID, reinterpret_cast<uintptr_t>(block));
+      stats.cacheHits++;
+      stats.splitCount++;
       if (programmedSeqLock != nullptr) {
-        *programmedSeqLock = regions[r].sequenceCache[address];
+        *programmedSeqLock = SeqLoc{
+            instLoc->second.blockIdx, seqID, existingSeqLoc->second.bbEnd,
+            address, existingSeqLoc->second.seqEnd,
+        };
       }
-      block->selectSeq(newSeqID);
+      block->selectEntry(instLoc->second.instID);
       return block;
     }
   }
   QBDI_DEBUG("Cache miss for sequence 0x{:x}", address);
+  stats.cacheMisses++;
   return nullptr;
 }
 
@@ -166,7 +345,7 @@ const ExecBlock *ExecBlockManager::getExecBlock(rword address) const {
     const ExecRegion &region = regions[r];
 
     // Attempting instCache resolution
-    const std::map<rword, InstLoc>::const_iterator instLoc =
+    const AddressMap<InstLoc>::const_iterator instLoc =
         region.instCache.find(address);
     if (instLoc != region.instCache.end()) {
       QBDI_DEBUG("Found address 0x{:x} in ExecBlock 0x{:x}", address,
@@ -179,10 +358,22 @@ const ExecBlock *ExecBlockManager::getExecBlock(rword address) const {
   return nullptr;
 }
 
+rword ExecBlockManager::getOriginalAddress(rword codeAddress) const {
+  for (const ExecRegion &region : regions) {
+    for (const std::unique_ptr<ExecBlock> &block : region.blocks) {
+      uint16_t instID = block->getInstIDOfCode(codeAddress);
+      if (instID != NOT_FOUND) {
+        return block->getInstAddress(instID);
+      }
+    }
+  }
+  return 0;
+}
+
 const SeqLoc *ExecBlockManager::getSeqLoc(rword address) const {
   size_t r = searchRegion(address);
   if (r < regions.size() && regions[r].covered.contains(address)) {
-    const std::map<rword, SeqLoc>::const_iterator seqLoc =
+    const AddressMap<SeqLoc>::const_iterator seqLoc =
         regions[r].sequenceCache.find(address);
     if (seqLoc != regions[r].sequenceCache.end()) {
       return &(seqLoc->second);
@@ -191,8 +382,7 @@ const SeqLoc *ExecBlockManager::getSeqLoc(rword address) const {
   return nullptr;
 }
 
-size_t
-ExecBlockManager::preWriteBasicBlock(const std::vector<Patch> &basicBlock) {
+size_t ExecBlockManager::preWriteBasicBlock(std::vector<Patch> &basicBlock) {
   // prereserve the region in the cache and return the instruction that are
   // already in the cache for this basicBlock
 
@@ -210,14 +400,25 @@ ExecBlockManager::preWriteBasicBlock(const std::vector<Patch> &basicBlock) {
     patchEnd--;
   }
 
+  // The patches use their near alternative until an ExecBlock of the region
+  // is allocated too far from the code
+  if (not region.farBlocks) {
+    for (size_t i = 0; i < patchEnd; i++) {
+      basicBlock[i].useNearInsts();
+    }
+  }
+
   return patchEnd;
 }
 
-void ExecBlockManager::writeBasicBlock(std::vector<Patch> &&basicBlock,
-                                       size_t patchEnd) {
+rword ExecBlockManager::writeBasicBlock(
+    std::vector<Patch> &&basicBlock, size_t patchEnd,
+    const std::vector<uint32_t> &instrRuleIDs) {
   unsigned translated = 0;
   unsigned translation = 0;
+  unsigned optimized = 0;
   size_t patchIdx = 0;
+  rword unwritten = 0;
   const Patch &firstPatch = basicBlock.front();
   const Patch &lastPatch = basicBlock.back();
   rword bbStart = firstPatch.metadata.address;
@@ -247,28 +448,65 @@ void ExecBlockManager::writeBasicBlock(std::vector<Patch> &&basicBlock,
   if (patchEnd == 0) {
     QBDI_DEBUG("Cache hit, basic block 0x{:x} already exist",
                firstPatch.metadata.address);
-    return;
+    return 0;
   }
   QBDI_DEBUG("Writting new basic block 0x{:x}", firstPatch.metadata.address);
+  region.lastUse = ++useClock;
+  addInstrRuleIDs(region, instrRuleIDs);
+  if (evictedRanges.overlaps(bbRange)) {
+    retranslationCount++;
+  }
+
+  // The new ExecBlocks are allocated near the code to reach its memory
+  rword nearAddress = 0;
+#if defined(QBDI_ARCH_X86_64)
+  if ((llvmCPUs.getOptions() & Options::OPT_ENABLE_NEAR_EXECBLOCK) != 0 and
+      not region.farBlocks) {
+    nearAddress = bbStart;
+  }
+#endif // QBDI_ARCH_X86_64
 
   // Writing the basic block as one or more sequences
-  while (patchIdx < patchEnd) {
+  while (patchIdx < patchEnd and unwritten == 0) {
     // Attempting to find an ExecBlock in the region
     for (size_t i = 0; true; i++) {
       // If the region doesn't have enough space in its ExecBlocks, we add one.
       // Optimally, a region should only have one ExecBlocks but misspredictions
       // or oversized basic blocks can cause overflows.
-      if (i >= region.blocks.size()) {
+      bool newBlock = i >= region.blocks.size();
+      // the ExecBlocks of the superblocks only hold hot code
+      if (not newBlock and region.blocks[i]->isHot()) {
+        continue;
+      }
+      if (newBlock) {
         QBDI_REQUIRE_ACTION(i < (1 << 16), abort());
         region.blocks.emplace_back(std::make_unique<ExecBlock>(
             llvmCPUs, vminstance, &execBlockPrologue, &execBlockEpilogue,
-            epilogueSize));
+            epilogueSize, sharedContext.get(), codeBlockSize, dataBlockSize,
+            execBlockTemplate.get(), nearAddress, &blockAllocator,
+            trampoline.get()));
+        blockRegistry.add(*region.blocks.back());
+        addBlockStats(*region.blocks.back());
+        if (cacheLimit != 0) {
+          evictRegions(r);
+        }
       }
       // Write sequence
+      rword available = region.blocks[i]->getEpilogueOffset();
+      size_t shadowCount = region.blocks[i]->getShadowCount();
+      bool shadowFull = region.blocks[i]->isShadowFull();
       SeqWriteResult res = region.blocks[i]->writeSequence(
           basicBlock.begin() + patchIdx, basicBlock.begin() + patchEnd);
+      updateShadowStats(*region.blocks[i], shadowCount, shadowFull);
       // Successful write
       if (res.seqID != EXEC_BLOCK_FULL) {
+        if (not instrRuleIDs.empty()) {
+          region.blocks[i]->setInstrumented();
+        }
+        stats.sequenceCount++;
+        stats.usedCodeSize +=
+            available - region.blocks[i]->getEpilogueOffset();
+        writtenCodeSize += available - region.blocks[i]->getEpilogueOffset();
         // Saving sequence in the sequence cache
         regions[r]
             .sequenceCache[basicBlock[patchIdx].metadata.address] = SeqLoc{
@@ -283,6 +521,7 @@ void ExecBlockManager::writeBasicBlock(std::vector<Patch> &&basicBlock,
         for (size_t j = 0; j < res.patchWritten; j++) {
           region.instCache[basicBlock[patchIdx + j].metadata.address] = InstLoc{
               static_cast<uint16_t>(i), static_cast<uint16_t>(startID + j)};
+          optimized += basicBlock[patchIdx + j].optimizedSize;
           std::move(basicBlock[patchIdx + j].userInstCB.begin(),
                     basicBlock[patchIdx + j].userInstCB.end(),
                     std::back_inserter(region.userInstCB));
@@ -301,15 +540,180 @@ void ExecBlockManager::writeBasicBlock(std::vector<Patch> &&basicBlock,
         patchIdx += res.patchWritten;
         break;
       }
+      // No ExecBlock near the code is available, the patches left must be
+      // generated again without their near alternative
+      if (newBlock and not region.blocks[i]->canReach(basicBlock[patchIdx])) {
+        QBDI_DEBUG("No ExecBlock can reach the memory of 0x{:x}",
+                   basicBlock[patchIdx].metadata.address);
+        region.farBlocks = true;
+        unwritten = basicBlock[patchIdx].metadata.address;
+        break;
+      }
     }
   }
   // Updating stats
   total_translation_size += translation;
   total_translated_size += translated;
+  stats.translationSize += translation;
+  stats.translatedSize += translated;
+  stats.optimizedSize += optimized;
   updateRegionStat(r, translated);
+  return unwritten;
+}
+
+ExecBlock *
+ExecBlockManager::getProgrammedSuperBlock(rword address,
+                                          SeqLoc *programmedSeqLock) {
+  size_t r = searchRegion(address);
+
+  if (r < regions.size() && regions[r].covered.contains(address)) {
+    ExecRegion &region = regions[r];
+    const AddressMap<SeqLoc>::const_iterator seqLoc =
+        region.superBlockCache.find(address);
+    if (seqLoc != region.superBlockCache.end()) {
+      QBDI_DEBUG("Found superblock 0x{:x} in ExecBlock 0x{:x} as seqID {:x}",
+                 address,
+                 reinterpret_cast<uintptr_t>(
+                     region.blocks[seqLoc->second.blockIdx].get()),
+                 seqLoc->second.seqID);
+      region.lastUse = ++useClock;
+      if (programmedSeqLock != nullptr) {
+        *programmedSeqLock = seqLoc->second;
+      }
+      stats.cacheHits++;
+      region.blocks[seqLoc->second.blockIdx]->selectSeq(seqLoc->second.seqID);
+      return region.blocks[seqLoc->second.blockIdx].get();
+    }
+  }
+  return nullptr;
+}
+
+uint32_t ExecBlockManager::countExecution(rword address) {
+  size_t r = searchRegion(address);
+  if (r < regions.size() && regions[r].covered.contains(address)) {
+    return ++regions[r].executionCount[address];
+  }
+  return 0;
+}
+
+bool ExecBlockManager::writeSuperBlock(
+    std::vector<Patch> &&superBlock,
+    const std::vector<uint32_t> &instrRuleIDs) {
+  QBDI_REQUIRE_ACTION(not superBlock.empty(), return false);
+  rword head = superBlock.front().metadata.address;
+
+  // The superblock is written in the region of its first instruction
+  size_t r = searchRegion(head);
+  if (r >= regions.size() or not regions[r].covered.contains(head) or
+      regions[r].toFlush) {
+    return false;
+  }
+  ExecRegion &region = regions[r];
+
+  // The superblocks are written in dedicated ExecBlocks, the hot code of the
+  // region stays contiguous instead of being interleaved with the sequences
+  // executed a few times.
+  for (size_t i = 0; true; i++) {
+    if (i < region.blocks.size() and not region.blocks[i]->isHot()) {
+      continue;
+    }
+    if (i >= region.blocks.size()) {
+      QBDI_REQUIRE_ACTION(i < (1 << 16), abort());
+      region.blocks.emplace_back(std::make_unique<ExecBlock>(
+          llvmCPUs, vminstance, &execBlockPrologue, &execBlockEpilogue,
+          epilogueSize, sharedContext.get(), codeBlockSize, dataBlockSize,
+          execBlockTemplate.get(), 0, &blockAllocator, trampoline.get()));
+      region.blocks.back()->setHot();
+      blockRegistry.add(*region.blocks.back());
+      addBlockStats(*region.blocks.back());
+      if (cacheLimit != 0) {
+        evictRegions(r);
+      }
+    }
+    // A partial write is still a valid superblock: the last sequence ends
+    // with a terminator or a change of PC
+    rword available = region.blocks[i]->getEpilogueOffset();
+    size_t shadowCount = region.blocks[i]->getShadowCount();
+    bool shadowFull = region.blocks[i]->isShadowFull();
+    SeqWriteResult res =
+        region.blocks[i]->writeSequence(superBlock.begin(), superBlock.end());
+    updateShadowStats(*region.blocks[i], shadowCount, shadowFull);
+    if (res.seqID == EXEC_BLOCK_FULL) {
+      continue;
+    }
+    if (not instrRuleIDs.empty()) {
+      region.blocks[i]->setInstrumented();
+    }
+    stats.usedCodeSize += available - region.blocks[i]->getEpilogueOffset();
+    writtenCodeSize += available - region.blocks[i]->getEpilogueOffset();
+    rword seqEnd = superBlock[res.patchWritten - 1].metadata.endAddress();
+    region.superBlockCache[head] =
+        SeqLoc{static_cast<uint16_t>(i), res.seqID, seqEnd, head, seqEnd};
+    addInstrRuleIDs(region, instrRuleIDs);
+    for (size_t j = 0; j < res.patchWritten; j++) {
+      region.superBlockRanges.add(
+          Range<rword>(superBlock[j].metadata.address,
+                       superBlock[j].metadata.endAddress()));
+      std::move(superBlock[j].userInstCB.begin(),
+                superBlock[j].userInstCB.end(),
+                std::back_inserter(region.userInstCB));
+      superBlock[j].userInstCB.clear();
+    }
+    QBDI_DEBUG("Superblock 0x{:x} of {} instructions written in ExecBlock "
+               "0x{:x} as seqID {:x}",
+               head, res.patchWritten,
+               reinterpret_cast<uintptr_t>(region.blocks[i].get()), res.seqID);
+    // the exits linked to the sequence of the head can use the superblock
+    for (auto &block : region.blocks) {
+      block->unlinkExits(head);
+    }
+    return true;
+  }
 }
 
-size_t ExecBlockManager::searchRegion(rword address) const {
+void ExecBlockManager::clearSuperBlocks(Range<rword> range) {
+  for (ExecRegion &region : regions) {
+    if (region.superBlockCache.empty() or
+        not region.superBlockRanges.overlaps(range)) {
+      continue;
+    }
+    QBDI_DEBUG("Drop the superblocks of region [0x{:x}, 0x{:x}]",
+               region.covered.start(), region.covered.end());
+    region.superBlockCache.clear();
+    region.superBlockRanges = RangeSet<rword>();
+    region.executionCount.clear();
+    // the code of the superblocks stays until the next flushCommit, but no
+    // exit may jump to it
+    for (auto &block : region.blocks) {
+      block->unlinkExits();
+    }
+    // the ExecBlocks of the superblocks are reclaimed with the flush
+    region.hasDeadSequences = true;
+    needFlush = true;
+  }
+}
+
+void ExecBlockManager::clearInstAnalyses() {
+  for (ExecRegion &region : regions) {
+    for (auto &block : region.blocks) {
+      block->clearInstAnalyses();
+    }
+  }
+}
+
+void ExecBlockManager::addInstrRuleIDs(ExecRegion &region,
+                                       const std::vector<uint32_t> &ids) {
+  if (ids.empty()) {
+    return;
+  }
+  std::vector<uint32_t> merged;
+  merged.reserve(region.instrRuleIDs.size() + ids.size());
+  std::set_union(region.instrRuleIDs.begin(), region.instrRuleIDs.end(),
+                 ids.begin(), ids.end(), std::back_inserter(merged));
+  region.instrRuleIDs.swap(merged);
+}
+
+size_t ExecBlockManager::searchRegionSlow(rword address) const {
   size_t low = 0;
   size_t high = regions.size();
   if (regions.size() == 0) {
@@ -326,11 +730,17 @@ size_t ExecBlockManager::searchRegion(rword address) const {
     } else {
       QBDI_DEBUG("Exact match for region {} [0x{:x}, 0x{:x}]", idx,
                  regions[idx].covered.start(), regions[idx].covered.end());
-      return idx;
+      low = idx;
+      break;
     }
   }
-  QBDI_DEBUG("Low match for region {} [0x{:x}, 0x{:x}]", low,
-             regions[low].covered.start(), regions[low].covered.end());
+  if (regions[low].covered.contains(address)) {
+    regionCache[(address >> REGION_CACHE_PAGE_SHIFT) % REGION_CACHE_SIZE] =
+        RegionCacheEntry{address >> REGION_CACHE_PAGE_SHIFT, low};
+  } else {
+    QBDI_DEBUG("Low match for region {} [0x{:x}, 0x{:x}]", low,
+               regions[low].covered.start(), regions[low].covered.end());
+  }
   return low;
 }
 
@@ -357,6 +767,17 @@ void ExecBlockManager::mergeRegion(size_t i) {
         it.second.instID,
     };
   }
+  // Superblocks
+  for (const auto &it : regions[i + 1].superBlockCache) {
+    regions[i].superBlockCache[it.first] = SeqLoc{
+        static_cast<uint16_t>(it.second.blockIdx + regions[i].blocks.size()),
+        it.second.seqID, it.second.bbEnd, it.second.seqStart, it.second.seqEnd};
+  }
+  regions[i].superBlockRanges.add(regions[i + 1].superBlockRanges);
+  addInstrRuleIDs(regions[i], regions[i + 1].instrRuleIDs);
+  for (const auto &it : regions[i + 1].executionCount) {
+    regions[i].executionCount[it.first] = it.second;
+  }
 
   // range
   regions[i].covered.setEnd(regions[i + 1].covered.end());
@@ -366,6 +787,8 @@ void ExecBlockManager::mergeRegion(size_t i) {
             std::back_inserter(regions[i].blocks));
   // flush
   regions[i].toFlush |= regions[i + 1].toFlush;
+  regions[i].hasDeadSequences |= regions[i + 1].hasDeadSequences;
+  regions[i].farBlocks |= regions[i + 1].farBlocks;
 
   regions.erase(regions.begin() + i + 1);
 }
@@ -506,6 +929,57 @@ void ExecBlockManager::updateRegionStat(size_t r, rword translated) {
   }
 }
 
+size_t ExecBlockManager::getCacheSize() const {
+  size_t size = 0;
+  for (const auto &r : regions) {
+    if (not r.toFlush) {
+      for (const auto &block : r.blocks) {
+        size += block->getAllocatedSize();
+      }
+    }
+  }
+  return size;
+}
+
+void ExecBlockManager::evictRegions(size_t current) {
+  size_t cacheSize = getCacheSize();
+  if (cacheSize <= cacheLimit) {
+    return;
+  }
+  // Evict the least recently used regions. The regions are only marked, they
+  // are erased at the next flushCommit when no ExecBlock runs.
+  std::vector<size_t> candidates;
+  for (size_t i = 0; i < regions.size(); i++) {
+    if (i != current and not regions[i].toFlush) {
+      candidates.push_back(i);
+    }
+  }
+  std::sort(candidates.begin(), candidates.end(),
+            [this](size_t a, size_t b) {
+              return regions[a].lastUse < regions[b].lastUse;
+            });
+  for (size_t i : candidates) {
+    if (cacheSize <= cacheLimit) {
+      break;
+    }
+    ExecRegion &region = regions[i];
+    QBDI_DEBUG("Evict region {} [0x{:x}, 0x{:x}]", i, region.covered.start(),
+               region.covered.end());
+    for (auto &block : region.blocks) {
+      cacheSize -= block->getAllocatedSize();
+      block->unlinkExits();
+    }
+    region.toFlush = true;
+    needFlush = true;
+    evictedRanges.add(region.covered);
+    evictionCount++;
+  }
+  if (cacheSize > cacheLimit) {
+    QBDI_DEBUG("Cache size 0x{:x} exceeds the limit 0x{:x}", cacheSize,
+               cacheLimit);
+  }
+}
+
 void ExecBlockManager::clearCache(RangeSet<rword> rangeSet) {
   const std::vector<Range<rword>> &ranges = rangeSet.getRanges();
   for (Range<rword> r : ranges) {
@@ -516,47 +990,250 @@ void ExecBlockManager::clearCache(RangeSet<rword> rangeSet) {
   total_translation_size = 1;
 }
 
+void ExecBlockManager::clearCache(const InstrRule &rule) {
+  const RangeSet<rword> range = rule.affectedRange();
+  std::vector<unsigned> opcodes;
+  bool anyOpcode = not rule.getOpcodes(opcodes);
+  std::sort(opcodes.begin(), opcodes.end());
+
+  for (ExecRegion &region : regions) {
+    if (region.toFlush) {
+      continue;
+    }
+    // the superblocks may inline code outside of the region
+    const std::vector<Range<rword>> &inlined =
+        region.superBlockRanges.getRanges();
+    if (not range.overlaps(region.covered) and
+        std::none_of(inlined.begin(), inlined.end(),
+                     [&range](const Range<rword> &r) {
+                       return range.overlaps(r);
+                     })) {
+      continue;
+    }
+    // look for an instruction of the region that the rule may instrument
+    bool affected = false;
+    for (size_t b = 0; b < region.blocks.size() and not affected; b++) {
+      const ExecBlock &block = *region.blocks[b];
+      for (uint16_t id = 0; id < block.getNextInstID() and not affected;
+           id++) {
+        const CachedInstMetadata &metadata = block.getInstMetadata(id);
+        affected =
+            (anyOpcode or std::binary_search(opcodes.begin(), opcodes.end(),
+                                             metadata.opcode)) and
+            range.overlaps(
+                Range<rword>(metadata.address, metadata.endAddress())) and
+            rule.mayInstrument(block.getOriginalInstMetadata(id),
+                               llvmCPUs.getCPU(metadata.cpuMode));
+      }
+    }
+    if (affected) {
+      QBDI_DEBUG("Erasing region [0x{:x}, 0x{:x}] for a new InstrRule",
+                 region.covered.start(), region.covered.end());
+      region.toFlush = true;
+      needFlush = true;
+      for (auto &block : region.blocks) {
+        block->unlinkExits();
+      }
+    }
+  }
+}
+
+void ExecBlockManager::clearInstrRule(uint32_t id) {
+  for (ExecRegion &region : regions) {
+    if (not region.toFlush and
+        std::binary_search(region.instrRuleIDs.begin(),
+                           region.instrRuleIDs.end(), id)) {
+      QBDI_DEBUG("Erasing region [0x{:x}, 0x{:x}] for InstrRule {:x}",
+                 region.covered.start(), region.covered.end(), id);
+      region.toFlush = true;
+      needFlush = true;
+      for (auto &block : region.blocks) {
+        block->unlinkExits();
+      }
+    }
+  }
+}
+
+void ExecBlockManager::reclaimBlocks(ExecRegion &region) {
+  region.hasDeadSequences = false;
+  if (region.sequenceCache.empty() and region.superBlockCache.empty()) {
+    QBDI_DEBUG("No live sequence in region [0x{:x}, 0x{:x}]",
+               region.covered.start(), region.covered.end());
+    region.toFlush = true;
+    return;
+  }
+  std::vector<bool> live(region.blocks.size(), false);
+  for (const auto &it : region.sequenceCache) {
+    live[it.second.blockIdx] = true;
+  }
+  for (const auto &it : region.superBlockCache) {
+    live[it.second.blockIdx] = true;
+  }
+  // Only the last ExecBlocks can be removed without changing the index of the
+  // others
+  size_t nbBlocks = region.blocks.size();
+  while (not live[nbBlocks - 1]) {
+    nbBlocks--;
+  }
+  if (nbBlocks == region.blocks.size()) {
+    return;
+  }
+  QBDI_DEBUG("Reclaim {} ExecBlocks of region [0x{:x}, 0x{:x}]",
+             region.blocks.size() - nbBlocks, region.covered.start(),
+             region.covered.end());
+  std::vector<rword> deadInsts;
+  for (const auto &it : region.instCache) {
+    if (it.second.blockIdx >= nbBlocks) {
+      deadInsts.push_back(it.first);
+    }
+  }
+  for (rword address : deadInsts) {
+    region.instCache.erase(address);
+  }
+  for (size_t i = nbBlocks; i < region.blocks.size(); i++) {
+    removeBlockStats(*region.blocks[i]);
+  }
+  region.blocks.resize(nbBlocks);
+  region.available = region.blocks[0]->getEpilogueOffset();
+}
+
 void ExecBlockManager::flushCommit() {
   // It needs to be erased from last to first to preserve index validity
   if (needFlush) {
     QBDI_DEBUG("Flushing analysis caches");
+    for (ExecRegion &region : regions) {
+      if (region.hasDeadSequences and not region.toFlush) {
+        reclaimBlocks(region);
+      }
+    }
     regions.erase(std::remove_if(regions.begin(), regions.end(),
-                                 [](const ExecRegion &r) -> bool {
-                                   if (r.toFlush)
+                                 [this](const ExecRegion &r) -> bool {
+                                   if (r.toFlush) {
                                      QBDI_DEBUG(
                                          "Erasing region [0x{:x}, 0x{:x}]",
                                          r.covered.start(), r.covered.end());
+                                     removeRegionStats(r);
+                                   }
                                    return r.toFlush;
                                  }),
                   regions.end());
     needFlush = false;
+    stats.flushCount++;
   }
 }
 
+void ExecBlockManager::clearSequences(ExecRegion &region,
+                                      const Range<rword> &range) {
+  // The sequences that overlap the range are removed from the caches, the
+  // lookups never return them again. Their code stays in the ExecBlocks until
+  // the ExecBlocks are reclaimed.
+  std::vector<rword> deadSeqs;
+  RangeSet<rword> deadCode;
+  for (const auto &it : region.sequenceCache) {
+    Range<rword> seqRange{it.second.seqStart, it.second.seqEnd};
+    if (seqRange.overlaps(range)) {
+      deadSeqs.push_back(it.first);
+      deadCode.add(seqRange);
+    }
+  }
+  if (deadSeqs.empty()) {
+    return;
+  }
+  QBDI_DEBUG("Remove {} sequences of region [0x{:x}, 0x{:x}]", deadSeqs.size(),
+             region.covered.start(), region.covered.end());
+  for (rword address : deadSeqs) {
+    region.sequenceCache.erase(address);
+    // the region may be executed until the next flushCommit, but no exit may
+    // jump to a removed sequence
+    for (auto &block : region.blocks) {
+      block->unlinkExits(address);
+    }
+  }
+  stats.sequenceCount -= deadSeqs.size();
+
+  std::vector<rword> deadInsts;
+  for (const auto &it : region.instCache) {
+    if (deadCode.contains(it.first)) {
+      deadInsts.push_back(it.first);
+    }
+  }
+  for (rword address : deadInsts) {
+    region.instCache.erase(address);
+  }
+  region.hasDeadSequences = true;
+  needFlush = true;
+}
+
 void ExecBlockManager::clearCache(Range<rword> range) {
-  size_t i = 0;
   QBDI_DEBUG("Erasing range [0x{:x}, 0x{:x}]", range.start(), range.end());
-  for (i = 0; i < regions.size(); i++) {
-    if (regions[i].covered.overlaps(range)) {
-      regions[i].toFlush = true;
-      needFlush = true;
+  for (ExecRegion &region : regions) {
+    if (region.covered.overlaps(range) and not region.toFlush) {
+      clearSequences(region, range);
     }
   }
+  // the superblocks of the other regions may inline a part of the range
+  clearSuperBlocks(range);
 }
 
 void ExecBlockManager::clearCache(bool flushNow) {
   QBDI_DEBUG("Erasing all cache");
   if (flushNow) {
     regions.clear();
+    stats.execBlockCount = 0;
+    stats.sequenceCount = 0;
+    stats.codeSize = 0;
+    stats.dataSize = 0;
+    stats.usedCodeSize = 0;
+    stats.shadowSize = 0;
+    stats.usedShadowSize = 0;
+    stats.flushCount++;
     total_translated_size = 1;
     total_translation_size = 1;
     needFlush = false;
+    evictedRanges = RangeSet<rword>();
   } else {
     for (auto &r : regions) {
       r.toFlush = true;
       needFlush = true;
     }
+    unlinkExits();
+  }
+}
+
+void ExecBlockManager::unlinkExits() {
+  QBDI_DEBUG("Unlink all the sequences");
+  for (auto &r : regions) {
+    for (auto &block : r.blocks) {
+      block->unlinkExits();
+    }
+  }
+}
+
+void ExecBlockManager::unlinkExits(rword target) {
+  // The exits can only be linked to a sequence of the same ExecBlock
+  size_t r = searchRegion(target);
+  if (r < regions.size() && regions[r].covered.contains(target)) {
+    for (auto &block : regions[r].blocks) {
+      block->unlinkExits(target);
+    }
+  }
+}
+
+size_t ExecBlockManager::sealCache() {
+  if (needFlush) {
+    flushCommit();
+  }
+  size_t count = 0;
+  for (auto &r : regions) {
+    for (auto &block : r.blocks) {
+      if (not block->isSealed()) {
+        block->seal();
+        count++;
+      }
+    }
   }
+  QBDI_DEBUG("Seal {} ExecBlocks", count);
+  return count;
 }
 
 } // namespace QBDI
@@ -19,23 +19,27 @@
 #define EXECBLOCKMANAGER_H
 
 #include <algorithm>
-#include <map>
 #include <memory>
 #include <stddef.h>
 #include <stdint.h>
 #include <vector>
 
+#include "QBDI/CacheStats.h"
 #include "QBDI/Callback.h"
 #include "QBDI/Range.h"
 #include "QBDI/State.h"
+#include "Utility/AddressMap.h"
 
 namespace QBDI {
 
 class ExecBlock;
 class ExecBroker;
+class InstrRule;
 class LLVMCPUs;
 class Patch;
 class RelocatableInst;
+struct ExecBlockTemplate;
+struct SharedContext;
 
 struct InstLoc {
   uint16_t blockIdx;
@@ -55,9 +59,25 @@ struct ExecRegion {
   unsigned translated;
   unsigned available;
   std::vector<std::unique_ptr<ExecBlock>> blocks;
-  std::map<rword, SeqLoc> sequenceCache;
-  std::map<rword, InstLoc> instCache;
+  AddressMap<SeqLoc> sequenceCache;
+  AddressMap<InstLoc> instCache;
+  // superblocks of the region, by their first address
+  AddressMap<SeqLoc> superBlockCache;
+  // code inlined in the superblocks, which may belong to another region
+  RangeSet<rword> superBlockRanges;
+  // number of executions of the sequences since the last superblocks drop
+  AddressMap<uint32_t> executionCount;
+  // sorted ids of the InstrRules applied on the instructions of the region
+  std::vector<uint32_t> instrRuleIDs;
   bool toFlush = false;
+  // some sequences have been removed, the ExecBlocks without a live sequence
+  // are reclaimed at the next flushCommit
+  bool hasDeadSequences = false;
+  // last use of the region, used to select the region to evict
+  uint64_t lastUse = 0;
+  // an ExecBlock of the region cannot reach the memory of the code, the
+  // near alternatives of the patches aren't used anymore
+  bool farBlocks = false;
 
   // lambda ptr for user callback set with addInstrRule
   // These pointers should be remove at the same time as the region
@@ -67,23 +87,80 @@ struct ExecRegion {
   ExecRegion &operator=(ExecRegion &&) = default;
 };
 
+// Entry of the cache of searchRegion
+struct RegionCacheEntry {
+  rword page;
+  size_t region;
+};
+
 class ExecBlockManager {
 private:
+  // Number of entries of the cache of searchRegion
+  static const size_t REGION_CACHE_SIZE = 4096;
+  static const unsigned REGION_CACHE_PAGE_SHIFT = 12;
+
   std::unique_ptr<ExecBroker> execBroker;
+  // declared before the regions, the ExecBlocks give their memory back to it
+  // when they are freed
+  ExecBlockAllocator blockAllocator;
+  // declared before the regions, the ExecBlocks leave it when they are freed
+  ExecBlockRegistry blockRegistry;
   std::vector<ExecRegion> regions;
+  // Direct mapped cache from a page to the last region found in this page.
+  // An entry is only used if the region still contains the address, the
+  // cache doesn't need to be updated when the regions are modified.
+  mutable std::vector<RegionCacheEntry> regionCache;
   rword total_translated_size;
   rword total_translation_size;
   bool needFlush;
 
+  // memory budget of the ExecBlocks of the regions (0 for no limit)
+  size_t cacheLimit;
+  uint64_t useClock;
+  rword evictionCount;
+  rword retranslationCount;
+  // bytes of code of the sequences written since the creation, never
+  // decreased by the flushes
+  rword writtenCodeSize;
+  // ranges of the evicted regions, used to count the retranslations
+  RangeSet<rword> evictedRanges;
+
+  // statistics kept up to date when the cache changes
+  CacheStats stats;
+
   VMInstanceRef vminstance;
   const LLVMCPUs &llvmCPUs;
 
+  // context page shared by the ExecBlocks with OPT_ENABLE_SHARED_CONTEXT
+  std::unique_ptr<SharedContext> sharedContext;
+
+  // size of the ExecBlocks of the regions (0 for one page). The data blocks
+  // grow when the shadows fill the ExecBlocks before their code.
+  uint32_t codeBlockSize;
+  uint32_t dataBlockSize;
+
   // cache ExecBlock prologue and epilogue
   uint32_t epilogueSize;
   const std::vector<std::unique_ptr<RelocatableInst>> execBlockPrologue;
   const std::vector<std::unique_ptr<RelocatableInst>> execBlockEpilogue;
-
-  size_t searchRegion(rword start) const;
+  // encoded prologue and epilogue of the ExecBlocks of the regions
+  std::unique_ptr<ExecBlockTemplate> execBlockTemplate;
+  // context switches called by the prologue and the epilogue of the
+  // ExecBlocks
+  std::unique_ptr<ExecBlockTrampoline> trampoline;
+
+  inline size_t searchRegion(rword address) const {
+    const RegionCacheEntry &entry =
+        regionCache[(address >> REGION_CACHE_PAGE_SHIFT) % REGION_CACHE_SIZE];
+    if (entry.page == (address >> REGION_CACHE_PAGE_SHIFT) and
+        entry.region < regions.size() and
+        regions[entry.region].covered.contains(address)) {
+      return entry.region;
+    }
+    return searchRegionSlow(address);
+  }
+
+  size_t searchRegionSlow(rword address) const;
 
   void mergeRegion(size_t i);
 
@@ -91,11 +168,31 @@ private:
 
   void updateRegionStat(size_t r, rword translated);
 
+  size_t getCacheSize() const;
+
+  void addBlockStats(const ExecBlock &block);
+
+  void removeBlockStats(const ExecBlock &block);
+
+  void removeRegionStats(const ExecRegion &region);
+
+  void updateShadowStats(const ExecBlock &block, size_t shadowCount,
+                         bool shadowFull);
+
+  void clearSequences(ExecRegion &region, const Range<rword> &range);
+
+  void reclaimBlocks(ExecRegion &region);
+
+  void evictRegions(size_t current);
+
+  void addInstrRuleIDs(ExecRegion &region, const std::vector<uint32_t> &ids);
+
   float getExpansionRatio() const;
 
 public:
   ExecBlockManager(const LLVMCPUs &llvmCPUs,
-                   VMInstanceRef vminstance = nullptr);
+                   VMInstanceRef vminstance = nullptr,
+                   uint32_t codeBlockSize = 0, uint32_t dataBlockSize = 0);
 
   ~ExecBlockManager();
 
@@ -107,16 +204,142 @@ public:
 
   void printCacheStatistics() const;
 
+  void getIBTCStats(rword &hits, rword &misses) const;
+
+  /*! Set the memory budget of the cache. When a new ExecBlock would exceed
+   * it, the least recently used regions are flushed at the next flushCommit.
+   *
+   * @param[in] limit  Budget in bytes (0 for no limit)
+   */
+  void setCacheLimit(size_t limit) { cacheLimit = limit; }
+
+  size_t getCacheLimit() const { return cacheLimit; }
+
+  /*! Move the ExecBlocks and their contexts to the NUMA node of the current
+   * thread, if the thread runs on another node than the one of the cache.
+   * The ExecBlocks near the code or with two mappings aren't moved.
+   */
+  void bindToCurrentNumaNode();
+
+  CacheStats getCacheStats() const;
+
+  /*! Get the bytes of code of the sequences written since the creation of
+   * the manager
+   */
+  inline rword getWrittenCodeSize() const { return writtenCodeSize; }
+
+  MemoryStats getMemoryStats() const;
+
   ExecBlock *getProgrammedExecBlock(rword address,
                                     SeqLoc *programmedSeqLock = nullptr);
 
   const ExecBlock *getExecBlock(rword address) const;
 
-  const SeqLoc *getSeqLoc(rword address) const;
+  /*! Get the ExecBlock of an instruction handle.
+   *
+   * @param[in] handle  The handle of the instruction
+   *
+   * @return The ExecBlock or nullptr if it has been freed
+   */
+  inline const ExecBlock *getExecBlockOfHandle(InstHandle handle) const {
+    return blockRegistry.get(handle);
+  }
 
-  size_t preWriteBasicBlock(const std::vector<Patch> &basicBlock);
+  const SeqLoc *getSeqLoc(rword address) const;
 
-  void writeBasicBlock(std::vector<Patch> &&basicBlock, size_t patchEnd);
+  /*! Get the original instruction whose instrumented code contains an
+   * address of the code blocks.
+   *
+   * @param[in] codeAddress  An address of the generated code
+   *
+   * @return The address of the original instruction, or 0 if the address
+   *         isn't in an ExecBlock of the cache
+   */
+  rword getOriginalAddress(rword codeAddress) const;
+
+  /*! Call a function on each live sequence of the cache. The regions waiting
+   * for a flush are skipped, the order of the sequences is unspecified.
+   *
+   * @param[in] f  Function called with the ExecBlock and the SeqLoc of each
+   *               sequence, the iteration stops when it returns false
+   */
+  template <typename F>
+  void forEachSequence(F &&f) const {
+    for (const ExecRegion &region : regions) {
+      if (region.toFlush) {
+        continue;
+      }
+      for (const auto &it : region.sequenceCache) {
+        if (not f(*region.blocks[it.second.blockIdx], it.second)) {
+          return;
+        }
+      }
+    }
+  }
+
+  /*! Reserve the region of a basic block and select the near alternative of
+   * its patches if the region can use them.
+   *
+   * @param[in] basicBlock  The patches of the basic block, not instrumented
+   *
+   * @return The number of patches which aren't in the cache
+   */
+  size_t preWriteBasicBlock(std::vector<Patch> &basicBlock);
+
+  /*! Write a basic block in the cache.
+   *
+   * @param[in] basicBlock    The instrumented patches of the basic block
+   * @param[in] patchEnd      The number of patches to write
+   * @param[in] instrRuleIDs  The sorted ids of the InstrRules applied on them
+   *
+   * @return 0, or the address of the first patch which hasn't been written
+   *         because no ExecBlock can reach its near alternative. The patches
+   *         from this address must be generated and written again.
+   */
+  rword writeBasicBlock(std::vector<Patch> &&basicBlock, size_t patchEnd,
+                        const std::vector<uint32_t> &instrRuleIDs = {});
+
+  /*! Get the superblock starting at an address and select it
+   *
+   * @param[in]  address            The first address of the superblock
+   * @param[out] programmedSeqLock  The SeqLoc of the superblock
+   *
+   * @return The ExecBlock of the superblock or nullptr
+   */
+  ExecBlock *getProgrammedSuperBlock(rword address,
+                                     SeqLoc *programmedSeqLock = nullptr);
+
+  /*! Count an execution of the sequence starting at an address. The counters
+   * are reset when the superblocks of the region are dropped.
+   *
+   * @param[in] address  The first address of the sequence
+   *
+   * @return The number of executions, or 0 if the address isn't in a region
+   */
+  uint32_t countExecution(rword address);
+
+  /*! Write a superblock in the region of its first instruction. The
+   * instructions of the superblock must already be in the cache, the
+   * superblock is only used by getProgrammedSuperBlock.
+   *
+   * @param[in] superBlock    The instrumented patches of the superblock
+   * @param[in] instrRuleIDs  The sorted ids of the InstrRules applied on them
+   *
+   * @return True if the superblock has been written
+   */
+  bool writeSuperBlock(std::vector<Patch> &&superBlock,
+                       const std::vector<uint32_t> &instrRuleIDs = {});
+
+  /*! Drop the superblocks of the regions that inline a part of a range.
+   *
+   * @param[in] range  The range of code
+   */
+  void clearSuperBlocks(Range<rword> range);
+
+  /*! Drop the analyses of the cached instructions, for a change of an option
+   * of the analysis. The code of the cache is kept.
+   */
+  void clearInstAnalyses();
 
   bool isFlushPending() { return needFlush; }
 
@@ -127,6 +350,30 @@ public:
   void clearCache(Range<rword> range);
 
   void clearCache(RangeSet<rword> rangeSet);
+
+  /*! Flush the regions with an instruction that a new InstrRule may
+   * instrument.
+   *
+   * @param[in] rule  The new InstrRule
+   */
+  void clearCache(const InstrRule &rule);
+
+  /*! Flush the regions where an InstrRule has been applied.
+   *
+   * @param[in] id  The id of the InstrRule
+   */
+  void clearInstrRule(uint32_t id);
+
+  void unlinkExits();
+
+  void unlinkExits(rword target);
+
+  /*! Seal the ExecBlocks of the regions. The new sequences are written in
+   * other ExecBlocks.
+   *
+   * @return The number of ExecBlocks sealed.
+   */
+  size_t sealCache();
 };
 
 } // namespace QBDI
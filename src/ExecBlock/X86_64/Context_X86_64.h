@@ -33,6 +33,12 @@ struct QBDI_ALIGNED(8) HostState {
   rword data;
   rword origin;
   rword executeFlags;
+  rword exitID;
+  rword ibtcEntry;
+  rword ibtcTarget;
+  rword prologue;
+  rword epilogue;
+  rword callbackSite;
 };
 
 /*! X86_64 Execution context.
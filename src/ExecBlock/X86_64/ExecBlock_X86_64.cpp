@@ -17,9 +17,14 @@
  * limitations under the License.
  */
 #include <memory>
+#include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 #include <vector>
 
+#include "X86InstrInfo.h"
+#include "llvm/MC/MCInst.h"
+#include "llvm/MC/MCInstrInfo.h"
 #include "llvm/Support/Memory.h"
 
 #include "QBDI/Config.h"
@@ -28,8 +33,11 @@
 #include "ExecBlock/ExecBlock.h"
 #include "ExecBlock/X86_64/Context_X86_64.h"
 #include "Patch/Patch.h"
+#include "Patch/PatchGenerator.h"
 #include "Patch/RelocatableInst.h"
+#include "Patch/X86_64/Layer2_X86_64.h"
 #include "Patch/X86_64/PatchRules_X86_64.h"
+#include "Patch/X86_64/RelocatableInst_X86_64.h"
 #include "Utility/LogSys.h"
 
 #if defined(QBDI_PLATFORM_WINDOWS)
@@ -45,6 +53,18 @@ void ExecBlock::selectSeq(uint16_t seqID) {
   QBDI_REQUIRE(seqID < seqRegistry.size());
   currentSeq = seqID;
   currentInst = seqRegistry[currentSeq].startInstID;
+  currentEntry = currentInst;
+  context->hostState.selector =
+      reinterpret_cast<rword>(codeBlock.base()) +
+      static_cast<rword>(instRegistry[currentInst].offset);
+  context->hostState.executeFlags = seqRegistry[currentSeq].executeFlags;
+}
+
+void ExecBlock::selectEntry(uint16_t instID) {
+  QBDI_REQUIRE(instID < instRegistry.size());
+  currentSeq = instRegistry[instID].seqID;
+  currentInst = instID;
+  currentEntry = instID;
   context->hostState.selector =
       reinterpret_cast<rword>(codeBlock.base()) +
       static_cast<rword>(instRegistry[currentInst].offset);
@@ -80,16 +100,317 @@ bool ExecBlock::writePatch(const Patch &p, const LLVMCPU &llvmcpu) {
                   static_cast<uint16_t>(codeStream->current_pos())});
       continue;
     } else if (getEpilogueOffset() > MINIMAL_BLOCK_SIZE) {
-      llvmcpu.writeInstruction(inst->reloc(this), codeStream.get());
+      // the callback of a site is registered before its relocation, the
+      // record is rolled back with the patch if the block overflows
+      rword callback, data;
+      if (inst->getCallbackSite(callback, data)) {
+        newCallbackSite(callback, data);
+      }
+      writeRelocatableInst(*inst, llvmcpu);
     } else {
       QBDI_DEBUG("Not enough space left: rollback");
       return false;
     }
   }
 
+  if (shadowsFull) {
+    QBDI_DEBUG("Not enough shadows left: rollback");
+    isFull = true;
+    return false;
+  }
+
   return true;
 }
 
+void ExecBlock::writeSequenceExits(uint16_t seqID, bool terminated,
+                                   uint8_t executeFlags,
+                                   const LLVMCPU &llvmcpu) {
+  const CachedInstMetadata &lastInst = instMetadata.back();
+  const llvm::MCInst inst = getOriginalMCInst(getNextInstID() - 1);
+  rword targets[2];
+  size_t nbTargets = 0;
+  bool conditional = false;
+  bool indirect = false;
+
+  // Only the static successors can be linked. For the conditional jumps, the
+  // condition is evaluated again at the end of the sequence to select the
+  // exit. This is only possible if no callback can change the flags after
+  // the jump.
+  if (terminated) {
+    targets[nbTargets++] = lastInst.endAddress();
+  } else {
+    switch (inst.getOpcode()) {
+      case llvm::X86::JMP_1:
+      case llvm::X86::JMP_2:
+      case llvm::X86::JMP_4:
+      case llvm::X86::CALL64pcrel32:
+      case llvm::X86::CALLpcrel16:
+      case llvm::X86::CALLpcrel32:
+        targets[nbTargets++] =
+            lastInst.endAddress() + inst.getOperand(0).getImm();
+        break;
+      case llvm::X86::JCC_1:
+      case llvm::X86::JCC_2:
+      case llvm::X86::JCC_4:
+        if (queryTagByInst(getNextInstID() - 1, RelocTagPostInstStdCBK)
+                .empty()) {
+          targets[nbTargets++] = lastInst.endAddress();
+          targets[nbTargets++] =
+              lastInst.endAddress() + inst.getOperand(0).getImm();
+          conditional = true;
+        }
+        break;
+      default: {
+        const llvm::MCInstrDesc &desc = llvmcpu.getMCII().get(inst.getOpcode());
+        indirect = desc.isReturn() or desc.isIndirectBranch() or desc.isCall();
+        break;
+      }
+    }
+  }
+
+  // The return address of the call is pushed on the return stack before the
+  // exits
+  const Options returnStackOptions = Options::OPT_ENABLE_RETURN_STACK |
+                                     Options::OPT_ENABLE_INDIRECT_CACHE;
+  if (not terminated and
+      (llvmcpu.getOptions() & returnStackOptions) == returnStackOptions and
+      llvmcpu.getMCII().get(inst.getOpcode()).isCall()) {
+    writeReturnPush(llvmcpu);
+  }
+
+  if (indirect and (llvmcpu.getOptions() &
+                    Options::OPT_ENABLE_INDIRECT_CACHE)) {
+    writeIndirectExit(seqID, executeFlags, llvmcpu);
+    return;
+  }
+  if (nbTargets == 0 or
+      (llvmcpu.getOptions() & Options::OPT_ENABLE_BLOCK_CHAINING) == 0) {
+    llvmcpu.writeInstruction(EpilogueRel(jmp(0), 0, -1).reloc(this),
+                             codeStream.get());
+    return;
+  }
+  if (conditional) {
+    // jump over the first exit (mov exitID + jmp)
+    llvmcpu.writeInstruction(
+        jcc1(is_x86 ? 16 : 17, inst.getOperand(1).getImm()), codeStream.get());
+  }
+  for (size_t i = 0; i < nbTargets; i++) {
+    uint16_t exitID = static_cast<uint16_t>(exitRegistry.size());
+    // Set the exitID in the context and jump to the epilogue. Only the jump
+    // is patched when the exit is linked.
+    llvmcpu.writeInstruction(
+        DataBlockRelx86(movmi(0, 1, 0, 0, 0, exitID), 0,
+                        offsetof(Context, hostState.exitID), 11)
+            ->reloc(this),
+        codeStream.get());
+    exitRegistry.push_back(
+        ExitInfo{seqID, static_cast<uint16_t>(codeStream->current_pos()),
+                 NOT_FOUND, false, targets[i]});
+    llvmcpu.writeInstruction(EpilogueRel(jmp(0), 0, -1).reloc(this),
+                             codeStream.get());
+  }
+}
+
+void ExecBlock::initReturnStack() {
+  if (returnStack) {
+    return;
+  }
+  returnStack = std::make_unique<ReturnStack>();
+  returnStack->top = 0;
+  resetIBTCEntry(returnStack->empty);
+  for (size_t i = 0; i < RETURN_STACK_SIZE; i++) {
+    returnStack->links[i] = &returnStack->empty;
+  }
+}
+
+void ExecBlock::writeReturnPush(const LLVMCPU &llvmcpu) {
+  initReturnStack();
+  returnLinks.emplace_back();
+  ReturnLink &link = returnLinks.back();
+  resetIBTCEntry(link.entry);
+  link.returnAddress = instMetadata.back().endAddress();
+
+  // The push mustn't change the flags:
+  //   rdx = (stack->top + 1) & 0xff
+  //   stack->top = rdx
+  //   stack->links[rdx] = &link
+  RelocatableInst::UniquePtrVec push;
+  append(push, SaveReg(Reg(0), Offset(Reg(0))));
+  append(push, SaveReg(Reg(3), Offset(Reg(3))));
+  push.push_back(NoReloc::unique(
+      movri(Reg(0), reinterpret_cast<rword>(returnStack.get()))));
+  push.push_back(NoReloc::unique(
+      movrm(Reg(3), Reg(0), 1, 0, offsetof(ReturnStack, top), 0)));
+  push.push_back(NoReloc::unique(lea(Reg(3), Reg(3), 1, 0, 1, 0)));
+  push.push_back(NoReloc::unique(movzxrr8(Reg(3), llvm::X86::DL)));
+  push.push_back(NoReloc::unique(
+      movmr(Reg(0), 1, 0, offsetof(ReturnStack, top), 0, Reg(3))));
+  push.push_back(NoReloc::unique(lea(Reg(0), Reg(0), sizeof(rword), Reg(3),
+                                     offsetof(ReturnStack, links), 0)));
+  push.push_back(NoReloc::unique(
+      movri(Reg(3), reinterpret_cast<rword>(&link.entry))));
+  push.push_back(NoReloc::unique(movmr(Reg(0), 1, 0, 0, 0, Reg(3))));
+  append(push, LoadReg(Reg(0), Offset(Reg(0))));
+  append(push, LoadReg(Reg(3), Offset(Reg(3))));
+
+  for (const RelocatableInst::UniquePtr &inst : push) {
+    writeRelocatableInst(*inst, llvmcpu);
+  }
+}
+
+void ExecBlock::writeIndirectExit(uint16_t seqID, uint8_t executeFlags,
+                                  const LLVMCPU &llvmcpu) {
+  static_assert(sizeof(IBTCEntry) == 4 * sizeof(rword));
+
+  if (not ibtc) {
+    ibtc = std::make_unique<IBTCEntry[]>(IBTC_SIZE);
+    for (size_t i = 0; i < IBTC_SIZE; i++) {
+      resetIBTCEntry(ibtc[i]);
+    }
+  }
+  // The cached targets must be compatible with the context of every
+  // sequences that can look them up.
+  if ((ibtcExecuteFlags & executeFlags) != ibtcExecuteFlags) {
+    ibtcExecuteFlags &= executeFlags;
+    for (size_t i = 0; i < IBTC_SIZE; i++) {
+      if (ibtc[i].instID != NOT_FOUND and
+          (seqRegistry[instRegistry[ibtc[i].instID].seqID].executeFlags &
+           ~ibtcExecuteFlags) != 0) {
+        resetIBTCEntry(ibtc[i]);
+      }
+    }
+    for (ReturnLink &link : returnLinks) {
+      if (link.entry.instID != NOT_FOUND and
+          (seqRegistry[instRegistry[link.entry.instID].seqID].executeFlags &
+           ~ibtcExecuteFlags) != 0) {
+        resetIBTCEntry(link.entry);
+      }
+    }
+  }
+
+  uint16_t exitID = static_cast<uint16_t>(exitRegistry.size());
+  exitRegistry.push_back(ExitInfo{seqID, 0, NOT_FOUND, true, 0});
+
+  RelocatableInst::UniquePtrVec pop, lookup, miss, hit;
+  append(pop, SaveReg(Reg(0), Offset(Reg(0))));
+  append(pop, SaveReg(Reg(2), Offset(Reg(2))));
+  append(pop, SaveReg(Reg(3), Offset(Reg(3))));
+  pop.push_back(DataBlockRelx86(movmi(0, 1, 0, 0, 0, exitID), 0,
+                                offsetof(Context, hostState.exitID), 11));
+
+  // A return first compares its target with the top of the return stack:
+  //   rcx = stack->links[stack->top]
+  //   stack->top = (stack->top - 1) & 0xff
+  //   rdx = rcx
+  //   rcx = target + link->negTarget
+  //   jrcxz hit
+  bool popReturn =
+      (llvmcpu.getOptions() & Options::OPT_ENABLE_RETURN_STACK) and
+      llvmcpu.getMCII().get(instMetadata.back().opcode).isReturn();
+  if (popReturn) {
+    initReturnStack();
+    pop.push_back(NoReloc::unique(
+        movri(Reg(0), reinterpret_cast<rword>(returnStack.get()))));
+    pop.push_back(NoReloc::unique(
+        movrm(Reg(3), Reg(0), 1, 0, offsetof(ReturnStack, top), 0)));
+    pop.push_back(NoReloc::unique(movrm(Reg(2), Reg(0), sizeof(rword), Reg(3),
+                                        offsetof(ReturnStack, links), 0)));
+    pop.push_back(NoReloc::unique(
+        lea(Reg(3), Reg(3), 1, 0, RETURN_STACK_SIZE - 1, 0)));
+    pop.push_back(NoReloc::unique(movzxrr8(Reg(3), llvm::X86::DL)));
+    pop.push_back(NoReloc::unique(
+        movmr(Reg(0), 1, 0, offsetof(ReturnStack, top), 0, Reg(3))));
+    pop.push_back(NoReloc::unique(lea(Reg(3), Reg(2), 1, 0, 0, 0)));
+    append(pop, LoadReg(Reg(2), Offset(Reg(REG_PC))));
+    pop.push_back(NoReloc::unique(
+        movrm(Reg(0), Reg(3), 1, 0, offsetof(IBTCEntry, negTarget), 0)));
+    pop.push_back(NoReloc::unique(lea(Reg(2), Reg(2), 1, Reg(0), 0, 0)));
+  }
+
+  // The lookup mustn't change the flags:
+  //   rcx = target
+  //   rdx = &ibtc[target & 0xff]
+  //   rcx = target + entry->negTarget
+  //   jrcxz hit
+  append(lookup, LoadReg(Reg(2), Offset(Reg(REG_PC))));
+  lookup.push_back(
+      NoReloc::unique(movri(Reg(0), reinterpret_cast<rword>(ibtc.get()))));
+  lookup.push_back(NoReloc::unique(movzxrr8(Reg(3), llvm::X86::CL)));
+  lookup.push_back(NoReloc::unique(lea(Reg(3), 0, 4, Reg(3), 0, 0)));
+  lookup.push_back(
+      NoReloc::unique(lea(Reg(3), Reg(0), sizeof(rword), Reg(3), 0, 0)));
+  lookup.push_back(NoReloc::unique(
+      movrm(Reg(0), Reg(3), 1, 0, offsetof(IBTCEntry, negTarget), 0)));
+  lookup.push_back(NoReloc::unique(lea(Reg(2), Reg(2), 1, Reg(0), 0, 0)));
+
+  append(miss, LoadReg(Reg(0), Offset(Reg(0))));
+  append(miss, LoadReg(Reg(2), Offset(Reg(2))));
+  append(miss, LoadReg(Reg(3), Offset(Reg(3))));
+
+  hit.push_back(DataBlockRelx86(movmi(0, 1, 0, 0, 0, IBTC_HIT), 0,
+                                offsetof(Context, hostState.exitID), 11));
+  append(hit, SaveReg(Reg(3), Offset(offsetof(Context, hostState.ibtcEntry))));
+  hit.push_back(NoReloc::unique(
+      movrm(Reg(2), Reg(3), 1, 0, offsetof(IBTCEntry, hits), 0)));
+  hit.push_back(NoReloc::unique(lea(Reg(2), Reg(2), 1, 0, 1, 0)));
+  hit.push_back(NoReloc::unique(
+      movmr(Reg(3), 1, 0, offsetof(IBTCEntry, hits), 0, Reg(2))));
+  hit.push_back(NoReloc::unique(
+      movrm(Reg(0), Reg(3), 1, 0, offsetof(IBTCEntry, hostAddr), 0)));
+  append(hit, SaveReg(Reg(0), Offset(offsetof(Context, hostState.ibtcTarget))));
+  append(hit, LoadReg(Reg(0), Offset(Reg(0))));
+  append(hit, LoadReg(Reg(2), Offset(Reg(2))));
+  append(hit, LoadReg(Reg(3), Offset(Reg(3))));
+  hit.push_back(JmpM(Offset(offsetof(Context, hostState.ibtcTarget))));
+
+  for (const RelocatableInst::UniquePtr &inst : pop) {
+    writeRelocatableInst(*inst, llvmcpu);
+  }
+  // the jrcxz of the pop and of the lookup are written once the size of the
+  // paths is known
+  uint64_t popJumpOffset = codeStream->current_pos();
+  if (popReturn) {
+    llvmcpu.writeInstruction(is_x86_64 ? jrcxz(0) : jecxz(0),
+                             codeStream.get());
+  }
+  for (const RelocatableInst::UniquePtr &inst : lookup) {
+    writeRelocatableInst(*inst, llvmcpu);
+  }
+  uint64_t jumpOffset = codeStream->current_pos();
+  llvmcpu.writeInstruction(is_x86_64 ? jrcxz(0) : jecxz(0), codeStream.get());
+  for (const RelocatableInst::UniquePtr &inst : miss) {
+    writeRelocatableInst(*inst, llvmcpu);
+  }
+  llvmcpu.writeInstruction(EpilogueRel(jmp(0), 0, -1).reloc(this),
+                           codeStream.get());
+  uint64_t hitOffset = codeStream->current_pos();
+  codeStream->seek(jumpOffset);
+  llvmcpu.writeInstruction(
+      is_x86_64 ? jrcxz(hitOffset - jumpOffset - 1)
+                : jecxz(hitOffset - jumpOffset - 1),
+      codeStream.get());
+  if (popReturn) {
+    // the rel8 of the jrcxz reaches the hit path
+    QBDI_REQUIRE_ACTION(hitOffset - popJumpOffset - 2 < 0x80, abort());
+    codeStream->seek(popJumpOffset);
+    llvmcpu.writeInstruction(
+        is_x86_64 ? jrcxz(hitOffset - popJumpOffset - 1)
+                  : jecxz(hitOffset - popJumpOffset - 1),
+        codeStream.get());
+  }
+  codeStream->seek(hitOffset);
+  for (const RelocatableInst::UniquePtr &inst : hit) {
+    writeRelocatableInst(*inst, llvmcpu);
+  }
+}
+
+void ExecBlock::writeExitJump(const ExitInfo &exit, rword target) {
+  // patch the rel32 of the JMP_4
+  int32_t rel = static_cast<int32_t>(target - (exit.offset + 5));
+  memcpy(reinterpret_cast<uint8_t *>(codeWriteBlock.base()) + exit.offset + 1,
+         &rel, sizeof(rel));
+}
+
 void ExecBlock::initScratchRegisterForPatch(
     std::vector<Patch>::const_iterator seqStart,
     std::vector<Patch>::const_iterator seqEnd) {}
@@ -15,6 +15,7 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <algorithm>
 #include <utility>
 
 #include "llvm/ADT/Optional.h"
@@ -22,14 +23,36 @@
 #include "llvm/Support/Process.h"
 
 #include "QBDI/Memory.hpp"
+#include "QBDI/Options.h"
+#include "Engine/LLVMCPU.h"
 #include "ExecBroker/ExecBroker.h"
 #include "Utility/LogSys.h"
+#include "Utility/System.h"
 
 namespace QBDI {
 
+// Call a function on the cached memory maps of the process. When it fails, the
+// function is called again on a new snapshot, the module may have been loaded
+// after the last one.
+template <typename F>
+static bool withProcessMaps(F &&f) {
+  if (f(getCachedProcessMaps())) {
+    return true;
+  }
+  invalidateProcessMapsCache();
+  return f(getCachedProcessMaps());
+}
+
 ExecBroker::ExecBroker(std::unique_ptr<ExecBlock> _transferBlock,
                        const LLVMCPUs &llvmCPUs, VMInstanceRef vminstance)
-    : transferBlock(std::move(_transferBlock)) {
+    : transferBlock(std::move(_transferBlock)), llvmCPUs(llvmCPUs),
+      pageCache(PAGE_CACHE_SIZE), moduleTracking(NO_MODULE_TRACKING),
+      modulesGeneration(0), returnPoint(nullptr), returnPointSP(0),
+      stackRange(0, 0) {
+  resetPageCache();
+  transferHook =
+      transferBlock->getCurrentPC() + transferBlock->getEpilogueOffset();
+  transferFPR = (llvmCPUs.getOptions() & Options::OPT_DISABLE_FPR) == 0;
   pageSize = llvm::expectedToOptional(llvm::sys::Process::getPageSize())
                  .getValueOr(4096);
   initExecBrokerSequences(llvmCPUs);
@@ -39,89 +62,256 @@ void ExecBroker::changeVMInstanceRef(VMInstanceRef vminstance) {
   transferBlock->changeVMInstanceRef(vminstance);
 }
 
+void ExecBroker::resetPageCache() {
+  // no address is in the page of index ~0
+  std::fill(pageCache.begin(), pageCache.end(),
+            InstrumentedPageEntry{~static_cast<rword>(0), false});
+}
+
+bool ExecBroker::isInstrumentedSlow(rword addr) const {
+  rword page = addr >> PAGE_CACHE_SHIFT;
+  Range<rword> pageRange{page << PAGE_CACHE_SHIFT,
+                         (page + 1) << PAGE_CACHE_SHIFT};
+  // the last page of the address space isn't cached
+  if (pageRange.end() > pageRange.start()) {
+    InstrumentedPageEntry &entry = pageCache[page % PAGE_CACHE_SIZE];
+    if (instrumented.contains(pageRange)) {
+      entry = {page, true};
+      return true;
+    } else if (not instrumented.overlaps(pageRange)) {
+      entry = {page, false};
+      return false;
+    }
+  }
+  return instrumented.contains(addr);
+}
+
 void ExecBroker::addInstrumentedRange(const Range<rword> &r) {
   QBDI_DEBUG("Adding instrumented range [0x{:x}, 0x{:x}]", r.start(), r.end());
   instrumented.add(r);
+  resetPageCache();
+}
+
+bool ExecBroker::addInstrumentedRanges(const std::vector<Range<rword>> &r) {
+  if (r.empty()) {
+    return false;
+  }
+  QBDI_DEBUG("Adding {} instrumented ranges", r.size());
+  instrumented.addAll(r);
+  resetPageCache();
+  return true;
 }
 
 void ExecBroker::removeInstrumentedRange(const Range<rword> &r) {
   QBDI_DEBUG("Removing instrumented range [0x{:x}, 0x{:x}]", r.start(),
              r.end());
   instrumented.remove(r);
+  resetPageCache();
 }
 
-void ExecBroker::removeAllInstrumentedRanges() { instrumented.clear(); }
+void ExecBroker::removeAllInstrumentedRanges() {
+  instrumented.clear();
+  resetPageCache();
+}
 
 bool ExecBroker::addInstrumentedModule(const std::string &name) {
-  bool instrumented = false;
   if (name.empty()) {
     return false;
   }
 
-  for (const MemoryMap &m : getCurrentProcessMaps()) {
-    if ((m.name == name) && (m.permission & QBDI::PF_EXEC)) {
-      addInstrumentedRange(m.range);
-      instrumented = true;
+  return withProcessMaps([&](const std::vector<MemoryMap> &maps) {
+    std::vector<Range<rword>> ranges;
+    for (const MemoryMap &m : maps) {
+      if ((m.name == name) && (m.permission & QBDI::PF_EXEC)) {
+        ranges.push_back(m.range);
+      }
     }
-  }
-  return instrumented;
+    return addInstrumentedRanges(ranges);
+  });
 }
 
 bool ExecBroker::addInstrumentedModuleFromAddr(rword addr) {
-  for (const MemoryMap &m : getCurrentProcessMaps()) {
-    if (m.range.contains(addr)) {
-      if (not m.name.empty()) {
-        return addInstrumentedModule(m.name);
-      } else if (m.permission & QBDI::PF_EXEC) {
-        addInstrumentedRange(m.range);
-        return true;
-      } else {
-        return false;
+  return withProcessMaps([&](const std::vector<MemoryMap> &maps) {
+    for (const MemoryMap &m : maps) {
+      if (m.range.contains(addr)) {
+        if (not m.name.empty()) {
+          return addInstrumentedModule(m.name);
+        } else if (m.permission & QBDI::PF_EXEC) {
+          addInstrumentedRange(m.range);
+          return true;
+        } else {
+          return false;
+        }
       }
     }
-  }
-  return false;
+    return false;
+  });
 }
 
 bool ExecBroker::removeInstrumentedModule(const std::string &name) {
-  bool removed = false;
-
-  for (const MemoryMap &m : getCurrentProcessMaps()) {
-    if (m.name == name) {
-      removeInstrumentedRange(m.range);
-      removed = true;
+  return withProcessMaps([&](const std::vector<MemoryMap> &maps) {
+    bool removed = false;
+    for (const MemoryMap &m : maps) {
+      if (m.name == name) {
+        removeInstrumentedRange(m.range);
+        removed = true;
+      }
     }
-  }
-  return removed;
+    return removed;
+  });
 }
 
 bool ExecBroker::removeInstrumentedModuleFromAddr(rword addr) {
-  for (const MemoryMap &m : getCurrentProcessMaps()) {
-    if (m.range.contains(addr)) {
-      removeInstrumentedRange(m.range);
-      if (not m.name.empty()) {
-        removeInstrumentedModule(m.name);
+  return withProcessMaps([&](const std::vector<MemoryMap> &maps) {
+    for (const MemoryMap &m : maps) {
+      if (m.range.contains(addr)) {
+        removeInstrumentedRange(m.range);
+        if (not m.name.empty()) {
+          removeInstrumentedModule(m.name);
+        }
+        return true;
       }
-      return true;
     }
-  }
-  return false;
+    return false;
+  });
 }
 
 bool ExecBroker::instrumentAllExecutableMaps() {
-  bool instrumented = false;
-
-  for (const MemoryMap &m : getCurrentProcessMaps()) {
+  // the anonymous executable maps aren't tracked, the snapshot is taken again
+  invalidateProcessMapsCache();
+  std::vector<Range<rword>> ranges;
+  for (const MemoryMap &m : getCachedProcessMaps()) {
     if (m.permission & QBDI::PF_EXEC) {
+      ranges.push_back(m.range);
+    }
+  }
+  return addInstrumentedRanges(ranges);
+}
+
+// The executable maps of the modules, sorted by address
+static std::vector<MemoryMap> getModuleExecMaps() {
+  std::vector<MemoryMap> modules;
+  for (MemoryMap &m : getCachedProcessMaps()) {
+    if ((m.permission & QBDI::PF_EXEC) and not m.name.empty()) {
+      modules.push_back(std::move(m));
+    }
+  }
+  std::sort(modules.begin(), modules.end(),
+            [](const MemoryMap &a, const MemoryMap &b) {
+              return a.range.start() < b.range.start();
+            });
+  return modules;
+}
+
+static bool containsModuleMap(const std::vector<MemoryMap> &modules,
+                              const MemoryMap &m) {
+  auto it = std::lower_bound(modules.begin(), modules.end(), m,
+                             [](const MemoryMap &a, const MemoryMap &b) {
+                               return a.range.start() < b.range.start();
+                             });
+  return it != modules.end() and it->range == m.range and it->name == m.name;
+}
+
+void ExecBroker::setModuleTracking(ModuleTracking tracking) {
+  moduleTracking = tracking;
+  trackedModules.clear();
+  if (tracking == NO_MODULE_TRACKING) {
+    return;
+  }
+  if (not getModulesGeneration(modulesGeneration)) {
+    QBDI_WARN("The modules cannot be tracked on this platform");
+    moduleTracking = NO_MODULE_TRACKING;
+    return;
+  }
+  trackedModules = getModuleExecMaps();
+}
+
+bool ExecBroker::updateModulesSlow(RangeSet<rword> &unloaded) {
+  uint64_t generation = 0;
+  if (not getModulesGeneration(generation) or
+      generation == modulesGeneration) {
+    return false;
+  }
+  modulesGeneration = generation;
+
+  bool changed = false;
+  std::vector<MemoryMap> modules = getModuleExecMaps();
+  for (const MemoryMap &m : trackedModules) {
+    if (containsModuleMap(modules, m)) {
+      continue;
+    }
+    QBDI_DEBUG("Module {} unloaded from [0x{:x}, 0x{:x}]", m.name,
+               m.range.start(), m.range.end());
+    if (moduleTracking & MODULE_TRACK_UNLOAD) {
+      unloaded.add(m.range);
+      if (instrumented.overlaps(m.range)) {
+        removeInstrumentedRange(m.range);
+        changed = true;
+      }
+    }
+  }
+  for (const MemoryMap &m : modules) {
+    if (containsModuleMap(trackedModules, m)) {
+      continue;
+    }
+    QBDI_DEBUG("Module {} loaded at [0x{:x}, 0x{:x}]", m.name,
+               m.range.start(), m.range.end());
+    if (moduleTracking & MODULE_TRACK_LOAD) {
       addInstrumentedRange(m.range);
-      instrumented = true;
+      changed = true;
     }
   }
-  return instrumented;
+  trackedModules = std::move(modules);
+  return changed;
+}
+
+Range<rword> ExecBroker::getStackRange(rword addr) {
+  if (not stackRange.contains(addr)) {
+    rword low = addr > REENTRY_STACK_SIZE ? addr - REENTRY_STACK_SIZE : 0;
+    stackRange = Range<rword>(low, addr + 1);
+    withProcessMaps([&](const std::vector<MemoryMap> &maps) {
+      for (const MemoryMap &m : maps) {
+        if (m.range.contains(addr)) {
+          stackRange = Range<rword>(std::max(low, m.range.start()),
+                                    m.range.end());
+          return true;
+        }
+      }
+      return false;
+    });
+  }
+  return stackRange;
 }
 
 bool ExecBroker::canTransferExecution(GPRState *gprState) const {
-  return getReturnPoint(gprState) ? true : false;
+  returnPointSP = QBDI_GPR_GET(gprState, REG_SP);
+  if (getPendingHook(gprState) != nullptr) {
+    // resume the native code of a previous transfer
+    returnPoint = nullptr;
+    return true;
+  }
+  returnPoint = getReturnPoint(gprState);
+  return returnPoint ? true : false;
+}
+
+std::vector<TransferStats> ExecBroker::getTransferStats(size_t topN) const {
+  std::vector<TransferStats> res;
+  res.reserve(transferStats.size());
+  for (const auto &it : transferStats) {
+    res.push_back(it.second);
+    res.back().target = it.first;
+  }
+  std::sort(res.begin(), res.end(),
+            [](const TransferStats &a, const TransferStats &b) {
+              if (a.cycles != b.cycles) {
+                return a.cycles > b.cycles;
+              }
+              return a.target < b.target;
+            });
+  if (topN != 0 and res.size() > topN) {
+    res.resize(topN);
+  }
+  return res;
 }
 
 } // namespace QBDI
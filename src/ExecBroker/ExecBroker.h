@@ -21,12 +21,15 @@
 #include <algorithm>
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "llvm/Support/Memory.h"
 
+#include "QBDI/CacheStats.h"
 #include "QBDI/Callback.h"
 #include "QBDI/Config.h"
+#include "QBDI/Memory.hpp"
 #include "QBDI/Range.h"
 #include "QBDI/State.h"
 #include "ExecBlock/ExecBlock.h"
@@ -44,12 +47,71 @@
 namespace QBDI {
 class LLVMCPUs;
 
+// Entry of the cache of isInstrumented
+struct InstrumentedPageEntry {
+  rword page;
+  bool instrumented;
+};
+
+// Return address pushed on the stack by an instrumented call
+struct ReturnPoint {
+  rword slot;
+  rword address;
+};
+
+// Return address hooked by a transfer to a native target
+struct PendingHook {
+  rword slot;
+  rword address;
+  rword target;
+};
+
 class ExecBroker {
 
 private:
+  // Number of entries of the cache of isInstrumented
+  static const size_t PAGE_CACHE_SIZE = 1024;
+  static const unsigned PAGE_CACHE_SHIFT = 12;
+  // Number of return points kept in the shadow call stack
+  static const size_t MAX_RETURN_POINTS = 64;
+  // Maximal size of the stack of a transfer for the reentry trampolines
+  static const rword REENTRY_STACK_SIZE = 8 * 1024 * 1024;
+
   RangeSet<rword> instrumented;
+  // Direct mapped cache of the pages entirely inside or outside of the
+  // instrumented ranges. The pages partially instrumented aren't cached. The
+  // cache is reset when the instrumented ranges change.
+  mutable std::vector<InstrumentedPageEntry> pageCache;
+
+  // policy of setModuleTracking and executable maps of the modules, sorted
+  // by address, at the generation of the last update
+  ModuleTracking moduleTracking;
+  uint64_t modulesGeneration;
+  std::vector<MemoryMap> trackedModules;
   std::unique_ptr<ExecBlock> transferBlock;
+  const LLVMCPUs &llvmCPUs;
   rword pageSize;
+  // address of the epilogue of the transferBlock, written in place of the
+  // return address
+  rword transferHook;
+  // the FPR state is only copied if the transferBlock restores it
+  bool transferFPR;
+  // return point found by canTransferExecution for the stack pointer
+  // returnPointSP, reused by the following transferExecution
+  mutable rword *returnPoint;
+  mutable rword returnPointSP;
+  // shadow call stack of the instrumented calls which have returned to the
+  // VM, from the outermost to the innermost frame
+  mutable std::vector<ReturnPoint> returnPoints;
+  // return addresses hooked by the transfers which haven't returned, from
+  // the outermost to the innermost. A transfer exits before its return when
+  // the native code calls an instrumented function through a reentry
+  // trampoline.
+  mutable std::vector<PendingHook> pendingHooks;
+  // memory map of the stack of the last transfer
+  Range<rword> stackRange;
+  // number of transfers and cycles spent in the native code, by target
+  std::unordered_map<rword, TransferStats> transferStats;
 
   using PF = llvm::sys::Memory::ProtectionFlags;
 
@@ -58,6 +120,17 @@ private:
 
   void initExecBrokerSequences(const LLVMCPUs &llvmCPUs);
   rword *getReturnPoint(GPRState *gprState) const;
+  const PendingHook *getPendingHook(const GPRState *gprState) const;
+
+  Range<rword> getStackRange(rword addr);
+  rword getReentryPoint(rword target);
+  void redirectArguments(GPRState *gprState);
+  void setReentryStack(rword slot);
+
+  bool isInstrumentedSlow(rword addr) const;
+  void resetPageCache();
+
+  bool updateModulesSlow(RangeSet<rword> &unloaded);
 
 public:
   ExecBroker(std::unique_ptr<ExecBlock> transferBlock, const LLVMCPUs &llvmCPUs,
@@ -65,13 +138,25 @@ public:
 
   void changeVMInstanceRef(VMInstanceRef vminstance);
 
-  bool isInstrumented(rword addr) const { return instrumented.contains(addr); }
+  inline bool isInstrumented(rword addr) const {
+    const InstrumentedPageEntry &entry =
+        pageCache[(addr >> PAGE_CACHE_SHIFT) % PAGE_CACHE_SIZE];
+    if (entry.page == (addr >> PAGE_CACHE_SHIFT)) {
+      return entry.instrumented;
+    }
+    return isInstrumentedSlow(addr);
+  }
 
-  void setInstrumentedRange(const RangeSet<rword> &r) { instrumented = r; }
+  void setInstrumentedRange(const RangeSet<rword> &r) {
+    instrumented = r;
+    resetPageCache();
+  }
 
   const RangeSet<rword> &getInstrumentedRange() const { return instrumented; }
 
   void addInstrumentedRange(const Range<rword> &r);
+  // add the ranges in a single merge, return false if the list is empty
+  bool addInstrumentedRanges(const std::vector<Range<rword>> &r);
   bool addInstrumentedModule(const std::string &name);
   bool addInstrumentedModuleFromAddr(rword addr);
 
@@ -82,9 +167,59 @@ public:
 
   bool instrumentAllExecutableMaps();
 
+  void setModuleTracking(ModuleTracking tracking);
+
+  ModuleTracking getModuleTracking() const { return moduleTracking; }
+
+  /*! Apply the module tracking policy if a module has been loaded or unloaded
+   * since the last update.
+   *
+   * @param[out] unloaded  The executable ranges of the unloaded modules to
+   *                       clear from the cache
+   *
+   * @return True if the instrumented ranges have changed
+   */
+  inline bool updateModules(RangeSet<rword> &unloaded) {
+    if (moduleTracking == NO_MODULE_TRACKING) {
+      return false;
+    }
+    return updateModulesSlow(unloaded);
+  }
+
+  /*! Resolve the target of a PLT stub, a jmp through a slot in memory.
+   *
+   * @param[in]  addr      The address of the stub
+   * @param[in]  gprState  The GPR state at the stub
+   * @param[out] target    The address in the slot of the stub
+   *
+   * @return True if the code at addr is a PLT stub
+   */
+  bool resolveStub(rword addr, const GPRState *gprState, rword &target) const;
+
+  /*! Record the return address of a call executed by the VM. The return
+   * point of a transfer is searched in these addresses when it isn't next to
+   * the stack pointer.
+   *
+   * @param[in] gprState  The GPR state after the call
+   * @param[in] address   The return address of the call
+   */
+  void addReturnPoint(const GPRState *gprState, rword address);
+
+  void clearReturnPoints() {
+    returnPoints.clear();
+    pendingHooks.clear();
+  }
+
   bool canTransferExecution(GPRState *gprState) const;
 
   bool transferExecution(rword addr, GPRState *gprState, FPRState *fprState);
+
+  /*! Get the statistics of the transfers, sorted by decreasing number of
+   * cycles.
+   *
+   * @param[in] topN  Maximal number of targets returned (0 for all)
+   */
+  std::vector<TransferStats> getTransferStats(size_t topN = 0) const;
 };
 
 } // namespace QBDI
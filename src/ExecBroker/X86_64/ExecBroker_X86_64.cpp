@@ -16,23 +16,65 @@
  * limitations under the License.
  */
 #include <memory>
+#include <stddef.h>
 #include <stdint.h>
+#include <string.h>
+#include <system_error>
+#include <vector>
 
+#include "MCTargetDesc/X86BaseInfo.h"
+#include "llvm/MC/MCInst.h"
+#include "llvm/Support/Memory.h"
+
+#include "QBDI/Options.h"
+#include "QBDI/Platform.h"
 #include "QBDI/State.h"
+#include "Engine/LLVMCPU.h"
 #include "ExecBlock/Context.h"
 #include "ExecBlock/ExecBlock.h"
 #include "ExecBroker/ExecBroker.h"
 #include "Patch/ExecBlockFlags.h"
+#include "Patch/Types.h"
+#include "Patch/X86_64/Layer2_X86_64.h"
 #include "Utility/LogSys.h"
+#include "Utility/Profiler.h"
+#include "Utility/System.h"
+#include "Utility/memory_ostream.h"
 
 namespace QBDI {
-class LLVMCPUs;
 
 void ExecBroker::initExecBrokerSequences(const LLVMCPUs &llvmCPUs) {}
 
+void ExecBroker::addReturnPoint(const GPRState *gprState, rword address) {
+  rword sp = QBDI_GPR_GET(gprState, REG_SP);
+  if (*reinterpret_cast<const rword *>(sp) != address) {
+    return;
+  }
+  // the frames of the previous return points below the new one have returned
+  while (not returnPoints.empty() and returnPoints.back().slot <= sp) {
+    returnPoints.pop_back();
+  }
+  if (returnPoints.size() == MAX_RETURN_POINTS) {
+    returnPoints.erase(returnPoints.begin());
+  }
+  returnPoints.push_back({sp, address});
+}
+
 rword *ExecBroker::getReturnPoint(GPRState *gprState) const {
   static int SCAN_DISTANCE = 3;
-  rword *ptr = (rword *)QBDI_GPR_GET(gprState, REG_SP);
+  rword sp = QBDI_GPR_GET(gprState, REG_SP);
+  rword *ptr = reinterpret_cast<rword *>(sp);
+
+  while (not returnPoints.empty() and returnPoints.back().slot < sp) {
+    returnPoints.pop_back();
+  }
+  // call of the instrumented code to the target
+  if (not returnPoints.empty() and returnPoints.back().slot == sp and
+      *ptr == returnPoints.back().address and isInstrumented(*ptr)) {
+    QBDI_DEBUG("Found the return address of the call on the stack at {:p}",
+               reinterpret_cast<void *>(ptr));
+    return ptr;
+  }
 
   for (int i = 0; i < SCAN_DISTANCE; i++) {
     if (isInstrumented(ptr[i])) {
@@ -41,41 +83,362 @@ rword *ExecBroker::getReturnPoint(GPRState *gprState) const {
       return &(ptr[i]);
     }
   }
+
+  // the target may have been reached by a jump after the call, after the
+  // arguments or the locals have been pushed
+  for (auto it = returnPoints.rbegin(); it != returnPoints.rend(); ++it) {
+    rword *slot = reinterpret_cast<rword *>(it->slot);
+    if (*slot == it->address and isInstrumented(it->address)) {
+      QBDI_DEBUG("Found the return address of a previous call at {:p}",
+                 reinterpret_cast<void *>(slot));
+      return slot;
+    }
+  }
   QBDI_DEBUG("No instrumented return address found on the stack");
   return nullptr;
 }
 
+bool ExecBroker::resolveStub(rword addr, const GPRState *gprState,
+                             rword &target) const {
+  const uint8_t *code = reinterpret_cast<const uint8_t *>(addr);
+  size_t offset = 0;
+
+  // endbr64 or endbr32 of the PLT with IBT
+  if (code[0] == 0xf3 and code[1] == 0x0f and code[2] == 0x1e and
+      (code[3] == 0xfa or code[3] == 0xfb)) {
+    offset = 4;
+  }
+  // bnd prefix of the PLT with MPX
+  if (code[offset] == 0xf2) {
+    offset++;
+  }
+  if (code[offset] != 0xff) {
+    return false;
+  }
+  int32_t disp;
+  memcpy(&disp, code + offset + 2, sizeof(disp));
+
+  rword slot;
+  if (code[offset + 1] == 0x25) {
+#if defined(QBDI_ARCH_X86_64)
+    // jmp [rip + disp32]
+    slot = addr + offset + 6 + disp;
+#else
+    // jmp [disp32]
+    slot = static_cast<uint32_t>(disp);
+#endif
+  }
+#if defined(QBDI_ARCH_X86)
+  else if (code[offset + 1] == 0xa3) {
+    // jmp [ebx + disp32] of the PIC PLT
+    slot = gprState->ebx + disp;
+  }
+#endif
+  else {
+    return false;
+  }
+  target = *reinterpret_cast<const rword *>(slot);
+  QBDI_DEBUG("Stub at 0x{:x} jumps through 0x{:x} to 0x{:x}", addr, slot,
+             target);
+  return true;
+}
+
+const PendingHook *ExecBroker::getPendingHook(const GPRState *gprState) const {
+  rword sp = QBDI_GPR_GET(gprState, REG_SP);
+  // drop the hooks of the frames which have returned or have been unwound
+  while (not pendingHooks.empty() and
+         (pendingHooks.back().slot < sp or
+          *reinterpret_cast<const rword *>(pendingHooks.back().slot) !=
+              transferHook)) {
+    pendingHooks.pop_back();
+  }
+  if (pendingHooks.empty()) {
+    return nullptr;
+  }
+  // a call of the instrumented code needs a new hook
+  if (not returnPoints.empty() and returnPoints.back().slot == sp and
+      *reinterpret_cast<const rword *>(sp) == returnPoints.back().address) {
+    return nullptr;
+  }
+  return &pendingHooks.back();
+}
+
+namespace {
+
+// Size of a reentry trampoline in the code page
+constexpr size_t REENTRY_STUB_SIZE = 64;
+
+// Assemble a stub in its memory. The data of the stub are addressed
+// relatively to the PC on x86_64 and with their absolute address on x86.
+class StubWriter {
+  const LLVMCPU &llvmcpu;
+  rword address;
+  llvm::sys::MemoryBlock block;
+  memory_ostream stream;
+
+public:
+  // base register of the memory operand of the data
+  static unsigned int dataBase() {
+    if constexpr (is_x86_64) {
+      return Reg(REG_PC);
+    } else {
+      return 0;
+    }
+  }
+
+  StubWriter(const LLVMCPU &llvmcpu, rword address, size_t size)
+      : llvmcpu(llvmcpu), address(address),
+        block(reinterpret_cast<void *>(address), size), stream(block) {}
+
+  void write(const llvm::MCInst &inst) {
+    llvmcpu.writeInstruction(inst, &stream);
+  }
+
+  // Write the instruction make(disp) of the data at addr, where disp is the
+  // displacement of its memory operand
+  template <typename F>
+  void writeData(rword addr, F make) {
+    if constexpr (is_x86_64) {
+      rword end = address + stream.current_pos() + llvmcpu.getInstSize(make(0));
+      write(make(addr - end));
+    } else {
+      write(make(addr));
+    }
+  }
+
+  size_t getSize(const llvm::MCInst &inst) const {
+    return llvmcpu.getInstSize(inst);
+  }
+
+  size_t current_pos() const { return stream.current_pos(); }
+};
+
+// The trampoline jumps to the epilogue of the transferBlock if the stack
+// pointer is in the stack of the current transfer, with the target as the PC
+// of the GPR state. Otherwise, the target is executed natively.
+void writeReentryStub(const LLVMCPU &llvmcpu, rword address, rword header,
+                      rword targetSlot) {
+  StubWriter w(llvmcpu, address, REENTRY_STUB_SIZE);
+  unsigned int base = StubWriter::dataBase();
+  auto load = [base](unsigned int reg) {
+    return [base, reg](rword disp) { return movrm(reg, base, 1, 0, disp, 0); };
+  };
+  auto jump = [base](rword disp) { return jmpm(base, disp); };
+
+  // offset of the stack pointer before the stub in the stack of the transfer
+  w.write(pushr(Reg(0)));
+  w.write(pushr(Reg(2)));
+  w.write(lea(Reg(0), Reg(REG_SP), 1, 0, 2 * sizeof(rword), 0));
+  w.writeData(header + offsetof(ReentryHeader, stackLow), load(Reg(2)));
+  w.write(subrr(Reg(0), Reg(2)));
+  w.writeData(header + offsetof(ReentryHeader, stackSize), load(Reg(2)));
+  w.write(cmprr(Reg(0), Reg(2)));
+  // the offset of a relative jump is encoded from its displacement
+  int32_t nativeSize = w.getSize(popr(Reg(2))) + w.getSize(popr(Reg(0))) +
+                      w.getSize(jump(0));
+  w.write(jcc1(nativeSize + 1, llvm::X86::CondCode::COND_B));
+  // native: pop the registers and jump to the target
+  w.write(popr(Reg(2)));
+  w.write(popr(Reg(0)));
+  w.writeData(targetSlot, jump);
+  // reentry: write the target in the PC of the GPR state and jump to the
+  // epilogue
+  w.writeData(targetSlot, load(Reg(0)));
+  w.writeData(header + offsetof(ReentryHeader, pc), load(Reg(2)));
+  w.write(movmr(Reg(2), 1, 0, 0, 0, Reg(0)));
+  w.write(popr(Reg(2)));
+  w.write(popr(Reg(0)));
+  w.writeData(header + offsetof(ReentryHeader, epilogue), jump);
+  // the remaining bytes of the slot are never executed
+  memset(reinterpret_cast<void *>(address + w.current_pos()), 0xcc,
+         REENTRY_STUB_SIZE - w.current_pos());
+}
+
+} // anonymous namespace
+
+ExecBrokerArchData::~ExecBrokerArchData() {
+  for (llvm::sys::MemoryBlock &block : reentryBlocks) {
+    releaseMappedMemory(block);
+  }
+}
+
+rword ExecBroker::getReentryPoint(rword target) {
+  auto it = archData.reentryPoints.find(target);
+  if (it != archData.reentryPoints.end()) {
+    return it->second;
+  }
+  if (archData.reentryBlocks.empty() or
+      archData.reentryUsed == pageSize / REENTRY_STUB_SIZE) {
+    std::error_code ec;
+    llvm::sys::MemoryBlock block = allocateMappedMemory(
+        2 * pageSize, nullptr, PF::MF_READ | PF::MF_WRITE, ec);
+    if (block.base() == nullptr) {
+      QBDI_WARN("Cannot allocate the reentry trampolines");
+      return 0;
+    }
+    ReentryHeader *header = reinterpret_cast<ReentryHeader *>(
+        reinterpret_cast<rword>(block.base()) + pageSize);
+    header->stackLow = 0;
+    header->stackSize = 0;
+    header->epilogue = transferHook;
+    header->pc =
+        reinterpret_cast<rword>(&transferBlock->getContext()->gprState) +
+        REG_PC * sizeof(rword);
+    archData.reentryBlocks.push_back(block);
+    archData.reentryUsed = 0;
+  }
+  llvm::sys::MemoryBlock codeBlock(archData.reentryBlocks.back().base(),
+                                   pageSize);
+  rword base = reinterpret_cast<rword>(codeBlock.base());
+  rword header = base + pageSize;
+  rword stub = base + archData.reentryUsed * REENTRY_STUB_SIZE;
+  rword targetSlot =
+      header + sizeof(ReentryHeader) + archData.reentryUsed * sizeof(rword);
+
+  *reinterpret_cast<rword *>(targetSlot) = target;
+  if (archData.reentryUsed != 0 and
+      llvm::sys::Memory::protectMappedMemory(codeBlock, PF::MF_READ |
+                                                            PF::MF_WRITE)) {
+    return 0;
+  }
+  writeReentryStub(llvmCPUs.getCPU(CPUMode::DEFAULT), stub, header,
+                   targetSlot);
+  if (llvm::sys::Memory::protectMappedMemory(codeBlock,
+                                             PF::MF_READ | PF::MF_EXEC)) {
+    return 0;
+  }
+  llvm::sys::Memory::InvalidateInstructionCache(codeBlock.base(), pageSize);
+
+  archData.reentryUsed++;
+  archData.reentryPoints[target] = stub;
+  QBDI_DEBUG("New reentry trampoline 0x{:x} for 0x{:x}", stub, target);
+  return stub;
+}
+
+void ExecBroker::redirectArguments(GPRState *gprState) {
+#if defined(QBDI_ARCH_X86_64)
+#if defined(QBDI_PLATFORM_WINDOWS)
+  rword *args[] = {&gprState->rcx, &gprState->rdx, &gprState->r8,
+                   &gprState->r9};
+#else
+  rword *args[] = {&gprState->rdi, &gprState->rsi, &gprState->rdx,
+                   &gprState->rcx, &gprState->r8,  &gprState->r9};
+#endif
+#else
+  // the arguments follow the return address on the stack
+  rword *stack = reinterpret_cast<rword *>(QBDI_GPR_GET(gprState, REG_SP));
+  rword *args[] = {&stack[1], &stack[2], &stack[3], &stack[4]};
+#endif
+  for (rword *arg : args) {
+    if (isInstrumented(*arg)) {
+      rword stub = getReentryPoint(*arg);
+      if (stub != 0) {
+        *arg = stub;
+      }
+    }
+  }
+}
+
+void ExecBroker::setReentryStack(rword slot) {
+  rword low = 0;
+  rword size = 0;
+  if (slot != 0) {
+    low = getStackRange(slot).start();
+    size = slot - low;
+  }
+  for (llvm::sys::MemoryBlock &block : archData.reentryBlocks) {
+    ReentryHeader *header = reinterpret_cast<ReentryHeader *>(
+        reinterpret_cast<rword>(block.base()) + pageSize);
+    header->stackLow = low;
+    header->stackSize = size;
+  }
+}
+
 bool ExecBroker::transferExecution(rword addr, GPRState *gprState,
                                    FPRState *fprState) {
-  rword hook = 0;
-
-  // Backup / Patch return address
-  hook = transferBlock->getCurrentPC() + transferBlock->getEpilogueOffset();
-  rword *ptr = getReturnPoint(gprState);
-  rword hookedAddress = *ptr;
-  *ptr = hook;
-  QBDI_DEBUG(
-      "TransferExecution: Patched {:} hooking return address 0x{:06x} with "
-      "0x{:06x}",
-      reinterpret_cast<void *>(ptr), hookedAddress, hook);
-
-  // Write transfer state
-  transferBlock->getContext()->gprState = *gprState;
-  transferBlock->getContext()->fprState = *fprState;
-  transferBlock->getContext()->hostState.selector = addr;
-  transferBlock->getContext()->hostState.executeFlags = defaultExecuteFlags;
+  const PendingHook *pending = getPendingHook(gprState);
+  rword *ptr;
+  if (pending != nullptr) {
+    // The native code of a previous transfer has called an instrumented
+    // function, its return address is still hooked
+    ptr = reinterpret_cast<rword *>(pending->slot);
+    QBDI_DEBUG("TransferExecution: Resume the transfer hooked at {:p}",
+               reinterpret_cast<void *>(ptr));
+  } else {
+    // Backup / Patch return address. The return point of
+    // canTransferExecution is used if the stack hasn't changed since.
+    ptr = returnPoint;
+    if (ptr == nullptr or returnPointSP != QBDI_GPR_GET(gprState, REG_SP) or
+        not isInstrumented(*ptr)) {
+      ptr = getReturnPoint(gprState);
+    }
+    rword hookedAddress = *ptr;
+    *ptr = transferHook;
+    pendingHooks.push_back({reinterpret_cast<rword>(ptr), hookedAddress, addr});
+    transferStats[addr].count++;
+    QBDI_DEBUG(
+        "TransferExecution: Patched {:} hooking return address 0x{:06x} with "
+        "0x{:06x}",
+        reinterpret_cast<void *>(ptr), hookedAddress, transferHook);
+  }
+  returnPoint = nullptr;
+
+  bool reentry = (llvmCPUs.getOptions() & Options::OPT_ENABLE_REENTRY) != 0;
+  if (reentry) {
+    if (pending == nullptr) {
+      redirectArguments(gprState);
+    }
+    setReentryStack(reinterpret_cast<rword>(ptr));
+  }
+
+  // Write transfer state. The states are already in the context of the
+  // transferBlock when the context is shared by the ExecBlocks.
+  Context *context = transferBlock->getContext();
+  bool copyGPR = &context->gprState != gprState;
+  bool copyFPR = transferFPR and &context->fprState != fprState;
+  if (copyGPR) {
+    context->gprState = *gprState;
+  }
+  if (copyFPR) {
+    context->fprState = *fprState;
+  }
+  // the PC is only written by a reentry trampoline
+  QBDI_GPR_SET(&context->gprState, REG_PC, 0);
+  context->hostState.selector = addr;
+  context->hostState.executeFlags = defaultExecuteFlags;
   // Execute transfer
   QBDI_DEBUG("Transfering execution to 0x{:x} using transferBlock 0x{:x}", addr,
              reinterpret_cast<uintptr_t>(&*transferBlock));
 
+  // a resumed transfer is accounted to the target of its first part
+  TransferStats &stats = transferStats[pendingHooks.back().target];
+  uint64_t start = readCycles();
   transferBlock->run();
+  stats.cycles += readCycles() - start;
+
+  if (reentry) {
+    setReentryStack(0);
+  }
+  rword reentryTarget = QBDI_GPR_GET(&context->gprState, REG_PC);
 
   // Read transfer result
-  *gprState = transferBlock->getContext()->gprState;
-  *fprState = transferBlock->getContext()->fprState;
+  if (copyGPR) {
+    *gprState = context->gprState;
+  }
+  if (copyFPR) {
+    *fprState = context->fprState;
+  }
 
-  // Restore original return
-  QBDI_GPR_SET(gprState, REG_PC, hookedAddress);
+  if (reentryTarget != 0) {
+    // An instrumented function has been called through a trampoline. The
+    // hook stays on the stack until the native code returns.
+    QBDI_DEBUG("TransferExecution: Reentry at 0x{:x}", reentryTarget);
+    QBDI_GPR_SET(gprState, REG_PC, reentryTarget);
+  } else {
+    // Restore original return
+    QBDI_GPR_SET(gprState, REG_PC, pendingHooks.back().address);
+    pendingHooks.pop_back();
+  }
 
   return true;
 }
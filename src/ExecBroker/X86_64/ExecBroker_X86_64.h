@@ -18,9 +18,39 @@
 #ifndef QBDI_EXECBROKER_X86_64_H
 #define QBDI_EXECBROKER_X86_64_H
 
+#include <stddef.h>
+#include <unordered_map>
+#include <vector>
+
+#include "llvm/Support/Memory.h"
+
+#include "QBDI/State.h"
+
 namespace QBDI {
 
-struct ExecBrokerArchData {};
+// Header of the data page of a block of reentry trampolines, followed by the
+// targets of the trampolines
+struct ReentryHeader {
+  rword stackLow;  // lowest address of the stack of the current transfer
+  rword stackSize; // size of this stack, 0 without transfer
+  rword epilogue;  // epilogue of the transferBlock
+  rword pc;        // address of the PC of the GPR state of the transferBlock
+};
+
+struct ExecBrokerArchData {
+  // code page followed by the data page of each block of trampolines
+  std::vector<llvm::sys::MemoryBlock> reentryBlocks;
+  // number of trampolines in the last block
+  size_t reentryUsed = 0;
+  // trampoline of each instrumented target
+  std::unordered_map<rword, rword> reentryPoints;
+
+  ExecBrokerArchData() = default;
+  ~ExecBrokerArchData();
+
+  ExecBrokerArchData(const ExecBrokerArchData &) = delete;
+  ExecBrokerArchData &operator=(const ExecBrokerArchData &) = delete;
+};
 
 } // namespace QBDI
 
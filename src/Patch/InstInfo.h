@@ -20,6 +20,8 @@
 
 #include <stdint.h>
 
+#include "QBDI/State.h"
+
 namespace llvm {
 class MCInst;
 class MCInstrDesc;
@@ -39,6 +41,41 @@ bool useAllRegisters(const llvm::MCInst &inst);
 bool unsupportedRead(const llvm::MCInst &inst);
 bool unsupportedWrite(const llvm::MCInst &inst);
 
+// Return true if the reads (or the writes) of the instruction are relative to
+// the stack: the implicit accesses of the stack instructions and the memory
+// operands based on the stack pointer, or on the frame pointer with frame.
+bool isStackRelativeRead(const llvm::MCInst &inst,
+                         const llvm::MCInstrDesc &desc, bool frame);
+bool isStackRelativeWrite(const llvm::MCInst &inst,
+                          const llvm::MCInstrDesc &desc, bool frame);
+
+// Get the static successors of the last instruction of a basic block (at
+// most 2) and return their number. The indirect branches have no static
+// successor.
+unsigned getStaticSuccessors(const llvm::MCInst &inst, rword address,
+                             rword instSize, rword successors[2]);
+
+// Get the target of a direct jump or call, which is always taken. Return
+// false for the other instructions.
+bool getUnconditionalTarget(const llvm::MCInst &inst, rword address,
+                            rword instSize, rword &target);
+
+// Get the target and the condition code of a conditional branch that only
+// depends on the flags. Return false for the other instructions.
+bool getConditionalBranch(const llvm::MCInst &inst, rword address,
+                          rword instSize, rword &target, unsigned &cond);
+
+// Return true if the instruction is a call or a jump to a register or a
+// memory operand.
+bool isIndirectCallOrJump(const llvm::MCInst &inst);
+
+// Return true if the instruction is a system call that returns to the next
+// instruction.
+bool isSyscall(const llvm::MCInst &inst);
+
+// Get the number of the system call of an instruction that isSyscall
+rword getSyscallNumber(const GPRState *gprState);
+
 }; // namespace QBDI
 
 #endif // INSTCLASSES_H
@@ -55,6 +55,29 @@ public:
   }
 };
 
+/*! Metadata of an instruction written in an ExecBlock. The operands of its
+ * MCInst are stored by the ExecBlock, which rebuilds the MCInst when it is
+ * needed.
+ */
+class CachedInstMetadata {
+public:
+  rword address;
+  uint32_t instSize;
+  uint32_t patchSize;
+  unsigned opcode;
+  unsigned flags;
+  // operands of the MCInst in the operands of the ExecBlock
+  uint32_t operandOffset;
+  uint16_t operandCount;
+  bool modifyPC;
+  bool merge;
+  CPUMode cpuMode;
+  uint8_t execblockFlags;
+  mutable InstAnalysisPtr analysis;
+
+  inline rword endAddress() const { return address + instSize; }
+};
+
 } // namespace QBDI
 
 #endif // INSTMETADATA_H
@@ -15,14 +15,24 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <algorithm>
+#include <inttypes.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <utility>
 
+#include "llvm/MC/MCInstrDesc.h"
+#include "llvm/MC/MCInstrInfo.h"
+
+#include "Engine/LLVMCPU.h"
 #include "Engine/VM_internal.h"
+#include "Patch/InstInfo.h"
 #include "Patch/InstMetadata.h"
 #include "Patch/InstrRule.h"
 #include "Patch/InstrRules.h"
+#include "Patch/MemoryAccess.h"
 #include "Patch/Patch.h"
 #include "Patch/PatchCondition.h"
 #include "Patch/PatchGenerator.h"
@@ -31,28 +41,29 @@
 #include "Patch/Types.h"
 #include "Utility/InstAnalysis_prive.h"
 #include "Utility/LogSys.h"
+#include "Utility/Profiler.h"
+#include "Utility/Symbol.h"
 
 namespace QBDI {
 
 // InstrRule
 // =========
 
-void InstrRule::instrument(Patch &patch,
-                           const PatchGenerator::UniquePtrVec &patchGen,
-                           bool breakToHost, InstPosition position,
-                           int priority, RelocatableInstTag tag) const {
-
-  if (patchGen.size() == 0 && breakToHost == false) {
-    QBDI_DEBUG("Empty patch Generator");
-    return;
-  }
+static RelocatableInst::UniquePtrVec
+generateInstrumentation(Patch &patch,
+                        const PatchGenerator::UniquePtrVec &patchGen,
+                        bool breakToHost, InstPosition position,
+                        RelocatableInstTag tag) {
 
   /* The instrument function needs to handle several different cases. An
    * instrumentation can be either prepended or appended to the patch and, in
    * each case, can trigger a break to host.
    */
   RelocatableInst::UniquePtrVec instru;
-  TempManager tempManager(patch, true);
+  TempManager tempManager(patch, true,
+                          (position == InstPosition::PREINST)
+                              ? patch.deadFlagsBefore
+                              : patch.deadFlagsAfter);
 
   // Generate the instrumentation code from the original instruction context
   for (const PatchGenerator::UniquePtr &g : patchGen) {
@@ -97,7 +108,8 @@ void InstrRule::instrument(Patch &patch,
   // restored by the break to host code.
   if (breakToHost) {
     for (uint32_t i = 1; i < usedRegisters.size(); i++) {
-      if (tempManager.shouldRestore(usedRegisters[i])) {
+      if (tempManager.shouldRestore(usedRegisters[i]) and
+          not tempManager.isDeadRegister(usedRegisters[i])) {
         append(instru, LoadReg(usedRegisters[i], Offset(usedRegisters[i])));
         prepend(instru, SaveReg(usedRegisters[i], Offset(usedRegisters[i])));
       }
@@ -112,7 +124,8 @@ void InstrRule::instrument(Patch &patch,
   // instrumentation
   else {
     for (uint32_t i = 0; i < usedRegisters.size(); i++) {
-      if (tempManager.shouldRestore(usedRegisters[i])) {
+      if (tempManager.shouldRestore(usedRegisters[i]) and
+          not tempManager.isDeadRegister(usedRegisters[i])) {
         append(instru, LoadReg(usedRegisters[i], Offset(usedRegisters[i])));
         prepend(instru, SaveReg(usedRegisters[i], Offset(usedRegisters[i])));
       }
@@ -122,6 +135,22 @@ void InstrRule::instrument(Patch &patch,
   // add Tag
   instru.insert(instru.begin(), RelocTag::unique(tag));
 
+  return instru;
+}
+
+void InstrRule::instrument(Patch &patch,
+                           const PatchGenerator::UniquePtrVec &patchGen,
+                           bool breakToHost, InstPosition position,
+                           int priority, RelocatableInstTag tag) const {
+
+  if (patchGen.size() == 0 && breakToHost == false) {
+    QBDI_DEBUG("Empty patch Generator");
+    return;
+  }
+
+  RelocatableInst::UniquePtrVec instru =
+      generateInstrumentation(patch, patchGen, breakToHost, position, tag);
+
   QBDI_DEBUG(
       "Insert {} PatchGen with priority {}, position {} ({}) and tag 0x{:x}",
       instru.size(), priority,
@@ -135,6 +164,88 @@ void InstrRule::instrument(Patch &patch,
   patch.addInstsPatch(position, priority, std::move(instru));
 }
 
+// Replace a callback by a lambda which counts its calls and their cycles in
+// the statistics of its rule
+static InstrCallback timeCallback(Patch &patch, const InstrCallback &callback) {
+  patch.userInstCB.emplace_back(std::make_unique<InstCbLambda>(
+      [callback](VMInstanceRef vm, GPRState *gprState, FPRState *fprState) {
+        uint64_t start = readCycles();
+        VMAction r = callback.cbk(vm, gprState, fprState, callback.data);
+        callback.stats->callbackCycles += readCycles() - start;
+        callback.stats->callbackCount++;
+        return r;
+      }));
+  return {InstCBLambdaProxy, patch.userInstCB.back().get(), callback.guard};
+}
+
+RelocatableInst::UniquePtrVec
+generateCallbacks(Patch &patch, InstPosition position, RelocatableInstTag tag,
+                  const std::vector<InstrCallback> &callbacks) {
+  QBDI_REQUIRE_ACTION(not callbacks.empty(), abort());
+
+  if (std::any_of(callbacks.begin(), callbacks.end(),
+                  [](const InstrCallback &c) { return c.stats != nullptr; })) {
+    std::vector<InstrCallback> timed;
+    for (const InstrCallback &callback : callbacks) {
+      timed.push_back(callback.stats != nullptr
+                          ? timeCallback(patch, callback)
+                          : callback);
+    }
+    return generateCallbacks(patch, position, tag, timed);
+  }
+
+  if (callbacks.size() == 1 and callbacks[0].guard == nullptr) {
+    return generateInstrumentation(
+        patch, getCallbackGenerator(callbacks[0].cbk, callbacks[0].data), true,
+        position, tag);
+  }
+  if (callbacks.size() == 1) {
+    // The generated code only breaks to the host if the rule is enabled, with
+    // the same value of PC as a break of generateInstrumentation
+    rword pc = 0;
+    if (position == PREINST) {
+      pc = patch.metadata.address;
+    } else if (not patch.metadata.modifyPC) {
+      pc = patch.metadata.endAddress();
+    }
+    return generateInstrumentation(
+        patch,
+        getFlagCallbackGenerator(callbacks[0].guard, callbacks[0].cbk,
+                                 callbacks[0].data, pc),
+        false, position, tag);
+  }
+
+  QBDI_DEBUG("Merge {} callbacks in a single break to the host",
+             callbacks.size());
+  // A single break to the host calls the callbacks in the priority order,
+  // until one of them doesn't return CONTINUE. The enable flags of the rules
+  // are tested by the host.
+  patch.userInstCB.emplace_back(std::make_unique<InstCbLambda>(
+      [callbacks, position](VMInstanceRef vm, GPRState *gprState,
+                            FPRState *fprState) {
+        for (const InstrCallback &callback : callbacks) {
+          if (callback.guard != nullptr and *callback.guard == 0) {
+            continue;
+          }
+          VMAction r = callback.cbk(vm, gprState, fprState, callback.data);
+          if (r == SKIP_INST and position == POSTINST) {
+            // the ExecBlock would handle it as CONTINUE
+            QBDI_WARN(
+                "POSTINST callback returned SKIP_INST: Use CONTINUE instead");
+            continue;
+          }
+          if (r != CONTINUE) {
+            return r;
+          }
+        }
+        return VMAction::CONTINUE;
+      }));
+  return generateInstrumentation(
+      patch,
+      getCallbackGenerator(InstCBLambdaProxy, patch.userInstCB.back().get()),
+      true, position, tag);
+}
+
 // InstrRuleBasicCBK
 // =================
 
@@ -170,6 +281,1017 @@ RangeSet<rword> InstrRuleBasicCBK::affectedRange() const {
   return condition->affectedRange();
 }
 
+bool InstrRuleBasicCBK::getOpcodes(std::vector<unsigned> &opcodes) const {
+  return condition->getOpcodes(opcodes);
+}
+
+bool InstrRuleBasicCBK::mayInstrument(const InstMetadata &metadata,
+                                      const LLVMCPU &llvmcpu) const {
+  return condition->test(metadata.inst, metadata.address, metadata.instSize,
+                         llvmcpu);
+}
+
+bool InstrRuleBasicCBK::tryInstrument(Patch &patch,
+                                      const LLVMCPU &llvmcpu) const {
+  if (not canBeApplied(patch, llvmcpu)) {
+    return false;
+  }
+  if (not breakToHost) {
+    instrument(patch, patchGen, breakToHost, position, priority, tag);
+    return true;
+  }
+  patch.addCallbackPatch(position, priority, tag, {cbk, data, guard});
+  return true;
+}
+
+// InstrRuleCounter
+// ================
+
+InstrRuleCounter::InstrRuleCounter(PatchConditionUniquePtr &&condition,
+                                   uint64_t *counter, InstPosition position,
+                                   int priority)
+    : AutoUnique<InstrRule, InstrRuleCounter>(priority),
+      condition(std::forward<PatchConditionUniquePtr>(condition)),
+      patchGen(getCounterGenerator(counter)), position(position),
+      counter(counter) {}
+
+InstrRuleCounter::~InstrRuleCounter() = default;
+
+bool InstrRuleCounter::canBeApplied(const Patch &patch,
+                                    const LLVMCPU &llvmcpu) const {
+  return condition->test(patch.metadata.inst, patch.metadata.address,
+                         patch.metadata.instSize, llvmcpu);
+}
+
+bool InstrRuleCounter::changeDataPtr(void *new_counter) {
+  counter = static_cast<uint64_t *>(new_counter);
+  patchGen = getCounterGenerator(counter);
+  return true;
+}
+
+std::unique_ptr<InstrRule> InstrRuleCounter::clone() const {
+  return InstrRuleCounter::unique(condition->clone(), counter, position,
+                                  priority);
+};
+
+RangeSet<rword> InstrRuleCounter::affectedRange() const {
+  return condition->affectedRange();
+}
+
+bool InstrRuleCounter::getOpcodes(std::vector<unsigned> &opcodes) const {
+  return condition->getOpcodes(opcodes);
+}
+
+bool InstrRuleCounter::mayInstrument(const InstMetadata &metadata,
+                                     const LLVMCPU &llvmcpu) const {
+  return condition->test(metadata.inst, metadata.address, metadata.instSize,
+                         llvmcpu);
+}
+
+// InstrRuleCoverage
+// =================
+
+InstrRuleCoverage::InstrRuleCoverage(uint8_t *bitmap, size_t size,
+                                     CoverageMode mode, rword *prevLoc,
+                                     int priority)
+    : AutoUnique<InstrRule, InstrRuleCoverage>(priority), bitmap(bitmap),
+      size(size), mode(mode), prevLoc(prevLoc) {}
+
+InstrRuleCoverage::~InstrRuleCoverage() = default;
+
+std::unique_ptr<InstrRule> InstrRuleCoverage::clone() const {
+  return InstrRuleCoverage::unique(bitmap, size, mode, prevLoc, priority);
+};
+
+rword InstrRuleCoverage::getLocation(rword address) const {
+  return ((address >> 4) ^ (address << 8)) & (size - 1);
+}
+
+RangeSet<rword> InstrRuleCoverage::affectedRange() const {
+  RangeSet<rword> r;
+  r.add(Range<rword>(0, (rword)-1));
+  return r;
+}
+
+bool InstrRuleCoverage::changeDataPtr(void *new_prevLoc) {
+  prevLoc = static_cast<rword *>(new_prevLoc);
+  return true;
+}
+
+bool InstrRuleCoverage::tryInstrument(Patch &patch,
+                                      const LLVMCPU &llvmcpu) const {
+  rword curLoc = getLocation(patch.metadata.address);
+  instrument(patch,
+             getCoverageGenerator(bitmap, curLoc,
+                                  mode == COVERAGE_EDGE ? prevLoc : nullptr),
+             false, PREINST, priority, RelocTagInvalid);
+  return true;
+}
+
+// SequenceProfile
+// ===============
+
+uint64_t *SequenceProfile::getCounter(rword address, rword instCount) {
+  auto it = index.find({address, instCount});
+  if (it != index.end()) {
+    return &counters[it->second].executions;
+  }
+  index.emplace(std::make_pair(address, instCount), counters.size());
+  counters.push_back(Counter{address, instCount, 0});
+  return &counters.back().executions;
+}
+
+std::vector<SequenceStats> SequenceProfile::getStats(size_t topN) const {
+  std::vector<SequenceStats> res;
+  for (const Counter &counter : counters) {
+    if (counter.executions != 0) {
+      res.push_back(SequenceStats{counter.address, counter.instCount,
+                                  counter.executions, nullptr, 0, nullptr});
+    }
+  }
+  std::sort(res.begin(), res.end(),
+            [](const SequenceStats &a, const SequenceStats &b) {
+              uint64_t costA = a.executions * a.instCount;
+              uint64_t costB = b.executions * b.instCount;
+              if (costA != costB) {
+                return costA > costB;
+              }
+              return a.address < b.address;
+            });
+  if (topN != 0 and res.size() > topN) {
+    res.resize(topN);
+  }
+  for (SequenceStats &stats : res) {
+    findSymbol(stats.address, stats.symbol, stats.symbolOffset, stats.module);
+  }
+  return res;
+}
+
+void SequenceProfile::reset() {
+  for (Counter &counter : counters) {
+    counter.executions = 0;
+  }
+}
+
+bool SequenceProfile::writeReport(const char *path) const {
+  FILE *file = fopen(path, "w");
+  if (file == nullptr) {
+    QBDI_ERROR("Cannot open the sequence profile {}", path);
+    return false;
+  }
+  fprintf(file, "# instructions executions instCount address symbol\n");
+  for (const SequenceStats &stats : getStats()) {
+    fprintf(file,
+            "%" PRIu64 " %" PRIu64 " %" PRIu64 " 0x%" PRIx64 " %s+0x%x %s\n",
+            static_cast<uint64_t>(stats.executions * stats.instCount),
+            stats.executions, static_cast<uint64_t>(stats.instCount),
+            static_cast<uint64_t>(stats.address),
+            stats.symbol != nullptr ? stats.symbol : "?", stats.symbolOffset,
+            stats.module != nullptr ? stats.module : "?");
+  }
+  return fclose(file) == 0;
+}
+
+// InstrRuleSequenceProfile
+// ========================
+
+InstrRuleSequenceProfile::InstrRuleSequenceProfile(SequenceProfile *profile,
+                                                   int priority)
+    : AutoUnique<InstrRule, InstrRuleSequenceProfile>(priority),
+      profile(profile) {}
+
+InstrRuleSequenceProfile::~InstrRuleSequenceProfile() = default;
+
+std::unique_ptr<InstrRule> InstrRuleSequenceProfile::clone() const {
+  return InstrRuleSequenceProfile::unique(profile, priority);
+};
+
+RangeSet<rword> InstrRuleSequenceProfile::affectedRange() const {
+  RangeSet<rword> r;
+  r.add(Range<rword>(0, (rword)-1));
+  return r;
+}
+
+bool InstrRuleSequenceProfile::changeDataPtr(void *new_profile) {
+  profile = static_cast<SequenceProfile *>(new_profile);
+  return true;
+}
+
+void InstrRuleSequenceProfile::instrumentSequence(
+    Patch &patch, rword instCount, const LLVMCPU &llvmcpu) const {
+  uint64_t *counter = profile->getCounter(patch.metadata.address, instCount);
+  instrument(patch, getCounterGenerator(counter), false, PREINST, priority,
+             RelocTagInvalid);
+}
+
+bool InstrRuleSequenceProfile::tryInstrument(Patch &patch,
+                                             const LLVMCPU &llvmcpu) const {
+  instrumentSequence(patch, 1, llvmcpu);
+  return true;
+}
+
+// InstrRuleInstructionBudget
+// ==========================
+
+InstrRuleInstructionBudget::InstrRuleInstructionBudget(rword *remaining,
+                                                       InstCallback cbk,
+                                                       void *data,
+                                                       int priority)
+    : AutoUnique<InstrRule, InstrRuleInstructionBudget>(priority),
+      remaining(remaining), cbk(cbk), data(data) {}
+
+InstrRuleInstructionBudget::~InstrRuleInstructionBudget() = default;
+
+std::unique_ptr<InstrRule> InstrRuleInstructionBudget::clone() const {
+  return InstrRuleInstructionBudget::unique(remaining, cbk, data, priority);
+};
+
+RangeSet<rword> InstrRuleInstructionBudget::affectedRange() const {
+  RangeSet<rword> r;
+  r.add(Range<rword>(0, (rword)-1));
+  return r;
+}
+
+bool InstrRuleInstructionBudget::changeDataPtr(void *new_data) {
+  data = new_data;
+  return true;
+}
+
+void InstrRuleInstructionBudget::instrumentSequence(
+    Patch &patch, rword instCount, const LLVMCPU &llvmcpu) const {
+  instrument(patch, getInstructionBudgetGenerator(remaining, instCount, cbk,
+                                                  data, patch.metadata.address),
+             false, PREINST, priority, RelocTagInvalid);
+}
+
+bool InstrRuleInstructionBudget::tryInstrument(Patch &patch,
+                                               const LLVMCPU &llvmcpu) const {
+  instrumentSequence(patch, 1, llvmcpu);
+  return true;
+}
+
+// InstrRuleStopRequest
+// ====================
+
+InstrRuleStopRequest::InstrRuleStopRequest(const rword *flag, InstCallback cbk,
+                                           void *data, int priority)
+    : AutoUnique<InstrRule, InstrRuleStopRequest>(priority), flag(flag),
+      cbk(cbk), data(data) {}
+
+InstrRuleStopRequest::~InstrRuleStopRequest() = default;
+
+std::unique_ptr<InstrRule> InstrRuleStopRequest::clone() const {
+  return InstrRuleStopRequest::unique(flag, cbk, data, priority);
+};
+
+RangeSet<rword> InstrRuleStopRequest::affectedRange() const {
+  RangeSet<rword> r;
+  r.add(Range<rword>(0, (rword)-1));
+  return r;
+}
+
+bool InstrRuleStopRequest::changeDataPtr(void *new_data) {
+  data = new_data;
+  return true;
+}
+
+bool InstrRuleStopRequest::tryInstrument(Patch &patch,
+                                         const LLVMCPU &llvmcpu) const {
+  instrument(patch,
+             getFlagCallbackGenerator(flag, cbk, data, patch.metadata.address),
+             false, PREINST, priority, RelocTagInvalid);
+  return true;
+}
+
+// BranchProfile
+// =============
+
+uint64_t *BranchProfile::getCounters(rword address, rword target) {
+  auto it = index.find(address);
+  if (it != index.end()) {
+    return counters[it->second].outcomes;
+  }
+  index.emplace(address, counters.size());
+  counters.push_back(Counter{address, target, {0, 0}});
+  return counters.back().outcomes;
+}
+
+std::vector<BranchStats> BranchProfile::getStats(size_t topN) const {
+  std::vector<BranchStats> res;
+  for (const Counter &counter : counters) {
+    if (counter.outcomes[0] != 0 or counter.outcomes[1] != 0) {
+      res.push_back(BranchStats{counter.address, counter.target,
+                                counter.outcomes[1], counter.outcomes[0],
+                                nullptr, 0, nullptr});
+    }
+  }
+  std::sort(res.begin(), res.end(),
+            [](const BranchStats &a, const BranchStats &b) {
+              uint64_t execA = a.taken + a.notTaken;
+              uint64_t execB = b.taken + b.notTaken;
+              if (execA != execB) {
+                return execA > execB;
+              }
+              return a.address < b.address;
+            });
+  if (topN != 0 and res.size() > topN) {
+    res.resize(topN);
+  }
+  for (BranchStats &stats : res) {
+    findSymbol(stats.address, stats.symbol, stats.symbolOffset, stats.module);
+  }
+  return res;
+}
+
+void BranchProfile::reset() {
+  for (Counter &counter : counters) {
+    counter.outcomes[0] = 0;
+    counter.outcomes[1] = 0;
+  }
+}
+
+// InstrRuleBranchProfile
+// ======================
+
+InstrRuleBranchProfile::InstrRuleBranchProfile(BranchProfile *profile,
+                                               int priority)
+    : AutoUnique<InstrRule, InstrRuleBranchProfile>(priority),
+      profile(profile) {}
+
+InstrRuleBranchProfile::~InstrRuleBranchProfile() = default;
+
+std::unique_ptr<InstrRule> InstrRuleBranchProfile::clone() const {
+  return InstrRuleBranchProfile::unique(profile, priority);
+};
+
+RangeSet<rword> InstrRuleBranchProfile::affectedRange() const {
+  RangeSet<rword> r;
+  r.add(Range<rword>(0, (rword)-1));
+  return r;
+}
+
+bool InstrRuleBranchProfile::changeDataPtr(void *new_profile) {
+  profile = static_cast<BranchProfile *>(new_profile);
+  return true;
+}
+
+bool InstrRuleBranchProfile::tryInstrument(Patch &patch,
+                                           const LLVMCPU &llvmcpu) const {
+  rword target;
+  unsigned cond;
+  if (not getConditionalBranch(patch.metadata.inst, patch.metadata.address,
+                               patch.metadata.instSize, target, cond)) {
+    return false;
+  }
+  uint64_t *counters = profile->getCounters(patch.metadata.address, target);
+  instrument(patch, getBranchCounterGenerator(counters, cond), false, PREINST,
+             priority, RelocTagInvalid);
+  return true;
+}
+
+// IndirectProfile
+// ===============
+
+IndirectTargetEntry *IndirectProfile::getTable(rword address) {
+  auto it = index.find(address);
+  if (it != index.end()) {
+    return sites[it->second].entries;
+  }
+  index.emplace(address, sites.size());
+  sites.push_back(Site{address, {}});
+  return sites.back().entries;
+}
+
+std::vector<IndirectTargetStats>
+IndirectProfile::getStats(size_t topN) const {
+  std::vector<IndirectTargetStats> res;
+  for (const Site &site : sites) {
+    for (size_t i = 0; i <= INDIRECT_TABLE_SIZE; i++) {
+      const IndirectTargetEntry &entry = site.entries[i];
+      if (entry.count != 0) {
+        // the overflow entry only keeps the last target beyond the table
+        rword target = i == INDIRECT_TABLE_SIZE ? 0 : entry.target;
+        res.push_back(IndirectTargetStats{site.address, target, entry.count,
+                                          nullptr, 0, nullptr, nullptr, 0});
+      }
+    }
+  }
+  std::sort(res.begin(), res.end(),
+            [](const IndirectTargetStats &a, const IndirectTargetStats &b) {
+              if (a.count != b.count) {
+                return a.count > b.count;
+              }
+              if (a.address != b.address) {
+                return a.address < b.address;
+              }
+              return a.target < b.target;
+            });
+  if (topN != 0 and res.size() > topN) {
+    res.resize(topN);
+  }
+  for (IndirectTargetStats &stats : res) {
+    findSymbol(stats.address, stats.symbol, stats.symbolOffset, stats.module);
+    if (stats.target != 0) {
+      const char *targetModule;
+      findSymbol(stats.target, stats.targetSymbol, stats.targetSymbolOffset,
+                 targetModule);
+    }
+  }
+  return res;
+}
+
+void IndirectProfile::reset() {
+  // the targets are kept, the generated code only fills the empty entries
+  for (Site &site : sites) {
+    for (IndirectTargetEntry &entry : site.entries) {
+      entry.count = 0;
+    }
+  }
+}
+
+// InstrRuleIndirectProfile
+// ========================
+
+InstrRuleIndirectProfile::InstrRuleIndirectProfile(IndirectProfile *profile,
+                                                   int priority)
+    : AutoUnique<InstrRule, InstrRuleIndirectProfile>(priority),
+      profile(profile) {}
+
+InstrRuleIndirectProfile::~InstrRuleIndirectProfile() = default;
+
+std::unique_ptr<InstrRule> InstrRuleIndirectProfile::clone() const {
+  return InstrRuleIndirectProfile::unique(profile, priority);
+};
+
+RangeSet<rword> InstrRuleIndirectProfile::affectedRange() const {
+  RangeSet<rword> r;
+  r.add(Range<rword>(0, (rword)-1));
+  return r;
+}
+
+bool InstrRuleIndirectProfile::changeDataPtr(void *new_profile) {
+  profile = static_cast<IndirectProfile *>(new_profile);
+  return true;
+}
+
+bool InstrRuleIndirectProfile::tryInstrument(Patch &patch,
+                                             const LLVMCPU &llvmcpu) const {
+  if (not isIndirectCallOrJump(patch.metadata.inst)) {
+    return false;
+  }
+  IndirectTargetEntry *table = profile->getTable(patch.metadata.address);
+  instrument(patch, getIndirectTargetGenerator(table), false, POSTINST,
+             priority, RelocTagInvalid);
+  return true;
+}
+
+// ValueProfile
+// ============
+
+ValueProfile::ValueProfile(rword address, unsigned reg, size_t nbEntries)
+    : address(address), reg(reg), entries(nbEntries + 1) {}
+
+std::vector<ValueStats> ValueProfile::getStats(size_t topN) const {
+  std::vector<ValueStats> res;
+  for (size_t i = 0; i < entries.size(); i++) {
+    const ValueProfileEntry &entry = entries[i];
+    if (entry.count != 0) {
+      uint8_t others = (i + 1 == entries.size()) ? 1 : 0;
+      res.push_back(ValueStats{address, static_cast<uint32_t>(reg), others,
+                               entry.value, entry.count});
+    }
+  }
+  std::sort(res.begin(), res.end(),
+            [](const ValueStats &a, const ValueStats &b) {
+              if (a.count != b.count) {
+                return a.count > b.count;
+              }
+              if (a.others != b.others) {
+                return a.others < b.others;
+              }
+              return a.value < b.value;
+            });
+  if (topN != 0 and res.size() > topN) {
+    res.resize(topN);
+  }
+  return res;
+}
+
+void ValueProfile::reset() {
+  // the values are kept, the generated code only fills the unused entries
+  for (ValueProfileEntry &entry : entries) {
+    entry.count = 0;
+  }
+}
+
+// InstrRuleValueProfile
+// =====================
+
+InstrRuleValueProfile::InstrRuleValueProfile(ValueProfile *profile,
+                                             int priority)
+    : AutoUnique<InstrRule, InstrRuleValueProfile>(priority),
+      profile(profile) {}
+
+InstrRuleValueProfile::~InstrRuleValueProfile() = default;
+
+std::unique_ptr<InstrRule> InstrRuleValueProfile::clone() const {
+  return InstrRuleValueProfile::unique(profile, priority);
+};
+
+RangeSet<rword> InstrRuleValueProfile::affectedRange() const {
+  RangeSet<rword> r;
+  r.add(Range<rword>(profile->address, profile->address + 1));
+  return r;
+}
+
+bool InstrRuleValueProfile::changeDataPtr(void *new_profile) {
+  profile = static_cast<ValueProfile *>(new_profile);
+  return true;
+}
+
+bool InstrRuleValueProfile::tryInstrument(Patch &patch,
+                                          const LLVMCPU &llvmcpu) const {
+  if (patch.metadata.address != profile->address) {
+    return false;
+  }
+  instrument(patch,
+             getValueProfileGenerator(profile->reg, profile->entries.data(),
+                                      profile->entries.size() - 1),
+             false, PREINST, priority, RelocTagInvalid);
+  return true;
+}
+
+// CallGraphProfile
+// ================
+
+CallGraphProfile::CallGraphProfile() {
+  // the frame 0 stays empty, it never matches a return of the entry point
+  memset(&state, 0, sizeof(state));
+}
+
+CallGraphEdge *CallGraphProfile::getEdges(rword address, rword target) {
+  auto it = index.find(address);
+  if (it != index.end()) {
+    return sites[it->second].edges;
+  }
+  index.emplace(address, sites.size());
+  sites.push_back(Site{address, target, {}});
+  // the target of a direct call is known, its edge is never selected
+  sites.back().edges[0].target = target;
+  return sites.back().edges;
+}
+
+void CallGraphProfile::popFrame(rword returnAddress) {
+  CallGraphFrame &frame = state.frames[state.top % CALL_GRAPH_DEPTH];
+  if (frame.returnAddress == returnAddress) {
+    frame.edge->inclusive += state.instCount - frame.start;
+    state.top--;
+  }
+}
+
+std::vector<CallGraphEdgeStats>
+CallGraphProfile::getStats(size_t topN) const {
+  std::vector<CallGraphEdgeStats> res;
+  for (const Site &site : sites) {
+    size_t nbEdges = site.target != 0 ? 1 : INDIRECT_TABLE_SIZE + 1;
+    for (size_t i = 0; i < nbEdges; i++) {
+      const CallGraphEdge &edge = site.edges[i];
+      if (edge.count != 0) {
+        // the overflow edge only keeps the last callee beyond the table
+        rword target = i == INDIRECT_TABLE_SIZE ? 0 : edge.target;
+        res.push_back(CallGraphEdgeStats{site.address, target, edge.count,
+                                         edge.inclusive, nullptr, 0, nullptr,
+                                         nullptr, 0});
+      }
+    }
+  }
+  std::sort(res.begin(), res.end(),
+            [](const CallGraphEdgeStats &a, const CallGraphEdgeStats &b) {
+              if (a.count != b.count) {
+                return a.count > b.count;
+              }
+              if (a.address != b.address) {
+                return a.address < b.address;
+              }
+              return a.target < b.target;
+            });
+  if (topN != 0 and res.size() > topN) {
+    res.resize(topN);
+  }
+  for (CallGraphEdgeStats &stats : res) {
+    findSymbol(stats.address, stats.symbol, stats.symbolOffset, stats.module);
+    if (stats.target != 0) {
+      const char *targetModule;
+      findSymbol(stats.target, stats.targetSymbol, stats.targetSymbolOffset,
+                 targetModule);
+    }
+  }
+  return res;
+}
+
+void CallGraphProfile::reset() {
+  // the shadow stack and the instruction counter are kept, the frames of the
+  // pending calls are still matched by their returns
+  for (Site &site : sites) {
+    for (CallGraphEdge &edge : site.edges) {
+      edge.count = 0;
+      edge.inclusive = 0;
+    }
+  }
+}
+
+// InstrRuleCallGraph
+// ==================
+
+InstrRuleCallGraph::InstrRuleCallGraph(CallGraphProfile *profile,
+                                       int priority)
+    : AutoUnique<InstrRule, InstrRuleCallGraph>(priority), profile(profile) {}
+
+InstrRuleCallGraph::~InstrRuleCallGraph() = default;
+
+std::unique_ptr<InstrRule> InstrRuleCallGraph::clone() const {
+  return InstrRuleCallGraph::unique(profile, priority);
+};
+
+RangeSet<rword> InstrRuleCallGraph::affectedRange() const {
+  RangeSet<rword> r;
+  r.add(Range<rword>(0, (rword)-1));
+  return r;
+}
+
+bool InstrRuleCallGraph::changeDataPtr(void *new_profile) {
+  profile = static_cast<CallGraphProfile *>(new_profile);
+  return true;
+}
+
+void InstrRuleCallGraph::instrumentSequence(Patch &patch, rword instCount,
+                                            const LLVMCPU &llvmcpu) const {
+  instrument(patch, getCallGraphSequenceGenerator(&profile->state, instCount),
+             false, PREINST, priority, RelocTagInvalid);
+}
+
+bool InstrRuleCallGraph::tryInstrument(Patch &patch,
+                                       const LLVMCPU &llvmcpu) const {
+  const llvm::MCInstrDesc &desc =
+      llvmcpu.getMCII().get(patch.metadata.inst.getOpcode());
+  if (desc.isReturn()) {
+    instrument(patch, getCallGraphReturnGenerator(&profile->state), false,
+               POSTINST, priority, RelocTagInvalid);
+    return true;
+  }
+  if (not desc.isCall()) {
+    return false;
+  }
+  rword target = 0;
+  bool indirect = isIndirectCallOrJump(patch.metadata.inst);
+  if (not indirect and
+      not getUnconditionalTarget(patch.metadata.inst, patch.metadata.address,
+                                 patch.metadata.instSize, target)) {
+    return false;
+  }
+  CallGraphEdge *edges = profile->getEdges(patch.metadata.address, target);
+  instrument(patch,
+             getCallGraphCallGenerator(&profile->state, edges, indirect,
+                                       patch.metadata.endAddress()),
+             false, POSTINST, priority, RelocTagInvalid);
+  return true;
+}
+
+// InstrRuleMemoryTrace
+// ====================
+
+InstrRuleMemoryTrace::InstrRuleMemoryTrace(MemoryTraceBuffer *buffer,
+                                           int priority)
+    : AutoUnique<InstrRule, InstrRuleMemoryTrace>(priority), buffer(buffer) {}
+
+InstrRuleMemoryTrace::~InstrRuleMemoryTrace() = default;
+
+std::unique_ptr<InstrRule> InstrRuleMemoryTrace::clone() const {
+  return InstrRuleMemoryTrace::unique(buffer, priority);
+};
+
+RangeSet<rword> InstrRuleMemoryTrace::affectedRange() const {
+  RangeSet<rword> r;
+  r.add(Range<rword>(0, (rword)-1));
+  return r;
+}
+
+bool InstrRuleMemoryTrace::changeDataPtr(void *new_buffer) {
+  buffer = static_cast<MemoryTraceBuffer *>(new_buffer);
+  return true;
+}
+
+bool InstrRuleMemoryTrace::tryInstrument(Patch &patch,
+                                         const LLVMCPU &llvmcpu) const {
+  bool applied = false;
+  for (InstPosition position : {PREINST, POSTINST}) {
+    PatchGeneratorUniquePtrVec gen =
+        getMemoryTraceGenerator(patch, llvmcpu, position, buffer);
+    if (not gen.empty()) {
+      instrument(patch, gen, false, position, priority, RelocTagInvalid);
+      applied = true;
+    }
+  }
+  return applied;
+}
+
+// InstrRuleCallTrace
+// ==================
+
+InstrRuleCallTrace::InstrRuleCallTrace(CallTraceBuffer *buffer, int priority)
+    : AutoUnique<InstrRule, InstrRuleCallTrace>(priority), buffer(buffer) {}
+
+InstrRuleCallTrace::~InstrRuleCallTrace() = default;
+
+std::unique_ptr<InstrRule> InstrRuleCallTrace::clone() const {
+  return InstrRuleCallTrace::unique(buffer, priority);
+};
+
+RangeSet<rword> InstrRuleCallTrace::affectedRange() const {
+  RangeSet<rword> r;
+  r.add(Range<rword>(0, (rword)-1));
+  return r;
+}
+
+bool InstrRuleCallTrace::changeDataPtr(void *new_buffer) {
+  buffer = static_cast<CallTraceBuffer *>(new_buffer);
+  return true;
+}
+
+bool InstrRuleCallTrace::tryInstrument(Patch &patch,
+                                       const LLVMCPU &llvmcpu) const {
+  const llvm::MCInstrDesc &desc =
+      llvmcpu.getMCII().get(patch.metadata.inst.getOpcode());
+  if (not desc.isCall()) {
+    return false;
+  }
+  // the target of the indirect calls is read in the context by the generated
+  // code, the arity of the callee is only known for the direct calls
+  rword target = 0;
+  uint32_t nbArgs = buffer->nbArgs;
+  if (not isIndirectCallOrJump(patch.metadata.inst) and
+      getUnconditionalTarget(patch.metadata.inst, patch.metadata.address,
+                             patch.metadata.instSize, target)) {
+    auto it = buffer->arity.find(target);
+    if (it != buffer->arity.end()) {
+      nbArgs = it->second;
+    }
+  } else {
+    target = 0;
+  }
+  instrument(patch, getCallTraceGenerator(buffer, target, nbArgs), false,
+             POSTINST, priority, RelocTagInvalid);
+  return true;
+}
+
+// InstrRulePageHistogram
+// ======================
+
+InstrRulePageHistogram::InstrRulePageHistogram(PageHistogram *histogram,
+                                               int priority)
+    : AutoUnique<InstrRule, InstrRulePageHistogram>(priority),
+      histogram(histogram) {}
+
+InstrRulePageHistogram::~InstrRulePageHistogram() = default;
+
+std::unique_ptr<InstrRule> InstrRulePageHistogram::clone() const {
+  return InstrRulePageHistogram::unique(histogram, priority);
+};
+
+RangeSet<rword> InstrRulePageHistogram::affectedRange() const {
+  RangeSet<rword> r;
+  r.add(Range<rword>(0, (rword)-1));
+  return r;
+}
+
+bool InstrRulePageHistogram::changeDataPtr(void *new_histogram) {
+  histogram = static_cast<PageHistogram *>(new_histogram);
+  return true;
+}
+
+bool InstrRulePageHistogram::tryInstrument(Patch &patch,
+                                           const LLVMCPU &llvmcpu) const {
+  bool applied = false;
+  for (InstPosition position : {PREINST, POSTINST}) {
+    PatchGeneratorUniquePtrVec gen =
+        getPageHistogramGenerator(patch, llvmcpu, position, histogram);
+    if (not gen.empty()) {
+      instrument(patch, gen, false, position, priority, RelocTagInvalid);
+      applied = true;
+    }
+  }
+  return applied;
+}
+
+// InstrRuleOwnership
+// ==================
+
+InstrRuleOwnership::InstrRuleOwnership(const OwnershipCheck &check,
+                                       int priority)
+    : AutoUnique<InstrRule, InstrRuleOwnership>(priority), check(check) {}
+
+InstrRuleOwnership::~InstrRuleOwnership() = default;
+
+std::unique_ptr<InstrRule> InstrRuleOwnership::clone() const {
+  return InstrRuleOwnership::unique(check, priority);
+};
+
+RangeSet<rword> InstrRuleOwnership::affectedRange() const {
+  RangeSet<rword> r;
+  r.add(Range<rword>(0, (rword)-1));
+  return r;
+}
+
+bool InstrRuleOwnership::tryInstrument(Patch &patch,
+                                       const LLVMCPU &llvmcpu) const {
+  PatchGeneratorUniquePtrVec gen =
+      getOwnershipGenerator(patch, llvmcpu, PREINST, check);
+  if (gen.empty()) {
+    return false;
+  }
+  instrument(patch, gen, false, PREINST, priority, RelocTagInvalid);
+  return true;
+}
+
+// InstrRulePredicateCBK
+// =====================
+
+// Draw the next countdown of a sampling in [1, 2 * period - 1] with a
+// xorshift64, the mean of the countdowns is the period
+static void drawCountdown(PredicateSample &sample) {
+  uint64_t x = sample.seed;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  sample.seed = x;
+  sample.countdown = 1 + static_cast<rword>(x % (2 * sample.period - 1));
+}
+
+// Called by the VM when the countdown of a sampling reaches 0
+static VMAction sampleCallback(VMInstanceRef vm, GPRState *gprState,
+                               FPRState *fprState, void *data) {
+  PredicateSample *sample = static_cast<PredicateSample *>(data);
+  drawCountdown(*sample);
+  return sample->cbk(vm, gprState, fprState, sample->data);
+}
+
+InstrRulePredicateCBK::InstrRulePredicateCBK(
+    PatchConditionUniquePtr &&condition, const CallbackPredicate &predicate,
+    InstCallback cbk, void *data, InstPosition position, int priority,
+    RelocatableInstTag tag)
+    : AutoUnique<InstrRule, InstrRulePredicateCBK>(priority),
+      condition(std::forward<PatchConditionUniquePtr>(condition)),
+      predicate(predicate), position(position), tag(tag), cbk(cbk), data(data),
+      counter(std::make_unique<rword>(0)) {
+  if (predicate.type == PREDICATE_SAMPLE) {
+    // a fixed seed keeps the sampling reproducible between two runs
+    sample = std::make_unique<PredicateSample>(PredicateSample{
+        0, predicate.value, UINT64_C(0x9E3779B97F4A7C15), cbk, data});
+    drawCountdown(*sample);
+  }
+}
+
+InstrRulePredicateCBK::~InstrRulePredicateCBK() = default;
+
+bool InstrRulePredicateCBK::canBeApplied(const Patch &patch,
+                                         const LLVMCPU &llvmcpu) const {
+  return condition->test(patch.metadata.inst, patch.metadata.address,
+                         patch.metadata.instSize, llvmcpu);
+}
+
+bool InstrRulePredicateCBK::changeDataPtr(void *new_data) {
+  data = new_data;
+  if (sample) {
+    sample->data = new_data;
+  }
+  return true;
+}
+
+std::unique_ptr<InstrRule> InstrRulePredicateCBK::clone() const {
+  // the counter and the sampling of the copy start again
+  return InstrRulePredicateCBK::unique(condition->clone(), predicate, cbk,
+                                       data, position, priority, tag);
+};
+
+RangeSet<rword> InstrRulePredicateCBK::affectedRange() const {
+  return condition->affectedRange();
+}
+
+bool InstrRulePredicateCBK::getOpcodes(std::vector<unsigned> &opcodes) const {
+  return condition->getOpcodes(opcodes);
+}
+
+bool InstrRulePredicateCBK::mayInstrument(const InstMetadata &metadata,
+                                          const LLVMCPU &llvmcpu) const {
+  return condition->test(metadata.inst, metadata.address, metadata.instSize,
+                         llvmcpu);
+}
+
+bool InstrRulePredicateCBK::tryInstrument(Patch &patch,
+                                          const LLVMCPU &llvmcpu) const {
+  if (not canBeApplied(patch, llvmcpu)) {
+    return false;
+  }
+  // PC must be set in the context before the break to the host, except after
+  // an instruction that sets it
+  rword pc = 0;
+  if (position == InstPosition::PREINST) {
+    pc = patch.metadata.address;
+  } else if (not patch.metadata.modifyPC) {
+    pc = patch.metadata.endAddress();
+  }
+  if (sample) {
+    // the host draws the next countdown before the user callback
+    instrument(patch,
+               getPredicateCallbackGenerator(predicate, &sample->countdown,
+                                             sampleCallback, sample.get(), pc),
+               false, position, priority, tag);
+  } else {
+    instrument(patch,
+               getPredicateCallbackGenerator(predicate, counter.get(), cbk,
+                                             data, pc),
+               false, position, priority, tag);
+  }
+  return true;
+}
+
+// InstrRuleDirectCBK
+// ==================
+
+InstrRuleDirectCBK::InstrRuleDirectCBK(PatchConditionUniquePtr &&condition,
+                                       InstCallback cbk, void *data,
+                                       CallbackFootprint footprint,
+                                       VMInstanceRef vminstance,
+                                       InstPosition position, int priority,
+                                       RelocatableInstTag tag)
+    : AutoUnique<InstrRule, InstrRuleDirectCBK>(priority),
+      condition(std::forward<PatchConditionUniquePtr>(condition)),
+      position(position), tag(tag), cbk(cbk), data(data), footprint(footprint),
+      vm(std::make_unique<VMInstanceRef>(vminstance)) {}
+
+InstrRuleDirectCBK::~InstrRuleDirectCBK() = default;
+
+bool InstrRuleDirectCBK::canBeApplied(const Patch &patch,
+                                      const LLVMCPU &llvmcpu) const {
+  return condition->test(patch.metadata.inst, patch.metadata.address,
+                         patch.metadata.instSize, llvmcpu);
+}
+
+bool InstrRuleDirectCBK::changeDataPtr(void *new_data) {
+  data = new_data;
+  return true;
+}
+
+std::unique_ptr<InstrRule> InstrRuleDirectCBK::clone() const {
+  return InstrRuleDirectCBK::unique(condition->clone(), cbk, data, footprint,
+                                    *vm, position, priority, tag);
+};
+
+RangeSet<rword> InstrRuleDirectCBK::affectedRange() const {
+  return condition->affectedRange();
+}
+
+bool InstrRuleDirectCBK::getOpcodes(std::vector<unsigned> &opcodes) const {
+  return condition->getOpcodes(opcodes);
+}
+
+bool InstrRuleDirectCBK::mayInstrument(const InstMetadata &metadata,
+                                       const LLVMCPU &llvmcpu) const {
+  return condition->test(metadata.inst, metadata.address, metadata.instSize,
+                         llvmcpu);
+}
+
+bool InstrRuleDirectCBK::tryInstrument(Patch &patch,
+                                       const LLVMCPU &llvmcpu) const {
+  if (not canBeApplied(patch, llvmcpu)) {
+    return false;
+  }
+  // The FPR can only be saved by the epilogue. The host FS/GS are only
+  // restored by the epilogue too.
+  bool fullContextSwitch = (footprint & FOOTPRINT_FPR) != 0;
+#if defined(QBDI_ARCH_X86_64)
+  fullContextSwitch |= (llvmcpu.getOptions() & Options::OPT_ENABLE_FS_GS) ==
+                       Options::OPT_ENABLE_FS_GS;
+#endif // QBDI_ARCH_X86_64
+  if (fullContextSwitch) {
+    instrument(patch, getCallbackGenerator(cbk, data), true, position,
+               priority, tag);
+    return true;
+  }
+  // PC must be set in the context before the call, except after an
+  // instruction that sets it
+  rword pc = 0;
+  if (position == InstPosition::PREINST) {
+    pc = patch.metadata.address;
+  } else if (not patch.metadata.modifyPC) {
+    pc = patch.metadata.endAddress();
+  }
+  instrument(patch,
+             getDirectCallbackGenerator(cbk, data, vm.get(), footprint, pc),
+             false, position, priority, tag);
+  return true;
+}
+
 // InstrRuleDynamic
 // ================
 
@@ -199,6 +1321,16 @@ RangeSet<rword> InstrRuleDynamic::affectedRange() const {
   return condition->affectedRange();
 }
 
+bool InstrRuleDynamic::getOpcodes(std::vector<unsigned> &opcodes) const {
+  return condition->getOpcodes(opcodes);
+}
+
+bool InstrRuleDynamic::mayInstrument(const InstMetadata &metadata,
+                                     const LLVMCPU &llvmcpu) const {
+  return condition->test(metadata.inst, metadata.address, metadata.instSize,
+                         llvmcpu);
+}
+
 // InstrRuleUser
 // =============
 
@@ -206,11 +1338,40 @@ InstrRuleUser::InstrRuleUser(InstrRuleCallback cbk, AnalysisType analysisType,
                              void *cbk_data, VMInstanceRef vm,
                              RangeSet<rword> range, int priority)
     : AutoClone<InstrRule, InstrRuleUser>(priority), cbk(cbk),
-      analysisType(analysisType), cbk_data(cbk_data), vm(vm),
+      cbkFill(nullptr), analysisType(analysisType), cbk_data(cbk_data), vm(vm),
+      range(std::move(range)) {}
+
+InstrRuleUser::InstrRuleUser(InstrRuleCallbackC cbk, AnalysisType analysisType,
+                             void *cbk_data, VMInstanceRef vm,
+                             RangeSet<rword> range, int priority)
+    : AutoClone<InstrRule, InstrRuleUser>(priority), cbk(nullptr),
+      cbkFill(cbk), analysisType(analysisType), cbk_data(cbk_data), vm(vm),
       range(std::move(range)) {}
 
 InstrRuleUser::~InstrRuleUser() = default;
 
+// Add the callbacks returned by a user rule to a patch
+static void addUserCallbacks(Patch &patch,
+                             std::vector<InstrRuleDataCBK> &cbks) {
+  for (InstrRuleDataCBK &cbkToAdd : cbks) {
+    RelocatableInstTag tag = (cbkToAdd.position == PREINST)
+                                 ? RelocTagPreInstStdCBK
+                                 : RelocTagPostInstStdCBK;
+    if (cbkToAdd.lambdaCbk == nullptr) {
+      patch.addCallbackPatch(cbkToAdd.position, cbkToAdd.priority, tag,
+                             {cbkToAdd.cbk, cbkToAdd.data, nullptr});
+    } else {
+      patch.userInstCB.emplace_back(
+          std::make_unique<InstCbLambda>(std::move(cbkToAdd.lambdaCbk)));
+      patch.addCallbackPatch(
+          cbkToAdd.position, cbkToAdd.priority, tag,
+          {InstCBLambdaProxy, patch.userInstCB.back().get(), nullptr});
+    }
+  }
+  // keep the capacity for the next instruction
+  cbks.clear();
+}
+
 bool InstrRuleUser::tryInstrument(Patch &patch, const LLVMCPU &llvmcpu) const {
   if (!range.contains(
           Range<rword>(patch.metadata.address,
@@ -219,38 +1380,71 @@ bool InstrRuleUser::tryInstrument(Patch &patch, const LLVMCPU &llvmcpu) const {
   }
 
   QBDI_DEBUG("Call user InstrCB at {} with analysisType 0x{:x}",
-             reinterpret_cast<void *>(cbk), analysisType);
+             cbk != nullptr ? reinterpret_cast<void *>(cbk)
+                            : reinterpret_cast<void *>(cbkFill),
+             analysisType);
 
   const InstAnalysis *ana =
       analyzeInstMetadata(patch.metadata, analysisType, llvmcpu);
 
-  std::vector<InstrRuleDataCBK> vec = cbk(vm, ana, cbk_data);
+  if (cbkFill != nullptr) {
+    cbkFill(vm, ana, &cbks, cbk_data);
+  } else {
+    cbks = cbk(vm, ana, cbk_data);
+  }
 
-  QBDI_DEBUG("InstrCB return {} callback(s)", vec.size());
+  QBDI_DEBUG("InstrCB return {} callback(s)", cbks.size());
 
-  if (vec.size() == 0) {
+  if (cbks.size() == 0) {
     return false;
   }
 
-  for (const InstrRuleDataCBK &cbkToAdd : vec) {
-    if (cbkToAdd.lambdaCbk == nullptr) {
-      instrument(patch, getCallbackGenerator(cbkToAdd.cbk, cbkToAdd.data), true,
-                 cbkToAdd.position, cbkToAdd.priority,
-                 (cbkToAdd.position == PREINST) ? RelocTagPreInstStdCBK
-                                                : RelocTagPostInstStdCBK);
-    } else {
-      patch.userInstCB.emplace_back(
-          std::make_unique<InstCbLambda>(cbkToAdd.lambdaCbk));
-      instrument(patch,
-                 getCallbackGenerator(InstCBLambdaProxy,
-                                      patch.userInstCB.back().get()),
-                 true, cbkToAdd.position, cbkToAdd.priority,
-                 (cbkToAdd.position == PREINST) ? RelocTagPreInstStdCBK
-                                                : RelocTagPostInstStdCBK);
+  addUserCallbacks(patch, cbks);
+
+  return true;
+}
+
+InstrRuleBBUser::InstrRuleBBUser(InstrRuleBBCallback cbk,
+                                 AnalysisType analysisType, void *cbk_data,
+                                 VMInstanceRef vm, RangeSet<rword> range,
+                                 int priority)
+    : AutoClone<InstrRule, InstrRuleBBUser>(priority), cbk(cbk),
+      analysisType(analysisType), cbk_data(cbk_data), vm(vm),
+      range(std::move(range)) {}
+
+InstrRuleBBUser::~InstrRuleBBUser() = default;
+
+bool InstrRuleBBUser::tryInstrumentBasicBlock(std::vector<Patch> &basicBlock,
+                                              size_t patchEnd,
+                                              const LLVMCPU &llvmcpu) const {
+  block.clear();
+  indexes.clear();
+  for (size_t i = 0; i < patchEnd; i++) {
+    const InstMetadata &metadata = basicBlock[i].metadata;
+    if (range.contains(Range<rword>(metadata.address, metadata.endAddress()))) {
+      block.push_back(analyzeInstMetadata(metadata, analysisType, llvmcpu));
+      indexes.push_back(i);
     }
   }
+  if (block.empty()) {
+    return false;
+  }
 
-  return true;
+  QBDI_DEBUG("Call user basic block InstrCB at {} with {} instruction(s)",
+             reinterpret_cast<void *>(cbk), block.size());
+
+  cbks.resize(block.size());
+  cbk(vm, block, cbks, cbk_data);
+  QBDI_REQUIRE_ACTION(cbks.size() == block.size(), abort());
+
+  bool instrumented = false;
+  for (size_t i = 0; i < cbks.size(); i++) {
+    if (not cbks[i].empty()) {
+      addUserCallbacks(basicBlock[indexes[i]], cbks[i]);
+      instrumented = true;
+    }
+  }
+  return instrumented;
 }
 
 } // namespace QBDI
@@ -19,12 +19,19 @@
 #define INSTRRULE_H
 
 #include <algorithm>
+#include <deque>
+#include <map>
 #include <memory>
+#include <stdint.h>
+#include <string>
+#include <utility>
 #include <vector>
 
+#include "Patch/InstrRules.h"
 #include "Patch/PatchUtils.h"
 #include "Patch/Types.h"
 
+#include "QBDI/CacheStats.h"
 #include "QBDI/Callback.h"
 #include "QBDI/InstAnalysis.h"
 #include "QBDI/Range.h"
@@ -32,8 +39,10 @@
 
 namespace QBDI {
 
+class InstMetadata;
 class LLVMCPU;
 class Patch;
+struct InstrCallback;
 class PatchCondition;
 class PatchGenerator;
 
@@ -48,6 +57,9 @@ protected:
   // priority of the rule.
   // The rule with the lesser priority will be applied first
   int priority;
+  // enable flag of the rule, owned by the Engine. Null if the rule is always
+  // enabled.
+  rword *guard = nullptr;
 
 public:
   InstrRule(int priority = PRIORITY_DEFAULT) : priority(priority) {}
@@ -59,6 +71,30 @@ public:
 
   virtual RangeSet<rword> affectedRange() const = 0;
 
+  /*! Get the opcodes this rule can instrument. Used with affectedRange to
+   * prefilter the rules before the call to tryInstrument.
+   *
+   * @param[out] opcodes  Vector where the opcodes are appended.
+   *
+   * @return False if the rule may instrument any opcode.
+   */
+  virtual bool getOpcodes(std::vector<unsigned> &opcodes) const {
+    return false;
+  }
+
+  /*! Determine if this rule may instrument an instruction, without side
+   * effect. Used to find the cached instructions affected by a new rule.
+   *
+   * @param[in] metadata  The metadata of the instruction.
+   * @param[in] llvmcpu   LLVMCPU object
+   *
+   * @return False if this rule never instruments the instruction.
+   */
+  virtual bool mayInstrument(const InstMetadata &metadata,
+                             const LLVMCPU &llvmcpu) const {
+    return true;
+  }
+
   inline int getPriority() const { return priority; };
 
   inline void setPriority(int priority) { this->priority = priority; };
@@ -67,6 +103,45 @@ public:
 
   inline virtual bool changeDataPtr(void *data) { return false; };
 
+  inline void setGuard(rword *flag) { guard = flag; };
+
+  inline rword *getGuard() const { return guard; };
+
+  inline void setEnabled(bool enable) {
+    if (guard != nullptr) {
+      *guard = enable ? 1 : 0;
+    }
+  };
+
+  inline bool isEnabled() const { return guard == nullptr or *guard != 0; };
+
+  /*! Determine whether the generated code of this rule tests its enable flag.
+   * Otherwise, the rule isn't applied when it is disabled and the cache must
+   * be flushed when the flag changes.
+   */
+  inline virtual bool hasInlineGuard() const { return false; };
+
+  /*! Determine whether this rule instruments a sequence of a basic block at
+   * once with tryInstrumentBasicBlock, instead of each patch with
+   * tryInstrument.
+   */
+  inline virtual bool isBasicBlockRule() const { return false; };
+
+  /*! Instrument the patches of the sequence of a basic block being
+   * translated.
+   *
+   * @param[in] basicBlock  The patches of the basic block.
+   * @param[in] patchEnd    The number of patches of the sequence.
+   * @param[in] llvmcpu     LLVMCPU object
+   *
+   * @return True if a patch of the sequence has been instrumented.
+   */
+  virtual bool tryInstrumentBasicBlock(std::vector<Patch> &basicBlock,
+                                       size_t patchEnd,
+                                       const LLVMCPU &llvmcpu) const {
+    return false;
+  }
+
   /*! Determine wheter this rule have to be apply on this Path and instrument if
    * needed.
    *
@@ -90,6 +165,18 @@ public:
                   RelocatableInstTag tag) const;
 };
 
+/*! Generate the code of the callbacks of a Patch at the same position. The
+ * callbacks share a single break to the host.
+ *
+ * @param[in] patch      The current patch to instrument.
+ * @param[in] position   The position of the callbacks
+ * @param[in] tag        The tag of the callbacks
+ * @param[in] callbacks  The callbacks, in the priority order
+ */
+std::vector<std::unique_ptr<RelocatableInst>>
+generateCallbacks(Patch &patch, InstPosition position, RelocatableInstTag tag,
+                  const std::vector<InstrCallback> &callbacks);
+
 class InstrRuleBasicCBK : public AutoUnique<InstrRule, InstrRuleBasicCBK> {
 
   PatchConditionUniquePtr condition;
@@ -130,6 +217,11 @@ public:
 
   RangeSet<rword> affectedRange() const override;
 
+  bool getOpcodes(std::vector<unsigned> &opcodes) const override;
+
+  bool mayInstrument(const InstMetadata &metadata,
+                     const LLVMCPU &llvmcpu) const override;
+
   /*! Determine wheter this rule applies by evaluating this rule condition on
    * the current context.
    *
@@ -143,16 +235,691 @@ public:
 
   bool changeDataPtr(void *data) override;
 
+  /*! The callback is skipped by the generated code when the rule is disabled
+   */
+  inline bool hasInlineGuard() const override { return breakToHost; };
+
+  bool tryInstrument(Patch &patch, const LLVMCPU &llvmcpu) const override;
+};
+
+class InstrRuleCounter : public AutoUnique<InstrRule, InstrRuleCounter> {
+
+  PatchConditionUniquePtr condition;
+  PatchGeneratorUniquePtrVec patchGen;
+  InstPosition position;
+  uint64_t *counter;
+
+public:
+  /*! Allocate a new instrumentation rule which increments a counter from the
+   * generated code each time an instruction matching the condition is
+   * executed. The instrumentation never breaks to the host.
+   *
+   * @param[in] condition    A PatchCondition which determine wheter or not this
+   *                         PatchRule applies.
+   * @param[in] counter      The counter to increment
+   * @param[in] position     An enum indicating wether this instrumentation
+   *                         should be positioned before the instruction or
+   *                         after it.
+   * @param[in] priority     Priority of the instrumentation
+   */
+  InstrRuleCounter(PatchConditionUniquePtr &&condition, uint64_t *counter,
+                   InstPosition position, int priority = PRIORITY_DEFAULT);
+
+  ~InstrRuleCounter() override;
+
+  std::unique_ptr<InstrRule> clone() const override;
+
+  inline InstPosition getPosition() const { return position; }
+
+  RangeSet<rword> affectedRange() const override;
+
+  bool getOpcodes(std::vector<unsigned> &opcodes) const override;
+
+  bool mayInstrument(const InstMetadata &metadata,
+                     const LLVMCPU &llvmcpu) const override;
+
+  bool canBeApplied(const Patch &patch, const LLVMCPU &llvmcpu) const;
+
+  bool changeDataPtr(void *data) override;
+
   inline bool tryInstrument(Patch &patch,
                             const LLVMCPU &llvmcpu) const override {
     if (canBeApplied(patch, llvmcpu)) {
-      instrument(patch, patchGen, breakToHost, position, priority, tag);
+      instrument(patch, patchGen, false, position, priority, RelocTagInvalid);
       return true;
     }
     return false;
   }
 };
 
+class InstrRuleCoverage : public AutoUnique<InstrRule, InstrRuleCoverage> {
+
+  uint8_t *bitmap;
+  size_t size;
+  CoverageMode mode;
+  rword *prevLoc;
+
+public:
+  /*! Allocate a new instrumentation rule which updates a coverage bitmap from
+   * the generated code before the instruction. The rule applies to every
+   * instruction: the Engine only gives it the first instruction of each
+   * sequence.
+   *
+   * @param[in] bitmap   The bitmap to update
+   * @param[in] size     The size of the bitmap, a power of two
+   * @param[in] mode     The kind of coverage
+   * @param[in] prevLoc  The previous location of the edge coverage
+   * @param[in] priority Priority of the instrumentation
+   */
+  InstrRuleCoverage(uint8_t *bitmap, size_t size, CoverageMode mode,
+                    rword *prevLoc, int priority = PRIORITY_DEFAULT);
+
+  ~InstrRuleCoverage() override;
+
+  std::unique_ptr<InstrRule> clone() const override;
+
+  /*! Get the location of an address in the bitmap
+   */
+  rword getLocation(rword address) const;
+
+  RangeSet<rword> affectedRange() const override;
+
+  bool changeDataPtr(void *data) override;
+
+  bool tryInstrument(Patch &patch, const LLVMCPU &llvmcpu) const override;
+};
+
+/*! Execution counters of the sequences, incremented by the generated code.
+ * The counter of a sequence is kept when the sequence is translated again.
+ */
+struct SequenceProfile {
+  struct Counter {
+    rword address;
+    rword instCount;
+    uint64_t executions;
+  };
+  // the generated code holds the address of the counters
+  std::deque<Counter> counters;
+  std::map<std::pair<rword, rword>, size_t> index;
+  // written by the destructor of the Engine, empty for no report
+  std::string reportPath;
+
+  /*! Get the counter of a sequence, allocated on the first call
+   */
+  uint64_t *getCounter(rword address, rword instCount);
+
+  /*! Get the counters of the executed sequences, symbolized and sorted by
+   * decreasing number of instructions executed
+   */
+  std::vector<SequenceStats> getStats(size_t topN = 0) const;
+
+  void reset();
+
+  /*! Write the sorted counters as text in a file
+   */
+  bool writeReport(const char *path) const;
+};
+
+class InstrRuleSequenceProfile
+    : public AutoUnique<InstrRule, InstrRuleSequenceProfile> {
+
+  SequenceProfile *profile;
+
+public:
+  /*! Allocate a new instrumentation rule which increments the execution
+   * counter of a sequence from the generated code, before its first
+   * instruction. Like InstrRuleCoverage, the Engine only gives it the first
+   * instruction of each sequence.
+   *
+   * @param[in] profile  The counters of the sequences
+   * @param[in] priority Priority of the instrumentation
+   */
+  InstrRuleSequenceProfile(SequenceProfile *profile,
+                           int priority = PRIORITY_DEFAULT);
+
+  ~InstrRuleSequenceProfile() override;
+
+  std::unique_ptr<InstrRule> clone() const override;
+
+  RangeSet<rword> affectedRange() const override;
+
+  bool changeDataPtr(void *data) override;
+
+  /*! Instrument the first patch of a sequence of instCount instructions
+   */
+  void instrumentSequence(Patch &patch, rword instCount,
+                          const LLVMCPU &llvmcpu) const;
+
+  bool tryInstrument(Patch &patch, const LLVMCPU &llvmcpu) const override;
+};
+
+class InstrRuleInstructionBudget
+    : public AutoUnique<InstrRule, InstrRuleInstructionBudget> {
+
+  rword *remaining;
+  InstCallback cbk;
+  void *data;
+
+public:
+  /*! Allocate a new instrumentation rule which subtracts the number of
+   * instructions of a sequence from a budget, before its first instruction.
+   * The generated code only breaks to the host with the callback when the
+   * budget is lower than the number of instructions of the sequence, the
+   * budget is then kept unchanged.
+   *
+   * @param[in] remaining  The budget, decremented by the generated code
+   * @param[in] cbk        The callback of an exhausted budget
+   * @param[in] data       The data of the callback
+   * @param[in] priority   Priority of the instrumentation
+   */
+  InstrRuleInstructionBudget(rword *remaining, InstCallback cbk, void *data,
+                             int priority = PRIORITY_DEFAULT);
+
+  ~InstrRuleInstructionBudget() override;
+
+  std::unique_ptr<InstrRule> clone() const override;
+
+  RangeSet<rword> affectedRange() const override;
+
+  bool changeDataPtr(void *data) override;
+
+  /*! Instrument the first patch of a sequence of instCount instructions
+   */
+  void instrumentSequence(Patch &patch, rword instCount,
+                          const LLVMCPU &llvmcpu) const;
+
+  bool tryInstrument(Patch &patch, const LLVMCPU &llvmcpu) const override;
+};
+
+class InstrRuleStopRequest
+    : public AutoUnique<InstrRule, InstrRuleStopRequest> {
+
+  const rword *flag;
+  InstCallback cbk;
+  void *data;
+
+public:
+  /*! Allocate a new instrumentation rule which tests a stop request flag
+   * before the first instruction of a sequence. The generated code only
+   * breaks to the host with the callback when the flag is set. Like
+   * InstrRuleCoverage, the Engine only gives it the first instruction of each
+   * sequence.
+   *
+   * @param[in] flag      The stop request flag, written by any thread
+   * @param[in] cbk       The callback of a stop request
+   * @param[in] data      The data of the callback
+   * @param[in] priority  Priority of the instrumentation
+   */
+  InstrRuleStopRequest(const rword *flag, InstCallback cbk, void *data,
+                       int priority = PRIORITY_DEFAULT);
+
+  ~InstrRuleStopRequest() override;
+
+  std::unique_ptr<InstrRule> clone() const override;
+
+  RangeSet<rword> affectedRange() const override;
+
+  bool changeDataPtr(void *data) override;
+
+  bool tryInstrument(Patch &patch, const LLVMCPU &llvmcpu) const override;
+};
+
+/*! Outcome counters of the conditional branches, incremented by the
+ * generated code. The counters of a branch are kept when the branch is
+ * translated again.
+ */
+struct BranchProfile {
+  struct Counter {
+    rword address;
+    rword target;
+    // the generated code increments outcomes[1] if the branch is taken
+    uint64_t outcomes[2];
+  };
+  // the generated code holds the address of the counters
+  std::deque<Counter> counters;
+  std::map<rword, size_t> index;
+
+  /*! Get the counters of a branch, allocated on the first call
+   */
+  uint64_t *getCounters(rword address, rword target);
+
+  /*! Get the counters of the executed branches, symbolized and sorted by
+   * decreasing number of executions
+   */
+  std::vector<BranchStats> getStats(size_t topN = 0) const;
+
+  void reset();
+};
+
+class InstrRuleBranchProfile
+    : public AutoUnique<InstrRule, InstrRuleBranchProfile> {
+
+  BranchProfile *profile;
+
+public:
+  /*! Allocate a new instrumentation rule which counts the outcomes of the
+   * conditional branches from the generated code, before the branches.
+   *
+   * @param[in] profile  The counters of the branches
+   * @param[in] priority Priority of the instrumentation
+   */
+  InstrRuleBranchProfile(BranchProfile *profile,
+                         int priority = PRIORITY_DEFAULT);
+
+  ~InstrRuleBranchProfile() override;
+
+  std::unique_ptr<InstrRule> clone() const override;
+
+  RangeSet<rword> affectedRange() const override;
+
+  bool changeDataPtr(void *data) override;
+
+  bool tryInstrument(Patch &patch, const LLVMCPU &llvmcpu) const override;
+};
+
+struct IndirectProfile {
+  struct Site {
+    rword address;
+    // the generated code fills the targets and increments the counts
+    IndirectTargetEntry entries[INDIRECT_TABLE_SIZE + 1];
+  };
+  // the generated code holds the address of the tables
+  std::deque<Site> sites;
+  std::map<rword, size_t> index;
+
+  /*! Get the table of an indirect call or jump, allocated on the first call
+   */
+  IndirectTargetEntry *getTable(rword address);
+
+  /*! Get the executed targets of the indirect calls and jumps, symbolized and
+   * sorted by decreasing number of executions
+   */
+  std::vector<IndirectTargetStats> getStats(size_t topN = 0) const;
+
+  void reset();
+};
+
+class InstrRuleIndirectProfile
+    : public AutoUnique<InstrRule, InstrRuleIndirectProfile> {
+
+  IndirectProfile *profile;
+
+public:
+  /*! Allocate a new instrumentation rule which counts the targets of the
+   * indirect calls and jumps from the generated code, after the instructions.
+   *
+   * @param[in] profile  The target tables of the indirect calls and jumps
+   * @param[in] priority Priority of the instrumentation
+   */
+  InstrRuleIndirectProfile(IndirectProfile *profile,
+                           int priority = PRIORITY_DEFAULT);
+
+  ~InstrRuleIndirectProfile() override;
+
+  std::unique_ptr<InstrRule> clone() const override;
+
+  RangeSet<rword> affectedRange() const override;
+
+  bool changeDataPtr(void *data) override;
+
+  bool tryInstrument(Patch &patch, const LLVMCPU &llvmcpu) const override;
+};
+
+struct ValueProfile {
+  rword address;
+  unsigned reg;
+  // the generated code holds the address of the entries, the last one counts
+  // the values beyond the table
+  std::vector<ValueProfileEntry> entries;
+
+  ValueProfile(rword address, unsigned reg, size_t nbEntries);
+
+  /*! Get the counters of the values, sorted by decreasing number of
+   * executions
+   */
+  std::vector<ValueStats> getStats(size_t topN = 0) const;
+
+  void reset();
+};
+
+class InstrRuleValueProfile
+    : public AutoUnique<InstrRule, InstrRuleValueProfile> {
+
+  ValueProfile *profile;
+
+public:
+  /*! Allocate a new instrumentation rule which counts the values of a
+   * register from the generated code, before an instruction.
+   *
+   * @param[in] profile  The value table of the instruction
+   * @param[in] priority Priority of the instrumentation
+   */
+  InstrRuleValueProfile(ValueProfile *profile,
+                        int priority = PRIORITY_DEFAULT);
+
+  ~InstrRuleValueProfile() override;
+
+  std::unique_ptr<InstrRule> clone() const override;
+
+  RangeSet<rword> affectedRange() const override;
+
+  bool changeDataPtr(void *data) override;
+
+  bool tryInstrument(Patch &patch, const LLVMCPU &llvmcpu) const override;
+};
+
+struct CallGraphProfile {
+  struct Site {
+    rword address;
+    // the callee of a direct call, 0 for an indirect call
+    rword target;
+    // a direct call only uses the first edge
+    CallGraphEdge edges[INDIRECT_TABLE_SIZE + 1];
+  };
+  // the generated code holds the address of the state and of the edges
+  CallGraphState state;
+  std::deque<Site> sites;
+  std::map<rword, size_t> index;
+
+  CallGraphProfile();
+
+  /*! Get the edges of a call site, allocated on the first call
+   */
+  CallGraphEdge *getEdges(rword address, rword target);
+
+  /*! Pop the top frame if its return address matches, as the generated code
+   * of a return. Used when a call returns through the ExecBroker.
+   */
+  void popFrame(rword returnAddress);
+
+  /*! Get the executed edges, symbolized and sorted by decreasing number of
+   * calls
+   */
+  std::vector<CallGraphEdgeStats> getStats(size_t topN = 0) const;
+
+  void reset();
+};
+
+class InstrRuleCallGraph : public AutoUnique<InstrRule, InstrRuleCallGraph> {
+
+  CallGraphProfile *profile;
+
+public:
+  /*! Allocate a new instrumentation rule which records the call graph from
+   * the generated code: the edges of the calls and a shadow stack of the
+   * frames to count the instructions between a call and its return.
+   *
+   * @param[in] profile  The call graph
+   * @param[in] priority Priority of the instrumentation
+   */
+  InstrRuleCallGraph(CallGraphProfile *profile,
+                     int priority = PRIORITY_DEFAULT);
+
+  ~InstrRuleCallGraph() override;
+
+  std::unique_ptr<InstrRule> clone() const override;
+
+  RangeSet<rword> affectedRange() const override;
+
+  bool changeDataPtr(void *data) override;
+
+  /*! Count the instructions of a sequence, on its first instruction
+   */
+  void instrumentSequence(Patch &patch, rword instCount,
+                          const LLVMCPU &llvmcpu) const;
+
+  bool tryInstrument(Patch &patch, const LLVMCPU &llvmcpu) const override;
+};
+
+struct MemoryTraceBuffer;
+
+class InstrRuleMemoryTrace
+    : public AutoUnique<InstrRule, InstrRuleMemoryTrace> {
+
+  MemoryTraceBuffer *buffer;
+
+public:
+  /*! Allocate a new instrumentation rule which appends the memory accesses of
+   * the instructions to a memory trace buffer from the generated code. The
+   * generated code only breaks to the host when the buffer is full.
+   *
+   * @param[in] buffer   The buffer of the memory trace
+   * @param[in] priority Priority of the instrumentation
+   */
+  InstrRuleMemoryTrace(MemoryTraceBuffer *buffer,
+                       int priority = PRIORITY_DEFAULT);
+
+  ~InstrRuleMemoryTrace() override;
+
+  std::unique_ptr<InstrRule> clone() const override;
+
+  RangeSet<rword> affectedRange() const override;
+
+  bool changeDataPtr(void *data) override;
+
+  bool tryInstrument(Patch &patch, const LLVMCPU &llvmcpu) const override;
+};
+
+struct CallTraceBuffer;
+
+class InstrRuleCallTrace : public AutoUnique<InstrRule, InstrRuleCallTrace> {
+
+  CallTraceBuffer *buffer;
+
+public:
+  /*! Allocate a new instrumentation rule which appends the target and the
+   * first arguments of the calls to a call trace buffer from the generated
+   * code. The generated code only breaks to the host when the buffer is full.
+   *
+   * @param[in] buffer   The buffer of the call trace
+   * @param[in] priority Priority of the instrumentation
+   */
+  InstrRuleCallTrace(CallTraceBuffer *buffer, int priority = PRIORITY_DEFAULT);
+
+  ~InstrRuleCallTrace() override;
+
+  std::unique_ptr<InstrRule> clone() const override;
+
+  RangeSet<rword> affectedRange() const override;
+
+  bool changeDataPtr(void *data) override;
+
+  bool tryInstrument(Patch &patch, const LLVMCPU &llvmcpu) const override;
+};
+
+struct PageHistogram;
+
+class InstrRulePageHistogram
+    : public AutoUnique<InstrRule, InstrRulePageHistogram> {
+
+  PageHistogram *histogram;
+
+public:
+  /*! Allocate a new instrumentation rule which counts the memory accesses of
+   * the instructions by page from the generated code. The generated code
+   * only breaks to the host when the leaf of a page is missing.
+   *
+   * @param[in] histogram  The page histogram
+   * @param[in] priority   Priority of the instrumentation
+   */
+  InstrRulePageHistogram(PageHistogram *histogram,
+                         int priority = PRIORITY_DEFAULT);
+
+  ~InstrRulePageHistogram() override;
+
+  std::unique_ptr<InstrRule> clone() const override;
+
+  RangeSet<rword> affectedRange() const override;
+
+  bool changeDataPtr(void *data) override;
+
+  bool tryInstrument(Patch &patch, const LLVMCPU &llvmcpu) const override;
+};
+
+struct OwnershipTable;
+
+/*! Constants of the generated code of an ownership filter
+ */
+struct OwnershipCheck {
+  const OwnershipTable *table;
+  // identifier of the thread of the filter
+  uint32_t thread;
+  // written by the generated code before the break to the host
+  rword *missAddress;
+  // the data of ownershipReadMiss and ownershipWriteMiss
+  void *filter;
+  MemoryAccessType type;
+};
+
+class InstrRuleOwnership : public AutoUnique<InstrRule, InstrRuleOwnership> {
+
+  OwnershipCheck check;
+
+public:
+  /*! Allocate a new instrumentation rule which compares the owners of the
+   * granules of the memory accesses with the thread of an ownership filter
+   * from the generated code. The generated code only breaks to the host when
+   * the owner of a granule is another thread.
+   *
+   * @param[in] check     The constants of the generated code
+   * @param[in] priority  Priority of the instrumentation
+   */
+  InstrRuleOwnership(const OwnershipCheck &check,
+                     int priority = PRIORITY_DEFAULT);
+
+  ~InstrRuleOwnership() override;
+
+  std::unique_ptr<InstrRule> clone() const override;
+
+  RangeSet<rword> affectedRange() const override;
+
+  bool tryInstrument(Patch &patch, const LLVMCPU &llvmcpu) const override;
+};
+
+/*! State of a PREDICATE_SAMPLE predicate. The countdown is decremented by the
+ * generated code and drawn again by the host when it reaches 0, before the
+ * user callback is called.
+ */
+struct PredicateSample {
+  rword countdown;
+  rword period;
+  uint64_t seed;
+  InstCallback cbk;
+  void *data;
+};
+
+class InstrRulePredicateCBK
+    : public AutoUnique<InstrRule, InstrRulePredicateCBK> {
+
+  PatchConditionUniquePtr condition;
+  CallbackPredicate predicate;
+  InstPosition position;
+  RelocatableInstTag tag;
+  InstCallback cbk;
+  void *data;
+  std::unique_ptr<rword> counter;
+  std::unique_ptr<PredicateSample> sample;
+
+public:
+  /*! Allocate a new instrumentation rule which calls a callback only if a
+   * predicate holds. The predicate is evaluated by the generated code, which
+   * only breaks to the host when the callback must be called.
+   *
+   * @param[in] condition    A PatchCondition which determine wheter or not this
+   *                         PatchRule applies.
+   * @param[in] predicate    The predicate evaluated before the callback
+   * @param[in] cbk          The callback to call
+   * @param[in] data         The data pointer to give to the callback
+   * @param[in] position     An enum indicating wether this instrumentation
+   *                         should be positioned before the instruction or
+   *                         after it.
+   * @param[in] priority     Priority of the callback
+   * @param[in] tag          A tag for the callback
+   */
+  InstrRulePredicateCBK(PatchConditionUniquePtr &&condition,
+                        const CallbackPredicate &predicate, InstCallback cbk,
+                        void *data, InstPosition position,
+                        int priority = PRIORITY_DEFAULT,
+                        RelocatableInstTag tag = RelocTagInvalid);
+
+  ~InstrRulePredicateCBK() override;
+
+  std::unique_ptr<InstrRule> clone() const override;
+
+  inline InstPosition getPosition() const { return position; }
+
+  RangeSet<rword> affectedRange() const override;
+
+  bool getOpcodes(std::vector<unsigned> &opcodes) const override;
+
+  bool mayInstrument(const InstMetadata &metadata,
+                     const LLVMCPU &llvmcpu) const override;
+
+  bool canBeApplied(const Patch &patch, const LLVMCPU &llvmcpu) const;
+
+  bool changeDataPtr(void *data) override;
+
+  bool tryInstrument(Patch &patch, const LLVMCPU &llvmcpu) const override;
+};
+
+class InstrRuleDirectCBK : public AutoUnique<InstrRule, InstrRuleDirectCBK> {
+
+  PatchConditionUniquePtr condition;
+  InstPosition position;
+  RelocatableInstTag tag;
+  InstCallback cbk;
+  void *data;
+  CallbackFootprint footprint;
+  std::unique_ptr<VMInstanceRef> vm;
+
+public:
+  /*! Allocate a new instrumentation rule which calls a callback directly from
+   * the generated code, without breaking to the host. Only the registers of
+   * the footprint are saved in the context with the registers clobbered by
+   * the call. A footprint with FOOTPRINT_FPR uses a break to host.
+   *
+   * @param[in] condition    A PatchCondition which determine wheter or not this
+   *                         PatchRule applies.
+   * @param[in] cbk          The callback to call
+   * @param[in] data         The data pointer to give to the callback
+   * @param[in] footprint    The registers used by the callback
+   * @param[in] vminstance   The VMInstanceRef to give to the callback
+   * @param[in] position     An enum indicating wether this instrumentation
+   *                         should be positioned before the instruction or
+   *                         after it.
+   * @param[in] priority     Priority of the callback
+   * @param[in] tag          A tag for the callback
+   */
+  InstrRuleDirectCBK(PatchConditionUniquePtr &&condition, InstCallback cbk,
+                     void *data, CallbackFootprint footprint,
+                     VMInstanceRef vminstance, InstPosition position,
+                     int priority = PRIORITY_DEFAULT,
+                     RelocatableInstTag tag = RelocTagInvalid);
+
+  ~InstrRuleDirectCBK() override;
+
+  std::unique_ptr<InstrRule> clone() const override;
+
+  inline InstPosition getPosition() const { return position; }
+
+  inline void changeVMInstanceRef(VMInstanceRef vminstance) override {
+    *vm = vminstance;
+  };
+
+  RangeSet<rword> affectedRange() const override;
+
+  bool getOpcodes(std::vector<unsigned> &opcodes) const override;
+
+  bool mayInstrument(const InstMetadata &metadata,
+                     const LLVMCPU &llvmcpu) const override;
+
+  bool canBeApplied(const Patch &patch, const LLVMCPU &llvmcpu) const;
+
+  bool changeDataPtr(void *data) override;
+
+  bool tryInstrument(Patch &patch, const LLVMCPU &llvmcpu) const override;
+};
+
 typedef const PatchGeneratorUniquePtrVec &(*PatchGenMethod)(
     Patch &patch, const LLVMCPU &llvmcpu);
 
@@ -194,6 +961,11 @@ public:
 
   RangeSet<rword> affectedRange() const override;
 
+  bool getOpcodes(std::vector<unsigned> &opcodes) const override;
+
+  bool mayInstrument(const InstMetadata &metadata,
+                     const LLVMCPU &llvmcpu) const override;
+
   /*! Determine wheter this rule applies by evaluating this rule condition on
    * the current context.
    *
@@ -219,16 +991,25 @@ public:
 class InstrRuleUser : public AutoClone<InstrRule, InstrRuleUser> {
 
   InstrRuleCallback cbk;
+  InstrRuleCallbackC cbkFill;
   AnalysisType analysisType;
   void *cbk_data;
   VMInstanceRef vm;
   RangeSet<rword> range;
 
+  // Output of cbkFill, reused between the instructions to avoid an
+  // allocation per instruction
+  mutable std::vector<InstrRuleDataCBK> cbks;
+
 public:
   InstrRuleUser(InstrRuleCallback cbk, AnalysisType analysisType,
                 void *cbk_data, VMInstanceRef vm, RangeSet<rword> range,
                 int priority = 0);
 
+  InstrRuleUser(InstrRuleCallbackC cbk, AnalysisType analysisType,
+                void *cbk_data, VMInstanceRef vm, RangeSet<rword> range,
+                int priority = 0);
+
   ~InstrRuleUser() override;
 
   inline void changeVMInstanceRef(VMInstanceRef vminstance) override {
@@ -245,6 +1026,52 @@ public:
   bool tryInstrument(Patch &patch, const LLVMCPU &llvmcpu) const override;
 };
 
+/*! A user rule called once for the sequence of a basic block being
+ * translated, with the analyses of its instructions in the range.
+ */
+class InstrRuleBBUser : public AutoClone<InstrRule, InstrRuleBBUser> {
+
+  InstrRuleBBCallback cbk;
+  AnalysisType analysisType;
+  void *cbk_data;
+  VMInstanceRef vm;
+  RangeSet<rword> range;
+
+  // Arguments of cbk, reused between the basic blocks
+  mutable std::vector<const InstAnalysis *> block;
+  mutable std::vector<std::vector<InstrRuleDataCBK>> cbks;
+  // index in the basic block of each analysis of block
+  mutable std::vector<size_t> indexes;
+
+public:
+  InstrRuleBBUser(InstrRuleBBCallback cbk, AnalysisType analysisType,
+                  void *cbk_data, VMInstanceRef vm, RangeSet<rword> range,
+                  int priority = 0);
+
+  ~InstrRuleBBUser() override;
+
+  inline void changeVMInstanceRef(VMInstanceRef vminstance) override {
+    vm = vminstance;
+  };
+
+  inline bool changeDataPtr(void *data) override {
+    cbk_data = data;
+    return true;
+  };
+
+  inline RangeSet<rword> affectedRange() const override { return range; }
+
+  inline bool isBasicBlockRule() const override { return true; };
+
+  inline bool tryInstrument(Patch &patch,
+                            const LLVMCPU &llvmcpu) const override {
+    return false;
+  }
+
+  bool tryInstrumentBasicBlock(std::vector<Patch> &basicBlock, size_t patchEnd,
+                               const LLVMCPU &llvmcpu) const override;
+};
+
 } // namespace QBDI
 
 #endif
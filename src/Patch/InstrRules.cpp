@@ -35,24 +35,41 @@ namespace QBDI {
  */
 PatchGenerator::UniquePtrVec getCallbackGenerator(InstCallback cbk,
                                                   void *data) {
-  PatchGenerator::UniquePtrVec callbackGenerator;
-
-  // Write callback address in host state
-  callbackGenerator.push_back(
-      GetConstant::unique(Temp(0), Constant((rword)cbk)));
-  callbackGenerator.push_back(WriteTemp::unique(
-      Temp(0), Offset(offsetof(Context, hostState.callback))));
-  // Write callback data pointer in host state
-  callbackGenerator.push_back(
-      GetConstant::unique(Temp(0), Constant((rword)data)));
-  callbackGenerator.push_back(
-      WriteTemp::unique(Temp(0), Offset(offsetof(Context, hostState.data))));
-  // Write internal instruction id of a callback
-  callbackGenerator.push_back(GetInstId::unique(Temp(0)));
-  callbackGenerator.push_back(
-      WriteTemp::unique(Temp(0), Offset(offsetof(Context, hostState.origin))));
-
-  return callbackGenerator;
+  // The callback, its data and the internal instruction id are kept in a
+  // record of the ExecBlock, the site only writes the index of the record in
+  // the host state
+  return conv_unique<PatchGenerator>(
+      WriteCallbackSite::unique(Constant((rword)cbk), Constant((rword)data)));
+}
+
+CallTraceBuffer::CallTraceBuffer(uint32_t nbArgs, size_t capacity,
+                                 CallTraceCallback cbk, void *data)
+    : nbArgs(nbArgs), capacity(capacity),
+      entries(std::make_unique<CallTraceEntry[]>(capacity)), cbk(cbk),
+      data(data) {
+  current = reinterpret_cast<rword>(entries.get());
+  // a call writes a single entry, the buffer is flushed once full
+  limit = reinterpret_cast<rword>(entries.get() + capacity);
+}
+
+size_t CallTraceBuffer::size() const {
+  return reinterpret_cast<const CallTraceEntry *>(current) - entries.get();
+}
+
+VMAction CallTraceBuffer::flush(VMInstanceRef vm) {
+  size_t count = size();
+  current = reinterpret_cast<rword>(entries.get());
+  if (count == 0) {
+    return CONTINUE;
+  }
+  return cbk(vm, entries.get(), count, data);
+}
+
+VMAction flushCallTrace(VMInstanceRef vm, GPRState *gprState,
+                        FPRState *fprState, void *data) {
+  VMAction action = static_cast<CallTraceBuffer *>(data)->flush(vm);
+  // The entries can only be flushed between two instructions
+  return (action == STOP) ? STOP : CONTINUE;
 }
 
 } // namespace QBDI
@@ -18,7 +18,9 @@
 #ifndef INSTRRULES_H
 #define INSTRRULES_H
 
+#include <map>
 #include <memory>
+#include <stdint.h>
 #include <vector>
 
 #include "Patch/Types.h"
@@ -41,6 +43,254 @@ class RelocatableInst;
 std::vector<std::unique_ptr<PatchGenerator>>
 getCallbackGenerator(InstCallback cbk, void *data);
 
+/*
+ * Increment a 64 bits counter from the generated code, without break to host
+ *
+ * @param[in] counter  Pointer to the counter
+ */
+std::vector<std::unique_ptr<PatchGenerator>>
+getCounterGenerator(uint64_t *counter);
+
+/*
+ * Increment the taken or the not taken counter of a conditional branch from
+ * the generated code, without break to host. The patch must be placed before
+ * the branch.
+ *
+ * @param[in] counters  Pointer to the not taken counter, followed by the taken
+ *                      counter
+ * @param[in] cond      Condition code of the branch
+ */
+std::vector<std::unique_ptr<PatchGenerator>>
+getBranchCounterGenerator(uint64_t *counters, unsigned cond);
+
+// Number of targets recorded for each indirect call or jump
+static const size_t INDIRECT_TABLE_SIZE = 4;
+
+// Entry of the target table of an indirect call or jump. The entry
+// INDIRECT_TABLE_SIZE counts the executions to the other targets.
+struct IndirectTargetEntry {
+  uint64_t count;
+  rword target;
+};
+
+// Number of frames of the shadow stack of the call graph. The low byte of the
+// top index selects the frame, a deeper stack overwrites the oldest frames.
+static const size_t CALL_GRAPH_DEPTH = 256;
+
+// Edge of the call graph from a call site to a callee. The count and the
+// target share the layout of IndirectTargetEntry.
+struct CallGraphEdge {
+  uint64_t count;
+  rword target;
+  // instructions executed between the call and the return
+  rword inclusive;
+};
+
+struct CallGraphFrame {
+  CallGraphEdge *edge;
+  rword returnAddress;
+  // instruction counter at the call
+  rword start;
+  rword padding;
+};
+
+// Shadow stack of the call graph, updated by the generated code
+struct CallGraphState {
+  // instructions executed, incremented at the entry of the sequences
+  rword instCount;
+  rword top;
+  // receives the returns without a matching frame
+  CallGraphEdge sink;
+  CallGraphFrame frames[CALL_GRAPH_DEPTH];
+};
+
+/*
+ * Count the target of an indirect call or jump in its target table from the
+ * generated code, without break to host. The patch must be placed after the
+ * instruction, once the target is written in the PC of the context.
+ *
+ * @param[in] table  Pointer to the INDIRECT_TABLE_SIZE + 1 entries
+ */
+std::vector<std::unique_ptr<PatchGenerator>>
+getIndirectTargetGenerator(IndirectTargetEntry *table);
+
+// Maximal number of values recorded for each site of a value profile
+static const size_t VALUE_TABLE_MAX_SIZE = 16;
+
+// Entry of the value table of a site. The entries are filled in order, the
+// last entry of the table counts the executions with the other values.
+struct ValueProfileEntry {
+  uint64_t count;
+  rword value;
+  // the entry holds a value, the value 0 is valid
+  rword used;
+};
+
+/*
+ * Count the value of a register in the value table of a site from the
+ * generated code, without break to host. The patch must be placed before the
+ * instruction.
+ *
+ * @param[in] reg        Index of the register in the GPRState
+ * @param[in] table      Pointer to the nbEntries + 1 entries
+ * @param[in] nbEntries  Number of values recorded in the table
+ */
+std::vector<std::unique_ptr<PatchGenerator>>
+getValueProfileGenerator(unsigned reg, ValueProfileEntry *table,
+                         size_t nbEntries);
+
+/*
+ * Add the number of instructions of a sequence to the instruction counter of
+ * the call graph.
+ */
+std::vector<std::unique_ptr<PatchGenerator>>
+getCallGraphSequenceGenerator(CallGraphState *state, rword instCount);
+
+/*
+ * Count the edge of a call and push a frame on the shadow stack of the call
+ * graph. The patch must be placed after the call. A direct call counts its
+ * edge, an indirect call selects its edge in the INDIRECT_TABLE_SIZE + 1
+ * edges of the table.
+ *
+ * @param[in] state          The shadow stack
+ * @param[in] edges          The edges of the call site
+ * @param[in] indirect       True if the callee is selected in the edges
+ * @param[in] returnAddress  The address after the call
+ */
+std::vector<std::unique_ptr<PatchGenerator>>
+getCallGraphCallGenerator(CallGraphState *state, CallGraphEdge *edges,
+                          bool indirect, rword returnAddress);
+
+/*
+ * Pop the top frame of the shadow stack of the call graph if its return
+ * address is the target of a return. The patch must be placed after the
+ * return.
+ */
+std::vector<std::unique_ptr<PatchGenerator>>
+getCallGraphReturnGenerator(CallGraphState *state);
+
+/*! Buffer of the call trace. The generated code appends an entry at current
+ * after each call and breaks to the host with flushCallTrace when current
+ * reaches limit.
+ */
+struct CallTraceBuffer {
+  // address of the next entry, updated by the generated code
+  rword current;
+  rword limit;
+
+  // number of arguments of the calls without arity
+  uint32_t nbArgs;
+  // number of arguments of the callees of the direct calls
+  std::map<rword, uint32_t> arity;
+  size_t capacity;
+  std::unique_ptr<CallTraceEntry[]> entries;
+  CallTraceCallback cbk;
+  void *data;
+
+  CallTraceBuffer(uint32_t nbArgs, size_t capacity, CallTraceCallback cbk,
+                  void *data);
+
+  size_t size() const;
+
+  /*! Give the entries to the user callback and empty the buffer
+   */
+  VMAction flush(VMInstanceRef vm);
+};
+
+/*! InstCallback of the generated code when the call trace buffer reaches its
+ * limit. The data is the CallTraceBuffer.
+ */
+VMAction flushCallTrace(VMInstanceRef vm, GPRState *gprState,
+                        FPRState *fprState, void *data);
+
+/*
+ * Append the target and the first arguments of a call to the call trace
+ * buffer from the generated code. The generated code only breaks to the host
+ * when the buffer is full. The patch must be placed after the call, once the
+ * target is written in the PC of the context.
+ *
+ * @param[in] buffer  The call trace buffer
+ * @param[in] target  The target of a direct call, 0 for an indirect call
+ * @param[in] nbArgs  The number of arguments to capture
+ */
+std::vector<std::unique_ptr<PatchGenerator>>
+getCallTraceGenerator(CallTraceBuffer *buffer, rword target, uint32_t nbArgs);
+
+/*
+ * Subtract the number of instructions of a sequence from a budget from the
+ * generated code. If the budget is lower than the number of instructions, the
+ * budget is kept and the generated code breaks to the host with a callback.
+ * The patch must be placed before the first instruction of the sequence.
+ *
+ * @param[in] remaining  Pointer to the budget
+ * @param[in] instCount  Number of instructions of the sequence
+ * @param[in] cbk        The callback of an exhausted budget
+ * @param[in] data       Opaque pointer to the callback data
+ * @param[in] pc         The address of the first instruction of the sequence
+ */
+std::vector<std::unique_ptr<PatchGenerator>>
+getInstructionBudgetGenerator(rword *remaining, rword instCount,
+                              InstCallback cbk, void *data, rword pc);
+
+/*
+ * Break to the host with a callback if a flag isn't 0. The flag is read by
+ * the generated code, it may be written by another thread.
+ *
+ * @param[in] flag  Pointer to the flag
+ * @param[in] cbk   The callback called when the flag is set
+ * @param[in] data  Opaque pointer to the callback data
+ * @param[in] pc    The value of PC to set in the context before the callback,
+ *                  0 to keep the value set by the instruction
+ */
+std::vector<std::unique_ptr<PatchGenerator>>
+getFlagCallbackGenerator(const rword *flag, InstCallback cbk, void *data,
+                         rword pc);
+
+/*
+ * Increment the entry of a coverage bitmap from the generated code, without
+ * break to host
+ *
+ * @param[in] bitmap   Pointer to the bitmap
+ * @param[in] curLoc   Location of the current basic block in the bitmap
+ * @param[in] prevLoc  Pointer to the previous location for the edge coverage,
+ *                     nullptr for the block coverage
+ */
+std::vector<std::unique_ptr<PatchGenerator>>
+getCoverageGenerator(uint8_t *bitmap, rword curLoc, rword *prevLoc);
+
+/*
+ * Setup a user callback called only if a predicate evaluated by the generated
+ * code holds. The generated code breaks to the host itself.
+ *
+ * @param[in] predicate  The predicate of the callback
+ * @param[in] counter    Pointer to the counter of PREDICATE_COUNTER or to
+ *                       the countdown of PREDICATE_SAMPLE
+ * @param[in] cbk        Pointer to a user callback
+ * @param[in] data       Opaque pointer to user callback data
+ * @param[in] pc         The value of PC to set in the context before the
+ *                       callback, 0 to keep the value set by the instruction
+ */
+std::vector<std::unique_ptr<PatchGenerator>>
+getPredicateCallbackGenerator(const CallbackPredicate &predicate,
+                              rword *counter, InstCallback cbk, void *data,
+                              rword pc);
+
+/*
+ * Call a user callback directly from the generated code, on the host stack.
+ * Only the registers clobbered by the call and the footprint are saved in the
+ * context.
+ *
+ * @param[in] cbk        Pointer to a user callback
+ * @param[in] data       Opaque pointer to user callback data
+ * @param[in] vm         Pointer to the VMInstanceRef given to the callback
+ * @param[in] footprint  The registers used by the callback
+ * @param[in] pc         The value of PC to set in the context before the
+ *                       callback, 0 to keep the value set by the instruction
+ */
+std::vector<std::unique_ptr<PatchGenerator>>
+getDirectCallbackGenerator(InstCallback cbk, void *data, VMInstanceRef *vm,
+                           CallbackFootprint footprint, rword pc);
+
 std::vector<std::unique_ptr<RelocatableInst>>
 getBreakToHost(Reg temp, const Patch &patch, bool restore);
 } // namespace QBDI
@@ -0,0 +1,203 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+
+#include "QBDI/Ownership.h"
+#include "Patch/MemoryAccess.h"
+#include "Utility/LogSys.h"
+
+namespace QBDI {
+
+MemoryTraceBuffer::MemoryTraceBuffer(MemoryAccessType type, size_t capacity,
+                                     MemoryTraceCallback cbk, void *data)
+    : type(type), capacity(capacity),
+      entries(std::make_unique<MemoryTraceEntry[]>(capacity)), cbk(cbk),
+      data(data) {
+  current = reinterpret_cast<rword>(entries.get());
+  // keep the room for the entries of one instruction after the limit
+  limit = reinterpret_cast<rword>(entries.get() + capacity -
+                                  MEMORY_TRACE_MAX_ENTRIES);
+}
+
+size_t MemoryTraceBuffer::size() const {
+  return reinterpret_cast<const MemoryTraceEntry *>(current) - entries.get();
+}
+
+VMAction MemoryTraceBuffer::flush(VMInstanceRef vm) {
+  size_t count = size();
+  current = reinterpret_cast<rword>(entries.get());
+  if (count == 0) {
+    return CONTINUE;
+  }
+  return cbk(vm, entries.get(), count, data);
+}
+
+VMAction flushMemoryTrace(VMInstanceRef vm, GPRState *gprState,
+                          FPRState *fprState, void *data) {
+  VMAction action = static_cast<MemoryTraceBuffer *>(data)->flush(vm);
+  // The entries can only be flushed between two instructions
+  return (action == STOP) ? STOP : CONTINUE;
+}
+
+PageHistogram::PageHistogram(MemoryAccessType type)
+    : missAddress(0), type(type) {
+  // the pages of the directory are only mapped once accessed
+  directory = static_cast<uint64_t **>(
+      calloc(PAGE_HISTOGRAM_DIRECTORY_SIZE, sizeof(uint64_t *)));
+  QBDI_REQUIRE_ACTION(directory != nullptr, abort());
+}
+
+PageHistogram::~PageHistogram() {
+  for (rword i = 0; i < PAGE_HISTOGRAM_DIRECTORY_SIZE; i++) {
+    free(directory[i]);
+  }
+  free(directory);
+}
+
+void PageHistogram::count(rword address) {
+  rword leafIdx = (address >> PAGE_HISTOGRAM_LEAF_SHIFT) &
+                  (PAGE_HISTOGRAM_DIRECTORY_SIZE - 1);
+  rword pageIdx = (address >> PAGE_HISTOGRAM_PAGE_SHIFT) &
+                  (PAGE_HISTOGRAM_LEAF_SIZE - 1);
+  if (directory[leafIdx] == nullptr) {
+    directory[leafIdx] = static_cast<uint64_t *>(
+        calloc(PAGE_HISTOGRAM_LEAF_SIZE, sizeof(uint64_t)));
+    QBDI_REQUIRE_ACTION(directory[leafIdx] != nullptr, abort());
+  }
+  directory[leafIdx][pageIdx]++;
+}
+
+std::vector<PageAccessStats> PageHistogram::getStats(size_t topN) const {
+  std::vector<PageAccessStats> res;
+  for (rword i = 0; i < PAGE_HISTOGRAM_DIRECTORY_SIZE; i++) {
+    const uint64_t *leaf = directory[i];
+    if (leaf == nullptr) {
+      continue;
+    }
+    for (rword j = 0; j < PAGE_HISTOGRAM_LEAF_SIZE; j++) {
+      if (leaf[j] != 0) {
+        rword page = (i << PAGE_HISTOGRAM_LEAF_SHIFT) |
+                     (j << PAGE_HISTOGRAM_PAGE_SHIFT);
+        res.push_back(PageAccessStats{page, leaf[j]});
+      }
+    }
+  }
+  std::sort(res.begin(), res.end(),
+            [](const PageAccessStats &a, const PageAccessStats &b) {
+              if (a.count != b.count) {
+                return a.count > b.count;
+              }
+              return a.page < b.page;
+            });
+  if (topN != 0 and res.size() > topN) {
+    res.resize(topN);
+  }
+  return res;
+}
+
+void PageHistogram::reset() {
+  for (rword i = 0; i < PAGE_HISTOGRAM_DIRECTORY_SIZE; i++) {
+    if (directory[i] != nullptr) {
+      memset(directory[i], 0, PAGE_HISTOGRAM_LEAF_SIZE * sizeof(uint64_t));
+    }
+  }
+}
+
+VMAction countPageMiss(VMInstanceRef vm, GPRState *gprState,
+                       FPRState *fprState, void *data) {
+  PageHistogram *histogram = static_cast<PageHistogram *>(data);
+  histogram->count(histogram->missAddress);
+  return CONTINUE;
+}
+
+// The generated code reads the directory and the owners as plain words
+static_assert(sizeof(std::atomic<OwnershipTable::Owner *>) == sizeof(rword),
+              "Unexpected size of an atomic pointer");
+static_assert(sizeof(OwnershipTable::Owner) == sizeof(uint32_t),
+              "Unexpected size of an atomic owner");
+
+OwnershipTable::OwnershipTable() : nbLeaves(0) {
+  // the pages of the directory and of the leaves are only mapped once
+  // accessed
+  directory = static_cast<std::atomic<Owner *> *>(
+      calloc(OWNERSHIP_DIRECTORY_SIZE, sizeof(std::atomic<Owner *>)));
+  QBDI_REQUIRE_ACTION(directory != nullptr, abort());
+}
+
+OwnershipTable::~OwnershipTable() {
+  for (rword i = 0; i < OWNERSHIP_DIRECTORY_SIZE; i++) {
+    free(directory[i].load(std::memory_order_relaxed));
+  }
+  free(directory);
+}
+
+OwnershipTable::Owner &OwnershipTable::get(rword address) {
+  rword leafIdx =
+      (address >> OWNERSHIP_LEAF_SHIFT) & (OWNERSHIP_DIRECTORY_SIZE - 1);
+  rword granuleIdx =
+      (address >> OWNERSHIP_GRANULE_SHIFT) & (OWNERSHIP_LEAF_SIZE - 1);
+  Owner *leaf = directory[leafIdx].load(std::memory_order_acquire);
+  if (leaf == nullptr) {
+    // the threads of the other filters may allocate the same leaf
+    std::lock_guard<std::mutex> guard(allocLock);
+    leaf = directory[leafIdx].load(std::memory_order_acquire);
+    if (leaf == nullptr) {
+      leaf = static_cast<Owner *>(calloc(OWNERSHIP_LEAF_SIZE, sizeof(Owner)));
+      QBDI_REQUIRE_ACTION(leaf != nullptr, abort());
+      directory[leafIdx].store(leaf, std::memory_order_release);
+      nbLeaves++;
+    }
+  }
+  return leaf[granuleIdx];
+}
+
+uint32_t OwnershipTable::load(rword address) const {
+  rword leafIdx =
+      (address >> OWNERSHIP_LEAF_SHIFT) & (OWNERSHIP_DIRECTORY_SIZE - 1);
+  const Owner *leaf = directory[leafIdx].load(std::memory_order_acquire);
+  if (leaf == nullptr) {
+    return 0;
+  }
+  return leaf[(address >> OWNERSHIP_GRANULE_SHIFT) & (OWNERSHIP_LEAF_SIZE - 1)]
+      .load(std::memory_order_relaxed);
+}
+
+void OwnershipTable::clear() {
+  for (rword i = 0; i < OWNERSHIP_DIRECTORY_SIZE; i++) {
+    Owner *leaf = directory[i].load(std::memory_order_acquire);
+    if (leaf != nullptr) {
+      memset(static_cast<void *>(leaf), 0, OWNERSHIP_LEAF_SIZE * sizeof(Owner));
+    }
+  }
+}
+
+VMAction ownershipReadMiss(VMInstanceRef vm, GPRState *gprState,
+                           FPRState *fprState, void *data) {
+  return static_cast<OwnershipFilter *>(data)->handleMiss(
+      vm, gprState, fprState, MEMORY_READ);
+}
+
+VMAction ownershipWriteMiss(VMInstanceRef vm, GPRState *gprState,
+                            FPRState *fprState, void *data) {
+  return static_cast<OwnershipFilter *>(data)->handleMiss(
+      vm, gprState, fprState, MEMORY_WRITE);
+}
+
+} // namespace QBDI
@@ -18,20 +18,232 @@
 #ifndef PATCH_MEMORYACCESS_H
 #define PATCH_MEMORYACCESS_H
 
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
 #include "Patch/InstrRule.h"
 
+#include "QBDI/CacheStats.h"
 #include "QBDI/Callback.h"
+#include "QBDI/Range.h"
+#include "QBDI/State.h"
 
 namespace QBDI {
 
 class ExecBlock;
+class LLVMCPU;
+class Patch;
+struct MemAccessInfo;
+
+// Maximum number of entries appended to the memory trace between two checks
+// of the limit
+static const size_t MEMORY_TRACE_MAX_ENTRIES = 3;
+
+/*! Buffer of the memory trace. The generated code appends the entries at
+ * current and breaks to the host with flushMemoryTrace when current reaches
+ * limit.
+ */
+struct MemoryTraceBuffer {
+  // address of the next entry, updated by the generated code
+  rword current;
+  rword limit;
+
+  MemoryAccessType type;
+  size_t capacity;
+  std::unique_ptr<MemoryTraceEntry[]> entries;
+  MemoryTraceCallback cbk;
+  void *data;
+
+  MemoryTraceBuffer(MemoryAccessType type, size_t capacity,
+                    MemoryTraceCallback cbk, void *data);
+
+  size_t size() const;
+
+  /*! Give the entries to the user callback and empty the buffer
+   */
+  VMAction flush(VMInstanceRef vm);
+};
+
+/*! InstCallback of the generated code when the buffer reaches its limit.
+ * The data is the MemoryTraceBuffer.
+ */
+VMAction flushMemoryTrace(VMInstanceRef vm, GPRState *gprState,
+                          FPRState *fprState, void *data);
+
+// The page histogram is a directory of leaves. A leaf counts the accesses of
+// the 4KiB pages of 1GiB of memory. The directory covers the 48 bits of the
+// user address space on X86_64 and the 32 bits of X86.
+static const unsigned PAGE_HISTOGRAM_PAGE_SHIFT = 12;
+static const unsigned PAGE_HISTOGRAM_LEAF_SHIFT = 30;
+static const rword PAGE_HISTOGRAM_LEAF_SIZE =
+    1 << (PAGE_HISTOGRAM_LEAF_SHIFT - PAGE_HISTOGRAM_PAGE_SHIFT);
+static const rword PAGE_HISTOGRAM_DIRECTORY_SIZE =
+    (is_x86_64) ? (1 << 18) : (1 << 2);
+
+/*! Counters of the memory accesses by page. The generated code increments
+ * the counter of the page of each access. The leaves are allocated by the
+ * host: when the leaf of an access is missing, the generated code writes the
+ * address in missAddress and breaks to the host with countPageMiss.
+ */
+struct PageHistogram {
+  // the leaves indexed by address >> 30, null until an access of the leaf
+  uint64_t **directory;
+  // address of the last access without leaf, written by the generated code
+  rword missAddress;
+
+  MemoryAccessType type;
+
+  PageHistogram(MemoryAccessType type);
+
+  ~PageHistogram();
+
+  PageHistogram(const PageHistogram &) = delete;
+  PageHistogram &operator=(const PageHistogram &) = delete;
+
+  /*! Count an access from the host, the leaf is allocated if needed
+   */
+  void count(rword address);
+
+  /*! Get the counters of the accessed pages, sorted by decreasing count
+   *
+   * @param[in] topN  Maximal number of pages returned (0 for all)
+   */
+  std::vector<PageAccessStats> getStats(size_t topN) const;
+
+  /*! Clear the counters, the leaves are kept
+   */
+  void reset();
+};
+
+/*! InstCallback of the generated code when the leaf of an access is missing.
+ * The data is the PageHistogram.
+ */
+VMAction countPageMiss(VMInstanceRef vm, GPRState *gprState,
+                       FPRState *fprState, void *data);
+
+// The ownership table is a directory of leaves. A leaf holds the owners of
+// the granules of 8 bytes of 64MiB of memory (16MiB on X86). The directory
+// covers the 48 bits of the user address space on X86_64 and the 32 bits of
+// X86.
+static const unsigned OWNERSHIP_GRANULE_SHIFT = 3;
+static const unsigned OWNERSHIP_LEAF_SHIFT = (is_x86_64) ? 26 : 24;
+static const rword OWNERSHIP_LEAF_SIZE =
+    1 << (OWNERSHIP_LEAF_SHIFT - OWNERSHIP_GRANULE_SHIFT);
+static const rword OWNERSHIP_DIRECTORY_SIZE =
+    (is_x86_64) ? (1 << 22) : (1 << 8);
+
+/*! Owners of the granules of the memory, shared by the threads. The
+ * generated code reads the directory and the leaves without lock, the host
+ * allocates the leaves and updates the owners atomically.
+ */
+struct OwnershipTable {
+  using Owner = std::atomic<uint32_t>;
+
+  // the leaves indexed by address >> OWNERSHIP_LEAF_SHIFT, null until a
+  // granule of the leaf has an owner
+  std::atomic<Owner *> *directory;
+  std::atomic<size_t> nbLeaves;
+  std::mutex allocLock;
+
+  OwnershipTable();
+
+  ~OwnershipTable();
+
+  OwnershipTable(const OwnershipTable &) = delete;
+  OwnershipTable &operator=(const OwnershipTable &) = delete;
+
+  /*! Get the owner of the granule of an address, the leaf is allocated if
+   * needed
+   */
+  Owner &get(rword address);
+
+  /*! Get the owner of the granule of an address, 0 if the leaf is missing
+   */
+  uint32_t load(rword address) const;
+
+  /*! Release all the granules, the leaves are kept
+   */
+  void clear();
+};
+
+/*! InstCallbacks of the generated code when the owner of a granule isn't the
+ * thread of the filter. The data is the OwnershipFilter.
+ */
+VMAction ownershipReadMiss(VMInstanceRef vm, GPRState *gprState,
+                           FPRState *fprState, void *data);
+
+VMAction ownershipWriteMiss(VMInstanceRef vm, GPRState *gprState,
+                            FPRState *fprState, void *data);
 
 void analyseMemoryAccess(const ExecBlock &currentExecBlock, uint16_t instID,
                          bool afterInst, std::vector<MemoryAccess> &dest);
 
-std::vector<std::unique_ptr<InstrRule>> getInstrRuleMemAccessRead();
+/*! Get the memory accesses of the instructions of a sequence from its entry
+ * startInstID to stopInstID excluded, once they have been executed.
+ */
+void analyseSeqMemoryAccess(const ExecBlock &currentExecBlock,
+                            uint16_t startInstID, uint16_t stopInstID,
+                            MemoryAccessType type,
+                            std::vector<MemoryAccess> &dest);
+
+/*! Copy the value of a memory access of the current sequence captured with
+ * OPT_ENABLE_WIDE_MEMACCESS_VALUE (MEMORY_WIDE_VALUE) in dest, which must
+ * hold access.size bytes. Return false if the access isn't found.
+ */
+bool getMemoryAccessValue(const ExecBlock &currentExecBlock,
+                          const MemoryAccess &access, uint8_t *dest);
+
+/*! Decode the shadows of the memory accesses of the instructions between
+ * startInstID and endInstID (included). Called when a sequence is written to
+ * the ExecBlock. With OPT_ENABLE_MEMACCESS_COALESCING, the adjacent accesses
+ * relative to the same registers are merged.
+ */
+void compileMemoryAccess(const ExecBlock &currentExecBlock,
+                         const LLVMCPU &llvmcpu, uint16_t startInstID,
+                         uint16_t endInstID, std::vector<MemAccessInfo> &dest);
+
+// The recording rules of all the instructions, with the modifiers of the type
+// (MEMORY_ADDRESS_ONLY, MEMORY_NO_STACK and MEMORY_NO_FRAME)
+std::vector<std::unique_ptr<InstrRule>>
+getInstrRuleMemAccessRead(MemoryAccessType type = MEMORY_READ);
+
+std::vector<std::unique_ptr<InstrRule>>
+getInstrRuleMemAccessWrite(MemoryAccessType type = MEMORY_WRITE);
+
+// The recording rules restricted to the instructions of a range
+std::vector<std::unique_ptr<InstrRule>>
+getInstrRuleMemAccessRead(Range<rword> range);
 
-std::vector<std::unique_ptr<InstrRule>> getInstrRuleMemAccessWrite();
+std::vector<std::unique_ptr<InstrRule>>
+getInstrRuleMemAccessWrite(Range<rword> range);
+
+/*! Get the generators which append the memory accesses of an instruction to
+ * the memory trace. The result is empty if there are no access to trace at
+ * this position.
+ */
+std::vector<std::unique_ptr<PatchGenerator>>
+getMemoryTraceGenerator(const Patch &patch, const LLVMCPU &llvmcpu,
+                        InstPosition position, MemoryTraceBuffer *buffer);
+
+/*! Get the generators which count the memory accesses of an instruction in
+ * the page histogram. The result is empty if there are no access to count at
+ * this position.
+ */
+std::vector<std::unique_ptr<PatchGenerator>>
+getPageHistogramGenerator(const Patch &patch, const LLVMCPU &llvmcpu,
+                          InstPosition position, PageHistogram *histogram);
+
+/*! Get the generators which compare the owners of the granules of the memory
+ * accesses of an instruction with the thread of an ownership filter. The
+ * result is empty if there are no access to check at this position.
+ */
+std::vector<std::unique_ptr<PatchGenerator>>
+getOwnershipGenerator(const Patch &patch, const LLVMCPU &llvmcpu,
+                      InstPosition position, const OwnershipCheck &check);
 
 } // namespace QBDI
 
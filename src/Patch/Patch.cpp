@@ -21,6 +21,7 @@
 
 #include "Engine/LLVMCPU.h"
 #include "Patch/ExecBlockFlags.h"
+#include "Patch/InstrRule.h"
 #include "Patch/Patch.h"
 #include "Patch/PatchGenerator.h"
 #include "Patch/Register.h"
@@ -43,6 +44,20 @@ Patch::Patch(const llvm::MCInst &inst, rword address, rword instSize,
 
 Patch::~Patch() = default;
 
+Patch::Patch(const Patch &other)
+    : metadata(other.metadata.lightCopy()), insts(cloneVec(other.insts)),
+      nearInsts(cloneVec(other.nearInsts)),
+      regUsage(other.regUsage), tempReg(other.tempReg),
+      deadGPR(other.deadGPR), deadFlagsBefore(other.deadFlagsBefore),
+      deadFlagsAfter(other.deadFlagsAfter),
+      optimizedSize(other.optimizedSize), llvmcpu(other.llvmcpu),
+      finalize(other.finalize) {
+  QBDI_REQUIRE_ACTION(other.instsPatchs.empty() and other.userInstCB.empty(),
+                      abort());
+}
+
+Patch Patch::clone() const { return Patch(*this); }
+
 Patch::Patch(Patch &&) = default;
 
 Patch &Patch::operator=(Patch &&) = default;
@@ -80,11 +95,18 @@ void Patch::prepend(RelocatableInst::UniquePtrVec v) {
   }
 }
 
+void Patch::addTempReg(unsigned reg) {
+  if (std::find(tempReg.begin(), tempReg.end(), reg) == tempReg.end()) {
+    tempReg.push_back(reg);
+  }
+}
+
 void Patch::addInstsPatch(InstPosition position, int priority,
                           std::vector<std::unique_ptr<RelocatableInst>> v) {
   QBDI_REQUIRE(not finalize);
 
   InstrPatch el{position, priority, std::move(v)};
+  el.stats = ruleStats;
 
   auto it = std::upper_bound(instsPatchs.begin(), instsPatchs.end(), el,
                              [](const InstrPatch &a, const InstrPatch &b) {
@@ -93,8 +115,90 @@ void Patch::addInstsPatch(InstPosition position, int priority,
   instsPatchs.insert(it, std::move(el));
 }
 
+void Patch::addCallbackPatch(InstPosition position, int priority,
+                             RelocatableInstTag tag, InstrCallback callback) {
+  QBDI_REQUIRE(not finalize);
+
+  callback.stats = ruleStats;
+  InstrPatch el{position, priority, {}, tag, {callback}};
+
+  auto it = std::upper_bound(instsPatchs.begin(), instsPatchs.end(), el,
+                             [](const InstrPatch &a, const InstrPatch &b) {
+                               return a.priority > b.priority;
+                             });
+  instsPatchs.insert(it, std::move(el));
+}
+
+void Patch::mergeCallbacks() {
+  for (size_t i = 0; i < instsPatchs.size(); i++) {
+    if (instsPatchs[i].callbacks.empty()) {
+      countInsts(instsPatchs[i]);
+      continue;
+    }
+    // merge the next callbacks at the same position, as long as no other
+    // instrumentation is inserted between them
+    size_t j = i + 1;
+    while (j < instsPatchs.size()) {
+      InstrPatch &next = instsPatchs[j];
+      if (next.position != instsPatchs[i].position) {
+        j++;
+        continue;
+      }
+      if (next.callbacks.empty() or next.tag != instsPatchs[i].tag) {
+        break;
+      }
+      std::move(next.callbacks.begin(), next.callbacks.end(),
+                std::back_inserter(instsPatchs[i].callbacks));
+      instsPatchs.erase(instsPatchs.begin() + j);
+    }
+    instsPatchs[i].insts =
+        generateCallbacks(*this, instsPatchs[i].position, instsPatchs[i].tag,
+                          instsPatchs[i].callbacks);
+    countInsts(instsPatchs[i]);
+    instsPatchs[i].callbacks.clear();
+  }
+}
+
+void Patch::countInsts(InstrPatch &instrPatch) {
+  if (instrPatch.stats == nullptr and
+      std::none_of(instrPatch.callbacks.begin(), instrPatch.callbacks.end(),
+                   [](const InstrCallback &c) { return c.stats != nullptr; })) {
+    return;
+  }
+  rword shadows = 0;
+  for (const auto &inst : instrPatch.insts) {
+    if (inst->createsShadow()) {
+      shadows++;
+    }
+  }
+  if (instrPatch.stats != nullptr) {
+    instrPatch.stats->instCount += instrPatch.insts.size();
+    instrPatch.stats->shadowCount += shadows;
+    return;
+  }
+  // the instructions of the merged callbacks are shared by their rules
+  rword share = instrPatch.callbacks.size();
+  for (const InstrCallback &callback : instrPatch.callbacks) {
+    if (callback.stats != nullptr) {
+      callback.stats->instCount += instrPatch.insts.size() / share;
+      callback.stats->shadowCount += shadows / share;
+    }
+  }
+}
+
+void Patch::useNearInsts() {
+  QBDI_REQUIRE(not finalize);
+  if (nearInsts.empty()) {
+    return;
+  }
+  insts.swap(nearInsts);
+  nearInsts.clear();
+  metadata.patchSize = insts.size();
+}
+
 void Patch::finalizeInstsPatch() {
   QBDI_REQUIRE(not finalize);
+  mergeCallbacks();
   // avoid to used prepend
   // The begin of the patch is a target for the prologue.
   std::vector<std::unique_ptr<RelocatableInst>> prePatch =
@@ -139,7 +243,53 @@ void Patch::finalizeInstsPatch() {
   }
 
   instsPatchs.clear();
+  optimizeInsts();
   finalize = true;
 }
 
+void Patch::optimizeInsts() {
+  // Remove the accesses to the data block that cannot change a value: a
+  // register stored or loaded at an offset holding the same value since a
+  // previous access. This is mostly the restoration of the temporary
+  // registers followed by their save in the next instrumentation.
+  // The entries of the patch are the prologue targets: the beginning, where
+  // a link from another sequence may arrive, and the tag RelocTagPatchEnd.
+  // The analysis doesn't cross them.
+  llvm::SmallVector<std::pair<unsigned, int64_t>, 4> known;
+  std::vector<std::unique_ptr<RelocatableInst>> v;
+  v.reserve(insts.size());
+  for (std::unique_ptr<RelocatableInst> &inst : insts) {
+    if (inst->getTag() != RelocInst) {
+      if (inst->getTag() == RelocTagPatchEnd) {
+        known.clear();
+      }
+      v.push_back(std::move(inst));
+      continue;
+    }
+    unsigned reg;
+    int64_t offset;
+    bool store;
+    size_t size = inst->getDataBlockAccess(reg, offset, store);
+    if (size == 0) {
+      known.clear();
+    } else if (std::find(known.begin(), known.end(),
+                         std::make_pair(reg, offset)) != known.end()) {
+      optimizedSize += size;
+      continue;
+    } else {
+      // a store changes the value at the offset, a load changes the register
+      known.erase(std::remove_if(known.begin(), known.end(),
+                                 [&](const std::pair<unsigned, int64_t> &e) {
+                                   return store ? (e.second == offset)
+                                                : (e.first == reg);
+                                 }),
+                  known.end());
+      known.emplace_back(reg, offset);
+    }
+    v.push_back(std::move(inst));
+  }
+  metadata.patchSize = v.size();
+  insts.swap(v);
+}
+
 } // namespace QBDI
@@ -18,14 +18,16 @@
 #ifndef PATCH_H
 #define PATCH_H
 
-#include <map>
 #include <memory>
-#include <set>
 #include <vector>
 
+#include "llvm/ADT/SmallVector.h"
+
 #include "Patch/InstMetadata.h"
 #include "Patch/Register.h"
+#include "Patch/Types.h"
 
+#include "QBDI/CacheStats.h"
 #include "QBDI/Callback.h"
 #include "QBDI/State.h"
 
@@ -37,26 +39,64 @@ namespace QBDI {
 class LLVMCPU;
 class RelocatableInst;
 
+// Callback which breaks to the host, merged with the adjacent callbacks at
+// the same position when the Patch is finalized
+struct InstrCallback {
+  InstCallback cbk;
+  void *data;
+  // enable flag of the rule, or nullptr
+  const rword *guard;
+  // statistics of the rule, or nullptr if they are disabled
+  InstrRuleStats *stats = nullptr;
+};
+
 struct InstrPatch {
   InstPosition position;
   int priority;
   std::vector<std::unique_ptr<RelocatableInst>> insts;
+  // pending callbacks, generated in insts by finalizeInstsPatch
+  RelocatableInstTag tag = RelocTagInvalid;
+  std::vector<InstrCallback> callbacks;
+  // statistics of the rule of insts, or nullptr
+  InstrRuleStats *stats = nullptr;
 };
 
 class Patch {
 private:
   std::vector<InstrPatch> instsPatchs;
 
+  // only used by clone
+  Patch(const Patch &);
+
+  void optimizeInsts();
+
+  void mergeCallbacks();
+
+  void countInsts(InstrPatch &instrPatch);
+
 public:
   InstMetadata metadata;
   std::vector<std::unique_ptr<RelocatableInst>> insts;
+  // Alternative of insts which accesses the original memory with a rel32
+  // displacement, only valid in an ExecBlock near it (empty if none)
+  std::vector<std::unique_ptr<RelocatableInst>> nearInsts;
   std::vector<std::unique_ptr<InstCbLambda>> userInstCB;
   // Registers Used and Defs by the instruction
-  std::map<unsigned, RegisterUsage> regUsage;
+  RegisterUsageMap regUsage;
   // Registers used by the TempRegister for this patch
-  std::set<unsigned> tempReg;
+  llvm::SmallVector<unsigned, 4> tempReg;
+  // GPR dead after the instruction (bit i for GPR_ID[i]) and flags dead
+  // before and after the instruction, set with OPT_ENABLE_LIVENESS
+  uint32_t deadGPR = 0;
+  bool deadFlagsBefore = false;
+  bool deadFlagsAfter = false;
+  // bytes of code removed by optimizeInsts when the patch was finalized
+  uint32_t optimizedSize = 0;
   const LLVMCPU *llvmcpu;
   bool finalize = false;
+  // statistics of the InstrRule applied by the Engine, given to the
+  // instrumentations added to the patch (nullptr if they are disabled)
+  InstrRuleStats *ruleStats = nullptr;
 
   using Vec = std::vector<Patch>;
 
@@ -68,6 +108,11 @@ public:
 
   ~Patch();
 
+  /*! Copy a patch which hasn't been instrumented yet. The analysis of the
+   * instruction isn't copied.
+   */
+  Patch clone() const;
+
   void setMerge(bool merge);
   void setModifyPC(bool modifyPC);
 
@@ -80,7 +125,21 @@ public:
   void addInstsPatch(InstPosition position, int priority,
                      std::vector<std::unique_ptr<RelocatableInst>> v);
 
+  /*! Add a callback which breaks to the host. The consecutive callbacks at
+   * the same position and with the same tag share a single break to the
+   * host.
+   */
+  void addCallbackPatch(InstPosition position, int priority,
+                        RelocatableInstTag tag, InstrCallback callback);
+
+  /*! Replace the instructions by their near alternative, if any. The patch
+   * must not be instrumented yet.
+   */
+  void useNearInsts();
+
   void finalizeInstsPatch();
+
+  void addTempReg(unsigned reg);
 };
 
 } // namespace QBDI
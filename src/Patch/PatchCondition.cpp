@@ -26,12 +26,51 @@
 
 namespace QBDI {
 
+MnemonicIs::MnemonicIs(const char *mnemonic, const LLVMCPUs &llvmcpus)
+    : mnemonic(mnemonic) {
+  for (int mode = 0; mode < CPUMode::COUNT; mode++) {
+    const llvm::MCInstrInfo &MCII =
+        llvmcpus.getCPU(static_cast<CPUMode>(mode)).getMCII();
+    std::vector<bool> &set = opcodeSet[mode];
+    set.resize(MCII.getNumOpcodes(), false);
+    for (unsigned opcode = 0; opcode < MCII.getNumOpcodes(); opcode++) {
+      set[opcode] = QBDI::String::startsWith(this->mnemonic.c_str(),
+                                             MCII.getName(opcode).data());
+    }
+  }
+}
+
 bool MnemonicIs::test(const llvm::MCInst &inst, rword address, rword instSize,
                       const LLVMCPU &llvmcpu) const {
+  const std::vector<bool> &set = opcodeSet[llvmcpu.getCPUMode()];
+  if (not set.empty()) {
+    return inst.getOpcode() < set.size() and set[inst.getOpcode()];
+  }
   return QBDI::String::startsWith(
       mnemonic.c_str(), llvmcpu.getMCII().getName(inst.getOpcode()).data());
 }
 
+bool MnemonicIs::getOpcodes(std::vector<unsigned> &opcodes) const {
+  for (const std::vector<bool> &set : opcodeSet) {
+    if (set.empty()) {
+      return false;
+    }
+  }
+  // the prefilter is shared by all the CPUMode, use the union of the sets
+  std::vector<unsigned> matches;
+  for (const std::vector<bool> &set : opcodeSet) {
+    for (unsigned opcode = 0; opcode < set.size(); opcode++) {
+      if (set[opcode]) {
+        matches.push_back(opcode);
+      }
+    }
+  }
+  std::sort(matches.begin(), matches.end());
+  matches.erase(std::unique(matches.begin(), matches.end()), matches.end());
+  opcodes.insert(opcodes.end(), matches.begin(), matches.end());
+  return true;
+}
+
 bool OpIs::test(const llvm::MCInst &inst, rword address, rword instSize,
                 const LLVMCPU &llvmcpu) const {
   return inst.getOpcode() == op;
@@ -50,12 +89,33 @@ bool UseReg::test(const llvm::MCInst &inst, rword address, rword instSize,
 
 bool DoesReadAccess::test(const llvm::MCInst &inst, rword address,
                           rword instSize, const LLVMCPU &llvmcpu) const {
-  return getReadSize(inst) > 0;
+  if (getReadSize(inst) == 0) {
+    return false;
+  }
+  if (type & (MEMORY_NO_STACK | MEMORY_NO_FRAME)) {
+    return not isStackRelativeRead(inst,
+                                   llvmcpu.getMCII().get(inst.getOpcode()),
+                                   type & MEMORY_NO_FRAME);
+  }
+  return true;
 }
 
 bool DoesWriteAccess::test(const llvm::MCInst &inst, rword address,
                            rword instSize, const LLVMCPU &llvmcpu) const {
-  return getWriteSize(inst) > 0;
+  if (getWriteSize(inst) == 0) {
+    return false;
+  }
+  if (type & (MEMORY_NO_STACK | MEMORY_NO_FRAME)) {
+    return not isStackRelativeWrite(inst,
+                                    llvmcpu.getMCII().get(inst.getOpcode()),
+                                    type & MEMORY_NO_FRAME);
+  }
+  return true;
+}
+
+bool IsSyscall::test(const llvm::MCInst &inst, rword address, rword instSize,
+                     const LLVMCPU &llvmcpu) const {
+  return isSyscall(inst);
 }
 
 } // namespace QBDI
@@ -27,6 +27,7 @@
 #include "Patch/PatchUtils.h"
 #include "Patch/Types.h"
 
+#include "QBDI/Callback.h"
 #include "QBDI/Range.h"
 #include "QBDI/State.h"
 
@@ -37,6 +38,7 @@ class MCInst;
 namespace QBDI {
 
 class LLVMCPU;
+class LLVMCPUs;
 
 class PatchCondition {
 public:
@@ -54,11 +56,26 @@ public:
     return r;
   }
 
+  /*! Get the opcodes this condition can match. Used to prefilter the
+   * conditions before the call to test.
+   *
+   * @param[out] opcodes  Vector where the opcodes are appended.
+   *
+   * @return False if the condition may match any opcode. In this case, the
+   *         content of opcodes must be ignored.
+   */
+  virtual bool getOpcodes(std::vector<unsigned> &opcodes) const {
+    return false;
+  }
+
   virtual ~PatchCondition() = default;
 };
 
 class MnemonicIs : public AutoClone<PatchCondition, MnemonicIs> {
   std::string mnemonic;
+  // opcodes matching the mnemonic in each CPUMode, indexed by opcode. Empty if
+  // the mnemonic is matched against the name of the opcodes.
+  std::vector<bool> opcodeSet[CPUMode::COUNT];
 
 public:
   /*! Return true if the mnemonic of the current instruction is equal to
@@ -69,8 +86,20 @@ public:
    */
   MnemonicIs(const char *mnemonic) : mnemonic(mnemonic){};
 
+  /*! Return true if the mnemonic of the current instruction is equal to
+   * Mnemonic. The mnemonic is resolved once to the matching opcodes of each
+   * CPUMode.
+   *
+   * @param[in] mnemonic   A null terminated instruction mnemonic (using LLVM
+   * style)
+   * @param[in] llvmcpus   The LLVMCPU of each CPUMode
+   */
+  MnemonicIs(const char *mnemonic, const LLVMCPUs &llvmcpus);
+
   bool test(const llvm::MCInst &inst, rword address, rword instSize,
             const LLVMCPU &llvmcpu) const override;
+
+  bool getOpcodes(std::vector<unsigned> &opcodes) const override;
 };
 
 class OpIs : public AutoClone<PatchCondition, OpIs> {
@@ -85,6 +114,11 @@ public:
 
   bool test(const llvm::MCInst &inst, rword address, rword instSize,
             const LLVMCPU &llvmcpu) const override;
+
+  bool getOpcodes(std::vector<unsigned> &opcodes) const override {
+    opcodes.push_back(op);
+    return true;
+  }
 };
 
 class UseReg : public AutoClone<PatchCondition, UseReg> {
@@ -146,6 +180,30 @@ public:
   }
 };
 
+class AddressIn : public AutoClone<PatchCondition, AddressIn> {
+  // a range of one byte for each address, the adjacent addresses are merged
+  RangeSet<rword> addresses;
+
+public:
+  /*! Return true if on one of the specified addresses
+   *
+   * @param[in] breakpoints List of the addresses.
+   */
+  AddressIn(std::vector<rword> breakpoints) {
+    std::sort(breakpoints.begin(), breakpoints.end());
+    for (rword breakpoint : breakpoints) {
+      addresses.add(Range<rword>(breakpoint, breakpoint + 1));
+    }
+  };
+
+  bool test(const llvm::MCInst &inst, rword address, rword instSize,
+            const LLVMCPU &llvmcpu) const override {
+    return addresses.contains(address);
+  }
+
+  RangeSet<rword> affectedRange() const override { return addresses; }
+};
+
 class And : public AutoUnique<PatchCondition, And> {
   PatchCondition::UniquePtrVec conditions;
 
@@ -175,6 +233,18 @@ public:
     return r;
   }
 
+  bool getOpcodes(std::vector<unsigned> &opcodes) const override {
+    // the opcodes of any condition is a superset of the intersection
+    for (const auto &cond : conditions) {
+      std::vector<unsigned> condOpcodes;
+      if (cond->getOpcodes(condOpcodes)) {
+        opcodes.insert(opcodes.end(), condOpcodes.begin(), condOpcodes.end());
+        return true;
+      }
+    }
+    return false;
+  }
+
   inline std::unique_ptr<PatchCondition> clone() const override {
     return And::unique(cloneVec(conditions));
   };
@@ -208,6 +278,13 @@ public:
     return r;
   }
 
+  bool getOpcodes(std::vector<unsigned> &opcodes) const override {
+    return std::all_of(conditions.begin(), conditions.end(),
+                       [&](const PatchCondition::UniquePtr &cond) {
+                         return cond->getOpcodes(opcodes);
+                       });
+  }
+
   inline std::unique_ptr<PatchCondition> clone() const override {
     return Or::unique(cloneVec(conditions));
   };
@@ -247,20 +324,40 @@ public:
 };
 
 class DoesReadAccess : public AutoClone<PatchCondition, DoesReadAccess> {
+  MemoryAccessType type;
+
 public:
   /*! Return true if the instruction read data from memory.
+   *
+   * @param[in] type  With MEMORY_NO_STACK or MEMORY_NO_FRAME, the reads
+   *                  relative to the stack aren't matched.
    */
-  DoesReadAccess(){};
+  DoesReadAccess(MemoryAccessType type = MEMORY_READ) : type(type){};
 
   bool test(const llvm::MCInst &inst, rword address, rword instSize,
             const LLVMCPU &llvmcpu) const override;
 };
 
 class DoesWriteAccess : public AutoClone<PatchCondition, DoesWriteAccess> {
+  MemoryAccessType type;
+
 public:
   /*! Return true if the instruction write data to memory.
+   *
+   * @param[in] type  With MEMORY_NO_STACK or MEMORY_NO_FRAME, the writes
+   *                  relative to the stack aren't matched.
+   */
+  DoesWriteAccess(MemoryAccessType type = MEMORY_WRITE) : type(type){};
+
+  bool test(const llvm::MCInst &inst, rword address, rword instSize,
+            const LLVMCPU &llvmcpu) const override;
+};
+
+class IsSyscall : public AutoClone<PatchCondition, IsSyscall> {
+public:
+  /*! Return true if the instruction is a system call.
    */
-  DoesWriteAccess(){};
+  IsSyscall(){};
 
   bool test(const llvm::MCInst &inst, rword address, rword instSize,
             const LLVMCPU &llvmcpu) const override;
@@ -186,4 +186,14 @@ RelocatableInst::UniquePtrVec GetInstId::generate(const Patch *patch,
       InstId::unique(temp_manager->getRegForTemp(temp)));
 }
 
+// WriteCallbackSite
+// =================
+
+RelocatableInst::UniquePtrVec
+WriteCallbackSite::generate(const Patch *patch, TempManager *temp_manager,
+                            Patch *toMerge) const {
+
+  return conv_unique<RelocatableInst>(CallbackSite::unique(cbk, data));
+}
+
 } // namespace QBDI
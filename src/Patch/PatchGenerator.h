@@ -346,6 +346,30 @@ public:
            Patch *toMerge) const override;
 };
 
+class WriteCallbackSite : public AutoClone<PatchGenerator, WriteCallbackSite> {
+
+  Constant cbk;
+  Constant data;
+
+public:
+  /*! Register a callback and its data in the ExecBlock with the id of the
+   * current instruction. The generated code only writes the index of the
+   * record in the host state, without temporary.
+   *
+   * @param[in] cbk    The callback function.
+   * @param[in] data   The data of the callback.
+   */
+  WriteCallbackSite(Constant cbk, Constant data) : cbk(cbk), data(data) {}
+
+  /*! Output:
+   *
+   * MOV MEM64 DataBlock[Offset(hostState.callbackSite)], IMM32 site
+   */
+  std::vector<std::unique_ptr<RelocatableInst>>
+  generate(const Patch *patch, TempManager *temp_manager,
+           Patch *toMerge) const override;
+};
+
 // Generic PatchGenerator that must be implemented by each target
 
 class TargetPrologue : public AutoClone<PatchGenerator, TargetPrologue> {
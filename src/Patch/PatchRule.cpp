@@ -15,10 +15,20 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <algorithm>
+#include <iterator>
 #include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
 #include <utility>
 
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/MC/MCDisassembler/MCDisassembler.h"
+#include "llvm/MC/MCInst.h"
+
 #include "QBDI/Bitmask.h"
+#include "Engine/LLVMCPU.h"
 #include "Patch/InstMetadata.h"
 #include "Patch/PatchCondition.h"
 #include "Patch/PatchGenerator.h"
@@ -27,12 +37,17 @@
 #include "Patch/RelocatableInst.h"
 #include "Patch/TempManager.h"
 #include "Patch/Types.h"
+#include "Utility/LogSys.h"
+#include "Utility/Profiler.h"
 
 namespace QBDI {
 
-PatchRule::PatchRule(PatchCondition::UniquePtr &&condition,
-                     std::vector<std::unique_ptr<PatchGenerator>> &&generators)
-    : condition(std::move(condition)), generators(std::move(generators)){};
+PatchRule::PatchRule(
+    PatchCondition::UniquePtr &&condition,
+    std::vector<std::unique_ptr<PatchGenerator>> &&generators,
+    std::vector<std::unique_ptr<PatchGenerator>> &&nearGenerators)
+    : condition(std::move(condition)), generators(std::move(generators)),
+      nearGenerators(std::move(nearGenerators)){};
 
 PatchRule::~PatchRule() = default;
 
@@ -43,9 +58,14 @@ bool PatchRule::canBeApplied(const llvm::MCInst &inst, rword address,
   return condition->test(inst, address, instSize, llvmcpu);
 }
 
+bool PatchRule::getOpcodes(std::vector<unsigned> &opcodes) const {
+  return condition->getOpcodes(opcodes);
+}
+
 Patch PatchRule::generate(const llvm::MCInst &inst, rword address,
                           rword instSize, const LLVMCPU &llvmcpu,
                           Patch *toMerge) const {
+  QBDI_PROFILE_SCOPE(patchRules);
 
   Patch patch(inst, address, instSize, llvmcpu);
   if (toMerge != nullptr) {
@@ -53,12 +73,7 @@ Patch PatchRule::generate(const llvm::MCInst &inst, rword address,
     patch.metadata.instSize += toMerge->metadata.instSize;
     patch.metadata.execblockFlags |= toMerge->metadata.execblockFlags;
     for (const auto &e : toMerge->regUsage) {
-      auto e2 = patch.regUsage.find(e.first);
-      if (e2 != patch.regUsage.end()) {
-        patch.regUsage[e.first] = e2->second | e.second;
-      } else {
-        patch.regUsage.insert(e);
-      }
+      patch.regUsage.add(e.first, e.second);
     }
   }
 
@@ -83,7 +98,196 @@ Patch PatchRule::generate(const llvm::MCInst &inst, rword address,
     }
   }
 
+  // The near alternative doesn't use temporary registers. A merged patch
+  // keeps the instructions of the previous one and has no alternative.
+  if (toMerge == nullptr) {
+    for (const auto &g : nearGenerators) {
+      append(patch.nearInsts, g->generate(&patch, nullptr, nullptr));
+    }
+  }
+
   return patch;
 }
 
+PatchRuleTable::PatchRuleTable(std::vector<PatchRule> &&rules_,
+                               unsigned nbOpcodes)
+    : rules(std::move(rules_)) {
+
+  // The first list holds the rules that may match any opcode. The lists of
+  // the other opcodes are merged with it to keep the order of the rules.
+  std::vector<uint32_t> anyOpcode;
+  std::map<unsigned, std::vector<uint32_t>> byOpcode;
+  for (uint32_t j = 0; j < rules.size(); j++) {
+    std::vector<unsigned> opcodes;
+    if (rules[j].getOpcodes(opcodes)) {
+      for (unsigned opcode : opcodes) {
+        std::vector<uint32_t> &r = byOpcode[opcode];
+        if (r.empty() or r.back() != j) {
+          r.push_back(j);
+        }
+      }
+    } else {
+      anyOpcode.push_back(j);
+    }
+  }
+
+  index.assign(nbOpcodes, 0);
+  candidates.push_back(anyOpcode);
+  for (const auto &e : byOpcode) {
+    if (e.first >= nbOpcodes) {
+      continue;
+    }
+    std::vector<uint32_t> r;
+    std::merge(e.second.begin(), e.second.end(), anyOpcode.begin(),
+               anyOpcode.end(), std::back_inserter(r));
+    index[e.first] = candidates.size();
+    candidates.push_back(std::move(r));
+  }
+}
+
+PatchRuleTable::~PatchRuleTable() = default;
+
+std::vector<Patch>
+PatchRuleTable::patchBasicBlock(rword start, rword end,
+                                const LLVMCPU &llvmcpu, bool single) const {
+  std::vector<Patch> basicBlock;
+  const llvm::ArrayRef<uint8_t> code((uint8_t *)start, (size_t)(end - start));
+  bool basicBlockEnd = false;
+  rword i = 0;
+  QBDI_DEBUG("Patching basic block at address 0x{:x}", start);
+
+  // Get Basic block
+  while (not basicBlockEnd) {
+    llvm::MCInst inst;
+    llvm::MCDisassembler::DecodeStatus dstatus;
+    rword address = start;
+    Patch *patch = nullptr;
+    uint64_t instSize = 0;
+
+    // Aggregate a complete patch
+    do {
+      // Disassemble
+      rword prev_address = address;
+      address = start + i;
+      dstatus = llvmcpu.getInstruction(inst, instSize, code.slice(i), address);
+      if (llvm::MCDisassembler::Success != dstatus) {
+        QBDI_DEBUG("Bump into invalid instruction at address {:x}", address);
+        // Current instruction is invalid, stop the basic block right here
+        if (prev_address == address) {
+          basicBlock.clear();
+          return basicBlock;
+        } else {
+          address = prev_address;
+          basicBlockEnd = true;
+          break;
+        }
+      }
+      QBDI_DEBUG_BLOCK({
+        std::string disass = llvmcpu.showInst(inst, address);
+        QBDI_DEBUG("Patching 0x{:x} {}", address, disass.c_str());
+      });
+      // Patch & merge
+      unsigned opcode = inst.getOpcode();
+      for (uint32_t j : candidates[opcode < index.size() ? index[opcode] : 0]) {
+        if (rules[j].canBeApplied(inst, address, instSize, llvmcpu)) {
+          QBDI_DEBUG("Patch rule {} applied", j);
+          if (patch == nullptr) {
+            basicBlock.push_back(
+                rules[j].generate(inst, address, instSize, llvmcpu));
+            patch = &basicBlock.back();
+          } else {
+            QBDI_DEBUG("Previous instruction merged");
+            *patch = rules[j].generate(inst, address, instSize, llvmcpu, patch);
+          }
+          break;
+        }
+      }
+      QBDI_REQUIRE_ACTION(patch != nullptr, abort());
+      i += instSize;
+    } while (patch->metadata.merge);
+
+    if (patch) {
+      QBDI_DEBUG("Patch of size {:x} generated", patch->metadata.patchSize);
+    }
+
+    if (basicBlockEnd || patch->metadata.modifyPC || single) {
+      QBDI_DEBUG(
+          "Basic block starting at address 0x{:x} ended at address 0x{:x}",
+          start, address);
+      basicBlockEnd = true;
+    }
+  }
+
+  return basicBlock;
+}
+
+std::shared_ptr<PatchCache> PatchCache::getShared(const std::string &key) {
+  // Never destroyed: a static VM may release its cache after the end of main
+  static std::mutex *sharedLock = new std::mutex;
+  static auto *shared =
+      new std::unordered_map<std::string, std::weak_ptr<PatchCache>>;
+
+  std::lock_guard<std::mutex> guard(*sharedLock);
+  for (auto it = shared->begin(); it != shared->end();) {
+    if (it->second.expired()) {
+      it = shared->erase(it);
+    } else {
+      ++it;
+    }
+  }
+  std::shared_ptr<PatchCache> cache = (*shared)[key].lock();
+  if (not cache) {
+    cache = std::make_shared<PatchCache>();
+    (*shared)[key] = cache;
+  }
+  return cache;
+}
+
+bool PatchCache::get(rword address, const LLVMCPU &llvmcpu,
+                     std::vector<Patch> &basicBlock) const {
+  std::shared_lock<std::shared_mutex> guard(lock);
+  auto it = basicBlocks.find(address);
+  if (it == basicBlocks.end() or
+      it->second.front().metadata.cpuMode != llvmcpu.getCPUMode()) {
+    return false;
+  }
+  basicBlock.clear();
+  basicBlock.reserve(it->second.size());
+  for (const Patch &p : it->second) {
+    basicBlock.push_back(p.clone());
+    // the basic block may have been patched by another VM
+    basicBlock.back().llvmcpu = &llvmcpu;
+  }
+  return true;
+}
+
+void PatchCache::add(const std::vector<Patch> &basicBlock) {
+  QBDI_REQUIRE_ACTION(not basicBlock.empty(), return );
+  std::unique_lock<std::shared_mutex> guard(lock);
+  if (basicBlocks.size() >= MAX_BASIC_BLOCKS) {
+    QBDI_DEBUG("PatchCache is full, clear it");
+    basicBlocks.clear();
+  }
+  std::vector<Patch> &cached = basicBlocks[basicBlock.front().metadata.address];
+  cached.clear();
+  cached.reserve(basicBlock.size());
+  for (const Patch &p : basicBlock) {
+    cached.push_back(p.clone());
+  }
+}
+
+void PatchCache::clear(const Range<rword> &range) {
+  std::unique_lock<std::shared_mutex> guard(lock);
+  // the entries of an AddressMap cannot be removed one by one
+  AddressMap<std::vector<Patch>> kept;
+  for (auto &it : basicBlocks) {
+    Range<rword> bbRange{it.second.front().metadata.address,
+                         it.second.back().metadata.endAddress()};
+    if (not bbRange.overlaps(range)) {
+      kept[it.first] = std::move(it.second);
+    }
+  }
+  basicBlocks = std::move(kept);
+}
+
 } // namespace QBDI
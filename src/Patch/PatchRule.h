@@ -19,10 +19,15 @@
 #define PATCHRULE_H
 
 #include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
 #include <vector>
 
+#include "QBDI/Range.h"
 #include "QBDI/State.h"
 #include "Patch/Patch.h"
+#include "Utility/AddressMap.h"
 
 namespace llvm {
 class MCInst;
@@ -38,17 +43,24 @@ class PatchCondition;
 class PatchRule {
   std::unique_ptr<PatchCondition> condition;
   std::vector<std::unique_ptr<PatchGenerator>> generators;
+  std::vector<std::unique_ptr<PatchGenerator>> nearGenerators;
 
 public:
   /*! Allocate a new patch rule with a condition and a list of generators.
    *
-   * @param[in] condition   A PatchCondition which determine wheter or not this
-   *                        PatchRule applies.
-   * @param[in] generators  A vector of PatchGenerator which will produce the
-   *                        patch instructions.
+   * @param[in] condition       A PatchCondition which determine wheter or not
+   *                            this PatchRule applies.
+   * @param[in] generators      A vector of PatchGenerator which will produce
+   *                            the patch instructions.
+   * @param[in] nearGenerators  A vector of PatchGenerator which will produce
+   *                            the near alternative of the patch instructions
+   *                            (Patch::nearInsts). They cannot use temporary
+   *                            registers.
    */
-  PatchRule(std::unique_ptr<PatchCondition> &&condition,
-            std::vector<std::unique_ptr<PatchGenerator>> &&generators);
+  PatchRule(
+      std::unique_ptr<PatchCondition> &&condition,
+      std::vector<std::unique_ptr<PatchGenerator>> &&generators,
+      std::vector<std::unique_ptr<PatchGenerator>> &&nearGenerators = {});
 
   PatchRule(PatchRule &&);
 
@@ -67,6 +79,14 @@ public:
   bool canBeApplied(const llvm::MCInst &inst, rword address, rword instSize,
                     const LLVMCPU &llvmcpu) const;
 
+  /*! Get the opcodes this rule can be applied on.
+   *
+   * @param[out] opcodes  Vector where the opcodes are appended.
+   *
+   * @return False if the rule may be applied on any opcode.
+   */
+  bool getOpcodes(std::vector<unsigned> &opcodes) const;
+
   /*! Generate this rule output patch by evaluating its generators on the
    * current context. Also handles the temporary register management for this
    * patch.
@@ -86,6 +106,94 @@ public:
                  const LLVMCPU &llvmcpu, Patch *toMerge = nullptr) const;
 };
 
+/*! The PatchRules of an architecture indexed by opcode.
+ */
+class PatchRuleTable {
+  std::vector<PatchRule> rules;
+  // candidates of each opcode, as an index in candidates
+  std::vector<uint16_t> index;
+  std::vector<std::vector<uint32_t>> candidates;
+
+public:
+  /*! Index the rules by opcode. The candidates of an opcode keep the order of
+   * the rules, the first one that can be applied is used.
+   *
+   * @param[in] rules      The patch rules.
+   * @param[in] nbOpcodes  The number of opcodes of the architecture.
+   */
+  PatchRuleTable(std::vector<PatchRule> &&rules, unsigned nbOpcodes);
+
+  ~PatchRuleTable();
+
+  /*! Disassemble and patch a basic block.
+   *
+   * @param[in] start     The address of the basic block.
+   * @param[in] end       The end of the readable code. The basic block stops
+   *                      before the first instruction that crosses it.
+   * @param[in] llvmcpu   LLVMCPU object
+   * @param[in] single    Stop the basic block after its first patch
+   *                      (OPT_SINGLE_STEP).
+   *
+   * @return The patches of the basic block. Empty if the first instruction
+   * cannot be disassembled.
+   */
+  std::vector<Patch> patchBasicBlock(rword start, rword end,
+                                     const LLVMCPU &llvmcpu,
+                                     bool single = false) const;
+};
+
+/*! The output of the PatchRules by basic block. It doesn't depend on the
+ * instrumentation and is only cleared when the code may have changed. The
+ * cache is thread safe, it may be shared by the VMs with the same CPU and
+ * options (OPT_ENABLE_SHARED_PATCHES).
+ */
+class PatchCache {
+  // the cache is emptied when it reaches this number of basic blocks
+  static constexpr size_t MAX_BASIC_BLOCKS = 0x10000;
+
+  mutable std::shared_mutex lock;
+  AddressMap<std::vector<Patch>> basicBlocks;
+
+public:
+  /*! Get the cache shared by the VMs of the process with the same key. The
+   * cache is released with its last user.
+   *
+   * @param[in] key  The CPU, the attributes and the options of the VM.
+   */
+  static std::shared_ptr<PatchCache> getShared(const std::string &key);
+
+  /*! Get a copy of a cached basic block.
+   *
+   * @param[in]  address     The address of the basic block.
+   * @param[in]  llvmcpu     The LLVMCPU of the copy, with the CPUMode of the
+   *                         basic block.
+   * @param[out] basicBlock  The patches of the basic block.
+   *
+   * @return True if the basic block is in the cache for this mode.
+   */
+  bool get(rword address, const LLVMCPU &llvmcpu,
+           std::vector<Patch> &basicBlock) const;
+
+  /*! Add a copy of a basic block which hasn't been instrumented yet.
+   *
+   * @param[in] basicBlock  The patches of the basic block.
+   */
+  void add(const std::vector<Patch> &basicBlock);
+
+  /*! Remove the basic blocks that overlap a range.
+   *
+   * @param[in] range  The range of code that may have changed.
+   */
+  void clear(const Range<rword> &range);
+
+  /*! Remove all the basic blocks.
+   */
+  void clear() {
+    std::unique_lock<std::shared_mutex> guard(lock);
+    basicBlocks.clear();
+  }
+};
+
 } // namespace QBDI
 
 #endif // PATCHRULE_H
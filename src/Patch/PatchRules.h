@@ -26,6 +26,7 @@
 
 namespace QBDI {
 
+class LLVMCPU;
 class PatchRule;
 class RelocatableInst;
 
@@ -35,6 +36,12 @@ getExecBlockPrologue(Options opts);
 std::vector<std::unique_ptr<RelocatableInst>>
 getExecBlockEpilogue(Options opts);
 
+std::vector<std::unique_ptr<RelocatableInst>>
+getTrampolinePrologue(Options opts, const LLVMCPU &llvmcpu);
+
+std::vector<std::unique_ptr<RelocatableInst>>
+getTrampolineEpilogue(Options opts, const LLVMCPU &llvmcpu);
+
 std::vector<std::unique_ptr<RelocatableInst>> getTerminator(rword address);
 
 std::vector<PatchRule> getDefaultPatchRules(Options opts);
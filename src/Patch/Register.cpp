@@ -23,25 +23,19 @@
 #include "llvm/MC/MCInstrInfo.h"
 
 #include "Engine/LLVMCPU.h"
+#include "Patch/Patch.h"
 #include "Patch/Register.h"
 
 #include "Utility/LogSys.h"
 
 namespace QBDI {
 
-void addRegisterInMap(std::map<unsigned, RegisterUsage> &m, unsigned reg,
-                      RegisterUsage usage) {
-  auto e = m.find(reg);
-  if (e != m.end()) {
-    m[reg] = usage | e->second;
-  } else {
-    m[reg] = usage;
-  }
+void addRegisterInMap(RegisterUsageMap &m, unsigned reg, RegisterUsage usage) {
+  m.add(reg, usage);
 }
 
-std::map<unsigned, RegisterUsage> getUsedGPR(const llvm::MCInst &inst,
-                                             const LLVMCPU &llvmcpu) {
-  std::map<unsigned, RegisterUsage> res{};
+RegisterUsageMap getUsedGPR(const llvm::MCInst &inst, const LLVMCPU &llvmcpu) {
+  RegisterUsageMap res{};
 
   const llvm::MCInstrDesc &desc = llvmcpu.getMCII().get(inst.getOpcode());
   unsigned e = desc.isVariadic() ? inst.getNumOperands() : desc.getNumDefs();
@@ -101,4 +95,42 @@ std::map<unsigned, RegisterUsage> getUsedGPR(const llvm::MCInst &inst,
   return res;
 }
 
+void computeLiveness(std::vector<Patch> &basicBlock) {
+  static const uint32_t allGPR = (1u << AVAILABLE_GPR) - 1;
+
+  uint32_t liveGPR = allGPR;
+  bool liveFlags = true;
+
+  for (auto it = basicBlock.rbegin(); it != basicBlock.rend(); ++it) {
+    Patch &patch = *it;
+    patch.deadGPR = allGPR & ~liveGPR;
+    patch.deadFlagsAfter = not liveFlags;
+
+    uint32_t overwrittenGPR = 0;
+    bool overwrittenFlags = false;
+    if (not getOverwrittenRegisters(patch.metadata.inst, *patch.llvmcpu,
+                                    overwrittenGPR, overwrittenFlags)) {
+      liveGPR = allGPR;
+      liveFlags = true;
+    } else {
+      liveGPR &= ~overwrittenGPR;
+      liveFlags = liveFlags and not overwrittenFlags;
+      for (const auto &e : patch.regUsage) {
+        if ((e.second & RegisterUsed) == 0) {
+          continue;
+        }
+        if (e.first == GPR_ID[REG_FLAG]) {
+          liveFlags = true;
+          continue;
+        }
+        size_t pos = getGPRPosition(e.first);
+        if (pos < AVAILABLE_GPR) {
+          liveGPR |= (1u << pos);
+        }
+      }
+    }
+    patch.deadFlagsBefore = not liveFlags;
+  }
+}
+
 } // namespace QBDI
@@ -18,9 +18,14 @@
 #ifndef REGISTER_H
 #define REGISTER_H
 
+#include <algorithm>
 #include <cstddef>
 #include <map>
 #include <stdint.h>
+#include <utility>
+#include <vector>
+
+#include "llvm/ADT/SmallVector.h"
 
 #include "QBDI/Bitmask.h"
 
@@ -30,6 +35,7 @@ class MCInst;
 
 namespace QBDI {
 class LLVMCPU;
+class Patch;
 
 extern const unsigned int GPR_ID[];
 extern const unsigned int FLAG_ID[];
@@ -56,13 +62,56 @@ typedef enum {
 
 _QBDI_ENABLE_BITMASK_OPERATORS(RegisterUsage)
 
+/* Flat map of the registers used by an instruction
+ *
+ * An instruction only uses a few registers: the entries are kept in a small
+ * inline buffer to avoid any allocation for each instruction.
+ */
+class RegisterUsageMap {
+public:
+  using value_type = std::pair<unsigned, RegisterUsage>;
+
+private:
+  llvm::SmallVector<value_type, 8> entries;
+
+public:
+  using const_iterator = llvm::SmallVector<value_type, 8>::const_iterator;
+
+  inline const_iterator begin() const { return entries.begin(); }
+  inline const_iterator end() const { return entries.end(); }
+
+  inline const_iterator find(unsigned reg) const {
+    return std::find_if(entries.begin(), entries.end(),
+                        [reg](const value_type &e) { return e.first == reg; });
+  }
+
+  inline size_t count(unsigned reg) const {
+    return (find(reg) != end()) ? 1 : 0;
+  }
+
+  inline size_t size() const { return entries.size(); }
+
+  inline bool empty() const { return entries.empty(); }
+
+  // Add the usage of a register, merged with the previous usage if any
+  inline void add(unsigned reg, RegisterUsage usage) {
+    for (value_type &e : entries) {
+      if (e.first == reg) {
+        e.second |= usage;
+        return;
+      }
+    }
+    entries.emplace_back(reg, usage);
+  }
+};
+
 /* Add register not declared by llvm in the RegisterUsageMap
  *
  * This method is called by getUsedGPR and must be implemented by each target
  * to fix missing declaration of LLVM.
  */
 void fixLLVMUsedGPR(const llvm::MCInst &inst, const LLVMCPU &llvmcpu,
-                    std::map<unsigned, RegisterUsage> &);
+                    RegisterUsageMap &);
 
 /* Get General Register used and set by an instruction (needed for TempManager)
  *
@@ -71,12 +120,26 @@ void fixLLVMUsedGPR(const llvm::MCInst &inst, const LLVMCPU &llvmcpu,
  * /!\ LLVM may not include all usage of stack register (mostly on call/ret
  * instruction)
  */
-std::map<unsigned, RegisterUsage> getUsedGPR(const llvm::MCInst &inst,
-                                             const LLVMCPU &llvmcpu);
+RegisterUsageMap getUsedGPR(const llvm::MCInst &inst, const LLVMCPU &llvmcpu);
 
 // Add a register in the register usage Map
-void addRegisterInMap(std::map<unsigned, RegisterUsage> &m, unsigned reg,
-                      RegisterUsage usage);
+void addRegisterInMap(RegisterUsageMap &m, unsigned reg, RegisterUsage usage);
+
+/* Get the registers overwritten by an instruction without reading them
+ *
+ * The GPR are a bitmask (bit i for GPR_ID[i]) and flags is true if all the
+ * arithmetic flags are overwritten. Return false if the instruction may read
+ * any register (system call, interruption, ...). This method must be
+ * implemented by each target.
+ */
+bool getOverwrittenRegisters(const llvm::MCInst &inst, const LLVMCPU &llvmcpu,
+                             uint32_t &gpr, bool &flags);
+
+/* Compute the GPR and the flags that are dead around each patch of a basic
+ * block (Patch::deadGPR, Patch::deadFlagsBefore and Patch::deadFlagsAfter).
+ * All the registers are live at the end of the basic block.
+ */
+void computeLiveness(std::vector<Patch> &basicBlock);
 
 }; // namespace QBDI
 
@@ -19,6 +19,8 @@
 #define RELOCATABLEINST_H
 
 #include <memory>
+#include <stddef.h>
+#include <stdint.h>
 #include <vector>
 
 #include "llvm/MC/MCInst.h"
@@ -28,20 +30,57 @@
 
 namespace QBDI {
 class ExecBlock;
+class LLVMCPU;
 
 class RelocatableInst {
+  // The tag and the kind are stored in the base, the ExecBlock reads them
+  // without a virtual call for each instruction it writes.
+  RelocatableInstTag tag;
+  bool noReloc;
+
+protected:
+  RelocatableInst(RelocatableInstTag tag, bool noReloc)
+      : tag(tag), noReloc(noReloc) {}
+
 public:
   using UniquePtr = std::unique_ptr<RelocatableInst>;
   using UniquePtrVec = std::vector<std::unique_ptr<RelocatableInst>>;
 
-  RelocatableInst() {}
+  RelocatableInst() : tag(RelocInst), noReloc(false) {}
 
-  virtual RelocatableInstTag getTag() const { return RelocInst; };
+  inline RelocatableInstTag getTag() const { return tag; };
+
+  // True for a NoReloc, its instruction is written as is by the ExecBlock
+  inline bool isNoReloc() const { return noReloc; }
 
   virtual std::unique_ptr<RelocatableInst> clone() const = 0;
 
   virtual llvm::MCInst reloc(ExecBlock *exec_block) const = 0;
 
+  // Get the size of the generated instruction. The relocation only changes
+  // the immediates and the displacements, their encodings have a fixed size.
+  virtual size_t getSize(const LLVMCPU &llvmcpu) const = 0;
+
+  // Describe an access between a register and the data block. Return the
+  // size of the generated instruction, or 0 if it isn't such an access.
+  virtual size_t getDataBlockAccess(unsigned &reg, int64_t &offset,
+                                    bool &store) const {
+    return 0;
+  }
+
+  // Get the address accessed with a rel32 displacement from the ExecBlock.
+  // Return false if the instruction doesn't use one.
+  virtual bool getRel32Target(rword &target) const { return false; }
+
+  // True if the instruction allocates a new shadow in the ExecBlock
+  virtual bool createsShadow() const { return false; }
+
+  // Get the callback of a break to the host, registered by the ExecBlock
+  // before the instruction is written. Return false if it isn't a site.
+  virtual bool getCallbackSite(rword &callback, rword &data) const {
+    return false;
+  }
+
   virtual ~RelocatableInst() = default;
 };
 
@@ -50,25 +89,29 @@ class NoReloc : public AutoClone<RelocatableInst, NoReloc> {
 
 public:
   NoReloc(llvm::MCInst &&inst)
-      : AutoClone<RelocatableInst, NoReloc>(),
+      : AutoClone<RelocatableInst, NoReloc>(RelocInst, true),
         inst(std::forward<llvm::MCInst>(inst)) {}
 
+  inline const llvm::MCInst &getInst() const { return inst; }
+
   llvm::MCInst reloc(ExecBlock *exec_block) const override { return inst; }
+
+  size_t getSize(const LLVMCPU &llvmcpu) const override;
 };
 
 // Generic RelocatableInst that must be implemented by each target
 
 class RelocTag : public AutoClone<RelocatableInst, RelocTag> {
-  RelocatableInstTag tag;
-
 public:
-  RelocTag(RelocatableInstTag t) : tag(t) {}
-
-  RelocatableInstTag getTag() const override { return tag; }
+  RelocTag(RelocatableInstTag t)
+      : AutoClone<RelocatableInst, RelocTag>(t, false) {}
 
   // The Execblock must skip the generation if a RelocatableInst doesn't return
   // RelocInst. Generate a NOP and a log Error.
   llvm::MCInst reloc(ExecBlock *execBlock) const override;
+
+  // A tag doesn't generate any code
+  size_t getSize(const LLVMCPU &llvmcpu) const override { return 0; }
 };
 
 class LoadShadow : public AutoClone<RelocatableInst, LoadShadow> {
@@ -81,6 +124,8 @@ public:
 
   // Load a value from the last shadow with the given tag
   llvm::MCInst reloc(ExecBlock *execBlock) const override;
+
+  size_t getSize(const LLVMCPU &llvmcpu) const override;
 };
 
 class StoreShadow : public AutoClone<RelocatableInst, StoreShadow> {
@@ -97,6 +142,10 @@ public:
   // if create, the shadow is create in the ExecBlock with the given tag
   // otherwise, the last shadow with this tag is used
   llvm::MCInst reloc(ExecBlock *execBlock) const override;
+
+  size_t getSize(const LLVMCPU &llvmcpu) const override;
+
+  bool createsShadow() const override { return create; }
 };
 
 class LoadDataBlock : public AutoClone<RelocatableInst, LoadDataBlock> {
@@ -109,6 +158,11 @@ public:
 
   // Load a value from the specified offset of the datablock
   llvm::MCInst reloc(ExecBlock *execBlock) const override;
+
+  size_t getSize(const LLVMCPU &llvmcpu) const override;
+
+  size_t getDataBlockAccess(unsigned &reg, int64_t &offset,
+                            bool &store) const override;
 };
 
 class StoreDataBlock : public AutoClone<RelocatableInst, StoreDataBlock> {
@@ -122,6 +176,11 @@ public:
 
   // Store a value to the specified offset of the datablock
   llvm::MCInst reloc(ExecBlock *execBlock) const override;
+
+  size_t getSize(const LLVMCPU &llvmcpu) const override;
+
+  size_t getDataBlockAccess(unsigned &reg, int64_t &offset,
+                            bool &store) const override;
 };
 
 class MovReg : public AutoClone<RelocatableInst, MovReg> {
@@ -134,6 +193,8 @@ public:
 
   // Move a value from a register to another
   llvm::MCInst reloc(ExecBlock *execBlock) const override;
+
+  size_t getSize(const LLVMCPU &llvmcpu) const override;
 };
 
 class LoadImm : public AutoClone<RelocatableInst, LoadImm> {
@@ -146,6 +207,8 @@ public:
 
   // Set the register to this value
   llvm::MCInst reloc(ExecBlock *execBlock) const override;
+
+  size_t getSize(const LLVMCPU &llvmcpu) const override;
 };
 
 class InstId : public AutoClone<RelocatableInst, InstId> {
@@ -156,6 +219,29 @@ public:
 
   // Store the current instruction ID in the register
   llvm::MCInst reloc(ExecBlock *exec_block) const override;
+
+  size_t getSize(const LLVMCPU &llvmcpu) const override;
+};
+
+class CallbackSite : public AutoClone<RelocatableInst, CallbackSite> {
+  rword callback;
+  rword data;
+
+public:
+  CallbackSite(rword callback, rword data)
+      : AutoClone<RelocatableInst, CallbackSite>(), callback(callback),
+        data(data) {}
+
+  // Store the index of the record of the callback in hostState.callbackSite
+  llvm::MCInst reloc(ExecBlock *exec_block) const override;
+
+  size_t getSize(const LLVMCPU &llvmcpu) const override;
+
+  bool getCallbackSite(rword &callback, rword &data) const override {
+    callback = this->callback;
+    data = this->data;
+    return true;
+  }
 };
 
 } // namespace QBDI
@@ -32,6 +32,7 @@
 #include "Patch/Register.h"
 #include "Patch/TempManager.h"
 #include "Utility/LogSys.h"
+#include "Utility/Profiler.h"
 
 #if defined(QBDI_ARCH_X86_64) || defined(QBDI_ARCH_X86)
 // skip RAX as it is very often used implicitly and LLVM
@@ -43,11 +44,17 @@ static constexpr unsigned int _QBDI_FIRST_FREE_REGISTER = 0;
 
 namespace QBDI {
 
-TempManager::TempManager(Patch &patch, bool allowInstRegister)
+TempManager::TempManager(Patch &patch, bool allowInstRegister,
+                         bool deadFlags)
     : patch(patch), MRI(patch.llvmcpu->getMRI()),
-      allowInstRegister(allowInstRegister) {}
+      allowInstRegister(allowInstRegister), deadFlags(deadFlags) {}
+
+bool TempManager::isDeadRegister(const Reg &r) const {
+  return r.getID() < AVAILABLE_GPR and (patch.deadGPR & (1u << r.getID()));
+}
 
 Reg TempManager::getRegForTemp(unsigned int id) {
+  QBDI_PROFILE_SCOPE(tempManager);
 
   // Check if the id is already alocated
   for (const auto &p : temps) {
@@ -70,15 +77,36 @@ Reg TempManager::getRegForTemp(unsigned int id) {
     }
     if (freeReg) {
       temps.emplace_back(id, r.getID());
-      patch.tempReg.insert(r);
+      patch.addTempReg(r);
       return r;
     }
   }
 
+  // try to find a register dead around the instruction
+  for (unsigned int i = _QBDI_FIRST_FREE_REGISTER; i < AVAILABLE_GPR; i++) {
+    if ((patch.deadGPR & (1u << i)) == 0 or
+        patch.regUsage.count(GPR_ID[i]) != 0) {
+      continue;
+    }
+    bool freeReg = true;
+    for (const auto &p : temps) {
+      if (p.second == i) {
+        freeReg = false;
+        break;
+      }
+    }
+    if (freeReg) {
+      temps.emplace_back(id, i);
+      patch.addTempReg(GPR_ID[i]);
+      return Reg(i);
+    }
+  }
+
   // Start from the last free register found (or default)
   unsigned int i;
   if (temps.size() > 0) {
-    if (unrestoreGPR.count(temps.back().second) == 0) {
+    if (unrestoreGPR.count(temps.back().second) == 0 and
+        not isDeadRegister(temps.back().second)) {
       i = temps.back().second + 1;
     } else {
       i = _QBDI_FIRST_FREE_REGISTER;
@@ -92,7 +120,7 @@ Reg TempManager::getRegForTemp(unsigned int id) {
     if (patch.regUsage.count(GPR_ID[i]) == 0) {
       // store it and return it
       temps.emplace_back(id, i);
-      patch.tempReg.insert(GPR_ID[i]);
+      patch.addTempReg(GPR_ID[i]);
       return Reg(i);
     }
   }
@@ -107,7 +135,7 @@ Reg TempManager::getRegForTemp(unsigned int id) {
     // store it and return it
     if (i < AVAILABLE_GPR) {
       temps.emplace_back(id, i);
-      patch.tempReg.insert(GPR_ID[i]);
+      patch.addTempReg(GPR_ID[i]);
       return Reg(i);
     }
   }
@@ -42,12 +42,14 @@ class TempManager {
   Patch &patch;
   const llvm::MCRegisterInfo &MRI;
   bool allowInstRegister;
+  bool deadFlags;
 
   // list of registers that doesn't need to be restore
   static const std::set<Reg> unrestoreGPR;
 
 public:
-  TempManager(Patch &patch, bool allowInstRegister = false);
+  TempManager(Patch &patch, bool allowInstRegister = false,
+              bool deadFlags = false);
 
   Reg getRegForTemp(unsigned int id);
 
@@ -55,6 +57,12 @@ public:
 
   bool shouldRestore(const Reg &r) const { return unrestoreGPR.count(r) == 0; }
 
+  // The register is dead around the instruction, it doesn't need to be saved
+  bool isDeadRegister(const Reg &r) const;
+
+  // The flags don't need to be preserved by the generated code
+  bool areFlagsDead() const { return deadFlags; }
+
   size_t getUsedRegisterNumber() const;
 
   unsigned getSizedSubReg(unsigned reg, unsigned size) const;
@@ -37,8 +37,12 @@ struct ExecBlockFlagsArray {
 
   constexpr ExecBlockFlagsArray() : arr() {
     for (unsigned i = 0; i < llvm::X86::NUM_TARGET_REGS; i++) {
-      if (llvm::X86::YMM0 <= i && i <= llvm::X86::YMM15) {
+      if ((llvm::X86::YMM0 <= i && i <= llvm::X86::YMM7) ||
+          (llvm::X86::ZMM0 <= i && i <= llvm::X86::ZMM7)) {
         arr[i] = ExecBlockFlags::needAVX | ExecBlockFlags::needFPU;
+      } else if ((llvm::X86::YMM8 <= i && i <= llvm::X86::YMM15) ||
+                 (llvm::X86::ZMM8 <= i && i <= llvm::X86::ZMM15)) {
+        arr[i] = ExecBlockFlags::needAVXHigh | ExecBlockFlags::needFPU;
       } else if ((llvm::X86::XMM0 <= i && i <= llvm::X86::XMM15) ||
                  (llvm::X86::ST0 <= i && i <= llvm::X86::ST7) ||
                  (llvm::X86::MM0 <= i && i <= llvm::X86::MM7) ||
@@ -63,9 +67,9 @@ struct ExecBlockFlagsArray {
 
 } // namespace
 
-const uint8_t defaultExecuteFlags = ExecBlockFlags::needAVX |
-                                    ExecBlockFlags::needFPU |
-                                    ExecBlockFlags::needFSGS;
+const uint8_t defaultExecuteFlags =
+    ExecBlockFlags::needAVX | ExecBlockFlags::needAVXHigh |
+    ExecBlockFlags::needFPU | ExecBlockFlags::needFSGS;
 
 uint8_t getExecBlockFlags(const llvm::MCInst &inst,
                           const QBDI::LLVMCPU &llvmcpu) {
@@ -74,11 +78,21 @@ uint8_t getExecBlockFlags(const llvm::MCInst &inst,
   const llvm::MCInstrDesc &desc = llvmcpu.getMCII().get(inst.getOpcode());
   uint8_t flags = 0;
 
+  // VEX and EVEX instructions zero the upper bits of their XMM destination
+  const uint64_t encoding = desc.TSFlags & llvm::X86II::EncodingMask;
+  const bool isVEX =
+      (encoding == llvm::X86II::VEX or encoding == llvm::X86II::EVEX);
+
   // register flag
   for (size_t i = 0; i < inst.getNumOperands(); i++) {
     const llvm::MCOperand &op = inst.getOperand(i);
     if (op.isReg()) {
       flags |= cache.get(op.getReg());
+      if (isVEX and llvm::X86::XMM0 <= op.getReg() and
+          op.getReg() <= llvm::X86::XMM15) {
+        flags |= (op.getReg() <= llvm::X86::XMM7) ? ExecBlockFlags::needAVX
+                                                  : ExecBlockFlags::needAVXHigh;
+      }
     }
   }
 
@@ -99,7 +113,7 @@ uint8_t getExecBlockFlags(const llvm::MCInst &inst,
     }
   }
 
-  if ((flags & ExecBlockFlags::needAVX) != 0) {
+  if ((flags & (ExecBlockFlags::needAVX | ExecBlockFlags::needAVXHigh)) != 0) {
     flags |= ExecBlockFlags::needFPU;
   }
 
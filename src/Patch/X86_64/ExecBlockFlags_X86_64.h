@@ -23,9 +23,12 @@
 namespace QBDI {
 
 typedef enum : uint8_t {
+  // upper halves of YMM0-YMM7
   needAVX = 1 << 0,
   needFPU = 1 << 1,
   needFSGS = 1 << 2,
+  // upper halves of YMM8-YMM15
+  needAVXHigh = 1 << 3,
 } ExecBlockFlags;
 
 }
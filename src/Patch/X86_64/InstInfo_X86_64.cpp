@@ -2870,6 +2870,48 @@ bool isStackWrite(const llvm::MCInst &inst) {
   return IS_STACK_WRITE(memAccessCache.get(inst.getOpcode()));
 }
 
+// The memory operand of the instruction is based on the stack pointer, or on
+// the frame pointer with frame. The other segments than SS aren't the stack.
+static bool isStackMemOperand(const llvm::MCInst &inst,
+                              const llvm::MCInstrDesc &desc, bool frame) {
+  int memIndex = llvm::X86II::getMemoryOperandNo(desc.TSFlags);
+  if (memIndex < 0 or implicitDSIAccess(inst, desc)) {
+    return false;
+  }
+  unsigned realMemIndex = memIndex + llvm::X86II::getOperandBias(desc);
+  if (inst.getNumOperands() <= realMemIndex + 4 or
+      not inst.getOperand(realMemIndex + 0).isReg() or
+      not inst.getOperand(realMemIndex + 4).isReg()) {
+    return false;
+  }
+  unsigned seg = inst.getOperand(realMemIndex + 4).getReg();
+  if (seg != 0 and seg != llvm::X86::SS) {
+    return false;
+  }
+  switch (inst.getOperand(realMemIndex + 0).getReg()) {
+    case llvm::X86::RSP:
+    case llvm::X86::ESP:
+      return true;
+    case llvm::X86::RBP:
+    case llvm::X86::EBP:
+      return frame;
+    default:
+      return false;
+  }
+}
+
+bool isStackRelativeRead(const llvm::MCInst &inst,
+                         const llvm::MCInstrDesc &desc, bool frame) {
+  return getReadSize(inst) > 0 and
+         (isStackRead(inst) or isStackMemOperand(inst, desc, frame));
+}
+
+bool isStackRelativeWrite(const llvm::MCInst &inst,
+                          const llvm::MCInstrDesc &desc, bool frame) {
+  return getWriteSize(inst) > 0 and
+         (isStackWrite(inst) or isStackMemOperand(inst, desc, frame));
+}
+
 bool isMinSizeRead(const llvm::MCInst &inst) {
   return IS_MIN_SIZE_READ(memAccessCache.get(inst.getOpcode()));
 }
@@ -3015,4 +3057,96 @@ bool unsupportedWrite(const llvm::MCInst &inst) {
   }
 }
 
+unsigned getStaticSuccessors(const llvm::MCInst &inst, rword address,
+                             rword instSize, rword successors[2]) {
+  rword next = address + instSize;
+  switch (inst.getOpcode()) {
+    case llvm::X86::JMP_1:
+    case llvm::X86::JMP_2:
+    case llvm::X86::JMP_4:
+      successors[0] = next + inst.getOperand(0).getImm();
+      return 1;
+    // the return address is likely executed after the call
+    case llvm::X86::CALL64pcrel32:
+    case llvm::X86::CALLpcrel16:
+    case llvm::X86::CALLpcrel32:
+    case llvm::X86::JCC_1:
+    case llvm::X86::JCC_2:
+    case llvm::X86::JCC_4:
+    case llvm::X86::LOOP:
+    case llvm::X86::LOOPE:
+    case llvm::X86::LOOPNE:
+      successors[0] = next + inst.getOperand(0).getImm();
+      successors[1] = next;
+      return 2;
+    default:
+      return 0;
+  }
+}
+
+bool getConditionalBranch(const llvm::MCInst &inst, rword address,
+                          rword instSize, rword &target, unsigned &cond) {
+  switch (inst.getOpcode()) {
+    // LOOP and JCXZ also depend on the count register
+    case llvm::X86::JCC_1:
+    case llvm::X86::JCC_2:
+    case llvm::X86::JCC_4:
+      target = address + instSize + inst.getOperand(0).getImm();
+      cond = inst.getOperand(1).getImm();
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool isIndirectCallOrJump(const llvm::MCInst &inst) {
+  switch (inst.getOpcode()) {
+    case llvm::X86::JMP32r:
+    case llvm::X86::JMP32m:
+    case llvm::X86::JMP64r:
+    case llvm::X86::JMP64m:
+    case llvm::X86::CALL32r:
+    case llvm::X86::CALL32m:
+    case llvm::X86::CALL64r:
+    case llvm::X86::CALL64m:
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool getUnconditionalTarget(const llvm::MCInst &inst, rword address,
+                            rword instSize, rword &target) {
+  switch (inst.getOpcode()) {
+    case llvm::X86::JMP_1:
+    case llvm::X86::JMP_2:
+    case llvm::X86::JMP_4:
+    case llvm::X86::CALL64pcrel32:
+    case llvm::X86::CALLpcrel16:
+    case llvm::X86::CALLpcrel32:
+      target = address + instSize + inst.getOperand(0).getImm();
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool isSyscall(const llvm::MCInst &inst) {
+  switch (inst.getOpcode()) {
+    case llvm::X86::SYSCALL:
+      return true;
+    // int 0x80 is the system call of linux 32 bits. sysenter isn't included,
+    // it doesn't return to the next instruction.
+    case llvm::X86::INT:
+      return inst.getNumOperands() == 1 and inst.getOperand(0).isImm() and
+             inst.getOperand(0).getImm() == 0x80;
+    default:
+      return false;
+  }
+}
+
+rword getSyscallNumber(const GPRState *gprState) {
+  return QBDI_GPR_GET(gprState, REG_RETURN);
+}
+
 }; // namespace QBDI
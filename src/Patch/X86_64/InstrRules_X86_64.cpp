@@ -24,6 +24,7 @@
 #include "Patch/RelocatableInst.h"
 #include "Patch/Types.h"
 #include "Patch/X86_64/Layer2_X86_64.h"
+#include "Patch/X86_64/PatchGenerator_X86_64.h"
 #include "Patch/X86_64/RelocatableInst_X86_64.h"
 
 #include "QBDI/Config.h"
@@ -64,4 +65,121 @@ RelocatableInst::UniquePtrVec getBreakToHost(Reg temp, const Patch &patch,
   return breakToHost;
 }
 
+PatchGenerator::UniquePtrVec getCounterGenerator(uint64_t *counter) {
+  return conv_unique<PatchGenerator>(IncrementCounter::unique(
+      Temp(0), Temp(1), Constant(reinterpret_cast<rword>(counter))));
+}
+
+PatchGenerator::UniquePtrVec getBranchCounterGenerator(uint64_t *counters,
+                                                      unsigned cond) {
+  return conv_unique<PatchGenerator>(IncrementBranchCounter::unique(
+      Temp(0), Temp(1), Constant(reinterpret_cast<rword>(counters)), cond));
+}
+
+PatchGenerator::UniquePtrVec
+getIndirectTargetGenerator(IndirectTargetEntry *table) {
+  return conv_unique<PatchGenerator>(UpdateTargetTable::unique(
+      Temp(0), Temp(1), Temp(2), Temp(3),
+      Constant(reinterpret_cast<rword>(table)), sizeof(IndirectTargetEntry)));
+}
+
+PatchGenerator::UniquePtrVec
+getValueProfileGenerator(unsigned reg, ValueProfileEntry *table,
+                         size_t nbEntries) {
+  // the value is copied before the other temporaries are written
+  return conv_unique<PatchGenerator>(
+      CopyReg::unique(Reg(reg), Temp(0)),
+      UpdateValueTable::unique(Temp(0), Temp(1), Temp(2), Temp(3),
+                               Constant(reinterpret_cast<rword>(table)),
+                               nbEntries));
+}
+
+PatchGenerator::UniquePtrVec
+getCallGraphSequenceGenerator(CallGraphState *state, rword instCount) {
+  return conv_unique<PatchGenerator>(AddCounter::unique(
+      Temp(0), Temp(1),
+      Constant(reinterpret_cast<rword>(&state->instCount)),
+      Constant(instCount)));
+}
+
+PatchGenerator::UniquePtrVec
+getCallGraphCallGenerator(CallGraphState *state, CallGraphEdge *edges,
+                          bool indirect, rword returnAddress) {
+  PatchGenerator::UniquePtrVec p;
+  if (indirect) {
+    p.push_back(UpdateTargetTable::unique(
+        Temp(0), Temp(1), Temp(2), Temp(3),
+        Constant(reinterpret_cast<rword>(edges)), sizeof(CallGraphEdge)));
+  } else {
+    p.push_back(
+        GetConstant::unique(Temp(2), Constant(reinterpret_cast<rword>(edges))));
+    p.push_back(IncrementCounter::unique(
+        Temp(0), Temp(1), Constant(reinterpret_cast<rword>(&edges->count))));
+  }
+  p.push_back(PushCallFrame::unique(Temp(2), Temp(0), Temp(1), Temp(3),
+                                    Constant(reinterpret_cast<rword>(state)),
+                                    Constant(returnAddress)));
+  return p;
+}
+
+PatchGenerator::UniquePtrVec
+getCallGraphReturnGenerator(CallGraphState *state) {
+  return conv_unique<PatchGenerator>(
+      PopCallFrame::unique(Temp(0), Temp(1), Temp(2), Temp(3), Temp(4),
+                           Constant(reinterpret_cast<rword>(state))));
+}
+
+PatchGenerator::UniquePtrVec
+getCallTraceGenerator(CallTraceBuffer *buffer, rword target, uint32_t nbArgs) {
+  return conv_unique<PatchGenerator>(WriteCallTrace::unique(
+      Temp(0), Temp(1), Constant(reinterpret_cast<rword>(&buffer->current)),
+      Constant(buffer->limit), Constant(reinterpret_cast<rword>(buffer)),
+      Constant(target), nbArgs));
+}
+
+PatchGenerator::UniquePtrVec
+getCoverageGenerator(uint8_t *bitmap, rword curLoc, rword *prevLoc) {
+  return conv_unique<PatchGenerator>(UpdateCoverage::unique(
+      Temp(0), Temp(1), Constant(reinterpret_cast<rword>(bitmap)),
+      Constant(curLoc), Constant(reinterpret_cast<rword>(prevLoc))));
+}
+
+PatchGenerator::UniquePtrVec
+getInstructionBudgetGenerator(rword *remaining, rword instCount,
+                              InstCallback cbk, void *data, rword pc) {
+  return conv_unique<PatchGenerator>(ConsumeBudget::unique(
+      Temp(0), Temp(1), Temp(2), Constant(reinterpret_cast<rword>(remaining)),
+      Constant(instCount), Constant(reinterpret_cast<rword>(cbk)),
+      Constant(reinterpret_cast<rword>(data)), Constant(pc)));
+}
+
+PatchGenerator::UniquePtrVec
+getFlagCallbackGenerator(const rword *flag, InstCallback cbk, void *data,
+                         rword pc) {
+  return conv_unique<PatchGenerator>(FlagCallback::unique(
+      Temp(0), Temp(1), Constant(reinterpret_cast<rword>(flag)),
+      Constant(reinterpret_cast<rword>(cbk)),
+      Constant(reinterpret_cast<rword>(data)), Constant(pc)));
+}
+
+PatchGenerator::UniquePtrVec
+getPredicateCallbackGenerator(const CallbackPredicate &predicate,
+                              rword *counter, InstCallback cbk, void *data,
+                              rword pc) {
+  return conv_unique<PatchGenerator>(PredicateCallback::unique(
+      Temp(0), Temp(1), Temp(2), predicate,
+      Constant(reinterpret_cast<rword>(counter)),
+      Constant(reinterpret_cast<rword>(cbk)),
+      Constant(reinterpret_cast<rword>(data)), Constant(pc)));
+}
+
+PatchGenerator::UniquePtrVec
+getDirectCallbackGenerator(InstCallback cbk, void *data, VMInstanceRef *vm,
+                           CallbackFootprint footprint, rword pc) {
+  return conv_unique<PatchGenerator>(DirectCallback::unique(
+      Constant(reinterpret_cast<rword>(cbk)),
+      Constant(reinterpret_cast<rword>(data)),
+      Constant(reinterpret_cast<rword>(vm)), Constant(pc), footprint));
+}
+
 } // namespace QBDI
@@ -63,6 +63,21 @@ llvm::MCInst mov32mr(unsigned int base, rword scale, unsigned int offset,
   return inst;
 }
 
+llvm::MCInst mov32mi(unsigned int base, rword scale, unsigned int offset,
+                     rword displacement, unsigned int seg, rword imm) {
+  llvm::MCInst inst;
+
+  inst.setOpcode(llvm::X86::MOV32mi);
+  inst.addOperand(llvm::MCOperand::createReg(base));
+  inst.addOperand(llvm::MCOperand::createImm(scale));
+  inst.addOperand(llvm::MCOperand::createReg(offset));
+  inst.addOperand(llvm::MCOperand::createImm(displacement));
+  inst.addOperand(llvm::MCOperand::createReg(seg));
+  inst.addOperand(llvm::MCOperand::createImm(imm));
+
+  return inst;
+}
+
 llvm::MCInst mov32rm8(unsigned int dst, unsigned int base, rword scale,
                       unsigned int offset, rword displacement,
                       unsigned int seg) {
@@ -157,6 +172,21 @@ llvm::MCInst mov64mr(unsigned int base, rword scale, unsigned int offset,
   return inst;
 }
 
+llvm::MCInst mov64mi32(unsigned int base, rword scale, unsigned int offset,
+                       rword displacement, unsigned int seg, rword imm) {
+  llvm::MCInst inst;
+
+  inst.setOpcode(llvm::X86::MOV64mi32);
+  inst.addOperand(llvm::MCOperand::createReg(base));
+  inst.addOperand(llvm::MCOperand::createImm(scale));
+  inst.addOperand(llvm::MCOperand::createReg(offset));
+  inst.addOperand(llvm::MCOperand::createImm(displacement));
+  inst.addOperand(llvm::MCOperand::createReg(seg));
+  inst.addOperand(llvm::MCOperand::createImm(imm));
+
+  return inst;
+}
+
 llvm::MCInst mov64rm(unsigned int dst, unsigned int base, rword scale,
                      unsigned int offset, rword displacement,
                      unsigned int seg) {
@@ -204,6 +234,195 @@ llvm::MCInst test64ri32(unsigned int base, uint32_t imm) {
   return inst;
 }
 
+llvm::MCInst cmp32rr(unsigned int reg1, unsigned int reg2) {
+  llvm::MCInst inst;
+
+  inst.setOpcode(llvm::X86::CMP32rr);
+  inst.addOperand(llvm::MCOperand::createReg(reg1));
+  inst.addOperand(llvm::MCOperand::createReg(reg2));
+
+  return inst;
+}
+
+llvm::MCInst cmp64rr(unsigned int reg1, unsigned int reg2) {
+  llvm::MCInst inst;
+
+  inst.setOpcode(llvm::X86::CMP64rr);
+  inst.addOperand(llvm::MCOperand::createReg(reg1));
+  inst.addOperand(llvm::MCOperand::createReg(reg2));
+
+  return inst;
+}
+
+llvm::MCInst sub32rr(unsigned int dst, unsigned int src) {
+  llvm::MCInst inst;
+
+  inst.setOpcode(llvm::X86::SUB32rr);
+  inst.addOperand(llvm::MCOperand::createReg(dst));
+  inst.addOperand(llvm::MCOperand::createReg(dst));
+  inst.addOperand(llvm::MCOperand::createReg(src));
+
+  return inst;
+}
+
+llvm::MCInst sub64rr(unsigned int dst, unsigned int src) {
+  llvm::MCInst inst;
+
+  inst.setOpcode(llvm::X86::SUB64rr);
+  inst.addOperand(llvm::MCOperand::createReg(dst));
+  inst.addOperand(llvm::MCOperand::createReg(dst));
+  inst.addOperand(llvm::MCOperand::createReg(src));
+
+  return inst;
+}
+
+llvm::MCInst cmov32rr(unsigned int dst, unsigned int src, unsigned int cond) {
+  llvm::MCInst inst;
+
+  inst.setOpcode(llvm::X86::CMOV32rr);
+  inst.addOperand(llvm::MCOperand::createReg(dst));
+  inst.addOperand(llvm::MCOperand::createReg(dst));
+  inst.addOperand(llvm::MCOperand::createReg(src));
+  inst.addOperand(llvm::MCOperand::createImm(cond));
+
+  return inst;
+}
+
+llvm::MCInst cmov64rr(unsigned int dst, unsigned int src, unsigned int cond) {
+  llvm::MCInst inst;
+
+  inst.setOpcode(llvm::X86::CMOV64rr);
+  inst.addOperand(llvm::MCOperand::createReg(dst));
+  inst.addOperand(llvm::MCOperand::createReg(dst));
+  inst.addOperand(llvm::MCOperand::createReg(src));
+  inst.addOperand(llvm::MCOperand::createImm(cond));
+
+  return inst;
+}
+
+llvm::MCInst xor32ri(unsigned int reg, uint32_t imm) {
+  llvm::MCInst inst;
+
+  inst.setOpcode(llvm::X86::XOR32ri);
+  inst.addOperand(llvm::MCOperand::createReg(reg));
+  inst.addOperand(llvm::MCOperand::createReg(reg));
+  inst.addOperand(llvm::MCOperand::createImm(imm));
+
+  return inst;
+}
+
+llvm::MCInst xor64ri32(unsigned int reg, uint32_t imm) {
+  llvm::MCInst inst;
+
+  inst.setOpcode(llvm::X86::XOR64ri32);
+  inst.addOperand(llvm::MCOperand::createReg(reg));
+  inst.addOperand(llvm::MCOperand::createReg(reg));
+  inst.addOperand(llvm::MCOperand::createImm(imm));
+
+  return inst;
+}
+
+llvm::MCInst and32ri8(unsigned int reg, int8_t imm) {
+  llvm::MCInst inst;
+
+  inst.setOpcode(llvm::X86::AND32ri8);
+  inst.addOperand(llvm::MCOperand::createReg(reg));
+  inst.addOperand(llvm::MCOperand::createReg(reg));
+  inst.addOperand(llvm::MCOperand::createImm(imm));
+
+  return inst;
+}
+
+llvm::MCInst and64ri8(unsigned int reg, int8_t imm) {
+  llvm::MCInst inst;
+
+  inst.setOpcode(llvm::X86::AND64ri8);
+  inst.addOperand(llvm::MCOperand::createReg(reg));
+  inst.addOperand(llvm::MCOperand::createReg(reg));
+  inst.addOperand(llvm::MCOperand::createImm(imm));
+
+  return inst;
+}
+
+llvm::MCInst and32ri(unsigned int reg, uint32_t imm) {
+  llvm::MCInst inst;
+
+  inst.setOpcode(llvm::X86::AND32ri);
+  inst.addOperand(llvm::MCOperand::createReg(reg));
+  inst.addOperand(llvm::MCOperand::createReg(reg));
+  inst.addOperand(llvm::MCOperand::createImm(imm));
+
+  return inst;
+}
+
+llvm::MCInst and64ri32(unsigned int reg, uint32_t imm) {
+  llvm::MCInst inst;
+
+  inst.setOpcode(llvm::X86::AND64ri32);
+  inst.addOperand(llvm::MCOperand::createReg(reg));
+  inst.addOperand(llvm::MCOperand::createReg(reg));
+  inst.addOperand(llvm::MCOperand::createImm(imm));
+
+  return inst;
+}
+
+llvm::MCInst shr32ri(unsigned int reg, uint8_t imm) {
+  llvm::MCInst inst;
+
+  inst.setOpcode(llvm::X86::SHR32ri);
+  inst.addOperand(llvm::MCOperand::createReg(reg));
+  inst.addOperand(llvm::MCOperand::createReg(reg));
+  inst.addOperand(llvm::MCOperand::createImm(imm));
+
+  return inst;
+}
+
+llvm::MCInst shr64ri(unsigned int reg, uint8_t imm) {
+  llvm::MCInst inst;
+
+  inst.setOpcode(llvm::X86::SHR64ri);
+  inst.addOperand(llvm::MCOperand::createReg(reg));
+  inst.addOperand(llvm::MCOperand::createReg(reg));
+  inst.addOperand(llvm::MCOperand::createImm(imm));
+
+  return inst;
+}
+
+llvm::MCInst test32rr(unsigned int reg1, unsigned int reg2) {
+  llvm::MCInst inst;
+
+  inst.setOpcode(llvm::X86::TEST32rr);
+  inst.addOperand(llvm::MCOperand::createReg(reg1));
+  inst.addOperand(llvm::MCOperand::createReg(reg2));
+
+  return inst;
+}
+
+llvm::MCInst test64rr(unsigned int reg1, unsigned int reg2) {
+  llvm::MCInst inst;
+
+  inst.setOpcode(llvm::X86::TEST64rr);
+  inst.addOperand(llvm::MCOperand::createReg(reg1));
+  inst.addOperand(llvm::MCOperand::createReg(reg2));
+
+  return inst;
+}
+
+llvm::MCInst add8mi(unsigned int base, rword scale, unsigned int offset,
+                    rword displacement, unsigned int seg, uint8_t imm) {
+  llvm::MCInst inst;
+
+  inst.setOpcode(llvm::X86::ADD8mi);
+  inst.addOperand(llvm::MCOperand::createReg(base));
+  inst.addOperand(llvm::MCOperand::createImm(scale));
+  inst.addOperand(llvm::MCOperand::createReg(offset));
+  inst.addOperand(llvm::MCOperand::createImm(displacement));
+  inst.addOperand(llvm::MCOperand::createReg(seg));
+  inst.addOperand(llvm::MCOperand::createImm(imm));
+
+  return inst;
+}
+
 llvm::MCInst jmp32m(unsigned int base, rword offset) {
   llvm::MCInst inst;
 
@@ -250,6 +469,34 @@ llvm::MCInst jne(int32_t offset) {
   return inst;
 }
 
+llvm::MCInst jcc1(int32_t offset, unsigned int cond) {
+  llvm::MCInst inst;
+
+  inst.setOpcode(llvm::X86::JCC_1);
+  inst.addOperand(llvm::MCOperand::createImm(offset));
+  inst.addOperand(llvm::MCOperand::createImm(cond));
+
+  return inst;
+}
+
+llvm::MCInst jecxz(int32_t offset) {
+  llvm::MCInst inst;
+
+  inst.setOpcode(llvm::X86::JECXZ);
+  inst.addOperand(llvm::MCOperand::createImm(offset));
+
+  return inst;
+}
+
+llvm::MCInst jrcxz(int32_t offset) {
+  llvm::MCInst inst;
+
+  inst.setOpcode(llvm::X86::JRCXZ);
+  inst.addOperand(llvm::MCOperand::createImm(offset));
+
+  return inst;
+}
+
 llvm::MCInst jmp(rword offset) {
   llvm::MCInst inst;
 
@@ -259,6 +506,24 @@ llvm::MCInst jmp(rword offset) {
   return inst;
 }
 
+llvm::MCInst call32r(unsigned int reg) {
+  llvm::MCInst inst;
+
+  inst.setOpcode(llvm::X86::CALL32r);
+  inst.addOperand(llvm::MCOperand::createReg(reg));
+
+  return inst;
+}
+
+llvm::MCInst call64r(unsigned int reg) {
+  llvm::MCInst inst;
+
+  inst.setOpcode(llvm::X86::CALL64r);
+  inst.addOperand(llvm::MCOperand::createReg(reg));
+
+  return inst;
+}
+
 llvm::MCInst fxsave(unsigned int base, rword offset) {
   llvm::MCInst inst;
 
@@ -366,6 +631,66 @@ llvm::MCInst addr64i(unsigned int dst, unsigned int src, rword imm) {
   return lea64(dst, src, 1, 0, imm, 0);
 }
 
+llvm::MCInst add32mi8(unsigned int base, rword scale, unsigned int offset,
+                      rword displacement, unsigned int seg, int8_t imm) {
+  llvm::MCInst inst;
+
+  inst.setOpcode(llvm::X86::ADD32mi8);
+  inst.addOperand(llvm::MCOperand::createReg(base));
+  inst.addOperand(llvm::MCOperand::createImm(scale));
+  inst.addOperand(llvm::MCOperand::createReg(offset));
+  inst.addOperand(llvm::MCOperand::createImm(displacement));
+  inst.addOperand(llvm::MCOperand::createReg(seg));
+  inst.addOperand(llvm::MCOperand::createImm(imm));
+
+  return inst;
+}
+
+llvm::MCInst add64mi8(unsigned int base, rword scale, unsigned int offset,
+                      rword displacement, unsigned int seg, int8_t imm) {
+  llvm::MCInst inst;
+
+  inst.setOpcode(llvm::X86::ADD64mi8);
+  inst.addOperand(llvm::MCOperand::createReg(base));
+  inst.addOperand(llvm::MCOperand::createImm(scale));
+  inst.addOperand(llvm::MCOperand::createReg(offset));
+  inst.addOperand(llvm::MCOperand::createImm(displacement));
+  inst.addOperand(llvm::MCOperand::createReg(seg));
+  inst.addOperand(llvm::MCOperand::createImm(imm));
+
+  return inst;
+}
+
+llvm::MCInst adc32mi8(unsigned int base, rword scale, unsigned int offset,
+                      rword displacement, unsigned int seg, int8_t imm) {
+  llvm::MCInst inst;
+
+  inst.setOpcode(llvm::X86::ADC32mi8);
+  inst.addOperand(llvm::MCOperand::createReg(base));
+  inst.addOperand(llvm::MCOperand::createImm(scale));
+  inst.addOperand(llvm::MCOperand::createReg(offset));
+  inst.addOperand(llvm::MCOperand::createImm(displacement));
+  inst.addOperand(llvm::MCOperand::createReg(seg));
+  inst.addOperand(llvm::MCOperand::createImm(imm));
+
+  return inst;
+}
+
+llvm::MCInst cmp32mi(unsigned int base, rword scale, unsigned int offset,
+                     rword displacement, unsigned int seg, uint32_t imm) {
+  llvm::MCInst inst;
+
+  inst.setOpcode(llvm::X86::CMP32mi);
+  inst.addOperand(llvm::MCOperand::createReg(base));
+  inst.addOperand(llvm::MCOperand::createImm(scale));
+  inst.addOperand(llvm::MCOperand::createReg(offset));
+  inst.addOperand(llvm::MCOperand::createImm(displacement));
+  inst.addOperand(llvm::MCOperand::createReg(seg));
+  inst.addOperand(llvm::MCOperand::createImm(static_cast<int32_t>(imm)));
+
+  return inst;
+}
+
 llvm::MCInst lea32(unsigned int dst, unsigned int base, rword scale,
                    unsigned int offset, rword displacement, unsigned int seg) {
   llvm::MCInst inst;
@@ -480,6 +805,14 @@ llvm::MCInst nop() {
   return inst;
 }
 
+llvm::MCInst cld() {
+  llvm::MCInst inst;
+
+  inst.setOpcode(llvm::X86::CLD);
+
+  return inst;
+}
+
 llvm::MCInst movrr(unsigned int dst, unsigned int src) {
   if constexpr (is_x86_64)
     return mov64rr(dst, src);
@@ -510,6 +843,14 @@ llvm::MCInst movrm(unsigned int dst, unsigned int base, rword scale,
     return mov32rm(dst, base, scale, offset, disp, seg);
 }
 
+llvm::MCInst movmi(unsigned int base, rword scale, unsigned int offset,
+                   rword disp, unsigned int seg, rword imm) {
+  if constexpr (is_x86_64)
+    return mov64mi32(base, scale, offset, disp, seg, imm);
+  else
+    return mov32mi(base, scale, offset, disp, seg, imm);
+}
+
 llvm::MCInst movzxrr8(unsigned int dst, unsigned int src) {
   if constexpr (is_x86_64)
     return movzx64rr8(dst, src);
@@ -524,6 +865,62 @@ llvm::MCInst testri(unsigned int base, uint32_t imm) {
     return test32ri(base, imm);
 }
 
+llvm::MCInst cmprr(unsigned int reg1, unsigned int reg2) {
+  if constexpr (is_x86_64)
+    return cmp64rr(reg1, reg2);
+  else
+    return cmp32rr(reg1, reg2);
+}
+
+llvm::MCInst subrr(unsigned int dst, unsigned int src) {
+  if constexpr (is_x86_64)
+    return sub64rr(dst, src);
+  else
+    return sub32rr(dst, src);
+}
+
+llvm::MCInst cmovrr(unsigned int dst, unsigned int src, unsigned int cond) {
+  if constexpr (is_x86_64)
+    return cmov64rr(dst, src, cond);
+  else
+    return cmov32rr(dst, src, cond);
+}
+
+llvm::MCInst xorri(unsigned int reg, uint32_t imm) {
+  if constexpr (is_x86_64)
+    return xor64ri32(reg, imm);
+  else
+    return xor32ri(reg, imm);
+}
+
+llvm::MCInst andri8(unsigned int reg, int8_t imm) {
+  if constexpr (is_x86_64)
+    return and64ri8(reg, imm);
+  else
+    return and32ri8(reg, imm);
+}
+
+llvm::MCInst andri(unsigned int reg, uint32_t imm) {
+  if constexpr (is_x86_64)
+    return and64ri32(reg, imm);
+  else
+    return and32ri(reg, imm);
+}
+
+llvm::MCInst shrri(unsigned int reg, uint8_t imm) {
+  if constexpr (is_x86_64)
+    return shr64ri(reg, imm);
+  else
+    return shr32ri(reg, imm);
+}
+
+llvm::MCInst testrr(unsigned int reg1, unsigned int reg2) {
+  if constexpr (is_x86_64)
+    return test64rr(reg1, reg2);
+  else
+    return test32rr(reg1, reg2);
+}
+
 llvm::MCInst pushr(unsigned int reg) {
   if constexpr (is_x86_64)
     return push64r(reg);
@@ -574,6 +971,13 @@ llvm::MCInst jmpm(unsigned int base, rword offset) {
     return jmp32m(base, offset);
 }
 
+llvm::MCInst callr(unsigned int reg) {
+  if constexpr (is_x86_64)
+    return call64r(reg);
+  else
+    return call32r(reg);
+}
+
 RelocatableInst::UniquePtr Mov(Reg dst, Reg src) {
   return MovReg::unique(dst, src);
 }
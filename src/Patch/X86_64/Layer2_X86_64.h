@@ -39,6 +39,9 @@ llvm::MCInst mov32ri(unsigned int reg, rword imm);
 llvm::MCInst mov32mr(unsigned int base, rword scale, unsigned int offset,
                      rword displacement, unsigned int seg, unsigned int src);
 
+llvm::MCInst mov32mi(unsigned int base, rword scale, unsigned int offset,
+                     rword displacement, unsigned int seg, rword imm);
+
 llvm::MCInst mov32rm8(unsigned int dst, unsigned int base, rword scale,
                       unsigned int offset, rword displacement,
                       unsigned int seg);
@@ -59,6 +62,9 @@ llvm::MCInst mov64ri(unsigned int reg, rword imm);
 llvm::MCInst mov64mr(unsigned int base, rword scale, unsigned int offset,
                      rword displacement, unsigned int seg, unsigned int src);
 
+llvm::MCInst mov64mi32(unsigned int base, rword scale, unsigned int offset,
+                       rword displacement, unsigned int seg, rword imm);
+
 llvm::MCInst mov64rm(unsigned int dst, unsigned int base, rword scale,
                      unsigned int offset, rword displacement, unsigned int seg);
 
@@ -68,16 +74,61 @@ llvm::MCInst test32ri(unsigned int base, uint32_t imm);
 
 llvm::MCInst test64ri32(unsigned int base, uint32_t imm);
 
+llvm::MCInst cmp32rr(unsigned int reg1, unsigned int reg2);
+
+llvm::MCInst cmp64rr(unsigned int reg1, unsigned int reg2);
+
+llvm::MCInst sub32rr(unsigned int dst, unsigned int src);
+
+llvm::MCInst sub64rr(unsigned int dst, unsigned int src);
+
+llvm::MCInst cmov32rr(unsigned int dst, unsigned int src, unsigned int cond);
+
+llvm::MCInst cmov64rr(unsigned int dst, unsigned int src, unsigned int cond);
+
+llvm::MCInst xor32ri(unsigned int reg, uint32_t imm);
+
+llvm::MCInst xor64ri32(unsigned int reg, uint32_t imm);
+
+llvm::MCInst and32ri8(unsigned int reg, int8_t imm);
+
+llvm::MCInst and64ri8(unsigned int reg, int8_t imm);
+
+llvm::MCInst and32ri(unsigned int reg, uint32_t imm);
+
+llvm::MCInst and64ri32(unsigned int reg, uint32_t imm);
+
+llvm::MCInst shr32ri(unsigned int reg, uint8_t imm);
+
+llvm::MCInst shr64ri(unsigned int reg, uint8_t imm);
+
+llvm::MCInst test32rr(unsigned int reg1, unsigned int reg2);
+
+llvm::MCInst test64rr(unsigned int reg1, unsigned int reg2);
+
+llvm::MCInst add8mi(unsigned int base, rword scale, unsigned int offset,
+                    rword displacement, unsigned int seg, uint8_t imm);
+
 llvm::MCInst je(int32_t offset);
 
 llvm::MCInst jne(int32_t offset);
 
+llvm::MCInst jcc1(int32_t offset, unsigned int cond);
+
+llvm::MCInst jecxz(int32_t offset);
+
+llvm::MCInst jrcxz(int32_t offset);
+
 llvm::MCInst jmp32m(unsigned int base, rword offset);
 
 llvm::MCInst jmp64m(unsigned int base, rword offset);
 
 llvm::MCInst jmp(rword offset);
 
+llvm::MCInst call32r(unsigned int reg);
+
+llvm::MCInst call64r(unsigned int reg);
+
 llvm::MCInst fxsave(unsigned int base, rword offset);
 
 llvm::MCInst fxrstor(unsigned int base, rword offset);
@@ -100,6 +151,18 @@ llvm::MCInst addr32i(unsigned int dst, unsigned int src, rword imm);
 
 llvm::MCInst addr64i(unsigned int dst, unsigned int src, rword imm);
 
+llvm::MCInst add32mi8(unsigned int base, rword scale, unsigned int offset,
+                      rword displacement, unsigned int seg, int8_t imm);
+
+llvm::MCInst add64mi8(unsigned int base, rword scale, unsigned int offset,
+                      rword displacement, unsigned int seg, int8_t imm);
+
+llvm::MCInst adc32mi8(unsigned int base, rword scale, unsigned int offset,
+                      rword displacement, unsigned int seg, int8_t imm);
+
+llvm::MCInst cmp32mi(unsigned int base, rword scale, unsigned int offset,
+                     rword displacement, unsigned int seg, uint32_t imm);
+
 llvm::MCInst lea32(unsigned int dst, unsigned int base, rword scale,
                    unsigned int offset, rword displacement, unsigned int seg);
 
@@ -116,16 +179,18 @@ llvm::MCInst popf64();
 
 llvm::MCInst ret();
 
-llvm::MCInst rdfsbase(unsigned int reg);
+llvm::MCInst rdfsbase64(unsigned int reg);
 
-llvm::MCInst rdgsbase(unsigned int reg);
+llvm::MCInst rdgsbase64(unsigned int reg);
 
-llvm::MCInst wrfsbase(unsigned int reg);
+llvm::MCInst wrfsbase64(unsigned int reg);
 
-llvm::MCInst wrgsbase(unsigned int reg);
+llvm::MCInst wrgsbase64(unsigned int reg);
 
 llvm::MCInst nop();
 
+llvm::MCInst cld();
+
 // low level layer 2 architecture abtraction
 
 llvm::MCInst movrr(unsigned int dst, unsigned int src);
@@ -138,10 +203,29 @@ llvm::MCInst movmr(unsigned int base, rword scale, unsigned int offset,
 llvm::MCInst movrm(unsigned int dst, unsigned int base, rword scale,
                    unsigned int offset, rword disp, unsigned int seg);
 
+llvm::MCInst movmi(unsigned int base, rword scale, unsigned int offset,
+                   rword disp, unsigned int seg, rword imm);
+
 llvm::MCInst movzxrr8(unsigned int dst, unsigned int src);
 
 llvm::MCInst testri(unsigned int base, uint32_t imm);
 
+llvm::MCInst cmprr(unsigned int reg1, unsigned int reg2);
+
+llvm::MCInst subrr(unsigned int dst, unsigned int src);
+
+llvm::MCInst cmovrr(unsigned int dst, unsigned int src, unsigned int cond);
+
+llvm::MCInst xorri(unsigned int reg, uint32_t imm);
+
+llvm::MCInst andri8(unsigned int reg, int8_t imm);
+
+llvm::MCInst andri(unsigned int reg, uint32_t imm);
+
+llvm::MCInst shrri(unsigned int reg, uint8_t imm);
+
+llvm::MCInst testrr(unsigned int reg1, unsigned int reg2);
+
 llvm::MCInst pushr(unsigned int reg);
 
 llvm::MCInst popr(unsigned int reg);
@@ -157,6 +241,8 @@ llvm::MCInst pushf();
 
 llvm::MCInst jmpm(unsigned int base, rword offset);
 
+llvm::MCInst callr(unsigned int reg);
+
 // high level layer 2
 
 std::unique_ptr<RelocatableInst> Mov(Reg dst, Reg src);
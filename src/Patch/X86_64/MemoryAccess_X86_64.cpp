@@ -16,9 +16,11 @@
  * limitations under the License.
  */
 #include <algorithm>
+#include <limits>
 #include <memory>
 #include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 #include <utility>
 #include <vector>
 
@@ -26,6 +28,8 @@
 #include "llvm/MC/MCInst.h"
 #include "llvm/MC/MCInstrInfo.h"
 
+#include "MCTargetDesc/X86BaseInfo.h"
+
 #include "Engine/LLVMCPU.h"
 #include "ExecBlock/ExecBlock.h"
 #include "Patch/InstInfo.h"
@@ -36,6 +40,7 @@
 #include "Patch/PatchCondition.h"
 #include "Patch/PatchGenerator.h"
 #include "Patch/PatchUtils.h"
+#include "Patch/Register.h"
 #include "Patch/Types.h"
 #include "Patch/X86_64/InstInfo_X86_64.h"
 #include "Patch/X86_64/PatchGenerator_X86_64.h"
@@ -43,6 +48,7 @@
 
 #include "QBDI/Bitmask.h"
 #include "QBDI/Callback.h"
+#include "QBDI/Options.h"
 #include "QBDI/State.h"
 
 namespace llvm {
@@ -65,19 +71,63 @@ enum MemoryTag : uint16_t {
   MEM_READ_0_END_ADDRESS_TAG = MEMORY_TAG_BEGIN + 7,
   MEM_READ_1_END_ADDRESS_TAG = MEMORY_TAG_BEGIN + 8,
   MEM_WRITE_END_ADDRESS_TAG = MEMORY_TAG_BEGIN + 9,
+
+  MEM_TRACE_WRITE_ADDRESS_TAG = MEMORY_TAG_BEGIN + 10,
+  PAGE_HISTOGRAM_WRITE_ADDRESS_TAG = MEMORY_TAG_BEGIN + 11,
+
+  MEM_READ_WIDE_VALUE_TAG = MEMORY_TAG_BEGIN + 12,
+  MEM_WRITE_WIDE_VALUE_TAG = MEMORY_TAG_BEGIN + 13,
 };
 
-void analyseMemoryAccessAddrValue(const ExecBlock &curExecBlock,
-                                  llvm::ArrayRef<ShadowInfo> &shadows,
-                                  std::vector<MemoryAccess> &dest) {
+// Search the shadow of the second part of an access. For most instruction,
+// it's the next shadow.
+static bool findShadowTag(const ExecBlock &curExecBlock,
+                          llvm::ArrayRef<ShadowInfo> shadows,
+                          uint16_t expectTag, uint16_t &shadowID) {
+  size_t index = 0;
+  do {
+    index += 1;
+    if (index >= shadows.size()) {
+      QBDI_ERROR("Not found shadow tag {:x} for instruction {:x}", expectTag,
+                 curExecBlock.getInstAddress(shadows[0].instID));
+      return false;
+    }
+    QBDI_REQUIRE_ACTION(shadows[0].instID == shadows[index].instID,
+                        return false);
+  } while (shadows[index].tag != expectTag);
+
+  shadowID = shadows[index].shadowID;
+  return true;
+}
+
+// Check if the instruction of the first shadow has a shadow with a tag
+static bool hasShadowTag(llvm::ArrayRef<ShadowInfo> shadows,
+                         uint16_t expectTag) {
+  return std::any_of(shadows.begin() + 1, shadows.end(),
+                     [&](const ShadowInfo &s) {
+                       return s.instID == shadows[0].instID and
+                              s.tag == expectTag;
+                     });
+}
+
+static void compileMemoryAccessAddrValue(const ExecBlock &curExecBlock,
+                                         llvm::ArrayRef<ShadowInfo> shadows,
+                                         bool withValue,
+                                         std::vector<MemAccessInfo> &dest) {
   if (shadows.size() < 1) {
     return;
   }
 
-  auto access = MemoryAccess();
+  MemAccessInfo access;
+  access.instID = shadows[0].instID;
+  access.shadowID = shadows[0].shadowID;
+  access.valueShadowID = shadows[0].shadowID;
+  access.offset = 0;
   access.flags = MEMORY_NO_FLAGS;
+  access.range = false;
 
   uint16_t expectValueTag;
+  uint16_t expectWideTag;
   const llvm::MCInst &inst = curExecBlock.getOriginalMCInst(shadows[0].instID);
   switch (shadows[0].tag) {
     default:
@@ -86,6 +136,7 @@ void analyseMemoryAccessAddrValue(const ExecBlock &curExecBlock,
       access.type = MEMORY_READ;
       access.size = getReadSize(inst);
       expectValueTag = MEM_READ_VALUE_TAG;
+      expectWideTag = MEM_READ_WIDE_VALUE_TAG;
       if (isMinSizeRead(inst)) {
         access.flags |= MEMORY_MINIMUM_SIZE;
       }
@@ -94,123 +145,86 @@ void analyseMemoryAccessAddrValue(const ExecBlock &curExecBlock,
       access.type = MEMORY_WRITE;
       access.size = getWriteSize(inst);
       expectValueTag = MEM_WRITE_VALUE_TAG;
+      expectWideTag = MEM_WRITE_WIDE_VALUE_TAG;
       if (isMinSizeRead(inst)) {
         access.flags |= MEMORY_MINIMUM_SIZE;
       }
       break;
   }
 
-  access.accessAddress = curExecBlock.getShadow(shadows[0].shadowID);
-  access.instAddress = curExecBlock.getInstAddress(shadows[0].instID);
+  // the value larger than a rword is in the shadows of the wide tag, the
+  // first one is given with the access
+  if (access.size > sizeof(rword) and withValue and
+      hasShadowTag(shadows, expectWideTag)) {
+    access.flags |= MEMORY_WIDE_VALUE;
+    if (findShadowTag(curExecBlock, shadows, expectWideTag,
+                      access.valueShadowID)) {
+      dest.push_back(access);
+    }
+    return;
+  }
 
-  if (access.size > sizeof(rword)) {
+  // the value isn't captured by the MEMORY_ADDRESS_ONLY instrumentation
+  if (access.size > sizeof(rword) or not withValue or
+      not hasShadowTag(shadows, expectValueTag)) {
     access.flags |= MEMORY_UNKNOWN_VALUE;
-    access.value = 0;
-    dest.push_back(std::move(access));
+    dest.push_back(access);
     return;
   }
 
-  size_t index = 0;
-  // search the index of MEM_x_VALUE_TAG. For most instruction, it's the next
-  // shadow.
-  do {
-    index += 1;
-    if (index >= shadows.size()) {
-      QBDI_ERROR("Not found shadow tag {:x} for instruction {:x}",
-                 expectValueTag, access.instAddress);
-      return;
-    }
-    QBDI_REQUIRE_ACTION(shadows[0].instID == shadows[index].instID, return );
-  } while (shadows[index].tag != expectValueTag);
-
-  access.value = curExecBlock.getShadow(shadows[index].shadowID);
-
-  dest.push_back(std::move(access));
+  if (findShadowTag(curExecBlock, shadows, expectValueTag,
+                    access.valueShadowID)) {
+    dest.push_back(access);
+  }
 }
 
-void analyseMemoryAccessAddrRange(const ExecBlock &curExecBlock,
-                                  llvm::ArrayRef<ShadowInfo> &shadows,
-                                  bool postInst,
-                                  std::vector<MemoryAccess> &dest) {
+static void compileMemoryAccessAddrRange(const ExecBlock &curExecBlock,
+                                         llvm::ArrayRef<ShadowInfo> shadows,
+                                         std::vector<MemAccessInfo> &dest) {
   if (shadows.size() < 1) {
     return;
   }
-  auto access = MemoryAccess();
-  access.flags = MEMORY_NO_FLAGS;
+
+  MemAccessInfo access;
+  access.instID = shadows[0].instID;
+  access.shadowID = shadows[0].shadowID;
+  access.offset = 0;
+  access.flags = MEMORY_UNKNOWN_VALUE;
+  access.range = true;
 
   uint16_t expectValueTag;
-  unsigned accessAtomicSize;
+  const llvm::MCInst &inst = curExecBlock.getOriginalMCInst(shadows[0].instID);
   switch (shadows[0].tag) {
     default:
       return;
     case MEM_READ_0_BEGIN_ADDRESS_TAG:
       access.type = MEMORY_READ;
       expectValueTag = MEM_READ_0_END_ADDRESS_TAG;
-      accessAtomicSize =
-          getReadSize(curExecBlock.getOriginalMCInst(shadows[0].instID));
+      access.size = getReadSize(inst);
       break;
     case MEM_READ_1_BEGIN_ADDRESS_TAG:
       access.type = MEMORY_READ;
       expectValueTag = MEM_READ_1_END_ADDRESS_TAG;
-      accessAtomicSize =
-          getReadSize(curExecBlock.getOriginalMCInst(shadows[0].instID));
+      access.size = getReadSize(inst);
       break;
     case MEM_WRITE_BEGIN_ADDRESS_TAG:
       access.type = MEMORY_WRITE;
       expectValueTag = MEM_WRITE_END_ADDRESS_TAG;
-      accessAtomicSize =
-          getWriteSize(curExecBlock.getOriginalMCInst(shadows[0].instID));
+      access.size = getWriteSize(inst);
       break;
   }
 
-  access.instAddress = curExecBlock.getInstAddress(shadows[0].instID);
-  access.flags |= MEMORY_UNKNOWN_VALUE;
-  access.value = 0;
-
-  if (!postInst) {
-    access.accessAddress = curExecBlock.getShadow(shadows[0].shadowID);
-    access.flags |= MEMORY_UNKNOWN_SIZE;
-    access.size = 0;
-    dest.push_back(std::move(access));
-    return;
+  if (findShadowTag(curExecBlock, shadows, expectValueTag,
+                    access.valueShadowID)) {
+    dest.push_back(access);
   }
-
-  size_t index = 0;
-  // search the index of MEM_x_VALUE_TAG. For most instruction, it's the next
-  // shadow.
-  do {
-    index += 1;
-    if (index >= shadows.size()) {
-      QBDI_ERROR("Not found shadow tag {:x} for instruction {:x}",
-                 expectValueTag, access.instAddress);
-      return;
-    }
-    QBDI_REQUIRE_ACTION(shadows[0].instID == shadows[index].instID, return );
-  } while (shadows[index].tag != expectValueTag);
-
-  rword beginAddress = curExecBlock.getShadow(shadows[0].shadowID);
-  rword endAddress = curExecBlock.getShadow(shadows[index].shadowID);
-
-  if (endAddress >= beginAddress) {
-    access.accessAddress = beginAddress;
-    access.size = endAddress - beginAddress;
-  } else {
-    // the endAddress is lesser than the begin address, this may be the case
-    // in X86 with REP prefix and DF=1
-    // In this case, the memory have been access between [endAddress +
-    // accessSize, beginAddress + accessAtomicSize)
-    access.accessAddress = endAddress + accessAtomicSize;
-    access.size = beginAddress - endAddress;
-  }
-
-  dest.push_back(std::move(access));
 }
 
-void analyseMemoryAccess(const ExecBlock &curExecBlock, uint16_t instID,
-                         bool afterInst, std::vector<MemoryAccess> &dest) {
+static void compileInstMemoryAccess(const ExecBlock &curExecBlock,
+                                    uint16_t instID, bool withValue,
+                                    std::vector<MemAccessInfo> &dest) {
 
   llvm::ArrayRef<ShadowInfo> shadows = curExecBlock.getShadowByInst(instID);
-  QBDI_DEBUG("Got {} shadows for Instruction {:x}", shadows.size(), instID);
 
   while (!shadows.empty()) {
     QBDI_REQUIRE(shadows[0].instID == instID);
@@ -219,27 +233,346 @@ void analyseMemoryAccess(const ExecBlock &curExecBlock, uint16_t instID,
       default:
         break;
       case MEM_READ_ADDRESS_TAG:
-        analyseMemoryAccessAddrValue(curExecBlock, shadows, dest);
-        break;
       case MEM_WRITE_ADDRESS_TAG:
-        if (afterInst) {
-          analyseMemoryAccessAddrValue(curExecBlock, shadows, dest);
-        }
+        compileMemoryAccessAddrValue(curExecBlock, shadows, withValue, dest);
         break;
       case MEM_READ_0_BEGIN_ADDRESS_TAG:
       case MEM_READ_1_BEGIN_ADDRESS_TAG:
-        analyseMemoryAccessAddrRange(curExecBlock, shadows, afterInst, dest);
-        break;
       case MEM_WRITE_BEGIN_ADDRESS_TAG:
-        if (afterInst) {
-          analyseMemoryAccessAddrRange(curExecBlock, shadows, afterInst, dest);
-        }
+        compileMemoryAccessAddrRange(curExecBlock, shadows, dest);
         break;
     }
     shadows = shadows.drop_front();
   }
 }
 
+static void decodeMemoryAccess(const ExecBlock &curExecBlock,
+                               const MemAccessInfo &info, bool afterInst,
+                               std::vector<MemoryAccess> &dest) {
+  // the writes are only known after the instruction
+  if (info.type == MEMORY_WRITE and not afterInst) {
+    return;
+  }
+
+  MemoryAccess access;
+  access.instAddress = curExecBlock.getInstAddress(info.instID);
+  access.type = info.type;
+  access.flags = info.flags;
+  access.value = 0;
+
+  if (not info.range) {
+    access.accessAddress = curExecBlock.getShadow(info.shadowID) + info.offset;
+    access.size = info.size;
+    if ((info.flags & MEMORY_UNKNOWN_VALUE) == 0) {
+      access.value = curExecBlock.getShadow(info.valueShadowID);
+    }
+  } else if (not afterInst) {
+    access.accessAddress = curExecBlock.getShadow(info.shadowID);
+    access.flags |= MEMORY_UNKNOWN_SIZE;
+    access.size = 0;
+  } else {
+    rword beginAddress = curExecBlock.getShadow(info.shadowID);
+    rword endAddress = curExecBlock.getShadow(info.valueShadowID);
+
+    rword length;
+    // the value of a bulk access is the length of its range
+    access.flags = static_cast<MemoryAccessFlags>(
+        (access.flags & ~MEMORY_UNKNOWN_VALUE) | MEMORY_BULK);
+
+    if (endAddress >= beginAddress) {
+      access.accessAddress = beginAddress;
+      length = endAddress - beginAddress;
+    } else {
+      // the endAddress is lesser than the begin address, this may be the case
+      // in X86 with REP prefix and DF=1
+      // In this case, the memory have been access between [endAddress +
+      // accessSize, beginAddress + accessAtomicSize)
+      access.accessAddress = endAddress + info.size;
+      length = beginAddress - endAddress;
+      access.flags |= MEMORY_BULK_BACKWARD;
+    }
+    // The bulk access keeps its exact length in the value, the size is only
+    // a minimum when the range doesn't fit in it.
+    access.value = length;
+    if (length > std::numeric_limits<uint16_t>::max()) {
+      access.size = std::numeric_limits<uint16_t>::max();
+      access.flags |= MEMORY_MINIMUM_SIZE;
+    } else {
+      access.size = length;
+    }
+  }
+
+  dest.push_back(std::move(access));
+}
+
+void analyseMemoryAccess(const ExecBlock &curExecBlock, uint16_t instID,
+                         bool afterInst, std::vector<MemoryAccess> &dest) {
+
+  // the accesses have been decoded with the sequence of the instruction
+  llvm::ArrayRef<MemAccessInfo> accesses =
+      curExecBlock.getMemAccessBySeq(curExecBlock.getSeqID(instID));
+  auto it = std::lower_bound(
+      accesses.begin(), accesses.end(), instID,
+      [](const MemAccessInfo &info, uint16_t id) { return info.instID < id; });
+  QBDI_DEBUG("Got {} shadows for Instruction {:x}",
+             curExecBlock.getShadowByInst(instID).size(), instID);
+
+  for (; it != accesses.end() and it->instID == instID; ++it) {
+    decodeMemoryAccess(curExecBlock, *it, afterInst, dest);
+  }
+}
+
+void analyseSeqMemoryAccess(const ExecBlock &curExecBlock,
+                            uint16_t startInstID, uint16_t stopInstID,
+                            MemoryAccessType type,
+                            std::vector<MemoryAccess> &dest) {
+  // the instructions before the entry of the sequence haven't been executed
+  llvm::ArrayRef<MemAccessInfo> accesses =
+      curExecBlock.getMemAccessBySeq(curExecBlock.getSeqID(startInstID));
+  auto it = std::lower_bound(accesses.begin(), accesses.end(), startInstID,
+                             [](const MemAccessInfo &info, uint16_t id) {
+                               return info.instID < id;
+                             });
+  for (; it != accesses.end() and it->instID < stopInstID; ++it) {
+    if (it->type & type) {
+      decodeMemoryAccess(curExecBlock, *it, true, dest);
+    }
+  }
+}
+
+bool getMemoryAccessValue(const ExecBlock &curExecBlock,
+                          const MemoryAccess &access, uint8_t *dest) {
+  llvm::ArrayRef<MemAccessInfo> accesses =
+      curExecBlock.getMemAccessBySeq(curExecBlock.getCurrentSeqID());
+  for (const MemAccessInfo &info : accesses) {
+    if ((info.flags & MEMORY_WIDE_VALUE) == 0 or info.type != access.type or
+        info.size != access.size or
+        curExecBlock.getInstAddress(info.instID) != access.instAddress or
+        curExecBlock.getShadow(info.shadowID) + info.offset !=
+            access.accessAddress) {
+      continue;
+    }
+    // the parts of the value are in the order of their shadows
+    uint16_t tag = (info.type == MEMORY_READ) ? MEM_READ_WIDE_VALUE_TAG
+                                              : MEM_WRITE_WIDE_VALUE_TAG;
+    size_t copied = 0;
+    for (const ShadowInfo &shadow : curExecBlock.getShadowByInst(info.instID)) {
+      if (shadow.tag == tag and copied + sizeof(rword) <= info.size) {
+        rword value = curExecBlock.getShadow(shadow.shadowID);
+        memcpy(dest + copied, &value, sizeof(rword));
+        copied += sizeof(rword);
+      }
+    }
+    return copied == info.size;
+  }
+  return false;
+}
+
+// Address of the explicit memory operand of an instruction:
+// base + scale * index + disp
+struct MemOperandExpr {
+  unsigned base;
+  unsigned index;
+  int64_t scale;
+  int64_t disp;
+};
+
+static bool getMemOperandExpr(const llvm::MCInst &inst,
+                              const LLVMCPU &llvmcpu, MemOperandExpr &expr) {
+  const llvm::MCInstrDesc &desc = llvmcpu.getMCII().get(inst.getOpcode());
+  if (isStackRead(inst) or isStackWrite(inst) or
+      implicitDSIAccess(inst, desc)) {
+    return false;
+  }
+  int memIndex = llvm::X86II::getMemoryOperandNo(desc.TSFlags);
+  if (memIndex < 0) {
+    return false;
+  }
+  unsigned realMemIndex = memIndex + llvm::X86II::getOperandBias(desc);
+  if (inst.getNumOperands() <= realMemIndex + 4 or
+      not inst.getOperand(realMemIndex + 0).isReg() or
+      not inst.getOperand(realMemIndex + 1).isImm() or
+      not inst.getOperand(realMemIndex + 2).isReg() or
+      not inst.getOperand(realMemIndex + 3).isImm() or
+      not inst.getOperand(realMemIndex + 4).isReg()) {
+    return false;
+  }
+  // the PC changes with each instruction and the base of the segments isn't
+  // known
+  if (inst.getOperand(realMemIndex + 0).getReg() == Reg(REG_PC) or
+      inst.getOperand(realMemIndex + 4).getReg() != 0) {
+    return false;
+  }
+  expr.base = getUpperRegister(inst.getOperand(realMemIndex + 0).getReg());
+  expr.scale = inst.getOperand(realMemIndex + 1).getImm();
+  expr.index = getUpperRegister(inst.getOperand(realMemIndex + 2).getReg());
+  expr.disp = inst.getOperand(realMemIndex + 3).getImm();
+  return true;
+}
+
+// Accesses merged in an entry of the table, relative to the address of the
+// first one
+struct CoalescedAccess {
+  MemOperandExpr expr;
+  MemoryAccessType type;
+  size_t pos;
+  int64_t begin;
+  int64_t end;
+};
+
+// Merge the accesses of the same type whose addresses are computed from the
+// same registers, if their ranges overlap or are adjacent. The registers
+// mustn't be modified between the instructions.
+static void coalesceMemoryAccess(const ExecBlock &curExecBlock,
+                                 const LLVMCPU &llvmcpu, uint16_t startInstID,
+                                 uint16_t endInstID, size_t first,
+                                 std::vector<MemAccessInfo> &dest) {
+  std::vector<CoalescedAccess> merged;
+  size_t out = first;
+  size_t i = first;
+
+  for (uint16_t instID = startInstID; instID <= endInstID; instID++) {
+    const llvm::MCInst &inst = curExecBlock.getOriginalMCInst(instID);
+    MemOperandExpr expr;
+    bool known = getMemOperandExpr(inst, llvmcpu, expr);
+
+    for (; i < dest.size() and dest[i].instID == instID; i++) {
+      MemAccessInfo access = dest[i];
+      if (not known or access.range or
+          (access.flags & (MEMORY_UNKNOWN_SIZE | MEMORY_MINIMUM_SIZE))) {
+        dest[out++] = access;
+        continue;
+      }
+      int64_t begin = expr.disp;
+      int64_t end = expr.disp + access.size;
+      auto it = std::find_if(
+          merged.begin(), merged.end(), [&](const CoalescedAccess &m) {
+            return m.type == access.type and m.expr.base == expr.base and
+                   m.expr.index == expr.index and
+                   m.expr.scale == expr.scale and begin <= m.end and
+                   m.begin <= end and
+                   std::max(end, m.end) - std::min(begin, m.begin) <=
+                       std::numeric_limits<uint16_t>::max();
+          });
+      if (it == merged.end()) {
+        merged.push_back({expr, access.type, out, begin, end});
+        dest[out++] = access;
+      } else {
+        it->begin = std::min(begin, it->begin);
+        it->end = std::max(end, it->end);
+        MemAccessInfo &target = dest[it->pos];
+        target.offset = static_cast<int32_t>(it->begin - it->expr.disp);
+        target.size = static_cast<uint16_t>(it->end - it->begin);
+      }
+    }
+
+    // the next instructions can't use the registers set by this one
+    if (not merged.empty()) {
+      RegisterUsageMap usage = getUsedGPR(inst, llvmcpu);
+      merged.erase(
+          std::remove_if(merged.begin(), merged.end(),
+                         [&usage](const CoalescedAccess &m) {
+                           for (unsigned reg : {m.expr.base, m.expr.index}) {
+                             auto u = usage.find(reg);
+                             if (reg != 0 and u != usage.end() and
+                                 (u->second & RegisterSet)) {
+                               return true;
+                             }
+                           }
+                           return false;
+                         }),
+          merged.end());
+    }
+  }
+  dest.resize(out);
+}
+
+void compileMemoryAccess(const ExecBlock &curExecBlock, const LLVMCPU &llvmcpu,
+                         uint16_t startInstID, uint16_t endInstID,
+                         std::vector<MemAccessInfo> &dest) {
+  bool coalesce =
+      llvmcpu.getOptions() & Options::OPT_ENABLE_MEMACCESS_COALESCING;
+  size_t first = dest.size();
+  for (uint16_t instID = startInstID; instID <= endInstID; instID++) {
+    compileInstMemoryAccess(curExecBlock, instID, not coalesce, dest);
+  }
+  if (coalesce) {
+    coalesceMemoryAccess(curExecBlock, llvmcpu, startInstID, endInstID, first,
+                         dest);
+  }
+}
+
+// Size of an access whose value is copied in several shadows with
+// OPT_ENABLE_WIDE_MEMACCESS_VALUE, 0 if the value isn't captured this way.
+// Only the accesses of 16, 32 and 64 bytes of an explicit memory operand are
+// captured.
+static unsigned getWideValueSize(const llvm::MCInst &inst,
+                                 const LLVMCPU &llvmcpu, unsigned size) {
+  if ((llvmcpu.getOptions() & Options::OPT_ENABLE_WIDE_MEMACCESS_VALUE) == 0 or
+      (llvmcpu.getOptions() & Options::OPT_ENABLE_MEMACCESS_COALESCING) or
+      (size != 16 and size != 32 and size != 64)) {
+    return 0;
+  }
+  const llvm::MCInstrDesc &desc = llvmcpu.getMCII().get(inst.getOpcode());
+  if (hasREPPrefix(inst) or isDoubleRead(inst) or isMinSizeRead(inst) or
+      isStackRead(inst) or isStackWrite(inst) or
+      implicitDSIAccess(inst, desc) or
+      llvm::X86II::getMemoryOperandNo(desc.TSFlags) < 0) {
+    return 0;
+  }
+  return size;
+}
+
+// Copy the value of the access whose address is in Temp(0) in the shadows of
+// the tag, a register at a time
+static PatchGenerator::UniquePtrVec
+appendWideValue(PatchGenerator::UniquePtrVec gen, unsigned size,
+                uint16_t tag) {
+  for (rword offset = 0; offset < size; offset += sizeof(rword)) {
+    gen.push_back(GetWideValue::unique(Temp(1), Temp(0), offset));
+    gen.push_back(WriteTemp::unique(Temp(1), Shadow(tag)));
+  }
+  return gen;
+}
+
+static unsigned getWideValueIndex(unsigned size) {
+  return (size == 16) ? 0 : ((size == 32) ? 1 : 2);
+}
+
+static const PatchGenerator::UniquePtrVec &
+generateWideReadPatch(unsigned size) {
+  static const auto gen = [](unsigned size) {
+    return appendWideValue(
+        conv_unique<PatchGenerator>(
+            GetReadAddress::unique(Temp(0)),
+            WriteTemp::unique(Temp(0), Shadow(MEM_READ_ADDRESS_TAG))),
+        size, MEM_READ_WIDE_VALUE_TAG);
+  };
+  static const PatchGenerator::UniquePtrVec r[] = {gen(16), gen(32), gen(64)};
+  return r[getWideValueIndex(size)];
+}
+
+static const PatchGenerator::UniquePtrVec &
+generateWideWritePatch(unsigned size, bool addressBefore) {
+  static const auto gen = [](unsigned size, bool addressBefore) {
+    if (addressBefore) {
+      return appendWideValue(conv_unique<PatchGenerator>(ReadTemp::unique(
+                                 Temp(0), Shadow(MEM_WRITE_ADDRESS_TAG))),
+                             size, MEM_WRITE_WIDE_VALUE_TAG);
+    }
+    return appendWideValue(
+        conv_unique<PatchGenerator>(
+            GetWriteAddress::unique(Temp(0)),
+            WriteTemp::unique(Temp(0), Shadow(MEM_WRITE_ADDRESS_TAG))),
+        size, MEM_WRITE_WIDE_VALUE_TAG);
+  };
+  static const PatchGenerator::UniquePtrVec r[] = {
+      gen(16, false), gen(32, false), gen(64, false),
+      gen(16, true),  gen(32, true),  gen(64, true)};
+  return r[getWideValueIndex(size) + (addressBefore ? 3 : 0)];
+}
+
+template <bool addressOnly>
 static const PatchGenerator::UniquePtrVec &
 generatePreReadInstrumentPatch(Patch &patch, const LLVMCPU &llvmcpu) {
 
@@ -259,9 +592,21 @@ generatePreReadInstrumentPatch(Patch &patch, const LLVMCPU &llvmcpu) {
       return r;
     }
   }
+  unsigned wideSize =
+      getWideValueSize(patch.metadata.inst, llvmcpu,
+                       addressOnly ? 0 : getReadSize(patch.metadata.inst));
+  if (wideSize > 0) {
+    return generateWideReadPatch(wideSize);
+  }
+  // the value isn't recorded when it doesn't fit in a shadow, when the
+  // accesses are coalesced or for MEMORY_ADDRESS_ONLY
+  bool withValue =
+      not addressOnly and getReadSize(patch.metadata.inst) <= sizeof(rword) and
+      not(llvmcpu.getOptions() & Options::OPT_ENABLE_MEMACCESS_COALESCING);
+
   // instruction with double read
-  else if (isDoubleRead(patch.metadata.inst)) {
-    if (getReadSize(patch.metadata.inst) > sizeof(rword)) {
+  if (isDoubleRead(patch.metadata.inst)) {
+    if (not withValue) {
       static const PatchGenerator::UniquePtrVec r = conv_unique<PatchGenerator>(
           GetReadAddress::unique(Temp(0), 0),
           WriteTemp::unique(Temp(0), Shadow(MEM_READ_ADDRESS_TAG)),
@@ -281,7 +626,7 @@ generatePreReadInstrumentPatch(Patch &patch, const LLVMCPU &llvmcpu) {
       return r;
     }
   } else {
-    if (getReadSize(patch.metadata.inst) > sizeof(rword)) {
+    if (not withValue) {
       static const PatchGenerator::UniquePtrVec r = conv_unique<PatchGenerator>(
           GetReadAddress::unique(Temp(0)),
           WriteTemp::unique(Temp(0), Shadow(MEM_READ_ADDRESS_TAG)));
@@ -346,6 +691,7 @@ generatePreWriteInstrumentPatch(Patch &patch, const LLVMCPU &llvmcpu) {
   }
 }
 
+template <bool addressOnly>
 static const PatchGenerator::UniquePtrVec &
 generatePostWriteInstrumentPatch(Patch &patch, const LLVMCPU &llvmcpu) {
 
@@ -358,10 +704,23 @@ generatePostWriteInstrumentPatch(Patch &patch, const LLVMCPU &llvmcpu) {
         WriteTemp::unique(Temp(0), Shadow(MEM_WRITE_END_ADDRESS_TAG)));
     return r;
   }
+  bool addressBefore = mayChangeWriteAddr(patch.metadata.inst, desc) &&
+                       !isStackWrite(patch.metadata.inst);
+  unsigned wideSize =
+      getWideValueSize(patch.metadata.inst, llvmcpu,
+                       addressOnly ? 0 : getWriteSize(patch.metadata.inst));
+  if (wideSize > 0) {
+    return generateWideWritePatch(wideSize, addressBefore);
+  }
+  // the value isn't recorded when it doesn't fit in a shadow, when the
+  // accesses are coalesced or for MEMORY_ADDRESS_ONLY
+  bool withValue =
+      not addressOnly and getWriteSize(patch.metadata.inst) <= sizeof(rword) and
+      not(llvmcpu.getOptions() & Options::OPT_ENABLE_MEMACCESS_COALESCING);
+
   // Some instruction need to have the address get before the instruction
-  else if (mayChangeWriteAddr(patch.metadata.inst, desc) &&
-           !isStackWrite(patch.metadata.inst)) {
-    if (getWriteSize(patch.metadata.inst) > sizeof(rword)) {
+  if (addressBefore) {
+    if (not withValue) {
       static const PatchGenerator::UniquePtrVec r;
       return r;
     } else {
@@ -372,7 +731,7 @@ generatePostWriteInstrumentPatch(Patch &patch, const LLVMCPU &llvmcpu) {
       return r;
     }
   } else {
-    if (getWriteSize(patch.metadata.inst) > sizeof(rword)) {
+    if (not withValue) {
       static const PatchGenerator::UniquePtrVec r = conv_unique<PatchGenerator>(
           GetWriteAddress::unique(Temp(0)),
           WriteTemp::unique(Temp(0), Shadow(MEM_WRITE_ADDRESS_TAG)));
@@ -388,24 +747,234 @@ generatePostWriteInstrumentPatch(Patch &patch, const LLVMCPU &llvmcpu) {
   }
 }
 
-std::vector<std::unique_ptr<InstrRule>> getInstrRuleMemAccessRead() {
+std::vector<std::unique_ptr<InstrRule>>
+getInstrRuleMemAccessRead(MemoryAccessType type) {
+  return conv_unique<InstrRule>(
+      InstrRuleDynamic::unique(DoesReadAccess::unique(type),
+                               (type & MEMORY_ADDRESS_ONLY)
+                                   ? generatePreReadInstrumentPatch<true>
+                                   : generatePreReadInstrumentPatch<false>,
+                               PREINST, false, PRIORITY_MEMACCESS_LIMIT + 1,
+                               RelocTagPreInstMemAccess),
+      InstrRuleDynamic::unique(DoesReadAccess::unique(type),
+                               generatePostReadInstrumentPatch, POSTINST,
+                               false, PRIORITY_MEMACCESS_LIMIT + 1,
+                               RelocTagPostInstMemAccess));
+}
+
+std::vector<std::unique_ptr<InstrRule>>
+getInstrRuleMemAccessRead(Range<rword> range) {
   return conv_unique<InstrRule>(
       InstrRuleDynamic::unique(
-          DoesReadAccess::unique(), generatePreReadInstrumentPatch, PREINST,
-          false, PRIORITY_MEMACCESS_LIMIT + 1, RelocTagPreInstMemAccess),
+          And::unique(conv_unique<PatchCondition>(
+              InstructionInRange::unique(range.start(), range.end()),
+              DoesReadAccess::unique())),
+          generatePreReadInstrumentPatch<false>, PREINST, false,
+          PRIORITY_MEMACCESS_LIMIT + 1, RelocTagPreInstMemAccess),
       InstrRuleDynamic::unique(
-          DoesReadAccess::unique(), generatePostReadInstrumentPatch, POSTINST,
-          false, PRIORITY_MEMACCESS_LIMIT + 1, RelocTagPostInstMemAccess));
+          And::unique(conv_unique<PatchCondition>(
+              InstructionInRange::unique(range.start(), range.end()),
+              DoesReadAccess::unique())),
+          generatePostReadInstrumentPatch, POSTINST, false,
+          PRIORITY_MEMACCESS_LIMIT + 1, RelocTagPostInstMemAccess));
 }
 
-std::vector<std::unique_ptr<InstrRule>> getInstrRuleMemAccessWrite() {
+std::vector<std::unique_ptr<InstrRule>>
+getInstrRuleMemAccessWrite(MemoryAccessType type) {
+  return conv_unique<InstrRule>(
+      InstrRuleDynamic::unique(DoesWriteAccess::unique(type),
+                               generatePreWriteInstrumentPatch, PREINST, false,
+                               PRIORITY_MEMACCESS_LIMIT,
+                               RelocTagPreInstMemAccess),
+      InstrRuleDynamic::unique(DoesWriteAccess::unique(type),
+                               (type & MEMORY_ADDRESS_ONLY)
+                                   ? generatePostWriteInstrumentPatch<true>
+                                   : generatePostWriteInstrumentPatch<false>,
+                               POSTINST, false, PRIORITY_MEMACCESS_LIMIT,
+                               RelocTagPostInstMemAccess));
+}
+
+std::vector<std::unique_ptr<InstrRule>>
+getInstrRuleMemAccessWrite(Range<rword> range) {
   return conv_unique<InstrRule>(
       InstrRuleDynamic::unique(
-          DoesWriteAccess::unique(), generatePreWriteInstrumentPatch, PREINST,
-          false, PRIORITY_MEMACCESS_LIMIT, RelocTagPreInstMemAccess),
+          And::unique(conv_unique<PatchCondition>(
+              InstructionInRange::unique(range.start(), range.end()),
+              DoesWriteAccess::unique())),
+          generatePreWriteInstrumentPatch, PREINST, false,
+          PRIORITY_MEMACCESS_LIMIT, RelocTagPreInstMemAccess),
       InstrRuleDynamic::unique(
-          DoesWriteAccess::unique(), generatePostWriteInstrumentPatch, POSTINST,
-          false, PRIORITY_MEMACCESS_LIMIT, RelocTagPostInstMemAccess));
+          And::unique(conv_unique<PatchCondition>(
+              InstructionInRange::unique(range.start(), range.end()),
+              DoesWriteAccess::unique())),
+          generatePostWriteInstrumentPatch<false>, POSTINST, false,
+          PRIORITY_MEMACCESS_LIMIT, RelocTagPostInstMemAccess));
+}
+
+PatchGenerator::UniquePtrVec
+getMemoryTraceGenerator(const Patch &patch, const LLVMCPU &llvmcpu,
+                        InstPosition position, MemoryTraceBuffer *buffer) {
+  const llvm::MCInst &inst = patch.metadata.inst;
+  const llvm::MCInstrDesc &desc = llvmcpu.getMCII().get(inst.getOpcode());
+
+  unsigned readSize = (buffer->type & MEMORY_READ) ? getReadSize(inst) : 0;
+  unsigned writeSize = (buffer->type & MEMORY_WRITE) ? getWriteSize(inst) : 0;
+  uint16_t sizeFlags = isMinSizeRead(inst) ? MEMORY_MINIMUM_SIZE : 0;
+  // The size of the REP accesses is only known after the instruction
+  bool rep = hasREPPrefix(inst);
+  uint16_t repFlags = MEMORY_UNKNOWN_SIZE | MEMORY_UNKNOWN_VALUE;
+  bool writeAddrBefore =
+      mayChangeWriteAddr(inst, desc) && !isStackWrite(inst);
+
+  PatchGenerator::UniquePtrVec gen;
+  std::vector<MemoryTraceRecord> records;
+  if (position == InstPosition::PREINST) {
+    if (readSize > 0) {
+      bool withValue = not rep and readSize <= sizeof(rword);
+      uint16_t flags =
+          rep ? repFlags
+              : (sizeFlags | (withValue ? 0 : MEMORY_UNKNOWN_VALUE));
+      uint16_t size = rep ? 0 : readSize;
+      for (uint16_t i = 0; i < (isDoubleRead(inst) ? 2 : 1); i++) {
+        records.push_back({MemoryTraceRecord::READ_ACCESS, i, withValue, size,
+                           MEMORY_READ, flags});
+      }
+    }
+    if (writeSize > 0 and rep) {
+      records.push_back({MemoryTraceRecord::WRITE_ACCESS, 0, false, 0,
+                         MEMORY_WRITE, repFlags});
+    } else if (writeSize > 0 and writeAddrBefore) {
+      gen.push_back(GetWriteAddress::unique(Temp(0)));
+      gen.push_back(
+          WriteTemp::unique(Temp(0), Shadow(MEM_TRACE_WRITE_ADDRESS_TAG)));
+    }
+  } else if (writeSize > 0 and not rep) {
+    bool withValue = writeSize <= sizeof(rword);
+    uint16_t flags = sizeFlags | (withValue ? 0 : MEMORY_UNKNOWN_VALUE);
+    if (writeAddrBefore) {
+      records.push_back({MemoryTraceRecord::SHADOW_WRITE,
+                         MEM_TRACE_WRITE_ADDRESS_TAG, withValue,
+                         static_cast<uint16_t>(writeSize), MEMORY_WRITE,
+                         flags});
+    } else {
+      records.push_back({MemoryTraceRecord::WRITE_ACCESS, 0, withValue,
+                         static_cast<uint16_t>(writeSize), MEMORY_WRITE,
+                         flags});
+    }
+  }
+  if (records.empty()) {
+    return gen;
+  }
+
+  // PC must be set in the context before the break to the host, except after
+  // an instruction that sets it
+  rword pc = 0;
+  if (position == InstPosition::PREINST) {
+    pc = patch.metadata.address;
+  } else if (not patch.metadata.modifyPC) {
+    pc = patch.metadata.endAddress();
+  }
+  gen.push_back(WriteMemoryTrace::unique(
+      Temp(0), Temp(1), Constant(reinterpret_cast<rword>(&buffer->current)),
+      Constant(buffer->limit), Constant(reinterpret_cast<rword>(buffer)),
+      std::move(records), Constant(pc)));
+  return gen;
+}
+
+PatchGenerator::UniquePtrVec
+getPageHistogramGenerator(const Patch &patch, const LLVMCPU &llvmcpu,
+                          InstPosition position, PageHistogram *histogram) {
+  const llvm::MCInst &inst = patch.metadata.inst;
+  const llvm::MCInstrDesc &desc = llvmcpu.getMCII().get(inst.getOpcode());
+
+  bool read = (histogram->type & MEMORY_READ) and getReadSize(inst) > 0;
+  bool write = (histogram->type & MEMORY_WRITE) and getWriteSize(inst) > 0;
+  // The REP accesses are counted once, on the page of their first address
+  bool rep = hasREPPrefix(inst);
+  bool writeAddrBefore =
+      mayChangeWriteAddr(inst, desc) && !isStackWrite(inst);
+
+  // The generators of the addresses of the accesses, in Temp(0)
+  PatchGenerator::UniquePtrVec accesses;
+  PatchGenerator::UniquePtrVec gen;
+  if (position == InstPosition::PREINST) {
+    if (read) {
+      for (uint8_t i = 0; i < (isDoubleRead(inst) ? 2 : 1); i++) {
+        accesses.push_back(GetReadAddress::unique(Temp(0), i));
+      }
+    }
+    if (write and rep) {
+      accesses.push_back(GetWriteAddress::unique(Temp(0)));
+    } else if (write and writeAddrBefore) {
+      gen.push_back(GetWriteAddress::unique(Temp(0)));
+      gen.push_back(WriteTemp::unique(
+          Temp(0), Shadow(PAGE_HISTOGRAM_WRITE_ADDRESS_TAG)));
+    }
+  } else if (write and not rep) {
+    if (writeAddrBefore) {
+      accesses.push_back(ReadTemp::unique(
+          Temp(0), Shadow(PAGE_HISTOGRAM_WRITE_ADDRESS_TAG)));
+    } else {
+      accesses.push_back(GetWriteAddress::unique(Temp(0)));
+    }
+  }
+
+  // PC must be set in the context before the break to the host, except after
+  // an instruction that sets it
+  rword pc = 0;
+  if (position == InstPosition::PREINST) {
+    pc = patch.metadata.address;
+  } else if (not patch.metadata.modifyPC) {
+    pc = patch.metadata.endAddress();
+  }
+  for (PatchGenerator::UniquePtr &access : accesses) {
+    gen.push_back(std::move(access));
+    gen.push_back(CountPageAccess::unique(
+        Temp(0), Temp(1), Temp(2),
+        Constant(reinterpret_cast<rword>(histogram->directory)),
+        Constant(reinterpret_cast<rword>(&histogram->missAddress)),
+        Constant(reinterpret_cast<rword>(histogram)), Constant(pc)));
+  }
+  return gen;
+}
+
+std::vector<std::unique_ptr<PatchGenerator>>
+getOwnershipGenerator(const Patch &patch, const LLVMCPU &llvmcpu,
+                      InstPosition position, const OwnershipCheck &check) {
+  const llvm::MCInst &inst = patch.metadata.inst;
+
+  // All the accesses are checked before the instruction. The stack of a
+  // thread is private, the writes on the stack are never checked.
+  PatchGenerator::UniquePtrVec gen;
+  if (position != InstPosition::PREINST) {
+    return gen;
+  }
+  bool read = (check.type & MEMORY_READ) and getReadSize(inst) > 0;
+  bool write = (check.type & MEMORY_WRITE) and getWriteSize(inst) > 0 and
+               not isStackWrite(inst);
+
+  auto checkAccess = [&](InstCallback cbk) {
+    gen.push_back(CheckOwnership::unique(
+        Temp(0), Temp(1), Temp(2),
+        Constant(reinterpret_cast<rword>(check.table->directory)),
+        Constant(check.thread),
+        Constant(reinterpret_cast<rword>(check.missAddress)),
+        Constant(reinterpret_cast<rword>(cbk)),
+        Constant(reinterpret_cast<rword>(check.filter)),
+        Constant(patch.metadata.address)));
+  };
+  // The REP accesses are checked once, on the granule of their first address
+  if (read) {
+    for (uint8_t i = 0; i < (isDoubleRead(inst) ? 2 : 1); i++) {
+      gen.push_back(GetReadAddress::unique(Temp(0), i));
+      checkAccess(ownershipReadMiss);
+    }
+  }
+  if (write) {
+    gen.push_back(GetWriteAddress::unique(Temp(0)));
+    checkAccess(ownershipWriteMiss);
+  }
+  return gen;
 }
 
 } // namespace QBDI
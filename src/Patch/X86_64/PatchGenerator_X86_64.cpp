@@ -15,6 +15,7 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <algorithm>
 #include <stdint.h>
 #include <stdlib.h>
 #include <utility>
@@ -28,7 +29,10 @@
 #include "QBDI/Config.h"
 #include "QBDI/Platform.h"
 #include "Engine/LLVMCPU.h"
+#include "ExecBlock/Context.h"
 #include "Patch/InstInfo.h"
+#include "Patch/InstrRules.h"
+#include "Patch/MemoryAccess.h"
 #include "Patch/Patch.h"
 #include "Patch/RelocatableInst.h"
 #include "Patch/TempManager.h"
@@ -41,6 +45,51 @@
 namespace QBDI {
 class Patch;
 
+// The offset of a relative jump is encoded from the start of its displacement
+// (see LLVMCPU::writeInstruction): a jump over n bytes needs an offset of n
+// plus the size of the displacement.
+static const int32_t jcc1Bias = 1;
+static const int32_t jmpBias = 4;
+
+// Get the size of the code of a sequence, the distance skipped by a jump over
+// it
+static int32_t getCodeSize(const RelocatableInst::UniquePtrVec &insts,
+                           const LLVMCPU &llvmcpu) {
+  size_t size = 0;
+  for (const RelocatableInst::UniquePtr &inst : insts) {
+    size += inst->getSize(llvmcpu);
+  }
+  return static_cast<int32_t>(size);
+}
+
+// The size of the red zone of the System V ABI, the flags of the guest are
+// saved below it
+static constexpr rword redZoneSize = 128;
+
+// Save the flags of the guest below the red zone, if they are live
+static RelocatableInst::UniquePtrVec saveFlags(bool live) {
+  RelocatableInst::UniquePtrVec p;
+  if (live) {
+    if constexpr (is_x86_64) {
+      p.push_back(Add(Reg(REG_SP), Constant(-redZoneSize)));
+    }
+    p.push_back(Pushf());
+  }
+  return p;
+}
+
+// Restore the flags of the guest saved by saveFlags
+static RelocatableInst::UniquePtrVec restoreFlags(bool live) {
+  RelocatableInst::UniquePtrVec p;
+  if (live) {
+    p.push_back(Popf());
+    if constexpr (is_x86_64) {
+      p.push_back(Add(Reg(REG_SP), Constant(redZoneSize)));
+    }
+  }
+  return p;
+}
+
 // Generic PatchGenerator that must be implemented by each target
 
 // TargetPrologue
@@ -85,6 +134,39 @@ RelocatableInst::UniquePtrVec GetPCOffset::generate(const Patch *patch,
   _QBDI_UNREACHABLE();
 }
 
+// RelocatePCRel
+// =============
+
+RelocatableInst::UniquePtrVec
+RelocatePCRel::generate(const Patch *patch, TempManager *temp_manager,
+                        Patch *toMerge) const {
+  const llvm::MCInst &inst = patch->metadata.inst;
+  int memIndex = -1;
+  for (unsigned i = 0; i < inst.getNumOperands(); i++) {
+    const llvm::MCOperand &op = inst.getOperand(i);
+    if (not op.isReg() or op.getReg() != Reg(REG_PC)) {
+      continue;
+    }
+    // RIP must only be the base of one memory operand without index
+    if (memIndex >= 0 or i + 3 >= inst.getNumOperands() or
+        not inst.getOperand(i + 2).isReg() or
+        inst.getOperand(i + 2).getReg() != 0 or
+        not inst.getOperand(i + 3).isImm()) {
+      return {};
+    }
+    memIndex = i;
+  }
+  if (memIndex < 0) {
+    return {};
+  }
+  rword target = patch->metadata.endAddress() +
+                 inst.getOperand(memIndex + 3).getImm();
+  llvm::MCInst a(inst);
+  unsigned instSize = patch->llvmcpu->getInstSize(a);
+  return conv_unique<RelocatableInst>(TargetPCRel::unique(
+      std::move(a), memIndex + 3 /* AddrDisp */, target, instSize));
+}
+
 // SimulateCall
 // ============
 
@@ -568,4 +650,997 @@ RelocatableInst::UniquePtrVec GetWriteValue::generate(const Patch *patch,
       abort());
 }
 
+// GetWideValue
+// ============
+
+RelocatableInst::UniquePtrVec GetWideValue::generate(const Patch *patch,
+                                                     TempManager *temp_manager,
+                                                     Patch *toMerge) const {
+  const llvm::MCInst &inst = patch->metadata.inst;
+  const llvm::MCInstrDesc &desc =
+      patch->llvmcpu->getMCII().get(inst.getOpcode());
+  int memIndex = llvm::X86II::getMemoryOperandNo(desc.TSFlags);
+  QBDI_REQUIRE_ACTION(memIndex >= 0 && "No memory operand in the instruction",
+                      abort());
+  unsigned realMemIndex = memIndex + llvm::X86II::getOperandBias(desc);
+  QBDI_REQUIRE_ACTION(inst.getNumOperands() > realMemIndex + 4 &&
+                          inst.getOperand(realMemIndex + 4).isReg(),
+                      abort());
+
+  // the address computed by GetReadAddress or GetWriteAddress doesn't include
+  // the base of the segment
+  unsigned seg = inst.getOperand(realMemIndex + 4).getReg();
+  return conv_unique<RelocatableInst>(NoReloc::unique(
+      movrm(temp_manager->getRegForTemp(temp),
+            temp_manager->getRegForTemp(address), 1, 0, offset, seg)));
+}
+
+// IncrementCounter
+// ================
+
+RelocatableInst::UniquePtrVec
+IncrementCounter::generate(const Patch *patch, TempManager *temp_manager,
+                           Patch *toMerge) const {
+  if constexpr (is_x86_64) {
+    Reg addr = temp_manager->getRegForTemp(address);
+    Reg val = temp_manager->getRegForTemp(value);
+    // LEA doesn't modify the flags, they don't need to be saved
+    return conv_unique<RelocatableInst>(
+        Mov(addr, counter), NoReloc::unique(mov64rm(val, addr, 1, 0, 0, 0)),
+        NoReloc::unique(addr64i(val, val, 1)),
+        NoReloc::unique(mov64mr(addr, 1, 0, 0, 0, val)));
+  } else {
+    // The 32 bits registers need a carry to increment the high part
+    if (temp_manager->areFlagsDead()) {
+      return conv_unique<RelocatableInst>(
+          NoReloc::unique(add32mi8(0, 0, 0, counter, 0, 1)),
+          NoReloc::unique(adc32mi8(0, 0, 0, counter + 4, 0, 0)));
+    }
+    return conv_unique<RelocatableInst>(
+        Pushf(), NoReloc::unique(add32mi8(0, 0, 0, counter, 0, 1)),
+        NoReloc::unique(adc32mi8(0, 0, 0, counter + 4, 0, 0)), Popf());
+  }
+}
+
+// IncrementBranchCounter
+// ======================
+
+RelocatableInst::UniquePtrVec
+IncrementBranchCounter::generate(const Patch *patch, TempManager *temp_manager,
+                                 Patch *toMerge) const {
+  Reg addr = temp_manager->getRegForTemp(address);
+  Reg val = temp_manager->getRegForTemp(value);
+  RelocatableInst::UniquePtrVec p = conv_unique<RelocatableInst>(
+      Mov(addr, counters),
+      NoReloc::unique(lea(val, addr, 1, 0, sizeof(uint64_t), 0)),
+      NoReloc::unique(cmovrr(addr, val, cond)));
+  if constexpr (is_x86_64) {
+    // LEA doesn't modify the flags, they don't need to be saved
+    append(p, conv_unique<RelocatableInst>(
+                  NoReloc::unique(mov64rm(val, addr, 1, 0, 0, 0)),
+                  NoReloc::unique(addr64i(val, val, 1)),
+                  NoReloc::unique(mov64mr(addr, 1, 0, 0, 0, val))));
+  } else {
+    // the flags are live: the branch follows the increment
+    append(p, conv_unique<RelocatableInst>(
+                  Pushf(), NoReloc::unique(add32mi8(addr, 1, 0, 0, 0, 1)),
+                  NoReloc::unique(adc32mi8(addr, 1, 0, 4, 0, 0)), Popf()));
+  }
+  return p;
+}
+
+// UpdateTargetTable
+// =================
+
+RelocatableInst::UniquePtrVec
+UpdateTargetTable::generate(const Patch *patch, TempManager *temp_manager,
+                            Patch *toMerge) const {
+  static const rword targetOffset = offsetof(IndirectTargetEntry, target);
+
+  RelocatableInst::UniquePtrVec p;
+  Reg t = temp_manager->getRegForTemp(target);
+  Reg a = temp_manager->getRegForTemp(table);
+  Reg e = temp_manager->getRegForTemp(entry);
+  Reg v = temp_manager->getRegForTemp(value);
+  bool liveFlags = not temp_manager->areFlagsDead();
+
+  append(p, LoadReg(t, Offset(Reg(REG_PC))));
+  append(p, saveFlags(liveFlags));
+  p.push_back(Mov(a, tableAddr));
+  p.push_back(
+      NoReloc::unique(lea(e, a, 1, 0, INDIRECT_TABLE_SIZE * entrySize, 0)));
+  // The entries are filled in order, the lowest empty entry follows the
+  // targets already recorded. A target of 0 is never executed.
+  for (size_t i = INDIRECT_TABLE_SIZE; i-- > 0;) {
+    rword entryOffset = i * entrySize;
+    p.push_back(
+        NoReloc::unique(movrm(v, a, 1, 0, entryOffset + targetOffset, 0)));
+    p.push_back(NoReloc::unique(testri(v, 0xffffffff)));
+    p.push_back(NoReloc::unique(lea(v, a, 1, 0, entryOffset, 0)));
+    p.push_back(NoReloc::unique(cmovrr(e, v, llvm::X86::CondCode::COND_E)));
+  }
+  for (size_t i = INDIRECT_TABLE_SIZE; i-- > 0;) {
+    rword entryOffset = i * entrySize;
+    p.push_back(
+        NoReloc::unique(movrm(v, a, 1, 0, entryOffset + targetOffset, 0)));
+    p.push_back(NoReloc::unique(cmprr(v, t)));
+    p.push_back(NoReloc::unique(lea(v, a, 1, 0, entryOffset, 0)));
+    p.push_back(NoReloc::unique(cmovrr(e, v, llvm::X86::CondCode::COND_E)));
+  }
+  // the overflow entry keeps the last target beyond the table
+  p.push_back(NoReloc::unique(movmr(e, 1, 0, targetOffset, 0, t)));
+  if constexpr (is_x86_64) {
+    p.push_back(NoReloc::unique(mov64rm(v, e, 1, 0, 0, 0)));
+    p.push_back(NoReloc::unique(addr64i(v, v, 1)));
+    p.push_back(NoReloc::unique(mov64mr(e, 1, 0, 0, 0, v)));
+  } else {
+    p.push_back(NoReloc::unique(add32mi8(e, 1, 0, 0, 0, 1)));
+    p.push_back(NoReloc::unique(adc32mi8(e, 1, 0, 4, 0, 0)));
+  }
+  append(p, restoreFlags(liveFlags));
+  return p;
+}
+
+// UpdateValueTable
+// ================
+
+RelocatableInst::UniquePtrVec
+UpdateValueTable::generate(const Patch *patch, TempManager *temp_manager,
+                           Patch *toMerge) const {
+  static const rword entrySize = sizeof(ValueProfileEntry);
+  static const rword valueOffset = offsetof(ValueProfileEntry, value);
+  static const rword usedOffset = offsetof(ValueProfileEntry, used);
+
+  RelocatableInst::UniquePtrVec p;
+  Reg t = temp_manager->getRegForTemp(value);
+  Reg a = temp_manager->getRegForTemp(table);
+  Reg e = temp_manager->getRegForTemp(entry);
+  Reg v = temp_manager->getRegForTemp(scratch);
+  bool liveFlags = not temp_manager->areFlagsDead();
+
+  append(p, saveFlags(liveFlags));
+  p.push_back(Mov(a, tableAddr));
+  p.push_back(NoReloc::unique(lea(e, a, 1, 0, nbEntries * entrySize, 0)));
+  // The entries are filled in order, the lowest unused entry follows the
+  // values already recorded. An unused entry holds the value 0 and is only
+  // selected by the value 0 after the recorded values.
+  for (size_t i = nbEntries; i-- > 0;) {
+    rword entryOffset = i * entrySize;
+    p.push_back(
+        NoReloc::unique(movrm(v, a, 1, 0, entryOffset + usedOffset, 0)));
+    p.push_back(NoReloc::unique(testri(v, 0xffffffff)));
+    p.push_back(NoReloc::unique(lea(v, a, 1, 0, entryOffset, 0)));
+    p.push_back(NoReloc::unique(cmovrr(e, v, llvm::X86::CondCode::COND_E)));
+  }
+  for (size_t i = nbEntries; i-- > 0;) {
+    rword entryOffset = i * entrySize;
+    p.push_back(
+        NoReloc::unique(movrm(v, a, 1, 0, entryOffset + valueOffset, 0)));
+    p.push_back(NoReloc::unique(cmprr(v, t)));
+    p.push_back(NoReloc::unique(lea(v, a, 1, 0, entryOffset, 0)));
+    p.push_back(NoReloc::unique(cmovrr(e, v, llvm::X86::CondCode::COND_E)));
+  }
+  // the overflow entry keeps the last value beyond the table
+  p.push_back(NoReloc::unique(movmr(e, 1, 0, valueOffset, 0, t)));
+  p.push_back(NoReloc::unique(movmi(e, 1, 0, usedOffset, 0, 1)));
+  if constexpr (is_x86_64) {
+    p.push_back(NoReloc::unique(mov64rm(v, e, 1, 0, 0, 0)));
+    p.push_back(NoReloc::unique(addr64i(v, v, 1)));
+    p.push_back(NoReloc::unique(mov64mr(e, 1, 0, 0, 0, v)));
+  } else {
+    p.push_back(NoReloc::unique(add32mi8(e, 1, 0, 0, 0, 1)));
+    p.push_back(NoReloc::unique(adc32mi8(e, 1, 0, 4, 0, 0)));
+  }
+  append(p, restoreFlags(liveFlags));
+  return p;
+}
+
+// AddCounter
+// ==========
+
+RelocatableInst::UniquePtrVec
+AddCounter::generate(const Patch *patch, TempManager *temp_manager,
+                     Patch *toMerge) const {
+  Reg addr = temp_manager->getRegForTemp(address);
+  Reg val = temp_manager->getRegForTemp(value);
+  // LEA doesn't modify the flags, they don't need to be saved
+  return conv_unique<RelocatableInst>(
+      Mov(addr, counter), NoReloc::unique(movrm(val, addr, 1, 0, 0, 0)),
+      NoReloc::unique(addri(val, val, increment)),
+      NoReloc::unique(movmr(addr, 1, 0, 0, 0, val)));
+}
+
+// The frame of the shadow stack is selected by the low byte of the top index
+static_assert(CALL_GRAPH_DEPTH == 256, "The shadow stack needs 256 frames");
+static_assert(sizeof(CallGraphFrame) == 4 * sizeof(rword),
+              "The frames are indexed with a scale of 4 registers");
+static_assert(offsetof(CallGraphEdge, target) ==
+                  offsetof(IndirectTargetEntry, target),
+              "The edges are selected by UpdateTargetTable");
+
+// Get the address of the top frame of a CallGraphState in a register
+static void loadTopFrame(RelocatableInst::UniquePtrVec &p,
+                         const TempManager *temp_manager, Reg state, Reg frame,
+                         Reg value) {
+  // MOVZX clears the high part of the register
+  unsigned value32 = value;
+  if constexpr (is_x86_64) {
+    value32 = temp_manager->getSizedSubReg(value, 4);
+  }
+  p.push_back(NoReloc::unique(
+      mov32rm8(value32, state, 1, 0, offsetof(CallGraphState, top), 0)));
+  p.push_back(NoReloc::unique(lea(value, value, 1, value, 0, 0)));
+  p.push_back(NoReloc::unique(lea(value, value, 1, value, 0, 0)));
+  p.push_back(NoReloc::unique(lea(frame, state, sizeof(rword), value,
+                                  offsetof(CallGraphState, frames), 0)));
+}
+
+// PushCallFrame
+// =============
+
+RelocatableInst::UniquePtrVec
+PushCallFrame::generate(const Patch *patch, TempManager *temp_manager,
+                        Patch *toMerge) const {
+  static const rword topOffset = offsetof(CallGraphState, top);
+
+  RelocatableInst::UniquePtrVec p;
+  Reg e = temp_manager->getRegForTemp(edge);
+  Reg s = temp_manager->getRegForTemp(state);
+  Reg f = temp_manager->getRegForTemp(frame);
+  Reg v = temp_manager->getRegForTemp(value);
+
+  p.push_back(Mov(s, stateAddr));
+  p.push_back(NoReloc::unique(movrm(v, s, 1, 0, topOffset, 0)));
+  p.push_back(NoReloc::unique(addri(v, v, 1)));
+  p.push_back(NoReloc::unique(movmr(s, 1, 0, topOffset, 0, v)));
+  loadTopFrame(p, temp_manager, s, f, v);
+  p.push_back(NoReloc::unique(
+      movmr(f, 1, 0, offsetof(CallGraphFrame, edge), 0, e)));
+  p.push_back(Mov(v, returnAddress));
+  p.push_back(NoReloc::unique(
+      movmr(f, 1, 0, offsetof(CallGraphFrame, returnAddress), 0, v)));
+  p.push_back(NoReloc::unique(
+      movrm(v, s, 1, 0, offsetof(CallGraphState, instCount), 0)));
+  p.push_back(NoReloc::unique(
+      movmr(f, 1, 0, offsetof(CallGraphFrame, start), 0, v)));
+  return p;
+}
+
+// PopCallFrame
+// ============
+
+RelocatableInst::UniquePtrVec
+PopCallFrame::generate(const Patch *patch, TempManager *temp_manager,
+                       Patch *toMerge) const {
+  static const rword topOffset = offsetof(CallGraphState, top);
+  static const rword inclusiveOffset = offsetof(CallGraphEdge, inclusive);
+
+  RelocatableInst::UniquePtrVec p;
+  Reg t = temp_manager->getRegForTemp(target);
+  Reg s = temp_manager->getRegForTemp(state);
+  Reg f = temp_manager->getRegForTemp(frame);
+  Reg v = temp_manager->getRegForTemp(value);
+  Reg e = temp_manager->getRegForTemp(edge);
+  bool liveFlags = not temp_manager->areFlagsDead();
+
+  append(p, LoadReg(t, Offset(Reg(REG_PC))));
+  append(p, saveFlags(liveFlags));
+  p.push_back(Mov(s, stateAddr));
+  loadTopFrame(p, temp_manager, s, f, v);
+  p.push_back(NoReloc::unique(
+      movrm(v, f, 1, 0, offsetof(CallGraphFrame, returnAddress), 0)));
+  p.push_back(NoReloc::unique(cmprr(v, t)));
+  // MOV and LEA keep the flags of the comparison
+  p.push_back(
+      NoReloc::unique(lea(e, s, 1, 0, offsetof(CallGraphState, sink), 0)));
+  p.push_back(NoReloc::unique(
+      movrm(v, f, 1, 0, offsetof(CallGraphFrame, edge), 0)));
+  p.push_back(NoReloc::unique(cmovrr(e, v, llvm::X86::CondCode::COND_E)));
+  p.push_back(NoReloc::unique(movrm(t, s, 1, 0, topOffset, 0)));
+  p.push_back(NoReloc::unique(addri(v, t, -1)));
+  p.push_back(NoReloc::unique(cmovrr(t, v, llvm::X86::CondCode::COND_E)));
+  p.push_back(NoReloc::unique(movmr(s, 1, 0, topOffset, 0, t)));
+  // inclusive += instCount - start
+  p.push_back(NoReloc::unique(
+      movrm(v, s, 1, 0, offsetof(CallGraphState, instCount), 0)));
+  p.push_back(NoReloc::unique(
+      movrm(t, f, 1, 0, offsetof(CallGraphFrame, start), 0)));
+  p.push_back(NoReloc::unique(subrr(v, t)));
+  p.push_back(NoReloc::unique(movrm(t, e, 1, 0, inclusiveOffset, 0)));
+  p.push_back(NoReloc::unique(lea(t, t, 1, v, 0, 0)));
+  p.push_back(NoReloc::unique(movmr(e, 1, 0, inclusiveOffset, 0, t)));
+  append(p, restoreFlags(liveFlags));
+  return p;
+}
+
+// UpdateCoverage
+// ==============
+
+RelocatableInst::UniquePtrVec
+UpdateCoverage::generate(const Patch *patch, TempManager *temp_manager,
+                         Patch *toMerge) const {
+  RelocatableInst::UniquePtrVec p;
+  Reg addr = temp_manager->getRegForTemp(address);
+  bool liveFlags = not temp_manager->areFlagsDead();
+
+  append(p, saveFlags(liveFlags));
+  if (prevLoc != 0) {
+    Reg idx = temp_manager->getRegForTemp(index);
+    p.push_back(Mov(addr, prevLoc));
+    p.push_back(NoReloc::unique(movrm(idx, addr, 1, 0, 0, 0)));
+    p.push_back(NoReloc::unique(xorri(idx, curLoc)));
+    p.push_back(NoReloc::unique(movmi(addr, 1, 0, 0, 0, curLoc >> 1)));
+    p.push_back(Mov(addr, bitmap));
+    p.push_back(NoReloc::unique(add8mi(addr, 1, idx, 0, 0, 1)));
+  } else {
+    p.push_back(Mov(addr, Constant(bitmap + curLoc)));
+    p.push_back(NoReloc::unique(add8mi(addr, 1, 0, 0, 0, 1)));
+  }
+  append(p, restoreFlags(liveFlags));
+  return p;
+}
+
+// WriteMemoryTrace
+// ================
+
+RelocatableInst::UniquePtrVec
+WriteMemoryTrace::generate(const Patch *patch, TempManager *temp_manager,
+                           Patch *toMerge) const {
+  QBDI_REQUIRE_ACTION(records.size() <= MEMORY_TRACE_MAX_ENTRIES, abort());
+
+  // The flags of the guest are saved around the comparison if they are live
+  const bool liveFlags = not temp_manager->areFlagsDead();
+
+  RelocatableInst::UniquePtrVec p;
+  Reg e = temp_manager->getRegForTemp(entry);
+  Reg v = temp_manager->getRegForTemp(value);
+
+  p.push_back(Mov(e, current));
+  p.push_back(NoReloc::unique(movrm(e, e, 1, 0, 0, 0)));
+  for (const MemoryTraceRecord &record : records) {
+    p.push_back(Mov(v, Constant(patch->metadata.address)));
+    p.push_back(NoReloc::unique(
+        movmr(e, 1, 0, offsetof(MemoryTraceEntry, instAddress), 0, v)));
+
+    switch (record.source) {
+      case MemoryTraceRecord::READ_ACCESS:
+        append(p, GetReadAddress(value, record.index)
+                      .generate(patch, temp_manager, toMerge));
+        break;
+      case MemoryTraceRecord::WRITE_ACCESS:
+        append(p,
+               GetWriteAddress(value).generate(patch, temp_manager, toMerge));
+        break;
+      case MemoryTraceRecord::SHADOW_WRITE:
+        append(p, ReadTemp(value, Shadow(record.index))
+                      .generate(patch, temp_manager, toMerge));
+        break;
+    }
+    p.push_back(NoReloc::unique(
+        movmr(e, 1, 0, offsetof(MemoryTraceEntry, accessAddress), 0, v)));
+
+    if (record.withValue) {
+      if (record.source == MemoryTraceRecord::READ_ACCESS) {
+        append(p, GetReadValue(value, record.index)
+                      .generate(patch, temp_manager, toMerge));
+      } else {
+        // the address of the write access is in the temporary
+        append(p, GetWriteValue(value).generate(patch, temp_manager, toMerge));
+      }
+      p.push_back(NoReloc::unique(
+          movmr(e, 1, 0, offsetof(MemoryTraceEntry, value), 0, v)));
+    } else {
+      p.push_back(NoReloc::unique(
+          movmi(e, 1, 0, offsetof(MemoryTraceEntry, value), 0, 0)));
+    }
+    p.push_back(NoReloc::unique(
+        mov32mi(e, 1, 0, offsetof(MemoryTraceEntry, size), 0,
+                static_cast<uint32_t>(record.size) |
+                    (static_cast<uint32_t>(record.type) << 16))));
+    p.push_back(NoReloc::unique(mov32mi(
+        e, 1, 0, offsetof(MemoryTraceEntry, flags), 0, record.flags)));
+    p.push_back(NoReloc::unique(addri(e, e, sizeof(MemoryTraceEntry))));
+  }
+  p.push_back(Mov(v, current));
+  p.push_back(NoReloc::unique(movmr(v, 1, 0, 0, 0, e)));
+
+  // Compare with the limit without changing the flags of the guest
+  p.push_back(Mov(v, limit));
+  append(p, saveFlags(liveFlags));
+  p.push_back(NoReloc::unique(cmprr(e, v)));
+
+  // The jumps skip over the flush
+  RelocatableInst::UniquePtrVec flush = restoreFlags(liveFlags);
+  flush.push_back(Mov(v, Constant(reinterpret_cast<rword>(flushMemoryTrace))));
+  flush.push_back(Mov(Offset(offsetof(Context, hostState.callback)), v));
+  flush.push_back(Mov(v, buffer));
+  flush.push_back(Mov(Offset(offsetof(Context, hostState.data)), v));
+  flush.push_back(InstId::unique(v));
+  flush.push_back(Mov(Offset(offsetof(Context, hostState.origin)), v));
+  if (pc != 0) {
+    flush.push_back(Mov(v, pc));
+    flush.push_back(Mov(Offset(Reg(REG_PC)), v));
+  }
+  flush.push_back(Mov(e, Offset(e)));
+  append(flush, getBreakToHost(v, *patch, true));
+
+  RelocatableInst::UniquePtrVec skip = restoreFlags(liveFlags);
+  skip.push_back(NoReloc::unique(
+      jmp(getCodeSize(flush, *patch->llvmcpu) + jmpBias)));
+  p.push_back(NoReloc::unique(
+      jcc1(getCodeSize(skip, *patch->llvmcpu) + jcc1Bias,
+           llvm::X86::CondCode::COND_AE)));
+  append(p, std::move(skip));
+  append(p, std::move(flush));
+
+  return p;
+}
+
+// WriteCallTrace
+// ==============
+
+// The registers of the first arguments, in the GPRState
+static const unsigned sysvArgs[QBDI_CALL_TRACE_MAX_ARGS] = {5, 4, 3, 2, 6, 7};
+static const unsigned win64Args[] = {2, 3, 6, 7};
+
+RelocatableInst::UniquePtrVec
+WriteCallTrace::generate(const Patch *patch, TempManager *temp_manager,
+                         Patch *toMerge) const {
+  QBDI_REQUIRE_ACTION(nbArgs <= QBDI_CALL_TRACE_MAX_ARGS, abort());
+  // Only the arguments in the registers are captured on Windows X86_64
+  uint32_t nb = nbArgs;
+  if constexpr (is_x86_64 and is_windows) {
+    nb = std::min<uint32_t>(nb, sizeof(win64Args) / sizeof(win64Args[0]));
+  }
+
+  const bool liveFlags = not temp_manager->areFlagsDead();
+
+  RelocatableInst::UniquePtrVec p;
+  Reg e = temp_manager->getRegForTemp(entry);
+  Reg v = temp_manager->getRegForTemp(value);
+
+  p.push_back(Mov(e, current));
+  p.push_back(NoReloc::unique(movrm(e, e, 1, 0, 0, 0)));
+  p.push_back(Mov(v, Constant(patch->metadata.address)));
+  p.push_back(NoReloc::unique(
+      movmr(e, 1, 0, offsetof(CallTraceEntry, callAddress), 0, v)));
+  if (target != 0) {
+    p.push_back(Mov(v, target));
+  } else {
+    p.push_back(Mov(v, Offset(Reg(REG_PC))));
+  }
+  p.push_back(NoReloc::unique(
+      movmr(e, 1, 0, offsetof(CallTraceEntry, target), 0, v)));
+  p.push_back(NoReloc::unique(
+      movmi(e, 1, 0, offsetof(CallTraceEntry, nbArgs), 0, nb)));
+
+  for (uint32_t i = 0; i < nb; i++) {
+    rword argOffset = offsetof(CallTraceEntry, args) + i * sizeof(rword);
+    if constexpr (is_x86_64) {
+      Reg arg(is_windows ? win64Args[i] : sysvArgs[i]);
+      if (arg.getID() == e.getID() or arg.getID() == v.getID()) {
+        // the value of the guest is saved in the context
+        p.push_back(Mov(v, Offset(arg)));
+        arg = v;
+      }
+      p.push_back(NoReloc::unique(movmr(e, 1, 0, argOffset, 0, arg)));
+    } else {
+      // the return address is on the top of the stack after the call
+      p.push_back(NoReloc::unique(movrm(v, Reg(REG_SP), 1, 0,
+                                        sizeof(rword) * (i + 1), 0)));
+      p.push_back(NoReloc::unique(movmr(e, 1, 0, argOffset, 0, v)));
+    }
+  }
+  p.push_back(NoReloc::unique(addri(e, e, sizeof(CallTraceEntry))));
+  p.push_back(Mov(v, current));
+  p.push_back(NoReloc::unique(movmr(v, 1, 0, 0, 0, e)));
+
+  // Compare with the limit without changing the flags of the guest
+  p.push_back(Mov(v, limit));
+  append(p, saveFlags(liveFlags));
+  p.push_back(NoReloc::unique(cmprr(e, v)));
+
+  // The jumps skip over the flush. PC is already the target of the call.
+  RelocatableInst::UniquePtrVec flush = restoreFlags(liveFlags);
+  flush.push_back(Mov(v, Constant(reinterpret_cast<rword>(flushCallTrace))));
+  flush.push_back(Mov(Offset(offsetof(Context, hostState.callback)), v));
+  flush.push_back(Mov(v, buffer));
+  flush.push_back(Mov(Offset(offsetof(Context, hostState.data)), v));
+  flush.push_back(InstId::unique(v));
+  flush.push_back(Mov(Offset(offsetof(Context, hostState.origin)), v));
+  flush.push_back(Mov(e, Offset(e)));
+  append(flush, getBreakToHost(v, *patch, true));
+
+  RelocatableInst::UniquePtrVec skip = restoreFlags(liveFlags);
+  skip.push_back(NoReloc::unique(
+      jmp(getCodeSize(flush, *patch->llvmcpu) + jmpBias)));
+  p.push_back(NoReloc::unique(
+      jcc1(getCodeSize(skip, *patch->llvmcpu) + jcc1Bias,
+           llvm::X86::CondCode::COND_AE)));
+  append(p, std::move(skip));
+  append(p, std::move(flush));
+
+  return p;
+}
+
+// CountPageAccess
+// ===============
+
+RelocatableInst::UniquePtrVec
+CountPageAccess::generate(const Patch *patch, TempManager *temp_manager,
+                          Patch *toMerge) const {
+  // The flags of the guest are saved around the test if they are live
+  const bool liveFlags = not temp_manager->areFlagsDead();
+
+  RelocatableInst::UniquePtrVec p;
+  Reg a = temp_manager->getRegForTemp(address);
+  Reg l = temp_manager->getRegForTemp(leaf);
+  Reg i = temp_manager->getRegForTemp(index);
+
+  append(p, saveFlags(liveFlags));
+  p.push_back(NoReloc::unique(movrr(l, a)));
+  p.push_back(NoReloc::unique(shrri(l, PAGE_HISTOGRAM_LEAF_SHIFT)));
+  p.push_back(NoReloc::unique(andri(l, PAGE_HISTOGRAM_DIRECTORY_SIZE - 1)));
+  p.push_back(Mov(i, directory));
+  p.push_back(NoReloc::unique(movrm(l, i, sizeof(rword), l, 0, 0)));
+  p.push_back(NoReloc::unique(testrr(l, l)));
+
+  // The jumps skip over the miss
+  RelocatableInst::UniquePtrVec miss = restoreFlags(liveFlags);
+  miss.push_back(Mov(i, missAddress));
+  miss.push_back(NoReloc::unique(movmr(i, 1, 0, 0, 0, a)));
+  miss.push_back(Mov(i, Constant(reinterpret_cast<rword>(countPageMiss))));
+  miss.push_back(Mov(Offset(offsetof(Context, hostState.callback)), i));
+  miss.push_back(Mov(i, histogram));
+  miss.push_back(Mov(Offset(offsetof(Context, hostState.data)), i));
+  miss.push_back(InstId::unique(i));
+  miss.push_back(Mov(Offset(offsetof(Context, hostState.origin)), i));
+  if (pc != 0) {
+    miss.push_back(Mov(i, pc));
+    miss.push_back(Mov(Offset(Reg(REG_PC)), i));
+  }
+  miss.push_back(Mov(l, Offset(l)));
+  miss.push_back(Mov(a, Offset(a)));
+  append(miss, getBreakToHost(i, *patch, true));
+
+  RelocatableInst::UniquePtrVec increment;
+  increment.push_back(NoReloc::unique(movrr(i, a)));
+  increment.push_back(NoReloc::unique(shrri(i, PAGE_HISTOGRAM_PAGE_SHIFT)));
+  increment.push_back(
+      NoReloc::unique(andri(i, PAGE_HISTOGRAM_LEAF_SIZE - 1)));
+  if constexpr (is_x86_64) {
+    increment.push_back(
+        NoReloc::unique(add64mi8(l, sizeof(uint64_t), i, 0, 0, 1)));
+  } else {
+    increment.push_back(
+        NoReloc::unique(add32mi8(l, sizeof(uint64_t), i, 0, 0, 1)));
+    increment.push_back(
+        NoReloc::unique(adc32mi8(l, sizeof(uint64_t), i, 4, 0, 0)));
+  }
+  append(increment, restoreFlags(liveFlags));
+  increment.push_back(
+      NoReloc::unique(jmp(getCodeSize(miss, *patch->llvmcpu) + jmpBias)));
+
+  p.push_back(NoReloc::unique(
+      jcc1(getCodeSize(increment, *patch->llvmcpu) + jcc1Bias,
+           llvm::X86::CondCode::COND_E)));
+  append(p, std::move(increment));
+  append(p, std::move(miss));
+
+  return p;
+}
+
+// CheckOwnership
+// ==============
+
+RelocatableInst::UniquePtrVec
+CheckOwnership::generate(const Patch *patch, TempManager *temp_manager,
+                         Patch *toMerge) const {
+  // The flags of the guest are saved around the test if they are live
+  const bool liveFlags = not temp_manager->areFlagsDead();
+
+  RelocatableInst::UniquePtrVec p;
+  Reg a = temp_manager->getRegForTemp(address);
+  Reg l = temp_manager->getRegForTemp(leaf);
+  Reg i = temp_manager->getRegForTemp(index);
+
+  append(p, saveFlags(liveFlags));
+  p.push_back(NoReloc::unique(movrr(l, a)));
+  p.push_back(NoReloc::unique(shrri(l, OWNERSHIP_LEAF_SHIFT)));
+  p.push_back(NoReloc::unique(andri(l, OWNERSHIP_DIRECTORY_SIZE - 1)));
+  p.push_back(Mov(i, directory));
+  p.push_back(NoReloc::unique(movrm(l, i, sizeof(rword), l, 0, 0)));
+  p.push_back(NoReloc::unique(testrr(l, l)));
+
+  // The jumps skip over the miss
+  RelocatableInst::UniquePtrVec miss = restoreFlags(liveFlags);
+  miss.push_back(Mov(i, missAddress));
+  miss.push_back(NoReloc::unique(movmr(i, 1, 0, 0, 0, a)));
+  miss.push_back(Mov(i, callback));
+  miss.push_back(Mov(Offset(offsetof(Context, hostState.callback)), i));
+  miss.push_back(Mov(i, filter));
+  miss.push_back(Mov(Offset(offsetof(Context, hostState.data)), i));
+  miss.push_back(InstId::unique(i));
+  miss.push_back(Mov(Offset(offsetof(Context, hostState.origin)), i));
+  miss.push_back(Mov(i, pc));
+  miss.push_back(Mov(Offset(Reg(REG_PC)), i));
+  miss.push_back(Mov(l, Offset(l)));
+  miss.push_back(Mov(a, Offset(a)));
+  append(miss, getBreakToHost(i, *patch, true));
+
+  RelocatableInst::UniquePtrVec owned = restoreFlags(liveFlags);
+  owned.push_back(
+      NoReloc::unique(jmp(getCodeSize(miss, *patch->llvmcpu) + jmpBias)));
+
+  RelocatableInst::UniquePtrVec check;
+  check.push_back(NoReloc::unique(movrr(i, a)));
+  check.push_back(NoReloc::unique(shrri(i, OWNERSHIP_GRANULE_SHIFT)));
+  check.push_back(NoReloc::unique(andri(i, OWNERSHIP_LEAF_SIZE - 1)));
+  check.push_back(NoReloc::unique(cmp32mi(l, sizeof(uint32_t), i, 0, 0,
+                                          static_cast<uint32_t>(thread))));
+  check.push_back(NoReloc::unique(
+      jcc1(getCodeSize(owned, *patch->llvmcpu) + jcc1Bias,
+           llvm::X86::CondCode::COND_NE)));
+
+  p.push_back(NoReloc::unique(
+      jcc1(getCodeSize(check, *patch->llvmcpu) +
+               getCodeSize(owned, *patch->llvmcpu) + jcc1Bias,
+           llvm::X86::CondCode::COND_E)));
+  append(p, std::move(check));
+  append(p, std::move(owned));
+  append(p, std::move(miss));
+
+  return p;
+}
+
+// ConsumeBudget
+// =============
+
+RelocatableInst::UniquePtrVec
+ConsumeBudget::generate(const Patch *patch, TempManager *temp_manager,
+                        Patch *toMerge) const {
+  // The flags of the guest are saved around the subtraction if they are live
+  const bool liveFlags = not temp_manager->areFlagsDead();
+
+  RelocatableInst::UniquePtrVec p;
+  Reg v = temp_manager->getRegForTemp(value);
+  Reg c = temp_manager->getRegForTemp(count);
+  Reg a = temp_manager->getRegForTemp(address);
+
+  append(p, saveFlags(liveFlags));
+  p.push_back(Mov(a, remaining));
+  p.push_back(NoReloc::unique(movrm(v, a, 1, 0, 0, 0)));
+  p.push_back(Mov(c, instCount));
+  p.push_back(NoReloc::unique(subrr(v, c)));
+
+  // The jumps skip over the exhausted budget
+  RelocatableInst::UniquePtrVec exhausted = restoreFlags(liveFlags);
+  exhausted.push_back(Mov(a, cbk));
+  exhausted.push_back(Mov(Offset(offsetof(Context, hostState.callback)), a));
+  exhausted.push_back(Mov(a, data));
+  exhausted.push_back(Mov(Offset(offsetof(Context, hostState.data)), a));
+  exhausted.push_back(InstId::unique(a));
+  exhausted.push_back(Mov(Offset(offsetof(Context, hostState.origin)), a));
+  exhausted.push_back(Mov(a, pc));
+  exhausted.push_back(Mov(Offset(Reg(REG_PC)), a));
+  exhausted.push_back(Mov(v, Offset(v)));
+  exhausted.push_back(Mov(c, Offset(c)));
+  append(exhausted, getBreakToHost(a, *patch, true));
+
+  RelocatableInst::UniquePtrVec store;
+  store.push_back(NoReloc::unique(movmr(a, 1, 0, 0, 0, v)));
+  append(store, restoreFlags(liveFlags));
+  store.push_back(NoReloc::unique(
+      jmp(getCodeSize(exhausted, *patch->llvmcpu) + jmpBias)));
+
+  p.push_back(NoReloc::unique(
+      jcc1(getCodeSize(store, *patch->llvmcpu) + jcc1Bias,
+           llvm::X86::CondCode::COND_B)));
+  append(p, std::move(store));
+  append(p, std::move(exhausted));
+
+  return p;
+}
+
+// FlagCallback
+// ============
+
+RelocatableInst::UniquePtrVec
+FlagCallback::generate(const Patch *patch, TempManager *temp_manager,
+                       Patch *toMerge) const {
+  // The flags of the guest are saved around the test if they are live
+  const bool liveFlags = not temp_manager->areFlagsDead();
+
+  RelocatableInst::UniquePtrVec p;
+  Reg v = temp_manager->getRegForTemp(value);
+  Reg a = temp_manager->getRegForTemp(address);
+
+  append(p, saveFlags(liveFlags));
+  p.push_back(Mov(a, flag));
+  p.push_back(NoReloc::unique(movrm(v, a, 1, 0, 0, 0)));
+  p.push_back(NoReloc::unique(testrr(v, v)));
+
+  // The jumps skip over the callback
+  RelocatableInst::UniquePtrVec callback = restoreFlags(liveFlags);
+  callback.push_back(Mov(a, cbk));
+  callback.push_back(Mov(Offset(offsetof(Context, hostState.callback)), a));
+  callback.push_back(Mov(a, data));
+  callback.push_back(Mov(Offset(offsetof(Context, hostState.data)), a));
+  callback.push_back(InstId::unique(a));
+  callback.push_back(Mov(Offset(offsetof(Context, hostState.origin)), a));
+  if (pc != 0) {
+    callback.push_back(Mov(a, pc));
+    callback.push_back(Mov(Offset(Reg(REG_PC)), a));
+  }
+  callback.push_back(Mov(v, Offset(v)));
+  append(callback, getBreakToHost(a, *patch, true));
+
+  RelocatableInst::UniquePtrVec skip = restoreFlags(liveFlags);
+  skip.push_back(NoReloc::unique(
+      jmp(getCodeSize(callback, *patch->llvmcpu) + jmpBias)));
+  p.push_back(NoReloc::unique(
+      jcc1(getCodeSize(skip, *patch->llvmcpu) + jcc1Bias,
+           llvm::X86::CondCode::COND_NE)));
+  append(p, std::move(skip));
+  append(p, std::move(callback));
+
+  return p;
+}
+
+// PredicateCallback
+// =================
+
+RelocatableInst::UniquePtrVec
+PredicateCallback::generate(const Patch *patch, TempManager *temp_manager,
+                            Patch *toMerge) const {
+  bool useCounter = predicate.type == PREDICATE_COUNTER or
+                    predicate.type == PREDICATE_SAMPLE;
+
+  // The flags of the guest are saved around the comparison if they are live
+  const bool liveFlags = not temp_manager->areFlagsDead();
+
+  RelocatableInst::UniquePtrVec p;
+  Reg v = temp_manager->getRegForTemp(value);
+  Reg b = temp_manager->getRegForTemp(bound);
+  Reg a = useCounter ? temp_manager->getRegForTemp(address) : v;
+
+  // The condition to skip the callback after CMP value, bound
+  unsigned skipCond;
+  switch (predicate.type) {
+    case PREDICATE_REG_EQUAL:
+    case PREDICATE_REG_NOT_EQUAL:
+    case PREDICATE_REG_BELOW:
+    case PREDICATE_REG_ABOVE_EQUAL: {
+      QBDI_REQUIRE_ACTION(predicate.reg < REG_PC, abort());
+      // The temporaries haven't been modified yet, they still have the value
+      // of the guest
+      unsigned guest = GPR_ID[predicate.reg];
+      if (guest != v) {
+        p.push_back(NoReloc::unique(movrr(v, guest)));
+      }
+      p.push_back(Mov(b, Constant(predicate.value)));
+      switch (predicate.type) {
+        default:
+        case PREDICATE_REG_EQUAL:
+          skipCond = llvm::X86::CondCode::COND_NE;
+          break;
+        case PREDICATE_REG_NOT_EQUAL:
+          skipCond = llvm::X86::CondCode::COND_E;
+          break;
+        case PREDICATE_REG_BELOW:
+          skipCond = llvm::X86::CondCode::COND_AE;
+          break;
+        case PREDICATE_REG_ABOVE_EQUAL:
+          skipCond = llvm::X86::CondCode::COND_B;
+          break;
+      }
+      break;
+    }
+    case PREDICATE_MEM_IN_RANGE:
+      QBDI_REQUIRE_ACTION(predicate.value < predicate.end, abort());
+      if (predicate.access == MEMORY_READ) {
+        append(p, GetReadAddress(value, 0).generate(patch, temp_manager,
+                                                    toMerge));
+      } else {
+        append(p, GetWriteAddress(value).generate(patch, temp_manager,
+                                                  toMerge));
+      }
+      // compare (address - start) with the size of the range
+      p.push_back(Mov(b, Constant(-predicate.value)));
+      p.push_back(NoReloc::unique(lea(v, v, 1, b, 0, 0)));
+      p.push_back(Mov(b, Constant(predicate.end - predicate.value)));
+      skipCond = llvm::X86::CondCode::COND_AE;
+      break;
+    case PREDICATE_COUNTER:
+      QBDI_REQUIRE_ACTION(predicate.value > 0, abort());
+      p.push_back(Mov(a, counter));
+      p.push_back(NoReloc::unique(movrm(v, a, 1, 0, 0, 0)));
+      p.push_back(NoReloc::unique(addri(v, v, 1)));
+      p.push_back(Mov(b, Constant(predicate.value)));
+      skipCond = llvm::X86::CondCode::COND_B;
+      break;
+    case PREDICATE_SAMPLE:
+      // the countdown is drawn again by the host when it reaches 0
+      QBDI_REQUIRE_ACTION(predicate.value > 0, abort());
+      p.push_back(Mov(a, counter));
+      p.push_back(NoReloc::unique(movrm(v, a, 1, 0, 0, 0)));
+      p.push_back(Mov(b, Constant(-1)));
+      p.push_back(NoReloc::unique(lea(v, v, 1, b, 0, 0)));
+      p.push_back(Mov(b, Constant(0)));
+      skipCond = llvm::X86::CondCode::COND_NE;
+      break;
+    default:
+      QBDI_ERROR("Unknown predicate type {}", predicate.type);
+      abort();
+  }
+
+  // Compare without changing the flags of the guest
+  append(p, saveFlags(liveFlags));
+  p.push_back(NoReloc::unique(cmprr(v, b)));
+  if (predicate.type == PREDICATE_COUNTER) {
+    // MOV and CMOV keep the flags of the comparison
+    p.push_back(Mov(b, Constant(0)));
+    p.push_back(NoReloc::unique(
+        cmovrr(v, b, llvm::X86::CondCode::COND_AE)));
+  }
+  if (useCounter) {
+    p.push_back(NoReloc::unique(movmr(a, 1, 0, 0, 0, v)));
+  }
+
+  // The jumps skip over the callback
+  RelocatableInst::UniquePtrVec skip = restoreFlags(liveFlags);
+  RelocatableInst::UniquePtrVec callback = restoreFlags(liveFlags);
+  callback.push_back(Mov(b, cbk));
+  callback.push_back(Mov(Offset(offsetof(Context, hostState.callback)), b));
+  callback.push_back(Mov(b, data));
+  callback.push_back(Mov(Offset(offsetof(Context, hostState.data)), b));
+  callback.push_back(InstId::unique(b));
+  callback.push_back(Mov(Offset(offsetof(Context, hostState.origin)), b));
+  if (pc != 0) {
+    callback.push_back(Mov(b, pc));
+    callback.push_back(Mov(Offset(Reg(REG_PC)), b));
+  }
+  callback.push_back(Mov(v, Offset(v)));
+  if (useCounter) {
+    callback.push_back(Mov(a, Offset(a)));
+  }
+  append(callback, getBreakToHost(b, *patch, true));
+  callback.push_back(
+      NoReloc::unique(jmp(getCodeSize(skip, *patch->llvmcpu) + jmpBias)));
+
+  p.push_back(NoReloc::unique(
+      jcc1(getCodeSize(callback, *patch->llvmcpu) + jcc1Bias, skipCond)));
+  append(p, std::move(callback));
+  append(p, std::move(skip));
+
+  return p;
+}
+
+// DirectCallback
+// ==============
+
+// Called by the VM when a direct callback doesn't return CONTINUE. The action
+// returned by the callback is the data.
+static VMAction directCallbackAction(VMInstanceRef vm, GPRState *gprState,
+                                     FPRState *fprState, void *data) {
+  return static_cast<VMAction>(reinterpret_cast<rword>(data));
+}
+
+RelocatableInst::UniquePtrVec
+DirectCallback::generate(const Patch *patch, TempManager *temp_manager,
+                         Patch *toMerge) const {
+  // The registers clobbered by a call, except RAX/EAX
+  static const uint32_t clobbered =
+      is_x86_64 ? (is_windows ? 0x3CC : 0x3FC) : 0xC;
+
+  RelocatableInst::UniquePtrVec p;
+  Reg scratch = Reg(0);
+  uint32_t saved = (clobbered | footprint) & ((1u << REG_SP) - 2);
+
+  // Save the flags with RAX/EAX
+  p.push_back(Mov(Offset(scratch), scratch));
+  append(p, saveFlags(true));
+  p.push_back(Popr(scratch));
+  if constexpr (is_x86_64) {
+    p.push_back(Add(Reg(REG_SP), Constant(redZoneSize)));
+  }
+  p.push_back(Mov(Offset(offsetof(Context, gprState.eflags)), scratch));
+
+  for (unsigned i = 1; i < REG_SP; i++) {
+    if ((saved & (1u << i)) != 0) {
+      p.push_back(Mov(Offset(Reg(i)), Reg(i)));
+    }
+  }
+  p.push_back(Mov(Offset(Reg(REG_SP)), Reg(REG_SP)));
+  if (pc != 0) {
+    p.push_back(Mov(scratch, pc));
+    p.push_back(Mov(Offset(Reg(REG_PC)), scratch));
+  }
+
+  // Call the callback on the host stack
+  if constexpr (is_x86_64) {
+    unsigned argVM = is_windows ? llvm::X86::RCX : llvm::X86::RDI;
+    unsigned argGPR = is_windows ? llvm::X86::RDX : llvm::X86::RSI;
+    unsigned argFPR = is_windows ? llvm::X86::R8 : llvm::X86::RDX;
+    unsigned argData = is_windows ? llvm::X86::R9 : llvm::X86::RCX;
+
+    p.push_back(NoReloc::unique(movri(argVM, vm)));
+    p.push_back(NoReloc::unique(movrm(argVM, argVM, 1, 0, 0, 0)));
+    p.push_back(DataBlockRelx86(lea(argGPR, 0, 1, 0, 0, 0), 1,
+                                offsetof(Context, gprState), 7));
+    p.push_back(DataBlockRelx86(lea(argFPR, 0, 1, 0, 0, 0), 1,
+                                offsetof(Context, fprState), 7));
+    p.push_back(NoReloc::unique(movri(argData, data)));
+    p.push_back(Mov(Reg(REG_SP), Offset(offsetof(Context, hostState.sp))));
+    p.push_back(NoReloc::unique(andri8(Reg(REG_SP), -16)));
+    if constexpr (is_windows) {
+      // shadow space of the arguments
+      p.push_back(Add(Reg(REG_SP), Constant(-32)));
+    }
+  } else {
+    unsigned arg = llvm::X86::ECX;
+
+    p.push_back(Mov(Reg(REG_SP), Offset(offsetof(Context, hostState.sp))));
+    p.push_back(NoReloc::unique(andri8(Reg(REG_SP), -16)));
+    p.push_back(NoReloc::unique(movri(arg, data)));
+    p.push_back(NoReloc::unique(pushr(arg)));
+    p.push_back(DataBlockRelx86(lea(arg, 0, 1, 0, 0, 0), 1,
+                                offsetof(Context, fprState), 6));
+    p.push_back(NoReloc::unique(pushr(arg)));
+    p.push_back(DataBlockRelx86(lea(arg, 0, 1, 0, 0, 0), 1,
+                                offsetof(Context, gprState), 6));
+    p.push_back(NoReloc::unique(pushr(arg)));
+    p.push_back(NoReloc::unique(movri(arg, vm)));
+    p.push_back(NoReloc::unique(movrm(arg, arg, 1, 0, 0, 0)));
+    p.push_back(NoReloc::unique(pushr(arg)));
+  }
+  // the ABI requires a clear direction flag
+  p.push_back(NoReloc::unique(cld()));
+  p.push_back(Mov(scratch, cbk));
+  p.push_back(NoReloc::unique(callr(scratch)));
+
+  // Reload the registers, the callback may have changed them
+  p.push_back(Mov(Offset(offsetof(Context, hostState.data)), scratch));
+  p.push_back(Mov(Reg(REG_SP), Offset(Reg(REG_SP))));
+  for (unsigned i = 1; i < REG_SP; i++) {
+    if ((saved & (1u << i)) != 0) {
+      p.push_back(Mov(Reg(i), Offset(Reg(i))));
+    }
+  }
+  p.push_back(Mov(scratch, Offset(offsetof(Context, hostState.data))));
+  p.push_back(NoReloc::unique(testri(scratch, 0xffffffff)));
+
+  // The jumps skip over the action and the continuation
+  RelocatableInst::UniquePtrVec restore[2];
+  for (RelocatableInst::UniquePtrVec &r : restore) {
+    r.push_back(Mov(scratch, Offset(offsetof(Context, gprState.eflags))));
+    if constexpr (is_x86_64) {
+      r.push_back(Add(Reg(REG_SP), Constant(-redZoneSize)));
+    }
+    r.push_back(Pushr(scratch));
+    append(r, restoreFlags(true));
+  }
+  // The action is already in hostState.data
+  RelocatableInst::UniquePtrVec action = std::move(restore[1]);
+  action.push_back(
+      Mov(scratch, Constant(reinterpret_cast<rword>(directCallbackAction))));
+  action.push_back(Mov(Offset(offsetof(Context, hostState.callback)), scratch));
+  action.push_back(InstId::unique(scratch));
+  action.push_back(Mov(Offset(offsetof(Context, hostState.origin)), scratch));
+  append(action, getBreakToHost(scratch, *patch, true));
+
+  RelocatableInst::UniquePtrVec resume = std::move(restore[0]);
+  resume.push_back(Mov(scratch, Offset(scratch)));
+  resume.push_back(
+      NoReloc::unique(jmp(getCodeSize(action, *patch->llvmcpu) + jmpBias)));
+
+  p.push_back(NoReloc::unique(
+      jcc1(getCodeSize(resume, *patch->llvmcpu) + jcc1Bias,
+           llvm::X86::CondCode::COND_NE)));
+  append(p, std::move(resume));
+  append(p, std::move(action));
+
+  return p;
+}
+
 } // namespace QBDI
@@ -22,6 +22,7 @@
 #include <stddef.h>
 #include <vector>
 
+#include "QBDI/Callback.h"
 #include "QBDI/State.h"
 #include "Patch/PatchGenerator.h"
 #include "Patch/PatchUtils.h"
@@ -77,6 +78,25 @@ public:
            Patch *toMerge) const override;
 };
 
+class RelocatePCRel : public AutoClone<PatchGenerator, RelocatePCRel> {
+
+public:
+  /*! Adjust the displacement of a memory operand relative to RIP, so that it
+   * accesses the same memory from the ExecBlock. The patch can only be
+   * written in an ExecBlock less than 2GiB away from the memory. Nothing is
+   * generated if the instruction uses RIP in another way.
+   */
+  RelocatePCRel() {}
+
+  /*! Output:
+   *
+   * INST [RIP + IMM'] with IMM' = address + instSize + IMM - ExecBlock PC
+   */
+  std::vector<std::unique_ptr<RelocatableInst>>
+  generate(const Patch *patch, TempManager *temp_manager,
+           Patch *toMerge) const override;
+};
+
 class SimulateCall : public AutoClone<PatchGenerator, SimulateCall> {
 
   Temp temp;
@@ -239,6 +259,934 @@ public:
            Patch *toMerge) const override;
 };
 
+class GetWideValue : public AutoClone<PatchGenerator, GetWideValue> {
+
+  Temp temp;
+  Temp address;
+  rword offset;
+
+public:
+  /*! Copy a part of the value of a memory access larger than a register in a
+   * temporary. The memory operand of the instruction gives the segment of the
+   * access.
+   *
+   * @param[in] temp      A temporary where the part of the value will be
+   *                      copied.
+   * @param[in] address   A temporary with the address of the access.
+   * @param[in] offset    The offset of the part in the access.
+   */
+  GetWideValue(Temp temp, Temp address, rword offset)
+      : temp(temp), address(address), offset(offset) {}
+
+  /*! Output:
+   *
+   * MOV REG64 temp, MEM64 [address + offset]
+   */
+  std::vector<std::unique_ptr<RelocatableInst>>
+  generate(const Patch *patch, TempManager *temp_manager,
+           Patch *toMerge) const override;
+};
+
+class IncrementBranchCounter
+    : public AutoClone<PatchGenerator, IncrementBranchCounter> {
+
+  Temp address;
+  Temp value;
+  Constant counters;
+  unsigned cond;
+
+public:
+  /*! Increment one of the two 64 bits counters of a conditional branch,
+   * before the branch: the second counter if the condition is true (the
+   * branch is taken), the first one otherwise. CMOV selects the counter, on
+   * X86_64 the flags are not modified. On X86, the flags are saved on the
+   * stack during the increment.
+   *
+   * @param[in] address   A temporary for the address of the counter.
+   * @param[in] value     A temporary for the value of the counter.
+   * @param[in] counters  The address of the counters.
+   * @param[in] cond      The condition code of the branch.
+   */
+  IncrementBranchCounter(Temp address, Temp value, Constant counters,
+                         unsigned cond)
+      : address(address), value(value), counters(counters), cond(cond) {}
+
+  /*! Output:
+   *
+   * MOV REG address, IMM counters
+   * LEA REG value, MEM [address + 8]
+   * CMOVcc REG address, REG value
+   * X86_64:
+   * MOV REG64 value, MEM64 [address]
+   * LEA REG64 value, MEM64 [value + 1]
+   * MOV MEM64 [address], REG64 value
+   * X86:
+   * PUSHFD
+   * ADD MEM32 [address], 1
+   * ADC MEM32 [address + 4], 0
+   * POPFD
+   */
+  std::vector<std::unique_ptr<RelocatableInst>>
+  generate(const Patch *patch, TempManager *temp_manager,
+           Patch *toMerge) const override;
+};
+
+class UpdateTargetTable : public AutoClone<PatchGenerator, UpdateTargetTable> {
+
+  Temp target;
+  Temp table;
+  Temp entry;
+  Temp value;
+  Constant tableAddr;
+  rword entrySize;
+
+public:
+  /*! Count the target written in the PC of the context in a table of
+   * INDIRECT_TABLE_SIZE + 1 entries, without jump. The entries begin with
+   * the count and the target of IndirectTargetEntry. The entry of the
+   * target is selected with CMOV: the first empty entry, replaced by the
+   * entry of the target if the table already holds it. A full table selects
+   * the overflow entry. The flags are saved during the selection if they are
+   * live.
+   *
+   * @param[in] target     A temporary for the target.
+   * @param[in] table      A temporary for the address of the table.
+   * @param[in] entry      A temporary for the selected entry.
+   * @param[in] value      A temporary for the comparisons.
+   * @param[in] tableAddr  The address of the table.
+   * @param[in] entrySize  The size of an entry of the table.
+   */
+  UpdateTargetTable(Temp target, Temp table, Temp entry, Temp value,
+                    Constant tableAddr, rword entrySize)
+      : target(target), table(table), entry(entry), value(value),
+        tableAddr(tableAddr), entrySize(entrySize) {}
+
+  /*! Output:
+   *
+   * MOV REG target, MEM DataBlock[Offset(RIP)]
+   * LEA RSP, [RSP - 128] # X86_64 only, if the flags are live
+   * PUSHF                # if the flags are live
+   * MOV REG table, IMM tableAddr
+   * LEA REG entry, [table + overflow entry]
+   * For each entry i, from the last one:
+   *   MOV REG value, MEM [table + entry i target]
+   *   TEST REG value, -1
+   *   LEA REG value, [table + entry i]
+   *   CMOVE REG entry, REG value
+   * For each entry i, from the last one:
+   *   MOV REG value, MEM [table + entry i target]
+   *   CMP REG value, REG target
+   *   LEA REG value, [table + entry i]
+   *   CMOVE REG entry, REG value
+   * MOV MEM [entry + target], REG target
+   * <increment the 64 bits counter at [entry]>
+   * POPF                 # if the flags are live
+   * LEA RSP, [RSP + 128] # X86_64 only, if the flags are live
+   */
+  std::vector<std::unique_ptr<RelocatableInst>>
+  generate(const Patch *patch, TempManager *temp_manager,
+           Patch *toMerge) const override;
+};
+
+class UpdateValueTable : public AutoClone<PatchGenerator, UpdateValueTable> {
+
+  Temp value;
+  Temp table;
+  Temp entry;
+  Temp scratch;
+  Constant tableAddr;
+  size_t nbEntries;
+
+public:
+  /*! Count a value in a table of nbEntries + 1 ValueProfileEntry, without
+   * jump. The selection is the one of UpdateTargetTable, but an entry is
+   * empty if it isn't used: the value 0 can be recorded.
+   *
+   * @param[in] value      A temporary which holds the value.
+   * @param[in] table      A temporary for the address of the table.
+   * @param[in] entry      A temporary for the selected entry.
+   * @param[in] scratch    A temporary for the comparisons.
+   * @param[in] tableAddr  The address of the table.
+   * @param[in] nbEntries  The number of values recorded in the table.
+   */
+  UpdateValueTable(Temp value, Temp table, Temp entry, Temp scratch,
+                   Constant tableAddr, size_t nbEntries)
+      : value(value), table(table), entry(entry), scratch(scratch),
+        tableAddr(tableAddr), nbEntries(nbEntries) {}
+
+  /*! Output:
+   *
+   * LEA RSP, [RSP - 128] # X86_64 only, if the flags are live
+   * PUSHF                # if the flags are live
+   * MOV REG table, IMM tableAddr
+   * LEA REG entry, [table + overflow entry]
+   * For each entry i, from the last one:
+   *   MOV REG scratch, MEM [table + entry i used]
+   *   TEST REG scratch, -1
+   *   LEA REG scratch, [table + entry i]
+   *   CMOVE REG entry, REG scratch
+   * For each entry i, from the last one:
+   *   MOV REG scratch, MEM [table + entry i value]
+   *   CMP REG scratch, REG value
+   *   LEA REG scratch, [table + entry i]
+   *   CMOVE REG entry, REG scratch
+   * MOV MEM [entry + value], REG value
+   * MOV MEM [entry + used], IMM 1
+   * <increment the 64 bits counter at [entry]>
+   * POPF                 # if the flags are live
+   * LEA RSP, [RSP + 128] # X86_64 only, if the flags are live
+   */
+  std::vector<std::unique_ptr<RelocatableInst>>
+  generate(const Patch *patch, TempManager *temp_manager,
+           Patch *toMerge) const override;
+};
+
+class AddCounter : public AutoClone<PatchGenerator, AddCounter> {
+
+  Temp address;
+  Temp value;
+  Constant counter;
+  Constant increment;
+
+public:
+  /*! Add a constant to a counter of the size of a register, without
+   * modifying the flags.
+   *
+   * @param[in] address    A temporary for the address of the counter.
+   * @param[in] value      A temporary for the value of the counter.
+   * @param[in] counter    The address of the counter.
+   * @param[in] increment  The value added to the counter.
+   */
+  AddCounter(Temp address, Temp value, Constant counter, Constant increment)
+      : address(address), value(value), counter(counter),
+        increment(increment) {}
+
+  /*! Output:
+   *
+   * MOV REG address, IMM counter
+   * MOV REG value, MEM [address]
+   * LEA REG value, MEM [value + increment]
+   * MOV MEM [address], REG value
+   */
+  std::vector<std::unique_ptr<RelocatableInst>>
+  generate(const Patch *patch, TempManager *temp_manager,
+           Patch *toMerge) const override;
+};
+
+class PushCallFrame : public AutoClone<PatchGenerator, PushCallFrame> {
+
+  Temp edge;
+  Temp state;
+  Temp frame;
+  Temp value;
+  Constant stateAddr;
+  Constant returnAddress;
+
+public:
+  /*! Push a frame on the shadow stack of a CallGraphState, without modifying
+   * the flags. The frame holds the edge of the call, the return address and
+   * the instruction counter.
+   *
+   * @param[in] edge           A temporary with the address of the edge.
+   * @param[in] state          A temporary for the address of the state.
+   * @param[in] frame          A temporary for the address of the frame.
+   * @param[in] value          A temporary for the values.
+   * @param[in] stateAddr      The address of the CallGraphState.
+   * @param[in] returnAddress  The return address of the call.
+   */
+  PushCallFrame(Temp edge, Temp state, Temp frame, Temp value,
+                Constant stateAddr, Constant returnAddress)
+      : edge(edge), state(state), frame(frame), value(value),
+        stateAddr(stateAddr), returnAddress(returnAddress) {}
+
+  /*! Output:
+   *
+   * MOV REG state, IMM stateAddr
+   * MOV REG value, MEM [state + top]
+   * LEA REG value, [value + 1]
+   * MOV MEM [state + top], REG value
+   * MOVZX REG value, MEM8 [state + top]
+   * LEA REG value, [value + value]
+   * LEA REG value, [value + value]
+   * LEA REG frame, [state + value * sizeof(rword) + frames]
+   * MOV MEM [frame + edge], REG edge
+   * MOV REG value, IMM returnAddress
+   * MOV MEM [frame + returnAddress], REG value
+   * MOV REG value, MEM [state + instCount]
+   * MOV MEM [frame + start], REG value
+   */
+  std::vector<std::unique_ptr<RelocatableInst>>
+  generate(const Patch *patch, TempManager *temp_manager,
+           Patch *toMerge) const override;
+};
+
+class PopCallFrame : public AutoClone<PatchGenerator, PopCallFrame> {
+
+  Temp target;
+  Temp state;
+  Temp frame;
+  Temp value;
+  Temp edge;
+  Constant stateAddr;
+
+public:
+  /*! Pop the top frame of the shadow stack of a CallGraphState if its return
+   * address is the target written in the PC of the context, without jump.
+   * The instructions executed since the call are added to the edge of the
+   * frame, or to the sink of the state if the frame doesn't match. The flags
+   * are saved if they are live.
+   *
+   * @param[in] target     A temporary for the target of the return.
+   * @param[in] state      A temporary for the address of the state.
+   * @param[in] frame      A temporary for the address of the frame.
+   * @param[in] value      A temporary for the values.
+   * @param[in] edge       A temporary for the address of the edge.
+   * @param[in] stateAddr  The address of the CallGraphState.
+   */
+  PopCallFrame(Temp target, Temp state, Temp frame, Temp value, Temp edge,
+               Constant stateAddr)
+      : target(target), state(state), frame(frame), value(value), edge(edge),
+        stateAddr(stateAddr) {}
+
+  /*! Output:
+   *
+   * MOV REG target, MEM DataBlock[Offset(RIP)]
+   * LEA RSP, [RSP - 128] # X86_64 only, if the flags are live
+   * PUSHF                # if the flags are live
+   * MOV REG state, IMM stateAddr
+   * <address of the top frame in frame>
+   * MOV REG value, MEM [frame + returnAddress]
+   * CMP REG value, REG target
+   * LEA REG edge, [state + sink]
+   * MOV REG value, MEM [frame + edge]
+   * CMOVE REG edge, REG value
+   * MOV REG target, MEM [state + top]
+   * LEA REG value, [target - 1]
+   * CMOVE REG target, REG value
+   * MOV MEM [state + top], REG target
+   * MOV REG value, MEM [state + instCount]
+   * MOV REG target, MEM [frame + start]
+   * SUB REG value, REG target
+   * MOV REG target, MEM [edge + inclusive]
+   * LEA REG target, [target + value]
+   * MOV MEM [edge + inclusive], REG target
+   * POPF                 # if the flags are live
+   * LEA RSP, [RSP + 128] # X86_64 only, if the flags are live
+   */
+  std::vector<std::unique_ptr<RelocatableInst>>
+  generate(const Patch *patch, TempManager *temp_manager,
+           Patch *toMerge) const override;
+};
+
+class IncrementCounter : public AutoClone<PatchGenerator, IncrementCounter> {
+
+  Temp address;
+  Temp value;
+  Constant counter;
+
+public:
+  /*! Increment a 64 bits counter in memory. On X86_64, the flags are not
+   * modified. On X86, the flags are saved on the stack during the increment.
+   *
+   * @param[in] address  A temporary for the address of the counter (X86_64).
+   * @param[in] value    A temporary for the value of the counter (X86_64).
+   * @param[in] counter  The address of the counter.
+   */
+  IncrementCounter(Temp address, Temp value, Constant counter)
+      : address(address), value(value), counter(counter) {}
+
+  /*! Output:
+   *
+   * X86_64:
+   * MOV REG64 address, IMM64 counter
+   * MOV REG64 value, MEM64 [address]
+   * LEA REG64 value, MEM64 [value + 1]
+   * MOV MEM64 [address], REG64 value
+   *
+   * X86:
+   * PUSHFD
+   * ADD MEM32 [counter], 1
+   * ADC MEM32 [counter + 4], 0
+   * POPFD
+   */
+  std::vector<std::unique_ptr<RelocatableInst>>
+  generate(const Patch *patch, TempManager *temp_manager,
+           Patch *toMerge) const override;
+};
+
+class UpdateCoverage : public AutoClone<PatchGenerator, UpdateCoverage> {
+
+  Temp address;
+  Temp index;
+  Constant bitmap;
+  Constant curLoc;
+  Constant prevLoc;
+
+public:
+  /*! Increment the entry of a coverage bitmap. If prevLoc isn't null, the
+   * entry is the edge between the previous location and curLoc, and curLoc is
+   * stored as the new previous location (AFL style). Otherwise, the entry is
+   * curLoc. The flags are saved on the stack, below the red zone on X86_64.
+   *
+   * @param[in] address  A temporary for the addresses.
+   * @param[in] index    A temporary for the index of the edge.
+   * @param[in] bitmap   The address of the bitmap.
+   * @param[in] curLoc   The location of the current basic block.
+   * @param[in] prevLoc  The address of the previous location, or 0.
+   */
+  UpdateCoverage(Temp address, Temp index, Constant bitmap, Constant curLoc,
+                 Constant prevLoc)
+      : address(address), index(index), bitmap(bitmap), curLoc(curLoc),
+        prevLoc(prevLoc) {}
+
+  /*! Output:
+   *
+   * LEA RSP, [RSP - 128] # X86_64 only
+   * PUSHF
+   * If prevLoc:
+   *   MOV REG address, IMM prevLoc
+   *   MOV REG index, MEM [address]
+   *   XOR REG index, IMM curLoc
+   *   MOV MEM [address], IMM (curLoc >> 1)
+   *   MOV REG address, IMM bitmap
+   *   ADD MEM8 [address + index], 1
+   * Else:
+   *   MOV REG address, IMM (bitmap + curLoc)
+   *   ADD MEM8 [address], 1
+   * POPF
+   * LEA RSP, [RSP + 128] # X86_64 only
+   */
+  std::vector<std::unique_ptr<RelocatableInst>>
+  generate(const Patch *patch, TempManager *temp_manager,
+           Patch *toMerge) const override;
+};
+
+/*! An entry of the memory trace written by WriteMemoryTrace
+ */
+struct MemoryTraceRecord {
+  enum Source {
+    READ_ACCESS,  // The address and the value of the read access index
+    WRITE_ACCESS, // The address and the value of the write access
+    SHADOW_WRITE, // The write access with the address in the shadow index
+  } source;
+  uint16_t index;
+  bool withValue;
+  uint16_t size;
+  uint16_t type;
+  uint16_t flags;
+};
+
+class WriteMemoryTrace : public AutoClone<PatchGenerator, WriteMemoryTrace> {
+
+  Temp entry;
+  Temp value;
+  Constant current;
+  Constant limit;
+  Constant buffer;
+  std::vector<MemoryTraceRecord> records;
+  Constant pc;
+
+public:
+  /*! Append some entries to the memory trace buffer. When the buffer reaches
+   * its limit, break to the host with the flushMemoryTrace callback.
+   *
+   * @param[in] entry    A temporary for the address of the entry.
+   * @param[in] value    A temporary for the fields of the entry.
+   * @param[in] current  The address of the current entry of the buffer.
+   * @param[in] limit    The limit of the current entry.
+   * @param[in] buffer   The MemoryTraceBuffer given to flushMemoryTrace.
+   * @param[in] records  The entries to append, at most
+   *                     MEMORY_TRACE_MAX_ENTRIES.
+   * @param[in] pc       The value of PC in the context when breaking to the
+   *                     host, or 0 to keep the value set by the instruction.
+   */
+  WriteMemoryTrace(Temp entry, Temp value, Constant current, Constant limit,
+                   Constant buffer, std::vector<MemoryTraceRecord> records,
+                   Constant pc)
+      : entry(entry), value(value), current(current), limit(limit),
+        buffer(buffer), records(std::move(records)), pc(pc) {}
+
+  /*! Output:
+   *
+   * MOV REG entry, IMM current
+   * MOV REG entry, MEM [entry]
+   * For each record:
+   *   MOV REG value, IMM address of the instruction
+   *   MOV MEM [entry], REG value
+   *   <address of the access in value>
+   *   MOV MEM [entry + 1 * rword], REG value
+   *   <value of the access in value>
+   *   MOV MEM [entry + 2 * rword], REG value
+   *   MOV MEM32 [entry + 3 * rword], IMM (size | type << 16)
+   *   MOV MEM32 [entry + 3 * rword + 4], IMM flags
+   *   LEA REG entry, [entry + sizeof(MemoryTraceEntry)]
+   * MOV REG value, IMM current
+   * MOV MEM [value], REG entry
+   * MOV REG value, IMM limit
+   * LEA RSP, [RSP - 128] # X86_64 only
+   * PUSHF
+   * CMP REG entry, REG value
+   * JAE flush
+   * POPF
+   * LEA RSP, [RSP + 128] # X86_64 only
+   * JMP end
+   * flush:
+   * POPF
+   * LEA RSP, [RSP + 128] # X86_64 only
+   * <callback flushMemoryTrace with the data buffer>
+   * <restore entry and break to host>
+   * end:
+   */
+  std::vector<std::unique_ptr<RelocatableInst>>
+  generate(const Patch *patch, TempManager *temp_manager,
+           Patch *toMerge) const override;
+};
+
+class WriteCallTrace : public AutoClone<PatchGenerator, WriteCallTrace> {
+
+  Temp entry;
+  Temp value;
+  Constant current;
+  Constant limit;
+  Constant buffer;
+  Constant target;
+  uint32_t nbArgs;
+
+public:
+  /*! Append a call to the call trace buffer, after the call. When the buffer
+   * reaches its limit, break to the host with the flushCallTrace callback.
+   * The arguments are read in the registers of the ABI of the platform on
+   * X86_64 and on the stack on X86.
+   *
+   * @param[in] entry    A temporary for the address of the entry.
+   * @param[in] value    A temporary for the fields of the entry.
+   * @param[in] current  The address of the current entry of the buffer.
+   * @param[in] limit    The limit of the current entry.
+   * @param[in] buffer   The CallTraceBuffer given to flushCallTrace.
+   * @param[in] target   The target of a direct call, 0 to read the target in
+   *                     the PC of the context.
+   * @param[in] nbArgs   The number of arguments, at most
+   *                     QBDI_CALL_TRACE_MAX_ARGS.
+   */
+  WriteCallTrace(Temp entry, Temp value, Constant current, Constant limit,
+                 Constant buffer, Constant target, uint32_t nbArgs)
+      : entry(entry), value(value), current(current), limit(limit),
+        buffer(buffer), target(target), nbArgs(nbArgs) {}
+
+  /*! Output:
+   *
+   * MOV REG entry, IMM current
+   * MOV REG entry, MEM [entry]
+   * MOV REG value, IMM address of the call
+   * MOV MEM [entry], REG value
+   * MOV REG value, IMM target | MOV REG value, MEM DataBlock[Offset(PC)]
+   * MOV MEM [entry + 1 * rword], REG value
+   * MOV MEM [entry + 2 * rword], IMM nbArgs
+   * For each argument:
+   *   MOV MEM [entry + (3 + i) * rword], REG argument
+   *   # or, for an argument in a temporary or on the stack
+   *   MOV REG value, MEM argument
+   *   MOV MEM [entry + (3 + i) * rword], REG value
+   * LEA REG entry, [entry + sizeof(CallTraceEntry)]
+   * <update current and compare with the limit, see WriteMemoryTrace>
+   * <callback flushCallTrace with the data buffer>
+   * <restore entry and break to host>
+   * end:
+   */
+  std::vector<std::unique_ptr<RelocatableInst>>
+  generate(const Patch *patch, TempManager *temp_manager,
+           Patch *toMerge) const override;
+};
+
+class CountPageAccess : public AutoClone<PatchGenerator, CountPageAccess> {
+
+  Temp address;
+  Temp leaf;
+  Temp index;
+  Constant directory;
+  Constant missAddress;
+  Constant histogram;
+  Constant pc;
+
+public:
+  /*! Increment the counter of the page of a memory access in the page
+   * histogram. When the leaf of the page isn't allocated, write the address
+   * in missAddress and break to the host with the countPageMiss callback.
+   *
+   * @param[in] address      A temporary with the address of the access.
+   * @param[in] leaf         A temporary for the address of the leaf.
+   * @param[in] index        A temporary for the index of the page.
+   * @param[in] directory    The address of the directory of the leaves.
+   * @param[in] missAddress  The address where the address of the access is
+   *                         written when the leaf is missing.
+   * @param[in] histogram    The PageHistogram given to countPageMiss.
+   * @param[in] pc           The value of PC in the context when breaking to
+   *                         the host, or 0 to keep the value set by the
+   *                         instruction.
+   */
+  CountPageAccess(Temp address, Temp leaf, Temp index, Constant directory,
+                  Constant missAddress, Constant histogram, Constant pc)
+      : address(address), leaf(leaf), index(index), directory(directory),
+        missAddress(missAddress), histogram(histogram), pc(pc) {}
+
+  /*! Output:
+   *
+   * LEA RSP, [RSP - 128] # X86_64 only
+   * PUSHF
+   * MOV REG leaf, REG address
+   * SHR REG leaf, 30
+   * AND REG leaf, IMM (PAGE_HISTOGRAM_DIRECTORY_SIZE - 1)
+   * MOV REG index, IMM directory
+   * MOV REG leaf, MEM [index + leaf * rword]
+   * TEST REG leaf, REG leaf
+   * JE miss
+   * MOV REG index, REG address
+   * SHR REG index, 12
+   * AND REG index, IMM (PAGE_HISTOGRAM_LEAF_SIZE - 1)
+   * ADD MEM64 [leaf + index * 8], 1 # X86_64
+   * ADD MEM32 [leaf + index * 8], 1 # X86
+   * ADC MEM32 [leaf + index * 8 + 4], 0 # X86
+   * POPF
+   * LEA RSP, [RSP + 128] # X86_64 only
+   * JMP end
+   * miss:
+   * POPF
+   * LEA RSP, [RSP + 128] # X86_64 only
+   * MOV REG index, IMM missAddress
+   * MOV MEM [index], REG address
+   * <callback countPageMiss with the data histogram>
+   * <restore leaf, address, index and break to host>
+   * end:
+   *
+   * The flags are only saved if they are live.
+   */
+  std::vector<std::unique_ptr<RelocatableInst>>
+  generate(const Patch *patch, TempManager *temp_manager,
+           Patch *toMerge) const override;
+};
+
+class CheckOwnership : public AutoClone<PatchGenerator, CheckOwnership> {
+
+  Temp address;
+  Temp leaf;
+  Temp index;
+  Constant directory;
+  Constant thread;
+  Constant missAddress;
+  Constant callback;
+  Constant filter;
+  Constant pc;
+
+public:
+  /*! Compare the owner of the granule of a memory access with the thread of
+   * an ownership filter. When the leaf of the granule isn't allocated or the
+   * owner is another thread, write the address in missAddress and break to
+   * the host with the callback.
+   *
+   * @param[in] address      A temporary with the address of the access.
+   * @param[in] leaf         A temporary for the address of the leaf.
+   * @param[in] index        A temporary for the index of the granule.
+   * @param[in] directory    The address of the directory of the leaves.
+   * @param[in] thread       The identifier of the thread of the filter.
+   * @param[in] missAddress  The address where the address of the access is
+   *                         written before the break to the host.
+   * @param[in] callback     The InstCallback of the break to the host.
+   * @param[in] filter       The OwnershipFilter given to the callback.
+   * @param[in] pc           The value of PC in the context when breaking to
+   *                         the host.
+   */
+  CheckOwnership(Temp address, Temp leaf, Temp index, Constant directory,
+                 Constant thread, Constant missAddress, Constant callback,
+                 Constant filter, Constant pc)
+      : address(address), leaf(leaf), index(index), directory(directory),
+        thread(thread), missAddress(missAddress), callback(callback),
+        filter(filter), pc(pc) {}
+
+  /*! Output:
+   *
+   * LEA RSP, [RSP - 128] # X86_64 only
+   * PUSHF
+   * MOV REG leaf, REG address
+   * SHR REG leaf, 26 # 24 on X86
+   * AND REG leaf, IMM (OWNERSHIP_DIRECTORY_SIZE - 1)
+   * MOV REG index, IMM directory
+   * MOV REG leaf, MEM [index + leaf * rword]
+   * TEST REG leaf, REG leaf
+   * JE miss
+   * MOV REG index, REG address
+   * SHR REG index, 3
+   * AND REG index, IMM (OWNERSHIP_LEAF_SIZE - 1)
+   * CMP MEM32 [leaf + index * 4], IMM thread
+   * JNE miss
+   * POPF
+   * LEA RSP, [RSP + 128] # X86_64 only
+   * JMP end
+   * miss:
+   * POPF
+   * LEA RSP, [RSP + 128] # X86_64 only
+   * MOV REG index, IMM missAddress
+   * MOV MEM [index], REG address
+   * <callback with the data filter>
+   * <restore leaf, address, index and break to host>
+   * end:
+   *
+   * The flags are only saved if they are live.
+   */
+  std::vector<std::unique_ptr<RelocatableInst>>
+  generate(const Patch *patch, TempManager *temp_manager,
+           Patch *toMerge) const override;
+};
+
+class ConsumeBudget : public AutoClone<PatchGenerator, ConsumeBudget> {
+
+  Temp value;
+  Temp count;
+  Temp address;
+  Constant remaining;
+  Constant instCount;
+  Constant cbk;
+  Constant data;
+  Constant pc;
+
+public:
+  /*! Subtract the number of instructions of a sequence from a budget. When
+   * the budget is lower than the number of instructions, keep the budget and
+   * break to the host with a callback.
+   *
+   * @param[in] value      A temporary for the budget.
+   * @param[in] count      A temporary for the number of instructions.
+   * @param[in] address    A temporary for the address of the budget.
+   * @param[in] remaining  The address of the budget.
+   * @param[in] instCount  The number of instructions of the sequence.
+   * @param[in] cbk        The callback of an exhausted budget.
+   * @param[in] data       The data of the callback.
+   * @param[in] pc         The value of PC in the context when breaking to the
+   *                       host.
+   */
+  ConsumeBudget(Temp value, Temp count, Temp address, Constant remaining,
+                Constant instCount, Constant cbk, Constant data, Constant pc)
+      : value(value), count(count), address(address), remaining(remaining),
+        instCount(instCount), cbk(cbk), data(data), pc(pc) {}
+
+  /*! Output:
+   *
+   * LEA RSP, [RSP - 128] # X86_64 only
+   * PUSHF
+   * MOV REG address, IMM remaining
+   * MOV REG value, MEM [address]
+   * MOV REG count, IMM instCount
+   * SUB REG value, REG count
+   * JB exhausted
+   * MOV MEM [address], REG value
+   * POPF
+   * LEA RSP, [RSP + 128] # X86_64 only
+   * JMP end
+   * exhausted:
+   * POPF
+   * LEA RSP, [RSP + 128] # X86_64 only
+   * <callback cbk with data>
+   * <restore value, count, address and break to host>
+   * end:
+   *
+   * The flags are only saved if they are live.
+   */
+  std::vector<std::unique_ptr<RelocatableInst>>
+  generate(const Patch *patch, TempManager *temp_manager,
+           Patch *toMerge) const override;
+};
+
+class FlagCallback : public AutoClone<PatchGenerator, FlagCallback> {
+
+  Temp value;
+  Temp address;
+  Constant flag;
+  Constant cbk;
+  Constant data;
+  Constant pc;
+
+public:
+  /*! Break to the host with a callback only if a flag in memory isn't 0.
+   *
+   * @param[in] value    A temporary for the value of the flag.
+   * @param[in] address  A temporary for the address of the flag.
+   * @param[in] flag     The address of the flag, a rword.
+   * @param[in] cbk      The callback.
+   * @param[in] data     The data of the callback.
+   * @param[in] pc       The value of PC in the context when breaking to the
+   *                     host, or 0 to keep the value set by the instruction.
+   */
+  FlagCallback(Temp value, Temp address, Constant flag, Constant cbk,
+               Constant data, Constant pc)
+      : value(value), address(address), flag(flag), cbk(cbk), data(data),
+        pc(pc) {}
+
+  /*! Output:
+   *
+   * LEA RSP, [RSP - 128] # X86_64 only
+   * PUSHF
+   * MOV REG address, IMM flag
+   * MOV REG value, MEM [address]
+   * TEST REG value, REG value
+   * JNE set
+   * POPF
+   * LEA RSP, [RSP + 128] # X86_64 only
+   * JMP end
+   * set:
+   * POPF
+   * LEA RSP, [RSP + 128] # X86_64 only
+   * <callback cbk with data>
+   * <restore value, address and break to host>
+   * end:
+   *
+   * The flags are only saved if they are live.
+   */
+  std::vector<std::unique_ptr<RelocatableInst>>
+  generate(const Patch *patch, TempManager *temp_manager,
+           Patch *toMerge) const override;
+};
+
+class PredicateCallback : public AutoClone<PatchGenerator, PredicateCallback> {
+
+  Temp value;
+  Temp bound;
+  Temp address;
+  CallbackPredicate predicate;
+  Constant counter;
+  Constant cbk;
+  Constant data;
+  Constant pc;
+
+public:
+  /*! Break to the host with a callback only if a predicate holds. The
+   * predicate is evaluated by the generated code.
+   *
+   * @param[in] value      A temporary for the tested value.
+   * @param[in] bound      A temporary for the bound of the test.
+   * @param[in] address    A temporary for the address of the counter
+   *                       (PREDICATE_COUNTER and PREDICATE_SAMPLE only).
+   * @param[in] predicate  The predicate to evaluate.
+   * @param[in] counter    The address of the counter (PREDICATE_COUNTER) or
+   *                       of the countdown (PREDICATE_SAMPLE).
+   * @param[in] cbk        The callback.
+   * @param[in] data       The data of the callback.
+   * @param[in] pc         The value of PC in the context when breaking to the
+   *                       host, or 0 to keep the value set by the instruction.
+   */
+  PredicateCallback(Temp value, Temp bound, Temp address,
+                    const CallbackPredicate &predicate, Constant counter,
+                    Constant cbk, Constant data, Constant pc)
+      : value(value), bound(bound), address(address), predicate(predicate),
+        counter(counter), cbk(cbk), data(data), pc(pc) {}
+
+  /*! Output:
+   *
+   * PREDICATE_REG_*:
+   *   MOV REG value, REG reg
+   *   MOV REG bound, IMM predicate.value
+   * PREDICATE_MEM_IN_RANGE:
+   *   <address of the access in value>
+   *   MOV REG bound, IMM -predicate.value
+   *   LEA REG value, [value + bound]
+   *   MOV REG bound, IMM (predicate.end - predicate.value)
+   * PREDICATE_COUNTER:
+   *   MOV REG address, IMM counter
+   *   MOV REG value, MEM [address]
+   *   LEA REG value, [value + 1]
+   *   MOV REG bound, IMM predicate.value
+   * PREDICATE_SAMPLE:
+   *   MOV REG address, IMM counter
+   *   MOV REG value, MEM [address]
+   *   MOV REG bound, IMM -1
+   *   LEA REG value, [value + bound]
+   *   MOV REG bound, IMM 0
+   * LEA RSP, [RSP - 128] # X86_64 only
+   * PUSHF
+   * CMP REG value, REG bound
+   * PREDICATE_COUNTER:
+   *   MOV REG bound, IMM 0
+   *   CMOVAE REG value, REG bound
+   * PREDICATE_COUNTER and PREDICATE_SAMPLE:
+   *   MOV MEM [address], REG value
+   * J<not predicate> skip
+   * POPF
+   * LEA RSP, [RSP + 128] # X86_64 only
+   * <callback cbk with data>
+   * <restore value and address, and break to host>
+   * JMP end
+   * skip:
+   * POPF
+   * LEA RSP, [RSP + 128] # X86_64 only
+   * end:
+   */
+  std::vector<std::unique_ptr<RelocatableInst>>
+  generate(const Patch *patch, TempManager *temp_manager,
+           Patch *toMerge) const override;
+};
+
+class DirectCallback : public AutoClone<PatchGenerator, DirectCallback> {
+
+  Constant cbk;
+  Constant data;
+  Constant vm;
+  Constant pc;
+  CallbackFootprint footprint;
+
+public:
+  /*! Call a callback from the generated code on the host stack, without
+   * breaking to the host. Only the registers clobbered by the call, SP, PC,
+   * the flags and the registers of the footprint are saved in the context
+   * and reloaded after the call. The generated code only breaks to the host
+   * if the callback doesn't return CONTINUE.
+   *
+   * @param[in] cbk        The callback.
+   * @param[in] data       The data of the callback.
+   * @param[in] vm         The address of the VMInstanceRef given to the
+   *                       callback.
+   * @param[in] pc         The value of PC in the context during the call, or
+   *                       0 to keep the value set by the instruction.
+   * @param[in] footprint  The registers used by the callback.
+   */
+  DirectCallback(Constant cbk, Constant data, Constant vm, Constant pc,
+                 CallbackFootprint footprint)
+      : cbk(cbk), data(data), vm(vm), pc(pc), footprint(footprint) {}
+
+  /*! Output (X86_64 System V):
+   *
+   * MOV MEM64 DataBlock[Offset(RAX)], RAX
+   * LEA RSP, [RSP - 128]
+   * PUSHF
+   * POP RAX
+   * LEA RSP, [RSP + 128]
+   * MOV MEM64 DataBlock[Offset(EFLAGS)], RAX
+   * <save the clobbered registers, the footprint and RSP>
+   * <set PC in the context>
+   * MOV RDI, IMM vm
+   * MOV RDI, MEM64 [RDI]
+   * LEA RSI, DataBlock[Offset(gprState)]
+   * LEA RDX, DataBlock[Offset(fprState)]
+   * MOV RCX, IMM data
+   * MOV RSP, MEM64 DataBlock[Offset(hostState.sp)]
+   * AND RSP, -16
+   * CLD
+   * MOV RAX, IMM cbk
+   * CALL RAX
+   * MOV MEM64 DataBlock[Offset(hostState.data)], RAX
+   * <reload RSP, the clobbered registers and the footprint>
+   * MOV RAX, MEM64 DataBlock[Offset(hostState.data)]
+   * TEST RAX, -1
+   * JNE action
+   * <restore the flags and RAX>
+   * JMP end
+   * action:
+   * <restore the flags>
+   * <break to host with a callback returning the action>
+   * end:
+   */
+  std::vector<std::unique_ptr<RelocatableInst>>
+  generate(const Patch *patch, TempManager *temp_manager,
+           Patch *toMerge) const override;
+};
+
 } // namespace QBDI
 
 #endif
@@ -17,6 +17,7 @@
  */
 #include <algorithm>
 #include <stddef.h>
+#include <utility>
 #include <vector>
 
 #include "X86InstrInfo.h"
@@ -24,6 +25,7 @@
 #include "QBDI/Config.h"
 #include "QBDI/Options.h"
 #include "QBDI/State.h"
+#include "Engine/LLVMCPU.h"
 #include "ExecBlock/Context.h"
 #include "Patch/InstTransform.h"
 #include "Patch/PatchCondition.h"
@@ -37,118 +39,161 @@
 #include "Patch/X86_64/Layer2_X86_64.h"
 #include "Patch/X86_64/PatchGenerator_X86_64.h"
 #include "Patch/X86_64/PatchRules_X86_64.h"
+#include "Patch/X86_64/RelocatableInst_X86_64.h"
 #include "Utility/LogSys.h"
 #include "Utility/System.h"
 
 namespace QBDI {
 
-RelocatableInst::UniquePtrVec getExecBlockPrologue(Options opts) {
-  RelocatableInst::UniquePtrVec prologue;
+namespace {
+
+// Upper halves of the YMM registers and their slot in the FPRState
+struct YMMSlot {
+  unsigned int reg;
+  size_t offset;
+};
+
+const YMMSlot lowYMM[] = {
+    {llvm::X86::YMM0, offsetof(FPRState, ymm0)},
+    {llvm::X86::YMM1, offsetof(FPRState, ymm1)},
+    {llvm::X86::YMM2, offsetof(FPRState, ymm2)},
+    {llvm::X86::YMM3, offsetof(FPRState, ymm3)},
+    {llvm::X86::YMM4, offsetof(FPRState, ymm4)},
+    {llvm::X86::YMM5, offsetof(FPRState, ymm5)},
+    {llvm::X86::YMM6, offsetof(FPRState, ymm6)},
+    {llvm::X86::YMM7, offsetof(FPRState, ymm7)},
+};
 
-  // Save host SP
-  append(prologue,
-         SaveReg(Reg(REG_SP), Offset(offsetof(Context, hostState.sp))));
-  // Restore FPR
-  if ((opts & Options::OPT_DISABLE_FPR) == 0) {
-    if ((opts & Options::OPT_DISABLE_OPTIONAL_FPR) == 0) {
-      append(
-          prologue,
-          LoadReg(Reg(0), Offset(offsetof(Context, hostState.executeFlags))));
-      prologue.push_back(Test(Reg(0), ExecBlockFlags::needFPU));
-      prologue.push_back(Je(7 + 4));
-    }
-    prologue.push_back(Fxrstor(Offset(offsetof(Context, fprState))));
-    // target je needFPU
-    if (isHostCPUFeaturePresent("avx")) {
-      QBDI_DEBUG("AVX support enabled in guest context switches");
-      // don't restore if not needed
-      if ((opts & Options::OPT_DISABLE_OPTIONAL_FPR) == 0) {
-        prologue.push_back(Test(Reg(0), ExecBlockFlags::needAVX));
-        if constexpr (is_x86_64)
-          prologue.push_back(Je(16 * 10 + 4));
-        else
-          prologue.push_back(Je(8 * 10 + 4));
-      }
-      prologue.push_back(Vinsertf128(
-          llvm::X86::YMM0,
-          Offset(offsetof(Context, fprState) + offsetof(FPRState, ymm0)), 1));
-      prologue.push_back(Vinsertf128(
-          llvm::X86::YMM1,
-          Offset(offsetof(Context, fprState) + offsetof(FPRState, ymm1)), 1));
-      prologue.push_back(Vinsertf128(
-          llvm::X86::YMM2,
-          Offset(offsetof(Context, fprState) + offsetof(FPRState, ymm2)), 1));
-      prologue.push_back(Vinsertf128(
-          llvm::X86::YMM3,
-          Offset(offsetof(Context, fprState) + offsetof(FPRState, ymm3)), 1));
-      prologue.push_back(Vinsertf128(
-          llvm::X86::YMM4,
-          Offset(offsetof(Context, fprState) + offsetof(FPRState, ymm4)), 1));
-      prologue.push_back(Vinsertf128(
-          llvm::X86::YMM5,
-          Offset(offsetof(Context, fprState) + offsetof(FPRState, ymm5)), 1));
-      prologue.push_back(Vinsertf128(
-          llvm::X86::YMM6,
-          Offset(offsetof(Context, fprState) + offsetof(FPRState, ymm6)), 1));
-      prologue.push_back(Vinsertf128(
-          llvm::X86::YMM7,
-          Offset(offsetof(Context, fprState) + offsetof(FPRState, ymm7)), 1));
 #if defined(QBDI_ARCH_X86_64)
-      prologue.push_back(Vinsertf128(
-          llvm::X86::YMM8,
-          Offset(offsetof(Context, fprState) + offsetof(FPRState, ymm8)), 1));
-      prologue.push_back(Vinsertf128(
-          llvm::X86::YMM9,
-          Offset(offsetof(Context, fprState) + offsetof(FPRState, ymm9)), 1));
-      prologue.push_back(Vinsertf128(
-          llvm::X86::YMM10,
-          Offset(offsetof(Context, fprState) + offsetof(FPRState, ymm10)), 1));
-      prologue.push_back(Vinsertf128(
-          llvm::X86::YMM11,
-          Offset(offsetof(Context, fprState) + offsetof(FPRState, ymm11)), 1));
-      prologue.push_back(Vinsertf128(
-          llvm::X86::YMM12,
-          Offset(offsetof(Context, fprState) + offsetof(FPRState, ymm12)), 1));
-      prologue.push_back(Vinsertf128(
-          llvm::X86::YMM13,
-          Offset(offsetof(Context, fprState) + offsetof(FPRState, ymm13)), 1));
-      prologue.push_back(Vinsertf128(
-          llvm::X86::YMM14,
-          Offset(offsetof(Context, fprState) + offsetof(FPRState, ymm14)), 1));
-      prologue.push_back(Vinsertf128(
-          llvm::X86::YMM15,
-          Offset(offsetof(Context, fprState) + offsetof(FPRState, ymm15)), 1));
+const YMMSlot highYMM[] = {
+    {llvm::X86::YMM8, offsetof(FPRState, ymm8)},
+    {llvm::X86::YMM9, offsetof(FPRState, ymm9)},
+    {llvm::X86::YMM10, offsetof(FPRState, ymm10)},
+    {llvm::X86::YMM11, offsetof(FPRState, ymm11)},
+    {llvm::X86::YMM12, offsetof(FPRState, ymm12)},
+    {llvm::X86::YMM13, offsetof(FPRState, ymm13)},
+    {llvm::X86::YMM14, offsetof(FPRState, ymm14)},
+    {llvm::X86::YMM15, offsetof(FPRState, ymm15)},
+};
 #endif // QBDI_ARCH_X86_64
-       // target je needAVX
+
+// The trampolines address the Context with its pointer in Reg(0) and keep
+// the executeFlags in Reg(5)
+constexpr unsigned int flagsReg = 5;
+
+// Append a section of a trampoline. When guarded, the section is skipped if
+// the flag isn't set in the executeFlags.
+void appendSection(RelocatableInst::UniquePtrVec &trampoline,
+                   std::vector<llvm::MCInst> &&section, bool guarded,
+                   unsigned int flag, const LLVMCPU &llvmcpu) {
+  if (guarded) {
+    int32_t sectionSize = 0;
+    for (const llvm::MCInst &inst : section) {
+      sectionSize += llvmcpu.getInstSize(inst);
     }
+    trampoline.push_back(Test(Reg(flagsReg), flag));
+    trampoline.push_back(Je(sectionSize + 4));
+  }
+  for (llvm::MCInst &inst : section) {
+    trampoline.push_back(NoReloc::unique(std::move(inst)));
+  }
+}
+
+void appendLoadFlags(RelocatableInst::UniquePtrVec &trampoline) {
+  trampoline.push_back(NoReloc::unique(
+      movrm(Reg(flagsReg), Reg(0), 1, 0,
+            offsetof(Context, hostState.executeFlags), 0)));
+}
+
+// Restore (or save) the FPR of the guest
+void appendFPR(RelocatableInst::UniquePtrVec &trampoline, Options opts,
+               bool restore, const LLVMCPU &llvmcpu) {
+  if ((opts & Options::OPT_DISABLE_FPR) != 0) {
+    return;
   }
+  // don't switch the registers if not needed
+  bool guarded = (opts & Options::OPT_DISABLE_OPTIONAL_FPR) == 0;
+  if (guarded) {
+    appendLoadFlags(trampoline);
+  }
+  if (restore) {
+    appendSection(trampoline, {fxrstor(Reg(0), offsetof(Context, fprState))},
+                  guarded, ExecBlockFlags::needFPU, llvmcpu);
+  } else {
+    appendSection(trampoline, {fxsave(Reg(0), offsetof(Context, fprState))},
+                  guarded, ExecBlockFlags::needFPU, llvmcpu);
+  }
+  if (not isHostCPUFeaturePresent("avx")) {
+    return;
+  }
+  QBDI_DEBUG("AVX support enabled in guest context switches");
+  auto upperHalves = [&](const YMMSlot(&slots)[8]) {
+    std::vector<llvm::MCInst> section;
+    for (const YMMSlot &slot : slots) {
+      rword offset = offsetof(Context, fprState) + slot.offset;
+      if (restore) {
+        section.push_back(vinsertf128(slot.reg, Reg(0), offset, 1));
+      } else {
+        section.push_back(vextractf128(Reg(0), offset, slot.reg, 1));
+      }
+    }
+    return section;
+  };
+  appendSection(trampoline, upperHalves(lowYMM), guarded,
+                ExecBlockFlags::needAVX, llvmcpu);
 #if defined(QBDI_ARCH_X86_64)
-  // if enable FS GS
-  if ((opts & Options::OPT_ENABLE_FS_GS) == Options::OPT_ENABLE_FS_GS) {
-    QBDI_REQUIRE_ACTION(isHostCPUFeaturePresent("fsgsbase"), abort());
-
-    append(prologue,
-           LoadReg(Reg(0), Offset(offsetof(Context, hostState.executeFlags))));
-    prologue.push_back(Test(Reg(0), ExecBlockFlags::needFSGS));
-    prologue.push_back(Je(5 * 4 + 7 * 4 + 4));
-
-    append(prologue, LoadReg(Reg(3), Offset(offsetof(Context, gprState.fs))));
-    append(prologue, LoadReg(Reg(4), Offset(offsetof(Context, gprState.gs))));
-    prologue.push_back(Rdfsbase(Reg(1)));
-    prologue.push_back(Rdgsbase(Reg(2)));
-    prologue.push_back(Wrfsbase(Reg(3)));
-    prologue.push_back(Wrgsbase(Reg(4)));
-    append(prologue, SaveReg(Reg(1), Offset(offsetof(Context, hostState.fs))));
-    append(prologue, SaveReg(Reg(2), Offset(offsetof(Context, hostState.gs))));
+  // the upper halves of YMM8-YMM15 are only used by a part of the AVX code
+  appendSection(trampoline, upperHalves(highYMM), guarded,
+                ExecBlockFlags::needAVXHigh, llvmcpu);
+#endif // QBDI_ARCH_X86_64
+}
+
+#if defined(QBDI_ARCH_X86_64)
+// Swap the FS and GS bases of the host and the guest
+void appendFSGS(RelocatableInst::UniquePtrVec &trampoline, Options opts,
+                bool restore, const LLVMCPU &llvmcpu) {
+  if ((opts & Options::OPT_ENABLE_FS_GS) != Options::OPT_ENABLE_FS_GS) {
+    return;
   }
+  QBDI_REQUIRE_ACTION(isHostCPUFeaturePresent("fsgsbase"), abort());
+
+  rword loadFS = offsetof(Context, hostState.fs);
+  rword loadGS = offsetof(Context, hostState.gs);
+  rword saveFS = offsetof(Context, gprState.fs);
+  rword saveGS = offsetof(Context, gprState.gs);
+  if (restore) {
+    std::swap(loadFS, saveFS);
+    std::swap(loadGS, saveGS);
+  }
+  appendLoadFlags(trampoline);
+  appendSection(trampoline,
+                {movrm(Reg(3), Reg(0), 1, 0, loadFS, 0),
+                 movrm(Reg(4), Reg(0), 1, 0, loadGS, 0), rdfsbase64(Reg(1)),
+                 rdgsbase64(Reg(2)), wrfsbase64(Reg(3)), wrgsbase64(Reg(4)),
+                 movmr(Reg(0), 1, 0, saveFS, 0, Reg(1)),
+                 movmr(Reg(0), 1, 0, saveGS, 0, Reg(2))},
+                true, ExecBlockFlags::needFSGS, llvmcpu);
+}
 #endif // QBDI_ARCH_X86_64
-  // Restore EFLAGS
-  append(prologue, LoadReg(Reg(0), Offset(offsetof(Context, gprState.eflags))));
-  prologue.push_back(Pushr(Reg(0)));
-  prologue.push_back(Popf());
-  // Restore GPR
-  for (unsigned int i = 0; i < NUM_GPR - 1; i++)
-    append(prologue, LoadReg(Reg(i), Offset(Reg(i))));
+
+// Load the address of the Context in Reg(0)
+RelocatableInst::UniquePtr LoadContext() {
+  return DataBlockRelx86(lea(Reg(0), 0, 1, 0, 0, 0), 1, 0, 7);
+}
+
+} // anonymous namespace
+
+RelocatableInst::UniquePtrVec getExecBlockPrologue(Options opts) {
+  RelocatableInst::UniquePtrVec prologue;
+
+  // Call the shared prologue, it saves the host SP and restores the guest
+  // state but Reg(0) and SP
+  prologue.push_back(LoadContext());
+  prologue.push_back(NoReloc::unique(
+      movrm(Reg(2), Reg(0), 1, 0, offsetof(Context, hostState.prologue), 0)));
+  prologue.push_back(NoReloc::unique(callr(Reg(2))));
+  append(prologue, LoadReg(Reg(REG_SP), Offset(Reg(REG_SP))));
+  append(prologue, LoadReg(Reg(0), Offset(Reg(0))));
   // Jump selector
   prologue.push_back(JmpM(Offset(offsetof(Context, hostState.selector))));
 
@@ -158,110 +203,67 @@ RelocatableInst::UniquePtrVec getExecBlockPrologue(Options opts) {
 RelocatableInst::UniquePtrVec getExecBlockEpilogue(Options opts) {
   RelocatableInst::UniquePtrVec epilogue;
 
-  // Save GPR
-  for (unsigned int i = 0; i < NUM_GPR - 1; i++)
-    append(epilogue, SaveReg(Reg(i), Offset(Reg(i))));
+  // Save Reg(0) and jump to the shared epilogue, it returns to the host
+  append(epilogue, SaveReg(Reg(0), Offset(Reg(0))));
+  epilogue.push_back(LoadContext());
+  epilogue.push_back(
+      NoReloc::unique(jmpm(Reg(0), offsetof(Context, hostState.epilogue))));
+
+  return epilogue;
+}
+
+RelocatableInst::UniquePtrVec getTrampolinePrologue(Options opts,
+                                                    const LLVMCPU &llvmcpu) {
+  RelocatableInst::UniquePtrVec prologue;
+
+  // Save host SP, as it was before the call of the ExecBlock prologue
+  prologue.push_back(
+      NoReloc::unique(lea(Reg(2), Reg(REG_SP), 1, 0, sizeof(rword), 0)));
+  prologue.push_back(NoReloc::unique(
+      movmr(Reg(0), 1, 0, offsetof(Context, hostState.sp), 0, Reg(2))));
+  // Restore FPR
+  appendFPR(prologue, opts, true, llvmcpu);
+#if defined(QBDI_ARCH_X86_64)
+  // if enable FS GS
+  appendFSGS(prologue, opts, true, llvmcpu);
+#endif // QBDI_ARCH_X86_64
+  // Restore EFLAGS
+  prologue.push_back(NoReloc::unique(
+      movrm(Reg(1), Reg(0), 1, 0, offsetof(Context, gprState.eflags), 0)));
+  prologue.push_back(Pushr(Reg(1)));
+  prologue.push_back(Popf());
+  // Restore GPR, Reg(0) and SP are restored by the ExecBlock prologue
+  for (unsigned int i = 1; i < REG_SP; i++)
+    prologue.push_back(
+        NoReloc::unique(movrm(Reg(i), Reg(0), 1, 0, Reg(i).offset(), 0)));
+  // return to the ExecBlock prologue
+  prologue.push_back(Ret());
+
+  return prologue;
+}
+
+RelocatableInst::UniquePtrVec getTrampolineEpilogue(Options opts,
+                                                    const LLVMCPU &llvmcpu) {
+  RelocatableInst::UniquePtrVec epilogue;
+
+  // Save GPR, Reg(0) is saved by the ExecBlock epilogue
+  for (unsigned int i = 1; i < NUM_GPR - 1; i++)
+    epilogue.push_back(
+        NoReloc::unique(movmr(Reg(0), 1, 0, Reg(i).offset(), 0, Reg(i))));
   // Restore host SP
-  append(epilogue,
-         LoadReg(Reg(REG_SP), Offset(offsetof(Context, hostState.sp))));
+  epilogue.push_back(NoReloc::unique(
+      movrm(Reg(REG_SP), Reg(0), 1, 0, offsetof(Context, hostState.sp), 0)));
   // Save EFLAGS
   epilogue.push_back(Pushf());
-  epilogue.push_back(Popr(Reg(0)));
-  append(epilogue, SaveReg(Reg(0), Offset(offsetof(Context, gprState.eflags))));
+  epilogue.push_back(Popr(Reg(1)));
+  epilogue.push_back(NoReloc::unique(
+      movmr(Reg(0), 1, 0, offsetof(Context, gprState.eflags), 0, Reg(1))));
 #if defined(QBDI_ARCH_X86_64)
   // if enable FS GS
-  if ((opts & Options::OPT_ENABLE_FS_GS) == Options::OPT_ENABLE_FS_GS) {
-    QBDI_REQUIRE_ACTION(isHostCPUFeaturePresent("fsgsbase"), abort());
-
-    append(epilogue,
-           LoadReg(Reg(0), Offset(offsetof(Context, hostState.executeFlags))));
-    epilogue.push_back(Test(Reg(0), ExecBlockFlags::needFSGS));
-    epilogue.push_back(Je(5 * 4 + 7 * 4 + 4));
-
-    append(epilogue, LoadReg(Reg(3), Offset(offsetof(Context, hostState.fs))));
-    append(epilogue, LoadReg(Reg(4), Offset(offsetof(Context, hostState.gs))));
-    epilogue.push_back(Rdfsbase(Reg(1)));
-    epilogue.push_back(Rdgsbase(Reg(2)));
-    epilogue.push_back(Wrfsbase(Reg(3)));
-    epilogue.push_back(Wrgsbase(Reg(4)));
-    append(epilogue, SaveReg(Reg(1), Offset(offsetof(Context, gprState.fs))));
-    append(epilogue, SaveReg(Reg(2), Offset(offsetof(Context, gprState.gs))));
-  }
+  appendFSGS(epilogue, opts, false, llvmcpu);
 #endif // QBDI_ARCH_X86_64
   // Save FPR
-  if ((opts & Options::OPT_DISABLE_FPR) == 0) {
-    if ((opts & Options::OPT_DISABLE_OPTIONAL_FPR) == 0) {
-      append(
-          epilogue,
-          LoadReg(Reg(0), Offset(offsetof(Context, hostState.executeFlags))));
-      epilogue.push_back(Test(Reg(0), ExecBlockFlags::needFPU));
-      epilogue.push_back(Je(7 + 4));
-    }
-    epilogue.push_back(Fxsave(Offset(offsetof(Context, fprState))));
-    // target je needFPU
-    if (isHostCPUFeaturePresent("avx")) {
-      QBDI_DEBUG("AVX support enabled in guest context switches");
-      // don't save if not needed
-      if ((opts & Options::OPT_DISABLE_OPTIONAL_FPR) == 0) {
-        epilogue.push_back(Test(Reg(0), ExecBlockFlags::needAVX));
-        if constexpr (is_x86_64)
-          epilogue.push_back(Je(16 * 10 + 4));
-        else
-          epilogue.push_back(Je(8 * 10 + 4));
-      }
-      epilogue.push_back(Vextractf128(
-          Offset(offsetof(Context, fprState) + offsetof(FPRState, ymm0)),
-          llvm::X86::YMM0, 1));
-      epilogue.push_back(Vextractf128(
-          Offset(offsetof(Context, fprState) + offsetof(FPRState, ymm1)),
-          llvm::X86::YMM1, 1));
-      epilogue.push_back(Vextractf128(
-          Offset(offsetof(Context, fprState) + offsetof(FPRState, ymm2)),
-          llvm::X86::YMM2, 1));
-      epilogue.push_back(Vextractf128(
-          Offset(offsetof(Context, fprState) + offsetof(FPRState, ymm3)),
-          llvm::X86::YMM3, 1));
-      epilogue.push_back(Vextractf128(
-          Offset(offsetof(Context, fprState) + offsetof(FPRState, ymm4)),
-          llvm::X86::YMM4, 1));
-      epilogue.push_back(Vextractf128(
-          Offset(offsetof(Context, fprState) + offsetof(FPRState, ymm5)),
-          llvm::X86::YMM5, 1));
-      epilogue.push_back(Vextractf128(
-          Offset(offsetof(Context, fprState) + offsetof(FPRState, ymm6)),
-          llvm::X86::YMM6, 1));
-      epilogue.push_back(Vextractf128(
-          Offset(offsetof(Context, fprState) + offsetof(FPRState, ymm7)),
-          llvm::X86::YMM7, 1));
-#if defined(QBDI_ARCH_X86_64)
-      epilogue.push_back(Vextractf128(
-          Offset(offsetof(Context, fprState) + offsetof(FPRState, ymm8)),
-          llvm::X86::YMM8, 1));
-      epilogue.push_back(Vextractf128(
-          Offset(offsetof(Context, fprState) + offsetof(FPRState, ymm9)),
-          llvm::X86::YMM9, 1));
-      epilogue.push_back(Vextractf128(
-          Offset(offsetof(Context, fprState) + offsetof(FPRState, ymm10)),
-          llvm::X86::YMM10, 1));
-      epilogue.push_back(Vextractf128(
-          Offset(offsetof(Context, fprState) + offsetof(FPRState, ymm11)),
-          llvm::X86::YMM11, 1));
-      epilogue.push_back(Vextractf128(
-          Offset(offsetof(Context, fprState) + offsetof(FPRState, ymm12)),
-          llvm::X86::YMM12, 1));
-      epilogue.push_back(Vextractf128(
-          Offset(offsetof(Context, fprState) + offsetof(FPRState, ymm13)),
-          llvm::X86::YMM13, 1));
-      epilogue.push_back(Vextractf128(
-          Offset(offsetof(Context, fprState) + offsetof(FPRState, ymm14)),
-          llvm::X86::YMM14, 1));
-      epilogue.push_back(Vextractf128(
-          Offset(offsetof(Context, fprState) + offsetof(FPRState, ymm15)),
-          llvm::X86::YMM15, 1));
-#endif // QBDI_ARCH_X86_64
-       // target je needAVX
-    }
-  }
+  appendFPR(epilogue, opts, false, llvmcpu);
   // return to host
   epilogue.push_back(Ret());
 
@@ -333,13 +335,22 @@ std::vector<PatchRule> getDefaultPatchRules(Options opts) {
    * Target:  Any instruction with RIP as operand, e.g. LEA RAX, [RIP + 1]
    * Patch:   Temp(0) := rip
    *          LEA RAX, [RIP + IMM] --> LEA RAX, [Temp(0) + IMM]
+   * Near:    LEA RAX, [RIP + IMM] --> LEA RAX, [RIP + IMM'] in the ExecBlocks
+   *          near the memory (OPT_ENABLE_NEAR_EXECBLOCK)
    */
+  PatchGenerator::UniquePtrVec nearRIP;
+#if defined(QBDI_ARCH_X86_64)
+  if ((opts & Options::OPT_ENABLE_NEAR_EXECBLOCK) != 0) {
+    nearRIP = conv_unique<PatchGenerator>(RelocatePCRel::unique());
+  }
+#endif // QBDI_ARCH_X86_64
   rules.emplace_back(
       UseReg::unique(Reg(REG_PC)),
       conv_unique<PatchGenerator>(
           GetPCOffset::unique(Temp(0), Constant(0)),
           ModifyInstruction::unique(conv_unique<InstTransform>(
-              SubstituteWithTemp::unique(Reg(REG_PC), Temp(0))))));
+              SubstituteWithTemp::unique(Reg(REG_PC), Temp(0))))),
+      std::move(nearRIP));
 
   /* Rule #4: Simulate JMP to memory value.
    * Target:  JMP *MEM
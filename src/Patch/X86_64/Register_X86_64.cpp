@@ -20,7 +20,13 @@
 #include <stddef.h>
 
 #include "X86InstrInfo.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/MC/MCInst.h"
+#include "llvm/MC/MCInstrDesc.h"
+#include "llvm/MC/MCInstrInfo.h"
 
+#include "Engine/LLVMCPU.h"
+#include "Patch/InstInfo.h"
 #include "Patch/Register.h"
 #include "Utility/LogSys.h"
 
@@ -601,7 +607,7 @@ unsigned getUpperRegister(unsigned reg, size_t pos) {
 }
 
 void fixLLVMUsedGPR(const llvm::MCInst &inst, const LLVMCPU &llvmcpu,
-                    std::map<unsigned, RegisterUsage> &m) {
+                    RegisterUsageMap &m) {
   switch (inst.getOpcode()) {
     case llvm::X86::LOOP:
     case llvm::X86::LOOPE:
@@ -613,4 +619,87 @@ void fixLLVMUsedGPR(const llvm::MCInst &inst, const LLVMCPU &llvmcpu,
   }
 }
 
+bool getOverwrittenRegisters(const llvm::MCInst &inst, const LLVMCPU &llvmcpu,
+                             uint32_t &gpr, bool &flags) {
+  gpr = 0;
+  flags = false;
+
+  // The kernel and the interruption handlers read the registers that LLVM
+  // doesn't declare
+  switch (inst.getOpcode()) {
+    case llvm::X86::INT:
+    case llvm::X86::INT3:
+    case llvm::X86::INTO:
+    case llvm::X86::SYSCALL:
+    case llvm::X86::SYSENTER:
+      return false;
+    default:
+      break;
+  }
+  if (useAllRegisters(inst)) {
+    return false;
+  }
+
+  const llvm::MCInstrDesc &desc = llvmcpu.getMCII().get(inst.getOpcode());
+  llvm::StringRef name = llvmcpu.getMCII().getName(inst.getOpcode());
+
+  // BSF and BSR keep the destination when the source is zero, CMPXCHG only
+  // writes the destination when the comparison succeeds
+  if (not desc.isVariadic() and not name.startswith("BSF") and
+      not name.startswith("BSR") and not name.startswith("CMPXCHG")) {
+    for (unsigned i = 0; i < desc.getNumDefs(); i++) {
+      const llvm::MCOperand &op = inst.getOperand(i);
+      if (not op.isReg()) {
+        continue;
+      }
+      // A write of 32 bits clears the upper half of the register in x86_64,
+      // a write of 8 or 16 bits keeps the other bits
+      size_t pos = getGPRPosition(op.getReg());
+      if (pos < AVAILABLE_GPR and getRegisterSize(op.getReg()) >= 4) {
+        gpr |= (1u << pos);
+      }
+    }
+  }
+
+  // Only the arithmetic and logical instructions are known to write all the
+  // flags. The shifts and the rotations keep them with a count of 0, the
+  // string comparisons keep them with a REP prefix and a count of 0.
+  switch (inst.getOpcode()) {
+    // ADCX only writes CF, ADOX only OF
+    case llvm::X86::ADCX32rr:
+    case llvm::X86::ADCX32rm:
+    case llvm::X86::ADCX64rr:
+    case llvm::X86::ADCX64rm:
+    case llvm::X86::ADOX32rr:
+    case llvm::X86::ADOX32rm:
+    case llvm::X86::ADOX64rr:
+    case llvm::X86::ADOX64rm:
+    // CMPXCHG8B and CMPXCHG16B only write ZF
+    case llvm::X86::CMPXCHG8B:
+    case llvm::X86::CMPXCHG16B:
+      return true;
+    default:
+      break;
+  }
+  bool writeFlags = false;
+  for (const uint16_t *implicitRegs = desc.getImplicitDefs();
+       implicitRegs && *implicitRegs; ++implicitRegs) {
+    if (*implicitRegs == llvm::X86::EFLAGS) {
+      writeFlags = true;
+    }
+  }
+  if (writeFlags and not name.startswith("CMPS")) {
+    static const char *const prefixes[] = {"ADC", "ADD", "AND", "CMP",
+                                           "NEG", "OR",  "SBB", "SUB",
+                                           "TEST", "XOR"};
+    for (const char *prefix : prefixes) {
+      if (name.startswith(prefix)) {
+        flags = true;
+        break;
+      }
+    }
+  }
+  return true;
+}
+
 } // namespace QBDI
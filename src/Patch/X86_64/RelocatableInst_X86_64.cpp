@@ -18,6 +18,7 @@
 
 #include <stdint.h>
 
+#include "Engine/LLVMCPU.h"
 #include "ExecBlock/ExecBlock.h"
 #include "Patch/X86_64/Layer2_X86_64.h"
 #include "Patch/X86_64/RelocatableInst_X86_64.h"
@@ -27,6 +28,13 @@ namespace QBDI {
 
 // Generic RelocatableInst that must be implemented by each target
 
+// NoReloc
+// =======
+
+size_t NoReloc::getSize(const LLVMCPU &llvmcpu) const {
+  return llvmcpu.getInstSize(inst);
+}
+
 // RelocTag
 // ========
 
@@ -51,6 +59,11 @@ llvm::MCInst LoadShadow::reloc(ExecBlock *exec_block) const {
   }
 }
 
+size_t LoadShadow::getSize(const LLVMCPU &llvmcpu) const {
+  // mov reg, [rip + disp32] or mov reg, [disp32]
+  return is_x86_64 ? 7 : 6;
+}
+
 // StoreShadow
 // ===========
 
@@ -72,6 +85,11 @@ llvm::MCInst StoreShadow::reloc(ExecBlock *exec_block) const {
   }
 }
 
+size_t StoreShadow::getSize(const LLVMCPU &llvmcpu) const {
+  // mov [rip + disp32], reg or mov [disp32], reg
+  return is_x86_64 ? 7 : 6;
+}
+
 // LoadDataBlock
 // =============
 
@@ -85,6 +103,20 @@ llvm::MCInst LoadDataBlock::reloc(ExecBlock *exec_block) const {
   }
 }
 
+size_t LoadDataBlock::getSize(const LLVMCPU &llvmcpu) const {
+  // mov reg, [rip + disp32] or mov reg, [disp32]
+  return is_x86_64 ? 7 : 6;
+}
+
+size_t LoadDataBlock::getDataBlockAccess(unsigned &reg_, int64_t &offset_,
+                                         bool &store) const {
+  reg_ = reg;
+  offset_ = offset;
+  store = false;
+  // mov reg, [rip + disp32] or mov reg, [disp32]
+  return is_x86_64 ? 7 : 6;
+}
+
 // StoreDataBlock
 // ==============
 
@@ -98,6 +130,20 @@ llvm::MCInst StoreDataBlock::reloc(ExecBlock *exec_block) const {
   }
 }
 
+size_t StoreDataBlock::getSize(const LLVMCPU &llvmcpu) const {
+  // mov [rip + disp32], reg or mov [disp32], reg
+  return is_x86_64 ? 7 : 6;
+}
+
+size_t StoreDataBlock::getDataBlockAccess(unsigned &reg_, int64_t &offset_,
+                                          bool &store) const {
+  reg_ = reg;
+  offset_ = offset;
+  store = true;
+  // mov [rip + disp32], reg or mov [disp32], reg
+  return is_x86_64 ? 7 : 6;
+}
+
 // MovReg
 // ======
 
@@ -105,6 +151,10 @@ llvm::MCInst MovReg::reloc(ExecBlock *exec_block) const {
   return movrr(dst, src);
 }
 
+size_t MovReg::getSize(const LLVMCPU &llvmcpu) const {
+  return llvmcpu.getInstSize(movrr(dst, src));
+}
+
 // LoadImm
 // =======
 
@@ -112,6 +162,10 @@ llvm::MCInst LoadImm::reloc(ExecBlock *exec_block) const {
   return movri(reg, imm);
 }
 
+size_t LoadImm::getSize(const LLVMCPU &llvmcpu) const {
+  return llvmcpu.getInstSize(movri(reg, imm));
+}
+
 // InstId
 // ======
 
@@ -119,6 +173,33 @@ llvm::MCInst InstId::reloc(ExecBlock *exec_block) const {
   return movri(reg, exec_block->getNextInstID());
 }
 
+size_t InstId::getSize(const LLVMCPU &llvmcpu) const {
+  // the immediate of MOV has the size of the register
+  return llvmcpu.getInstSize(movri(reg, 0));
+}
+
+// CallbackSite
+// ============
+
+llvm::MCInst CallbackSite::reloc(ExecBlock *exec_block) const {
+  uint32_t site = exec_block->getCallbackSite(callback, data);
+  QBDI_REQUIRE_ACTION(site != 0, abort());
+  rword offset = offsetof(Context, hostState.callbackSite);
+
+  if constexpr (is_x86_64) {
+    // mov qword [rip + disp32], imm32
+    return movmi(Reg(REG_PC), 1, 0,
+                 exec_block->getDataBlockOffset() + offset - 11, 0, site);
+  } else {
+    return movmi(0, 0, 0, exec_block->getDataBlockBase() + offset, 0, site);
+  }
+}
+
+size_t CallbackSite::getSize(const LLVMCPU &llvmcpu) const {
+  // mov [rip + disp32], imm32 or mov [disp32], imm32
+  return is_x86_64 ? 11 : 10;
+}
+
 // Target Specific RelocatableInst
 
 // EpilogueRel
@@ -130,6 +211,10 @@ llvm::MCInst EpilogueRel::reloc(ExecBlock *exec_block) const {
   return res;
 }
 
+size_t EpilogueRel::getSize(const LLVMCPU &llvmcpu) const {
+  return llvmcpu.getInstSize(inst);
+}
+
 // HostPCRel
 // =========
 
@@ -139,6 +224,24 @@ llvm::MCInst HostPCRel::reloc(ExecBlock *exec_block) const {
   return res;
 }
 
+size_t HostPCRel::getSize(const LLVMCPU &llvmcpu) const {
+  return llvmcpu.getInstSize(inst);
+}
+
+// TargetPCRel
+// ===========
+
+llvm::MCInst TargetPCRel::reloc(ExecBlock *exec_block) const {
+  llvm::MCInst res = inst;
+  res.getOperand(opn).setImm(static_cast<int64_t>(
+      target - (exec_block->getCurrentPC() + instSize)));
+  return res;
+}
+
+size_t TargetPCRel::getSize(const LLVMCPU &llvmcpu) const {
+  return llvmcpu.getInstSize(inst);
+}
+
 // DataBlockRel
 // ============
 
@@ -148,6 +251,10 @@ llvm::MCInst DataBlockRel::reloc(ExecBlock *exec_block) const {
   return res;
 }
 
+size_t DataBlockRel::getSize(const LLVMCPU &llvmcpu) const {
+  return llvmcpu.getInstSize(inst);
+}
+
 // DataBlockAbsRel
 // ===============
 
@@ -157,4 +264,8 @@ llvm::MCInst DataBlockAbsRel::reloc(ExecBlock *exec_block) const {
   return res;
 }
 
+size_t DataBlockAbsRel::getSize(const LLVMCPU &llvmcpu) const {
+  return llvmcpu.getInstSize(inst);
+}
+
 } // namespace QBDI
@@ -31,6 +31,7 @@
 
 namespace QBDI {
 class ExecBlock;
+class LLVMCPU;
 
 class EpilogueRel : public AutoClone<RelocatableInst, EpilogueRel> {
   llvm::MCInst inst;
@@ -44,6 +45,8 @@ public:
 
   // Set an operand to epilogueOffset + offset
   llvm::MCInst reloc(ExecBlock *exec_block) const override;
+
+  size_t getSize(const LLVMCPU &llvmcpu) const override;
 };
 
 class HostPCRel : public AutoClone<RelocatableInst, HostPCRel> {
@@ -58,6 +61,32 @@ public:
 
   // set a an operand at currentPC + offset
   llvm::MCInst reloc(ExecBlock *exec_block) const override;
+
+  size_t getSize(const LLVMCPU &llvmcpu) const override;
+};
+
+class TargetPCRel : public AutoClone<RelocatableInst, TargetPCRel> {
+  llvm::MCInst inst;
+  unsigned int opn;
+  rword target;
+  rword instSize;
+
+public:
+  TargetPCRel(llvm::MCInst &&inst, unsigned int opn, rword target,
+              rword instSize)
+      : AutoClone<RelocatableInst, TargetPCRel>(),
+        inst(std::forward<llvm::MCInst>(inst)), opn(opn), target(target),
+        instSize(instSize) {}
+
+  // Set an operand at target - (currentPC + instSize)
+  llvm::MCInst reloc(ExecBlock *exec_block) const override;
+
+  size_t getSize(const LLVMCPU &llvmcpu) const override;
+
+  bool getRel32Target(rword &target_) const override {
+    target_ = target;
+    return true;
+  }
 };
 
 class DataBlockRel : public AutoClone<RelocatableInst, DataBlockRel> {
@@ -71,6 +100,8 @@ public:
         inst(std::forward<llvm::MCInst>(inst)), opn(opn), offset(offset) {}
 
   llvm::MCInst reloc(ExecBlock *exec_block) const override;
+
+  size_t getSize(const LLVMCPU &llvmcpu) const override;
 };
 
 class DataBlockAbsRel : public AutoClone<RelocatableInst, DataBlockAbsRel> {
@@ -84,6 +115,8 @@ public:
         inst(std::forward<llvm::MCInst>(inst)), opn(opn), offset(offset) {}
 
   llvm::MCInst reloc(ExecBlock *exec_block) const override;
+
+  size_t getSize(const LLVMCPU &llvmcpu) const override;
 };
 
 inline std::unique_ptr<RelocatableInst> DataBlockRelx86(llvm::MCInst &&inst,
@@ -0,0 +1,213 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef QBDI_ADDRESSMAP_H
+#define QBDI_ADDRESSMAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+#include "QBDI/State.h"
+
+namespace QBDI {
+
+/*! Open addressing hash map indexed by an address. The entries are stored in
+ * a single array with linear probing and the iteration order is unspecified.
+ *
+ * The address ~0 is reserved to mark the empty slots.
+ */
+template <typename T>
+class AddressMap {
+public:
+  using value_type = std::pair<rword, T>;
+
+private:
+  static constexpr rword EMPTY = ~static_cast<rword>(0);
+  static constexpr size_t MIN_CAPACITY = 16;
+
+  std::vector<value_type> slots;
+  size_t nbEntries = 0;
+
+  // Fibonacci hashing, the capacity is always a power of two
+  inline size_t slotOf(rword address) const {
+    return static_cast<size_t>((static_cast<uint64_t>(address) *
+                                UINT64_C(0x9E3779B97F4A7C15)) >>
+                               32) &
+           (slots.size() - 1);
+  }
+
+  size_t lookup(rword address) const {
+    if (slots.empty()) {
+      return slots.size();
+    }
+    for (size_t i = slotOf(address);; i = (i + 1) & (slots.size() - 1)) {
+      if (slots[i].first == address) {
+        return i;
+      } else if (slots[i].first == EMPTY) {
+        return slots.size();
+      }
+    }
+  }
+
+  void grow() {
+    std::vector<value_type> old;
+    old.swap(slots);
+    // the values may not be copyable, mark the new slots one by one
+    slots.resize(old.empty() ? MIN_CAPACITY : old.size() * 2);
+    for (value_type &v : slots) {
+      v.first = EMPTY;
+    }
+    for (value_type &v : old) {
+      if (v.first != EMPTY) {
+        size_t i = slotOf(v.first);
+        while (slots[i].first != EMPTY) {
+          i = (i + 1) & (slots.size() - 1);
+        }
+        slots[i] = std::move(v);
+      }
+    }
+  }
+
+  template <typename V>
+  class Iterator {
+    friend class AddressMap;
+    template <typename W>
+    friend class Iterator;
+
+    V *slots;
+    size_t pos;
+    size_t end;
+
+    Iterator(V *slots, size_t pos, size_t end)
+        : slots(slots), pos(pos), end(end) {
+      skipEmpty();
+    }
+
+    inline void skipEmpty() {
+      while (pos < end and slots[pos].first == EMPTY) {
+        pos++;
+      }
+    }
+
+  public:
+    // allow the conversion from iterator to const_iterator
+    template <typename W>
+    Iterator(const Iterator<W> &o) : slots(o.slots), pos(o.pos), end(o.end) {}
+
+    inline V &operator*() const { return slots[pos]; }
+    inline V *operator->() const { return &slots[pos]; }
+    inline Iterator &operator++() {
+      pos++;
+      skipEmpty();
+      return *this;
+    }
+    inline bool operator==(const Iterator &o) const { return pos == o.pos; }
+    inline bool operator!=(const Iterator &o) const { return pos != o.pos; }
+  };
+
+public:
+  using iterator = Iterator<value_type>;
+  using const_iterator = Iterator<const value_type>;
+
+  iterator begin() { return iterator(slots.data(), 0, slots.size()); }
+  iterator end() { return iterator(slots.data(), slots.size(), slots.size()); }
+  const_iterator begin() const {
+    return const_iterator(slots.data(), 0, slots.size());
+  }
+  const_iterator end() const {
+    return const_iterator(slots.data(), slots.size(), slots.size());
+  }
+
+  iterator find(rword address) {
+    return iterator(slots.data(), lookup(address), slots.size());
+  }
+
+  const_iterator find(rword address) const {
+    return const_iterator(slots.data(), lookup(address), slots.size());
+  }
+
+  size_t count(rword address) const {
+    return lookup(address) != slots.size() ? 1 : 0;
+  }
+
+  /*! Get the value of an address, inserting a default value if the address
+   * is not in the map. The references to the values are invalidated when an
+   * address is inserted.
+   */
+  T &operator[](rword address) {
+    size_t i = lookup(address);
+    if (i != slots.size()) {
+      return slots[i].second;
+    }
+    // keep the load factor under 3/4
+    if ((nbEntries + 1) * 4 > slots.size() * 3) {
+      grow();
+    }
+    i = slotOf(address);
+    while (slots[i].first != EMPTY) {
+      i = (i + 1) & (slots.size() - 1);
+    }
+    slots[i].first = address;
+    nbEntries++;
+    return slots[i].second;
+  }
+
+  /*! Remove an address from the map. The following entries of the probe
+   * sequence are shifted back, the iterators are invalidated.
+   *
+   * @return True if the address was in the map
+   */
+  bool erase(rword address) {
+    size_t i = lookup(address);
+    if (i == slots.size()) {
+      return false;
+    }
+    const size_t mask = slots.size() - 1;
+    for (size_t j = (i + 1) & mask; slots[j].first != EMPTY;
+         j = (j + 1) & mask) {
+      // the entry stays if its home slot is cyclically in (i, j]
+      size_t home = slotOf(slots[j].first);
+      bool stay = (i < j) ? (i < home and home <= j) : (i < home or home <= j);
+      if (not stay) {
+        slots[i] = std::move(slots[j]);
+        i = j;
+      }
+    }
+    slots[i].first = EMPTY;
+    slots[i].second = T{};
+    nbEntries--;
+    return true;
+  }
+
+  size_t size() const { return nbEntries; }
+
+  bool empty() const { return nbEntries == 0; }
+
+  // Bytes of the slots of the map
+  size_t memorySize() const { return slots.capacity() * sizeof(value_type); }
+
+  void clear() {
+    slots.clear();
+    nbEntries = 0;
+  }
+};
+
+} // namespace QBDI
+
+#endif
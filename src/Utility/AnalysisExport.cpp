@@ -0,0 +1,341 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "QBDI/AnalysisExport.h"
+#include "Utility/LogSys.h"
+
+namespace QBDI {
+
+namespace {
+
+constexpr char EXPORT_MAGIC[8] = {'Q', 'B', 'D', 'I', 'A', 'N', 'A', '\0'};
+
+inline uint64_t alignOffset(uint64_t offset) { return (offset + 7) & ~7ULL; }
+
+bool writePadding(FILE *file, uint64_t from, uint64_t to) {
+  static const uint8_t zero[8] = {0};
+  return to == from or fwrite(zero, 1, to - from, file) == to - from;
+}
+
+} // anonymous namespace
+
+class AnalysisExportData {
+public:
+  std::vector<InstAnalysisRecord> records;
+  std::vector<OperandRecord> operands;
+  std::vector<char> stringPool;
+  std::unordered_map<std::string, uint32_t> strings;
+  std::unordered_set<rword> addresses;
+
+  // Offset of a string in the pool, false if the pool is full
+  bool addString(const char *str, uint32_t &offset) {
+    if (str == nullptr) {
+      offset = QBDI_ANALYSIS_EXPORT_NO_STRING;
+      return true;
+    }
+    auto it = strings.find(str);
+    if (it != strings.end()) {
+      offset = it->second;
+      return true;
+    }
+    size_t len = strlen(str) + 1;
+    QBDI_REQUIRE_ACTION(
+        stringPool.size() + len < QBDI_ANALYSIS_EXPORT_NO_STRING,
+        return false);
+    offset = static_cast<uint32_t>(stringPool.size());
+    stringPool.insert(stringPool.end(), str, str + len);
+    strings.emplace(str, offset);
+    return true;
+  }
+};
+
+AnalysisExporter::AnalysisExporter()
+    : data(std::make_unique<AnalysisExportData>()) {}
+
+AnalysisExporter::~AnalysisExporter() = default;
+
+size_t AnalysisExporter::size() const { return data->records.size(); }
+
+bool AnalysisExporter::add(const InstAnalysis &analysis) {
+  if (data->addresses.count(analysis.address) != 0) {
+    return false;
+  }
+  InstAnalysisRecord record = {};
+  record.address = analysis.address;
+  record.gprRead = analysis.gprRead;
+  record.gprWrite = analysis.gprWrite;
+  record.fprRead = analysis.fprRead;
+  record.fprWrite = analysis.fprWrite;
+  record.instSize = analysis.instSize;
+  record.symbolOffset = analysis.symbolOffset;
+  record.loadSize = analysis.loadSize;
+  record.storeSize = analysis.storeSize;
+  record.analysisType = analysis.analysisType;
+  record.condition = static_cast<uint8_t>(analysis.condition);
+  record.flagsAccess = static_cast<uint8_t>(analysis.flagsAccess);
+  record.cpuMode = static_cast<uint8_t>(analysis.cpuMode);
+  record.flags = (analysis.affectControlFlow ? RECORD_AFFECT_CONTROL_FLOW : 0) |
+                 (analysis.isBranch ? RECORD_IS_BRANCH : 0) |
+                 (analysis.isCall ? RECORD_IS_CALL : 0) |
+                 (analysis.isReturn ? RECORD_IS_RETURN : 0) |
+                 (analysis.isCompare ? RECORD_IS_COMPARE : 0) |
+                 (analysis.isPredicable ? RECORD_IS_PREDICABLE : 0) |
+                 (analysis.isMoveImm ? RECORD_IS_MOVE_IMM : 0) |
+                 (analysis.mayLoad ? RECORD_MAY_LOAD : 0) |
+                 (analysis.mayStore ? RECORD_MAY_STORE : 0) |
+                 (analysis.mayLoad_LLVM ? RECORD_MAY_LOAD_LLVM : 0) |
+                 (analysis.mayStore_LLVM ? RECORD_MAY_STORE_LLVM : 0);
+  if (not data->addString(analysis.mnemonic, record.mnemonic) or
+      not data->addString(analysis.disassembly, record.disassembly) or
+      not data->addString(analysis.symbol, record.symbol) or
+      not data->addString(analysis.module, record.module)) {
+    return false;
+  }
+
+  record.firstOperand = static_cast<uint32_t>(data->operands.size());
+  if (analysis.operands != nullptr) {
+    record.numOperands = analysis.numOperands;
+    for (uint8_t i = 0; i < analysis.numOperands; i++) {
+      const OperandAnalysis &op = analysis.operands[i];
+      OperandRecord opRecord = {};
+      opRecord.value = op.value;
+      opRecord.regCtxIdx = op.regCtxIdx;
+      opRecord.type = static_cast<uint8_t>(op.type);
+      opRecord.flag = static_cast<uint8_t>(op.flag);
+      opRecord.size = op.size;
+      opRecord.regOff = op.regOff;
+      opRecord.regAccess = static_cast<uint8_t>(op.regAccess);
+      if (not data->addString(op.regName, opRecord.regName)) {
+        data->operands.resize(record.firstOperand);
+        return false;
+      }
+      data->operands.push_back(opRecord);
+    }
+  }
+  data->records.push_back(record);
+  data->addresses.insert(analysis.address);
+  return true;
+}
+
+bool AnalysisExporter::write(const std::string &path) const {
+  std::vector<InstAnalysisRecord> records = data->records;
+  std::sort(records.begin(), records.end(),
+            [](const InstAnalysisRecord &a, const InstAnalysisRecord &b) {
+              return a.address < b.address;
+            });
+
+  AnalysisExportHeader header = {};
+  memcpy(header.magic, EXPORT_MAGIC, sizeof(EXPORT_MAGIC));
+  header.version = QBDI_ANALYSIS_EXPORT_VERSION;
+  header.headerSize = sizeof(AnalysisExportHeader);
+  header.recordSize = sizeof(InstAnalysisRecord);
+  header.operandSize = sizeof(OperandRecord);
+  header.nbRecords = records.size();
+  header.nbOperands = data->operands.size();
+  header.stringPoolSize = data->stringPool.size();
+  header.recordsOffset = alignOffset(sizeof(AnalysisExportHeader));
+  header.operandsOffset = alignOffset(
+      header.recordsOffset + header.nbRecords * sizeof(InstAnalysisRecord));
+  header.stringPoolOffset = alignOffset(
+      header.operandsOffset + header.nbOperands * sizeof(OperandRecord));
+
+  FILE *file = fopen(path.c_str(), "wb");
+  if (file == nullptr) {
+    QBDI_WARN("Cannot open the export file {}", path);
+    return false;
+  }
+  uint64_t recordsEnd =
+      header.recordsOffset + header.nbRecords * sizeof(InstAnalysisRecord);
+  uint64_t operandsEnd =
+      header.operandsOffset + header.nbOperands * sizeof(OperandRecord);
+  bool ok =
+      fwrite(&header, sizeof(header), 1, file) == 1 and
+      writePadding(file, sizeof(header), header.recordsOffset) and
+      fwrite(records.data(), sizeof(InstAnalysisRecord), records.size(),
+             file) == records.size() and
+      writePadding(file, recordsEnd, header.operandsOffset) and
+      fwrite(data->operands.data(), sizeof(OperandRecord),
+             data->operands.size(), file) == data->operands.size() and
+      writePadding(file, operandsEnd, header.stringPoolOffset) and
+      fwrite(data->stringPool.data(), 1, data->stringPool.size(), file) ==
+          data->stringPool.size();
+  ok = (fclose(file) == 0) and ok;
+  if (not ok) {
+    QBDI_WARN("Fail to write the export file {}", path);
+  }
+  return ok;
+}
+
+// =========================
+
+class AnalysisExportFile {
+public:
+  std::vector<uint8_t> content;
+  const AnalysisExportHeader *header = nullptr;
+  const InstAnalysisRecord *records = nullptr;
+  const OperandRecord *operands = nullptr;
+  const char *stringPool = nullptr;
+
+  bool validString(uint32_t offset) const {
+    return offset == QBDI_ANALYSIS_EXPORT_NO_STRING or
+           offset < header->stringPoolSize;
+  }
+
+  bool load(const std::string &path) {
+    FILE *file = fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+      return false;
+    }
+    uint8_t buffer[65536];
+    size_t nb;
+    while ((nb = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+      content.insert(content.end(), buffer, buffer + nb);
+    }
+    fclose(file);
+
+    if (content.size() < sizeof(AnalysisExportHeader)) {
+      return false;
+    }
+    header = reinterpret_cast<const AnalysisExportHeader *>(content.data());
+    uint64_t size = content.size();
+    if (memcmp(header->magic, EXPORT_MAGIC, sizeof(EXPORT_MAGIC)) != 0 or
+        header->version != QBDI_ANALYSIS_EXPORT_VERSION or
+        header->headerSize != sizeof(AnalysisExportHeader) or
+        header->recordSize != sizeof(InstAnalysisRecord) or
+        header->operandSize != sizeof(OperandRecord) or
+        header->recordsOffset % 8 != 0 or header->operandsOffset % 8 != 0 or
+        header->recordsOffset > size or header->operandsOffset > size or
+        header->stringPoolOffset > size or
+        header->nbRecords > (size - header->recordsOffset) /
+                                sizeof(InstAnalysisRecord) or
+        header->nbOperands > (size - header->operandsOffset) /
+                                 sizeof(OperandRecord) or
+        header->stringPoolSize > size - header->stringPoolOffset or
+        (header->stringPoolSize != 0 and
+         content[header->stringPoolOffset + header->stringPoolSize - 1] !=
+             '\0')) {
+      return false;
+    }
+    records = reinterpret_cast<const InstAnalysisRecord *>(
+        content.data() + header->recordsOffset);
+    operands = reinterpret_cast<const OperandRecord *>(
+        content.data() + header->operandsOffset);
+    stringPool = reinterpret_cast<const char *>(content.data() +
+                                                header->stringPoolOffset);
+
+    for (uint64_t i = 0; i < header->nbRecords; i++) {
+      const InstAnalysisRecord &r = records[i];
+      if ((i > 0 and records[i - 1].address >= r.address) or
+          static_cast<uint64_t>(r.firstOperand) + r.numOperands >
+              header->nbOperands or
+          not validString(r.mnemonic) or not validString(r.disassembly) or
+          not validString(r.symbol) or not validString(r.module)) {
+        return false;
+      }
+    }
+    for (uint64_t i = 0; i < header->nbOperands; i++) {
+      if (not validString(operands[i].regName)) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+AnalysisExportReader::AnalysisExportReader(const std::string &path)
+    : file(std::make_unique<AnalysisExportFile>()) {
+  if (not file->load(path)) {
+    QBDI_WARN("{} isn't a valid analysis export", path);
+    file->header = nullptr;
+  }
+}
+
+AnalysisExportReader::~AnalysisExportReader() = default;
+
+bool AnalysisExportReader::isOpen() const { return file->header != nullptr; }
+
+size_t AnalysisExportReader::size() const {
+  return isOpen() ? file->header->nbRecords : 0;
+}
+
+const InstAnalysisRecord &AnalysisExportReader::getRecord(size_t index) const {
+  QBDI_REQUIRE_ACTION(index < size(), abort());
+  return file->records[index];
+}
+
+const InstAnalysisRecord *AnalysisExportReader::find(rword address) const {
+  const InstAnalysisRecord *begin = file->records;
+  const InstAnalysisRecord *end = begin + size();
+  const InstAnalysisRecord *it = std::lower_bound(
+      begin, end, address, [](const InstAnalysisRecord &r, rword addr) {
+        return r.address < addr;
+      });
+  if (it == end or it->address != address) {
+    return nullptr;
+  }
+  return it;
+}
+
+const OperandRecord &
+AnalysisExportReader::getOperand(const InstAnalysisRecord &record,
+                                 size_t index) const {
+  QBDI_REQUIRE_ACTION(isOpen() and index < record.numOperands, abort());
+  return file->operands[record.firstOperand + index];
+}
+
+const char *AnalysisExportReader::getString(uint32_t offset) const {
+  if (not isOpen() or offset == QBDI_ANALYSIS_EXPORT_NO_STRING) {
+    return nullptr;
+  }
+  QBDI_REQUIRE_ACTION(offset < file->header->stringPoolSize, return nullptr);
+  return file->stringPool + offset;
+}
+
+// =========================
+
+AnalysisExporterRef qbdi_newAnalysisExporter() {
+  return new AnalysisExporter();
+}
+
+void qbdi_deleteAnalysisExporter(AnalysisExporterRef exporter) {
+  delete exporter;
+}
+
+bool qbdi_analysisExporterAdd(AnalysisExporterRef exporter,
+                              const InstAnalysis *analysis) {
+  QBDI_REQUIRE_ACTION(exporter != nullptr, return false);
+  QBDI_REQUIRE_ACTION(analysis != nullptr, return false);
+  return exporter->add(*analysis);
+}
+
+bool qbdi_analysisExporterWrite(AnalysisExporterRef exporter,
+                                const char *path) {
+  QBDI_REQUIRE_ACTION(exporter != nullptr, return false);
+  QBDI_REQUIRE_ACTION(path != nullptr, return false);
+  return exporter->write(std::string(path));
+}
+
+} // namespace QBDI
@@ -0,0 +1,76 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef QBDI_DIRTYPAGES_H
+#define QBDI_DIRTYPAGES_H
+
+#include "QBDI/Range.h"
+#include "QBDI/State.h"
+
+namespace QBDI {
+
+/*! The dirty page tracking finds the pages written in some ranges of memory
+ * since the last reset, by the instrumented code or not. On Linux, the soft
+ * dirty bits of the pagemap are used: a reset clears the bits of all the
+ * process, the pages written since the last reset of the other owners are
+ * kept for them.
+ *
+ * The registry is process wide, each set of ranges is identified by an owner.
+ */
+
+/*! Return true if the dirty page tracking is available on this platform and
+ * this kernel.
+ */
+bool isDirtyPageTrackingSupported();
+
+/*! Track the pages written in some ranges for an owner, replacing the
+ * previous ranges of the owner. The written pages are reset.
+ *
+ * @param[in] owner   The owner of the ranges.
+ * @param[in] ranges  The ranges of memory to track.
+ *
+ * @return False if the pages cannot be tracked.
+ */
+bool trackDirtyPages(const void *owner, const RangeSet<rword> &ranges);
+
+/*! Get the pages written in the ranges of an owner since the last reset.
+ *
+ * @param[in]  owner  The owner of the ranges.
+ * @param[out] pages  The written pages. They are aligned on the pages and
+ *                    may exceed the ranges.
+ *
+ * @return False if the written pages are unknown.
+ */
+bool takeDirtyPages(const void *owner, RangeSet<rword> &pages);
+
+/*! Reset the pages written in the ranges of an owner.
+ *
+ * @param[in] owner  The owner of the ranges.
+ *
+ * @return False if the next written pages are unknown.
+ */
+bool resetDirtyPages(const void *owner);
+
+/*! Stop the tracking of the ranges of an owner.
+ *
+ * @param[in] owner  The owner of the ranges.
+ */
+void untrackDirtyPages(const void *owner);
+
+} // namespace QBDI
+
+#endif // QBDI_DIRTYPAGES_H
@@ -0,0 +1,240 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+#include <fcntl.h>
+#include <mutex>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+#include "Utility/DirtyPages.h"
+#include "Utility/LogSys.h"
+
+namespace QBDI {
+
+namespace {
+
+constexpr uint64_t PAGEMAP_SOFT_DIRTY = 1ULL << 55;
+// number of entries of the pagemap read at once
+constexpr size_t PAGEMAP_BATCH = 512;
+
+struct TrackedRanges {
+  const void *owner;
+  RangeSet<rword> ranges;
+  // the pages written before a reset of another owner
+  RangeSet<rword> pending;
+};
+
+class DirtyPageTracker {
+private:
+  std::mutex lock;
+  std::vector<TrackedRanges> tracked;
+  int pagemap = -1;
+  int clearRefs = -1;
+  // the files of a forked process are opened again
+  pid_t pid = 0;
+  rword pageSize = 0;
+  bool probed = false;
+  bool supported = false;
+
+  bool openFiles() {
+    if (pid == getpid()) {
+      return pagemap != -1 and clearRefs != -1;
+    }
+    if (pagemap != -1) {
+      close(pagemap);
+    }
+    if (clearRefs != -1) {
+      close(clearRefs);
+    }
+    pid = getpid();
+    pageSize = static_cast<rword>(sysconf(_SC_PAGESIZE));
+    pagemap = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+    clearRefs = open("/proc/self/clear_refs", O_WRONLY | O_CLOEXEC);
+    if (pagemap == -1 or clearRefs == -1) {
+      QBDI_DEBUG("Cannot open the pagemap or the clear_refs of the process");
+      return false;
+    }
+    return true;
+  }
+
+  bool clearSoftDirty() { return write(clearRefs, "4", 1) == 1; }
+
+  // Add the soft dirty pages of the ranges to pages
+  bool readSoftDirty(const RangeSet<rword> &ranges, RangeSet<rword> &pages) {
+    uint64_t entries[PAGEMAP_BATCH];
+    for (const Range<rword> &r : ranges.getRanges()) {
+      rword page = r.start() & ~(pageSize - 1);
+      while (page < r.end()) {
+        size_t nb = std::min<rword>(PAGEMAP_BATCH,
+                                    (r.end() - page + pageSize - 1) / pageSize);
+        ssize_t size = nb * sizeof(uint64_t);
+        if (pread(pagemap, entries, size,
+                  (page / pageSize) * sizeof(uint64_t)) != size) {
+          return false;
+        }
+        for (size_t i = 0; i < nb; i++, page += pageSize) {
+          if (entries[i] & PAGEMAP_SOFT_DIRTY) {
+            pages.add({page, page + pageSize});
+          }
+        }
+      }
+    }
+    return true;
+  }
+
+  // A kernel without CONFIG_MEM_SOFT_DIRTY accepts the reset but never sets
+  // the bits: a written page must be found
+  bool probe() {
+    void *mem = mmap(nullptr, pageSize, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+      return false;
+    }
+    volatile uint8_t *probePage = static_cast<volatile uint8_t *>(mem);
+    RangeSet<rword> ranges;
+    ranges.add({reinterpret_cast<rword>(mem),
+                reinterpret_cast<rword>(mem) + pageSize});
+    RangeSet<rword> before;
+    RangeSet<rword> after;
+    probePage[0] = 1;
+    bool res = clearSoftDirty() and readSoftDirty(ranges, before);
+    probePage[0] = 2;
+    res = res and readSoftDirty(ranges, after) and
+          before.getRanges().empty() and not after.getRanges().empty();
+    munmap(mem, pageSize);
+    return res;
+  }
+
+  bool init() {
+    if (not openFiles()) {
+      return false;
+    }
+    if (not probed) {
+      probed = true;
+      supported = probe();
+      if (not supported) {
+        QBDI_DEBUG("The soft dirty bits aren't supported by the kernel");
+      }
+    }
+    return supported;
+  }
+
+  TrackedRanges *find(const void *owner) {
+    auto it = std::find_if(
+        tracked.begin(), tracked.end(),
+        [owner](const TrackedRanges &t) { return t.owner == owner; });
+    return (it == tracked.end()) ? nullptr : &*it;
+  }
+
+  // Clear the soft dirty bits, the written pages of the other owners are kept
+  bool resetLocked(const void *owner) {
+    for (TrackedRanges &t : tracked) {
+      if (t.owner != owner and not readSoftDirty(t.ranges, t.pending)) {
+        return false;
+      }
+    }
+    return clearSoftDirty();
+  }
+
+public:
+  bool isSupported() {
+    std::lock_guard<std::mutex> guard(lock);
+    return init();
+  }
+
+  bool track(const void *owner, const RangeSet<rword> &ranges) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (not init()) {
+      return false;
+    }
+    TrackedRanges *t = find(owner);
+    if (t == nullptr) {
+      t = &tracked.emplace_back();
+      t->owner = owner;
+    }
+    t->ranges = ranges;
+    t->pending.clear();
+    if (not resetLocked(owner)) {
+      tracked.erase(tracked.begin() + (t - tracked.data()));
+      return false;
+    }
+    return true;
+  }
+
+  bool take(const void *owner, RangeSet<rword> &pages) {
+    std::lock_guard<std::mutex> guard(lock);
+    TrackedRanges *t = find(owner);
+    if (t == nullptr or not init()) {
+      return false;
+    }
+    pages = t->pending;
+    t->pending.clear();
+    return readSoftDirty(t->ranges, pages);
+  }
+
+  bool reset(const void *owner) {
+    std::lock_guard<std::mutex> guard(lock);
+    TrackedRanges *t = find(owner);
+    if (t == nullptr or not init()) {
+      return false;
+    }
+    t->pending.clear();
+    return resetLocked(owner);
+  }
+
+  void untrack(const void *owner) {
+    std::lock_guard<std::mutex> guard(lock);
+    tracked.erase(std::remove_if(tracked.begin(), tracked.end(),
+                                 [owner](const TrackedRanges &t) {
+                                   return t.owner == owner;
+                                 }),
+                  tracked.end());
+  }
+};
+
+DirtyPageTracker &getDirtyPageTracker() {
+  // never destroyed, the snapshots of the static VMs may outlive it
+  static DirtyPageTracker *tracker = new DirtyPageTracker;
+  return *tracker;
+}
+
+} // anonymous namespace
+
+bool isDirtyPageTrackingSupported() {
+  return getDirtyPageTracker().isSupported();
+}
+
+bool trackDirtyPages(const void *owner, const RangeSet<rword> &ranges) {
+  return getDirtyPageTracker().track(owner, ranges);
+}
+
+bool takeDirtyPages(const void *owner, RangeSet<rword> &pages) {
+  return getDirtyPageTracker().take(owner, pages);
+}
+
+bool resetDirtyPages(const void *owner) {
+  return getDirtyPageTracker().reset(owner);
+}
+
+void untrackDirtyPages(const void *owner) {
+  getDirtyPageTracker().untrack(owner);
+}
+
+} // namespace QBDI
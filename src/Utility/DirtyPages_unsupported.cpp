@@ -0,0 +1,36 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "Utility/DirtyPages.h"
+
+namespace QBDI {
+
+bool isDirtyPageTrackingSupported() { return false; }
+
+bool trackDirtyPages(const void *owner, const RangeSet<rword> &ranges) {
+  return false;
+}
+
+bool takeDirtyPages(const void *owner, RangeSet<rword> &pages) {
+  return false;
+}
+
+bool resetDirtyPages(const void *owner) { return false; }
+
+void untrackDirtyPages(const void *owner) {}
+
+} // namespace QBDI
@@ -15,11 +15,13 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <algorithm>
 #include <bitset>
 #include <cstdint>
 #include <map>
 #include <string.h>
 #include <string>
+#include <thread>
 #include <utility>
 
 #include "llvm/ADT/StringRef.h"
@@ -35,19 +37,14 @@
 #include "Patch/Register.h"
 #include "Utility/InstAnalysis_prive.h"
 #include "Utility/LogSys.h"
+#include "Utility/Symbol.h"
 
 #include "QBDI/Bitmask.h"
 #include "QBDI/Config.h"
 #include "QBDI/InstAnalysis.h"
+#include "QBDI/Options.h"
 #include "QBDI/State.h"
 
-#ifndef QBDI_PLATFORM_WINDOWS
-#if defined(QBDI_PLATFORM_LINUX) && !defined(__USE_GNU)
-#define __USE_GNU
-#endif
-#include <dlfcn.h>
-#endif
-
 namespace QBDI {
 namespace InstructionAnalysis {
 
@@ -190,9 +187,47 @@ void analyseImplicitRegisters(InstAnalysis *instAnalysis,
   }
 }
 
+void analyseRegisterMasks(InstAnalysis *instAnalysis) {
+  for (uint16_t i = 0; i < instAnalysis->numOperands; i++) {
+    const OperandAnalysis &opa = instAnalysis->operands[i];
+    if (opa.regCtxIdx < 0) {
+      continue;
+    }
+    uint64_t *readMask;
+    uint64_t *writeMask;
+    unsigned bit;
+    if (opa.type == OPERAND_GPR) {
+      readMask = &instAnalysis->gprRead;
+      writeMask = &instAnalysis->gprWrite;
+      bit = opa.regCtxIdx;
+    } else if (opa.type == OPERAND_FPR) {
+      readMask = &instAnalysis->fprRead;
+      writeMask = &instAnalysis->fprWrite;
+      bit = opa.regCtxIdx / 16;
+    } else {
+      continue;
+    }
+    if (bit >= 64) {
+      continue;
+    }
+    if (opa.regAccess & REGISTER_READ) {
+      *readMask |= (1ull << bit);
+    }
+    if (opa.regAccess & REGISTER_WRITE) {
+      *writeMask |= (1ull << bit);
+    }
+  }
+  if (instAnalysis->flagsAccess & REGISTER_READ) {
+    instAnalysis->gprRead |= (1ull << REG_FLAG);
+  }
+  if (instAnalysis->flagsAccess & REGISTER_WRITE) {
+    instAnalysis->gprWrite |= (1ull << REG_FLAG);
+  }
+}
+
 void analyseOperands(InstAnalysis *instAnalysis, const llvm::MCInst &inst,
-                     const llvm::MCInstrDesc &desc,
-                     const llvm::MCRegisterInfo &MRI) {
+                     const OpcodeAnalysis &opcodeAnalysis,
+                     OpcodeAnalysisCache &cache, InstAnalysisArena *arena) {
   if (!instAnalysis) {
     // no instruction analysis
     return;
@@ -200,32 +235,37 @@ void analyseOperands(InstAnalysis *instAnalysis, const llvm::MCInst &inst,
   instAnalysis->numOperands = 0; // updated later because we could skip some
   instAnalysis->operands = NULL;
   // number of first def operand that are tied to a later used operand
-  unsigned operandBias = getBias(desc);
+  unsigned operandBias = opcodeAnalysis.operandBias;
+  const std::vector<OperandAnalysis> &implicitOperands =
+      opcodeAnalysis.implicitOperands;
   // Analysis of instruction operands
   uint8_t numOperands = inst.getNumOperands();
-  uint8_t numOperandsMax = numOperands + desc.getNumImplicitDefs() +
-                           desc.getNumImplicitUses() - operandBias;
-  // (R|E)SP are missing for RET and CALL in x86
-  numOperandsMax += getAdditionnalOperandNumber(inst, desc);
+  uint8_t numOperandsMax =
+      numOperands + implicitOperands.size() - operandBias;
   if (numOperandsMax == 0) {
     // no operand to analyse
     return;
   }
-  instAnalysis->operands = new OperandAnalysis[numOperandsMax]();
-  // find written registers
-  std::bitset<16> regWrites;
-  for (unsigned i = 0, e = desc.isVariadic() ? inst.getNumOperands()
-                                             : desc.getNumDefs();
-       i != e; ++i) {
-    const llvm::MCOperand &op = inst.getOperand(i);
-    if (op.isReg()) {
-      regWrites.set(i, true);
-    }
+  if (arena != nullptr) {
+    instAnalysis->operands = arena->allocate<OperandAnalysis>(numOperandsMax);
+  } else {
+    instAnalysis->operands = new OperandAnalysis[numOperandsMax]();
   }
+  // the written registers are the first defs
+  unsigned numWritten =
+      opcodeAnalysis.isVariadic ? numOperands : opcodeAnalysis.numDefs;
+  auto isWritten = [&inst, numWritten](unsigned i) {
+    return i < numWritten and inst.getOperand(i).isReg();
+  };
+  static const OpcodeAnalysis::OperandDesc unknownDesc = {
+      llvm::MCOI::OPERAND_UNKNOWN, -1, false, false};
   // for each instruction operands
   for (uint8_t i = operandBias; i < numOperands; i++) {
     const llvm::MCOperand &op = inst.getOperand(i);
-    const llvm::MCOperandInfo &opdesc = desc.OpInfo[i];
+    const OpcodeAnalysis::OperandDesc &opdesc =
+        (i < opcodeAnalysis.operandsDesc.size())
+            ? opcodeAnalysis.operandsDesc[i]
+            : unknownDesc;
     // fill a new operand analysis
     OperandAnalysis &opa = instAnalysis->operands[instAnalysis->numOperands];
     // reinitialise the opa if a previous iteration has write some value
@@ -236,17 +276,18 @@ void analyseOperands(InstAnalysis *instAnalysis, const llvm::MCInst &inst,
     }
     if (op.isReg()) {
       unsigned int regNo = op.getReg();
+      const RegisterAnalysis &regAnalysis = cache.getRegister(regNo);
       // don't reject regNo == 0 tp keep the same position of operand
       // ex : "lea rax, [rbx+10]" and "lea rax, [rbx+4*rcx+10]" will have the
       // same number of operand
-      if (isFlagRegister(regNo)) {
+      if (regAnalysis.isFlag) {
         instAnalysis->flagsAccess |=
-            regWrites.test(i) ? REGISTER_WRITE : REGISTER_READ;
+            isWritten(i) ? REGISTER_WRITE : REGISTER_READ;
         continue;
       }
       // fill the operand analysis
-      analyseRegister(opa, regNo, MRI);
-      switch (opdesc.OperandType) {
+      opa = regAnalysis.analysis;
+      switch (opdesc.operandType) {
         case llvm::MCOI::OPERAND_REGISTER:
           break;
         case llvm::MCOI::OPERAND_MEMORY:
@@ -257,38 +298,35 @@ void analyseOperands(InstAnalysis *instAnalysis, const llvm::MCInst &inst,
           break;
         default:
           QBDI_WARN("Not supported operandType {} for register operand",
-                    opdesc.OperandType);
+                    opdesc.operandType);
           continue;
       }
       if (regNo != 0) {
-        opa.regAccess = regWrites.test(i) ? REGISTER_WRITE : REGISTER_READ;
-
-        if (operandBias != 0) {
-          // verify if the register is allocate in the same place as anothe
-          // register
-          int tied_to = desc.getOperandConstraint(i, llvm::MCOI::TIED_TO);
-          if (tied_to != -1) {
-            opa.regAccess |=
-                regWrites.test(tied_to) ? REGISTER_WRITE : REGISTER_READ;
-          }
+        opa.regAccess = isWritten(i) ? REGISTER_WRITE : REGISTER_READ;
+
+        // verify if the register is allocate in the same place as another
+        // register
+        if (opdesc.tiedTo != -1) {
+          opa.regAccess |=
+              isWritten(opdesc.tiedTo) ? REGISTER_WRITE : REGISTER_READ;
         }
       }
       instAnalysis->numOperands++;
     } else if (op.isImm()) {
-      if (isFlagOperand(inst.getOpcode(), i, opdesc.OperandType)) {
+      if (opdesc.isFlag) {
         continue;
       }
       // fill the operand analysis
-      switch (opdesc.OperandType) {
+      switch (opdesc.operandType) {
         case llvm::MCOI::OPERAND_IMMEDIATE:
-          opa.size = getImmediateSize(inst, desc);
+          opa.size = opcodeAnalysis.immSize;
           break;
         case llvm::MCOI::OPERAND_MEMORY:
           opa.flag |= OPERANDFLAG_ADDR;
           opa.size = sizeof(rword);
           break;
         case llvm::MCOI::OPERAND_PCREL:
-          opa.size = getImmediateSize(inst, desc);
+          opa.size = opcodeAnalysis.immSize;
           opa.flag |= OPERANDFLAG_PCREL;
           break;
         case llvm::MCOI::OPERAND_UNKNOWN:
@@ -297,10 +335,10 @@ void analyseOperands(InstAnalysis *instAnalysis, const llvm::MCInst &inst,
           break;
         default:
           QBDI_WARN("Not supported operandType {} for immediate operand",
-                    opdesc.OperandType);
+                    opdesc.operandType);
           continue;
       }
-      if (opdesc.isPredicate()) {
+      if (opdesc.isPredicate) {
         opa.type = OPERAND_PRED;
       } else {
         opa.type = OPERAND_IMM;
@@ -310,41 +348,193 @@ void analyseOperands(InstAnalysis *instAnalysis, const llvm::MCInst &inst,
     }
   }
 
-  // analyse implicit registers (R/W)
-  analyseImplicitRegisters(instAnalysis, desc.getImplicitUses(), REGISTER_READ,
-                           MRI);
-  analyseImplicitRegisters(instAnalysis, desc.getImplicitDefs(), REGISTER_WRITE,
-                           MRI);
+  // implicit registers (R/W), analysed with the opcode
+  for (const OperandAnalysis &implicitOpa : implicitOperands) {
+    instAnalysis->operands[instAnalysis->numOperands++] = implicitOpa;
+  }
+  instAnalysis->flagsAccess |= opcodeAnalysis.implicitFlagsAccess;
+
+  analyseRegisterMasks(instAnalysis);
+}
 
+// The parts of the operand analysis which only depend on the opcode
+void analyseOpcodeOperands(OpcodeAnalysis &opAnalysis,
+                           const llvm::MCInst &inst,
+                           const llvm::MCInstrDesc &desc,
+                           const llvm::MCRegisterInfo &MRI) {
+  opAnalysis.operandBias = getBias(desc);
+  opAnalysis.immSize = getImmediateSize(inst, desc);
+  opAnalysis.numDefs = desc.getNumDefs();
+  opAnalysis.isVariadic = desc.isVariadic();
+  opAnalysis.operandsDesc.resize(desc.getNumOperands());
+  for (unsigned i = 0; i < desc.getNumOperands(); i++) {
+    const llvm::MCOperandInfo &opInfo = desc.OpInfo[i];
+    OpcodeAnalysis::OperandDesc &opdesc = opAnalysis.operandsDesc[i];
+    opdesc.operandType = opInfo.OperandType;
+    opdesc.isPredicate = opInfo.isPredicate();
+    opdesc.isFlag = isFlagOperand(inst.getOpcode(), i, opInfo.OperandType);
+    opdesc.tiedTo = (opAnalysis.operandBias != 0)
+                        ? desc.getOperandConstraint(i, llvm::MCOI::TIED_TO)
+                        : -1;
+  }
+
+  opAnalysis.implicitFlagsAccess = REGISTER_UNUSED;
   // (R|E)SP are missing for RET and CALL in x86
-  getAdditionnalOperand(instAnalysis, inst, desc, MRI);
+  size_t numImplicitMax = desc.getNumImplicitDefs() +
+                          desc.getNumImplicitUses() +
+                          getAdditionnalOperandNumber(inst, desc);
+  if (numImplicitMax == 0) {
+    return;
+  }
+  std::vector<OperandAnalysis> operands(numImplicitMax);
+  InstAnalysis implicitAnalysis;
+  memset(&implicitAnalysis, 0, sizeof(InstAnalysis));
+  implicitAnalysis.operands = operands.data();
+  analyseImplicitRegisters(&implicitAnalysis, desc.getImplicitUses(),
+                           REGISTER_READ, MRI);
+  analyseImplicitRegisters(&implicitAnalysis, desc.getImplicitDefs(),
+                           REGISTER_WRITE, MRI);
+  getAdditionnalOperand(&implicitAnalysis, inst, desc, MRI);
+  opAnalysis.implicitOperands.assign(
+      operands.begin(), operands.begin() + implicitAnalysis.numOperands);
+  opAnalysis.implicitFlagsAccess = implicitAnalysis.flagsAccess;
 }
 
 } // namespace InstructionAnalysis
 
+OpcodeAnalysisCache::OpcodeAnalysisCache(const llvm::MCInstrInfo &MCII,
+                                         const llvm::MCRegisterInfo &MRI)
+    : MCII(MCII), MRI(MRI), opcodes(MCII.getNumOpcodes()),
+      registers(MRI.getNumRegs()) {}
+
+const OpcodeAnalysis &OpcodeAnalysisCache::get(const llvm::MCInst &inst) {
+  unsigned opcode = inst.getOpcode();
+  QBDI_REQUIRE_ACTION(opcode < opcodes.size(), abort());
+  return opcodes.get(opcode, [this, &inst, opcode](OpcodeAnalysis &opa) {
+    const llvm::MCInstrDesc &desc = MCII.get(opcode);
+    opa.mnemonic = MCII.getName(opcode).data();
+    opa.isBranch = desc.isBranch();
+    opa.isCall = desc.isCall();
+    opa.isReturn = desc.isReturn();
+    opa.isCompare = desc.isCompare();
+    opa.isPredicable = desc.isPredicable();
+    opa.isMoveImm = desc.isMoveImmediate();
+    opa.loadSize = getReadSize(inst);
+    opa.storeSize = getWriteSize(inst);
+    opa.mayLoad = opa.loadSize != 0 || unsupportedRead(inst);
+    opa.mayStore = opa.storeSize != 0 || unsupportedWrite(inst);
+    opa.mayLoad_LLVM = desc.mayLoad();
+    opa.mayStore_LLVM = desc.mayStore();
+    InstructionAnalysis::analyseOpcodeCondition(opa, opcode, desc);
+    InstructionAnalysis::analyseOpcodeOperands(opa, inst, desc, MRI);
+  });
+}
+
+const RegisterAnalysis &OpcodeAnalysisCache::getRegister(unsigned regNo) {
+  QBDI_REQUIRE_ACTION(regNo < registers.size(), abort());
+  return registers.get(regNo, [this, regNo](RegisterAnalysis &reg) {
+    reg.isFlag = InstructionAnalysis::isFlagRegister(regNo);
+    if (not reg.isFlag) {
+      InstructionAnalysis::analyseRegister(reg.analysis, regNo, MRI);
+    }
+  });
+}
+
+void *InstAnalysisArena::allocate(size_t size, size_t align) {
+  size_t padding =
+      (align - reinterpret_cast<uintptr_t>(current) % align) % align;
+  if (size + padding > available) {
+    // a large allocation has its own chunk and the current chunk is kept
+    if (size > CHUNK_SIZE / 4) {
+      chunks.emplace_back(new uint8_t[size]());
+      allocatedSize += size;
+      return chunks.back().get();
+    }
+    chunks.emplace_back(new uint8_t[CHUNK_SIZE]());
+    allocatedSize += CHUNK_SIZE;
+    current = chunks.back().get();
+    available = CHUNK_SIZE;
+    padding = 0;
+  }
+  void *ptr = current + padding;
+  current += size + padding;
+  available -= size + padding;
+  return ptr;
+}
+
+void InstAnalysisArena::clear() {
+  chunks.clear();
+  current = nullptr;
+  available = 0;
+  allocatedSize = 0;
+}
+
+void releaseInstAnalysisContent(InstAnalysis &analysis) {
+  if (analysis.operands != nullptr) {
+    delete[] analysis.operands;
+    analysis.operands = nullptr;
+  }
+  if (analysis.disassembly != nullptr) {
+    delete[] analysis.disassembly;
+    analysis.disassembly = nullptr;
+  }
+}
+
+void copyInstAnalysisContent(InstAnalysis &analysis) {
+  if (analysis.operands != nullptr) {
+    OperandAnalysis *operands = new OperandAnalysis[analysis.numOperands];
+    std::copy(analysis.operands, analysis.operands + analysis.numOperands,
+              operands);
+    analysis.operands = operands;
+  }
+  if (analysis.disassembly != nullptr) {
+    size_t len = strlen(analysis.disassembly) + 1;
+    char *disassembly = new char[len];
+    memcpy(disassembly, analysis.disassembly, len);
+    analysis.disassembly = disassembly;
+  }
+}
+
 void InstAnalysisDestructor::operator()(InstAnalysis *ptr) const {
-  if (ptr == nullptr) {
+  if (shared != nullptr) {
+    releaseSharedAnalysis(shared);
     return;
   }
-  if (ptr->operands != nullptr) {
-    delete[] ptr->operands;
-  }
-  if (ptr->disassembly != nullptr) {
-    delete[] ptr->disassembly;
+  if (ptr == nullptr or arena != nullptr) {
+    return;
   }
+  releaseInstAnalysisContent(*ptr);
   delete ptr;
 }
 
 const InstAnalysis *analyzeInstMetadata(const InstMetadata &instMetadata,
                                         AnalysisType type,
-                                        const LLVMCPU &llvmcpu) {
+                                        const LLVMCPU &llvmcpu,
+                                        InstAnalysisArena *arena) {
 
   InstAnalysis *instAnalysis = instMetadata.analysis.get();
+  if (instAnalysis == nullptr and
+      (llvmcpu.getOptions() & Options::OPT_ENABLE_SHARED_ANALYSIS)) {
+    // a shared analysis is complete and is never modified
+    instMetadata.analysis = acquireSharedAnalysis(instMetadata, llvmcpu);
+    instAnalysis = instMetadata.analysis.get();
+    if (instAnalysis != nullptr) {
+      return instAnalysis;
+    }
+  }
   if (instAnalysis == nullptr) {
-    instAnalysis = new InstAnalysis;
-    // set all values to NULL/0/false
-    memset(instAnalysis, 0, sizeof(InstAnalysis));
-    instMetadata.analysis.reset(instAnalysis);
+    if (arena != nullptr) {
+      // the memory of the arena is already zeroed
+      instAnalysis = arena->allocate<InstAnalysis>();
+    } else {
+      instAnalysis = new InstAnalysis;
+      // set all values to NULL/0/false
+      memset(instAnalysis, 0, sizeof(InstAnalysis));
+    }
+    instMetadata.analysis = InstAnalysisPtr(instAnalysis, {arena, nullptr});
+  } else {
+    // complete the analysis with its own allocator
+    arena = instMetadata.analysis.get_deleter().arena;
   }
 
   uint32_t oldType = instAnalysis->analysisType;
@@ -356,72 +546,62 @@ const InstAnalysis *analyzeInstMetadata(const InstMetadata &instMetadata,
   }
 
   instAnalysis->analysisType = newType;
+  completeInstAnalysis(instAnalysis, missingType, instMetadata, llvmcpu,
+                       arena);
+  return instAnalysis;
+}
 
-  const llvm::MCInstrInfo &MCII = llvmcpu.getMCII();
+void completeInstAnalysis(InstAnalysis *instAnalysis, uint32_t missingType,
+                          const InstMetadata &instMetadata,
+                          const LLVMCPU &llvmcpu, InstAnalysisArena *arena) {
   const llvm::MCInst &inst = instMetadata.inst;
-  const llvm::MCInstrDesc &desc = MCII.get(inst.getOpcode());
 
   if (missingType & ANALYSIS_DISASSEMBLY) {
     std::string buffer = llvmcpu.showInst(inst, instMetadata.address);
     int len = buffer.size() + 1;
-    instAnalysis->disassembly = new char[len];
+    if (arena != nullptr) {
+      instAnalysis->disassembly = arena->allocate<char>(len);
+    } else {
+      instAnalysis->disassembly = new char[len];
+    }
     strncpy(instAnalysis->disassembly, buffer.c_str(), len);
     buffer.clear();
   }
 
+  OpcodeAnalysisCache &cache = llvmcpu.getOpcodeAnalysis();
+  const OpcodeAnalysis &opa = cache.get(inst);
+
   if (missingType & ANALYSIS_INSTRUCTION) {
     instAnalysis->address = instMetadata.address;
     instAnalysis->instSize = instMetadata.instSize;
     instAnalysis->affectControlFlow = instMetadata.modifyPC;
-    instAnalysis->isBranch = desc.isBranch();
-    instAnalysis->isCall = desc.isCall();
-    instAnalysis->isReturn = desc.isReturn();
-    instAnalysis->isCompare = desc.isCompare();
-    instAnalysis->isPredicable = desc.isPredicable();
-    instAnalysis->isMoveImm = desc.isMoveImmediate();
-    instAnalysis->loadSize = getReadSize(inst);
-    instAnalysis->storeSize = getWriteSize(inst);
-    instAnalysis->mayLoad =
-        instAnalysis->loadSize != 0 || unsupportedRead(inst);
-    instAnalysis->mayStore =
-        instAnalysis->storeSize != 0 || unsupportedWrite(inst);
-    instAnalysis->mayLoad_LLVM = desc.mayLoad();
-    instAnalysis->mayStore_LLVM = desc.mayStore();
-    instAnalysis->mnemonic = MCII.getName(inst.getOpcode()).data();
-
-    InstructionAnalysis::analyseCondition(instAnalysis, inst, desc);
+    instAnalysis->isBranch = opa.isBranch;
+    instAnalysis->isCall = opa.isCall;
+    instAnalysis->isReturn = opa.isReturn;
+    instAnalysis->isCompare = opa.isCompare;
+    instAnalysis->isPredicable = opa.isPredicable;
+    instAnalysis->isMoveImm = opa.isMoveImm;
+    instAnalysis->loadSize = opa.loadSize;
+    instAnalysis->storeSize = opa.storeSize;
+    instAnalysis->mayLoad = opa.mayLoad;
+    instAnalysis->mayStore = opa.mayStore;
+    instAnalysis->mayLoad_LLVM = opa.mayLoad_LLVM;
+    instAnalysis->mayStore_LLVM = opa.mayStore_LLVM;
+    instAnalysis->mnemonic = opa.mnemonic;
+    instAnalysis->condition = InstructionAnalysis::analyseCondition(opa, inst);
   }
 
   if (missingType & ANALYSIS_OPERANDS) {
     // analyse operands (immediates / registers)
-    InstructionAnalysis::analyseOperands(instAnalysis, inst, desc,
-                                         llvmcpu.getMRI());
+    InstructionAnalysis::analyseOperands(instAnalysis, inst, opa, cache,
+                                         arena);
   }
 
   if (missingType & ANALYSIS_SYMBOL) {
     // find nearest symbol (if any)
-#ifndef QBDI_PLATFORM_WINDOWS
-    Dl_info info;
-    const char *ptr;
-
-    int ret = dladdr((void *)instAnalysis->address, &info);
-    if (ret != 0) {
-      if (info.dli_sname) {
-        instAnalysis->symbol = info.dli_sname;
-        instAnalysis->symbolOffset =
-            instAnalysis->address - (rword)info.dli_saddr;
-      }
-      if (info.dli_fname) {
-        // dirty basename, but thead safe
-        if ((ptr = strrchr(info.dli_fname, '/')) != nullptr) {
-          instAnalysis->module = ptr + 1;
-        }
-      }
-    }
-#endif
+    findSymbol(instMetadata.address, instAnalysis->symbol,
+               instAnalysis->symbolOffset, instAnalysis->module);
   }
-
-  return instAnalysis;
 }
 
 } // namespace QBDI
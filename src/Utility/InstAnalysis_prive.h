@@ -18,11 +18,17 @@
 #ifndef INSTANALYSISPRIVE_H
 #define INSTANALYSISPRIVE_H
 
+#include <atomic>
 #include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <thread>
+#include <vector>
 
 #include "QBDI/InstAnalysis.h"
 
 namespace llvm {
+class MCInst;
 class MCInstrDesc;
 class MCInstrInfo;
 class MCRegisterInfo;
@@ -32,8 +38,46 @@ namespace QBDI {
 
 class InstMetadata;
 class LLVMCPU;
+struct SharedAnalysis;
 
+// Bump allocator of the analyses of an ExecBlock. The memory is zeroed and is
+// only released with the arena.
+class InstAnalysisArena {
+private:
+  static constexpr size_t CHUNK_SIZE = 16384;
+
+  std::vector<std::unique_ptr<uint8_t[]>> chunks;
+  uint8_t *current = nullptr;
+  size_t available = 0;
+  size_t allocatedSize = 0;
+
+public:
+  InstAnalysisArena() = default;
+
+  InstAnalysisArena(const InstAnalysisArena &) = delete;
+  InstAnalysisArena &operator=(const InstAnalysisArena &) = delete;
+
+  void *allocate(size_t size, size_t align);
+
+  template <typename T>
+  inline T *allocate(size_t nb = 1) {
+    return static_cast<T *>(allocate(sizeof(T) * nb, alignof(T)));
+  }
+
+  // Bytes of the chunks of the arena
+  inline size_t getAllocatedSize() const { return allocatedSize; }
+
+  // Release all the allocations, the analyses of the arena must be dropped
+  void clear();
+};
+
+// An analysis allocated in an arena is released with the arena. The operands
+// and the disassembly of an analysis use the same allocator as the analysis.
+// A shared analysis is released by its last owner.
 struct InstAnalysisDestructor {
+  InstAnalysisArena *arena = nullptr;
+  SharedAnalysis *shared = nullptr;
+
   void operator()(InstAnalysis *ptr) const;
 };
 
@@ -41,7 +85,134 @@ using InstAnalysisPtr = std::unique_ptr<InstAnalysis, InstAnalysisDestructor>;
 
 const InstAnalysis *analyzeInstMetadata(const InstMetadata &instMetadata,
                                         AnalysisType type,
-                                        const LLVMCPU &llvmcpu);
+                                        const LLVMCPU &llvmcpu,
+                                        InstAnalysisArena *arena = nullptr);
+
+// Compute the missingType parts of an analysis
+void completeInstAnalysis(InstAnalysis *instAnalysis, uint32_t missingType,
+                          const InstMetadata &instMetadata,
+                          const LLVMCPU &llvmcpu, InstAnalysisArena *arena);
+
+// Release the operands and the disassembly of a heap allocated analysis
+void releaseInstAnalysisContent(InstAnalysis &analysis);
+
+// Copy the operands and the disassembly of an analysis in the heap
+void copyInstAnalysisContent(InstAnalysis &analysis);
+
+// Obtain the complete analysis of an instruction from the process-wide cache
+// of OPT_ENABLE_SHARED_ANALYSIS. The analysis is computed by its first owner
+// and released with the last one. Return nullptr if the instruction cannot be
+// shared.
+InstAnalysisPtr acquireSharedAnalysis(const InstMetadata &instMetadata,
+                                      const LLVMCPU &llvmcpu);
+
+void releaseSharedAnalysis(SharedAnalysis *shared);
+
+// The fields of ANALYSIS_INSTRUCTION which only depend on the opcode
+struct OpcodeAnalysis {
+  const char *mnemonic;
+  uint32_t loadSize;
+  uint32_t storeSize;
+  // index of the operand of the condition code, -1 if the condition doesn't
+  // depend on the operands
+  int condOperand;
+  ConditionType condition;
+  bool isBranch;
+  bool isCall;
+  bool isReturn;
+  bool isCompare;
+  bool isPredicable;
+  bool isMoveImm;
+  bool mayLoad;
+  bool mayStore;
+  bool mayLoad_LLVM;
+  bool mayStore_LLVM;
+
+  // ANALYSIS_OPERANDS
+  // The parts of the explicit operand analysis which only depend on the
+  // operand index
+  struct OperandDesc {
+    uint8_t operandType;
+    // index of the tied operand, -1 if none
+    int8_t tiedTo;
+    bool isPredicate;
+    bool isFlag;
+  };
+  std::vector<OperandDesc> operandsDesc;
+  // the implicit registers (and the registers missing in LLVM description),
+  // merged
+  std::vector<OperandAnalysis> implicitOperands;
+  RegisterAccessType implicitFlagsAccess;
+  uint8_t operandBias;
+  uint8_t immSize;
+  uint8_t numDefs;
+  bool isVariadic;
+};
+
+// The analysis of a register of an operand
+struct RegisterAnalysis {
+  OperandAnalysis analysis;
+  bool isFlag;
+};
+
+// Table of values computed on first use. The table may be used by several
+// threads.
+template <typename T>
+class LazyTable {
+private:
+  struct Entry {
+    // 0: not computed, 1: in computation, 2: ready
+    std::atomic<uint8_t> state{0};
+    T value;
+  };
+
+  std::unique_ptr<Entry[]> entries;
+  size_t nbEntries;
+
+public:
+  LazyTable(size_t nbEntries)
+      : entries(std::make_unique<Entry[]>(nbEntries)), nbEntries(nbEntries) {}
+
+  inline size_t size() const { return nbEntries; }
+
+  template <typename F>
+  const T &get(size_t index, F &&init) {
+    Entry &entry = entries[index];
+    if (entry.state.load(std::memory_order_acquire) == 2) {
+      return entry.value;
+    }
+    uint8_t expected = 0;
+    if (not entry.state.compare_exchange_strong(expected, 1,
+                                                std::memory_order_acq_rel)) {
+      // another thread is computing the entry
+      while (entry.state.load(std::memory_order_acquire) != 2) {
+        std::this_thread::yield();
+      }
+      return entry.value;
+    }
+    init(entry.value);
+    entry.state.store(2, std::memory_order_release);
+    return entry.value;
+  }
+};
+
+// Tables of the OpcodeAnalysis and of the RegisterAnalysis of a LLVMCPU, each
+// opcode and each register is analysed the first time it's needed.
+class OpcodeAnalysisCache {
+private:
+  const llvm::MCInstrInfo &MCII;
+  const llvm::MCRegisterInfo &MRI;
+  LazyTable<OpcodeAnalysis> opcodes;
+  LazyTable<RegisterAnalysis> registers;
+
+public:
+  OpcodeAnalysisCache(const llvm::MCInstrInfo &MCII,
+                      const llvm::MCRegisterInfo &MRI);
+
+  const OpcodeAnalysis &get(const llvm::MCInst &inst);
+
+  const RegisterAnalysis &getRegister(unsigned regNo);
+};
 namespace InstructionAnalysis {
 
 void analyseRegister(OperandAnalysis &opa, unsigned int regNo,
@@ -51,8 +222,12 @@ void tryMergeCurrentRegister(InstAnalysis *instAnalysis);
 // Arch specific
 // =============
 
-void analyseCondition(InstAnalysis *instAnalysis, const llvm::MCInst &inst,
-                      const llvm::MCInstrDesc &desc);
+// Search the operand of the condition code of an opcode, or set its
+// constant condition
+void analyseOpcodeCondition(OpcodeAnalysis &opAnalysis, unsigned opcode,
+                            const llvm::MCInstrDesc &desc);
+ConditionType analyseCondition(const OpcodeAnalysis &opAnalysis,
+                               const llvm::MCInst &inst);
 bool isFlagOperand(unsigned opcode, unsigned opNum, unsigned operandType);
 unsigned getBias(const llvm::MCInstrDesc &desc);
 
@@ -15,6 +15,7 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <chrono>
 #include <utility>
 
 #include "Utility/LogSys.h"
@@ -38,6 +39,28 @@ static QBDI::Logger logger;
 
 namespace QBDI {
 
+bool LogLimiter::allow(uint64_t &nbSuppressed) {
+  int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch())
+                    .count();
+  return allow(now, nbSuppressed);
+}
+
+bool LogLimiter::allow(int64_t nowMs, uint64_t &nbSuppressed) {
+  int64_t start = windowStart.load(std::memory_order_relaxed);
+  if (nowMs - start >= WINDOW_MS and
+      windowStart.compare_exchange_strong(start, nowMs,
+                                          std::memory_order_relaxed)) {
+    count.store(0, std::memory_order_relaxed);
+  }
+  if (count.fetch_add(1, std::memory_order_relaxed) >= BURST) {
+    suppressed.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  nbSuppressed = suppressed.exchange(0, std::memory_order_relaxed);
+  return true;
+}
+
 Logger::Logger(void) {
   setDefaultLogger();
   spdlog::set_pattern("%^[%l] (%!) %s:%#%$ %v");
@@ -18,16 +18,39 @@
 #ifndef LOGSYS_H
 #define LOGSYS_H
 
+#include <atomic>
 #include <memory>
+#include <stdint.h>
 #include <string>
 
 #include "QBDI/Config.h"
 #include "QBDI/Logs.h"
 #include "spdlog/spdlog.h"
 
-#define QBDI_INFO(...) SPDLOG_INFO(__VA_ARGS__)
-#define QBDI_WARN(...) SPDLOG_WARN(__VA_ARGS__)
-#define QBDI_ERROR(...) SPDLOG_ERROR(__VA_ARGS__)
+// The messages of a call site are limited to a burst per second, the
+// suppressed messages are counted and reported with the next message. A
+// suppressed message isn't formatted.
+#define QBDI_LOG_LIMITED(level, ...)                                          \
+  do {                                                                        \
+    static QBDI::LogLimiter qbdiLogLimiter_;                                  \
+    uint64_t qbdiSuppressed_ = 0;                                             \
+    if (spdlog::default_logger_raw()->should_log(level) and                   \
+        qbdiLogLimiter_.allow(qbdiSuppressed_)) {                             \
+      if (qbdiSuppressed_ != 0) {                                             \
+        SPDLOG_LOGGER_CALL(spdlog::default_logger_raw(), level,               \
+                           "{} similar messages suppressed", qbdiSuppressed_); \
+      }                                                                       \
+      SPDLOG_LOGGER_CALL(spdlog::default_logger_raw(), level, __VA_ARGS__);   \
+    }                                                                         \
+  } while (0)
+
+#if SPDLOG_ACTIVE_LEVEL <= SPDLOG_LEVEL_INFO
+#define QBDI_INFO(...) QBDI_LOG_LIMITED(spdlog::level::info, __VA_ARGS__)
+#else
+#define QBDI_INFO(...) (void)0
+#endif
+#define QBDI_WARN(...) QBDI_LOG_LIMITED(spdlog::level::warn, __VA_ARGS__)
+#define QBDI_ERROR(...) QBDI_LOG_LIMITED(spdlog::level::err, __VA_ARGS__)
 #define QBDI_CRITICAL(...) SPDLOG_CRITICAL(__VA_ARGS__)
 
 #if defined(QBDI_LOG_DEBUG)
@@ -50,6 +73,24 @@
 
 namespace QBDI {
 
+class LogLimiter {
+public:
+  static const uint32_t BURST = 16;
+  static const int64_t WINDOW_MS = 1000;
+
+  constexpr LogLimiter() : windowStart(0), count(0), suppressed(0) {}
+
+  // Return true if the message can be written, with the number of messages
+  // suppressed since the last written one
+  bool allow(uint64_t &nbSuppressed);
+  bool allow(int64_t nowMs, uint64_t &nbSuppressed);
+
+private:
+  std::atomic<int64_t> windowStart;
+  std::atomic<uint32_t> count;
+  std::atomic<uint64_t> suppressed;
+};
+
 class Logger {
 public:
   Logger(void);
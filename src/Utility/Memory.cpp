@@ -17,6 +17,7 @@
  */
 #include <iterator>
 #include <memory>
+#include <mutex>
 #include <set>
 #include <stdarg.h>
 #include <stdint.h>
@@ -31,11 +32,66 @@
 #include "QBDI/Range.h"
 #include "QBDI/State.h"
 #include "Utility/LogSys.h"
+#include "Utility/System.h"
 
 #define FRAME_LENGTH 16
 
 namespace QBDI {
 
+namespace {
+
+// Snapshot of the memory maps, with and without the full path of the modules
+struct ProcessMapsSnapshot {
+  std::mutex lock;
+  bool valid[2] = {false, false};
+  uint64_t generation[2] = {0, 0};
+  std::vector<MemoryMap> maps[2];
+  // sorted names of the modules of maps[0]
+  bool modulesValid = false;
+  std::vector<std::string> modules;
+};
+
+// Never destroyed: a static VM may instrument a module after the end of main
+ProcessMapsSnapshot &getProcessMapsSnapshot() {
+  static ProcessMapsSnapshot *snapshot = new ProcessMapsSnapshot;
+  return *snapshot;
+}
+
+// Refresh the snapshot if needed. The lock of the snapshot must be held.
+const std::vector<MemoryMap> &updateSnapshot(ProcessMapsSnapshot &snapshot,
+                                             bool full_path) {
+  uint64_t generation = 0;
+  bool tracked = getModulesGeneration(generation);
+  size_t i = full_path ? 1 : 0;
+
+  if (not snapshot.valid[i] or
+      (tracked and snapshot.generation[i] != generation)) {
+    snapshot.maps[i] = getCurrentProcessMaps(full_path);
+    snapshot.generation[i] = generation;
+    snapshot.valid[i] = true;
+    if (i == 0) {
+      snapshot.modulesValid = false;
+    }
+  }
+  return snapshot.maps[i];
+}
+
+// Append a name to a string pool of the caller, return its offset or
+// QBDI_MEMORYMAP_NO_NAME if the pool is too small
+uint32_t writeName(const std::string &name, char *pool, size_t poolSize,
+                   size_t &poolUsed) {
+  size_t offset = poolUsed;
+  poolUsed += name.size() + 1;
+  if (pool == nullptr or poolUsed > poolSize or
+      offset >= QBDI_MEMORYMAP_NO_NAME) {
+    return QBDI_MEMORYMAP_NO_NAME;
+  }
+  memcpy(pool + offset, name.c_str(), name.size() + 1);
+  return static_cast<uint32_t>(offset);
+}
+
+} // anonymous namespace
+
 // C++ method
 std::vector<std::string> getModuleNames() {
   std::set<std::string> modules;
@@ -47,6 +103,20 @@ std::vector<std::string> getModuleNames() {
   return {std::begin(modules), std::end(modules)};
 }
 
+std::vector<MemoryMap> getCachedProcessMaps(bool full_path) {
+  ProcessMapsSnapshot &snapshot = getProcessMapsSnapshot();
+  std::lock_guard<std::mutex> guard(snapshot.lock);
+  return updateSnapshot(snapshot, full_path);
+}
+
+void invalidateProcessMapsCache() {
+  ProcessMapsSnapshot &snapshot = getProcessMapsSnapshot();
+  std::lock_guard<std::mutex> guard(snapshot.lock);
+  snapshot.valid[0] = false;
+  snapshot.valid[1] = false;
+  snapshot.modulesValid = false;
+}
+
 void *alignedAlloc(size_t size, size_t align) {
   void *allocated = nullptr;
   // Alignment needs to be a power of 2
@@ -203,6 +273,40 @@ qbdi_MemoryMap *qbdi_getCurrentProcessMaps(bool full_path, size_t *size) {
   return convert_MemoryMap_to_C(getCurrentProcessMaps(full_path), size);
 }
 
+qbdi_MemoryMap *qbdi_getCachedProcessMaps(bool full_path, size_t *size) {
+  if (size == NULL)
+    return NULL;
+  return convert_MemoryMap_to_C(getCachedProcessMaps(full_path), size);
+}
+
+size_t qbdi_getCachedProcessMapsBuffer(bool full_path,
+                                       qbdi_MemoryMapEntry *maps,
+                                       size_t capacity, char *pool,
+                                       size_t poolSize, size_t *poolNeeded) {
+  ProcessMapsSnapshot &snapshot = getProcessMapsSnapshot();
+  std::lock_guard<std::mutex> guard(snapshot.lock);
+  const std::vector<MemoryMap> &snapshotMaps =
+      updateSnapshot(snapshot, full_path);
+
+  size_t poolUsed = 0;
+  for (size_t i = 0; i < snapshotMaps.size(); i++) {
+    uint32_t name = writeName(snapshotMaps[i].name, pool, poolSize, poolUsed);
+    if (maps != nullptr and i < capacity) {
+      maps[i].start = snapshotMaps[i].range.start();
+      maps[i].end = snapshotMaps[i].range.end();
+      maps[i].permission =
+          static_cast<qbdi_Permission>(snapshotMaps[i].permission);
+      maps[i].name = name;
+    }
+  }
+  if (poolNeeded != nullptr) {
+    *poolNeeded = poolUsed;
+  }
+  return snapshotMaps.size();
+}
+
+void qbdi_invalidateProcessMapsCache() { invalidateProcessMapsCache(); }
+
 void qbdi_freeMemoryMapArray(qbdi_MemoryMap *arr, size_t size) {
   for (size_t i = 0; i < size; i++) {
     if (arr[i].name) {
@@ -228,6 +332,36 @@ char **qbdi_getModuleNames(size_t *size) {
   return names;
 }
 
+size_t qbdi_getCachedModuleNamesBuffer(uint32_t *names, size_t capacity,
+                                       char *pool, size_t poolSize,
+                                       size_t *poolNeeded) {
+  ProcessMapsSnapshot &snapshot = getProcessMapsSnapshot();
+  std::lock_guard<std::mutex> guard(snapshot.lock);
+  const std::vector<MemoryMap> &snapshotMaps = updateSnapshot(snapshot, false);
+  if (not snapshot.modulesValid) {
+    std::set<std::string> modules;
+    for (const MemoryMap &m : snapshotMaps) {
+      if (not m.name.empty()) {
+        modules.insert(m.name);
+      }
+    }
+    snapshot.modules.assign(modules.begin(), modules.end());
+    snapshot.modulesValid = true;
+  }
+
+  size_t poolUsed = 0;
+  for (size_t i = 0; i < snapshot.modules.size(); i++) {
+    uint32_t name = writeName(snapshot.modules[i], pool, poolSize, poolUsed);
+    if (names != nullptr and i < capacity) {
+      names[i] = name;
+    }
+  }
+  if (poolNeeded != nullptr) {
+    *poolNeeded = poolUsed;
+  }
+  return snapshot.modules.size();
+}
+
 void *qbdi_alignedAlloc(size_t size, size_t align) {
   return alignedAlloc(size, align);
 }
@@ -17,6 +17,8 @@
  */
 #include <algorithm>
 #include <ctype.h>
+#include <link.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -25,13 +27,43 @@
 #include <vector>
 
 #include "QBDI/Bitmask.h"
+#include "QBDI/Config.h"
 #include "QBDI/Memory.hpp"
 #include "QBDI/Range.h"
 #include "QBDI/State.h"
 #include "Utility/LogSys.h"
+#include "Utility/System.h"
 
 namespace QBDI {
 
+bool getModulesGeneration(uint64_t &generation) {
+#if defined(QBDI_PLATFORM_LINUX)
+  struct ModulesCounters {
+    bool found;
+    uint64_t generation;
+  } counters = {false, 0};
+
+  // The counters of the loader are given with every module, the iteration
+  // stops at the first one.
+  dl_iterate_phdr(
+      [](struct dl_phdr_info *info, size_t size, void *data) -> int {
+        ModulesCounters *counters = static_cast<ModulesCounters *>(data);
+        if (size >= offsetof(struct dl_phdr_info, dlpi_subs) +
+                        sizeof(info->dlpi_subs)) {
+          counters->found = true;
+          counters->generation = info->dlpi_adds + info->dlpi_subs;
+        }
+        return 1;
+      },
+      &counters);
+  generation = counters.generation;
+  return counters.found;
+#else
+  // the counters of the loader aren't available on every Android version
+  return false;
+#endif
+}
+
 std::vector<MemoryMap> getCurrentProcessMaps(bool full_path) {
   return getRemoteProcessMaps(getpid(), full_path);
 }
@@ -20,7 +20,10 @@
 #include "QBDI/Memory.h"
 #include "QBDI/Memory.hpp"
 #include "Utility/LogSys.h"
+#include "Utility/System.h"
 
+#include <atomic>
+#include <mutex>
 #include <set>
 
 #include <mach-o/dyld.h>
@@ -163,6 +166,22 @@ uintptr_t getImageSlideWithHeader(const struct dyld_image_info *image_info,
   return 0;
 }
 
+static std::atomic<uint64_t> modulesGeneration{0};
+
+static void onModuleChange(const struct mach_header *, intptr_t) {
+  modulesGeneration.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool getModulesGeneration(uint64_t &generation) {
+  static std::once_flag registered;
+  std::call_once(registered, []() {
+    _dyld_register_func_for_add_image(onModuleChange);
+    _dyld_register_func_for_remove_image(onModuleChange);
+  });
+  generation = modulesGeneration.load(std::memory_order_relaxed);
+  return true;
+}
+
 std::vector<MemoryMap> getCurrentProcessMaps(bool full_path) {
   return getRemoteProcessMaps(getpid(), full_path);
 }
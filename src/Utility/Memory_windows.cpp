@@ -20,6 +20,7 @@
 #include "QBDI/Memory.h"
 #include "QBDI/Memory.hpp"
 #include "Utility/LogSys.h"
+#include "Utility/System.h"
 
 #include <Psapi.h>
 #include <Windows.h>
@@ -34,6 +35,8 @@ namespace QBDI {
 #define PROT_ISWRITE(PROT) ((PROT)&0xCC)
 #define PROT_ISEXEC(PROT) ((PROT)&0xF0)
 
+bool getModulesGeneration(uint64_t &generation) { return false; }
+
 std::vector<MemoryMap> getCurrentProcessMaps(bool full_path) {
   return getRemoteProcessMaps(GetCurrentProcessId(), full_path);
 }
@@ -0,0 +1,237 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+#include "QBDI/Errors.h"
+#include "QBDI/Observer.h"
+#include "QBDI/VM.h"
+#include "Utility/LogSys.h"
+
+namespace QBDI {
+
+namespace {
+
+// Queue of a worker thread, the instrumented thread is the only producer
+class ObserverShard {
+private:
+  std::vector<ObservedState> states;
+  size_t mask;
+  // head is written by the producer, tail by the worker thread once the
+  // callback of the state returned
+  alignas(64) std::atomic<size_t> head{0};
+  alignas(64) std::atomic<size_t> tail{0};
+  std::atomic<bool> stop{false};
+
+  const ObserverCbLambda &cbk;
+  std::thread worker;
+
+  void run() {
+    while (true) {
+      bool stopping = stop.load(std::memory_order_acquire);
+      size_t t = tail.load(std::memory_order_relaxed);
+      size_t h = head.load(std::memory_order_acquire);
+      for (; t != h; t++) {
+        cbk(states[t & mask]);
+        tail.store(t + 1, std::memory_order_release);
+      }
+      if (stopping) {
+        return;
+      }
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+  }
+
+public:
+  ObserverShard(const ObserverCbLambda &cbk, size_t capacity) : cbk(cbk) {
+    size_t size = 16;
+    while (size < capacity) {
+      size <<= 1;
+    }
+    states.resize(size);
+    mask = size - 1;
+    worker = std::thread(&ObserverShard::run, this);
+  }
+
+  ~ObserverShard() {
+    stop.store(true, std::memory_order_release);
+    worker.join();
+  }
+
+  // the state is written in place and published by commit
+  ObservedState &reserve() {
+    size_t h = head.load(std::memory_order_relaxed);
+    // no state is dropped, the producer waits for the worker
+    while (h - tail.load(std::memory_order_acquire) > mask) {
+      std::this_thread::yield();
+    }
+    return states[h & mask];
+  }
+
+  void commit() {
+    head.store(head.load(std::memory_order_relaxed) + 1,
+               std::memory_order_release);
+  }
+
+  void flush() {
+    size_t h = head.load(std::memory_order_relaxed);
+    while (tail.load(std::memory_order_acquire) != h) {
+      std::this_thread::yield();
+    }
+  }
+};
+
+struct ObserverFunction {
+  ObserverCallback cbk;
+  void *data;
+
+  void operator()(const ObservedState &state) const { cbk(&state, data); }
+};
+
+} // anonymous namespace
+
+class ObserverQueue {
+private:
+  ObserverCbLambda cbk;
+  std::vector<std::unique_ptr<ObserverShard>> shards;
+  size_t next = 0;
+
+public:
+  const uint32_t registers;
+  const bool memory;
+
+  ObserverQueue(const ObserverCbLambda &cbk, uint32_t registers, bool memory,
+                size_t workers, size_t capacity)
+      : cbk(cbk), registers(registers), memory(memory) {
+    workers = std::max<size_t>(workers, 1);
+    for (size_t i = 0; i < workers; i++) {
+      shards.push_back(std::make_unique<ObserverShard>(this->cbk, capacity));
+    }
+  }
+
+  void capture(VM &vm, GPRState *gprState) {
+    ObserverShard &shard = *shards[next];
+    if (++next == shards.size()) {
+      next = 0;
+    }
+    ObservedState &state = shard.reserve();
+    state.address = QBDI_GPR_GET(gprState, REG_PC);
+    memset(&state.gprState, 0, sizeof(GPRState));
+    for (unsigned i = 0; i < NUM_GPR; i++) {
+      if ((registers & (1u << i)) != 0) {
+        QBDI_GPR_SET(&state.gprState, i, QBDI_GPR_GET(gprState, i));
+      }
+    }
+    state.nbAccess = 0;
+    if (memory) {
+      size_t nb =
+          vm.getInstMemoryAccess(state.access, QBDI_OBSERVER_MAX_ACCESS);
+      state.nbAccess = std::min<size_t>(nb, QBDI_OBSERVER_MAX_ACCESS);
+    }
+    shard.commit();
+  }
+
+  void flush() {
+    for (auto &shard : shards) {
+      shard->flush();
+    }
+  }
+};
+
+// =========================
+
+Observer::Observer(const ObserverCbLambda &cbk, uint32_t registers,
+                   bool memory, size_t workers, size_t capacity)
+    : queue(std::make_unique<ObserverQueue>(cbk, registers, memory, workers,
+                                            capacity)) {}
+
+Observer::Observer(ObserverCallback cbk, void *data, uint32_t registers,
+                   bool memory, size_t workers, size_t capacity)
+    : Observer(ObserverFunction{cbk, data}, registers, memory, workers,
+               capacity) {}
+
+Observer::~Observer() = default;
+
+void Observer::flush() { queue->flush(); }
+
+uint32_t Observer::attach(VM &vm, InstPosition pos) {
+  if (queue->memory) {
+    if (not vm.recordMemoryAccess(MEMORY_READ_WRITE)) {
+      return VMError::INVALID_EVENTID;
+    }
+    return vm.addCodeCB(pos, observeCB, this);
+  }
+  return vm.addCodeCBLight(
+      pos, observeCB, this,
+      static_cast<CallbackFootprint>(queue->registers & FOOTPRINT_ALL_GPR));
+}
+
+uint32_t Observer::attachRange(VM &vm, rword start, rword end,
+                               InstPosition pos) {
+  if (queue->memory) {
+    if (not vm.recordMemoryAccessRange(start, end, MEMORY_READ_WRITE)) {
+      return VMError::INVALID_EVENTID;
+    }
+    return vm.addCodeRangeCB(start, end, pos, observeCB, this);
+  }
+  return vm.addCodeRangeCBLight(
+      start, end, pos, observeCB, this,
+      static_cast<CallbackFootprint>(queue->registers & FOOTPRINT_ALL_GPR));
+}
+
+VMAction Observer::observeCB(VMInstanceRef vm, GPRState *gprState,
+                             FPRState *fprState, void *data) {
+  static_cast<Observer *>(data)->queue->capture(*vm, gprState);
+  return CONTINUE;
+}
+
+// =========================
+
+ObserverRef qbdi_newObserver(ObserverCallback cbk, void *data,
+                             uint32_t registers, bool memory, size_t workers,
+                             size_t capacity) {
+  QBDI_REQUIRE_ACTION(cbk != nullptr, return nullptr);
+  return new Observer(cbk, data, registers, memory, workers, capacity);
+}
+
+void qbdi_deleteObserver(ObserverRef observer) { delete observer; }
+
+void qbdi_flushObserver(ObserverRef observer) {
+  QBDI_REQUIRE_ACTION(observer != nullptr, return);
+  observer->flush();
+}
+
+uint32_t qbdi_attachObserver(ObserverRef observer, VMInstanceRef instance,
+                             InstPosition pos) {
+  QBDI_REQUIRE_ACTION(observer != nullptr, return VMError::INVALID_EVENTID);
+  QBDI_REQUIRE_ACTION(instance != nullptr, return VMError::INVALID_EVENTID);
+  return observer->attach(*instance, pos);
+}
+
+uint32_t qbdi_attachObserverRange(ObserverRef observer, VMInstanceRef instance,
+                                  rword start, rword end, InstPosition pos) {
+  QBDI_REQUIRE_ACTION(observer != nullptr, return VMError::INVALID_EVENTID);
+  QBDI_REQUIRE_ACTION(instance != nullptr, return VMError::INVALID_EVENTID);
+  return observer->attachRange(*instance, start, end, pos);
+}
+
+} // namespace QBDI
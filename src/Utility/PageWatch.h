@@ -0,0 +1,93 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef QBDI_PAGEWATCH_H
+#define QBDI_PAGEWATCH_H
+
+#include <vector>
+
+#include "QBDI/Callback.h"
+#include "QBDI/Range.h"
+#include "QBDI/State.h"
+
+namespace QBDI {
+
+/*! The page watch protects the pages of some ranges of memory and records the
+ * address of the instructions that access them. The faulting instruction is
+ * executed in single step with the original protection of the page, then the
+ * page is protected again.
+ *
+ * The registry is process wide, each set of pages is identified by an owner.
+ */
+
+/*! Return true if the page watch is available on this platform.
+ */
+bool isPageWatchSupported();
+
+/*! Protect the pages of a range against the accesses of a type for an owner.
+ *
+ * @param[in] owner  The owner of the watch.
+ * @param[in] range  The range of memory to watch.
+ * @param[in] type   The type of access to fault on.
+ *
+ * @return False if the pages cannot be watched.
+ */
+bool watchPages(const void *owner, Range<rword> range, MemoryAccessType type);
+
+/*! Protect the writable pages of a range against the writes until their first
+ * write. The faulting write is executed with the original protection of the
+ * page, which isn't protected again. The pages which aren't writable are
+ * ignored. An owner uses either watchPages or watchPagesOnce.
+ *
+ * @param[in]  owner    The owner of the watch.
+ * @param[in]  range    The range of memory to watch.
+ * @param[out] watched  The pages protected for the owner are added.
+ *
+ * @return False if some pages cannot be watched.
+ */
+bool watchPagesOnce(const void *owner, Range<rword> range,
+                    RangeSet<rword> &watched);
+
+/*! Restore the protection of all the pages watched by an owner.
+ *
+ * @param[in] owner  The owner of the watch.
+ */
+void unwatchPages(const void *owner);
+
+/*! Move the address of the instructions which have faulted on the pages of an
+ * owner since the last call.
+ *
+ * @param[in]  owner  The owner of the watch.
+ * @param[out] pcs    The addresses of the faulting instructions.
+ *
+ * @return True if at least one address was moved in pcs.
+ */
+bool takePageFaults(const void *owner, std::vector<rword> &pcs);
+
+/*! Move the pages watched with watchPagesOnce by an owner which have been
+ * written since the last call.
+ *
+ * @param[in]  owner  The owner of the watch.
+ * @param[out] pages  The written pages.
+ *
+ * @return True if at least one page was moved in pages.
+ */
+bool takeWrittenPages(const void *owner, RangeSet<rword> &pages);
+
+} // namespace QBDI
+
+#endif // QBDI_PAGEWATCH_H
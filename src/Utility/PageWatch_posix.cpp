@@ -0,0 +1,382 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <signal.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+#include "QBDI/Config.h"
+#if defined(QBDI_PLATFORM_OSX)
+#include <sys/ucontext.h>
+#else
+#include <ucontext.h>
+#endif
+
+#include "QBDI/Bitmask.h"
+#include "QBDI/Memory.hpp"
+#include "Utility/LogSys.h"
+#include "Utility/PageWatch.h"
+
+namespace QBDI {
+
+namespace {
+
+constexpr size_t MAX_WATCHED_PAGES = 1024;
+constexpr size_t MAX_PAGE_FAULTS = 256;
+constexpr rword TRAP_FLAG = 0x100;
+
+// The slots are read by the signal handlers without lock. A slot is free when
+// its page is 0.
+struct WatchedPage {
+  std::atomic<rword> page;
+  const void *owner;
+  // protection of the page while it is watched by the owner
+  int prot;
+  // protection of the page before any watch
+  int origProt;
+  // the original protection is restored for a single step
+  std::atomic<bool> lifted;
+  // watchPagesOnce: the slot is freed by the first write
+  bool once;
+};
+
+// A fault is pending while its owner is not nullptr. The pc is the written
+// page for the owners of watchPagesOnce.
+struct PageFault {
+  std::atomic<const void *> owner;
+  rword pc;
+};
+
+WatchedPage watchedPages[MAX_WATCHED_PAGES];
+PageFault pageFaults[MAX_PAGE_FAULTS];
+std::atomic<size_t> nextFault{0};
+std::atomic<size_t> nbPendingFaults{0};
+std::atomic<size_t> nbLiftedPages{0};
+
+std::mutex watchMutex;
+struct sigaction oldSegvAction;
+struct sigaction oldBusAction;
+struct sigaction oldTrapAction;
+rword pageSize = 0;
+
+inline rword &contextPC(void *ctx) {
+  ucontext_t *uc = static_cast<ucontext_t *>(ctx);
+#if defined(QBDI_PLATFORM_OSX) && defined(QBDI_ARCH_X86_64)
+  return reinterpret_cast<rword &>(uc->uc_mcontext->__ss.__rip);
+#elif defined(QBDI_PLATFORM_OSX)
+  return reinterpret_cast<rword &>(uc->uc_mcontext->__ss.__eip);
+#elif defined(QBDI_ARCH_X86_64)
+  return reinterpret_cast<rword &>(uc->uc_mcontext.gregs[REG_RIP]);
+#else
+  return reinterpret_cast<rword &>(uc->uc_mcontext.gregs[REG_EIP]);
+#endif
+}
+
+inline rword &contextFlags(void *ctx) {
+  ucontext_t *uc = static_cast<ucontext_t *>(ctx);
+#if defined(QBDI_PLATFORM_OSX) && defined(QBDI_ARCH_X86_64)
+  return reinterpret_cast<rword &>(uc->uc_mcontext->__ss.__rflags);
+#elif defined(QBDI_PLATFORM_OSX)
+  return reinterpret_cast<rword &>(uc->uc_mcontext->__ss.__eflags);
+#else
+  return reinterpret_cast<rword &>(uc->uc_mcontext.gregs[REG_EFL]);
+#endif
+}
+
+// The protection of a page with all its watches, origProt if none
+int effectiveProt(rword page, int origProt) {
+  int prot = origProt;
+  for (WatchedPage &w : watchedPages) {
+    if (w.page.load(std::memory_order_acquire) == page) {
+      prot &= w.prot;
+    }
+  }
+  return prot;
+}
+
+void recordFault(const void *owner, rword pc) {
+  PageFault &f =
+      pageFaults[nextFault.fetch_add(1, std::memory_order_relaxed) %
+                 MAX_PAGE_FAULTS];
+  f.pc = pc;
+  // an overwritten fault is lost but stays counted once
+  if (f.owner.exchange(owner, std::memory_order_acq_rel) == nullptr) {
+    nbPendingFaults.fetch_add(1, std::memory_order_release);
+  }
+}
+
+void chainSignal(int sig, siginfo_t *info, void *ctx,
+                 const struct sigaction &old) {
+  if (old.sa_flags & SA_SIGINFO) {
+    if (old.sa_sigaction != nullptr) {
+      old.sa_sigaction(sig, info, ctx);
+    }
+  } else if (old.sa_handler == SIG_IGN && sig == SIGTRAP) {
+    return;
+  } else if (old.sa_handler == SIG_DFL || old.sa_handler == SIG_IGN) {
+    // a fault is raised again when the instruction is restarted, the trap
+    // must be raised explicitly
+    sigaction(sig, &old, nullptr);
+    if (sig == SIGTRAP) {
+      raise(sig);
+    }
+  } else {
+    old.sa_handler(sig);
+  }
+}
+
+void faultHandler(int sig, siginfo_t *info, void *ctx) {
+  rword page = reinterpret_cast<rword>(info->si_addr) & ~(pageSize - 1);
+  rword pc = contextPC(ctx);
+  bool watched = false;
+  bool step = false;
+  bool once = false;
+  int origProt = 0;
+  for (WatchedPage &w : watchedPages) {
+    if (w.page.load(std::memory_order_acquire) != page) {
+      continue;
+    }
+    // a fault with the original protection isn't caused by the watch
+    if (w.lifted.load(std::memory_order_acquire)) {
+      watched = false;
+      break;
+    }
+    watched = true;
+    origProt = w.origProt;
+    if (w.once) {
+      once = true;
+      recordFault(w.owner, page);
+      continue;
+    }
+    step = true;
+    w.lifted.store(true, std::memory_order_release);
+    recordFault(w.owner, pc);
+  }
+  if (not watched) {
+    chainSignal(sig, info, ctx,
+                (sig == SIGSEGV) ? oldSegvAction : oldBusAction);
+    return;
+  }
+  mprotect(reinterpret_cast<void *>(page), pageSize, origProt);
+  if (once) {
+    // The slots are freed after the change of protection: another thread
+    // which faults on the page in between still finds them. The trap
+    // protects the page again without them.
+    for (WatchedPage &w : watchedPages) {
+      if (w.once && w.page.load(std::memory_order_acquire) == page) {
+        w.page.store(0, std::memory_order_release);
+      }
+    }
+    if (not step) {
+      return;
+    }
+  }
+  nbLiftedPages.fetch_add(1, std::memory_order_release);
+  contextFlags(ctx) |= TRAP_FLAG;
+}
+
+void trapHandler(int sig, siginfo_t *info, void *ctx) {
+  if (nbLiftedPages.load(std::memory_order_acquire) == 0 ||
+      (contextFlags(ctx) & TRAP_FLAG) == 0) {
+    chainSignal(sig, info, ctx, oldTrapAction);
+    return;
+  }
+  nbLiftedPages.store(0, std::memory_order_release);
+  for (WatchedPage &w : watchedPages) {
+    rword page = w.page.load(std::memory_order_acquire);
+    if (page != 0 && w.lifted.exchange(false, std::memory_order_acq_rel)) {
+      mprotect(reinterpret_cast<void *>(page), pageSize,
+               effectiveProt(page, w.origProt));
+    }
+  }
+  contextFlags(ctx) &= ~TRAP_FLAG;
+}
+
+// Install a handler if it isn't the current one, another library may have
+// replaced it since the last watch
+bool installHandler(int sig, void (*handler)(int, siginfo_t *, void *),
+                    struct sigaction &old) {
+  struct sigaction current;
+  QBDI_REQUIRE_ACTION(sigaction(sig, nullptr, &current) == 0, return false);
+  if ((current.sa_flags & SA_SIGINFO) && current.sa_sigaction == handler) {
+    return true;
+  }
+  struct sigaction action = {};
+  action.sa_flags = SA_SIGINFO | SA_RESTART | SA_ONSTACK;
+  sigemptyset(&action.sa_mask);
+  action.sa_sigaction = handler;
+  QBDI_REQUIRE_ACTION(sigaction(sig, &action, &old) == 0, return false);
+  return true;
+}
+
+bool installHandlers() {
+  if (pageSize == 0) {
+    pageSize = static_cast<rword>(sysconf(_SC_PAGESIZE));
+  }
+  return installHandler(SIGSEGV, faultHandler, oldSegvAction) &&
+         installHandler(SIGBUS, faultHandler, oldBusAction) &&
+         installHandler(SIGTRAP, trapHandler, oldTrapAction);
+}
+
+int toProt(Permission perm) {
+  return ((perm & PF_READ) ? PROT_READ : 0) |
+         ((perm & PF_WRITE) ? PROT_WRITE : 0) |
+         ((perm & PF_EXEC) ? PROT_EXEC : 0);
+}
+
+bool watchPagesImpl(const void *owner, Range<rword> range, int removedProt,
+                    RangeSet<rword> *once) {
+  std::lock_guard<std::mutex> lock(watchMutex);
+  if (not installHandlers()) {
+    return false;
+  }
+  std::vector<MemoryMap> maps = getCurrentProcessMaps(false);
+
+  for (rword page = range.start() & ~(pageSize - 1); page < range.end();
+       page += pageSize) {
+    WatchedPage *sameOwner = nullptr;
+    WatchedPage *freeSlot = nullptr;
+    int origProt = -1;
+    for (WatchedPage &w : watchedPages) {
+      rword p = w.page.load(std::memory_order_acquire);
+      if (p == page) {
+        origProt = w.origProt;
+        if (w.owner == owner) {
+          sameOwner = &w;
+        }
+      } else if (p == 0 && freeSlot == nullptr) {
+        freeSlot = &w;
+      }
+    }
+    if (sameOwner != nullptr) {
+      sameOwner->prot &= ~removedProt;
+    } else {
+      if (origProt == -1) {
+        auto it = std::find_if(maps.begin(), maps.end(),
+                               [page](const MemoryMap &m) {
+                                 return m.range.contains(page);
+                               });
+        // an unmapped page cannot be accessed
+        if (it == maps.end()) {
+          continue;
+        }
+        origProt = toProt(it->permission);
+      }
+      // a page which isn't writable is never written
+      if (once != nullptr && (origProt & PROT_WRITE) == 0) {
+        continue;
+      }
+      if (freeSlot == nullptr) {
+        QBDI_WARN("Too many watched pages, 0x{:x} isn't watched", page);
+        return false;
+      }
+      freeSlot->owner = owner;
+      freeSlot->prot = origProt & ~removedProt;
+      freeSlot->origProt = origProt;
+      freeSlot->once = (once != nullptr);
+      freeSlot->lifted.store(false, std::memory_order_relaxed);
+      freeSlot->page.store(page, std::memory_order_release);
+    }
+    if (mprotect(reinterpret_cast<void *>(page), pageSize,
+                 effectiveProt(page, origProt)) != 0) {
+      QBDI_WARN("Fail to protect the watched page 0x{:x}", page);
+      return false;
+    }
+    if (once != nullptr) {
+      once->add({page, page + pageSize});
+    }
+  }
+  return true;
+}
+
+} // anonymous namespace
+
+bool isPageWatchSupported() { return true; }
+
+bool watchPages(const void *owner, Range<rword> range, MemoryAccessType type) {
+  // x86 cannot protect a page for the reads only
+  int removedProt = (type & MEMORY_READ)
+                        ? (PROT_READ | PROT_WRITE | PROT_EXEC)
+                        : PROT_WRITE;
+  return watchPagesImpl(owner, range, removedProt, nullptr);
+}
+
+bool watchPagesOnce(const void *owner, Range<rword> range,
+                    RangeSet<rword> &watched) {
+  return watchPagesImpl(owner, range, PROT_WRITE, &watched);
+}
+
+void unwatchPages(const void *owner) {
+  std::lock_guard<std::mutex> lock(watchMutex);
+  for (WatchedPage &w : watchedPages) {
+    rword page = w.page.load(std::memory_order_acquire);
+    if (page == 0 || w.owner != owner) {
+      continue;
+    }
+    w.page.store(0, std::memory_order_release);
+    mprotect(reinterpret_cast<void *>(page), pageSize,
+             effectiveProt(page, w.origProt));
+  }
+  for (PageFault &f : pageFaults) {
+    const void *expected = owner;
+    if (f.owner.compare_exchange_strong(expected, nullptr,
+                                        std::memory_order_acq_rel)) {
+      nbPendingFaults.fetch_sub(1, std::memory_order_release);
+    }
+  }
+}
+
+bool takePageFaults(const void *owner, std::vector<rword> &pcs) {
+  pcs.clear();
+  if (nbPendingFaults.load(std::memory_order_acquire) == 0) {
+    return false;
+  }
+  for (PageFault &f : pageFaults) {
+    rword pc = f.pc;
+    const void *expected = owner;
+    if (f.owner.compare_exchange_strong(expected, nullptr,
+                                        std::memory_order_acq_rel)) {
+      nbPendingFaults.fetch_sub(1, std::memory_order_release);
+      pcs.push_back(pc);
+    }
+  }
+  return not pcs.empty();
+}
+
+bool takeWrittenPages(const void *owner, RangeSet<rword> &pages) {
+  pages.clear();
+  if (nbPendingFaults.load(std::memory_order_acquire) == 0) {
+    return false;
+  }
+  for (PageFault &f : pageFaults) {
+    rword page = f.pc;
+    const void *expected = owner;
+    if (f.owner.compare_exchange_strong(expected, nullptr,
+                                        std::memory_order_acq_rel)) {
+      nbPendingFaults.fetch_sub(1, std::memory_order_release);
+      pages.add({page, page + pageSize});
+    }
+  }
+  return not pages.getRanges().empty();
+}
+
+} // namespace QBDI
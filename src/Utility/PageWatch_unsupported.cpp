@@ -0,0 +1,47 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <vector>
+
+#include "Utility/PageWatch.h"
+
+namespace QBDI {
+
+bool isPageWatchSupported() { return false; }
+
+bool watchPages(const void *owner, Range<rword> range, MemoryAccessType type) {
+  return false;
+}
+
+bool watchPagesOnce(const void *owner, Range<rword> range,
+                    RangeSet<rword> &watched) {
+  return false;
+}
+
+void unwatchPages(const void *owner) {}
+
+bool takePageFaults(const void *owner, std::vector<rword> &pcs) {
+  pcs.clear();
+  return false;
+}
+
+bool takeWrittenPages(const void *owner, RangeSet<rword> &pages) {
+  pages.clear();
+  return false;
+}
+
+} // namespace QBDI
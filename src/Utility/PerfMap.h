@@ -0,0 +1,49 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef QBDI_PERFMAP_H
+#define QBDI_PERFMAP_H
+
+#include "QBDI/State.h"
+
+namespace QBDI {
+
+/*! The perf map of the process (/tmp/perf-<pid>.map) names the code of the
+ * ExecBlocks for perf. The entries of all the VMs are buffered and appended
+ * to the map when the buffer is full or when flushPerfMap is called. The
+ * entries of a flushed ExecBlock aren't removed from the map.
+ */
+
+/*! Return true if the perf map is available on this platform.
+ */
+bool isPerfMapSupported();
+
+/*! Add an entry to the perf map.
+ *
+ * @param[in] start  The address of the code.
+ * @param[in] size   The size of the code.
+ * @param[in] name   The name of the code.
+ */
+void addPerfMapEntry(rword start, rword size, const char *name);
+
+/*! Append the buffered entries to the perf map.
+ */
+void flushPerfMap();
+
+} // namespace QBDI
+
+#endif // QBDI_PERFMAP_H
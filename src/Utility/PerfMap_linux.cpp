@@ -0,0 +1,114 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <inttypes.h>
+#include <mutex>
+#include <stdio.h>
+#include <string>
+#include <unistd.h>
+
+#include "Utility/LogSys.h"
+#include "Utility/PerfMap.h"
+
+namespace QBDI {
+
+namespace {
+
+// size of the buffer written at once in the map
+constexpr size_t PERF_MAP_BUFFER_SIZE = 1 << 16;
+
+class PerfMapWriter {
+private:
+  std::mutex lock;
+  std::string buffer;
+  FILE *file = nullptr;
+  // the map of a forked process is another file
+  pid_t pid = 0;
+
+  void flushLocked() {
+    if (buffer.empty()) {
+      return;
+    }
+    if (file != nullptr and pid != getpid()) {
+      fclose(file);
+      file = nullptr;
+    }
+    if (file == nullptr) {
+      pid = getpid();
+      char path[64];
+      snprintf(path, sizeof(path), "/tmp/perf-%d.map", pid);
+      file = fopen(path, "a");
+      if (file == nullptr) {
+        QBDI_WARN("Cannot open the perf map {}", path);
+        buffer.clear();
+        return;
+      }
+    }
+    fwrite(buffer.data(), 1, buffer.size(), file);
+    fflush(file);
+    buffer.clear();
+  }
+
+public:
+  PerfMapWriter() { buffer.reserve(PERF_MAP_BUFFER_SIZE); }
+
+  ~PerfMapWriter() {
+    flush();
+    if (file != nullptr) {
+      fclose(file);
+    }
+  }
+
+  void add(rword start, rword size, const char *name) {
+    char entry[48];
+    int len = snprintf(entry, sizeof(entry), "%" PRIx64 " %" PRIx64 " ",
+                       static_cast<uint64_t>(start),
+                       static_cast<uint64_t>(size));
+    std::lock_guard<std::mutex> guard(lock);
+    buffer.append(entry, len);
+    buffer.append(name);
+    buffer.push_back('\n');
+    if (buffer.size() >= PERF_MAP_BUFFER_SIZE) {
+      flushLocked();
+    }
+  }
+
+  void flush() {
+    std::lock_guard<std::mutex> guard(lock);
+    flushLocked();
+  }
+};
+
+PerfMapWriter &getPerfMapWriter() {
+  static PerfMapWriter writer;
+  return writer;
+}
+
+} // anonymous namespace
+
+bool isPerfMapSupported() { return true; }
+
+void addPerfMapEntry(rword start, rword size, const char *name) {
+  if (size == 0) {
+    return;
+  }
+  getPerfMapWriter().add(start, size, name);
+}
+
+void flushPerfMap() { getPerfMapWriter().flush(); }
+
+} // namespace QBDI
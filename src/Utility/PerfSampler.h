@@ -0,0 +1,96 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef QBDI_PERFSAMPLER_H
+#define QBDI_PERFSAMPLER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "QBDI/CacheStats.h"
+#include "QBDI/State.h"
+
+namespace QBDI {
+
+/*! Sampler of a hardware event of the thread of a VM (perf_event_open on
+ * Linux and Android). The sampled PCs are written by the kernel in a ring
+ * buffer, the VM reads them between the sequences and maps the PCs in the
+ * ExecBlocks to the original instructions.
+ */
+class PerfSampler {
+private:
+  HardwareEvent event;
+  uint64_t period;
+  int fd = -1;
+  void *buffer = nullptr;
+  size_t bufferSize = 0;
+  size_t pageSize = 0;
+  // thread of the counter, the counter is opened again in another thread
+  long tid = 0;
+  uint64_t lost = 0;
+
+  bool open();
+
+  void close();
+
+public:
+  /*! Create a sampler of an event. The counter is opened in the current
+   * thread.
+   *
+   * @param[in] event   The hardware event
+   * @param[in] period  The number of events between two samples
+   */
+  PerfSampler(HardwareEvent event, uint64_t period);
+
+  ~PerfSampler();
+
+  PerfSampler(const PerfSampler &) = delete;
+  PerfSampler &operator=(const PerfSampler &) = delete;
+
+  /*! Return true if the counter is opened.
+   */
+  bool isValid() const { return fd >= 0; }
+
+  HardwareEvent getEvent() const { return event; }
+
+  uint64_t getPeriod() const { return period; }
+
+  /*! Get the number of samples lost because the ring buffer was full.
+   */
+  uint64_t getLost() const { return lost; }
+
+  /*! Enable the counter in the current thread.
+   *
+   * @return False if the counter cannot be opened in this thread.
+   */
+  bool start();
+
+  /*! Disable the counter.
+   */
+  void stop();
+
+  /*! Move the PCs of the samples of the ring buffer in a vector.
+   *
+   * @param[out] pcs  The vector where the PCs are appended
+   */
+  void drain(std::vector<rword> &pcs);
+};
+
+} // namespace QBDI
+
+#endif // QBDI_PERFSAMPLER_H
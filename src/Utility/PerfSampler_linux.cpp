@@ -0,0 +1,163 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "Utility/LogSys.h"
+#include "Utility/PerfSampler.h"
+
+namespace QBDI {
+
+namespace {
+
+// pages of the ring buffer, a power of two
+constexpr size_t PERF_SAMPLER_PAGES = 64;
+
+uint64_t getHardwareConfig(HardwareEvent event) {
+  switch (event) {
+  case SAMPLE_CYCLES:
+  default:
+    return PERF_COUNT_HW_CPU_CYCLES;
+  case SAMPLE_INSTRUCTIONS:
+    return PERF_COUNT_HW_INSTRUCTIONS;
+  case SAMPLE_CACHE_MISSES:
+    return PERF_COUNT_HW_CACHE_MISSES;
+  case SAMPLE_BRANCH_MISSES:
+    return PERF_COUNT_HW_BRANCH_MISSES;
+  }
+}
+
+// Copy a record of the ring buffer, which may wrap around the end
+void readRing(const uint8_t *data, size_t size, uint64_t pos, void *dst,
+              size_t len) {
+  size_t offset = pos & (size - 1);
+  size_t first = std::min(len, size - offset);
+  memcpy(dst, data + offset, first);
+  memcpy(static_cast<uint8_t *>(dst) + first, data, len - first);
+}
+
+} // anonymous namespace
+
+PerfSampler::PerfSampler(HardwareEvent event, uint64_t period)
+    : event(event), period(period) {
+  open();
+}
+
+PerfSampler::~PerfSampler() { close(); }
+
+bool PerfSampler::open() {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = getHardwareConfig(event);
+  attr.sample_period = period;
+  attr.sample_type = PERF_SAMPLE_IP;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+
+  tid = syscall(SYS_gettid);
+  fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1,
+                                PERF_FLAG_FD_CLOEXEC));
+  if (fd < 0) {
+    QBDI_WARN("Cannot open the hardware counter: {}", strerror(errno));
+    return false;
+  }
+  // one page of metadata and the ring buffer
+  pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  bufferSize = (PERF_SAMPLER_PAGES + 1) * pageSize;
+  buffer = mmap(nullptr, bufferSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (buffer == MAP_FAILED) {
+    QBDI_WARN("Cannot map the buffer of the hardware counter: {}",
+              strerror(errno));
+    buffer = nullptr;
+    close();
+    return false;
+  }
+  return true;
+}
+
+void PerfSampler::close() {
+  if (buffer != nullptr) {
+    munmap(buffer, bufferSize);
+    buffer = nullptr;
+  }
+  if (fd >= 0) {
+    ::close(fd);
+    fd = -1;
+  }
+}
+
+bool PerfSampler::start() {
+  if (fd >= 0 and tid != syscall(SYS_gettid)) {
+    close();
+  }
+  if (fd < 0 and not open()) {
+    return false;
+  }
+  return ioctl(fd, PERF_EVENT_IOC_ENABLE, 0) == 0;
+}
+
+void PerfSampler::stop() {
+  if (fd >= 0) {
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+  }
+}
+
+void PerfSampler::drain(std::vector<rword> &pcs) {
+  if (buffer == nullptr) {
+    return;
+  }
+  struct perf_event_mmap_page *meta =
+      static_cast<struct perf_event_mmap_page *>(buffer);
+  const uint8_t *data = static_cast<const uint8_t *>(buffer) + pageSize;
+  size_t size = bufferSize - pageSize;
+
+  uint64_t head = __atomic_load_n(&meta->data_head, __ATOMIC_ACQUIRE);
+  uint64_t tail = meta->data_tail;
+  if (tail == head) {
+    return;
+  }
+  while (tail < head) {
+    struct perf_event_header header;
+    readRing(data, size, tail, &header, sizeof(header));
+    if (header.size == 0) {
+      break;
+    }
+    if (header.type == PERF_RECORD_SAMPLE) {
+      uint64_t ip;
+      readRing(data, size, tail + sizeof(header), &ip, sizeof(ip));
+      pcs.push_back(static_cast<rword>(ip));
+    } else if (header.type == PERF_RECORD_LOST) {
+      uint64_t record[2]; // id, lost
+      readRing(data, size, tail + sizeof(header), record, sizeof(record));
+      lost += record[1];
+    }
+    tail += header.size;
+  }
+  __atomic_store_n(&meta->data_tail, tail, __ATOMIC_RELEASE);
+}
+
+} // namespace QBDI
@@ -0,0 +1,43 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "Utility/LogSys.h"
+#include "Utility/PerfSampler.h"
+
+namespace QBDI {
+
+PerfSampler::PerfSampler(HardwareEvent event, uint64_t period)
+    : event(event), period(period) {
+  open();
+}
+
+PerfSampler::~PerfSampler() { close(); }
+
+bool PerfSampler::open() {
+  QBDI_WARN("The hardware sampling isn't supported on this platform");
+  return false;
+}
+
+void PerfSampler::close() {}
+
+bool PerfSampler::start() { return false; }
+
+void PerfSampler::stop() {}
+
+void PerfSampler::drain(std::vector<rword> &pcs) {}
+
+} // namespace QBDI
@@ -0,0 +1,47 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "Utility/Profiler.h"
+#include "Utility/LogSys.h"
+
+namespace QBDI {
+
+#if defined(QBDI_PROFILE_TRANSLATION)
+thread_local TranslationProfile *currentProfile = nullptr;
+#endif
+
+void dumpTranslationProfile(const TranslationProfile &profile) {
+  static const struct {
+    const char *name;
+    ProfilePhase TranslationProfile::*phase;
+  } phases[] = {
+      {"disassembly", &TranslationProfile::disassembly},
+      {"patchRules", &TranslationProfile::patchRules},
+      {"instrRules", &TranslationProfile::instrRules},
+      {"tempManager", &TranslationProfile::tempManager},
+      {"encoding", &TranslationProfile::encoding},
+      {"writeSequence", &TranslationProfile::writeSequence},
+  };
+  QBDI_INFO("Translation profile:");
+  for (const auto &p : phases) {
+    const ProfilePhase &phase = profile.*p.phase;
+    QBDI_INFO("  {:<14} {:>14} cycles {:>10} calls {:>10} bytes", p.name,
+              phase.cycles, phase.count, phase.bytes);
+  }
+}
+
+} // namespace QBDI
@@ -0,0 +1,114 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef QBDI_PROFILER_H
+#define QBDI_PROFILER_H
+
+#include <stdint.h>
+
+#include "QBDI/Config.h"
+#include "QBDI/TranslationProfile.h"
+
+#if defined(QBDI_ARCH_X86) || defined(QBDI_ARCH_X86_64)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#else
+#include <chrono>
+#endif
+
+namespace QBDI {
+
+void dumpTranslationProfile(const TranslationProfile &profile);
+
+// Cycle counter of the profiles and of the statistics of the ExecBroker
+inline uint64_t readCycles() {
+#if defined(QBDI_ARCH_X86) || defined(QBDI_ARCH_X86_64)
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+#endif
+}
+
+#if defined(QBDI_PROFILE_TRANSLATION)
+
+// Profile of the translation in progress in the current thread. It is nullptr
+// outside of the translation or in the worker of OPT_ENABLE_ASYNC_PATCH.
+extern thread_local TranslationProfile *currentProfile;
+
+// Select the profile updated by the current thread until the end of the scope
+class ProfileTarget {
+  TranslationProfile *previous;
+
+public:
+  ProfileTarget(TranslationProfile &profile) : previous(currentProfile) {
+    currentProfile = &profile;
+  }
+  ~ProfileTarget() { currentProfile = previous; }
+
+  ProfileTarget(const ProfileTarget &) = delete;
+  ProfileTarget &operator=(const ProfileTarget &) = delete;
+};
+
+// Add the cycles of the scope to a phase of the current profile
+class ProfileScope {
+  ProfilePhase *phase;
+  uint64_t start;
+
+public:
+  ProfileScope(ProfilePhase TranslationProfile::*p)
+      : phase(currentProfile ? &(currentProfile->*p) : nullptr),
+        start(phase ? readCycles() : 0) {}
+  ~ProfileScope() {
+    if (phase) {
+      phase->cycles += readCycles() - start;
+      phase->count++;
+    }
+  }
+
+  ProfileScope(const ProfileScope &) = delete;
+  ProfileScope &operator=(const ProfileScope &) = delete;
+};
+
+inline void profileBytes(ProfilePhase TranslationProfile::*p, uint64_t size) {
+  if (currentProfile) {
+    (currentProfile->*p).bytes += size;
+  }
+}
+
+#define QBDI_PROFILE_TARGET(profile) \
+  ProfileTarget qbdiProfileTarget_(profile)
+#define QBDI_PROFILE_SCOPE(phase) \
+  ProfileScope qbdiProfileScope_(&TranslationProfile::phase)
+#define QBDI_PROFILE_BYTES(phase, size) \
+  profileBytes(&TranslationProfile::phase, size)
+
+#else
+
+#define QBDI_PROFILE_TARGET(profile) (void)0
+#define QBDI_PROFILE_SCOPE(phase) (void)0
+#define QBDI_PROFILE_BYTES(phase, size) (void)0
+
+#endif
+
+} // namespace QBDI
+
+#endif // QBDI_PROFILER_H
@@ -0,0 +1,123 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef QBDI_SHADOWMEMORY_H
+#define QBDI_SHADOWMEMORY_H
+
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "QBDI/State.h"
+#include "Utility/AddressMap.h"
+
+namespace QBDI {
+
+/*! Byte granular shadow of the address space. The first level maps the page
+ * number to a page of shadow bytes, the pages are only allocated when a non
+ * zero byte is written in them. The bytes out of the allocated pages are 0.
+ */
+class ShadowMemory {
+private:
+  static constexpr unsigned PAGE_BITS = 16;
+  static constexpr rword PAGE_SIZE = static_cast<rword>(1) << PAGE_BITS;
+  static constexpr rword PAGE_MASK = PAGE_SIZE - 1;
+
+  AddressMap<std::unique_ptr<uint8_t[]>> pages;
+  // the last page accessed, most accesses stay in the same page
+  mutable rword lastPageNum = ~static_cast<rword>(0);
+  mutable uint8_t *lastPage = nullptr;
+
+  uint8_t *findPage(rword pageNum) const {
+    if (pageNum != lastPageNum) {
+      auto it = pages.find(pageNum);
+      lastPageNum = pageNum;
+      lastPage = (it != pages.end()) ? it->second.get() : nullptr;
+    }
+    return lastPage;
+  }
+
+  uint8_t *allocPage(rword pageNum) {
+    uint8_t *page = findPage(pageNum);
+    if (page == nullptr) {
+      std::unique_ptr<uint8_t[]> &p = pages[pageNum];
+      p = std::make_unique<uint8_t[]>(PAGE_SIZE);
+      lastPage = p.get();
+      page = lastPage;
+    }
+    return page;
+  }
+
+public:
+  /*! Get the union of the shadow bytes of a range.
+   *
+   * @param[in] address  Start of the range
+   * @param[in] size     Size of the range
+   */
+  uint8_t get(rword address, rword size = 1) const {
+    uint8_t value = 0;
+    while (size > 0) {
+      rword offset = address & PAGE_MASK;
+      rword len = (size < PAGE_SIZE - offset) ? size : PAGE_SIZE - offset;
+      const uint8_t *page = findPage(address >> PAGE_BITS);
+      if (page != nullptr) {
+        for (rword i = 0; i < len; i++) {
+          value |= page[offset + i];
+        }
+      }
+      address += len;
+      size -= len;
+    }
+    return value;
+  }
+
+  /*! Set the shadow bytes of a range.
+   *
+   * @param[in] address  Start of the range
+   * @param[in] size     Size of the range
+   * @param[in] value    The value of the shadow bytes
+   */
+  void set(rword address, rword size, uint8_t value) {
+    while (size > 0) {
+      rword offset = address & PAGE_MASK;
+      rword len = (size < PAGE_SIZE - offset) ? size : PAGE_SIZE - offset;
+      // clearing a range never allocates a page
+      uint8_t *page = (value != 0) ? allocPage(address >> PAGE_BITS)
+                                   : findPage(address >> PAGE_BITS);
+      if (page != nullptr) {
+        memset(page + offset, value, len);
+      }
+      address += len;
+      size -= len;
+    }
+  }
+
+  /*! Get the size of the allocated shadow pages in bytes
+   */
+  size_t getAllocatedSize() const { return pages.size() * PAGE_SIZE; }
+
+  void clear() {
+    pages.clear();
+    lastPageNum = ~static_cast<rword>(0);
+    lastPage = nullptr;
+  }
+};
+
+} // namespace QBDI
+
+#endif
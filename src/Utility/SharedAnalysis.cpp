@@ -0,0 +1,199 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <unordered_map>
+
+#include "llvm/MC/MCInst.h"
+
+#include "Engine/LLVMCPU.h"
+#include "Patch/InstMetadata.h"
+#include "Utility/InstAnalysis_prive.h"
+
+#include "QBDI/InstAnalysis.h"
+#include "QBDI/Options.h"
+#include "QBDI/State.h"
+
+namespace QBDI {
+
+struct SharedAnalysis {
+  InstAnalysis analysis;
+  llvm::MCInst inst;
+  rword address;
+  uint64_t key;
+  uint32_t instSize;
+  CPUMode cpuMode;
+  bool attSyntax;
+  // incremented with the shared lock of the shard, decremented with the
+  // exclusive lock
+  std::atomic<size_t> refs;
+};
+
+namespace {
+
+constexpr size_t NB_SHARDS = 64;
+
+const AnalysisType COMPLETE_ANALYSIS = ANALYSIS_INSTRUCTION |
+                                        ANALYSIS_DISASSEMBLY |
+                                        ANALYSIS_OPERANDS | ANALYSIS_SYMBOL;
+
+struct Shard {
+  std::shared_mutex lock;
+  std::unordered_multimap<uint64_t, SharedAnalysis *> entries;
+};
+
+// Never destroyed: the analyses may be released by the ExecBlocks of a static
+// VM after the end of main
+Shard *getShards() {
+  static Shard *shards = new Shard[NB_SHARDS];
+  return shards;
+}
+
+inline uint64_t mix(uint64_t h, uint64_t v) {
+  h ^= v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+  return h;
+}
+
+// Hash of the decoded instruction. Only the registers and the immediates are
+// hashed, an instruction with another operand isn't shared.
+bool hashInst(const llvm::MCInst &inst, uint64_t &hash) {
+  hash = mix(0, inst.getOpcode());
+  hash = mix(hash, inst.getFlags());
+  for (const llvm::MCOperand &op : inst) {
+    if (op.isReg()) {
+      hash = mix(hash, (1ULL << 32) | op.getReg());
+    } else if (op.isImm()) {
+      hash = mix(hash, static_cast<uint64_t>(op.getImm()));
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool sameInst(const llvm::MCInst &a, const llvm::MCInst &b) {
+  if (a.getOpcode() != b.getOpcode() or a.getFlags() != b.getFlags() or
+      a.getNumOperands() != b.getNumOperands()) {
+    return false;
+  }
+  for (unsigned i = 0; i < a.getNumOperands(); i++) {
+    const llvm::MCOperand &opA = a.getOperand(i);
+    const llvm::MCOperand &opB = b.getOperand(i);
+    if (opA.isReg() != opB.isReg()) {
+      return false;
+    }
+    if (opA.isReg() ? (opA.getReg() != opB.getReg())
+                    : (opA.getImm() != opB.getImm())) {
+      return false;
+    }
+  }
+  return true;
+}
+
+SharedAnalysis *find(Shard &shard, uint64_t key,
+                     const InstMetadata &instMetadata, bool attSyntax) {
+  auto range = shard.entries.equal_range(key);
+  for (auto it = range.first; it != range.second; ++it) {
+    SharedAnalysis *shared = it->second;
+    if (shared->address == instMetadata.address and
+        shared->instSize == instMetadata.instSize and
+        shared->cpuMode == instMetadata.cpuMode and
+        shared->attSyntax == attSyntax and
+        sameInst(shared->inst, instMetadata.inst)) {
+      return shared;
+    }
+  }
+  return nullptr;
+}
+
+} // anonymous namespace
+
+InstAnalysisPtr acquireSharedAnalysis(const InstMetadata &instMetadata,
+                                      const LLVMCPU &llvmcpu) {
+  uint64_t instHash;
+  if (not hashInst(instMetadata.inst, instHash)) {
+    return nullptr;
+  }
+  bool attSyntax = (llvmcpu.getOptions() & Options::OPT_ATT_SYNTAX) != 0;
+  uint64_t key = mix(instHash, instMetadata.address);
+  key = mix(key, instMetadata.instSize);
+  key = mix(key, (static_cast<uint64_t>(instMetadata.cpuMode) << 1) |
+                     (attSyntax ? 1 : 0));
+  Shard &shard = getShards()[(key >> 32) % NB_SHARDS];
+
+  {
+    std::shared_lock<std::shared_mutex> lock(shard.lock);
+    SharedAnalysis *shared = find(shard, key, instMetadata, attSyntax);
+    if (shared != nullptr) {
+      shared->refs.fetch_add(1, std::memory_order_relaxed);
+      return InstAnalysisPtr(&shared->analysis, {nullptr, shared});
+    }
+  }
+
+  // the analysis is computed without lock, a concurrent VM may publish the
+  // same instruction first
+  SharedAnalysis *newShared = new SharedAnalysis;
+  memset(&newShared->analysis, 0, sizeof(InstAnalysis));
+  newShared->inst = instMetadata.inst;
+  newShared->address = instMetadata.address;
+  newShared->key = key;
+  newShared->instSize = instMetadata.instSize;
+  newShared->cpuMode = instMetadata.cpuMode;
+  newShared->attSyntax = attSyntax;
+  newShared->refs.store(1, std::memory_order_relaxed);
+  newShared->analysis.analysisType = COMPLETE_ANALYSIS;
+  completeInstAnalysis(&newShared->analysis, COMPLETE_ANALYSIS, instMetadata,
+                       llvmcpu, nullptr);
+
+  std::unique_lock<std::shared_mutex> lock(shard.lock);
+  SharedAnalysis *shared = find(shard, key, instMetadata, attSyntax);
+  if (shared != nullptr) {
+    shared->refs.fetch_add(1, std::memory_order_relaxed);
+    lock.unlock();
+    releaseInstAnalysisContent(newShared->analysis);
+    delete newShared;
+    return InstAnalysisPtr(&shared->analysis, {nullptr, shared});
+  }
+  shard.entries.emplace(key, newShared);
+  return InstAnalysisPtr(&newShared->analysis, {nullptr, newShared});
+}
+
+void releaseSharedAnalysis(SharedAnalysis *shared) {
+  Shard &shard = getShards()[(shared->key >> 32) % NB_SHARDS];
+  {
+    std::unique_lock<std::shared_mutex> lock(shard.lock);
+    if (shared->refs.fetch_sub(1, std::memory_order_relaxed) != 1) {
+      return;
+    }
+    auto range = shard.entries.equal_range(shared->key);
+    for (auto it = range.first; it != range.second; ++it) {
+      if (it->second == shared) {
+        shard.entries.erase(it);
+        break;
+      }
+    }
+  }
+  releaseInstAnalysisContent(shared->analysis);
+  delete shared;
+}
+
+} // namespace QBDI
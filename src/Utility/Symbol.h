@@ -0,0 +1,90 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef QBDI_SYMBOL_H
+#define QBDI_SYMBOL_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "QBDI/Range.h"
+#include "QBDI/State.h"
+
+namespace QBDI {
+
+/*! Find the nearest symbol before an address and the module of the address.
+ * The strings stay valid while the module is loaded.
+ *
+ * On Linux and Android, the symbol tables of a module are indexed the first
+ * time an address of the module is looked up and the index is shared by all
+ * the ExecBlocks. The modules without symbol table and the other platforms
+ * use dladdr.
+ *
+ * @param[in]  address       The address to resolve.
+ * @param[out] symbol        The name of the symbol, or unchanged.
+ * @param[out] symbolOffset  The offset of the address in the symbol, or
+ *                           unchanged.
+ * @param[out] module        The basename of the module, or unchanged.
+ */
+void findSymbol(rword address, const char *&symbol, uint32_t &symbolOffset,
+                const char *&module);
+
+/*! Append the addresses of the function symbols of the loaded modules in a
+ * range. Only the symbol tables indexed on Linux and Android are used, the
+ * other platforms don't append any address.
+ *
+ * @param[in]  start      The start of the range.
+ * @param[in]  end        The end of the range (excluded).
+ * @param[out] addresses  The addresses of the functions.
+ */
+void getFunctionSymbols(rword start, rword end, std::vector<rword> &addresses);
+
+/*! Append the extents of the function symbols of the loaded modules with a
+ * name. A symbol without size extends to the next symbol of its module. Only
+ * the symbol tables indexed on Linux and Android are used.
+ *
+ * @param[in]  name     The name of the functions.
+ * @param[out] extents  The address ranges of the functions.
+ */
+void getFunctionExtents(const std::string &name,
+                        std::vector<Range<rword>> &extents);
+
+/*! Append the extents of the function symbols of the loaded modules whose
+ * name matches a POSIX extended regular expression (a part of the name
+ * matches, unless the expression is anchored).
+ *
+ * @param[in]  pattern  The regular expression.
+ * @param[out] extents  The address ranges of the functions.
+ *
+ * @return False if the expression is invalid or not supported
+ */
+bool getFunctionExtentsRegex(const std::string &pattern,
+                             std::vector<Range<rword>> &extents);
+
+/*! Get the extent of the function symbol which contains an address.
+ *
+ * @param[in]  address  The address.
+ * @param[out] extent   The address range of the function.
+ *
+ * @return False if no function symbol contains the address
+ */
+bool getFunctionExtent(rword address, Range<rword> &extent);
+
+} // namespace QBDI
+
+#endif // QBDI_SYMBOL_H
@@ -0,0 +1,67 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+#include "QBDI/Config.h"
+
+#ifndef QBDI_PLATFORM_WINDOWS
+#include <dlfcn.h>
+#endif
+
+#include "Utility/Symbol.h"
+
+namespace QBDI {
+
+void findSymbol(rword address, const char *&symbol, uint32_t &symbolOffset,
+                const char *&module) {
+#ifndef QBDI_PLATFORM_WINDOWS
+  Dl_info info;
+  const char *ptr;
+
+  int ret = dladdr(reinterpret_cast<void *>(address), &info);
+  if (ret != 0) {
+    if (info.dli_sname) {
+      symbol = info.dli_sname;
+      symbolOffset = address - reinterpret_cast<rword>(info.dli_saddr);
+    }
+    if (info.dli_fname) {
+      // dirty basename, but thead safe
+      if ((ptr = strrchr(info.dli_fname, '/')) != nullptr) {
+        module = ptr + 1;
+      }
+    }
+  }
+#endif
+}
+
+void getFunctionSymbols(rword start, rword end, std::vector<rword> &addresses) {
+}
+
+void getFunctionExtents(const std::string &name,
+                        std::vector<Range<rword>> &extents) {}
+
+bool getFunctionExtentsRegex(const std::string &pattern,
+                             std::vector<Range<rword>> &extents) {
+  return false;
+}
+
+bool getFunctionExtent(rword address, Range<rword> &extent) { return false; }
+
+} // namespace QBDI
@@ -0,0 +1,449 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <iterator>
+#include <link.h>
+#include <memory>
+#include <mutex>
+#include <regex.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#include "QBDI/Config.h"
+#include "QBDI/State.h"
+#include "Utility/LogSys.h"
+#include "Utility/Symbol.h"
+
+namespace QBDI {
+
+namespace {
+
+struct ModuleSymbol {
+  rword address;
+  rword size;
+  // offset of the name in ModuleIndex::strings
+  uint32_t name;
+  bool function;
+
+  inline bool operator<(const ModuleSymbol &other) const {
+    return address < other.address;
+  }
+};
+
+struct ModuleIndex {
+  rword base;
+  rword start;
+  rword end;
+  std::string path;
+  std::string name;
+  bool indexed = false;
+  std::vector<ModuleSymbol> symbols;
+  std::vector<char> strings;
+};
+
+using LoadCounters = std::pair<unsigned long long, unsigned long long>;
+
+std::mutex symbolMutex;
+// the loaded modules, sorted by their start
+std::vector<std::unique_ptr<ModuleIndex>> modules;
+#if defined(QBDI_PLATFORM_LINUX)
+unsigned long long knownAdds = 0;
+unsigned long long knownSubs = 0;
+#endif
+
+#if defined(QBDI_PLATFORM_LINUX)
+int countersCB(struct dl_phdr_info *info, size_t size, void *data) {
+  LoadCounters *counters = static_cast<LoadCounters *>(data);
+  counters->first = info->dlpi_adds;
+  counters->second = info->dlpi_subs;
+  // only the first module is needed
+  return 1;
+}
+#endif
+
+int modulesCB(struct dl_phdr_info *info, size_t size, void *data) {
+  auto *loaded = static_cast<std::vector<std::unique_ptr<ModuleIndex>> *>(data);
+  std::unique_ptr<ModuleIndex> module = std::make_unique<ModuleIndex>();
+  module->base = info->dlpi_addr;
+  module->start = ~static_cast<rword>(0);
+  module->end = 0;
+  for (ElfW(Half) i = 0; i < info->dlpi_phnum; i++) {
+    const ElfW(Phdr) &phdr = info->dlpi_phdr[i];
+    if (phdr.p_type != PT_LOAD) {
+      continue;
+    }
+    rword segStart = info->dlpi_addr + phdr.p_vaddr;
+    module->start = std::min(module->start, segStart);
+    module->end = std::max(module->end, segStart + phdr.p_memsz);
+  }
+  if (module->start >= module->end) {
+    return 0;
+  }
+  if (info->dlpi_name != nullptr) {
+    module->path = info->dlpi_name;
+  }
+  loaded->push_back(std::move(module));
+  return 0;
+}
+
+// Replace the list of the modules, the index of the modules still loaded are
+// kept
+void refreshModules() {
+  std::vector<std::unique_ptr<ModuleIndex>> loaded;
+  dl_iterate_phdr(modulesCB, &loaded);
+
+  for (std::unique_ptr<ModuleIndex> &module : loaded) {
+    auto it = std::find_if(modules.begin(), modules.end(),
+                           [&module](const std::unique_ptr<ModuleIndex> &m) {
+                             return m != nullptr && m->base == module->base &&
+                                    m->start == module->start &&
+                                    m->path == module->path;
+                           });
+    if (it != modules.end()) {
+      module = std::move(*it);
+    }
+  }
+  std::sort(loaded.begin(), loaded.end(),
+            [](const std::unique_ptr<ModuleIndex> &a,
+               const std::unique_ptr<ModuleIndex> &b) {
+              return a->start < b->start;
+            });
+  modules = std::move(loaded);
+}
+
+ModuleIndex *searchModule(rword address) {
+  auto it = std::upper_bound(
+      modules.begin(), modules.end(), address,
+      [](rword addr, const std::unique_ptr<ModuleIndex> &m) {
+        return addr < m->start;
+      });
+  if (it == modules.begin()) {
+    return nullptr;
+  }
+  --it;
+  if (address >= (*it)->end) {
+    return nullptr;
+  }
+  return it->get();
+}
+
+void addSymbols(ModuleIndex &module, const uint8_t *file, size_t fileSize,
+                const ElfW(Shdr) &symtab, const ElfW(Shdr) &strtab) {
+  if (symtab.sh_offset > fileSize ||
+      symtab.sh_size > fileSize - symtab.sh_offset ||
+      strtab.sh_offset > fileSize ||
+      strtab.sh_size > fileSize - strtab.sh_offset || strtab.sh_size == 0) {
+    return;
+  }
+  const ElfW(Sym) *syms =
+      reinterpret_cast<const ElfW(Sym) *>(file + symtab.sh_offset);
+  size_t nbSyms = symtab.sh_size / sizeof(ElfW(Sym));
+  const char *names = reinterpret_cast<const char *>(file + strtab.sh_offset);
+
+  for (size_t i = 0; i < nbSyms; i++) {
+    const ElfW(Sym) &sym = syms[i];
+    // st_info has the same layout in ELF32 and ELF64
+    unsigned type = ELF32_ST_TYPE(sym.st_info);
+    if ((type != STT_FUNC && type != STT_OBJECT && type != STT_GNU_IFUNC) ||
+        sym.st_shndx == SHN_UNDEF || sym.st_value == 0 ||
+        sym.st_name >= strtab.sh_size) {
+      continue;
+    }
+    const char *name = names + sym.st_name;
+    size_t len = strnlen(name, strtab.sh_size - sym.st_name);
+    if (len == 0 || len == strtab.sh_size - sym.st_name) {
+      continue;
+    }
+    module.symbols.push_back(
+        {module.base + static_cast<rword>(sym.st_value),
+         static_cast<rword>(sym.st_size),
+         static_cast<uint32_t>(module.strings.size()), type != STT_OBJECT});
+    module.strings.insert(module.strings.end(), name, name + len + 1);
+  }
+}
+
+// Read the symbol tables of the file of a module
+void indexModule(ModuleIndex &module) {
+  module.indexed = true;
+
+  std::string filePath = module.path;
+  if (filePath.empty()) {
+    // the main program
+    char buffer[4096];
+    ssize_t len = readlink("/proc/self/exe", buffer, sizeof(buffer) - 1);
+    if (len <= 0) {
+      return;
+    }
+    filePath = std::string(buffer, len);
+  }
+  size_t slash = filePath.rfind('/');
+  module.name =
+      (slash == std::string::npos) ? filePath : filePath.substr(slash + 1);
+
+  int fd = open(filePath.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 ||
+      static_cast<size_t>(st.st_size) < sizeof(ElfW(Ehdr))) {
+    close(fd);
+    return;
+  }
+  size_t fileSize = st.st_size;
+  void *map = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    return;
+  }
+  const uint8_t *file = static_cast<const uint8_t *>(map);
+  const ElfW(Ehdr) *ehdr = reinterpret_cast<const ElfW(Ehdr) *>(file);
+
+  if (memcmp(ehdr->e_ident, ELFMAG, SELFMAG) == 0 &&
+      ehdr->e_shentsize == sizeof(ElfW(Shdr)) && ehdr->e_shoff <= fileSize &&
+      ehdr->e_shnum <= (fileSize - ehdr->e_shoff) / sizeof(ElfW(Shdr))) {
+    const ElfW(Shdr) *shdrs =
+        reinterpret_cast<const ElfW(Shdr) *>(file + ehdr->e_shoff);
+    for (ElfW(Half) i = 0; i < ehdr->e_shnum; i++) {
+      if ((shdrs[i].sh_type == SHT_SYMTAB ||
+           shdrs[i].sh_type == SHT_DYNSYM) &&
+          shdrs[i].sh_link < ehdr->e_shnum) {
+        addSymbols(module, file, fileSize, shdrs[i], shdrs[shdrs[i].sh_link]);
+      }
+    }
+  }
+  munmap(map, fileSize);
+
+  // the symbols of .dynsym are also in .symtab
+  std::stable_sort(module.symbols.begin(), module.symbols.end());
+  module.symbols.erase(
+      std::unique(module.symbols.begin(), module.symbols.end(),
+                  [](const ModuleSymbol &a, const ModuleSymbol &b) {
+                    return a.address == b.address;
+                  }),
+      module.symbols.end());
+  module.symbols.shrink_to_fit();
+  module.strings.shrink_to_fit();
+  QBDI_DEBUG("Index {} symbols of {}", module.symbols.size(), module.name);
+}
+
+void dladdrSymbol(rword address, const char *&symbol, uint32_t &symbolOffset,
+                  const char *&module) {
+  Dl_info info;
+  const char *ptr;
+
+  int ret = dladdr(reinterpret_cast<void *>(address), &info);
+  if (ret != 0) {
+    if (info.dli_sname) {
+      symbol = info.dli_sname;
+      symbolOffset = address - reinterpret_cast<rword>(info.dli_saddr);
+    }
+    if (info.dli_fname) {
+      // dirty basename, but thead safe
+      if ((ptr = strrchr(info.dli_fname, '/')) != nullptr) {
+        module = ptr + 1;
+      }
+    }
+  }
+}
+
+#if defined(QBDI_PLATFORM_LINUX)
+// an unloaded module invalidates the list of the modules
+void checkLoadCounters() {
+  LoadCounters counters = {0, 0};
+  dl_iterate_phdr(countersCB, &counters);
+  if (counters.first != knownAdds || counters.second != knownSubs) {
+    knownAdds = counters.first;
+    knownSubs = counters.second;
+    refreshModules();
+  }
+}
+#endif
+
+void updateModules() {
+#if defined(QBDI_PLATFORM_LINUX)
+  checkLoadCounters();
+#else
+  refreshModules();
+#endif
+}
+
+// The symbol ends at its size, or at the next symbol of the module
+Range<rword> symbolExtent(const ModuleIndex &index,
+                          std::vector<ModuleSymbol>::const_iterator it) {
+  if (it->size != 0) {
+    return Range<rword>(it->address, it->address + it->size);
+  }
+  auto next = std::next(it);
+  rword end = (next != index.symbols.end()) ? next->address : index.end;
+  return Range<rword>(it->address, std::max(end, it->address + 1));
+}
+
+// Append the extents of the function symbols whose name matches
+template <typename F>
+void matchFunctions(const F &match, std::vector<Range<rword>> &extents) {
+  for (const std::unique_ptr<ModuleIndex> &index : modules) {
+    if (not index->indexed) {
+      indexModule(*index);
+    }
+    for (auto it = index->symbols.cbegin(); it != index->symbols.cend();
+         ++it) {
+      if (it->function && match(index->strings.data() + it->name)) {
+        extents.push_back(symbolExtent(*index, it));
+      }
+    }
+  }
+}
+
+} // anonymous namespace
+
+void findSymbol(rword address, const char *&symbol, uint32_t &symbolOffset,
+                const char *&module) {
+  std::lock_guard<std::mutex> lock(symbolMutex);
+
+#if defined(QBDI_PLATFORM_LINUX)
+  checkLoadCounters();
+#endif
+
+  ModuleIndex *index = searchModule(address);
+#if !defined(QBDI_PLATFORM_LINUX)
+  // without the load counters, the modules are refreshed when an address is
+  // outside of the known modules
+  if (index == nullptr) {
+    refreshModules();
+    index = searchModule(address);
+  }
+#endif
+  if (index == nullptr) {
+    return;
+  }
+  if (not index->indexed) {
+    indexModule(*index);
+  }
+  // stripped module
+  if (index->symbols.empty()) {
+    dladdrSymbol(address, symbol, symbolOffset, module);
+    return;
+  }
+
+  module = index->name.c_str();
+  auto it = std::upper_bound(index->symbols.begin(), index->symbols.end(),
+                             ModuleSymbol{address, 0, 0, false});
+  if (it == index->symbols.begin()) {
+    return;
+  }
+  --it;
+  // dladdr doesn't match the address after the end of a sized symbol
+  if (it->size != 0 && address - it->address >= it->size) {
+    return;
+  }
+  symbol = index->strings.data() + it->name;
+  symbolOffset = address - it->address;
+}
+
+void getFunctionSymbols(rword start, rword end, std::vector<rword> &addresses) {
+  std::lock_guard<std::mutex> lock(symbolMutex);
+
+#if defined(QBDI_PLATFORM_LINUX)
+  checkLoadCounters();
+#else
+  refreshModules();
+#endif
+
+  for (const std::unique_ptr<ModuleIndex> &index : modules) {
+    if (index->end <= start || end <= index->start) {
+      continue;
+    }
+    if (not index->indexed) {
+      indexModule(*index);
+    }
+    auto it = std::lower_bound(index->symbols.begin(), index->symbols.end(),
+                               ModuleSymbol{start, 0, 0, false});
+    for (; it != index->symbols.end() && it->address < end; ++it) {
+      if (it->function) {
+        addresses.push_back(it->address);
+      }
+    }
+  }
+}
+
+void getFunctionExtents(const std::string &name,
+                        std::vector<Range<rword>> &extents) {
+  std::lock_guard<std::mutex> lock(symbolMutex);
+  updateModules();
+
+  matchFunctions(
+      [&name](const char *symbol) { return strcmp(symbol, name.c_str()) == 0; },
+      extents);
+}
+
+bool getFunctionExtentsRegex(const std::string &pattern,
+                             std::vector<Range<rword>> &extents) {
+  regex_t regex;
+  if (regcomp(&regex, pattern.c_str(), REG_EXTENDED | REG_NOSUB) != 0) {
+    QBDI_WARN("Invalid regular expression \"{}\"", pattern);
+    return false;
+  }
+  {
+    std::lock_guard<std::mutex> lock(symbolMutex);
+    updateModules();
+
+    matchFunctions(
+        [&regex](const char *symbol) {
+          return regexec(&regex, symbol, 0, nullptr, 0) == 0;
+        },
+        extents);
+  }
+  regfree(&regex);
+  return true;
+}
+
+bool getFunctionExtent(rword address, Range<rword> &extent) {
+  std::lock_guard<std::mutex> lock(symbolMutex);
+  updateModules();
+
+  ModuleIndex *index = searchModule(address);
+  if (index == nullptr) {
+    return false;
+  }
+  if (not index->indexed) {
+    indexModule(*index);
+  }
+  auto it = std::upper_bound(index->symbols.cbegin(), index->symbols.cend(),
+                             ModuleSymbol{address, 0, 0, false});
+  if (it == index->symbols.cbegin()) {
+    return false;
+  }
+  --it;
+  if (not it->function) {
+    return false;
+  }
+  extent = symbolExtent(*index, it);
+  return extent.contains(address);
+}
+
+} // namespace QBDI
@@ -19,6 +19,7 @@
 #define SYSTEM_H
 
 #include <stddef.h>
+#include <stdint.h>
 #include <string>
 #include <system_error>
 #include <vector>
@@ -31,10 +32,37 @@ llvm::sys::MemoryBlock
 allocateMappedMemory(size_t NumBytes,
                      const llvm::sys::MemoryBlock *const NearBlock,
                      unsigned PFlags, std::error_code &EC);
+// Allocate a block within a distance of an address. Return an empty block
+// if no space is available near the address.
+llvm::sys::MemoryBlock allocateNearMappedMemory(size_t numBytes,
+                                                uint64_t address,
+                                                uint64_t distance,
+                                                unsigned pFlags,
+                                                std::error_code &ec);
+// Allocate a block aligned on the size of a huge page, backed by transparent
+// huge pages when the system supports them (Linux and Android only)
+llvm::sys::MemoryBlock allocateHugeMappedMemory(size_t numBytes,
+                                                unsigned pFlags,
+                                                std::error_code &ec);
 void releaseMappedMemory(llvm::sys::MemoryBlock &block);
+// Get the NUMA node of the CPU which runs the thread. Return -1 if the node
+// is unknown (Linux and Android only)
+int getCurrentNumaNode();
+// Prefer the pages of a block on a NUMA node, the pages already touched are
+// moved to the node. Return false if the policy cannot be set.
+bool bindMemoryToNumaNode(const llvm::sys::MemoryBlock &block, int node);
+int createSharedMemory(size_t numBytes);
+llvm::sys::MemoryBlock
+mapSharedMemory(int handle, size_t numBytes, void *address,
+                unsigned pFlags = llvm::sys::Memory::MF_READ |
+                                  llvm::sys::Memory::MF_WRITE);
+void releaseSharedMemory(int handle);
 const std::string getHostCPUName();
 const std::vector<std::string> getHostCPUFeatures();
 bool isHostCPUFeaturePresent(const char *f);
+// Get a counter changed each time a module is loaded or unloaded. Return
+// false if the platform cannot track the modules.
+bool getModulesGeneration(uint64_t &generation);
 } // namespace QBDI
 
 #endif // SYSTEM_H
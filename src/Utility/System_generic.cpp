@@ -16,10 +16,13 @@
  * limitations under the License.
  */
 #include <algorithm>
+#include <errno.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string>
 #include <system_error>
+#include <vector>
 
 #include "llvm/ADT/StringMap.h"
 #include "llvm/ADT/StringRef.h"
@@ -32,8 +35,41 @@
 #include "Utility/LogSys.h"
 #include "Utility/System.h"
 
+#if defined(QBDI_PLATFORM_LINUX) || defined(QBDI_PLATFORM_ANDROID)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 namespace QBDI {
 
+#if defined(QBDI_PLATFORM_LINUX) || defined(QBDI_PLATFORM_ANDROID)
+namespace {
+
+// Size of the huge pages of the transparent huge pages
+const size_t HUGE_PAGE_SIZE = 0x200000;
+
+// Policy and flag of mbind (linux/mempolicy.h)
+const int NUMA_MPOL_PREFERRED = 1;
+const unsigned NUMA_MPOL_MF_MOVE = 1 << 1;
+
+int getProtection(unsigned pFlags) {
+  int prot = PROT_NONE;
+  if (pFlags & llvm::sys::Memory::MF_READ) {
+    prot |= PROT_READ;
+  }
+  if (pFlags & llvm::sys::Memory::MF_WRITE) {
+    prot |= PROT_WRITE;
+  }
+  if (pFlags & llvm::sys::Memory::MF_EXEC) {
+    prot |= PROT_EXEC;
+  }
+  return prot;
+}
+
+} // anonymous namespace
+#endif
+
 bool isRWXSupported() { return false; }
 
 llvm::sys::MemoryBlock
@@ -45,11 +81,151 @@ allocateMappedMemory(size_t numBytes,
                                                  ec);
 }
 
+llvm::sys::MemoryBlock allocateNearMappedMemory(size_t numBytes,
+                                                uint64_t address,
+                                                uint64_t distance,
+                                                unsigned pFlags,
+                                                std::error_code &ec) {
+  // The near block is only a hint of the mapping, the hints are moved away
+  // from the address until a block is mapped within the distance
+  static const uint64_t step = 1 << 24;
+  for (uint64_t delta = step; delta < distance; delta += step) {
+    const uint64_t hints[] = {address - delta, address + delta};
+    for (size_t i = 0; i < 2; i++) {
+      // skip the hints which wrap around the address space
+      if ((i == 0) ? (delta >= address) : (hints[i] < address)) {
+        continue;
+      }
+      const llvm::sys::MemoryBlock nearBlock(
+          reinterpret_cast<void *>(static_cast<uintptr_t>(hints[i])), 0);
+      llvm::sys::MemoryBlock block = llvm::sys::Memory::allocateMappedMemory(
+          numBytes, &nearBlock, pFlags, ec);
+      if (block.base() == nullptr) {
+        continue;
+      }
+      uint64_t base = reinterpret_cast<uint64_t>(block.base());
+      if ((base < address ? address - base
+                          : base + block.allocatedSize() - address) <=
+          distance) {
+        return block;
+      }
+      llvm::sys::Memory::releaseMappedMemory(block);
+    }
+  }
+  return llvm::sys::MemoryBlock();
+}
+
+llvm::sys::MemoryBlock allocateHugeMappedMemory(size_t numBytes,
+                                                unsigned pFlags,
+                                                std::error_code &ec) {
+#if defined(QBDI_PLATFORM_LINUX) || defined(QBDI_PLATFORM_ANDROID)
+  // Map one more huge page and unmap the unaligned head and tail
+  numBytes = (numBytes + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+  void *res = mmap(nullptr, numBytes + HUGE_PAGE_SIZE, getProtection(pFlags),
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (res == MAP_FAILED) {
+    ec = std::error_code(errno, std::generic_category());
+    return llvm::sys::MemoryBlock();
+  }
+  uintptr_t start = reinterpret_cast<uintptr_t>(res);
+  uintptr_t aligned = (start + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+  if (aligned != start) {
+    munmap(res, aligned - start);
+  }
+  munmap(reinterpret_cast<void *>(aligned + numBytes),
+         start + HUGE_PAGE_SIZE - aligned);
+#if defined(MADV_HUGEPAGE)
+  if (madvise(reinterpret_cast<void *>(aligned), numBytes, MADV_HUGEPAGE) !=
+      0) {
+    QBDI_DEBUG("Transparent huge pages not available");
+  }
+#endif
+  return llvm::sys::MemoryBlock(reinterpret_cast<void *>(aligned), numBytes);
+#else
+  return llvm::sys::Memory::allocateMappedMemory(numBytes, nullptr, pFlags, ec);
+#endif
+}
+
 void releaseMappedMemory(llvm::sys::MemoryBlock &block) {
   llvm::sys::Memory::releaseMappedMemory(block);
 }
 
-const std::string getHostCPUName() {
+int getCurrentNumaNode() {
+#if defined(QBDI_PLATFORM_LINUX) || defined(QBDI_PLATFORM_ANDROID)
+  // getcpu isn't available in the libc of older Android and glibc
+  unsigned cpu = 0;
+  unsigned node = 0;
+  if (syscall(__NR_getcpu, &cpu, &node, nullptr) == 0) {
+    return static_cast<int>(node);
+  }
+#endif
+  return -1;
+}
+
+bool bindMemoryToNumaNode(const llvm::sys::MemoryBlock &block, int node) {
+#if defined(QBDI_PLATFORM_LINUX) || defined(QBDI_PLATFORM_ANDROID)
+  if (node < 0 or block.base() == nullptr) {
+    return false;
+  }
+  const size_t bits = sizeof(unsigned long) * 8;
+  std::vector<unsigned long> mask(node / bits + 1, 0);
+  mask[node / bits] = 1UL << (node % bits);
+  // the kernel reads one bit less than maxnode
+  if (syscall(__NR_mbind, block.base(), block.allocatedSize(),
+              NUMA_MPOL_PREFERRED, mask.data(), mask.size() * bits + 1,
+              NUMA_MPOL_MF_MOVE) == 0) {
+    return true;
+  }
+  QBDI_DEBUG("Fail to bind 0x{:x} to the NUMA node {}: errno {}",
+             reinterpret_cast<uintptr_t>(block.base()), node, errno);
+#endif
+  return false;
+}
+
+int createSharedMemory(size_t numBytes) {
+#if defined(QBDI_PLATFORM_LINUX) || defined(QBDI_PLATFORM_ANDROID)
+  // memfd_create isn't available in the libc of older Android
+  int fd = static_cast<int>(syscall(__NR_memfd_create, "qbdi", 0));
+  if (fd < 0) {
+    QBDI_WARN("Fail to create a shared memory object");
+    return -1;
+  }
+  if (ftruncate(fd, numBytes) != 0) {
+    QBDI_WARN("Fail to resize the shared memory object");
+    close(fd);
+    return -1;
+  }
+  return fd;
+#else
+  return -1;
+#endif
+}
+
+llvm::sys::MemoryBlock mapSharedMemory(int handle, size_t numBytes,
+                                       void *address, unsigned pFlags) {
+#if defined(QBDI_PLATFORM_LINUX) || defined(QBDI_PLATFORM_ANDROID)
+  // when an address is given, it replaces the existing mapping
+  int flags = MAP_SHARED;
+  if (address != nullptr) {
+    flags |= MAP_FIXED;
+  }
+  void *res = mmap(address, numBytes, getProtection(pFlags), flags, handle, 0);
+  if (res != MAP_FAILED) {
+    return llvm::sys::MemoryBlock(res, numBytes);
+  }
+#endif
+  return llvm::sys::MemoryBlock();
+}
+
+void releaseSharedMemory(int handle) {
+#if defined(QBDI_PLATFORM_LINUX) || defined(QBDI_PLATFORM_ANDROID)
+  close(handle);
+#endif
+}
+
+namespace {
+
+std::string detectHostCPUName() {
   const std::string cpuname = llvm::sys::getHostCPUName().str();
   // set default ARM CPU
   if constexpr (is_arm)
@@ -58,7 +234,7 @@ const std::string getHostCPUName() {
   return cpuname;
 }
 
-const std::vector<std::string> getHostCPUFeatures() {
+std::vector<std::string> detectHostCPUFeatures() {
   std::vector<std::string> mattrs = {};
   llvm::StringMap<bool> features;
 
@@ -167,6 +343,19 @@ const std::vector<std::string> getHostCPUFeatures() {
   return mattrs;
 }
 
+} // anonymous namespace
+
+// The host is detected once, each VM would otherwise query it again
+const std::string getHostCPUName() {
+  static const std::string cpuname = detectHostCPUName();
+  return cpuname;
+}
+
+const std::vector<std::string> getHostCPUFeatures() {
+  static const std::vector<std::string> mattrs = detectHostCPUFeatures();
+  return mattrs;
+}
+
 bool isHostCPUFeaturePresent(const char *query) {
   std::vector<std::string> features = getHostCPUFeatures();
   for (const std::string &feature : features) {
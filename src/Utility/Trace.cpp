@@ -0,0 +1,654 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "QBDI/Config.h"
+#if defined(QBDI_PLATFORM_WINDOWS)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "QBDI/Errors.h"
+#include "QBDI/Trace.h"
+#include "QBDI/VM.h"
+#include "Utility/AddressMap.h"
+#include "Utility/LogSys.h"
+
+// The trace starts with the magic, the version and the size of a rword. Each
+// record is a tag followed by LEB128 varints. The addresses are encoded as a
+// zigzag delta with the previous address of the same kind, a sequence is
+// encoded with its start and its size the first time and with its identifier
+// after. With the compressed control flow, a sequence which is one of the two
+// last successors of the previous sequence is encoded as a bit of a branch
+// record, the other ones are encoded as before.
+
+namespace QBDI {
+
+namespace {
+
+constexpr char TRACE_MAGIC[] = {'Q', 'B', 'D', 'I', 'T', 'R', 'C'};
+constexpr uint8_t TRACE_VERSION = 2;
+
+enum TraceTag : uint8_t {
+  TAG_NEW_SEQUENCE = 1,
+  TAG_SEQUENCE = 2,
+  TAG_MEMORY = 3,
+  TAG_COVERAGE = 4,
+  TAG_BRANCHES = 5,
+};
+
+// maximal number of bits of a branch record
+constexpr unsigned MAX_BRANCH_BITS = 64;
+
+enum TraceEventKind : uint8_t {
+  EVENT_SEQUENCE,
+  EVENT_MEMORY,
+  EVENT_COVERAGE,
+  EVENT_COMPRESSION,
+};
+
+struct TraceEvent {
+  rword a;
+  rword b;
+  rword c;
+  uint16_t size;
+  uint16_t type;
+  uint16_t flags;
+  TraceEventKind kind;
+};
+
+inline uint64_t zigzag(rword v) {
+  int64_t s = static_cast<int64_t>(static_cast<std::make_signed_t<rword>>(v));
+  return (static_cast<uint64_t>(s) << 1) ^ static_cast<uint64_t>(s >> 63);
+}
+
+inline rword unzigzag(uint64_t v) {
+  return static_cast<rword>((v >> 1) ^ (~(v & 1) + 1));
+}
+
+inline uint8_t *putVarint(uint8_t *p, uint64_t v) {
+  while (v >= 0x80) {
+    *p++ = static_cast<uint8_t>(v) | 0x80;
+    v >>= 7;
+  }
+  *p++ = static_cast<uint8_t>(v);
+  return p;
+}
+
+bool getVarint(FILE *file, uint64_t &v) {
+  v = 0;
+  for (unsigned shift = 0; shift < 64; shift += 7) {
+    int c = getc(file);
+    if (c == EOF) {
+      return false;
+    }
+    v |= static_cast<uint64_t>(c & 0x7f) << shift;
+    if ((c & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// The successors of each sequence identifier, learned in the same order by the
+// encoder and the decoder from the sequences that aren't encoded as a bit.
+class SuccessorTable {
+private:
+  std::vector<std::array<uint32_t, 2>> table;
+  uint32_t last = 0;
+
+public:
+  // successor of the last sequence for a bit, 0 if unknown
+  inline uint32_t get(unsigned bit) const {
+    return (last < table.size()) ? table[last][bit] : 0;
+  }
+
+  // the next sequence is encoded with its identifier
+  void learn(uint32_t id) {
+    if (last != 0) {
+      if (last >= table.size()) {
+        table.resize(last + 1, {0, 0});
+      }
+      std::array<uint32_t, 2> &s = table[last];
+      if (s[0] == 0) {
+        s[0] = id;
+      } else if (s[0] != id and s[1] != id) {
+        // the most recent target of an indirect branch replaces the second
+        s[1] = id;
+      }
+    }
+    last = id;
+  }
+
+  // the next sequence is encoded as a bit
+  inline void follow(uint32_t id) { last = id; }
+};
+
+FILE *openFd(int fd) {
+#if defined(QBDI_PLATFORM_WINDOWS)
+  int copy = _dup(fd);
+  FILE *file = (copy < 0) ? nullptr : _fdopen(copy, "wb");
+  if (file == nullptr && copy >= 0) {
+    _close(copy);
+  }
+#else
+  int copy = dup(fd);
+  FILE *file = (copy < 0) ? nullptr : fdopen(copy, "wb");
+  if (file == nullptr && copy >= 0) {
+    close(copy);
+  }
+#endif
+  return file;
+}
+
+} // anonymous namespace
+
+class TraceQueue {
+private:
+  struct SequenceID {
+    uint32_t id = 0;
+    rword end = 0;
+  };
+
+  std::vector<TraceEvent> events;
+  size_t mask;
+  // head is written by the producer, tail by the writer thread
+  alignas(64) std::atomic<size_t> head{0};
+  alignas(64) std::atomic<size_t> tail{0};
+  alignas(64) std::atomic<size_t> flushRequest{0};
+  std::atomic<size_t> flushDone{0};
+  std::atomic<bool> stop{false};
+
+  FILE *file;
+  std::thread writer;
+
+  // state of the encoder, only used by the writer thread
+  AddressMap<SequenceID> sequenceIDs;
+  uint32_t nextID = 1;
+  rword lastPC = 0;
+  rword lastInst = 0;
+  rword lastAccess = 0;
+  rword lastIndex = 0;
+  SuccessorTable successors;
+  bool compressed = false;
+  uint64_t branchBits = 0;
+  unsigned nbBranchBits = 0;
+
+  void flushBranches() {
+    if (nbBranchBits == 0) {
+      return;
+    }
+    uint8_t buffer[16];
+    uint8_t *p = buffer;
+    *p++ = TAG_BRANCHES;
+    p = putVarint(p, nbBranchBits);
+    for (unsigned i = 0; i < nbBranchBits; i += 8) {
+      *p++ = static_cast<uint8_t>(branchBits >> i);
+    }
+    fwrite(buffer, 1, p - buffer, file);
+    branchBits = 0;
+    nbBranchBits = 0;
+  }
+
+  // encode a known successor of the previous sequence as a bit
+  bool encodeBranch(const TraceEvent &e) {
+    if (not compressed) {
+      return false;
+    }
+    auto it = sequenceIDs.find(e.a);
+    if (it == sequenceIDs.end() or it->second.id == 0 or
+        it->second.end != e.b) {
+      return false;
+    }
+    uint32_t id = it->second.id;
+    unsigned bit;
+    if (successors.get(0) == id) {
+      bit = 0;
+    } else if (successors.get(1) == id) {
+      bit = 1;
+    } else {
+      return false;
+    }
+    branchBits |= static_cast<uint64_t>(bit) << nbBranchBits;
+    if (++nbBranchBits == MAX_BRANCH_BITS) {
+      flushBranches();
+    }
+    successors.follow(id);
+    lastPC = e.a;
+    return true;
+  }
+
+  void encode(const TraceEvent &e) {
+    uint8_t buffer[64];
+    uint8_t *p = buffer;
+    if (e.kind == EVENT_COMPRESSION) {
+      compressed = (e.a != 0);
+      return;
+    }
+    if (e.kind == EVENT_SEQUENCE and encodeBranch(e)) {
+      return;
+    }
+    // the bits are decoded before the next record
+    flushBranches();
+    switch (e.kind) {
+      case EVENT_SEQUENCE: {
+        SequenceID &seq = sequenceIDs[e.a];
+        if (seq.id != 0 and seq.end == e.b) {
+          *p++ = TAG_SEQUENCE;
+          p = putVarint(p, seq.id);
+        } else {
+          // a sequence may be cut differently after a cache flush
+          seq.id = nextID++;
+          seq.end = e.b;
+          *p++ = TAG_NEW_SEQUENCE;
+          p = putVarint(p, zigzag(e.a - lastPC));
+          p = putVarint(p, e.b - e.a);
+        }
+        successors.learn(seq.id);
+        lastPC = e.a;
+        break;
+      }
+      case EVENT_MEMORY:
+        *p++ = TAG_MEMORY;
+        p = putVarint(p, zigzag(e.a - lastInst));
+        p = putVarint(p, zigzag(e.b - lastAccess));
+        p = putVarint(p, e.size);
+        p = putVarint(p, e.type | (static_cast<uint64_t>(e.flags) << 2));
+        if ((e.flags & MEMORY_UNKNOWN_VALUE) == 0) {
+          p = putVarint(p, e.c);
+        }
+        lastInst = e.a;
+        lastAccess = e.b;
+        break;
+      case EVENT_COVERAGE:
+        *p++ = TAG_COVERAGE;
+        p = putVarint(p, zigzag(e.a - lastIndex));
+        p = putVarint(p, e.b);
+        lastIndex = e.a;
+        break;
+      case EVENT_COMPRESSION:
+        break;
+    }
+    fwrite(buffer, 1, p - buffer, file);
+  }
+
+  void run() {
+    while (true) {
+      // the request is read before the head: the events pushed before the
+      // request are written before the flush
+      size_t request = flushRequest.load(std::memory_order_acquire);
+      bool stopping = stop.load(std::memory_order_acquire);
+      size_t t = tail.load(std::memory_order_relaxed);
+      size_t h = head.load(std::memory_order_acquire);
+      for (; t != h; t++) {
+        encode(events[t & mask]);
+      }
+      tail.store(t, std::memory_order_release);
+      if (request != flushDone.load(std::memory_order_relaxed)) {
+        flushBranches();
+        fflush(file);
+        flushDone.store(request, std::memory_order_release);
+      } else if (stopping) {
+        flushBranches();
+        return;
+      } else if (t == h) {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+      }
+    }
+  }
+
+public:
+  TraceQueue(FILE *file, size_t capacity) : file(file) {
+    size_t size = 16;
+    while (size < capacity) {
+      size <<= 1;
+    }
+    events.resize(size);
+    mask = size - 1;
+    if (file == nullptr) {
+      return;
+    }
+    setvbuf(file, nullptr, _IOFBF, 1 << 20);
+    uint8_t header[sizeof(TRACE_MAGIC) + 2];
+    memcpy(header, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+    header[sizeof(TRACE_MAGIC)] = TRACE_VERSION;
+    header[sizeof(TRACE_MAGIC) + 1] = sizeof(rword);
+    fwrite(header, 1, sizeof(header), file);
+    writer = std::thread(&TraceQueue::run, this);
+  }
+
+  ~TraceQueue() {
+    if (file == nullptr) {
+      return;
+    }
+    stop.store(true, std::memory_order_release);
+    writer.join();
+    fclose(file);
+  }
+
+  inline bool isOpen() const { return file != nullptr; }
+
+  void push(const TraceEvent &e) {
+    if (file == nullptr) {
+      return;
+    }
+    size_t h = head.load(std::memory_order_relaxed);
+    // the trace is never truncated, the producer waits for the writer
+    while (h - tail.load(std::memory_order_acquire) > mask) {
+      std::this_thread::yield();
+    }
+    events[h & mask] = e;
+    head.store(h + 1, std::memory_order_release);
+  }
+
+  void flush() {
+    if (file == nullptr) {
+      return;
+    }
+    size_t request = flushRequest.fetch_add(1, std::memory_order_acq_rel) + 1;
+    while (flushDone.load(std::memory_order_acquire) != request) {
+      std::this_thread::yield();
+    }
+  }
+};
+
+class TraceDecoder {
+private:
+  FILE *file;
+  std::vector<std::pair<rword, rword>> sequences;
+  rword lastPC = 0;
+  rword lastInst = 0;
+  rword lastAccess = 0;
+  rword lastIndex = 0;
+  SuccessorTable successors;
+  uint64_t branchBits = 0;
+  unsigned nbBranchBits = 0;
+
+  void setSequence(TraceRecord &record, uint32_t id) {
+    record.type = TRACE_SEQUENCE;
+    record.blockID = id;
+    record.start = sequences[id].first;
+    record.end = sequences[id].second;
+    lastPC = record.start;
+  }
+
+public:
+  TraceDecoder(const std::string &path) : file(fopen(path.c_str(), "rb")) {
+    if (file == nullptr) {
+      return;
+    }
+    uint8_t header[sizeof(TRACE_MAGIC) + 2];
+    if (fread(header, 1, sizeof(header), file) != sizeof(header) or
+        memcmp(header, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0 or
+        header[sizeof(TRACE_MAGIC)] == 0 or
+        header[sizeof(TRACE_MAGIC)] > TRACE_VERSION or
+        header[sizeof(TRACE_MAGIC) + 1] != sizeof(rword)) {
+      QBDI_WARN("{} isn't a trace of this architecture", path);
+      fclose(file);
+      file = nullptr;
+    }
+    // the index 0 isn't a valid identifier
+    sequences.emplace_back(0, 0);
+  }
+
+  ~TraceDecoder() {
+    if (file != nullptr) {
+      fclose(file);
+    }
+  }
+
+  inline bool isOpen() const { return file != nullptr; }
+
+  bool next(TraceRecord &record) {
+    if (file == nullptr) {
+      return false;
+    }
+    memset(&record, 0, sizeof(record));
+    if (nbBranchBits != 0) {
+      uint32_t id = successors.get(branchBits & 1);
+      branchBits >>= 1;
+      nbBranchBits--;
+      if (id == 0) {
+        return false;
+      }
+      successors.follow(id);
+      setSequence(record, id);
+      return true;
+    }
+    int tag = getc(file);
+    uint64_t a, b, c, d, v = 0;
+    switch (tag) {
+      case TAG_NEW_SEQUENCE:
+        if (not getVarint(file, a) or not getVarint(file, b)) {
+          return false;
+        }
+        lastPC += unzigzag(a);
+        sequences.emplace_back(lastPC, lastPC + static_cast<rword>(b));
+        successors.learn(static_cast<uint32_t>(sequences.size() - 1));
+        setSequence(record, static_cast<uint32_t>(sequences.size() - 1));
+        return true;
+      case TAG_SEQUENCE:
+        if (not getVarint(file, a) or a == 0 or a >= sequences.size()) {
+          return false;
+        }
+        successors.learn(static_cast<uint32_t>(a));
+        setSequence(record, static_cast<uint32_t>(a));
+        return true;
+      case TAG_BRANCHES:
+        if (not getVarint(file, a) or a == 0 or a > MAX_BRANCH_BITS) {
+          return false;
+        }
+        for (unsigned i = 0; i < a; i += 8) {
+          int byte = getc(file);
+          if (byte == EOF) {
+            return false;
+          }
+          branchBits |= static_cast<uint64_t>(byte) << i;
+        }
+        nbBranchBits = static_cast<unsigned>(a);
+        return next(record);
+      case TAG_MEMORY:
+        if (not getVarint(file, a) or not getVarint(file, b) or
+            not getVarint(file, c) or not getVarint(file, d)) {
+          return false;
+        }
+        if (((d >> 2) & MEMORY_UNKNOWN_VALUE) == 0 and
+            not getVarint(file, v)) {
+          return false;
+        }
+        lastInst += unzigzag(a);
+        lastAccess += unzigzag(b);
+        record.type = TRACE_MEMORY;
+        record.access.instAddress = lastInst;
+        record.access.accessAddress = lastAccess;
+        record.access.value = static_cast<rword>(v);
+        record.access.size = static_cast<uint16_t>(c);
+        record.access.type = static_cast<uint16_t>(d & 3);
+        record.access.flags = static_cast<uint16_t>(d >> 2);
+        return true;
+      case TAG_COVERAGE:
+        if (not getVarint(file, a) or not getVarint(file, b)) {
+          return false;
+        }
+        lastIndex += unzigzag(a);
+        record.type = TRACE_COVERAGE;
+        record.start = lastIndex;
+        record.end = static_cast<rword>(b);
+        return true;
+      case EOF:
+        return false;
+      default:
+        QBDI_WARN("Unknown trace record 0x{:x}", tag);
+        return false;
+    }
+  }
+};
+
+// =========================
+
+TraceWriter::TraceWriter(const std::string &path, size_t capacity)
+    : queue(std::make_unique<TraceQueue>(fopen(path.c_str(), "wb"),
+                                         capacity)) {
+  if (not queue->isOpen()) {
+    QBDI_WARN("Cannot open the trace file {}", path);
+  }
+}
+
+TraceWriter::TraceWriter(int fd, size_t capacity)
+    : queue(std::make_unique<TraceQueue>(openFd(fd), capacity)) {
+  if (not queue->isOpen()) {
+    QBDI_WARN("Cannot write the trace to the descriptor {}", fd);
+  }
+}
+
+TraceWriter::~TraceWriter() = default;
+
+bool TraceWriter::isOpen() const { return queue->isOpen(); }
+
+void TraceWriter::addSequence(rword start, rword end) {
+  queue->push({start, end, 0, 0, 0, 0, EVENT_SEQUENCE});
+}
+
+void TraceWriter::addMemoryAccess(const MemoryTraceEntry &access) {
+  queue->push({access.instAddress, access.accessAddress, access.value,
+               access.size, access.type, access.flags, EVENT_MEMORY});
+}
+
+void TraceWriter::setCompressedControlFlow(bool enable) {
+  queue->push({enable ? 1u : 0u, 0, 0, 0, 0, 0, EVENT_COMPRESSION});
+}
+
+void TraceWriter::addCoverage(const uint8_t *bitmap, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    if (bitmap[i] != 0) {
+      queue->push({i, bitmap[i], 0, 0, 0, 0, EVENT_COVERAGE});
+    }
+  }
+}
+
+void TraceWriter::flush() { queue->flush(); }
+
+uint32_t TraceWriter::attach(VM &vm, MemoryAccessType type) {
+  if (type != 0 and not vm.setMemoryTrace(type, memoryCB, this)) {
+    return VMError::INVALID_EVENTID;
+  }
+  return vm.addVMEventCB(SEQUENCE_ENTRY, sequenceCB, this);
+}
+
+VMAction TraceWriter::sequenceCB(VMInstanceRef vm, const VMState *vmState,
+                                 GPRState *gprState, FPRState *fprState,
+                                 void *data) {
+  static_cast<TraceWriter *>(data)->addSequence(vmState->sequenceStart,
+                                                vmState->sequenceEnd);
+  return CONTINUE;
+}
+
+VMAction TraceWriter::memoryCB(VMInstanceRef vm,
+                               const MemoryTraceEntry *entries, size_t count,
+                               void *data) {
+  TraceWriter *writer = static_cast<TraceWriter *>(data);
+  for (size_t i = 0; i < count; i++) {
+    writer->addMemoryAccess(entries[i]);
+  }
+  return CONTINUE;
+}
+
+TraceReader::TraceReader(const std::string &path)
+    : decoder(std::make_unique<TraceDecoder>(path)) {}
+
+TraceReader::~TraceReader() = default;
+
+bool TraceReader::isOpen() const { return decoder->isOpen(); }
+
+bool TraceReader::next(TraceRecord &record) { return decoder->next(record); }
+
+// =========================
+
+TraceWriterRef qbdi_newTraceWriter(const char *path, size_t capacity) {
+  QBDI_REQUIRE_ACTION(path != nullptr, return nullptr);
+  TraceWriter *writer = new TraceWriter(std::string(path), capacity);
+  if (not writer->isOpen()) {
+    delete writer;
+    return nullptr;
+  }
+  return writer;
+}
+
+TraceWriterRef qbdi_newTraceWriterFd(int fd, size_t capacity) {
+  TraceWriter *writer = new TraceWriter(fd, capacity);
+  if (not writer->isOpen()) {
+    delete writer;
+    return nullptr;
+  }
+  return writer;
+}
+
+void qbdi_deleteTraceWriter(TraceWriterRef writer) { delete writer; }
+
+void qbdi_flushTraceWriter(TraceWriterRef writer) {
+  QBDI_REQUIRE_ACTION(writer != nullptr, return);
+  writer->flush();
+}
+
+void qbdi_traceWriterAddCoverage(TraceWriterRef writer, const uint8_t *bitmap,
+                                 size_t size) {
+  QBDI_REQUIRE_ACTION(writer != nullptr, return);
+  QBDI_REQUIRE_ACTION(bitmap != nullptr or size == 0, return);
+  writer->addCoverage(bitmap, size);
+}
+
+void qbdi_traceWriterSetCompressedControlFlow(TraceWriterRef writer,
+                                              bool enable) {
+  QBDI_REQUIRE_ACTION(writer != nullptr, return);
+  writer->setCompressedControlFlow(enable);
+}
+
+uint32_t qbdi_attachTraceWriter(TraceWriterRef writer, VMInstanceRef instance,
+                                MemoryAccessType type) {
+  QBDI_REQUIRE_ACTION(writer != nullptr, return VMError::INVALID_EVENTID);
+  QBDI_REQUIRE_ACTION(instance != nullptr, return VMError::INVALID_EVENTID);
+  return writer->attach(*instance, type);
+}
+
+TraceReaderRef qbdi_newTraceReader(const char *path) {
+  QBDI_REQUIRE_ACTION(path != nullptr, return nullptr);
+  TraceReader *reader = new TraceReader(std::string(path));
+  if (not reader->isOpen()) {
+    delete reader;
+    return nullptr;
+  }
+  return reader;
+}
+
+bool qbdi_traceReaderNext(TraceReaderRef reader, TraceRecord *record) {
+  QBDI_REQUIRE_ACTION(reader != nullptr, return false);
+  QBDI_REQUIRE_ACTION(record != nullptr, return false);
+  return reader->next(*record);
+}
+
+void qbdi_deleteTraceReader(TraceReaderRef reader) { delete reader; }
+
+} // namespace QBDI
@@ -76,30 +76,40 @@ static ConditionType ConditionLLVM2QBDI(unsigned cond) {
   }
 }
 
-void analyseCondition(InstAnalysis *instAnalysis, const llvm::MCInst &inst,
-                      const llvm::MCInstrDesc &desc) {
-  const unsigned numOperands = inst.getNumOperands();
+void analyseOpcodeCondition(OpcodeAnalysis &opAnalysis, unsigned opcode,
+                            const llvm::MCInstrDesc &desc) {
+  opAnalysis.condOperand = -1;
+  opAnalysis.condition = CONDITION_NONE;
+  const unsigned numOperands = desc.getNumOperands();
   for (unsigned i = 0; i < numOperands; i++) {
     const llvm::MCOperandInfo &opdesc = desc.OpInfo[i];
     if (opdesc.OperandType == llvm::X86::OperandType::OPERAND_COND_CODE) {
-      instAnalysis->condition = ConditionLLVM2QBDI(
-          static_cast<unsigned>(inst.getOperand(i).getImm()));
+      opAnalysis.condOperand = i;
       return;
     }
   }
-  switch (inst.getOpcode()) {
+  switch (opcode) {
     case llvm::X86::LOOPE:
-      instAnalysis->condition = CONDITION_EQUALS;
+      opAnalysis.condition = CONDITION_EQUALS;
       break;
     case llvm::X86::LOOPNE:
-      instAnalysis->condition = CONDITION_NOT_EQUALS;
+      opAnalysis.condition = CONDITION_NOT_EQUALS;
       break;
     default:
-      instAnalysis->condition = CONDITION_NONE;
       break;
   }
 }
 
+ConditionType analyseCondition(const OpcodeAnalysis &opAnalysis,
+                               const llvm::MCInst &inst) {
+  if (opAnalysis.condOperand < 0 or
+      static_cast<unsigned>(opAnalysis.condOperand) >= inst.getNumOperands()) {
+    return opAnalysis.condition;
+  }
+  return ConditionLLVM2QBDI(
+      static_cast<unsigned>(inst.getOperand(opAnalysis.condOperand).getImm()));
+}
+
 bool isFlagOperand(unsigned opcode, unsigned opNum, unsigned operandType) {
   switch (operandType) {
     default:
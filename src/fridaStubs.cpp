@@ -55,7 +55,7 @@ QBDI_EXPORT const StructDesc *qbdi_getMemoryAccessStructDesc() {
 
 QBDI_EXPORT const StructDesc *qbdi_getVMStateStructDesc() {
   static const StructDesc VMStateDesc{sizeof(VMState),
-                                      6,
+                                      7,
                                       {
                                           offsetof(VMState, event),
                                           offsetof(VMState, sequenceStart),
@@ -63,6 +63,7 @@ QBDI_EXPORT const StructDesc *qbdi_getVMStateStructDesc() {
                                           offsetof(VMState, basicBlockStart),
                                           offsetof(VMState, basicBlockEnd),
                                           offsetof(VMState, lastSignal),
+                                          offsetof(VMState, syscallNumber),
                                       }};
   return &VMStateDesc;
 }
@@ -87,7 +88,7 @@ QBDI_EXPORT const StructDesc *qbdi_getOperandAnalysisStructDesc() {
 QBDI_EXPORT const StructDesc *qbdi_getInstAnalysisStructDesc() {
   static const StructDesc InstAnalysisDesc{
       sizeof(InstAnalysis),
-      22,
+      26,
       {
           offsetof(InstAnalysis, mnemonic),
           offsetof(InstAnalysis, disassembly),
@@ -111,6 +112,10 @@ QBDI_EXPORT const StructDesc *qbdi_getInstAnalysisStructDesc() {
           offsetof(InstAnalysis, symbol),
           offsetof(InstAnalysis, symbolOffset),
           offsetof(InstAnalysis, module),
+          offsetof(InstAnalysis, gprRead),
+          offsetof(InstAnalysis, gprWrite),
+          offsetof(InstAnalysis, fprRead),
+          offsetof(InstAnalysis, fprWrite),
       }};
   return &InstAnalysisDesc;
 }
@@ -18,8 +18,10 @@
 #include <catch2/catch.hpp>
 #include "APITest.h"
 
+#include <map>
 #include <sstream>
 #include <string>
+#include <vector>
 #include "inttypes.h"
 
 #include "TestSetup/InMemoryAssembler.h"
@@ -27,6 +29,7 @@
 #include "QBDI/Memory.hpp"
 #include "QBDI/Platform.h"
 #include "QBDI/Range.h"
+#include "QBDI/Trace.h"
 
 #define FAKE_RET_ADDR 0x666
 
@@ -364,6 +367,45 @@ QBDI::VMAction checkUnrolledReadBB(QBDI::VMInstanceRef vm,
   return QBDI::VMAction::CONTINUE;
 }
 
+QBDI::VMAction checkUnrolledReadBatch(QBDI::VMInstanceRef vm,
+                                      const QBDI::VMState *vmState,
+                                      QBDI::GPRState *gprState,
+                                      QBDI::FPRState *fprState,
+                                      const QBDI::MemoryAccess *accesses,
+                                      size_t count, void *data) {
+
+  TestInfo *info = (TestInfo *)data;
+  // the batch has the read accesses given by getBBMemoryAccess
+  std::vector<QBDI::MemoryAccess> expected;
+  for (const QBDI::MemoryAccess &memaccess : vm->getBBMemoryAccess()) {
+    if (memaccess.type == QBDI::MEMORY_READ) {
+      expected.push_back(memaccess);
+    }
+  }
+  CHECK(count == expected.size());
+  QBDI::Range<QBDI::rword> brange((QBDI::rword)info->buffer,
+                                  ((QBDI::rword)info->buffer) +
+                                      info->buffer_size);
+  for (size_t i = 0; i < count; i++) {
+    const QBDI::MemoryAccess &memaccess = accesses[i];
+    if (i < expected.size()) {
+      CHECK(memaccess.instAddress == expected[i].instAddress);
+      CHECK(memaccess.accessAddress == expected[i].accessAddress);
+      CHECK(memaccess.value == expected[i].value);
+      CHECK(memaccess.size == expected[i].size);
+      CHECK(memaccess.flags == expected[i].flags);
+    }
+    CHECK(memaccess.type == QBDI::MEMORY_READ);
+    if (brange.contains(memaccess.accessAddress)) {
+      size_t offset = memaccess.accessAddress - brange.start();
+      if ((QBDI::rword)((uint8_t *)info->buffer)[offset] == memaccess.value) {
+        info->i += offset;
+      }
+    }
+  }
+  return QBDI::VMAction::CONTINUE;
+}
+
 QBDI::VMAction checkUnrolledWriteBB(QBDI::VMInstanceRef vm,
                                     const QBDI::VMState *vmState,
                                     QBDI::GPRState *gprState,
@@ -474,6 +516,45 @@ TEST_CASE_METHOD(APITest, "MemoryAccessTest-Read32") {
   REQUIRE(OFFSET_SUM(buffer_size) == info.i);
 }
 
+static QBDI::VMAction checkAccessBuffer(QBDI::VMInstanceRef vm,
+                                        QBDI::GPRState *gprState,
+                                        QBDI::FPRState *fprState, void *data) {
+  std::vector<QBDI::MemoryAccess> expected = vm->getInstMemoryAccess();
+  QBDI::MemoryAccess buffer[4];
+  // without capacity, only the number of accesses is returned
+  REQUIRE(vm->getInstMemoryAccess(nullptr, 0) == expected.size());
+  size_t size = vm->getInstMemoryAccess(buffer, 4);
+  REQUIRE(size == expected.size());
+  for (size_t i = 0; i < size and i < 4; i++) {
+    CHECK(buffer[i].instAddress == expected[i].instAddress);
+    CHECK(buffer[i].accessAddress == expected[i].accessAddress);
+    CHECK(buffer[i].value == expected[i].value);
+    CHECK(buffer[i].size == expected[i].size);
+    CHECK(buffer[i].type == expected[i].type);
+  }
+  *static_cast<size_t *>(data) += size;
+  return QBDI::VMAction::CONTINUE;
+}
+
+TEST_CASE_METHOD(APITest, "MemoryAccessTest-Read32-Buffer") {
+  uint32_t buffer[] = {3531902336, 1974345459, 1037124602, 2572792182,
+                       3451121073, 4105092976, 2050515100, 2786945221,
+                       1496976643, 515521533};
+  size_t buffer_size = sizeof(buffer) / sizeof(uint32_t);
+  size_t count = 0;
+
+  vm.addMemAccessCB(QBDI::MEMORY_READ, checkAccessBuffer, &count);
+
+  QBDI::simulateCall(state, FAKE_RET_ADDR,
+                     {(QBDI::rword)buffer, (QBDI::rword)buffer_size});
+  bool ran = vm.run((QBDI::rword)arrayRead32, (QBDI::rword)FAKE_RET_ADDR);
+
+  REQUIRE(true == ran);
+  QBDI::rword ret = QBDI_GPR_GET(state, QBDI::REG_RETURN);
+  REQUIRE(ret == (QBDI::rword)arrayRead32(buffer, buffer_size));
+  REQUIRE(count >= buffer_size);
+}
+
 TEST_CASE_METHOD(APITest, "MemoryAccessTest-Write8") {
   const size_t buffer_size = 10;
   uint8_t buffer[buffer_size];
@@ -525,6 +606,60 @@ TEST_CASE_METHOD(APITest, "MemoryAccessTest-Write32") {
   REQUIRE(OFFSET_SUM(buffer_size) == info.i);
 }
 
+TEST_CASE_METHOD(APITest, "MemoryAccessTest-AddressOnly") {
+  uint32_t buffer[] = {3531902336, 1974345459, 1037124602, 2572792182,
+                       3451121073, 4105092976, 2050515100, 2786945221,
+                       1496976643, 515521533};
+  size_t buffer_size = sizeof(buffer) / sizeof(uint32_t);
+  size_t nbAccess = 0, nbValue = 0;
+
+  vm.addMemAccessCB(
+      QBDI::MEMORY_READ | QBDI::MEMORY_ADDRESS_ONLY,
+      [&](QBDI::VMInstanceRef vm, QBDI::GPRState *, QBDI::FPRState *) {
+        for (const QBDI::MemoryAccess &m : vm->getInstMemoryAccess()) {
+          if (m.accessAddress < (QBDI::rword)buffer or
+              m.accessAddress >= (QBDI::rword)(buffer + buffer_size)) {
+            continue;
+          }
+          CHECK(m.size == sizeof(uint32_t));
+          nbAccess++;
+          if ((m.flags & QBDI::MEMORY_UNKNOWN_VALUE) == 0) {
+            size_t offset =
+                (m.accessAddress - (QBDI::rword)buffer) / sizeof(uint32_t);
+            CHECK(m.value == buffer[offset]);
+            nbValue++;
+          }
+        }
+        return QBDI::VMAction::CONTINUE;
+      });
+
+  QBDI::rword retval;
+  vm.call(&retval, (QBDI::rword)arrayRead32,
+          {(QBDI::rword)buffer, (QBDI::rword)buffer_size});
+  REQUIRE(retval == (QBDI::rword)arrayRead32(buffer, buffer_size));
+  REQUIRE(nbAccess == buffer_size);
+  REQUIRE(nbValue == 0);
+
+  // a recording with the values replaces the address only one
+  nbAccess = 0;
+  REQUIRE(vm.recordMemoryAccess(QBDI::MEMORY_READ));
+  vm.call(&retval, (QBDI::rword)arrayRead32,
+          {(QBDI::rword)buffer, (QBDI::rword)buffer_size});
+  REQUIRE(retval == (QBDI::rword)arrayRead32(buffer, buffer_size));
+  REQUIRE(nbAccess == buffer_size);
+  REQUIRE(nbValue == buffer_size);
+
+  // the values stay captured
+  nbAccess = 0;
+  nbValue = 0;
+  REQUIRE(vm.recordMemoryAccess(QBDI::MEMORY_READ |
+                                QBDI::MEMORY_ADDRESS_ONLY));
+  vm.call(&retval, (QBDI::rword)arrayRead32,
+          {(QBDI::rword)buffer, (QBDI::rword)buffer_size});
+  REQUIRE(nbAccess == buffer_size);
+  REQUIRE(nbValue == buffer_size);
+}
+
 TEST_CASE_METHOD(APITest, "MemoryAccessTest-BasicBlockRead") {
   char buffer[] = "p0p30fd0p3";
   size_t buffer_size = sizeof(buffer) / sizeof(char);
@@ -589,6 +724,42 @@ TEST_CASE_METHOD(APITest, "MemoryAccessTest-BasicBlockWrite") {
   REQUIRE(infoInst.i == infoBB.i);
 }
 
+TEST_CASE_METHOD(APITest, "MemoryAccessTest-BasicBlockBatch") {
+  char buffer[] = "p0p30fd0p3";
+  size_t buffer_size = sizeof(buffer) / sizeof(char);
+  TestInfo infoBB = {(void *)buffer, sizeof(buffer), 0};
+
+  uint32_t id =
+      vm.addBBMemAccessCB(QBDI::MEMORY_READ, checkUnrolledReadBatch, &infoBB);
+  REQUIRE(id != QBDI::INVALID_EVENTID);
+
+  QBDI::simulateCall(state, FAKE_RET_ADDR, {(QBDI::rword)buffer});
+  bool ran = vm.run((QBDI::rword)unrolledRead, (QBDI::rword)FAKE_RET_ADDR);
+
+  REQUIRE(true == ran);
+  QBDI::rword ret = QBDI_GPR_GET(state, QBDI::REG_RETURN);
+  REQUIRE(ret == (QBDI::rword)unrolledRead(buffer));
+  REQUIRE(OFFSET_SUM(buffer_size) == infoBB.i);
+
+  infoBB.i = 0;
+
+  QBDI::simulateCall(state, FAKE_RET_ADDR, {(QBDI::rword)buffer, buffer_size});
+  ran = vm.run((QBDI::rword)unrolledReadLoop, (QBDI::rword)FAKE_RET_ADDR);
+
+  REQUIRE(true == ran);
+  ret = QBDI_GPR_GET(state, QBDI::REG_RETURN);
+  REQUIRE(ret == (QBDI::rword)unrolledReadLoop(buffer, buffer_size));
+  REQUIRE(OFFSET_SUM(buffer_size) == infoBB.i);
+
+  infoBB.i = 0;
+  REQUIRE(vm.deleteInstrumentation(id));
+
+  QBDI::simulateCall(state, FAKE_RET_ADDR, {(QBDI::rword)buffer});
+  ran = vm.run((QBDI::rword)unrolledRead, (QBDI::rword)FAKE_RET_ADDR);
+  REQUIRE(true == ran);
+  REQUIRE(infoBB.i == 0);
+}
+
 TEST_CASE_METHOD(APITest, "MemoryAccessTest-ReadRange") {
   uint32_t buffer[] = {3531902336, 1974345459, 1037124602, 2572792182,
                        3451121073, 4105092976, 2050515100, 2786945221,
@@ -658,6 +829,57 @@ TEST_CASE_METHOD(APITest, "MemoryAccessTest-ReadWriteRange") {
   REQUIRE(OFFSET_SUM(buffer_size) == info.i);
 }
 
+static QBDI::VMAction countMemCB(QBDI::VMInstanceRef vm,
+                                 QBDI::GPRState *gprState,
+                                 QBDI::FPRState *fprState, void *data) {
+  *static_cast<unsigned *>(data) += 1;
+  return QBDI::VMAction::CONTINUE;
+}
+
+TEST_CASE_METHOD(APITest, "MemoryAccessTest-SeveralRanges") {
+  uint32_t buffer[] = {3531902336, 1974345459, 1037124602, 2572792182,
+                       3451121073, 4105092976, 2050515100, 2786945221,
+                       1496976643, 515521533};
+  const size_t buffer_size = sizeof(buffer) / sizeof(uint32_t);
+  unsigned countAll = 0;
+  unsigned countRW = 0;
+  unsigned counts[buffer_size] = {0};
+
+  // overlapping ranges, registered in any order
+  uint32_t all =
+      vm.addMemRangeCB((QBDI::rword)buffer, (QBDI::rword)(buffer + buffer_size),
+                       QBDI::MEMORY_READ, countMemCB, &countAll);
+  REQUIRE(all != QBDI::INVALID_EVENTID);
+  for (size_t i = buffer_size; i > 0; i--) {
+    vm.addMemRangeCB((QBDI::rword)&buffer[i - 1], (QBDI::rword)&buffer[i],
+                     QBDI::MEMORY_READ, countMemCB, &counts[i - 1]);
+  }
+  vm.addMemAddrCB((QBDI::rword)&buffer[3], QBDI::MEMORY_READ_WRITE, countMemCB,
+                  &countRW);
+
+  QBDI::simulateCall(state, FAKE_RET_ADDR,
+                     {(QBDI::rword)buffer, (QBDI::rword)buffer_size});
+  bool ran = vm.run((QBDI::rword)arrayRead32, (QBDI::rword)FAKE_RET_ADDR);
+  REQUIRE(true == ran);
+  REQUIRE(countAll == buffer_size);
+  REQUIRE(countRW == 1);
+  for (size_t i = 0; i < buffer_size; i++) {
+    REQUIRE(counts[i] == 1);
+  }
+
+  // the other ranges are still reached once a range is removed
+  REQUIRE(vm.deleteInstrumentation(all));
+  QBDI::simulateCall(state, FAKE_RET_ADDR,
+                     {(QBDI::rword)buffer, (QBDI::rword)buffer_size});
+  ran = vm.run((QBDI::rword)arrayRead32, (QBDI::rword)FAKE_RET_ADDR);
+  REQUIRE(true == ran);
+  REQUIRE(countAll == buffer_size);
+  REQUIRE(countRW == 2);
+  for (size_t i = 0; i < buffer_size; i++) {
+    REQUIRE(counts[i] == 2);
+  }
+}
+
 TEST_CASE_METHOD(APITest, "MemoryAccessTest-MemorySnooping") {
   uint32_t a = 10, b = 42, c = 1337;
   QBDI::rword original = mad(&a, &b, &c);
@@ -977,4 +1199,383 @@ TEST_CASE_METHOD(APITest, "MemoryAccessTest-InstCbLambda-addMemRangeCB") {
   SUCCEED();
 }
 
+struct TraceInfo {
+  std::vector<QBDI::MemoryTraceEntry> entries;
+  size_t nbFlush;
+};
+
+static QBDI::VMAction collectTrace(QBDI::VMInstanceRef vm,
+                                   const QBDI::MemoryTraceEntry *entries,
+                                   size_t count, void *data) {
+  TraceInfo *info = static_cast<TraceInfo *>(data);
+  info->entries.insert(info->entries.end(), entries, entries + count);
+  info->nbFlush++;
+  return QBDI::VMAction::CONTINUE;
+}
+
+TEST_CASE_METHOD(APITest, "MemoryAccessTest-MemoryTrace") {
+  uint32_t buffer[] = {3531902336, 1974345459, 1037124602, 2572792182,
+                       3451121073, 4105092976, 2050515100, 2786945221,
+                       1496976643, 515521533,  3531902336, 1974345459,
+                       1037124602, 2572792182, 3451121073, 4105092976,
+                       2050515100, 2786945221, 1496976643, 515521533};
+  size_t buffer_size = sizeof(buffer) / sizeof(uint32_t);
+  TraceInfo trace = {{}, 0};
+  std::vector<QBDI::MemoryAccess> expected;
+
+  REQUIRE(vm.setMemoryTrace(QBDI::MEMORY_READ_WRITE, collectTrace, &trace, 16));
+  REQUIRE(vm.recordMemoryAccess(QBDI::MEMORY_READ_WRITE));
+  vm.addCodeCB(
+      QBDI::POSTINST,
+      [&expected](QBDI::VMInstanceRef vm, QBDI::GPRState *, QBDI::FPRState *) {
+        for (const QBDI::MemoryAccess &m : vm->getInstMemoryAccess()) {
+          expected.push_back(m);
+        }
+        return QBDI::VMAction::CONTINUE;
+      });
+
+  QBDI::rword retval;
+  vm.call(&retval, (QBDI::rword)arrayRead32,
+          {(QBDI::rword)buffer, (QBDI::rword)buffer_size});
+  REQUIRE(retval == (QBDI::rword)arrayRead32(buffer, buffer_size));
+
+  // the buffer is flushed when full and at the end of the run
+  REQUIRE(trace.nbFlush > 1);
+  REQUIRE(trace.entries.size() == expected.size());
+  size_t sum = 0;
+  for (size_t i = 0; i < expected.size(); i++) {
+    const QBDI::MemoryTraceEntry &e = trace.entries[i];
+    const QBDI::MemoryAccess &m = expected[i];
+    CHECK(e.instAddress == m.instAddress);
+    CHECK(e.accessAddress == m.accessAddress);
+    CHECK(e.size == m.size);
+    CHECK(e.type == m.type);
+    if (((e.flags | m.flags) & QBDI::MEMORY_UNKNOWN_VALUE) == 0) {
+      CHECK(e.value == m.value);
+    }
+    if (e.type == QBDI::MEMORY_READ and e.size == sizeof(uint32_t) and
+        e.accessAddress >= (QBDI::rword)buffer and
+        e.accessAddress < (QBDI::rword)(buffer + buffer_size)) {
+      size_t offset =
+          (e.accessAddress - (QBDI::rword)buffer) / sizeof(uint32_t);
+      if (e.value == buffer[offset]) {
+        sum += offset;
+      }
+    }
+  }
+  REQUIRE(OFFSET_SUM(buffer_size) == sum);
+
+  // disable the trace
+  REQUIRE(vm.setMemoryTrace(QBDI::MEMORY_READ_WRITE, nullptr, nullptr));
+  trace.entries.clear();
+  trace.nbFlush = 0;
+  vm.call(&retval, (QBDI::rword)arrayRead32,
+          {(QBDI::rword)buffer, (QBDI::rword)buffer_size});
+  REQUIRE(retval == (QBDI::rword)arrayRead32(buffer, buffer_size));
+  REQUIRE(trace.nbFlush == 0);
+  REQUIRE(trace.entries.empty());
+}
+
+TEST_CASE_METHOD(APITest, "MemoryAccessTest-TraceWriter") {
+  uint32_t buffer[] = {3531902336, 1974345459, 1037124602, 2572792182,
+                       3451121073, 4105092976, 2050515100, 2786945221,
+                       1496976643, 515521533};
+  size_t buffer_size = sizeof(buffer) / sizeof(uint32_t);
+  const char *path = "QBDITest-TraceWriter.trace";
+  std::vector<std::pair<QBDI::rword, QBDI::rword>> sequences;
+  std::vector<QBDI::MemoryAccess> expected;
+
+  QBDI::TraceWriter writer(path, 16);
+  REQUIRE(writer.isOpen());
+  REQUIRE(writer.attach(vm, QBDI::MEMORY_READ) !=
+          QBDI::VMError::INVALID_EVENTID);
+  REQUIRE(vm.recordMemoryAccess(QBDI::MEMORY_READ));
+  vm.addVMEventCB(QBDI::SEQUENCE_ENTRY,
+                  [&sequences](QBDI::VMInstanceRef vm,
+                               const QBDI::VMState *vmState, QBDI::GPRState *,
+                               QBDI::FPRState *) {
+                    sequences.emplace_back(vmState->sequenceStart,
+                                           vmState->sequenceEnd);
+                    return QBDI::VMAction::CONTINUE;
+                  });
+  vm.addCodeCB(
+      QBDI::POSTINST,
+      [&expected](QBDI::VMInstanceRef vm, QBDI::GPRState *, QBDI::FPRState *) {
+        for (const QBDI::MemoryAccess &m : vm->getInstMemoryAccess()) {
+          expected.push_back(m);
+        }
+        return QBDI::VMAction::CONTINUE;
+      });
+
+  QBDI::rword retval;
+  vm.call(&retval, (QBDI::rword)arrayRead32,
+          {(QBDI::rword)buffer, (QBDI::rword)buffer_size});
+  REQUIRE(retval == (QBDI::rword)arrayRead32(buffer, buffer_size));
+  uint8_t bitmap[] = {0, 3, 0, 0, 1};
+  writer.addCoverage(bitmap, sizeof(bitmap));
+  writer.flush();
+
+  QBDI::TraceReader reader(path);
+  REQUIRE(reader.isOpen());
+  QBDI::TraceRecord record;
+  std::map<uint32_t, std::pair<QBDI::rword, QBDI::rword>> blocks;
+  size_t nbSequence = 0, nbMemory = 0, nbCoverage = 0;
+  while (reader.next(record)) {
+    if (record.type == QBDI::TRACE_SEQUENCE) {
+      REQUIRE(nbSequence < sequences.size());
+      CHECK(record.start == sequences[nbSequence].first);
+      CHECK(record.end == sequences[nbSequence].second);
+      // an identifier always names the same sequence
+      auto it = blocks.emplace(record.blockID,
+                               std::make_pair(record.start, record.end));
+      CHECK(it.first->second == sequences[nbSequence]);
+      nbSequence++;
+    } else if (record.type == QBDI::TRACE_MEMORY) {
+      REQUIRE(nbMemory < expected.size());
+      const QBDI::MemoryAccess &m = expected[nbMemory];
+      CHECK(record.access.instAddress == m.instAddress);
+      CHECK(record.access.accessAddress == m.accessAddress);
+      CHECK(record.access.size == m.size);
+      CHECK(record.access.type == m.type);
+      nbMemory++;
+    } else {
+      REQUIRE(record.type == QBDI::TRACE_COVERAGE);
+      CHECK(bitmap[record.start] == record.end);
+      nbCoverage++;
+    }
+  }
+  CHECK(nbSequence == sequences.size());
+  CHECK(nbMemory == expected.size());
+  CHECK(nbCoverage == 2);
+  // the loop reuses its sequences
+  CHECK(blocks.size() < sequences.size());
+
+  REQUIRE(vm.setMemoryTrace(QBDI::MEMORY_READ, nullptr, nullptr));
+  vm.deleteAllInstrumentations();
+  remove(path);
+}
+
+static long traceSize(const char *path) {
+  FILE *file = fopen(path, "rb");
+  if (file == nullptr) {
+    return -1;
+  }
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  fclose(file);
+  return size;
+}
+
+TEST_CASE_METHOD(APITest, "MemoryAccessTest-TraceWriterCompressed") {
+  uint32_t buffer[64];
+  size_t buffer_size = sizeof(buffer) / sizeof(uint32_t);
+  for (size_t i = 0; i < buffer_size; i++) {
+    buffer[i] = static_cast<uint32_t>(i * 2654435761u);
+  }
+  const char *path = "QBDITest-TraceWriterCompressed.trace";
+  const char *fullPath = "QBDITest-TraceWriterFull.trace";
+  std::vector<std::pair<QBDI::rword, QBDI::rword>> sequences;
+
+  QBDI::TraceWriter writer(path, 16);
+  QBDI::TraceWriter fullWriter(fullPath, 16);
+  REQUIRE(writer.isOpen());
+  REQUIRE(fullWriter.isOpen());
+  writer.setCompressedControlFlow(true);
+  REQUIRE(writer.attach(vm, static_cast<QBDI::MemoryAccessType>(0)) !=
+          QBDI::VMError::INVALID_EVENTID);
+  REQUIRE(fullWriter.attach(vm, static_cast<QBDI::MemoryAccessType>(0)) !=
+          QBDI::VMError::INVALID_EVENTID);
+  vm.addVMEventCB(QBDI::SEQUENCE_ENTRY,
+                  [&sequences](QBDI::VMInstanceRef vm,
+                               const QBDI::VMState *vmState, QBDI::GPRState *,
+                               QBDI::FPRState *) {
+                    sequences.emplace_back(vmState->sequenceStart,
+                                           vmState->sequenceEnd);
+                    return QBDI::VMAction::CONTINUE;
+                  });
+
+  QBDI::rword retval;
+  for (int i = 0; i < 4; i++) {
+    vm.call(&retval, (QBDI::rword)arrayRead32,
+            {(QBDI::rword)buffer, (QBDI::rword)buffer_size});
+    REQUIRE(retval == (QBDI::rword)arrayRead32(buffer, buffer_size));
+  }
+  writer.flush();
+  fullWriter.flush();
+
+  // the path is rebuilt from the bits without the code
+  QBDI::TraceReader reader(path);
+  REQUIRE(reader.isOpen());
+  QBDI::TraceRecord record;
+  size_t nbSequence = 0;
+  while (reader.next(record)) {
+    REQUIRE(record.type == QBDI::TRACE_SEQUENCE);
+    REQUIRE(nbSequence < sequences.size());
+    CHECK(record.start == sequences[nbSequence].first);
+    CHECK(record.end == sequences[nbSequence].second);
+    nbSequence++;
+  }
+  CHECK(nbSequence == sequences.size());
+  CHECK(traceSize(path) * 4 < traceSize(fullPath));
+
+  vm.deleteAllInstrumentations();
+  remove(path);
+  remove(fullPath);
+}
+
+TEST_CASE_METHOD(APITest, "MemoryAccessTest-RecordRange") {
+  QBDI::rword retval;
+  uint32_t buffer32[] = {3531902336, 1974345459, 1037124602, 2572792182,
+                         3451121073, 4105092976, 2050515100, 2786945221,
+                         1496976643, 515521533};
+  uint16_t buffer16[] = {4310, 13625, 45639, 7908, 28990,
+                         59440, 20818, 3579, 64184, 20790};
+  const size_t buffer_size = 10;
+  QBDI::RangeSet<QBDI::rword> code;
+
+  // collect the instructions of arrayRead32
+  uint32_t id = vm.addCodeCB(
+      QBDI::PREINST, [&code](QBDI::VMInstanceRef vm, QBDI::GPRState *gpr,
+                             QBDI::FPRState *fpr) {
+        const QBDI::InstAnalysis *ana =
+            vm->getInstAnalysis(QBDI::ANALYSIS_INSTRUCTION);
+        code.add({ana->address, ana->address + ana->instSize});
+        return QBDI::VMAction::CONTINUE;
+      });
+  REQUIRE(vm.call(&retval, (QBDI::rword)arrayRead32,
+                  {(QBDI::rword)buffer32, (QBDI::rword)buffer_size}));
+  REQUIRE(vm.deleteInstrumentation(id));
+  REQUIRE(vm.recordMemoryAccessRangeSet(code, QBDI::MEMORY_READ));
+
+  size_t count32 = 0;
+  size_t countOther = 0;
+  QBDI::VMCbLambda countReads = [&](QBDI::VMInstanceRef vm,
+                                    const QBDI::VMState *state,
+                                    QBDI::GPRState *gpr, QBDI::FPRState *fpr) {
+    for (const QBDI::MemoryAccess &m : vm->getBBMemoryAccess()) {
+      if (m.accessAddress >= (QBDI::rword)buffer32 and
+          m.accessAddress < (QBDI::rword)(buffer32 + buffer_size)) {
+        count32++;
+      } else {
+        countOther++;
+      }
+    }
+    return QBDI::VMAction::CONTINUE;
+  };
+  vm.addVMEventCB(QBDI::VMEvent::SEQUENCE_EXIT, countReads);
+
+  REQUIRE(vm.call(&retval, (QBDI::rword)arrayRead32,
+                  {(QBDI::rword)buffer32, (QBDI::rword)buffer_size}));
+  REQUIRE(retval == (QBDI::rword)arrayRead32(buffer32, buffer_size));
+  REQUIRE(count32 == buffer_size);
+
+  // the instructions of arrayRead16 don't record their accesses
+  countOther = 0;
+  REQUIRE(vm.call(&retval, (QBDI::rword)arrayRead16,
+                  {(QBDI::rword)buffer16, (QBDI::rword)buffer_size}));
+  REQUIRE(retval == (QBDI::rword)arrayRead16(buffer16, buffer_size));
+  REQUIRE(countOther == 0);
+
+  // the range rules are dropped when the reads are recorded everywhere
+  count32 = 0;
+  countOther = 0;
+  REQUIRE(vm.recordMemoryAccess(QBDI::MEMORY_READ));
+  REQUIRE(vm.call(&retval, (QBDI::rword)arrayRead32,
+                  {(QBDI::rword)buffer32, (QBDI::rword)buffer_size}));
+  REQUIRE(count32 == buffer_size);
+  REQUIRE(vm.call(&retval, (QBDI::rword)arrayRead16,
+                  {(QBDI::rword)buffer16, (QBDI::rword)buffer_size}));
+  REQUIRE(countOther >= buffer_size);
+}
+
+TEST_CASE_METHOD(APITest, "MemoryAccessTest-PageWatch") {
+  const size_t page_size = 4096;
+  const size_t buffer_size = 16;
+  // the watched buffer has its own page
+  uint32_t *buffer =
+      static_cast<uint32_t *>(QBDI::alignedAlloc(page_size, page_size));
+  for (size_t i = 0; i < buffer_size; i++) {
+    buffer[i] = i * 7;
+  }
+  unsigned count = 0;
+
+  vm.setOptions(vm.getOptions() |
+                QBDI::Options::OPT_ENABLE_MEMCB_PAGE_WATCH);
+  uint32_t id =
+      vm.addMemRangeCB((QBDI::rword)buffer, (QBDI::rword)(buffer + buffer_size),
+                       QBDI::MEMORY_READ, countMemCB, &count);
+  REQUIRE(id != QBDI::INVALID_EVENTID);
+
+  // the first execution promotes the sequences which read the buffer
+  QBDI::rword retval;
+  REQUIRE(vm.call(&retval, (QBDI::rword)arrayRead32,
+                  {(QBDI::rword)buffer, (QBDI::rword)buffer_size}));
+  REQUIRE(count <= buffer_size);
+
+  count = 0;
+  REQUIRE(vm.call(&retval, (QBDI::rword)arrayRead32,
+                  {(QBDI::rword)buffer, (QBDI::rword)buffer_size}));
+  // the native accesses to a watched page are restarted
+  REQUIRE(retval == (QBDI::rword)arrayRead32(buffer, buffer_size));
+  REQUIRE(count == buffer_size);
+
+  count = 0;
+  REQUIRE(vm.deleteInstrumentation(id));
+  REQUIRE(vm.call(&retval, (QBDI::rword)arrayRead32,
+                  {(QBDI::rword)buffer, (QBDI::rword)buffer_size}));
+  REQUIRE(count == 0);
+
+  QBDI::alignedFree(buffer);
+}
+
+TEST_CASE_METHOD(APITest, "MemoryAccessTest-SharedInstMemoryAccess") {
+  const size_t buffer_size = 16;
+  uint32_t buffer[buffer_size];
+  for (size_t i = 0; i < buffer_size; i++) {
+    buffer[i] = i * 3;
+  }
+  std::vector<QBDI::MemoryAccess> first;
+  std::vector<QBDI::rword> addresses;
+  bool same = true;
+
+  // the callbacks of an instruction see the same accesses, decoded once for
+  // each execution of the instruction
+  uint32_t id1 = vm.addMemAccessCB(
+      QBDI::MEMORY_READ,
+      [&first](QBDI::VMInstanceRef vm, QBDI::GPRState *, QBDI::FPRState *) {
+        first = vm->getInstMemoryAccess();
+        return QBDI::VMAction::CONTINUE;
+      },
+      10);
+  uint32_t id2 = vm.addMemAccessCB(
+      QBDI::MEMORY_READ,
+      [&](QBDI::VMInstanceRef vm, QBDI::GPRState *, QBDI::FPRState *) {
+        QBDI::MemoryAccess accesses[8];
+        size_t nb = vm->getInstMemoryAccess(accesses, 8);
+        same &= (nb == first.size());
+        for (size_t i = 0; i < nb and i < first.size(); i++) {
+          same &= (accesses[i].accessAddress == first[i].accessAddress and
+                   accesses[i].value == first[i].value);
+          if (accesses[i].accessAddress >= (QBDI::rword)buffer and
+              accesses[i].accessAddress < (QBDI::rword)(buffer + buffer_size)) {
+            addresses.push_back(accesses[i].accessAddress);
+          }
+        }
+        return QBDI::VMAction::CONTINUE;
+      },
+      0);
+  REQUIRE(id1 != QBDI::INVALID_EVENTID);
+  REQUIRE(id2 != QBDI::INVALID_EVENTID);
+
+  QBDI::rword retval;
+  REQUIRE(vm.call(&retval, (QBDI::rword)arrayRead32,
+                  {(QBDI::rword)buffer, (QBDI::rword)buffer_size}));
+  REQUIRE(retval == (QBDI::rword)arrayRead32(buffer, buffer_size));
+  CHECK(same);
+  REQUIRE(addresses.size() == buffer_size);
+  for (size_t i = 0; i < buffer_size; i++) {
+    CHECK(addresses[i] == (QBDI::rword)(buffer + i));
+  }
+}
+
 #endif
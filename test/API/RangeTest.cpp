@@ -154,3 +154,97 @@ TEST_CASE("Range-IntersectionAndOverlaps") {
     testRanges.push_back(newRange);
   }
 }
+
+TEST_CASE("Range-RangeSetOverlaps") {
+  QBDI::RangeSet<int> rangeSet;
+  rangeSet.add(QBDI::Range<int>(0, 10));
+  rangeSet.add(QBDI::Range<int>(100, 200));
+
+  CHECK(rangeSet.overlaps(QBDI::Range<int>(5, 15)));
+  CHECK(rangeSet.overlaps(QBDI::Range<int>(150, 151)));
+  CHECK(rangeSet.overlaps(QBDI::Range<int>(50, 101)));
+  CHECK(rangeSet.overlaps(QBDI::Range<int>(199, 300)));
+  CHECK_FALSE(rangeSet.overlaps(QBDI::Range<int>(10, 100)));
+  CHECK_FALSE(rangeSet.overlaps(QBDI::Range<int>(200, 300)));
+}
+
+TEST_CASE("Range-RangeSetLookup") {
+  QBDI::RangeSet<int> rangeSet;
+  std::vector<bool> covered(1100, false);
+  for (int i = 0; i < 100; i++) {
+    int start = (i * 37) % 1000;
+    int end = start + i % 15;
+    if (i % 4 == 3) {
+      rangeSet.remove(QBDI::Range<int>(start, end));
+    } else {
+      rangeSet.add(QBDI::Range<int>(start, end));
+    }
+    for (int j = start; j < end; j++) {
+      covered[j] = (i % 4 != 3);
+    }
+  }
+
+  for (int i = 0; i < 1050; i++) {
+    REQUIRE(rangeSet.contains(i) == covered[i]);
+    for (int size = 1; size < 8; size++) {
+      bool all = true;
+      bool any = false;
+      for (int j = i; j < i + size; j++) {
+        all = all and covered[j];
+        any = any or covered[j];
+      }
+      REQUIRE(rangeSet.contains(QBDI::Range<int>(i, i + size)) == all);
+      REQUIRE(rangeSet.overlaps(QBDI::Range<int>(i, i + size)) == any);
+    }
+  }
+}
+
+TEST_CASE("Range-RangeSetBulk") {
+  static const int N = 200;
+  std::vector<QBDI::Range<int>> testRanges;
+  std::vector<QBDI::Range<int>> removedRanges;
+  // adjacent and empty ranges are part of the inputs
+  for (int i = 0; i < N; i++) {
+    int start = rand() % 5000;
+    testRanges.emplace_back(start, start + rand() % 50);
+    start = rand() % 5000;
+    removedRanges.emplace_back(start, start + rand() % 50);
+  }
+
+  QBDI::RangeSet<int> expected;
+  QBDI::RangeSet<int> removed;
+  for (const QBDI::Range<int> &r : testRanges) {
+    expected.add(r);
+  }
+  for (const QBDI::Range<int> &r : removedRanges) {
+    removed.add(r);
+  }
+
+  // unsorted and sorted inputs, on an existing set
+  QBDI::RangeSet<int> bulk;
+  bulk.addAll(testRanges);
+  REQUIRE(bulk == expected);
+  std::sort(testRanges.begin(), testRanges.end(),
+            [](const QBDI::Range<int> &a, const QBDI::Range<int> &b) {
+              return a.start() < b.start();
+            });
+  bulk.addAll(testRanges);
+  REQUIRE(bulk == expected);
+  QBDI::RangeSet<int> merged = removed;
+  merged.add(expected);
+  for (int i = 0; i < 5100; i++) {
+    REQUIRE(merged.contains(i) ==
+            (expected.contains(i) or removed.contains(i)));
+  }
+
+  QBDI::RangeSet<int> difference = expected;
+  difference.remove(removed);
+  for (const QBDI::Range<int> &r : removedRanges) {
+    expected.remove(r);
+  }
+  REQUIRE(difference == expected);
+
+  QBDI::RangeSet<int> intersection = merged;
+  intersection.intersect(removed);
+  REQUIRE(intersection == removed);
+}
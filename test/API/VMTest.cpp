@@ -16,15 +16,24 @@
  * limitations under the License.
  */
 #include <algorithm>
+#include <atomic>
+#include <map>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
 #include <catch2/catch.hpp>
 #include "APITest.h"
 
 #include "inttypes.h"
 
+#include "QBDI/AnalysisExport.h"
+#include "QBDI/Memory.h"
 #include "QBDI/Memory.hpp"
+#include "QBDI/Observer.h"
 #include "QBDI/Platform.h"
 #include "Utility/LogSys.h"
 #include "Utility/String.h"
+#include "Utility/System.h"
 
 #if defined(QBDI_ARCH_X86)
 #include "X86/VMTest_X86.h"
@@ -142,6 +151,495 @@ TEST_CASE_METHOD(APITest, "VMTest-Call8") {
   SUCCEED();
 }
 
+TEST_CASE_METHOD(APITest, "VMTest-PrepareCall") {
+  QBDI::PreparedCall call = vm.prepareCall((QBDI::rword)dummyFun4, 4);
+  REQUIRE(call.getArgNum() == 4);
+
+  QBDI::rword ret = 0;
+  REQUIRE(call.invoke(&ret, {0, 2, 3, 5}));
+  QBDI::rword sp = QBDI_GPR_GET(state, QBDI::REG_SP);
+  for (QBDI::rword i = 1; i < 10; i++) {
+    REQUIRE(call.invoke(&ret, {i, 2, 3, 5}));
+    REQUIRE(ret == (QBDI::rword)dummyFun4(i, 2, 3, 5));
+  }
+  // the frames of the calls don't drift down the stack
+  QBDI::rword args[] = {1, 2, 3, 5};
+  REQUIRE(call.invoke(&ret, args));
+  REQUIRE(ret == (QBDI::rword)dummyFun4(1, 2, 3, 5));
+  REQUIRE(QBDI_GPR_GET(state, QBDI::REG_SP) == sp);
+
+  // no translation after the first call
+  QBDI::rword flushCount = vm.getCacheStats().flushCount;
+  QBDI::rword translated = vm.getCacheStats().translatedSize;
+  REQUIRE(call.invoke(&ret, {8, 13, 21, 34}));
+  REQUIRE(ret == (QBDI::rword)dummyFun4(8, 13, 21, 34));
+  REQUIRE(vm.getCacheStats().flushCount == flushCount);
+  REQUIRE(vm.getCacheStats().translatedSize == translated);
+
+  SUCCEED();
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-CacheStats") {
+  QBDI::CacheStats stats = vm.getCacheStats();
+  REQUIRE(stats.regionCount == 0);
+  REQUIRE(stats.execBlockCount == 0);
+  REQUIRE(stats.codeSize == 0);
+
+  QBDI::rword retval;
+  REQUIRE(vm.call(&retval, (QBDI::rword)dummyFun5, {1, 2, 3, 5, 8}));
+  stats = vm.getCacheStats();
+  REQUIRE(stats.regionCount > 0);
+  REQUIRE(stats.execBlockCount > 0);
+  REQUIRE(stats.sequenceCount > 0);
+  REQUIRE(stats.codeSize > 0);
+  REQUIRE(stats.dataSize > 0);
+  REQUIRE(stats.usedCodeSize > 0);
+  REQUIRE(stats.usedCodeSize <= stats.codeSize);
+  REQUIRE(stats.shadowSize > 0);
+  REQUIRE(stats.usedShadowSize <= stats.shadowSize);
+  REQUIRE(stats.translatedSize > 0);
+  REQUIRE(stats.translationSize > 0);
+  REQUIRE(stats.cacheMisses > 0);
+
+  // the second call only uses the cache
+  QBDI::CacheStats stats2;
+  REQUIRE(vm.call(&retval, (QBDI::rword)dummyFun5, {1, 2, 3, 5, 8}));
+  stats2 = vm.getCacheStats();
+  REQUIRE(stats2.execBlockCount == stats.execBlockCount);
+  REQUIRE(stats2.translatedSize == stats.translatedSize);
+  REQUIRE(stats2.cacheHits > stats.cacheHits);
+
+  vm.clearAllCache();
+  stats2 = vm.getCacheStats();
+  REQUIRE(stats2.regionCount == 0);
+  REQUIRE(stats2.execBlockCount == 0);
+  REQUIRE(stats2.sequenceCount == 0);
+  REQUIRE(stats2.codeSize == 0);
+  REQUIRE(stats2.usedCodeSize == 0);
+  REQUIRE(stats2.usedShadowSize == 0);
+  REQUIRE(stats2.flushCount == stats.flushCount + 1);
+  REQUIRE(stats2.translatedSize == stats.translatedSize);
+
+  SUCCEED();
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-CacheProfile") {
+  QBDI::rword retval;
+  REQUIRE(vm.call(&retval, (QBDI::rword)dummyFun5, {1, 2, 3, 5, 8}));
+  QBDI::CacheStats stats = vm.getCacheStats();
+  REQUIRE(stats.sequenceCount > 0);
+
+  const char *path = "qbdi_cache_profile_test.txt";
+  REQUIRE(vm.saveCacheProfile(path));
+
+  // the profile restores the translation of the run in one go
+  vm.clearAllCache();
+  size_t nb = vm.prewarmCache(path);
+  CHECK(nb > 0);
+  CHECK(nb <= stats.sequenceCount);
+  QBDI::CacheStats stats2 = vm.getCacheStats();
+  CHECK(stats2.execBlockCount > 0);
+
+  QBDI::rword retval2;
+  REQUIRE(vm.call(&retval2, (QBDI::rword)dummyFun5, {1, 2, 3, 5, 8}));
+  CHECK(retval2 == retval);
+  QBDI::CacheStats stats3 = vm.getCacheStats();
+  CHECK(stats3.translatedSize == stats2.translatedSize);
+
+  // the cached sequences are skipped
+  CHECK(vm.prewarmCache(path) == 0);
+  CHECK(vm.prewarmCache("qbdi_cache_profile_missing.txt") == 0);
+  remove(path);
+}
+
+QBDI_DISABLE_ASAN QBDI_NOINLINE QBDI::rword precacheFibonacci(QBDI::rword n) {
+  if (n < 2) {
+    return n;
+  }
+  return precacheFibonacci(n - 1) + precacheFibonacci(n - 2);
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-PrecacheRange") {
+  QBDI::rword start = reinterpret_cast<QBDI::rword>(precacheFibonacci);
+  size_t nb = vm.precacheRange(start, start + 512);
+  CHECK(nb > 0);
+  QBDI::CacheStats stats = vm.getCacheStats();
+  CHECK(stats.execBlockCount > 0);
+
+  // the branches, the recursive calls and their returns are cached
+  QBDI::rword retval;
+  REQUIRE(vm.call(&retval, start, {10}));
+  CHECK(retval == precacheFibonacci(10));
+  QBDI::CacheStats stats2 = vm.getCacheStats();
+  CHECK(stats2.translatedSize == stats.translatedSize);
+
+  CHECK(vm.precacheRange(start, start + 512) == 0);
+  CHECK(vm.precacheModule("qbdi_missing_module.so") == 0);
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-MemoryStats") {
+  QBDI::MemoryStats stats = vm.getMemoryStats();
+  REQUIRE(stats.codeSize == 0);
+  REQUIRE(stats.instCount == 0);
+
+  QBDI::rword retval;
+  REQUIRE(vm.call(&retval, (QBDI::rword)dummyFun5, {1, 2, 3, 5, 8}));
+  stats = vm.getMemoryStats();
+  QBDI::CacheStats cacheStats = vm.getCacheStats();
+  REQUIRE(stats.codeSize == cacheStats.codeSize);
+  REQUIRE(stats.dataSize == cacheStats.dataSize);
+  REQUIRE(stats.metadataSize > 0);
+  REQUIRE(stats.regionMapSize > 0);
+  REQUIRE(stats.instCount > 0);
+  REQUIRE(stats.totalSize == stats.codeSize + stats.dataSize +
+                                 stats.metadataSize + stats.analysisSize +
+                                 stats.regionMapSize + stats.callbackSize);
+
+  vm.clearAllCache();
+  stats = vm.getMemoryStats();
+  REQUIRE(stats.codeSize == 0);
+  REQUIRE(stats.dataSize == 0);
+  REQUIRE(stats.metadataSize == 0);
+  REQUIRE(stats.analysisSize == 0);
+  REQUIRE(stats.instCount == 0);
+
+  SUCCEED();
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-ExecStats") {
+  QBDI::rword retval;
+  // the counters are disabled by default
+  REQUIRE(vm.call(&retval, (QBDI::rword)dummyFun5, {1, 2, 3, 5, 8}));
+  QBDI::ExecStats stats = vm.getExecStats();
+  REQUIRE(stats.dispatchCount == 0);
+  REQUIRE(stats.hostExitCount == 0);
+
+  vm.clearAllCache();
+  vm.setExecStats(true);
+  size_t instCount = 0;
+  QBDI::InstCbLambda instCbk = [&instCount](QBDI::VMInstanceRef,
+                                            QBDI::GPRState *,
+                                            QBDI::FPRState *) {
+    instCount++;
+    return QBDI::CONTINUE;
+  };
+  REQUIRE(vm.addCodeCB(QBDI::PREINST, instCbk) != QBDI::INVALID_EVENTID);
+  REQUIRE(vm.call(&retval, (QBDI::rword)dummyFun5, {1, 2, 3, 5, 8}));
+  stats = vm.getExecStats();
+  REQUIRE(stats.dispatchCount > 0);
+  REQUIRE(stats.cacheMisses > 0);
+  REQUIRE(stats.callbackContinue >= instCount);
+  REQUIRE(stats.callbackBreakToVM == 0);
+  REQUIRE(stats.callbackStop == 0);
+  REQUIRE(stats.sequenceExitCount <= stats.dispatchCount);
+  // each return to the VM ends the sequence or calls a callback
+  REQUIRE(stats.hostExitCount ==
+          stats.sequenceExitCount + stats.callbackContinue +
+              stats.callbackSkipInst + stats.callbackSkipPatch);
+
+  // the second run only uses the cache
+  vm.resetExecStats();
+  REQUIRE(vm.getExecStats().dispatchCount == 0);
+  instCount = 0;
+  REQUIRE(vm.call(&retval, (QBDI::rword)dummyFun5, {1, 2, 3, 5, 8}));
+  stats = vm.getExecStats();
+  REQUIRE(stats.dispatchCount > 0);
+  REQUIRE(stats.cacheMisses == 0);
+  REQUIRE(stats.callbackContinue >= instCount);
+
+  vm.setExecStats(false);
+  REQUIRE(vm.getExecStats().dispatchCount == 0);
+
+  SUCCEED();
+}
+
+QBDI_DISABLE_ASAN QBDI_NOINLINE QBDI::rword demotionLeaf(QBDI::rword v) {
+  return v * 3 + 1;
+}
+
+QBDI_DISABLE_ASAN QBDI_NOINLINE QBDI::rword demotionLoop(QBDI::rword n) {
+  QBDI::rword acc = 0;
+  for (QBDI::rword i = 0; i < n; i++) {
+    acc += demotionLeaf(i);
+  }
+  return acc;
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-AutoDemotion") {
+  QBDI::rword retval;
+  const QBDI::rword leaf = reinterpret_cast<QBDI::rword>(demotionLeaf);
+  const QBDI::rword loop = reinterpret_cast<QBDI::rword>(demotionLoop);
+
+  // the leaf is demoted after 4 calls without instrumentation
+  vm.setAutoDemotion(4);
+  REQUIRE(vm.call(&retval, loop, {16}));
+  REQUIRE(retval == demotionLoop(16));
+  REQUIRE(vm.getDemotedFunctions() == std::vector<QBDI::rword>{leaf});
+
+  // the demoted leaf is executed by the ExecBroker
+  vm.setExecStats(true);
+  REQUIRE(vm.call(&retval, loop, {16}));
+  REQUIRE(retval == demotionLoop(16));
+  REQUIRE(vm.getExecStats().transferCount == 16);
+  vm.setExecStats(false);
+
+  // a new instrumentation promotes the leaf again, and the instrumented leaf
+  // isn't demoted
+  size_t leafCount = 0;
+  QBDI::InstCbLambda leafCbk = [&leafCount](QBDI::VMInstanceRef,
+                                            QBDI::GPRState *,
+                                            QBDI::FPRState *) {
+    leafCount++;
+    return QBDI::CONTINUE;
+  };
+  uint32_t id = vm.addCodeAddrCB(leaf, QBDI::PREINST, leafCbk);
+  REQUIRE(id != QBDI::INVALID_EVENTID);
+  REQUIRE(vm.getDemotedFunctions().empty());
+  REQUIRE(vm.call(&retval, loop, {16}));
+  REQUIRE(retval == demotionLoop(16));
+  REQUIRE(leafCount == 16);
+  REQUIRE(vm.getDemotedFunctions().empty());
+  vm.deleteInstrumentation(id);
+
+  // the demoted leaf is instrumented in the runs with VMEvents
+  uint32_t eventId = vm.addVMEventCB(
+      QBDI::SEQUENCE_ENTRY,
+      [](QBDI::VMInstanceRef, const QBDI::VMState *, QBDI::GPRState *,
+         QBDI::FPRState *, void *) { return QBDI::CONTINUE; },
+      nullptr);
+  REQUIRE(eventId != QBDI::INVALID_EVENTID);
+  vm.setAutoDemotion(4);
+  REQUIRE(vm.call(&retval, loop, {16}));
+  REQUIRE(retval == demotionLoop(16));
+  vm.setExecStats(true);
+  REQUIRE(vm.call(&retval, loop, {16}));
+  REQUIRE(retval == demotionLoop(16));
+  REQUIRE(vm.getExecStats().transferCount == 0);
+  vm.setExecStats(false);
+  vm.deleteInstrumentation(eventId);
+
+  vm.setAutoDemotion(0);
+  REQUIRE(vm.getDemotedFunctions().empty());
+  REQUIRE(vm.call(&retval, loop, {16}));
+  REQUIRE(vm.getDemotedFunctions().empty());
+
+  SUCCEED();
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-InstrRuleStats") {
+  QBDI::rword retval;
+  const QBDI::rword leaf = reinterpret_cast<QBDI::rword>(demotionLeaf);
+  const QBDI::rword loop = reinterpret_cast<QBDI::rword>(demotionLoop);
+  REQUIRE(vm.setInstrRuleStats(true));
+
+  size_t instCount = 0;
+  QBDI::InstCbLambda instCbk = [&instCount](QBDI::VMInstanceRef,
+                                            QBDI::GPRState *,
+                                            QBDI::FPRState *) {
+    instCount++;
+    return QBDI::CONTINUE;
+  };
+  size_t leafCount = 0;
+  QBDI::InstCbLambda leafCbk = [&leafCount](QBDI::VMInstanceRef,
+                                            QBDI::GPRState *,
+                                            QBDI::FPRState *) {
+    leafCount++;
+    return QBDI::CONTINUE;
+  };
+  uint32_t instId = vm.addCodeCB(QBDI::PREINST, instCbk);
+  REQUIRE(instId != QBDI::INVALID_EVENTID);
+  uint32_t leafId = vm.addCodeAddrCB(leaf, QBDI::PREINST, leafCbk);
+  REQUIRE(leafId != QBDI::INVALID_EVENTID);
+  REQUIRE(vm.call(&retval, loop, {16}));
+  REQUIRE(retval == demotionLoop(16));
+
+  std::vector<QBDI::InstrRuleStats> stats = vm.getInstrRuleStats();
+  REQUIRE(stats.size() == 2);
+  // sorted by decreasing cycles of the callbacks
+  REQUIRE(stats[0].callbackCycles >= stats[1].callbackCycles);
+  for (const QBDI::InstrRuleStats &s : stats) {
+    REQUIRE((s.id == instId or s.id == leafId));
+    REQUIRE(s.instrumentCount > 0);
+    REQUIRE(s.instCount > 0);
+    REQUIRE(s.codeSize > 0);
+    REQUIRE(s.callbackCount == (s.id == instId ? instCount : leafCount));
+    if (s.id == leafId) {
+      REQUIRE(s.instrumentCount == 1);
+      REQUIRE(s.callbackCount == 16);
+    }
+  }
+  REQUIRE(vm.getInstrRuleStats(1).size() == 1);
+
+  // the statistics are kept without the rule, and reset without flush
+  vm.deleteInstrumentation(leafId);
+  vm.resetInstrRuleStats();
+  stats = vm.getInstrRuleStats();
+  REQUIRE(stats.size() == 2);
+  for (const QBDI::InstrRuleStats &s : stats) {
+    REQUIRE(s.callbackCount == 0);
+    REQUIRE(s.codeSize == 0);
+  }
+
+  // the callbacks aren't timed anymore once the statistics are disabled
+  REQUIRE(vm.setInstrRuleStats(false));
+  instCount = 0;
+  REQUIRE(vm.call(&retval, loop, {16}));
+  REQUIRE(instCount > 0);
+  for (const QBDI::InstrRuleStats &s : vm.getInstrRuleStats()) {
+    REQUIRE(s.callbackCount == 0);
+  }
+
+  SUCCEED();
+}
+
+#if defined(QBDI_PLATFORM_LINUX) || defined(QBDI_PLATFORM_ANDROID)
+// The volatile pointers keep the calls to the libc
+static void *(*volatile allocationMalloc)(size_t) = malloc;
+static void *(*volatile allocationCalloc)(size_t, size_t) = calloc;
+static void (*volatile allocationFree)(void *) = free;
+
+QBDI_DISABLE_ASAN QBDI_NOINLINE QBDI::rword allocationLoop(QBDI::rword n) {
+  volatile QBDI::rword acc = 0;
+  for (QBDI::rword i = 0; i < n; i++) {
+    void *p = allocationMalloc(16 + i);
+    void *q = allocationCalloc(4, 8);
+    acc = acc + (p != nullptr) + (q != nullptr);
+    allocationFree(p);
+    allocationFree(q);
+  }
+  return acc;
+}
+
+QBDI_DISABLE_ASAN QBDI_NOINLINE QBDI::rword allocationRoot(QBDI::rword n) {
+  volatile QBDI::rword acc = allocationLoop(n);
+  return acc + 1;
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-AllocationProfile") {
+  const QBDI::rword root = reinterpret_cast<QBDI::rword>(allocationRoot);
+  QBDI::AllocationStats stats = vm.getAllocationProfile();
+  REQUIRE(stats.mallocCount == 0);
+  REQUIRE(vm.getAllocationSites().empty());
+
+  REQUIRE(vm.setAllocationProfile(true, 4));
+  QBDI::rword retval;
+  REQUIRE(vm.call(&retval, root, {10}));
+  REQUIRE(retval == 21);
+
+  // 10 malloc of 16 to 25 bytes and 10 calloc of 32 bytes
+  stats = vm.getAllocationProfile();
+  REQUIRE(stats.mallocCount == 10);
+  REQUIRE(stats.callocCount == 10);
+  REQUIRE(stats.freeCount == 20);
+  REQUIRE(stats.reallocCount == 0);
+  REQUIRE(stats.allocatedBytes == 525);
+  REQUIRE(stats.sizeClasses[5] == 10);
+  REQUIRE(stats.sizeClasses[6] == 10);
+
+  // one allocation in 4 is sampled, the call graph is disabled
+  std::vector<QBDI::AllocationSite> sites = vm.getAllocationSites();
+  REQUIRE(not sites.empty());
+  uint64_t samples = 0;
+  for (size_t i = 0; i < sites.size(); i++) {
+    samples += sites[i].samples;
+    REQUIRE(sites[i].frames[0] > reinterpret_cast<QBDI::rword>(allocationLoop));
+    REQUIRE(sites[i].frames[1] == 0);
+    if (i != 0) {
+      REQUIRE(sites[i - 1].sampledBytes >= sites[i].sampledBytes);
+    }
+  }
+  REQUIRE(samples == 5);
+  REQUIRE(vm.getAllocationSites(1).size() == 1);
+
+  // the callers come from the shadow stack of the call graph
+  vm.resetAllocationProfile();
+  REQUIRE(vm.getAllocationProfile().mallocCount == 0);
+  REQUIRE(vm.getAllocationSites().empty());
+  REQUIRE(vm.setCallGraphProfile(true));
+  REQUIRE(vm.call(&retval, root, {10}));
+  sites = vm.getAllocationSites();
+  REQUIRE(not sites.empty());
+  for (const QBDI::AllocationSite &site : sites) {
+    REQUIRE(site.frames[1] > root);
+  }
+  REQUIRE(vm.setCallGraphProfile(false));
+
+  // the copy counts in its own profile
+  QBDI::VM vm2(vm);
+  REQUIRE(vm2.getAllocationProfile().mallocCount == 0);
+  REQUIRE(vm2.call(&retval, root, {3}));
+  REQUIRE(vm2.getAllocationProfile().mallocCount == 3);
+  REQUIRE(vm.getAllocationProfile().mallocCount == 10);
+
+  // the counters are kept once the profile is disabled
+  REQUIRE(vm.setAllocationProfile(false));
+  REQUIRE(vm.call(&retval, root, {10}));
+  stats = vm.getAllocationProfile();
+  REQUIRE(stats.mallocCount == 10);
+  REQUIRE(stats.freeCount == 20);
+
+  SUCCEED();
+}
+#endif
+
+TEST_CASE_METHOD(APITest, "VMTest-OptimizedSize") {
+  // the temporary registers restored after the record of the memory accesses
+  // are saved again by the callbacks
+  size_t instCount = 0;
+  size_t accessCount = 0;
+  QBDI::InstCbLambda instCbk = [&instCount](QBDI::VMInstanceRef,
+                                            QBDI::GPRState *,
+                                            QBDI::FPRState *) {
+    instCount++;
+    return QBDI::CONTINUE;
+  };
+  QBDI::InstCbLambda accessCbk = [&accessCount](QBDI::VMInstanceRef,
+                                                QBDI::GPRState *,
+                                                QBDI::FPRState *) {
+    accessCount++;
+    return QBDI::CONTINUE;
+  };
+  REQUIRE(vm.addCodeCB(QBDI::PREINST, instCbk) != QBDI::INVALID_EVENTID);
+  REQUIRE(vm.addMemAccessCB(QBDI::MEMORY_READ_WRITE, accessCbk) !=
+          QBDI::INVALID_EVENTID);
+
+  QBDI::rword retval;
+  REQUIRE(vm.call(&retval, (QBDI::rword)dummyFun5, {1, 2, 3, 5, 8}));
+  REQUIRE(retval == (QBDI::rword)dummyFun5(1, 2, 3, 5, 8));
+  REQUIRE(instCount > 0);
+  REQUIRE(accessCount > 0);
+  REQUIRE(vm.getCacheStats().optimizedSize > 0);
+
+  SUCCEED();
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-TranslationProfile") {
+  QBDI::TranslationProfile profile = vm.getTranslationProfile();
+  REQUIRE(profile.disassembly.count == 0);
+  REQUIRE(profile.writeSequence.count == 0);
+
+  QBDI::rword retval;
+  REQUIRE(vm.call(&retval, (QBDI::rword)dummyFun5, {1, 2, 3, 5, 8}));
+  profile = vm.getTranslationProfile();
+#if defined(QBDI_PROFILE_TRANSLATION)
+  CHECK(profile.disassembly.count > 0);
+  CHECK(profile.disassembly.bytes > 0);
+  CHECK(profile.patchRules.count > 0);
+  CHECK(profile.encoding.bytes > 0);
+  CHECK(profile.writeSequence.count > 0);
+
+  // the second call only uses the cache
+  QBDI::TranslationProfile profile2;
+  REQUIRE(vm.call(&retval, (QBDI::rword)dummyFun5, {1, 2, 3, 5, 8}));
+  profile2 = vm.getTranslationProfile();
+  CHECK(profile2.disassembly.count == profile.disassembly.count);
+  CHECK(profile2.writeSequence.count == profile.writeSequence.count);
+#else
+  CHECK(profile.disassembly.count == 0);
+  CHECK(profile.writeSequence.count == 0);
+#endif
+}
+
 TEST_CASE_METHOD(APITest, "VMTest-ExternalCall") {
 
   dummyFunCall(42);
@@ -162,6 +660,80 @@ QBDI::VMAction countInstruction(QBDI::VMInstanceRef vm,
   return QBDI::VMAction::CONTINUE;
 }
 
+#if defined(QBDI_PLATFORM_LINUX) || defined(QBDI_PLATFORM_ANDROID)
+TEST_CASE_METHOD(APITest, "VMTest-InstrumentedFunction") {
+  QBDI::rword retval;
+  uint32_t countCall = 0;
+  uint32_t countFun1 = 0;
+
+  vm.addCodeAddrCB((QBDI::rword)dummyFunCall, QBDI::InstPosition::PREINST,
+                   countInstruction, &countCall);
+  vm.addCodeAddrCB((QBDI::rword)dummyFun1, QBDI::InstPosition::PREINST,
+                   countInstruction, &countFun1);
+
+  // dummyFun1 is called natively
+  vm.removeAllInstrumentedRanges();
+  REQUIRE(vm.addInstrumentedFunctionFromAddr((QBDI::rword)dummyFunCall + 1));
+  REQUIRE(vm.call(&retval, (QBDI::rword)dummyFunCall, {42}));
+  REQUIRE(retval == (QBDI::rword)dummyFun1(42));
+  REQUIRE(countCall == 1);
+  REQUIRE(countFun1 == 0);
+
+  // the mangled name contains the name of the function
+  vm.removeAllInstrumentedRanges();
+  vm.clearAllCache();
+  REQUIRE(vm.addInstrumentedFunctionRegex("dummyFun(Call|1)"));
+  REQUIRE(vm.call(&retval, (QBDI::rword)dummyFunCall, {42}));
+  REQUIRE(retval == (QBDI::rword)dummyFun1(42));
+  REQUIRE(countCall == 2);
+  REQUIRE(countFun1 == 1);
+
+  REQUIRE_FALSE(vm.addInstrumentedFunctionRegex("dummyFun("));
+  REQUIRE_FALSE(vm.addInstrumentedFunction("_QBDI_no_such_function"));
+  REQUIRE_FALSE(vm.addInstrumentedFunctionFromAddr(0x10));
+}
+#endif
+
+TEST_CASE_METHOD(APITest, "VMTest-ExecBlockSize") {
+  uint32_t codeSize = 1, dataSize = 1;
+  vm.getExecBlockSize(&codeSize, &dataSize);
+  REQUIRE(codeSize == 0);
+  REQUIRE(dataSize == 0);
+
+  // too large for the 16 bits offsets
+  REQUIRE_FALSE(vm.setExecBlockSize(0x20000, 0));
+  REQUIRE_FALSE(vm.setExecBlockSize(0, 0x100000));
+  vm.getExecBlockSize(&codeSize, &dataSize);
+  REQUIRE(codeSize == 0);
+  REQUIRE(dataSize == 0);
+
+  REQUIRE(vm.setExecBlockSize(0x4000, 0x10000));
+  vm.getExecBlockSize(&codeSize, &dataSize);
+  REQUIRE(codeSize == 0x4000);
+  REQUIRE(dataSize == 0x10000);
+
+  uint32_t count = 0;
+  vm.addCodeCB(QBDI::InstPosition::PREINST, countInstruction, &count);
+
+  QBDI::rword retval;
+  bool ran = vm.call(&retval, reinterpret_cast<QBDI::rword>(dummyFunBB),
+                     {5, 3, 7, reinterpret_cast<QBDI::rword>(dummyFun1),
+                      reinterpret_cast<QBDI::rword>(dummyFun1),
+                      reinterpret_cast<QBDI::rword>(dummyFun1)});
+  REQUIRE(ran);
+  REQUIRE(retval == (QBDI::rword)dummyFunBB(5, 3, 7, dummyFun1, dummyFun1,
+                                             dummyFun1));
+  REQUIRE(count > 0);
+
+  // the copy keeps the size of the ExecBlocks
+  QBDI::VM vm2(vm);
+  vm2.getExecBlockSize(&codeSize, &dataSize);
+  REQUIRE(codeSize == 0x4000);
+  REQUIRE(dataSize == 0x10000);
+
+  SUCCEED();
+}
+
 QBDI::VMAction evilCbk(QBDI::VMInstanceRef vm, QBDI::GPRState *gprState,
                        QBDI::FPRState *fprState, void *data) {
   const QBDI::InstAnalysis *ana = vm->getInstAnalysis();
@@ -215,6 +787,478 @@ TEST_CASE_METHOD(APITest, "VMTest-InstCallback") {
   SUCCEED();
 }
 
+TEST_CASE_METHOD(APITest, "VMTest-CodeCounter") {
+  QBDI::rword retval;
+  uint32_t count = 0;
+  uint64_t *counter = nullptr;
+  uint64_t *postCounter = nullptr;
+
+  vm.addCodeRangeCB((QBDI::rword)&dummyFun5, ((QBDI::rword)&dummyFun5) + 64,
+                    QBDI::InstPosition::PREINST, countInstruction, &count);
+  uint32_t id = vm.addCodeCounter(
+      (QBDI::rword)&dummyFun5, ((QBDI::rword)&dummyFun5) + 64,
+      QBDI::InstPosition::PREINST, &counter);
+  REQUIRE(id != QBDI::VMError::INVALID_EVENTID);
+  REQUIRE(counter != nullptr);
+  vm.addCodeCounter((QBDI::rword)&dummyFun5, ((QBDI::rword)&dummyFun5) + 64,
+                    QBDI::InstPosition::POSTINST, &postCounter);
+  REQUIRE(*counter == 0);
+
+  vm.call(&retval, (QBDI::rword)dummyFun5, {1, 2, 3, 5, 8});
+  REQUIRE(retval == (QBDI::rword)dummyFun5(1, 2, 3, 5, 8));
+  REQUIRE(count > 0);
+  REQUIRE(*counter == count);
+  REQUIRE(*postCounter == count);
+
+  // the counter can be reset without flushing the cache
+  *counter = 0;
+  vm.call(&retval, (QBDI::rword)dummyFun5, {1, 2, 3, 5, 8});
+  REQUIRE(*counter * 2 == count);
+
+  // the copy of the VM has its own counter
+  QBDI::VM vm2 = vm;
+  vm2.call(&retval, (QBDI::rword)dummyFun5, {1, 2, 3, 5, 8});
+  REQUIRE(*counter * 3 == count);
+
+  REQUIRE(vm.deleteInstrumentation(id));
+  vm.call(&retval, (QBDI::rword)dummyFun5, {1, 2, 3, 5, 8});
+  REQUIRE(*postCounter * 4 == count * 3);
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-Plan") {
+  QBDI::rword retval;
+  uint32_t count = 0;
+  uint64_t instructions = 0;
+  uint64_t calls = 0;
+  uint8_t bitmap[64] = {0};
+  QBDI::rword start = (QBDI::rword)&dummyFun5;
+
+  vm.addCodeRangeCB(start, start + 64, QBDI::InstPosition::PREINST,
+                    countInstruction, &count);
+  QBDI::PlanStep steps[3] = {};
+  steps[0].action = QBDI::PLAN_COUNT_INSTRUCTIONS;
+  steps[0].start = start;
+  steps[0].end = start + 64;
+  steps[0].counter = &instructions;
+  steps[1].action = QBDI::PLAN_COUNT_CALLS;
+  steps[1].start = start;
+  steps[1].end = start + 64;
+  steps[1].counter = &calls;
+  steps[2].action = QBDI::PLAN_COVERAGE;
+  steps[2].bitmap = bitmap;
+  steps[2].size = sizeof(bitmap);
+  steps[2].coverage = QBDI::COVERAGE_BLOCK;
+  uint32_t ids[3];
+  REQUIRE(vm.addPlan(steps, 3, ids));
+  CHECK(ids[0] != QBDI::VMError::INVALID_EVENTID);
+  CHECK(ids[1] != QBDI::VMError::INVALID_EVENTID);
+  CHECK(ids[2] == QBDI::VMError::INVALID_EVENTID);
+
+  vm.call(&retval, (QBDI::rword)dummyFun5, {1, 2, 3, 5, 8});
+  REQUIRE(retval == (QBDI::rword)dummyFun5(1, 2, 3, 5, 8));
+  REQUIRE(count > 0);
+  CHECK(instructions == count);
+  CHECK(calls == 1);
+  CHECK(std::any_of(std::begin(bitmap), std::end(bitmap),
+                    [](uint8_t e) { return e != 0; }));
+
+  // a step which can't be applied removes the whole plan
+  QBDI::PlanStep invalid[2] = {};
+  invalid[0].action = QBDI::PLAN_COUNT_CALLS;
+  invalid[0].start = start;
+  invalid[0].end = start + 64;
+  invalid[0].counter = &calls;
+  invalid[1].action = QBDI::PLAN_COUNT_INSTRUCTIONS;
+  invalid[1].counter = &instructions;
+  REQUIRE_FALSE(vm.addPlan(invalid, 2, ids));
+  CHECK(ids[0] == QBDI::VMError::INVALID_EVENTID);
+
+  vm.call(&retval, (QBDI::rword)dummyFun5, {1, 2, 3, 5, 8});
+  CHECK(instructions * 2 == count);
+  CHECK(calls == 2);
+  vm.setCoverageBitmap(nullptr, 0);
+}
+
+QBDI_DISABLE_ASAN QBDI_NOINLINE int dummyFunCallTrace(int arg0) {
+  return dummyFun4(arg0, arg0 + 1, arg0 + 2, arg0 + 3) + 1;
+}
+
+static QBDI::VMAction collectCallTrace(QBDI::VMInstanceRef vm,
+                                       const QBDI::CallTraceEntry *entries,
+                                       size_t count, void *data) {
+  std::vector<QBDI::CallTraceEntry> *trace =
+      static_cast<std::vector<QBDI::CallTraceEntry> *>(data);
+  trace->insert(trace->end(), entries, entries + count);
+  return QBDI::VMAction::CONTINUE;
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-CallTrace") {
+  QBDI::rword retval;
+  std::vector<QBDI::CallTraceEntry> trace;
+  QBDI::rword start = (QBDI::rword)&dummyFunCallTrace;
+
+  REQUIRE_FALSE(vm.setCallTraceArity(start, 1));
+  REQUIRE(vm.setCallTrace(collectCallTrace, &trace, 4, 2));
+  vm.call(&retval, (QBDI::rword)dummyFunCallTrace, {5});
+  REQUIRE(retval == (QBDI::rword)dummyFunCallTrace(5));
+
+  // the call of dummyFun4 with its arguments
+  auto it = std::find_if(trace.begin(), trace.end(),
+                         [start](const QBDI::CallTraceEntry &e) {
+                           return e.callAddress >= start and
+                                  e.callAddress < start + 64;
+                         });
+  REQUIRE(it != trace.end());
+  QBDI::CallTraceEntry entry = *it;
+  CHECK(entry.target != 0);
+  REQUIRE(entry.nbArgs == 4);
+  for (unsigned i = 0; i < 4; i++) {
+    CHECK((uint32_t)entry.args[i] == 5 + i);
+  }
+
+  // the arity of the callee of the direct call
+  trace.clear();
+  REQUIRE(vm.setCallTraceArity(entry.target, 2));
+  vm.call(&retval, (QBDI::rword)dummyFunCallTrace, {5});
+  it = std::find_if(trace.begin(), trace.end(),
+                    [&entry](const QBDI::CallTraceEntry &e) {
+                      return e.callAddress == entry.callAddress;
+                    });
+  REQUIRE(it != trace.end());
+  CHECK(it->target == entry.target);
+  CHECK(it->nbArgs == 2);
+
+  // disable the trace
+  REQUIRE(vm.setCallTrace(nullptr, nullptr));
+  trace.clear();
+  vm.call(&retval, (QBDI::rword)dummyFunCallTrace, {5});
+  REQUIRE(trace.empty());
+}
+
+QBDI::VMAction countReturnBelow10(QBDI::VMInstanceRef vm,
+                                  QBDI::GPRState *gprState,
+                                  QBDI::FPRState *fprState, void *data) {
+  if (QBDI_GPR_GET(gprState, QBDI::REG_RETURN) < 10) {
+    *((uint32_t *)data) += 1;
+  }
+  return QBDI::VMAction::CONTINUE;
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-CodeCBIf") {
+  QBDI::rword retval;
+  QBDI::rword start = (QBDI::rword)&dummyFun5;
+  QBDI::rword end = start + 64;
+  uint32_t count = 0;
+  uint32_t countBelow = 0;
+  uint32_t countIfBelow = 0;
+  uint32_t countIfCounter = 0;
+  uint32_t countIfSample = 0;
+
+  vm.addCodeRangeCB(start, end, QBDI::InstPosition::PREINST, countInstruction,
+                    &count);
+  vm.addCodeRangeCB(start, end, QBDI::InstPosition::PREINST,
+                    countReturnBelow10, &countBelow);
+
+  QBDI::CallbackPredicate below = {QBDI::PREDICATE_REG_BELOW,
+                                   QBDI::REG_RETURN, QBDI::MEMORY_READ, 10, 0};
+  REQUIRE(vm.addCodeRangeCBIf(start, end, QBDI::InstPosition::PREINST, below,
+                              countInstruction, &countIfBelow) !=
+          QBDI::VMError::INVALID_EVENTID);
+
+  QBDI::CallbackPredicate counter = {QBDI::PREDICATE_COUNTER, 0,
+                                     QBDI::MEMORY_READ, 2, 0};
+  REQUIRE(vm.addCodeRangeCBIf(start, end, QBDI::InstPosition::POSTINST,
+                              counter, countInstruction, &countIfCounter) !=
+          QBDI::VMError::INVALID_EVENTID);
+
+  QBDI::CallbackPredicate sample = {QBDI::PREDICATE_SAMPLE, 0,
+                                    QBDI::MEMORY_READ, 2, 0};
+  REQUIRE(vm.addCodeRangeCBIf(start, end, QBDI::InstPosition::PREINST, sample,
+                              countInstruction, &countIfSample) !=
+          QBDI::VMError::INVALID_EVENTID);
+
+  // invalid predicates
+  QBDI::CallbackPredicate invalid = {QBDI::PREDICATE_COUNTER, 0,
+                                     QBDI::MEMORY_READ, 0, 0};
+  REQUIRE(vm.addCodeCBIf(QBDI::InstPosition::PREINST, invalid,
+                         countInstruction, nullptr) ==
+          QBDI::VMError::INVALID_EVENTID);
+  invalid = {QBDI::PREDICATE_MEM_IN_RANGE, 0, QBDI::MEMORY_READ, 0, 0x1000};
+  REQUIRE(vm.addCodeCBIf(QBDI::InstPosition::POSTINST, invalid,
+                         countInstruction, nullptr) ==
+          QBDI::VMError::INVALID_EVENTID);
+  invalid = {QBDI::PREDICATE_SAMPLE, 0, QBDI::MEMORY_READ, 0, 0};
+  REQUIRE(vm.addCodeCBIf(QBDI::InstPosition::PREINST, invalid,
+                         countInstruction, nullptr) ==
+          QBDI::VMError::INVALID_EVENTID);
+
+  vm.call(&retval, (QBDI::rword)dummyFun5, {1, 2, 3, 5, 8});
+  REQUIRE(retval == (QBDI::rword)dummyFun5(1, 2, 3, 5, 8));
+  REQUIRE(count > 0);
+  REQUIRE(countIfBelow == countBelow);
+  REQUIRE(countIfCounter == count / 2);
+  REQUIRE(countIfSample > 0);
+  REQUIRE(countIfSample < count);
+}
+
+static volatile int memAccessBuffer[16];
+
+QBDI_DISABLE_ASAN QBDI_NOINLINE int dummyFunMemAccess(int arg0) {
+  for (int i = 0; i < 16; i++) {
+    memAccessBuffer[i] = arg0 + i;
+  }
+  int sum = 0;
+  for (int i = 0; i < 16; i++) {
+    sum += memAccessBuffer[i];
+  }
+  return sum;
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-MemAccessCBIf") {
+  QBDI::rword retval;
+  uint32_t count = 0;
+  uint32_t countIfCounter = 0;
+  uint32_t countIfSample = 0;
+
+  REQUIRE(vm.addMemAccessCB(QBDI::MEMORY_READ_WRITE, countInstruction,
+                            &count) != QBDI::VMError::INVALID_EVENTID);
+
+  QBDI::CallbackPredicate counter = {QBDI::PREDICATE_COUNTER, 0,
+                                     QBDI::MEMORY_READ, 3, 0};
+  REQUIRE(vm.addMemAccessCBIf(QBDI::MEMORY_READ_WRITE, counter,
+                              countInstruction, &countIfCounter) !=
+          QBDI::VMError::INVALID_EVENTID);
+
+  QBDI::CallbackPredicate sample = {QBDI::PREDICATE_SAMPLE, 0,
+                                    QBDI::MEMORY_READ, 4, 0};
+  REQUIRE(vm.addMemAccessCBIf(QBDI::MEMORY_READ_WRITE, sample,
+                              countInstruction, &countIfSample) !=
+          QBDI::VMError::INVALID_EVENTID);
+
+  // the address of the access is only known before a read
+  QBDI::CallbackPredicate invalid = {QBDI::PREDICATE_MEM_IN_RANGE, 0,
+                                     QBDI::MEMORY_WRITE, 0, 0x1000};
+  REQUIRE(vm.addMemAccessCBIf(QBDI::MEMORY_WRITE, invalid, countInstruction,
+                              nullptr) == QBDI::VMError::INVALID_EVENTID);
+
+  vm.call(&retval, (QBDI::rword)dummyFunMemAccess, {5});
+  REQUIRE(retval == (QBDI::rword)dummyFunMemAccess(5));
+  REQUIRE(count >= 32);
+  REQUIRE(countIfCounter == count / 3);
+  REQUIRE(countIfSample > 0);
+  REQUIRE(countIfSample < count);
+}
+
+struct PCRecord {
+  QBDI::rword pcs[256];
+  size_t size;
+};
+
+// don't call a function that may use the vector registers
+QBDI::VMAction recordPC(QBDI::VMInstanceRef vm, QBDI::GPRState *gprState,
+                        QBDI::FPRState *fprState, void *data) {
+  PCRecord *record = static_cast<PCRecord *>(data);
+  if (record->size < 256) {
+    record->pcs[record->size] = QBDI_GPR_GET(gprState, QBDI::REG_PC);
+  }
+  record->size++;
+  return QBDI::VMAction::CONTINUE;
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-CodeCBLight") {
+  QBDI::rword retval;
+  QBDI::rword start = (QBDI::rword)&dummyFun5;
+  QBDI::rword end = start + 64;
+  PCRecord expected = {{0}, 0};
+  PCRecord pcs = {{0}, 0};
+  PCRecord postPCs = {{0}, 0};
+  uint32_t countFPR = 0;
+
+  vm.addCodeRangeCB(start, end, QBDI::InstPosition::PREINST, recordPC,
+                    &expected);
+  REQUIRE(vm.addCodeRangeCBLight(start, end, QBDI::InstPosition::PREINST,
+                                 recordPC, &pcs, QBDI::FOOTPRINT_NONE) !=
+          QBDI::VMError::INVALID_EVENTID);
+  vm.addCodeRangeCBLight(start, end, QBDI::InstPosition::POSTINST, recordPC,
+                         &postPCs, QBDI::FOOTPRINT_ALL_GPR);
+  vm.addCodeRangeCBLight(start, end, QBDI::InstPosition::PREINST,
+                         countInstruction, &countFPR, QBDI::FOOTPRINT_FPR);
+
+  vm.call(&retval, (QBDI::rword)dummyFun5, {1, 2, 3, 5, 8});
+  REQUIRE(retval == (QBDI::rword)dummyFun5(1, 2, 3, 5, 8));
+  REQUIRE(expected.size > 0);
+  REQUIRE(expected.size <= 256);
+  REQUIRE(pcs.size == expected.size);
+  for (size_t i = 0; i < expected.size; i++) {
+    REQUIRE(pcs.pcs[i] == expected.pcs[i]);
+  }
+  REQUIRE(postPCs.size == expected.size);
+  REQUIRE(countFPR == expected.size);
+
+  // the copy of the VM calls the callbacks too
+  QBDI::VM vm2 = vm;
+  pcs.size = 0;
+  vm2.call(&retval, (QBDI::rword)dummyFun5, {1, 2, 3, 5, 8});
+  REQUIRE(retval == (QBDI::rword)dummyFun5(1, 2, 3, 5, 8));
+  REQUIRE(pcs.size == expected.size);
+}
+
+struct AnalysisRecord {
+  size_t count;
+  size_t mismatch;
+};
+
+QBDI::VMAction checkAnalysis(QBDI::VMInstanceRef vm, QBDI::GPRState *gprState,
+                             QBDI::FPRState *fprState,
+                             const QBDI::InstAnalysis *analysis, void *data) {
+  AnalysisRecord *record = static_cast<AnalysisRecord *>(data);
+  const QBDI::InstAnalysis *expected = vm->getInstAnalysis(
+      QBDI::ANALYSIS_INSTRUCTION | QBDI::ANALYSIS_DISASSEMBLY);
+  record->count++;
+  if (analysis->address != QBDI_GPR_GET(gprState, QBDI::REG_PC) or
+      analysis->address != expected->address or
+      analysis->disassembly == nullptr or
+      strcmp(analysis->disassembly, expected->disassembly) != 0) {
+    record->mismatch++;
+  }
+  return QBDI::VMAction::CONTINUE;
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-CodeAnalysisCB") {
+  QBDI::rword retval;
+  QBDI::rword start = (QBDI::rword)&dummyFun5;
+  AnalysisRecord record = {0, 0};
+  AnalysisRecord rangeRecord = {0, 0};
+
+  REQUIRE(vm.addCodeAnalysisCB(QBDI::InstPosition::PREINST, nullptr,
+                               nullptr) == QBDI::VMError::INVALID_EVENTID);
+  REQUIRE(vm.addCodeAnalysisCB(
+              QBDI::InstPosition::PREINST, checkAnalysis, &record,
+              QBDI::ANALYSIS_INSTRUCTION | QBDI::ANALYSIS_DISASSEMBLY) !=
+          QBDI::VMError::INVALID_EVENTID);
+  uint32_t rangeID = vm.addCodeRangeAnalysisCB(
+      start, start + 64, QBDI::InstPosition::PREINST, checkAnalysis,
+      &rangeRecord, QBDI::ANALYSIS_INSTRUCTION | QBDI::ANALYSIS_DISASSEMBLY);
+  REQUIRE(rangeID != QBDI::VMError::INVALID_EVENTID);
+
+  vm.call(&retval, (QBDI::rword)dummyFun5, {1, 2, 3, 5, 8});
+  REQUIRE(retval == (QBDI::rword)dummyFun5(1, 2, 3, 5, 8));
+  REQUIRE(record.count > 0);
+  REQUIRE(record.mismatch == 0);
+  REQUIRE(rangeRecord.count > 0);
+  REQUIRE(rangeRecord.count <= record.count);
+  REQUIRE(rangeRecord.mismatch == 0);
+
+  // the analyses of the cached instructions are still valid
+  size_t count = record.count;
+  vm.deleteInstrumentation(rangeID);
+  vm.call(&retval, (QBDI::rword)dummyFun5, {1, 2, 3, 5, 8});
+  REQUIRE(record.count == 2 * count);
+  REQUIRE(record.mismatch == 0);
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-CoverageBitmap") {
+  QBDI::rword retval;
+  std::vector<uint8_t> bitmap(1 << 16, 0);
+  auto sumBitmap = [&bitmap]() {
+    size_t sum = 0;
+    for (uint8_t v : bitmap) {
+      sum += v;
+    }
+    return sum;
+  };
+
+  REQUIRE_FALSE(vm.setCoverageBitmap(bitmap.data(), 1000));
+  REQUIRE(vm.setCoverageBitmap(bitmap.data(), bitmap.size(),
+                               QBDI::COVERAGE_BLOCK));
+  vm.call(&retval, (QBDI::rword)dummyFun5, {1, 2, 3, 5, 8});
+  REQUIRE(retval == (QBDI::rword)dummyFun5(1, 2, 3, 5, 8));
+  size_t blockSum = sumBitmap();
+  REQUIRE(blockSum > 0);
+
+  // the edge coverage counts the same sequences
+  REQUIRE(vm.setCoverageBitmap(bitmap.data(), bitmap.size(),
+                               QBDI::COVERAGE_EDGE));
+  vm.resetCoverage();
+  vm.call(&retval, (QBDI::rword)dummyFun5, {1, 2, 3, 5, 8});
+  REQUIRE(retval == (QBDI::rword)dummyFun5(1, 2, 3, 5, 8));
+  REQUIRE(sumBitmap() == blockSum);
+
+  // the reset doesn't flush the cache
+  QBDI::CacheStats stats = vm.getCacheStats();
+  vm.resetCoverage();
+  REQUIRE(sumBitmap() == 0);
+  vm.call(&retval, (QBDI::rword)dummyFun5, {1, 2, 3, 5, 8});
+  REQUIRE(sumBitmap() == blockSum);
+  REQUIRE(vm.getCacheStats().translatedSize == stats.translatedSize);
+
+  // disable the coverage
+  REQUIRE(vm.setCoverageBitmap(nullptr, 0));
+  vm.resetCoverage();
+  std::fill(bitmap.begin(), bitmap.end(), 0);
+  vm.call(&retval, (QBDI::rword)dummyFun5, {1, 2, 3, 5, 8});
+  REQUIRE(sumBitmap() == 0);
+}
+
+static int persistentData[4] = {1, 2, 3, 4};
+
+QBDI_DISABLE_ASAN QBDI_NOINLINE int dummyFunPersistent(int arg0) {
+  persistentData[arg0 & 3] += arg0;
+  return persistentData[arg0 & 3];
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-Snapshot") {
+  QBDI::rword retval;
+  REQUIRE_FALSE(vm.restoreSnapshot());
+
+  QBDI::RangeSet<QBDI::rword> ranges;
+  ranges.add({(QBDI::rword)persistentData,
+              (QBDI::rword)persistentData + sizeof(persistentData)});
+  QBDI::rword sp = QBDI_GPR_GET(state, QBDI::REG_SP);
+  vm.takeSnapshot(ranges);
+
+  vm.call(&retval, (QBDI::rword)dummyFunPersistent, {5});
+  REQUIRE(retval == (QBDI::rword)7);
+  QBDI::CacheStats stats = vm.getCacheStats();
+
+  // each iteration starts from the snapshot, without a new translation
+  for (int i = 0; i < 3; i++) {
+    REQUIRE(vm.restoreSnapshot());
+    REQUIRE(persistentData[1] == 2);
+    REQUIRE(QBDI_GPR_GET(state, QBDI::REG_SP) == sp);
+    vm.call(&retval, (QBDI::rword)dummyFunPersistent, {5});
+    REQUIRE(retval == (QBDI::rword)7);
+  }
+  REQUIRE(vm.getCacheStats().translatedSize == stats.translatedSize);
+}
+
+static uint8_t snapshotPages[64 * 4096];
+
+QBDI_DISABLE_ASAN QBDI_NOINLINE int dummyFunWritePage(int page) {
+  snapshotPages[page * 4096 + 7] += page + 1;
+  return snapshotPages[page * 4096 + 7];
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-SnapshotDirtyPages") {
+  QBDI::rword retval;
+  QBDI::RangeSet<QBDI::rword> ranges;
+  ranges.add({(QBDI::rword)snapshotPages,
+              (QBDI::rword)snapshotPages + sizeof(snapshotPages)});
+  memset(snapshotPages, 0, sizeof(snapshotPages));
+  vm.takeSnapshot(ranges);
+
+  for (int i = 0; i < 3; i++) {
+    // written by the instrumented code and by the host
+    vm.call(&retval, (QBDI::rword)dummyFunWritePage, {(QBDI::rword)(i * 7)});
+    REQUIRE(retval == (QBDI::rword)(i * 7 + 1));
+    snapshotPages[sizeof(snapshotPages) - 1 - i] = 42;
+
+    REQUIRE(vm.restoreSnapshot());
+    REQUIRE(std::count(snapshotPages, snapshotPages + sizeof(snapshotPages),
+                       0) == sizeof(snapshotPages));
+  }
+}
+
 QBDI::VMAction evilMnemCbk(QBDI::VMInstanceRef vm, QBDI::GPRState *gprState,
                            QBDI::FPRState *fprState, void *data) {
   QBDI::rword *info = (QBDI::rword *)data;
@@ -350,65 +1394,1525 @@ TEST_CASE_METHOD(APITest, "VMTest-VMEvent_ExecTransfer") {
   vm.deleteAllInstrumentations();
 }
 
-struct CheckBasicBlockData {
-  bool waitingEnd;
-  QBDI::rword BBStart;
-  QBDI::rword BBEnd;
-  size_t count;
+TEST_CASE_METHOD(APITest, "VMTest-TransferHook") {
+  int s = 0;
+  int other = 0;
+
+  bool instrumented = vm.addInstrumentedModuleFromAddr(
+      reinterpret_cast<QBDI::rword>(dummyFunBB));
+  REQUIRE(instrumented);
+  vm.removeInstrumentedRange(reinterpret_cast<QBDI::rword>(dummyFun1),
+                             reinterpret_cast<QBDI::rword>(dummyFun1) + 1);
+
+  uint32_t id =
+      vm.addTransferHook(reinterpret_cast<QBDI::rword>(dummyFun1),
+                         checkTransfer, checkTransfer, (void *)&s);
+  REQUIRE(id != QBDI::INVALID_EVENTID);
+  // the hooks of the other targets aren't called
+  uint32_t otherID =
+      vm.addTransferHook(reinterpret_cast<QBDI::rword>(dummyFunBB),
+                         checkTransfer, nullptr, (void *)&other);
+  REQUIRE(otherID != QBDI::INVALID_EVENTID);
+  REQUIRE(vm.addTransferHook(reinterpret_cast<QBDI::rword>(dummyFun1), nullptr,
+                             nullptr, nullptr) == QBDI::INVALID_EVENTID);
+
+  QBDI::rword retval;
+  bool ran = vm.call(&retval, reinterpret_cast<QBDI::rword>(dummyFunBB),
+                     {0, 0, 0, reinterpret_cast<QBDI::rword>(dummyFun1),
+                      reinterpret_cast<QBDI::rword>(dummyFun1),
+                      reinterpret_cast<QBDI::rword>(dummyFun1)});
+  REQUIRE(ran);
+  REQUIRE(retval == (QBDI::rword)0);
+  REQUIRE(10 == s);
+  REQUIRE(0 == other);
+
+  REQUIRE(vm.deleteInstrumentation(id));
+  REQUIRE_FALSE(vm.deleteInstrumentation(id));
+  ran = vm.call(&retval, reinterpret_cast<QBDI::rword>(dummyFunBB),
+                {0, 0, 0, reinterpret_cast<QBDI::rword>(dummyFun1),
+                 reinterpret_cast<QBDI::rword>(dummyFun1),
+                 reinterpret_cast<QBDI::rword>(dummyFun1)});
+  REQUIRE(ran);
+  REQUIRE(10 == s);
+  vm.deleteAllInstrumentations();
+}
+
+struct FunctionHookCount {
+  int entries = 0;
+  int exits = 0;
+  std::vector<QBDI::rword> entrySP;
 };
 
-static QBDI::VMAction checkBasicBlock(QBDI::VMInstanceRef vm,
-                                      const QBDI::VMState *vmState,
-                                      QBDI::GPRState *gprState,
-                                      QBDI::FPRState *fprState, void *data_) {
-  CheckBasicBlockData *data = static_cast<CheckBasicBlockData *>(data_);
-  CHECK((vmState->event & (QBDI::BASIC_BLOCK_ENTRY | QBDI::BASIC_BLOCK_EXIT)) !=
-        0);
-  CHECK((vmState->event & (QBDI::BASIC_BLOCK_ENTRY | QBDI::BASIC_BLOCK_EXIT)) !=
-        (QBDI::BASIC_BLOCK_ENTRY | QBDI::BASIC_BLOCK_EXIT));
-  if (vmState->event & QBDI::BASIC_BLOCK_ENTRY) {
-    CHECK_FALSE(data->waitingEnd);
-    CHECK(vmState->basicBlockStart == vmState->sequenceStart);
-    *data = {true, vmState->basicBlockStart, vmState->basicBlockEnd,
-             data->count};
-  } else if (vmState->event & QBDI::BASIC_BLOCK_EXIT) {
-    CHECK(data->waitingEnd);
-    CHECK(data->BBStart == vmState->basicBlockStart);
-    CHECK(data->BBEnd == vmState->basicBlockEnd);
-    CHECK(vmState->basicBlockEnd == vmState->sequenceEnd);
-    data->waitingEnd = false;
-    data->count++;
+static QBDI::VMAction countFunctionEntry(QBDI::VMInstanceRef vm,
+                                         QBDI::GPRState *gprState,
+                                         QBDI::FPRState *fprState,
+                                         void *data) {
+  FunctionHookCount *count = static_cast<FunctionHookCount *>(data);
+  count->entries++;
+  count->entrySP.push_back(QBDI_GPR_GET(gprState, QBDI::REG_SP));
+  return QBDI::VMAction::CONTINUE;
+}
+
+static QBDI::VMAction countFunctionExit(QBDI::VMInstanceRef vm,
+                                        QBDI::GPRState *gprState,
+                                        QBDI::FPRState *fprState, void *data) {
+  FunctionHookCount *count = static_cast<FunctionHookCount *>(data);
+  // the exit is after the return of the call of the last entry
+  REQUIRE(count->exits < count->entries);
+  REQUIRE(QBDI_GPR_GET(gprState, QBDI::REG_SP) >
+          count->entrySP[count->exits]);
+  count->exits++;
+  return QBDI::VMAction::CONTINUE;
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-FunctionHook") {
+  FunctionHookCount count;
+
+  bool instrumented = vm.addInstrumentedModuleFromAddr(
+      reinterpret_cast<QBDI::rword>(dummyFunBB));
+  REQUIRE(instrumented);
+
+  uint32_t id = vm.addFunctionHook(reinterpret_cast<QBDI::rword>(dummyFun1),
+                                   countFunctionEntry, countFunctionExit,
+                                   &count);
+  REQUIRE(id != QBDI::INVALID_EVENTID);
+  REQUIRE(vm.addFunctionHook(reinterpret_cast<QBDI::rword>(dummyFun1),
+                             nullptr, nullptr,
+                             nullptr) == QBDI::INVALID_EVENTID);
+
+  QBDI::rword retval;
+  bool ran = vm.call(&retval, reinterpret_cast<QBDI::rword>(dummyFunBB),
+                     {5, 3, 7, reinterpret_cast<QBDI::rword>(dummyFun1),
+                      reinterpret_cast<QBDI::rword>(dummyFun1),
+                      reinterpret_cast<QBDI::rword>(dummyFun1)});
+  REQUIRE(ran);
+  REQUIRE(retval == (QBDI::rword)dummyFunBB(5, 3, 7, dummyFun1, dummyFun1,
+                                            dummyFun1));
+  REQUIRE(count.entries == 5);
+  REQUIRE(count.exits == 5);
+
+  // the exit gates are removed with the hook
+  REQUIRE(vm.deleteInstrumentation(id));
+  ran = vm.call(&retval, reinterpret_cast<QBDI::rword>(dummyFunBB),
+                {5, 3, 7, reinterpret_cast<QBDI::rword>(dummyFun1),
+                 reinterpret_cast<QBDI::rword>(dummyFun1),
+                 reinterpret_cast<QBDI::rword>(dummyFun1)});
+  REQUIRE(ran);
+  REQUIRE(count.entries == 5);
+  REQUIRE(count.exits == 5);
+}
+
+static int replacementCalls = 0;
+
+QBDI_DISABLE_ASAN QBDI_NOINLINE int dummyFunReplacement(int arg0) {
+  replacementCalls++;
+  return arg0 + 1;
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-ReplaceFunction") {
+  uint32_t origCount = 0;
+
+  bool instrumented = vm.addInstrumentedModuleFromAddr(
+      reinterpret_cast<QBDI::rword>(dummyFunBB));
+  REQUIRE(instrumented);
+  int expected = dummyFunBB(5, 3, 7, dummyFunReplacement, dummyFunReplacement,
+                            dummyFunReplacement);
+  replacementCalls = 0;
+
+  // the original function is never translated
+  uint32_t cbID = vm.addCodeAddrCB(reinterpret_cast<QBDI::rword>(dummyFun1),
+                                   QBDI::PREINST, countInstruction, &origCount);
+  REQUIRE(cbID != QBDI::INVALID_EVENTID);
+  uint32_t id =
+      vm.replaceFunction(reinterpret_cast<QBDI::rword>(dummyFun1),
+                         reinterpret_cast<QBDI::rword>(dummyFunReplacement));
+  REQUIRE(id != QBDI::INVALID_EVENTID);
+  REQUIRE(vm.replaceFunction(reinterpret_cast<QBDI::rword>(dummyFun1),
+                             reinterpret_cast<QBDI::rword>(dummyFun1)) ==
+          QBDI::INVALID_EVENTID);
+
+  QBDI::rword retval;
+  bool ran = vm.call(&retval, reinterpret_cast<QBDI::rword>(dummyFunBB),
+                     {5, 3, 7, reinterpret_cast<QBDI::rword>(dummyFun1),
+                      reinterpret_cast<QBDI::rword>(dummyFun1),
+                      reinterpret_cast<QBDI::rword>(dummyFun1)});
+  REQUIRE(ran);
+  REQUIRE(retval == (QBDI::rword)expected);
+  REQUIRE(replacementCalls == 5);
+  REQUIRE(origCount == 0);
+
+  // the original function is called again once the replacement is removed
+  REQUIRE(vm.deleteInstrumentation(id));
+  REQUIRE_FALSE(vm.deleteInstrumentation(id));
+  ran = vm.call(&retval, reinterpret_cast<QBDI::rword>(dummyFunBB),
+                {5, 3, 7, reinterpret_cast<QBDI::rword>(dummyFun1),
+                 reinterpret_cast<QBDI::rword>(dummyFun1),
+                 reinterpret_cast<QBDI::rword>(dummyFun1)});
+  REQUIRE(ran);
+  REQUIRE(retval == (QBDI::rword)dummyFunBB(5, 3, 7, dummyFun1, dummyFun1,
+                                            dummyFun1));
+  REQUIRE(replacementCalls == 5);
+  REQUIRE(origCount == 5);
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-TransferStats") {
+  REQUIRE(vm.getTransferStats().empty());
+
+  bool instrumented = vm.addInstrumentedModuleFromAddr(
+      reinterpret_cast<QBDI::rword>(dummyFunBB));
+  REQUIRE(instrumented);
+  vm.removeInstrumentedRange(reinterpret_cast<QBDI::rword>(dummyFun1),
+                             reinterpret_cast<QBDI::rword>(dummyFun1) + 1);
+
+  QBDI::rword retval;
+  bool ran = vm.call(&retval, reinterpret_cast<QBDI::rword>(dummyFunBB),
+                     {0, 0, 0, reinterpret_cast<QBDI::rword>(dummyFun1),
+                      reinterpret_cast<QBDI::rword>(dummyFun1),
+                      reinterpret_cast<QBDI::rword>(dummyFun1)});
+  REQUIRE(ran);
+  REQUIRE(retval == (QBDI::rword)0);
+
+  std::vector<QBDI::TransferStats> stats = vm.getTransferStats();
+  REQUIRE(stats.size() == 1);
+  CHECK(stats[0].target == reinterpret_cast<QBDI::rword>(dummyFun1));
+  CHECK(stats[0].count == 5);
+  CHECK(stats[0].cycles > 0);
+
+  // the counters are cumulative
+  ran = vm.call(&retval, reinterpret_cast<QBDI::rword>(dummyFunBB),
+                {0, 0, 0, reinterpret_cast<QBDI::rword>(dummyFun1),
+                 reinterpret_cast<QBDI::rword>(dummyFun1),
+                 reinterpret_cast<QBDI::rword>(dummyFun1)});
+  REQUIRE(ran);
+  stats = vm.getTransferStats(1);
+  REQUIRE(stats.size() == 1);
+  CHECK(stats[0].count == 10);
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-SequenceProfile") {
+  REQUIRE(vm.getSequenceProfile().empty());
+  REQUIRE(vm.setSequenceProfile(true));
+
+  bool instrumented = vm.addInstrumentedModuleFromAddr(
+      reinterpret_cast<QBDI::rword>(dummyFun1));
+  REQUIRE(instrumented);
+
+  QBDI::rword retval;
+  for (int i = 0; i < 3; i++) {
+    bool ran =
+        vm.call(&retval, reinterpret_cast<QBDI::rword>(dummyFun1), {42});
+    REQUIRE(ran);
+    REQUIRE(retval == (QBDI::rword)42);
+  }
+
+  std::vector<QBDI::SequenceStats> stats = vm.getSequenceProfile();
+  REQUIRE(stats.size() >= 1);
+  auto entry = std::find_if(stats.begin(), stats.end(),
+                            [](const QBDI::SequenceStats &s) {
+                              return s.address ==
+                                     reinterpret_cast<QBDI::rword>(dummyFun1);
+                            });
+  REQUIRE(entry != stats.end());
+  CHECK(entry->executions == 3);
+  CHECK(entry->instCount > 0);
+  for (size_t i = 1; i < stats.size(); i++) {
+    CHECK(stats[i - 1].executions * stats[i - 1].instCount >=
+          stats[i].executions * stats[i].instCount);
+  }
+
+  // the counters are kept when the cache is flushed
+  vm.clearAllCache();
+  bool ran = vm.call(&retval, reinterpret_cast<QBDI::rword>(dummyFun1), {42});
+  REQUIRE(ran);
+  stats = vm.getSequenceProfile();
+  uint64_t executions = 0;
+  for (const QBDI::SequenceStats &s : stats) {
+    if (s.address == reinterpret_cast<QBDI::rword>(dummyFun1)) {
+      executions += s.executions;
+    }
+  }
+  CHECK(executions == 4);
+  CHECK(vm.getSequenceProfile(1).size() == 1);
+
+  vm.resetSequenceProfile();
+  CHECK(vm.getSequenceProfile().empty());
+
+  // disabled, the counters aren't incremented
+  REQUIRE(vm.setSequenceProfile(false));
+  ran = vm.call(&retval, reinterpret_cast<QBDI::rword>(dummyFun1), {42});
+  REQUIRE(ran);
+  CHECK(vm.getSequenceProfile().empty());
+}
+
+QBDI_DISABLE_ASAN QBDI_NOINLINE QBDI::rword branchLoop(QBDI::rword n) {
+  volatile QBDI::rword acc = 0;
+  for (QBDI::rword i = 0; i < n; i++) {
+    if (acc % 3 == 0) {
+      acc = acc + 5;
+    } else {
+      acc = acc + 1;
+    }
+  }
+  return acc;
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-BranchProfile") {
+  REQUIRE(vm.getBranchProfile().empty());
+
+  // the reference is computed by a POSTINST callback on the Jcc
+  std::map<QBDI::rword, std::pair<uint64_t, uint64_t>> expected;
+  uint32_t cbId = vm.addCodeCB(
+      QBDI::POSTINST,
+      [&expected](QBDI::VMInstanceRef vm, QBDI::GPRState *gprState,
+                  QBDI::FPRState *) {
+        const QBDI::InstAnalysis *ana = vm->getInstAnalysis();
+        if (strncmp(ana->mnemonic, "JCC", 3) == 0) {
+          if (QBDI_GPR_GET(gprState, QBDI::REG_PC) !=
+              ana->address + ana->instSize) {
+            expected[ana->address].first++;
+          } else {
+            expected[ana->address].second++;
+          }
+        }
+        return QBDI::VMAction::CONTINUE;
+      });
+  REQUIRE(cbId != QBDI::INVALID_EVENTID);
+
+  bool instrumented = vm.addInstrumentedModuleFromAddr(
+      reinterpret_cast<QBDI::rword>(branchLoop));
+  REQUIRE(instrumented);
+  QBDI::rword retval;
+  bool ran = vm.call(&retval, reinterpret_cast<QBDI::rword>(branchLoop), {30});
+  REQUIRE(ran);
+  REQUIRE(retval == branchLoop(30));
+  REQUIRE(not expected.empty());
+
+  vm.deleteInstrumentation(cbId);
+  REQUIRE(vm.setBranchProfile(true));
+  ran = vm.call(&retval, reinterpret_cast<QBDI::rword>(branchLoop), {30});
+  REQUIRE(ran);
+  REQUIRE(retval == branchLoop(30));
+
+  std::vector<QBDI::BranchStats> stats = vm.getBranchProfile();
+  REQUIRE(stats.size() == expected.size());
+  for (const QBDI::BranchStats &s : stats) {
+    auto it = expected.find(s.address);
+    REQUIRE(it != expected.end());
+    CHECK(s.taken == it->second.first);
+    CHECK(s.notTaken == it->second.second);
+  }
+  for (size_t i = 1; i < stats.size(); i++) {
+    CHECK(stats[i - 1].taken + stats[i - 1].notTaken >=
+          stats[i].taken + stats[i].notTaken);
+  }
+  CHECK(vm.getBranchProfile(1).size() == 1);
+
+  vm.resetBranchProfile();
+  CHECK(vm.getBranchProfile().empty());
+
+  // disabled, the counters aren't incremented
+  REQUIRE(vm.setBranchProfile(false));
+  ran = vm.call(&retval, reinterpret_cast<QBDI::rword>(branchLoop), {30});
+  REQUIRE(ran);
+  CHECK(vm.getBranchProfile().empty());
+}
+
+QBDI_DISABLE_ASAN QBDI_NOINLINE QBDI::rword indirectAdd(QBDI::rword v) {
+  return v + 3;
+}
+QBDI_DISABLE_ASAN QBDI_NOINLINE QBDI::rword indirectXor(QBDI::rword v) {
+  return v ^ 0x55;
+}
+QBDI_DISABLE_ASAN QBDI_NOINLINE QBDI::rword indirectMul(QBDI::rword v) {
+  return v * 5;
+}
+QBDI_DISABLE_ASAN QBDI_NOINLINE QBDI::rword indirectSub(QBDI::rword v) {
+  return v - 7;
+}
+QBDI_DISABLE_ASAN QBDI_NOINLINE QBDI::rword indirectShr(QBDI::rword v) {
+  return v >> 1;
+}
+QBDI_DISABLE_ASAN QBDI_NOINLINE QBDI::rword indirectNot(QBDI::rword v) {
+  return ~v;
+}
+
+// more targets than the table of a site, the last ones overflow
+static QBDI::rword (*volatile indirectHandlers[6])(QBDI::rword) = {
+    indirectAdd, indirectXor, indirectMul,
+    indirectSub, indirectShr, indirectNot};
+
+QBDI_DISABLE_ASAN QBDI_NOINLINE QBDI::rword indirectLoop(QBDI::rword n) {
+  QBDI::rword acc = 0;
+  for (QBDI::rword i = 0; i < n; i++) {
+    acc = indirectHandlers[(i * i) % 6](acc);
+  }
+  return acc;
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-IndirectProfile") {
+  REQUIRE(vm.getIndirectProfile().empty());
+
+  // the reference is computed by a POSTINST callback on the indirect calls
+  // and jumps, with the same table size as the profile
+  std::map<QBDI::rword, std::vector<QBDI::rword>> targets;
+  std::map<std::pair<QBDI::rword, QBDI::rword>, uint64_t> expected;
+  uint32_t cbId = vm.addCodeCB(
+      QBDI::POSTINST,
+      [&](QBDI::VMInstanceRef vm, QBDI::GPRState *gprState, QBDI::FPRState *) {
+        const QBDI::InstAnalysis *ana = vm->getInstAnalysis();
+        size_t len = strlen(ana->mnemonic);
+        char last = ana->mnemonic[len - 1];
+        if ((ana->isCall or ana->isBranch) and (last == 'r' or last == 'm')) {
+          QBDI::rword target = QBDI_GPR_GET(gprState, QBDI::REG_PC);
+          std::vector<QBDI::rword> &site = targets[ana->address];
+          if (std::find(site.begin(), site.end(), target) == site.end()) {
+            site.push_back(target);
+          }
+          size_t pos =
+              std::find(site.begin(), site.end(), target) - site.begin();
+          expected[{ana->address, pos < 4 ? target : 0}]++;
+        }
+        return QBDI::VMAction::CONTINUE;
+      });
+  REQUIRE(cbId != QBDI::INVALID_EVENTID);
+
+  bool instrumented = vm.addInstrumentedModuleFromAddr(
+      reinterpret_cast<QBDI::rword>(indirectLoop));
+  REQUIRE(instrumented);
+  QBDI::rword retval;
+  bool ran =
+      vm.call(&retval, reinterpret_cast<QBDI::rword>(indirectLoop), {40});
+  REQUIRE(ran);
+  REQUIRE(retval == indirectLoop(40));
+  REQUIRE(not expected.empty());
+
+  vm.deleteInstrumentation(cbId);
+  REQUIRE(vm.setIndirectProfile(true));
+  ran = vm.call(&retval, reinterpret_cast<QBDI::rword>(indirectLoop), {40});
+  REQUIRE(ran);
+  REQUIRE(retval == indirectLoop(40));
+
+  std::vector<QBDI::IndirectTargetStats> stats = vm.getIndirectProfile();
+  REQUIRE(stats.size() == expected.size());
+  bool overflow = false;
+  for (const QBDI::IndirectTargetStats &s : stats) {
+    auto it = expected.find({s.address, s.target});
+    REQUIRE(it != expected.end());
+    CHECK(s.count == it->second);
+    overflow = overflow or s.target == 0;
+  }
+  CHECK(overflow);
+  for (size_t i = 1; i < stats.size(); i++) {
+    CHECK(stats[i - 1].count >= stats[i].count);
+  }
+  CHECK(vm.getIndirectProfile(1).size() == 1);
+
+  vm.resetIndirectProfile();
+  CHECK(vm.getIndirectProfile().empty());
+
+  // disabled, the counters aren't incremented
+  REQUIRE(vm.setIndirectProfile(false));
+  ran = vm.call(&retval, reinterpret_cast<QBDI::rword>(indirectLoop), {40});
+  REQUIRE(ran);
+  CHECK(vm.getIndirectProfile().empty());
+}
+
+#if defined(QBDI_ARCH_X86_64)
+TEST_CASE_METHOD(APITest, "VMTest-ValueProfile") {
+#ifdef QBDI_PLATFORM_WINDOWS
+  const uint32_t argReg = 2; // rcx
+#else
+  const uint32_t argReg = 5; // rdi
+#endif
+  QBDI::rword address = reinterpret_cast<QBDI::rword>(indirectAdd);
+  bool instrumented = vm.addInstrumentedModuleFromAddr(address);
+  REQUIRE(instrumented);
+
+  CHECK(vm.addValueProfile(address, argReg, 0) == QBDI::INVALID_EVENTID);
+  CHECK(vm.addValueProfile(address, QBDI::REG_PC, 2) ==
+        QBDI::INVALID_EVENTID);
+  uint32_t id = vm.addValueProfile(address, argReg, 2);
+  REQUIRE(id != QBDI::INVALID_EVENTID);
+  CHECK(vm.getValueProfile(id).empty());
+
+  // 0 is recorded as a value, the values beyond the table are counted together
+  QBDI::rword retval;
+  for (QBDI::rword v : {0, 0, 0, 7, 7, 9, 11}) {
+    bool ran = vm.call(&retval, address, {v});
+    REQUIRE(ran);
+    REQUIRE(retval == indirectAdd(v));
+  }
+  std::vector<QBDI::ValueStats> stats = vm.getValueProfile(id);
+  REQUIRE(stats.size() == 3);
+  CHECK(stats[0].address == address);
+  CHECK(stats[0].reg == argReg);
+  CHECK(stats[0].others == 0);
+  CHECK(stats[0].value == 0);
+  CHECK(stats[0].count == 3);
+  CHECK(stats[1].others == 0);
+  CHECK(stats[1].value == 7);
+  CHECK(stats[1].count == 2);
+  CHECK(stats[2].others == 1);
+  CHECK(stats[2].count == 2);
+  CHECK(vm.getValueProfile(id, 1).size() == 1);
+
+  // the table keeps its values after a reset
+  REQUIRE(vm.resetValueProfile(id));
+  CHECK(vm.getValueProfile(id).empty());
+  bool ran = vm.call(&retval, address, {7});
+  REQUIRE(ran);
+  stats = vm.getValueProfile(id);
+  REQUIRE(stats.size() == 1);
+  CHECK(stats[0].value == 7);
+  CHECK(stats[0].count == 1);
+
+  REQUIRE(vm.deleteInstrumentation(id));
+  CHECK_FALSE(vm.resetValueProfile(id));
+  CHECK(vm.getValueProfile(id).empty());
+  ran = vm.call(&retval, address, {7});
+  REQUIRE(ran);
+  REQUIRE(retval == indirectAdd(7));
+}
+#endif
+
+QBDI_DISABLE_ASAN QBDI_NOINLINE QBDI::rword callGraphLeaf(QBDI::rword v) {
+  volatile QBDI::rword acc = v;
+  for (QBDI::rword i = 0; i < (v & 7); i++) {
+    acc = acc + i;
+  }
+  return acc;
+}
+
+QBDI_DISABLE_ASAN QBDI_NOINLINE QBDI::rword callGraphMiddle(QBDI::rword v) {
+  volatile QBDI::rword r = callGraphLeaf(v);
+  r = r + callGraphLeaf(v + 1);
+  return r;
+}
+
+static QBDI::rword (*volatile callGraphHandlers[2])(QBDI::rword) = {
+    callGraphLeaf, callGraphMiddle};
+
+QBDI_DISABLE_ASAN QBDI_NOINLINE QBDI::rword callGraphRoot(QBDI::rword n) {
+  volatile QBDI::rword acc = 0;
+  for (QBDI::rword i = 0; i < n; i++) {
+    acc = acc + callGraphMiddle(i);
+    acc = acc + callGraphHandlers[i & 1](acc);
+  }
+  return acc;
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-CallGraphProfile") {
+  REQUIRE(vm.getCallGraphProfile().empty());
+
+  // the reference is computed by callbacks with the same shadow stack
+  struct Frame {
+    QBDI::rword returnAddress;
+    uint64_t start;
+    std::pair<QBDI::rword, QBDI::rword> edge;
+  };
+  std::vector<Frame> frames;
+  std::map<std::pair<QBDI::rword, QBDI::rword>, std::pair<uint64_t, uint64_t>>
+      expected;
+  uint64_t instCount = 0;
+  uint32_t countId = vm.addCodeCB(
+      QBDI::PREINST,
+      [&instCount](QBDI::VMInstanceRef, QBDI::GPRState *, QBDI::FPRState *) {
+        instCount++;
+        return QBDI::VMAction::CONTINUE;
+      });
+  REQUIRE(countId != QBDI::INVALID_EVENTID);
+  uint32_t edgeId = vm.addCodeCB(
+      QBDI::POSTINST,
+      [&](QBDI::VMInstanceRef vm, QBDI::GPRState *gprState, QBDI::FPRState *) {
+        const QBDI::InstAnalysis *ana = vm->getInstAnalysis();
+        QBDI::rword pc = QBDI_GPR_GET(gprState, QBDI::REG_PC);
+        if (ana->isCall) {
+          std::pair<QBDI::rword, QBDI::rword> edge = {ana->address, pc};
+          expected[edge].first++;
+          frames.push_back({ana->address + ana->instSize, instCount, edge});
+        } else if (ana->isReturn and not frames.empty() and
+                   frames.back().returnAddress == pc) {
+          const Frame &frame = frames.back();
+          expected[frame.edge].second += instCount - frame.start;
+          frames.pop_back();
+        }
+        return QBDI::VMAction::CONTINUE;
+      });
+  REQUIRE(edgeId != QBDI::INVALID_EVENTID);
+
+  bool instrumented = vm.addInstrumentedModuleFromAddr(
+      reinterpret_cast<QBDI::rword>(callGraphRoot));
+  REQUIRE(instrumented);
+  QBDI::rword retval;
+  bool ran =
+      vm.call(&retval, reinterpret_cast<QBDI::rword>(callGraphRoot), {20});
+  REQUIRE(ran);
+  REQUIRE(retval == callGraphRoot(20));
+  REQUIRE(not expected.empty());
+
+  vm.deleteInstrumentation(countId);
+  vm.deleteInstrumentation(edgeId);
+  REQUIRE(vm.setCallGraphProfile(true));
+  ran = vm.call(&retval, reinterpret_cast<QBDI::rword>(callGraphRoot), {20});
+  REQUIRE(ran);
+  REQUIRE(retval == callGraphRoot(20));
+
+  std::vector<QBDI::CallGraphEdgeStats> stats = vm.getCallGraphProfile();
+  REQUIRE(stats.size() == expected.size());
+  for (const QBDI::CallGraphEdgeStats &s : stats) {
+    auto it = expected.find({s.address, s.target});
+    REQUIRE(it != expected.end());
+    CHECK(s.count == it->second.first);
+    CHECK(s.inclusive == it->second.second);
+  }
+  for (size_t i = 1; i < stats.size(); i++) {
+    CHECK(stats[i - 1].count >= stats[i].count);
+  }
+  CHECK(vm.getCallGraphProfile(1).size() == 1);
+
+  vm.resetCallGraphProfile();
+  CHECK(vm.getCallGraphProfile().empty());
+
+  // disabled, the counters aren't incremented
+  REQUIRE(vm.setCallGraphProfile(false));
+  ran = vm.call(&retval, reinterpret_cast<QBDI::rword>(callGraphRoot), {20});
+  REQUIRE(ran);
+  CHECK(vm.getCallGraphProfile().empty());
+}
+
+// a buffer of 8 pages, the first pages are accessed more often
+static volatile QBDI::rword pageBuffer[8 * 4096 / sizeof(QBDI::rword)];
+
+QBDI_DISABLE_ASAN QBDI_NOINLINE QBDI::rword pageLoop(QBDI::rword n) {
+  static const QBDI::rword pageWords = 4096 / sizeof(QBDI::rword);
+  QBDI::rword acc = 0;
+  for (QBDI::rword i = 0; i < n; i++) {
+    QBDI::rword page = (i % 3 == 0) ? 0 : (i % 8);
+    acc += pageBuffer[page * pageWords + (i % pageWords)];
+    pageBuffer[page * pageWords + (acc % pageWords)] = i;
+  }
+  return acc;
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-PageHistogram") {
+  REQUIRE(vm.getPageHistogram().empty());
+  REQUIRE_FALSE(
+      vm.setPageHistogram(true, static_cast<QBDI::MemoryAccessType>(0)));
+
+  // the reference counts the accesses reported by a memory callback
+  std::map<QBDI::rword, uint64_t> expected;
+  uint64_t total = 0;
+  uint32_t cbId = vm.addMemAccessCB(
+      QBDI::MEMORY_READ_WRITE,
+      [&](QBDI::VMInstanceRef vm, QBDI::GPRState *, QBDI::FPRState *) {
+        for (const QBDI::MemoryAccess &m : vm->getInstMemoryAccess()) {
+          expected[m.accessAddress & ~static_cast<QBDI::rword>(4095)]++;
+          total++;
+        }
+        return QBDI::VMAction::CONTINUE;
+      });
+  REQUIRE(cbId != QBDI::INVALID_EVENTID);
+
+  bool instrumented = vm.addInstrumentedModuleFromAddr(
+      reinterpret_cast<QBDI::rword>(pageLoop));
+  REQUIRE(instrumented);
+  QBDI::rword retval;
+  bool ran = vm.call(&retval, reinterpret_cast<QBDI::rword>(pageLoop), {500});
+  REQUIRE(ran);
+  REQUIRE(total != 0);
+
+  vm.deleteInstrumentation(cbId);
+  REQUIRE(vm.setPageHistogram(true));
+  ran = vm.call(&retval, reinterpret_cast<QBDI::rword>(pageLoop), {500});
+  REQUIRE(ran);
+
+  // the stack may move between the runs, only the pages of the buffer are
+  // compared
+  std::vector<QBDI::PageAccessStats> stats = vm.getPageHistogram();
+  REQUIRE(not stats.empty());
+  uint64_t histogramTotal = 0;
+  QBDI::rword bufferStart = reinterpret_cast<QBDI::rword>(pageBuffer);
+  QBDI::rword bufferEnd = bufferStart + sizeof(pageBuffer);
+  size_t bufferPages = 0;
+  for (size_t i = 0; i < stats.size(); i++) {
+    const QBDI::PageAccessStats &s = stats[i];
+    CHECK((s.page & 4095) == 0);
+    if (i > 0) {
+      CHECK(stats[i - 1].count >= s.count);
+    }
+    histogramTotal += s.count;
+    if (s.page + 4096 > bufferStart and s.page < bufferEnd) {
+      CHECK(s.count == expected[s.page]);
+      bufferPages++;
+    }
+  }
+  CHECK(histogramTotal == total);
+  CHECK(bufferPages >= 8);
+
+  std::vector<QBDI::PageAccessStats> top = vm.getPageHistogram(2);
+  REQUIRE(top.size() == 2);
+  CHECK(top[0].page == stats[0].page);
+  CHECK(top[1].page == stats[1].page);
+
+  // the counters are incremented from the generated code on every run
+  ran = vm.call(&retval, reinterpret_cast<QBDI::rword>(pageLoop), {500});
+  REQUIRE(ran);
+  uint64_t secondTotal = 0;
+  for (const QBDI::PageAccessStats &s : vm.getPageHistogram()) {
+    secondTotal += s.count;
+  }
+  CHECK(secondTotal == 2 * total);
+
+  vm.resetPageHistogram();
+  CHECK(vm.getPageHistogram().empty());
+
+  // disabled, the counters aren't incremented
+  REQUIRE(vm.setPageHistogram(false));
+  ran = vm.call(&retval, reinterpret_cast<QBDI::rword>(pageLoop), {500});
+  REQUIRE(ran);
+  CHECK(vm.getPageHistogram().empty());
+}
+
+QBDI_NOINLINE QBDI::rword budgetLoop(QBDI::rword n) {
+  volatile QBDI::rword acc = 0;
+  for (QBDI::rword i = 0; i < n; i++) {
+    if (i % 3 == 0) {
+      acc = acc + i;
+    } else {
+      acc = acc ^ (i << 2);
+    }
+  }
+  return acc;
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-InstructionBudget") {
+  REQUIRE(vm.getInstructionBudget() == 0);
+
+  // the reference records the address of each executed instruction
+  std::vector<QBDI::rword> trace;
+  uint32_t cbId = vm.addCodeCB(
+      QBDI::PREINST,
+      [&](QBDI::VMInstanceRef vm, QBDI::GPRState *gprState, QBDI::FPRState *) {
+        trace.push_back(QBDI_GPR_GET(gprState, QBDI::REG_PC));
+        return QBDI::VMAction::CONTINUE;
+      });
+  REQUIRE(cbId != QBDI::INVALID_EVENTID);
+
+  bool instrumented = vm.addInstrumentedModuleFromAddr(
+      reinterpret_cast<QBDI::rword>(budgetLoop));
+  REQUIRE(instrumented);
+  QBDI::GPRState initial = *vm.getGPRState();
+  QBDI::rword retval;
+  bool ran =
+      vm.call(&retval, reinterpret_cast<QBDI::rword>(budgetLoop), {100});
+  REQUIRE(ran);
+  const QBDI::rword expected = retval;
+  const std::vector<QBDI::rword> reference = trace;
+  const QBDI::rword total = reference.size();
+  REQUIRE(total > 100);
+
+  // a large budget is a counter of the executed instructions
+  REQUIRE(vm.setInstructionBudget(10 * total));
+  trace.clear();
+  vm.setGPRState(&initial);
+  ran = vm.call(&retval, reinterpret_cast<QBDI::rword>(budgetLoop), {100});
+  REQUIRE(ran);
+  CHECK(retval == expected);
+  CHECK(trace.size() == total);
+  CHECK(vm.getInstructionBudget() == 9 * total);
+
+  // the run stops before the first instruction over the budget
+  for (QBDI::rword budget :
+       {(QBDI::rword)1, (QBDI::rword)2, total / 3, total / 2, total - 1}) {
+    REQUIRE(vm.setInstructionBudget(budget));
+    trace.clear();
+    vm.setGPRState(&initial);
+    ran = vm.call(&retval, reinterpret_cast<QBDI::rword>(budgetLoop), {100});
+    REQUIRE(ran);
+    CHECK(trace.size() == budget);
+    CHECK(vm.getInstructionBudget() == 0);
+    CHECK(QBDI_GPR_GET(vm.getGPRState(), QBDI::REG_PC) == reference[budget]);
+  }
+
+  // a budget of all the instructions doesn't stop the call
+  REQUIRE(vm.setInstructionBudget(total));
+  trace.clear();
+  vm.setGPRState(&initial);
+  ran = vm.call(&retval, reinterpret_cast<QBDI::rword>(budgetLoop), {100});
+  REQUIRE(ran);
+  CHECK(retval == expected);
+  CHECK(trace.size() == total);
+  CHECK(vm.getInstructionBudget() == 0);
+
+  // an exhausted budget stops on the first instruction
+  trace.clear();
+  vm.setGPRState(&initial);
+  vm.call(&retval, reinterpret_cast<QBDI::rword>(budgetLoop), {100});
+  CHECK(trace.empty());
+  CHECK(QBDI_GPR_GET(vm.getGPRState(), QBDI::REG_PC) == reference[0]);
+
+  // disabled, the call is complete
+  REQUIRE(vm.setInstructionBudget(0));
+  trace.clear();
+  vm.setGPRState(&initial);
+  ran = vm.call(&retval, reinterpret_cast<QBDI::rword>(budgetLoop), {100});
+  REQUIRE(ran);
+  CHECK(retval == expected);
+  CHECK(trace.size() == total);
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-RunFor") {
+  const QBDI::rword retAddr = 42;
+  bool instrumented = vm.addInstrumentedModuleFromAddr(
+      reinterpret_cast<QBDI::rword>(budgetLoop));
+  REQUIRE(instrumented);
+  QBDI::GPRState initial = *vm.getGPRState();
+
+  // two tasks run budgetLoop with a context each
+  QBDI::GPRState tasks[2] = {initial, initial};
+  // the stacks of the tasks must not overlap
+  QBDI_GPR_SET(&tasks[1], QBDI::REG_SP,
+               QBDI_GPR_GET(&tasks[1], QBDI::REG_SP) - 0x800);
+  QBDI::simulateCall(&tasks[0], retAddr, {100});
+  QBDI::simulateCall(&tasks[1], retAddr, {50});
+  for (QBDI::GPRState &task : tasks) {
+    QBDI_GPR_SET(&task, QBDI::REG_PC,
+                 reinterpret_cast<QBDI::rword>(budgetLoop));
+  }
+
+  bool finished[2] = {false, false};
+  unsigned nbSlices = 0;
+  QBDI::rword flushCount = 0;
+  while (not finished[0] or not finished[1]) {
+    for (int t = 0; t < 2; t++) {
+      if (finished[t]) {
+        continue;
+      }
+      vm.setGPRState(&tasks[t]);
+      QBDI::SliceStatus status = vm.runFor(retAddr, 20);
+      REQUIRE(status != QBDI::SliceStatus::SLICE_NOT_RUN);
+      REQUIRE(status != QBDI::SliceStatus::SLICE_STOPPED);
+      tasks[t] = *vm.getGPRState();
+      finished[t] = (status == QBDI::SliceStatus::SLICE_FINISHED);
+      // only the first slice flushes the cache
+      if (nbSlices++ == 0) {
+        flushCount = vm.getCacheStats().flushCount;
+      }
+      CHECK(vm.getCacheStats().flushCount == flushCount);
+    }
+  }
+  CHECK(nbSlices > 10);
+  CHECK(QBDI_GPR_GET(&tasks[0], QBDI::REG_RETURN) == budgetLoop(100));
+  CHECK(QBDI_GPR_GET(&tasks[1], QBDI::REG_RETURN) == budgetLoop(50));
+
+  // the slices don't limit the next runs
+  CHECK(vm.getInstructionBudget() == 0);
+  QBDI::rword retval;
+  vm.setGPRState(&initial);
+  bool ran = vm.call(&retval, reinterpret_cast<QBDI::rword>(budgetLoop), {100});
+  REQUIRE(ran);
+  CHECK(retval == budgetLoop(100));
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-SingleStep") {
+  const QBDI::rword retAddr = 42;
+  bool instrumented = vm.addInstrumentedModuleFromAddr(
+      reinterpret_cast<QBDI::rword>(budgetLoop));
+  REQUIRE(instrumented);
+  QBDI::GPRState initial = *vm.getGPRState();
+  QBDI::simulateCall(&initial, retAddr, {30});
+  QBDI_GPR_SET(&initial, QBDI::REG_PC,
+               reinterpret_cast<QBDI::rword>(budgetLoop));
+
+  // the reference is the list of the addresses of the instructions
+  std::vector<QBDI::rword> expected;
+  uint32_t cbId = vm.addCodeCB(
+      QBDI::PREINST,
+      [&](QBDI::VMInstanceRef vm, QBDI::GPRState *gprState, QBDI::FPRState *) {
+        expected.push_back(QBDI_GPR_GET(gprState, QBDI::REG_PC));
+        return QBDI::VMAction::CONTINUE;
+      });
+  REQUIRE(cbId != QBDI::INVALID_EVENTID);
+  vm.setGPRState(&initial);
+  bool ran = vm.run(reinterpret_cast<QBDI::rword>(budgetLoop), retAddr);
+  REQUIRE(ran);
+  vm.deleteInstrumentation(cbId);
+
+  // the option is needed and clears the chaining
+  vm.setGPRState(&initial);
+  CHECK_FALSE(vm.step());
+  vm.setOptions(vm.getOptions() | QBDI::Options::OPT_SINGLE_STEP |
+                QBDI::Options::OPT_ENABLE_BLOCK_CHAINING);
+  CHECK((vm.getOptions() & QBDI::Options::OPT_ENABLE_BLOCK_CHAINING) == 0);
+
+  std::vector<QBDI::rword> steps;
+  while (QBDI_GPR_GET(vm.getGPRState(), QBDI::REG_PC) != retAddr and
+         steps.size() <= expected.size()) {
+    steps.push_back(QBDI_GPR_GET(vm.getGPRState(), QBDI::REG_PC));
+    REQUIRE(vm.step());
+  }
+  CHECK(steps == expected);
+  CHECK(QBDI_GPR_GET(vm.getGPRState(), QBDI::REG_RETURN) == budgetLoop(30));
+
+  // run still executes the sequences of one instruction
+  QBDI::rword retval;
+  ran = vm.call(&retval, reinterpret_cast<QBDI::rword>(budgetLoop), {30});
+  REQUIRE(ran);
+  CHECK(retval == budgetLoop(30));
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-Observer") {
+  std::vector<QBDI::rword> expected;
+  uint32_t cbId = vm.addCodeCB(
+      QBDI::PREINST,
+      [&](QBDI::VMInstanceRef vm, QBDI::GPRState *gprState, QBDI::FPRState *) {
+        expected.push_back(QBDI_GPR_GET(gprState, QBDI::REG_PC));
+        return QBDI::VMAction::CONTINUE;
+      });
+  REQUIRE(cbId != QBDI::INVALID_EVENTID);
+  QBDI::rword retval;
+  bool ran = vm.call(&retval, reinterpret_cast<QBDI::rword>(budgetLoop), {20});
+  REQUIRE(ran);
+  vm.deleteInstrumentation(cbId);
+  REQUIRE_FALSE(expected.empty());
+
+  // a single worker keeps the order of the instructions
+  // the callback runs in a worker thread, the checks are done after flush
+  std::vector<QBDI::rword> observed;
+  bool onlyObserved = true;
+  {
+    QBDI::Observer observer(
+        [&](const QBDI::ObservedState &state) {
+          observed.push_back(state.address);
+          onlyObserved = onlyObserved and
+                         QBDI_GPR_GET(&state.gprState, QBDI::REG_SP) != 0 and
+                         QBDI_GPR_GET(&state.gprState, QBDI::REG_RETURN) == 0;
+        },
+        1 << QBDI::REG_SP, false, 1, 16);
+    REQUIRE(observer.attach(vm) != QBDI::INVALID_EVENTID);
+    ran = vm.call(&retval, reinterpret_cast<QBDI::rword>(budgetLoop), {20});
+    REQUIRE(ran);
+    observer.flush();
+    CHECK(observed == expected);
+    CHECK(onlyObserved);
+    vm.deleteAllInstrumentations();
+  }
+
+  // the states are distributed to the workers
+  std::atomic<size_t> count{0};
+  QBDI::Observer observer(
+      [&count](const QBDI::ObservedState &) {
+        count.fetch_add(1, std::memory_order_relaxed);
+      },
+      0, false, 4, 16);
+  REQUIRE(observer.attach(vm) != QBDI::INVALID_EVENTID);
+  ran = vm.call(&retval, reinterpret_cast<QBDI::rword>(budgetLoop), {20});
+  REQUIRE(ran);
+  CHECK(retval == budgetLoop(20));
+  observer.flush();
+  CHECK(count.load() == expected.size());
+  vm.deleteAllInstrumentations();
+}
+
+QBDI_NOINLINE QBDI::rword exitOdd(QBDI::rword v) { return v + 1; }
+
+QBDI_NOINLINE QBDI::rword exitEven(QBDI::rword v) { return v * 2; }
+
+QBDI_NOINLINE QBDI::rword multiExit(QBDI::rword n) {
+  volatile QBDI::rword acc = n;
+  for (QBDI::rword i = 0; i < n; i++) {
+    acc = acc + i;
+  }
+  if (acc & 1) {
+    return exitOdd(acc);
+  }
+  return exitEven(acc);
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-RunUntil") {
+  vm.setOptions(vm.getOptions() | QBDI::Options::OPT_ENABLE_BLOCK_CHAINING);
+  bool instrumented = vm.addInstrumentedModuleFromAddr(
+      reinterpret_cast<QBDI::rword>(multiExit));
+  REQUIRE(instrumented);
+  const QBDI::rword fakeRet = 42;
+  const QBDI::rword odd = reinterpret_cast<QBDI::rword>(exitOdd);
+  const QBDI::rword even = reinterpret_cast<QBDI::rword>(exitEven);
+  QBDI::GPRState initial = *vm.getGPRState();
+
+  // the second round runs the cached and linked sequences
+  for (int round = 0; round < 2; round++) {
+    // 5 + 10 is odd, 4 + 6 is even
+    for (QBDI::rword n : {(QBDI::rword)5, (QBDI::rword)4}) {
+      vm.setGPRState(&initial);
+      QBDI::simulateCall(vm.getGPRState(), fakeRet, {n});
+      bool ran = vm.runUntil(reinterpret_cast<QBDI::rword>(multiExit),
+                             {fakeRet, odd, even});
+      REQUIRE(ran);
+      CHECK(QBDI_GPR_GET(vm.getGPRState(), QBDI::REG_PC) ==
+            ((n == 5) ? odd : even));
+    }
+  }
+
+  // without the exits in the stops, the call is complete
+  vm.setGPRState(&initial);
+  QBDI::simulateCall(vm.getGPRState(), fakeRet, {5});
+  bool ran =
+      vm.runUntil(reinterpret_cast<QBDI::rword>(multiExit), {fakeRet});
+  REQUIRE(ran);
+  CHECK(QBDI_GPR_GET(vm.getGPRState(), QBDI::REG_PC) == fakeRet);
+  CHECK(QBDI_GPR_GET(vm.getGPRState(), QBDI::REG_RETURN) == multiExit(5));
+}
+
+static std::atomic<QBDI::rword> stopProgress{0};
+
+QBDI_NOINLINE QBDI::rword stopLoop(QBDI::rword n) {
+  volatile QBDI::rword acc = 0;
+  for (QBDI::rword i = 0; i < n; i++) {
+    acc = acc + (i ^ (acc >> 3));
+    stopProgress.store(i + 1, std::memory_order_relaxed);
+  }
+  return acc;
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-RequestStop") {
+  // the sequences of the loop are linked, the execution doesn't return to
+  // the VM between them
+  vm.setOptions(vm.getOptions() | QBDI::Options::OPT_ENABLE_BLOCK_CHAINING);
+  bool instrumented = vm.addInstrumentedModuleFromAddr(
+      reinterpret_cast<QBDI::rword>(stopLoop));
+  REQUIRE(instrumented);
+  QBDI::GPRState initial = *vm.getGPRState();
+  QBDI::rword retval;
+
+  // a request made before the run stops it before the first instruction
+  vm.requestStop();
+  stopProgress = 0;
+  bool ran = vm.call(&retval, reinterpret_cast<QBDI::rword>(stopLoop), {10});
+  CHECK_FALSE(ran);
+  CHECK(stopProgress == 0);
+  CHECK(QBDI_GPR_GET(vm.getGPRState(), QBDI::REG_PC) ==
+        reinterpret_cast<QBDI::rword>(stopLoop));
+
+  // the request is cleared by the stop
+  vm.setGPRState(&initial);
+  ran = vm.call(&retval, reinterpret_cast<QBDI::rword>(stopLoop), {10});
+  REQUIRE(ran);
+  CHECK(stopProgress == 10);
+
+  // a watchdog thread stops the loop, tested by the generated code
+  REQUIRE(vm.setStopPolling(true));
+  static const QBDI::rword iterations = 1 << 26;
+  stopProgress = 0;
+  std::thread watchdog([this] {
+    while (stopProgress.load() < 1000) {
+      std::this_thread::yield();
+    }
+    vm.requestStop();
+  });
+  vm.setGPRState(&initial);
+  ran = vm.call(&retval, reinterpret_cast<QBDI::rword>(stopLoop),
+                {iterations});
+  watchdog.join();
+  REQUIRE(ran);
+  CHECK(stopProgress >= 1000);
+  CHECK(stopProgress < iterations);
+
+  // the polling disabled, the call is complete
+  REQUIRE(vm.setStopPolling(false));
+  vm.setGPRState(&initial);
+  ran = vm.call(&retval, reinterpret_cast<QBDI::rword>(stopLoop), {10});
+  REQUIRE(ran);
+  CHECK(stopProgress == 10);
+}
+
+#if defined(QBDI_PLATFORM_LINUX) || defined(QBDI_PLATFORM_ANDROID)
+QBDI_DISABLE_ASAN QBDI_NOINLINE QBDI::rword sampledLoop(QBDI::rword n) {
+  volatile QBDI::rword acc = 0;
+  for (QBDI::rword i = 0; i < n; i++) {
+    acc = acc + (i ^ (acc >> 3));
+  }
+  return acc;
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-HardwareSampling") {
+  REQUIRE(vm.getHardwareSamples().empty());
+  if (not vm.setHardwareSampling(QBDI::SAMPLE_INSTRUCTIONS, 10000)) {
+    // the hardware counters may be unavailable (perf_event_paranoid, VM)
+    WARN("perf_event_open is unavailable, the test is skipped");
+    return;
+  }
+  bool instrumented = vm.addInstrumentedModuleFromAddr(
+      reinterpret_cast<QBDI::rword>(sampledLoop));
+  REQUIRE(instrumented);
+
+  QBDI::rword retval;
+  bool ran = vm.call(&retval, reinterpret_cast<QBDI::rword>(sampledLoop),
+                     {1000000});
+  REQUIRE(ran);
+  REQUIRE(retval == sampledLoop(1000000));
+
+  // the samples in the ExecBlocks are attributed to the original code
+  std::vector<QBDI::HardwareSample> samples = vm.getHardwareSamples();
+  REQUIRE(not samples.empty());
+  uint64_t inLoop = 0;
+  for (const QBDI::HardwareSample &sample : samples) {
+    if (sample.address >= reinterpret_cast<QBDI::rword>(sampledLoop) and
+        sample.address < reinterpret_cast<QBDI::rword>(sampledLoop) + 0x100) {
+      inLoop += sample.samples;
+    }
+  }
+  CHECK(inLoop > 0);
+  for (size_t i = 1; i < samples.size(); i++) {
+    CHECK(samples[i - 1].samples >= samples[i].samples);
+  }
+
+  vm.resetHardwareSamples();
+  CHECK(vm.getHardwareSamples().empty());
+  REQUIRE(vm.setHardwareSampling(QBDI::SAMPLE_INSTRUCTIONS, 0));
+  ran = vm.call(&retval, reinterpret_cast<QBDI::rword>(sampledLoop), {1000});
+  REQUIRE(ran);
+  CHECK(vm.getHardwareSamples().empty());
+}
+#endif
+
+#if defined(QBDI_ARCH_X86_64)
+static QBDI::VMAction countTransfer(QBDI::VMInstanceRef vm,
+                                    const QBDI::VMState *state,
+                                    QBDI::GPRState *gprState,
+                                    QBDI::FPRState *fprState, void *data) {
+  *static_cast<int *>(data) += 1;
+  return QBDI::VMAction::CONTINUE;
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-ExecTransferReturnPoint") {
+  // the return address is below the values pushed before the jump to the
+  // native function
+  InMemoryObject nativeObj("addq $32, %rsp\n"
+                           "movq $41, %rax\n"
+                           "ret\n");
+  QBDI::rword native = (QBDI::rword)nativeObj.getCode().data();
+  QBDI::rword addr = genASM("callq 1f\n"
+                            "addq $1, %rax\n"
+                            "ret\n"
+                            "1:\n"
+                            "pushq $0\n"
+                            "pushq $0\n"
+                            "pushq $0\n"
+                            "pushq $0\n"
+                            "jmpq *%rdi\n");
+
+  int transfer = 0;
+  uint32_t id = vm.addVMEventCB(QBDI::VMEvent::EXEC_TRANSFER_CALL,
+                                countTransfer, &transfer);
+  REQUIRE(id != QBDI::INVALID_EVENTID);
+
+  QBDI::rword retval = 0;
+  REQUIRE(vm.call(&retval, addr, {native}));
+  REQUIRE(retval == 42);
+  REQUIRE(transfer == 1);
+}
+
+static QBDI::VMAction countInc(QBDI::VMInstanceRef vm,
+                               QBDI::GPRState *gprState,
+                               QBDI::FPRState *fprState, void *data) {
+  *static_cast<int *>(data) += 1;
+  return QBDI::VMAction::CONTINUE;
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-ExecTransferReentry") {
+  // the native function calls its argument twice
+  InMemoryObject nativeObj("pushq %r12\n"
+                           "movq %rdi, %r12\n"
+                           "callq *%r12\n"
+                           "callq *%r12\n"
+                           "popq %r12\n"
+                           "ret\n");
+  QBDI::rword native = (QBDI::rword)nativeObj.getCode().data();
+  QBDI::rword addr = genASM("pushq %rbx\n"
+                            "xorq %rbx, %rbx\n"
+                            "movq %rdi, %rax\n"
+                            "leaq 1f(%rip), %rdi\n"
+                            "callq *%rax\n"
+                            "movq %rbx, %rax\n"
+                            "popq %rbx\n"
+                            "ret\n"
+                            "1:\n"
+                            "incq %rbx\n");
+
+  int inc = 0;
+  uint32_t id = vm.addMnemonicCB("INC*", QBDI::PREINST, countInc, &inc);
+  REQUIRE(id != QBDI::INVALID_EVENTID);
+
+  // without the option, the callback is executed natively
+  QBDI::rword retval = 0;
+  REQUIRE(vm.call(&retval, addr, {native}));
+  REQUIRE(retval == 2);
+  REQUIRE(inc == 0);
+
+  vm.setOptions(vm.getOptions() | QBDI::Options::OPT_ENABLE_REENTRY);
+  retval = 0;
+  REQUIRE(vm.call(&retval, addr, {native}));
+  REQUIRE(retval == 2);
+  REQUIRE(inc == 2);
+
+  // the trampoline is reused
+  inc = 0;
+  REQUIRE(vm.call(&retval, addr, {native}));
+  REQUIRE(retval == 2);
+  REQUIRE(inc == 2);
+}
+
+#if !defined(QBDI_PLATFORM_WINDOWS)
+TEST_CASE_METHOD(APITest, "VMTest-ExecTransferReentryQsort") {
+  // qsort(array, count, sizeof(int), cmp) with an instrumented comparator
+  QBDI::rword addr = genASM("pushq %rbx\n"
+                            "movq %rdx, %rax\n"
+                            "movq $4, %rdx\n"
+                            "leaq 1f(%rip), %rcx\n"
+                            "callq *%rax\n"
+                            "popq %rbx\n"
+                            "ret\n"
+                            "1:\n"
+                            "movl (%rdi), %eax\n"
+                            "subl (%rsi), %eax\n"
+                            "ret\n");
+
+  int cmp = 0;
+  uint32_t id = vm.addMnemonicCB("SUB32rm", QBDI::PREINST, countInc, &cmp);
+  REQUIRE(id != QBDI::INVALID_EVENTID);
+
+  const int values[] = {5, 3, 9, 1, 7, 2, 8, 6, 4, 0};
+  const size_t count = sizeof(values) / sizeof(values[0]);
+  int array[count];
+  auto sort = [&]() {
+    std::copy(values, values + count, array);
+    REQUIRE(vm.call(nullptr, addr,
+                    {reinterpret_cast<QBDI::rword>(array), count,
+                     reinterpret_cast<QBDI::rword>(qsort)}));
+    CHECK(std::is_sorted(array, array + count));
+  };
+
+  // without the option, the comparator is executed natively
+  sort();
+  CHECK(cmp == 0);
+
+  // each call of the comparator by qsort enters the VM again
+  vm.setOptions(vm.getOptions() | QBDI::Options::OPT_ENABLE_REENTRY);
+  sort();
+  CHECK(cmp >= static_cast<int>(count - 1));
+  int calls = cmp;
+
+  cmp = 0;
+  sort();
+  CHECK(cmp == calls);
+}
+#endif
+
+#if defined(QBDI_PLATFORM_LINUX)
+struct SyscallData {
+  int entry;
+  int exit;
+  QBDI::rword number;
+  QBDI::rword result;
+};
+
+static QBDI::VMAction checkSyscall(QBDI::VMInstanceRef vm,
+                                   const QBDI::VMState *state,
+                                   QBDI::GPRState *gprState,
+                                   QBDI::FPRState *fprState, void *data_) {
+  SyscallData *data = static_cast<SyscallData *>(data_);
+  if (state->event & QBDI::SYSCALL_ENTRY) {
+    CHECK(data->entry == data->exit);
+    data->entry++;
+  } else if (state->event & QBDI::SYSCALL_EXIT) {
+    CHECK(data->entry == data->exit + 1);
+    data->exit++;
+    data->result = gprState->rax;
+  }
+  data->number = state->syscallNumber;
+  return QBDI::VMAction::CONTINUE;
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-VMEvent_Syscall") {
+  // getpid
+  QBDI::rword addr = genASM("movq $39, %rax\n"
+                            "syscall\n");
+
+  SyscallData data{0, 0, 0, 0};
+  uint32_t id = vm.addVMEventCB(QBDI::SYSCALL_ENTRY | QBDI::SYSCALL_EXIT,
+                                checkSyscall, &data);
+  REQUIRE(id != QBDI::INVALID_EVENTID);
+
+  QBDI::rword retval = 0;
+  REQUIRE(vm.call(&retval, addr));
+  CHECK(data.entry == 1);
+  CHECK(data.exit == 1);
+  CHECK(data.number == 39);
+  CHECK(data.result == retval);
+
+  // the instrumentation of the system call is removed with the callback
+  REQUIRE(vm.deleteInstrumentation(id));
+  REQUIRE(vm.call(&retval, addr));
+  CHECK(data.entry == 1);
+  CHECK(data.exit == 1);
+}
+#endif
+
+TEST_CASE_METHOD(APITest, "VMTest-AVXUpperHalves") {
+  if (not QBDI::isHostCPUFeaturePresent("avx")) {
+    WARN("Host doesn't support avx feature: SKIP");
+    return;
+  }
+  const uint8_t upper[16] = {0x41, 0x6a, 0xc4, 0x1e, 0x14, 0xa9, 0x5d, 0x27,
+                             0x67, 0x4f, 0x91, 0x6e, 0x4b, 0x57, 0x4d, 0xc9};
+  const uint8_t zero[16] = {0};
+
+  // a VEX instruction clears the upper half of its XMM destination
+  QBDI::rword addr = genASM("vmovaps %xmm0, %xmm1\n"
+                            "vmovaps %xmm8, %xmm2\n");
+
+  QBDI::FPRState *fstate = vm.getFPRState();
+  memcpy(fstate->ymm1, upper, sizeof(upper));
+  memcpy(fstate->ymm2, upper, sizeof(upper));
+  memcpy(fstate->ymm9, upper, sizeof(upper));
+  vm.setFPRState(fstate);
+
+  QBDI::rword retval;
+  REQUIRE(vm.call(&retval, addr));
+  CHECK(memcmp(fstate->ymm1, zero, sizeof(zero)) == 0);
+  CHECK(memcmp(fstate->ymm2, zero, sizeof(zero)) == 0);
+  // the upper half of YMM9 isn't touched by the sequence
+  CHECK(memcmp(fstate->ymm9, upper, sizeof(upper)) == 0);
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-Liveness") {
+  // RCX, RDX and the flags are overwritten before being read
+  QBDI::rword addr = genASM("movq %rdi, -8(%rsp)\n"
+                            "movq %rsi, -16(%rsp)\n"
+                            "movq -8(%rsp), %rcx\n"
+                            "movq -16(%rsp), %rdx\n"
+                            "xorq %rax, %rax\n"
+                            "addq %rcx, %rax\n"
+                            "adcq %rdx, %rax\n");
+
+  int count = 0;
+  REQUIRE(vm.addMemAccessCB(QBDI::MEMORY_READ_WRITE, countInc, &count) !=
+          QBDI::INVALID_EVENTID);
+
+  QBDI::rword retval;
+  REQUIRE(vm.call(&retval, addr, {20, 22}));
+  CHECK(retval == 42);
+  int firstCount = count;
+  CHECK(firstCount > 0);
+  QBDI::rword size = vm.getCacheStats().translationSize;
+
+  // the instrumentation of the memory accesses doesn't save the dead
+  // registers
+  vm.setOptions(vm.getOptions() | QBDI::Options::OPT_ENABLE_LIVENESS);
+  QBDI::rword retval2;
+  REQUIRE(vm.call(&retval2, addr, {20, 22}));
+  CHECK(retval2 == 42);
+  CHECK(count == 2 * firstCount);
+  CHECK(vm.getCacheStats().translationSize - size < size);
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-NearExecBlock") {
+  QBDI::rword addr = genASM("leaq 0x1234(%rip), %rax\n"
+                            "movq (%rip), %rdx\n"
+                            "addq %rdx, %rax\n");
+  // the LEA and the MOV are 7 bytes long
+  QBDI::rword expected =
+      addr + 7 + 0x1234 + *reinterpret_cast<const uint64_t *>(addr + 14);
+
+  QBDI::rword retval;
+  REQUIRE(vm.call(&retval, addr));
+  CHECK(retval == expected);
+  QBDI::rword size = vm.getCacheStats().translationSize;
+
+  // the memory operands keep RIP instead of a temporary register
+  vm.setOptions(vm.getOptions() | QBDI::Options::OPT_ENABLE_NEAR_EXECBLOCK);
+  QBDI::rword retval2;
+  REQUIRE(vm.call(&retval2, addr));
+  CHECK(retval2 == expected);
+  CHECK(vm.getCacheStats().translationSize < size);
+}
+#endif
+
+struct CheckBasicBlockData {
+  bool waitingEnd;
+  QBDI::rword BBStart;
+  QBDI::rword BBEnd;
+  size_t count;
+};
+
+static QBDI::VMAction checkBasicBlock(QBDI::VMInstanceRef vm,
+                                      const QBDI::VMState *vmState,
+                                      QBDI::GPRState *gprState,
+                                      QBDI::FPRState *fprState, void *data_) {
+  CheckBasicBlockData *data = static_cast<CheckBasicBlockData *>(data_);
+  CHECK((vmState->event & (QBDI::BASIC_BLOCK_ENTRY | QBDI::BASIC_BLOCK_EXIT)) !=
+        0);
+  CHECK((vmState->event & (QBDI::BASIC_BLOCK_ENTRY | QBDI::BASIC_BLOCK_EXIT)) !=
+        (QBDI::BASIC_BLOCK_ENTRY | QBDI::BASIC_BLOCK_EXIT));
+  if (vmState->event & QBDI::BASIC_BLOCK_ENTRY) {
+    CHECK_FALSE(data->waitingEnd);
+    CHECK(vmState->basicBlockStart == vmState->sequenceStart);
+    *data = {true, vmState->basicBlockStart, vmState->basicBlockEnd,
+             data->count};
+  } else if (vmState->event & QBDI::BASIC_BLOCK_EXIT) {
+    CHECK(data->waitingEnd);
+    CHECK(data->BBStart == vmState->basicBlockStart);
+    CHECK(data->BBEnd == vmState->basicBlockEnd);
+    CHECK(vmState->basicBlockEnd == vmState->sequenceEnd);
+    data->waitingEnd = false;
+    data->count++;
+  }
+  return QBDI::VMAction::CONTINUE;
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-VMEvent_BasicBlock") {
+  CheckBasicBlockData data{false, 0, 0, 0};
+  vm.addVMEventCB(QBDI::BASIC_BLOCK_ENTRY | QBDI::BASIC_BLOCK_EXIT,
+                  checkBasicBlock, &data);
+
+  // backup GPRState to have the same state before each run
+  QBDI::GPRState backup = *(vm.getGPRState());
+
+  for (QBDI::rword j = 0; j < 4; j++) {
+    for (QBDI::rword i = 0; i < 8; i++) {
+      QBDI_DEBUG("Begin Loop iteration {} {}", j, i);
+      vm.setGPRState(&backup);
+
+      data.waitingEnd = false;
+      data.count = 0;
+      QBDI::rword retval;
+      bool ran =
+          vm.call(&retval, reinterpret_cast<QBDI::rword>(dummyFunBB),
+                  {i ^ j, 5, 13, reinterpret_cast<QBDI::rword>(dummyFun1),
+                   reinterpret_cast<QBDI::rword>(dummyFun1),
+                   reinterpret_cast<QBDI::rword>(dummyFun1)});
+      CHECK(ran);
+      CHECK_FALSE(data.waitingEnd);
+      CHECK(data.count != 0);
+    }
+    vm.clearAllCache();
+  }
+}
+
+struct DispatchRecord {
+  int id;
+  std::vector<int> *order;
+};
+
+static QBDI::VMAction recordDispatch(QBDI::VMInstanceRef vm,
+                                     const QBDI::VMState *vmState,
+                                     QBDI::GPRState *gprState,
+                                     QBDI::FPRState *fprState, void *data) {
+  DispatchRecord *r = static_cast<DispatchRecord *>(data);
+  r->order->push_back(r->id);
+  return QBDI::VMAction::CONTINUE;
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-VMEvent_Dispatch") {
+  std::vector<int> order;
+  DispatchRecord r0{0, &order};
+  DispatchRecord r1{1, &order};
+  DispatchRecord r2{2, &order};
+
+  // SEQUENCE_EXIT | BASIC_BLOCK_EXIT is signaled at once at the end of a
+  // basic block, each callback must be called once in the registration order
+  vm.addVMEventCB(QBDI::SEQUENCE_EXIT | QBDI::BASIC_BLOCK_EXIT, recordDispatch,
+                  &r0);
+  uint32_t id1 = vm.addVMEventCB(QBDI::SEQUENCE_EXIT, recordDispatch, &r1);
+  REQUIRE(id1 != QBDI::INVALID_EVENTID);
+  vm.addVMEventCB(QBDI::BASIC_BLOCK_EXIT, recordDispatch, &r2);
+
+  QBDI::GPRState backup = *(vm.getGPRState());
+  QBDI::rword retval;
+  bool ran = vm.call(&retval, reinterpret_cast<QBDI::rword>(dummyFunBB),
+                     {5, 5, 13, reinterpret_cast<QBDI::rword>(dummyFun1),
+                      reinterpret_cast<QBDI::rword>(dummyFun1),
+                      reinterpret_cast<QBDI::rword>(dummyFun1)});
+  REQUIRE(ran);
+  REQUIRE(order.size() > 0);
+  for (size_t i = 0; i < order.size(); i++) {
+    if (order[i] == 0) {
+      REQUIRE(i + 1 < order.size());
+      CHECK(order[i + 1] == 1);
+    } else if (order[i] == 1) {
+      CHECK(i > 0);
+      CHECK(order[i - 1] == 0);
+    } else {
+      CHECK(order[i] == 2);
+      CHECK(i > 1);
+      CHECK(order[i - 1] == 1);
+    }
+  }
+
+  // the deleted callback is removed from the dispatch of both events
+  REQUIRE(vm.deleteInstrumentation(id1));
+  order.clear();
+  vm.setGPRState(&backup);
+  ran = vm.call(&retval, reinterpret_cast<QBDI::rword>(dummyFunBB),
+                {5, 5, 13, reinterpret_cast<QBDI::rword>(dummyFun1),
+                 reinterpret_cast<QBDI::rword>(dummyFun1),
+                 reinterpret_cast<QBDI::rword>(dummyFun1)});
+  REQUIRE(ran);
+  REQUIRE(order.size() > 0);
+  for (int id : order) {
+    CHECK(id != 1);
+  }
+}
+
+struct LateEventData {
+  uint32_t id;
+  uint32_t count;
+};
+
+static QBDI::VMAction countLateEvent(QBDI::VMInstanceRef vm,
+                                     const QBDI::VMState *vmState,
+                                     QBDI::GPRState *gprState,
+                                     QBDI::FPRState *fprState, void *data) {
+  static_cast<LateEventData *>(data)->count++;
+  return QBDI::VMAction::CONTINUE;
+}
+
+static QBDI::VMAction addLateEvent(QBDI::VMInstanceRef vm,
+                                   QBDI::GPRState *gprState,
+                                   QBDI::FPRState *fprState, void *data) {
+  LateEventData *d = static_cast<LateEventData *>(data);
+  if (d->id == QBDI::INVALID_EVENTID) {
+    d->id = vm->addVMEventCB(QBDI::SEQUENCE_ENTRY, countLateEvent, d);
   }
   return QBDI::VMAction::CONTINUE;
 }
 
-TEST_CASE_METHOD(APITest, "VMTest-VMEvent_BasicBlock") {
-  CheckBasicBlockData data{false, 0, 0, 0};
-  vm.addVMEventCB(QBDI::BASIC_BLOCK_ENTRY | QBDI::BASIC_BLOCK_EXIT,
-                  checkBasicBlock, &data);
+TEST_CASE_METHOD(APITest, "VMTest-VMEvent_AddedDuringRun") {
+  LateEventData data{QBDI::INVALID_EVENTID, 0};
+  // the run starts in the dispatch loop without events
+  vm.addCodeAddrCB(reinterpret_cast<QBDI::rword>(dummyFun1), QBDI::PREINST,
+                   addLateEvent, &data);
 
-  // backup GPRState to have the same state before each run
   QBDI::GPRState backup = *(vm.getGPRState());
-
-  for (QBDI::rword j = 0; j < 4; j++) {
-    for (QBDI::rword i = 0; i < 8; i++) {
-      QBDI_DEBUG("Begin Loop iteration {} {}", j, i);
-      vm.setGPRState(&backup);
-
-      data.waitingEnd = false;
-      data.count = 0;
-      QBDI::rword retval;
-      bool ran =
-          vm.call(&retval, reinterpret_cast<QBDI::rword>(dummyFunBB),
-                  {i ^ j, 5, 13, reinterpret_cast<QBDI::rword>(dummyFun1),
-                   reinterpret_cast<QBDI::rword>(dummyFun1),
-                   reinterpret_cast<QBDI::rword>(dummyFun1)});
-      CHECK(ran);
-      CHECK_FALSE(data.waitingEnd);
-      CHECK(data.count != 0);
-    }
-    vm.clearAllCache();
-  }
+  QBDI::rword retval;
+  bool ran = vm.call(&retval, reinterpret_cast<QBDI::rword>(dummyFunBB),
+                     {5, 5, 13, reinterpret_cast<QBDI::rword>(dummyFun1),
+                      reinterpret_cast<QBDI::rword>(dummyFun1),
+                      reinterpret_cast<QBDI::rword>(dummyFun1)});
+  REQUIRE(ran);
+  REQUIRE(data.id != QBDI::INVALID_EVENTID);
+  // the sequences after the callback are signaled in the same run
+  CHECK(data.count > 0);
+
+  REQUIRE(vm.deleteInstrumentation(data.id));
+  uint32_t count = data.count;
+  vm.setGPRState(&backup);
+  ran = vm.call(&retval, reinterpret_cast<QBDI::rword>(dummyFunBB),
+                {5, 5, 13, reinterpret_cast<QBDI::rword>(dummyFun1),
+                 reinterpret_cast<QBDI::rword>(dummyFun1),
+                 reinterpret_cast<QBDI::rword>(dummyFun1)});
+  REQUIRE(ran);
+  CHECK(data.count == count);
 }
 
 TEST_CASE_METHOD(APITest, "VMTest-CacheInvalidation") {
@@ -503,6 +3007,130 @@ TEST_CASE_METHOD(APITest, "VMTest-CacheInvalidation") {
   REQUIRE((uint32_t)0 == count2);
 }
 
+struct NewBlockBatchData {
+  std::vector<QBDI::NewBasicBlockEntry> entries;
+  size_t batches = 0;
+};
+
+static QBDI::VMAction collectNewBlocks(QBDI::VMInstanceRef vm,
+                                       const QBDI::NewBasicBlockEntry *entries,
+                                       size_t count, void *data) {
+  NewBlockBatchData *batch = static_cast<NewBlockBatchData *>(data);
+  batch->entries.insert(batch->entries.end(), entries, entries + count);
+  batch->batches++;
+  return QBDI::VMAction::CONTINUE;
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-NewBasicBlockBatch") {
+  std::vector<std::pair<QBDI::rword, QBDI::rword>> expected;
+  NewBlockBatchData batch;
+
+  bool instrumented =
+      vm.addInstrumentedModuleFromAddr((QBDI::rword)&dummyFunCall);
+  REQUIRE(instrumented);
+  vm.addVMEventCB(QBDI::VMEvent::BASIC_BLOCK_NEW,
+                  [&expected](QBDI::VMInstanceRef, const QBDI::VMState *state,
+                              QBDI::GPRState *, QBDI::FPRState *) {
+                    expected.emplace_back(state->basicBlockStart,
+                                          state->basicBlockEnd);
+                    return QBDI::VMAction::CONTINUE;
+                  });
+  REQUIRE_FALSE(vm.setNewBasicBlockBatch(collectNewBlocks, &batch, 0));
+  REQUIRE(vm.setNewBasicBlockBatch(collectNewBlocks, &batch, 2));
+
+  QBDI::simulateCall(state, FAKE_RET_ADDR, {1, 2, 3, 4});
+  bool ran = vm.run((QBDI::rword)dummyFun4, (QBDI::rword)FAKE_RET_ADDR);
+  REQUIRE(ran);
+  REQUIRE(QBDI_GPR_GET(state, QBDI::REG_RETURN) == (QBDI::rword)10);
+  REQUIRE_FALSE(expected.empty());
+
+  // the same basic blocks as the events, the last ones at the end of the run
+  REQUIRE(batch.entries.size() == expected.size());
+  CHECK(batch.batches == (expected.size() + 1) / 2);
+  QBDI::rword moduleStart = batch.entries[0].moduleStart;
+  CHECK(moduleStart != 0);
+  CHECK(moduleStart <= (QBDI::rword)dummyFun4);
+  for (size_t i = 0; i < expected.size(); i++) {
+    CHECK(batch.entries[i].start == expected[i].first);
+    CHECK(batch.entries[i].end == expected[i].second);
+    CHECK(batch.entries[i].moduleStart == moduleStart);
+  }
+
+  // the cached basic blocks aren't given again
+  QBDI::simulateCall(state, FAKE_RET_ADDR, {1, 2, 3, 4});
+  ran = vm.run((QBDI::rword)dummyFun4, (QBDI::rword)FAKE_RET_ADDR);
+  REQUIRE(ran);
+  CHECK(batch.entries.size() == expected.size());
+
+  REQUIRE(vm.setNewBasicBlockBatch(nullptr, nullptr));
+  vm.clearAllCache();
+  QBDI::simulateCall(state, FAKE_RET_ADDR, {1, 2, 3, 4});
+  ran = vm.run((QBDI::rword)dummyFun4, (QBDI::rword)FAKE_RET_ADDR);
+  REQUIRE(ran);
+  CHECK(batch.entries.size() * 2 == expected.size());
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-RuleScopedInvalidation") {
+  uint32_t count = 0;
+  uint32_t newBlock = 0;
+
+  bool instrumented =
+      vm.addInstrumentedModuleFromAddr((QBDI::rword)&dummyFunCall);
+  REQUIRE(instrumented);
+  vm.addVMEventCB(QBDI::VMEvent::BASIC_BLOCK_NEW,
+                  [&newBlock](QBDI::VMInstanceRef, const QBDI::VMState *,
+                              QBDI::GPRState *, QBDI::FPRState *) {
+                    newBlock++;
+                    return QBDI::VMAction::CONTINUE;
+                  });
+
+  QBDI::simulateCall(state, FAKE_RET_ADDR, {1, 2, 3, 4});
+  bool ran = vm.run((QBDI::rword)dummyFun4, (QBDI::rword)FAKE_RET_ADDR);
+  REQUIRE(ran);
+  REQUIRE(QBDI_GPR_GET(state, QBDI::REG_RETURN) == (QBDI::rword)10);
+  REQUIRE(newBlock != 0);
+
+  // a rule that doesn't match any cached instruction keeps the cache
+  uint32_t instr = vm.addMnemonicCB("CPUID", QBDI::InstPosition::PREINST,
+                                    countInstruction, &count);
+  REQUIRE(instr != QBDI::INVALID_EVENTID);
+  newBlock = 0;
+  QBDI::simulateCall(state, FAKE_RET_ADDR, {1, 2, 3, 4});
+  ran = vm.run((QBDI::rword)dummyFun4, (QBDI::rword)FAKE_RET_ADDR);
+  REQUIRE(ran);
+  REQUIRE(QBDI_GPR_GET(state, QBDI::REG_RETURN) == (QBDI::rword)10);
+  REQUIRE(newBlock == 0);
+  REQUIRE(count == 0);
+
+  // the rule hasn't been applied, its removal keeps the cache
+  REQUIRE(vm.deleteInstrumentation(instr));
+  newBlock = 0;
+  QBDI::simulateCall(state, FAKE_RET_ADDR, {1, 2, 3, 4});
+  ran = vm.run((QBDI::rword)dummyFun4, (QBDI::rword)FAKE_RET_ADDR);
+  REQUIRE(ran);
+  REQUIRE(newBlock == 0);
+
+  // a rule that matches the cached instructions flushes them
+  instr = vm.addCodeCB(QBDI::InstPosition::PREINST, countInstruction, &count);
+  newBlock = 0;
+  QBDI::simulateCall(state, FAKE_RET_ADDR, {1, 2, 3, 4});
+  ran = vm.run((QBDI::rword)dummyFun4, (QBDI::rword)FAKE_RET_ADDR);
+  REQUIRE(ran);
+  REQUIRE(QBDI_GPR_GET(state, QBDI::REG_RETURN) == (QBDI::rword)10);
+  REQUIRE(newBlock != 0);
+  REQUIRE(count != 0);
+
+  // and its removal too
+  REQUIRE(vm.deleteInstrumentation(instr));
+  newBlock = 0;
+  count = 0;
+  QBDI::simulateCall(state, FAKE_RET_ADDR, {1, 2, 3, 4});
+  ran = vm.run((QBDI::rword)dummyFun4, (QBDI::rword)FAKE_RET_ADDR);
+  REQUIRE(ran);
+  REQUIRE(newBlock != 0);
+  REQUIRE(count == 0);
+}
+
 struct FunkyInfo {
   uint32_t instID;
   uint32_t count;
@@ -1755,3 +4383,770 @@ TEST_CASE_METHOD(APITest, "VMTest-SelfModifyingCode2") {
 
   SUCCEED();
 }
+
+TEST_CASE_METHOD(APITest, "VMTest-AnalyzeRange") {
+  QBDI::rword start = reinterpret_cast<QBDI::rword>(dummyFun4);
+  QBDI::InstAnalysis analyses[64];
+  QBDI::AnalysisType type = QBDI::ANALYSIS_INSTRUCTION |
+                            QBDI::ANALYSIS_DISASSEMBLY |
+                            QBDI::ANALYSIS_OPERANDS;
+
+  size_t nb = vm.analyzeRange(start, start + 4096, analyses, 64, type, true, 1);
+  REQUIRE(nb > 0);
+  REQUIRE(nb <= 64);
+  // the range isn't translated
+  CHECK(vm.getCachedInstAnalysis(start) == nullptr);
+  CHECK(analyses[nb - 1].affectControlFlow);
+
+  REQUIRE(vm.precacheBasicBlock(start));
+  QBDI::rword address = start;
+  for (size_t i = 0; i < nb; i++) {
+    const QBDI::InstAnalysis *cached = vm.getCachedInstAnalysis(address, type);
+    REQUIRE(cached != nullptr);
+    CHECK(analyses[i].address == address);
+    CHECK(analyses[i].instSize == cached->instSize);
+    CHECK(std::string(analyses[i].mnemonic) == cached->mnemonic);
+    CHECK(std::string(analyses[i].disassembly) == cached->disassembly);
+    CHECK(analyses[i].numOperands == cached->numOperands);
+    CHECK(analyses[i].operands != cached->operands);
+    address += analyses[i].instSize;
+  }
+
+  // the result doesn't depend on the number of threads
+  QBDI::InstAnalysis threaded[64];
+  size_t nb2 =
+      vm.analyzeRange(start, start + 4096, threaded, 64, type, true, 4);
+  REQUIRE(nb2 == nb);
+  for (size_t i = 0; i < nb; i++) {
+    CHECK(threaded[i].address == analyses[i].address);
+    CHECK(std::string(threaded[i].disassembly) == analyses[i].disassembly);
+  }
+
+  QBDI::VM::releaseAnalyses(analyses, nb);
+  QBDI::VM::releaseAnalyses(threaded, nb2);
+  CHECK(analyses[0].operands == nullptr);
+  CHECK(analyses[0].disassembly == nullptr);
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-InstHandle") {
+  QBDI::rword start = reinterpret_cast<QBDI::rword>(dummyFun4);
+
+  CHECK(vm.getCachedInstHandle(start) == 0);
+  CHECK(vm.getInstAnalysisByHandle(0) == nullptr);
+  REQUIRE(vm.precacheBasicBlock(start));
+
+  QBDI::InstHandle handle = vm.getCachedInstHandle(start);
+  REQUIRE(handle != 0);
+  const QBDI::InstAnalysis *ana = vm.getInstAnalysisByHandle(handle);
+  REQUIRE(ana != nullptr);
+  CHECK(ana == vm.getCachedInstAnalysis(start));
+  CHECK(ana->address == start);
+
+  // the handle of an instruction is stable while it is in the cache
+  QBDI::rword next = start + ana->instSize;
+  QBDI::InstHandle nextHandle = vm.getCachedInstHandle(next);
+  if (nextHandle != 0) {
+    CHECK(nextHandle != handle);
+    CHECK(vm.getInstAnalysisByHandle(nextHandle)->address == next);
+  }
+  CHECK(vm.getCachedInstHandle(start) == handle);
+
+  vm.clearAllCache();
+  CHECK(vm.getInstAnalysisByHandle(handle) == nullptr);
+  CHECK(vm.getCachedInstHandle(start) == 0);
+
+  // a new ExecBlock doesn't reuse the handle
+  REQUIRE(vm.precacheBasicBlock(start));
+  QBDI::InstHandle newHandle = vm.getCachedInstHandle(start);
+  CHECK(newHandle != 0);
+  CHECK(newHandle != handle);
+  CHECK(vm.getInstAnalysisByHandle(handle) == nullptr);
+}
+
+struct IterateCacheData {
+  QBDI::VM *vm;
+  size_t count;
+  size_t stopAfter;
+  bool valid;
+};
+
+static QBDI::VMAction iterateCacheCB(QBDI::VMInstanceRef vm,
+                                     const QBDI::CachedInstLocation *location,
+                                     const QBDI::InstAnalysis *analysis,
+                                     void *data) {
+  IterateCacheData *info = static_cast<IterateCacheData *>(data);
+  info->count++;
+  if (vm != info->vm or analysis == nullptr or
+      location->instIndex >= location->nbInst or
+      analysis != info->vm->getCachedInstAnalysis(analysis->address,
+                                                  QBDI::ANALYSIS_INSTRUCTION) or
+      analysis->address < location->seqStart or
+      analysis->address + analysis->instSize > location->seqEnd or
+      location->seqEnd > location->bbEnd) {
+    info->valid = false;
+  }
+  // the first and the last instruction are at the bounds of the sequence
+  if ((location->instIndex == 0 and analysis->address != location->seqStart) or
+      (location->instIndex + 1 == location->nbInst and
+       analysis->address + analysis->instSize != location->seqEnd)) {
+    info->valid = false;
+  }
+  if (info->count == info->stopAfter) {
+    return QBDI::VMAction::STOP;
+  }
+  return QBDI::VMAction::CONTINUE;
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-IterateCache") {
+  QBDI::rword start = reinterpret_cast<QBDI::rword>(dummyFun4);
+
+  IterateCacheData info = {&vm, 0, 0, true};
+  CHECK(vm.iterateCache(iterateCacheCB, &info) == 0);
+  CHECK(info.count == 0);
+
+  REQUIRE(vm.precacheBasicBlock(start));
+  size_t nb = vm.iterateCache(iterateCacheCB, &info);
+  CHECK(nb > 0);
+  CHECK(nb == info.count);
+  CHECK(info.valid);
+
+  // the iteration ends when the callback returns STOP
+  if (nb > 1) {
+    info = {&vm, 0, 1, true};
+    CHECK(vm.iterateCache(iterateCacheCB, &info) == 1);
+    CHECK(info.count == 1);
+  }
+
+  vm.clearAllCache();
+  info = {&vm, 0, 0, true};
+  CHECK(vm.iterateCache(iterateCacheCB, &info) == 0);
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-SharedAnalysis") {
+  QBDI::rword start = reinterpret_cast<QBDI::rword>(dummyFun4);
+  QBDI::AnalysisType type = QBDI::ANALYSIS_INSTRUCTION |
+                            QBDI::ANALYSIS_DISASSEMBLY |
+                            QBDI::ANALYSIS_OPERANDS;
+
+  vm.setOptions(vm.getOptions() | QBDI::Options::OPT_ENABLE_SHARED_ANALYSIS);
+  QBDI::VM *vm2 = new QBDI::VM(vm);
+  QBDI::VM vm3;
+  vm3.addInstrumentedModuleFromAddr(start);
+
+  REQUIRE(vm.precacheBasicBlock(start));
+  REQUIRE(vm2->precacheBasicBlock(start));
+  REQUIRE(vm3.precacheBasicBlock(start));
+
+  const QBDI::InstAnalysis *ana = vm.getCachedInstAnalysis(start, type);
+  REQUIRE(ana != nullptr);
+  // a shared analysis is complete
+  CHECK((ana->analysisType & QBDI::ANALYSIS_SYMBOL) != 0);
+  CHECK(vm2->getCachedInstAnalysis(start, type) == ana);
+
+  // a VM without the option keeps its own analysis
+  const QBDI::InstAnalysis *ana3 = vm3.getCachedInstAnalysis(start, type);
+  REQUIRE(ana3 != nullptr);
+  CHECK(ana3 != ana);
+  CHECK(std::string(ana3->disassembly) == ana->disassembly);
+  CHECK(ana3->numOperands == ana->numOperands);
+
+  // the analysis remains valid while a VM has it in its cache
+  delete vm2;
+  CHECK(vm.getCachedInstAnalysis(start, type) == ana);
+  CHECK(std::string(ana->disassembly) == ana3->disassembly);
+
+  vm.clearAllCache();
+  REQUIRE(vm.precacheBasicBlock(start));
+  ana = vm.getCachedInstAnalysis(start, type);
+  REQUIRE(ana != nullptr);
+  CHECK(std::string(ana->disassembly) == ana3->disassembly);
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-SharedPatches") {
+  vm.setOptions(vm.getOptions() | QBDI::Options::OPT_ENABLE_SHARED_PATCHES);
+  QBDI::VM *vm2 = new QBDI::VM(vm);
+
+  QBDI::rword retval;
+  REQUIRE(vm2->call(&retval, (QBDI::rword)dummyFun5, {1, 2, 3, 5, 8}));
+  CHECK(retval == (QBDI::rword)dummyFun5(1, 2, 3, 5, 8));
+#if defined(QBDI_PROFILE_TRANSLATION)
+  CHECK(vm2->getTranslationProfile().patchRules.count > 0);
+#endif
+  // the basic blocks patched by the second VM remain valid without it
+  delete vm2;
+
+  // the first VM only instruments the basic blocks
+  QBDI::rword retval2;
+  REQUIRE(vm.call(&retval2, (QBDI::rword)dummyFun5, {1, 2, 3, 5, 8}));
+  CHECK(retval2 == retval);
+#if defined(QBDI_PROFILE_TRANSLATION)
+  QBDI::TranslationProfile profile = vm.getTranslationProfile();
+  CHECK(profile.patchRules.count == 0);
+  CHECK(profile.writeSequence.count > 0);
+#endif
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-PrecacheFrom") {
+  QBDI::rword retval;
+  REQUIRE(vm.call(&retval, (QBDI::rword)dummyFun5, {1, 2, 3, 5, 8}));
+
+  // a copy of a warm VM translates its sequences with the same patches
+  QBDI::VM *vm2 = new QBDI::VM(vm);
+  CHECK(vm2->getCacheStats().execBlockCount == 0);
+  size_t nb = vm2->precacheFrom(vm);
+  CHECK(nb > 0);
+  CHECK(nb <= vm.getCacheStats().sequenceCount);
+#if defined(QBDI_PROFILE_TRANSLATION)
+  CHECK(vm2->getTranslationProfile().patchRules.count == 0);
+#endif
+  QBDI::CacheStats stats = vm2->getCacheStats();
+
+  QBDI::rword retval2;
+  REQUIRE(vm2->call(&retval2, (QBDI::rword)dummyFun5, {1, 2, 3, 5, 8}));
+  CHECK(retval2 == retval);
+  CHECK(vm2->getCacheStats().translatedSize == stats.translatedSize);
+
+  CHECK(vm2->precacheFrom(vm) == 0);
+  CHECK(vm2->precacheFrom(*vm2) == 0);
+  delete vm2;
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-AnalysisExport") {
+  QBDI::rword start = reinterpret_cast<QBDI::rword>(dummyFun4);
+  QBDI::InstAnalysis analyses[64];
+  QBDI::AnalysisType type =
+      QBDI::ANALYSIS_INSTRUCTION | QBDI::ANALYSIS_DISASSEMBLY |
+      QBDI::ANALYSIS_OPERANDS | QBDI::ANALYSIS_SYMBOL;
+  size_t nb = vm.analyzeRange(start, start + 4096, analyses, 64, type, true);
+  REQUIRE(nb > 0);
+
+  QBDI::AnalysisExporter exporter;
+  // added in reverse order, the export is sorted by address
+  for (size_t i = nb; i > 0; i--) {
+    CHECK(exporter.add(analyses[i - 1]));
+  }
+  CHECK_FALSE(exporter.add(analyses[0]));
+  CHECK(exporter.size() == nb);
+
+  std::string path = "qbdi_analysis_export_test.bin";
+  REQUIRE(exporter.write(path));
+
+  QBDI::AnalysisExportReader reader(path);
+  REQUIRE(reader.isOpen());
+  REQUIRE(reader.size() == nb);
+  for (size_t i = 0; i < nb; i++) {
+    const QBDI::InstAnalysis &ana = analyses[i];
+    const QBDI::InstAnalysisRecord &record = reader.getRecord(i);
+    CHECK(record.address == ana.address);
+    CHECK(reader.find(ana.address) == &record);
+    CHECK(record.instSize == ana.instSize);
+    CHECK(record.gprRead == ana.gprRead);
+    CHECK(record.gprWrite == ana.gprWrite);
+    CHECK(std::string(reader.getString(record.mnemonic)) == ana.mnemonic);
+    CHECK(std::string(reader.getString(record.disassembly)) ==
+          ana.disassembly);
+    CHECK(((record.flags & QBDI::RECORD_AFFECT_CONTROL_FLOW) != 0) ==
+          ana.affectControlFlow);
+    if (ana.symbol != nullptr) {
+      CHECK(std::string(reader.getString(record.symbol)) == ana.symbol);
+    } else {
+      CHECK(reader.getString(record.symbol) == nullptr);
+    }
+    REQUIRE(record.numOperands == ana.numOperands);
+    for (uint8_t j = 0; j < ana.numOperands; j++) {
+      const QBDI::OperandRecord &op = reader.getOperand(record, j);
+      CHECK(op.type == ana.operands[j].type);
+      CHECK(op.value == static_cast<uint64_t>(ana.operands[j].value));
+      CHECK(op.regCtxIdx == ana.operands[j].regCtxIdx);
+      if (ana.operands[j].regName != nullptr) {
+        CHECK(std::string(reader.getString(op.regName)) ==
+              ana.operands[j].regName);
+      }
+    }
+  }
+  CHECK(reader.find(start + 4096) == nullptr);
+
+  QBDI::VM::releaseAnalyses(analyses, nb);
+  remove(path.c_str());
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-CachedProcessMaps") {
+  QBDI::rword addr = reinterpret_cast<QBDI::rword>(dummyFun4);
+  auto findMap = [addr](const std::vector<QBDI::MemoryMap> &maps) {
+    return std::find_if(maps.begin(), maps.end(),
+                        [addr](const QBDI::MemoryMap &m) {
+                          return m.range.contains(addr);
+                        });
+  };
+
+  QBDI::invalidateProcessMapsCache();
+  std::vector<QBDI::MemoryMap> current = QBDI::getCurrentProcessMaps();
+  std::vector<QBDI::MemoryMap> cached = QBDI::getCachedProcessMaps();
+  auto currentMap = findMap(current);
+  auto cachedMap = findMap(cached);
+  REQUIRE(currentMap != current.end());
+  REQUIRE(cachedMap != cached.end());
+  CHECK(cachedMap->range == currentMap->range);
+  CHECK(cachedMap->name == currentMap->name);
+  CHECK((cachedMap->permission & QBDI::PF_EXEC) != 0);
+
+  // the module of the test is found in the snapshot
+  vm.removeAllInstrumentedRanges();
+  CHECK(vm.addInstrumentedModuleFromAddr(addr));
+  CHECK(vm.removeInstrumentedModuleFromAddr(addr));
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-CachedProcessMapsBuffer") {
+  QBDI::rword addr = reinterpret_cast<QBDI::rword>(dummyFun4);
+  QBDI::invalidateProcessMapsCache();
+  std::vector<QBDI::MemoryMap> cached = QBDI::getCachedProcessMaps();
+
+  // the sizes are returned without buffer
+  size_t poolNeeded = 0;
+  size_t nb = QBDI::qbdi_getCachedProcessMapsBuffer(false, nullptr, 0, nullptr,
+                                                    0, &poolNeeded);
+  REQUIRE(nb == cached.size());
+  CHECK(poolNeeded >= nb);
+
+  std::vector<QBDI::qbdi_MemoryMapEntry> maps(nb);
+  std::vector<char> pool(poolNeeded);
+  CHECK(QBDI::qbdi_getCachedProcessMapsBuffer(false, maps.data(), maps.size(),
+                                              pool.data(), pool.size(),
+                                              nullptr) == nb);
+  bool found = false;
+  for (size_t i = 0; i < nb; i++) {
+    CHECK(maps[i].start == cached[i].range.start());
+    CHECK(maps[i].end == cached[i].range.end());
+    REQUIRE(maps[i].name != QBDI_MEMORYMAP_NO_NAME);
+    CHECK(cached[i].name == &pool[maps[i].name]);
+    if (cached[i].range.contains(addr)) {
+      found = true;
+      CHECK((maps[i].permission & QBDI::QBDI_PF_EXEC) != 0);
+    }
+  }
+  CHECK(found);
+
+  // a small pool gives no name for the maps that don't fit
+  QBDI::qbdi_MemoryMapEntry first;
+  CHECK(QBDI::qbdi_getCachedProcessMapsBuffer(false, &first, 1, nullptr, 0,
+                                              nullptr) == nb);
+  CHECK(first.start == cached[0].range.start());
+  CHECK(first.name == QBDI_MEMORYMAP_NO_NAME);
+
+  std::vector<std::string> modules = QBDI::getModuleNames();
+  size_t nbModules = QBDI::qbdi_getCachedModuleNamesBuffer(nullptr, 0, nullptr,
+                                                           0, &poolNeeded);
+  CHECK(nbModules == modules.size());
+  std::vector<uint32_t> names(nbModules);
+  pool.resize(poolNeeded);
+  CHECK(QBDI::qbdi_getCachedModuleNamesBuffer(names.data(), names.size(),
+                                              pool.data(), pool.size(),
+                                              nullptr) == nbModules);
+  for (size_t i = 0; i < nbModules and i < modules.size(); i++) {
+    REQUIRE(names[i] != QBDI_MEMORYMAP_NO_NAME);
+    CHECK(modules[i] == &pool[names[i]]);
+  }
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-ModuleTracking") {
+  CHECK(vm.getModuleTracking() == QBDI::NO_MODULE_TRACKING);
+
+  vm.setModuleTracking(QBDI::MODULE_TRACK_ALL);
+#if defined(QBDI_PLATFORM_LINUX) || defined(QBDI_PLATFORM_OSX)
+  CHECK(vm.getModuleTracking() == QBDI::MODULE_TRACK_ALL);
+#else
+  // the modules cannot be tracked
+  CHECK(vm.getModuleTracking() == QBDI::NO_MODULE_TRACKING);
+#endif
+
+  // the tracking doesn't change the execution of an instrumented function
+  QBDI::rword retval = 0;
+  REQUIRE(vm.call(&retval, (QBDI::rword)dummyFun5, {1, 2, 3, 5, 8}));
+  CHECK(retval == (QBDI::rword)dummyFun5(1, 2, 3, 5, 8));
+
+  vm.setModuleTracking(QBDI::NO_MODULE_TRACKING);
+  CHECK(vm.getModuleTracking() == QBDI::NO_MODULE_TRACKING);
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-InstrumentationEnabled") {
+  bool instrumented = vm.addInstrumentedModuleFromAddr(
+      reinterpret_cast<QBDI::rword>(stopLoop));
+  REQUIRE(instrumented);
+  QBDI::GPRState initial = *vm.getGPRState();
+  QBDI::rword retval;
+
+  uint32_t count = 0;
+  uint32_t id = vm.addCodeCB(QBDI::InstPosition::PREINST, countInstruction,
+                             &count);
+  REQUIRE(id != QBDI::INVALID_EVENTID);
+  bool ran = vm.call(&retval, reinterpret_cast<QBDI::rword>(stopLoop), {10});
+  REQUIRE(ran);
+  uint32_t expected = count;
+  REQUIRE(expected > 0);
+
+  // the callback is skipped by the generated code, the cache is kept
+  QBDI::CacheStats stats = vm.getCacheStats();
+  REQUIRE(vm.setInstrumentationEnabled(id, false));
+  count = 0;
+  vm.setGPRState(&initial);
+  ran = vm.call(&retval, reinterpret_cast<QBDI::rword>(stopLoop), {10});
+  REQUIRE(ran);
+  CHECK(count == 0);
+
+  REQUIRE(vm.setInstrumentationEnabled(id, true));
+  vm.setGPRState(&initial);
+  ran = vm.call(&retval, reinterpret_cast<QBDI::rword>(stopLoop), {10});
+  REQUIRE(ran);
+  CHECK(count == expected);
+  CHECK(vm.getCacheStats().translatedSize == stats.translatedSize);
+  CHECK(vm.getCacheStats().flushCount == stats.flushCount);
+
+  // the VM events and the unknown ids cannot be disabled
+  uint32_t eventId = vm.addVMEventCB(
+      QBDI::VMEvent::SEQUENCE_ENTRY,
+      [](QBDI::VMInstanceRef, const QBDI::VMState *, QBDI::GPRState *,
+         QBDI::FPRState *, void *) { return QBDI::VMAction::CONTINUE; },
+      nullptr);
+  REQUIRE(eventId != QBDI::INVALID_EVENTID);
+  CHECK_FALSE(vm.setInstrumentationEnabled(eventId, false));
+  CHECK_FALSE(vm.setInstrumentationEnabled(id + 1000, false));
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-InstrumentationEnabledReuse") {
+  bool instrumented = vm.addInstrumentedModuleFromAddr(
+      reinterpret_cast<QBDI::rword>(stopLoop));
+  REQUIRE(instrumented);
+  QBDI::GPRState initial = *vm.getGPRState();
+  QBDI::rword retval;
+
+  uint32_t count = 0;
+  uint32_t expected = 0;
+  for (unsigned i = 0; i < 4; i++) {
+    // the new rule reuses the flag of the deleted one, and is enabled
+    uint32_t id = vm.addCodeCB(QBDI::InstPosition::PREINST, countInstruction,
+                               &count);
+    REQUIRE(id != QBDI::INVALID_EVENTID);
+    count = 0;
+    vm.setGPRState(&initial);
+    bool ran = vm.call(&retval, reinterpret_cast<QBDI::rword>(stopLoop), {10});
+    REQUIRE(ran);
+    if (i == 0) {
+      expected = count;
+      REQUIRE(expected > 0);
+    }
+    CHECK(count == expected);
+
+    REQUIRE(vm.setInstrumentationEnabled(id, false));
+    REQUIRE(vm.deleteInstrumentation(id));
+  }
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-CodeAddrSetCB") {
+  bool instrumented = vm.addInstrumentedModuleFromAddr(
+      reinterpret_cast<QBDI::rword>(multiExit));
+  REQUIRE(instrumented);
+  const QBDI::rword odd = reinterpret_cast<QBDI::rword>(exitOdd);
+  const QBDI::rword even = reinterpret_cast<QBDI::rword>(exitEven);
+  QBDI::GPRState initial = *vm.getGPRState();
+
+  std::vector<QBDI::rword> matched;
+  uint32_t id = vm.addCodeAddrSetCB(
+      {even, odd}, QBDI::InstPosition::PREINST,
+      [&matched](QBDI::VMInstanceRef vm, QBDI::GPRState *gprState,
+                 QBDI::FPRState *) {
+        const QBDI::InstAnalysis *ana =
+            vm->getInstAnalysis(QBDI::ANALYSIS_INSTRUCTION);
+        CHECK(ana->address == QBDI_GPR_GET(gprState, QBDI::REG_PC));
+        matched.push_back(ana->address);
+        return QBDI::VMAction::CONTINUE;
+      });
+  REQUIRE(id != QBDI::INVALID_EVENTID);
+  REQUIRE(vm.addCodeAddrSetCB({}, QBDI::InstPosition::PREINST,
+                              countInstruction,
+                              nullptr) == QBDI::INVALID_EVENTID);
+
+  QBDI::rword retval;
+  for (QBDI::rword n : {(QBDI::rword)5, (QBDI::rword)4, (QBDI::rword)5}) {
+    vm.setGPRState(&initial);
+    bool ran =
+        vm.call(&retval, reinterpret_cast<QBDI::rword>(multiExit), {n});
+    REQUIRE(ran);
+    CHECK(retval == multiExit(n));
+  }
+  CHECK(matched == std::vector<QBDI::rword>{odd, even, odd});
+
+  // the set is removed as a single instrumentation
+  REQUIRE(vm.deleteInstrumentation(id));
+  matched.clear();
+  vm.setGPRState(&initial);
+  bool ran = vm.call(&retval, reinterpret_cast<QBDI::rword>(multiExit), {5});
+  REQUIRE(ran);
+  CHECK(matched.empty());
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-FunctorCB") {
+  struct Counter {
+    uint32_t *total;
+    uint32_t count = 0;
+
+    QBDI::VMAction operator()(QBDI::VMInstanceRef, QBDI::GPRState *,
+                              QBDI::FPRState *) {
+      count++;
+      (*total)++;
+      return QBDI::VMAction::CONTINUE;
+    }
+  };
+  bool instrumented = vm.addInstrumentedModuleFromAddr(
+      reinterpret_cast<QBDI::rword>(stopLoop));
+  REQUIRE(instrumented);
+  QBDI::GPRState initial = *vm.getGPRState();
+  QBDI::rword retval;
+
+  uint32_t reference = 0;
+  uint32_t id = vm.addCodeCB(QBDI::InstPosition::PREINST, countInstruction,
+                             &reference);
+  REQUIRE(id != QBDI::INVALID_EVENTID);
+  uint32_t total = 0;
+  uint32_t functorId = vm.addCodeCB(QBDI::InstPosition::PREINST,
+                                    Counter{&total});
+  REQUIRE(functorId != QBDI::INVALID_EVENTID);
+  uint32_t lambdaCount = 0;
+  uint32_t lambdaId = vm.addCodeRangeCB(
+      reinterpret_cast<QBDI::rword>(stopLoop),
+      reinterpret_cast<QBDI::rword>(stopLoop) + 1,
+      QBDI::InstPosition::PREINST,
+      [&lambdaCount](QBDI::VMInstanceRef, QBDI::GPRState *, QBDI::FPRState *) {
+        lambdaCount++;
+        return QBDI::VMAction::CONTINUE;
+      });
+  REQUIRE(lambdaId != QBDI::INVALID_EVENTID);
+
+  bool ran = vm.call(&retval, reinterpret_cast<QBDI::rword>(stopLoop), {10});
+  REQUIRE(ran);
+  REQUIRE(reference > 0);
+  CHECK(total == reference);
+  CHECK(lambdaCount == 1);
+
+  // the copy of the VM calls its own copy of the callable
+  QBDI::VM vm2(vm);
+  reference = 0;
+  total = 0;
+  vm2.setGPRState(&initial);
+  ran = vm2.call(&retval, reinterpret_cast<QBDI::rword>(stopLoop), {10});
+  REQUIRE(ran);
+  CHECK(total == reference);
+  CHECK(lambdaCount == 2);
+
+  REQUIRE(vm.deleteInstrumentation(functorId));
+  reference = 0;
+  total = 0;
+  vm.setGPRState(&initial);
+  ran = vm.call(&retval, reinterpret_cast<QBDI::rword>(stopLoop), {10});
+  REQUIRE(ran);
+  CHECK(reference > 0);
+  CHECK(total == 0);
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-MergedCallbacks") {
+  bool instrumented = vm.addInstrumentedModuleFromAddr(
+      reinterpret_cast<QBDI::rword>(stopLoop));
+  REQUIRE(instrumented);
+  const QBDI::rword entry = reinterpret_cast<QBDI::rword>(stopLoop);
+  QBDI::GPRState initial = *vm.getGPRState();
+  QBDI::rword retval;
+
+  // the callbacks at the same instruction share a break to the host and are
+  // called in the priority order
+  std::string order;
+  uint32_t low = vm.addCodeAddrCB(
+      entry, QBDI::InstPosition::PREINST,
+      [&order](QBDI::VMInstanceRef, QBDI::GPRState *, QBDI::FPRState *) {
+        order += 'L';
+        return QBDI::VMAction::CONTINUE;
+      },
+      -10);
+  uint32_t high = vm.addCodeAddrCB(
+      entry, QBDI::InstPosition::PREINST,
+      [&order](QBDI::VMInstanceRef, QBDI::GPRState *, QBDI::FPRState *) {
+        order += 'H';
+        return QBDI::VMAction::CONTINUE;
+      },
+      10);
+  uint32_t stop = vm.addCodeAddrCB(
+      entry, QBDI::InstPosition::PREINST,
+      [&order](QBDI::VMInstanceRef, QBDI::GPRState *, QBDI::FPRState *) {
+        order += 'S';
+        return QBDI::VMAction::STOP;
+      },
+      -20);
+  REQUIRE(low != QBDI::INVALID_EVENTID);
+  REQUIRE(high != QBDI::INVALID_EVENTID);
+  REQUIRE(stop != QBDI::INVALID_EVENTID);
+
+  vm.call(&retval, entry, {10});
+  CHECK(order == "HLS");
+
+  // a disabled callback is skipped by the merged callbacks
+  REQUIRE(vm.setInstrumentationEnabled(high, false));
+  REQUIRE(vm.deleteInstrumentation(stop));
+  order.clear();
+  vm.setGPRState(&initial);
+  bool ran = vm.call(&retval, entry, {10});
+  REQUIRE(ran);
+  CHECK(retval == stopLoop(10));
+  CHECK(order == "L");
+}
+
+static void fillCountRule(QBDI::VMInstanceRef vm,
+                          const QBDI::InstAnalysis *inst,
+                          std::vector<QBDI::InstrRuleDataCBK> *cbks,
+                          void *data) {
+  cbks->emplace_back(QBDI::InstPosition::PREINST, countInstruction, data);
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-InstrRuleFillCbLambda") {
+  bool instrumented = vm.addInstrumentedModuleFromAddr(
+      reinterpret_cast<QBDI::rword>(stopLoop));
+  REQUIRE(instrumented);
+  QBDI::GPRState initial = *vm.getGPRState();
+  QBDI::rword retval;
+
+  uint32_t reference = 0;
+  uint32_t id = vm.addCodeCB(QBDI::InstPosition::PREINST, countInstruction,
+                             &reference);
+  REQUIRE(id != QBDI::INVALID_EVENTID);
+
+  // the lambda only adds a callback on the first instruction of stopLoop
+  uint32_t nbRuleCall = 0;
+  uint32_t entryCount = 0;
+  uint32_t lambdaId = vm.addInstrRule(
+      [&nbRuleCall, &entryCount](QBDI::VMInstanceRef vm,
+                                 const QBDI::InstAnalysis *inst,
+                                 std::vector<QBDI::InstrRuleDataCBK> &cbks) {
+        nbRuleCall++;
+        if (inst->address != reinterpret_cast<QBDI::rword>(stopLoop)) {
+          return;
+        }
+        cbks.emplace_back(QBDI::InstPosition::PREINST, countInstruction,
+                          &entryCount);
+      },
+      QBDI::ANALYSIS_INSTRUCTION);
+  REQUIRE(lambdaId != QBDI::INVALID_EVENTID);
+
+  uint32_t total = 0;
+  uint32_t fillId =
+      vm.addInstrRule(fillCountRule, QBDI::ANALYSIS_INSTRUCTION, &total);
+  REQUIRE(fillId != QBDI::INVALID_EVENTID);
+
+  bool ran = vm.call(&retval, reinterpret_cast<QBDI::rword>(stopLoop), {10});
+  REQUIRE(ran);
+  REQUIRE(reference > 0);
+  CHECK(nbRuleCall > 0);
+  CHECK(entryCount == 1);
+  CHECK(total == reference);
+
+  // the copy of the VM keeps the ids of the rules
+  QBDI::VM vm2(vm);
+  reference = 0;
+  entryCount = 0;
+  total = 0;
+  vm2.setGPRState(&initial);
+  ran = vm2.call(&retval, reinterpret_cast<QBDI::rword>(stopLoop), {10});
+  REQUIRE(ran);
+  CHECK(entryCount == 1);
+  CHECK(total == reference);
+
+  REQUIRE(vm2.deleteInstrumentation(fillId));
+  REQUIRE(vm2.deleteInstrumentation(lambdaId));
+  reference = 0;
+  entryCount = 0;
+  total = 0;
+  vm2.setGPRState(&initial);
+  ran = vm2.call(&retval, reinterpret_cast<QBDI::rword>(stopLoop), {10});
+  REQUIRE(ran);
+  CHECK(reference > 0);
+  CHECK(entryCount == 0);
+  CHECK(total == 0);
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-BBInstrRule") {
+  bool instrumented = vm.addInstrumentedModuleFromAddr(
+      reinterpret_cast<QBDI::rword>(stopLoop));
+  REQUIRE(instrumented);
+  QBDI::GPRState initial = *vm.getGPRState();
+  QBDI::rword retval;
+
+  uint32_t reference = 0;
+  uint32_t id = vm.addCodeCB(QBDI::InstPosition::PREINST, countInstruction,
+                             &reference);
+  REQUIRE(id != QBDI::INVALID_EVENTID);
+
+  // count each instruction with a callback added by the basic block rule
+  uint32_t nbRuleCall = 0;
+  uint32_t nbInst = 0;
+  bool contiguous = true;
+  uint32_t total = 0;
+  uint32_t bbId = vm.addBBInstrRule(
+      [&](QBDI::VMInstanceRef vm,
+          const std::vector<const QBDI::InstAnalysis *> &block,
+          std::vector<std::vector<QBDI::InstrRuleDataCBK>> &cbks) {
+        nbRuleCall++;
+        nbInst += block.size();
+        REQUIRE(cbks.size() == block.size());
+        for (size_t i = 0; i < block.size(); i++) {
+          if (i > 0 and
+              block[i - 1]->address + block[i - 1]->instSize !=
+                  block[i]->address) {
+            contiguous = false;
+          }
+          cbks[i].emplace_back(QBDI::InstPosition::PREINST, countInstruction,
+                               &total);
+        }
+      },
+      QBDI::ANALYSIS_INSTRUCTION);
+  REQUIRE(bbId != QBDI::INVALID_EVENTID);
+
+  bool ran = vm.call(&retval, reinterpret_cast<QBDI::rword>(stopLoop), {10});
+  REQUIRE(ran);
+  REQUIRE(reference > 0);
+  CHECK(contiguous);
+  CHECK(nbRuleCall > 0);
+  CHECK(nbRuleCall < nbInst);
+  CHECK(total == reference);
+
+  // a rule on a range only instruments the first instruction of stopLoop
+  uint32_t entryCount = 0;
+  uint32_t rangeId = vm.addBBInstrRuleRange(
+      reinterpret_cast<QBDI::rword>(stopLoop),
+      reinterpret_cast<QBDI::rword>(stopLoop) + 1,
+      [&entryCount](QBDI::VMInstanceRef vm,
+                    const std::vector<const QBDI::InstAnalysis *> &block,
+                    std::vector<std::vector<QBDI::InstrRuleDataCBK>> &cbks) {
+        REQUIRE(block.size() == 1);
+        REQUIRE(block[0]->address == reinterpret_cast<QBDI::rword>(stopLoop));
+        cbks[0].emplace_back(QBDI::InstPosition::PREINST, countInstruction,
+                             &entryCount);
+      },
+      QBDI::ANALYSIS_INSTRUCTION);
+  REQUIRE(rangeId != QBDI::INVALID_EVENTID);
+
+  // the copy of the VM calls its own copy of the lambdas
+  QBDI::VM vm2(vm);
+  reference = 0;
+  total = 0;
+  vm2.setGPRState(&initial);
+  ran = vm2.call(&retval, reinterpret_cast<QBDI::rword>(stopLoop), {10});
+  REQUIRE(ran);
+  CHECK(total == reference);
+  CHECK(entryCount == 1);
+
+  REQUIRE(vm2.deleteInstrumentation(bbId));
+  reference = 0;
+  total = 0;
+  vm2.setGPRState(&initial);
+  ran = vm2.call(&retval, reinterpret_cast<QBDI::rword>(stopLoop), {10});
+  REQUIRE(ran);
+  CHECK(reference > 0);
+  CHECK(total == 0);
+  CHECK(entryCount == 2);
+}
@@ -373,8 +373,8 @@ TEST_CASE_METHOD(APITest, "MemoryAccessTest_X86-rep_cmpsb") {
        QBDI::MEMORY_UNKNOWN_VALUE | QBDI::MEMORY_UNKNOWN_SIZE},
   }};
   ExpectedMemoryAccesses expectedPost = {{
-      {(QBDI::rword)&v1, 0, 10, QBDI::MEMORY_READ, QBDI::MEMORY_UNKNOWN_VALUE},
-      {(QBDI::rword)&v2, 0, 10, QBDI::MEMORY_READ, QBDI::MEMORY_UNKNOWN_VALUE},
+      {(QBDI::rword)&v1, 10, 10, QBDI::MEMORY_READ, QBDI::MEMORY_BULK},
+      {(QBDI::rword)&v2, 10, 10, QBDI::MEMORY_READ, QBDI::MEMORY_BULK},
   }};
 
   vm.recordMemoryAccess(QBDI::MEMORY_READ);
@@ -414,8 +414,8 @@ TEST_CASE_METHOD(APITest, "MemoryAccessTest_X86-repne_cmpsb") {
        QBDI::MEMORY_UNKNOWN_VALUE | QBDI::MEMORY_UNKNOWN_SIZE},
   }};
   ExpectedMemoryAccesses expectedPost = {{
-      {(QBDI::rword)&v1, 0, 10, QBDI::MEMORY_READ, QBDI::MEMORY_UNKNOWN_VALUE},
-      {(QBDI::rword)&v2, 0, 10, QBDI::MEMORY_READ, QBDI::MEMORY_UNKNOWN_VALUE},
+      {(QBDI::rword)&v1, 10, 10, QBDI::MEMORY_READ, QBDI::MEMORY_BULK},
+      {(QBDI::rword)&v2, 10, 10, QBDI::MEMORY_READ, QBDI::MEMORY_BULK},
   }};
 
   vm.recordMemoryAccess(QBDI::MEMORY_READ);
@@ -456,8 +456,10 @@ TEST_CASE_METHOD(APITest, "MemoryAccessTest_X86-rep_cmpsb2") {
        QBDI::MEMORY_UNKNOWN_VALUE | QBDI::MEMORY_UNKNOWN_SIZE},
   }};
   ExpectedMemoryAccesses expectedPost = {{
-      {(QBDI::rword)&v1, 0, 10, QBDI::MEMORY_READ, QBDI::MEMORY_UNKNOWN_VALUE},
-      {(QBDI::rword)&v2, 0, 10, QBDI::MEMORY_READ, QBDI::MEMORY_UNKNOWN_VALUE},
+      {(QBDI::rword)&v1, 10, 10, QBDI::MEMORY_READ,
+       QBDI::MEMORY_BULK | QBDI::MEMORY_BULK_BACKWARD},
+      {(QBDI::rword)&v2, 10, 10, QBDI::MEMORY_READ,
+       QBDI::MEMORY_BULK | QBDI::MEMORY_BULK_BACKWARD},
   }};
 
   vm.recordMemoryAccess(QBDI::MEMORY_READ);
@@ -497,8 +499,8 @@ TEST_CASE_METHOD(APITest, "MemoryAccessTest_X86-rep_cmpsw") {
        QBDI::MEMORY_UNKNOWN_VALUE | QBDI::MEMORY_UNKNOWN_SIZE},
   }};
   ExpectedMemoryAccesses expectedPost = {{
-      {(QBDI::rword)&v1, 0, 10, QBDI::MEMORY_READ, QBDI::MEMORY_UNKNOWN_VALUE},
-      {(QBDI::rword)&v2, 0, 10, QBDI::MEMORY_READ, QBDI::MEMORY_UNKNOWN_VALUE},
+      {(QBDI::rword)&v1, 10, 10, QBDI::MEMORY_READ, QBDI::MEMORY_BULK},
+      {(QBDI::rword)&v2, 10, 10, QBDI::MEMORY_READ, QBDI::MEMORY_BULK},
   }};
 
   vm.recordMemoryAccess(QBDI::MEMORY_READ);
@@ -539,8 +541,10 @@ TEST_CASE_METHOD(APITest, "MemoryAccessTest_X86-rep_cmpsw2") {
        QBDI::MEMORY_UNKNOWN_VALUE | QBDI::MEMORY_UNKNOWN_SIZE},
   }};
   ExpectedMemoryAccesses expectedPost = {{
-      {(QBDI::rword)&v1, 0, 10, QBDI::MEMORY_READ, QBDI::MEMORY_UNKNOWN_VALUE},
-      {(QBDI::rword)&v2, 0, 10, QBDI::MEMORY_READ, QBDI::MEMORY_UNKNOWN_VALUE},
+      {(QBDI::rword)&v1, 10, 10, QBDI::MEMORY_READ,
+       QBDI::MEMORY_BULK | QBDI::MEMORY_BULK_BACKWARD},
+      {(QBDI::rword)&v2, 10, 10, QBDI::MEMORY_READ,
+       QBDI::MEMORY_BULK | QBDI::MEMORY_BULK_BACKWARD},
   }};
 
   vm.recordMemoryAccess(QBDI::MEMORY_READ);
@@ -761,10 +765,10 @@ TEST_CASE_METHOD(APITest, "MemoryAccessTest_X86-rep_movsl") {
        QBDI::MEMORY_UNKNOWN_VALUE | QBDI::MEMORY_UNKNOWN_SIZE},
   }};
   ExpectedMemoryAccesses expectedPost = {{
-      {(QBDI::rword)&v1, 0, sizeof(v1), QBDI::MEMORY_READ,
-       QBDI::MEMORY_UNKNOWN_VALUE},
-      {(QBDI::rword)&v2, 0, sizeof(v1), QBDI::MEMORY_WRITE,
-       QBDI::MEMORY_UNKNOWN_VALUE},
+      {(QBDI::rword)&v1, sizeof(v1), sizeof(v1), QBDI::MEMORY_READ,
+       QBDI::MEMORY_BULK},
+      {(QBDI::rword)&v2, sizeof(v1), sizeof(v1), QBDI::MEMORY_WRITE,
+       QBDI::MEMORY_BULK},
   }};
 
   vm.recordMemoryAccess(QBDI::MEMORY_READ_WRITE);
@@ -803,10 +807,10 @@ TEST_CASE_METHOD(APITest, "MemoryAccessTest_X86-rep_movsl2") {
        QBDI::MEMORY_UNKNOWN_VALUE | QBDI::MEMORY_UNKNOWN_SIZE},
   }};
   ExpectedMemoryAccesses expectedPost = {{
-      {(QBDI::rword)&v1, 0, sizeof(v1), QBDI::MEMORY_READ,
-       QBDI::MEMORY_UNKNOWN_VALUE},
-      {(QBDI::rword)&v2, 0, sizeof(v1), QBDI::MEMORY_WRITE,
-       QBDI::MEMORY_UNKNOWN_VALUE},
+      {(QBDI::rword)&v1, sizeof(v1), sizeof(v1), QBDI::MEMORY_READ,
+       QBDI::MEMORY_BULK | QBDI::MEMORY_BULK_BACKWARD},
+      {(QBDI::rword)&v2, sizeof(v1), sizeof(v1), QBDI::MEMORY_WRITE,
+       QBDI::MEMORY_BULK | QBDI::MEMORY_BULK_BACKWARD},
   }};
 
   vm.recordMemoryAccess(QBDI::MEMORY_READ_WRITE);
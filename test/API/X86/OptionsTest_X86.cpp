@@ -52,6 +52,34 @@ TEST_CASE_METHOD(OptionsTest, "OptionsTest_X86-ATTSyntax") {
   CHECK(std::string(ana->disassembly) == std::string("\tleal\t(%eax), %ebx"));
 }
 
+TEST_CASE_METHOD(OptionsTest, "OptionsTest_X86-ATTSyntaxKeepCache") {
+
+  InMemoryObject leaObj("leal (%eax), %ebx\nret\n");
+  QBDI::rword addr = (QBDI::rword)leaObj.getCode().data();
+
+  vm.setOptions(QBDI::Options::NO_OPT);
+  CHECK(vm.precacheBasicBlock(addr));
+  QBDI::CacheStats stats = vm.getCacheStats();
+
+  const QBDI::InstAnalysis *ana =
+      vm.getCachedInstAnalysis(addr, QBDI::ANALYSIS_DISASSEMBLY);
+  REQUIRE(ana != nullptr);
+  REQUIRE(ana->disassembly != nullptr);
+  CHECK(std::string(ana->disassembly) == std::string("\tlea\tebx, [eax]"));
+
+  // only the analyses are dropped
+  vm.setOptions(QBDI::Options::OPT_ATT_SYNTAX);
+  QBDI::CacheStats stats2 = vm.getCacheStats();
+  CHECK(stats2.flushCount == stats.flushCount);
+  CHECK(stats2.execBlockCount == stats.execBlockCount);
+  CHECK_FALSE(vm.precacheBasicBlock(addr));
+
+  ana = vm.getCachedInstAnalysis(addr, QBDI::ANALYSIS_DISASSEMBLY);
+  REQUIRE(ana != nullptr);
+  REQUIRE(ana->disassembly != nullptr);
+  CHECK(std::string(ana->disassembly) == std::string("\tleal\t(%eax), %ebx"));
+}
+
 static QBDI::VMAction setBool(QBDI::VMInstanceRef vm, QBDI::GPRState *gprState,
                               QBDI::FPRState *fprState, void *data) {
   *((bool *)data) = true;
@@ -0,0 +1,272 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+#include <stddef.h>
+#include <vector>
+#include <catch2/catch.hpp>
+
+#include "API/APITest.h"
+#include "QBDI/Ownership.h"
+
+// The inline instrumentations skip their slow path with a jump over its code.
+// Each one runs its two paths, with the flags of the guest live and dead.
+
+namespace {
+
+// The flags of the comparison are live across the instrumentation of the
+// accesses. The result is rdi + (rdi < rsi).
+const char liveFlagsSource[] = "cmpq %rsi, %rdi\n"
+                               "movq %rdi, (%rdx)\n"
+                               "movq (%rdx), %rcx\n"
+                               "setb %al\n"
+                               "movzbl %al, %eax\n"
+                               "addq %rcx, %rax\n";
+
+// The flags are dead across the instrumentation of the accesses with
+// OPT_ENABLE_LIVENESS. The result is rdi.
+const char deadFlagsSource[] = "movq %rdi, (%rdx)\n"
+                               "movq (%rdx), %rcx\n"
+                               "xorl %eax, %eax\n"
+                               "addq %rcx, %rax\n";
+
+// The instructions executed by InlinePathTest::run
+const uint32_t runInstructions = 19;
+
+// Index of RDI in the GPRState
+const uint32_t regRDI = offsetof(QBDI::GPRState, rdi) / sizeof(QBDI::rword);
+
+// The accessed buffer, out of the stacks
+alignas(8) QBDI::rword buffer;
+
+class InlinePathTest : public APITest {
+protected:
+  QBDI::rword live;
+  QBDI::rword dead;
+
+public:
+  InlinePathTest() {
+    vm.setOptions(vm.getOptions() | QBDI::Options::OPT_ENABLE_LIVENESS);
+    live = genASM(liveFlagsSource);
+    dead = genASM(deadFlagsSource);
+  }
+
+  void run() {
+    QBDI::rword retval;
+    REQUIRE(vm.call(&retval, live, {1, 2, (QBDI::rword)&buffer}));
+    CHECK(retval == 2);
+    REQUIRE(vm.call(&retval, live, {3, 2, (QBDI::rword)&buffer}));
+    CHECK(retval == 3);
+    REQUIRE(vm.call(&retval, dead, {5, 0, (QBDI::rword)&buffer}));
+    CHECK(retval == 5);
+  }
+};
+
+QBDI::VMAction collectMemoryTrace(QBDI::VMInstanceRef vm,
+                                  const QBDI::MemoryTraceEntry *entries,
+                                  size_t count, void *data) {
+  std::vector<QBDI::MemoryTraceEntry> *trace =
+      static_cast<std::vector<QBDI::MemoryTraceEntry> *>(data);
+  trace->insert(trace->end(), entries, entries + count);
+  return QBDI::VMAction::CONTINUE;
+}
+
+QBDI::VMAction collectCallTrace(QBDI::VMInstanceRef vm,
+                                const QBDI::CallTraceEntry *entries,
+                                size_t count, void *data) {
+  std::vector<QBDI::CallTraceEntry> *trace =
+      static_cast<std::vector<QBDI::CallTraceEntry> *>(data);
+  trace->insert(trace->end(), entries, entries + count);
+  return QBDI::VMAction::CONTINUE;
+}
+
+QBDI::VMAction countBufferBreaks(QBDI::VMInstanceRef vm,
+                                 QBDI::GPRState *gprState,
+                                 QBDI::FPRState *fprState,
+                                 const QBDI::OwnershipAccess *access,
+                                 void *data) {
+  if (access->address == (QBDI::rword)&buffer) {
+    *static_cast<uint32_t *>(data) += 1;
+  }
+  return QBDI::VMAction::CONTINUE;
+}
+
+QBDI::VMAction countContinue(QBDI::VMInstanceRef vm, QBDI::GPRState *gprState,
+                             QBDI::FPRState *fprState, void *data) {
+  *static_cast<uint32_t *>(data) += 1;
+  return QBDI::VMAction::CONTINUE;
+}
+
+QBDI::VMAction countBreakToVM(QBDI::VMInstanceRef vm, QBDI::GPRState *gprState,
+                              QBDI::FPRState *fprState, void *data) {
+  *static_cast<uint32_t *>(data) += 1;
+  return QBDI::VMAction::BREAK_TO_VM;
+}
+
+} // namespace
+
+TEST_CASE_METHOD(InlinePathTest, "InlinePathTest_X86_64-MemoryTrace") {
+  std::vector<QBDI::MemoryTraceEntry> trace;
+  // a buffer of one entry is flushed by each access, the larger buffer at
+  // the end of the runs
+  for (size_t capacity : {1, 4096}) {
+    trace.clear();
+    REQUIRE(vm.setMemoryTrace(QBDI::MEMORY_READ_WRITE, collectMemoryTrace,
+                              &trace, capacity));
+    run();
+    CHECK(std::count_if(trace.begin(), trace.end(),
+                        [](const QBDI::MemoryTraceEntry &e) {
+                          return e.accessAddress == (QBDI::rword)&buffer;
+                        }) == 6);
+  }
+}
+
+TEST_CASE_METHOD(InlinePathTest, "InlinePathTest_X86_64-CallTrace") {
+  // the flags of the comparison are live across the call
+  QBDI::rword addr = genASM("cmpq %rsi, %rdi\n"
+                            "callq 1f\n"
+                            "setb %al\n"
+                            "movzbl %al, %eax\n"
+                            "addq %rdi, %rax\n"
+                            "ret\n"
+                            "1:\n");
+
+  std::vector<QBDI::CallTraceEntry> trace;
+  for (size_t capacity : {1, 1024}) {
+    trace.clear();
+    REQUIRE(vm.setCallTrace(collectCallTrace, &trace, 2, capacity));
+    QBDI::rword retval;
+    REQUIRE(vm.call(&retval, addr, {1, 2}));
+    CHECK(retval == 2);
+    REQUIRE(vm.call(&retval, addr, {3, 2}));
+    CHECK(retval == 3);
+    CHECK(std::count_if(trace.begin(), trace.end(),
+                        [addr](const QBDI::CallTraceEntry &e) {
+                          return e.callAddress == addr + 3;
+                        }) == 2);
+  }
+}
+
+TEST_CASE_METHOD(InlinePathTest, "InlinePathTest_X86_64-PageHistogram") {
+  REQUIRE(vm.setPageHistogram(true));
+  QBDI::rword page = (QBDI::rword)&buffer & ~static_cast<QBDI::rword>(4095);
+  auto getCount = [this, page]() {
+    for (const QBDI::PageAccessStats &s : vm.getPageHistogram()) {
+      if (s.page == page) {
+        return s.count;
+      }
+    }
+    return static_cast<uint64_t>(0);
+  };
+
+  // the first access of the memory breaks to allocate the counters
+  run();
+  CHECK(getCount() == 6);
+  run();
+  CHECK(getCount() == 12);
+}
+
+TEST_CASE_METHOD(InlinePathTest, "InlinePathTest_X86_64-OwnershipFilter") {
+  uint32_t breaks = 0;
+  QBDI::OwnershipShadow shadow;
+  QBDI::OwnershipFilter filter(shadow, 1, countBufferBreaks, &breaks);
+  REQUIRE(vm.addOwnershipFilter(&filter) != QBDI::VMError::INVALID_EVENTID);
+
+  // the accesses to the granule of another thread break, the stack of the
+  // guest has no shadow yet
+  shadow.setOwner((QBDI::rword)&buffer, sizeof(buffer), 2);
+  run();
+  CHECK(breaks == 6);
+
+  // the granule of the thread doesn't break
+  shadow.setOwner((QBDI::rword)&buffer, sizeof(buffer), 1);
+  breaks = 0;
+  run();
+  CHECK(breaks == 0);
+}
+
+TEST_CASE_METHOD(InlinePathTest, "InlinePathTest_X86_64-InstructionBudget") {
+  // a large budget counts the instructions
+  REQUIRE(vm.setInstructionBudget(1000));
+  run();
+  CHECK(vm.getInstructionBudget() == 1000 - runInstructions);
+
+  // the run stops on an exhausted budget and resumes with the state of the
+  // guest
+  for (QBDI::rword addr : {live, dead}) {
+    REQUIRE(vm.setInstructionBudget(2));
+    QBDI::rword retval;
+    vm.call(&retval, addr, {1, 2, (QBDI::rword)&buffer});
+    CHECK(vm.getInstructionBudget() == 0);
+    QBDI::rword pc = QBDI_GPR_GET(vm.getGPRState(), QBDI::REG_PC);
+    CHECK(pc > addr);
+
+    REQUIRE(vm.setInstructionBudget(0));
+    // the return address of VM::call
+    REQUIRE(vm.run(pc, 42));
+    CHECK(QBDI_GPR_GET(vm.getGPRState(), QBDI::REG_RETURN) ==
+          (addr == live ? 2 : 1));
+  }
+}
+
+TEST_CASE_METHOD(InlinePathTest, "InlinePathTest_X86_64-FlagCallback") {
+  uint32_t count = 0;
+  uint32_t id = vm.addCodeCB(QBDI::PREINST, countContinue, &count);
+  REQUIRE(id != QBDI::INVALID_EVENTID);
+
+  run();
+  CHECK(count == runInstructions);
+
+  REQUIRE(vm.setInstrumentationEnabled(id, false));
+  count = 0;
+  run();
+  CHECK(count == 0);
+}
+
+TEST_CASE_METHOD(InlinePathTest, "InlinePathTest_X86_64-PredicateCallback") {
+  // only the first run of the live source has RDI == 1
+  uint32_t count = 0;
+  QBDI::CallbackPredicate equal = {QBDI::PREDICATE_REG_EQUAL, regRDI,
+                                   QBDI::MEMORY_READ, 1, 0};
+  uint32_t id = vm.addCodeCBIf(QBDI::PREINST, equal, countContinue, &count);
+  REQUIRE(id != QBDI::INVALID_EVENTID);
+  run();
+  CHECK(count == 7);
+  vm.deleteInstrumentation(id);
+
+  // the counter also keeps the flags of the guest
+  count = 0;
+  QBDI::CallbackPredicate counter = {QBDI::PREDICATE_COUNTER, 0,
+                                     QBDI::MEMORY_READ, 2, 0};
+  id = vm.addCodeCBIf(QBDI::PREINST, counter, countContinue, &count);
+  REQUIRE(id != QBDI::INVALID_EVENTID);
+  run();
+  CHECK(count == runInstructions / 2);
+}
+
+TEST_CASE_METHOD(InlinePathTest, "InlinePathTest_X86_64-DirectCallback") {
+  // CONTINUE resumes the generated code, another action breaks to the host
+  for (QBDI::InstCallback cbk : {countContinue, countBreakToVM}) {
+    uint32_t count = 0;
+    uint32_t id =
+        vm.addCodeCBLight(QBDI::PREINST, cbk, &count, QBDI::FOOTPRINT_NONE);
+    REQUIRE(id != QBDI::INVALID_EVENTID);
+    run();
+    CHECK(count == runInstructions);
+    vm.deleteInstrumentation(id);
+  }
+}
@@ -96,6 +96,33 @@ static void checkOperand(const QBDI::InstAnalysis *ana,
         CHECK(expect.regName == op.regName);
       }
     }
+
+    // the bitmasks summarize the registers of the operands
+    uint64_t gprRead = 0, gprWrite = 0, fprRead = 0, fprWrite = 0;
+    for (const QBDI::OperandAnalysis &expect : expecteds) {
+      if (expect.regCtxIdx < 0) {
+        continue;
+      }
+      if (expect.type == QBDI::OPERAND_GPR) {
+        uint64_t bit = 1ull << expect.regCtxIdx;
+        gprRead |= (expect.regAccess & QBDI::REGISTER_READ) ? bit : 0;
+        gprWrite |= (expect.regAccess & QBDI::REGISTER_WRITE) ? bit : 0;
+      } else if (expect.type == QBDI::OPERAND_FPR) {
+        uint64_t bit = 1ull << (expect.regCtxIdx / 16);
+        fprRead |= (expect.regAccess & QBDI::REGISTER_READ) ? bit : 0;
+        fprWrite |= (expect.regAccess & QBDI::REGISTER_WRITE) ? bit : 0;
+      }
+    }
+    if (flagsAccess & QBDI::REGISTER_READ) {
+      gprRead |= 1ull << QBDI::REG_FLAG;
+    }
+    if (flagsAccess & QBDI::REGISTER_WRITE) {
+      gprWrite |= 1ull << QBDI::REG_FLAG;
+    }
+    CHECK(gprRead == ana->gprRead);
+    CHECK(gprWrite == ana->gprWrite);
+    CHECK(fprRead == ana->fprRead);
+    CHECK(fprWrite == ana->fprWrite);
   }
 }
 
@@ -21,6 +21,7 @@
 #include "inttypes.h"
 
 #include "QBDI/Memory.hpp"
+#include "QBDI/Ownership.h"
 #include "QBDI/Platform.h"
 #include "QBDI/Range.h"
 
@@ -343,8 +344,8 @@ TEST_CASE_METHOD(APITest, "MemoryAccessTest_X86_64-rep_cmpsb") {
        QBDI::MEMORY_UNKNOWN_VALUE | QBDI::MEMORY_UNKNOWN_SIZE},
   }};
   ExpectedMemoryAccesses expectedPost = {{
-      {(QBDI::rword)&v1, 0, 10, QBDI::MEMORY_READ, QBDI::MEMORY_UNKNOWN_VALUE},
-      {(QBDI::rword)&v2, 0, 10, QBDI::MEMORY_READ, QBDI::MEMORY_UNKNOWN_VALUE},
+      {(QBDI::rword)&v1, 10, 10, QBDI::MEMORY_READ, QBDI::MEMORY_BULK},
+      {(QBDI::rword)&v2, 10, 10, QBDI::MEMORY_READ, QBDI::MEMORY_BULK},
   }};
 
   vm.recordMemoryAccess(QBDI::MEMORY_READ);
@@ -384,8 +385,8 @@ TEST_CASE_METHOD(APITest, "MemoryAccessTest_X86_64-repne_cmpsb") {
        QBDI::MEMORY_UNKNOWN_VALUE | QBDI::MEMORY_UNKNOWN_SIZE},
   }};
   ExpectedMemoryAccesses expectedPost = {{
-      {(QBDI::rword)&v1, 0, 10, QBDI::MEMORY_READ, QBDI::MEMORY_UNKNOWN_VALUE},
-      {(QBDI::rword)&v2, 0, 10, QBDI::MEMORY_READ, QBDI::MEMORY_UNKNOWN_VALUE},
+      {(QBDI::rword)&v1, 10, 10, QBDI::MEMORY_READ, QBDI::MEMORY_BULK},
+      {(QBDI::rword)&v2, 10, 10, QBDI::MEMORY_READ, QBDI::MEMORY_BULK},
   }};
 
   vm.recordMemoryAccess(QBDI::MEMORY_READ);
@@ -426,8 +427,10 @@ TEST_CASE_METHOD(APITest, "MemoryAccessTest_X86_64-rep_cmpsb2") {
        QBDI::MEMORY_UNKNOWN_VALUE | QBDI::MEMORY_UNKNOWN_SIZE},
   }};
   ExpectedMemoryAccesses expectedPost = {{
-      {(QBDI::rword)&v1, 0, 10, QBDI::MEMORY_READ, QBDI::MEMORY_UNKNOWN_VALUE},
-      {(QBDI::rword)&v2, 0, 10, QBDI::MEMORY_READ, QBDI::MEMORY_UNKNOWN_VALUE},
+      {(QBDI::rword)&v1, 10, 10, QBDI::MEMORY_READ,
+       QBDI::MEMORY_BULK | QBDI::MEMORY_BULK_BACKWARD},
+      {(QBDI::rword)&v2, 10, 10, QBDI::MEMORY_READ,
+       QBDI::MEMORY_BULK | QBDI::MEMORY_BULK_BACKWARD},
   }};
 
   vm.recordMemoryAccess(QBDI::MEMORY_READ);
@@ -467,8 +470,8 @@ TEST_CASE_METHOD(APITest, "MemoryAccessTest_X86_64-rep_cmpsw") {
        QBDI::MEMORY_UNKNOWN_VALUE | QBDI::MEMORY_UNKNOWN_SIZE},
   }};
   ExpectedMemoryAccesses expectedPost = {{
-      {(QBDI::rword)&v1, 0, 10, QBDI::MEMORY_READ, QBDI::MEMORY_UNKNOWN_VALUE},
-      {(QBDI::rword)&v2, 0, 10, QBDI::MEMORY_READ, QBDI::MEMORY_UNKNOWN_VALUE},
+      {(QBDI::rword)&v1, 10, 10, QBDI::MEMORY_READ, QBDI::MEMORY_BULK},
+      {(QBDI::rword)&v2, 10, 10, QBDI::MEMORY_READ, QBDI::MEMORY_BULK},
   }};
 
   vm.recordMemoryAccess(QBDI::MEMORY_READ);
@@ -509,8 +512,10 @@ TEST_CASE_METHOD(APITest, "MemoryAccessTest_X86_64-rep_cmpsw2") {
        QBDI::MEMORY_UNKNOWN_VALUE | QBDI::MEMORY_UNKNOWN_SIZE},
   }};
   ExpectedMemoryAccesses expectedPost = {{
-      {(QBDI::rword)&v1, 0, 10, QBDI::MEMORY_READ, QBDI::MEMORY_UNKNOWN_VALUE},
-      {(QBDI::rword)&v2, 0, 10, QBDI::MEMORY_READ, QBDI::MEMORY_UNKNOWN_VALUE},
+      {(QBDI::rword)&v1, 10, 10, QBDI::MEMORY_READ,
+       QBDI::MEMORY_BULK | QBDI::MEMORY_BULK_BACKWARD},
+      {(QBDI::rword)&v2, 10, 10, QBDI::MEMORY_READ,
+       QBDI::MEMORY_BULK | QBDI::MEMORY_BULK_BACKWARD},
   }};
 
   vm.recordMemoryAccess(QBDI::MEMORY_READ);
@@ -790,10 +795,10 @@ TEST_CASE_METHOD(APITest, "MemoryAccessTest_X86_64-rep_movsl") {
        QBDI::MEMORY_UNKNOWN_VALUE | QBDI::MEMORY_UNKNOWN_SIZE},
   }};
   ExpectedMemoryAccesses expectedPost = {{
-      {(QBDI::rword)&v1, 0, sizeof(v1), QBDI::MEMORY_READ,
-       QBDI::MEMORY_UNKNOWN_VALUE},
-      {(QBDI::rword)&v2, 0, sizeof(v1), QBDI::MEMORY_WRITE,
-       QBDI::MEMORY_UNKNOWN_VALUE},
+      {(QBDI::rword)&v1, sizeof(v1), sizeof(v1), QBDI::MEMORY_READ,
+       QBDI::MEMORY_BULK},
+      {(QBDI::rword)&v2, sizeof(v1), sizeof(v1), QBDI::MEMORY_WRITE,
+       QBDI::MEMORY_BULK},
   }};
 
   vm.recordMemoryAccess(QBDI::MEMORY_READ_WRITE);
@@ -832,10 +837,10 @@ TEST_CASE_METHOD(APITest, "MemoryAccessTest_X86_64-rep_movsl2") {
        QBDI::MEMORY_UNKNOWN_VALUE | QBDI::MEMORY_UNKNOWN_SIZE},
   }};
   ExpectedMemoryAccesses expectedPost = {{
-      {(QBDI::rword)&v1, 0, sizeof(v1), QBDI::MEMORY_READ,
-       QBDI::MEMORY_UNKNOWN_VALUE},
-      {(QBDI::rword)&v2, 0, sizeof(v1), QBDI::MEMORY_WRITE,
-       QBDI::MEMORY_UNKNOWN_VALUE},
+      {(QBDI::rword)&v1, sizeof(v1), sizeof(v1), QBDI::MEMORY_READ,
+       QBDI::MEMORY_BULK | QBDI::MEMORY_BULK_BACKWARD},
+      {(QBDI::rword)&v2, sizeof(v1), sizeof(v1), QBDI::MEMORY_WRITE,
+       QBDI::MEMORY_BULK | QBDI::MEMORY_BULK_BACKWARD},
   }};
 
   vm.recordMemoryAccess(QBDI::MEMORY_READ_WRITE);
@@ -1781,3 +1786,301 @@ TEST_CASE_METHOD(APITest, "MemoryAccessTest_X86_64-xsave") {
   for (auto &e : expectedPost.accesses)
     CHECK(e.see);
 }
+
+static QBDI::VMAction countAccess(QBDI::VMInstanceRef vm,
+                                  QBDI::GPRState *gprState,
+                                  QBDI::FPRState *fprState, void *data) {
+  *static_cast<size_t *>(data) += vm->getInstMemoryAccess().size();
+  return QBDI::VMAction::CONTINUE;
+}
+
+TEST_CASE_METHOD(APITest, "MemoryAccessTest_X86_64-ShadowPressure") {
+
+  // a data block of one page can't hold the shadows of all the accesses
+  std::string source;
+  for (int i = 0; i < 256; i++) {
+    source += "movq (%rcx), %rax\n"
+              "movq %rax, 8(%rcx)\n";
+  }
+
+  QBDI::rword v[2] = {0x6a4b2c1d, 0};
+
+  REQUIRE(vm.setExecBlockSize(0x10000, 0));
+  size_t count = 0;
+  vm.addMemAccessCB(QBDI::MEMORY_READ_WRITE, countAccess, &count);
+
+  QBDI::GPRState *state = vm.getGPRState();
+  state->rcx = (QBDI::rword)&v;
+  vm.setGPRState(state);
+
+  QBDI::rword retval;
+  bool ran = runOnASM(&retval, source.c_str());
+
+  CHECK(ran);
+  CHECK(v[1] == v[0]);
+  CHECK(count == 512);
+
+  QBDI::CacheStats stats = vm.getCacheStats();
+  CHECK(stats.shadowFullCount > 0);
+  CHECK(stats.usedShadowSize > 0);
+  CHECK(stats.usedShadowSize <= stats.shadowSize);
+  CHECK(stats.shadowRatio > 0);
+}
+
+static QBDI::VMAction collectBBAccess(QBDI::VMInstanceRef vm,
+                                      const QBDI::VMState *vmState,
+                                      QBDI::GPRState *gprState,
+                                      QBDI::FPRState *fprState,
+                                      const QBDI::MemoryAccess *accesses,
+                                      size_t count, void *data) {
+  std::vector<QBDI::MemoryAccess> *dest =
+      static_cast<std::vector<QBDI::MemoryAccess> *>(data);
+  dest->insert(dest->end(), accesses, accesses + count);
+  return QBDI::VMAction::CONTINUE;
+}
+
+TEST_CASE_METHOD(APITest, "MemoryAccessTest_X86_64-Coalescing") {
+
+  const char source[] = "movq %rax, 16(%rcx)\n"
+                        "movq %rax, 8(%rcx)\n"
+                        "movq %rax, (%rcx)\n"
+                        "addq $32, %rcx\n"
+                        "movq %rax, (%rcx)\n"
+                        "movq (%rcx), %rdx\n";
+
+  QBDI::rword v[5] = {0};
+
+  vm.setOptions(vm.getOptions() |
+                QBDI::Options::OPT_ENABLE_MEMACCESS_COALESCING);
+  std::vector<QBDI::MemoryAccess> accesses;
+  vm.addBBMemAccessCB(QBDI::MEMORY_READ_WRITE, collectBBAccess, &accesses);
+
+  QBDI::GPRState *state = vm.getGPRState();
+  state->rax = 0x5a3c;
+  state->rcx = (QBDI::rword)&v;
+  vm.setGPRState(state);
+
+  QBDI::rword retval;
+  bool ran = runOnASM(&retval, source);
+
+  CHECK(ran);
+  CHECK(v[4] == 0x5a3c);
+  // the three first writes are merged, the write and the read after the
+  // change of rcx are separated, the last access is the read of ret
+  REQUIRE(accesses.size() == 4);
+  CHECK(accesses[0].accessAddress == (QBDI::rword)&v[0]);
+  CHECK(accesses[0].size == 24);
+  CHECK(accesses[0].type == QBDI::MEMORY_WRITE);
+  CHECK(accesses[0].flags == QBDI::MEMORY_UNKNOWN_VALUE);
+  CHECK(accesses[1].accessAddress == (QBDI::rword)&v[4]);
+  CHECK(accesses[1].size == 8);
+  CHECK(accesses[1].type == QBDI::MEMORY_WRITE);
+  CHECK(accesses[2].accessAddress == (QBDI::rword)&v[4]);
+  CHECK(accesses[2].size == 8);
+  CHECK(accesses[2].type == QBDI::MEMORY_READ);
+  CHECK(accesses[3].type == QBDI::MEMORY_READ);
+}
+
+struct WideAccess {
+  QBDI::MemoryAccess access;
+  std::vector<uint8_t> value;
+};
+
+static QBDI::VMAction collectWideAccess(QBDI::VMInstanceRef vm,
+                                        QBDI::GPRState *gprState,
+                                        QBDI::FPRState *fprState,
+                                        void *data) {
+  std::vector<WideAccess> *dest = static_cast<std::vector<WideAccess> *>(data);
+  for (const QBDI::MemoryAccess &access : vm->getInstMemoryAccess()) {
+    WideAccess wide{access, std::vector<uint8_t>(access.size)};
+    if (not vm->getMemoryAccessValue(access, wide.value.data(),
+                                     wide.value.size())) {
+      wide.value.clear();
+    }
+    dest->push_back(std::move(wide));
+  }
+  return QBDI::VMAction::CONTINUE;
+}
+
+TEST_CASE_METHOD(APITest, "MemoryAccessTest_X86_64-WideValue") {
+
+  const char source[] = "movdqu (%rcx), %xmm0\n"
+                        "movdqu %xmm0, 16(%rcx)\n";
+
+  uint8_t v[32] = {0};
+  for (size_t i = 0; i < 16; i++) {
+    v[i] = i * 7 + 1;
+  }
+
+  vm.setOptions(vm.getOptions() |
+                QBDI::Options::OPT_ENABLE_WIDE_MEMACCESS_VALUE);
+  vm.recordMemoryAccess(QBDI::MEMORY_READ_WRITE);
+  std::vector<WideAccess> accesses;
+  vm.addMnemonicCB("MOVDQU*", QBDI::POSTINST, collectWideAccess, &accesses);
+
+  QBDI::GPRState *state = vm.getGPRState();
+  state->rcx = (QBDI::rword)&v;
+  vm.setGPRState(state);
+
+  QBDI::rword retval;
+  bool ran = runOnASM(&retval, source);
+
+  CHECK(ran);
+  CHECK(memcmp(v, v + 16, 16) == 0);
+  REQUIRE(accesses.size() == 2);
+  for (const WideAccess &wide : accesses) {
+    CHECK(wide.access.size == 16);
+    CHECK(wide.access.flags == QBDI::MEMORY_WIDE_VALUE);
+    REQUIRE(wide.value.size() == 16);
+    CHECK(memcmp(wide.value.data(), v, 16) == 0);
+    // the value of the access holds the first bytes
+    CHECK(memcmp(&wide.access.value, v, sizeof(QBDI::rword)) == 0);
+  }
+  CHECK(accesses[0].access.type == QBDI::MEMORY_READ);
+  CHECK(accesses[0].access.accessAddress == (QBDI::rword)&v[0]);
+  CHECK(accesses[1].access.type == QBDI::MEMORY_WRITE);
+  CHECK(accesses[1].access.accessAddress == (QBDI::rword)&v[16]);
+}
+
+static QBDI::VMAction collectInstAccess(QBDI::VMInstanceRef vm,
+                                        QBDI::GPRState *gprState,
+                                        QBDI::FPRState *fprState,
+                                        void *data) {
+  std::vector<QBDI::MemoryAccess> *dest =
+      static_cast<std::vector<QBDI::MemoryAccess> *>(data);
+  for (const QBDI::MemoryAccess &access : vm->getInstMemoryAccess()) {
+    dest->push_back(access);
+  }
+  return QBDI::VMAction::CONTINUE;
+}
+
+TEST_CASE_METHOD(APITest, "MemoryAccessTest_X86_64-NoStack") {
+
+  const char source[] = "pushq %rax\n"
+                        "movq (%rsp), %rdx\n"
+                        "movq %rdx, (%rbp)\n"
+                        "movq %rdx, (%rcx)\n"
+                        "movq 8(%rcx), %rdx\n"
+                        "popq %rax\n";
+
+  QBDI::rword v[2] = {0, 0x1234};
+  QBDI::rword frame = 0;
+
+  vm.recordMemoryAccess(QBDI::MEMORY_READ_WRITE | QBDI::MEMORY_NO_FRAME);
+  std::vector<QBDI::MemoryAccess> accesses;
+  vm.addCodeCB(QBDI::POSTINST, collectInstAccess, &accesses);
+
+  QBDI::GPRState *state = vm.getGPRState();
+  state->rax = 0x5a3c;
+  state->rcx = (QBDI::rword)&v;
+  state->rbp = (QBDI::rword)&frame;
+  vm.setGPRState(state);
+
+  QBDI::rword retval;
+  bool ran = runOnASM(&retval, source);
+
+  CHECK(ran);
+  CHECK(v[0] == 0x5a3c);
+  CHECK(frame == 0x5a3c);
+  // push, pop, ret and the operands based on rsp and rbp aren't recorded
+  REQUIRE(accesses.size() == 2);
+  CHECK(accesses[0].accessAddress == (QBDI::rword)&v[0]);
+  CHECK(accesses[0].type == QBDI::MEMORY_WRITE);
+  CHECK(accesses[0].value == 0x5a3c);
+  CHECK(accesses[1].accessAddress == (QBDI::rword)&v[1]);
+  CHECK(accesses[1].type == QBDI::MEMORY_READ);
+  CHECK(accesses[1].value == 0x1234);
+
+  // a recording of all the accesses records the stack again
+  vm.recordMemoryAccess(QBDI::MEMORY_READ_WRITE);
+  accesses.clear();
+  v[0] = 0;
+  frame = 0;
+  state = vm.getGPRState();
+  state->rcx = (QBDI::rword)&v;
+  state->rbp = (QBDI::rword)&frame;
+  vm.setGPRState(state);
+
+  ran = runOnASM(&retval, source);
+
+  CHECK(ran);
+  CHECK(v[0] == 0x5a3c);
+  CHECK(frame == 0x5a3c);
+  REQUIRE(accesses.size() == 7);
+  CHECK(accesses[2].accessAddress == (QBDI::rword)&frame);
+  CHECK(accesses[2].type == QBDI::MEMORY_WRITE);
+}
+
+struct OwnershipBreaks {
+  QBDI::rword start;
+  QBDI::rword end;
+  std::vector<QBDI::OwnershipAccess> accesses;
+};
+
+static QBDI::VMAction recordOwnership(QBDI::VMInstanceRef vm,
+                                      QBDI::GPRState *gprState,
+                                      QBDI::FPRState *fprState,
+                                      const QBDI::OwnershipAccess *access,
+                                      void *data) {
+  OwnershipBreaks *breaks = static_cast<OwnershipBreaks *>(data);
+  // the stack of runOnASM is checked too
+  if (access->address >= breaks->start and access->address < breaks->end) {
+    breaks->accesses.push_back(*access);
+  }
+  return QBDI::VMAction::CONTINUE;
+}
+
+TEST_CASE_METHOD(APITest, "MemoryAccessTest_X86_64-OwnershipFilter") {
+
+  const char source[] = "movq (%rcx), %rax\n"
+                        "movq %rax, 8(%rcx)\n"
+                        "movq (%rcx), %rdx\n"
+                        "movq 16(%rcx), %rbx\n"
+                        "movq %rbx, 20(%rcx)\n";
+
+  alignas(8) QBDI::rword v[4] = {0x42, 0, 0x1234, 0};
+  OwnershipBreaks breaks = {(QBDI::rword)&v[0], (QBDI::rword)&v[4], {}};
+
+  QBDI::OwnershipShadow shadow;
+  shadow.setOwner((QBDI::rword)&v[2], sizeof(QBDI::rword), 2);
+  CHECK(shadow.getShadowSize() > 0);
+  QBDI::OwnershipFilter filter(shadow, 1, recordOwnership, &breaks);
+  CHECK(filter.getThread() == 1);
+
+  REQUIRE(vm.addOwnershipFilter(&filter) != QBDI::VMError::INVALID_EVENTID);
+
+  QBDI::GPRState *state = vm.getGPRState();
+  state->rcx = (QBDI::rword)&v;
+  vm.setGPRState(state);
+
+  QBDI::rword retval;
+  bool ran = runOnASM(&retval, source);
+
+  CHECK(ran);
+  CHECK(v[1] == 0x42);
+  // the second read of v[0] is owned by the thread and doesn't break
+  REQUIRE(breaks.accesses.size() == 4);
+  CHECK(breaks.accesses[0].address == (QBDI::rword)&v[0]);
+  CHECK(breaks.accesses[0].owner == 0);
+  CHECK(breaks.accesses[0].type == QBDI::MEMORY_READ);
+  CHECK(breaks.accesses[1].address == (QBDI::rword)&v[1]);
+  CHECK(breaks.accesses[1].owner == 0);
+  CHECK(breaks.accesses[1].type == QBDI::MEMORY_WRITE);
+  CHECK(breaks.accesses[2].address == (QBDI::rword)&v[2]);
+  CHECK(breaks.accesses[2].owner == 2);
+  CHECK(breaks.accesses[2].thread == 1);
+  CHECK(breaks.accesses[2].type == QBDI::MEMORY_READ);
+  // only the granule of the first byte of an access is checked
+  CHECK(breaks.accesses[3].address == (QBDI::rword)&v[2] + 4);
+  CHECK(breaks.accesses[3].owner == 2);
+  CHECK(breaks.accesses[3].type == QBDI::MEMORY_WRITE);
+
+  CHECK(shadow.getOwner((QBDI::rword)&v[0]) == 1);
+  CHECK(shadow.getOwner((QBDI::rword)&v[1]) == 1);
+  CHECK(shadow.getOwner((QBDI::rword)&v[2]) == 2);
+  CHECK(shadow.getOwner((QBDI::rword)&v[3]) == 0);
+
+  shadow.clear();
+  CHECK(shadow.getOwner((QBDI::rword)&v[0]) == 0);
+  CHECK(shadow.getShadowSize() > 0);
+}
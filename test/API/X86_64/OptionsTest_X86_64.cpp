@@ -21,6 +21,11 @@
 #include <algorithm>
 #include <sstream>
 #include <string>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
 #include "inttypes.h"
 
 #include "QBDI/Memory.hpp"
@@ -52,6 +57,34 @@ TEST_CASE_METHOD(OptionsTest, "OptionsTest_X86_64-ATTSyntax") {
   CHECK(std::string(ana->disassembly) == std::string("\tleaq\t(%rax), %rbx"));
 }
 
+TEST_CASE_METHOD(OptionsTest, "OptionsTest_X86_64-ATTSyntaxKeepCache") {
+
+  InMemoryObject leaObj("leaq (%rax), %rbx\nret\n");
+  QBDI::rword addr = (QBDI::rword)leaObj.getCode().data();
+
+  vm.setOptions(QBDI::Options::NO_OPT);
+  CHECK(vm.precacheBasicBlock(addr));
+  QBDI::CacheStats stats = vm.getCacheStats();
+
+  const QBDI::InstAnalysis *ana =
+      vm.getCachedInstAnalysis(addr, QBDI::ANALYSIS_DISASSEMBLY);
+  REQUIRE(ana != nullptr);
+  REQUIRE(ana->disassembly != nullptr);
+  CHECK(std::string(ana->disassembly) == std::string("\tlea\trbx, [rax]"));
+
+  // only the analyses are dropped
+  vm.setOptions(QBDI::Options::OPT_ATT_SYNTAX);
+  QBDI::CacheStats stats2 = vm.getCacheStats();
+  CHECK(stats2.flushCount == stats.flushCount);
+  CHECK(stats2.execBlockCount == stats.execBlockCount);
+  CHECK_FALSE(vm.precacheBasicBlock(addr));
+
+  ana = vm.getCachedInstAnalysis(addr, QBDI::ANALYSIS_DISASSEMBLY);
+  REQUIRE(ana != nullptr);
+  REQUIRE(ana->disassembly != nullptr);
+  CHECK(std::string(ana->disassembly) == std::string("\tleaq\t(%rax), %rbx"));
+}
+
 static QBDI::VMAction setBool(QBDI::VMInstanceRef vm, QBDI::GPRState *gprState,
                               QBDI::FPRState *fprState, void *data) {
   *((bool *)data) = true;
@@ -103,3 +136,626 @@ TEST_CASE_METHOD(OptionsTest, "OptionsTest_X86_64-setOption") {
 
   QBDI::alignedFree(fakestack);
 }
+
+static QBDI::VMAction countInst(QBDI::VMInstanceRef vm,
+                                QBDI::GPRState *gprState,
+                                QBDI::FPRState *fprState, void *data) {
+  *((unsigned *)data) += 1;
+  return QBDI::VMAction::CONTINUE;
+}
+
+static QBDI::VMAction countEvent(QBDI::VMInstanceRef vm,
+                                 const QBDI::VMState *vmState,
+                                 QBDI::GPRState *gprState,
+                                 QBDI::FPRState *fprState, void *data) {
+  *((unsigned *)data) += 1;
+  return QBDI::VMAction::CONTINUE;
+}
+
+TEST_CASE_METHOD(OptionsTest, "OptionsTest_X86_64-BlockChaining") {
+
+  InMemoryObject loopObj("xorq %rax, %rax\n"
+                         "movq $100, %rcx\n"
+                         "1:\n"
+                         "addq $2, %rax\n"
+                         "decq %rcx\n"
+                         "jnz 1b\n"
+                         "ret\n");
+  QBDI::rword addr = (QBDI::rword)loopObj.getCode().data();
+
+  uint8_t *fakestack;
+  QBDI::GPRState *state = vm.getGPRState();
+  bool ret = QBDI::allocateVirtualStack(state, 4096, &fakestack);
+  REQUIRE(ret == true);
+
+  vm.setOptions(QBDI::Options::OPT_ENABLE_BLOCK_CHAINING);
+  vm.addInstrumentedRange(addr, addr + (QBDI::rword)loopObj.getCode().size());
+
+  QBDI::rword retval = 0;
+  REQUIRE(vm.call(&retval, addr, {}));
+  REQUIRE(retval == 200);
+
+  // the InstCallback must be reached in linked sequences
+  unsigned instCount = 0;
+  vm.addCodeAddrCB(addr + 10, QBDI::PREINST, countInst, &instCount);
+  retval = 0;
+  REQUIRE(vm.call(&retval, addr, {}));
+  REQUIRE(retval == 200);
+  REQUIRE(instCount == 100);
+
+  // BASIC_BLOCK_NEW is signaled when the code is translated, the sequences
+  // are still linked
+  unsigned newCount = 0;
+  uint32_t newID =
+      vm.addVMEventCB(QBDI::BASIC_BLOCK_NEW, countEvent, &newCount);
+  REQUIRE(newID != QBDI::INVALID_EVENTID);
+  vm.clearAllCache();
+  retval = 0;
+  REQUIRE(vm.call(&retval, addr, {}));
+  REQUIRE(retval == 200);
+  REQUIRE(newCount > 0);
+  QBDI::rword cacheHits = vm.getCacheStats().cacheHits;
+  retval = 0;
+  REQUIRE(vm.call(&retval, addr, {}));
+  REQUIRE(retval == 200);
+  REQUIRE(vm.getCacheStats().cacheHits - cacheHits < 100);
+  REQUIRE(vm.deleteInstrumentation(newID));
+
+  // SEQUENCE_ENTRY needs to return to the VM for each sequence
+  unsigned eventCount = 0;
+  uint32_t seqID =
+      vm.addVMEventCB(QBDI::SEQUENCE_ENTRY, countEvent, &eventCount);
+  retval = 0;
+  REQUIRE(vm.call(&retval, addr, {}));
+  REQUIRE(retval == 200);
+  REQUIRE(eventCount > 100);
+
+  // the sequences are linked again once the callback is removed
+  REQUIRE(vm.deleteInstrumentation(seqID));
+  cacheHits = vm.getCacheStats().cacheHits;
+  retval = 0;
+  REQUIRE(vm.call(&retval, addr, {}));
+  REQUIRE(retval == 200);
+  REQUIRE(vm.getCacheStats().cacheHits - cacheHits < 100);
+
+  QBDI::alignedFree(fakestack);
+}
+
+TEST_CASE_METHOD(OptionsTest, "OptionsTest_X86_64-IndirectCache") {
+
+  InMemoryObject loopObj("xorq %rax, %rax\n"
+                         "movq $100, %rcx\n"
+                         "1:\n"
+                         "callq 2f\n"
+                         "decq %rcx\n"
+                         "jnz 1b\n"
+                         "ret\n"
+                         "2:\n"
+                         "addq $2, %rax\n"
+                         "leaq 3f(%rip), %rdx\n"
+                         "jmpq *%rdx\n"
+                         "3:\n"
+                         "ret\n");
+  QBDI::rword addr = (QBDI::rword)loopObj.getCode().data();
+
+  uint8_t *fakestack;
+  QBDI::GPRState *state = vm.getGPRState();
+  bool ret = QBDI::allocateVirtualStack(state, 4096, &fakestack);
+  REQUIRE(ret == true);
+
+  vm.setOptions(QBDI::Options::OPT_ENABLE_BLOCK_CHAINING |
+                QBDI::Options::OPT_ENABLE_INDIRECT_CACHE);
+  vm.addInstrumentedRange(addr, addr + (QBDI::rword)loopObj.getCode().size());
+
+  QBDI::rword retval = 0;
+  REQUIRE(vm.call(&retval, addr, {}));
+  REQUIRE(retval == 200);
+  REQUIRE(state->rcx == 0);
+
+  // the InstCallback must be reached after a hit in the cache
+  unsigned instCount = 0;
+  vm.addCodeAddrCB(addr + 21, QBDI::PREINST, countInst, &instCount);
+  retval = 0;
+  REQUIRE(vm.call(&retval, addr, {}));
+  REQUIRE(retval == 200);
+  REQUIRE(instCount == 100);
+
+  // SEQUENCE_ENTRY needs to return to the VM for each sequence
+  unsigned eventCount = 0;
+  vm.addVMEventCB(QBDI::SEQUENCE_ENTRY, countEvent, &eventCount);
+  retval = 0;
+  REQUIRE(vm.call(&retval, addr, {}));
+  REQUIRE(retval == 200);
+  REQUIRE(eventCount > 300);
+
+  QBDI::alignedFree(fakestack);
+}
+
+TEST_CASE_METHOD(OptionsTest, "OptionsTest_X86_64-ReturnStack") {
+
+  // the two return addresses use the same entry of the indirect branch cache
+  InMemoryObject loopObj("xorq %rax, %rax\n"
+                         "movq $100, %rcx\n"
+                         "jmp 1f\n"
+                         ".p2align 8, 0x90\n"
+                         "1:\n"
+                         "callq 3f\n"
+                         "jmp 2f\n"
+                         ".p2align 8, 0x90\n"
+                         "2:\n"
+                         "callq 3f\n"
+                         "decq %rcx\n"
+                         "jnz 1b\n"
+                         "ret\n"
+                         "3:\n"
+                         "addq $1, %rax\n"
+                         "ret\n");
+  QBDI::rword addr = (QBDI::rword)loopObj.getCode().data();
+
+  uint8_t *fakestack;
+  QBDI::GPRState *state = vm.getGPRState();
+  bool ret = QBDI::allocateVirtualStack(state, 4096, &fakestack);
+  REQUIRE(ret == true);
+
+  vm.setOptions(QBDI::Options::OPT_ENABLE_BLOCK_CHAINING |
+                QBDI::Options::OPT_ENABLE_INDIRECT_CACHE);
+  vm.addInstrumentedRange(addr, addr + (QBDI::rword)loopObj.getCode().size());
+
+  QBDI::rword retval = 0;
+  REQUIRE(vm.call(&retval, addr, {}));
+  REQUIRE(retval == 200);
+  QBDI::rword misses = vm.getCacheStats().ibtcMisses;
+
+  // the returns are predicted by the links of the calls
+  vm.setOptions(QBDI::Options::OPT_ENABLE_BLOCK_CHAINING |
+                QBDI::Options::OPT_ENABLE_INDIRECT_CACHE |
+                QBDI::Options::OPT_ENABLE_RETURN_STACK);
+  retval = 0;
+  REQUIRE(vm.call(&retval, addr, {}));
+  REQUIRE(retval == 200);
+  REQUIRE(state->rcx == 0);
+  CHECK(vm.getCacheStats().ibtcMisses < misses);
+
+  QBDI::alignedFree(fakestack);
+}
+
+static QBDI::VMAction incRax(QBDI::VMInstanceRef vm, QBDI::GPRState *gprState,
+                             QBDI::FPRState *fprState, void *data) {
+  gprState->rax += 1;
+  return QBDI::VMAction::CONTINUE;
+}
+
+TEST_CASE_METHOD(OptionsTest, "OptionsTest_X86_64-SharedContext") {
+
+  InMemoryObject loopObj("xorq %rax, %rax\n"
+                         "movq $100, %rcx\n"
+                         "1:\n"
+                         "callq *%rdi\n"
+                         "decq %rcx\n"
+                         "jnz 1b\n"
+                         "ret\n");
+  InMemoryObject addObj("addq $2, %rax\n"
+                        "ret\n");
+  QBDI::rword addr = (QBDI::rword)loopObj.getCode().data();
+  QBDI::rword addAddr = (QBDI::rword)addObj.getCode().data();
+
+  uint8_t *fakestack;
+  QBDI::GPRState *state = vm.getGPRState();
+  bool ret = QBDI::allocateVirtualStack(state, 4096, &fakestack);
+  REQUIRE(ret == true);
+
+  vm.setOptions(QBDI::Options::OPT_ENABLE_SHARED_CONTEXT);
+  vm.addInstrumentedRange(addr, addr + (QBDI::rword)loopObj.getCode().size());
+  vm.addInstrumentedRange(addAddr,
+                          addAddr + (QBDI::rword)addObj.getCode().size());
+
+  QBDI::rword retval = 0;
+  REQUIRE(vm.call(&retval, addr, {addAddr}));
+  REQUIRE(retval == 200);
+
+  // the state written by a callback must be kept across the ExecBlocks
+  vm.addCodeAddrCB(addAddr, QBDI::PREINST, incRax, nullptr);
+  retval = 0;
+  REQUIRE(vm.call(&retval, addr, {addAddr}));
+  REQUIRE(retval == 300);
+
+  // the native function is executed by the ExecBroker in the shared context
+  vm.removeInstrumentedRange(addAddr,
+                             addAddr + (QBDI::rword)addObj.getCode().size());
+  retval = 0;
+  REQUIRE(vm.call(&retval, addr, {addAddr}));
+  REQUIRE(retval == 200);
+
+  QBDI::alignedFree(fakestack);
+}
+
+TEST_CASE_METHOD(OptionsTest, "OptionsTest_X86_64-DualMapping") {
+
+  InMemoryObject loopObj("xorq %rax, %rax\n"
+                         "movq $100, %rcx\n"
+                         "1:\n"
+                         "callq *%rdi\n"
+                         "decq %rcx\n"
+                         "jnz 1b\n"
+                         "ret\n");
+  InMemoryObject addObj("addq $2, %rax\n"
+                        "ret\n");
+  QBDI::rword addr = (QBDI::rword)loopObj.getCode().data();
+  QBDI::rword addAddr = (QBDI::rword)addObj.getCode().data();
+
+  uint8_t *fakestack;
+  QBDI::GPRState *state = vm.getGPRState();
+  bool ret = QBDI::allocateVirtualStack(state, 4096, &fakestack);
+  REQUIRE(ret == true);
+
+  // the exits are patched through the writable alias
+  vm.setOptions(QBDI::Options::OPT_ENABLE_DUAL_MAPPING |
+                QBDI::Options::OPT_ENABLE_BLOCK_CHAINING);
+  vm.addInstrumentedRange(addr, addr + (QBDI::rword)loopObj.getCode().size());
+  vm.addInstrumentedRange(addAddr,
+                          addAddr + (QBDI::rword)addObj.getCode().size());
+
+  QBDI::rword retval = 0;
+  REQUIRE(vm.call(&retval, addr, {addAddr}));
+  REQUIRE(retval == 200);
+
+  // write new sequences in the executed ExecBlocks
+  vm.addCodeAddrCB(addAddr, QBDI::PREINST, incRax, nullptr);
+  retval = 0;
+  REQUIRE(vm.call(&retval, addr, {addAddr}));
+  REQUIRE(retval == 300);
+
+  QBDI::alignedFree(fakestack);
+}
+
+TEST_CASE_METHOD(OptionsTest, "OptionsTest_X86_64-HugePages") {
+
+  InMemoryObject loopObj("xorq %rax, %rax\n"
+                         "movq $100, %rcx\n"
+                         "1:\n"
+                         "callq *%rdi\n"
+                         "decq %rcx\n"
+                         "jnz 1b\n"
+                         "ret\n");
+  InMemoryObject addObj("addq $2, %rax\n"
+                        "ret\n");
+  QBDI::rword addr = (QBDI::rword)loopObj.getCode().data();
+  QBDI::rword addAddr = (QBDI::rword)addObj.getCode().data();
+
+  uint8_t *fakestack;
+  QBDI::GPRState *state = vm.getGPRState();
+  bool ret = QBDI::allocateVirtualStack(state, 4096, &fakestack);
+  REQUIRE(ret == true);
+
+  // the data blocks aren't after the code blocks
+  vm.setOptions(QBDI::Options::OPT_ENABLE_HUGE_PAGES |
+                QBDI::Options::OPT_ENABLE_BLOCK_CHAINING);
+  vm.addInstrumentedRange(addr, addr + (QBDI::rword)loopObj.getCode().size());
+  vm.addInstrumentedRange(addAddr,
+                          addAddr + (QBDI::rword)addObj.getCode().size());
+
+  QBDI::rword retval = 0;
+  REQUIRE(vm.call(&retval, addr, {addAddr}));
+  REQUIRE(retval == 200);
+
+  // the flushed ExecBlocks are reused
+  vm.clearAllCache();
+  vm.addCodeAddrCB(addAddr, QBDI::PREINST, incRax, nullptr);
+  retval = 0;
+  REQUIRE(vm.call(&retval, addr, {addAddr}));
+  REQUIRE(retval == 300);
+
+  QBDI::alignedFree(fakestack);
+}
+
+static QBDI::VMAction countNewBlock(QBDI::VMInstanceRef vm,
+                                   const QBDI::VMState *vmState,
+                                   QBDI::GPRState *gprState,
+                                   QBDI::FPRState *fprState, void *data) {
+  *static_cast<unsigned *>(data) += 1;
+  return QBDI::VMAction::CONTINUE;
+}
+
+TEST_CASE_METHOD(OptionsTest, "OptionsTest_X86_64-CacheLimit") {
+
+  InMemoryObject loopObj("xorq %rax, %rax\n"
+                         "movq $100, %rcx\n"
+                         "1:\n"
+                         "callq *%rdi\n"
+                         "decq %rcx\n"
+                         "jnz 1b\n"
+                         "ret\n");
+  InMemoryObject addObj("addq $2, %rax\n"
+                        "ret\n");
+  QBDI::rword addr = (QBDI::rword)loopObj.getCode().data();
+  QBDI::rword addAddr = (QBDI::rword)addObj.getCode().data();
+
+  uint8_t *fakestack;
+  QBDI::GPRState *state = vm.getGPRState();
+  bool ret = QBDI::allocateVirtualStack(state, 4096, &fakestack);
+  REQUIRE(ret == true);
+
+  vm.addInstrumentedRange(addr, addr + (QBDI::rword)loopObj.getCode().size());
+  vm.addInstrumentedRange(addAddr,
+                          addAddr + (QBDI::rword)addObj.getCode().size());
+  unsigned newBlock = 0;
+  vm.addVMEventCB(QBDI::BASIC_BLOCK_NEW, countNewBlock, &newBlock);
+
+  QBDI::rword retval = 0;
+  REQUIRE(vm.call(&retval, addr, {addAddr}));
+  REQUIRE(retval == 200);
+  unsigned nbNewBlock = newBlock;
+
+  // each region evicts the other one when it is translated again
+  REQUIRE(vm.getCacheLimit() == 0);
+  vm.setCacheLimit(1);
+  REQUIRE(vm.getCacheLimit() == 1);
+  vm.clearAllCache();
+  newBlock = 0;
+  retval = 0;
+  REQUIRE(vm.call(&retval, addr, {addAddr}));
+  REQUIRE(retval == 200);
+  REQUIRE(newBlock > 100 + nbNewBlock);
+
+  // without limit, the cache is kept between the calls
+  vm.setCacheLimit(0);
+  newBlock = 0;
+  REQUIRE(vm.call(&retval, addr, {addAddr}));
+  REQUIRE(newBlock <= nbNewBlock);
+
+  QBDI::alignedFree(fakestack);
+}
+
+TEST_CASE_METHOD(OptionsTest, "OptionsTest_X86_64-AsyncPatch") {
+
+  InMemoryObject loopObj("xorq %rax, %rax\n"
+                         "movq $100, %rcx\n"
+                         "1:\n"
+                         "callq *%rdi\n"
+                         "decq %rcx\n"
+                         "jnz 1b\n"
+                         "ret\n");
+  InMemoryObject addObj("addq $2, %rax\n"
+                        "ret\n");
+  QBDI::rword addr = (QBDI::rword)loopObj.getCode().data();
+  QBDI::rword addAddr = (QBDI::rword)addObj.getCode().data();
+
+  uint8_t *fakestack;
+  QBDI::GPRState *state = vm.getGPRState();
+  bool ret = QBDI::allocateVirtualStack(state, 4096, &fakestack);
+  REQUIRE(ret == true);
+
+  vm.setOptions(QBDI::Options::OPT_ENABLE_ASYNC_PATCH);
+  vm.addInstrumentedRange(addr, addr + (QBDI::rword)loopObj.getCode().size());
+  vm.addInstrumentedRange(addAddr,
+                          addAddr + (QBDI::rword)addObj.getCode().size());
+  unsigned newBlock = 0;
+  vm.addVMEventCB(QBDI::BASIC_BLOCK_NEW, countNewBlock, &newBlock);
+
+  QBDI::rword retval = 0;
+  REQUIRE(vm.call(&retval, addr, {addAddr}));
+  REQUIRE(retval == 200);
+  // the prepared basic blocks are still reported as new
+  unsigned firstRun = newBlock;
+  REQUIRE(firstRun > 0);
+
+  // the instrumentation is applied on the prepared basic blocks
+  vm.addCodeAddrCB(addAddr, QBDI::PREINST, incRax, nullptr);
+  retval = 0;
+  REQUIRE(vm.call(&retval, addr, {addAddr}));
+  REQUIRE(retval == 300);
+
+  QBDI::alignedFree(fakestack);
+}
+
+TEST_CASE_METHOD(OptionsTest, "OptionsTest_X86_64-SuperBlock") {
+
+  InMemoryObject loopObj("xorq %rax, %rax\n"
+                         "movq $200, %rcx\n"
+                         "1:\n"
+                         "callq 2f\n"
+                         "decq %rcx\n"
+                         "jnz 1b\n"
+                         "ret\n"
+                         "2:\n"
+                         "addq $2, %rax\n"
+                         "jmp 3f\n"
+                         "3:\n"
+                         "ret\n");
+  QBDI::rword addr = (QBDI::rword)loopObj.getCode().data();
+
+  uint8_t *fakestack;
+  QBDI::GPRState *state = vm.getGPRState();
+  bool ret = QBDI::allocateVirtualStack(state, 4096, &fakestack);
+  REQUIRE(ret == true);
+
+  vm.setOptions(QBDI::Options::OPT_ENABLE_SUPERBLOCK);
+  vm.addInstrumentedRange(addr, addr + (QBDI::rword)loopObj.getCode().size());
+
+  QBDI::rword retval = 0;
+  REQUIRE(vm.call(&retval, addr));
+  REQUIRE(retval == 400);
+
+  // the superblocks are built again with the new instrumentation
+  uint32_t id = vm.addMnemonicCB("ADD*", QBDI::PREINST, incRax, nullptr);
+  REQUIRE(id != QBDI::INVALID_EVENTID);
+  retval = 0;
+  REQUIRE(vm.call(&retval, addr));
+  REQUIRE(retval == 600);
+  vm.deleteInstrumentation(id);
+
+  // the basic block events are the same as without superblocks
+  unsigned bbEntry = 0;
+  vm.addVMEventCB(QBDI::BASIC_BLOCK_ENTRY, countNewBlock, &bbEntry);
+  REQUIRE(vm.call(&retval, addr));
+  REQUIRE(retval == 400);
+  unsigned withSuperBlock = bbEntry;
+
+  vm.setOptions(QBDI::Options::NO_OPT);
+  bbEntry = 0;
+  REQUIRE(vm.call(&retval, addr));
+  REQUIRE(retval == 400);
+  REQUIRE(bbEntry == withSuperBlock);
+
+  QBDI::alignedFree(fakestack);
+}
+
+TEST_CASE_METHOD(OptionsTest, "OptionsTest_X86_64-BypassPLT") {
+
+  InMemoryObject callObj("callq *%rdi\n"
+                         "addq $1, %rax\n"
+                         "ret\n");
+  InMemoryObject targetObj("movq $40, %rax\n"
+                           "ret\n");
+  InMemoryObject otherObj("movq $50, %rax\n"
+                          "ret\n");
+  QBDI::rword addr = (QBDI::rword)callObj.getCode().data();
+  QBDI::rword target = (QBDI::rword)targetObj.getCode().data();
+  QBDI::rword other = (QBDI::rword)otherObj.getCode().data();
+
+  // jmp [rip], followed by the slot. The stubs are only executed by the VM.
+  std::vector<uint8_t> stub = {0xff, 0x25, 0x00, 0x00, 0x00, 0x00};
+  stub.resize(stub.size() + sizeof(QBDI::rword));
+  memcpy(stub.data() + 6, &target, sizeof(QBDI::rword));
+  // endbr64; bnd jmp [rip]
+  std::vector<uint8_t> ibtStub = {0xf3, 0x0f, 0x1e, 0xfa, 0xf2, 0xff,
+                                  0x25, 0x00, 0x00, 0x00, 0x00};
+  ibtStub.resize(ibtStub.size() + sizeof(QBDI::rword));
+  memcpy(ibtStub.data() + 11, &target, sizeof(QBDI::rword));
+  QBDI::rword stubAddr = (QBDI::rword)stub.data();
+  QBDI::rword ibtStubAddr = (QBDI::rword)ibtStub.data();
+
+  uint8_t *fakestack;
+  QBDI::GPRState *state = vm.getGPRState();
+  bool ret = QBDI::allocateVirtualStack(state, 4096, &fakestack);
+  REQUIRE(ret == true);
+
+  vm.addInstrumentedRange(addr, addr + (QBDI::rword)callObj.getCode().size());
+  vm.addInstrumentedRange(target,
+                          target + (QBDI::rword)targetObj.getCode().size());
+  vm.addInstrumentedRange(other,
+                          other + (QBDI::rword)otherObj.getCode().size());
+  vm.addInstrumentedRange(stubAddr, stubAddr + stub.size());
+  vm.addInstrumentedRange(ibtStubAddr, ibtStubAddr + ibtStub.size());
+  unsigned stubInst = 0;
+  vm.addCodeRangeCB(stubAddr, stubAddr + stub.size(), QBDI::PREINST,
+                    countInst, &stubInst);
+  vm.addCodeRangeCB(ibtStubAddr, ibtStubAddr + ibtStub.size(), QBDI::PREINST,
+                    countInst, &stubInst);
+
+  // without the option, the stub is instrumented
+  QBDI::rword retval = 0;
+  REQUIRE(vm.call(&retval, addr, {stubAddr}));
+  REQUIRE(retval == 41);
+  REQUIRE(stubInst == 1);
+
+  vm.setOptions(QBDI::Options::OPT_BYPASS_PLT);
+  stubInst = 0;
+  retval = 0;
+  REQUIRE(vm.call(&retval, addr, {stubAddr}));
+  REQUIRE(retval == 41);
+  REQUIRE(vm.call(&retval, addr, {ibtStubAddr}));
+  REQUIRE(retval == 41);
+  REQUIRE(stubInst == 0);
+
+  // the slot is read again at each call
+  memcpy(stub.data() + 6, &other, sizeof(QBDI::rword));
+  REQUIRE(vm.call(&retval, addr, {stubAddr}));
+  REQUIRE(retval == 51);
+  REQUIRE(stubInst == 0);
+
+  QBDI::alignedFree(fakestack);
+}
+
+#if defined(QBDI_PLATFORM_LINUX) || defined(QBDI_PLATFORM_ANDROID)
+TEST_CASE_METHOD(OptionsTest, "OptionsTest_X86_64-PerfMap") {
+
+  InMemoryObject addObj("lea 0x2a(%rdi), %rax\nret\n");
+  QBDI::rword addr = (QBDI::rword)addObj.getCode().data();
+
+  QBDI::GPRState *state = vm.getGPRState();
+  uint8_t *fakestack;
+  bool ret = QBDI::allocateVirtualStack(state, 4096, &fakestack);
+  REQUIRE(ret == true);
+
+  vm.setOptions(QBDI::Options::OPT_ENABLE_PERF_MAP);
+  vm.addInstrumentedRange(addr, addr + (QBDI::rword)addObj.getCode().size());
+  vm.addCodeCB(
+      QBDI::PREINST,
+      [](QBDI::VMInstanceRef, QBDI::GPRState *, QBDI::FPRState *) {
+        return QBDI::VMAction::CONTINUE;
+      });
+
+  QBDI::rword retval = 0;
+  REQUIRE(vm.call(&retval, addr, {1}));
+  REQUIRE(retval == 43);
+
+  // the entries are written at the end of the run
+  std::string path = "/tmp/perf-" + std::to_string(getpid()) + ".map";
+  FILE *file = fopen(path.c_str(), "r");
+  REQUIRE(file != nullptr);
+  bool foundCode = false;
+  bool foundInstrumentation = false;
+  char line[512];
+  while (fgets(line, sizeof(line), file) != nullptr) {
+    uint64_t start = 0, size = 0;
+    char name[400] = {0};
+    if (sscanf(line, "%" SCNx64 " %" SCNx64 " %399[^\n]", &start, &size,
+               name) != 3) {
+      continue;
+    }
+    CHECK(size != 0);
+    if (strncmp(name, "[QBDI] ", 7) == 0) {
+      foundCode = true;
+    } else if (strncmp(name, "[QBDI instrumentation] ", 23) == 0) {
+      foundInstrumentation = true;
+    }
+  }
+  fclose(file);
+  CHECK(foundCode);
+  CHECK(foundInstrumentation);
+
+  QBDI::alignedFree(fakestack);
+}
+#endif
+
+#if defined(QBDI_PLATFORM_LINUX) || defined(QBDI_PLATFORM_ANDROID) ||          \
+    defined(QBDI_PLATFORM_OSX)
+TEST_CASE_METHOD(OptionsTest, "OptionsTest_X86_64-SMCDetection") {
+
+  // mov $value, %eax; ret
+  const uint8_t code[] = {0xb8, 0x01, 0x00, 0x00, 0x00, 0xc3};
+  void *page = mmap(nullptr, 4096, PROT_READ | PROT_WRITE | PROT_EXEC,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  REQUIRE(page != MAP_FAILED);
+  uint8_t *jit = static_cast<uint8_t *>(page);
+  memcpy(jit, code, sizeof(code));
+  QBDI::rword addr = reinterpret_cast<QBDI::rword>(jit);
+
+  QBDI::GPRState *state = vm.getGPRState();
+  uint8_t *fakestack;
+  bool ret = QBDI::allocateVirtualStack(state, 4096, &fakestack);
+  REQUIRE(ret == true);
+
+  vm.setOptions(QBDI::Options::OPT_ENABLE_SMC_DETECTION |
+                QBDI::Options::OPT_ENABLE_BLOCK_CHAINING);
+  vm.addInstrumentedRange(addr, addr + 4096);
+
+  QBDI::rword retval = 0;
+  REQUIRE(vm.call(&retval, addr));
+  REQUIRE(retval == 1);
+  REQUIRE(vm.call(&retval, addr));
+  REQUIRE(retval == 1);
+
+  // the write to the page flushes its translated code
+  for (uint8_t value = 2; value < 5; value++) {
+    jit[1] = value;
+    REQUIRE(vm.call(&retval, addr));
+    REQUIRE(retval == value);
+  }
+
+  vm.clearAllCache();
+  QBDI::alignedFree(fakestack);
+  munmap(page, 4096);
+}
+#endif
@@ -0,0 +1,121 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <catch2/catch.hpp>
+#include "API/APITest.h"
+
+#include "QBDI/Taint.h"
+
+struct TaintEvents {
+  uint32_t branch;
+  uint32_t pointer;
+  QBDI::TaintLabel label;
+};
+
+static QBDI::VMAction countTaintEvent(QBDI::VMInstanceRef vm,
+                                      QBDI::GPRState *gprState,
+                                      QBDI::FPRState *fprState,
+                                      QBDI::TaintEvent event,
+                                      QBDI::TaintLabel label, void *data) {
+  TaintEvents *events = static_cast<TaintEvents *>(data);
+  if (event == QBDI::TAINT_BRANCH) {
+    events->branch++;
+  } else if (event == QBDI::TAINT_POINTER) {
+    events->pointer++;
+  }
+  events->label |= label;
+  return QBDI::VMAction::CONTINUE;
+}
+
+TEST_CASE_METHOD(APITest, "TaintTest_X86_64-Propagation") {
+
+  const char source[] = "movq (%rcx), %rax\n"
+                        "addq %rax, %rdx\n"
+                        "movq %rdx, 8(%rcx)\n"
+                        "movb 24(%rcx), %bl\n"
+                        "xorq %rax, %rax\n"
+                        "movq %rax, 16(%rcx)\n";
+
+  QBDI::rword v[4] = {1, 0, 0, 0};
+  QBDI::TaintState taint;
+  taint.setMemoryLabel((QBDI::rword)&v[0], sizeof(QBDI::rword), 1);
+  taint.setMemoryLabel((QBDI::rword)&v[2], sizeof(QBDI::rword), 2);
+  taint.setMemoryLabel((QBDI::rword)&v[3], 1, 4);
+  taint.setRegisterLabel(1, 8);
+  CHECK(taint.getShadowSize() > 0);
+
+  REQUIRE(vm.addTaintTracking(&taint, nullptr, nullptr) !=
+          QBDI::VMError::INVALID_EVENTID);
+
+  QBDI::GPRState *state = vm.getGPRState();
+  state->rcx = (QBDI::rword)&v;
+  state->rdx = 2;
+  vm.setGPRState(state);
+
+  QBDI::rword retval;
+  bool ran = runOnASM(&retval, source);
+
+  CHECK(ran);
+  CHECK(v[1] == 3);
+  // rax is cleared by the xor, rdx holds the loaded value
+  CHECK(taint.getRegisterLabel(0) == 0);
+  CHECK(taint.getRegisterLabel(3) == 1);
+  // the write of bl keeps the label of the other bytes of rbx
+  CHECK(taint.getRegisterLabel(1) == (8 | 4));
+  CHECK(taint.getMemoryLabel((QBDI::rword)&v[1], sizeof(QBDI::rword)) == 1);
+  CHECK(taint.getMemoryLabel((QBDI::rword)&v[2], sizeof(QBDI::rword)) == 0);
+  CHECK(taint.getRegisterLabel(QBDI::REG_SP) == 0);
+
+  taint.clear();
+  CHECK(taint.getMemoryLabel((QBDI::rword)&v[0], sizeof(v)) == 0);
+  CHECK(taint.getRegisterLabel(1) == 0);
+  CHECK(taint.getShadowSize() == 0);
+}
+
+TEST_CASE_METHOD(APITest, "TaintTest_X86_64-PolicyEvents") {
+
+  const char source[] = "movq (%rcx), %rax\n"
+                        "movq (%rdx,%rax,8), %rbx\n"
+                        "cmpq $0, %rax\n"
+                        "jne test_taint\n"
+                        "nop\n"
+                        "test_taint:\n";
+
+  QBDI::rword v[2] = {0, 0x42};
+  QBDI::TaintState taint;
+  taint.setMemoryLabel((QBDI::rword)&v[0], sizeof(QBDI::rword), 2);
+  TaintEvents events = {0, 0, 0};
+
+  REQUIRE(vm.addTaintTracking(&taint, countTaintEvent, &events) !=
+          QBDI::VMError::INVALID_EVENTID);
+
+  QBDI::GPRState *state = vm.getGPRState();
+  state->rcx = (QBDI::rword)&v[0];
+  state->rdx = (QBDI::rword)&v[1];
+  vm.setGPRState(state);
+
+  QBDI::rword retval;
+  bool ran = runOnASM(&retval, source);
+
+  CHECK(ran);
+  CHECK(events.pointer == 1);
+  CHECK(events.branch == 1);
+  CHECK(events.label == 2);
+  // the value loaded through the tainted pointer isn't tainted
+  CHECK(taint.getRegisterLabel(1) == 0);
+  CHECK(taint.getFlagsLabel() == 2);
+}
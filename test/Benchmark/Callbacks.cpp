@@ -0,0 +1,272 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <chrono>
+#include <functional>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "QBDI.h"
+#include "QBDI/VM_C.h"
+
+#include "Benchmark/Report.h"
+
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include <catch2/catch.hpp>
+
+// Matrix of the cost of the kinds of callbacks. The results are printed and
+// written as JSON in the file of QBDI_BENCHMARK_JSON if it is defined.
+
+static const size_t BUFFER_SIZE = 4096;
+static QBDI::rword buffer[BUFFER_SIZE];
+
+QBDI_NOINLINE QBDI::rword callbackTarget(QBDI::rword n) {
+  QBDI::rword acc = 0;
+  for (QBDI::rword i = 0; i < n; i++) {
+    acc += buffer[(i * 7) % BUFFER_SIZE];
+    buffer[i % BUFFER_SIZE] = acc;
+  }
+  return acc;
+}
+
+struct CallbackResult {
+  std::string name;
+  std::string kind;
+  double nsPerRun;
+  double nsPerCallback;
+  uint64_t callbacks;
+};
+
+static QBDI::VMAction countInstCB(QBDI::VMInstanceRef vm,
+                                  QBDI::GPRState *gprState,
+                                  QBDI::FPRState *fprState, void *data) {
+  (*static_cast<uint64_t *>(data))++;
+  return QBDI::VMAction::CONTINUE;
+}
+
+static QBDI::VMAction countEventCB(QBDI::VMInstanceRef vm,
+                                   const QBDI::VMState *vmState,
+                                   QBDI::GPRState *gprState,
+                                   QBDI::FPRState *fprState, void *data) {
+  (*static_cast<uint64_t *>(data))++;
+  return QBDI::VMAction::CONTINUE;
+}
+
+struct AnalysisData {
+  uint64_t count;
+  QBDI::AnalysisType type;
+};
+
+static QBDI::VMAction analysisCB(QBDI::VMInstanceRef vm,
+                                 QBDI::GPRState *gprState,
+                                 QBDI::FPRState *fprState, void *data) {
+  AnalysisData *d = static_cast<AnalysisData *>(data);
+  if (vm->getInstAnalysis(d->type) != nullptr) {
+    d->count++;
+  }
+  return QBDI::VMAction::CONTINUE;
+}
+
+static std::string analysisName(QBDI::AnalysisType type) {
+  static const std::pair<QBDI::AnalysisType, const char *> names[] = {
+      {QBDI::ANALYSIS_INSTRUCTION, "INSTRUCTION"},
+      {QBDI::ANALYSIS_DISASSEMBLY, "DISASSEMBLY"},
+      {QBDI::ANALYSIS_OPERANDS, "OPERANDS"},
+      {QBDI::ANALYSIS_SYMBOL, "SYMBOL"},
+  };
+  std::string name;
+  for (const auto &n : names) {
+    if (type & n.first) {
+      if (not name.empty()) {
+        name += "|";
+      }
+      name += n.second;
+    }
+  }
+  return name;
+}
+
+class CallbackBenchmark {
+private:
+  static const unsigned ROUNDS = 20;
+  static const QBDI::rword ITERATIONS = 1000;
+
+  std::vector<CallbackResult> results;
+  double baseline = 0;
+
+  // Run the target on a VM configured by the setup. The setup returns the
+  // counter of the callbacks.
+  double measure(const std::function<uint64_t *(QBDI::VM &)> &setup,
+                 uint64_t &callbacks) {
+    QBDI::VM vm;
+    uint8_t *fakestack = nullptr;
+    QBDI::allocateVirtualStack(vm.getGPRState(), 1 << 20, &fakestack);
+    vm.addInstrumentedModuleFromAddr(
+        reinterpret_cast<QBDI::rword>(callbackTarget));
+    uint64_t *counter = setup(vm);
+
+    QBDI::rword ret_value = 0;
+    // fill the cache, the measure only includes the execution
+    vm.call(&ret_value, reinterpret_cast<QBDI::rword>(callbackTarget),
+            {ITERATIONS});
+    uint64_t before = counter != nullptr ? *counter : 0;
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned i = 0; i < ROUNDS; i++) {
+      vm.call(&ret_value, reinterpret_cast<QBDI::rword>(callbackTarget),
+              {ITERATIONS});
+    }
+    auto end = std::chrono::steady_clock::now();
+    callbacks = counter != nullptr ? (*counter - before) / ROUNDS : 0;
+
+    QBDI::alignedFree(fakestack);
+    return std::chrono::duration<double, std::nano>(end - start).count() /
+           ROUNDS;
+  }
+
+public:
+  CallbackBenchmark() {
+    uint64_t callbacks;
+    baseline = measure([](QBDI::VM &) { return nullptr; }, callbacks);
+    results.push_back({"none", "baseline", baseline, 0, 0});
+  }
+
+  void add(const std::string &name, const std::string &kind,
+           const std::function<uint64_t *(QBDI::VM &)> &setup) {
+    uint64_t callbacks = 0;
+    double ns = measure(setup, callbacks);
+    double perCallback = callbacks == 0 ? 0 : (ns - baseline) / callbacks;
+    results.push_back({name, kind, ns, perCallback, callbacks});
+    reportBenchmarkCounter("Callbacks/" + kind + "/" + name + "/ns per run", ns,
+                           false);
+    printf("%s (%s): %.0f ns per run, %.2f ns per callback (%llu callbacks)\n",
+           name.c_str(), kind.c_str(), ns, perCallback,
+           static_cast<unsigned long long>(callbacks));
+  }
+
+  void writeJSON(const char *path) const {
+    FILE *file = fopen(path, "w");
+    if (file == nullptr) {
+      return;
+    }
+    fprintf(file, "{\n  \"benchmark\": \"callbacks\",\n  \"results\": [\n");
+    for (size_t i = 0; i < results.size(); i++) {
+      const CallbackResult &r = results[i];
+      fprintf(file,
+              "    {\"name\": \"%s\", \"kind\": \"%s\", \"ns_per_run\": %.2f, "
+              "\"ns_per_callback\": %.2f, \"callbacks\": %llu}%s\n",
+              r.name.c_str(), r.kind.c_str(), r.nsPerRun, r.nsPerCallback,
+              static_cast<unsigned long long>(r.callbacks),
+              i + 1 < results.size() ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+    fclose(file);
+  }
+};
+
+TEST_CASE("Benchmark_Callbacks") {
+  CallbackBenchmark bench;
+  uint64_t counter = 0;
+  AnalysisData analysisData;
+
+  bench.add("PREINST", "InstCallback", [&](QBDI::VM &vm) {
+    vm.addCodeCB(QBDI::PREINST, countInstCB, &counter);
+    return &counter;
+  });
+  bench.add("POSTINST", "InstCallback", [&](QBDI::VM &vm) {
+    vm.addCodeCB(QBDI::POSTINST, countInstCB, &counter);
+    return &counter;
+  });
+  bench.add("PREINST", "InstCallback light", [&](QBDI::VM &vm) {
+    vm.addCodeCBLight(QBDI::PREINST, countInstCB, &counter,
+                      QBDI::FOOTPRINT_NONE);
+    return &counter;
+  });
+  bench.add("PREINST", "InstCallback C API", [&](QBDI::VM &vm) {
+    QBDI::qbdi_addCodeCB(&vm, QBDI::PREINST, countInstCB, &counter,
+                         QBDI::PRIORITY_DEFAULT);
+    return &counter;
+  });
+  bench.add("PREINST", "InstCbLambda", [&](QBDI::VM &vm) {
+    vm.addCodeCB(QBDI::PREINST,
+                 [&counter](QBDI::VMInstanceRef, QBDI::GPRState *,
+                            QBDI::FPRState *) {
+                   counter++;
+                   return QBDI::VMAction::CONTINUE;
+                 });
+    return &counter;
+  });
+
+  // every combination of the AnalysisType
+  for (unsigned type = 1; type < (1 << 4); type++) {
+    bench.add(analysisName(static_cast<QBDI::AnalysisType>(type)),
+              "InstAnalysis", [&](QBDI::VM &vm) {
+                analysisData = {0, static_cast<QBDI::AnalysisType>(type)};
+                vm.addCodeCB(QBDI::PREINST, analysisCB, &analysisData);
+                return &analysisData.count;
+              });
+  }
+
+  for (QBDI::MemoryAccessType type :
+       {QBDI::MEMORY_READ, QBDI::MEMORY_WRITE, QBDI::MEMORY_READ_WRITE}) {
+    const char *name = type == QBDI::MEMORY_READ    ? "MEMORY_READ"
+                       : type == QBDI::MEMORY_WRITE ? "MEMORY_WRITE"
+                                                    : "MEMORY_READ_WRITE";
+    bench.add(name, "MemAccessCB", [&](QBDI::VM &vm) {
+      vm.addMemAccessCB(type, countInstCB, &counter);
+      return &counter;
+    });
+  }
+
+  // the ranges share the buffer
+  for (unsigned nbRanges : {1, 10, 100}) {
+    bench.add(std::to_string(nbRanges) + " ranges", "MemRangeCB",
+              [&](QBDI::VM &vm) {
+                QBDI::rword start = reinterpret_cast<QBDI::rword>(buffer);
+                QBDI::rword size = sizeof(buffer) / nbRanges;
+                for (unsigned i = 0; i < nbRanges; i++) {
+                  vm.addMemRangeCB(start + i * size, start + (i + 1) * size,
+                                   QBDI::MEMORY_READ_WRITE, countInstCB,
+                                   &counter);
+                }
+                return &counter;
+              });
+  }
+
+  static const std::pair<QBDI::VMEvent, const char *> events[] = {
+      {QBDI::SEQUENCE_ENTRY, "SEQUENCE_ENTRY"},
+      {QBDI::SEQUENCE_EXIT, "SEQUENCE_EXIT"},
+      {QBDI::BASIC_BLOCK_ENTRY, "BASIC_BLOCK_ENTRY"},
+      {QBDI::BASIC_BLOCK_EXIT, "BASIC_BLOCK_EXIT"},
+      {QBDI::BASIC_BLOCK_NEW, "BASIC_BLOCK_NEW"},
+      {QBDI::EXEC_TRANSFER_CALL, "EXEC_TRANSFER_CALL"},
+      {QBDI::EXEC_TRANSFER_RETURN, "EXEC_TRANSFER_RETURN"},
+  };
+  for (const auto &event : events) {
+    bench.add(event.second, "VMCallback", [&](QBDI::VM &vm) {
+      vm.addVMEventCB(event.first, countEventCB, &counter);
+      return &counter;
+    });
+  }
+
+  const char *path = getenv("QBDI_BENCHMARK_JSON");
+  if (path != nullptr) {
+    bench.writeJSON(path);
+  }
+}
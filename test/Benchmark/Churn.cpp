@@ -0,0 +1,185 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+#include <chrono>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <QBDI.h>
+
+#include "Benchmark/Report.h"
+
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include <catch2/catch.hpp>
+
+// Churn of the translation cache: the executions are interleaved with
+// invalidations of random ranges and with the addition and the removal of
+// instrumentations, as done by the tools of JIT engines.
+
+static const unsigned CHURN_FUNCTIONS = 1024;
+
+// A chain of distinct functions, the translation spans many sequences
+template <unsigned N>
+QBDI_NOINLINE QBDI::rword churnChain(QBDI::rword v) {
+  volatile QBDI::rword acc = v * 5 + N;
+  acc = acc ^ (acc >> 3);
+  return churnChain<N - 1>(acc) + N;
+}
+
+template <>
+QBDI_NOINLINE QBDI::rword churnChain<0>(QBDI::rword v) {
+  return v;
+}
+
+QBDI_NOINLINE QBDI::rword churnTarget(QBDI::rword n) {
+  QBDI::rword acc = 0;
+  for (QBDI::rword i = 0; i < n; i++) {
+    acc += churnChain<CHURN_FUNCTIONS - 1>(acc + i);
+  }
+  return acc;
+}
+
+template <size_t... I>
+static std::vector<QBDI::rword> churnAddresses(std::index_sequence<I...>) {
+  return {reinterpret_cast<QBDI::rword>(churnChain<I>)...};
+}
+
+static QBDI::VMAction churnCB(QBDI::VMInstanceRef vm, QBDI::GPRState *gprState,
+                              QBDI::FPRState *fprState, void *data) {
+  (*static_cast<uint64_t *>(data))++;
+  return QBDI::VMAction::CONTINUE;
+}
+
+static double elapsedNs(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::nano>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+TEST_CASE("Benchmark_Churn") {
+  static const unsigned STEPS = 400;
+  static const unsigned SAMPLE_PERIOD = 50;
+
+  std::vector<QBDI::rword> functions =
+      churnAddresses(std::make_index_sequence<CHURN_FUNCTIONS>());
+  std::sort(functions.begin(), functions.end());
+
+  QBDI::VM vm;
+  uint8_t *fakestack = nullptr;
+  QBDI::allocateVirtualStack(vm.getGPRState(), 1 << 20, &fakestack);
+  vm.addInstrumentedModuleFromAddr(reinterpret_cast<QBDI::rword>(churnTarget));
+
+  const QBDI::rword target = reinterpret_cast<QBDI::rword>(churnTarget);
+  QBDI::rword ret_value = 0;
+  vm.call(&ret_value, target, {1});
+  QBDI::CacheStats initial = vm.getCacheStats();
+  printf("Churn: %llu sequences translated in %llu regions\n",
+         static_cast<unsigned long long>(initial.sequenceCount),
+         static_cast<unsigned long long>(initial.regionCount));
+
+  uint32_t seed = 7;
+  auto random = [&seed](uint32_t bound) {
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 8) % bound;
+  };
+
+  uint64_t callbacks = 0;
+  std::vector<uint32_t> rules;
+  double invalidationNs = 0;
+  double executionAfterInvalidationNs = 0;
+  unsigned invalidations = 0;
+  double ruleNs = 0;
+  unsigned ruleToggles = 0;
+  QBDI::rword peakMemory = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned step = 0; step < STEPS; step++) {
+    uint32_t op = random(10);
+    if (op < 6) {
+      // invalidate the functions of a random range
+      size_t first = random(CHURN_FUNCTIONS);
+      size_t last =
+          std::min<size_t>(first + 1 + random(64), CHURN_FUNCTIONS - 1);
+      auto t = std::chrono::steady_clock::now();
+      vm.clearCache(functions[first], functions[last]);
+      invalidationNs += elapsedNs(t);
+      // the flush is committed and the range translated again at the next run
+      t = std::chrono::steady_clock::now();
+      vm.call(&ret_value, target, {1});
+      executionAfterInvalidationNs += elapsedNs(t);
+      invalidations++;
+      continue;
+    }
+    if (op < 8) {
+      // add or remove an instrumentation of a random range
+      auto t = std::chrono::steady_clock::now();
+      if (rules.empty() or random(2) == 0) {
+        size_t first = random(CHURN_FUNCTIONS - 1);
+        rules.push_back(vm.addCodeRangeCB(functions[first],
+                                          functions[first + 1], QBDI::PREINST,
+                                          churnCB, &callbacks));
+      } else {
+        size_t i = random(rules.size());
+        vm.deleteInstrumentation(rules[i]);
+        rules.erase(rules.begin() + i);
+      }
+      ruleNs += elapsedNs(t);
+      ruleToggles++;
+    }
+    vm.call(&ret_value, target, {1});
+
+    if ((step + 1) % SAMPLE_PERIOD == 0) {
+      QBDI::MemoryStats memory = vm.getMemoryStats();
+      peakMemory = std::max(peakMemory, memory.totalSize);
+      printf("Churn step %u: %llu bytes in the cache, %llu instructions\n",
+             step + 1, static_cast<unsigned long long>(memory.totalSize),
+             static_cast<unsigned long long>(memory.instCount));
+    }
+  }
+  double totalNs = elapsedNs(start);
+  QBDI::CacheStats stats = vm.getCacheStats();
+  QBDI::MemoryStats memory = vm.getMemoryStats();
+  QBDI::alignedFree(fakestack);
+
+  double execsPerSec = STEPS * 1e9 / totalNs;
+  double perInvalidation =
+      invalidations == 0 ? 0 : invalidationNs / invalidations;
+  double perExecution = invalidations == 0
+                            ? 0
+                            : executionAfterInvalidationNs / invalidations;
+  double perToggle = ruleToggles == 0 ? 0 : ruleNs / ruleToggles;
+  reportBenchmarkCounter("Churn/executions per second", execsPerSec, true);
+  reportBenchmarkCounter("Churn/ns per clearCache", perInvalidation, false);
+  reportBenchmarkCounter("Churn/ns per execution after clearCache",
+                         perExecution, false);
+  reportBenchmarkCounter("Churn/ns per instrumentation toggle", perToggle,
+                         false);
+  reportBenchmarkCounter("Churn/peak bytes in the cache",
+                         static_cast<double>(peakMemory), false);
+  reportBenchmarkCounter("Churn/final bytes in the cache",
+                         static_cast<double>(memory.totalSize), false);
+  printf("Churn: %.0f executions per second, %.0f ns per clearCache, "
+         "%.0f ns per execution after clearCache, %.0f ns per "
+         "instrumentation toggle, %llu retranslations, %llu flushes\n",
+         execsPerSec, perInvalidation, perExecution, perToggle,
+         static_cast<unsigned long long>(stats.retranslationCount),
+         static_cast<unsigned long long>(stats.flushCount));
+}
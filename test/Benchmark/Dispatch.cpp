@@ -0,0 +1,185 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <chrono>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+
+#include <QBDI.h>
+
+#include "Benchmark/Report.h"
+
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include <catch2/catch.hpp>
+
+// Targets of the dispatch benchmarks. The volatile variables keep the loops
+// and the calls, the compiler cannot simplify them.
+
+QBDI_NOINLINE QBDI::rword directLoop(QBDI::rword n) {
+  volatile QBDI::rword acc = 0;
+  for (QBDI::rword i = 0; i < n; i++) {
+    if (i & 1) {
+      acc = acc + i;
+    } else {
+      acc = acc ^ i;
+    }
+  }
+  return acc;
+}
+
+QBDI_NOINLINE QBDI::rword handlerAdd(QBDI::rword v) { return v + 3; }
+QBDI_NOINLINE QBDI::rword handlerXor(QBDI::rword v) { return v ^ 0x55; }
+QBDI_NOINLINE QBDI::rword handlerMul(QBDI::rword v) { return v * 5; }
+QBDI_NOINLINE QBDI::rword handlerSub(QBDI::rword v) { return v - 7; }
+
+static QBDI::rword (*volatile handlers[4])(QBDI::rword) = {
+    handlerAdd, handlerXor, handlerMul, handlerSub};
+
+QBDI_NOINLINE QBDI::rword indirectCalls(QBDI::rword n) {
+  QBDI::rword acc = 0;
+  for (QBDI::rword i = 0; i < n; i++) {
+    acc = handlers[(acc + i) & 3](acc);
+  }
+  return acc;
+}
+
+QBDI_NOINLINE QBDI::rword recursion(QBDI::rword depth) {
+  if (depth == 0) {
+    return 0;
+  }
+  volatile QBDI::rword r = recursion(depth - 1);
+  return r + depth;
+}
+
+// A chain of distinct functions, the translation spans many ExecBlocks
+template <unsigned N>
+QBDI_NOINLINE QBDI::rword chain(QBDI::rword v) {
+  volatile QBDI::rword acc = v * 3 + N;
+  acc = acc ^ (acc >> 7);
+  acc = acc + (acc << 3);
+  return chain<N - 1>(acc) + N;
+}
+
+template <>
+QBDI_NOINLINE QBDI::rword chain<0>(QBDI::rword v) {
+  return v;
+}
+
+QBDI_NOINLINE QBDI::rword manyBlocks(QBDI::rword n) {
+  QBDI::rword acc = 0;
+  for (QBDI::rword i = 0; i < n; i++) {
+    acc += chain<512>(acc + i);
+  }
+  return acc;
+}
+
+class DispatchVM {
+private:
+  uint8_t *fakestack = nullptr;
+
+public:
+  QBDI::VM vm;
+
+  DispatchVM(QBDI::rword target) {
+    QBDI::allocateVirtualStack(vm.getGPRState(), 1 << 20, &fakestack);
+    vm.addInstrumentedModuleFromAddr(target);
+  }
+
+  ~DispatchVM() { QBDI::alignedFree(fakestack); }
+
+  QBDI::rword call(QBDI::rword target, QBDI::rword arg) {
+    QBDI::rword ret_value = 0;
+    vm.call(&ret_value, target, {arg});
+    return ret_value;
+  }
+};
+
+static QBDI::rword dispatchCount(const QBDI::CacheStats &stats) {
+  return stats.cacheHits + stats.cacheMisses;
+}
+
+// Print the time spent per sequence dispatched by the engine, the cache is
+// filled before the measure
+static void reportDispatchCost(const char *name, QBDI::rword target,
+                               QBDI::rword arg) {
+  static const unsigned ROUNDS = 20;
+  DispatchVM dvm(target);
+  dvm.call(target, arg);
+
+  QBDI::rword before = dispatchCount(dvm.vm.getCacheStats());
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned i = 0; i < ROUNDS; i++) {
+    dvm.call(target, arg);
+  }
+  auto end = std::chrono::steady_clock::now();
+  QBDI::rword dispatched = dispatchCount(dvm.vm.getCacheStats()) - before;
+
+  double ns = std::chrono::duration<double, std::nano>(end - start).count();
+  reportBenchmarkCounter(std::string("Dispatch/") + name +
+                             "/ns per dispatched sequence",
+                         dispatched == 0 ? 0.0 : ns / dispatched, false);
+  reportBenchmarkCounter(std::string("Dispatch/") + name +
+                             "/sequences per call",
+                         static_cast<double>(dispatched / ROUNDS), false);
+  printf("%s: %.2f ns per dispatched sequence (%llu sequences per call)\n",
+         name, dispatched == 0 ? 0.0 : ns / dispatched,
+         static_cast<unsigned long long>(dispatched / ROUNDS));
+}
+
+static void benchmarkDispatch(Catch::Benchmark::Chronometer &meter,
+                              QBDI::rword target, QBDI::rword arg) {
+  DispatchVM dvm(target);
+  dvm.call(target, arg);
+
+  meter.measure([&] { return dvm.call(target, arg); });
+}
+
+TEST_CASE("Benchmark_Dispatch") {
+
+  const QBDI::rword directTarget = reinterpret_cast<QBDI::rword>(directLoop);
+  const QBDI::rword indirectTarget =
+      reinterpret_cast<QBDI::rword>(indirectCalls);
+  const QBDI::rword recursionTarget = reinterpret_cast<QBDI::rword>(recursion);
+  const QBDI::rword manyBlocksTarget =
+      reinterpret_cast<QBDI::rword>(manyBlocks);
+
+  reportDispatchCost("Direct branches", directTarget, 10000);
+  reportDispatchCost("Indirect calls", indirectTarget, 10000);
+  reportDispatchCost("Recursion", recursionTarget, 1000);
+  reportDispatchCost("Many ExecBlocks", manyBlocksTarget, 10);
+
+  BENCHMARK_ADVANCED("Direct branches with QBDI")
+  (Catch::Benchmark::Chronometer meter) {
+    benchmarkDispatch(meter, directTarget, 10000);
+  };
+
+  BENCHMARK_ADVANCED("Indirect calls with QBDI")
+  (Catch::Benchmark::Chronometer meter) {
+    benchmarkDispatch(meter, indirectTarget, 10000);
+  };
+
+  BENCHMARK_ADVANCED("Recursion with QBDI")
+  (Catch::Benchmark::Chronometer meter) {
+    benchmarkDispatch(meter, recursionTarget, 1000);
+  };
+
+  BENCHMARK_ADVANCED("Many ExecBlocks with QBDI")
+  (Catch::Benchmark::Chronometer meter) {
+    benchmarkDispatch(meter, manyBlocksTarget, 10);
+  };
+}
@@ -0,0 +1,252 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <chrono>
+#include <memory>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include <QBDI.h>
+
+#include "Benchmark/Report.h"
+
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include <catch2/catch.hpp>
+
+// Throughput of a fuzzing harness: executions per second of a parser with
+// the coverage bitmap, in the usual modes of the harnesses.
+
+static const size_t INPUT_SIZE = 64;
+static uint8_t harnessInput[INPUT_SIZE];
+// state of the parser changed by each execution, restored by the snapshot
+static uint32_t harnessState[16];
+
+// A small parser of records "<tag><length><payload>", with checksums and
+// magic values as a fuzzing target
+QBDI_NOINLINE QBDI::rword harnessTarget(QBDI::rword size) {
+  QBDI::rword result = 1;
+  size_t i = 0;
+  while (i + 2 <= size) {
+    uint8_t tag = harnessInput[i];
+    size_t len = harnessInput[i + 1] % 16;
+    i += 2;
+    if (i + len > size) {
+      return 0;
+    }
+    uint32_t checksum = 0;
+    for (size_t j = 0; j < len; j++) {
+      checksum = (checksum << 1) ^ harnessInput[i + j];
+    }
+    switch (tag & 7) {
+      case 0:
+        harnessState[checksum & 15]++;
+        break;
+      case 1:
+        if (len >= 4 and memcmp(&harnessInput[i], "QBDI", 4) == 0) {
+          result += 100;
+        }
+        break;
+      case 2:
+        if (checksum == 0xdeadbeef) {
+          result += 1000;
+        }
+        break;
+      case 3:
+        result = result * 3 + checksum;
+        break;
+      default:
+        result ^= checksum + tag;
+        break;
+    }
+    i += len;
+  }
+  return result;
+}
+
+// Inputs of the executions, generated once
+static const std::vector<std::vector<uint8_t>> &harnessCorpus() {
+  static const std::vector<std::vector<uint8_t>> corpus = [] {
+    std::vector<std::vector<uint8_t>> c;
+    uint32_t seed = 1337;
+    for (unsigned n = 0; n < 64; n++) {
+      std::vector<uint8_t> input(INPUT_SIZE);
+      for (uint8_t &b : input) {
+        seed = seed * 1103515245 + 12345;
+        b = static_cast<uint8_t>(seed >> 16);
+      }
+      c.push_back(input);
+    }
+    return c;
+  }();
+  return corpus;
+}
+
+static void setInput(unsigned n) {
+  const std::vector<uint8_t> &input =
+      harnessCorpus()[n % harnessCorpus().size()];
+  memcpy(harnessInput, input.data(), INPUT_SIZE);
+}
+
+static QBDI::VMAction cmpCB(QBDI::VMInstanceRef vm, QBDI::GPRState *gprState,
+                            QBDI::FPRState *fprState, void *data) {
+  (*static_cast<uint64_t *>(data))++;
+  return QBDI::VMAction::CONTINUE;
+}
+
+enum HarnessMode { FRESH_VM, WARM_VM, SNAPSHOT };
+
+struct HarnessResult {
+  double nsPerExec;
+  double sequencesPerExec;
+  double translationCyclesPerExec;
+};
+
+static uint64_t translationCycles(const QBDI::TranslationProfile &profile) {
+  // the TempManager is nested in the rules
+  return profile.disassembly.cycles + profile.patchRules.cycles +
+         profile.instrRules.cycles + profile.encoding.cycles +
+         profile.writeSequence.cycles;
+}
+
+class HarnessVM {
+private:
+  uint8_t *fakestack = nullptr;
+  std::vector<uint8_t> bitmap;
+  uint64_t comparisons = 0;
+
+public:
+  QBDI::VM vm;
+
+  HarnessVM(bool cmpCallback) : bitmap(1 << 16, 0) {
+    QBDI::allocateVirtualStack(vm.getGPRState(), 1 << 20, &fakestack);
+    vm.addInstrumentedModuleFromAddr(
+        reinterpret_cast<QBDI::rword>(harnessTarget));
+    vm.setCoverageBitmap(bitmap.data(), bitmap.size());
+    if (cmpCallback) {
+      vm.addMnemonicCB("CMP*", QBDI::PREINST, cmpCB, &comparisons);
+    }
+  }
+
+  ~HarnessVM() { QBDI::alignedFree(fakestack); }
+
+  QBDI::rword exec() {
+    QBDI::rword ret_value = 0;
+    vm.call(&ret_value, reinterpret_cast<QBDI::rword>(harnessTarget),
+            {INPUT_SIZE});
+    return ret_value;
+  }
+};
+
+static HarnessResult runHarness(HarnessMode mode, bool cmpCallback,
+                                unsigned execs) {
+  HarnessResult result = {0, 0, 0};
+  std::unique_ptr<HarnessVM> hvm;
+  QBDI::RangeSet<QBDI::rword> ranges;
+  ranges.add({reinterpret_cast<QBDI::rword>(harnessState),
+              reinterpret_cast<QBDI::rword>(harnessState) +
+                  sizeof(harnessState)});
+  if (mode != FRESH_VM) {
+    hvm = std::make_unique<HarnessVM>(cmpCallback);
+    if (mode == SNAPSHOT) {
+      hvm->vm.takeSnapshot(ranges);
+    }
+    // fill the cache with the whole corpus
+    for (unsigned n = 0; n < harnessCorpus().size(); n++) {
+      setInput(n);
+      hvm->exec();
+      if (mode == SNAPSHOT) {
+        hvm->vm.restoreSnapshot();
+      }
+    }
+  }
+
+  uint64_t sequences = 0;
+  uint64_t cycles = 0;
+  if (hvm) {
+    // only count the executions of the measure
+    QBDI::CacheStats stats = hvm->vm.getCacheStats();
+    sequences -= stats.cacheHits + stats.cacheMisses;
+    cycles -= translationCycles(hvm->vm.getTranslationProfile());
+  }
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned n = 0; n < execs; n++) {
+    setInput(n);
+    if (mode == FRESH_VM) {
+      HarnessVM fresh(cmpCallback);
+      fresh.exec();
+      QBDI::CacheStats stats = fresh.vm.getCacheStats();
+      sequences += stats.cacheHits + stats.cacheMisses;
+      cycles += translationCycles(fresh.vm.getTranslationProfile());
+      continue;
+    }
+    hvm->vm.resetCoverage();
+    hvm->exec();
+    if (mode == SNAPSHOT) {
+      hvm->vm.restoreSnapshot();
+    }
+  }
+  auto end = std::chrono::steady_clock::now();
+  if (hvm) {
+    QBDI::CacheStats stats = hvm->vm.getCacheStats();
+    sequences += stats.cacheHits + stats.cacheMisses;
+    cycles += translationCycles(hvm->vm.getTranslationProfile());
+  }
+
+  result.nsPerExec =
+      std::chrono::duration<double, std::nano>(end - start).count() / execs;
+  result.sequencesPerExec = static_cast<double>(sequences) / execs;
+  result.translationCyclesPerExec = static_cast<double>(cycles) / execs;
+  return result;
+}
+
+TEST_CASE("Benchmark_Harness") {
+  static const std::pair<HarnessMode, const char *> modes[] = {
+      {FRESH_VM, "fresh VM"},
+      {WARM_VM, "reused VM"},
+      {SNAPSHOT, "snapshot"},
+  };
+  static const unsigned EXECS = 2000;
+
+  for (const auto &mode : modes) {
+    // the fresh VMs are slower, fewer executions keep the same duration
+    unsigned execs = mode.first == FRESH_VM ? EXECS / 20 : EXECS;
+    HarnessResult coverage = runHarness(mode.first, false, execs);
+    HarnessResult cmp = runHarness(mode.first, true, execs);
+
+    double execsPerSec = 1e9 / coverage.nsPerExec;
+    double callbackNs = cmp.nsPerExec - coverage.nsPerExec;
+    std::string prefix = std::string("Harness/") + mode.second;
+    reportBenchmarkCounter(prefix + "/execs per second", execsPerSec, true);
+    reportBenchmarkCounter(prefix + "/with CMP callback/execs per second",
+                           1e9 / cmp.nsPerExec, true);
+    reportBenchmarkCounter(prefix + "/sequences per exec",
+                           coverage.sequencesPerExec, false);
+    reportBenchmarkCounter(prefix + "/translation cycles per exec",
+                           coverage.translationCyclesPerExec, false);
+    reportBenchmarkCounter(prefix + "/CMP callback ns per exec", callbackNs,
+                           false);
+    printf("%s: %.0f execs per second (%.0f with CMP callback), "
+           "%.1f sequences per exec, %.0f translation cycles per exec, "
+           "%.0f ns of CMP callbacks per exec\n",
+           mode.second, execsPerSec, 1e9 / cmp.nsPerExec,
+           coverage.sequencesPerExec, coverage.translationCyclesPerExec,
+           callbackNs);
+  }
+}
@@ -0,0 +1,130 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+#include <functional>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "sha256.h"
+#include "QBDI.h"
+
+#include "Benchmark/Report.h"
+
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include <catch2/catch.hpp>
+
+// Memory footprint of the translation cache per 1K translated instructions,
+// by component, for a few workloads and instrumentations.
+
+QBDI_NOINLINE QBDI::rword memoryFibonacci(QBDI::rword number) {
+  if (number < 2)
+    return 1;
+  return memoryFibonacci(number - 1) + memoryFibonacci(number - 2);
+}
+
+static const uint8_t memoryBuffer[1 << 10] = {0};
+
+QBDI_NOINLINE QBDI::rword memorySHA256(QBDI::rword len) {
+  size_t size = std::min<size_t>(len, sizeof(memoryBuffer));
+  sha256::HashType hash = sha256::compute(memoryBuffer, size);
+  return hash[0];
+}
+
+static QBDI::VMAction analysisCB(QBDI::VMInstanceRef vm,
+                                 QBDI::GPRState *gprState,
+                                 QBDI::FPRState *fprState, void *data) {
+  vm->getInstAnalysis(QBDI::ANALYSIS_INSTRUCTION | QBDI::ANALYSIS_DISASSEMBLY |
+                      QBDI::ANALYSIS_OPERANDS);
+  return QBDI::VMAction::CONTINUE;
+}
+
+struct Instrumentation {
+  const char *name;
+  std::function<void(QBDI::VM &)> setup;
+};
+
+static void reportFootprint(const char *workload, QBDI::rword target,
+                            QBDI::rword arg, const Instrumentation &instr) {
+  QBDI::VM vm;
+  uint8_t *fakestack = nullptr;
+  QBDI::allocateVirtualStack(vm.getGPRState(), 1 << 20, &fakestack);
+  vm.addInstrumentedModuleFromAddr(target);
+  instr.setup(vm);
+
+  QBDI::rword ret_value = 0;
+  vm.call(&ret_value, target, {arg});
+  QBDI::MemoryStats stats = vm.getMemoryStats();
+  QBDI::alignedFree(fakestack);
+
+  double perK = stats.instCount == 0 ? 0.0 : 1000.0 / stats.instCount;
+  const std::pair<const char *, QBDI::rword> components[] = {
+      {"code", stats.codeSize},
+      {"data", stats.dataSize},
+      {"metadata", stats.metadataSize},
+      {"analysis", stats.analysisSize},
+      {"region maps", stats.regionMapSize},
+      {"callbacks", stats.callbackSize},
+      {"total", stats.totalSize},
+  };
+  std::string prefix = std::string("Memory/") + workload + "/" + instr.name;
+  printf("%s with %s (%llu instructions), bytes per 1K instructions:",
+         workload, instr.name,
+         static_cast<unsigned long long>(stats.instCount));
+  for (const auto &c : components) {
+    reportBenchmarkCounter(prefix + "/" + c.first +
+                               " bytes per 1K instructions",
+                           c.second * perK, false);
+    printf(" %s %.0f", c.first, c.second * perK);
+  }
+  printf("\n");
+}
+
+TEST_CASE("Benchmark_Memory") {
+  const Instrumentation instrumentations[] = {
+      {"no instrumentation", [](QBDI::VM &) {}},
+      {"memory access",
+       [](QBDI::VM &vm) { vm.recordMemoryAccess(QBDI::MEMORY_READ_WRITE); }},
+      {"PREINST analysis",
+       [](QBDI::VM &vm) {
+         vm.addCodeCB(QBDI::PREINST, analysisCB, nullptr);
+       }},
+      {"InstrRule lambda",
+       [](QBDI::VM &vm) {
+         vm.addInstrRule(
+             [](QBDI::VMInstanceRef, const QBDI::InstAnalysis *)
+                 -> std::vector<QBDI::InstrRuleDataCBK> {
+               return {{QBDI::PREINST,
+                        [](QBDI::VMInstanceRef, QBDI::GPRState *,
+                           QBDI::FPRState *) {
+                          return QBDI::VMAction::CONTINUE;
+                        }}};
+             },
+             QBDI::ANALYSIS_INSTRUCTION);
+       }},
+  };
+
+  for (const Instrumentation &instr : instrumentations) {
+    reportFootprint("Fibonacci(20)",
+                    reinterpret_cast<QBDI::rword>(memoryFibonacci), 20, instr);
+    reportFootprint("sha256(len: 1KBytes)",
+                    reinterpret_cast<QBDI::rword>(memorySHA256),
+                    sizeof(memoryBuffer), instr);
+  }
+}
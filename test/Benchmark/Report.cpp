@@ -0,0 +1,124 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <mutex>
+#include <ostream>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "Benchmark/Report.h"
+
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include <catch2/catch.hpp>
+
+namespace {
+
+struct BenchmarkCounter {
+  std::string name;
+  double value;
+  bool higherIsBetter;
+};
+
+std::mutex countersLock;
+std::vector<BenchmarkCounter> counters;
+
+std::string escapeJSON(const std::string &str) {
+  std::string res;
+  for (char c : str) {
+    if (c == '"' or c == '\\') {
+      res.push_back('\\');
+      res.push_back(c);
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      res.push_back(' ');
+    } else {
+      res.push_back(c);
+    }
+  }
+  return res;
+}
+
+// Write the statistics of the benchmarks and the counters as JSON:
+//   {"benchmarks": [{"name", "mean", "lowMean", "highMean", "stdDev",
+//                    "samples", "iterations"}, ...],
+//    "counters": [{"name", "value", "higherIsBetter"}, ...]}
+// The durations are in nanoseconds. The name of a benchmark is prefixed by
+// its test case.
+class JSONReporter : public Catch::StreamingReporterBase<JSONReporter> {
+private:
+  bool firstBenchmark = true;
+  std::string testCase;
+
+public:
+  JSONReporter(const Catch::ReporterConfig &config)
+      : StreamingReporterBase(config) {}
+
+  static std::string getDescription() {
+    return "Reports the benchmarks and the counters of QBDIBenchmark as JSON";
+  }
+
+  void testRunStarting(const Catch::TestRunInfo &info) override {
+    StreamingReporterBase::testRunStarting(info);
+    stream << "{\n  \"benchmarks\": [";
+  }
+
+  void testCaseStarting(const Catch::TestCaseInfo &info) override {
+    StreamingReporterBase::testCaseStarting(info);
+    testCase = info.name;
+  }
+
+  void assertionStarting(const Catch::AssertionInfo &) override {}
+
+  bool assertionEnded(const Catch::AssertionStats &) override { return true; }
+
+  void benchmarkEnded(const Catch::BenchmarkStats<> &stats) override {
+    stream << (firstBenchmark ? "\n" : ",\n");
+    firstBenchmark = false;
+    stream << "    {\"name\": \""
+           << escapeJSON(testCase + "/" + stats.info.name)
+           << "\", \"mean\": " << stats.mean.point.count()
+           << ", \"lowMean\": " << stats.mean.lower_bound.count()
+           << ", \"highMean\": " << stats.mean.upper_bound.count()
+           << ", \"stdDev\": " << stats.standardDeviation.point.count()
+           << ", \"samples\": " << stats.info.samples
+           << ", \"iterations\": " << stats.info.iterations << "}";
+  }
+
+  void testRunEnded(const Catch::TestRunStats &stats) override {
+    stream << "\n  ],\n  \"counters\": [";
+    std::lock_guard<std::mutex> guard(countersLock);
+    for (size_t i = 0; i < counters.size(); i++) {
+      const BenchmarkCounter &counter = counters[i];
+      stream << (i == 0 ? "\n" : ",\n") << "    {\"name\": \""
+             << escapeJSON(counter.name) << "\", \"value\": " << counter.value
+             << ", \"higherIsBetter\": "
+             << (counter.higherIsBetter ? "true" : "false") << "}";
+    }
+    stream << "\n  ]\n}\n";
+    StreamingReporterBase::testRunEnded(stats);
+  }
+};
+
+} // anonymous namespace
+
+CATCH_REGISTER_REPORTER("json", JSONReporter)
+
+void reportBenchmarkCounter(const std::string &name, double value,
+                            bool higherIsBetter) {
+  std::lock_guard<std::mutex> guard(countersLock);
+  counters.push_back({name, value, higherIsBetter});
+}
@@ -0,0 +1,30 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef QBDIBENCHMARK_REPORT_H
+#define QBDIBENCHMARK_REPORT_H
+
+#include <string>
+
+// Counters of the benchmarks which aren't measured by Catch2 (rates, ratios
+// and statistics of the VM). They are written by the "json" reporter with
+// the statistics of the Catch2 benchmarks, and compared with a baseline by
+// compare_benchmark.py.
+void reportBenchmarkCounter(const std::string &name, double value,
+                            bool higherIsBetter);
+
+#endif // QBDIBENCHMARK_REPORT_H
@@ -0,0 +1,190 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <chrono>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+
+#include <QBDI.h>
+
+#include "Benchmark/Report.h"
+
+#if defined(QBDI_PLATFORM_LINUX) && defined(QBDI_BENCHMARK_STARTUP_PRELOAD)
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include <catch2/catch.hpp>
+
+// Time to the first instrumented instruction of a new VM, in the process and
+// with QBDIPreload. The short-lived instrumented processes mostly pay this
+// cost.
+
+QBDI_NOINLINE QBDI::rword startupTarget(QBDI::rword v) { return v + 1; }
+
+static QBDI::VMAction stopCB(QBDI::VMInstanceRef vm, QBDI::GPRState *gprState,
+                             QBDI::FPRState *fprState, void *data) {
+  return QBDI::VMAction::STOP;
+}
+
+// Create a VM and run until the first instruction of the target
+static bool firstInstruction(bool allMaps) {
+  QBDI::VM vm;
+  uint8_t *fakestack = nullptr;
+  QBDI::allocateVirtualStack(vm.getGPRState(), 1 << 20, &fakestack);
+  if (allMaps) {
+    vm.instrumentAllExecutableMaps();
+  } else {
+    vm.addInstrumentedModuleFromAddr(
+        reinterpret_cast<QBDI::rword>(startupTarget));
+  }
+  vm.addCodeCB(QBDI::PREINST, stopCB, nullptr);
+  QBDI::rword ret_value = 0;
+  bool res = vm.call(&ret_value, reinterpret_cast<QBDI::rword>(startupTarget),
+                     {1});
+  QBDI::alignedFree(fakestack);
+  return res;
+}
+
+#if defined(QBDI_PLATFORM_LINUX) && defined(QBDI_BENCHMARK_STARTUP_PRELOAD)
+
+static const char *STARTUP_PROGRAM = "/bin/true";
+
+static uint64_t monotonicNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// Execute the startup program, with the preload library if preload is true.
+// Return false if the program or the preload failed. With the preload, the
+// monotonic times of the preload start and of the first instruction are
+// written in times.
+static bool spawnStartup(bool preload, uint64_t &start, uint64_t times[2],
+                         uint64_t &end) {
+  int fds[2];
+  if (pipe(fds) != 0) {
+    return false;
+  }
+  start = monotonicNs();
+  pid_t pid = fork();
+  if (pid < 0) {
+    close(fds[0]);
+    close(fds[1]);
+    return false;
+  }
+  if (pid == 0) {
+    close(fds[0]);
+    if (preload) {
+      setenv("LD_PRELOAD", QBDI_BENCHMARK_STARTUP_PRELOAD, 1);
+      setenv("QBDI_BENCHMARK_STARTUP_FD", std::to_string(fds[1]).c_str(), 1);
+    }
+    execl(STARTUP_PROGRAM, STARTUP_PROGRAM, nullptr);
+    _exit(127);
+  }
+  close(fds[1]);
+  size_t received = 0;
+  while (received < 2 * sizeof(uint64_t)) {
+    ssize_t r = read(fds[0], reinterpret_cast<uint8_t *>(times) + received,
+                     2 * sizeof(uint64_t) - received);
+    if (r <= 0) {
+      break;
+    }
+    received += r;
+  }
+  close(fds[0]);
+  int status = 0;
+  waitpid(pid, &status, 0);
+  end = monotonicNs();
+  return WIFEXITED(status) and WEXITSTATUS(status) == 0 and
+         (not preload or received == 2 * sizeof(uint64_t));
+}
+
+static void reportPreloadStartup() {
+  static const unsigned ROUNDS = 20;
+  double nativeNs = 0;
+  double loadNs = 0;
+  double firstNs = 0;
+  double exitNs = 0;
+
+  for (unsigned i = 0; i < ROUNDS; i++) {
+    uint64_t start, end, times[2];
+    if (not spawnStartup(false, start, times, end)) {
+      WARN("Cannot execute " << STARTUP_PROGRAM);
+      return;
+    }
+    nativeNs += end - start;
+    if (not spawnStartup(true, start, times, end)) {
+      WARN("QBDIPreload failed on " << STARTUP_PROGRAM);
+      return;
+    }
+    loadNs += times[0] - start;
+    firstNs += times[1] - times[0];
+    exitNs += end - start;
+  }
+  nativeNs /= ROUNDS;
+  loadNs /= ROUNDS;
+  firstNs /= ROUNDS;
+  exitNs /= ROUNDS;
+
+  reportBenchmarkCounter("Startup/native/ns to exit", nativeNs, false);
+  reportBenchmarkCounter("Startup/QBDIPreload/ns to preload start", loadNs,
+                         false);
+  reportBenchmarkCounter("Startup/QBDIPreload/ns from preload start to first "
+                         "instruction",
+                         firstNs, false);
+  reportBenchmarkCounter("Startup/QBDIPreload/ns to exit", exitNs, false);
+  printf("%s: native %.0f ns, with QBDIPreload %.0f ns (%.0f ns to the "
+         "preload start, %.0f ns from the preload start to the first "
+         "instruction)\n",
+         STARTUP_PROGRAM, nativeNs, exitNs, loadNs, firstNs);
+}
+
+#endif
+
+TEST_CASE("Benchmark_Startup") {
+
+  for (bool allMaps : {false, true}) {
+    static const unsigned ROUNDS = 20;
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned i = 0; i < ROUNDS; i++) {
+      firstInstruction(allMaps);
+    }
+    auto end = std::chrono::steady_clock::now();
+    double ns =
+        std::chrono::duration<double, std::nano>(end - start).count() / ROUNDS;
+    const char *name = allMaps ? "instrumentAllExecutableMaps" : "one module";
+    reportBenchmarkCounter(std::string("Startup/static/") + name +
+                               "/ns to first instruction",
+                           ns, false);
+    printf("VM() with %s: %.0f ns to the first instruction\n", name, ns);
+  }
+
+#if defined(QBDI_PLATFORM_LINUX) && defined(QBDI_BENCHMARK_STARTUP_PRELOAD)
+  reportPreloadStartup();
+#endif
+
+  BENCHMARK("VM() and first instruction") { return firstInstruction(false); };
+
+  BENCHMARK("VM() with instrumentAllExecutableMaps and first instruction") {
+    return firstInstruction(true);
+  };
+}
@@ -0,0 +1,77 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "QBDIPreload.h"
+
+// Preload library of the startup benchmark. The monotonic time of the
+// preload start and of the first instrumented instruction are written in the
+// file descriptor of QBDI_BENCHMARK_STARTUP_FD, the execution is then stopped.
+
+static int startupFd = -1;
+
+static void writeTime() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  uint64_t ns = static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+  if (startupFd >= 0 and write(startupFd, &ns, sizeof(ns)) != sizeof(ns)) {
+    startupFd = -1;
+  }
+}
+
+static QBDI::VMAction onFirstInstruction(QBDI::VMInstanceRef vm,
+                                         QBDI::GPRState *gprState,
+                                         QBDI::FPRState *fprState,
+                                         void *data) {
+  writeTime();
+  return QBDI::STOP;
+}
+
+extern "C" {
+
+QBDIPRELOAD_INIT;
+
+int qbdipreload_on_start(void *main) {
+  const char *fd = getenv("QBDI_BENCHMARK_STARTUP_FD");
+  if (fd != nullptr) {
+    startupFd = atoi(fd);
+  }
+  writeTime();
+  return QBDIPRELOAD_NOT_HANDLED;
+}
+
+int qbdipreload_on_premain(void *gprCtx, void *fpuCtx) {
+  return QBDIPRELOAD_NOT_HANDLED;
+}
+
+int qbdipreload_on_main(int argc, char **argv) {
+  return QBDIPRELOAD_NOT_HANDLED;
+}
+
+int qbdipreload_on_run(QBDI::VMInstanceRef vm, QBDI::rword start,
+                       QBDI::rword stop) {
+  vm->addCodeCB(QBDI::PREINST, onFirstInstruction, nullptr);
+  vm->run(start, stop);
+  return QBDIPRELOAD_NO_ERROR;
+}
+
+int qbdipreload_on_exit(int status) { return QBDIPRELOAD_NO_ERROR; }
+}
@@ -0,0 +1,136 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sha256.h"
+#include "QBDI.h"
+
+#include "Benchmark/Report.h"
+
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include <catch2/catch.hpp>
+
+// Scaling of independent VMs, one per thread. A global state of the process
+// (LLVM, the logs, the mappings of the ExecBlocks) shared by the VMs limits
+// the throughput when the number of threads grows.
+
+QBDI_NOINLINE QBDI::rword threadFibonacci(QBDI::rword number) {
+  if (number < 2)
+    return 1;
+  return threadFibonacci(number - 1) + threadFibonacci(number - 2);
+}
+
+static const uint8_t threadBuffer[1 << 10] = {0};
+
+QBDI_NOINLINE QBDI::rword threadSHA256(QBDI::rword len) {
+  size_t size = std::min<size_t>(len, sizeof(threadBuffer));
+  sha256::HashType hash = sha256::compute(threadBuffer, size);
+  return hash[0];
+}
+
+struct Workload {
+  const char *name;
+  QBDI::rword target;
+  QBDI::rword arg;
+};
+
+// Run the workload on a VM per thread, return the number of calls per second
+// of all the threads. With a cold cache, the cache is cleared before each
+// call.
+static double runThreads(const Workload &workload, unsigned nbThreads,
+                         bool cold) {
+  static const unsigned CALLS = 20;
+  std::atomic<unsigned> ready{0};
+  std::atomic<bool> start{false};
+  std::vector<std::thread> threads;
+
+  for (unsigned t = 0; t < nbThreads; t++) {
+    threads.emplace_back([&] {
+      QBDI::VM vm;
+      uint8_t *fakestack = nullptr;
+      QBDI::allocateVirtualStack(vm.getGPRState(), 1 << 20, &fakestack);
+      vm.addInstrumentedModuleFromAddr(workload.target);
+
+      QBDI::rword ret_value = 0;
+      if (not cold) {
+        vm.call(&ret_value, workload.target, {workload.arg});
+      }
+      ready++;
+      while (not start.load()) {
+        std::this_thread::yield();
+      }
+      for (unsigned i = 0; i < CALLS; i++) {
+        if (cold) {
+          vm.clearAllCache();
+        }
+        vm.call(&ret_value, workload.target, {workload.arg});
+      }
+      QBDI::alignedFree(fakestack);
+    });
+  }
+  while (ready.load() != nbThreads) {
+    std::this_thread::yield();
+  }
+  auto begin = std::chrono::steady_clock::now();
+  start.store(true);
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  double seconds = std::chrono::duration<double>(end - begin).count();
+  return seconds == 0 ? 0 : nbThreads * CALLS / seconds;
+}
+
+TEST_CASE("Benchmark_Threads") {
+  const Workload workloads[] = {
+      {"Fibonacci(20)", reinterpret_cast<QBDI::rword>(threadFibonacci), 20},
+      {"sha256(len: 1KBytes)", reinterpret_cast<QBDI::rword>(threadSHA256),
+       sizeof(threadBuffer)},
+  };
+  unsigned maxThreads = std::max(1u, std::thread::hardware_concurrency());
+
+  for (const Workload &workload : workloads) {
+    for (bool cold : {false, true}) {
+      double single = 0;
+      for (unsigned nbThreads = 1; nbThreads <= maxThreads; nbThreads *= 2) {
+        double throughput = runThreads(workload, nbThreads, cold);
+        if (nbThreads == 1) {
+          single = throughput;
+        }
+        reportBenchmarkCounter(std::string("Threads/") + workload.name + "/" +
+                                   (cold ? "uncached" : "cached") + "/" +
+                                   std::to_string(nbThreads) +
+                                   " threads/calls per second",
+                               throughput, true);
+        printf("%s with QBDI %s, %u threads: %.1f calls/s (%.1f%% of the "
+               "linear scaling)\n",
+               workload.name, cold ? "uncached" : "cached", nbThreads,
+               throughput,
+               single == 0 ? 0.0 : 100 * throughput / (single * nbThreads));
+      }
+    }
+  }
+}
@@ -0,0 +1,190 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <chrono>
+#include <functional>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+#include <QBDI.h>
+
+#include "Benchmark/Report.h"
+
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include <catch2/catch.hpp>
+
+// Fixed costs of the VM: the transfers of the ExecBroker to the native code
+// of another module, and the entry in the instrumented code by VM::call.
+
+// The volatile pointers keep the calls to the libc, the compiler cannot
+// inline nor remove them
+static size_t (*volatile transferStrlen)(const char *) = strlen;
+static int (*volatile transferMemcmp)(const void *, const void *,
+                                      size_t) = memcmp;
+
+static const char transferString[] = "qbdi";
+
+QBDI_NOINLINE QBDI::rword transferLoop(QBDI::rword n) {
+  QBDI::rword acc = 0;
+  for (QBDI::rword i = 0; i < n; i++) {
+    acc += transferStrlen(transferString);
+    acc += transferMemcmp(transferString, transferString + (i & 1), 1) != 0;
+  }
+  return acc;
+}
+
+QBDI_NOINLINE QBDI::rword trivialFunction(QBDI::rword v) { return v + 1; }
+
+static QBDI::VMAction countTransferCB(QBDI::VMInstanceRef vm,
+                                      const QBDI::VMState *vmState,
+                                      QBDI::GPRState *gprState,
+                                      QBDI::FPRState *fprState, void *data) {
+  (*static_cast<uint64_t *>(data))++;
+  return QBDI::VMAction::CONTINUE;
+}
+
+class TransferVM {
+private:
+  uint8_t *fakestack = nullptr;
+
+public:
+  QBDI::VM vm;
+
+  TransferVM(QBDI::rword target) {
+    QBDI::allocateVirtualStack(vm.getGPRState(), 1 << 20, &fakestack);
+    vm.addInstrumentedModuleFromAddr(target);
+  }
+
+  ~TransferVM() { QBDI::alignedFree(fakestack); }
+};
+
+static double elapsedNs(const std::function<void()> &f) {
+  auto start = std::chrono::steady_clock::now();
+  f();
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - start).count();
+}
+
+// Print the time per transfer to the libc, without the time of the native
+// execution of the loop
+static void reportTransferCost() {
+  static const QBDI::rword ITERATIONS = 10000;
+  const QBDI::rword target = reinterpret_cast<QBDI::rword>(transferLoop);
+  QBDI::rword ret_value = 0;
+
+  // the number of transfers of a call
+  uint64_t transfers = 0;
+  {
+    TransferVM tvm(target);
+    tvm.vm.addVMEventCB(QBDI::EXEC_TRANSFER_CALL, countTransferCB,
+                        &transfers);
+    tvm.vm.call(&ret_value, target, {ITERATIONS});
+  }
+  REQUIRE(ret_value == transferLoop(ITERATIONS));
+
+  TransferVM tvm(target);
+  // fill the cache, the measure only includes the execution
+  tvm.vm.call(&ret_value, target, {ITERATIONS});
+  double native = elapsedNs([&] { ret_value = transferLoop(ITERATIONS); });
+  double ns =
+      elapsedNs([&] { tvm.vm.call(&ret_value, target, {ITERATIONS}); });
+
+  double perTransfer = transfers == 0 ? 0.0 : (ns - native) / transfers;
+  reportBenchmarkCounter("Transfer/libc calls/ns per transfer", perTransfer,
+                         false);
+  printf("libc calls: %.2f ns per transfer (%llu transfers per call)\n",
+         perTransfer, static_cast<unsigned long long>(transfers));
+}
+
+using CallFunction = std::function<void()>;
+
+// Print the time per call of a trivial function. The setup returns the call
+// on its VM, the cache is filled before the measure.
+static void
+reportCallCost(const char *name,
+               const std::function<CallFunction(QBDI::VM &)> &setup) {
+  static const unsigned CALLS = 10000;
+  TransferVM tvm(reinterpret_cast<QBDI::rword>(trivialFunction));
+  CallFunction call = setup(tvm.vm);
+  call();
+
+  double ns = elapsedNs([&] {
+    for (unsigned i = 0; i < CALLS; i++) {
+      call();
+    }
+  });
+  reportBenchmarkCounter(std::string("Transfer/") + name + "/ns per call",
+                         ns / CALLS, false);
+  printf("%s: %.2f ns per call\n", name, ns / CALLS);
+}
+
+TEST_CASE("Benchmark_Transfer") {
+  const QBDI::rword trivialTarget =
+      reinterpret_cast<QBDI::rword>(trivialFunction);
+  const QBDI::rword transferTarget =
+      reinterpret_cast<QBDI::rword>(transferLoop);
+
+  reportTransferCost();
+
+  reportCallCost("VM::call", [&](QBDI::VM &vm) -> CallFunction {
+    return [&vm, trivialTarget] {
+      QBDI::rword ret_value = 0;
+      vm.call(&ret_value, trivialTarget, {42});
+    };
+  });
+  reportCallCost("VM::callA", [&](QBDI::VM &vm) -> CallFunction {
+    return [&vm, trivialTarget] {
+      QBDI::rword ret_value = 0;
+      QBDI::rword args[] = {42};
+      vm.callA(&ret_value, trivialTarget, 1, args);
+    };
+  });
+  reportCallCost("PreparedCall::invoke", [&](QBDI::VM &vm) -> CallFunction {
+    QBDI::PreparedCall prepared = vm.prepareCall(trivialTarget, 1);
+    return [prepared]() mutable {
+      QBDI::rword ret_value = 0;
+      QBDI::rword args[] = {42};
+      prepared.invoke(&ret_value, args);
+    };
+  });
+
+  BENCHMARK_ADVANCED("libc calls with QBDI")
+  (Catch::Benchmark::Chronometer meter) {
+    TransferVM tvm(transferTarget);
+    QBDI::rword ret_value = 0;
+    tvm.vm.call(&ret_value, transferTarget, {1000});
+
+    meter.measure([&] {
+      tvm.vm.call(&ret_value, transferTarget, {1000});
+      return ret_value;
+    });
+  };
+
+  BENCHMARK_ADVANCED("VM::call of a trivial function")
+  (Catch::Benchmark::Chronometer meter) {
+    TransferVM tvm(trivialTarget);
+    QBDI::rword ret_value = 0;
+    tvm.vm.call(&ret_value, trivialTarget, {42});
+
+    meter.measure([&] {
+      tvm.vm.call(&ret_value, trivialTarget, {42});
+      return ret_value;
+    });
+  };
+}
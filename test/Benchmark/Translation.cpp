@@ -0,0 +1,232 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <chrono>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <QBDI.h>
+
+#include "Benchmark/Report.h"
+
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include <catch2/catch.hpp>
+
+// Generated functions with a few basic blocks each
+template <unsigned N>
+QBDI_NOINLINE QBDI::rword generated(QBDI::rword v) {
+  volatile QBDI::rword acc = v;
+  switch ((acc + N) & 7) {
+  case 0:
+    acc = acc * 3 + N;
+    break;
+  case 1:
+    acc = acc ^ (N << 4);
+    break;
+  case 2:
+    acc = acc - (acc >> 3);
+    break;
+  case 3:
+    acc = acc + (acc << 5) + N;
+    break;
+  case 4:
+    acc = (acc << 7) | (acc >> 9);
+    break;
+  case 5:
+    acc = acc / (N + 1);
+    break;
+  case 6:
+    acc = acc % (N + 3);
+    break;
+  default:
+    acc = ~acc;
+    break;
+  }
+  for (unsigned i = 0; i < (N & 3) + 1; i++) {
+    acc = acc ^ (acc >> (i + 1));
+  }
+  return acc;
+}
+
+template <size_t... I>
+static std::vector<QBDI::rword>
+generatedFunctions(std::index_sequence<I...>) {
+  return {reinterpret_cast<QBDI::rword>(generated<I>)...};
+}
+
+static const std::vector<QBDI::rword> &getGeneratedCode() {
+  static const std::vector<QBDI::rword> entries =
+      generatedFunctions(std::make_index_sequence<1024>());
+  return entries;
+}
+
+// Entry points of functions of the libc
+static const std::vector<QBDI::rword> &getLibcCode() {
+  static const std::vector<QBDI::rword> entries = {
+      reinterpret_cast<QBDI::rword>(&memcpy),
+      reinterpret_cast<QBDI::rword>(&memmove),
+      reinterpret_cast<QBDI::rword>(&memset),
+      reinterpret_cast<QBDI::rword>(&memcmp),
+      reinterpret_cast<QBDI::rword>(&strlen),
+      reinterpret_cast<QBDI::rword>(&strcmp),
+      reinterpret_cast<QBDI::rword>(&strncmp),
+      reinterpret_cast<QBDI::rword>(&strncpy),
+      reinterpret_cast<QBDI::rword>(&strspn),
+      reinterpret_cast<QBDI::rword>(&strtol),
+      reinterpret_cast<QBDI::rword>(&strtod),
+      reinterpret_cast<QBDI::rword>(&atoi),
+      reinterpret_cast<QBDI::rword>(&qsort),
+      reinterpret_cast<QBDI::rword>(&bsearch),
+      reinterpret_cast<QBDI::rword>(&malloc),
+      reinterpret_cast<QBDI::rword>(&calloc),
+      reinterpret_cast<QBDI::rword>(&realloc),
+      reinterpret_cast<QBDI::rword>(&free),
+      reinterpret_cast<QBDI::rword>(&snprintf),
+      reinterpret_cast<QBDI::rword>(&sscanf),
+      reinterpret_cast<QBDI::rword>(&fopen),
+      reinterpret_cast<QBDI::rword>(&fread),
+      reinterpret_cast<QBDI::rword>(&fwrite),
+      reinterpret_cast<QBDI::rword>(&fclose),
+  };
+  return entries;
+}
+
+// Precache the basic blocks that follow each entry, up to maxSize bytes
+static size_t precacheCode(QBDI::VM &vm,
+                           const std::vector<QBDI::rword> &entries,
+                           QBDI::rword maxSize) {
+  size_t blocks = 0;
+  for (QBDI::rword entry : entries) {
+    QBDI::rword address = entry;
+    while (address < entry + maxSize) {
+      QBDI::rword before = vm.getCacheStats().translatedSize;
+      if (not vm.precacheBasicBlock(address)) {
+        break;
+      }
+      QBDI::rword size = vm.getCacheStats().translatedSize - before;
+      if (size == 0) {
+        break;
+      }
+      address += size;
+      blocks++;
+    }
+  }
+  return blocks;
+}
+
+static void emptyRule(QBDI::VMInstanceRef vm, const QBDI::InstAnalysis *inst,
+                      std::vector<QBDI::InstrRuleDataCBK> *cbks, void *data) {}
+
+static void setupVM(QBDI::VM &vm, const std::vector<QBDI::rword> &entries,
+                    bool memoryAccess, unsigned nbRules) {
+  vm.addInstrumentedModuleFromAddr(entries[0]);
+  if (memoryAccess) {
+    vm.recordMemoryAccess(QBDI::MEMORY_READ_WRITE);
+  }
+  // rules which analyse each instruction without instrumenting it
+  for (unsigned i = 0; i < nbRules; i++) {
+    vm.addInstrRule(emptyRule, QBDI::ANALYSIS_INSTRUCTION, nullptr);
+  }
+}
+
+// Print the number of instructions translated per second and the expansion
+// ratio of the translation of a set of code
+static void reportTranslation(const char *name,
+                              const std::vector<QBDI::rword> &entries,
+                              QBDI::rword maxSize, bool memoryAccess,
+                              unsigned nbRules) {
+  static const unsigned ROUNDS = 5;
+
+  // count the instructions once, the counting rule isn't measured
+  size_t nbInst = 0;
+  {
+    QBDI::VM vm;
+    setupVM(vm, entries, memoryAccess, 0);
+    vm.addInstrRule(
+        [&nbInst](QBDI::VMInstanceRef vm, const QBDI::InstAnalysis *inst)
+            -> std::vector<QBDI::InstrRuleDataCBK> {
+          nbInst++;
+          return {};
+        },
+        QBDI::ANALYSIS_INSTRUCTION);
+    precacheCode(vm, entries, maxSize);
+  }
+
+  double ns = 0;
+  size_t blocks = 0;
+  float expansion = 0;
+  for (unsigned i = 0; i < ROUNDS; i++) {
+    QBDI::VM vm;
+    setupVM(vm, entries, memoryAccess, nbRules);
+    auto start = std::chrono::steady_clock::now();
+    blocks = precacheCode(vm, entries, maxSize);
+    auto end = std::chrono::steady_clock::now();
+    ns += std::chrono::duration<double, std::nano>(end - start).count();
+    expansion = vm.getCacheStats().expansionRatio;
+  }
+
+  std::string counterName =
+      std::string("Translation/") + name + "/" +
+      (memoryAccess ? "memory access" : "no memory access") + "/" +
+      std::to_string(nbRules) + " InstrRules/";
+  reportBenchmarkCounter(counterName + "instructions per second",
+                         ns == 0 ? 0.0 : nbInst * ROUNDS * 1e9 / ns, true);
+  reportBenchmarkCounter(counterName + "expansion ratio", expansion, false);
+  printf("%s (%s, %u InstrRules): %.0f instructions/s, expansion ratio %.2f "
+         "(%zu instructions, %zu basic blocks)\n",
+         name, memoryAccess ? "memory access" : "no memory access", nbRules,
+         ns == 0 ? 0.0 : nbInst * ROUNDS * 1e9 / ns, expansion, nbInst,
+         blocks);
+}
+
+TEST_CASE("Benchmark_Translation") {
+
+  for (bool memoryAccess : {false, true}) {
+    for (unsigned nbRules : {0, 10, 50}) {
+      reportTranslation("Generated code", getGeneratedCode(), 512,
+                        memoryAccess, nbRules);
+      reportTranslation("libc", getLibcCode(), 1024, memoryAccess, nbRules);
+    }
+  }
+
+  BENCHMARK_ADVANCED("Generated code translation")
+  (Catch::Benchmark::Chronometer meter) {
+    QBDI::VM vm;
+    setupVM(vm, getGeneratedCode(), false, 0);
+
+    meter.measure([&] {
+      vm.clearAllCache();
+      return precacheCode(vm, getGeneratedCode(), 512);
+    });
+  };
+
+  BENCHMARK_ADVANCED("libc translation")
+  (Catch::Benchmark::Chronometer meter) {
+    QBDI::VM vm;
+    setupVM(vm, getLibcCode(), false, 0);
+
+    meter.measure([&] {
+      vm.clearAllCache();
+      return precacheCode(vm, getLibcCode(), 1024);
+    });
+  };
+}
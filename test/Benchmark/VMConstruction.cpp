@@ -0,0 +1,54 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <QBDI.h>
+
+#include "Engine/LLVMCPU.h"
+#include "ExecBlock/ExecBlock.h"
+#include "ExecBlock/ExecBlockManager.h"
+
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include <catch2/catch.hpp>
+
+TEST_CASE("Benchmark_VMConstruction") {
+
+  // the components constructed by the VM
+  BENCHMARK("LLVMCPUs()") {
+    QBDI::LLVMCPUs llvmCPUs;
+    return llvmCPUs.getOptions();
+  };
+
+  BENCHMARK_ADVANCED("ExecBlockManager() with the ExecBroker transferBlock")
+  (Catch::Benchmark::Chronometer meter) {
+    QBDI::LLVMCPUs llvmCPUs;
+    meter.measure([&] {
+      QBDI::ExecBlockManager blockManager(llvmCPUs);
+      return blockManager.getCacheLimit();
+    });
+  };
+
+  BENCHMARK("VM()") {
+    QBDI::VM vm;
+    return vm.getOptions();
+  };
+
+  BENCHMARK("VM() with instrumentAllExecutableMaps") {
+    QBDI::VM vm;
+    return vm.instrumentAllExecutableMaps();
+  };
+}
@@ -0,0 +1,454 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "QBDI.h"
+
+#include "Benchmark/Report.h"
+
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include <catch2/catch.hpp>
+
+// Macro benchmarks of larger workloads: STL containers, heap allocations,
+// virtual calls and libc functions. Each workload is executed natively and
+// under several instrumentations, the slowdown versus the native execution
+// is reported.
+
+// Text of the workloads, generated once
+static const std::string &workloadText() {
+  static const std::string text = [] {
+    static const char *words[] = {"qbdi",  "instrumentation", "dynamic",
+                                  "binary", "callback",       "memory",
+                                  "access", "sequence",       "block"};
+    std::string t;
+    uint32_t seed = 42;
+    while (t.size() < (1 << 14)) {
+      seed = seed * 1103515245 + 12345;
+      t += words[(seed >> 16) % (sizeof(words) / sizeof(words[0]))];
+      t += ((seed >> 8) & 7) == 0 ? '\n' : ' ';
+    }
+    return t;
+  }();
+  return text;
+}
+
+// Compression
+// ===========
+
+// LZ77 with a hash table of the last position of each 3-byte prefix
+static std::vector<uint8_t> lzCompress(const uint8_t *data, size_t size) {
+  static const size_t HASH_SIZE = 1 << 12;
+  std::vector<uint8_t> out;
+  std::vector<size_t> table(HASH_SIZE, SIZE_MAX);
+  size_t i = 0;
+  while (i < size) {
+    size_t len = 0;
+    size_t dist = 0;
+    if (i + 3 <= size) {
+      size_t h = ((data[i] << 8) ^ (data[i + 1] << 4) ^ data[i + 2]) %
+                 HASH_SIZE;
+      size_t prev = table[h];
+      table[h] = i;
+      if (prev != SIZE_MAX and i - prev < 0xffff) {
+        while (i + len < size and len < 0xff and
+               data[prev + len] == data[i + len]) {
+          len++;
+        }
+        dist = i - prev;
+      }
+    }
+    if (len >= 3) {
+      out.push_back(1);
+      out.push_back(static_cast<uint8_t>(len));
+      out.push_back(static_cast<uint8_t>(dist & 0xff));
+      out.push_back(static_cast<uint8_t>(dist >> 8));
+      i += len;
+    } else {
+      out.push_back(0);
+      out.push_back(data[i]);
+      i++;
+    }
+  }
+  return out;
+}
+
+static std::vector<uint8_t> lzDecompress(const std::vector<uint8_t> &in) {
+  std::vector<uint8_t> out;
+  for (size_t i = 0; i < in.size();) {
+    if (in[i] == 0) {
+      out.push_back(in[i + 1]);
+      i += 2;
+    } else {
+      size_t len = in[i + 1];
+      size_t dist = in[i + 2] | (in[i + 3] << 8);
+      size_t start = out.size() - dist;
+      for (size_t j = 0; j < len; j++) {
+        out.push_back(out[start + j]);
+      }
+      i += 4;
+    }
+  }
+  return out;
+}
+
+QBDI_NOINLINE QBDI::rword workloadCompression(QBDI::rword size) {
+  const std::string &text = workloadText();
+  size = std::min<size_t>(size, text.size());
+  std::vector<uint8_t> compressed =
+      lzCompress(reinterpret_cast<const uint8_t *>(text.data()), size);
+  std::vector<uint8_t> decompressed = lzDecompress(compressed);
+  if (decompressed.size() != size or
+      memcmp(decompressed.data(), text.data(), size) != 0) {
+    return 0;
+  }
+  return compressed.size();
+}
+
+// JSON
+// ====
+
+struct JSONValue {
+  enum Type { NUMBER, STRING, ARRAY, OBJECT } type = NUMBER;
+  double number = 0;
+  std::string string;
+  std::vector<std::unique_ptr<JSONValue>> array;
+  std::map<std::string, std::unique_ptr<JSONValue>> object;
+};
+
+class JSONParser {
+private:
+  const char *cur;
+  const char *end;
+
+  void skip() {
+    while (cur < end and (*cur == ' ' or *cur == '\n' or *cur == ',' or
+                          *cur == ':')) {
+      cur++;
+    }
+  }
+
+  std::string parseString() {
+    std::string s;
+    cur++;
+    while (cur < end and *cur != '"') {
+      s += *cur++;
+    }
+    cur++;
+    return s;
+  }
+
+public:
+  JSONParser(const std::string &doc)
+      : cur(doc.data()), end(doc.data() + doc.size()) {}
+
+  std::unique_ptr<JSONValue> parse() {
+    std::unique_ptr<JSONValue> v = std::make_unique<JSONValue>();
+    skip();
+    if (cur >= end) {
+      return v;
+    }
+    if (*cur == '{') {
+      v->type = JSONValue::OBJECT;
+      cur++;
+      skip();
+      while (cur < end and *cur != '}') {
+        std::string key = parseString();
+        v->object[key] = parse();
+        skip();
+      }
+      cur++;
+    } else if (*cur == '[') {
+      v->type = JSONValue::ARRAY;
+      cur++;
+      skip();
+      while (cur < end and *cur != ']') {
+        v->array.push_back(parse());
+        skip();
+      }
+      cur++;
+    } else if (*cur == '"') {
+      v->type = JSONValue::STRING;
+      v->string = parseString();
+    } else {
+      char *next = nullptr;
+      v->number = strtod(cur, &next);
+      cur = next;
+    }
+    return v;
+  }
+};
+
+static double jsonSum(const JSONValue &v) {
+  switch (v.type) {
+    case JSONValue::NUMBER:
+      return v.number;
+    case JSONValue::STRING:
+      return v.string.size();
+    case JSONValue::ARRAY: {
+      double sum = 0;
+      for (const auto &e : v.array) {
+        sum += jsonSum(*e);
+      }
+      return sum;
+    }
+    case JSONValue::OBJECT: {
+      double sum = 0;
+      for (const auto &e : v.object) {
+        sum += jsonSum(*e.second);
+      }
+      return sum;
+    }
+  }
+  return 0;
+}
+
+static const std::string &workloadJSON() {
+  static const std::string doc = [] {
+    std::string d = "[";
+    char item[128];
+    for (unsigned i = 0; i < 256; i++) {
+      snprintf(item, sizeof(item),
+               "{\"id\": %u, \"name\": \"item%u\", \"price\": %u.%02u, "
+               "\"tags\": [\"a%u\", \"b%u\", %u]},\n",
+               i, i, i * 3, i % 100, i % 7, i % 11, i * i);
+      d += item;
+    }
+    d += "]";
+    return d;
+  }();
+  return doc;
+}
+
+QBDI_NOINLINE QBDI::rword workloadJSONParse(QBDI::rword rounds) {
+  const std::string &doc = workloadJSON();
+  double sum = 0;
+  for (QBDI::rword i = 0; i < rounds; i++) {
+    JSONParser parser(doc);
+    sum += jsonSum(*parser.parse());
+  }
+  return static_cast<QBDI::rword>(sum);
+}
+
+// Containers
+// ==========
+
+QBDI_NOINLINE QBDI::rword workloadContainers(QBDI::rword count) {
+  std::map<std::string, QBDI::rword> ordered;
+  std::unordered_map<QBDI::rword, QBDI::rword> hashed;
+  char key[32];
+  for (QBDI::rword i = 0; i < count; i++) {
+    QBDI::rword k = (i * 2654435761u) % (count * 4);
+    snprintf(key, sizeof(key), "key%llu", static_cast<unsigned long long>(k));
+    ordered[key] += i;
+    hashed[k] += i;
+  }
+  QBDI::rword acc = 0;
+  for (QBDI::rword i = 0; i < count; i++) {
+    auto it = hashed.find(i);
+    if (it != hashed.end()) {
+      acc += it->second;
+      hashed.erase(it);
+    }
+  }
+  for (auto it = ordered.begin(); it != ordered.end();) {
+    acc += it->second + it->first.size();
+    it = ordered.erase(it);
+  }
+  return acc + hashed.size();
+}
+
+// Virtual calls
+// =============
+
+class Shape {
+public:
+  virtual ~Shape() = default;
+  virtual double area() const = 0;
+  virtual const char *name() const = 0;
+};
+
+class Rectangle : public Shape {
+  double w, h;
+
+public:
+  Rectangle(double w, double h) : w(w), h(h) {}
+  double area() const override { return w * h; }
+  const char *name() const override { return "rectangle"; }
+};
+
+class Triangle : public Shape {
+  double b, h;
+
+public:
+  Triangle(double b, double h) : b(b), h(h) {}
+  double area() const override { return b * h / 2; }
+  const char *name() const override { return "triangle"; }
+};
+
+class Circle : public Shape {
+  double r;
+
+public:
+  Circle(double r) : r(r) {}
+  double area() const override { return 3.14159 * r * r; }
+  const char *name() const override { return "circle"; }
+};
+
+QBDI_NOINLINE QBDI::rword workloadVirtual(QBDI::rword count) {
+  std::vector<std::unique_ptr<Shape>> shapes;
+  for (QBDI::rword i = 0; i < count; i++) {
+    double v = static_cast<double>((i * 37) % 101) + 1;
+    switch (i % 3) {
+      case 0:
+        shapes.push_back(std::make_unique<Rectangle>(v, v / 2));
+        break;
+      case 1:
+        shapes.push_back(std::make_unique<Triangle>(v, v + 1));
+        break;
+      default:
+        shapes.push_back(std::make_unique<Circle>(v / 10));
+        break;
+    }
+  }
+  std::sort(shapes.begin(), shapes.end(),
+            [](const std::unique_ptr<Shape> &a,
+               const std::unique_ptr<Shape> &b) {
+              return a->area() < b->area();
+            });
+  QBDI::rword acc = 0;
+  for (const auto &s : shapes) {
+    acc += strlen(s->name()) + static_cast<QBDI::rword>(s->area());
+  }
+  return acc;
+}
+
+// Profiles
+// ========
+
+static QBDI::VMAction emptyInstCB(QBDI::VMInstanceRef vm,
+                                  QBDI::GPRState *gprState,
+                                  QBDI::FPRState *fprState, void *data) {
+  return QBDI::VMAction::CONTINUE;
+}
+
+static QBDI::VMAction emptyEventCB(QBDI::VMInstanceRef vm,
+                                   const QBDI::VMState *vmState,
+                                   QBDI::GPRState *gprState,
+                                   QBDI::FPRState *fprState, void *data) {
+  return QBDI::VMAction::CONTINUE;
+}
+
+struct Workload {
+  const char *name;
+  QBDI::rword (*function)(QBDI::rword);
+  QBDI::rword arg;
+};
+
+struct Profile {
+  const char *name;
+  std::function<void(QBDI::VM &)> setup;
+};
+
+static const unsigned ROUNDS = 5;
+
+static double measureNative(const Workload &workload) {
+  // warm up the caches and the static data of the workload
+  QBDI::rword ret = workload.function(workload.arg);
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned i = 0; i < ROUNDS; i++) {
+    ret += workload.function(workload.arg);
+  }
+  auto end = std::chrono::steady_clock::now();
+  REQUIRE(ret != 0);
+  return std::chrono::duration<double, std::nano>(end - start).count() /
+         ROUNDS;
+}
+
+static double measureVM(const Workload &workload, const Profile &profile) {
+  QBDI::VM vm;
+  uint8_t *fakestack = nullptr;
+  QBDI::allocateVirtualStack(vm.getGPRState(), 1 << 20, &fakestack);
+  vm.addInstrumentedModuleFromAddr(
+      reinterpret_cast<QBDI::rword>(workload.function));
+  profile.setup(vm);
+
+  QBDI::rword expected = workload.function(workload.arg);
+  QBDI::rword ret_value = 0;
+  // fill the cache, the measure only includes the execution
+  vm.call(&ret_value, reinterpret_cast<QBDI::rword>(workload.function),
+          {workload.arg});
+  CHECK(ret_value == expected);
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned i = 0; i < ROUNDS; i++) {
+    vm.call(&ret_value, reinterpret_cast<QBDI::rword>(workload.function),
+            {workload.arg});
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  QBDI::alignedFree(fakestack);
+  return std::chrono::duration<double, std::nano>(end - start).count() /
+         ROUNDS;
+}
+
+TEST_CASE("Benchmark_Workloads") {
+  const Workload workloads[] = {
+      {"compression(16KBytes)", workloadCompression, 1 << 14},
+      {"JSON parse(256 objects)", workloadJSONParse, 4},
+      {"map and unordered_map(4096 keys)", workloadContainers, 4096},
+      {"virtual calls(4096 objects)", workloadVirtual, 4096},
+  };
+  const Profile profiles[] = {
+      {"no instrumentation", [](QBDI::VM &) {}},
+      {"BASIC_BLOCK_ENTRY",
+       [](QBDI::VM &vm) {
+         vm.addVMEventCB(QBDI::BASIC_BLOCK_ENTRY, emptyEventCB, nullptr);
+       }},
+      {"memory access",
+       [](QBDI::VM &vm) { vm.recordMemoryAccess(QBDI::MEMORY_READ_WRITE); }},
+      {"PREINST callback",
+       [](QBDI::VM &vm) {
+         vm.addCodeCB(QBDI::PREINST, emptyInstCB, nullptr);
+       }},
+  };
+
+  for (const Workload &workload : workloads) {
+    double native = measureNative(workload);
+    printf("%s: native %.0f ns per run\n", workload.name, native);
+    for (const Profile &profile : profiles) {
+      double ns = measureVM(workload, profile);
+      double slowdown = native == 0 ? 0 : ns / native;
+      std::string prefix =
+          std::string("Workloads/") + workload.name + "/" + profile.name;
+      reportBenchmarkCounter(prefix + "/ns per run", ns, false);
+      reportBenchmarkCounter(prefix + "/slowdown", slowdown, false);
+      printf("%s with %s: %.0f ns per run, slowdown %.1fx\n", workload.name,
+             profile.name, ns, slowdown);
+    }
+  }
+}
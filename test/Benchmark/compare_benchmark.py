@@ -0,0 +1,110 @@
+#!/usr/bin/env python3
+
+# This file is part of QBDI.
+#
+# Copyright 2017 - 2022 Quarkslab
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+# Compare the JSON output of "QBDIBenchmark -r json" with a baseline.
+#
+# A benchmark regresses when its mean time grows by more than the threshold.
+# A counter regresses when it moves in the wrong direction by more than the
+# counter threshold. An entry of the baseline can override the threshold with
+# a "threshold" key. The script exits with 1 if an entry regresses.
+
+import argparse
+import json
+import shutil
+import sys
+
+
+def load(path):
+    with open(path, 'r') as f:
+        data = json.load(f)
+    return ({b['name']: b for b in data.get('benchmarks', [])},
+            {c['name']: c for c in data.get('counters', [])})
+
+
+def relative_change(base, value):
+    if base == 0:
+        return 0.0 if value == 0 else float('inf')
+    return (value - base) / abs(base)
+
+
+def compare(baseline, results, threshold, report):
+    regressions = 0
+    for name, base in sorted(baseline.items()):
+        if name not in results:
+            print("[MISSING]    {}".format(name))
+            continue
+        limit = base.get('threshold', threshold)
+        base_value, value, worse = report(base, results[name])
+        change = relative_change(base_value, value)
+        regress = (change if worse else -change) > limit
+        if regress:
+            regressions += 1
+        print("[{}] {} : {:.6g} -> {:.6g} ({:+.1f}%)".format(
+            "REGRESSION" if regress else "OK        ", name, base_value, value,
+            change * 100))
+    for name in sorted(set(results) - set(baseline)):
+        print("[NEW]        {}".format(name))
+    return regressions
+
+
+def benchmark_report(base, result):
+    # the time of a benchmark is worse when it grows
+    return base['mean'], result['mean'], True
+
+
+def counter_report(base, result):
+    return base['value'], result['value'], not base.get('higherIsBetter', False)
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Compare the results of QBDIBenchmark with a baseline")
+    parser.add_argument('results', help="The output of QBDIBenchmark -r json")
+    parser.add_argument('baseline', help="The stored baseline")
+    parser.add_argument('--threshold', type=float, default=0.10,
+                        help="Relative slowdown of a benchmark considered as "
+                             "a regression (default: 0.10)")
+    parser.add_argument('--counter-threshold', type=float, default=0.10,
+                        help="Relative degradation of a counter considered as "
+                             "a regression (default: 0.10)")
+    parser.add_argument('--update', action='store_true',
+                        help="Replace the baseline with the results")
+    args = parser.parse_args()
+
+    if args.update:
+        shutil.copyfile(args.results, args.baseline)
+        print("Baseline {} updated".format(args.baseline))
+        return 0
+
+    results_benchmarks, results_counters = load(args.results)
+    baseline_benchmarks, baseline_counters = load(args.baseline)
+
+    regressions = compare(baseline_benchmarks, results_benchmarks,
+                          args.threshold, benchmark_report)
+    regressions += compare(baseline_counters, results_counters,
+                           args.counter_threshold, counter_report)
+
+    if regressions != 0:
+        print("{} regression(s) against {}".format(regressions, args.baseline))
+        return 1
+    print("No regression against {}".format(args.baseline))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -55,6 +55,32 @@ TEST_CASE_METHOD(ExecBlockManagerTest, "ExecBlockManagerTest-ClearCache") {
   REQUIRE(nullptr == execBlockManager.getProgrammedExecBlock(0x42424242));
 }
 
+TEST_CASE_METHOD(ExecBlockManagerTest,
+                 "ExecBlockManagerTest-ClearCacheRange") {
+  QBDI::ExecBlockManager execBlockManager(*this);
+
+  execBlockManager.writeBasicBlock(getEmptyBB(0x42424242, *this), 1);
+  execBlockManager.writeBasicBlock(getEmptyBB(0x42424250, *this), 1);
+  QBDI::ExecBlock *block = execBlockManager.getProgrammedExecBlock(0x42424242);
+  REQUIRE(nullptr != block);
+  REQUIRE(block == execBlockManager.getProgrammedExecBlock(0x42424250));
+
+  // only the sequences in the range are removed
+  execBlockManager.clearCache(QBDI::Range<QBDI::rword>(0x42424250, 0x42424251));
+  REQUIRE(nullptr == execBlockManager.getProgrammedExecBlock(0x42424250));
+  REQUIRE(block == execBlockManager.getProgrammedExecBlock(0x42424242));
+  execBlockManager.flushCommit();
+  REQUIRE(nullptr == execBlockManager.getProgrammedExecBlock(0x42424250));
+  REQUIRE(block == execBlockManager.getProgrammedExecBlock(0x42424242));
+
+  // the region is removed with its last sequence
+  execBlockManager.clearCache(QBDI::Range<QBDI::rword>(0x42424242, 0x42424243));
+  execBlockManager.flushCommit();
+  REQUIRE(nullptr == execBlockManager.getProgrammedExecBlock(0x42424242));
+  execBlockManager.writeBasicBlock(getEmptyBB(0x42424250, *this), 1);
+  REQUIRE(nullptr != execBlockManager.getProgrammedExecBlock(0x42424250));
+}
+
 TEST_CASE_METHOD(ExecBlockManagerTest, "ExecBlockManagerTest-ExecBlockReuse") {
   QBDI::ExecBlockManager execBlockManager(*this);
 
@@ -64,6 +90,87 @@ TEST_CASE_METHOD(ExecBlockManagerTest, "ExecBlockManagerTest-ExecBlockReuse") {
           execBlockManager.getProgrammedExecBlock(0x42424243));
 }
 
+TEST_CASE_METHOD(ExecBlockManagerTest, "ExecBlockManagerTest-HotExecBlock") {
+  QBDI::ExecBlockManager execBlockManager(*this);
+
+  execBlockManager.writeBasicBlock(getEmptyBB(0x42424242, *this), 1);
+  QBDI::ExecBlock *cold = execBlockManager.getProgrammedExecBlock(0x42424242);
+  REQUIRE(cold != nullptr);
+  REQUIRE(execBlockManager.writeSuperBlock(getEmptyBB(0x42424242, *this)));
+  QBDI::ExecBlock *hot = execBlockManager.getProgrammedSuperBlock(0x42424242);
+  REQUIRE(hot != nullptr);
+  REQUIRE(hot != cold);
+  REQUIRE(hot->isHot());
+  REQUIRE_FALSE(cold->isHot());
+  REQUIRE(execBlockManager.getCacheStats().execBlockCount == 2);
+
+  // the new sequences aren't written in the ExecBlock of the superblocks
+  execBlockManager.writeBasicBlock(getEmptyBB(0x42424243, *this), 1);
+  REQUIRE(execBlockManager.getProgrammedExecBlock(0x42424243) == cold);
+
+  // the ExecBlock of the dropped superblocks is reclaimed
+  execBlockManager.clearSuperBlocks(
+      QBDI::Range<QBDI::rword>(0x42424242, 0x42424243));
+  execBlockManager.flushCommit();
+  REQUIRE(execBlockManager.getProgrammedSuperBlock(0x42424242) == nullptr);
+  REQUIRE(execBlockManager.getProgrammedExecBlock(0x42424242) == cold);
+  REQUIRE(execBlockManager.getCacheStats().execBlockCount == 1);
+}
+
+TEST_CASE_METHOD(ExecBlockManagerTest, "ExecBlockManagerTest-SealCache") {
+  QBDI::ExecBlockManager execBlockManager(*this);
+
+  execBlockManager.writeBasicBlock(getEmptyBB(0x42424242, *this), 1);
+  QBDI::ExecBlock *sealed = execBlockManager.getProgrammedExecBlock(0x42424242);
+  REQUIRE(sealed != nullptr);
+  REQUIRE(execBlockManager.sealCache() == 1);
+  REQUIRE(sealed->isSealed());
+  REQUIRE(execBlockManager.sealCache() == 0);
+
+  // the sealed ExecBlock keeps its sequences, the new ones are written in
+  // another ExecBlock
+  execBlockManager.writeBasicBlock(getEmptyBB(0x42424243, *this), 1);
+  QBDI::ExecBlock *block = execBlockManager.getProgrammedExecBlock(0x42424243);
+  REQUIRE(block != nullptr);
+  REQUIRE(block != sealed);
+  REQUIRE_FALSE(block->isSealed());
+  REQUIRE(execBlockManager.getProgrammedExecBlock(0x42424242) == sealed);
+  REQUIRE(execBlockManager.getCacheStats().execBlockCount == 2);
+}
+
+TEST_CASE_METHOD(ExecBlockManagerTest, "ExecBlockManagerTest-MidBlockEntry") {
+  QBDI::ExecBlockManager execBlockManager(*this);
+
+  QBDI::Patch::Vec bb;
+  for (QBDI::rword address = 0x42424242; address < 0x42424246; address++) {
+    bb.push_back(generateEmptyPatch(address, *this));
+  }
+  execBlockManager.writeBasicBlock(std::move(bb), 4);
+  QBDI::SeqLoc start;
+  QBDI::ExecBlock *block =
+      execBlockManager.getProgrammedExecBlock(0x42424242, &start);
+  REQUIRE(block != nullptr);
+  uint16_t startID = block->getSeqStart(start.seqID);
+  REQUIRE(block->getCurrentEntryID() == startID);
+  size_t metadata = block->getMetadataMemory();
+
+  // the entries in the middle share the sequence, without new metadata
+  for (unsigned i = 0; i < 2; i++) {
+    QBDI::SeqLoc middle;
+    REQUIRE(execBlockManager.getProgrammedExecBlock(0x42424244, &middle) ==
+            block);
+    REQUIRE(middle.seqID == start.seqID);
+    REQUIRE(middle.seqStart == 0x42424244);
+    REQUIRE(middle.seqEnd == start.seqEnd);
+    REQUIRE(middle.bbEnd == start.bbEnd);
+    REQUIRE(block->getCurrentSeqID() == start.seqID);
+    REQUIRE(block->getCurrentEntryID() == startID + 2);
+  }
+  REQUIRE(block->getMetadataMemory() == metadata);
+  REQUIRE(execBlockManager.getCacheStats().sequenceCount == 1);
+  REQUIRE(execBlockManager.getCacheStats().splitCount == 2);
+}
+
 TEST_CASE_METHOD(ExecBlockManagerTest,
                  "ExecBlockManagerTest-ExecBlockRegions") {
   QBDI::ExecBlockManager execBlockManager(*this);
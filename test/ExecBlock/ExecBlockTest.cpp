@@ -26,6 +26,7 @@
 #include "Patch/PatchRule.h"
 #include "Patch/PatchRules.h"
 #include "Patch/RelocatableInst.h"
+#include "Utility/System.h"
 
 TEST_CASE_METHOD(ExecBlockTest, "ExecBlockTest-EmptyBasicBlock") {
   // Allocate ExecBlock
@@ -90,3 +91,139 @@ TEST_CASE_METHOD(ExecBlockTest, "ExecBlockTest-BasicBlockOverload") {
   }
   INFO("Maximum basic block per exec block: " << i);
 }
+
+TEST_CASE_METHOD(ExecBlockTest, "ExecBlockTest-FullBlockMetadata") {
+  QBDI::ExecBlock execBlock(*this);
+  QBDI::SeqWriteResult res;
+  QBDI::rword address = 0x42424242;
+  size_t nbSeq = 0;
+
+  do {
+    QBDI::Patch::Vec bb;
+    bb.push_back(generateEmptyPatch(address++, *this));
+    res = execBlock.writeSequence(bb.begin(), bb.end());
+    if (res.seqID != QBDI::EXEC_BLOCK_FULL) {
+      nbSeq++;
+    }
+  } while (res.seqID != QBDI::EXEC_BLOCK_FULL);
+  REQUIRE(nbSeq > 0);
+  REQUIRE(execBlock.getInstCount() == nbSeq);
+
+  // the capacity of the metadata is released once the ExecBlock is full
+  size_t shadows = execBlock.queryShadowBySeq(QBDI::ANY, QBDI::ANY).size();
+  size_t tags = 0;
+  for (uint16_t instID = 0; instID < nbSeq; instID++) {
+    tags += execBlock.getTagByInst(instID).size();
+    REQUIRE(execBlock.queryShadowByInst(instID, QBDI::ANY).size() ==
+            execBlock.getShadowByInst(instID).size());
+  }
+  REQUIRE(execBlock.getMetadataMemory() <=
+          nbSeq * (sizeof(QBDI::InstMetadata) + sizeof(QBDI::InstInfo) +
+                   sizeof(QBDI::SeqInfo) + 2 * sizeof(QBDI::ExitInfo)) +
+              shadows * sizeof(QBDI::ShadowInfo) +
+              tags * sizeof(QBDI::TagInfo));
+}
+
+TEST_CASE_METHOD(ExecBlockTest, "ExecBlockTest-OriginalMCInst") {
+  QBDI::ExecBlock execBlock(*this);
+  QBDI::Patch::Vec bb;
+  bb.push_back(generateEmptyPatch(0x42424242, *this));
+  llvm::MCInst &inst = bb[0].metadata.inst;
+  inst.setFlags(3);
+  inst.addOperand(llvm::MCOperand::createReg(1));
+  inst.addOperand(llvm::MCOperand::createImm(0x4242));
+  llvm::MCInst expected = inst;
+
+  QBDI::SeqWriteResult res = execBlock.writeSequence(bb.begin(), bb.end());
+  REQUIRE(res.seqID != QBDI::EXEC_BLOCK_FULL);
+  uint16_t instID = execBlock.getSeqStart(res.seqID);
+
+  // the MCInst is rebuilt from the operands stored by the ExecBlock
+  llvm::MCInst original = execBlock.getOriginalMCInst(instID);
+  REQUIRE(original.getOpcode() == expected.getOpcode());
+  REQUIRE(original.getFlags() == expected.getFlags());
+  REQUIRE(original.getNumOperands() == 2);
+  REQUIRE(original.getOperand(0).getReg() == 1);
+  REQUIRE(original.getOperand(1).getImm() == 0x4242);
+  QBDI::InstMetadata metadata = execBlock.getOriginalInstMetadata(instID);
+  REQUIRE(metadata.address == 0x42424242);
+  REQUIRE(metadata.inst.getOpcode() == expected.getOpcode());
+  REQUIRE(execBlock.getInstMetadata(instID).address == 0x42424242);
+}
+
+#if defined(QBDI_ARCH_X86_64)
+TEST_CASE_METHOD(ExecBlockTest, "ExecBlockTest-Template") {
+  // The first ExecBlock fills the template, the second copies it
+  QBDI::ExecBlockTemplate blockTemplate;
+  QBDI::ExecBlock execBlock1(*this, nullptr, nullptr, nullptr, 0, nullptr, 0,
+                             0, &blockTemplate);
+  REQUIRE(blockTemplate.epilogue.size() == execBlock1.getEpilogueSize());
+  REQUIRE_FALSE(blockTemplate.prologue.empty());
+  QBDI::ExecBlock execBlock2(*this, nullptr, nullptr, nullptr,
+                             execBlock1.getEpilogueSize(), nullptr, 0, 0,
+                             &blockTemplate);
+  REQUIRE(execBlock2.getEpilogueOffset() == execBlock1.getEpilogueOffset());
+  // Execute a terminator in the copied ExecBlock
+  QBDI::Patch::Vec terminator;
+  terminator.push_back(generateEmptyPatch(0x42424242, *this));
+  terminator[0].append(QBDI::getTerminator(0x42424242));
+  terminator[0].metadata.modifyPC = true;
+  QBDI::SeqWriteResult res =
+      execBlock2.writeSequence(terminator.begin(), terminator.end());
+  REQUIRE(res.seqID != QBDI::EXEC_BLOCK_FULL);
+  execBlock2.selectSeq(res.seqID);
+  execBlock2.execute();
+  REQUIRE(QBDI_GPR_GET(&execBlock2.getContext()->gprState, QBDI::REG_PC) ==
+          0x42424242);
+}
+#endif
+
+TEST_CASE_METHOD(ExecBlockTest, "ExecBlockTest-Allocator") {
+  // The memory of a freed ExecBlock is reused by the next one
+  QBDI::ExecBlockAllocator allocator;
+  QBDI::rword dataBlockBase;
+  {
+    QBDI::ExecBlock execBlock1(*this, nullptr, nullptr, nullptr, 0, nullptr, 0,
+                               0, nullptr, 0, &allocator);
+    dataBlockBase = execBlock1.getDataBlockBase();
+  }
+  size_t mappedSize = allocator.getMappedSize();
+  QBDI::ExecBlock execBlock2(*this, nullptr, nullptr, nullptr, 0, nullptr, 0, 0,
+                             nullptr, 0, &allocator);
+  REQUIRE(execBlock2.getDataBlockBase() == dataBlockBase);
+  REQUIRE(allocator.getMappedSize() == mappedSize);
+  // Execute a terminator in the recycled ExecBlock
+  QBDI::Patch::Vec terminator;
+  terminator.push_back(generateEmptyPatch(0x42424242, *this));
+  terminator[0].append(QBDI::getTerminator(0x42424242));
+  terminator[0].metadata.modifyPC = true;
+  QBDI::SeqWriteResult res =
+      execBlock2.writeSequence(terminator.begin(), terminator.end());
+  REQUIRE(res.seqID != QBDI::EXEC_BLOCK_FULL);
+  execBlock2.selectSeq(res.seqID);
+  execBlock2.execute();
+  REQUIRE(QBDI_GPR_GET(&execBlock2.getContext()->gprState, QBDI::REG_PC) ==
+          0x42424242);
+}
+
+#if defined(QBDI_PLATFORM_LINUX) || defined(QBDI_PLATFORM_ANDROID)
+TEST_CASE_METHOD(ExecBlockTest, "ExecBlockTest-AllocatorNumaBinding") {
+  // The chunks take the node of the thread, even if the sandbox of the test
+  // forbids to bind them
+  int node = QBDI::getCurrentNumaNode();
+  REQUIRE(node >= 0);
+  QBDI::ExecBlockAllocator allocator(false, true);
+  REQUIRE(allocator.getNumaNode() == -1);
+  QBDI::ExecBlock execBlock(*this, nullptr, nullptr, nullptr, 0, nullptr, 0, 0,
+                            nullptr, 0, &allocator);
+  REQUIRE(allocator.getNumaNode() == node);
+  // the thread may have moved to another node since
+  allocator.bindToCurrentNumaNode();
+  REQUIRE(allocator.getNumaNode() >= 0);
+
+  // The binding is only done with the option
+  QBDI::ExecBlockAllocator unbound;
+  REQUIRE_FALSE(unbound.bindToCurrentNumaNode());
+  REQUIRE(unbound.getNumaNode() == -1);
+}
+#endif
@@ -0,0 +1,147 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <catch2/catch.hpp>
+#include <vector>
+
+#include "X86InstrInfo.h"
+#include "llvm/MC/MCInst.h"
+
+#include "QBDI/Callback.h"
+#include "QBDI/State.h"
+#include "ExecBlock/ExecBlock.h"
+#include "ExecBlock/ExecBlockTest.h"
+#include "Patch/InstInfo.h"
+#include "Patch/Patch.h"
+#include "Patch/Types.h"
+
+namespace {
+
+struct Site {
+  std::vector<const Site *> *log;
+};
+
+QBDI::VMAction logSite(QBDI::VMInstanceRef vm, QBDI::GPRState *gprState,
+                       QBDI::FPRState *fprState, void *data) {
+  const Site *site = static_cast<const Site *>(data);
+  site->log->push_back(site);
+  return QBDI::CONTINUE;
+}
+
+struct SitePosition {
+  QBDI::InstPosition position;
+  QBDI::RelocatableInstTag tag;
+  const Site *site;
+};
+
+// An empty patch with a break to the host for each site. The sites with an
+// other tag or position aren't merged in a single break.
+QBDI::Patch getCallbackPatch(QBDI::rword address,
+                             const std::vector<SitePosition> &sites,
+                             const QBDI::LLVMCPUs &llvmcpu) {
+  llvm::MCInst inst;
+  inst.setOpcode(llvm::X86::NOOP);
+
+  QBDI::Patch p{inst, address, 1, llvmcpu.getCPU(QBDI::CPUMode::DEFAULT)};
+  for (const SitePosition &s : sites) {
+    p.addCallbackPatch(s.position, 0, s.tag,
+                       QBDI::InstrCallback{logSite,
+                                           const_cast<Site *>(s.site),
+                                           nullptr});
+  }
+  p.finalizeInstsPatch();
+  return p;
+}
+
+} // namespace
+
+TEST_CASE_METHOD(ExecBlockTest, "CallbackSiteTest_X86_64-MultipleSites") {
+  QBDI::ExecBlock execBlock(*this);
+  std::vector<const Site *> log;
+  Site sites[4] = {{&log}, {&log}, {&log}, {&log}};
+
+  // the same callback and data after the instruction share the record of
+  // the site before it
+  QBDI::Patch::Vec bb;
+  bb.push_back(getCallbackPatch(
+      0x42424242,
+      {{QBDI::PREINST, QBDI::RelocTagPreInstMemAccess, &sites[0]},
+       {QBDI::PREINST, QBDI::RelocTagPreInstStdCBK, &sites[1]},
+       {QBDI::POSTINST, QBDI::RelocTagPostInstMemAccess, &sites[0]},
+       {QBDI::POSTINST, QBDI::RelocTagPostInstStdCBK, &sites[2]}},
+      *this));
+  bb.push_back(getCallbackPatch(
+      0x42424243,
+      {{QBDI::PREINST, QBDI::RelocTagPreInstStdCBK, &sites[3]},
+       {QBDI::POSTINST, QBDI::RelocTagPostInstStdCBK, &sites[0]}},
+      *this));
+  QBDI::SeqWriteResult res = execBlock.writeSequence(bb.begin(), bb.end());
+  REQUIRE(res.seqID != QBDI::EXEC_BLOCK_FULL);
+  REQUIRE(res.patchWritten == 2);
+  CHECK(execBlock.getCallbackSiteCount() == 5);
+
+  for (unsigned i = 0; i < 2; i++) {
+    log.clear();
+    execBlock.selectSeq(res.seqID);
+    execBlock.execute();
+    std::vector<const Site *> expected = {&sites[0], &sites[1], &sites[0],
+                                          &sites[2], &sites[3], &sites[0]};
+    CHECK(log == expected);
+  }
+}
+
+TEST_CASE_METHOD(ExecBlockTest, "CallbackSiteTest_X86_64-OverflowRollback") {
+  QBDI::ExecBlock execBlock(*this);
+  std::vector<const Site *> log;
+  std::vector<Site> sites;
+  std::vector<uint16_t> seqIDs;
+  QBDI::rword address = 0x42424242;
+
+  // large enough not to move during the test
+  sites.reserve(4096);
+  QBDI::SeqWriteResult res;
+  do {
+    REQUIRE(sites.size() + 2 <= sites.capacity());
+    sites.push_back({&log});
+    sites.push_back({&log});
+    QBDI::Patch::Vec bb;
+    bb.push_back(getCallbackPatch(
+        address,
+        {{QBDI::PREINST, QBDI::RelocTagPreInstStdCBK, &sites.end()[-2]},
+         {QBDI::POSTINST, QBDI::RelocTagPostInstStdCBK, &sites.end()[-1]}},
+        *this));
+    res = execBlock.writeSequence(bb.begin(), bb.end());
+    if (res.seqID != QBDI::EXEC_BLOCK_FULL) {
+      seqIDs.push_back(res.seqID);
+    }
+    address++;
+  } while (res.seqID != QBDI::EXEC_BLOCK_FULL);
+  REQUIRE(seqIDs.size() > 0);
+
+  // the records of the patch which didn't fit have been rolled back
+  REQUIRE(execBlock.getInstCount() == seqIDs.size());
+  CHECK(execBlock.getCallbackSiteCount() == 2 * seqIDs.size());
+
+  // each site still calls the callback of its own instruction
+  for (size_t i = 0; i < seqIDs.size(); i++) {
+    log.clear();
+    execBlock.selectSeq(seqIDs[i]);
+    execBlock.execute();
+    std::vector<const Site *> expected = {&sites[2 * i], &sites[2 * i + 1]};
+    CHECK(log == expected);
+  }
+}
@@ -0,0 +1,360 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <catch2/catch.hpp>
+#include <string.h>
+#include <xmmintrin.h>
+
+#include "X86InstrInfo.h"
+#include "llvm/MC/MCInst.h"
+#include "llvm/MC/MCInstBuilder.h"
+
+#include "QBDI/Options.h"
+#include "QBDI/State.h"
+#include "Engine/LLVMCPU.h"
+#include "ExecBlock/Context.h"
+#include "ExecBlock/ExecBlock.h"
+#include "ExecBlock/ExecBlockManager.h"
+#include "Patch/ExecBlockFlags.h"
+#include "Patch/Patch.h"
+#include "Patch/RelocatableInst.h"
+#include "Utility/System.h"
+
+namespace {
+
+const QBDI::rword address = 0x42424242;
+
+// A patch of the instruction, the ExecBlock terminates its sequence
+QBDI::Patch getPatch(QBDI::rword address, const llvm::MCInst &inst,
+                     const QBDI::LLVMCPUs &llvmcpus) {
+  const QBDI::LLVMCPU &llvmcpu = llvmcpus.getCPU(QBDI::CPUMode::DEFAULT);
+
+  QBDI::Patch p{inst, address, llvmcpu.getInstSize(inst), llvmcpu};
+  p.append(QBDI::NoReloc::unique(llvm::MCInst(inst)));
+  p.finalizeInstsPatch();
+  return p;
+}
+
+uint16_t writeInst(QBDI::ExecBlock &execBlock, const llvm::MCInst &inst,
+                   const QBDI::LLVMCPUs &llvmcpus) {
+  QBDI::Patch::Vec bb;
+  bb.push_back(getPatch(address, inst, llvmcpus));
+  QBDI::SeqWriteResult res = execBlock.writeSequence(bb.begin(), bb.end());
+  REQUIRE(res.seqID != QBDI::EXEC_BLOCK_FULL);
+  return res.seqID;
+}
+
+// Distinct values in every GPR, the stack pointer points to a valid stack
+void initGPR(QBDI::GPRState &gprState, QBDI::rword *stack) {
+  memset(&gprState, 0, sizeof(QBDI::GPRState));
+  for (unsigned int i = 0; i < QBDI::REG_PC; i++) {
+    QBDI_GPR_SET(&gprState, i, 0x1111111111111111 * (i + 1));
+  }
+  QBDI_GPR_SET(&gprState, QBDI::REG_SP, reinterpret_cast<QBDI::rword>(stack));
+  // CF and the reserved bit
+  gprState.eflags = 0x203;
+}
+
+// The default FPR of the Engine, with distinct values in the XMM and YMM
+void initFPR(QBDI::FPRState &fprState) {
+  memset(&fprState, 0, sizeof(QBDI::FPRState));
+  fprState.rfcw = 0x37F;
+  fprState.mxcsr = 0x1F80;
+  fprState.mxcsrmask = 0xFFFF;
+  char *xmm = fprState.xmm0;
+  char *ymm = fprState.ymm0;
+  for (unsigned int i = 0; i < 16 * 16; i++) {
+    xmm[i] = static_cast<char>(i);
+    ymm[i] = static_cast<char>(0xff - i);
+  }
+}
+
+// The control registers and the vector registers are unchanged, the other
+// fields of the FXSAVE area are written by the processor
+bool sameVectors(const QBDI::FPRState &a, const QBDI::FPRState &b) {
+  return a.rfcw == b.rfcw and a.mxcsr == b.mxcsr and
+         memcmp(a.xmm0, b.xmm0, 16 * 16) == 0 and
+         memcmp(a.ymm0, b.ymm0, 16 * 16) == 0;
+}
+
+} // namespace
+
+TEST_CASE("TrampolineTest_X86_64-GPR") {
+  QBDI::LLVMCPUs llvmcpus;
+  QBDI::ExecBlock execBlock(llvmcpus);
+  QBDI::rword stack[16];
+
+  // rax = rax + rbx + CF
+  uint16_t seqID = writeInst(execBlock,
+                             llvm::MCInstBuilder(llvm::X86::ADC64rr)
+                                 .addReg(llvm::X86::RAX)
+                                 .addReg(llvm::X86::RAX)
+                                 .addReg(llvm::X86::RBX),
+                             llvmcpus);
+  QBDI::GPRState &gprState = execBlock.getContext()->gprState;
+  initGPR(gprState, &stack[8]);
+  QBDI::GPRState expected = gprState;
+  expected.rax = gprState.rax + gprState.rbx + 1;
+
+  for (unsigned int i = 0; i < 2; i++) {
+    execBlock.selectSeq(seqID);
+    execBlock.execute();
+    for (unsigned int reg = 0; reg < QBDI::REG_PC; reg++) {
+      INFO("Register " << QBDI::GPR_NAMES[reg]);
+      CHECK(QBDI_GPR_GET(&gprState, reg) == QBDI_GPR_GET(&expected, reg));
+    }
+    CHECK(gprState.rip == address + 3);
+    // the addition has cleared CF
+    CHECK((gprState.eflags & 0x1) == 0);
+    CHECK((gprState.eflags & 0x2) == 0x2);
+
+    expected.rax += gprState.rbx;
+    gprState.eflags = 0x202;
+  }
+}
+
+TEST_CASE("TrampolineTest_X86_64-FPR") {
+  QBDI::Options opts =
+      GENERATE(QBDI::Options::NO_OPT, QBDI::Options::OPT_DISABLE_FPR,
+               QBDI::Options::OPT_DISABLE_OPTIONAL_FPR);
+  INFO("Options " << opts);
+  QBDI::LLVMCPUs llvmcpus{"", {}, opts};
+  QBDI::ExecBlock execBlock(llvmcpus);
+
+  // xmm0 = xmm1
+  uint16_t fprSeq = writeInst(execBlock,
+                              llvm::MCInstBuilder(llvm::X86::MOVAPSrr)
+                                  .addReg(llvm::X86::XMM0)
+                                  .addReg(llvm::X86::XMM1),
+                              llvmcpus);
+  uint16_t gprSeq = writeInst(execBlock,
+                              llvm::MCInstBuilder(llvm::X86::ADD64rr)
+                                  .addReg(llvm::X86::RAX)
+                                  .addReg(llvm::X86::RAX)
+                                  .addReg(llvm::X86::RBX),
+                              llvmcpus);
+  QBDI::FPRState &fprState = execBlock.getContext()->fprState;
+  initFPR(fprState);
+  // round down, the host keeps its own rounding mode
+  fprState.mxcsr = 0x3F80;
+  QBDI::FPRState initial = fprState;
+  unsigned int hostMXCSR = _mm_getcsr();
+
+  execBlock.selectSeq(fprSeq);
+  if (opts == QBDI::Options::OPT_DISABLE_FPR) {
+    CHECK(execBlock.getContext()->hostState.executeFlags == 0);
+  } else if (opts == QBDI::Options::OPT_DISABLE_OPTIONAL_FPR) {
+    CHECK(execBlock.getContext()->hostState.executeFlags ==
+          QBDI::defaultExecuteFlags);
+  } else {
+    CHECK(execBlock.getContext()->hostState.executeFlags ==
+          QBDI::ExecBlockFlags::needFPU);
+  }
+  execBlock.execute();
+  CHECK(_mm_getcsr() == hostMXCSR);
+  CHECK(fprState.mxcsr == initial.mxcsr);
+  CHECK(fprState.rfcw == initial.rfcw);
+  if (opts == QBDI::Options::OPT_DISABLE_FPR) {
+    // the instruction has used the registers of the host
+    CHECK(sameVectors(fprState, initial));
+  } else {
+    CHECK(memcmp(fprState.xmm0, initial.xmm1, sizeof(fprState.xmm0)) == 0);
+    CHECK(memcmp(fprState.xmm1, initial.xmm1, sizeof(fprState.xmm1)) == 0);
+    CHECK(memcmp(fprState.xmm2, initial.xmm2, 14 * 16) == 0);
+    CHECK(memcmp(fprState.ymm0, initial.ymm0, 16 * 16) == 0);
+  }
+
+  // a sequence without FPR only switches them with OPT_DISABLE_OPTIONAL_FPR
+  initFPR(fprState);
+  initial = fprState;
+  execBlock.selectSeq(gprSeq);
+  if (opts == QBDI::Options::OPT_DISABLE_OPTIONAL_FPR) {
+    CHECK(execBlock.getContext()->hostState.executeFlags ==
+          QBDI::defaultExecuteFlags);
+  } else {
+    CHECK(execBlock.getContext()->hostState.executeFlags == 0);
+  }
+  execBlock.execute();
+  CHECK(_mm_getcsr() == hostMXCSR);
+  CHECK(sameVectors(fprState, initial));
+}
+
+TEST_CASE("TrampolineTest_X86_64-AVX") {
+  if (not QBDI::isHostCPUFeaturePresent("avx")) {
+    return;
+  }
+  QBDI::Options opts = GENERATE(QBDI::Options::NO_OPT,
+                                QBDI::Options::OPT_DISABLE_OPTIONAL_FPR);
+  INFO("Options " << opts);
+  QBDI::LLVMCPUs llvmcpus{"", {}, opts};
+  QBDI::ExecBlock execBlock(llvmcpus);
+
+  // ymm0 = ymm1 only needs the low upper halves, ymm8 = ymm9 the high ones
+  uint16_t lowSeq = writeInst(execBlock,
+                              llvm::MCInstBuilder(llvm::X86::VMOVAPSYrr)
+                                  .addReg(llvm::X86::YMM0)
+                                  .addReg(llvm::X86::YMM1),
+                              llvmcpus);
+  uint16_t highSeq = writeInst(execBlock,
+                               llvm::MCInstBuilder(llvm::X86::VMOVAPSYrr)
+                                   .addReg(llvm::X86::YMM8)
+                                   .addReg(llvm::X86::YMM9),
+                               llvmcpus);
+  QBDI::FPRState &fprState = execBlock.getContext()->fprState;
+  initFPR(fprState);
+  QBDI::FPRState initial = fprState;
+
+  execBlock.selectSeq(lowSeq);
+  if (opts == QBDI::Options::NO_OPT) {
+    CHECK(execBlock.getContext()->hostState.executeFlags ==
+          (QBDI::ExecBlockFlags::needAVX | QBDI::ExecBlockFlags::needFPU));
+  }
+  execBlock.execute();
+  CHECK(memcmp(fprState.xmm0, initial.xmm1, sizeof(fprState.xmm0)) == 0);
+  CHECK(memcmp(fprState.ymm0, initial.ymm1, sizeof(fprState.ymm0)) == 0);
+  CHECK(memcmp(fprState.ymm1, initial.ymm1, 15 * 16) == 0);
+
+  initFPR(fprState);
+  execBlock.selectSeq(highSeq);
+  if (opts == QBDI::Options::NO_OPT) {
+    CHECK(execBlock.getContext()->hostState.executeFlags ==
+          (QBDI::ExecBlockFlags::needAVXHigh | QBDI::ExecBlockFlags::needFPU));
+  }
+  execBlock.execute();
+  CHECK(memcmp(fprState.xmm8, initial.xmm9, sizeof(fprState.xmm8)) == 0);
+  CHECK(memcmp(fprState.ymm8, initial.ymm9, sizeof(fprState.ymm8)) == 0);
+  CHECK(memcmp(fprState.ymm0, initial.ymm0, 8 * 16) == 0);
+  CHECK(memcmp(fprState.ymm9, initial.ymm9, 7 * 16) == 0);
+}
+
+TEST_CASE("TrampolineTest_X86_64-FSGS") {
+  if (not QBDI::isHostCPUFeaturePresent("fsgsbase")) {
+    return;
+  }
+  static thread_local QBDI::rword hostTLS = 0x13371337;
+  QBDI::LLVMCPUs llvmcpus{"", {}, QBDI::Options::OPT_ENABLE_FS_GS};
+  QBDI::ExecBlock execBlock(llvmcpus);
+  QBDI::rword guestTLS[2] = {0x42424242, 0x24242424};
+
+  // rax = fs:[0], rbx = gs:[8]
+  QBDI::Patch::Vec bb;
+  bb.push_back(getPatch(address,
+                        llvm::MCInstBuilder(llvm::X86::MOV64rm)
+                            .addReg(llvm::X86::RAX)
+                            .addReg(0)
+                            .addImm(1)
+                            .addReg(0)
+                            .addImm(0)
+                            .addReg(llvm::X86::FS),
+                        llvmcpus));
+  bb.push_back(getPatch(address + 9,
+                        llvm::MCInstBuilder(llvm::X86::MOV64rm)
+                            .addReg(llvm::X86::RBX)
+                            .addReg(0)
+                            .addImm(1)
+                            .addReg(0)
+                            .addImm(8)
+                            .addReg(llvm::X86::GS),
+                        llvmcpus));
+  QBDI::SeqWriteResult res = execBlock.writeSequence(bb.begin(), bb.end());
+  REQUIRE(res.seqID != QBDI::EXEC_BLOCK_FULL);
+
+  QBDI::GPRState &gprState = execBlock.getContext()->gprState;
+  gprState.fs = reinterpret_cast<QBDI::rword>(&guestTLS[0]);
+  gprState.gs = reinterpret_cast<QBDI::rword>(&guestTLS[0]);
+  execBlock.selectSeq(res.seqID);
+  CHECK((execBlock.getContext()->hostState.executeFlags &
+         QBDI::ExecBlockFlags::needFSGS) != 0);
+  execBlock.execute();
+
+  CHECK(gprState.rax == guestTLS[0]);
+  CHECK(gprState.rbx == guestTLS[1]);
+  CHECK(gprState.fs == reinterpret_cast<QBDI::rword>(&guestTLS[0]));
+  CHECK(gprState.gs == reinterpret_cast<QBDI::rword>(&guestTLS[0]));
+  // the thread-local storage of the host is addressed with its FS again
+  CHECK(hostTLS == 0x13371337);
+  hostTLS++;
+  CHECK(hostTLS == 0x13371338);
+}
+
+TEST_CASE("TrampolineTest_X86_64-TwoManagers") {
+  QBDI::LLVMCPUs llvmcpus;
+  QBDI::LLVMCPUs noFPRcpus{"", {}, QBDI::Options::OPT_DISABLE_FPR};
+  QBDI::ExecBlockManager manager(llvmcpus);
+  QBDI::ExecBlockManager noFPRManager(noFPRcpus);
+  QBDI::rword stack[2][16];
+
+  // xmm0 = xmm1, rax = rax + rbx
+  auto write = [&](QBDI::ExecBlockManager &m, const QBDI::LLVMCPUs &cpus) {
+    QBDI::Patch::Vec bb;
+    bb.push_back(getPatch(address,
+                          llvm::MCInstBuilder(llvm::X86::MOVAPSrr)
+                              .addReg(llvm::X86::XMM0)
+                              .addReg(llvm::X86::XMM1),
+                          cpus));
+    bb.push_back(getPatch(address + 3,
+                          llvm::MCInstBuilder(llvm::X86::ADD64rr)
+                              .addReg(llvm::X86::RAX)
+                              .addReg(llvm::X86::RAX)
+                              .addReg(llvm::X86::RBX),
+                          cpus));
+    m.writeBasicBlock(std::move(bb), 2);
+  };
+  write(manager, llvmcpus);
+  write(noFPRManager, noFPRcpus);
+
+  QBDI::ExecBlock *blocks[2] = {manager.getProgrammedExecBlock(address),
+                                noFPRManager.getProgrammedExecBlock(address)};
+  REQUIRE(blocks[0] != nullptr);
+  REQUIRE(blocks[1] != nullptr);
+  // each manager switches the contexts with its own trampolines
+  REQUIRE(blocks[0]->getContext() != blocks[1]->getContext());
+  CHECK(blocks[0]->getContext()->hostState.prologue !=
+        blocks[1]->getContext()->hostState.prologue);
+  CHECK(blocks[0]->getContext()->hostState.epilogue !=
+        blocks[1]->getContext()->hostState.epilogue);
+
+  QBDI::FPRState initial;
+  initFPR(initial);
+  for (unsigned int i = 0; i < 2; i++) {
+    QBDI::Context *context = blocks[i]->getContext();
+    initGPR(context->gprState, &stack[i][8]);
+    context->gprState.rbx = i + 1;
+    context->fprState = initial;
+  }
+
+  // the executions alternate between the two VMs
+  for (unsigned int n = 1; n <= 3; n++) {
+    for (unsigned int i = 0; i < 2; i++) {
+      INFO("Execution " << n << " of the ExecBlock " << i);
+      QBDI::Context *context = blocks[i]->getContext();
+      REQUIRE(manager.getProgrammedExecBlock(address) == blocks[0]);
+      REQUIRE(noFPRManager.getProgrammedExecBlock(address) == blocks[1]);
+      blocks[i]->execute();
+      CHECK(context->gprState.rax == 0x1111111111111111 + n * (i + 1));
+      CHECK(context->gprState.rip == address + 6);
+      CHECK(context->gprState.rsp ==
+            reinterpret_cast<QBDI::rword>(&stack[i][8]));
+      if (i == 0) {
+        CHECK(memcmp(context->fprState.xmm0, initial.xmm1, 16) == 0);
+      } else {
+        CHECK(memcmp(context->fprState.xmm0, initial.xmm0, 16) == 0);
+      }
+      CHECK(memcmp(context->fprState.xmm1, initial.xmm1, 15 * 16) == 0);
+    }
+  }
+}
@@ -0,0 +1,117 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <map>
+#include <memory>
+#include <catch2/catch.hpp>
+
+#include "Utility/AddressMap.h"
+
+TEST_CASE("AddressMapTest-InsertFind") {
+  QBDI::AddressMap<unsigned> map;
+
+  CHECK(map.empty());
+  CHECK(map.find(0x1000) == map.end());
+  CHECK(map.count(0x1000) == 0);
+
+  map[0x1000] = 1;
+  map[0x2000] = 2;
+  map[0x1000] += 2;
+
+  CHECK(map.size() == 2);
+  CHECK(map.count(0x1000) == 1);
+  CHECK(map.find(0x1000)->second == 3);
+  CHECK(map.find(0x2000)->second == 2);
+  CHECK(map.find(0x3000) == map.end());
+
+  map.clear();
+  CHECK(map.empty());
+  CHECK(map.find(0x1000) == map.end());
+}
+
+TEST_CASE("AddressMapTest-Grow") {
+  QBDI::AddressMap<QBDI::rword> map;
+  std::map<QBDI::rword, QBDI::rword> ref;
+
+  for (QBDI::rword i = 0; i < 10000; i++) {
+    QBDI::rword address = 0x400000 + (i * 7) % 4096 * 16;
+    map[address] += i;
+    ref[address] += i;
+  }
+  REQUIRE(map.size() == ref.size());
+
+  for (const auto &it : ref) {
+    const auto entry = map.find(it.first);
+    REQUIRE(entry != map.end());
+    CHECK(entry->second == it.second);
+  }
+
+  size_t count = 0;
+  for (const auto &it : map) {
+    REQUIRE(ref.count(it.first) == 1);
+    CHECK(ref[it.first] == it.second);
+    count++;
+  }
+  CHECK(count == ref.size());
+}
+
+TEST_CASE("AddressMapTest-MoveOnly") {
+  QBDI::AddressMap<std::unique_ptr<QBDI::rword>> map;
+
+  for (QBDI::rword i = 0; i < 100; i++) {
+    map[0x1000 + i * 4] = std::make_unique<QBDI::rword>(i);
+  }
+  REQUIRE(map.size() == 100);
+
+  for (QBDI::rword i = 0; i < 100; i++) {
+    const auto entry = map.find(0x1000 + i * 4);
+    REQUIRE(entry != map.end());
+    REQUIRE(entry->second != nullptr);
+    CHECK(*entry->second == i);
+  }
+}
+
+TEST_CASE("AddressMapTest-Erase") {
+  QBDI::AddressMap<QBDI::rword> map;
+  std::map<QBDI::rword, QBDI::rword> ref;
+
+  for (QBDI::rword i = 0; i < 2000; i++) {
+    QBDI::rword address = 0x400000 + i * 16;
+    map[address] = i;
+    ref[address] = i;
+  }
+  CHECK_FALSE(map.erase(0x1000));
+
+  // remove one address of three, the probe sequences must stay valid
+  for (QBDI::rword i = 0; i < 2000; i += 3) {
+    QBDI::rword address = 0x400000 + i * 16;
+    CHECK(map.erase(address));
+    ref.erase(address);
+  }
+  REQUIRE(map.size() == ref.size());
+
+  for (QBDI::rword i = 0; i < 2000; i++) {
+    QBDI::rword address = 0x400000 + i * 16;
+    const auto entry = map.find(address);
+    if (ref.count(address) == 0) {
+      CHECK(entry == map.end());
+    } else {
+      REQUIRE(entry != map.end());
+      CHECK(entry->second == ref[address]);
+    }
+  }
+}
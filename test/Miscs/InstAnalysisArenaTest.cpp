@@ -0,0 +1,63 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdint.h>
+#include <catch2/catch.hpp>
+
+#include "Utility/InstAnalysis_prive.h"
+
+TEST_CASE("InstAnalysisArenaTest-Allocate") {
+  QBDI::InstAnalysisArena arena;
+
+  char *c = arena.allocate<char>(3);
+  QBDI::InstAnalysis *ana = arena.allocate<QBDI::InstAnalysis>();
+  QBDI::OperandAnalysis *ops = arena.allocate<QBDI::OperandAnalysis>(8);
+
+  CHECK(reinterpret_cast<uintptr_t>(ana) % alignof(QBDI::InstAnalysis) == 0);
+  CHECK(reinterpret_cast<uintptr_t>(ops) % alignof(QBDI::OperandAnalysis) ==
+        0);
+  CHECK(static_cast<void *>(c + 3) <= static_cast<void *>(ana));
+  CHECK(static_cast<void *>(ana + 1) <= static_cast<void *>(ops));
+
+  // the memory is zeroed
+  CHECK(c[0] == 0);
+  CHECK(ana->mnemonic == nullptr);
+  CHECK(ana->operands == nullptr);
+  for (int i = 0; i < 8; i++) {
+    CHECK(ops[i].regName == nullptr);
+    CHECK(ops[i].value == 0);
+  }
+}
+
+TEST_CASE("InstAnalysisArenaTest-Large") {
+  QBDI::InstAnalysisArena arena;
+
+  uint8_t *small = arena.allocate<uint8_t>(16);
+  uint8_t *large = arena.allocate<uint8_t>(65536);
+  uint8_t *next = arena.allocate<uint8_t>(16);
+
+  large[0] = 1;
+  large[65535] = 1;
+  // the large buffer doesn't consume the current chunk
+  CHECK(next == small + 16);
+
+  for (int i = 0; i < 10000; i++) {
+    QBDI::InstAnalysis *ana = arena.allocate<QBDI::InstAnalysis>();
+    CHECK(ana->analysisType == 0);
+    ana->analysisType = QBDI::ANALYSIS_INSTRUCTION;
+  }
+}
@@ -0,0 +1,45 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <string>
+#include <vector>
+#include <catch2/catch.hpp>
+
+#include "Engine/LLVMCPU.h"
+#include "QBDI/Options.h"
+#include "QBDI/State.h"
+
+TEST_CASE("LLVMCPUTest-SharedTarget") {
+  QBDI::LLVMCPUs cpus1;
+  QBDI::LLVMCPUs cpus2("", {}, QBDI::Options::OPT_ATT_SYNTAX);
+  const QBDI::LLVMCPU &cpu1 = cpus1.getCPU(QBDI::CPUMode::DEFAULT);
+  const QBDI::LLVMCPU &cpu2 = cpus2.getCPU(QBDI::CPUMode::DEFAULT);
+
+  // the read-only components don't depend on the options
+  CHECK(&cpu1.getMCII() == &cpu2.getMCII());
+  CHECK(&cpu1.getMRI() == &cpu2.getMRI());
+  CHECK(&cpu1.getOpcodeAnalysis() == &cpu2.getOpcodeAnalysis());
+  CHECK(cpus1.isSameCPU(cpus2));
+  CHECK(cpu1.getOptions() != cpu2.getOptions());
+
+  // another CPU has its own components
+  std::string other = cpu1.getCPU() == "generic" ? "x86-64" : "generic";
+  QBDI::LLVMCPUs cpus3(other);
+  const QBDI::LLVMCPU &cpu3 = cpus3.getCPU(QBDI::CPUMode::DEFAULT);
+  CHECK(&cpu1.getMCII() != &cpu3.getMCII());
+  CHECK_FALSE(cpus1.isSameCPU(cpus3));
+}
@@ -0,0 +1,56 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <catch2/catch.hpp>
+
+#include "Utility/LogSys.h"
+
+TEST_CASE("LogLimiterTest-Burst") {
+  QBDI::LogLimiter limiter;
+  uint64_t suppressed = 0;
+  int64_t now = 10000;
+
+  for (uint32_t i = 0; i < QBDI::LogLimiter::BURST; i++) {
+    REQUIRE(limiter.allow(now, suppressed));
+    REQUIRE(suppressed == 0);
+  }
+  for (unsigned i = 0; i < 100; i++) {
+    REQUIRE_FALSE(limiter.allow(now + i, suppressed));
+  }
+
+  // the next window reports the suppressed messages once
+  now += QBDI::LogLimiter::WINDOW_MS;
+  REQUIRE(limiter.allow(now, suppressed));
+  CHECK(suppressed == 100);
+  REQUIRE(limiter.allow(now, suppressed));
+  CHECK(suppressed == 0);
+}
+
+TEST_CASE("LogLimiterTest-Macro") {
+  QBDI::setLogPriority(QBDI::LogPriority::DISABLE);
+  // a disabled message isn't counted nor formatted
+  unsigned formatted = 0;
+  auto arg = [&formatted]() {
+    formatted++;
+    return 0;
+  };
+  for (unsigned i = 0; i < 100; i++) {
+    QBDI_WARN("Test message {}", arg());
+  }
+  CHECK(formatted == 0);
+  QBDI::setLogPriority(QBDI::LogPriority::INFO);
+}
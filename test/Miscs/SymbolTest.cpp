@@ -0,0 +1,52 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdint.h>
+#include <string.h>
+#include <catch2/catch.hpp>
+
+#include "QBDI/Config.h"
+#include "QBDI/Platform.h"
+#include "Utility/Symbol.h"
+
+extern "C" QBDI_NOINLINE int qbdiSymbolTestFunction(int a) {
+  return a * 3 + 1;
+}
+
+TEST_CASE("SymbolTest-FindSymbol") {
+  const char *symbol = nullptr;
+  const char *module = nullptr;
+  uint32_t symbolOffset = 0;
+
+  QBDI::rword addr = reinterpret_cast<QBDI::rword>(qbdiSymbolTestFunction);
+  QBDI::findSymbol(addr + 1, symbol, symbolOffset, module);
+
+#if defined(QBDI_PLATFORM_LINUX) || defined(QBDI_PLATFORM_ANDROID)
+  REQUIRE(symbol != nullptr);
+  CHECK(strcmp(symbol, "qbdiSymbolTestFunction") == 0);
+  CHECK(symbolOffset == 1);
+  CHECK(module != nullptr);
+
+  // the index is reused
+  const char *symbol2 = nullptr;
+  const char *module2 = nullptr;
+  QBDI::findSymbol(addr, symbol2, symbolOffset, module2);
+  CHECK(symbol2 == symbol);
+  CHECK(module2 == module);
+  CHECK(symbolOffset == 0);
+#endif
+}
@@ -0,0 +1,91 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <catch2/catch.hpp>
+
+#include "X86InstrInfo.h"
+#include "llvm/MC/MCInst.h"
+#include "llvm/MC/MCInstBuilder.h"
+
+#include "Engine/LLVMCPU.h"
+#include "Patch/Register.h"
+
+namespace {
+
+llvm::MCInst memInst(unsigned opcode) {
+  return llvm::MCInstBuilder(opcode)
+      .addReg(llvm::X86::RDI)
+      .addImm(1)
+      .addReg(0)
+      .addImm(0)
+      .addReg(0);
+}
+
+bool overwriteFlags(const QBDI::LLVMCPU &llvmcpu, const llvm::MCInst &inst) {
+  uint32_t gpr = 0;
+  bool flags = false;
+  REQUIRE(QBDI::getOverwrittenRegisters(inst, llvmcpu, gpr, flags));
+  return flags;
+}
+
+} // namespace
+
+TEST_CASE("Liveness_X86_64-Flags") {
+  QBDI::LLVMCPUs llvmcpus;
+  const QBDI::LLVMCPU &llvmcpu = llvmcpus.getCPU(QBDI::CPUMode::DEFAULT);
+  using namespace llvm::X86;
+
+  // the reference, ADD writes all the flags
+  CHECK(overwriteFlags(llvmcpu, llvm::MCInstBuilder(ADD32rr)
+                                    .addReg(EAX)
+                                    .addReg(EAX)
+                                    .addReg(ECX)));
+  CHECK(overwriteFlags(llvmcpu, llvm::MCInstBuilder(ADC64rr)
+                                    .addReg(RAX)
+                                    .addReg(RAX)
+                                    .addReg(RCX)));
+
+  // ADCX only writes CF, ADOX only OF
+  for (unsigned opcode : {ADCX32rr, ADOX32rr}) {
+    CHECK_FALSE(overwriteFlags(
+        llvmcpu,
+        llvm::MCInstBuilder(opcode).addReg(EAX).addReg(EAX).addReg(ECX)));
+  }
+  for (unsigned opcode : {ADCX64rr, ADOX64rr}) {
+    CHECK_FALSE(overwriteFlags(
+        llvmcpu,
+        llvm::MCInstBuilder(opcode).addReg(RAX).addReg(RAX).addReg(RCX)));
+  }
+  for (unsigned opcode : {ADCX32rm, ADOX32rm}) {
+    llvm::MCInst inst = llvm::MCInstBuilder(opcode).addReg(EAX).addReg(EAX);
+    for (const llvm::MCOperand &op : memInst(opcode)) {
+      inst.addOperand(op);
+    }
+    CHECK_FALSE(overwriteFlags(llvmcpu, inst));
+  }
+  for (unsigned opcode : {ADCX64rm, ADOX64rm}) {
+    llvm::MCInst inst = llvm::MCInstBuilder(opcode).addReg(RAX).addReg(RAX);
+    for (const llvm::MCOperand &op : memInst(opcode)) {
+      inst.addOperand(op);
+    }
+    CHECK_FALSE(overwriteFlags(llvmcpu, inst));
+  }
+
+  // CMPXCHG8B and CMPXCHG16B only write ZF
+  CHECK_FALSE(overwriteFlags(llvmcpu, memInst(CMPXCHG8B)));
+  CHECK_FALSE(overwriteFlags(llvmcpu, memInst(CMPXCHG16B)));
+}
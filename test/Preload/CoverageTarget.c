@@ -0,0 +1,38 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <signal.h>
+
+// Target of the coverage tests: the process exits with 0, or is killed by
+// SIGTERM when it has an argument.
+
+__attribute__((noinline)) static int collatz(unsigned n) {
+  int steps = 0;
+  while (n != 1) {
+    n = (n % 2 == 0) ? n / 2 : 3 * n + 1;
+    steps++;
+  }
+  return steps;
+}
+
+int main(int argc, char **argv) {
+  int steps = collatz(27);
+  if (argc > 1) {
+    raise(SIGTERM);
+  }
+  return steps == 111 ? 0 : 1;
+}
@@ -0,0 +1,150 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <fstream>
+#include <iterator>
+#include <signal.h>
+#include <sstream>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+#include <catch2/catch.hpp>
+
+namespace {
+
+struct DrcovModule {
+  uint64_t base;
+  uint64_t end;
+  std::string path;
+};
+
+struct DrcovBlock {
+  uint32_t start;
+  uint16_t size;
+  uint16_t id;
+};
+
+// Run the target under the coverage tool and return its wait status
+int runCoverage(const std::string &output, bool killed) {
+  pid_t pid = fork();
+  REQUIRE(pid >= 0);
+  if (pid == 0) {
+    const char *target = QBDI_TEST_COVERAGE_TARGET;
+    const char *name = strrchr(target, '/');
+    setenv("LD_PRELOAD", QBDI_TEST_COVERAGE_LIBRARY, 1);
+    setenv("QBDIPRELOAD_MODULES", name != nullptr ? name + 1 : target, 1);
+    setenv("QBDI_COVERAGE_OUTPUT", output.c_str(), 1);
+    if (killed) {
+      execl(target, target, "kill", nullptr);
+    } else {
+      execl(target, target, nullptr);
+    }
+    _exit(127);
+  }
+  int status = 0;
+  REQUIRE(waitpid(pid, &status, 0) == pid);
+  return status;
+}
+
+// Parse the drcov file and check the blocks of the target
+void checkCoverage(const std::string &path) {
+  std::ifstream file(path, std::ios::binary);
+  REQUIRE(file.is_open());
+  std::string line;
+  REQUIRE(std::getline(file, line));
+  CHECK(line == "DRCOV VERSION: 2");
+  REQUIRE(std::getline(file, line));
+  CHECK(line == "DRCOV FLAVOR: drcov");
+
+  size_t moduleCount = 0;
+  REQUIRE(std::getline(file, line));
+  REQUIRE(sscanf(line.c_str(), "Module Table: version 2, count %zu",
+                 &moduleCount) == 1);
+  REQUIRE(std::getline(file, line));
+  CHECK(line == "Columns: id, base, end, entry, path");
+  std::vector<DrcovModule> modules;
+  for (size_t i = 0; i < moduleCount; i++) {
+    REQUIRE(std::getline(file, line));
+    size_t id = 0;
+    unsigned long long base = 0, end = 0, entry = 0;
+    int pathOffset = 0;
+    REQUIRE(sscanf(line.c_str(), "%zu, 0x%llx, 0x%llx, 0x%llx, %n", &id, &base,
+                   &end, &entry, &pathOffset) == 4);
+    CHECK(id == i);
+    CHECK(base < end);
+    modules.push_back({base, end, line.substr(pathOffset)});
+  }
+
+  size_t blockCount = 0;
+  REQUIRE(std::getline(file, line));
+  REQUIRE(sscanf(line.c_str(), "BB Table: %zu bbs", &blockCount) == 1);
+  std::string table{std::istreambuf_iterator<char>(file),
+                    std::istreambuf_iterator<char>()};
+  REQUIRE(table.size() == blockCount * sizeof(DrcovBlock));
+
+  // only the target is instrumented, its blocks are in its module
+  const char *target = QBDI_TEST_COVERAGE_TARGET;
+  const char *name = strrchr(target, '/');
+  name = (name != nullptr) ? name + 1 : target;
+  size_t targetBlocks = 0;
+  for (size_t i = 0; i < blockCount; i++) {
+    DrcovBlock block;
+    memcpy(&block, table.data() + i * sizeof(DrcovBlock), sizeof(block));
+    REQUIRE(block.id < modules.size());
+    const DrcovModule &module = modules[block.id];
+    CHECK(block.size > 0);
+    CHECK(module.base + block.start + block.size <= module.end);
+    const std::string &path = module.path;
+    if (path.size() >= strlen(name) and
+        path.compare(path.size() - strlen(name), std::string::npos, name) ==
+            0) {
+      targetBlocks++;
+    }
+  }
+  CHECK(targetBlocks > 0);
+  CHECK(targetBlocks == blockCount);
+}
+
+} // namespace
+
+// The coverage is written by the exit of the target
+TEST_CASE("CoverageTest-Exit") {
+  std::string output =
+      "/tmp/QBDITestCoverage." + std::to_string(getpid()) + ".log";
+  int status = runCoverage(output, false);
+  REQUIRE(WIFEXITED(status));
+  CHECK(WEXITSTATUS(status) == 0);
+  checkCoverage(output);
+  unlink(output.c_str());
+}
+
+// The coverage is written by the signal handler, then the target is killed
+// by the signal
+TEST_CASE("CoverageTest-Signal") {
+  std::string output =
+      "/tmp/QBDITestCoverageSignal." + std::to_string(getpid()) + ".log";
+  int status = runCoverage(output, true);
+  REQUIRE(WIFSIGNALED(status));
+  CHECK(WTERMSIG(status) == SIGTERM);
+  checkCoverage(output);
+  unlink(output.c_str());
+}
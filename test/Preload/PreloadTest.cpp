@@ -0,0 +1,63 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <catch2/catch.hpp>
+
+// A thread of the target ends with pthread_exit in the middle of its start
+// routine, in the VM of the thread. The VM must stop and be destroyed before
+// the thread exits with the value of pthread_exit.
+TEST_CASE("PreloadTest-ThreadExit") {
+  int fds[2];
+  REQUIRE(pipe(fds) == 0);
+  pid_t pid = fork();
+  REQUIRE(pid >= 0);
+  if (pid == 0) {
+    close(fds[0]);
+    setenv("LD_PRELOAD", QBDI_TEST_PRELOAD_LIBRARY, 1);
+    setenv("QBDI_TEST_PRELOAD_FD", std::to_string(fds[1]).c_str(), 1);
+    execl(QBDI_TEST_THREAD_EXIT, QBDI_TEST_THREAD_EXIT, nullptr);
+    _exit(127);
+  }
+  close(fds[1]);
+  uint64_t result[2] = {0, 0};
+  size_t received = 0;
+  while (received < sizeof(result)) {
+    ssize_t r = read(fds[0], reinterpret_cast<uint8_t *>(result) + received,
+                     sizeof(result) - received);
+    if (r <= 0) {
+      break;
+    }
+    received += r;
+  }
+  close(fds[0]);
+  int status = 0;
+  REQUIRE(waitpid(pid, &status, 0) == pid);
+
+  // the thread has been joined with the value of pthread_exit
+  REQUIRE(WIFEXITED(status));
+  CHECK(WEXITSTATUS(status) == 0);
+  // qbdipreload_on_thread_exit has received the value, the routine ran in
+  // the VM of the thread
+  REQUIRE(received == sizeof(result));
+  CHECK(result[0] == 55);
+  CHECK(result[1] > 0);
+}
@@ -0,0 +1,81 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "QBDIPreload.h"
+
+// Preload library of the thread test. The threads are run in their VM, the
+// return value of each thread and the number of instructions it executed in
+// its VM are written in the file descriptor of QBDI_TEST_PRELOAD_FD.
+
+static int resultFd = -1;
+static thread_local uint64_t threadInstCount = 0;
+
+static QBDI::VMAction countInstruction(QBDI::VMInstanceRef vm,
+                                       QBDI::GPRState *gprState,
+                                       QBDI::FPRState *fprState, void *data) {
+  threadInstCount++;
+  return QBDI::CONTINUE;
+}
+
+extern "C" {
+
+QBDIPRELOAD_INIT;
+
+int qbdipreload_on_start(void *main) {
+  const char *fd = getenv("QBDI_TEST_PRELOAD_FD");
+  if (fd != nullptr) {
+    resultFd = atoi(fd);
+  }
+  QBDI::qbdipreload_hook_threads();
+  return QBDIPRELOAD_NOT_HANDLED;
+}
+
+int qbdipreload_on_premain(void *gprCtx, void *fpuCtx) {
+  return QBDIPRELOAD_NOT_HANDLED;
+}
+
+int qbdipreload_on_main(int argc, char **argv) {
+  return QBDIPRELOAD_NOT_HANDLED;
+}
+
+int qbdipreload_on_run(QBDI::VMInstanceRef vm, QBDI::rword start,
+                       QBDI::rword stop) {
+  vm->run(start, stop);
+  return QBDIPRELOAD_NO_ERROR;
+}
+
+int qbdipreload_on_thread_start(QBDI::VMInstanceRef vm, QBDI::rword start,
+                                QBDI::rword arg) {
+  vm->addCodeCB(QBDI::PREINST, countInstruction, nullptr);
+  return QBDIPRELOAD_NO_ERROR;
+}
+
+int qbdipreload_on_thread_exit(QBDI::VMInstanceRef vm, QBDI::rword retval) {
+  uint64_t result[2] = {static_cast<uint64_t>(retval), threadInstCount};
+  if (resultFd >= 0 and write(resultFd, result, sizeof(result)) !=
+                            static_cast<ssize_t>(sizeof(result))) {
+    resultFd = -1;
+  }
+  return QBDIPRELOAD_NO_ERROR;
+}
+
+int qbdipreload_on_exit(int status) { return QBDIPRELOAD_NO_ERROR; }
+}
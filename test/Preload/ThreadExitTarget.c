@@ -0,0 +1,54 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <pthread.h>
+#include <stdint.h>
+
+// Target of the preload test: a thread ends with pthread_exit in the middle
+// of its start routine. The exit status is 0 if the thread was joined with
+// the value of pthread_exit and the end of the routine was skipped.
+
+static volatile int afterExit = 0;
+
+__attribute__((noinline)) static void stopThread(intptr_t value) {
+  if (value > 0) {
+    pthread_exit((void *)value);
+  }
+  afterExit = 1;
+}
+
+static void *threadRoutine(void *arg) {
+  volatile intptr_t acc = (intptr_t)arg;
+  for (intptr_t i = 0; i < 10; i++) {
+    acc = acc + i;
+  }
+  stopThread(acc);
+  afterExit = 1;
+  return NULL;
+}
+
+int main() {
+  pthread_t thread;
+  if (pthread_create(&thread, NULL, threadRoutine, (void *)10) != 0) {
+    return 2;
+  }
+  void *retval = NULL;
+  if (pthread_join(thread, &retval) != 0) {
+    return 3;
+  }
+  return (retval == (void *)55 && afterExit == 0) ? 0 : 1;
+}
@@ -72,6 +72,39 @@ void qbdipreload_floatCtxToFPRState(const void *fprCtx, FPRState *fprState);
  */
 int qbdipreload_hook_main(void *main);
 
+/** Enable QBDIPreload hook on the threads created with `pthread_create`
+ * (Linux only). The start routine of each new thread is run in its own VM,
+ * with the options of the VM of the main thread.
+ *
+ * A call to `pthread_exit` by the instrumented code stops the VM of the
+ * thread, which exits once its VM is destroyed.
+ *
+ * @warning `qbdipreload_on_thread_start` must be defined to use this API. The
+ * cleanup handlers pushed by an instrumented thread aren't called when it ends
+ * with `pthread_exit`, and the thread must not call `pthread_exit` from a
+ * native function.
+ *
+ * @return int     QBDIPreload state
+ */
+int qbdipreload_hook_threads();
+
+/** Start a fork server with the protocol of AFL (Linux only). It is called at
+ * a chosen point of the execution, for instance in a callback of the VM once
+ * the translation cache is warmed up. For each request read on `controlFd`,
+ * the process is forked and the child returns from this function with the
+ * translation cache of its VMs. The parent writes the pid and the wait status
+ * of each child on `statusFd`, and exits when `controlFd` is closed.
+ *
+ * @warning Only the calling thread exists in the children.
+ *
+ * @param[in] controlFd  File descriptor of the requests (198 for AFL)
+ * @param[in] statusFd   File descriptor of the status (199 for AFL)
+ *
+ * @return int     QBDIPRELOAD_NO_ERROR in a child, QBDIPRELOAD_NOT_HANDLED if
+ *                 no fork server client listens on `statusFd`
+ */
+int qbdipreload_fork_server(int controlFd, int statusFd);
+
 /*
  * QBDIPreload callbacks
  *
@@ -127,6 +160,33 @@ extern int qbdipreload_on_run(VMInstanceRef vm, rword start, rword stop);
  */
 extern int qbdipreload_on_exit(int status);
 
+/*
+ * QBDIPreload thread callbacks
+ *
+ * The following functions are only needed with `qbdipreload_hook_threads`.
+ */
+
+/*! Function called in a new thread, before its start routine is run in the
+ * VM of the thread. The VM instruments the same modules as the VM of the main
+ * thread, the callbacks of the thread can be added on it.
+ * @param[in]  vm     VM instance of the thread.
+ * @param[in]  start  Address of the start routine.
+ * @param[in]  arg    Argument of the start routine.
+ * @return     int    QBDIPreload state, the thread runs natively if it isn't
+ *                    QBDIPRELOAD_NO_ERROR or QBDIPRELOAD_NOT_HANDLED
+ */
+extern int qbdipreload_on_thread_start(VMInstanceRef vm, rword start,
+                                       rword arg) __attribute__((weak));
+
+/*! Function called when an instrumented thread ends (return of the start
+ * routine or `pthread_exit`), before its VM is destroyed.
+ * @param[in]  vm      VM instance of the thread.
+ * @param[in]  retval  Return value of the thread.
+ * @return     int     QBDIPreload state
+ */
+extern int qbdipreload_on_thread_exit(VMInstanceRef vm, rword retval)
+    __attribute__((weak));
+
 /*
  * Private API
  */
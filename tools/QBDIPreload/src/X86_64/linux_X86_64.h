@@ -36,6 +36,11 @@ static inline rword getReturnAddress(GPRState *gprState) {
   return *((rword *)QBDI_GPR_GET(gprState, REG_SP));
 }
 
+// first argument of a call, at the entry of the callee
+static inline rword getFirstArgument(GPRState *gprState) {
+  return gprState->rdi;
+}
+
 static inline void fix_ucontext_t(ucontext_t *uap) {
   uap->uc_mcontext.gregs[REG_RIP] -= 1;
 }
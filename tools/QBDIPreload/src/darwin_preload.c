@@ -405,6 +405,16 @@ int qbdipreload_hook_main(void *main) {
   return QBDIPRELOAD_NO_ERROR;
 }
 
+int qbdipreload_hook_threads() {
+  // not supported on macOS
+  return QBDIPRELOAD_ERR_STARTUP_FAILED;
+}
+
+int qbdipreload_fork_server(int controlFd, int statusFd) {
+  // not supported on macOS
+  return QBDIPRELOAD_ERR_STARTUP_FAILED;
+}
+
 QBDI_FORCE_EXPORT void intercept_exit(int status) {
   if (!HAS_EXITED && HAS_PRELOAD) {
     HAS_EXITED = true;
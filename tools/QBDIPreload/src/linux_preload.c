@@ -18,6 +18,8 @@
 #include "QBDIPreload.h"
 
 #include <dlfcn.h>
+#include <errno.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <string.h>
@@ -44,9 +46,24 @@ static const size_t STACK_SIZE = 8388608;
 static bool HAS_EXITED = false;
 static bool HAS_PRELOAD = false;
 static bool DEFAULT_HANDLER = false;
+static bool HOOK_THREADS = false;
+static VMInstanceRef MAIN_VM = NULL;
 GPRState ENTRY_GPR;
 FPRState ENTRY_FPR;
 
+struct ThreadStart {
+  void *(*routine)(void *);
+  void *arg;
+};
+
+// State of a thread running in its VM, set by the hooks of pthread_exit
+struct ThreadVM {
+  bool exited;
+  void *retval;
+};
+
+typedef void (*pthread_exit_fn)(void *);
+
 static struct {
   void *address;
   long value;
@@ -73,6 +90,42 @@ void unsetEntryBreakpoint() {
   mprotect((void *)base, pageSize, PROT_READ | PROT_EXEC);
 }
 
+void catchEntrypoint(int argc, char **argv);
+
+// Instrument the modules of QBDIPRELOAD_MODULES (separated by ':') instead
+// of all the executable maps
+static void instrumentPreloadModules(VMInstanceRef vm) {
+  const char *names = getenv("QBDIPRELOAD_MODULES");
+  if (names == NULL) {
+    qbdi_instrumentAllExecutableMaps(vm);
+    return;
+  }
+  char *list = strdup(names);
+  char *saveptr = NULL;
+  for (char *name = strtok_r(list, ":", &saveptr); name != NULL;
+       name = strtok_r(NULL, ":", &saveptr)) {
+    if (!qbdi_addInstrumentedModule(vm, name)) {
+      fprintf(stderr, "QBDIPreload: module %s not found\n", name);
+    }
+  }
+  free(list);
+}
+
+static void initPreloadVM(VMInstanceRef *vm, Options options) {
+  qbdi_initVM(vm, NULL, NULL, options);
+  instrumentPreloadModules(*vm);
+
+  // the maps have just been read by the instrumentation
+  size_t size = 0;
+  qbdi_MemoryMap *modules = qbdi_getCachedProcessMaps(false, &size);
+
+  // Filter some modules to avoid conflicts
+  qbdi_removeInstrumentedModuleFromAddr(*vm, (rword)&catchEntrypoint);
+  removeConflictModule(*vm, modules, size);
+
+  qbdi_freeMemoryMapArray(modules, size);
+}
+
 void catchEntrypoint(int argc, char **argv) {
   int status = QBDIPRELOAD_NOT_HANDLED;
 
@@ -82,17 +135,9 @@ void catchEntrypoint(int argc, char **argv) {
 
   if (DEFAULT_HANDLER && (status == QBDIPRELOAD_NOT_HANDLED)) {
     VMInstanceRef vm;
-    qbdi_initVM(&vm, NULL, NULL, 0);
-    qbdi_instrumentAllExecutableMaps(vm);
-
-    size_t size = 0;
-    qbdi_MemoryMap *modules = qbdi_getCurrentProcessMaps(false, &size);
-
-    // Filter some modules to avoid conflicts
-    qbdi_removeInstrumentedModuleFromAddr(vm, (rword)&catchEntrypoint);
-    removeConflictModule(vm, modules, size);
-
-    qbdi_freeMemoryMapArray(modules, size);
+    initPreloadVM(&vm, QBDI_NO_OPT);
+    // the VMs of the threads use the options of this VM
+    MAIN_VM = vm;
 
     // Set original states
     qbdi_setGPRState(vm, &ENTRY_GPR);
@@ -150,9 +195,141 @@ int qbdipreload_hook_main(void *main) {
   return QBDIPRELOAD_NO_ERROR;
 }
 
+static VMAction onPthreadExit(VMInstanceRef vm, GPRState *gprState,
+                              FPRState *fprState, void *data) {
+  struct ThreadVM *thread = (struct ThreadVM *)data;
+  thread->exited = true;
+  thread->retval = (void *)getFirstArgument(gprState);
+  return QBDI_STOP;
+}
+
+static VMAction onPthreadExitTransfer(VMInstanceRef vm, const VMState *vmState,
+                                      GPRState *gprState, FPRState *fprState,
+                                      void *data) {
+  return onPthreadExit(vm, gprState, fprState, data);
+}
+
+static void *threadTrampoline(void *data) {
+  struct ThreadStart start = *(struct ThreadStart *)data;
+  free(data);
+
+  VMInstanceRef vm;
+  initPreloadVM(&vm, MAIN_VM != NULL ? qbdi_getOptions(MAIN_VM) : QBDI_NO_OPT);
+
+  int status = qbdipreload_on_thread_start(vm, (rword)start.routine,
+                                           (rword)start.arg);
+  uint8_t *stack = NULL;
+  if (status != QBDIPRELOAD_NO_ERROR && status != QBDIPRELOAD_NOT_HANDLED) {
+    // the thread isn't instrumented
+    qbdi_terminateVM(vm);
+    return start.routine(start.arg);
+  }
+  if (!qbdi_allocateVirtualStack(qbdi_getGPRState(vm), STACK_SIZE, &stack)) {
+    fprintf(stderr, "Could not allocate the stack of the thread ...\n");
+    qbdi_terminateVM(vm);
+    return start.routine(start.arg);
+  }
+
+  // the instrumented code cannot be unwound: a call to pthread_exit stops
+  // the VM, the thread exits once the VM is destroyed
+  struct ThreadVM thread;
+  thread.exited = false;
+  thread.retval = NULL;
+  pthread_exit_fn o_pthread_exit =
+      (pthread_exit_fn)dlsym(RTLD_DEFAULT, "pthread_exit");
+  qbdi_addTransferHook(vm, (rword)o_pthread_exit, onPthreadExitTransfer, NULL,
+                       &thread);
+  // pthread_exit is instrumented if the libc is in QBDIPRELOAD_MODULES
+  qbdi_addCodeAddrCB(vm, (rword)o_pthread_exit, QBDI_PREINST, onPthreadExit,
+                     &thread, QBDI_PRIORITY_DEFAULT);
+
+  rword retval = 0;
+  qbdi_call(vm, &retval, (rword)start.routine, 1, (rword)start.arg);
+  if (!thread.exited) {
+    thread.retval = (void *)retval;
+  }
+
+  if (qbdipreload_on_thread_exit != NULL) {
+    qbdipreload_on_thread_exit(vm, (rword)thread.retval);
+  }
+  qbdi_terminateVM(vm);
+  qbdi_alignedFree(stack);
+  if (thread.exited) {
+    o_pthread_exit(thread.retval);
+  }
+  return thread.retval;
+}
+
+int qbdipreload_hook_threads() {
+  if (qbdipreload_on_thread_start == NULL) {
+    return QBDIPRELOAD_ERR_STARTUP_FAILED;
+  }
+  HOOK_THREADS = true;
+  return QBDIPRELOAD_NO_ERROR;
+}
+
+int qbdipreload_fork_server(int controlFd, int statusFd) {
+  uint32_t msg = 0;
+  // hello message, the process isn't run by a fork server client if it fails
+  if (write(statusFd, &msg, sizeof(msg)) != sizeof(msg)) {
+    return QBDIPRELOAD_NOT_HANDLED;
+  }
+  while (read(controlFd, &msg, sizeof(msg)) == sizeof(msg)) {
+    pid_t pid = fork();
+    if (pid < 0) {
+      break;
+    }
+    if (pid == 0) {
+      close(controlFd);
+      close(statusFd);
+      return QBDIPRELOAD_NO_ERROR;
+    }
+    int status = 0;
+    if (write(statusFd, &pid, sizeof(pid)) != sizeof(pid) ||
+        waitpid(pid, &status, 0) < 0 ||
+        write(statusFd, &status, sizeof(status)) != sizeof(status)) {
+      break;
+    }
+  }
+  // the client has stopped, the parent exits without calling the exit hooks
+  ((void (*)(int))dlsym(RTLD_NEXT, "_exit"))(0);
+  __builtin_unreachable();
+}
+
+typedef int (*pthread_create_fn)(pthread_t *, const pthread_attr_t *,
+                                 void *(*)(void *), void *);
+
+QBDI_FORCE_EXPORT int pthread_create(pthread_t *thread,
+                                     const pthread_attr_t *attr,
+                                     void *(*routine)(void *), void *arg) {
+  pthread_create_fn o_pthread_create =
+      (pthread_create_fn)dlsym(RTLD_NEXT, "pthread_create");
+
+  if (!HOOK_THREADS) {
+    return o_pthread_create(thread, attr, routine, arg);
+  }
+  struct ThreadStart *start = malloc(sizeof(struct ThreadStart));
+  if (start == NULL) {
+    return EAGAIN;
+  }
+  start->routine = routine;
+  start->arg = arg;
+  int ret = o_pthread_create(thread, attr, threadTrampoline, start);
+  if (ret != 0) {
+    free(start);
+  }
+  return ret;
+}
+
+// exit may be called by several threads, only the first one calls
+// qbdipreload_on_exit
+static bool firstExit() {
+  return HAS_PRELOAD && !__atomic_exchange_n(&HAS_EXITED, true,
+                                             __ATOMIC_SEQ_CST);
+}
+
 QBDI_FORCE_EXPORT void exit(int status) {
-  if (!HAS_EXITED && HAS_PRELOAD) {
-    HAS_EXITED = true;
+  if (firstExit()) {
     qbdipreload_on_exit(status);
   }
   ((void (*)(int))dlsym(RTLD_NEXT, "exit"))(status);
@@ -160,8 +337,7 @@ QBDI_FORCE_EXPORT void exit(int status) {
 }
 
 QBDI_FORCE_EXPORT void _exit(int status) {
-  if (!HAS_EXITED && HAS_PRELOAD) {
-    HAS_EXITED = true;
+  if (firstExit()) {
     qbdipreload_on_exit(status);
   }
   ((void (*)(int))dlsym(RTLD_NEXT, "_exit"))(status);
@@ -0,0 +1,377 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+#include <atomic>
+#include <fcntl.h>
+#include <mutex>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#include "QBDI.h"
+#include "QBDIPreload.h"
+
+// Coverage of the instrumented modules in the drcov format.
+//
+// The basic blocks are recorded when they are translated (BASIC_BLOCK_NEW):
+// the instrumented code runs without callback once it is in the cache. The
+// coverage is written at the exit of the process or on SIGINT, SIGTERM and
+// SIGHUP.
+//
+// The signal handler may interrupt the recording of a block, it only reads
+// the published entries of the tables and writes the file with open and
+// write, without lock nor allocation.
+//
+// Environment variables:
+// - QBDIPRELOAD_MODULES: the modules to instrument, separated by ':' (all the
+//   executable maps by default).
+// - QBDI_COVERAGE_OUTPUT: the path of the coverage file, '%p' is replaced by
+//   the pid of the process (drcov.%p.log by default).
+
+namespace {
+
+// Entry of the BB table of drcov
+struct DrcovBlock {
+  uint32_t start;
+  uint16_t size;
+  uint16_t id;
+};
+
+static_assert(sizeof(DrcovBlock) == 8, "Unexpected size of a drcov block");
+
+struct CoverageModule {
+  std::string name;
+  QBDI::Range<QBDI::rword> range{0, 0};
+  bool executable;
+};
+
+// Append only array, readable by a signal handler. An entry is written
+// before it is published by the count, the chunks are never moved nor freed.
+// The writers are serialized by blocksLock.
+template <typename T>
+class PublishedArray {
+  static constexpr size_t CHUNK_SIZE = 1024;
+  static constexpr size_t MAX_CHUNKS = 4096;
+
+  T *chunks[MAX_CHUNKS] = {};
+  std::atomic<size_t> count{0};
+
+public:
+  bool push(const T &value) {
+    size_t i = count.load(std::memory_order_relaxed);
+    if (i / CHUNK_SIZE >= MAX_CHUNKS) {
+      return false;
+    }
+    if (chunks[i / CHUNK_SIZE] == nullptr) {
+      chunks[i / CHUNK_SIZE] = new T[CHUNK_SIZE];
+    }
+    chunks[i / CHUNK_SIZE][i % CHUNK_SIZE] = value;
+    count.store(i + 1, std::memory_order_release);
+    return true;
+  }
+
+  size_t size() const { return count.load(std::memory_order_acquire); }
+
+  const T &operator[](size_t i) const {
+    return chunks[i / CHUNK_SIZE][i % CHUNK_SIZE];
+  }
+};
+
+std::mutex blocksLock;
+// start of the recorded basic blocks to their size
+std::unordered_map<QBDI::rword, uint16_t> blocks;
+// the modules in the order of their ids, and the BB table
+PublishedArray<CoverageModule> modules;
+PublishedArray<DrcovBlock> table;
+// the output path, around the '%p' of QBDI_COVERAGE_OUTPUT
+std::string outputPrefix;
+std::string outputSuffix;
+bool outputPid = false;
+std::atomic_flag written = ATOMIC_FLAG_INIT;
+
+const int coverageSignals[] = {SIGINT, SIGTERM, SIGHUP};
+
+// The executable modules with a path
+std::vector<CoverageModule> getModules() {
+  std::vector<CoverageModule> res;
+  for (const QBDI::MemoryMap &map : QBDI::getCurrentProcessMaps(true)) {
+    if (map.name.find('/') == std::string::npos) {
+      continue;
+    }
+    auto it = std::find_if(
+        res.begin(), res.end(),
+        [&map](const CoverageModule &m) { return m.name == map.name; });
+    bool executable = (map.permission & QBDI::PF_EXEC) != 0;
+    if (it == res.end()) {
+      res.push_back({map.name, map.range, executable});
+    } else {
+      it->range = QBDI::Range<QBDI::rword>(
+          std::min(it->range.start(), map.range.start()),
+          std::max(it->range.end(), map.range.end()));
+      it->executable = it->executable or executable;
+    }
+  }
+  res.erase(std::remove_if(res.begin(), res.end(),
+                           [](const CoverageModule &m) {
+                             return not m.executable;
+                           }),
+            res.end());
+  return res;
+}
+
+// Get the id of the module of an address, -1 if it isn't in a module. The
+// modules loaded since the last lookup are added to the table.
+int findModule(QBDI::rword address) {
+  for (int pass = 0; pass < 2; pass++) {
+    for (size_t id = 0; id < modules.size(); id++) {
+      if (modules[id].range.contains(address)) {
+        return static_cast<int>(id);
+      }
+    }
+    if (pass != 0) {
+      break;
+    }
+    for (const CoverageModule &m : getModules()) {
+      bool known = false;
+      for (size_t id = 0; id < modules.size() and not known; id++) {
+        known = modules[id].name == m.name and
+                modules[id].range.start() == m.range.start();
+      }
+      if (not known and not modules.push(m)) {
+        break;
+      }
+    }
+  }
+  return -1;
+}
+
+QBDI::VMAction onNewBlock(QBDI::VMInstanceRef vm,
+                          const QBDI::VMState *vmState,
+                          QBDI::GPRState *gprState, QBDI::FPRState *fprState,
+                          void *data) {
+  QBDI::rword start = vmState->basicBlockStart;
+  uint16_t size = std::min<QBDI::rword>(
+      vmState->basicBlockEnd - vmState->basicBlockStart, 0xffff);
+  std::lock_guard<std::mutex> guard(blocksLock);
+  auto it = blocks.find(start);
+  if (it != blocks.end() and it->second >= size) {
+    return QBDI::VMAction::CONTINUE;
+  }
+  blocks[start] = size;
+  // a block translated again with a larger size is recorded twice, the
+  // readers of drcov merge the entries
+  int id = findModule(start);
+  if (id >= 0) {
+    table.push({static_cast<uint32_t>(start - modules[id].range.start()),
+                size, static_cast<uint16_t>(id)});
+  }
+  return QBDI::VMAction::CONTINUE;
+}
+
+void setOutputPath() {
+  const char *env = getenv("QBDI_COVERAGE_OUTPUT");
+  outputPrefix = (env != nullptr) ? env : "drcov.%p.log";
+  size_t pos = outputPrefix.find("%p");
+  if (pos != std::string::npos) {
+    outputSuffix = outputPrefix.substr(pos + 2);
+    outputPrefix.resize(pos);
+    outputPid = true;
+  }
+}
+
+// Buffered output with the async-signal-safe functions only
+class SafeOutput {
+private:
+  int fd;
+  char buffer[4096];
+  size_t pos = 0;
+
+public:
+  SafeOutput(int fd) : fd(fd) {}
+
+  ~SafeOutput() { flush(); }
+
+  void flush() {
+    size_t done = 0;
+    while (done < pos) {
+      ssize_t r = write(fd, buffer + done, pos - done);
+      if (r <= 0) {
+        break;
+      }
+      done += r;
+    }
+    pos = 0;
+  }
+
+  void put(const void *data, size_t size) {
+    const char *d = static_cast<const char *>(data);
+    while (size > 0) {
+      if (pos == sizeof(buffer)) {
+        flush();
+      }
+      size_t n = std::min(size, sizeof(buffer) - pos);
+      memcpy(buffer + pos, d, n);
+      pos += n;
+      d += n;
+      size -= n;
+    }
+  }
+
+  void put(const char *s) { put(s, strlen(s)); }
+
+  // unsigned value, padded with pad to width characters
+  void put(uint64_t value, unsigned base, size_t width = 0, char pad = ' ') {
+    char digits[24];
+    size_t n = 0;
+    do {
+      digits[n++] = "0123456789abcdef"[value % base];
+      value /= base;
+    } while (value != 0);
+    for (; width > n; width--) {
+      put(&pad, 1);
+    }
+    while (n > 0) {
+      put(&digits[--n], 1);
+    }
+  }
+};
+
+// Write the coverage once, from the exit of the process or from a signal
+// handler
+void writeCoverage() {
+  if (written.test_and_set()) {
+    return;
+  }
+
+  char path[4096];
+  size_t len = 0;
+  auto append = [&path, &len](const char *s, size_t n) {
+    n = std::min(n, sizeof(path) - 1 - len);
+    memcpy(path + len, s, n);
+    len += n;
+  };
+  append(outputPrefix.data(), outputPrefix.size());
+  if (outputPid) {
+    char pid[24];
+    size_t n = 0;
+    for (uint64_t v = getpid(); v != 0 or n == 0; v /= 10) {
+      pid[n++] = '0' + v % 10;
+    }
+    std::reverse(pid, pid + n);
+    append(pid, n);
+    append(outputSuffix.data(), outputSuffix.size());
+  }
+  path[len] = '\0';
+
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    SafeOutput err(STDERR_FILENO);
+    err.put("QBDI coverage: cannot open ");
+    err.put(path);
+    err.put("\n");
+    return;
+  }
+  {
+    SafeOutput output(fd);
+    size_t moduleCount = modules.size();
+    size_t blockCount = table.size();
+    output.put("DRCOV VERSION: 2\n");
+    output.put("DRCOV FLAVOR: drcov\n");
+    output.put("Module Table: version 2, count ");
+    output.put(moduleCount, 10);
+    output.put("\nColumns: id, base, end, entry, path\n");
+    for (size_t id = 0; id < moduleCount; id++) {
+      output.put(id, 10, 2);
+      output.put(", 0x");
+      output.put(modules[id].range.start(), 16);
+      output.put(", 0x");
+      output.put(modules[id].range.end(), 16);
+      output.put(", 0x");
+      output.put(0, 16, sizeof(QBDI::rword) * 2, '0');
+      output.put(", ");
+      output.put(modules[id].name.c_str());
+      output.put("\n");
+    }
+    output.put("BB Table: ");
+    output.put(blockCount, 10);
+    output.put(" bbs\n");
+    for (size_t i = 0; i < blockCount; i++) {
+      output.put(&table[i], sizeof(DrcovBlock));
+    }
+  }
+  close(fd);
+}
+
+void onSignal(int signum) {
+  writeCoverage();
+  signal(signum, SIG_DFL);
+  raise(signum);
+}
+
+void setupVM(QBDI::VM *vm) {
+  vm->addVMEventCB(QBDI::BASIC_BLOCK_NEW, onNewBlock, nullptr);
+}
+
+} // namespace
+
+extern "C" {
+
+QBDIPRELOAD_INIT;
+
+int qbdipreload_on_start(void *main) {
+#if defined(QBDI_PLATFORM_LINUX)
+  QBDI::qbdipreload_hook_threads();
+#endif
+  setOutputPath();
+  for (int signum : coverageSignals) {
+    signal(signum, onSignal);
+  }
+  return QBDIPRELOAD_NOT_HANDLED;
+}
+
+int qbdipreload_on_premain(void *gprCtx, void *fpuCtx) {
+  return QBDIPRELOAD_NOT_HANDLED;
+}
+
+int qbdipreload_on_main(int argc, char **argv) {
+  return QBDIPRELOAD_NOT_HANDLED;
+}
+
+int qbdipreload_on_run(QBDI::VMInstanceRef vm, QBDI::rword start,
+                       QBDI::rword stop) {
+  setupVM(vm);
+  vm->run(start, stop);
+  return QBDIPRELOAD_NO_ERROR;
+}
+
+int qbdipreload_on_thread_start(QBDI::VMInstanceRef vm, QBDI::rword start,
+                                QBDI::rword arg) {
+  setupVM(vm);
+  return QBDIPRELOAD_NO_ERROR;
+}
+
+int qbdipreload_on_exit(int status) {
+  writeCoverage();
+  return QBDIPRELOAD_NO_ERROR;
+}
+}
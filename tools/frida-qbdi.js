@@ -277,6 +277,8 @@ var QBDI_C = Object.freeze({
     terminateVM: _qbdibinder.bind('qbdi_terminateVM', 'void', ['pointer']),
     getOptions: _qbdibinder.bind('qbdi_getOptions', rword, ['pointer']),
     setOptions: _qbdibinder.bind('qbdi_setOptions', 'void', ['pointer', rword]),
+    getExecBlockSize: _qbdibinder.bind('qbdi_getExecBlockSize', 'void', ['pointer', 'pointer', 'pointer']),
+    setExecBlockSize: _qbdibinder.bind('qbdi_setExecBlockSize', 'uchar', ['pointer', 'uint32', 'uint32']),
     addInstrumentedRange: _qbdibinder.bind('qbdi_addInstrumentedRange', 'void', ['pointer', rword, rword]),
     addInstrumentedModule: _qbdibinder.bind('qbdi_addInstrumentedModule', 'uchar', ['pointer', 'pointer']),
     addInstrumentedModuleFromAddr: _qbdibinder.bind('qbdi_addInstrumentedModuleFromAddr', 'uchar', ['pointer', rword]),
@@ -285,7 +287,10 @@ var QBDI_C = Object.freeze({
     removeInstrumentedModule: _qbdibinder.bind('qbdi_removeInstrumentedModule', 'uchar', ['pointer', 'pointer']),
     removeInstrumentedModuleFromAddr: _qbdibinder.bind('qbdi_removeInstrumentedModuleFromAddr', 'uchar', ['pointer', rword]),
     removeAllInstrumentedRanges: _qbdibinder.bind('qbdi_removeAllInstrumentedRanges', 'void', ['pointer']),
+    setModuleTracking: _qbdibinder.bind('qbdi_setModuleTracking', 'void', ['pointer', 'uint32']),
+    getModuleTracking: _qbdibinder.bind('qbdi_getModuleTracking', 'uint32', ['pointer']),
     run: _qbdibinder.bind('qbdi_run', 'uchar', ['pointer', rword, rword]),
+    step: _qbdibinder.bind('qbdi_step', 'uchar', ['pointer']),
     call: _qbdibinder.bind('qbdi_call', 'uchar', ['pointer', 'pointer', rword, 'uint32',
                            rword, rword, rword, rword, rword, rword, rword, rword, rword, rword]),
     getGPRState: _qbdibinder.bind('qbdi_getGPRState', 'pointer', ['pointer']),
@@ -303,13 +308,20 @@ var QBDI_C = Object.freeze({
     addCodeAddrCB: _qbdibinder.bind('qbdi_addCodeAddrCB', 'uint32', ['pointer', rword, 'uint32', 'pointer', 'pointer', 'int32']),
     addCodeRangeCB: _qbdibinder.bind('qbdi_addCodeRangeCB', 'uint32', ['pointer', rword, rword, 'uint32', 'pointer', 'pointer', 'int32']),
     addVMEventCB: _qbdibinder.bind('qbdi_addVMEventCB', 'uint32', ['pointer', 'uint32', 'pointer', 'pointer']),
+    replaceFunction: _qbdibinder.bind('qbdi_replaceFunction', 'uint32', ['pointer', rword, rword]),
     deleteInstrumentation: _qbdibinder.bind('qbdi_deleteInstrumentation', 'uchar', ['pointer', 'uint32']),
     deleteAllInstrumentations: _qbdibinder.bind('qbdi_deleteAllInstrumentations', 'void', ['pointer']),
     getInstAnalysis: _qbdibinder.bind('qbdi_getInstAnalysis', 'pointer', ['pointer', 'uint32']),
     getCachedInstAnalysis: _qbdibinder.bind('qbdi_getCachedInstAnalysis', 'pointer', ['pointer', rword, 'uint32']),
+    getInstHandle: _qbdibinder.bind('qbdi_getInstHandle', 'uint64', ['pointer']),
+    getCachedInstHandle: _qbdibinder.bind('qbdi_getCachedInstHandle', 'uint64', ['pointer', rword]),
+    getInstAnalysisByHandle: _qbdibinder.bind('qbdi_getInstAnalysisByHandle', 'pointer', ['pointer', 'uint64', 'uint32']),
     recordMemoryAccess: _qbdibinder.bind('qbdi_recordMemoryAccess', 'uchar', ['pointer', 'uint32']),
+    recordMemoryAccessRange: _qbdibinder.bind('qbdi_recordMemoryAccessRange', 'uchar', ['pointer', rword, rword, 'uint32']),
     getInstMemoryAccess: _qbdibinder.bind('qbdi_getInstMemoryAccess', 'pointer', ['pointer', 'pointer']),
     getBBMemoryAccess: _qbdibinder.bind('qbdi_getBBMemoryAccess', 'pointer', ['pointer', 'pointer']),
+    getInstMemoryAccessBuffer: _qbdibinder.bind('qbdi_getInstMemoryAccessBuffer', rword, ['pointer', 'pointer', rword]),
+    getBBMemoryAccessBuffer: _qbdibinder.bind('qbdi_getBBMemoryAccessBuffer', rword, ['pointer', 'pointer', rword]),
     // Memory
     allocateVirtualStack: _qbdibinder.bind('qbdi_allocateVirtualStack', 'uchar', ['pointer', 'uint32', 'pointer']),
     alignedAlloc: _qbdibinder.bind('qbdi_alignedAlloc', 'pointer', ['uint32', 'uint32']),
@@ -330,6 +342,9 @@ var QBDI_C = Object.freeze({
     precacheBasicBlock: _qbdibinder.bind('qbdi_precacheBasicBlock', 'uchar', ['pointer', rword]),
     clearCache: _qbdibinder.bind('qbdi_clearCache', 'void', ['pointer', rword, rword]),
     clearAllCache: _qbdibinder.bind('qbdi_clearAllCache', 'void', ['pointer']),
+    sealCache: _qbdibinder.bind('qbdi_sealCache', 'uchar', ['pointer']),
+    getCacheLimit: _qbdibinder.bind('qbdi_getCacheLimit', rword, ['pointer']),
+    setCacheLimit: _qbdibinder.bind('qbdi_setCacheLimit', 'void', ['pointer', rword]),
 });
 
 // Init some globals
@@ -497,11 +512,11 @@ var VMEvent = Object.freeze({
      */
     EXEC_TRANSFER_RETURN  : 1<<6,
     /**
-     * Not implemented.
+     * Triggered before the execution of a system call.
      */
     SYSCALL_ENTRY         : 1<<7,
     /**
-     * Not implemented.
+     * Triggered after the execution of a system call.
      */
     SYSCALL_EXIT          : 1<<8,
     /**
@@ -525,7 +540,43 @@ var MemoryAccessType = Object.freeze({
     /**
      * Memory read/write access.
      */
-    MEMORY_READ_WRITE : 3
+    MEMORY_READ_WRITE : 3,
+    /**
+     * Modifier of the recording: the value isn't captured.
+     */
+    MEMORY_ADDRESS_ONLY : 4,
+    /**
+     * Modifier of the recording: the accesses relative to the stack pointer
+     * (push, pop, call, ret and the operands based on it) aren't recorded.
+     */
+    MEMORY_NO_STACK : 8,
+    /**
+     * Modifier of the recording: as MEMORY_NO_STACK, and the operands based
+     * on the frame pointer aren't recorded.
+     */
+    MEMORY_NO_FRAME : 16
+});
+
+/**
+ * Policy of the tracking of the modules loaded and unloaded by the process
+ */
+var ModuleTracking = Object.freeze({
+    /**
+     * The modules aren't tracked.
+     */
+    NO_MODULE_TRACKING : 0,
+    /**
+     * Add the executable ranges of the loaded modules to the instrumented ranges.
+     */
+    MODULE_TRACK_LOAD : 1,
+    /**
+     * Remove the executable ranges of the unloaded modules from the instrumented ranges and from the cache.
+     */
+    MODULE_TRACK_UNLOAD : 2,
+    /**
+     * MODULE_TRACK_LOAD and MODULE_TRACK_UNLOAD.
+     */
+    MODULE_TRACK_ALL : 3
 });
 
 /**
@@ -545,9 +596,23 @@ var MemoryAccessFlags = Object.freeze({
      */
     MEMORY_MINIMUM_SIZE : 1<<1,
     /**
-     * The value of the access is unknown or hasn't been retrived.
+     * The value of the access is unknown or hasn't been retrived. Never set
+     * with MEMORY_BULK.
+     */
+    MEMORY_UNKNOWN_VALUE : 1<<2,
+    /**
+     * The access summarizes all the iterations of an instruction with a REP
+     * prefix. The value holds the length of the range in bytes.
      */
-    MEMORY_UNKNOWN_VALUE : 1<<2
+    MEMORY_BULK : 1<<3,
+    /**
+     * The bulk access has been done backward (DF=1).
+     */
+    MEMORY_BULK_BACKWARD : 1<<4,
+    /**
+     * The value is larger than a rword and holds its first bytes.
+     */
+    MEMORY_WIDE_VALUE : 1<<5
 });
 
 /**
@@ -747,6 +812,110 @@ var Options = Object.freeze({
      * execblock doesn't used FPR.
      */
     OPT_DISABLE_OPTIONAL_FPR : 1<<1,
+    /**
+     * Link the translated sequences together when the successor is already
+     * in the cache, without returning to the VM between them.
+     */
+    OPT_ENABLE_BLOCK_CHAINING : 1<<2,
+    /**
+     * Look up the targets of the indirect branches in a cache of the ExecBlock
+     * and jump to the translated sequence on a hit.
+     */
+    OPT_ENABLE_INDIRECT_CACHE : 1<<3,
+    /**
+     * Share the context page between all the ExecBlocks to avoid copying the
+     * state when the execution moves to another ExecBlock (Linux and Android
+     * only).
+     */
+    OPT_ENABLE_SHARED_CONTEXT : 1<<4,
+    /**
+     * Map the code of the ExecBlocks twice, a writable and an executable
+     * alias, to write the code without changing the permissions of the pages
+     * (Linux and Android only).
+     */
+    OPT_ENABLE_DUAL_MAPPING : 1<<5,
+    /**
+     * Disassemble and patch the likely successors of the translated basic
+     * blocks in a worker thread.
+     */
+    OPT_ENABLE_ASYNC_PATCH : 1<<6,
+    /**
+     * Retranslate the hot sequences as superblocks that follow the direct
+     * jumps and calls.
+     */
+    OPT_ENABLE_SUPERBLOCK : 1<<7,
+    /**
+     * Record only the address of the memory accesses and merge the adjacent
+     * accesses of a sequence relative to the same registers.
+     */
+    OPT_ENABLE_MEMACCESS_COALESCING : 1<<8,
+    /**
+     * Protect the pages of the ranges of addMemRangeCB and only instrument the
+     * sequences which access them.
+     */
+    OPT_ENABLE_MEMCB_PAGE_WATCH : 1<<9,
+    /**
+     * Share the analyses of the instructions with the other VMs of the
+     * process which use this option.
+     */
+    OPT_ENABLE_SHARED_ANALYSIS : 1<<10,
+    /**
+     * Execute the targets of the PLT stubs without instrumenting the stubs
+     * (for X86 and X86_64).
+     */
+    OPT_BYPASS_PLT : 1<<11,
+    /**
+     * Execute through the VM the instrumented functions called back by the
+     * non-instrumented functions (for X86 and X86_64).
+     */
+    OPT_ENABLE_REENTRY : 1<<12,
+    /**
+     * Share the translated basic blocks with the other VMs of the process
+     * which use the same CPU and options.
+     */
+    OPT_ENABLE_SHARED_PATCHES : 1<<13,
+    /**
+     * Use the registers and the flags dead in the basic block as scratch of
+     * the instrumentation. Their value may be wrong in the callbacks.
+     */
+    OPT_ENABLE_LIVENESS : 1<<14,
+    /**
+     * Put the code and the data of the ExecBlocks in separate areas backed by
+     * transparent huge pages (Linux and Android only).
+     */
+    OPT_ENABLE_HUGE_PAGES : 1<<15,
+    /**
+     * Predict the targets of the returns with a shadow stack of the calls of
+     * the ExecBlock. Used with OPT_ENABLE_INDIRECT_CACHE.
+     */
+    OPT_ENABLE_RETURN_STACK : 1<<16,
+    /**
+     * Name the translated code in the perf map of the process
+     * (/tmp/perf-<pid>.map, Linux and Android only)
+     */
+    OPT_ENABLE_PERF_MAP : 1<<17,
+    /**
+     * Protect the writable pages of the translated code against the writes
+     * and translate again the code of the written pages (Linux, Android and
+     * macOS only)
+     */
+    OPT_ENABLE_SMC_DETECTION : 1<<18,
+    /**
+     * Capture the value of the recorded accesses of 16, 32 and 64 bytes.
+     */
+    OPT_ENABLE_WIDE_MEMACCESS_VALUE : 1<<19,
+    /**
+     * Translate the instructions in sequences of one instruction, executed
+     * one at a time by VM.step. The chaining, the superblocks and the
+     * asynchronous patch are disabled.
+     */
+    OPT_SINGLE_STEP : 1<<20,
+    /**
+     * Bind the ExecBlocks and their contexts to the NUMA node of the thread
+     * which runs the VM, and move them when the VM runs on another node
+     * (Linux and Android only).
+     */
+    OPT_ENABLE_NUMA_BINDING : 1<<21,
     /**
      * Used the AT&T syntax for instruction disassembly (for X86 and X86_64)
      */
@@ -756,7 +925,13 @@ var Options = Object.freeze({
      * This option uses the instructions (RD|WR)(FS|GS)BASE that must be 
      * supported by the operating system.
      */
-    OPT_ENABLE_FS_GS : 1<<25
+    OPT_ENABLE_FS_GS : 1<<25,
+    /**
+     * Allocate the ExecBlocks near the instrumented code and access the
+     * memory relative to RIP without a temporary register when it is
+     * reachable (for X86_64).
+     */
+    OPT_ENABLE_NEAR_EXECBLOCK : 1<<26
 });
 
 class InstrRuleDataCBK {
@@ -764,7 +939,7 @@ class InstrRuleDataCBK {
      * Object to define an :js:func:`InstCallback` in an :js:func:`InstrRuleCallback`
      *
      * @param {InstPosition} pos       Relative position of the callback (PreInst / PostInst).
-     * @param {InstCallback} cbk       A **native** InstCallback returned by :js:func:`QBDI.newInstCallback`.
+     * @param {InstCallback} cbk       A **native** InstCallback returned by :js:func:`QBDI.newInstCallback`, or a native function (see :js:func:`QBDI.newInstCallback`).
      * @param {Object}       data      User defined data passed to the callback.
      * @param {Int}          priority  The priority of the callback.
      */
@@ -853,6 +1028,29 @@ class GPRState extends State  {
         return gprs;
     }
 
+    /**
+     * Get a view of the registers without a copy. The view is written by the
+     * VM and can be modified, the registers are in the order of GPR_NAMES.
+     *
+     * @return {ArrayBuffer} The memory of the state.
+     */
+    toArrayBuffer() {
+        return ArrayBuffer.wrap(this.ptr, GPR_NAMES.length * Process.pointerSize);
+    }
+
+    /**
+     * Get a typed array of the registers without a copy (a BigUint64Array on
+     * a 64 bits architecture, an Uint32Array else).
+     *
+     * @return The registers in the order of GPR_NAMES.
+     */
+    toTypedArray() {
+        if (Process.pointerSize === 8) {
+            return new BigUint64Array(this.toArrayBuffer());
+        }
+        return new Uint32Array(this.toArrayBuffer());
+    }
+
     /**
      * This function is used to set values of all registers.
      *
@@ -962,6 +1160,8 @@ class QBDI {
     // private member
     #vm = null;
     #memoryAccessDesc = null;
+    #memoryAccessBuffer = null;
+    #memoryAccessCapacity = 0;
     #operandAnalysisStructDesc = null;
     #instAnalysisStructDesc = null;
     #vmStateStructDesc = null;
@@ -1051,6 +1251,31 @@ class QBDI {
         QBDI_C.setOptions(this.#vm, options);
     }
 
+    /**
+     * Get the size of the code and data blocks used to store the instrumented code.
+     *
+     * @return {Object}  An object with the ``codeSize`` and ``dataSize`` in bytes (0 for one page).
+     */
+    getExecBlockSize() {
+        var codeSize = Memory.alloc(4);
+        var dataSize = Memory.alloc(4);
+        QBDI_C.getExecBlockSize(this.#vm, codeSize, dataSize);
+        return {codeSize: Memory.readU32(codeSize), dataSize: Memory.readU32(dataSize)};
+    }
+
+    /**
+     * Set the size of the code and data blocks used to store the instrumented code.
+     * The sizes are rounded up to the page size.
+     *
+     * @param  {Number}  codeSize  Size in bytes of the code blocks, up to 64KiB (0 for one page).
+     * @param  {Number}  dataSize  Size in bytes of the data blocks, up to 512KiB (0 for one page).
+     *
+     * @return {bool} True if the sizes are valid and have been applied.
+     */
+    setExecBlockSize(codeSize, dataSize) {
+        return QBDI_C.setExecBlockSize(this.#vm, codeSize, dataSize) == true;
+    }
+
     /**
      * Add an address range to the set of instrumented address ranges.
      *
@@ -1133,6 +1358,25 @@ class QBDI {
         QBDI_C.removeAllInstrumentedRanges(this.#vm);
     }
 
+    /**
+     * Track the modules loaded and unloaded by the process during the execution, without polling the memory maps.
+     * The modules are tracked on Linux and macOS only.
+     *
+     * @param {ModuleTracking} tracking  The policy, NO_MODULE_TRACKING to disable the tracking.
+     */
+    setModuleTracking(tracking) {
+        QBDI_C.setModuleTracking(this.#vm, tracking);
+    }
+
+    /**
+     * Get the policy of the tracking of the modules.
+     *
+     * @return {ModuleTracking} The policy set with setModuleTracking.
+     */
+    getModuleTracking() {
+        return QBDI_C.getModuleTracking(this.#vm);
+    }
+
     /**
      * Start the execution by the DBI from a given address (and stop when another is reached).
      *
@@ -1145,6 +1389,15 @@ class QBDI {
         return QBDI_C.run(this.#vm, start.toRword(), stop.toRword()) == true;
     }
 
+    /**
+     * Execute the instruction at the current PC and return (need the option OPT_SINGLE_STEP).
+     *
+     * @return {bool} True if the instruction has been executed.
+     */
+    step() {
+        return QBDI_C.step(this.#vm) == true;
+    }
+
     /**
      * Obtain the current general register state.
      *
@@ -1211,13 +1464,42 @@ class QBDI {
         QBDI_C.clearAllCache(this.#vm)
     }
 
+    /**
+     * Seal the translation cache before the process forks its workers. The
+     * forked processes share the code of the cached sequences with the parent.
+     *
+     * @return {bool} False if OPT_ENABLE_DUAL_MAPPING or OPT_ENABLE_SHARED_CONTEXT is enabled.
+     */
+    sealCache() {
+        return QBDI_C.sealCache(this.#vm) == true
+    }
+
+    /**
+     * Get the memory budget of the translation cache.
+     *
+     * @return {Number} The budget in bytes (0 for no limit).
+     */
+    getCacheLimit() {
+        return QBDI_C.getCacheLimit(this.#vm);
+    }
+
+    /**
+     * Set the memory budget of the translation cache. When a new ExecBlock exceeds
+     * the budget, the least recently used regions of the cache are evicted.
+     *
+     * @param {Number} limit  The budget in bytes (0 for no limit).
+     */
+    setCacheLimit(limit) {
+        QBDI_C.setCacheLimit(this.#vm, limit)
+    }
+
 
     /**
      * Register a callback event if the instruction matches the mnemonic.
      *
      * @param {String}       mnem      Mnemonic to match.
      * @param {InstPosition} pos       Relative position of the callback (PreInst / PostInst).
-     * @param {InstCallback} cbk       A **native** InstCallback returned by :js:func:`QBDI.newInstCallback`.
+     * @param {InstCallback} cbk       A **native** InstCallback returned by :js:func:`QBDI.newInstCallback`, or a native function (see :js:func:`QBDI.newInstCallback`).
      * @param {Object}       data      User defined data passed to the callback.
      * @param {Int}          priority  The priority of the callback.
      *
@@ -1226,7 +1508,7 @@ class QBDI {
     addMnemonicCB(mnem, pos, cbk, data, priority = CallbackPriority.PRIORITY_DEFAULT) {
         var mnemPtr = Memory.allocUtf8String(mnem);
         var vm = this.#vm;
-        return this._retainUserData(data, function (dataPtr) {
+        return this._retainUserData(data, cbk, function (dataPtr) {
             return QBDI_C.addMnemonicCB(vm, mnemPtr, pos, cbk, dataPtr, priority);
         });
     }
@@ -1235,7 +1517,7 @@ class QBDI {
      * Register a callback event for every memory access matching the type bitfield made by the instruction in the range codeStart to codeEnd.
      *
      * @param {MemoryAccessType} type      A mode bitfield: either MEMORY_READ, MEMORY_WRITE or both (MEMORY_READ_WRITE).
-     * @param {InstCallback}     cbk       A **native** InstCallback returned by :js:func:`QBDI.newInstCallback`.
+     * @param {InstCallback}     cbk       A **native** InstCallback returned by :js:func:`QBDI.newInstCallback`, or a native function (see :js:func:`QBDI.newInstCallback`).
      * @param {Object}           data      User defined data passed to the callback.
      * @param {Int}              priority  The priority of the callback.
      *
@@ -1243,7 +1525,7 @@ class QBDI {
      */
     addMemAccessCB(type, cbk, data, priority = CallbackPriority.PRIORITY_DEFAULT) {
         var vm = this.#vm;
-        return this._retainUserData(data, function (dataPtr) {
+        return this._retainUserData(data, cbk, function (dataPtr) {
             return QBDI_C.addMemAccessCB(vm, type, cbk, dataPtr, priority);
         });
     }
@@ -1288,14 +1570,14 @@ class QBDI {
      *
      * @param {String|Number}     addr   Code address which will trigger the callback.
      * @param {MemoryAccessType}  type   A mode bitfield: either MEMORY_READ, MEMORY_WRITE or both (MEMORY_READ_WRITE).
-     * @param {InstCallback}      cbk    A **native** InstCallback returned by :js:func:`QBDI.newInstCallback`.
+     * @param {InstCallback}      cbk    A **native** InstCallback returned by :js:func:`QBDI.newInstCallback`, or a native function (see :js:func:`QBDI.newInstCallback`).
      * @param {Object}            data   User defined data passed to the callback.
      *
      * @return {Number} The id of the registered instrumentation (or VMError.INVALID_EVENTID in case of failure).
      */
     addMemAddrCB(addr, type, cbk, data) {
         var vm = this.#vm;
-        return this._retainUserData(data, function (dataPtr) {
+        return this._retainUserData(data, cbk, function (dataPtr) {
             return QBDI_C.addMemAddrCB(vm, addr.toRword(), type, cbk, dataPtr);
         });
     }
@@ -1307,14 +1589,14 @@ class QBDI {
      * @param {String|Number}     start    Start of the address range which will trigger the callback.
      * @param {String|Number}     end      End of the address range which will trigger the callback.
      * @param {MemoryAccessType}  type     A mode bitfield: either MEMORY_READ, MEMORY_WRITE or both (MEMORY_READ_WRITE).
-     * @param {InstCallback}      cbk      A **native** InstCallback returned by :js:func:`QBDI.newInstCallback`.
+     * @param {InstCallback}      cbk      A **native** InstCallback returned by :js:func:`QBDI.newInstCallback`, or a native function (see :js:func:`QBDI.newInstCallback`).
      * @param {Object}            data     User defined data passed to the callback.
      *
      * @return {Number} The id of the registered instrumentation (or VMError.INVALID_EVENTID in case of failure).
      */
     addMemRangeCB(start, end, type, cbk, data) {
         var vm = this.#vm;
-        return this._retainUserData(data, function (dataPtr) {
+        return this._retainUserData(data, cbk, function (dataPtr) {
             return QBDI_C.addMemRangeCB(vm, start.toRword(), end.toRword(), type, cbk, dataPtr);
         });
     }
@@ -1323,7 +1605,7 @@ class QBDI {
      * Register a callback event for a specific instruction event.
      *
      * @param {InstPosition} pos       Relative position of the callback (PreInst / PostInst).
-     * @param {InstCallback} cbk       A **native** InstCallback returned by :js:func:`QBDI.newInstCallback`.
+     * @param {InstCallback} cbk       A **native** InstCallback returned by :js:func:`QBDI.newInstCallback`, or a native function (see :js:func:`QBDI.newInstCallback`).
      * @param {Object}       data      User defined data passed to the callback.
      * @param {Int}          priority  The priority of the callback.
      *
@@ -1331,7 +1613,7 @@ class QBDI {
      */
     addCodeCB(pos, cbk, data, priority = CallbackPriority.PRIORITY_DEFAULT) {
         var vm = this.#vm;
-        return this._retainUserData(data, function (dataPtr) {
+        return this._retainUserData(data, cbk, function (dataPtr) {
             return QBDI_C.addCodeCB(vm, pos, cbk, dataPtr, priority);
         });
     }
@@ -1341,7 +1623,7 @@ class QBDI {
      *
      * @param {String|Number} addr      Code address which will trigger the callback.
      * @param {InstPosition}  pos       Relative position of the callback (PreInst / PostInst).
-     * @param {InstCallback}  cbk       A **native** InstCallback returned by :js:func:`QBDI.newInstCallback`.
+     * @param {InstCallback}  cbk       A **native** InstCallback returned by :js:func:`QBDI.newInstCallback`, or a native function (see :js:func:`QBDI.newInstCallback`).
      * @param {Object}        data      User defined data passed to the callback.
      * @param {Int}           priority  The priority of the callback.
      *
@@ -1349,7 +1631,7 @@ class QBDI {
      */
     addCodeAddrCB(addr, pos, cbk, data, priority = CallbackPriority.PRIORITY_DEFAULT) {
         var vm = this.#vm;
-        return this._retainUserData(data, function (dataPtr) {
+        return this._retainUserData(data, cbk, function (dataPtr) {
             return QBDI_C.addCodeAddrCB(vm, addr.toRword(), pos, cbk, dataPtr, priority);
         });
     }
@@ -1360,7 +1642,7 @@ class QBDI {
      * @param {String|Number} start     Start of the address range which will trigger the callback.
      * @param {String|Number} end       End of the address range which will trigger the callback.
      * @param {InstPosition}  pos       Relative position of the callback (PreInst / PostInst).
-     * @param {InstCallback}  cbk       A **native** InstCallback returned by :js:func:`QBDI.newInstCallback`.
+     * @param {InstCallback}  cbk       A **native** InstCallback returned by :js:func:`QBDI.newInstCallback`, or a native function (see :js:func:`QBDI.newInstCallback`).
      * @param {Object}        data      User defined data passed to the callback.
      * @param {Int}           priority  The priority of the callback.
      *
@@ -1368,7 +1650,7 @@ class QBDI {
      */
     addCodeRangeCB(start, end, pos, cbk, data, priority = CallbackPriority.PRIORITY_DEFAULT) {
         var vm = this.#vm;
-        return this._retainUserData(data, function (dataPtr) {
+        return this._retainUserData(data, cbk, function (dataPtr) {
             return QBDI_C.addCodeRangeCB(vm, start.toRword(), end.toRword(), pos, cbk, dataPtr, priority);
         });
     }
@@ -1377,18 +1659,31 @@ class QBDI {
      * Register a callback event for a specific VM event.
      *
      * @param {VMEvent}    mask   A mask of VM event type which will trigger the callback.
-     * @param {VMCallback} cbk    A **native** VMCallback returned by :js:func:`QBDI.newVMCallback`.
+     * @param {VMCallback} cbk    A **native** VMCallback returned by :js:func:`QBDI.newVMCallback`, or a native function.
      * @param {Object}     data   User defined data passed to the callback.
      *
      * @return {Number} The id of the registered instrumentation (or VMError.INVALID_EVENTID in case of failure).
      */
     addVMEventCB(mask, cbk, data) {
         var vm = this.#vm;
-        return this._retainUserData(data, function (dataPtr) {
+        return this._retainUserData(data, cbk, function (dataPtr) {
             return QBDI_C.addVMEventCB(vm, mask, cbk, dataPtr);
         });
     }
 
+    /**
+     * Replace a function by another one. The calls and the jumps to the original function continue at the
+     * replacement without any callback.
+     *
+     * @param {String|Number} orig         The address of the original function.
+     * @param {String|Number} replacement  The address of the replacement.
+     *
+     * @return {Number} The id of the registered instrumentation (or VMError.INVALID_EVENTID in case of failure).
+     */
+    replaceFunction(orig, replacement) {
+        return QBDI_C.replaceFunction(this.#vm, orig, replacement);
+    }
+
     /**
      * Remove an instrumentation.
      *
@@ -1443,6 +1738,44 @@ class QBDI {
         return this._parseInstAnalysis(analysis);
     }
 
+    /**
+     * Obtain the handle of the current instruction. The handle resolves the analysis of the instruction without searching the cache.
+     * This method must only be used in an InstCallback.
+     *
+     * @return {UInt64} The handle of the current instruction, 0 on failure.
+     */
+    getInstHandle() {
+        return QBDI_C.getInstHandle(this.#vm);
+    }
+
+    /**
+     * Obtain the handle of a cached instruction.
+     *
+     * @param {String|Number} addr    The address of the instruction.
+     *
+     * @return {UInt64} The handle of the instruction, 0 if the instruction isn't in the cache.
+     */
+    getCachedInstHandle(addr) {
+        return QBDI_C.getCachedInstHandle(this.#vm, addr.toRword());
+    }
+
+    /**
+     * Obtain the analysis of an instruction from its handle. A handle is invalidated when the ExecBlock of its instruction is freed.
+     *
+     * @param {UInt64}        handle  The handle of the instruction.
+     * @param {AnalysisType}  [type]  Properties to retrieve during analysis (default to ANALYSIS_INSTRUCTION | ANALYSIS_DISASSEMBLY).
+     *
+     * @return {InstAnalysis} A :js:class:`InstAnalysis` object containing the analysis result. null if the handle is no longer valid.
+     */
+    getInstAnalysisByHandle(handle, type) {
+        type = type || (AnalysisType.ANALYSIS_INSTRUCTION | AnalysisType.ANALYSIS_DISASSEMBLY);
+        var analysis = QBDI_C.getInstAnalysisByHandle(this.#vm, handle, type);
+        if (analysis.isNull()) {
+            return NULL;
+        }
+        return this._parseInstAnalysis(analysis);
+    }
+
     /**
      * Obtain the memory accesses made by the last executed instruction. Return NULL and a size of 0 if the instruction made no memory access.
      *
@@ -1452,6 +1785,19 @@ class QBDI {
         return QBDI_C.recordMemoryAccess(this.#vm, type) == true;
     }
 
+    /**
+     * Add instrumentation rules to log the memory accesses of the instructions of a range only.
+     *
+     * @param {String|Number}    start Start of the range of instructions.
+     * @param {String|Number}    end   End of the range of instructions (not included).
+     * @param {MemoryAccessType} type  Memory mode bitfield to activate the logging for: either MEMORY_READ, MEMORY_WRITE or both (MEMORY_READ_WRITE).
+     *
+     * @return {bool} True if inline memory logging is supported, False if not or in case of error.
+     */
+    recordMemoryAccessRange(start, end, type) {
+        return QBDI_C.recordMemoryAccessRange(this.#vm, start.toRword(), end.toRword(), type) == true;
+    }
+
     /**
      * Obtain the memory accesses made by the last executed instruction. Return NULL and a size of 0 if the instruction made no memory access.
      *
@@ -1470,6 +1816,30 @@ class QBDI {
         return this._getMemoryAccess(QBDI_C.getBBMemoryAccess);
     }
 
+    /**
+     * Obtain the memory accesses made by the last executed instruction without
+     * creating an object per access. The records are written by the VM in a
+     * buffer kept by this instance, the result is valid until the next call
+     * of getInstMemoryAccessBuffer or getBBMemoryAccessBuffer.
+     *
+     * @return {Object} The records: ``buffer`` (an ArrayBuffer), ``count``,
+     *                  ``stride`` (size of a record) and ``offsets`` (offset
+     *                  of each field of :js:class:`MemoryAccess` in a record).
+     */
+    getInstMemoryAccessBuffer() {
+        return this._getMemoryAccessBuffer(QBDI_C.getInstMemoryAccessBuffer);
+    }
+
+    /**
+     * Obtain the memory accesses made by the last executed sequence without
+     * creating an object per access (see getInstMemoryAccessBuffer).
+     *
+     * @return {Object} The records of the accesses.
+     */
+    getBBMemoryAccessBuffer() {
+        return this._getMemoryAccessBuffer(QBDI_C.getBBMemoryAccessBuffer);
+    }
+
     // Memory
 
     /**
@@ -1595,7 +1965,7 @@ class QBDI {
                 return;
             }
             for (var i = 0; i < res.length; i++) {
-                var d = vm._retainUserDataForInstrRuleCB2(res[i].data, data.id);
+                var d = vm._retainUserDataForInstrRuleCB2(res[i].data, data.id, res[i].cbk);
                 QBDI_C.addInstrRuleData(cbksPtr, res[i].position, res[i].cbk, d, res[i].priority);
             }
         }
@@ -1613,6 +1983,23 @@ class QBDI {
      *       >>>   return VMAction.CONTINUE;
      *       >>> });
      *
+     * A native function can be given instead of the result of this function
+     * wherever an InstCallback is accepted, for instance a symbol of a Frida
+     * ``CModule``. The instrumented code doesn't enter the JS engine and a
+     * ``NativePointer`` data is given as is to the function. The results are
+     * aggregated by JS after the run, or periodically by the host thread:
+     *
+     *       >>> var cm = new CModule(`
+     *       >>>   #include <stdint.h>
+     *       >>>   int count(void *vm, void *gpr, void *fpr, void *data) {
+     *       >>>     *(uint64_t *) data += 1;
+     *       >>>     return 0;
+     *       >>>   }`);
+     *       >>> var counter = Memory.alloc(8);
+     *       >>> vm.addCodeCB(InstPosition.PREINST, cm.count, counter);
+     *       >>> vm.call(funcPtr, []);
+     *       >>> console.log(counter.readU64());
+     *
      * @param {InstCallback} cbk an instruction callback (ex: function(vm, gpr, fpr, data) {};)
      *
      * @return an native InstCallback
@@ -1732,10 +2119,12 @@ class QBDI {
     //
     // If a ``NativePointer`` is given, it will be used as raw user data and the
     // object will not be retained.
-    _retainUserData(data, fn) {
+    _retainUserData(data, cbk, fn) {
         var dataPtr = ptr("0");
         var managed = false;
-        if (data !== null && data !== undefined) {
+        if (this._isNativeData(data, cbk)) {
+            dataPtr = data;
+        } else if (data !== null && data !== undefined) {
             this.#userDataPointer += 1;
             dataPtr = dataPtr.add(this.#userDataPointer);
             managed = true;
@@ -1759,8 +2148,10 @@ class QBDI {
         return iid;
     }
 
-    _retainUserDataForInstrRuleCB2(data, id) {
-        if (data !== null && data !== undefined) {
+    _retainUserDataForInstrRuleCB2(data, id, cbk) {
+        if (this._isNativeData(data, cbk)) {
+            return data;
+        } else if (data !== null && data !== undefined) {
             this.#userDataPointer += 1;
             var dataPtr = ptr("0").add(this.#userDataPointer);
 
@@ -1772,6 +2163,13 @@ class QBDI {
         }
     }
 
+    // A callback which isn't created by newInstCallback, newVMCallback or
+    // newInstrRuleCallback is a native function (a CModule symbol or a raw
+    // function pointer), its NativePointer data is given without translation.
+    _isNativeData(data, cbk) {
+        return (data instanceof NativePointer) && !(cbk instanceof NativeCallback);
+    }
+
     // Retrieve a user data object from its ``NativePointer`` reference.
     // If pointer is NULL or no data object is found, the ``NativePointer``
     // object will be returned.
@@ -1864,6 +2262,37 @@ class QBDI {
         return accesses;
     }
 
+    _getMemoryAccessBuffer(f) {
+        var desc = this.#memoryAccessDesc;
+        var cnt = 0;
+        while (true) {
+            cnt = Number(f(this.#vm, this.#memoryAccessBuffer === null ? ptr("0") : this.#memoryAccessBuffer,
+                           this.#memoryAccessCapacity));
+            if (cnt <= this.#memoryAccessCapacity) {
+                break;
+            }
+            this.#memoryAccessCapacity = Math.max(cnt, this.#memoryAccessCapacity * 2, 64);
+            this.#memoryAccessBuffer = Memory.alloc(this.#memoryAccessCapacity * desc.size);
+        }
+        var buffer = new ArrayBuffer(0);
+        if (cnt > 0) {
+            buffer = ArrayBuffer.wrap(this.#memoryAccessBuffer, cnt * desc.size);
+        }
+        return Object.freeze({
+            buffer: buffer,
+            count: cnt,
+            stride: desc.size,
+            offsets: Object.freeze({
+                instAddress: desc.offsets[0],
+                accessAddress: desc.offsets[1],
+                value: desc.offsets[2],
+                size: desc.offsets[3],
+                type: desc.offsets[4],
+                flags: desc.offsets[5],
+            }),
+        });
+    }
+
     _parseVMState(ptr) {
         var state = {};
         var p = ptr.add(this.#instAnalysisStructDesc.offsets[0]);
@@ -1878,6 +2307,8 @@ class QBDI {
         state.basicBlockEnd = Memory.readRword(p);
         p = ptr.add(this.#vmStateStructDesc.offsets[5]);
         state.lastSignal = Memory.readRword(p);
+        p = ptr.add(this.#vmStateStructDesc.offsets[6]);
+        state.syscallNumber = Memory.readRword(p);
         Object.freeze(state);
         return state;
     }
@@ -1970,6 +2401,14 @@ class QBDI {
         } else {
             analysis.module = "";
         }
+        p = ptr.add(this.#instAnalysisStructDesc.offsets[22]);
+        analysis.gprRead = Memory.readU64(p);
+        p = ptr.add(this.#instAnalysisStructDesc.offsets[23]);
+        analysis.gprWrite = Memory.readU64(p);
+        p = ptr.add(this.#instAnalysisStructDesc.offsets[24]);
+        analysis.fprRead = Memory.readU64(p);
+        p = ptr.add(this.#instAnalysisStructDesc.offsets[25]);
+        analysis.fprWrite = Memory.readU64(p);
         Object.freeze(analysis);
         return analysis;
     }
@@ -1988,6 +2427,7 @@ if (typeof(module) !== "undefined") {
         InstrRuleDataCBK: InstrRuleDataCBK,
         MemoryAccessFlags: MemoryAccessFlags,
         MemoryAccessType: MemoryAccessType,
+        ModuleTracking: ModuleTracking,
         OperandFlag: OperandFlag,
         OperandType: OperandType,
         Options: Options,
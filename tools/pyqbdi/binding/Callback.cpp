@@ -86,6 +86,10 @@ void init_binding_Callback(py::module_ &m) {
       .value(
           "EXEC_TRANSFER_RETURN", VMEvent::EXEC_TRANSFER_RETURN,
           "Triggered when the ExecBroker returns from an execution transfer.")
+      .value("SYSCALL_ENTRY", VMEvent::SYSCALL_ENTRY,
+             "Triggered before the execution of a system call.")
+      .value("SYSCALL_EXIT", VMEvent::SYSCALL_EXIT,
+             "Triggered after the execution of a system call.")
       .export_values()
       .def_invert()
       .def_repr_str();
@@ -98,9 +102,87 @@ void init_binding_Callback(py::module_ &m) {
              "Memory write access")
       .value("MEMORY_READ_WRITE", MemoryAccessType::MEMORY_READ_WRITE,
              "Memory read/write access")
+      .value("MEMORY_ADDRESS_ONLY", MemoryAccessType::MEMORY_ADDRESS_ONLY,
+             "Modifier of the recording: the value isn't captured")
+      .value("MEMORY_NO_STACK", MemoryAccessType::MEMORY_NO_STACK,
+             "Modifier of the recording: the accesses relative to the stack "
+             "pointer aren't recorded")
+      .value("MEMORY_NO_FRAME", MemoryAccessType::MEMORY_NO_FRAME,
+             "Modifier of the recording: as MEMORY_NO_STACK, and the accesses "
+             "relative to the frame pointer aren't recorded")
       .export_values()
       .def_invert();
 
+  enum_int_flag_<ModuleTracking>(
+      m, "ModuleTracking",
+      "Policy of the tracking of the modules loaded and unloaded by the "
+      "process",
+      py::arithmetic())
+      .value("NO_MODULE_TRACKING", ModuleTracking::NO_MODULE_TRACKING)
+      .value("MODULE_TRACK_LOAD", ModuleTracking::MODULE_TRACK_LOAD,
+             "Add the executable ranges of the loaded modules to the "
+             "instrumented ranges")
+      .value("MODULE_TRACK_UNLOAD", ModuleTracking::MODULE_TRACK_UNLOAD,
+             "Remove the executable ranges of the unloaded modules from the "
+             "instrumented ranges and from the cache")
+      .value("MODULE_TRACK_ALL", ModuleTracking::MODULE_TRACK_ALL,
+             "MODULE_TRACK_LOAD and MODULE_TRACK_UNLOAD")
+      .export_values()
+      .def_invert();
+
+  py::enum_<SliceStatus>(m, "SliceStatus",
+                         "Status of a slice of execution run by runFor")
+      .value("SLICE_NOT_RUN", SliceStatus::SLICE_NOT_RUN,
+             "The PC isn't instrumented, nothing has been executed")
+      .value("SLICE_FINISHED", SliceStatus::SLICE_FINISHED,
+             "The stop address has been reached")
+      .value("SLICE_EXPIRED", SliceStatus::SLICE_EXPIRED,
+             "The budget of the slice is exhausted, the PC is the entry of "
+             "the next sequence")
+      .value("SLICE_STOPPED", SliceStatus::SLICE_STOPPED,
+             "A callback or a stop request stopped the execution")
+      .export_values();
+
+  py::enum_<PredicateType>(m, "PredicateType",
+                           "Kind of predicate evaluated by the generated code "
+                           "before a callback.")
+      .value("PREDICATE_REG_EQUAL", PredicateType::PREDICATE_REG_EQUAL,
+             "The register is equal to value")
+      .value("PREDICATE_REG_NOT_EQUAL", PredicateType::PREDICATE_REG_NOT_EQUAL,
+             "The register isn't equal to value")
+      .value("PREDICATE_REG_BELOW", PredicateType::PREDICATE_REG_BELOW,
+             "The register is below value (unsigned)")
+      .value("PREDICATE_REG_ABOVE_EQUAL",
+             PredicateType::PREDICATE_REG_ABOVE_EQUAL,
+             "The register is above or equal to value (unsigned)")
+      .value("PREDICATE_MEM_IN_RANGE", PredicateType::PREDICATE_MEM_IN_RANGE,
+             "The address of the access is in [value, end) (PREINST only)")
+      .value("PREDICATE_COUNTER", PredicateType::PREDICATE_COUNTER,
+             "Once every value executions")
+      .value("PREDICATE_SAMPLE", PredicateType::PREDICATE_SAMPLE,
+             "After a pseudo-random number of executions, value on average")
+      .export_values();
+
+  py::class_<CallbackPredicate>(m, "CallbackPredicate")
+      .def(py::init([](PredicateType type, uint32_t reg,
+                       MemoryAccessType access, rword value, rword end) {
+             return CallbackPredicate{type, reg, access, value, end};
+           }),
+           "Create a predicate of a callback, evaluated by the instrumented "
+           "code without entering Python when it doesn't hold.",
+           "type"_a, "reg"_a = 0, "access"_a = MemoryAccessType::MEMORY_READ,
+           "value"_a = 0, "end"_a = 0)
+      .def_readwrite("type", &CallbackPredicate::type, "Kind of predicate")
+      .def_readwrite("reg", &CallbackPredicate::reg,
+                     "Index of the register in GPRState (PREDICATE_REG_*)")
+      .def_readwrite("access", &CallbackPredicate::access,
+                     "MEMORY_READ or MEMORY_WRITE (PREDICATE_MEM_IN_RANGE)")
+      .def_readwrite("value", &CallbackPredicate::value,
+                     "Compared value, start of the range or period of the "
+                     "counter or of the sampling")
+      .def_readwrite("end", &CallbackPredicate::end,
+                     "End of the range (PREDICATE_MEM_IN_RANGE)");
+
   py::class_<VMState>(m, "VMState")
       .def_readonly("event", &VMState::event,
                     "The event(s) which triggered the callback (must be "
@@ -116,7 +198,10 @@ void init_binding_Callback(py::module_ &m) {
                     "execution transfer destination.")
       .def_readonly("sequenceEnd", &VMState::sequenceEnd,
                     "The current sequence end address which can also be the "
-                    "execution transfer destination.");
+                    "execution transfer destination.")
+      .def_readonly("syscallNumber", &VMState::syscallNumber,
+                    "The number of the system call (SYSCALL_ENTRY and "
+                    "SYSCALL_EXIT).");
 
   enum_int_flag_<MemoryAccessFlags>(m, "MemoryAccessFlags",
                                     "Memory access flags", py::arithmetic())
@@ -127,7 +212,16 @@ void init_binding_Callback(py::module_ &m) {
       .value("MEMORY_MINIMUM_SIZE", MemoryAccessFlags::MEMORY_MINIMUM_SIZE,
              "The given size is a minimum size.")
       .value("MEMORY_UNKNOWN_VALUE", MemoryAccessFlags::MEMORY_UNKNOWN_VALUE,
-             "The value of the access is unknown or hasn't been retrived.")
+             "The value of the access is unknown or hasn't been retrived. "
+             "Never set with MEMORY_BULK.")
+      .value("MEMORY_BULK", MemoryAccessFlags::MEMORY_BULK,
+             "The access summarizes all the iterations of an instruction "
+             "with a REP prefix.")
+      .value("MEMORY_BULK_BACKWARD", MemoryAccessFlags::MEMORY_BULK_BACKWARD,
+             "The bulk access has been done backward (DF=1).")
+      .value("MEMORY_WIDE_VALUE", MemoryAccessFlags::MEMORY_WIDE_VALUE,
+             "The value is larger than a rword and holds its first bytes, "
+             "the whole value is given by VM.getMemoryAccessValue.")
       .export_values()
       .def_invert()
       .def_repr_str();
@@ -145,6 +239,18 @@ void init_binding_Callback(py::module_ &m) {
                      "Memory access type (READ / WRITE)")
       .def_readwrite("flags", &MemoryAccess::flags, "Memory access flags");
 
+  py::class_<CachedInstLocation>(m, "CachedInstLocation")
+      .def_readonly("seqStart", &CachedInstLocation::seqStart,
+                    "Address of the first instruction of the sequence")
+      .def_readonly("seqEnd", &CachedInstLocation::seqEnd,
+                    "Address after the last instruction of the sequence")
+      .def_readonly("bbEnd", &CachedInstLocation::bbEnd,
+                    "Address after the basic block of the sequence")
+      .def_readonly("instIndex", &CachedInstLocation::instIndex,
+                    "Index of the instruction in the sequence")
+      .def_readonly("nbInst", &CachedInstLocation::nbInst,
+                    "Number of instructions of the sequence");
+
   py::class_<InstrRuleDataCBKPython>(m, "InstrRuleDataCBK")
       .def(py::init<PyInstCallback &, py::object &, InstPosition, int>(),
            "cbk"_a, "data"_a, "position"_a, "priority"_a = PRIORITY_DEFAULT)
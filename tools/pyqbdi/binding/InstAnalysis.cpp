@@ -279,6 +279,36 @@ void init_binding_InstAnalysis(py::module_ &m) {
                                            ANALYSIS_OPERANDS);
           },
           "Flag access type (noaccess, r, w, rw) (if ANALYSIS_OPERANDS)")
+      .def_property_readonly(
+          "gprRead",
+          [](const InstAnalysis &obj) {
+            return get_InstAnalysis_member(obj, &InstAnalysis::gprRead,
+                                           ANALYSIS_OPERANDS);
+          },
+          "Bitmask of the GPRState registers read (if ANALYSIS_OPERANDS)")
+      .def_property_readonly(
+          "gprWrite",
+          [](const InstAnalysis &obj) {
+            return get_InstAnalysis_member(obj, &InstAnalysis::gprWrite,
+                                           ANALYSIS_OPERANDS);
+          },
+          "Bitmask of the GPRState registers written (if ANALYSIS_OPERANDS)")
+      .def_property_readonly(
+          "fprRead",
+          [](const InstAnalysis &obj) {
+            return get_InstAnalysis_member(obj, &InstAnalysis::fprRead,
+                                           ANALYSIS_OPERANDS);
+          },
+          "Bitmask of the 16 bytes slots of the FPRState read (if "
+          "ANALYSIS_OPERANDS)")
+      .def_property_readonly(
+          "fprWrite",
+          [](const InstAnalysis &obj) {
+            return get_InstAnalysis_member(obj, &InstAnalysis::fprWrite,
+                                           ANALYSIS_OPERANDS);
+          },
+          "Bitmask of the 16 bytes slots of the FPRState written (if "
+          "ANALYSIS_OPERANDS)")
       .def_property_readonly(
           "numOperands",
           [](const InstAnalysis &obj) {
@@ -323,6 +353,18 @@ void init_binding_InstAnalysis(py::module_ &m) {
                                            ANALYSIS_SYMBOL);
           },
           "Instruction module name (if ANALYSIS_SYMBOL and found)");
+
+  py::class_<AnalysisExporter>(m, "AnalysisExporter",
+                               "Builder of a compact binary export of "
+                               "InstAnalysis")
+      .def(py::init<>(), "Create an empty analysis exporter.")
+      .def("add", &AnalysisExporter::add,
+           "Add an analysis to the export. An address already exported is "
+           "ignored.",
+           "analysis"_a)
+      .def("__len__", &AnalysisExporter::size)
+      .def("write", &AnalysisExporter::write,
+           "Write the export to a file. The file is truncated.", "path"_a);
 }
 
 } // namespace pyQBDI
@@ -55,6 +55,14 @@ void init_binding_Memory(py::module_ &m) {
         "Get a list of all the memory maps (regions) of the current process.",
         "full_path"_a = false);
 
+  m.def("getCachedProcessMaps", &getCachedProcessMaps,
+        "Get a list of all the memory maps (regions) of the current process "
+        "from a snapshot.",
+        "full_path"_a = false);
+
+  m.def("invalidateProcessMapsCache", &invalidateProcessMapsCache,
+        "Invalidate the snapshot of the memory maps of the current process.");
+
   m.def("getModuleNames",
         static_cast<std::vector<std::string> (*)()>(&getModuleNames),
         "Get a list of all the module names loaded in the process memory.");
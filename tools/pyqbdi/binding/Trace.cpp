@@ -0,0 +1,281 @@
+/*
+ * This file is part of pyQBDI (python binding for QBDI).
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <vector>
+
+#include "pyqbdi.hpp"
+#include "trace_array.h"
+
+namespace QBDI {
+namespace pyQBDI {
+
+// Native collector of the events of a VM. The events are recorded by C++
+// callbacks, no Python code is executed for an event. The GIL is released
+// during the runs, it is only taken back to give a chunk to onChunk.
+class TraceCollector {
+private:
+  std::vector<rword> sequences;
+  std::vector<rword> instructions;
+  std::vector<MemoryTraceEntry> accesses;
+  size_t chunkSize;
+  py::object onChunk;
+
+  void checkChunk() {
+    if (chunkSize == 0 or size() < chunkSize) {
+      return;
+    }
+    py::gil_scoped_acquire gil;
+    try {
+      onChunk(takeSequences(), takeInstructions(), takeMemoryAccesses());
+    } catch (const std::exception &e) {
+      std::cerr << "Error during TraceCollector chunk : " << e.what()
+                << std::endl;
+      exit(1);
+    }
+  }
+
+  static VMAction sequenceCB(VMInstanceRef vm, const VMState *vmState,
+                             GPRState *gprState, FPRState *fprState,
+                             void *data) {
+    TraceCollector *collector = static_cast<TraceCollector *>(data);
+    collector->sequences.push_back(vmState->sequenceStart);
+    collector->sequences.push_back(vmState->sequenceEnd);
+    collector->checkChunk();
+    return CONTINUE;
+  }
+
+  static VMAction instructionCB(VMInstanceRef vm, GPRState *gprState,
+                                FPRState *fprState, void *data) {
+    TraceCollector *collector = static_cast<TraceCollector *>(data);
+    collector->instructions.push_back(QBDI_GPR_GET(gprState, REG_PC));
+    collector->checkChunk();
+    return CONTINUE;
+  }
+
+  static VMAction memoryCB(VMInstanceRef vm, const MemoryTraceEntry *entries,
+                           size_t count, void *data) {
+    TraceCollector *collector = static_cast<TraceCollector *>(data);
+    collector->accesses.insert(collector->accesses.end(), entries,
+                               entries + count);
+    collector->checkChunk();
+    return CONTINUE;
+  }
+
+public:
+  // without onChunk, the events wait until they are taken
+  TraceCollector(size_t chunkSize, const py::object &onChunk)
+      : chunkSize(onChunk.is_none() ? 0 : chunkSize), onChunk(onChunk) {}
+
+  std::vector<uint32_t> attach(VM &vm, bool traceSequences,
+                               bool traceInstructions, MemoryAccessType type) {
+    std::vector<uint32_t> ids;
+    if (type != 0 and not vm.setMemoryTrace(type, memoryCB, this)) {
+      return ids;
+    }
+    if (traceSequences) {
+      ids.push_back(vm.addVMEventCB(SEQUENCE_ENTRY, sequenceCB, this));
+    }
+    if (traceInstructions) {
+      ids.push_back(vm.addCodeCB(PREINST, instructionCB, this));
+    }
+    return ids;
+  }
+
+  // number of events waiting in the collector
+  size_t size() const {
+    return sequences.size() / 2 + instructions.size() + accesses.size();
+  }
+
+  AddressArray takeSequences() {
+    AddressArray res(std::move(sequences), 2);
+    sequences.clear();
+    return res;
+  }
+
+  AddressArray takeInstructions() {
+    AddressArray res(std::move(instructions));
+    instructions.clear();
+    return res;
+  }
+
+  MemoryAccessArray takeMemoryAccesses() {
+    MemoryAccessArray res(std::move(accesses));
+    accesses.clear();
+    return res;
+  }
+};
+
+void init_binding_Trace(py::module_ &m) {
+
+  py::class_<AddressArray>(m, "AddressArray", py::buffer_protocol(),
+                           "Addresses with the buffer protocol, an array of "
+                           "rword with a row by entry")
+      .def_buffer([](AddressArray &a) {
+        if (a.columns == 1) {
+          return py::buffer_info(a.values.data(), a.values.size());
+        }
+        return py::buffer_info(
+            a.values.data(), sizeof(rword),
+            py::format_descriptor<rword>::format(), 2,
+            {a.values.size() / a.columns, a.columns},
+            {sizeof(rword) * a.columns, sizeof(rword)});
+      })
+      .def("__len__",
+           [](const AddressArray &a) { return a.values.size() / a.columns; });
+
+  py::class_<MemoryAccessArray>(m, "MemoryAccessArray", py::buffer_protocol(),
+                                "Memory accesses with the buffer protocol, "
+                                "a structured array of MemoryTraceEntry")
+      .def_buffer([](MemoryAccessArray &a) {
+        return py::buffer_info(a.entries.data(), sizeof(MemoryTraceEntry),
+                               memoryTraceEntryFormat(), 1, {a.entries.size()},
+                               {sizeof(MemoryTraceEntry)});
+      })
+      .def("__len__",
+           [](const MemoryAccessArray &a) { return a.entries.size(); })
+      .def(
+          "__getitem__",
+          [](const MemoryAccessArray &a, size_t i) {
+            if (i >= a.entries.size()) {
+              throw py::index_error();
+            }
+            return a.entries[i];
+          },
+          "index"_a);
+
+  py::enum_<TraceRecordType>(m, "TraceRecordType",
+                             "Type of a record of a binary trace")
+      .value("TRACE_SEQUENCE", TraceRecordType::TRACE_SEQUENCE,
+             "A sequence of instructions is executed")
+      .value("TRACE_MEMORY", TraceRecordType::TRACE_MEMORY, "A memory access")
+      .value("TRACE_COVERAGE", TraceRecordType::TRACE_COVERAGE,
+             "A non zero entry of a coverage bitmap")
+      .export_values();
+
+  py::class_<MemoryTraceEntry>(m, "MemoryTraceEntry")
+      .def_readonly("instAddress", &MemoryTraceEntry::instAddress,
+                    "Address of instruction making the access")
+      .def_readonly("accessAddress", &MemoryTraceEntry::accessAddress,
+                    "Address of accessed memory")
+      .def_readonly("value", &MemoryTraceEntry::value,
+                    "Value read from / written to memory")
+      .def_readonly("size", &MemoryTraceEntry::size,
+                    "Size of memory access (in bytes)")
+      .def_property_readonly(
+          "type",
+          [](const MemoryTraceEntry &e) {
+            return static_cast<MemoryAccessType>(e.type);
+          },
+          "Memory access type (READ / WRITE)")
+      .def_property_readonly(
+          "flags",
+          [](const MemoryTraceEntry &e) {
+            return static_cast<MemoryAccessFlags>(e.flags);
+          },
+          "Memory access flags");
+
+  py::class_<TraceRecord>(m, "TraceRecord")
+      .def_readonly("type", &TraceRecord::type, "Type of the record")
+      .def_readonly("blockID", &TraceRecord::blockID,
+                    "TRACE_SEQUENCE: identifier of the sequence in the trace")
+      .def_readonly("start", &TraceRecord::start,
+                    "TRACE_SEQUENCE: start of the sequence. TRACE_COVERAGE: "
+                    "index in the bitmap")
+      .def_readonly("end", &TraceRecord::end,
+                    "TRACE_SEQUENCE: end of the sequence (excluded). "
+                    "TRACE_COVERAGE: value of the entry")
+      .def_readonly("access", &TraceRecord::access,
+                    "TRACE_MEMORY: the memory access");
+
+  py::class_<TraceWriter>(m, "TraceWriter",
+                          "Binary trace sink with a writer thread")
+      .def(py::init<const std::string &, size_t>(),
+           "Create a trace writer to a file.", "path"_a,
+           "capacity"_a = 65536)
+      .def(py::init<int, size_t>(),
+           "Create a trace writer to a file descriptor (a pipe or a socket).",
+           "fd"_a, "capacity"_a = 65536)
+      .def("isOpen", &TraceWriter::isOpen,
+           "Return True if the output is open.")
+      .def("addSequence", &TraceWriter::addSequence,
+           "Add an executed sequence to the trace.", "start"_a, "end"_a)
+      .def("setCompressedControlFlow", &TraceWriter::setCompressedControlFlow,
+           "Encode the following sequences as taken / not taken bits when "
+           "they are one of the two last successors of the previous sequence.",
+           "enable"_a)
+      .def(
+          "addCoverage",
+          [](TraceWriter &writer, const py::bytes &bitmap) {
+            std::string b = bitmap;
+            writer.addCoverage(reinterpret_cast<const uint8_t *>(b.data()),
+                               b.size());
+          },
+          "Add the non zero entries of a coverage bitmap to the trace.",
+          "bitmap"_a)
+      .def("flush", &TraceWriter::flush,
+           "Wait until all the events given to the writer are written.",
+           py::call_guard<py::gil_scoped_release>())
+      .def("attach", &TraceWriter::attach,
+           "Register the callbacks of the writer on a VM. The writer is kept "
+           "alive by the VM.",
+           "vm"_a, "type"_a = MemoryAccessType::MEMORY_READ_WRITE,
+           py::keep_alive<2, 1>());
+
+  py::class_<TraceReader>(m, "TraceReader",
+                          "Decoder of a binary trace written by a TraceWriter")
+      .def(py::init<const std::string &>(), "Open a trace file.", "path"_a)
+      .def("isOpen", &TraceReader::isOpen,
+           "Return True if the file is open and has a valid header.")
+      .def("__iter__", [](py::object &reader) { return reader; })
+      .def("__next__", [](TraceReader &reader) {
+        TraceRecord record;
+        if (not reader.next(record)) {
+          throw py::stop_iteration();
+        }
+        return record;
+      });
+
+  py::class_<TraceCollector>(
+      m, "TraceCollector",
+      "Native collector of the executed sequences, instructions and memory "
+      "accesses, returned as arrays with the buffer protocol")
+      .def(py::init<size_t, const py::object &>(),
+           "Create a collector. When chunkSize events are waiting, the arrays "
+           "are taken and given to onChunk(sequences, instructions, "
+           "accesses).",
+           "chunkSize"_a = 0, "onChunk"_a = py::none())
+      .def("attach", &TraceCollector::attach,
+           "Register the callbacks of the collector on a VM and return their "
+           "ids. The collector is kept alive by the VM.",
+           "vm"_a, "sequences"_a = true, "instructions"_a = false,
+           "type"_a = MemoryAccessType::MEMORY_READ_WRITE,
+           py::keep_alive<2, 1>())
+      .def("__len__", &TraceCollector::size,
+           "Return the number of events waiting in the collector.")
+      .def("takeSequences", &TraceCollector::takeSequences,
+           "Take the executed sequences, an AddressArray of (start, end) "
+           "rows.")
+      .def("takeInstructions", &TraceCollector::takeInstructions,
+           "Take the addresses of the executed instructions, an "
+           "AddressArray.")
+      .def("takeMemoryAccesses", &TraceCollector::takeMemoryAccesses,
+           "Take the memory accesses, a MemoryAccessArray.");
+}
+
+} // namespace pyQBDI
+} // namespace QBDI
@@ -18,6 +18,7 @@
 
 #include "callback_python.h"
 #include "pyqbdi.hpp"
+#include "trace_array.h"
 
 namespace QBDI {
 namespace pyQBDI {
@@ -71,10 +72,13 @@ static void clearTrampDataMap() {
 }
 
 // QBDI trampoline for python callback
+// The GIL is released during the runs of the VM and only taken back by the
+// trampolines, while the python objects are used.
 static VMAction trampoline_InstCallback(VMInstanceRef vm, GPRState *gprState,
                                         FPRState *fprState, void *data) {
   TrampData<PyInstCallback> *cbk =
       static_cast<TrampData<PyInstCallback> *>(data);
+  py::gil_scoped_acquire gil;
   VMAction res;
   try {
     res = cbk->cbk(vm, gprState, fprState, cbk->obj);
@@ -89,6 +93,7 @@ static VMAction trampoline_VMCallback(VMInstanceRef vm, const VMState *vmState,
                                       GPRState *gprState, FPRState *fprState,
                                       void *data) {
   TrampData<PyVMCallback> *cbk = static_cast<TrampData<PyVMCallback> *>(data);
+  py::gil_scoped_acquire gil;
   VMAction res;
   try {
     res = cbk->cbk(vm, vmState, gprState, fprState, cbk->obj);
@@ -99,11 +104,29 @@ static VMAction trampoline_VMCallback(VMInstanceRef vm, const VMState *vmState,
   return res;
 }
 
-static std::vector<InstrRuleDataCBK>
-trampoline_InstrRuleCallback(VMInstanceRef vm, const InstAnalysis *analysis,
-                             void *data) {
+static VMAction
+trampoline_CachedInstCallback(VMInstanceRef vm,
+                              const CachedInstLocation *location,
+                              const InstAnalysis *analysis, void *data) {
+  TrampData<PyCachedInstCallback> *cbk =
+      static_cast<TrampData<PyCachedInstCallback> *>(data);
+  py::gil_scoped_acquire gil;
+  VMAction res;
+  try {
+    res = cbk->cbk(vm, location, analysis, cbk->obj);
+  } catch (const std::exception &e) {
+    std::cerr << "Error during CachedInstCallback : " << e.what() << std::endl;
+    exit(1);
+  }
+  return res;
+}
+
+static void trampoline_InstrRuleCallback(VMInstanceRef vm,
+                                         const InstAnalysis *analysis,
+                                         InstrRuleDataVec res, void *data) {
   TrampData<PyInstrRuleCallback> *cbk =
       static_cast<TrampData<PyInstrRuleCallback> *>(data);
+  py::gil_scoped_acquire gil;
   std::vector<InstrRuleDataCBKPython> resCB;
   try {
     resCB = cbk->cbk(vm, analysis, cbk->obj);
@@ -111,9 +134,8 @@ trampoline_InstrRuleCallback(VMInstanceRef vm, const InstAnalysis *analysis,
     std::cerr << "Error during InstrRuleCallback : " << e.what() << std::endl;
     exit(1);
   }
-  std::vector<InstrRuleDataCBK> res;
   if (resCB.size() == 0) {
-    return res;
+    return;
   }
   if (InstrumentInstCallbackMap.count(cbk->id) == 0) {
     InstrumentInstCallbackMap[cbk->id] =
@@ -127,12 +149,10 @@ trampoline_InstrRuleCallback(VMInstanceRef vm, const InstAnalysis *analysis,
     std::unique_ptr<TrampData<PyInstCallback>> data{
         new TrampData<PyInstCallback>(cb.cbk, cb.data)};
     data->id = cbk->id;
-    res.emplace_back(cb.position, trampoline_InstCallback,
-                     static_cast<void *>(data.get()), cb.priority);
+    res->emplace_back(cb.position, trampoline_InstCallback,
+                      static_cast<void *>(data.get()), cb.priority);
     vec.push_back(std::move(data));
   }
-
-  return res;
 }
 
 void init_binding_VM(py::module_ &m) {
@@ -140,6 +160,398 @@ void init_binding_VM(py::module_ &m) {
   py::module_ atexit = py::module_::import("atexit");
   atexit.attr("register")(std::function<void()>(clearTrampDataMap));
 
+  py::class_<CacheStats>(m, "CacheStats")
+      .def_readonly("regionCount", &CacheStats::regionCount,
+                    "Number of regions of the cache")
+      .def_readonly("execBlockCount", &CacheStats::execBlockCount,
+                    "Number of ExecBlocks of the regions")
+      .def_readonly("sequenceCount", &CacheStats::sequenceCount,
+                    "Number of sequences of the ExecBlocks")
+      .def_readonly("codeSize", &CacheStats::codeSize,
+                    "Bytes of code blocks mapped")
+      .def_readonly("dataSize", &CacheStats::dataSize,
+                    "Bytes of data blocks mapped")
+      .def_readonly("usedCodeSize", &CacheStats::usedCodeSize,
+                    "Bytes of code written in the code blocks")
+      .def_readonly("shadowSize", &CacheStats::shadowSize,
+                    "Bytes of the data blocks available for the shadows")
+      .def_readonly("usedShadowSize", &CacheStats::usedShadowSize,
+                    "Bytes of shadows allocated in the data blocks")
+      .def_readonly("shadowFullCount", &CacheStats::shadowFullCount,
+                    "Number of ExecBlocks filled by their shadows since the "
+                    "creation of the VM")
+      .def_readonly("translatedSize", &CacheStats::translatedSize,
+                    "Bytes of original code translated since the creation of "
+                    "the VM")
+      .def_readonly("translationSize", &CacheStats::translationSize,
+                    "Bytes of code generated since the creation of the VM")
+      .def_readonly("optimizedSize", &CacheStats::optimizedSize,
+                    "Bytes of code removed by the optimization of the patches "
+                    "since the creation of the VM")
+      .def_readonly("cacheHits", &CacheStats::cacheHits,
+                    "Number of sequences found in the cache")
+      .def_readonly("cacheMisses", &CacheStats::cacheMisses,
+                    "Number of addresses not found in the cache")
+      .def_readonly("splitCount", &CacheStats::splitCount,
+                    "Number of lookups which entered an existing sequence in "
+                    "its middle")
+      .def_readonly("flushCount", &CacheStats::flushCount,
+                    "Number of flushes of the cache")
+      .def_readonly("evictionCount", &CacheStats::evictionCount,
+                    "Number of regions evicted by the cache limit")
+      .def_readonly("retranslationCount", &CacheStats::retranslationCount,
+                    "Number of basic blocks translated again after an "
+                    "eviction")
+      .def_readonly("ibtcHits", &CacheStats::ibtcHits,
+                    "Hits of the indirect branch cache of the current "
+                    "ExecBlocks")
+      .def_readonly("ibtcMisses", &CacheStats::ibtcMisses,
+                    "Misses of the indirect branch cache of the current "
+                    "ExecBlocks")
+      .def_readonly("occupationRatio", &CacheStats::occupationRatio,
+                    "Ratio of the code blocks written")
+      .def_readonly("shadowRatio", &CacheStats::shadowRatio,
+                    "Ratio of the shadows of the data blocks allocated")
+      .def_readonly("expansionRatio", &CacheStats::expansionRatio,
+                    "Ratio between the generated code size and the "
+                    "translated code size");
+
+  py::class_<MemoryStats>(m, "MemoryStats")
+      .def_readonly("codeSize", &MemoryStats::codeSize,
+                    "Bytes of code blocks mapped")
+      .def_readonly("dataSize", &MemoryStats::dataSize,
+                    "Bytes of data blocks mapped")
+      .def_readonly("metadataSize", &MemoryStats::metadataSize,
+                    "Bytes of the metadata of the instructions and the "
+                    "sequences of the ExecBlocks")
+      .def_readonly("analysisSize", &MemoryStats::analysisSize,
+                    "Bytes of the InstAnalysis cached by the ExecBlocks")
+      .def_readonly("regionMapSize", &MemoryStats::regionMapSize,
+                    "Bytes of the regions and their address maps")
+      .def_readonly("callbackSize", &MemoryStats::callbackSize,
+                    "Bytes of the callbacks of the InstrRules kept by the "
+                    "regions")
+      .def_readonly("totalSize", &MemoryStats::totalSize,
+                    "Sum of the previous sizes")
+      .def_readonly("instCount", &MemoryStats::instCount,
+                    "Number of instructions in the cache");
+
+  py::class_<TransferStats>(m, "TransferStats")
+      .def_readonly("target", &TransferStats::target,
+                    "Address of the native code called by the transfers")
+      .def_readonly("count", &TransferStats::count,
+                    "Number of transfers to the target")
+      .def_readonly("cycles", &TransferStats::cycles,
+                    "Cycles spent in the native code of the transfers");
+
+  py::class_<ExecStats>(m, "ExecStats")
+      .def_readonly("dispatchCount", &ExecStats::dispatchCount,
+                    "Number of sequences dispatched by the VM")
+      .def_readonly("hostExitCount", &ExecStats::hostExitCount,
+                    "Number of returns of the generated code to the VM")
+      .def_readonly("sequenceExitCount", &ExecStats::sequenceExitCount,
+                    "Returns at the end of a sequence")
+      .def_readonly("callbackContinue", &ExecStats::callbackContinue,
+                    "Returns for a callback which returned CONTINUE")
+      .def_readonly("callbackSkipInst", &ExecStats::callbackSkipInst,
+                    "Returns for a callback which returned SKIP_INST")
+      .def_readonly("callbackSkipPatch", &ExecStats::callbackSkipPatch,
+                    "Returns for a callback which returned SKIP_PATCH")
+      .def_readonly("callbackBreakToVM", &ExecStats::callbackBreakToVM,
+                    "Returns for a callback which returned BREAK_TO_VM")
+      .def_readonly("callbackStop", &ExecStats::callbackStop,
+                    "Returns for a callback which returned STOP")
+      .def_readonly("breakToVMCount", &ExecStats::breakToVMCount,
+                    "Dispatches done again after a BREAK_TO_VM of a callback "
+                    "or an event")
+      .def_readonly("transferCount", &ExecStats::transferCount,
+                    "Transfers of the ExecBroker to the native code")
+      .def_readonly("cacheMisses", &ExecStats::cacheMisses,
+                    "Addresses not found in the cache")
+      .def_readonly("splitCount", &ExecStats::splitCount,
+                    "Lookups which entered an existing sequence in its "
+                    "middle");
+
+  py::enum_<HardwareEvent>(m, "HardwareEvent",
+                           "Hardware event sampled by the hardware sampling.")
+      .value("SAMPLE_CYCLES", HardwareEvent::SAMPLE_CYCLES, "CPU cycles")
+      .value("SAMPLE_INSTRUCTIONS", HardwareEvent::SAMPLE_INSTRUCTIONS,
+             "Retired instructions")
+      .value("SAMPLE_CACHE_MISSES", HardwareEvent::SAMPLE_CACHE_MISSES,
+             "Last level cache misses")
+      .value("SAMPLE_BRANCH_MISSES", HardwareEvent::SAMPLE_BRANCH_MISSES,
+             "Mispredicted branches")
+      .export_values();
+
+  py::class_<HardwareSample>(m, "HardwareSample")
+      .def_readonly("address", &HardwareSample::address,
+                    "Address of the original instruction, 0 for the samples "
+                    "outside of the ExecBlocks")
+      .def_readonly("samples", &HardwareSample::samples,
+                    "Number of samples of the instruction")
+      .def_property_readonly(
+          "symbol",
+          [](const HardwareSample &obj) -> py::object {
+            if (obj.symbol == nullptr) {
+              return py::none();
+            }
+            return py::cast(obj.symbol);
+          },
+          "Nearest symbol before the address (may be None)")
+      .def_readonly("symbolOffset", &HardwareSample::symbolOffset,
+                    "Offset of the address in the symbol")
+      .def_property_readonly(
+          "module",
+          [](const HardwareSample &obj) -> py::object {
+            if (obj.module == nullptr) {
+              return py::none();
+            }
+            return py::cast(obj.module);
+          },
+          "Module of the address (may be None)");
+
+  py::class_<InstrRuleStats>(m, "InstrRuleStats")
+      .def_readonly("id", &InstrRuleStats::id, "Id of the InstrRule")
+      .def_readonly("instrumentCount", &InstrRuleStats::instrumentCount,
+                    "Number of instructions instrumented by the rule")
+      .def_readonly("instCount", &InstrRuleStats::instCount,
+                    "Number of instructions generated by the rule")
+      .def_readonly("codeSize", &InstrRuleStats::codeSize,
+                    "Estimated bytes of code written for the rule")
+      .def_readonly("shadowCount", &InstrRuleStats::shadowCount,
+                    "Number of shadows allocated by the generated "
+                    "instructions")
+      .def_readonly("callbackCount", &InstrRuleStats::callbackCount,
+                    "Number of calls of the callbacks of the rule")
+      .def_readonly("callbackCycles", &InstrRuleStats::callbackCycles,
+                    "Cycles spent in the callbacks of the rule");
+
+  py::class_<SequenceStats>(m, "SequenceStats")
+      .def_readonly("address", &SequenceStats::address,
+                    "Address of the first instruction of the sequence")
+      .def_readonly("instCount", &SequenceStats::instCount,
+                    "Number of instructions of the sequence")
+      .def_readonly("executions", &SequenceStats::executions,
+                    "Number of executions of the sequence")
+      .def_property_readonly(
+          "symbol",
+          [](const SequenceStats &obj) -> py::object {
+            if (obj.symbol == nullptr) {
+              return py::none();
+            }
+            return py::cast(obj.symbol);
+          },
+          "Nearest symbol before the address (may be None)")
+      .def_readonly("symbolOffset", &SequenceStats::symbolOffset,
+                    "Offset of the address in the symbol")
+      .def_property_readonly(
+          "module",
+          [](const SequenceStats &obj) -> py::object {
+            if (obj.module == nullptr) {
+              return py::none();
+            }
+            return py::cast(obj.module);
+          },
+          "Module of the address (may be None)");
+
+  py::class_<BranchStats>(m, "BranchStats")
+      .def_readonly("address", &BranchStats::address,
+                    "Address of the conditional branch")
+      .def_readonly("target", &BranchStats::target,
+                    "Address of the branch target")
+      .def_readonly("taken", &BranchStats::taken,
+                    "Number of executions which jumped to the target")
+      .def_readonly("notTaken", &BranchStats::notTaken,
+                    "Number of executions which fell through")
+      .def_property_readonly(
+          "symbol",
+          [](const BranchStats &obj) -> py::object {
+            if (obj.symbol == nullptr) {
+              return py::none();
+            }
+            return py::cast(obj.symbol);
+          },
+          "Nearest symbol before the address (may be None)")
+      .def_readonly("symbolOffset", &BranchStats::symbolOffset,
+                    "Offset of the address in the symbol")
+      .def_property_readonly(
+          "module",
+          [](const BranchStats &obj) -> py::object {
+            if (obj.module == nullptr) {
+              return py::none();
+            }
+            return py::cast(obj.module);
+          },
+          "Module of the address (may be None)");
+
+  py::class_<IndirectTargetStats>(m, "IndirectTargetStats")
+      .def_readonly("address", &IndirectTargetStats::address,
+                    "Address of the indirect call or jump")
+      .def_readonly("target", &IndirectTargetStats::target,
+                    "Address of the target, 0 for the targets beyond the "
+                    "table of the site")
+      .def_readonly("count", &IndirectTargetStats::count,
+                    "Number of executions to the target")
+      .def_property_readonly(
+          "symbol",
+          [](const IndirectTargetStats &obj) -> py::object {
+            if (obj.symbol == nullptr) {
+              return py::none();
+            }
+            return py::cast(obj.symbol);
+          },
+          "Nearest symbol before the address (may be None)")
+      .def_readonly("symbolOffset", &IndirectTargetStats::symbolOffset,
+                    "Offset of the address in the symbol")
+      .def_property_readonly(
+          "module",
+          [](const IndirectTargetStats &obj) -> py::object {
+            if (obj.module == nullptr) {
+              return py::none();
+            }
+            return py::cast(obj.module);
+          },
+          "Module of the address (may be None)")
+      .def_property_readonly(
+          "targetSymbol",
+          [](const IndirectTargetStats &obj) -> py::object {
+            if (obj.targetSymbol == nullptr) {
+              return py::none();
+            }
+            return py::cast(obj.targetSymbol);
+          },
+          "Nearest symbol before the target (may be None)")
+      .def_readonly("targetSymbolOffset",
+                    &IndirectTargetStats::targetSymbolOffset,
+                    "Offset of the target in its symbol");
+
+  py::class_<ValueStats>(m, "ValueStats")
+      .def_readonly("address", &ValueStats::address,
+                    "Address of the profiled instruction")
+      .def_readonly("reg", &ValueStats::reg,
+                    "Index of the register in the GPRState")
+      .def_property_readonly(
+          "others", [](const ValueStats &obj) { return obj.others != 0; },
+          "True for the values beyond the table of the site")
+      .def_readonly("value", &ValueStats::value,
+                    "Value of the register (0 for the other values)")
+      .def_readonly("count", &ValueStats::count,
+                    "Number of executions with the value");
+
+  py::class_<CallGraphEdgeStats>(m, "CallGraphEdgeStats")
+      .def_readonly("address", &CallGraphEdgeStats::address,
+                    "Address of the call instruction")
+      .def_readonly("target", &CallGraphEdgeStats::target,
+                    "Address of the callee, 0 for the callees beyond the "
+                    "table of an indirect call")
+      .def_readonly("count", &CallGraphEdgeStats::count, "Number of calls")
+      .def_readonly("inclusive", &CallGraphEdgeStats::inclusive,
+                    "Number of instrumented instructions executed between "
+                    "the calls and their returns")
+      .def_property_readonly(
+          "symbol",
+          [](const CallGraphEdgeStats &obj) -> py::object {
+            if (obj.symbol == nullptr) {
+              return py::none();
+            }
+            return py::cast(obj.symbol);
+          },
+          "Nearest symbol before the call (may be None)")
+      .def_readonly("symbolOffset", &CallGraphEdgeStats::symbolOffset,
+                    "Offset of the call in the symbol")
+      .def_property_readonly(
+          "module",
+          [](const CallGraphEdgeStats &obj) -> py::object {
+            if (obj.module == nullptr) {
+              return py::none();
+            }
+            return py::cast(obj.module);
+          },
+          "Module of the call (may be None)")
+      .def_property_readonly(
+          "targetSymbol",
+          [](const CallGraphEdgeStats &obj) -> py::object {
+            if (obj.targetSymbol == nullptr) {
+              return py::none();
+            }
+            return py::cast(obj.targetSymbol);
+          },
+          "Nearest symbol before the callee (may be None)")
+      .def_readonly("targetSymbolOffset",
+                    &CallGraphEdgeStats::targetSymbolOffset,
+                    "Offset of the callee in its symbol");
+
+  py::class_<AllocationStats>(m, "AllocationStats")
+      .def_readonly("mallocCount", &AllocationStats::mallocCount,
+                    "Number of calls to malloc")
+      .def_readonly("callocCount", &AllocationStats::callocCount,
+                    "Number of calls to calloc")
+      .def_readonly("reallocCount", &AllocationStats::reallocCount,
+                    "Number of calls to realloc")
+      .def_readonly("freeCount", &AllocationStats::freeCount,
+                    "Number of calls to free")
+      .def_readonly("newCount", &AllocationStats::newCount,
+                    "Number of calls to operator new and new[]")
+      .def_readonly("deleteCount", &AllocationStats::deleteCount,
+                    "Number of calls to operator delete and delete[]")
+      .def_readonly("allocatedBytes", &AllocationStats::allocatedBytes,
+                    "Bytes requested by the allocations")
+      .def_property_readonly(
+          "sizeClasses",
+          [](const AllocationStats &obj) {
+            return std::vector<uint64_t>(std::begin(obj.sizeClasses),
+                                         std::end(obj.sizeClasses));
+          },
+          "Number of allocations by size class, the class i counts the "
+          "sizes in [2^(i-1), 2^i)");
+
+  py::class_<AllocationSite>(m, "AllocationSite")
+      .def_property_readonly(
+          "frames",
+          [](const AllocationSite &obj) {
+            std::vector<rword> frames;
+            for (rword frame : obj.frames) {
+              if (frame == 0) {
+                break;
+              }
+              frames.push_back(frame);
+            }
+            return frames;
+          },
+          "Return addresses, from the allocator to its callers")
+      .def_readonly("samples", &AllocationSite::samples,
+                    "Number of allocations sampled with the stack")
+      .def_readonly("sampledBytes", &AllocationSite::sampledBytes,
+                    "Bytes requested by the sampled allocations");
+
+  py::class_<PageAccessStats>(m, "PageAccessStats")
+      .def_readonly("page", &PageAccessStats::page,
+                    "Address of the page (aligned on 4KiB)")
+      .def_readonly("count", &PageAccessStats::count,
+                    "Number of memory accesses which start in the page");
+
+  py::class_<ProfilePhase>(m, "ProfilePhase")
+      .def_readonly("cycles", &ProfilePhase::cycles,
+                    "Cycles spent in the phase, including the nested phases")
+      .def_readonly("count", &ProfilePhase::count,
+                    "Number of times the phase was entered")
+      .def_readonly("bytes", &ProfilePhase::bytes,
+                    "Bytes read or written by the phase, if any");
+
+  py::class_<TranslationProfile>(m, "TranslationProfile")
+      .def_readonly("disassembly", &TranslationProfile::disassembly,
+                    "Disassembly of the original instructions")
+      .def_readonly("patchRules", &TranslationProfile::patchRules,
+                    "Generation of the patches by the PatchRules")
+      .def_readonly("instrRules", &TranslationProfile::instrRules,
+                    "Application of the InstrRules")
+      .def_readonly("tempManager", &TranslationProfile::tempManager,
+                    "Allocation of the temporary registers")
+      .def_readonly("encoding", &TranslationProfile::encoding,
+                    "Encoding of the generated instructions")
+      .def_readonly("writeSequence", &TranslationProfile::writeSequence,
+                    "Writing of the sequences in the ExecBlocks");
+
   py::class_<VM>(m, "VM")
       .def(py::init<const std::string &, const std::vector<std::string> &,
                     Options>(),
@@ -148,6 +560,19 @@ void init_binding_VM(py::module_ &m) {
            "options"_a = NO_OPT)
       .def_property("options", &VM::getOptions, &VM::setOptions,
                     "Options of the VM")
+      .def(
+          "getExecBlockSize",
+          [](const VM &vm) {
+            uint32_t codeSize, dataSize;
+            vm.getExecBlockSize(&codeSize, &dataSize);
+            return std::make_tuple(codeSize, dataSize);
+          },
+          "Get the size of the code and data blocks used to store the "
+          "instrumented code.")
+      .def("setExecBlockSize", &VM::setExecBlockSize,
+           "Set the size of the code and data blocks used to store the "
+           "instrumented code.",
+           "codeSize"_a, "dataSize"_a)
       .def("getGPRState", &VM::getGPRState,
            py::return_value_policy::reference_internal,
            "Obtain the current general purpose register state.")
@@ -186,8 +611,26 @@ void init_binding_VM(py::module_ &m) {
            "addr"_a)
       .def("removeAllInstrumentedRanges", &VM::removeAllInstrumentedRanges,
            "Remove all instrumented ranges.")
+      .def("setModuleTracking", &VM::setModuleTracking,
+           "Track the modules loaded and unloaded by the process during the "
+           "execution.",
+           "tracking"_a)
+      .def("getModuleTracking", &VM::getModuleTracking,
+           "Get the policy of the tracking of the modules.")
       .def("run", &VM::run, "Start the execution by the DBI.", "start"_a,
-           "stop"_a)
+           "stop"_a, py::call_guard<py::gil_scoped_release>())
+      .def("runUntil", &VM::runUntil,
+           "Start the execution by the DBI, until one of the stop addresses "
+           "is reached.",
+           "start"_a, "stops"_a, py::call_guard<py::gil_scoped_release>())
+      .def("runFor", &VM::runFor,
+           "Run a slice of the execution from the current PC, until the stop "
+           "address or the end of the budget of instructions.",
+           "stop"_a, "budget"_a, py::call_guard<py::gil_scoped_release>())
+      .def("step", &VM::step,
+           "Execute the instruction at the current PC and return (need "
+           "OPT_SINGLE_STEP).",
+           py::call_guard<py::gil_scoped_release>())
       .def(
           "call",
           [](VM &vm, rword function, std::vector<rword> &args) {
@@ -196,7 +639,19 @@ void init_binding_VM(py::module_ &m) {
             return std::make_tuple(ret, retvalue);
           },
           "Call a function using the DBI (and its current state).",
-          "function"_a, "args"_a)
+          "function"_a, "args"_a, py::call_guard<py::gil_scoped_release>())
+      .def("setInstructionBudget", &VM::setInstructionBudget,
+           "Limit the number of instructions executed by the next runs "
+           "(0 to disable the budget).",
+           "budget"_a)
+      .def("getInstructionBudget", &VM::getInstructionBudget,
+           "Get the number of instructions left in the budget.")
+      .def("setStopPolling", &VM::setStopPolling,
+           "Enable or disable the test of the stop requests by the generated "
+           "code.",
+           "enable"_a)
+      .def("requestStop", &VM::requestStop,
+           "Request the run to stop at the entry of the next sequence.")
       .def(
           "addInstrRule",
           [](VM &vm, PyInstrRuleCallback &cbk, AnalysisType type,
@@ -283,6 +738,79 @@ void init_binding_VM(py::module_ &m) {
           "Register a callback for when a specific address range is executed.",
           "start"_a, "end"_a, "pos"_a, "cbk"_a, "data"_a,
           "priority"_a = PRIORITY_DEFAULT)
+      .def(
+          "addCodeAddrSetCB",
+          [](VM &vm, const std::vector<rword> &addresses, InstPosition pos,
+             PyInstCallback &cbk, py::object &obj, int priority) {
+            std::unique_ptr<TrampData<PyInstCallback>> data{
+                new TrampData<PyInstCallback>(cbk, obj)};
+            uint32_t n =
+                vm.addCodeAddrSetCB(addresses, pos, &trampoline_InstCallback,
+                                    static_cast<void *>(data.get()), priority);
+            data->id = n;
+            return addTrampData(n, InstCallbackMap, std::move(data));
+          },
+          "Register a callback for when one of the addresses is executed. The "
+          "other instructions don't enter Python.",
+          "addresses"_a, "pos"_a, "cbk"_a, "data"_a,
+          "priority"_a = PRIORITY_DEFAULT)
+      .def(
+          "addMnemonicSetCB",
+          [](VM &vm, const std::vector<std::string> &mnemonics,
+             InstPosition pos, PyInstCallback &cbk, py::object &obj,
+             int priority) {
+            std::vector<py::object> ids;
+            for (const std::string &mnemonic : mnemonics) {
+              std::unique_ptr<TrampData<PyInstCallback>> data{
+                  new TrampData<PyInstCallback>(cbk, obj)};
+              uint32_t n = vm.addMnemonicCB(
+                  mnemonic.c_str(), pos, &trampoline_InstCallback,
+                  static_cast<void *>(data.get()), priority);
+              data->id = n;
+              ids.push_back(addTrampData(n, InstCallbackMap, std::move(data)));
+            }
+            return ids;
+          },
+          "Register a callback event if the instruction matches one of the "
+          "mnemonics. The other instructions don't enter Python. Return the "
+          "list of the ids of the callbacks.",
+          "mnemonics"_a, "pos"_a, "cbk"_a, "data"_a,
+          "priority"_a = PRIORITY_DEFAULT)
+      .def(
+          "addCodeCBIf",
+          [](VM &vm, InstPosition pos, const CallbackPredicate &predicate,
+             PyInstCallback &cbk, py::object &obj, int priority) {
+            std::unique_ptr<TrampData<PyInstCallback>> data{
+                new TrampData<PyInstCallback>(cbk, obj)};
+            uint32_t n = vm.addCodeCBIf(pos, predicate,
+                                        &trampoline_InstCallback,
+                                        static_cast<void *>(data.get()),
+                                        priority);
+            data->id = n;
+            return addTrampData(n, InstCallbackMap, std::move(data));
+          },
+          "Register a callback for every instruction executed, called only if "
+          "the predicate holds. The predicate is evaluated by the "
+          "instrumented code, without entering Python when it doesn't hold.",
+          "pos"_a, "predicate"_a, "cbk"_a, "data"_a,
+          "priority"_a = PRIORITY_DEFAULT)
+      .def(
+          "addCodeRangeCBIf",
+          [](VM &vm, rword start, rword end, InstPosition pos,
+             const CallbackPredicate &predicate, PyInstCallback &cbk,
+             py::object &obj, int priority) {
+            std::unique_ptr<TrampData<PyInstCallback>> data{
+                new TrampData<PyInstCallback>(cbk, obj)};
+            uint32_t n = vm.addCodeRangeCBIf(
+                start, end, pos, predicate, &trampoline_InstCallback,
+                static_cast<void *>(data.get()), priority);
+            data->id = n;
+            return addTrampData(n, InstCallbackMap, std::move(data));
+          },
+          "Register a callback for when a specific address range is executed, "
+          "called only if the predicate holds.",
+          "start"_a, "end"_a, "pos"_a, "predicate"_a, "cbk"_a, "data"_a,
+          "priority"_a = PRIORITY_DEFAULT)
       .def(
           "addMemAccessCB",
           [](VM &vm, MemoryAccessType type, PyInstCallback &cbk,
@@ -298,6 +826,23 @@ void init_binding_VM(py::module_ &m) {
           "Register a callback event for every memory access matching the type "
           "bitfield made by the instructions.",
           "type"_a, "cbk"_a, "data"_a, "priority"_a = PRIORITY_DEFAULT)
+      .def(
+          "addMemAccessCBIf",
+          [](VM &vm, MemoryAccessType type, const CallbackPredicate &predicate,
+             PyInstCallback &cbk, py::object &obj, int priority) {
+            std::unique_ptr<TrampData<PyInstCallback>> data{
+                new TrampData<PyInstCallback>(cbk, obj)};
+            uint32_t n = vm.addMemAccessCBIf(type, predicate,
+                                             &trampoline_InstCallback,
+                                             static_cast<void *>(data.get()),
+                                             priority);
+            data->id = n;
+            return addTrampData(n, InstCallbackMap, std::move(data));
+          },
+          "Register a callback for every memory access matching the type, "
+          "called only if the predicate holds.",
+          "type"_a, "predicate"_a, "cbk"_a, "data"_a,
+          "priority"_a = PRIORITY_DEFAULT)
       .def(
           "addMemAddrCB",
           [](VM &vm, rword address, MemoryAccessType type, PyInstCallback &cbk,
@@ -347,6 +892,8 @@ void init_binding_VM(py::module_ &m) {
           },
           "Register a callback event for a specific VM event.", "mask"_a,
           "cbk"_a, "data"_a)
+      .def("replaceFunction", &VM::replaceFunction,
+           "Replace a function by another one.", "orig"_a, "replacement"_a)
       .def(
           "deleteInstrumentation",
           [](VM &vm, uint32_t id) {
@@ -357,6 +904,9 @@ void init_binding_VM(py::module_ &m) {
             removeTrampData(id, InstrumentInstCallbackMap);
           },
           "Remove an instrumentation.", "id"_a)
+      .def("setInstrumentationEnabled", &VM::setInstrumentationEnabled,
+           "Enable or disable an instrumentation without removing it.",
+           "id"_a, "enable"_a)
       .def(
           "deleteAllInstrumentations",
           [](VM &vm) {
@@ -391,23 +941,268 @@ void init_binding_VM(py::module_ &m) {
                     "AnalysisType.ANALYSIS_INSTRUCTION|AnalysisType.ANALYSIS_"
                     "DISASSEMBLY"),
           py::return_value_policy::copy)
+      .def("getInstHandle", &VM::getInstHandle,
+           "Obtain the handle of the current instruction. The handle resolves "
+           "the analysis of the instruction without searching the cache.")
+      .def("getCachedInstHandle", &VM::getCachedInstHandle,
+           "Obtain the handle of a cached instruction.", "address"_a)
+      .def(
+          "getInstAnalysisByHandle",
+          [](const VM &vm, InstHandle handle, AnalysisType type) {
+            return vm.getInstAnalysisByHandle(handle, type);
+          },
+          "Obtain the analysis of an instruction from its handle. A handle is "
+          "invalidated when the ExecBlock of its instruction is freed.",
+          "handle"_a,
+          py::arg_v("type",
+                    AnalysisType::ANALYSIS_INSTRUCTION |
+                        AnalysisType::ANALYSIS_DISASSEMBLY,
+                    "AnalysisType.ANALYSIS_INSTRUCTION|AnalysisType.ANALYSIS_"
+                    "DISASSEMBLY"),
+          py::return_value_policy::copy)
+      .def(
+          "iterateCache",
+          [](const VM &vm, PyCachedInstCallback &cbk, py::object &obj,
+             AnalysisType type) {
+            TrampData<PyCachedInstCallback> data{cbk, obj};
+            return vm.iterateCache(&trampoline_CachedInstCallback,
+                                   static_cast<void *>(&data), type);
+          },
+          "Call a callback on each instruction of the translation cache with "
+          "its analysis. The order of the sequences is unspecified.",
+          "cbk"_a, "data"_a,
+          py::arg_v("type", AnalysisType::ANALYSIS_INSTRUCTION,
+                    "AnalysisType.ANALYSIS_INSTRUCTION"))
       .def("recordMemoryAccess", &VM::recordMemoryAccess,
            "Add instrumentation rules to log memory access using inline "
            "instrumentation and instruction shadows.",
            "type"_a)
-      .def("getInstMemoryAccess", &VM::getInstMemoryAccess,
+      .def("recordMemoryAccessRange", &VM::recordMemoryAccessRange,
+           "Add instrumentation rules to log the memory accesses of the "
+           "instructions of a range only.",
+           "start"_a, "end"_a, "type"_a)
+      .def(
+          "getInstMemoryAccess",
+          [](const VM &vm) { return vm.getInstMemoryAccess(); },
            "Obtain the memory accesses made by the last executed instruction.",
            py::return_value_policy::copy)
-      .def("getBBMemoryAccess", &VM::getBBMemoryAccess,
+      .def(
+          "getBBMemoryAccess",
+          [](const VM &vm) { return vm.getBBMemoryAccess(); },
            "Obtain the memory accesses made by the last executed sequence.",
            py::return_value_policy::copy)
+      .def(
+          "getInstMemoryAccessArray",
+          [](const VM &vm) {
+            return MemoryAccessArray(vm.getInstMemoryAccess());
+          },
+          "Obtain the memory accesses made by the last executed instruction, "
+          "as a MemoryAccessArray which can be used with numpy without a "
+          "Python object per access.")
+      .def(
+          "getBBMemoryAccessArray",
+          [](const VM &vm) {
+            return MemoryAccessArray(vm.getBBMemoryAccess());
+          },
+          "Obtain the memory accesses made by the last executed sequence, as "
+          "a MemoryAccessArray.")
+      .def(
+          "getMemoryAccessValue",
+          [](const VM &vm, const MemoryAccess &access) -> py::object {
+            std::string value(access.size, '\0');
+            if (not vm.getMemoryAccessValue(access, value.data(),
+                                            value.size())) {
+              return py::none();
+            }
+            return py::bytes(value);
+          },
+          "Obtain the whole value of an access with MEMORY_WIDE_VALUE, as "
+          "bytes (None if it isn't found).",
+          "access"_a)
+      .def("setPageHistogram", &VM::setPageHistogram,
+           "Count the memory accesses by page of 4KiB from the generated "
+           "code.",
+           "enable"_a, "type"_a = MemoryAccessType::MEMORY_READ_WRITE)
+      .def("getPageHistogram", &VM::getPageHistogram,
+           "Get the counters of the accessed pages, sorted by decreasing "
+           "number of accesses (topN=0 for all the pages).",
+           "topN"_a = 0)
+      .def("resetPageHistogram", &VM::resetPageHistogram,
+           "Clear the counters of the page histogram.")
       .def("precacheBasicBlock", &VM::precacheBasicBlock,
            "Pre-cache a known basic block", "pc"_a)
+      .def("precacheBasicBlocks", &VM::precacheBasicBlocks,
+           "Pre-cache a list of known basic blocks in one go", "addresses"_a)
+      .def("precacheRange", &VM::precacheRange,
+           "Pre-cache the code of a range reachable from entry points "
+           "through the direct branches and calls",
+           "start"_a, "end"_a, "entries"_a = std::vector<rword>(),
+           "useSymbols"_a = false)
+      .def("precacheModule", &VM::precacheModule,
+           "Pre-cache the code of a module reachable from entry points and "
+           "its function symbols",
+           "name"_a, "entries"_a = std::vector<rword>(),
+           "useSymbols"_a = true)
+      .def("precacheFrom", &VM::precacheFrom,
+           "Pre-cache the sequences cached by another VM", "vm"_a)
+      .def("saveCacheProfile", &VM::saveCacheProfile,
+           "Write the start addresses of the cached sequences in a file, "
+           "relative to their module",
+           "path"_a)
+      .def("prewarmCache", &VM::prewarmCache,
+           "Pre-cache the sequences recorded by saveCacheProfile", "path"_a)
       .def("clearCache", &VM::clearCache,
            "Clear a specific address range from the translation cache.",
            "start"_a, "end"_a)
       .def("clearAllCache", &VM::clearAllCache,
-           "Clear the entire translation cache.");
+           "Clear the entire translation cache.")
+      .def("sealCache", &VM::sealCache,
+           "Seal the translation cache before the process forks its workers. "
+           "The forked processes share the code of the cached sequences.")
+      .def("getCacheLimit", &VM::getCacheLimit,
+           "Get the memory budget of the translation cache (0 for no limit).")
+      .def("setCacheLimit", &VM::setCacheLimit,
+           "Set the memory budget of the translation cache (0 for no limit).",
+           "limit"_a)
+      .def("getCacheStats", &VM::getCacheStats,
+           "Get the statistics of the translation cache.")
+      .def("getMemoryStats", &VM::getMemoryStats,
+           "Get the memory used by the translation cache, by component.")
+      .def("getTransferStats", &VM::getTransferStats,
+           "Get the statistics of the transfers to the native code, sorted "
+           "by decreasing number of cycles (topN=0 for all the targets).",
+           "topN"_a = 0)
+      .def("setExecStats", &VM::setExecStats,
+           "Count the dispatches of the sequences and the reasons of the "
+           "returns of the generated code to the VM. The counters are reset "
+           "when they are enabled.",
+           "enable"_a)
+      .def("getExecStats", &VM::getExecStats,
+           "Get the execution counters since their last reset.")
+      .def("resetExecStats", &VM::resetExecStats,
+           "Reset the execution counters.")
+      .def("setAutoDemotion", &VM::setAutoDemotion,
+           "Demote automatically to the native execution the functions "
+           "called threshold times without executing an instrumented "
+           "sequence (0 to disable).",
+           "threshold"_a)
+      .def("getDemotedFunctions", &VM::getDemotedFunctions,
+           "Get the entries of the functions demoted by the automatic "
+           "demotion.")
+      .def(
+          "setInstrRuleStats",
+          [](VM &vm, bool enable, py::object reportPath) {
+            if (reportPath.is_none()) {
+              return vm.setInstrRuleStats(enable);
+            }
+            std::string path = reportPath.cast<std::string>();
+            return vm.setInstrRuleStats(enable, path.c_str());
+          },
+          "Attribute the costs of the instrumentation to the InstrRules. The "
+          "statistics sorted by cost are written in reportPath when the VM "
+          "is destroyed.",
+          "enable"_a, "reportPath"_a = py::none())
+      .def("getInstrRuleStats", &VM::getInstrRuleStats,
+           "Get the statistics of the InstrRules, sorted by decreasing cost "
+           "(topN=0 for all the rules).",
+           "topN"_a = 0)
+      .def("resetInstrRuleStats", &VM::resetInstrRuleStats,
+           "Reset the statistics of the InstrRules.")
+      .def(
+          "setSequenceProfile",
+          [](VM &vm, bool enable, py::object reportPath) {
+            if (reportPath.is_none()) {
+              return vm.setSequenceProfile(enable);
+            }
+            std::string path = reportPath.cast<std::string>();
+            return vm.setSequenceProfile(enable, path.c_str());
+          },
+          "Count the executions of each sequence from the generated code. "
+          "The sorted profile is written in reportPath when the VM is "
+          "destroyed.",
+          "enable"_a, "reportPath"_a = py::none())
+      .def("getSequenceProfile", &VM::getSequenceProfile,
+           "Get the execution counters of the sequences, sorted by decreasing "
+           "number of instructions executed (topN=0 for all the sequences).",
+           "topN"_a = 0)
+      .def("resetSequenceProfile", &VM::resetSequenceProfile,
+           "Clear the execution counters of the sequences.")
+      .def("setBranchProfile", &VM::setBranchProfile,
+           "Count the outcomes of the conditional branches from the "
+           "generated code.",
+           "enable"_a)
+      .def("getBranchProfile", &VM::getBranchProfile,
+           "Get the outcome counters of the conditional branches, sorted by "
+           "decreasing number of executions (topN=0 for all the branches).",
+           "topN"_a = 0)
+      .def("resetBranchProfile", &VM::resetBranchProfile,
+           "Clear the outcome counters of the conditional branches.")
+      .def("setIndirectProfile", &VM::setIndirectProfile,
+           "Count the targets of the indirect calls and jumps from the "
+           "generated code.",
+           "enable"_a)
+      .def("getIndirectProfile", &VM::getIndirectProfile,
+           "Get the counters of the targets of the indirect calls and jumps, "
+           "sorted by decreasing number of executions (topN=0 for all the "
+           "targets).",
+           "topN"_a = 0)
+      .def("resetIndirectProfile", &VM::resetIndirectProfile,
+           "Clear the counters of the targets of the indirect calls and "
+           "jumps.")
+      .def("addValueProfile", &VM::addValueProfile,
+           "Count the values of a register before an instruction from the "
+           "generated code.",
+           "address"_a, "reg"_a, "buckets"_a = 4)
+      .def("getValueProfile", &VM::getValueProfile,
+           "Get the values counted by a value profile, sorted by decreasing "
+           "number of executions (topN=0 for all the values).",
+           "id"_a, "topN"_a = 0)
+      .def("resetValueProfile", &VM::resetValueProfile,
+           "Clear the counters of a value profile.", "id"_a)
+      .def("setCallGraphProfile", &VM::setCallGraphProfile,
+           "Record the call graph from the generated code.", "enable"_a)
+      .def("getCallGraphProfile", &VM::getCallGraphProfile,
+           "Get the edges of the call graph, sorted by decreasing number of "
+           "calls (topN=0 for all the edges).",
+           "topN"_a = 0)
+      .def("resetCallGraphProfile", &VM::resetCallGraphProfile,
+           "Clear the counters of the edges of the call graph.")
+      .def(
+          "setAllocationProfile",
+          [](VM &vm, bool enable, uint32_t samplePeriod,
+             py::object reportPath) {
+            if (reportPath.is_none()) {
+              return vm.setAllocationProfile(enable, samplePeriod);
+            }
+            std::string path = reportPath.cast<std::string>();
+            return vm.setAllocationProfile(enable, samplePeriod, path.c_str());
+          },
+          "Count the calls to the allocators with transfer hooks and sample "
+          "the stacks of one allocation in samplePeriod. The profile is "
+          "written in reportPath when the VM is destroyed.",
+          "enable"_a, "samplePeriod"_a = 64, "reportPath"_a = py::none())
+      .def("getAllocationProfile", &VM::getAllocationProfile,
+           "Get the counters of the allocation profile.")
+      .def("getAllocationSites", &VM::getAllocationSites,
+           "Get the stacks sampled by the allocation profile, sorted by "
+           "decreasing sampled bytes (topN=0 for all the stacks).",
+           "topN"_a = 0)
+      .def("resetAllocationProfile", &VM::resetAllocationProfile,
+           "Clear the counters and the stacks of the allocation profile.")
+      .def("setHardwareSampling", &VM::setHardwareSampling,
+           "Sample a hardware event of the thread of the VM during the runs "
+           "(Linux and Android only, period=0 to disable).",
+           "event"_a, "period"_a)
+      .def("getHardwareSamples", &VM::getHardwareSamples,
+           "Get the samples of the hardware event by original instruction, "
+           "sorted by decreasing number of samples (topN=0 for all the "
+           "instructions).",
+           "topN"_a = 0)
+      .def("resetHardwareSamples", &VM::resetHardwareSamples,
+           "Clear the samples of the hardware sampling.")
+      .def("getTranslationProfile", &VM::getTranslationProfile,
+           "Get the cumulative profile of the translation phases (only "
+           "updated when QBDI is compiled with QBDI_PROFILE_TRANSLATION).");
 }
 
 } // namespace pyQBDI
@@ -32,12 +32,85 @@ void init_binding_Options(py::module_ &m) {
       .value("OPT_DISABLE_OPTIONAL_FPR", Options::OPT_DISABLE_OPTIONAL_FPR,
              "Disable context switch optimisation when the target execblock "
              "doesn't used FPR")
+      .value("OPT_ENABLE_BLOCK_CHAINING", Options::OPT_ENABLE_BLOCK_CHAINING,
+             "Link the translated sequences together when the successor is "
+             "already in the cache, without returning to the VM between them")
+      .value("OPT_ENABLE_INDIRECT_CACHE", Options::OPT_ENABLE_INDIRECT_CACHE,
+             "Look up the targets of the indirect branches in a cache of the "
+             "ExecBlock and jump to the translated sequence on a hit")
+      .value("OPT_ENABLE_SHARED_CONTEXT", Options::OPT_ENABLE_SHARED_CONTEXT,
+             "Share the context page between all the ExecBlocks to avoid "
+             "copying the state when the execution moves to another "
+             "ExecBlock (Linux and Android only)")
+      .value("OPT_ENABLE_DUAL_MAPPING", Options::OPT_ENABLE_DUAL_MAPPING,
+             "Map the code of the ExecBlocks twice, a writable and an "
+             "executable alias, to write the code without changing the "
+             "permissions of the pages (Linux and Android only)")
+      .value("OPT_ENABLE_ASYNC_PATCH", Options::OPT_ENABLE_ASYNC_PATCH,
+             "Disassemble and patch the likely successors of the translated "
+             "basic blocks in a worker thread")
+      .value("OPT_ENABLE_SUPERBLOCK", Options::OPT_ENABLE_SUPERBLOCK,
+             "Retranslate the hot sequences as superblocks that follow the "
+             "direct jumps and calls")
+      .value("OPT_ENABLE_MEMACCESS_COALESCING",
+             Options::OPT_ENABLE_MEMACCESS_COALESCING,
+             "Record only the address of the memory accesses and merge the "
+             "adjacent accesses of a sequence relative to the same registers")
+      .value("OPT_ENABLE_MEMCB_PAGE_WATCH",
+             Options::OPT_ENABLE_MEMCB_PAGE_WATCH,
+             "Protect the pages of the ranges of addMemRangeCB and only "
+             "instrument the sequences which access them")
+      .value("OPT_ENABLE_SHARED_ANALYSIS", Options::OPT_ENABLE_SHARED_ANALYSIS,
+             "Share the analyses of the instructions with the other VMs of "
+             "the process which use this option")
+      .value("OPT_BYPASS_PLT", Options::OPT_BYPASS_PLT,
+             "Execute the targets of the PLT stubs without instrumenting the "
+             "stubs")
+      .value("OPT_ENABLE_REENTRY", Options::OPT_ENABLE_REENTRY,
+             "Execute through the VM the instrumented functions called back "
+             "by the non-instrumented functions")
+      .value("OPT_ENABLE_SHARED_PATCHES", Options::OPT_ENABLE_SHARED_PATCHES,
+             "Share the translated basic blocks with the other VMs of the "
+             "process which use the same CPU and options")
+      .value("OPT_ENABLE_LIVENESS", Options::OPT_ENABLE_LIVENESS,
+             "Use the registers and the flags dead in the basic block as "
+             "scratch of the instrumentation. Their value may be wrong in the "
+             "callbacks")
+      .value("OPT_ENABLE_HUGE_PAGES", Options::OPT_ENABLE_HUGE_PAGES,
+             "Put the code and the data of the ExecBlocks in separate areas "
+             "backed by transparent huge pages (Linux and Android only)")
+      .value("OPT_ENABLE_RETURN_STACK", Options::OPT_ENABLE_RETURN_STACK,
+             "Predict the targets of the returns with a shadow stack of the "
+             "calls of the ExecBlock. Used with OPT_ENABLE_INDIRECT_CACHE")
+      .value("OPT_ENABLE_PERF_MAP", Options::OPT_ENABLE_PERF_MAP,
+             "Name the translated code in the perf map of the process "
+             "(/tmp/perf-<pid>.map, Linux and Android only)")
+      .value("OPT_ENABLE_SMC_DETECTION", Options::OPT_ENABLE_SMC_DETECTION,
+             "Protect the writable pages of the translated code against the "
+             "writes and translate again the code of the written pages "
+             "(Linux, Android and macOS only)")
+      .value("OPT_ENABLE_WIDE_MEMACCESS_VALUE",
+             Options::OPT_ENABLE_WIDE_MEMACCESS_VALUE,
+             "Capture the value of the recorded accesses of 16, 32 and 64 "
+             "bytes")
+      .value("OPT_SINGLE_STEP", Options::OPT_SINGLE_STEP,
+             "Translate the instructions in sequences of one instruction, "
+             "executed one at a time by VM.step. The chaining, the "
+             "superblocks and the asynchronous patch are disabled")
+      .value("OPT_ENABLE_NUMA_BINDING", Options::OPT_ENABLE_NUMA_BINDING,
+             "Bind the ExecBlocks and their contexts to the NUMA node of the "
+             "thread which runs the VM, and move them when the VM runs on "
+             "another node (Linux and Android only)")
       .value("OPT_ATT_SYNTAX", Options::OPT_ATT_SYNTAX,
              "Used the AT&T syntax for instruction disassembly")
       .value("OPT_ENABLE_FS_GS", Options::OPT_ENABLE_FS_GS,
              "Enable Backup/Restore of FS/GS segment. This option uses the "
              "instructions (RD|WR)(FS|GS)BASE that must be supported by the "
              "operating system.")
+      .value("OPT_ENABLE_NEAR_EXECBLOCK", Options::OPT_ENABLE_NEAR_EXECBLOCK,
+             "Allocate the ExecBlocks near the instrumented code and access "
+             "the memory relative to RIP without a temporary register when it "
+             "is reachable")
       .export_values()
       .def_invert()
       .def_repr_str();
@@ -110,8 +110,14 @@ void init_binding_State(py::module_ &m) {
             std::string(v).copy(t.reg, sizeof(t.reg), 0);
           });
 
-  py::class_<FPRState>(m, "FPRState")
+  py::class_<FPRState>(m, "FPRState", py::buffer_protocol())
       .def(py::init<>())
+      // bytes of the state, without a copy
+      .def_buffer([](FPRState &s) {
+        return py::buffer_info(&s, sizeof(uint8_t),
+                               py::format_descriptor<uint8_t>::format(), 1,
+                               {sizeof(FPRState)}, {sizeof(uint8_t)});
+      })
       .def_readwrite("fcw", &FPRState::fcw, "x87 FPU control word")
       .def_readwrite("rfcw", &FPRState::rfcw, "x87 FPU control word")
       .def_readwrite("fsw", &FPRState::fsw, "x87 FPU status word")
@@ -495,8 +501,15 @@ void init_binding_State(py::module_ &m) {
   m.attr("REG_LR") = py::none();
   m.attr("REG_FLAG") = REG_FLAG;
 
-  py::class_<GPRState>(m, "GPRState")
+  py::class_<GPRState>(m, "GPRState", py::buffer_protocol())
       .def(py::init<>())
+      // array of the registers in the order of GPRState, without a copy
+      .def_buffer([](GPRState &s) {
+        return py::buffer_info(&s, sizeof(rword),
+                               py::format_descriptor<rword>::format(), 1,
+                               {sizeof(GPRState) / sizeof(rword)},
+                               {sizeof(rword)});
+      })
       .def_readwrite("rax", &GPRState::rax)
       .def_readwrite("rbx", &GPRState::rbx)
       .def_readwrite("rcx", &GPRState::rcx)
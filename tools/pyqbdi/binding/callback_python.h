@@ -43,6 +43,10 @@ struct InstrRuleDataCBKPython {
 using PyInstrRuleCallback = std::function<std::vector<InstrRuleDataCBKPython>(
     VMInstanceRef, const InstAnalysis *, py::object &)>;
 
+using PyCachedInstCallback =
+    std::function<VMAction(VMInstanceRef, const CachedInstLocation *,
+                           const InstAnalysis *, py::object &)>;
+
 } // namespace pyQBDI
 } // namespace QBDI
 
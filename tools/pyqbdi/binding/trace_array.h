@@ -0,0 +1,66 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2022 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef TRACE_ARRAY_H_
+#define TRACE_ARRAY_H_
+
+#include <string>
+#include <vector>
+
+#include "pyqbdi.hpp"
+
+namespace QBDI {
+namespace pyQBDI {
+
+// Memory accesses exposed with the buffer protocol, as an array of
+// MemoryTraceEntry
+struct MemoryAccessArray {
+  std::vector<MemoryTraceEntry> entries;
+
+  MemoryAccessArray(std::vector<MemoryTraceEntry> &&entries)
+      : entries(std::move(entries)) {}
+
+  MemoryAccessArray(const std::vector<MemoryAccess> &accesses) {
+    entries.reserve(accesses.size());
+    for (const MemoryAccess &a : accesses) {
+      entries.push_back({a.instAddress, a.accessAddress, a.value, a.size,
+                         static_cast<uint16_t>(a.type),
+                         static_cast<uint16_t>(a.flags), 0});
+    }
+  }
+};
+
+// Addresses exposed with the buffer protocol, as an array of rword with
+// a row of columns elements by entry
+struct AddressArray {
+  std::vector<rword> values;
+  size_t columns;
+
+  AddressArray(std::vector<rword> &&values, size_t columns = 1)
+      : values(std::move(values)), columns(columns) {}
+};
+
+inline std::string memoryTraceEntryFormat() {
+  const std::string r = py::format_descriptor<rword>::format();
+  return "T{" + r + ":instAddress:" + r + ":accessAddress:" + r +
+         ":value:H:size:H:type:H:flags:H:reserved:}";
+}
+
+} // namespace pyQBDI
+} // namespace QBDI
+
+#endif /* TRACE_ARRAY_H_ */
@@ -49,6 +49,7 @@ void init_binding_Memory(py::module_ &m);
 void init_binding_Options(py::module_ &m);
 void init_binding_Range(py::module_ &m);
 void init_binding_State(py::module_ &m);
+void init_binding_Trace(py::module_ &m);
 void init_binding_VM(py::module_ &m);
 
 void init_utils_Memory(py::module_ &m);
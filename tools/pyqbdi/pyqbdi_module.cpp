@@ -40,6 +40,7 @@ PYBIND11_MODULE(pyqbdi, m) {
   init_binding_VM(m);
   init_binding_Logs(m);
   init_binding_Errors(m);
+  init_binding_Trace(m);
 
   init_utils_Float(m);
   init_utils_Memory(m);
@@ -0,0 +1,152 @@
+#!/usr/bin/env python3
+
+# This file is part of pyQBDI (python binding for QBDI).
+#
+# Copyright 2017 - 2022 Quarkslab
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+
+import ctypes
+import mmap
+import platform
+import sys
+import unittest
+
+import pyqbdi
+
+# sum(uint64_t *values, size_t n): add the n values, store the sum after them
+# and return it.
+#   0: xor eax, eax
+#   2: add rax, [rdi]
+#   5: add rdi, 8
+#   9: dec rsi
+#   c: jne 2
+#   e: mov [rdi], rax
+#  11: ret
+SUM_CODE = bytes.fromhex("31c0480307" "4883c708" "48ffce" "75f4" "488907" "c3")
+SUM_LOOP = [0x2, 0x5, 0x9, 0xc]
+SUM_VALUES = [3, 5, 7, 11, 13]
+
+STACK_SIZE = 0x100000
+FAKE_RET = 0x42424242
+
+
+@unittest.skipUnless(platform.machine().lower() in ('x86_64', 'amd64') and
+                     sys.platform in ('linux', 'darwin'),
+                     "the target is written for the System V x86_64 ABI")
+class TraceCollectorTest(unittest.TestCase):
+
+    def setUp(self):
+        self.code = mmap.mmap(-1, mmap.PAGESIZE,
+                              prot=mmap.PROT_READ | mmap.PROT_WRITE |
+                              mmap.PROT_EXEC)
+        self.code.write(SUM_CODE)
+        self.codeAddr = ctypes.addressof(ctypes.c_char.from_buffer(self.code))
+        self.values = (ctypes.c_uint64 * (len(SUM_VALUES) + 1))(*SUM_VALUES)
+        self.valuesAddr = ctypes.addressof(self.values)
+
+        self.vm = pyqbdi.VM()
+        self.vm.addInstrumentedRange(self.codeAddr,
+                                     self.codeAddr + len(SUM_CODE))
+        self.stack = pyqbdi.allocateVirtualStack(self.vm.getGPRState(),
+                                                 STACK_SIZE)
+        self.assertIsNotNone(self.stack)
+
+    def tearDown(self):
+        del self.vm
+        pyqbdi.alignedFree(self.stack)
+
+    def run_sum(self):
+        state = self.vm.getGPRState()
+        pyqbdi.simulateCall(state, FAKE_RET,
+                            [self.valuesAddr, len(SUM_VALUES)])
+        self.assertTrue(self.vm.run(self.codeAddr, FAKE_RET))
+        self.assertEqual(self.vm.getGPRState().rax, sum(SUM_VALUES))
+
+    def expected_instructions(self):
+        offsets = [0x0] + SUM_LOOP * len(SUM_VALUES) + [0xe, 0x11]
+        return [self.codeAddr + o for o in offsets]
+
+    def expected_accesses(self):
+        # the reads of the values, then the write of the sum
+        res = []
+        for i, v in enumerate(SUM_VALUES):
+            res.append((self.codeAddr + 0x2, self.valuesAddr + 8 * i, v, 8,
+                        pyqbdi.MEMORY_READ))
+        res.append((self.codeAddr + 0xe, self.valuesAddr + 8 * len(SUM_VALUES),
+                    sum(SUM_VALUES), 8, pyqbdi.MEMORY_WRITE))
+        return res
+
+    def check_trace(self, sequences, instructions, accesses):
+        self.assertEqual(instructions, self.expected_instructions())
+
+        # the entries of the loop and of its exit, in the sum function
+        self.assertGreaterEqual(len(sequences), 2)
+        self.assertEqual(sequences[0][0], self.codeAddr)
+        for start, end in sequences:
+            self.assertGreaterEqual(start, self.codeAddr)
+            self.assertLess(start, self.codeAddr + len(SUM_CODE))
+            self.assertGreater(end, start)
+
+        # the return address is read from the stack by the ret
+        values = [a for a in accesses
+                  if self.valuesAddr <= a[1] < self.valuesAddr +
+                  ctypes.sizeof(self.values)]
+        self.assertEqual(values, self.expected_accesses())
+
+    @staticmethod
+    def to_list(sequences, instructions, accesses):
+        return (memoryview(sequences).tolist(),
+                memoryview(instructions).tolist(),
+                [(a.instAddress, a.accessAddress, a.value, a.size, a.type)
+                 for a in (accesses[i] for i in range(len(accesses)))])
+
+    def test_whole_run(self):
+        collector = pyqbdi.TraceCollector()
+        ids = collector.attach(self.vm, sequences=True, instructions=True)
+        self.assertEqual(len(ids), 2)
+        self.run_sum()
+
+        self.assertGreater(len(collector), 0)
+        sequences, instructions, accesses = self.to_list(
+            collector.takeSequences(), collector.takeInstructions(),
+            collector.takeMemoryAccesses())
+        self.assertEqual(len(collector), 0)
+        self.check_trace(sequences, instructions, accesses)
+
+    def test_chunk_run(self):
+        # the chunks are given during vm.run, with the GIL released
+        chunks = []
+
+        def onChunk(sequences, instructions, accesses):
+            chunks.append(self.to_list(sequences, instructions, accesses))
+
+        collector = pyqbdi.TraceCollector(4, onChunk)
+        collector.attach(self.vm, sequences=True, instructions=True)
+        self.run_sum()
+
+        self.assertGreater(len(chunks), 1)
+        for chunk in chunks:
+            self.assertGreaterEqual(
+                len(chunk[0]) + len(chunk[1]) + len(chunk[2]), 4)
+        # the events left after the last chunk are taken at the end
+        self.assertLess(len(collector), 4)
+        chunks.append(self.to_list(collector.takeSequences(),
+                                   collector.takeInstructions(),
+                                   collector.takeMemoryAccesses()))
+        self.check_trace(*(sum((c[i] for c in chunks), []) for i in range(3)))
+
+
+if __name__ == '__main__':
+    unittest.main()
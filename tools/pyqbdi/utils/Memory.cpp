@@ -16,7 +16,12 @@
  * limitations under the License.
  */
 
+#include <string.h>
+#include <utility>
+#include <vector>
+
 #include "pyqbdi.hpp"
+#include "trace_array.h"
 
 namespace QBDI {
 namespace pyQBDI {
@@ -58,6 +63,82 @@ void init_utils_Memory(py::module_ &m) {
             )doc",
       "address"_a);
 
+  m.def(
+      "readMemoryBatch",
+      [](const std::vector<std::pair<QBDI::rword, QBDI::rword>> &ranges,
+         py::object buffer) {
+        size_t total = 0;
+        for (const auto &r : ranges) {
+          total += r.second;
+        }
+        if (buffer.is_none()) {
+          buffer = py::bytearray(nullptr, total);
+        }
+        py::buffer_info info = py::buffer(buffer).request(true);
+        if (static_cast<size_t>(info.size * info.itemsize) < total) {
+          throw py::value_error("The buffer is too small");
+        }
+        char *dst = static_cast<char *>(info.ptr);
+        for (const auto &r : ranges) {
+          memcpy(dst, reinterpret_cast<const void *>(r.first), r.second);
+          dst += r.second;
+        }
+        return buffer;
+      },
+      R"doc(
+            Read many contents in one call. The contents are concatenated in
+            a single buffer.
+
+            :param ranges: List of (address, size)
+            :param buffer: Writable buffer (bytearray, memoryview, ...) which
+                           receives the contents. A bytearray is allocated if
+                           None.
+
+            :returns: The buffer.
+
+            .. warning::
+                This API is hazardous as the whole process memory can be read.
+            )doc",
+      "ranges"_a, "buffer"_a = py::none());
+
+  m.def(
+      "readRwordArray",
+      [](QBDI::rword address, QBDI::rword count) {
+        const QBDI::rword *src = reinterpret_cast<const QBDI::rword *>(address);
+        return AddressArray(std::vector<QBDI::rword>(src, src + count));
+      },
+      R"doc(
+            Read an array of rword.
+
+            :param address: Base address
+            :param count: Number of rword
+
+            :returns: An AddressArray, with the buffer protocol.
+
+            .. warning::
+                This API is hazardous as the whole process memory can be read.
+            )doc",
+      "address"_a, "count"_a);
+
+  m.def(
+      "readCString",
+      [](QBDI::rword address, QBDI::rword maxLength) {
+        const char *src = reinterpret_cast<const char *>(address);
+        return py::bytes(src, strnlen(src, maxLength));
+      },
+      R"doc(
+            Read a null terminated string.
+
+            :param address: Base address
+            :param maxLength: Maximum length of the string
+
+            :returns: Bytes of the string, without the null byte.
+
+            .. warning::
+                This API is hazardous as the whole process memory can be read.
+            )doc",
+      "address"_a, "maxLength"_a = 4096);
+
   m.def(
       "writeMemory",
       [](QBDI::rword address, std::string bytes) {
@@ -74,6 +155,26 @@ void init_utils_Memory(py::module_ &m) {
             )doc",
       "address"_a, "bytes"_a);
 
+  m.def(
+      "writeMemoryBatch",
+      [](const std::vector<std::pair<QBDI::rword, py::buffer>> &contents) {
+        for (const auto &c : contents) {
+          py::buffer_info info = c.second.request();
+          memcpy(reinterpret_cast<void *>(c.first), info.ptr,
+                 info.size * info.itemsize);
+        }
+      },
+      R"doc(
+            Write many memory contents in one call, without a copy of the
+            contents.
+
+            :param contents: List of (address, buffer)
+
+            .. warning::
+                This API is hazardous as the whole process memory can be written.
+            )doc",
+      "contents"_a);
+
   m.def(
       "writeRword",
       [](QBDI::rword address, QBDI::rword value) {
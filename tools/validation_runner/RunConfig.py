@@ -31,12 +31,19 @@ class TestConfig:
             self.arguments = conf['arguments']
         else:
             self.arguments = []
+        # Number of shards validated concurrently, each of shard_size
+        # instructions (the last one validates the rest of the execution)
+        self.shards = int(conf.get('shards', 1))
+        assert self.shards > 0
+        self.shard_size = int(conf.get('shard_size', 0))
 
     @classmethod
     def from_dict(cls, d):
         self = TestConfig()
         self.command = d['command']
         self.arguments = list(d['arguments'].lstrip("['").rstrip("']").split("', '"))
+        self.shards = 1
+        self.shard_size = 0
         return self
 
     def command_line(self):
@@ -59,13 +66,17 @@ class RunConfig:
             # Tests
             self.tests = []
             for test in conf['tests']:
+                if 'shard_size' in conf and 'shard_size' not in test:
+                    test = dict(test, shard_size=conf['shard_size'])
                 self.tests.append(TestConfig(test))
-            # Thread
-            if 'threads' in conf:
+            # Thread, one validation per core by default
+            if 'threads' in conf and int(conf['threads']) > 0:
                 self.thread = int(conf['threads'])
-                assert self.thread > 0
             else:
-                self.thread = multiprocessing.cpu_count() / 2
+                self.thread = multiprocessing.cpu_count()
+            # Reuse the results of the tests already validated with the same
+            # QBDI commit and the same binary
+            self.reuse_results = bool(conf.get('reuse_results', True))
             # Validator path
             self.validator_path = conf['validator_path']
             # Database
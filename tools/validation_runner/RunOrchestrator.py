@@ -20,13 +20,22 @@ import time
 import multiprocessing
 import subprocess
 
-from TestResult import TestResult
-from RunResult import RunResult
+from TestResult import TestResult, binary_hash
+from RunResult import RunResult, get_git_revision
 
-def run_test(test, env, idx):
-    print('[{}] Validating {}'.format(idx, test.command_line()))
+def run_test(test, env, idx, shard=None):
+    if shard is None:
+        print('[{}] Validating {}'.format(idx, test.command_line()))
+        coverage_file = '.{}_coverage'.format(idx)
+    else:
+        print('[{}] Validating shard {} of {}'.format(idx, shard, test.command_line()))
+        coverage_file = '.{}_{}_coverage'.format(idx, shard)
+        # Instructions validated by the shard
+        env['VALIDATOR_CHECKPOINT_START'] = str(shard * test.shard_size)
+        if shard < test.shards - 1:
+            env['VALIDATOR_CHECKPOINT_END'] = str((shard + 1) * test.shard_size)
     # Setup files
-    coverage_file = '.{}_coverage'.format(idx)
+    error = False
     error = False
 
     env['VALIDATOR_COVERAGE'] = coverage_file
@@ -50,6 +59,8 @@ def run_test(test, env, idx):
         coverage = ""
 
     test_result = TestResult(test, retcode, result, coverage, error)
+    if shard is not None:
+        return test_result
 
     if test_result.retcode == 0:
         print('[{}] Validated {}'.format(idx, test.command_line()))
@@ -59,19 +70,59 @@ def run_test(test, env, idx):
     return test_result
 
 class RunOrchestrator:
-    def __init__(self, run_cfg):
+    def __init__(self, run_cfg, db=None):
         self.run_cfg = run_cfg
+        self.db = db
+
+    def find_cached_results(self):
+        # Results of the tests already validated with the current commit. A
+        # modified tree isn't the commit of the results, nothing is reused.
+        cached = {}
+        if self.db is None or not self.run_cfg.reuse_results:
+            return cached
+        _, commit, clean = get_git_revision()
+        if not clean:
+            print('[+] Modified tree, all the tests are validated')
+            return cached
+        for idx, test in enumerate(self.run_cfg.tests):
+            h = binary_hash(test.command)
+            if h == 'UNKNOWN':
+                continue
+            test_result = self.db.find_test_result(commit, test, h)
+            if test_result is not None:
+                print('[{}] Reuse the result of {}'.format(idx, test.command_line()))
+                cached[idx] = test_result
+        return cached
 
     def run(self):
         pool = multiprocessing.Pool(processes=self.run_cfg.thread)
         tests = self.run_cfg.tests
+        cached = self.find_cached_results()
         async_res = []
-        # Schedule validation on multiple process
+        # Schedule validation on multiple process, a sharded test is split
+        # in shards validated concurrently
         for idx in range(len(tests)):
+            if idx in cached:
+                async_res.append(None)
+                continue
             env = dict(os.environ, LD_PRELOAD=self.run_cfg.validator_path, VALIDATOR_VERBOSITY='Detail', LD_BIND_NOW='1')
-            async_res.append(pool.apply_async(run_test, (tests[idx], env, idx)))
+            if tests[idx].shards > 1 and tests[idx].shard_size > 0:
+                async_res.append([pool.apply_async(run_test, (tests[idx], dict(env), idx, shard))
+                                  for shard in range(tests[idx].shards)])
+            else:
+                async_res.append(pool.apply_async(run_test, (tests[idx], env, idx)))
         test_results = []
         for idx in range(len(tests)):
-            test_results.append(async_res[idx].get())
+            if async_res[idx] is None:
+                test_results.append(cached[idx])
+            elif isinstance(async_res[idx], list):
+                test_result = TestResult.merge(tests[idx], [r.get() for r in async_res[idx]])
+                if test_result.retcode == 0:
+                    print('[{}] Validated {}'.format(idx, tests[idx].command_line()))
+                else:
+                    print('[{}] Failed validation {}'.format(idx, tests[idx].command_line()))
+                test_results.append(test_result)
+            else:
+                test_results.append(async_res[idx].get())
         run_result = RunResult(test_results)
         return run_result
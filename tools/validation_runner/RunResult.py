@@ -19,6 +19,18 @@ import subprocess
 from operator import itemgetter
 from TestResult import scan_for_pattern, coverage_to_log
 
+def get_git_revision():
+    # Return the branch, the commit and if the tracked files are unmodified
+    try:
+        out = subprocess.check_output(['git', 'status', '-b', '-uno', '--porcelain=2'], universal_newlines=True)
+    except Exception as e:
+        print('[!] git command error : {}'.format(e))
+        return 'UNKNOWN', 'UNKNOWN', False
+    commit = scan_for_pattern(out, '# branch.oid ([0-9a-fA-F]+)')[0]
+    branch = scan_for_pattern(out, '# branch.head (\S+)')[0]
+    clean = all(line.startswith('#') for line in out.splitlines())
+    return branch, commit, clean
+
 class RunResult:
     def __init__(self, test_results=None):
         if test_results == None:
@@ -151,15 +163,7 @@ class RunResult:
 
 
     def get_branch_commit(self):
-        try:
-            out = subprocess.check_output(['git', 'status', '-b', '-uno', '--porcelain=2'], universal_newlines=True)
-        except Exception as e:
-            print('[!] git command error : {}'.format(e))
-            self.commit = 'UNKNOWN'
-            self.branch = 'UNKNOWN'
-        else:
-            self.commit = scan_for_pattern(out, '# branch.oid ([0-9a-fA-F]+)')[0]
-            self.branch = scan_for_pattern(out, '# branch.head (\S+)')[0]
+        self.branch, self.commit, _ = get_git_revision()
 
     def write_to_db(self, db):
         run_id = db.insert_run_result(self)
@@ -135,6 +135,21 @@ class SQLiteDBAdapter:
         self.connection.commit()
         return run_id
 
+    def find_test_result(self, commit, test_cfg, binary_hash):
+        # Last result of a test validated with a commit and a binary
+        cursor = self.connection.cursor()
+        cursor.execute('''select Tests.* from Tests join Runs on Tests.run_id = Runs.run_id
+                          where Runs."commit"=? and Tests.command=? and Tests.arguments=?
+                          and Tests.binary_hash=? order by Runs.timestamp desc;''',
+                       (commit, test_cfg.command, str(test_cfg.arguments), binary_hash))
+        row = cursor.fetchone()
+        if row == None:
+            return None
+        test_result = TestResult.from_dict({k: row[k] for k in row.keys()})
+        test_result.cfg = test_cfg
+        test_result.exec_error = False
+        return test_result
+
     def get_last_run(self, branch):
         cursor = self.connection.cursor()
         # Find run result
@@ -37,6 +37,16 @@ def scan_for_multipattern(data, pattern):
         r[m.groups()[0]] = r.get(m.groups()[0], 0) + 1
     return r
 
+def binary_hash(command):
+    for path in os.environ["PATH"].split(os.pathsep):
+        realpath = os.path.join(path.strip('"'), command)
+        if os.path.isfile(realpath):
+            h = hashlib.sha256()
+            with open(realpath, 'rb') as f:
+                h.update(f.read())
+            return h.hexdigest()
+    return 'UNKNOWN'
+
 def coverage_to_log(coverage):
     coverage = list(coverage)
     coverage.sort(key=itemgetter(1), reverse=True)
@@ -110,6 +120,38 @@ class TestResult:
             self.coverage_log = ""
             self.memaccess_unique_log = ""
 
+    @classmethod
+    def merge(cls, cfg, results):
+        # Merge the results of the shards of a test, in the order of the
+        # execution
+        self = TestResult()
+        self.cfg = cfg
+        self.exec_error = any(r.exec_error for r in results)
+        self.binary_hash = results[0].binary_hash
+        self.retcode = 0
+        for r in results:
+            if r.retcode != 0:
+                self.retcode = r.retcode
+                break
+        for attr in ['total_instr', 'diff_map', 'errors', 'no_impact_err', 'non_critical_err',
+                     'critical_err', 'cascades', 'no_impact_casc', 'non_critical_casc',
+                     'critical_casc', 'memaccess_error']:
+            setattr(self, attr, sum(getattr(r, attr) for r in results))
+        self.coverage = {}
+        self.memaccess_unique = {}
+        for r in results:
+            for inst, count in r.coverage.items():
+                self.coverage[inst] = self.coverage.get(inst, 0) + count
+            for inst, count in r.memaccess_unique.items():
+                self.memaccess_unique[inst] = self.memaccess_unique.get(inst, 0) + count
+        self.unique_instr = len(self.coverage)
+        self.memaccess_unique_error = len(self.memaccess_unique)
+        self.memaccess_log = ''.join(r.memaccess_log for r in results)
+        self.cascades_log = ''.join(r.cascades_log for r in results)
+        self.coverage_log = coverage_to_log(self.coverage.items())
+        self.memaccess_unique_log = coverage_to_log(self.memaccess_unique.items())
+        return self
+
     @classmethod
     def from_dict(cls, d):
         self = TestResult()
@@ -148,11 +190,4 @@ class TestResult:
         return self
 
     def get_binary_hash(self):
-        for path in os.environ["PATH"].split(os.pathsep):
-            realpath = os.path.join(path.strip('"'), self.cfg.command)
-            if os.path.isfile(realpath):
-                h = hashlib.sha256()
-                with open(realpath, 'rb') as f:
-                    h.update(f.read())
-                return h.hexdigest()
-        return 'UNKNOWN'
+        return binary_hash(self.cfg.command)
@@ -28,7 +28,7 @@ if __name__ == '__main__':
         sys.exit(1)
     run_cfg = RunConfig(sys.argv[1])
     db  = SQLiteDBAdapter(run_cfg.database)
-    orchestrator = RunOrchestrator(run_cfg)
+    orchestrator = RunOrchestrator(run_cfg, db)
     run_result = orchestrator.run()
     run_result.print_stats()
     reg = run_result.compartive_analysis(db)
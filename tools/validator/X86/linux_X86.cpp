@@ -16,7 +16,7 @@
  * limitations under the License.
  */
 
-#include "linux_X86.h"
+#include "linux_process.h"
 #include <stdlib.h>
 #include <sys/ptrace.h>
 #include "validator.h"
@@ -62,6 +62,10 @@ void userToFPRState(const FPR_STRUCT *user, QBDI::FPRState *fprState) {
 }
 
 void LinuxProcess::getProcessGPR(QBDI::GPRState *gprState) {
+  if (this->gpr_cache_valid) {
+    userToGPRState(&this->gpr_cache, gprState);
+    return;
+  }
   GPR_STRUCT user;
   if (ptrace(PTRACE_GETREGS, this->pid, NULL, &user) == -1) {
     QBDI_ERROR("Failed to get GPR state: {}", strerror(errno));
@@ -23,7 +23,6 @@
 #include <QBDI.h>
 #include <sys/ptrace.h>
 #include <sys/user.h>
-#include "linux_process.h"
 
 #define SIGBRK SIGTRAP
 static const long BRK_MASK = 0xFF;
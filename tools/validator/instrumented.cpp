@@ -19,10 +19,13 @@
 #include <errno.h>
 #include <inttypes.h>
 #include <set>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <unordered_set>
 
 #include "instrumented.h"
 #include "pipes.h"
@@ -37,12 +40,63 @@ struct Pipes {
   FILE *dataPipe;
 };
 
+// Window of the validated instructions of a shard (VALIDATOR_CHECKPOINT_START
+// and VALIDATOR_CHECKPOINT_END). The debugged process is synchronized on the
+// first execution of an address, a shard begins at the first instruction
+// never executed before its start index and ends at the first one after its
+// end index. The next shard begins at the same instruction.
+struct ShardWindow {
+  bool enabled = false;
+  bool reporting = true;
+  bool ended = false;
+  uint64_t start = 0;
+  uint64_t end = UINT64_MAX;
+  uint64_t count = 0;
+  std::unordered_set<QBDI::rword> executed;
+};
+
+static ShardWindow SHARD;
+
+// Number of instruction events sent before a synchronization with the master
+// (VALIDATOR_BATCH)
+static unsigned BATCH_SIZE = 64;
+static unsigned BATCH_COUNT = 0;
+
+// Return true if the instruction must be reported to the master
+static bool shardStep(QBDI::rword address, FILE *dataPipe) {
+  ShardWindow &cp = SHARD;
+  if (not cp.enabled) {
+    return true;
+  }
+  uint64_t index = cp.count++;
+  bool firstExecution = cp.executed.insert(address).second;
+  if (not cp.reporting) {
+    if (index < cp.start or not firstExecution) {
+      return false;
+    }
+    cp.reporting = true;
+    writeCheckpointEvent(index, dataPipe);
+  } else if (index >= cp.end and firstExecution) {
+    cp.reporting = false;
+    cp.ended = true;
+    writeEvent(EVENT::EXIT, dataPipe);
+    fflush(dataPipe);
+    return false;
+  }
+  return true;
+}
+
 static QBDI::VMAction step(QBDI::VMInstanceRef vm, QBDI::GPRState *gprState,
                            QBDI::FPRState *fprState, void *data) {
   COMMAND cmd;
   SAVED_ERRNO = errno;
   Pipes *pipes = (Pipes *)data;
 
+  if (not shardStep(QBDI_GPR_GET(gprState, QBDI::REG_PC), pipes->dataPipe)) {
+    errno = SAVED_ERRNO;
+    return SHARD.ended ? QBDI::VMAction::STOP : QBDI::VMAction::CONTINUE;
+  }
+
   const QBDI::InstAnalysis *instAnalysis = vm->getInstAnalysis(
       QBDI::ANALYSIS_INSTRUCTION | QBDI::ANALYSIS_DISASSEMBLY);
   // Write a new instruction event
@@ -53,6 +107,24 @@ static QBDI::VMAction step(QBDI::VMInstanceRef vm, QBDI::GPRState *gprState,
     QBDI_ERROR("Lost the data pipe, exiting!");
     return QBDI::VMAction::STOP;
   }
+  // The events are buffered until the end of the batch. They are also sent
+  // before a syscall, which may block the process
+  bool syscall = strncmp(instAnalysis->mnemonic, "SYSCALL", 7) == 0 or
+                 strncmp(instAnalysis->mnemonic, "SYSENTER", 8) == 0 or
+                 strncmp(instAnalysis->mnemonic, "INT", 3) == 0;
+  if (++BATCH_COUNT < BATCH_SIZE) {
+    if (syscall) {
+      fflush(pipes->dataPipe);
+    }
+    errno = SAVED_ERRNO;
+    return QBDI::VMAction::CONTINUE;
+  }
+  BATCH_COUNT = 0;
+  if (writeEvent(EVENT::SYNC, pipes->dataPipe) != 1 or
+      fflush(pipes->dataPipe) != 0) {
+    QBDI_ERROR("Lost the data pipe, exiting!");
+    return QBDI::VMAction::STOP;
+  }
   // Read next command
   if (readCommand(&cmd, pipes->ctrlPipe) != 1) {
     // CTRL pipe failure, we exit
@@ -76,6 +148,9 @@ static QBDI::VMAction step(QBDI::VMInstanceRef vm, QBDI::GPRState *gprState,
 static QBDI::VMAction verifyMemoryAccess(QBDI::VMInstanceRef vm,
                                          QBDI::GPRState *gprState,
                                          QBDI::FPRState *fprState, void *data) {
+  if (not SHARD.reporting) {
+    return QBDI::VMAction::CONTINUE;
+  }
   SAVED_ERRNO = errno;
   Pipes *pipes = (Pipes *)data;
 
@@ -197,6 +272,9 @@ static QBDI::VMAction verifyMemoryAccess(QBDI::VMInstanceRef vm,
 static QBDI::VMAction logSyscall(QBDI::VMInstanceRef vm,
                                  QBDI::GPRState *gprState,
                                  QBDI::FPRState *fprState, void *data) {
+  if (not SHARD.reporting) {
+    return QBDI::VMAction::CONTINUE;
+  }
   Pipes *pipes = (Pipes *)data;
   // We don't have the address, it just need to be different from 0
   writeExecTransferEvent(1, pipes->dataPipe);
@@ -208,6 +286,9 @@ static QBDI::VMAction logTransfer(QBDI::VMInstanceRef vm,
                                   const QBDI::VMState *state,
                                   QBDI::GPRState *gprState,
                                   QBDI::FPRState *fprState, void *data) {
+  if (not SHARD.reporting) {
+    return QBDI::VMAction::CONTINUE;
+  }
   Pipes *pipes = (Pipes *)data;
   writeExecTransferEvent(state->basicBlockStart, pipes->dataPipe);
   return QBDI::VMAction::CONTINUE;
@@ -235,7 +316,9 @@ QBDI::VM *VM;
 void cleanup_instrumentation() {
   static bool cleaned_up = false;
   if (cleaned_up == false) {
-    writeEvent(EVENT::EXIT, PIPES.dataPipe);
+    if (not SHARD.ended) {
+      writeEvent(EVENT::EXIT, PIPES.dataPipe);
+    }
     fclose(PIPES.ctrlPipe);
     fclose(PIPES.dataPipe);
     delete VM;
@@ -260,6 +343,22 @@ void start_instrumented(QBDI::VM *vm, QBDI::rword start, QBDI::rword stop,
     return;
   }
 
+  const char *env = getenv("VALIDATOR_CHECKPOINT_START");
+  if (env != nullptr) {
+    SHARD.enabled = true;
+    SHARD.start = strtoull(env, nullptr, 0);
+  }
+  env = getenv("VALIDATOR_CHECKPOINT_END");
+  if (env != nullptr) {
+    SHARD.enabled = true;
+    SHARD.end = strtoull(env, nullptr, 0);
+  }
+  SHARD.reporting = not SHARD.enabled;
+  env = getenv("VALIDATOR_BATCH");
+  if (env != nullptr and atoi(env) > 0) {
+    BATCH_SIZE = atoi(env);
+  }
+
   vm->addCodeCB(QBDI::PREINST, step, (void *)&PIPES);
 #if defined(QBDI_ARCH_X86_64) || defined(QBDI_ARCH_X86) || \
     defined(QBDI_ARCH_AARCH64)
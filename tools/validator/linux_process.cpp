@@ -45,6 +45,7 @@ void LinuxProcess::unsetBreakpoint() {
 }
 
 void LinuxProcess::continueExecution() {
+  this->gpr_cache_valid = false;
   ptrace(PTRACE_CONT, this->pid, NULL, NULL);
 }
 
@@ -53,10 +54,12 @@ int LinuxProcess::waitForStatus() {
   waitpid(this->pid, &status, 0);
 #if defined(QBDI_ARCH_X86_64) || defined(QBDI_ARCH_X86)
   if (WSTOPSIG(status) == SIGBRK) {
-    GPR_STRUCT user;
-    ptrace(PTRACE_GETREGS, this->pid, NULL, &user);
-    fix_GPR_STRUCT(&user);
-    ptrace(PTRACE_SETREGS, this->pid, NULL, &user);
+    GPR_STRUCT *user = &this->gpr_cache;
+    if (ptrace(PTRACE_GETREGS, this->pid, NULL, user) != -1) {
+      fix_GPR_STRUCT(user);
+      ptrace(PTRACE_SETREGS, this->pid, NULL, user);
+      this->gpr_cache_valid = true;
+    }
   }
 #endif
   return status;
@@ -36,10 +36,15 @@ private:
   pid_t pid;
   void *brk_address;
   long brk_value;
+  // GPR fetched by waitForStatus on a breakpoint, valid until the process
+  // continues
+  GPR_STRUCT gpr_cache;
+  bool gpr_cache_valid;
 
 public:
   LinuxProcess(pid_t process)
-      : pid(process), brk_address(nullptr), brk_value(0) {}
+      : pid(process), brk_address(nullptr), brk_value(0),
+        gpr_cache_valid(false) {}
 
   pid_t getPID() { return pid; }
 
@@ -81,6 +81,17 @@ void start_master(Process *debugged, pid_t instrumented, int ctrlfd,
     if (event == EVENT::EXIT) {
       debugged->continueExecution();
       break;
+    } else if (event == EVENT::CHECKPOINT) {
+      // The debugged process reaches the first instruction of the shard at
+      // its next breakpoint, the instruction has never been executed before
+      uint64_t index;
+      if (readCheckpointEvent(&index, dataPipe) != 1) {
+        QBDI_ERROR("Lost the data pipe, exiting!");
+        debugged->continueExecution();
+        error = VALIDATOR_ERR_DATA_PIPE_LOST;
+        break;
+      }
+      validator.signalCheckpoint(index);
     } else if (event == EVENT::EXEC_TRANSFER) {
       QBDI::rword transferAddress;
       if (readExecTransferEvent(&transferAddress, dataPipe) != 1) {
@@ -90,13 +101,15 @@ void start_master(Process *debugged, pid_t instrumented, int ctrlfd,
         break;
       }
       validator.signalExecTransfer(transferAddress);
-    } else if (event == EVENT::INSTRUCTION) {
+    } else if (event == EVENT::SYNC) {
+      // end of a batch of events, the instrumented process waits for it
       if (writeCommand(COMMAND::CONTINUE, ctrlPipe) != 1) {
         QBDI_ERROR("Lost the control pipe, exiting!");
         debugged->continueExecution();
         error = VALIDATOR_ERR_CTRL_PIPE_LOST;
         break;
       }
+    } else if (event == EVENT::INSTRUCTION) {
       if (readInstructionEvent(&address, mnemonic, BUFFER_SIZE, disassembly,
                                BUFFER_SIZE, &gprStateInstr, &fprStateInstr,
                                dataPipe) != 1) {
@@ -129,9 +142,11 @@ void start_master(Process *debugged, pid_t instrumented, int ctrlfd,
           break;
         }
         debugged->getProcessGPR(&gprStateDbg);
-        debugged->getProcessFPR(&fprStateDbg);
       } while (QBDI_GPR_GET(&gprStateDbg, QBDI::REG_PC) !=
                QBDI_GPR_GET(&gprStateInstr, QBDI::REG_PC));
+      if (running) {
+        debugged->getProcessFPR(&fprStateDbg);
+      }
       validator.signalNewState(address, mnemonic, disassembly, &gprStateDbg,
                                &fprStateDbg, &gprStateInstr, &fprStateInstr);
       if (running) {
@@ -86,7 +86,7 @@ int writeInstructionEvent(QBDI::rword address, const char *mnemonic,
   if (fwrite((void *)fprState, sizeof(QBDI::FPRState), 1, pipe) != 1) {
     return 0;
   }
-  fflush(pipe);
+  // buffered, the instrumented process flushes the pipe at the end of a batch
   return 1;
 }
 
@@ -175,6 +175,24 @@ int writeExecTransferEvent(QBDI::rword address, FILE *pipe) {
   return 1;
 }
 
+int readCheckpointEvent(uint64_t *index, FILE *pipe) {
+  if (fread((void *)index, sizeof(uint64_t), 1, pipe) != 1) {
+    return 0;
+  }
+  return 1;
+}
+
+int writeCheckpointEvent(uint64_t index, FILE *pipe) {
+  if (writeEvent(EVENT::CHECKPOINT, pipe) != 1) {
+    return 0;
+  }
+  if (fwrite((void *)&index, sizeof(uint64_t), 1, pipe) != 1) {
+    return 0;
+  }
+  fflush(pipe);
+  return 1;
+}
+
 int readEvent(EVENT *event, FILE *pipe) {
   if (fread((void *)event, sizeof(EVENT), 1, pipe) != 1) {
     return 0;
@@ -186,7 +204,6 @@ int writeEvent(EVENT event, FILE *pipe) {
   if (fwrite((void *)&event, sizeof(EVENT), 1, pipe) != 1) {
     return 0;
   }
-  fflush(pipe);
   return 1;
 }
 
@@ -27,6 +27,8 @@ enum EVENT {
   MISSMATCHMEMACCESS,
   EXEC_TRANSFER,
   EXIT,
+  CHECKPOINT,
+  SYNC,
 };
 
 enum COMMAND {
@@ -61,6 +63,10 @@ int readExecTransferEvent(QBDI::rword *address, FILE *pipe);
 
 int writeExecTransferEvent(QBDI::rword address, FILE *pipe);
 
+int readCheckpointEvent(uint64_t *index, FILE *pipe);
+
+int writeCheckpointEvent(uint64_t index, FILE *pipe);
+
 int readEvent(EVENT *event, FILE *pipe);
 
 int writeEvent(EVENT event, FILE *pipe);
@@ -341,6 +341,11 @@ void ValidatorEngine::signalCriticalState() {
   }
 }
 
+void ValidatorEngine::signalCheckpoint(uint64_t index) {
+  execID = index;
+  firstExecID = index;
+}
+
 void ValidatorEngine::flushLastLog() {
   if (lastLogEntry != nullptr) {
     if (verbosity == LogVerbosity::Full) {
@@ -370,7 +375,11 @@ void ValidatorEngine::logCascades() {
     size_t criticalCount = 0;
     fprintf(stderr, "Stats\n");
     fprintf(stderr, "=====\n\n");
-    fprintf(stderr, "Executed %" PRIu64 " total instructions\n", execID);
+    if (firstExecID != 0) {
+      fprintf(stderr, "Started at instruction %" PRIu64 "\n", firstExecID);
+    }
+    fprintf(stderr, "Executed %" PRIu64 " total instructions\n",
+            execID - firstExecID);
     fprintf(stderr, "Executed %zu unique instructions\n", coverage.size());
     fprintf(stderr, "Encountered %zu difference mappings\n", diffMaps.size());
     fprintf(stderr, "Encountered %" PRIu64 " memoryAccess errors\n",
@@ -111,6 +111,8 @@ class ValidatorEngine {
   QBDI::rword instrumented;
   LogVerbosity verbosity;
   uint64_t execID;
+  // index of the first validated instruction of a shard
+  uint64_t firstExecID;
   uint64_t accessError;
 
   ssize_t logEntryLookup(uint64_t execID);
@@ -137,7 +139,7 @@ public:
   ValidatorEngine(pid_t debugged, pid_t instrumented, LogVerbosity verbosity)
       : lastLogEntry(nullptr), curLogEntry(nullptr), debugged(debugged),
         instrumented(instrumented), verbosity(verbosity), execID(0),
-        accessError(0) {}
+        firstExecID(0), accessError(0) {}
 
   void signalNewState(QBDI::rword address, const char *mnemonic,
                       const char *disassembly,
@@ -154,6 +156,8 @@ public:
 
   void signalCriticalState();
 
+  void signalCheckpoint(uint64_t index);
+
   void flushLastLog();
 
   void logCascades();